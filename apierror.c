@@ -54,6 +54,10 @@ const char *janus_get_api_error(int error) {
 			return "Wrong WebRTC state";
 		case JANUS_ERROR_NOT_ACCEPTING_SESSIONS:
 			return "Currently not accepting new sessions";
+		case JANUS_ERROR_SERVER_BUSY:
+			return "Server busy";
+		case JANUS_ERROR_OVERLOADED:
+			return "Server overloaded";
 		default:
 			return "Unknown error";
 	}
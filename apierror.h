@@ -66,6 +66,10 @@
 #define JANUS_ERROR_WEBRTC_STATE				471
 /*! \brief The server is currently configured not to accept new sessions */
 #define JANUS_ERROR_NOT_ACCEPTING_SESSIONS		472
+/*! \brief The server is too busy to handle the request right now */
+#define JANUS_ERROR_SERVER_BUSY					473
+/*! \brief The server is overloaded, and is not accepting new sessions or handles for the time being */
+#define JANUS_ERROR_OVERLOADED					474
 
 
 /*! \brief Helper method to get a string representation of an API error code
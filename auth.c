@@ -21,6 +21,13 @@
  * application and Janus is necessary. Instead, the application signs
  * tokens that Janus can verify using the secret key.
  *
+ * Since tokens are checked for each request, lookups are optimized for
+ * reading: stored tokens are protected by a read-write lock, so that
+ * requests never wait for each other, and signed tokens are only parsed
+ * and verified the first time we see them, after which they're cached
+ * (with their expiry) until they expire, which means that checking the
+ * token of, e.g., a keepalive is just a lookup in a hash table.
+ *
  * \ingroup core
  * \ref core
  */
@@ -30,19 +37,42 @@
 
 #include "auth.h"
 #include "debug.h"
-#include "mutex.h"
 #include "utils.h"
 
 /* Hash table to contain the tokens to match */
 static GHashTable *tokens = NULL, *allowed_plugins = NULL;
 static gboolean auth_enabled = FALSE;
-static janus_mutex mutex;
+static GRWLock tokens_lock;
 static char *auth_secret = NULL;
 
 static void janus_auth_free_token(char *token) {
 	g_free(token);
 }
 
+/* Signed tokens we already verified, and how many we keep at most */
+#define JANUS_AUTH_SIGNED_CACHE_SIZE	8192
+typedef struct janus_auth_signed_token {
+	/* Expiry time (in seconds), realm and descriptors, as found in the token */
+	gint64 expiry;
+	gchar **data;
+} janus_auth_signed_token;
+static GHashTable *signed_tokens = NULL;
+static GRWLock signed_tokens_lock;
+
+static void janus_auth_signed_token_free(janus_auth_signed_token *st) {
+	g_strfreev(st->data);
+	g_free(st);
+}
+/* Tokens are compared in constant time, so that cache lookups don't leak anything about valid ones */
+static gboolean janus_auth_signed_token_equal(gconstpointer a, gconstpointer b) {
+	const unsigned char *t1 = (const unsigned char *)a, *t2 = (const unsigned char *)b;
+	size_t len1 = strlen((const char *)t1), len2 = strlen((const char *)t2), i = 0;
+	unsigned char result = (len1 != len2);
+	for(i=0; i<len1 && i<len2; i++)
+		result |= t1[i] ^ t2[i];
+	return result == 0;
+}
+
 /* Setup */
 void janus_auth_init(gboolean enabled, const char *secret) {
 	if(enabled) {
@@ -54,12 +84,15 @@ void janus_auth_init(gboolean enabled, const char *secret) {
 		} else {
 			JANUS_LOG(LOG_INFO, "Signed-Token based authentication enabled\n");
 			auth_secret = g_strdup(secret);
+			signed_tokens = g_hash_table_new_full(g_str_hash, janus_auth_signed_token_equal,
+				(GDestroyNotify)g_free, (GDestroyNotify)janus_auth_signed_token_free);
 			auth_enabled = TRUE;
 		}
 	} else {
 		JANUS_LOG(LOG_WARN, "Token based authentication disabled\n");
 	}
-	janus_mutex_init(&mutex);
+	g_rw_lock_init(&tokens_lock);
+	g_rw_lock_init(&signed_tokens_lock);
 }
 
 gboolean janus_auth_is_enabled(void) {
@@ -71,37 +104,37 @@ gboolean janus_auth_is_stored_mode(void) {
 }
 
 void janus_auth_deinit(void) {
-	janus_mutex_lock(&mutex);
+	g_rw_lock_writer_lock(&tokens_lock);
 	if(tokens != NULL)
 		g_hash_table_destroy(tokens);
 	tokens = NULL;
 	if(allowed_plugins != NULL)
 		g_hash_table_destroy(allowed_plugins);
 	allowed_plugins = NULL;
+	g_rw_lock_writer_unlock(&tokens_lock);
+	g_rw_lock_writer_lock(&signed_tokens_lock);
+	if(signed_tokens != NULL)
+		g_hash_table_destroy(signed_tokens);
+	signed_tokens = NULL;
 	g_free(auth_secret);
 	auth_secret = NULL;
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_writer_unlock(&signed_tokens_lock);
 }
 
-gboolean janus_auth_check_signature(const char *token, const char *realm) {
-	if (!auth_enabled || auth_secret == NULL)
-		return FALSE;
+/* Parse and verify a signed token: the realm and descriptors are checked by the callers */
+static janus_auth_signed_token *janus_auth_signed_token_parse(const char *token, gint64 now) {
 	gchar **parts = g_strsplit(token, ":", 2);
 	gchar **data = NULL;
 	/* Token should have exactly one data and one hash part */
 	if(!parts[0] || !parts[1] || parts[2])
 		goto fail;
-	data = g_strsplit(parts[0], ",", 3);
+	data = g_strsplit(parts[0], ",", 0);
 	/* Need at least an expiry timestamp and realm */
 	if(!data[0] || !data[1])
 		goto fail;
 	/* Verify timestamp */
 	gint64 expiry_time = strtoll(data[0], NULL, 10);
-	gint64 real_time = janus_get_real_time() / 1000000;
-	if(expiry_time < 0 || real_time > expiry_time)
-		goto fail;
-	/* Verify realm */
-	if(strcmp(data[1], realm))
+	if(expiry_time < 0 || now > expiry_time)
 		goto fail;
 	/* Verify HMAC-SHA1 */
 	unsigned char signature[EVP_MAX_MD_SIZE];
@@ -109,63 +142,94 @@ gboolean janus_auth_check_signature(const char *token, const char *realm) {
 	HMAC(EVP_sha1(), auth_secret, strlen(auth_secret), (const unsigned char*)parts[0], strlen(parts[0]), signature, &len);
 	gchar *base64 = g_base64_encode(signature, len);
 	gboolean result = janus_strcmp_const_time(parts[1], base64);
-	g_strfreev(data);
-	g_strfreev(parts);
 	g_free(base64);
-	return result;
+	if(!result)
+		goto fail;
+	g_strfreev(parts);
+	janus_auth_signed_token *st = g_malloc(sizeof(janus_auth_signed_token));
+	st->expiry = expiry_time;
+	st->data = data;
+	return st;
 
 fail:
 	g_strfreev(data);
 	g_strfreev(parts);
-	return FALSE;
+	return NULL;
 }
 
-gboolean janus_auth_check_signature_contains(const char *token, const char *realm, const char *desc) {
-	if (!auth_enabled || auth_secret == NULL)
+/* Check a signed token, using the cache of those we verified already */
+static gboolean janus_auth_signed_token_check(const char *token, const char *realm, const char *desc) {
+	if(!auth_enabled || auth_secret == NULL || token == NULL || realm == NULL)
 		return FALSE;
-	gchar **parts = g_strsplit(token, ":", 2);
-	gchar **data = NULL;
-	/* Token should have exactly one data and one hash part */
-	if(!parts[0] || !parts[1] || parts[2])
-		goto fail;
-	data = g_strsplit(parts[0], ",", 0);
-	/* Need at least an expiry timestamp and realm */
-	if(!data[0] || !data[1])
-		goto fail;
-	/* Verify timestamp */
-	gint64 expiry_time = strtoll(data[0], NULL, 10);
-	gint64 real_time = janus_get_real_time() / 1000000;
-	if(expiry_time < 0 || real_time > expiry_time)
-		goto fail;
-	/* Verify realm */
-	if(strcmp(data[1], realm))
-		goto fail;
-	/* Find descriptor */
-	gboolean result = FALSE;
-	int i = 2;
-	for(i = 2; data[i]; i++) {
-		if (!strcmp(desc, data[i])) {
-			result = TRUE;
-			break;
+	gint64 now = janus_get_real_time() / 1000000;
+	gboolean found = FALSE, result = FALSE;
+	g_rw_lock_reader_lock(&signed_tokens_lock);
+	janus_auth_signed_token *st = signed_tokens ? g_hash_table_lookup(signed_tokens, token) : NULL;
+	if(st != NULL) {
+		found = TRUE;
+		result = (now <= st->expiry && !strcmp(st->data[1], realm));
+		if(result && desc != NULL) {
+			/* Find descriptor */
+			result = FALSE;
+			int i = 2;
+			for(i = 2; st->data[i]; i++) {
+				if(!strcmp(desc, st->data[i])) {
+					result = TRUE;
+					break;
+				}
+			}
 		}
 	}
-	if (!result)
-		goto fail;
-	/* Verify HMAC-SHA1 */
-	unsigned char signature[EVP_MAX_MD_SIZE];
-	unsigned int len;
-	HMAC(EVP_sha1(), auth_secret, strlen(auth_secret), (const unsigned char*)parts[0], strlen(parts[0]), signature, &len);
-	gchar *base64 = g_base64_encode(signature, len);
-	result = janus_strcmp_const_time(parts[1], base64);
-	g_strfreev(data);
-	g_strfreev(parts);
-	g_free(base64);
+	g_rw_lock_reader_unlock(&signed_tokens_lock);
+	if(found)
+		return result;
+	/* First time we see this token, verify the signature */
+	st = janus_auth_signed_token_parse(token, now);
+	if(st == NULL)
+		return FALSE;
+	result = !strcmp(st->data[1], realm);
+	if(result && desc != NULL) {
+		result = FALSE;
+		int i = 2;
+		for(i = 2; st->data[i]; i++) {
+			if(!strcmp(desc, st->data[i])) {
+				result = TRUE;
+				break;
+			}
+		}
+	}
+	g_rw_lock_writer_lock(&signed_tokens_lock);
+	if(signed_tokens != NULL) {
+		if(g_hash_table_size(signed_tokens) >= JANUS_AUTH_SIGNED_CACHE_SIZE) {
+			/* Get rid of the tokens that expired, or of all of them if that's not enough */
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, signed_tokens);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_auth_signed_token *cached = value;
+				if(now > cached->expiry)
+					g_hash_table_iter_remove(&iter);
+			}
+			if(g_hash_table_size(signed_tokens) >= JANUS_AUTH_SIGNED_CACHE_SIZE)
+				g_hash_table_remove_all(signed_tokens);
+		}
+		g_hash_table_insert(signed_tokens, g_strdup(token), st);
+		st = NULL;
+	}
+	g_rw_lock_writer_unlock(&signed_tokens_lock);
+	if(st != NULL)
+		janus_auth_signed_token_free(st);
 	return result;
+}
 
-fail:
-	g_strfreev(data);
-	g_strfreev(parts);
-	return FALSE;
+gboolean janus_auth_check_signature(const char *token, const char *realm) {
+	return janus_auth_signed_token_check(token, realm, NULL);
+}
+
+gboolean janus_auth_check_signature_contains(const char *token, const char *realm, const char *desc) {
+	if(desc == NULL)
+		return FALSE;
+	return janus_auth_signed_token_check(token, realm, desc);
 }
 
 /* Tokens manipulation */
@@ -176,15 +240,15 @@ gboolean janus_auth_add_token(const char *token) {
 	}
 	if(token == NULL)
 		return FALSE;
-	janus_mutex_lock(&mutex);
+	g_rw_lock_writer_lock(&tokens_lock);
 	if(g_hash_table_lookup(tokens, token)) {
 		JANUS_LOG(LOG_VERB, "Token already validated\n");
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_writer_unlock(&tokens_lock);
 		return TRUE;
 	}
 	char *new_token = g_strdup(token);
 	g_hash_table_insert(tokens, new_token, new_token);
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_writer_unlock(&tokens_lock);
 	return TRUE;
 }
 
@@ -194,12 +258,12 @@ gboolean janus_auth_check_token(const char *token) {
 		return TRUE;
 	if (tokens == NULL)
 		return janus_auth_check_signature(token, "janus");
-	janus_mutex_lock(&mutex);
+	g_rw_lock_reader_lock(&tokens_lock);
 	if(token && g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_reader_unlock(&tokens_lock);
 		return TRUE;
 	}
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_reader_unlock(&tokens_lock);
 	return FALSE;
 }
 
@@ -207,7 +271,7 @@ GList *janus_auth_list_tokens(void) {
 	/* Always NULL if the mechanism is disabled, of course */
 	if(!auth_enabled || tokens == NULL)
 		return NULL;
-	janus_mutex_lock(&mutex);
+	g_rw_lock_reader_lock(&tokens_lock);
 	GList *list = NULL;
 	if(g_hash_table_size(tokens) > 0) {
 		GHashTableIter iter;
@@ -218,7 +282,7 @@ GList *janus_auth_list_tokens(void) {
 			list = g_list_append(list, g_strdup(token));
 		}
 	}
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_reader_unlock(&tokens_lock);
 	return list;
 }
 
@@ -227,7 +291,7 @@ gboolean janus_auth_remove_token(const char *token) {
 		JANUS_LOG(LOG_ERR, "Can't remove token, stored-authentication mechanism is disabled\n");
 		return FALSE;
 	}
-	janus_mutex_lock(&mutex);
+	g_rw_lock_writer_lock(&tokens_lock);
 	gboolean ok = token && g_hash_table_remove(tokens, token);
 	/* Also clear the allowed plugins mapping */
 	GList *list = g_hash_table_lookup(allowed_plugins, token);
@@ -235,7 +299,7 @@ gboolean janus_auth_remove_token(const char *token) {
 	if(list != NULL)
 		g_list_free(list);
 	/* Done */
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_writer_unlock(&tokens_lock);
 	return ok;
 }
 
@@ -247,9 +311,9 @@ gboolean janus_auth_allow_plugin(const char *token, janus_plugin *plugin) {
 	}
 	if(token == NULL || plugin == NULL)
 		return FALSE;
-	janus_mutex_lock(&mutex);
+	g_rw_lock_writer_lock(&tokens_lock);
 	if(!g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_writer_unlock(&tokens_lock);
 		return FALSE;
 	}
 	GList *list = g_hash_table_lookup(allowed_plugins, token);
@@ -258,19 +322,19 @@ gboolean janus_auth_allow_plugin(const char *token, janus_plugin *plugin) {
 		list = g_list_append(list, plugin);
 		char *new_token = g_strdup(token);
 		g_hash_table_insert(allowed_plugins, new_token, list);
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_writer_unlock(&tokens_lock);
 		return TRUE;
 	}
 	/* We already have a list, update it if needed */
 	if(g_list_find(list, plugin) != NULL) {
 		JANUS_LOG(LOG_VERB, "Plugin access already allowed for token\n");
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_writer_unlock(&tokens_lock);
 		return TRUE;
 	}
 	list = g_list_append(list, plugin);
 	char *new_token = g_strdup(token);
 	g_hash_table_insert(allowed_plugins, new_token, list);
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_writer_unlock(&tokens_lock);
 	return TRUE;
 }
 
@@ -280,17 +344,17 @@ gboolean janus_auth_check_plugin(const char *token, janus_plugin *plugin) {
 		return TRUE;
 	if (allowed_plugins == NULL)
 		return janus_auth_check_signature_contains(token, "janus", plugin->get_package());
-	janus_mutex_lock(&mutex);
+	g_rw_lock_reader_lock(&tokens_lock);
 	if(!g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_reader_unlock(&tokens_lock);
 		return FALSE;
 	}
 	GList *list = g_hash_table_lookup(allowed_plugins, token);
 	if(g_list_find(list, plugin) == NULL) {
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_reader_unlock(&tokens_lock);
 		return FALSE;
 	}
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_reader_unlock(&tokens_lock);
 	return TRUE;
 }
 
@@ -298,16 +362,16 @@ GList *janus_auth_list_plugins(const char *token) {
 	/* Always NULL if the mechanism is disabled, of course */
 	if(!auth_enabled || allowed_plugins == NULL)
 		return NULL;
-	janus_mutex_lock(&mutex);
+	g_rw_lock_reader_lock(&tokens_lock);
 	if(!g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_reader_unlock(&tokens_lock);
 		return FALSE;
 	}
 	GList *list = NULL;
 	GList *plugins_list = g_hash_table_lookup(allowed_plugins, token);
 	if(plugins_list != NULL)
 		list = g_list_copy(plugins_list);
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_reader_unlock(&tokens_lock);
 	return list;
 }
 
@@ -316,9 +380,9 @@ gboolean janus_auth_disallow_plugin(const char *token, janus_plugin *plugin) {
 		JANUS_LOG(LOG_ERR, "Can't disallow access to plugin, authentication mechanism is disabled\n");
 		return FALSE;
 	}
-	janus_mutex_lock(&mutex);
+	g_rw_lock_writer_lock(&tokens_lock);
 	if(!g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		g_rw_lock_writer_unlock(&tokens_lock);
 		return FALSE;
 	}
 	GList *list = g_hash_table_lookup(allowed_plugins, token);
@@ -328,6 +392,6 @@ gboolean janus_auth_disallow_plugin(const char *token, janus_plugin *plugin) {
 		char *new_token = g_strdup(token);
 		g_hash_table_insert(allowed_plugins, new_token, list);
 	}
-	janus_mutex_unlock(&mutex);
+	g_rw_lock_writer_unlock(&tokens_lock);
 	return TRUE;
 }
@@ -34,6 +34,7 @@ gboolean janus_auth_is_stored_mode(void);
 void janus_auth_deinit(void);
 
 /*! \brief Method to check whether a signed token is valid
+ * \note Signatures are only verified the first time a token is seen, and cached until it expires
  * @param[in] token The token to validate
  * @param[in] realm The token realm
  * @returns TRUE if the signature is valid and not expired, FALSE otherwise */
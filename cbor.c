@@ -0,0 +1,399 @@
+/*! \file    cbor.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    CBOR encoding of Janus API messages
+ * \details  Implementation of a minimal CBOR (RFC 8949) codec that maps
+ * CBOR items directly to and from Jansson objects, so that transports
+ * can offer CBOR as an alternative encoding of the Janus API without
+ * having to go through a JSON text representation.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "cbor.h"
+
+/* CBOR major types */
+#define JANUS_CBOR_UINT		0
+#define JANUS_CBOR_NEGINT	1
+#define JANUS_CBOR_BYTES	2
+#define JANUS_CBOR_TEXT		3
+#define JANUS_CBOR_ARRAY	4
+#define JANUS_CBOR_MAP		5
+#define JANUS_CBOR_TAG		6
+#define JANUS_CBOR_SIMPLE	7
+/* Additional information for indefinite lengths, and the break code */
+#define JANUS_CBOR_INDEFINITE	31
+#define JANUS_CBOR_BREAK		0xFF
+
+
+/* Decoder */
+typedef struct janus_cbor_decoder {
+	const uint8_t *data;
+	size_t len, pos;
+	json_error_t *error;
+} janus_cbor_decoder;
+
+static void janus_cbor_error(janus_cbor_decoder *dec, const char *text) {
+	if(dec->error == NULL)
+		return;
+	dec->error->line = -1;
+	dec->error->column = -1;
+	dec->error->position = (int)dec->pos;
+	g_strlcpy(dec->error->source, "<cbor>", JSON_ERROR_SOURCE_LENGTH);
+	g_strlcpy(dec->error->text, text, JSON_ERROR_TEXT_LENGTH);
+}
+
+/* Parse the initial byte of an item and its argument, if any */
+static int janus_cbor_read_head(janus_cbor_decoder *dec, uint8_t *major, uint8_t *info, uint64_t *value) {
+	if(dec->pos >= dec->len) {
+		janus_cbor_error(dec, "Unexpected end of data");
+		return -1;
+	}
+	uint8_t byte = dec->data[dec->pos++];
+	*major = byte >> 5;
+	*info = byte & 0x1F;
+	*value = 0;
+	int bytes = 0;
+	if(*info < 24) {
+		*value = *info;
+		return 0;
+	} else if(*info == 24) {
+		bytes = 1;
+	} else if(*info == 25) {
+		bytes = 2;
+	} else if(*info == 26) {
+		bytes = 4;
+	} else if(*info == 27) {
+		bytes = 8;
+	} else if(*info == JANUS_CBOR_INDEFINITE) {
+		if(*major == JANUS_CBOR_UINT || *major == JANUS_CBOR_NEGINT || *major == JANUS_CBOR_TAG) {
+			janus_cbor_error(dec, "Invalid indefinite length");
+			return -1;
+		}
+		return 0;
+	} else {
+		janus_cbor_error(dec, "Reserved additional information");
+		return -1;
+	}
+	if(dec->len - dec->pos < (size_t)bytes) {
+		janus_cbor_error(dec, "Unexpected end of data");
+		return -1;
+	}
+	int i = 0;
+	for(i=0; i<bytes; i++)
+		*value = (*value << 8) | dec->data[dec->pos++];
+	return 0;
+}
+
+/* Half precision floats, as per Appendix D of RFC 8949 */
+static double janus_cbor_half_to_double(uint16_t half) {
+	int exp = (half >> 10) & 0x1F;
+	int mant = half & 0x3FF;
+	double val = 0;
+	if(exp == 0)
+		val = ldexp(mant, -24);
+	else if(exp != 31)
+		val = ldexp(mant + 1024, exp - 25);
+	else
+		val = mant == 0 ? INFINITY : NAN;
+	return (half & 0x8000) ? -val : val;
+}
+
+static json_t *janus_cbor_decode_item(janus_cbor_decoder *dec, int depth);
+
+/* Text strings can be split in chunks, when their length is indefinite */
+static json_t *janus_cbor_decode_text(janus_cbor_decoder *dec, uint8_t info, uint64_t value) {
+	GString *text = NULL;
+	if(info != JANUS_CBOR_INDEFINITE) {
+		if(value > dec->len - dec->pos) {
+			janus_cbor_error(dec, "Text string longer than the data");
+			return NULL;
+		}
+		text = g_string_new_len((const char *)dec->data + dec->pos, (gssize)value);
+		dec->pos += value;
+	} else {
+		text = g_string_new(NULL);
+		while(TRUE) {
+			if(dec->pos >= dec->len) {
+				janus_cbor_error(dec, "Unexpected end of data");
+				g_string_free(text, TRUE);
+				return NULL;
+			}
+			if(dec->data[dec->pos] == JANUS_CBOR_BREAK) {
+				dec->pos++;
+				break;
+			}
+			uint8_t cmajor = 0, cinfo = 0;
+			uint64_t clen = 0;
+			if(janus_cbor_read_head(dec, &cmajor, &cinfo, &clen) < 0) {
+				g_string_free(text, TRUE);
+				return NULL;
+			}
+			if(cmajor != JANUS_CBOR_TEXT || cinfo == JANUS_CBOR_INDEFINITE || clen > dec->len - dec->pos) {
+				janus_cbor_error(dec, "Invalid text string chunk");
+				g_string_free(text, TRUE);
+				return NULL;
+			}
+			g_string_append_len(text, (const char *)dec->data + dec->pos, (gssize)clen);
+			dec->pos += clen;
+		}
+	}
+	/* Jansson strings can't contain zeros, and must be valid UTF-8 */
+	json_t *string = NULL;
+	if(strlen(text->str) == text->len)
+		string = json_string(text->str);
+	g_string_free(text, TRUE);
+	if(string == NULL)
+		janus_cbor_error(dec, "Invalid text string");
+	return string;
+}
+
+/* Check if we reached the end of an indefinite length array or map */
+static int janus_cbor_check_break(janus_cbor_decoder *dec) {
+	if(dec->pos >= dec->len) {
+		janus_cbor_error(dec, "Unexpected end of data");
+		return -1;
+	}
+	if(dec->data[dec->pos] == JANUS_CBOR_BREAK) {
+		dec->pos++;
+		return 1;
+	}
+	return 0;
+}
+
+static json_t *janus_cbor_decode_item(janus_cbor_decoder *dec, int depth) {
+	uint8_t major = 0, info = 0;
+	uint64_t value = 0;
+	if(janus_cbor_read_head(dec, &major, &info, &value) < 0)
+		return NULL;
+	switch(major) {
+		case JANUS_CBOR_UINT:
+			if(value > (uint64_t)INT64_MAX)
+				return json_real((double)value);
+			return json_integer((json_int_t)value);
+		case JANUS_CBOR_NEGINT:
+			if(value > (uint64_t)INT64_MAX)
+				return json_real(-1.0 - (double)value);
+			return json_integer(-1 - (json_int_t)value);
+		case JANUS_CBOR_BYTES:
+			janus_cbor_error(dec, "Byte strings are not supported");
+			return NULL;
+		case JANUS_CBOR_TEXT:
+			return janus_cbor_decode_text(dec, info, value);
+		case JANUS_CBOR_ARRAY:
+		case JANUS_CBOR_MAP: {
+			if(depth >= JANUS_CBOR_MAX_DEPTH) {
+				janus_cbor_error(dec, "Too many nesting levels");
+				return NULL;
+			}
+			gboolean indefinite = (info == JANUS_CBOR_INDEFINITE);
+			/* Each element takes at least a byte (two for map entries) */
+			if(!indefinite && value > (dec->len - dec->pos) / (major == JANUS_CBOR_MAP ? 2 : 1)) {
+				janus_cbor_error(dec, "More elements than the data can contain");
+				return NULL;
+			}
+			json_t *container = (major == JANUS_CBOR_MAP) ? json_object() : json_array();
+			uint64_t i = 0;
+			while(indefinite || i < value) {
+				if(indefinite) {
+					int res = janus_cbor_check_break(dec);
+					if(res < 0) {
+						json_decref(container);
+						return NULL;
+					} else if(res > 0) {
+						break;
+					}
+				}
+				json_t *key = NULL;
+				if(major == JANUS_CBOR_MAP) {
+					key = janus_cbor_decode_item(dec, depth+1);
+					if(key == NULL || !json_is_string(key)) {
+						if(key != NULL)
+							janus_cbor_error(dec, "Map keys must be text strings");
+						json_decref(key);
+						json_decref(container);
+						return NULL;
+					}
+				}
+				json_t *item = janus_cbor_decode_item(dec, depth+1);
+				if(item == NULL) {
+					json_decref(key);
+					json_decref(container);
+					return NULL;
+				}
+				if(key != NULL) {
+					json_object_set_new(container, json_string_value(key), item);
+					json_decref(key);
+				} else {
+					json_array_append_new(container, item);
+				}
+				i++;
+			}
+			return container;
+		}
+		case JANUS_CBOR_TAG:
+			/* We don't care about the semantics of tags, just decode the item */
+			return janus_cbor_decode_item(dec, depth+1);
+		case JANUS_CBOR_SIMPLE:
+		default:
+			if(info == 20)
+				return json_false();
+			if(info == 21)
+				return json_true();
+			if(info == 22 || info == 23)
+				return json_null();
+			if(info >= 25 && info <= 27) {
+				double d = 0;
+				if(info == 25) {
+					d = janus_cbor_half_to_double((uint16_t)value);
+				} else if(info == 26) {
+					uint32_t bits = (uint32_t)value;
+					float f = 0;
+					memcpy(&f, &bits, sizeof(f));
+					d = f;
+				} else {
+					memcpy(&d, &value, sizeof(d));
+				}
+				/* JSON has no NaN or infinity */
+				json_t *real = json_real(d);
+				if(real == NULL)
+					janus_cbor_error(dec, "Invalid float");
+				return real;
+			}
+			janus_cbor_error(dec, info == JANUS_CBOR_INDEFINITE ? "Unexpected break" : "Unsupported simple value");
+			return NULL;
+	}
+	return NULL;
+}
+
+json_t *janus_cbor_decode(const uint8_t *data, size_t len, json_error_t *error) {
+	janus_cbor_decoder dec = { .data = data, .len = len, .pos = 0, .error = error };
+	if(data == NULL || len == 0) {
+		janus_cbor_error(&dec, "No data");
+		return NULL;
+	}
+	json_t *json = janus_cbor_decode_item(&dec, 0);
+	if(json != NULL && dec.pos < dec.len) {
+		janus_cbor_error(&dec, "Trailing data after the item");
+		json_decref(json);
+		return NULL;
+	}
+	return json;
+}
+
+
+/* Encoder */
+static void janus_cbor_write_head(GByteArray *buf, uint8_t major, uint64_t value) {
+	uint8_t head[9];
+	int bytes = 0;
+	if(value < 24) {
+		head[0] = (major << 5) | (uint8_t)value;
+	} else if(value <= 0xFF) {
+		head[0] = (major << 5) | 24;
+		bytes = 1;
+	} else if(value <= 0xFFFF) {
+		head[0] = (major << 5) | 25;
+		bytes = 2;
+	} else if(value <= 0xFFFFFFFF) {
+		head[0] = (major << 5) | 26;
+		bytes = 4;
+	} else {
+		head[0] = (major << 5) | 27;
+		bytes = 8;
+	}
+	int i = 0;
+	for(i=0; i<bytes; i++)
+		head[1+i] = (uint8_t)(value >> (8*(bytes-1-i)));
+	g_byte_array_append(buf, head, 1+bytes);
+}
+
+static void janus_cbor_write_text(GByteArray *buf, const char *text) {
+	size_t len = strlen(text);
+	janus_cbor_write_head(buf, JANUS_CBOR_TEXT, len);
+	g_byte_array_append(buf, (const guint8 *)text, len);
+}
+
+static int janus_cbor_encode_item(GByteArray *buf, json_t *json) {
+	switch(json_typeof(json)) {
+		case JSON_OBJECT: {
+			janus_cbor_write_head(buf, JANUS_CBOR_MAP, json_object_size(json));
+			const char *key = NULL;
+			json_t *value = NULL;
+			json_object_foreach(json, key, value) {
+				janus_cbor_write_text(buf, key);
+				if(janus_cbor_encode_item(buf, value) < 0)
+					return -1;
+			}
+			return 0;
+		}
+		case JSON_ARRAY: {
+			janus_cbor_write_head(buf, JANUS_CBOR_ARRAY, json_array_size(json));
+			size_t i = 0;
+			for(i=0; i<json_array_size(json); i++) {
+				if(janus_cbor_encode_item(buf, json_array_get(json, i)) < 0)
+					return -1;
+			}
+			return 0;
+		}
+		case JSON_STRING:
+			janus_cbor_write_text(buf, json_string_value(json));
+			return 0;
+		case JSON_INTEGER: {
+			json_int_t value = json_integer_value(json);
+			if(value >= 0)
+				janus_cbor_write_head(buf, JANUS_CBOR_UINT, (uint64_t)value);
+			else
+				janus_cbor_write_head(buf, JANUS_CBOR_NEGINT, (uint64_t)(-1 - value));
+			return 0;
+		}
+		case JSON_REAL: {
+			/* We always use double precision floats */
+			double d = json_real_value(json);
+			uint64_t bits = 0;
+			memcpy(&bits, &d, sizeof(bits));
+			uint8_t real[9];
+			real[0] = (JANUS_CBOR_SIMPLE << 5) | 27;
+			int i = 0;
+			for(i=0; i<8; i++)
+				real[1+i] = (uint8_t)(bits >> (8*(7-i)));
+			g_byte_array_append(buf, real, sizeof(real));
+			return 0;
+		}
+		case JSON_TRUE: {
+			uint8_t b = (JANUS_CBOR_SIMPLE << 5) | 21;
+			g_byte_array_append(buf, &b, 1);
+			return 0;
+		}
+		case JSON_FALSE: {
+			uint8_t b = (JANUS_CBOR_SIMPLE << 5) | 20;
+			g_byte_array_append(buf, &b, 1);
+			return 0;
+		}
+		case JSON_NULL: {
+			uint8_t b = (JANUS_CBOR_SIMPLE << 5) | 22;
+			g_byte_array_append(buf, &b, 1);
+			return 0;
+		}
+		default:
+			break;
+	}
+	return -1;
+}
+
+uint8_t *janus_cbor_encode(json_t *json, size_t *len) {
+	if(json == NULL || len == NULL)
+		return NULL;
+	GByteArray *buf = g_byte_array_sized_new(256);
+	if(janus_cbor_encode_item(buf, json) < 0) {
+		g_byte_array_free(buf, TRUE);
+		*len = 0;
+		return NULL;
+	}
+	*len = buf->len;
+	return g_byte_array_free(buf, FALSE);
+}
@@ -0,0 +1,43 @@
+/*! \file    cbor.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    CBOR encoding of Janus API messages (headers)
+ * \details  Implementation of a minimal CBOR (RFC 8949) codec that maps
+ * CBOR items directly to and from Jansson objects, so that transports
+ * can offer CBOR as an alternative encoding of the Janus API without
+ * having to go through a JSON text representation. Only the subset of
+ * CBOR that has a JSON equivalent is supported: integers, floats, text
+ * strings, arrays, maps with text keys, booleans and null. Tags are
+ * ignored (the tagged item is decoded as is), while byte strings and
+ * other simple values are rejected.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_CBOR_H
+#define JANUS_CBOR_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Maximum nesting level of arrays and maps we accept when decoding */
+#define JANUS_CBOR_MAX_DEPTH	64
+
+/*! \brief Helper to decode a CBOR item to a Jansson object
+ * @note Trailing data after the first item is considered an error
+ * @param[in] data The buffer containing the CBOR item
+ * @param[in] len The size of the buffer
+ * @param[out] error Where to write details about the error, if any (can be NULL);
+ * the position field is the offset in the buffer where parsing failed
+ * @returns A new json_t object, or NULL in case of errors */
+json_t *janus_cbor_decode(const uint8_t *data, size_t len, json_error_t *error);
+
+/*! \brief Helper to encode a Jansson object as a CBOR item
+ * @note Object properties are encoded in the order Jansson iterates them
+ * @param[in] json The json_t object to encode
+ * @param[out] len The size of the encoded item
+ * @returns A buffer with the encoded item, to be freed with g_free, or NULL in case of errors */
+uint8_t *janus_cbor_encode(json_t *json, size_t *len);
+
+#endif
@@ -3,6 +3,12 @@
  * \copyright GNU General Public License v3
  * \brief    Configuration files parsing
  * \details  Implementation of a parser of INI and libconfig configuration files.
+ * Lookups walk the lists of elements, unless a category (or the root) has
+ * many of them, in which case an index by name is created and kept up to
+ * date. The journal is a text file with a JSON object per line, each one
+ * either the full content of a top level category or its removal: since
+ * replaying an entry only replaces or removes a category, replaying a
+ * journal that was already folded into the file does no harm.
  *
  * \ingroup core
  * \ref core
@@ -14,13 +20,23 @@
 #include <ctype.h>
 #include <errno.h>
 #include <libgen.h>
+#include <unistd.h>
 
 #include <libconfig.h>
+#include <jansson.h>
 
 #include "config.h"
 #include "debug.h"
 #include "utils.h"
 
+/* Lists longer than this get an index for lookups by name */
+#define JANUS_CONFIG_INDEX_THRESHOLD	32
+/* The journal is folded back into the file when it has this many entries... */
+#define JANUS_CONFIG_JOURNAL_MAX_ENTRIES	1000
+/* ... or when it's this old (in seconds), whichever comes first */
+#define JANUS_CONFIG_JOURNAL_MAX_AGE	300
+
+static void janus_config_journal_replay(janus_config *config, const char *config_file);
 
 /* Filename helper */
 static char *get_filename(char *path) {
@@ -306,6 +322,8 @@ janus_config *janus_config_parse(const char *config_file) {
 done:
 	g_free(tmp_filename);
 	fclose(file);
+	/* Apply the changes that were journaled since the file was saved, if any */
+	janus_config_journal_replay(jc, config_file);
 	return jc;
 
 error:
@@ -363,10 +381,32 @@ void janus_config_container_destroy(janus_config_container *container) {
 			g_free((gpointer)container->value);
 		if(container->list)
 			g_list_free_full(container->list, (GDestroyNotify)janus_config_container_destroy);
+		if(container->index)
+			g_hash_table_destroy(container->index);
 		g_free(container);
 	}
 }
 
+/* Indexes by name: arrays can contain elements with the same name, where
+ * the first one wins, so we only index the root and categories */
+static GHashTable **janus_config_index_get(janus_config *config, janus_config_container *parent) {
+	if(parent == NULL)
+		return &config->index;
+	return parent->type == janus_config_type_category ? &parent->index : NULL;
+}
+static void janus_config_index_add(GHashTable *index, janus_config_container *c) {
+	if(index != NULL && c != NULL && c->name != NULL)
+		g_hash_table_insert(index, g_ascii_strdown(c->name, -1), c);
+}
+static void janus_config_index_remove(GHashTable *index, janus_config_container *c) {
+	if(index == NULL || c == NULL || c->name == NULL)
+		return;
+	char *key = g_ascii_strdown(c->name, -1);
+	if(g_hash_table_lookup(index, key) == c)
+		g_hash_table_remove(index, key);
+	g_free(key);
+}
+
 static janus_config_container *janus_config_get_internal(janus_config *config,
 		janus_config_container *parent, janus_config_type type, const char *name, gboolean create) {
 	if(config == NULL || name == NULL)
@@ -375,12 +415,32 @@ static janus_config_container *janus_config_get_internal(janus_config *config,
 		return NULL;
 	janus_config_container *c = NULL;
 	GList *l = parent ? parent->list : config->list;
+	GHashTable **index = janus_config_index_get(config, parent);
+	if(index != NULL && *index != NULL) {
+		char *key = g_ascii_strdown(name, -1);
+		c = g_hash_table_lookup(*index, key);
+		g_free(key);
+		if(c && (type == janus_config_type_any || c->type == type))
+			return c;
+		l = NULL;
+	}
+	guint walked = 0;
 	while(l) {
 		c = (janus_config_container *)l->data;
 		if(c && c->name && !strcasecmp(name, c->name) &&
 				(type == janus_config_type_any || c->type == type))
 			return c;
 		l = l->next;
+		walked++;
+	}
+	if(index != NULL && *index == NULL && walked > JANUS_CONFIG_INDEX_THRESHOLD) {
+		/* This is getting large, index it for the next lookups */
+		*index = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+		l = parent ? parent->list : config->list;
+		while(l) {
+			janus_config_index_add(*index, (janus_config_container *)l->data);
+			l = l->next;
+		}
 	}
 	/* If we got here, it doesn't exist, should we create it? */
 	c = NULL;
@@ -460,6 +520,9 @@ int janus_config_add(janus_config *config, janus_config_container *container, ja
 		/* Add to root */
 		config->list = g_list_append(config->list, item);
 	}
+	GHashTable **index = janus_config_index_get(config, container);
+	if(index != NULL)
+		janus_config_index_add(*index, item);
 	return 0;
 }
 
@@ -471,6 +534,9 @@ int janus_config_remove(janus_config *config, janus_config_container *container,
 	janus_config_container *item = janus_config_get(config, container, janus_config_type_any, name);
 	if(item == NULL)
 		return -3;
+	GHashTable **index = janus_config_index_get(config, container);
+	if(index != NULL)
+		janus_config_index_remove(*index, item);
 	if(container) {
 		/* Remove from parent */
 		container->list = g_list_remove(container->list, item);
@@ -667,9 +733,13 @@ gboolean janus_config_save(janus_config *config, const char *folder, const char
 	} else {
 		g_snprintf(path, 1024, "%s.%s", filename, config->is_jcfg ? "jcfg" : "cfg");
 	}
-	file = fopen(path, "wt");
+	/* We write to a temporary file first, and then replace the old one with it,
+	 * so that a crash while saving can't leave us with a truncated file */
+	char tmp_path[1040];
+	g_snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	file = fopen(tmp_path, "wt");
 	if(file == NULL) {
-		JANUS_LOG(LOG_ERR, "Couldn't save configuration file, error opening file '%s'...\n", path);
+		JANUS_LOG(LOG_ERR, "Couldn't save configuration file, error opening file '%s'...\n", tmp_path);
 		if(config->is_jcfg)
 			config_destroy(&lcfg);
 		return -3;
@@ -694,9 +764,175 @@ gboolean janus_config_save(janus_config *config, const char *folder, const char
 	}
 	/* Done */
 	fclose(file);
+	if(rename(tmp_path, path) < 0) {
+		JANUS_LOG(LOG_ERR, "Couldn't save configuration file, error renaming '%s'... %d (%s)\n",
+			tmp_path, errno, strerror(errno));
+		unlink(tmp_path);
+		return -4;
+	}
+	/* Whatever was journaled is part of the file now */
+	char journal[1050];
+	g_snprintf(journal, sizeof(journal), "%s.journal", path);
+	if(unlink(journal) < 0 && errno != ENOENT) {
+		JANUS_LOG(LOG_WARN, "Couldn't remove configuration journal '%s'... %d (%s)\n",
+			journal, errno, strerror(errno));
+	}
+	config->journal_entries = 0;
+	config->journal_saved = janus_get_monotonic_time();
 	return 0;
 }
 
+/* Journal */
+static json_t *janus_config_journal_serialize(janus_config_container *c) {
+	json_t *elem = json_object();
+	if(c->name)
+		json_object_set_new(elem, "n", json_string(c->name));
+	if(c->type == janus_config_type_item) {
+		json_object_set_new(elem, "v", json_string(c->value ? c->value : ""));
+	} else {
+		json_t *list = json_array();
+		GList *l = c->list;
+		while(l) {
+			json_array_append_new(list, janus_config_journal_serialize((janus_config_container *)l->data));
+			l = l->next;
+		}
+		json_object_set_new(elem, c->type == janus_config_type_array ? "a" : "c", list);
+	}
+	return elem;
+}
+
+static janus_config_container *janus_config_journal_deserialize(janus_config *config, json_t *elem) {
+	if(!json_is_object(elem))
+		return NULL;
+	const char *name = json_string_value(json_object_get(elem, "n"));
+	json_t *value = json_object_get(elem, "v");
+	if(value != NULL)
+		return janus_config_item_create(name, json_string_value(value));
+	json_t *list = json_object_get(elem, "c");
+	janus_config_container *c = NULL;
+	if(list != NULL) {
+		c = janus_config_category_create(name);
+	} else {
+		list = json_object_get(elem, "a");
+		c = janus_config_array_create(name);
+	}
+	size_t i = 0;
+	json_t *child = NULL;
+	json_array_foreach(list, i, child) {
+		janus_config_container *cc = janus_config_journal_deserialize(config, child);
+		if(cc == NULL || janus_config_add(config, c, cc) < 0) {
+			janus_config_container_destroy(cc);
+			janus_config_container_destroy(c);
+			return NULL;
+		}
+	}
+	return c;
+}
+
+static void janus_config_journal_replay(janus_config *config, const char *config_file) {
+	char journal[1050];
+	g_snprintf(journal, sizeof(journal), "%s.journal", config_file);
+	FILE *file = fopen(journal, "rt");
+	if(file == NULL)
+		return;
+	int line_number = 0;
+	char line[BUFSIZ];
+	GString *entry = g_string_new(NULL);
+	while(fgets(line, sizeof(line), file)) {
+		/* Entries can be longer than our buffer */
+		g_string_append(entry, line);
+		if(entry->len == 0 || entry->str[entry->len-1] != '\n')
+			continue;
+		line_number++;
+		json_error_t error;
+		json_t *root = json_loads(entry->str, 0, &error);
+		g_string_truncate(entry, 0);
+		const char *name = root ? json_string_value(json_object_get(root, "remove")) : NULL;
+		json_t *elem = root ? json_object_get(root, "set") : NULL;
+		janus_config_container *c = elem ? janus_config_journal_deserialize(config, elem) : NULL;
+		if(name == NULL && (c == NULL || c->name == NULL)) {
+			JANUS_LOG(LOG_WARN, "Ignoring invalid entry at line %d of configuration journal '%s'\n", line_number, journal);
+			janus_config_container_destroy(c);
+			json_decref(root);
+			continue;
+		}
+		if(name != NULL) {
+			janus_config_remove(config, NULL, name);
+		} else if(janus_config_add(config, NULL, c) < 0) {
+			janus_config_container_destroy(c);
+		}
+		config->journal_entries++;
+		json_decref(root);
+	}
+	if(entry->len > 0) {
+		/* Probably a crash while writing the last entry */
+		JANUS_LOG(LOG_WARN, "Ignoring truncated entry at the end of configuration journal '%s'\n", journal);
+	}
+	g_string_free(entry, TRUE);
+	fclose(file);
+	if(config->journal_entries > 0) {
+		JANUS_LOG(LOG_VERB, "Replayed %u changes from configuration journal '%s'\n", config->journal_entries, journal);
+		config->journal_saved = janus_get_monotonic_time();
+	}
+}
+
+int janus_config_journal(janus_config *config, const char *folder, const char *filename, const char *name) {
+	if(config == NULL || filename == NULL || name == NULL)
+		return -1;
+	gint64 now = janus_get_monotonic_time();
+	if(config->journal_entries == 0)
+		config->journal_saved = now;
+	if(config->journal_entries >= JANUS_CONFIG_JOURNAL_MAX_ENTRIES ||
+			now - config->journal_saved >= (gint64)JANUS_CONFIG_JOURNAL_MAX_AGE*G_USEC_PER_SEC) {
+		/* Time to fold the journal back into the file: this already includes the change */
+		return janus_config_save(config, folder, filename);
+	}
+	char path[1024];
+	if(folder != NULL) {
+		if(janus_mkdir(folder, 0755) < 0) {
+			JANUS_LOG(LOG_ERR, "Couldn't save configuration journal, error creating folder '%s'...\n", folder);
+			return -2;
+		}
+		g_snprintf(path, sizeof(path), "%s/%s.%s.journal", folder, filename, config->is_jcfg ? "jcfg" : "cfg");
+	} else {
+		g_snprintf(path, sizeof(path), "%s.%s.journal", filename, config->is_jcfg ? "jcfg" : "cfg");
+	}
+	/* Prepare the entry: the category as it is now, or its removal */
+	json_t *root = json_object();
+	janus_config_container *c = janus_config_get(config, NULL, janus_config_type_any, name);
+	if(c != NULL)
+		json_object_set_new(root, "set", janus_config_journal_serialize(c));
+	else
+		json_object_set_new(root, "remove", json_string(name));
+	char *text = json_dumps(root, JSON_COMPACT | JSON_PRESERVE_ORDER);
+	json_decref(root);
+	if(text == NULL)
+		return -3;
+	FILE *file = fopen(path, "at");
+	if(file == NULL) {
+		JANUS_LOG(LOG_ERR, "Couldn't save configuration journal, error opening file '%s'...\n", path);
+		free(text);
+		return -4;
+	}
+	size_t len = strlen(text);
+	gboolean written = (fwrite(text, sizeof(char), len, file) == len && fwrite("\n", sizeof(char), 1, file) == 1);
+	free(text);
+	if(fclose(file) != 0 || !written) {
+		JANUS_LOG(LOG_ERR, "Couldn't save configuration journal, error writing file '%s'...\n", path);
+		return -5;
+	}
+	config->journal_entries++;
+	return 0;
+}
+
+int janus_config_compact(janus_config *config, const char *folder, const char *filename) {
+	if(config == NULL || filename == NULL)
+		return -1;
+	if(config->journal_entries == 0)
+		return 0;
+	return janus_config_save(config, folder, filename);
+}
+
 void janus_config_destroy(janus_config *config) {
 	if(config == NULL)
 		return;
@@ -704,6 +940,10 @@ void janus_config_destroy(janus_config *config) {
 		g_list_free_full(config->list, (GDestroyNotify)janus_config_container_destroy);
 		config->list = NULL;
 	}
+	if(config->index) {
+		g_hash_table_destroy(config->index);
+		config->index = NULL;
+	}
 	g_free((gpointer)config->name);
 	g_free((gpointer)config);
 	config = NULL;
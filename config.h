@@ -3,6 +3,11 @@
  * \copyright GNU General Public License v3
  * \brief    Configuration files parsing (headers)
  * \details  Implementation of a parser of INI and libconfig configuration files.
+ * Changes to top level categories can be persisted incrementally, by
+ * appending them to a journal next to the file (see janus_config_journal),
+ * rather than saving the whole configuration each time: the journal is
+ * replayed when the file is parsed, and folded back into it every now
+ * and then, or by calling janus_config_compact.
  *
  * \ingroup core
  * \ref core
@@ -35,6 +40,8 @@ typedef struct janus_config_container {
 	const char *value;
 	/*! \brief Linked list of contained items/categories/arrays (category and array only) */
 	GList *list;
+	/*! \brief Index of the contained elements by (lowercase) name, created when a category grows large */
+	GHashTable *index;
 } janus_config_container;
 
 /*! \brief Configuration item (defined for backwards compatibility) */
@@ -54,6 +61,12 @@ typedef struct janus_config {
 	const char *name;
 	/*! \brief Linked list of items/categories/arrays */
 	GList *list;
+	/*! \brief Index of the root elements by (lowercase) name, created when the root grows large */
+	GHashTable *index;
+	/*! \brief Number of changes appended to the journal since the file was last saved */
+	guint journal_entries;
+	/*! \brief Monotonic time of when the file was last saved (or the journal first written to) */
+	gint64 journal_saved;
 } janus_config;
 
 
@@ -81,6 +94,25 @@ void janus_config_print_as(janus_config *config, int level);
  * @param[in] filename The file name, extension included (should be .jcfg, or .cfg for legacy INI files)
  * @returns 0 if successful, a negative integer otherwise */
 int janus_config_save(janus_config *config, const char *folder, const char *filename);
+/*! \brief Helper method to persist the changes to a single top level category
+ * \note Rather than saving the whole configuration, this appends the current
+ * content of the category (or its removal, if it's not there anymore) to
+ * a journal next to the configuration file (e.g., \c janus.plugin.videoroom.jcfg.journal),
+ * which is replayed by janus_config_parse. When the journal has grown large,
+ * or hasn't been folded back in a while, this also saves the whole file (see janus_config_compact)
+ * @param[in] config The configuration the category belongs to
+ * @param[in] folder The folder the file is saved to
+ * @param[in] filename The file name, without extension (as in janus_config_save)
+ * @param[in] name The name of the category that was added, changed or removed
+ * @returns 0 if successful, a negative integer otherwise */
+int janus_config_journal(janus_config *config, const char *folder, const char *filename, const char *name);
+/*! \brief Helper method to save the whole configuration, and get rid of the journal, if any
+ * @note This does nothing if there's nothing in the journal
+ * @param[in] config The configuration to save
+ * @param[in] folder The folder the file is saved to
+ * @param[in] filename The file name, without extension (as in janus_config_save)
+ * @returns 0 if successful, a negative integer otherwise */
+int janus_config_compact(janus_config *config, const char *folder, const char *filename);
 /*! \brief Destroy a configuration container instance
  * @param[in] config The configuration to destroy */
 void janus_config_destroy(janus_config *config);
@@ -0,0 +1,624 @@
+/*! \file    core-bench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Micro-benchmarks for the core media helpers
+ * \details  Standalone tool that measures the helpers the core and plugins
+ * call for each packet or negotiation: RTCP parsing and generation, RTP
+ * header rewriting, RTP extensions, VP8/VP9 payload descriptors, SDP
+ * parsing and writing, and saving frames to a recording. One more checks
+ * the layout of janus_ice_stream, by reading the fields plugin threads
+ * read to relay a packet while another thread keeps updating those the
+ * loop of a handle updates for each packet it sends, as it happens when
+ * fanning out to many subscribers (this needs at least two cores to show
+ * any contention). Two more compare taking a reference to each of the
+ * objects a packet goes through when fanned out to 500 subscribers with
+ * borrowing them all under a single guard, while another thread does the
+ * same, as the loops of other publishers would. Another protects the same packet with the SRTP
+ * contexts of several PeerConnections, which is what the loops of the
+ * subscribers end up doing, together, when a packet is fanned out to
+ * them (for each of the key lengths and ciphers the core may negotiate,
+ * so that the libsrtp build in use can be compared). Whenever a
+ * helper processes existing data, it's fed all the samples in the
+ * \c fuzzers/corpora folder, so the inputs are the same as the fuzzers'.
+ * For each benchmark the time and number of heap allocations per call
+ * are printed, and a substring can be passed to only run some of them:
+ *
+\verbatim
+./core-bench -c fuzzers/corpora
+./core-bench -c fuzzers/corpora -n 1000 -b rtcp
+\endverbatim
+ *
+ * Allocations are counted by wrapping malloc, calloc and realloc, which
+ * is only done when building against glibc: GSlice is configured to
+ * always use malloc, so that the lists the helpers return are counted
+ * too. Since the numbers depend on the machine, they're mostly useful
+ * to compare different versions of the code on the same box.
+ *
+ * \ingroup tools
+ * \ref tools
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "debug.h"
+#include "rtcp.h"
+#include "rtp.h"
+#include "sdp-utils.h"
+#include "record.h"
+#include "utils.h"
+#include "ice.h"
+#include "refcount.h"
+
+int janus_log_level = LOG_NONE;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+int refcount_debug = 0;
+
+/* Heap allocations counter */
+static gboolean core_bench_counting = FALSE;
+static guint64 core_bench_allocs = 0;
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+	if(core_bench_counting)
+		core_bench_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	if(core_bench_counting)
+		core_bench_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	if(core_bench_counting)
+		core_bench_allocs++;
+	return __libc_realloc(ptr, size);
+}
+#define CORE_BENCH_ALLOCS	TRUE
+#else
+#define CORE_BENCH_ALLOCS	FALSE
+#endif
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* A sample from the fuzzers corpora, and its parsed version where needed */
+typedef struct core_bench_input {
+	char *data;
+	int len;
+	janus_sdp *sdp;
+} core_bench_input;
+
+/* Shared state, and a sink to keep the compiler from skipping calls */
+static janus_rtcp_context core_bench_rtcp_ctx;
+static janus_rtp_switching_context core_bench_rtp_ctx;
+static janus_recorder *core_bench_recorder = NULL;
+static GSList *core_bench_nacks = NULL;
+static char core_bench_buf[1500];
+static volatile int core_bench_sink = 0;
+
+/* Load all the samples in a folder of the corpora, recursively */
+static void core_bench_load(const char *folder, GPtrArray *inputs, gboolean sdp) {
+	GDir *dir = g_dir_open(folder, 0, NULL);
+	if(dir == NULL)
+		return;
+	const char *name = NULL;
+	while((name = g_dir_read_name(dir)) != NULL) {
+		if(name[0] == '.' || strstr(name, "LICENSE"))
+			continue;
+		char *path = g_build_filename(folder, name, NULL);
+		if(g_file_test(path, G_FILE_TEST_IS_DIR)) {
+			core_bench_load(path, inputs, sdp);
+			g_free(path);
+			continue;
+		}
+		gchar *contents = NULL;
+		gsize len = 0;
+		if(g_file_get_contents(path, &contents, &len, NULL) && len > 0) {
+			core_bench_input *input = g_malloc0(sizeof(core_bench_input));
+			input->data = contents;
+			input->len = len;
+			if(sdp) {
+				char error[512];
+				input->sdp = janus_sdp_parse(contents, error, sizeof(error));
+			}
+			g_ptr_array_add(inputs, input);
+		} else {
+			g_free(contents);
+		}
+		g_free(path);
+	}
+	g_dir_close(dir);
+}
+
+static void core_bench_input_free(gpointer data) {
+	core_bench_input *input = (core_bench_input *)data;
+	g_free(input->data);
+	if(input->sdp)
+		janus_sdp_destroy(input->sdp);
+	g_free(input);
+}
+
+/* RTCP */
+static void core_bench_rtcp_parse(core_bench_input *input) {
+	core_bench_sink += janus_rtcp_parse(&core_bench_rtcp_ctx, input->data, input->len);
+}
+
+static void core_bench_rtcp_fix_ssrc(core_bench_input *input) {
+	core_bench_sink += janus_rtcp_fix_ssrc(NULL, input->data, input->len, 1, 1234, 5678);
+}
+
+static void core_bench_rtcp_get_nacks(core_bench_input *input) {
+	GSList *nacks = janus_rtcp_get_nacks(input->data, input->len);
+	core_bench_sink += g_slist_length(nacks);
+	g_slist_free(nacks);
+}
+
+static void core_bench_rtcp_pli(core_bench_input *input) {
+	core_bench_sink += janus_rtcp_pli(core_bench_buf, 12);
+}
+
+static void core_bench_rtcp_fir(core_bench_input *input) {
+	static int seqnr = 0;
+	core_bench_sink += janus_rtcp_fir(core_bench_buf, 20, &seqnr);
+}
+
+static void core_bench_rtcp_remb(core_bench_input *input) {
+	core_bench_sink += janus_rtcp_remb(core_bench_buf, 24, 512000);
+}
+
+static void core_bench_rtcp_nacks(core_bench_input *input) {
+	core_bench_sink += janus_rtcp_nacks(core_bench_buf, 120, core_bench_nacks);
+}
+
+/* RTP */
+static void core_bench_rtp_header_update(core_bench_input *input) {
+	static uint16_t seq = 0;
+	static uint32_t timestamp = 0;
+	janus_rtp_header *header = (janus_rtp_header *)core_bench_buf;
+	header->version = 2;
+	header->type = 96;
+	header->ssrc = htonl(1234);
+	header->seq_number = htons(++seq);
+	timestamp += 3000;
+	header->timestamp = htonl(timestamp);
+	janus_rtp_header_update(header, &core_bench_rtp_ctx, TRUE, 0);
+	core_bench_sink += header->seq_number;
+}
+
+static void core_bench_rtp_extensions(core_bench_input *input) {
+	char sdes_item[16];
+	gboolean vad = FALSE;
+	int level = 0;
+	uint16_t transport_seq_num = 0;
+	core_bench_sink += janus_rtp_header_extension_parse_audio_level(input->data, input->len, 1, &vad, &level);
+	core_bench_sink += janus_rtp_header_extension_parse_mid(input->data, input->len, 4, sdes_item, sizeof(sdes_item));
+	core_bench_sink += janus_rtp_header_extension_parse_rid(input->data, input->len, 10, sdes_item, sizeof(sdes_item));
+	core_bench_sink += janus_rtp_header_extension_parse_transport_wide_cc(input->data, input->len, 3, &transport_seq_num);
+}
+
+static void core_bench_rtp_extensions_map(core_bench_input *input) {
+	char sdes_item[16];
+	gboolean vad = FALSE;
+	int level = 0;
+	uint16_t transport_seq_num = 0;
+	janus_rtp_header_extensions_map map;
+	if(janus_rtp_header_extensions_map_parse(input->data, input->len, &map) < 0)
+		return;
+	core_bench_sink += janus_rtp_header_extension_map_parse_audio_level(&map, input->data, input->len, 1, &vad, &level);
+	core_bench_sink += janus_rtp_header_extension_map_parse_mid(&map, input->data, input->len, 4, sdes_item, sizeof(sdes_item));
+	core_bench_sink += janus_rtp_header_extension_map_parse_rid(&map, input->data, input->len, 10, sdes_item, sizeof(sdes_item));
+	core_bench_sink += janus_rtp_header_extension_map_parse_transport_wide_cc(&map, input->data, input->len, 3, &transport_seq_num);
+}
+
+static void core_bench_vp8_parse_descriptor(core_bench_input *input) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(input->data, input->len, &plen);
+	if(payload == NULL)
+		return;
+	uint16_t picid = 0;
+	uint8_t tlzi = 0, tid = 0, ybit = 0, keyidx = 0;
+	core_bench_sink += janus_vp8_parse_descriptor(payload, plen, &picid, &tlzi, &tid, &ybit, &keyidx);
+}
+
+static void core_bench_vp9_parse_svc(core_bench_input *input) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(input->data, input->len, &plen);
+	if(payload == NULL)
+		return;
+	gboolean found = FALSE;
+	janus_vp9_svc_info info;
+	core_bench_sink += janus_vp9_parse_svc(payload, plen, &found, &info);
+}
+
+/* SDP */
+static void core_bench_sdp_parse(core_bench_input *input) {
+	char error[512];
+	janus_sdp *sdp = janus_sdp_parse(input->data, error, sizeof(error));
+	core_bench_sink += (sdp != NULL);
+	janus_sdp_destroy(sdp);
+}
+
+static void core_bench_sdp_write(core_bench_input *input) {
+	if(input->sdp == NULL)
+		return;
+	char *text = janus_sdp_write(input->sdp);
+	core_bench_sink += (text != NULL);
+	g_free(text);
+}
+
+/* Recordings */
+static void core_bench_recorder_save_frame(core_bench_input *input) {
+	core_bench_sink += janus_recorder_save_frame(core_bench_recorder, input->data, input->len);
+}
+
+/* Fields of a stream the relaying threads read, while a thread updates the
+ * ones the loop of the handle updates for each packet (see ice.h) */
+static janus_ice_stream core_bench_stream;
+static GThread *core_bench_stream_thread = NULL;
+static volatile gint core_bench_stream_stop = 0;
+static void *core_bench_stream_writer(void *data) {
+	janus_ice_stream *stream = &core_bench_stream;
+	while(!g_atomic_int_get(&core_bench_stream_stop)) {
+		stream->transport_wide_cc_out_seq_num++;
+		stream->transport_wide_cc_last_seq_num++;
+		stream->video_last_ntp_ts++;
+		stream->video_last_rtp_ts += 3000;
+	}
+	return NULL;
+}
+static void core_bench_stream_setup(void) {
+	memset(&core_bench_stream, 0, sizeof(core_bench_stream));
+	core_bench_stream.video_ssrc = 0x11111111;
+	core_bench_stream.video_ssrc_peer[0] = 0x22222222;
+	core_bench_stream.mid_ext_id = 1;
+	core_bench_stream.transport_wide_cc_ext_id = 2;
+	core_bench_stream.audiolevel_ext_id = 3;
+	core_bench_stream.videoorientation_ext_id = 4;
+	g_atomic_int_set(&core_bench_stream_stop, 0);
+	core_bench_stream_thread = g_thread_new("core-bench stream", core_bench_stream_writer, NULL);
+}
+static void core_bench_stream_teardown(void) {
+	g_atomic_int_set(&core_bench_stream_stop, 1);
+	g_thread_join(core_bench_stream_thread);
+	core_bench_stream_thread = NULL;
+}
+static void core_bench_stream_relay(core_bench_input *input) {
+	const volatile janus_ice_stream *stream = &core_bench_stream;
+	int i = 0;
+	for(i = 0; i < 1000; i++) {
+		core_bench_sink += stream->mid_ext_id + stream->transport_wide_cc_ext_id +
+			stream->audiolevel_ext_id + stream->videoorientation_ext_id +
+			(stream->video_ssrc ^ stream->video_ssrc_peer[0]);
+	}
+}
+
+/* Objects a packet goes through when fanned out to many subscribers, either
+ * referenced for each packet or borrowed via a guard (see refcount.h), while
+ * a thread does the same, as the loop of another publisher would */
+#define CORE_BENCH_FANOUT		500
+static janus_refcount core_bench_refs[CORE_BENCH_FANOUT];
+static janus_refcount_guard core_bench_guards[2];
+static GThread *core_bench_refcount_thread = NULL;
+static volatile gint core_bench_refcount_stop = 0;
+static void core_bench_refcount_noop(const janus_refcount *ref) {
+	/* We never get here, as counters never go below 1 */
+}
+static void *core_bench_refcount_other(void *data) {
+	gboolean guard = GPOINTER_TO_INT(data);
+	int i = 0;
+	while(!g_atomic_int_get(&core_bench_refcount_stop)) {
+		for(i = 0; i < CORE_BENCH_FANOUT; i++) {
+			if(guard) {
+				janus_refcount_guard_enter(&core_bench_guards[1]);
+				core_bench_sink += core_bench_refs[i].count;
+				janus_refcount_guard_leave(&core_bench_guards[1]);
+			} else {
+				janus_refcount_increase_nodebug(&core_bench_refs[i]);
+				janus_refcount_decrease_nodebug(&core_bench_refs[i]);
+			}
+		}
+	}
+	return NULL;
+}
+static void core_bench_refcount_start(gboolean guard) {
+	int i = 0;
+	for(i = 0; i < CORE_BENCH_FANOUT; i++)
+		janus_refcount_init_nodebug(&core_bench_refs[i], core_bench_refcount_noop);
+	memset(core_bench_guards, 0, sizeof(core_bench_guards));
+	g_atomic_int_set(&core_bench_refcount_stop, 0);
+	core_bench_refcount_thread = g_thread_new("core-bench refcount", core_bench_refcount_other, GINT_TO_POINTER(guard));
+}
+static void core_bench_refcount_setup(void) {
+	core_bench_refcount_start(FALSE);
+}
+static void core_bench_refcount_guard_setup(void) {
+	core_bench_refcount_start(TRUE);
+}
+static void core_bench_refcount_teardown(void) {
+	g_atomic_int_set(&core_bench_refcount_stop, 1);
+	g_thread_join(core_bench_refcount_thread);
+	core_bench_refcount_thread = NULL;
+}
+static void core_bench_refcount_fanout(core_bench_input *input) {
+	int i = 0;
+	for(i = 0; i < CORE_BENCH_FANOUT; i++) {
+		janus_refcount_increase_nodebug(&core_bench_refs[i]);
+		core_bench_sink += core_bench_refs[i].count;
+		janus_refcount_decrease_nodebug(&core_bench_refs[i]);
+	}
+}
+static void core_bench_refcount_guard_fanout(core_bench_input *input) {
+	int i = 0;
+	janus_refcount_guard_enter(&core_bench_guards[0]);
+	for(i = 0; i < CORE_BENCH_FANOUT; i++)
+		core_bench_sink += core_bench_refs[i].count;
+	janus_refcount_guard_leave(&core_bench_guards[0]);
+}
+
+/* The same packet protected by the SRTP contexts of several PeerConnections,
+ * each with its own keys, as it happens when fanning out to subscribers */
+#define CORE_BENCH_SRTP_LEGS		8
+#define CORE_BENCH_SRTP_PAYLOAD		1200
+static srtp_t core_bench_srtp[CORE_BENCH_SRTP_LEGS];
+static char core_bench_srtp_packet[RTP_HEADER_SIZE+CORE_BENCH_SRTP_PAYLOAD];
+static char core_bench_srtp_buf[RTP_HEADER_SIZE+CORE_BENCH_SRTP_PAYLOAD+SRTP_MAX_TAG_LEN];
+static uint16_t core_bench_srtp_seq = 0;
+static void core_bench_srtp_setup(janus_srtp_profile profile) {
+	if(srtp_init() != srtp_err_status_ok) {
+		fprintf(stderr, "Couldn't initialize libsrtp\n");
+		exit(1);
+	}
+	unsigned char key[SRTP_AESGCM256_MASTER_LENGTH];
+	int i = 0, k = 0;
+	for(i = 0; i < CORE_BENCH_SRTP_LEGS; i++) {
+		srtp_policy_t policy;
+		memset(&policy, 0, sizeof(policy));
+		switch(profile) {
+#ifdef HAVE_SRTP_AESGCM
+			case JANUS_SRTP_AEAD_AES_128_GCM:
+				srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtp);
+				srtp_crypto_policy_set_aes_gcm_128_16_auth(&policy.rtcp);
+				break;
+			case JANUS_SRTP_AEAD_AES_256_GCM:
+				srtp_crypto_policy_set_aes_gcm_256_16_auth(&policy.rtp);
+				srtp_crypto_policy_set_aes_gcm_256_16_auth(&policy.rtcp);
+				break;
+#endif
+			case JANUS_SRTP_AES128_CM_SHA1_80:
+			default:
+				srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtp);
+				srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtcp);
+				break;
+		}
+		for(k = 0; k < (int)sizeof(key); k++)
+			key[k] = g_random_int_range(0, 256);
+		policy.ssrc.type = ssrc_any_outbound;
+		policy.key = key;
+		policy.window_size = 128;
+		policy.allow_repeat_tx = 0;
+		policy.next = NULL;
+		if(srtp_create(&core_bench_srtp[i], &policy) != srtp_err_status_ok) {
+			fprintf(stderr, "Couldn't create the SRTP context\n");
+			exit(1);
+		}
+	}
+	memset(core_bench_srtp_packet, 0, sizeof(core_bench_srtp_packet));
+	janus_rtp_header *header = (janus_rtp_header *)core_bench_srtp_packet;
+	header->version = 2;
+	header->type = 96;
+	header->ssrc = htonl(0x11111111);
+	for(k = RTP_HEADER_SIZE; k < (int)sizeof(core_bench_srtp_packet); k++)
+		core_bench_srtp_packet[k] = k & 0xFF;
+	core_bench_srtp_seq = 0;
+}
+static void core_bench_srtp_setup_aes_cm(void) {
+	core_bench_srtp_setup(JANUS_SRTP_AES128_CM_SHA1_80);
+}
+#ifdef HAVE_SRTP_AESGCM
+static void core_bench_srtp_setup_aes_gcm_128(void) {
+	core_bench_srtp_setup(JANUS_SRTP_AEAD_AES_128_GCM);
+}
+static void core_bench_srtp_setup_aes_gcm_256(void) {
+	core_bench_srtp_setup(JANUS_SRTP_AEAD_AES_256_GCM);
+}
+#endif
+static void core_bench_srtp_teardown(void) {
+	int i = 0;
+	for(i = 0; i < CORE_BENCH_SRTP_LEGS; i++) {
+		srtp_dealloc(core_bench_srtp[i]);
+		core_bench_srtp[i] = NULL;
+	}
+	srtp_shutdown();
+}
+static void core_bench_srtp_protect(core_bench_input *input) {
+	janus_rtp_header *header = (janus_rtp_header *)core_bench_srtp_packet;
+	header->seq_number = htons(++core_bench_srtp_seq);
+	header->timestamp = htonl(core_bench_srtp_seq * 3000);
+	int i = 0;
+	for(i = 0; i < CORE_BENCH_SRTP_LEGS; i++) {
+		int protected = sizeof(core_bench_srtp_packet);
+		memcpy(core_bench_srtp_buf, core_bench_srtp_packet, protected);
+		core_bench_sink += srtp_protect(core_bench_srtp[i], core_bench_srtp_buf, &protected);
+		core_bench_sink += protected;
+	}
+}
+
+typedef struct core_bench {
+	const char *name;
+	GPtrArray **inputs;
+	void (*run)(core_bench_input *input);
+	/* Optional helpers, in case a benchmark needs something running in the background */
+	void (*setup)(void);
+	void (*teardown)(void);
+} core_bench;
+
+static GPtrArray *core_bench_rtcp = NULL, *core_bench_rtp = NULL, *core_bench_sdp = NULL;
+static core_bench core_bench_list[] = {
+	{ "janus_rtcp_parse", &core_bench_rtcp, core_bench_rtcp_parse },
+	{ "janus_rtcp_fix_ssrc", &core_bench_rtcp, core_bench_rtcp_fix_ssrc },
+	{ "janus_rtcp_get_nacks", &core_bench_rtcp, core_bench_rtcp_get_nacks },
+	{ "janus_rtcp_pli", NULL, core_bench_rtcp_pli },
+	{ "janus_rtcp_fir", NULL, core_bench_rtcp_fir },
+	{ "janus_rtcp_remb", NULL, core_bench_rtcp_remb },
+	{ "janus_rtcp_nacks (16)", NULL, core_bench_rtcp_nacks },
+	{ "janus_rtp_header_update", NULL, core_bench_rtp_header_update },
+	{ "janus_rtp_header_extension_parse_* (4)", &core_bench_rtp, core_bench_rtp_extensions },
+	{ "janus_rtp_header_extension_map_* (4)", &core_bench_rtp, core_bench_rtp_extensions_map },
+	{ "janus_vp8_parse_descriptor", &core_bench_rtp, core_bench_vp8_parse_descriptor },
+	{ "janus_vp9_parse_svc", &core_bench_rtp, core_bench_vp9_parse_svc },
+	{ "janus_sdp_parse", &core_bench_sdp, core_bench_sdp_parse },
+	{ "janus_sdp_write", &core_bench_sdp, core_bench_sdp_write },
+	{ "janus_recorder_save_frame", &core_bench_rtp, core_bench_recorder_save_frame },
+	{ "janus_ice_stream relay reads (1000)", NULL, core_bench_stream_relay,
+		core_bench_stream_setup, core_bench_stream_teardown },
+	{ "janus_refcount fan-out (500)", NULL, core_bench_refcount_fanout,
+		core_bench_refcount_setup, core_bench_refcount_teardown },
+	{ "janus_refcount_guard fan-out (500)", NULL, core_bench_refcount_guard_fanout,
+		core_bench_refcount_guard_setup, core_bench_refcount_teardown },
+	{ "srtp_protect AES-CM-128 fan-out (8)", NULL, core_bench_srtp_protect,
+		core_bench_srtp_setup_aes_cm, core_bench_srtp_teardown },
+#ifdef HAVE_SRTP_AESGCM
+	{ "srtp_protect AES-GCM-128 fan-out (8)", NULL, core_bench_srtp_protect,
+		core_bench_srtp_setup_aes_gcm_128, core_bench_srtp_teardown },
+	{ "srtp_protect AES-GCM-256 fan-out (8)", NULL, core_bench_srtp_protect,
+		core_bench_srtp_setup_aes_gcm_256, core_bench_srtp_teardown },
+#endif
+	{ NULL, NULL, NULL }
+};
+
+static void usage(const char *name) {
+	printf("Usage: %s [-c corpora] [-n iterations] [-b benchmark]\n", name);
+	printf("  -c  Folder with the fuzzers corpora (default: fuzzers/corpora)\n");
+	printf("  -n  How many times to go through the samples, or to call the generators (default: 2000)\n");
+	printf("  -b  Only run the benchmarks whose name contains this string (default: all)\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *corpora = "fuzzers/corpora", *filter = NULL;
+	int num = 2000, opt = 0;
+	while((opt = getopt(argc, argv, "c:n:b:h")) != -1) {
+		switch(opt) {
+			case 'c':
+				corpora = optarg;
+				break;
+			case 'n':
+				num = atoi(optarg);
+				break;
+			case 'b':
+				filter = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if(num < 1) {
+		usage(argv[0]);
+		exit(1);
+	}
+	/* Make sure list nodes are allocated (and counted) one by one */
+	g_setenv("G_SLICE", "always-malloc", TRUE);
+	/* Load the corpora */
+	core_bench_rtcp = g_ptr_array_new_with_free_func(core_bench_input_free);
+	core_bench_rtp = g_ptr_array_new_with_free_func(core_bench_input_free);
+	core_bench_sdp = g_ptr_array_new_with_free_func(core_bench_input_free);
+	char *folder = g_build_filename(corpora, "rtcp_fuzzer", NULL);
+	core_bench_load(folder, core_bench_rtcp, FALSE);
+	g_free(folder);
+	folder = g_build_filename(corpora, "rtp_fuzzer", NULL);
+	core_bench_load(folder, core_bench_rtp, FALSE);
+	g_free(folder);
+	folder = g_build_filename(corpora, "sdp_fuzzer", NULL);
+	core_bench_load(folder, core_bench_sdp, TRUE);
+	g_free(folder);
+	if(core_bench_rtcp->len == 0 || core_bench_rtp->len == 0 || core_bench_sdp->len == 0) {
+		fprintf(stderr, "Couldn't find the samples in %s\n", corpora);
+		exit(1);
+	}
+	/* Prepare the shared state */
+	memset(&core_bench_rtcp_ctx, 0, sizeof(core_bench_rtcp_ctx));
+	core_bench_rtcp_ctx.tb = 90000;
+	janus_rtp_switching_context_reset(&core_bench_rtp_ctx);
+	int i = 0;
+	for(i = 0; i < 16; i++)
+		core_bench_nacks = g_slist_append(core_bench_nacks, GUINT_TO_POINTER(1000 + i*3));
+	char *tmp = g_dir_make_tmp("core-bench-XXXXXX", NULL);
+	if(tmp == NULL) {
+		fprintf(stderr, "Couldn't create a temporary folder for the recording\n");
+		exit(1);
+	}
+	janus_recorder_init(FALSE, NULL);
+	core_bench_recorder = janus_recorder_create(tmp, "vp8", "core-bench");
+	if(core_bench_recorder == NULL) {
+		fprintf(stderr, "Couldn't create the recording in %s\n", tmp);
+		exit(1);
+	}
+	printf("%d iterations, %u RTCP, %u RTP and %u SDP samples\n", num,
+		core_bench_rtcp->len, core_bench_rtp->len, core_bench_sdp->len);
+	printf("%-40s %10s %12s %10s\n", "benchmark", "calls", "ns/call", "allocs/call");
+	core_bench *bench = NULL;
+	for(bench = core_bench_list; bench->name != NULL; bench++) {
+		if(filter && !strstr(bench->name, filter))
+			continue;
+		GPtrArray *inputs = bench->inputs ? *bench->inputs : NULL;
+		guint64 calls = (guint64)num * (inputs ? inputs->len : 1);
+		guint n = 0;
+		if(bench->setup)
+			bench->setup();
+		core_bench_allocs = 0;
+		core_bench_counting = TRUE;
+		double start = now_seconds();
+		for(i = 0; i < num; i++) {
+			if(inputs == NULL) {
+				bench->run(NULL);
+				continue;
+			}
+			for(n = 0; n < inputs->len; n++)
+				bench->run(g_ptr_array_index(inputs, n));
+		}
+		double elapsed = now_seconds() - start;
+		core_bench_counting = FALSE;
+		if(bench->teardown)
+			bench->teardown();
+		if(CORE_BENCH_ALLOCS) {
+			printf("%-40s %10"SCNu64" %12.2f %10.2f\n", bench->name, calls,
+				elapsed*1e9/calls, (double)core_bench_allocs/calls);
+		} else {
+			printf("%-40s %10"SCNu64" %12.2f %10s\n", bench->name, calls,
+				elapsed*1e9/calls, "-");
+		}
+	}
+	/* Clean up */
+	janus_recorder_close(core_bench_recorder);
+	char *path = g_build_filename(tmp, "core-bench.mjr", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_rmdir(tmp);
+	g_free(tmp);
+	janus_recorder_destroy(core_bench_recorder);
+	g_slist_free(core_bench_nacks);
+	g_ptr_array_free(core_bench_rtcp, TRUE);
+	g_ptr_array_free(core_bench_rtp, TRUE);
+	g_ptr_array_free(core_bench_sdp, TRUE);
+	return 0;
+}
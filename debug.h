@@ -84,10 +84,13 @@ static const char *janus_log_prefix[] = {
 #define JANUS_PRINT janus_vprintf
 /*! \brief Logger based on different levels, which can either be displayed
  * or not according to the configuration of the server.
- * The format must be a string literal. */
+ * The format must be a string literal. When deferred logging is enabled,
+ * formatting happens on the log thread instead (see janus_log_deferred_printf). */
 #define JANUS_LOG(level, format, ...) \
 do { \
-	if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level) { \
+	if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level && janus_log_deferred) { \
+		janus_log_deferred_printf(level, __FILE__, __FUNCTION__, __LINE__, format, ##__VA_ARGS__); \
+	} else if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level) { \
 		char janus_log_ts[64] = ""; \
 		char janus_log_src[128] = ""; \
 		if (janus_log_timestamps) { \
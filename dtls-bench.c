@@ -0,0 +1,351 @@
+/*! \file    dtls-bench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    DTLS handshakes benchmark
+ * \details  Standalone tool that measures how many DTLS-SRTP handshakes
+ * per second a single core can do, using the same DTLS settings the core
+ * uses (ciphers, SRTP profiles, P-256 ECDHE, mutual authentication with
+ * self-signed certificates, export of the SRTP keying material). Both peers
+ * live in the same thread and exchange datagrams via memory BIOs, so no
+ * network is involved: the time spent in the "server" peer is accounted
+ * separately, as that's what a Janus instance would have to do for each
+ * PeerConnection. Different configurations can be compared, e.g.:
+ *
+\verbatim
+./dtls-bench                  (all configurations)
+./dtls-bench -c rsa -n 500    (RSA-2048 certificates, 500 handshakes)
+./dtls-bench -c ecdsa -r      (ECDSA P-256 certificates, resumed sessions)
+\endverbatim
+ *
+ * The \c -l option reproduces the per-PeerConnection setup older versions
+ * of the core did (new ECDH parameters and options for each SSL instance,
+ * session cache left at its defaults), to compare it with the current one.
+ *
+ * \ingroup tools
+ * \ref tools
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/ec.h>
+
+#define DTLS_BENCH_CIPHERS	"DEFAULT:!NULL:!aNULL:!SHA256:!SHA384:!aECDH:!AESGCM+AES256:!aPSK"
+#define DTLS_BENCH_PROFILES	"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#define DTLS_BENCH_MTU		1200
+
+/* A benchmark configuration */
+typedef struct dtls_bench_config {
+	const char *name;
+	int rsa;
+	int resume;
+	int legacy;
+} dtls_bench_config;
+
+static int verify_callback(int preverify_ok, X509_STORE_CTX *ctx) {
+	/* Self-signed certificates are fine, as in WebRTC */
+	return 1;
+}
+
+/* Generate a self-signed certificate, the same way the core does */
+static int generate_cert(int rsa, X509 **cert, EVP_PKEY **key) {
+	EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(rsa ? EVP_PKEY_RSA : EVP_PKEY_EC, NULL);
+	if(kctx == NULL || EVP_PKEY_keygen_init(kctx) <= 0)
+		goto error;
+	if(rsa) {
+		if(EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, 2048) <= 0)
+			goto error;
+	} else if(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) <= 0) {
+		goto error;
+	}
+	*key = NULL;
+	if(EVP_PKEY_keygen(kctx, key) <= 0)
+		goto error;
+	EVP_PKEY_CTX_free(kctx);
+	kctx = NULL;
+	*cert = X509_new();
+	if(*cert == NULL)
+		goto error;
+	X509_set_version(*cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(*cert), rand());
+	X509_gmtime_adj(X509_get_notBefore(*cert), -1 * 60 * 60 * 24);
+	X509_gmtime_adj(X509_get_notAfter(*cert), 60 * 60 * 24 * 30);
+	X509_set_pubkey(*cert, *key);
+	X509_NAME *name = X509_get_subject_name(*cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"dtls-bench", -1, -1, 0);
+	X509_set_issuer_name(*cert, name);
+	if(X509_sign(*cert, *key, EVP_sha256()) == 0)
+		goto error;
+	return 0;
+
+error:
+	if(kctx)
+		EVP_PKEY_CTX_free(kctx);
+	fprintf(stderr, "Error generating certificate: %s\n", ERR_reason_error_string(ERR_get_error()));
+	return -1;
+}
+
+/* Create a context for one of the peers */
+static SSL_CTX *create_context(dtls_bench_config *config, int server) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	SSL_CTX *ctx = SSL_CTX_new(DTLSv1_2_method());
+#else
+	SSL_CTX *ctx = SSL_CTX_new(DTLS_method());
+#endif
+	if(ctx == NULL)
+		return NULL;
+	X509 *cert = NULL;
+	EVP_PKEY *key = NULL;
+	if(generate_cert(config->rsa, &cert, &key) < 0) {
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	SSL_CTX_use_certificate(ctx, cert);
+	SSL_CTX_use_PrivateKey(ctx, key);
+	X509_free(cert);
+	EVP_PKEY_free(key);
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, verify_callback);
+	SSL_CTX_set_tlsext_use_srtp(ctx, DTLS_BENCH_PROFILES);
+	SSL_CTX_set_cipher_list(ctx, DTLS_BENCH_CIPHERS);
+	SSL_CTX_set_read_ahead(ctx, 1);
+	if(!config->legacy) {
+		/* What the core does now: everything is set once on the context */
+		EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+		SSL_CTX_set_tmp_ecdh(ctx, ecdh);
+		EC_KEY_free(ecdh);
+		SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION | SSL_OP_SINGLE_ECDH_USE);
+		if(config->resume) {
+			SSL_CTX_set_session_cache_mode(ctx, server ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_CLIENT);
+			SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"dtls-bench", 10);
+		} else {
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+			SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		}
+	}
+	return ctx;
+}
+
+/* Create an SSL instance for one of the peers */
+static SSL *create_ssl(dtls_bench_config *config, SSL_CTX *ctx, int server) {
+	SSL *ssl = SSL_new(ctx);
+	if(ssl == NULL)
+		return NULL;
+	if(config->legacy) {
+		/* What the core used to do for each PeerConnection */
+		EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+		SSL_set_options(ssl, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION | SSL_OP_SINGLE_ECDH_USE);
+		SSL_set_tmp_ecdh(ssl, ecdh);
+		EC_KEY_free(ecdh);
+	}
+	BIO *rbio = BIO_new(BIO_s_mem()), *wbio = BIO_new(BIO_s_mem());
+	BIO_set_mem_eof_return(rbio, -1);
+	BIO_set_mem_eof_return(wbio, -1);
+	SSL_set_bio(ssl, rbio, wbio);
+	SSL_set_options(ssl, SSL_OP_NO_QUERY_MTU);
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	SSL_set_mtu(ssl, DTLS_BENCH_MTU);
+#else
+	DTLS_set_link_mtu(ssl, DTLS_BENCH_MTU);
+#endif
+	if(server)
+		SSL_set_accept_state(ssl);
+	else
+		SSL_set_connect_state(ssl);
+	return ssl;
+}
+
+/* Move what a peer wrote to the read BIO of the other one */
+static int relay(SSL *from, SSL *to) {
+	BIO *wbio = SSL_get_wbio(from), *rbio = SSL_get_rbio(to);
+	char buf[8192];
+	int moved = 0, len = 0;
+	while((len = BIO_read(wbio, buf, sizeof(buf))) > 0) {
+		BIO_write(rbio, buf, len);
+		moved += len;
+	}
+	return moved;
+}
+
+static double elapsed(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Step one of the peers, accounting the CPU time it took */
+static void step(SSL *ssl, double *cpu) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	if(!SSL_is_init_finished(ssl)) {
+		SSL_do_handshake(ssl);
+	} else {
+		/* Consume anything that's left (e.g., the last flight) */
+		char buf[1500];
+		SSL_read(ssl, buf, sizeof(buf));
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	*cpu += elapsed(&start, &end);
+}
+
+/* Do a single handshake: returns 1 if it was resumed, 0 if it was a full one, -1 on errors */
+static int handshake(dtls_bench_config *config, SSL_CTX *sctx, SSL_CTX *cctx,
+		SSL_SESSION **session, double *server_cpu, double *client_cpu) {
+	SSL *server = create_ssl(config, sctx, 1), *client = create_ssl(config, cctx, 0);
+	if(server == NULL || client == NULL) {
+		SSL_free(server);
+		SSL_free(client);
+		return -1;
+	}
+	if(config->resume && *session != NULL)
+		SSL_set_session(client, *session);
+	int rounds = 0, res = -1;
+	while(rounds < 50) {
+		step(client, client_cpu);
+		int moved = relay(client, server);
+		step(server, server_cpu);
+		moved += relay(server, client);
+		if(SSL_is_init_finished(client) && SSL_is_init_finished(server) && moved == 0)
+			break;
+		rounds++;
+	}
+	if(SSL_is_init_finished(client) && SSL_is_init_finished(server)) {
+		/* Do what the core does once the handshake is done */
+		struct timespec start, end;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+		unsigned char material[60];
+		X509 *rcert = SSL_get_peer_certificate(server);
+		unsigned char fingerprint[EVP_MAX_MD_SIZE];
+		unsigned int size = 0;
+		if(rcert != NULL) {
+			X509_digest(rcert, EVP_sha256(), fingerprint, &size);
+			X509_free(rcert);
+		}
+		int exported = SSL_export_keying_material(server, material, sizeof(material), "EXTRACTOR-dtls_srtp", 19, NULL, 0, 0);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		*server_cpu += elapsed(&start, &end);
+		if(size > 0 && exported)
+			res = SSL_session_reused(server) ? 1 : 0;
+		if(config->resume) {
+			if(*session != NULL)
+				SSL_SESSION_free(*session);
+			*session = SSL_get1_session(client);
+		}
+		/* Pretend we closed cleanly, or the session would be marked as not resumable */
+		SSL_set_shutdown(server, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+		SSL_set_shutdown(client, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+	}
+	SSL_free(server);
+	SSL_free(client);
+	return res;
+}
+
+static void run(dtls_bench_config *config, int num) {
+	SSL_CTX *sctx = create_context(config, 1), *cctx = create_context(config, 0);
+	if(sctx == NULL || cctx == NULL) {
+		fprintf(stderr, "Error creating the DTLS contexts for '%s'\n", config->name);
+		SSL_CTX_free(sctx);
+		SSL_CTX_free(cctx);
+		return;
+	}
+	SSL_SESSION *session = NULL;
+	double server_cpu = 0, client_cpu = 0;
+	int i = 0, done = 0, resumed = 0, failed = 0;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i=0; i<num; i++) {
+		int res = handshake(config, sctx, cctx, &session, &server_cpu, &client_cpu);
+		if(res < 0) {
+			failed++;
+			continue;
+		}
+		done++;
+		resumed += res;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double wall = elapsed(&start, &end);
+	printf("%-24s %6d %8d %8d %12.1f %12.1f %10.3f\n", config->name, done, resumed, failed,
+		wall > 0 ? done / wall : 0, server_cpu > 0 ? done / server_cpu : 0,
+		done > 0 ? server_cpu * 1000 / done : 0);
+	if(session != NULL)
+		SSL_SESSION_free(session);
+	SSL_CTX_free(sctx);
+	SSL_CTX_free(cctx);
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-c ecdsa|rsa] [-r] [-l] [-n handshakes]\n", name);
+	printf("  -c  Certificate type (default: run all configurations)\n");
+	printf("  -r  Resume sessions after the first handshake\n");
+	printf("  -l  Use the legacy per-PeerConnection setup\n");
+	printf("  -n  Number of handshakes per configuration (default: 1000)\n");
+}
+
+int main(int argc, char *argv[]) {
+	int num = 1000, opt = 0;
+	dtls_bench_config custom = { .name = NULL };
+	while((opt = getopt(argc, argv, "c:rln:h")) != -1) {
+		switch(opt) {
+			case 'c':
+				if(!strcasecmp(optarg, "rsa")) {
+					custom.rsa = 1;
+				} else if(strcasecmp(optarg, "ecdsa")) {
+					usage(argv[0]);
+					exit(1);
+				}
+				custom.name = "custom";
+				break;
+			case 'r':
+				custom.resume = 1;
+				custom.name = "custom";
+				break;
+			case 'l':
+				custom.legacy = 1;
+				custom.name = "custom";
+				break;
+			case 'n':
+				num = atoi(optarg);
+				if(num < 1) {
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	SSL_library_init();
+	SSL_load_error_strings();
+	OpenSSL_add_all_algorithms();
+#endif
+	srand(time(NULL));
+	printf("%s, %d handshakes per configuration, single thread\n", OPENSSL_VERSION_TEXT, num);
+	printf("%-24s %6s %8s %8s %12s %12s %10s\n", "configuration", "done", "resumed", "failed",
+		"hs/s (both)", "hs/s (srv)", "ms (srv)");
+	if(custom.name != NULL) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s%s%s", custom.rsa ? "rsa" : "ecdsa",
+			custom.resume ? " resumed" : " full", custom.legacy ? " legacy" : "");
+		custom.name = name;
+		run(&custom, num);
+		return 0;
+	}
+	dtls_bench_config configs[] = {
+		{ .name = "ecdsa full legacy", .legacy = 1 },
+		{ .name = "ecdsa full" },
+		{ .name = "ecdsa resumed", .resume = 1 },
+		{ .name = "rsa full legacy", .rsa = 1, .legacy = 1 },
+		{ .name = "rsa full", .rsa = 1 },
+		{ .name = "rsa resumed", .rsa = 1, .resume = 1 },
+	};
+	size_t i = 0;
+	for(i=0; i<sizeof(configs)/sizeof(configs[0]); i++)
+		run(&configs[i], num);
+	return 0;
+}
@@ -6,7 +6,9 @@
  * transport. The code takes care of the DTLS handshake between peers and
  * the server, and sets the proper SRTP and SRTCP context up accordingly.
  * A DTLS alert from a peer is notified to the plugin handling him/her
- * by means of the hangup_media callback.
+ * by means of the hangup_media callback. Handshakes can optionally be
+ * offloaded to a small pool of dedicated threads, so that a storm of
+ * reconnections doesn't stall the media of existing PeerConnections.
  *
  * \ingroup protocols
  * \ref protocols
@@ -17,6 +19,7 @@
 #include "dtls.h"
 #include "rtcp.h"
 #include "events.h"
+#include "metrics.h"
 
 #include <openssl/err.h>
 #include <openssl/bn.h>
@@ -75,7 +78,7 @@ const gchar *janus_get_dtls_srtp_profile(int profile) {
 
 /* Helper to notify DTLS state changes to the event handlers */
 static void janus_dtls_notify_state_change(janus_dtls_srtp *dtls) {
-	if(!janus_events_is_enabled())
+	if(!janus_events_is_wanted(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_DTLS))
 		return;
 	if(dtls == NULL)
 		return;
@@ -130,6 +133,32 @@ static X509 *ssl_cert = NULL;
 static EVP_PKEY *ssl_key = NULL;
 
 static gchar local_fingerprint[160];
+
+/* Pool of threads DTLS handshakes can be offloaded to (default=disabled) */
+typedef struct janus_dtls_handshake_job {
+	janus_dtls_srtp *dtls;
+	janus_ice_handle *handle;
+	janus_ice_component *component;
+	char *buf;
+	uint16_t len;
+	gint64 queued;
+} janus_dtls_handshake_job;
+static janus_dtls_handshake_job exit_job;
+static int hs_workers_num = 0, hs_backlog = 0;
+static GThread **hs_workers = NULL;
+static GAsyncQueue **hs_queues = NULL;
+static volatile gint hs_next = 0, hs_active = 0, hs_queued = 0;
+static volatile gint hs_offloaded = 0, hs_rejected = 0;
+/* Log2-bucketed histograms of handshake times and time spent waiting for a worker, in milliseconds */
+#define JANUS_DTLS_LATENCY_BUCKETS	17
+typedef struct janus_dtls_latency {
+	guint32 buckets[JANUS_DTLS_LATENCY_BUCKETS];
+	guint64 count;
+	guint64 sum;
+	gint64 max;
+} janus_dtls_latency;
+static janus_dtls_latency hs_latency, hs_wait;
+static janus_mutex hs_latency_mutex = JANUS_MUTEX_INITIALIZER;
 gchar *janus_dtls_get_local_fingerprint(void) {
 	return (gchar *)local_fingerprint;
 }
@@ -369,9 +398,46 @@ const char *janus_get_ssl_version(void) {
 	return OPENSSL_VERSION_TEXT;
 }
 
+/* SRTP profiles we support, in our default order of preference */
+#ifdef HAVE_SRTP_AESGCM
+#define JANUS_DTLS_SRTP_PROFILES	"SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#else
+#define JANUS_DTLS_SRTP_PROFILES	"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#endif
+/* Validate a custom order of preference for SRTP profiles, dropping
+ * the ones we don't know or support: returns NULL if none is left */
+static gchar *janus_dtls_srtp_profiles_parse(const char *profiles) {
+	gchar **names = g_strsplit_set(profiles, ":, ", -1);
+	GString *list = g_string_new(NULL);
+	int i = 0;
+	for(i=0; names[i] != NULL; i++) {
+		if(strlen(names[i]) == 0)
+			continue;
+		gchar **supported = g_strsplit(JANUS_DTLS_SRTP_PROFILES, ":", -1);
+		gboolean found = FALSE;
+		int j = 0;
+		for(j=0; supported[j] != NULL; j++) {
+			if(!strcasecmp(names[i], supported[j])) {
+				found = TRUE;
+				g_string_append_printf(list, "%s%s", list->len ? ":" : "", supported[j]);
+				break;
+			}
+		}
+		g_strfreev(supported);
+		if(!found)
+			JANUS_LOG(LOG_WARN, "Unsupported SRTP profile '%s', ignoring\n", names[i]);
+	}
+	g_strfreev(names);
+	if(list->len == 0) {
+		g_string_free(list, TRUE);
+		return NULL;
+	}
+	return g_string_free(list, FALSE);
+}
+
 /* DTLS-SRTP initialization */
 gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password,
-		const char *ciphers, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned) {
+		const char *ciphers, const char *srtp_profiles, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned) {
 	const char *crypto_lib = NULL;
 #if JANUS_USE_OPENSSL_PRE_1_1_API && !defined(HAVE_BORINGSSL)
 #if defined(LIBRESSL_VERSION_NUMBER)
@@ -413,12 +479,18 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		return -1;
 	}
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, janus_dtls_verify_callback);
-	SSL_CTX_set_tlsext_use_srtp(ssl_ctx,
-#ifdef HAVE_SRTP_AESGCM
-		"SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#else
-		"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#endif
+	/* When we're the DTLS server, we pick the first profile in this list the
+	 * peer supports; when we're the client, it's the list we offer in order */
+	gchar *profiles = srtp_profiles ? janus_dtls_srtp_profiles_parse(srtp_profiles) : NULL;
+	if(srtp_profiles && profiles == NULL)
+		JANUS_LOG(LOG_WARN, "No supported SRTP profile in '%s', using the defaults\n", srtp_profiles);
+	JANUS_LOG(LOG_INFO, "SRTP profiles: %s\n", profiles ? profiles : JANUS_DTLS_SRTP_PROFILES);
+	if(SSL_CTX_set_tlsext_use_srtp(ssl_ctx, profiles ? profiles : JANUS_DTLS_SRTP_PROFILES) != 0) {
+		JANUS_LOG(LOG_FATAL, "Error setting the SRTP profiles\n");
+		g_free(profiles);
+		return -1;
+	}
+	g_free(profiles);
 
 	if(!server_pem && !server_key) {
 		JANUS_LOG(LOG_WARN, "No cert/key specified, autogenerating some...\n");
@@ -446,6 +518,23 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		return -6;
 	}
 	SSL_CTX_set_read_ahead(ssl_ctx,1);
+	/* https://code.google.com/p/chromium/issues/detail?id=406458
+	 * Specify an ECDH group for ECDHE ciphers, otherwise they cannot be
+	 * negotiated when acting as the server. Use NIST's P-256 which is
+	 * commonly supported. This, and the options, are set once on the
+	 * context, rather than for each PeerConnection */
+	EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+	if(ecdh == NULL) {
+		JANUS_LOG(LOG_FATAL, "Error creating ECDH group! (%s)\n", ERR_reason_error_string(ERR_get_error()));
+		return -11;
+	}
+	SSL_CTX_set_tmp_ecdh(ssl_ctx, ecdh);
+	EC_KEY_free(ecdh);
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION | SSL_OP_SINGLE_ECDH_USE);
+	/* Browsers never resume DTLS sessions, so by default we don't waste
+	 * time caching sessions and issuing tickets (see janus_dtls_set_session_cache) */
+	SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_TICKET);
 
 	unsigned int size;
 	unsigned char fingerprint[EVP_MAX_MD_SIZE];
@@ -522,6 +611,20 @@ static void janus_dtls_srtp_free(const janus_refcount *dtls_ref) {
 }
 
 void janus_dtls_srtp_cleanup(void) {
+	if(hs_workers != NULL) {
+		int i = 0;
+		for(i=0; i<hs_workers_num; i++)
+			g_async_queue_push(hs_queues[i], &exit_job);
+		for(i=0; i<hs_workers_num; i++) {
+			g_thread_join(hs_workers[i]);
+			g_async_queue_unref(hs_queues[i]);
+		}
+		g_free(hs_workers);
+		hs_workers = NULL;
+		g_free(hs_queues);
+		hs_queues = NULL;
+		hs_workers_num = 0;
+	}
 	if(ssl_cert != NULL) {
 		X509_free(ssl_cert);
 		ssl_cert = NULL;
@@ -559,6 +662,8 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_component, janus_dtls_role rol
 	janus_dtls_srtp *dtls = g_malloc0(sizeof(janus_dtls_srtp));
 	g_atomic_int_set(&dtls->destroyed, 0);
 	janus_refcount_init(&dtls->ref, janus_dtls_srtp_free);
+	janus_mutex_init(&dtls->mutex);
+	dtls->worker = -1;
 	/* Create SSL context, at last */
 	dtls->srtp_valid = 0;
 	dtls->ssl = SSL_new(ssl_ctx);
@@ -588,22 +693,6 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_component, janus_dtls_role rol
 	SSL_set_bio(dtls->ssl, dtls->read_bio, dtls->write_bio);
 	/* The role may change later, depending on the negotiation */
 	dtls->dtls_role = role;
-	/* https://code.google.com/p/chromium/issues/detail?id=406458
-	 * Specify an ECDH group for ECDHE ciphers, otherwise they cannot be
-	 * negotiated when acting as the server. Use NIST's P-256 which is
-	 * commonly supported.
-	 */
-	EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
-	if(ecdh == NULL) {
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"]   Error creating ECDH group! (%s)\n",
-			handle->handle_id, ERR_reason_error_string(ERR_get_error()));
-		janus_refcount_decrease(&dtls->ref);
-		return NULL;
-	}
-	const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION | SSL_OP_SINGLE_ECDH_USE;
-	SSL_set_options(dtls->ssl, flags);
-	SSL_set_tmp_ecdh(dtls->ssl, ecdh);
-	EC_KEY_free(ecdh);
 #ifdef HAVE_DTLS_SETTIMEOUT
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"]   Setting DTLS initial timeout: %"SCNu16"ms\n", handle->handle_id, dtls_timeout_base);
 	DTLSv1_set_initial_timeout_duration(dtls->ssl, dtls_timeout_base);
@@ -622,6 +711,7 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_component, janus_dtls_role rol
 void janus_dtls_srtp_handshake(janus_dtls_srtp *dtls) {
 	if(dtls == NULL || dtls->ssl == NULL)
 		return;
+	janus_mutex_lock_nodebug(&dtls->mutex);
 	if(dtls->dtls_state == JANUS_DTLS_STATE_CREATED) {
 		/* Starting the handshake now: enforce the role */
 		dtls->dtls_started = janus_get_monotonic_time();
@@ -633,6 +723,7 @@ void janus_dtls_srtp_handshake(janus_dtls_srtp *dtls) {
 		dtls->dtls_state = JANUS_DTLS_STATE_TRYING;
 	}
 	SSL_do_handshake(dtls->ssl);
+	janus_mutex_unlock_nodebug(&dtls->mutex);
 
 	/* Notify event handlers */
 	janus_dtls_notify_state_change(dtls);
@@ -665,11 +756,94 @@ int janus_dtls_srtp_create_sctp(janus_dtls_srtp *dtls) {
 #endif
 }
 
-void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len) {
-	if(dtls == NULL) {
-		JANUS_LOG(LOG_ERR, "No DTLS-SRTP stack, no incoming message...\n");
+/* Helper to account a sample in one of the handshake histograms */
+static void janus_dtls_latency_add(janus_dtls_latency *h, gint64 usec) {
+	gint64 ms = usec > 0 ? usec/1000 : 0;
+	guint bucket = ms > 0 ? g_bit_storage((gulong)ms) : 0;
+	if(bucket >= JANUS_DTLS_LATENCY_BUCKETS)
+		bucket = JANUS_DTLS_LATENCY_BUCKETS-1;
+	janus_mutex_lock(&hs_latency_mutex);
+	h->buckets[bucket]++;
+	h->count++;
+	h->sum += ms;
+	if(ms > h->max)
+		h->max = ms;
+	janus_mutex_unlock(&hs_latency_mutex);
+}
+
+/* Percentiles are the upper bound of the bucket they fall in (must be called with hs_latency_mutex held) */
+static gint64 janus_dtls_latency_percentile(janus_dtls_latency *h, int percentile) {
+	guint64 target = (h->count * percentile + 99) / 100, seen = 0;
+	int i = 0;
+	for(i=0; i<JANUS_DTLS_LATENCY_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if(seen >= target)
+			return (i == JANUS_DTLS_LATENCY_BUCKETS-1) ? h->max : ((gint64)1 << i);
+	}
+	return h->max;
+}
+
+static json_t *janus_dtls_latency_summary(janus_dtls_latency *h) {
+	json_t *info = json_object();
+	janus_mutex_lock(&hs_latency_mutex);
+	json_object_set_new(info, "samples", json_integer(h->count));
+	if(h->count > 0) {
+		json_object_set_new(info, "avg", json_integer(h->sum / h->count));
+		json_object_set_new(info, "max", json_integer(h->max));
+		json_object_set_new(info, "p50", json_integer(janus_dtls_latency_percentile(h, 50)));
+		json_object_set_new(info, "p90", json_integer(janus_dtls_latency_percentile(h, 90)));
+		json_object_set_new(info, "p99", json_integer(janus_dtls_latency_percentile(h, 99)));
+	}
+	janus_mutex_unlock(&hs_latency_mutex);
+	return info;
+}
+
+json_t *janus_dtls_handshake_summary(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "workers", json_integer(hs_workers_num));
+	if(hs_workers_num > 0) {
+		json_object_set_new(info, "backlog", json_integer(hs_backlog));
+		json_object_set_new(info, "active", json_integer(g_atomic_int_get(&hs_active)));
+		json_object_set_new(info, "queued", json_integer(g_atomic_int_get(&hs_queued)));
+		json_object_set_new(info, "offloaded", json_integer(g_atomic_int_get(&hs_offloaded)));
+		json_object_set_new(info, "rejected", json_integer(g_atomic_int_get(&hs_rejected)));
+		json_object_set_new(info, "queue_wait", janus_dtls_latency_summary(&hs_wait));
+	}
+	json_object_set_new(info, "latency", janus_dtls_latency_summary(&hs_latency));
+	return info;
+}
+
+void janus_dtls_handshake_metrics(GString *text) {
+	if(text == NULL)
 		return;
+	static const int quantiles[] = { 50, 90, 99 };
+	janus_metrics_append_family(text, "janus_dtls_handshake_seconds", "summary", "Time it took to complete DTLS handshakes");
+	janus_mutex_lock(&hs_latency_mutex);
+	guint i = 0;
+	if(hs_latency.count > 0) {
+		for(i=0; i<G_N_ELEMENTS(quantiles); i++) {
+			g_string_append_printf(text, "janus_dtls_handshake_seconds{quantile=\"0.%d\"} %.3f\n",
+				quantiles[i], (double)janus_dtls_latency_percentile(&hs_latency, quantiles[i])/1000);
+		}
+	}
+	g_string_append_printf(text, "janus_dtls_handshake_seconds_sum %.3f\n", (double)hs_latency.sum/1000);
+	g_string_append_printf(text, "janus_dtls_handshake_seconds_count %"SCNu64"\n", hs_latency.count);
+	janus_mutex_unlock(&hs_latency_mutex);
+	if(hs_workers_num > 0) {
+		janus_metrics_append_family(text, "janus_dtls_handshakes_active", "gauge", "DTLS handshakes in progress on the handshake workers");
+		g_string_append_printf(text, "janus_dtls_handshakes_active %d\n", g_atomic_int_get(&hs_active));
+		janus_metrics_append_family(text, "janus_dtls_handshakes_rejected", "counter", "DTLS messages dropped because too many handshakes were in progress");
+		g_string_append_printf(text, "janus_dtls_handshakes_rejected_total %d\n", g_atomic_int_get(&hs_rejected));
 	}
+}
+
+/* Helper to give back the handshake slot an instance took on the pool, if any */
+static void janus_dtls_handshake_release(janus_dtls_srtp *dtls) {
+	if(g_atomic_int_compare_and_exchange(&dtls->admitted, 1, 0))
+		g_atomic_int_add(&hs_active, -1);
+}
+
+static void janus_dtls_srtp_incoming_msg_internal(janus_dtls_srtp *dtls, char *buf, uint16_t len) {
 	janus_ice_component *component = (janus_ice_component *)dtls->component;
 	if(component == NULL) {
 		JANUS_LOG(LOG_ERR, "No component, no DTLS...\n");
@@ -774,6 +948,7 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"]  Fingerprint is a match!\n", handle->handle_id);
 				dtls->dtls_state = JANUS_DTLS_STATE_CONNECTED;
 				dtls->dtls_connected = janus_get_monotonic_time();
+				janus_dtls_latency_add(&hs_latency, dtls->dtls_connected - dtls->dtls_started);
 				/* Notify event handlers */
 				janus_dtls_notify_state_change(dtls);
 			} else {
@@ -956,6 +1131,131 @@ done:
 	}
 }
 
+/* Thread processing the DTLS messages of the handshakes assigned to it */
+static void *janus_dtls_handshake_thread(void *data) {
+	GAsyncQueue *queue = (GAsyncQueue *)data;
+	JANUS_LOG(LOG_VERB, "DTLS handshake worker started\n");
+	janus_dtls_handshake_job *job = NULL;
+	while((job = g_async_queue_pop(queue)) != &exit_job) {
+		g_atomic_int_add(&hs_queued, -1);
+		janus_dtls_srtp *dtls = job->dtls;
+		janus_dtls_latency_add(&hs_wait, janus_get_monotonic_time() - job->queued);
+		if(!g_atomic_int_get(&dtls->destroyed) && !g_atomic_int_get(&job->handle->destroyed)) {
+			janus_mutex_lock_nodebug(&dtls->mutex);
+			janus_dtls_srtp_incoming_msg_internal(dtls, job->buf, job->len);
+			janus_mutex_unlock_nodebug(&dtls->mutex);
+		}
+		/* If the handshake is over, one way or another, let a new one in */
+		if(dtls->ready || dtls->dtls_state == JANUS_DTLS_STATE_FAILED || g_atomic_int_get(&dtls->destroyed) ||
+				janus_flags_is_set(&job->handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+			janus_dtls_handshake_release(dtls);
+		g_atomic_int_add(&dtls->offloaded, -1);
+		janus_refcount_decrease(&job->component->ref);
+		janus_refcount_decrease(&job->handle->ref);
+		janus_refcount_decrease(&dtls->ref);
+		g_free(job->buf);
+		g_free(job);
+	}
+	JANUS_LOG(LOG_VERB, "DTLS handshake worker leaving\n");
+	return NULL;
+}
+
+/* Helper to hand an incoming message to the handshake worker of an instance:
+ * returns FALSE if the message should be processed right away, instead */
+static gboolean janus_dtls_handshake_offload(janus_dtls_srtp *dtls, char *buf, uint16_t len) {
+	if(dtls->ready && g_atomic_int_get(&dtls->offloaded) == 0) {
+		/* Handshake done and nothing left in the queue, no need for the worker anymore */
+		return FALSE;
+	}
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	janus_ice_stream *stream = component ? component->stream : NULL;
+	janus_ice_handle *handle = stream ? stream->handle : NULL;
+	if(handle == NULL || dtls->dtls_started == 0)
+		return FALSE;
+	if(dtls->worker < 0) {
+		/* This is a new handshake: check if we can take it */
+		if(g_atomic_int_add(&hs_active, 1) >= hs_backlog) {
+			g_atomic_int_add(&hs_active, -1);
+			g_atomic_int_inc(&hs_rejected);
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Too many DTLS handshakes in progress, dropping message\n", handle->handle_id);
+			return TRUE;
+		}
+		g_atomic_int_set(&dtls->admitted, 1);
+		dtls->worker = (guint)g_atomic_int_add(&hs_next, 1) % hs_workers_num;
+	}
+	janus_dtls_handshake_job *job = g_malloc(sizeof(janus_dtls_handshake_job));
+	janus_refcount_increase(&dtls->ref);
+	janus_refcount_increase(&handle->ref);
+	janus_refcount_increase(&component->ref);
+	job->dtls = dtls;
+	job->handle = handle;
+	job->component = component;
+	job->buf = g_malloc(len);
+	memcpy(job->buf, buf, len);
+	job->len = len;
+	job->queued = janus_get_monotonic_time();
+	g_atomic_int_inc(&dtls->offloaded);
+	g_atomic_int_inc(&hs_offloaded);
+	g_atomic_int_inc(&hs_queued);
+	g_async_queue_push(hs_queues[dtls->worker], job);
+	return TRUE;
+}
+
+void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len) {
+	if(dtls == NULL) {
+		JANUS_LOG(LOG_ERR, "No DTLS-SRTP stack, no incoming message...\n");
+		return;
+	}
+	if(hs_workers_num > 0 && janus_dtls_handshake_offload(dtls, buf, len))
+		return;
+	janus_mutex_lock_nodebug(&dtls->mutex);
+	janus_dtls_srtp_incoming_msg_internal(dtls, buf, len);
+	janus_mutex_unlock_nodebug(&dtls->mutex);
+}
+
+void janus_dtls_set_session_cache(gboolean enabled) {
+	if(ssl_ctx == NULL || !enabled)
+		return;
+	SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_session_id_context(ssl_ctx, (const unsigned char *)"janus", 5);
+	SSL_CTX_clear_options(ssl_ctx, SSL_OP_NO_TICKET);
+	JANUS_LOG(LOG_INFO, "DTLS session resumption enabled\n");
+}
+
+void janus_dtls_set_handshake_pool(int workers, int backlog) {
+	if(hs_workers != NULL || workers < 1)
+		return;
+	hs_backlog = backlog > 0 ? backlog : 256;
+	hs_workers = g_malloc0(workers * sizeof(GThread *));
+	hs_queues = g_malloc0(workers * sizeof(GAsyncQueue *));
+	int i = 0;
+	for(i=0; i<workers; i++) {
+		hs_queues[i] = g_async_queue_new();
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "dtls hs %d", i+1);
+		hs_workers[i] = g_thread_try_new(tname, &janus_dtls_handshake_thread, hs_queues[i], &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a DTLS handshake worker...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_async_queue_unref(hs_queues[i]);
+			hs_queues[i] = NULL;
+			break;
+		}
+	}
+	hs_workers_num = i;
+	if(hs_workers_num == 0) {
+		g_free(hs_workers);
+		hs_workers = NULL;
+		g_free(hs_queues);
+		hs_queues = NULL;
+		return;
+	}
+	JANUS_LOG(LOG_INFO, "DTLS handshakes offloaded to %d workers (at most %d at the same time)\n",
+		hs_workers_num, hs_backlog);
+}
+
 void janus_dtls_srtp_send_alert(janus_dtls_srtp *dtls) {
 	if(!dtls)
 		return;
@@ -970,6 +1270,7 @@ void janus_dtls_srtp_send_alert(janus_dtls_srtp *dtls) {
 void janus_dtls_srtp_destroy(janus_dtls_srtp *dtls) {
 	if(!dtls || !g_atomic_int_compare_and_exchange(&dtls->destroyed, 0, 1))
 		return;
+	janus_dtls_handshake_release(dtls);
 	dtls->ready = 0;
 	dtls->retransmissions = 0;
 #ifdef HAVE_SCTP
@@ -1119,9 +1420,13 @@ gboolean janus_dtls_retry(gpointer stack) {
 		janus_ice_webrtc_hangup(handle, "DTLS timeout");
 		goto stoptimer;
 	}
+	/* If a handshake worker is busy with this instance, we'll check again later */
+	if(!janus_mutex_trylock(&dtls->mutex))
+		return TRUE;
 	struct timeval timeout = {0};
 	if(DTLSv1_get_timeout(dtls->ssl, &timeout) == 0) {
 		/* failed to get timeout. try again on next iter */
+		janus_mutex_unlock_nodebug(&dtls->mutex);
 		return TRUE;
 	}
 	guint64 timeout_value = timeout.tv_sec*1000 + timeout.tv_usec/1000;
@@ -1134,6 +1439,7 @@ gboolean janus_dtls_retry(gpointer stack) {
 		/* Retransmit the packet */
 		DTLSv1_handle_timeout(dtls->ssl);
 	}
+	janus_mutex_unlock_nodebug(&dtls->mutex);
 	return TRUE;
 
 stoptimer:
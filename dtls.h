@@ -17,11 +17,13 @@
 
 #include <inttypes.h>
 #include <glib.h>
+#include <jansson.h>
 
 #include "rtp.h"
 #include "rtpsrtp.h"
 #include "sctp.h"
 #include "refcount.h"
+#include "mutex.h"
 #include "dtls-bio.h"
 
 /*! \brief Helper method to return info on the crypto library and its version
@@ -33,18 +35,45 @@ const char *janus_get_ssl_version(void);
  * @param[in] server_key Path to the key to use
  * @param[in] password Password needed to use the key, if any
  * @param[in] ciphers DTLS ciphers to use (will use hardcoded defaults, if NULL)
+ * @param[in] srtp_profiles Colon separated SRTP profiles to negotiate, in order of preference (will use hardcoded defaults, if NULL)
  * @param[in] timeout DTLS timeout base, in ms, to use for retransmissions (ignored if not using BoringSSL)
  * @param[in] rsa_private_key Whether RSA certificates should be generated, instead of NIST P-256
  * @param[in] accept_selfsigned Whether to accept self-signed certificates (default) or enforce validation
  * @returns 0 in case of success, a negative integer on errors */
 gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password,
-	const char *ciphers, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned);
+	const char *ciphers, const char *srtp_profiles, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned);
 /*! \brief Method to cleanup DTLS stuff before exiting */
 void janus_dtls_srtp_cleanup(void);
 /*! \brief Method to return a string representation (SHA-256) of the certificate fingerprint */
 gchar *janus_dtls_get_local_fingerprint(void);
 /*! \brief Method to check whether DTLS self-signed certificates are ok (default) or not */
 gboolean janus_dtls_are_selfsigned_certs_ok(void);
+/*! \brief Method to allow peers to resume DTLS sessions
+ * \details Browsers always perform a full handshake for new PeerConnections,
+ * so by default sessions are not cached and no session ticket is issued,
+ * which saves some work for each handshake. Peers that do try to resume
+ * sessions (e.g., other gateways) can be allowed to do that with this method:
+ * the fingerprint of the certificate is checked against the SDP either way.
+ * \note This must be called after janus_dtls_srtp_init, before any PeerConnection is created
+ * @param[in] enabled Whether session resumption should be allowed */
+void janus_dtls_set_session_cache(gboolean enabled);
+/*! \brief Method to offload DTLS handshakes to a pool of dedicated threads
+ * \details By default, handshakes are processed by the thread serving the
+ * PeerConnection (e.g., its event loop), which means their crypto competes
+ * with media. When a pool is configured, incoming DTLS messages are handed
+ * to one of its workers until the handshake is over: at most \c backlog
+ * handshakes can be in progress on the pool at the same time, and messages
+ * starting new ones are dropped when that's reached (the peer will retransmit).
+ * \note This must be called after janus_dtls_srtp_init, before any PeerConnection is created
+ * @param[in] workers How many worker threads to start (0 disables the pool)
+ * @param[in] backlog Maximum number of handshakes in progress on the pool */
+void janus_dtls_set_handshake_pool(int workers, int backlog);
+/*! \brief Method to get a summary of the DTLS handshakes (pool status and latency percentiles), e.g., for the Admin API
+ * @returns A json_t object with the handshakes info */
+json_t *janus_dtls_handshake_summary(void);
+/*! \brief Helper to append the DTLS handshakes metrics in the OpenMetrics text format
+ * @param[in] text The buffer to append to */
+void janus_dtls_handshake_metrics(GString *text);
 
 
 /*! \brief DTLS roles */
@@ -100,6 +129,14 @@ typedef struct janus_dtls_srtp {
 	/*! \brief SCTP association, if DataChannels are involved */
 	janus_sctp_association *sctp;
 #endif
+	/*! \brief Mutex to serialize access to the SSL context, in case the handshake is offloaded */
+	janus_mutex mutex;
+	/*! \brief Handshake worker this instance was assigned to, if any (-1 otherwise) */
+	int worker;
+	/*! \brief Whether this instance is taking one of the handshake slots of the pool */
+	volatile gint admitted;
+	/*! \brief How many incoming messages for this instance are waiting for (or being processed by) its worker */
+	volatile gint offloaded;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
 	volatile gint destroyed;
 	/*! \brief Reference counter for this instance */
@@ -4,7 +4,10 @@
  * \brief    Event handler notifications
  * \details  Event handler plugins can receive events from the Janus core
  * and other plugins, in order to handle them somehow. This methods
- * provide helpers to notify events to such handlers.
+ * provide helpers to notify events to such handlers. Each handler has
+ * its own bounded queue of events and its own thread to pass them, so
+ * that a slow handler can't delay the others: when a queue is full, the
+ * configured overflow policy decides which events are dropped.
  *
  * \ingroup core
  * \ref core
@@ -13,6 +16,7 @@
 #include <stdarg.h>
 
 #include "events.h"
+#include "mutex.h"
 #include "utils.h"
 
 static struct janus_event_types {
@@ -33,34 +37,166 @@ static struct janus_event_types {
 	{ -1, NULL, NULL},
 };
 
+static struct janus_event_subtypes {
+	int type;
+	int subtype;
+	const char *label;
+} event_subtypes_string[] = {
+	{ JANUS_EVENT_TYPE_CORE, JANUS_EVENT_SUBTYPE_CORE_STARTUP, "core.startup"},
+	{ JANUS_EVENT_TYPE_CORE, JANUS_EVENT_SUBTYPE_CORE_SHUTDOWN, "core.shutdown"},
+	{ JANUS_EVENT_TYPE_CORE, JANUS_EVENT_SUBTYPE_CORE_OVERLOAD, "core.overload"},
+	{ JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_ICE, "webrtc.ice"},
+	{ JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_LCAND, "webrtc.lcand"},
+	{ JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_RCAND, "webrtc.rcand"},
+	{ JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_PAIR, "webrtc.pair"},
+	{ JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_DTLS, "webrtc.dtls"},
+	{ JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_STATE, "webrtc.state"},
+	{ JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_STATE, "media.state"},
+	{ JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_SLOWLINK, "media.slowlink"},
+	{ JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_STATS, "media.stats"},
+	{ JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_SUMMARY, "media.summary"},
+	{ -1, -1, NULL},
+};
+
 static gboolean eventsenabled = FALSE;
 static char *server = NULL;
 static GHashTable *eventhandlers = NULL;
 
-static GAsyncQueue *events = NULL;
-static json_t exit_event;
+/* Queue of events for a specific handler, served by its own thread */
+typedef struct janus_events_queue {
+	janus_eventhandler *handler;	/* The handler we pass the events to */
+	GThread *thread;				/* Thread passing the events to the handler */
+	GQueue *events;					/* Events waiting to be passed */
+	guint64 delivered;				/* How many events have been passed to the handler */
+	guint64 dropped;				/* How many events were dropped because the queue was full */
+	guint max_queued;				/* Largest backlog we've seen */
+	guint sample_count;				/* Events received since the last one we kept, when sampling */
+	gboolean dropping;				/* Whether we're currently dropping events */
+	gboolean stop;					/* Whether the thread should stop */
+	janus_mutex mutex;
+	janus_condition cond;
+} janus_events_queue;
+static GList *queues = NULL;
+static void *janus_events_queue_thread(void *data);
+
+/* Subtypes nobody gets, as a mask of subtypes for each type (indexed by
+ * the bit of the type), and plugins nobody gets events from */
+#define JANUS_EVENTS_TYPES	9
+static guint32 excluded_subtypes[JANUS_EVENTS_TYPES];
+static char **excluded_plugins = NULL;
 
-static GThread *events_thread;
-void *janus_events_thread(void *data);
+/* Overflow settings: the default matches the old unbounded behaviour */
+static guint queue_size = 0;
+static janus_events_overflow_policy overflow_policy = janus_events_overflow_drop_oldest;
+static janus_flags overflow_types;
+static guint overflow_sample = 10;
+
+/* Events are never modified after they've been queued, and handlers are
+ * expected to treat them as read-only: this means we can share the same
+ * instance with all of them, rather than giving each a deep copy, as long as
+ * Jansson can reference and encode the same value from different threads
+ * (atomic reference counts since 2.11, no more "visited" marks when
+ * encoding since 2.13). With older versions we keep on copying. */
+#if defined(JANSSON_THREAD_SAFE_REFCOUNT) && JANSSON_THREAD_SAFE_REFCOUNT && (JANSSON_VERSION_HEX >= 0x020d00)
+static const gboolean events_shared = TRUE;
+#else
+static const gboolean events_shared = FALSE;
+#endif
+
+void janus_events_set_overflow(guint size, janus_events_overflow_policy policy, const char *types, guint sample) {
+	queue_size = size;
+	overflow_policy = policy;
+	janus_flags_reset(&overflow_types);
+	if(types != NULL)
+		janus_events_edit_events_mask(types, &overflow_types);
+	overflow_sample = sample > 0 ? sample : 1;
+}
+
+janus_events_overflow_policy janus_events_overflow_policy_from_string(const char *policy) {
+	if(policy == NULL)
+		return janus_events_overflow_drop_oldest;
+	if(!strcasecmp(policy, "drop_oldest"))
+		return janus_events_overflow_drop_oldest;
+	if(!strcasecmp(policy, "drop_types"))
+		return janus_events_overflow_drop_types;
+	if(!strcasecmp(policy, "sample"))
+		return janus_events_overflow_sample;
+	return janus_events_overflow_invalid;
+}
+
+static const char *janus_events_overflow_policy_str(janus_events_overflow_policy policy) {
+	switch(policy) {
+		case janus_events_overflow_drop_oldest:
+			return "drop_oldest";
+		case janus_events_overflow_drop_types:
+			return "drop_types";
+		case janus_events_overflow_sample:
+			return "sample";
+		default:
+			break;
+	}
+	return NULL;
+}
+
+static void janus_events_queue_destroy(janus_events_queue *queue) {
+	if(queue == NULL)
+		return;
+	janus_mutex_lock(&queue->mutex);
+	queue->stop = TRUE;
+	janus_condition_signal(&queue->cond);
+	janus_mutex_unlock(&queue->mutex);
+	if(queue->thread != NULL)
+		g_thread_join(queue->thread);
+	json_t *event = NULL;
+	while((event = g_queue_pop_head(queue->events)) != NULL)
+		json_decref(event);
+	g_queue_free(queue->events);
+	janus_mutex_destroy(&queue->mutex);
+	janus_condition_destroy(&queue->cond);
+	g_free(queue);
+}
 
 int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers) {
 	eventsenabled = enabled;
 	if(eventsenabled) {
-		events = g_async_queue_new();
+		JANUS_LOG(LOG_VERB, "Events will be %s with event handlers\n", events_shared ? "shared" : "copied");
+		if(queue_size > 0) {
+			JANUS_LOG(LOG_INFO, "Event handlers queues limited to %u events (%s)\n",
+				queue_size, janus_events_overflow_policy_str(overflow_policy));
+		}
 		if(server_name != NULL)
 			server = g_strdup(server_name);
 		eventhandlers = handlers;
-		/* We setup a thread for passing events to the handlers */
-		GError *error = NULL;
-		events_thread = g_thread_try_new("janus events thread", janus_events_thread, NULL, &error);
-		if(error != NULL) {
-			eventsenabled = FALSE;
-			g_free(server);
-			g_async_queue_unref(events);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Events handler thread...\n",
-				error->code, error->message ? error->message : "??");
-			g_error_free(error);
-			return -1;
+		/* We setup a queue and a thread for passing events to each handler */
+		if(eventhandlers != NULL) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, eventhandlers);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_eventhandler *e = value;
+				if(e == NULL)
+					continue;
+				janus_events_queue *queue = g_malloc0(sizeof(janus_events_queue));
+				queue->handler = e;
+				queue->events = g_queue_new();
+				janus_mutex_init(&queue->mutex);
+				janus_condition_init(&queue->cond);
+				GError *error = NULL;
+				queue->thread = g_thread_try_new("janus events", janus_events_queue_thread, queue, &error);
+				if(error != NULL) {
+					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Events handler thread for %s...\n",
+						error->code, error->message ? error->message : "??", e->get_package());
+					g_error_free(error);
+					janus_events_queue_destroy(queue);
+					eventsenabled = FALSE;
+					g_list_free_full(queues, (GDestroyNotify)janus_events_queue_destroy);
+					queues = NULL;
+					g_free(server);
+					server = NULL;
+					return -1;
+				}
+				queues = g_list_append(queues, queue);
+			}
 		}
 	}
 	return 0;
@@ -68,29 +204,193 @@ int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers)
 
 void janus_events_deinit(void) {
 	eventsenabled = FALSE;
-	if(events != NULL) {
-		g_async_queue_push(events, &exit_event);
+	g_list_free_full(queues, (GDestroyNotify)janus_events_queue_destroy);
+	queues = NULL;
+	g_free(server);
+	g_strfreev(excluded_plugins);
+	excluded_plugins = NULL;
+}
+
+/* Add an event to the queue of a handler, enforcing the overflow policy:
+ * returns FALSE if the event was dropped, in which case we still own it */
+static gboolean janus_events_queue_push(janus_events_queue *queue, int type, json_t *event) {
+	gboolean keep = TRUE;
+	janus_mutex_lock(&queue->mutex);
+	if(queue->stop) {
+		janus_mutex_unlock(&queue->mutex);
+		return FALSE;
+	}
+	if(queue_size > 0 && g_queue_get_length(queue->events) >= queue_size) {
+		if(!queue->dropping) {
+			queue->dropping = TRUE;
+			JANUS_LOG(LOG_WARN, "Queue of event handler %s is full (%u events), dropping events (%s)\n",
+				queue->handler->get_package(), queue_size, janus_events_overflow_policy_str(overflow_policy));
+		}
+		if(overflow_policy == janus_events_overflow_drop_types && janus_flags_is_set(&overflow_types, type)) {
+			/* This type of event can be dropped, so we drop the new one */
+			keep = FALSE;
+		} else if(overflow_policy == janus_events_overflow_sample) {
+			/* Only keep one every N events, as long as we're full */
+			queue->sample_count++;
+			if(queue->sample_count < overflow_sample)
+				keep = FALSE;
+			else
+				queue->sample_count = 0;
+		}
+		if(keep) {
+			/* Make room, getting rid of the oldest event */
+			json_t *oldest = g_queue_pop_head(queue->events);
+			json_decref(oldest);
+		}
+		queue->dropped++;
+	} else if(queue->dropping && g_queue_get_length(queue->events) < queue_size/2) {
+		queue->dropping = FALSE;
+		queue->sample_count = 0;
+		JANUS_LOG(LOG_INFO, "Queue of event handler %s is draining, not dropping events anymore (%"SCNu64" dropped so far)\n",
+			queue->handler->get_package(), queue->dropped);
 	}
-	if(events_thread != NULL) {
-		g_thread_join(events_thread);
-		events_thread = NULL;
+	if(keep) {
+		g_queue_push_tail(queue->events, event);
+		guint queued = g_queue_get_length(queue->events);
+		if(queued > queue->max_queued)
+			queue->max_queued = queued;
+		janus_condition_signal(&queue->cond);
+	}
+	janus_mutex_unlock(&queue->mutex);
+	return keep;
+}
+
+/* Pass an event to the queues of all the interested handlers */
+static void janus_events_dispatch(json_t *event) {
+	int type = json_integer_value(json_object_get(event, "type"));
+	guint count = g_list_length(queues);
+	GList *temp = queues;
+	while(temp) {
+		janus_events_queue *queue = (janus_events_queue *)temp->data;
+		temp = temp->next;
+		if(!janus_flags_is_set(&queue->handler->events_mask, type))
+			continue;
+		/* Events are read-only, so we can share them, unless Jansson can't do that across threads */
+		json_t *instance = (count == 1 || events_shared) ? json_incref(event) : json_deep_copy(event);
+		if(!janus_events_queue_push(queue, type, instance))
+			json_decref(instance);
+	}
+	json_decref(event);
+}
+
+json_t *janus_events_queues_info(void) {
+	json_t *info = json_object();
+	GList *temp = queues;
+	while(temp) {
+		janus_events_queue *queue = (janus_events_queue *)temp->data;
+		temp = temp->next;
+		json_t *q = json_object();
+		janus_mutex_lock(&queue->mutex);
+		json_object_set_new(q, "queued", json_integer(g_queue_get_length(queue->events)));
+		json_object_set_new(q, "max_queued", json_integer(queue->max_queued));
+		json_object_set_new(q, "delivered", json_integer(queue->delivered));
+		json_object_set_new(q, "dropped", json_integer(queue->dropped));
+		json_object_set_new(q, "dropping", queue->dropping ? json_true() : json_false());
+		janus_mutex_unlock(&queue->mutex);
+		json_object_set_new(info, queue->handler->get_package(), q);
+	}
+	return info;
+}
+
+json_t *janus_events_overflow_info(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "queue_size", json_integer(queue_size));
+	json_object_set_new(info, "overflow_policy", json_string(janus_events_overflow_policy_str(overflow_policy)));
+	if(overflow_policy == janus_events_overflow_sample)
+		json_object_set_new(info, "overflow_sample", json_integer(overflow_sample));
+	return info;
+}
+
+void janus_events_set_excluded(const char *list) {
+	memset(excluded_subtypes, 0, sizeof(excluded_subtypes));
+	g_strfreev(excluded_plugins);
+	excluded_plugins = NULL;
+	if(list == NULL)
+		return;
+	GPtrArray *plugins = g_ptr_array_new();
+	gchar **items = g_strsplit(list, ",", -1);
+	int i = 0, j = 0;
+	for(i=0; items[i] != NULL; i++) {
+		char *item = g_strstrip(items[i]);
+		if(*item == '\0')
+			continue;
+		gboolean found = FALSE;
+		for(j=0; event_subtypes_string[j].label != NULL; j++) {
+			if(!strcasecmp(item, event_subtypes_string[j].label)) {
+				int index = g_bit_nth_lsf(event_subtypes_string[j].type, -1);
+				excluded_subtypes[index] |= (1 << event_subtypes_string[j].subtype);
+				found = TRUE;
+				break;
+			}
+		}
+		if(found)
+			continue;
+		if(strstr(item, ".plugin.") != NULL) {
+			g_ptr_array_add(plugins, g_strdup(item));
+		} else {
+			JANUS_LOG(LOG_WARN, "Unsupported event subtype or plugin to exclude '%s', ignoring\n", item);
+		}
+	}
+	g_strfreev(items);
+	if(plugins->len > 0) {
+		g_ptr_array_add(plugins, NULL);
+		excluded_plugins = (char **)g_ptr_array_free(plugins, FALSE);
+	} else {
+		g_ptr_array_free(plugins, TRUE);
 	}
-	if(events != NULL)
-		g_async_queue_unref(events);
-	g_free(server);
 }
 
 gboolean janus_events_is_enabled(void) {
 	return eventsenabled;
 }
 
+gboolean janus_events_is_wanted(int type, int subtype) {
+	if(!eventsenabled || queues == NULL)
+		return FALSE;
+	if(subtype > 0 && subtype < 32) {
+		int index = g_bit_nth_lsf(type, -1);
+		if(index >= 0 && index < JANUS_EVENTS_TYPES && (excluded_subtypes[index] & (1 << subtype)))
+			return FALSE;
+	}
+	/* Check if any handler is subscribed to this type: the list of queues
+	 * never changes after janus_events_init, so we can walk it as it is */
+	GList *temp = queues;
+	while(temp) {
+		janus_events_queue *queue = (janus_events_queue *)temp->data;
+		if(janus_flags_is_set(&queue->handler->events_mask, type))
+			return TRUE;
+		temp = temp->next;
+	}
+	return FALSE;
+}
+
+gboolean janus_events_is_plugin_wanted(const char *package) {
+	if(!janus_events_is_wanted(JANUS_EVENT_TYPE_PLUGIN, JANUS_EVENT_SUBTYPE_NONE))
+		return FALSE;
+	if(excluded_plugins != NULL && package != NULL) {
+		int i = 0;
+		for(i=0; excluded_plugins[i] != NULL; i++) {
+			if(!strcasecmp(package, excluded_plugins[i]))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...) {
 	/* This method has a variable list of arguments, depending on the event type */
 	va_list args;
 	va_start(args, session_id);
 
-	if(!eventsenabled || eventhandlers == NULL || g_hash_table_size(eventhandlers) == 0) {
-		/* Event handlers disabled, or no event handler plugins available: free resources, if needed */
+	if(!eventsenabled || eventhandlers == NULL || g_hash_table_size(eventhandlers) == 0 ||
+			!janus_events_is_wanted(type, subtype)) {
+		/* Event handlers disabled, no event handler plugins available, or
+		 * nobody interested in this event: free resources, if needed */
 		if(type == JANUS_EVENT_TYPE_MEDIA || type == JANUS_EVENT_TYPE_WEBRTC) {
 			/* These events allocate a json_t object for their data, skip some arguments and unref it */
 			va_arg(args, guint64);
@@ -140,8 +440,9 @@ void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...
 	json_object_set_new(event, "timestamp", json_integer(janus_get_real_time()));
 	if(type != JANUS_EVENT_TYPE_CORE && type != JANUS_EVENT_TYPE_EXTERNAL) {
 		/* Core and Admin API originated events don't have a session ID */
-		if(session_id == 0 && (type == JANUS_EVENT_TYPE_PLUGIN || type == JANUS_EVENT_TYPE_TRANSPORT)) {
-			/* ... but plugin/transport events may not have one either */
+		if(session_id == 0 && (type == JANUS_EVENT_TYPE_PLUGIN || type == JANUS_EVENT_TYPE_TRANSPORT ||
+				(type == JANUS_EVENT_TYPE_MEDIA && subtype == JANUS_EVENT_SUBTYPE_MEDIA_SUMMARY))) {
+			/* ... but plugin/transport events and media summaries may not have one either */
 		} else {
 			json_object_set_new(event, "session_id", json_integer(session_id));
 		}
@@ -207,7 +508,8 @@ void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...
 		case JANUS_EVENT_TYPE_MEDIA: {
 			/* For WebRTC and media-related events, there's the handle ID and a json_t object with info on what happened */
 			guint64 handle_id = va_arg(args, guint64);
-			json_object_set_new(event, "handle_id", json_integer(handle_id));
+			if(handle_id > 0)	/* Media summaries cover many handles, so they have none */
+				json_object_set_new(event, "handle_id", json_integer(handle_id));
 			char *opaque_id = va_arg(args, char *);
 			if(opaque_id != NULL)
 				json_object_set_new(event, "opaque_id", json_string(opaque_id));
@@ -270,56 +572,34 @@ void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...
 		json_decref(event);
 		return;
 	}
-	/* Enqueue the event */
-	g_async_queue_push(events, event);
+	/* Enqueue the event for all the interested handlers */
+	janus_events_dispatch(event);
 }
 
-void *janus_events_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Events handler thread\n");
+static void *janus_events_queue_thread(void *data) {
+	janus_events_queue *queue = (janus_events_queue *)data;
+	JANUS_LOG(LOG_VERB, "Joining Events handler thread (%s)\n", queue->handler->get_package());
 	json_t *event = NULL;
 
-	while(eventsenabled) {
+	while(TRUE) {
 		/* Any event in queue? */
-		event = g_async_queue_pop(events);
-		if(event == &exit_event)
+		janus_mutex_lock(&queue->mutex);
+		while(!queue->stop && g_queue_is_empty(queue->events))
+			janus_condition_wait(&queue->cond, &queue->mutex);
+		if(queue->stop) {
+			janus_mutex_unlock(&queue->mutex);
 			break;
-
-		/* Notify all interested handlers, increasing the event reference to make sure it's not lost because of errors */
-		int type = json_integer_value(json_object_get(event, "type"));
-		guint count = g_hash_table_size(eventhandlers);
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, eventhandlers);
-		json_incref(event);
-		while(g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_eventhandler *e = value;
-			if(e == NULL)
-				continue;
-			if(!janus_flags_is_set(&e->events_mask, type))
-				continue;
-			if(count == 1) {
-				/* Single event handler: pass this instance directly */
-				e->incoming_event(event);
-			} else {
-				/* Multiple event handlers, that may modify the event: pass a copy */
-				json_t *copy = json_deep_copy(event);
-				e->incoming_event(copy);
-				json_decref(copy);
-			}
 		}
-		json_decref(event);
+		event = g_queue_pop_head(queue->events);
+		queue->delivered++;
+		janus_mutex_unlock(&queue->mutex);
 
-		/* Unref the final event reference, interested handlers will have their own reference */
+		/* Notify the handler: it will take its own reference, if interested */
+		queue->handler->incoming_event(event);
 		json_decref(event);
 	}
 
-	/* Cleanup pending events */
-	while((event = g_async_queue_try_pop(events)) != NULL) {
-		if(event != &exit_event)
-			json_decref(event);
-	}
-
-	JANUS_LOG(LOG_VERB, "Leaving Events handler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving Events handler thread (%s)\n", queue->handler->get_package());
 	return NULL;
 }
 
@@ -16,6 +16,31 @@
 #include "debug.h"
 #include "events/eventhandler.h"
 
+/*! \brief What to do when the queue of events of a handler is full */
+typedef enum janus_events_overflow_policy {
+	/*! \brief Invalid policy */
+	janus_events_overflow_invalid = -1,
+	/*! \brief Drop the oldest queued event to make room for the new one */
+	janus_events_overflow_drop_oldest = 0,
+	/*! \brief Drop new events of some types (e.g., media), and the oldest event for the others */
+	janus_events_overflow_drop_types,
+	/*! \brief Only keep one new event out of N (dropping the oldest to make room) */
+	janus_events_overflow_sample
+} janus_events_overflow_policy;
+
+/*! \brief Helper to parse an overflow policy
+ * @param[in] policy The policy (drop_oldest, drop_types or sample)
+ * @returns The policy, or janus_events_overflow_invalid if unknown */
+janus_events_overflow_policy janus_events_overflow_policy_from_string(const char *policy);
+
+/*! \brief Configure how big the queues of events for handlers can be, and
+ * what to do when they're full (must be called before janus_events_init)
+ * @param[in] size Maximum number of events in each queue (0 means unlimited)
+ * @param[in] policy What to do when a queue is full
+ * @param[in] types Comma separated list of event types that can be dropped (drop_types policy only)
+ * @param[in] sample How many events to drop for each one we keep (sample policy only) */
+void janus_events_set_overflow(guint size, janus_events_overflow_policy policy, const char *types, guint sample);
+
 /*! \brief Initialize the event handlers broadcaster
  * @param[in] enabled Whether broadcasting events should be supported at all
  * @param[in] server_name The name of this server, to be added to all events
@@ -26,10 +51,36 @@ int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers)
 /*! \brief De-initialize the event handlers broadcaster */
 void janus_events_deinit(void);
 
+/*! \brief Helper to get the state of the queues of events of all handlers (Admin API)
+ * @returns A json_t object, indexed by handler package */
+json_t *janus_events_queues_info(void);
+
+/*! \brief Helper to get the current overflow settings (Admin API)
+ * @returns A json_t object */
+json_t *janus_events_overflow_info(void);
+
+/*! \brief Configure event subtypes and plugins no handler should ever receive
+ * events for (must be called before janus_events_init)
+ * @param[in] list Comma separated list of subtypes (e.g., webrtc.lcand or media.stats) and plugin packages */
+void janus_events_set_excluded(const char *list);
+
 /*! \brief Quick method to check whether event handlers are enabled at all or not
  * @returns TRUE if they're enabled, FALSE if not */
 gboolean janus_events_is_enabled(void);
 
+/*! \brief Quick method to check whether any handler would receive an event
+ * of a specific type and subtype, before preparing it: this takes no lock
+ * and allocates nothing, so it's meant to be used before building events
+ * @param[in] type Type of the event
+ * @param[in] subtype Subtype of the event, where applicable (0 if not)
+ * @returns TRUE if at least a handler is interested, FALSE otherwise */
+gboolean janus_events_is_wanted(int type, int subtype);
+
+/*! \brief Same as janus_events_is_wanted, for events originated by a plugin
+ * @param[in] package The package name of the plugin
+ * @returns TRUE if at least a handler is interested, FALSE otherwise */
+gboolean janus_events_is_plugin_wanted(const char *package);
+
 /*! \brief Notify an event to all interested handlers
  * @note According to the type of event to notify, different arguments may
  * be required and used in order to prepare the actual object to pass to handlers.
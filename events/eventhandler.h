@@ -101,7 +101,7 @@ janus_eventhandler *create(void) {
 
 
 /*! \brief Version of the API, to match the one event handler plugins were compiled against */
-#define JANUS_EVENTHANDLER_API_VERSION	3
+#define JANUS_EVENTHANDLER_API_VERSION	4
 
 /*! \brief Initialization of all event handler plugin properties to NULL
  *
@@ -171,6 +171,8 @@ static janus_eventhandler janus_fake_eventhandler_plugin =
 #define JANUS_EVENT_SUBTYPE_CORE_STARTUP	1
 /*! \brief Core event subtypes: shutdown */
 #define JANUS_EVENT_SUBTYPE_CORE_SHUTDOWN	2
+/*! \brief Core event subtypes: overload protection state changed */
+#define JANUS_EVENT_SUBTYPE_CORE_OVERLOAD	3
 /*! \brief WebRTC event subtypes: ICE state */
 #define JANUS_EVENT_SUBTYPE_WEBRTC_ICE		1
 /*! \brief WebRTC event subtypes: local candidate */
@@ -189,6 +191,8 @@ static janus_eventhandler janus_fake_eventhandler_plugin =
 #define JANUS_EVENT_SUBTYPE_MEDIA_SLOWLINK	2
 /*! \brief Media event subtypes: stats */
 #define JANUS_EVENT_SUBTYPE_MEDIA_STATS		3
+/*! \brief Media event subtypes: stats summary (all handles, column oriented) */
+#define JANUS_EVENT_SUBTYPE_MEDIA_SUMMARY	4
 ///@}
 
 #define JANUS_EVENTHANDLER_INIT(...) {			\
@@ -254,6 +258,9 @@ struct janus_eventhandler {
 	 * working threads, and so you'd most likely end up slowing it down. Just take note of it
 	 * and handle it somewhere else. It's your responsibility to \c json_decref the event
 	 * object once you're done with it: a failure to do so will result in memory leaks.
+	 * \note The same event object is shared with all the other event handlers, so it
+	 * MUST be considered read-only: if you need to modify it (e.g., to add properties),
+	 * do that on a copy (a shallow \c json_copy is usually enough) and release the original.
 	 * @param[in] event Jansson object containing the event details */
 	void (* const incoming_event)(json_t *event);
 
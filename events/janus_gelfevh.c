@@ -12,6 +12,11 @@
  * headers. UDP messages will be chunked automatically.
  * There is also compression available for UDP protocol, to save network bandwidth
  * while using a bit more CPU. This is not available for TCP due to GELF limitations
+ * Messages are prepared by the handler thread, and then queued for one or
+ * more sender threads, each with its own persistent connection (so with
+ * TCP you can have a pool of connections to Graylog) that is automatically
+ * reestablished when it breaks: chunks of large UDP messages are sent
+ * straight from the message, without copying them.
  *
  * \ingroup eventhandlers
  * \ref eventhandlers
@@ -30,6 +35,7 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include "../ip-utils.h"
 
@@ -42,6 +48,8 @@
 #define JANUS_GELFEVH_PACKAGE			"janus.eventhandler.gelfevh"
 
 #define MAX_GELF_CHUNKS 				128
+#define JANUS_GELFEVH_MAX_CONNECTIONS	8
+#define JANUS_GELFEVH_QUEUE_SIZE		10000
 
 /* Plugin methods */
 janus_eventhandler *create(void);
@@ -115,9 +123,44 @@ typedef enum janus_gelfevh_socket_type {
 } janus_gelfevh_socket_type;
 
 static int max_gelf_msg_len = 500;
-static int sockfd;
 /* Set TCP as Default transport */
 static janus_gelfevh_socket_type transport = JANUS_GELFEVH_SOCKET_TYPE_UDP;
+/* Incremented any time the backend changes, so that connections are reestablished */
+static volatile gint backend_version = 0;
+
+/* Serialized messages waiting to be sent */
+typedef struct janus_gelfevh_message {
+	char *payload;
+	size_t len;
+} janus_gelfevh_message;
+static GAsyncQueue *messages = NULL;
+static janus_gelfevh_message exit_message;
+static int max_queued = JANUS_GELFEVH_QUEUE_SIZE;
+static void janus_gelfevh_message_free(janus_gelfevh_message *message) {
+	if(!message || message == &exit_message)
+		return;
+	free(message->payload);
+	g_free(message);
+}
+
+/* Each sender thread has its own connection to the backend */
+typedef struct janus_gelfevh_connection {
+	int id;
+	int fd;
+	janus_gelfevh_socket_type type;
+	int version;
+	/* When we can try connecting again, after a failure */
+	gint64 retry;
+	/* Compression context and buffer, reused for all messages */
+	janus_gzip_stream *zstream;
+	int level;
+	char *compressed;
+	size_t compressed_size;
+	GThread *thread;
+} janus_gelfevh_connection;
+static janus_gelfevh_connection connections[JANUS_GELFEVH_MAX_CONNECTIONS];
+static int connections_num = 1;
+static void *janus_gelfevh_sender(void *data);
 
 /* Parameter validation (for tweaking via Admin API) */
 static struct janus_json_parameter request_parameters[] = {
@@ -127,6 +170,8 @@ static struct janus_json_parameter tweak_parameters[] = {
 	{"backend", JSON_STRING, 0},
 	{"port", JSON_STRING, 0},
 	{"max_gelf_msg_len", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_message_len", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"protocol", JSON_STRING, 0},
 	{"janus_gelfevh_socket_type", JSON_STRING, 0}
 };
 /* Error codes (for the tweaking via Admin API */
@@ -136,78 +181,82 @@ static struct janus_json_parameter tweak_parameters[] = {
 #define JANUS_GELFEVH_ERROR_UNKNOWN_ERROR		499
 
 /* Plugin implementation */
-static char *randstring(size_t length) {
-	static char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-	char *randomString = NULL;
-	int n;
-	if(length) {
-		randomString = g_malloc(sizeof(char) * (length + 1));
-		if(randomString) {
-			for(n = 0; n < (int)length; n++) {
-				int key = rand() % (int)(sizeof(charset) - 1);
-				randomString[n] = charset[key];
-			}
-			randomString[length] = '\0';
-		}
-	}
-	return randomString;
-}
-
-static int janus_gelfevh_connect(void) {
+static int janus_gelfevh_connect(janus_gelfevh_connection *conn) {
 	struct addrinfo *res = NULL;
 	janus_network_address addr;
 	janus_network_address_string_buffer addr_buf;
 	struct sockaddr_in servaddr;
 
-	if(getaddrinfo(backend, NULL, NULL, &res) != 0 ||
+	if(conn->fd > -1)
+		close(conn->fd);
+	conn->fd = -1;
+	/* The backend may be tweaked via Admin API in the meanwhile */
+	janus_mutex_lock(&evh_mutex);
+	conn->version = g_atomic_int_get(&backend_version);
+	char *address = g_strdup(backend), *service = g_strdup(port);
+	int sock_type = transport;
+	janus_mutex_unlock(&evh_mutex);
+
+	if(getaddrinfo(address, NULL, NULL, &res) != 0 ||
 				janus_network_address_from_sockaddr(res->ai_addr, &addr) != 0 ||
 				janus_network_address_to_string_buffer(&addr, &addr_buf) != 0) {
 		if(res)
 			freeaddrinfo(res);
-		JANUS_LOG(LOG_ERR, "Could not resolve address (%s): %d (%s)\n", backend, errno, strerror(errno));
+		JANUS_LOG(LOG_ERR, "Could not resolve address (%s): %d (%s)\n", address, errno, strerror(errno));
+		g_free(address);
+		g_free(service);
 		return -1;
 	}
 	char *host = g_strdup(janus_network_address_string_from_buffer(&addr_buf));
 	freeaddrinfo(res);
 
-	if((sockfd = socket(AF_INET, transport, 0)) < 0 ) {
+	int sockfd = -1;
+	if((sockfd = socket(AF_INET, sock_type, 0)) < 0 ) {
 		JANUS_LOG(LOG_ERR, "Socket creation failed: %d (%s)\n", errno, strerror(errno));
 		g_free(host);
+		g_free(address);
+		g_free(service);
 		return -1;
 	}
 
 	memset(&servaddr, 0, sizeof(servaddr));
 
 	servaddr.sin_family = AF_INET;
-	servaddr.sin_port = htons(atoi(port));
+	servaddr.sin_port = htons(atoi(service));
 	servaddr.sin_addr.s_addr = inet_addr(host);
 
 	if(connect(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
 		JANUS_LOG(LOG_ERR, "Connect to GELF host failed\n");
+		close(sockfd);
 		g_free(host);
+		g_free(address);
+		g_free(service);
 		return -1;
 	}
-	JANUS_LOG(LOG_INFO, "Connected to GELF backend: [%s:%s]\n", host, port);
+	JANUS_LOG(LOG_INFO, "[%d] Connected to GELF backend: [%s:%s]\n", conn->id, host, service);
+	conn->fd = sockfd;
+	conn->type = sock_type;
 	g_free(host);
+	g_free(address);
+	g_free(service);
 	return 0;
 }
 
-static char compressed_text[8192];
-static int janus_gelfevh_send(char *message) {
-	if(!message) {
+static int janus_gelfevh_send(janus_gelfevh_connection *conn, janus_gelfevh_message *message) {
+	if(!message || !message->payload) {
 		JANUS_LOG(LOG_WARN, "Message is NULL, not sending to GELF!\n");
 		return -1;
 	}
-	if(transport == JANUS_GELFEVH_SOCKET_TYPE_TCP) {
-		/* TCP */
-		int out_bytes = 0;
-		int length = strlen(message);
-		char *buffer = message;
+	if(conn->type == JANUS_GELFEVH_SOCKET_TYPE_TCP) {
+		/* TCP: messages are delimited by the terminating NUL */
+		size_t length = message->len + 1;
+		char *buffer = message->payload;
 		while(length > 0) {
-			out_bytes = send(sockfd, buffer, length + 1, 0);
+			ssize_t out_bytes = send(conn->fd, buffer, length, 0);
 			if(out_bytes <= 0) {
-				JANUS_LOG(LOG_WARN, "Sending TCP message failed, dropping event: %d (%s)\n", errno, strerror(errno));
-				close(sockfd);
+				JANUS_LOG(LOG_WARN, "[%d] Sending TCP message failed: %d (%s)\n", conn->id, errno, strerror(errno));
+				close(conn->fd);
+				conn->fd = -1;
 				return -1;
 			}
 			buffer += out_bytes;
@@ -215,61 +264,95 @@ static int janus_gelfevh_send(char *message) {
 		}
 	} else {
 		/* UDP chunking with headers. Check if we need to compress the data */
-		int len = strlen(message);
-		char *buf = message;
+		size_t len = message->len;
+		char *buf = message->payload;
 		if(compress) {
-			size_t compressed_len = 0;
-			compressed_len = janus_gzip_compress(compression,
-				message, strlen(message),
-				compressed_text, sizeof(compressed_text));
+			if(conn->zstream == NULL || conn->level != compression) {
+				janus_gzip_stream_destroy(conn->zstream);
+				conn->level = compression;
+				conn->zstream = janus_gzip_stream_create(conn->level);
+			}
+			size_t bound = janus_gzip_stream_bound(conn->zstream, len);
+			if(bound > conn->compressed_size) {
+				conn->compressed = g_realloc(conn->compressed, bound);
+				conn->compressed_size = bound;
+			}
+			size_t compressed_len = janus_gzip_stream_compress(conn->zstream,
+				message->payload, message->len, conn->compressed, conn->compressed_size);
 			if(compressed_len == 0) {
-				JANUS_LOG(LOG_WARN, "Failed to compress event (%zu bytes), sending message uncompressed\n", strlen(message));
+				JANUS_LOG(LOG_WARN, "Failed to compress event (%zu bytes), sending message uncompressed\n", message->len);
 				/* Sending message uncompressed */
 			} else {
 				len = compressed_len;
-				buf = compressed_text;
+				buf = conn->compressed;
 			}
 		}
 
-		int total = len / max_gelf_msg_len + 1;
+		size_t max_len = g_atomic_int_get(&max_gelf_msg_len);
+		size_t total = (len + max_len - 1) / max_len;
 		if(total > MAX_GELF_CHUNKS) {
 			JANUS_LOG(LOG_WARN, "Event not sent! GELF allows %d number of chunks, try increasing max_gelf_msg_len\n", MAX_GELF_CHUNKS);
 			return -1;
 		}
 		/* Do we need to chunk the message */
-		if(total == 1) {
-			int n = send(sockfd, buf, len, 0);
+		if(total <= 1) {
+			ssize_t n = send(conn->fd, buf, len, 0);
 			if(n < 0) {
-				JANUS_LOG(LOG_WARN, "Sending UDP message failed, dropping event: %d (%s)\n", errno, strerror(errno));
+				JANUS_LOG(LOG_WARN, "[%d] Sending UDP message failed, dropping event: %d (%s)\n", conn->id, errno, strerror(errno));
 				return -1;
 			}
 			return 0;
-		} else {
-			int offset = 0;
-			char *rnd = randstring(8);
-			int i;
-			for(i = 0; i < total; i++) {
-				int bytesToSend = ((offset + max_gelf_msg_len) < len) ? max_gelf_msg_len : (len - offset);
-				/* Prepend the necessary headers (imitate TCP) */
-				char chunk[bytesToSend + 12];
-				chunk[0] = 0x1e;
-				chunk[1] = 0x0f;
-				memcpy(chunk + 2, rnd, 8);
-				chunk[10] = (char)i;
-				chunk[11] = (char)total;
-				char *head = chunk;
-				memcpy(head+12, buf, bytesToSend);
-				buf += bytesToSend;
-				int n = send(sockfd, head, bytesToSend + 12, 0);
-				if(n < 0) {
-					JANUS_LOG(LOG_WARN, "Sending UDP message failed: %d (%s)\n", errno, strerror(errno));
-					return -1;
-				}
-				offset += bytesToSend;
-				memset(chunk, 0, sizeof chunk);
+		}
+		/* Each chunk is its own datagram, made of the GELF chunk header
+		 * followed by the portion of the message, which we don't copy */
+		guint8 headers[MAX_GELF_CHUNKS][12];
+		struct iovec iov[MAX_GELF_CHUNKS][2];
+		guint64 id = janus_random_uint64();
+		size_t i = 0, offset = 0;
+		for(i = 0; i < total; i++) {
+			size_t bytesToSend = ((offset + max_len) < len) ? max_len : (len - offset);
+			headers[i][0] = 0x1e;
+			headers[i][1] = 0x0f;
+			memcpy(&headers[i][2], &id, 8);
+			headers[i][10] = (guint8)i;
+			headers[i][11] = (guint8)total;
+			iov[i][0].iov_base = headers[i];
+			iov[i][0].iov_len = 12;
+			iov[i][1].iov_base = buf + offset;
+			iov[i][1].iov_len = bytesToSend;
+			offset += bytesToSend;
+		}
+#ifdef HAVE_SENDMMSG
+		/* Send all the chunks with as few syscalls as possible */
+		struct mmsghdr chunks[MAX_GELF_CHUNKS];
+		memset(chunks, 0, total * sizeof(struct mmsghdr));
+		for(i = 0; i < total; i++) {
+			chunks[i].msg_hdr.msg_iov = iov[i];
+			chunks[i].msg_hdr.msg_iovlen = 2;
+		}
+		i = 0;
+		while(i < total) {
+			int n = sendmmsg(conn->fd, chunks + i, total - i, 0);
+			if(n < 0) {
+				if(errno == EINTR)
+					continue;
+				JANUS_LOG(LOG_WARN, "[%d] Sending UDP message failed: %d (%s)\n", conn->id, errno, strerror(errno));
+				return -1;
+			}
+			i += n;
+		}
+#else
+		struct msghdr chunk;
+		memset(&chunk, 0, sizeof(chunk));
+		for(i = 0; i < total; i++) {
+			chunk.msg_iov = iov[i];
+			chunk.msg_iovlen = 2;
+			if(sendmsg(conn->fd, &chunk, 0) < 0) {
+				JANUS_LOG(LOG_WARN, "[%d] Sending UDP message failed: %d (%s)\n", conn->id, errno, strerror(errno));
+				return -1;
 			}
-			g_free(rnd);
 		}
+#endif
 	}
 	return 0;
 }
@@ -330,6 +413,25 @@ int janus_gelfevh_init(const char *config_path) {
 				JANUS_LOG(LOG_WARN, "Missing or invalid transport, using default: UDP\n");
 			}
 		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "connections");
+		if(item && item->value) {
+			int n = atoi(item->value);
+			if(n < 1 || n > JANUS_GELFEVH_MAX_CONNECTIONS) {
+				JANUS_LOG(LOG_WARN, "Invalid connections value '%s' (must be between 1 and %d), using default: %d\n",
+					item->value, JANUS_GELFEVH_MAX_CONNECTIONS, connections_num);
+			} else {
+				connections_num = n;
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "max_queued");
+		if(item && item->value) {
+			int n = atoi(item->value);
+			if(n < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid max_queued value '%s', using default: %d\n", item->value, max_queued);
+			} else {
+				max_queued = n;
+			}
+		}
 		item = janus_config_get(config, config_general, janus_config_type_item, "max_message_len");
 		if(item && item->value) {
 			if(atoi(item->value) == 0) {
@@ -376,19 +478,46 @@ done:
 	}
 	JANUS_LOG(LOG_VERB, "GELF event handler configured: %s:%s\n", backend, port);
 
-	/* Check if connection failed. Error is logged in janus_gelfevh_connect function */
-	if(janus_gelfevh_connect() < 0 ) {
+	janus_mutex_init(&evh_mutex);
+	int i = 0;
+	for(i=0; i<JANUS_GELFEVH_MAX_CONNECTIONS; i++) {
+		memset(&connections[i], 0, sizeof(janus_gelfevh_connection));
+		connections[i].id = i;
+		connections[i].fd = -1;
+	}
+	/* Check if connection failed. Error is logged in janus_gelfevh_connect function:
+	 * the other connections, if any, are established by their threads */
+	if(janus_gelfevh_connect(&connections[0]) < 0 ) {
 		return -1;
 	}
 
-	/* Initialize the events queue */
+	/* Initialize the events and messages queues */
 	events = g_async_queue_new_full((GDestroyNotify) janus_gelfevh_event_free);
-	janus_mutex_init(&evh_mutex);
+	messages = g_async_queue_new_full((GDestroyNotify) janus_gelfevh_message_free);
 
 	g_atomic_int_set(&initialized, 1);
 
-	/* Launch the thread that will handle incoming events */
+	/* Launch the threads that will send the messages */
 	GError *error = NULL;
+	for(i=0; i<connections_num; i++) {
+		char tname[32];
+		g_snprintf(tname, sizeof(tname), "gelfevh sender %d", i);
+		connections[i].thread = g_thread_try_new(tname, janus_gelfevh_sender, &connections[i], &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the GelfEventHandler sender thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			error = NULL;
+			if(i == 0) {
+				g_atomic_int_set(&initialized, 0);
+				return -1;
+			}
+			/* Go on with the connections we have */
+			connections_num = i;
+			break;
+		}
+	}
+	/* Launch the thread that will handle incoming events */
 	handler_thread = g_thread_try_new("janus gelfevh handler", janus_gelfevh_handler, NULL, &error);
 	if(error != NULL) {
 		g_atomic_int_set(&initialized, 0);
@@ -411,17 +540,37 @@ void janus_gelfevh_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* Wake all the senders */
+	int i = 0;
+	for(i=0; i<connections_num; i++)
+		g_async_queue_push(messages, &exit_message);
+	for(i=0; i<JANUS_GELFEVH_MAX_CONNECTIONS; i++) {
+		janus_gelfevh_connection *conn = &connections[i];
+		if(conn->thread != NULL) {
+			g_thread_join(conn->thread);
+			conn->thread = NULL;
+		}
+		if(conn->fd > -1)
+			close(conn->fd);
+		conn->fd = -1;
+		janus_gzip_stream_destroy(conn->zstream);
+		conn->zstream = NULL;
+		g_free(conn->compressed);
+		conn->compressed = NULL;
+		conn->compressed_size = 0;
+	}
 
 	g_async_queue_unref(events);
 	events = NULL;
+	g_async_queue_unref(messages);
+	messages = NULL;
 
 	g_free(backend);
+	g_free(port);
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 
-	close(sockfd);
-
 	JANUS_LOG(LOG_INFO, "%s destroyed!\n", JANUS_GELFEVH_NAME);
 }
 
@@ -510,14 +659,15 @@ json_t *janus_gelfevh_handle_request(json_t *request) {
 		if(json_object_get(request, "port"))
 			req_port = json_string_value(json_object_get(request, "port"));
 		if(json_object_get(request, "max_message_len"))
-			max_gelf_msg_len = json_integer_value(json_object_get(request, "max_message_len"));
-		if(strcasecmp(json_string_value(json_object_get(request, "protocol")), "tcp") == 0) {
-			transport = JANUS_GELFEVH_SOCKET_TYPE_TCP;
-		} else if(strcasecmp(json_string_value(json_object_get(request, "protocol")), "udp") == 0) {
-			transport = JANUS_GELFEVH_SOCKET_TYPE_UDP;
+			g_atomic_int_set(&max_gelf_msg_len, json_integer_value(json_object_get(request, "max_message_len")));
+		const char *req_protocol = json_string_value(json_object_get(request, "protocol"));
+		janus_gelfevh_socket_type req_transport = JANUS_GELFEVH_SOCKET_TYPE_UDP;
+		if(req_protocol && strcasecmp(req_protocol, "tcp") == 0) {
+			req_transport = JANUS_GELFEVH_SOCKET_TYPE_TCP;
+		} else if(req_protocol && strcasecmp(req_protocol, "udp") == 0) {
+			req_transport = JANUS_GELFEVH_SOCKET_TYPE_UDP;
 		} else {
 			JANUS_LOG(LOG_WARN, "Missing or invalid transport, using default: UDP\n");
-			transport = JANUS_GELFEVH_SOCKET_TYPE_UDP;
 		}
 		if(!req_backend || !req_port) {
 			/* Invalid backend address or port */
@@ -527,6 +677,7 @@ json_t *janus_gelfevh_handle_request(json_t *request) {
 		}
 		/* If we got here, we can enforce */
 		janus_mutex_lock(&evh_mutex);
+		transport = req_transport;
 		if(req_events)
 			janus_events_edit_events_mask(req_events, &janus_gelfevh.events_mask);
 		if(req_compress > -1) {
@@ -545,6 +696,8 @@ json_t *janus_gelfevh_handle_request(json_t *request) {
 			backend = g_strdup(req_backend);
 			port = g_strdup(req_port);
 		}
+		/* Have the senders connect again, with the (possibly) new settings */
+		g_atomic_int_inc(&backend_version);
 		janus_mutex_unlock(&evh_mutex);
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
@@ -589,22 +742,33 @@ static void *janus_gelfevh_handler(void *data) {
 			json_t *microtimestamp = json_object_get(event, "timestamp");
 			if(microtimestamp && json_is_integer(microtimestamp)) {
 				double created_timestamp = (double)json_integer_value(microtimestamp) / 1000000;
-				json_object_set(output, "timestamp", json_real(created_timestamp));
+				json_object_set_new(output, "timestamp", json_real(created_timestamp));
 			} else {
-				json_object_set(output, "timestamp", json_real(janus_get_real_time()));
+				json_object_set_new(output, "timestamp", json_real(janus_get_real_time()));
 			}
 			json_object_set(output, "host", json_object_get(event, "emitter"));
-			json_object_set(output, "version", json_string("1.1"));
+			json_object_set_new(output, "version", json_string("1.1"));
 			json_object_set(output, "level", json_object_get(event, "type"));
-			json_object_set(output, "short_message", json_string(short_message));
+			json_object_set_new(output, "short_message", json_string(short_message));
 			json_object_set(output, "full_message", event);
 
-			if(janus_gelfevh_send(json_dumps(output, json_format)) < 0) {
-				JANUS_LOG(LOG_WARN, "Couldn't send event to GELF, reconnect?, or event was null: %s\n",
-					json_dumps(output, json_format));
-			}
+			/* Serialize the message, and leave the actual sending to the senders */
+			char *payload = json_dumps(output, json_format);
 			json_decref(output);
 			output = NULL;
+			if(payload == NULL) {
+				JANUS_LOG(LOG_WARN, "Couldn't serialize event for GELF\n");
+				break;
+			}
+			if(g_async_queue_length(messages) >= max_queued) {
+				JANUS_LOG(LOG_WARN, "Too many messages waiting to be sent to GELF, dropping event\n");
+				free(payload);
+				break;
+			}
+			janus_gelfevh_message *message = g_malloc(sizeof(janus_gelfevh_message));
+			message->payload = payload;
+			message->len = strlen(payload);
+			g_async_queue_push(messages, message);
 
 			break;
 		}
@@ -612,3 +776,45 @@ static void *janus_gelfevh_handler(void *data) {
 	JANUS_LOG(LOG_VERB, "Leaving GELF Event handler thread\n");
 	return NULL;
 }
+
+/* Thread to send serialized messages on a connection */
+static void *janus_gelfevh_sender(void *data) {
+	janus_gelfevh_connection *conn = (janus_gelfevh_connection *)data;
+	JANUS_LOG(LOG_VERB, "[%d] Joining GelfEventHandler sender thread\n", conn->id);
+	janus_gelfevh_message *message = NULL;
+
+	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
+		message = g_async_queue_pop(messages);
+		if(message == NULL)
+			continue;
+		if(message == &exit_message)
+			break;
+		/* Make sure we're connected, and with the current settings */
+		gint64 now = janus_get_monotonic_time();
+		if((conn->fd < 0 || conn->version != g_atomic_int_get(&backend_version)) && now >= conn->retry) {
+			if(janus_gelfevh_connect(conn) < 0) {
+				/* Don't try again for a while */
+				conn->retry = now + G_USEC_PER_SEC;
+			}
+		}
+		if(conn->fd < 0) {
+			JANUS_LOG(LOG_WARN, "[%d] Not connected to GELF, dropping event\n", conn->id);
+			janus_gelfevh_message_free(message);
+			continue;
+		}
+		if(janus_gelfevh_send(conn, message) < 0) {
+			/* If the TCP connection broke, try once more on a new one */
+			if(conn->fd < 0 && janus_gelfevh_connect(conn) == 0) {
+				if(janus_gelfevh_send(conn, message) < 0)
+					JANUS_LOG(LOG_WARN, "[%d] Couldn't send event to GELF, dropping it\n", conn->id);
+			} else {
+				if(conn->fd < 0)
+					conn->retry = now + G_USEC_PER_SEC;
+				JANUS_LOG(LOG_WARN, "[%d] Couldn't send event to GELF, dropping it\n", conn->id);
+			}
+		}
+		janus_gelfevh_message_free(message);
+	}
+	JANUS_LOG(LOG_VERB, "[%d] Leaving GELF Event handler sender thread\n", conn->id);
+	return NULL;
+}
@@ -1181,6 +1181,10 @@ static void *janus_mqttevh_handler(void *data) {
 		/* Hack to test new functions */
 		if(elabel && ename) {
 			JANUS_LOG(LOG_HUGE, "Event label %s, name %s\n", elabel, ename);
+			/* The event is shared with other handlers, so we add the property to a copy */
+			json_t *copy = json_copy(event);
+			json_decref(event);
+			event = copy;
 			json_object_set_new(event, "eventtype", json_string(ename));
 		} else {
 			JANUS_LOG(LOG_WARN, "Can't get event label or name\n");
@@ -2,7 +2,11 @@
  * \author Lorenzo Miniero <lorenzo@meetecho.com>
  * \copyright GNU General Public License v3
  * \brief  Janus NanomsgEventHandler plugin
- * \details  This is a trivial Nanomsg event handler plugin for Janus
+ * \details  This is a trivial Nanomsg event handler plugin for Janus.
+ * Events are serialized straight to buffers allocated by Nanomsg, which
+ * are then sent with \c NN_MSG and so never copied again: multiple worker
+ * threads can be configured, each with its own socket connected to the
+ * same address, to carry higher rates of events.
  *
  * \ingroup eventhandlers
  * \ref eventhandlers
@@ -14,9 +18,9 @@
 
 #include <nanomsg/nn.h>
 #include <nanomsg/pubsub.h>
+#include <nanomsg/bus.h>
 #include <nanomsg/inproc.h>
 #include <nanomsg/ipc.h>
-#include <nanomsg/pipeline.h>
 
 #include "../debug.h"
 #include "../config.h"
@@ -76,11 +80,11 @@ janus_eventhandler *create(void) {
 
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
-static GThread *pub_thread, *handler_thread;
+static GThread *handler_thread;
 static void *janus_nanomsgevh_thread(void *data);
 static void *janus_nanomsgevh_handler(void *data);
 
-/* Queue of events to handle */
+/* Queue of events to handle, and of serialized events to send */
 static GAsyncQueue *events = NULL, *nfd_queue = NULL;
 static gboolean group_events = TRUE;
 static json_t exit_event;
@@ -89,12 +93,75 @@ static void janus_nanomsgevh_event_free(json_t *event) {
 		return;
 	json_decref(event);
 }
+static char exit_message;
+static void janus_nanomsgevh_message_free(void *message) {
+	if(!message || message == &exit_message)
+		return;
+	(void)nn_freemsg(message);
+}
 
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
-/* Nanomsg stuff */
-static int nfd = -1, nfd_addr = -1, write_nfd[2];
+/* Nanomsg stuff: each worker thread has its own socket */
+typedef struct janus_nanomsgevh_worker {
+	int nfd, nfd_addr;
+	GThread *thread;
+} janus_nanomsgevh_worker;
+static janus_nanomsgevh_worker *workers = NULL;
+static int workers_num = 0;
+#define JANUS_NANOMSGEVH_MAX_WORKERS	16
+
+/* Helper to serialize an event straight to a Nanomsg buffer, which we
+ * can then pass to nn_send() with NN_MSG, so that it doesn't copy it */
+static void *janus_nanomsgevh_dump(json_t *event) {
+#if JANSSON_VERSION_HEX >= 0x020a00
+	size_t size = json_dumpb(event, NULL, 0, json_format);
+	if(size == 0)
+		return NULL;
+	void *buffer = nn_allocmsg(size, 0);
+	if(buffer == NULL)
+		return NULL;
+	json_dumpb(event, buffer, size, json_format);
+	return buffer;
+#else
+	/* This version of Jansson can't serialize to a buffer we provide */
+	char *payload = json_dumps(event, json_format);
+	if(payload == NULL)
+		return NULL;
+	size_t size = strlen(payload);
+	void *buffer = nn_allocmsg(size, 0);
+	if(buffer != NULL)
+		memcpy(buffer, payload, size);
+	free(payload);
+	return buffer;
+#endif
+}
+
+
+/* Helper to stop the worker threads, and close their sockets */
+static void janus_nanomsgevh_workers_stop(void) {
+	int i = 0;
+	for(i=0; i<workers_num; i++) {
+		if(workers[i].thread != NULL)
+			g_async_queue_push(nfd_queue, &exit_message);
+	}
+	for(i=0; i<workers_num; i++) {
+		janus_nanomsgevh_worker *worker = &workers[i];
+		if(worker->thread != NULL) {
+			g_thread_join(worker->thread);
+			worker->thread = NULL;
+		}
+		if(worker->nfd > -1) {
+			nn_shutdown(worker->nfd, worker->nfd_addr);
+			nn_close(worker->nfd);
+			worker->nfd = -1;
+		}
+	}
+	g_free(workers);
+	workers = NULL;
+	workers_num = 0;
+}
 
 
 /* Parameter validation (for tweaking via Admin API) */
@@ -173,17 +240,6 @@ int janus_nanomsgevh_init(const char *config_path) {
 	if(item && item->value)
 		group_events = janus_is_true(item->value);
 
-	/* First of all, initialize the pipeline for writeable notifications */
-	write_nfd[0] = nn_socket(AF_SP, NN_PULL);
-	write_nfd[1] = nn_socket(AF_SP, NN_PUSH);
-	if(nn_bind(write_nfd[0], "inproc://janusevh") < 0) {
-		JANUS_LOG(LOG_ERR, "Error configuring internal Nanomsg pipeline... %d (%s)\n", errno, nn_strerror(errno));
-		goto error;
-	}
-	if(nn_connect(write_nfd[1], "inproc://janusevh") < 0) {
-		JANUS_LOG(LOG_ERR, "Error configuring internal Nanomsg pipeline...%d (%s)\n", errno, nn_strerror(errno));
-		goto error;
-	}
 	/* Handle the Nanomsg configuration */
 	item = janus_config_get(config, config_general, janus_config_type_item, "address");
 	const char *address = item && item->value ? item->value : NULL;
@@ -191,49 +247,81 @@ int janus_nanomsgevh_init(const char *config_path) {
 	const char *mode = item && item->value ? item->value : NULL;
 	if(mode == NULL)
 		mode = "connect";
-	nfd = nn_socket(AF_SP, NN_PUB);
-	if(nfd < 0) {
-		JANUS_LOG(LOG_ERR, "Error creating Nanomsg event handler socket: %d (%s)\n", errno, nn_strerror(errno));
+	if(strcasecmp(mode, "bind") && strcasecmp(mode, "connect")) {
+		/* Unsupported mode */
+		JANUS_LOG(LOG_ERR, "Unsupported mode '%s'\n", mode);
 		goto error;
 	}
-	if(!strcasecmp(mode, "bind")) {
-		/* Bind to this address */
-		nfd_addr = nn_bind(nfd, address);
-		if(nfd_addr < 0) {
-			JANUS_LOG(LOG_ERR, "Error binding Nanomsg event handler socket to address '%s': %d (%s)\n",
-				address, errno, nn_strerror(errno));
-			goto error;
+	item = janus_config_get(config, config_general, janus_config_type_item, "pattern");
+	int protocol = NN_PUB;
+	if(item && item->value && !strcasecmp(item->value, "bus")) {
+		protocol = NN_BUS;
+	} else if(item && item->value && strcasecmp(item->value, "pubsub")) {
+		JANUS_LOG(LOG_ERR, "Unsupported pattern '%s'\n", item->value);
+		goto error;
+	}
+	workers_num = 1;
+	item = janus_config_get(config, config_general, janus_config_type_item, "workers");
+	if(item && item->value) {
+		workers_num = atoi(item->value);
+		if(workers_num < 1 || workers_num > JANUS_NANOMSGEVH_MAX_WORKERS) {
+			JANUS_LOG(LOG_WARN, "Invalid number of workers '%s', using 1\n", item->value);
+			workers_num = 1;
+		} else if(workers_num > 1 && !strcasecmp(mode, "bind")) {
+			/* We can't bind more sockets to the same address */
+			JANUS_LOG(LOG_WARN, "Multiple workers are only supported in 'connect' mode, using 1\n");
+			workers_num = 1;
 		}
-	} else if(!strcasecmp(mode, "connect")) {
-		/* Connect to this address */
-		nfd_addr = nn_connect(nfd, address);
-		if(nfd_addr < 0) {
-			JANUS_LOG(LOG_ERR, "Error connecting Nanomsg event handler socket to address '%s': %d (%s)\n",
-				address, errno, nn_strerror(errno));
+	}
+	workers = g_malloc0(workers_num * sizeof(janus_nanomsgevh_worker));
+	int i = 0;
+	for(i=0; i<workers_num; i++)
+		workers[i].nfd = -1;
+	for(i=0; i<workers_num; i++) {
+		janus_nanomsgevh_worker *worker = &workers[i];
+		worker->nfd = nn_socket(AF_SP, protocol);
+		if(worker->nfd < 0) {
+			JANUS_LOG(LOG_ERR, "Error creating Nanomsg event handler socket: %d (%s)\n", errno, nn_strerror(errno));
 			goto error;
 		}
-	} else {
-		/* Unsupported mode */
-		JANUS_LOG(LOG_ERR, "Unsupported mode '%s'\n", mode);
-		goto error;
+		if(!strcasecmp(mode, "bind")) {
+			/* Bind to this address */
+			worker->nfd_addr = nn_bind(worker->nfd, address);
+			if(worker->nfd_addr < 0) {
+				JANUS_LOG(LOG_ERR, "Error binding Nanomsg event handler socket to address '%s': %d (%s)\n",
+					address, errno, nn_strerror(errno));
+				goto error;
+			}
+		} else {
+			/* Connect to this address */
+			worker->nfd_addr = nn_connect(worker->nfd, address);
+			if(worker->nfd_addr < 0) {
+				JANUS_LOG(LOG_ERR, "Error connecting Nanomsg event handler socket to address '%s': %d (%s)\n",
+					address, errno, nn_strerror(errno));
+				goto error;
+			}
+		}
 	}
 
 	/* Initialize the events queue */
 	events = g_async_queue_new_full((GDestroyNotify) janus_nanomsgevh_event_free);
-	nfd_queue = g_async_queue_new_full((GDestroyNotify) g_free);
+	nfd_queue = g_async_queue_new_full((GDestroyNotify) janus_nanomsgevh_message_free);
 	g_atomic_int_set(&initialized, 1);
 
-	/* Start the Nanomsg and event handler threads */
+	/* Start the Nanomsg worker threads and the event handler thread */
 	GError *error = NULL;
-	handler_thread = g_thread_try_new("janus nanomsgevh thread", janus_nanomsgevh_thread, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&initialized, 0);
-		JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the NanomsgEventHandler loop thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		goto error;
+	for(i=0; i<workers_num; i++) {
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "nanomsgevh %d", i);
+		workers[i].thread = g_thread_try_new(tname, janus_nanomsgevh_thread, &workers[i], &error);
+		if(error != NULL) {
+			g_atomic_int_set(&initialized, 0);
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the NanomsgEventHandler loop thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			goto error;
+		}
 	}
-	error = NULL;
 	handler_thread = g_thread_try_new("janus nanomsgevh handler", janus_nanomsgevh_handler, NULL, &error);
 	if(error != NULL) {
 		g_atomic_int_set(&initialized, 0);
@@ -250,14 +338,7 @@ int janus_nanomsgevh_init(const char *config_path) {
 error:
 	/* If we got here, something went wrong */
 	success = FALSE;
-	if(write_nfd[0] > -1)
-		nn_close(write_nfd[0]);
-	if(write_nfd[1] > -1)
-		nn_close(write_nfd[1]);
-	if(nfd > -1) {
-		nn_shutdown(nfd, nfd_addr);
-		nn_close(nfd);
-	}
+	janus_nanomsgevh_workers_stop();
 	/* Fall through */
 done:
 	if(config)
@@ -275,15 +356,11 @@ void janus_nanomsgevh_destroy(void) {
 	g_atomic_int_set(&stopping, 1);
 
 	g_async_queue_push(events, &exit_event);
-	(void)nn_send(write_nfd[1], "x", 1, 0);
-	if(pub_thread != NULL) {
-		g_thread_join(pub_thread);
-		pub_thread = NULL;
-	}
 	if(handler_thread != NULL) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	janus_nanomsgevh_workers_stop();
 
 	g_async_queue_unref(events);
 	events = NULL;
@@ -393,7 +470,7 @@ plugin_response:
 static void *janus_nanomsgevh_handler(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining NanomsgEventHandler handler thread\n");
 	json_t *event = NULL, *output = NULL;
-	char *event_text = NULL;
+	void *event_text = NULL;
 	int count = 0, max = group_events ? 100 : 1;
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
@@ -432,9 +509,9 @@ static void *janus_nanomsgevh_handler(void *data) {
 
 		if(!g_atomic_int_get(&stopping)) {
 			/* Since this a simple plugin, it does the same for all events: so just convert to string... */
-			event_text = json_dumps(output, json_format);
-			g_async_queue_push(nfd_queue, event_text);
-			(void)nn_send(write_nfd[1], "x", 1, 0);
+			event_text = janus_nanomsgevh_dump(output);
+			if(event_text != NULL)
+				g_async_queue_push(nfd_queue, event_text);
 		}
 
 		/* Done, let's unref the event */
@@ -446,70 +523,27 @@ static void *janus_nanomsgevh_handler(void *data) {
 }
 
 /* Thread */
-void *janus_nanomsgevh_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining NanomsgEventHandler loop thread\n");
-
-	int fds = 0;
-	struct nn_pollfd poll_nfds[2];
-	char buffer[1];
-
-	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		/* Prepare poll list of file descriptors */
-		fds = 0;
-		/* Writeable monitor */
-		poll_nfds[fds].fd = write_nfd[0];
-		poll_nfds[fds].events = NN_POLLIN;
-		fds++;
-		/* Publisher socket */
-		if(nfd > -1 && g_async_queue_length(nfd_queue) > 0) {
-			poll_nfds[fds].fd = nfd;
-			poll_nfds[fds].events |= NN_POLLOUT;
-			fds++;
-		}
-		/* Start polling */
-		int res = nn_poll(poll_nfds, fds, -1);
-		if(res == 0)
-			continue;
-		if(res < 0) {
-			if(errno == EINTR) {
-				JANUS_LOG(LOG_HUGE, "Got an EINTR (%s) polling the Nanomsg descriptors, ignoring...\n", nn_strerror(errno));
-				continue;
-			}
-			JANUS_LOG(LOG_ERR, "poll() failed: %d (%s)\n", errno, nn_strerror(errno));
+static void *janus_nanomsgevh_thread(void *data) {
+	janus_nanomsgevh_worker *worker = (janus_nanomsgevh_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining NanomsgEventHandler loop thread (socket %d)\n", worker->nfd);
+
+	void *payload = NULL;
+	while(TRUE) {
+		payload = g_async_queue_pop(nfd_queue);
+		if(payload == &exit_message)
 			break;
+		/* Nanomsg takes ownership of the buffer, when the send succeeds: since
+		 * we never block here, events are dropped if the peers can't keep up */
+		int res = nn_send(worker->nfd, &payload, NN_MSG, NN_DONTWAIT);
+		if(res < 0) {
+			JANUS_LOG(LOG_HUGE, "Error sending event on %d: %d (%s)\n", worker->nfd, errno, nn_strerror(errno));
+			(void)nn_freemsg(payload);
+			continue;
 		}
-		int i = 0;
-		for(i=0; i<fds; i++) {
-			/* FIXME Is there a Nanomsg equivalent of POLLERR? */
-			if(poll_nfds[i].revents & NN_POLLOUT) {
-				/* Find the client from its file descriptor */
-				if(poll_nfds[i].fd == nfd) {
-					char *payload = NULL;
-					while((payload = g_async_queue_try_pop(nfd_queue)) != NULL) {
-						int res = nn_send(poll_nfds[i].fd, payload, strlen(payload), 0);
-						/* FIXME Should we check if sent everything? */
-						JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, strlen(payload), poll_nfds[i].fd);
-						g_free(payload);
-					}
-				}
-			}
-			if(poll_nfds[i].revents & NN_POLLIN) {
-				if(poll_nfds[i].fd == write_nfd[0]) {
-					/* Read and ignore: we use this to unlock the poll if there's data to write */
-					(void)nn_recv(poll_nfds[i].fd, buffer, sizeof(buffer), 0);
-				}
-			}
-		}
-	}
-
-	nn_close(write_nfd[0]);
-	nn_close(write_nfd[1]);
-	if(nfd > -1) {
-		nn_shutdown(nfd, nfd_addr);
-		nn_close(nfd);
+		JANUS_LOG(LOG_HUGE, "Written %d bytes on %d\n", res, worker->nfd);
 	}
 
 	/* Done */
-	JANUS_LOG(LOG_VERB, "Leaving NanomsgEventHandler loop thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving NanomsgEventHandler loop thread (socket %d)\n", worker->nfd);
 	return NULL;
 }
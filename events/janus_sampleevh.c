@@ -76,6 +76,7 @@ janus_eventhandler *create(void) {
 static volatile gint initialized = 0, stopping = 0;
 static GThread *handler_thread;
 static void *janus_sampleevh_handler(void *data);
+static void *janus_sampleevh_sender(void *data);
 static janus_mutex evh_mutex;
 
 /* JSON serialization options */
@@ -94,6 +95,41 @@ static void janus_sampleevh_event_free(json_t *event) {
 		return;
 	json_decref(event);
 }
+/* Batches are closed when they have batch_events events, or when the
+ * first event in the batch has waited batch_timeout milliseconds */
+static int batch_events = 100;
+static int batch_timeout = 0;
+
+/* Batches of events, serialized (and compressed, if needed) and ready to be sent */
+typedef struct janus_sampleevh_batch {
+	char *payload;
+	size_t len;
+	gboolean compressed;
+	int events;
+} janus_sampleevh_batch;
+static janus_sampleevh_batch exit_batch;
+static void janus_sampleevh_batch_free(janus_sampleevh_batch *batch) {
+	if(!batch || batch == &exit_batch)
+		return;
+	g_free(batch->payload);
+	g_free(batch);
+}
+static GAsyncQueue *batches = NULL;
+/* Threads sending the batches: each has a POST in flight at most */
+#define JANUS_SAMPLEEVH_MAX_INFLIGHT	16
+static GThread *senders[JANUS_SAMPLEEVH_MAX_INFLIGHT];
+static int senders_num = 1;
+/* cURL share handle, to reuse connections (and DNS lookups) across senders */
+static CURLSH *curl_share = NULL;
+static janus_mutex curl_share_mutex[CURL_LOCK_DATA_LAST];
+static void janus_sampleevh_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+	if(data >= 0 && data < CURL_LOCK_DATA_LAST)
+		janus_mutex_lock(&curl_share_mutex[data]);
+}
+static void janus_sampleevh_share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+	if(data >= 0 && data < CURL_LOCK_DATA_LAST)
+		janus_mutex_unlock(&curl_share_mutex[data]);
+}
 
 /* Retransmission management */
 static int max_retransmissions = 5;
@@ -118,7 +154,9 @@ static struct janus_json_parameter tweak_parameters[] = {
 	{"backend_user", JSON_STRING, 0},
 	{"backend_pwd", JSON_STRING, 0},
 	{"max_retransmissions", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
-	{"retransmissions_backoff", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+	{"retransmissions_backoff", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"batch_events", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"batch_timeout", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 /* Error codes (for the tweaking via Admin API */
 #define JANUS_SAMPLEEVH_ERROR_INVALID_REQUEST		411
@@ -201,6 +239,36 @@ int janus_sampleevh_init(const char *config_path) {
 				item = janus_config_get(config, config_general, janus_config_type_item, "grouping");
 				if(item && item->value)
 					group_events = janus_is_true(item->value);
+				/* How big can batches be, and how long can we wait to fill them? */
+				item = janus_config_get(config, config_general, janus_config_type_item, "batch_events");
+				if(item && item->value) {
+					int be = atoi(item->value);
+					if(be < 1) {
+						JANUS_LOG(LOG_WARN, "Invalid value for 'batch_events', using default (%d)\n", batch_events);
+					} else {
+						batch_events = be;
+					}
+				}
+				item = janus_config_get(config, config_general, janus_config_type_item, "batch_timeout");
+				if(item && item->value) {
+					int bt = atoi(item->value);
+					if(bt < 0) {
+						JANUS_LOG(LOG_WARN, "Invalid value for 'batch_timeout', using default (%d)\n", batch_timeout);
+					} else {
+						batch_timeout = bt;
+					}
+				}
+				/* How many POSTs can be in flight at the same time? */
+				item = janus_config_get(config, config_general, janus_config_type_item, "max_inflight");
+				if(item && item->value) {
+					int mi = atoi(item->value);
+					if(mi < 1 || mi > JANUS_SAMPLEEVH_MAX_INFLIGHT) {
+						JANUS_LOG(LOG_WARN, "Invalid value for 'max_inflight' (should be 1-%d), using default (%d)\n",
+							JANUS_SAMPLEEVH_MAX_INFLIGHT, senders_num);
+					} else {
+						senders_num = mi;
+					}
+				}
 				/* Check the JSON indentation */
 				item = janus_config_get(config, config_general, janus_config_type_item, "json");
 				if(item && item->value) {
@@ -249,9 +317,24 @@ int janus_sampleevh_init(const char *config_path) {
 
 	/* Initialize libcurl, needed for forwarding events via HTTP POST */
 	curl_global_init(CURL_GLOBAL_ALL);
+	int i = 0;
+	for(i=0; i<CURL_LOCK_DATA_LAST; i++)
+		janus_mutex_init(&curl_share_mutex[i]);
+	curl_share = curl_share_init();
+	if(curl_share != NULL) {
+		curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, janus_sampleevh_share_lock);
+		curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, janus_sampleevh_share_unlock);
+		curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x073900
+		/* Sharing the connection cache needs cURL >= 7.57.0: with older
+		 * versions, each sender still keeps its own connection alive */
+		curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+	}
 
-	/* Initialize the events queue */
+	/* Initialize the events and batches queues */
 	events = g_async_queue_new_full((GDestroyNotify) janus_sampleevh_event_free);
+	batches = g_async_queue_new_full((GDestroyNotify) janus_sampleevh_batch_free);
 	janus_mutex_init(&evh_mutex);
 
 	g_atomic_int_set(&initialized, 1);
@@ -266,6 +349,30 @@ int janus_sampleevh_init(const char *config_path) {
 		g_error_free(error);
 		return -1;
 	}
+	/* Launch the threads that will send the batches */
+	for(i=0; i<senders_num; i++) {
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "sampleevh %d", i+1);
+		senders[i] = g_thread_try_new(tname, janus_sampleevh_sender, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a SampleEventHandler sender thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			error = NULL;
+			if(i == 0) {
+				/* Without senders, there's no point in going on */
+				g_atomic_int_set(&stopping, 1);
+				g_async_queue_push(events, &exit_event);
+				g_thread_join(handler_thread);
+				handler_thread = NULL;
+				g_atomic_int_set(&initialized, 0);
+				g_atomic_int_set(&stopping, 0);
+				return -1;
+			}
+			break;
+		}
+	}
+	senders_num = i;
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_SAMPLEEVH_NAME);
 	return 0;
 }
@@ -280,9 +387,21 @@ void janus_sampleevh_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* The handler thread told the senders to leave, wait for them */
+	int i = 0;
+	for(i=0; i<senders_num; i++) {
+		if(senders[i] != NULL)
+			g_thread_join(senders[i]);
+		senders[i] = NULL;
+	}
 
 	g_async_queue_unref(events);
 	events = NULL;
+	g_async_queue_unref(batches);
+	batches = NULL;
+	if(curl_share != NULL)
+		curl_share_cleanup(curl_share);
+	curl_share = NULL;
 
 	g_free(backend);
 
@@ -363,13 +482,17 @@ json_t *janus_sampleevh_handle_request(json_t *request) {
 		const char *req_events = NULL, *req_backend = NULL,
 			*req_backend_user = NULL, *req_backend_pwd = NULL;
 		int req_grouping = -1, req_maxretr = -1, req_backoff = -1,
-			req_compress = -1, req_compression = -1;
+			req_compress = -1, req_compression = -1, req_batch_events = -1, req_batch_timeout = -1;
 		/* Events */
 		if(json_object_get(request, "events"))
 			req_events = json_string_value(json_object_get(request, "events"));
 		/* Grouping */
 		if(json_object_get(request, "grouping"))
 			req_grouping = json_is_true(json_object_get(request, "grouping"));
+		if(json_object_get(request, "batch_events"))
+			req_batch_events = json_integer_value(json_object_get(request, "batch_events"));
+		if(json_object_get(request, "batch_timeout"))
+			req_batch_timeout = json_integer_value(json_object_get(request, "batch_timeout"));
 		/* Compression */
 		if(json_object_get(request, "compress"))
 			req_compress = json_is_true(json_object_get(request, "compress"));
@@ -399,6 +522,10 @@ json_t *janus_sampleevh_handle_request(json_t *request) {
 			janus_events_edit_events_mask(req_events, &janus_sampleevh.events_mask);
 		if(req_grouping > -1)
 			group_events = req_grouping ? TRUE : FALSE;
+		if(req_batch_events > 0)
+			batch_events = req_batch_events;
+		if(req_batch_timeout > -1)
+			batch_timeout = req_batch_timeout;
 		if(req_compress > -1)
 			compress = req_compress ? TRUE : FALSE;
 		if(req_compression > -1 && req_compression < 10)
@@ -443,346 +570,400 @@ plugin_response:
 		}
 }
 
-/* Thread to handle incoming events */
+/* Thread to handle incoming events, and group them in batches */
 static void *janus_sampleevh_handler(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining SampleEventHandler handler thread\n");
 	json_t *event = NULL, *output = NULL;
-	char *event_text = NULL;
-	char compressed_text[8192];
-	size_t compressed_len = 0;
-	int count = 0, max = group_events ? 100 : 1;
-	int retransmit = 0;
+	int count = 0;
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		if(!retransmit) {
-			event = g_async_queue_pop(events);
-			if(event == &exit_event)
-				break;
-			count = 0;
-			output = NULL;
-
-			while(TRUE) {
-				/* Handle event: just for fun, let's see how long it took for us to take care of this */
-				json_t *created = json_object_get(event, "timestamp");
-				if(created && json_is_integer(created)) {
-					gint64 then = json_integer_value(created);
-					gint64 now = janus_get_monotonic_time();
-					JANUS_LOG(LOG_DBG, "Handled event after %"SCNu64" us\n", now-then);
-				}
+		event = g_async_queue_pop(events);
+		if(event == &exit_event)
+			break;
+		count = 0;
+		output = NULL;
+		janus_mutex_lock(&evh_mutex);
+		gboolean grouping = group_events;
+		int max = grouping ? batch_events : 1;
+		gint64 timeout = grouping ? (gint64)batch_timeout*1000 : 0;
+		gboolean gzip = compress;
+		int level = compression;
+		janus_mutex_unlock(&evh_mutex);
+		/* The batch is done when it's full, or when we waited long enough for more events */
+		gint64 deadline = janus_get_monotonic_time() + timeout;
+		gboolean exiting = FALSE;
+
+		while(TRUE) {
+			/* Handle event: just for fun, let's see how long it took for us to take care of this */
+			json_t *created = json_object_get(event, "timestamp");
+			if(created && json_is_integer(created)) {
+				gint64 then = json_integer_value(created);
+				gint64 now = janus_get_monotonic_time();
+				JANUS_LOG(LOG_DBG, "Handled event after %"SCNu64" us\n", now-then);
+			}
 
-				/* Let's check what kind of event this is: we don't really do anything
-				 * with it in this plugin, it's just to show how you can handle
-				 * different types of events in an event handler. */
-				int type = json_integer_value(json_object_get(event, "type"));
-				switch(type) {
-					case JANUS_EVENT_TYPE_SESSION:
-						/* This is a session related event. The only info that is
-						 * required is a name for the event itself: a "created"
-						 * event may also contain transport info, in the form of
-						 * the transport module that originated the session
-						 * (e.g., "janus.transport.http") and an internal unique
-						 * ID for the transport instance (which may be associated
-						 * to a connection or anything else within the specifics
-						 * of the transport module itself). Here's an example of
-						 * a new session being created:
-							{
-							   "type": 1,
-							   "timestamp": 3583879627,
-							   "session_id": 2004798115,
-							   "event": {
-								  "name": "created"
-							   },
-							   "transport": {
-							      "transport": "janus.transport.http",
-							      "id": "0x7fcb100008c0"
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_HANDLE:
-						/* This is a handle related event. The only info that is provided
-						 * are the name for the event itself and the package name of the
-						 * plugin this handle refers to (e.g., "janus.plugin.echotest").
-						 * Here's an example of a new handled being attached in a session
-						 * to the EchoTest plugin:
-							{
-							   "type": 2,
-							   "timestamp": 3570304977,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "name": "attached",
-								  "plugin: "janus.plugin.echotest"
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_JSEP:
-						/* This is a JSEP/SDP related event. It provides information
-						 * about an ongoing WebRTC negotiation, and so tells you
-						 * about the SDP being sent/received, and who's sending it
-						 * ("local" means Janus, "remote" means the user). Here's an
-						 * example, where the user originated an offer towards Janus:
-							{
-							   "type": 8,
-							   "timestamp": 3570400208,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "owner": "remote",
-								  "jsep": {
-									 "type": "offer",
-									 "sdp": "v=0[..]\r\n"
-								  }
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_WEBRTC:
-						/* This is a WebRTC related event, and so the content of
-						 * the event may vary quite a bit. In fact, you may be notified
-						 * about ICE or DTLS states, or when a WebRTC PeerConnection
-						 * goes up or down. Here are some examples, in no particular order:
-							{
-							   "type": 16,
-							   "timestamp": 3570416659,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "ice": "connecting",
-								  "stream_id": 1,
-								  "component_id": 1
-							   }
-							}
-						 *
-							{
-							   "type": 16,
-							   "timestamp": 3570637554,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "selected-pair": "[..]",
-								  "stream_id": 1,
-								  "component_id": 1
-							   }
-							}
-						 *
-							{
-							   "type": 16,
-							   "timestamp": 3570656112,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "dtls": "connected",
-								  "stream_id": 1,
-								  "component_id": 1
-							   }
-							}
-						 *
-							{
-							   "type": 16,
-							   "timestamp": 3570657237,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "connection": "webrtcup"
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_MEDIA:
-						/* This is a media related event. This can contain different
-						 * information about the health of a media session, or about
-						 * what's going on in general (e.g., when Janus started/stopped
-						 * receiving media of a certain type, or (TODO) when some media related
-						 * statistics are available). Here's an example of Janus getting
-						 * video from the peer for the first time, or after a second
-						 * of no video at all (which would have triggered a "receiving": false):
-							{
-							   "type": 32,
-							   "timestamp": 3571078797,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "media": "video",
-								  "receiving": "true"
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_PLUGIN:
-						/* This is a plugin related event. Since each plugin may
-						 * provide info in a very custom way, the format of this event
-						 * is in general very dynamic. You'll always find, though,
-						 * an "event" object containing the package name of the
-						 * plugin (e.g., "janus.plugin.echotest") and a "data"
-						 * object that contains whatever the plugin decided to
-						 * notify you about, that will always vary from plugin to
-						 * plugin. Besides, notice that "session_id" and "handle_id"
-						 * may or may not be present: when they are, you'll know
-						 * the event has been triggered within the context of a
-						 * specific handle session with the plugin; when they're
-						 * not, the plugin sent an event out of context of a
-						 * specific session it is handling. Here's an example:
-							{
-							   "type": 64,
-							   "timestamp": 3570336031,
-							   "session_id": 2004798115,
-							   "handle_id": 3708519405,
-							   "event": {
-								  "plugin": "janus.plugin.echotest",
-								  "data": {
-									 "audio_active": "true",
-									 "video_active": "true",
-									 "bitrate": 0
-								  }
-							   }
-							}
-						*/
-						break;
-					case JANUS_EVENT_TYPE_TRANSPORT:
-						/* This is a transport related event (TODO). The syntax of
-						 * the common format (transport specific data aside) is
-						 * exactly the same as that of the plugin related events
-						 * above, with a "transport" property instead of "plugin"
-						 * to contain the transport package name. */
-						break;
-					case JANUS_EVENT_TYPE_CORE:
-						/* This is a core related event. This can contain different
-						 * information about the health of the Janus instance, or
-						 * more generically on some events in the Janus life cycle
-						 * (e.g., when it's just been started or when a shutdown
-						 * has been requested). Considering the heterogeneous nature
-						 * of the information being reported, the content is always
-						 * a JSON object (event). Core events are the only ones
-						 * missing a session_id. Here's an example:
-							{
-							   "type": 256,
-							   "timestamp": 28381185382,
-							   "event": {
-								  "status": "started"
-							   }
-							}
-						*/
-					case JANUS_EVENT_TYPE_EXTERNAL:
-						/* This is an external event, not originated by Janus itself
-						 * or any of its plugins, but from an ad-hoc Admin API request
-						 * instead. As such, the content of the event is not bound to
-						 * any rules (apart from the fact that it needs to be a JSON
-						 * object), but can be whatever the external source thought
-						 * appropriate. In order to facilitare life to recipients, all
-						 * external events must contain a "schema" property, which anyway
-						 * is not bound to any rules either. As an example:
-							{
-							   "type": 4,
-							   "timestamp": 28381185382,
-							   "event": {
-								  "schema": "my.custom.source",
-								  "data": {
-								     "whatever": "youwant"
-								  }
-							   }
-							}
-						*/
-						break;
-					default:
-						JANUS_LOG(LOG_WARN, "Unknown type of event '%d'\n", type);
-						break;
-				}
-				if(!group_events) {
-					/* We're done here, we just need a single event */
-					output = event;
+			/* Let's check what kind of event this is: we don't really do anything
+			 * with it in this plugin, it's just to show how you can handle
+			 * different types of events in an event handler. */
+			int type = json_integer_value(json_object_get(event, "type"));
+			switch(type) {
+				case JANUS_EVENT_TYPE_SESSION:
+					/* This is a session related event. The only info that is
+					 * required is a name for the event itself: a "created"
+					 * event may also contain transport info, in the form of
+					 * the transport module that originated the session
+					 * (e.g., "janus.transport.http") and an internal unique
+					 * ID for the transport instance (which may be associated
+					 * to a connection or anything else within the specifics
+					 * of the transport module itself). Here's an example of
+					 * a new session being created:
+						{
+						   "type": 1,
+						   "timestamp": 3583879627,
+						   "session_id": 2004798115,
+						   "event": {
+							  "name": "created"
+						   },
+						   "transport": {
+						      "transport": "janus.transport.http",
+						      "id": "0x7fcb100008c0"
+						   }
+						}
+					*/
 					break;
-				}
-				/* If we got here, we're grouping */
-				if(output == NULL)
-					output = json_array();
-				json_array_append_new(output, event);
-				/* Never group more than a maximum number of events, though, or we might stay here forever */
-				count++;
-				if(count == max)
+				case JANUS_EVENT_TYPE_HANDLE:
+					/* This is a handle related event. The only info that is provided
+					 * are the name for the event itself and the package name of the
+					 * plugin this handle refers to (e.g., "janus.plugin.echotest").
+					 * Here's an example of a new handled being attached in a session
+					 * to the EchoTest plugin:
+						{
+						   "type": 2,
+						   "timestamp": 3570304977,
+						   "session_id": 2004798115,
+						   "handle_id": 3708519405,
+						   "event": {
+							  "name": "attached",
+							  "plugin: "janus.plugin.echotest"
+						   }
+						}
+					*/
+					break;
+				case JANUS_EVENT_TYPE_JSEP:
+					/* This is a JSEP/SDP related event. It provides information
+					 * about an ongoing WebRTC negotiation, and so tells you
+					 * about the SDP being sent/received, and who's sending it
+					 * ("local" means Janus, "remote" means the user). Here's an
+					 * example, where the user originated an offer towards Janus:
+						{
+						   "type": 8,
+						   "timestamp": 3570400208,
+						   "session_id": 2004798115,
+						   "handle_id": 3708519405,
+						   "event": {
+							  "owner": "remote",
+							  "jsep": {
+								 "type": "offer",
+								 "sdp": "v=0[..]\r\n"
+							  }
+						   }
+						}
+					*/
+					break;
+				case JANUS_EVENT_TYPE_WEBRTC:
+					/* This is a WebRTC related event, and so the content of
+					 * the event may vary quite a bit. In fact, you may be notified
+					 * about ICE or DTLS states, or when a WebRTC PeerConnection
+					 * goes up or down. Here are some examples, in no particular order:
+						{
+						   "type": 16,
+						   "timestamp": 3570416659,
+						   "session_id": 2004798115,
+						   "handle_id": 3708519405,
+						   "event": {
+							  "ice": "connecting",
+							  "stream_id": 1,
+							  "component_id": 1
+						   }
+						}
+					 *
+						{
+						   "type": 16,
+						   "timestamp": 3570637554,
+						   "session_id": 2004798115,
+						   "handle_id": 3708519405,
+						   "event": {
+							  "selected-pair": "[..]",
+							  "stream_id": 1,
+							  "component_id": 1
+						   }
+						}
+					 *
+						{
+						   "type": 16,
+						   "timestamp": 3570656112,
+						   "session_id": 2004798115,
+						   "handle_id": 3708519405,
+						   "event": {
+							  "dtls": "connected",
+							  "stream_id": 1,
+							  "component_id": 1
+						   }
+						}
+					 *
+						{
+						   "type": 16,
+						   "timestamp": 3570657237,
+						   "session_id": 2004798115,
+						   "handle_id": 3708519405,
+						   "event": {
+							  "connection": "webrtcup"
+						   }
+						}
+					*/
+					break;
+				case JANUS_EVENT_TYPE_MEDIA:
+					/* This is a media related event. This can contain different
+					 * information about the health of a media session, or about
+					 * what's going on in general (e.g., when Janus started/stopped
+					 * receiving media of a certain type, or (TODO) when some media related
+					 * statistics are available). Here's an example of Janus getting
+					 * video from the peer for the first time, or after a second
+					 * of no video at all (which would have triggered a "receiving": false):
+						{
+						   "type": 32,
+						   "timestamp": 3571078797,
+						   "session_id": 2004798115,
+						   "handle_id": 3708519405,
+						   "event": {
+							  "media": "video",
+							  "receiving": "true"
+						   }
+						}
+					*/
+					break;
+				case JANUS_EVENT_TYPE_PLUGIN:
+					/* This is a plugin related event. Since each plugin may
+					 * provide info in a very custom way, the format of this event
+					 * is in general very dynamic. You'll always find, though,
+					 * an "event" object containing the package name of the
+					 * plugin (e.g., "janus.plugin.echotest") and a "data"
+					 * object that contains whatever the plugin decided to
+					 * notify you about, that will always vary from plugin to
+					 * plugin. Besides, notice that "session_id" and "handle_id"
+					 * may or may not be present: when they are, you'll know
+					 * the event has been triggered within the context of a
+					 * specific handle session with the plugin; when they're
+					 * not, the plugin sent an event out of context of a
+					 * specific session it is handling. Here's an example:
+						{
+						   "type": 64,
+						   "timestamp": 3570336031,
+						   "session_id": 2004798115,
+						   "handle_id": 3708519405,
+						   "event": {
+							  "plugin": "janus.plugin.echotest",
+							  "data": {
+								 "audio_active": "true",
+								 "video_active": "true",
+								 "bitrate": 0
+							  }
+						   }
+						}
+					*/
 					break;
-				event = g_async_queue_try_pop(events);
-				if(event == NULL || event == &exit_event)
+				case JANUS_EVENT_TYPE_TRANSPORT:
+					/* This is a transport related event (TODO). The syntax of
+					 * the common format (transport specific data aside) is
+					 * exactly the same as that of the plugin related events
+					 * above, with a "transport" property instead of "plugin"
+					 * to contain the transport package name. */
+					break;
+				case JANUS_EVENT_TYPE_CORE:
+					/* This is a core related event. This can contain different
+					 * information about the health of the Janus instance, or
+					 * more generically on some events in the Janus life cycle
+					 * (e.g., when it's just been started or when a shutdown
+					 * has been requested). Considering the heterogeneous nature
+					 * of the information being reported, the content is always
+					 * a JSON object (event). Core events are the only ones
+					 * missing a session_id. Here's an example:
+						{
+						   "type": 256,
+						   "timestamp": 28381185382,
+						   "event": {
+							  "status": "started"
+						   }
+						}
+					*/
+				case JANUS_EVENT_TYPE_EXTERNAL:
+					/* This is an external event, not originated by Janus itself
+					 * or any of its plugins, but from an ad-hoc Admin API request
+					 * instead. As such, the content of the event is not bound to
+					 * any rules (apart from the fact that it needs to be a JSON
+					 * object), but can be whatever the external source thought
+					 * appropriate. In order to facilitare life to recipients, all
+					 * external events must contain a "schema" property, which anyway
+					 * is not bound to any rules either. As an example:
+						{
+						   "type": 4,
+						   "timestamp": 28381185382,
+						   "event": {
+							  "schema": "my.custom.source",
+							  "data": {
+							     "whatever": "youwant"
+							  }
+						   }
+						}
+					*/
+					break;
+				default:
+					JANUS_LOG(LOG_WARN, "Unknown type of event '%d'\n", type);
 					break;
 			}
-
-			/* Since this a simple plugin, it does the same for all events: so just convert to string... */
-			event_text = json_dumps(output, json_format);
-		}
-		/* Whether we just prepared the event or this is a retransmission, send it via HTTP POST */
-		CURLcode res;
-		struct curl_slist *headers = NULL;
-		CURL *curl = curl_easy_init();
-		if(curl == NULL) {
-			JANUS_LOG(LOG_ERR, "Error initializing CURL context\n");
-			goto done;
-		}
-		janus_mutex_lock(&evh_mutex);
-		curl_easy_setopt(curl, CURLOPT_URL, backend);
-		/* Any credentials? */
-		if(backend_user != NULL && backend_pwd != NULL) {
-			curl_easy_setopt(curl, CURLOPT_USERNAME, backend_user);
-			curl_easy_setopt(curl, CURLOPT_PASSWORD, backend_pwd);
-		}
-		janus_mutex_unlock(&evh_mutex);
-		/* Check if we need to compress the data */
-		if(compress) {
-			compressed_len = janus_gzip_compress(compression,
-				event_text, strlen(event_text),
-				compressed_text, sizeof(compressed_text));
-			if(compressed_len == 0) {
-				JANUS_LOG(LOG_ERR, "Failed to compress event (%zu bytes)...\n", strlen(event_text));
-				/* Nothing we can do... get rid of the event */
-				g_free(event_text);
-				json_decref(output);
-				output = NULL;
-				continue;
+			if(!grouping) {
+				/* We're done here, we just need a single event */
+				output = event;
+				break;
 			}
+			/* If we got here, we're grouping */
+			if(output == NULL)
+				output = json_array();
+			json_array_append_new(output, event);
+			/* Never group more than a maximum number of events, though, or we might stay here forever */
+			count++;
+			if(count == max)
+				break;
+			gint64 now = janus_get_monotonic_time();
+			event = now < deadline ? g_async_queue_timeout_pop(events, deadline - now) : g_async_queue_try_pop(events);
+			if(event == &exit_event)
+				exiting = TRUE;
+			if(event == NULL || event == &exit_event)
+				break;
 		}
-		headers = curl_slist_append(headers, compress ? "Accept: application/gzip": "Accept: application/json");
-		headers = curl_slist_append(headers, compress ? "Content-Type: application/gzip" : "Content-Type: application/json");
-		headers = curl_slist_append(headers, "charsets: utf-8");
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, compress ? compressed_text : event_text);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, compress ? compressed_len : strlen(event_text));
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_sampleehv_write_data);
-		/* Don't wait forever (let's say, 10 seconds) */
-		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-		/* Send the request */
-		res = curl_easy_perform(curl);
-		if(res != CURLE_OK) {
-			JANUS_LOG(LOG_ERR, "Couldn't relay event to the backend: %s\n", curl_easy_strerror(res));
-			if(max_retransmissions > 0) {
-				/* Retransmissions enabled, let's try again */
-				if(retransmit == max_retransmissions) {
-					retransmit = 0;
-					JANUS_LOG(LOG_WARN, "Maximum number of retransmissions reached (%d), event lost...\n", max_retransmissions);
+
+		/* Since this a simple plugin, it does the same for all events: so just convert to string... */
+		janus_sampleevh_batch *batch = g_malloc0(sizeof(janus_sampleevh_batch));
+		batch->payload = json_dumps(output, json_format);
+		json_decref(output);
+		output = NULL;
+		if(batch->payload == NULL) {
+			JANUS_LOG(LOG_ERR, "Failed to serialize %d events...\n", count);
+			g_free(batch);
+		} else {
+			batch->len = strlen(batch->payload);
+			batch->events = grouping ? count : 1;
+			/* Check if we need to compress the data */
+			if(gzip) {
+				/* Even when data can't be compressed, deflate only adds a
+				 * few bytes every few KB, plus the gzip header and trailer */
+				size_t zlen = batch->len + batch->len/1000 + 64;
+				char *compressed = g_malloc(zlen);
+				size_t compressed_len = janus_gzip_compress(level, batch->payload, batch->len, compressed, zlen);
+				if(compressed_len == 0) {
+					/* Nothing we can do... get rid of the events */
+					JANUS_LOG(LOG_ERR, "Failed to compress events (%zu bytes)...\n", batch->len);
+					g_free(compressed);
+					janus_sampleevh_batch_free(batch);
+					batch = NULL;
 				} else {
-					int next = retransmissions_backoff * (pow(2, retransmit));
-					JANUS_LOG(LOG_WARN, "Retransmitting event in %d ms...\n", next);
-					g_usleep(next*1000);
-					retransmit++;
+					g_free(batch->payload);
+					batch->payload = compressed;
+					batch->len = compressed_len;
+					batch->compressed = TRUE;
 				}
-			} else {
-				JANUS_LOG(LOG_WARN, "Retransmissions disabled, event lost...\n");
 			}
-		} else {
-			JANUS_LOG(LOG_DBG, "Event sent!\n");
-			retransmit = 0;
+			if(batch != NULL)
+				g_async_queue_push(batches, batch);
 		}
-done:
-		/* Cleanup */
-		if(curl)
-			curl_easy_cleanup(curl);
-		if(headers)
-			curl_slist_free_all(headers);
-		if(!retransmit)
-			g_free(event_text);
-
-		/* Done, let's unref the event */
-		json_decref(output);
-		output = NULL;
+		if(exiting)
+			break;
 	}
+	/* Wake up the senders, so that they leave too */
+	int i = 0;
+	for(i=0; i<senders_num; i++)
+		g_async_queue_push(batches, &exit_batch);
 	JANUS_LOG(LOG_VERB, "Leaving SampleEventHandler handler thread\n");
 	return NULL;
 }
+
+/* Threads to send batches of events to the backend: each has its own cURL
+ * handle, but they all share the connections (and DNS) cache, so that
+ * connections to the backend are kept alive and reused across requests */
+static void *janus_sampleevh_sender(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining SampleEventHandler sender thread\n");
+	CURL *curl = NULL;
+	janus_sampleevh_batch *batch = NULL;
+	while(g_atomic_int_get(&initialized)) {
+		batch = g_async_queue_pop(batches);
+		if(batch == &exit_batch)
+			break;
+		int retransmit = 0;
+		while(TRUE) {
+			/* Whether this is the first attempt or a retransmission, send the batch via HTTP POST */
+			CURLcode res;
+			struct curl_slist *headers = NULL;
+			if(curl == NULL) {
+				curl = curl_easy_init();
+				if(curl == NULL) {
+					JANUS_LOG(LOG_ERR, "Error initializing CURL context\n");
+					break;
+				}
+				if(curl_share != NULL)
+					curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+				curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+				curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_sampleehv_write_data);
+				/* Don't wait forever (let's say, 10 seconds) */
+				curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+			}
+			janus_mutex_lock(&evh_mutex);
+			curl_easy_setopt(curl, CURLOPT_URL, backend);
+			/* Any credentials? */
+			if(backend_user != NULL && backend_pwd != NULL) {
+				curl_easy_setopt(curl, CURLOPT_USERNAME, backend_user);
+				curl_easy_setopt(curl, CURLOPT_PASSWORD, backend_pwd);
+			} else {
+				curl_easy_setopt(curl, CURLOPT_USERNAME, NULL);
+				curl_easy_setopt(curl, CURLOPT_PASSWORD, NULL);
+			}
+			int maxretr = max_retransmissions, backoff = retransmissions_backoff;
+			janus_mutex_unlock(&evh_mutex);
+			headers = curl_slist_append(headers, batch->compressed ? "Accept: application/gzip": "Accept: application/json");
+			headers = curl_slist_append(headers, batch->compressed ? "Content-Type: application/gzip" : "Content-Type: application/json");
+			headers = curl_slist_append(headers, "charsets: utf-8");
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, batch->payload);
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)batch->len);
+			/* Send the request */
+			res = curl_easy_perform(curl);
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+			curl_slist_free_all(headers);
+			if(res == CURLE_OK) {
+				JANUS_LOG(LOG_DBG, "Sent %d events!\n", batch->events);
+				break;
+			}
+			JANUS_LOG(LOG_ERR, "Couldn't relay %d events to the backend: %s\n", batch->events, curl_easy_strerror(res));
+			if(maxretr == 0) {
+				JANUS_LOG(LOG_WARN, "Retransmissions disabled, events lost...\n");
+				break;
+			}
+			/* Retransmissions enabled, let's try again */
+			if(retransmit >= maxretr) {
+				JANUS_LOG(LOG_WARN, "Maximum number of retransmissions reached (%d), events lost...\n", maxretr);
+				break;
+			}
+			if(g_atomic_int_get(&stopping)) {
+				JANUS_LOG(LOG_WARN, "Shutting down, events lost...\n");
+				break;
+			}
+			int next = backoff * (pow(2, retransmit));
+			JANUS_LOG(LOG_WARN, "Retransmitting events in %d ms...\n", next);
+			g_usleep(next*1000);
+			retransmit++;
+		}
+		janus_sampleevh_batch_free(batch);
+	}
+	if(curl)
+		curl_easy_cleanup(curl);
+	JANUS_LOG(LOG_VERB, "Leaving SampleEventHandler sender thread\n");
+	return NULL;
+}
@@ -2,7 +2,12 @@
  * \author Lorenzo Miniero <lorenzo@meetecho.com>
  * \copyright GNU General Public License v3
  * \brief  Janus WebSockets EventHandler plugin
- * \details  This is a trivial WebSockets event handler plugin for Janus
+ * \details  This is a trivial WebSockets event handler plugin for Janus.
+ * Serialized events wait to be sent in a bounded buffer: when it's full
+ * (e.g., because the backend is slow or we're reconnecting), events are
+ * spilled to a file, if configured, and dropped otherwise, so that an
+ * outage of the backend can't make Janus memory grow indefinitely. The
+ * \c info request returns how far behind the backend is.
  *
  * \ingroup eventhandlers
  * \ref eventhandlers
@@ -11,6 +16,8 @@
 #include "eventhandler.h"
 
 #include <math.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include <libwebsockets.h>
 
@@ -96,7 +103,8 @@ static struct janus_json_parameter request_parameters[] = {
 };
 static struct janus_json_parameter tweak_parameters[] = {
 	{"events", JSON_STRING, 0},
-	{"grouping", JANUS_JSON_BOOL, 0}
+	{"grouping", JANUS_JSON_BOOL, 0},
+	{"buffer_size", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 /* Error codes (for the tweaking via Admin API */
 #define JANUS_WSEVH_ERROR_INVALID_REQUEST		411
@@ -124,8 +132,165 @@ typedef struct janus_wsevh_client {
 } janus_wsevh_client;
 static janus_wsevh_client *ws_client = NULL;
 static struct lws *wsi = NULL;
-static GAsyncQueue *messages = NULL;	/* Queue of outgoing messages to push */
 static janus_mutex writable_mutex;
+static gboolean compress = TRUE;	/* Whether to offer permessage-deflate */
+
+/* Buffer of outgoing messages to push: messages are kept in memory up to
+ * buffer_size bytes, then appended to the spill file (if any) up to
+ * spill_size bytes, and dropped after that. As long as there's something
+ * in the spill file, new messages go there too, to preserve the order */
+typedef struct janus_wsevh_message {
+	char *text;
+	size_t len;
+	gint64 queued;
+} janus_wsevh_message;
+static GQueue *buffered = NULL;
+static size_t buffered_bytes = 0, buffer_size = 16*1024*1024;
+static char *spill_path = NULL;
+static FILE *spill_file = NULL;
+static off_t spill_read = 0, spill_write = 0, spill_size = 256*1024*1024;
+static guint64 spilled = 0, spill_pending = 0;
+static guint64 delivered = 0, dropped = 0;
+static gboolean dropping = FALSE;
+static janus_mutex buffer_mutex;
+/* Spilled messages are stored as timestamp, length and text */
+#define JANUS_WSEVH_SPILL_HEADER	(sizeof(gint64) + sizeof(guint32))
+
+static void janus_wsevh_message_free(janus_wsevh_message *message) {
+	if(message == NULL)
+		return;
+	free(message->text);
+	g_free(message);
+}
+
+/* Add a serialized message to the buffer (takes ownership of the text) */
+static void janus_wsevh_buffer_push(char *text) {
+	janus_wsevh_message *message = g_malloc(sizeof(janus_wsevh_message));
+	message->text = text;
+	message->len = strlen(text);
+	message->queued = janus_get_monotonic_time();
+	janus_mutex_lock(&buffer_mutex);
+	if(spill_pending == 0 && (buffer_size == 0 || buffered_bytes + message->len <= buffer_size)) {
+		/* There's room in memory */
+		g_queue_push_tail(buffered, message);
+		buffered_bytes += message->len;
+		if(dropping) {
+			dropping = FALSE;
+			JANUS_LOG(LOG_INFO, "WebSockets event handler buffer is draining (%"SCNu64" events dropped so far)\n", dropped);
+		}
+		janus_mutex_unlock(&buffer_mutex);
+		return;
+	}
+	if(spill_file != NULL && spill_write + (off_t)(JANUS_WSEVH_SPILL_HEADER + message->len) <= spill_size) {
+		guint32 len = message->len;
+		if(fseeko(spill_file, spill_write, SEEK_SET) == 0 &&
+				fwrite(&message->queued, sizeof(gint64), 1, spill_file) == 1 &&
+				fwrite(&len, sizeof(guint32), 1, spill_file) == 1 &&
+				fwrite(message->text, 1, message->len, spill_file) == message->len) {
+			if(spill_pending == 0)
+				JANUS_LOG(LOG_WARN, "WebSockets event handler buffer is full, spilling events to %s\n", spill_path);
+			spill_write += JANUS_WSEVH_SPILL_HEADER + message->len;
+			spill_pending++;
+			spilled++;
+			janus_mutex_unlock(&buffer_mutex);
+			janus_wsevh_message_free(message);
+			return;
+		}
+		JANUS_LOG(LOG_ERR, "Error writing to spill file %s: %d (%s)\n", spill_path, errno, strerror(errno));
+	}
+	/* No room anywhere, drop the event */
+	if(!dropping) {
+		dropping = TRUE;
+		JANUS_LOG(LOG_WARN, "WebSockets event handler buffer is full, dropping events\n");
+	}
+	dropped++;
+	janus_mutex_unlock(&buffer_mutex);
+	janus_wsevh_message_free(message);
+}
+
+/* Get the next message to send, if any: messages in memory are always older than spilled ones */
+static janus_wsevh_message *janus_wsevh_buffer_pop(void) {
+	janus_mutex_lock(&buffer_mutex);
+	janus_wsevh_message *message = g_queue_pop_head(buffered);
+	if(message != NULL) {
+		buffered_bytes -= message->len;
+		janus_mutex_unlock(&buffer_mutex);
+		return message;
+	}
+	if(spill_pending > 0) {
+		gint64 queued = 0;
+		guint32 len = 0;
+		if(fseeko(spill_file, spill_read, SEEK_SET) == 0 &&
+				fread(&queued, sizeof(gint64), 1, spill_file) == 1 &&
+				fread(&len, sizeof(guint32), 1, spill_file) == 1) {
+			message = g_malloc(sizeof(janus_wsevh_message));
+			message->text = malloc(len + 1);
+			message->len = len;
+			message->queued = queued;
+			if(fread(message->text, 1, len, spill_file) != len) {
+				JANUS_LOG(LOG_ERR, "Error reading from spill file %s, dropping spilled events\n", spill_path);
+				janus_wsevh_message_free(message);
+				message = NULL;
+				dropped += spill_pending;
+				spill_pending = 0;
+			} else {
+				message->text[len] = '\0';
+				spill_read += JANUS_WSEVH_SPILL_HEADER + len;
+				spill_pending--;
+			}
+		} else {
+			JANUS_LOG(LOG_ERR, "Error reading from spill file %s, dropping spilled events\n", spill_path);
+			dropped += spill_pending;
+			spill_pending = 0;
+		}
+		if(spill_pending == 0) {
+			/* We caught up: start again from the beginning of the file */
+			spill_read = 0;
+			spill_write = 0;
+			if(ftruncate(fileno(spill_file), 0) < 0)
+				JANUS_LOG(LOG_WARN, "Error truncating spill file %s: %d (%s)\n", spill_path, errno, strerror(errno));
+			JANUS_LOG(LOG_INFO, "WebSockets event handler caught up with spilled events\n");
+		}
+	}
+	janus_mutex_unlock(&buffer_mutex);
+	return message;
+}
+
+static gboolean janus_wsevh_buffer_is_empty(void) {
+	janus_mutex_lock(&buffer_mutex);
+	gboolean empty = g_queue_is_empty(buffered) && spill_pending == 0;
+	janus_mutex_unlock(&buffer_mutex);
+	return empty;
+}
+
+/* Info on how far behind the backend is */
+static json_t *janus_wsevh_buffer_info(void) {
+	json_t *info = json_object();
+	janus_mutex_lock(&buffer_mutex);
+	/* The oldest message waiting is either in memory or at the head of the spill file */
+	gint64 oldest = 0;
+	janus_wsevh_message *head = g_queue_peek_head(buffered);
+	if(head != NULL) {
+		oldest = head->queued;
+	} else if(spill_pending > 0 && fseeko(spill_file, spill_read, SEEK_SET) == 0) {
+		if(fread(&oldest, sizeof(gint64), 1, spill_file) != 1)
+			oldest = 0;
+	}
+	json_object_set_new(info, "connected", (ws_client != NULL && ws_client->wsi != NULL) ? json_true() : json_false());
+	json_object_set_new(info, "buffered", json_integer(g_queue_get_length(buffered)));
+	json_object_set_new(info, "buffered_bytes", json_integer(buffered_bytes));
+	json_object_set_new(info, "buffer_size", json_integer(buffer_size));
+	if(spill_file != NULL) {
+		json_object_set_new(info, "spill_pending", json_integer(spill_pending));
+		json_object_set_new(info, "spill_bytes", json_integer(spill_write - spill_read));
+		json_object_set_new(info, "spilled", json_integer(spilled));
+	}
+	json_object_set_new(info, "delivered", json_integer(delivered));
+	json_object_set_new(info, "dropped", json_integer(dropped));
+	json_object_set_new(info, "lag", json_integer(oldest > 0 ? (janus_get_monotonic_time() - oldest)/1000 : 0));
+	janus_mutex_unlock(&buffer_mutex);
+	return info;
+}
 
 static int janus_wsevh_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
 static struct lws_protocols protocols[] = {
@@ -140,6 +305,24 @@ static const struct lws_extension exts[] = {
 
 /* WebSockets error management */
 #define CASE_STR(name) case name: return #name
+/* Connect (or reconnect) to the backend */
+static struct lws *janus_wsevh_connect(void) {
+	struct lws_client_connect_info i;
+	memset(&i, 0, sizeof(i));
+	i.host = address;
+	i.origin = address;
+	i.address = address;
+	i.port = port;
+	i.path = path;
+	i.context = context;
+	i.ssl_connection = 0;
+	i.ietf_version_or_minus_one = -1;
+	i.client_exts = compress ? exts : NULL;
+	i.protocol = protocols[0].name;
+	i.method = NULL;
+	return lws_client_connect_via_info(&i);
+}
+
 static const char *janus_wsevh_reason_string(enum lws_callback_reasons reason) {
 	switch(reason) {
 		CASE_STR(LWS_CALLBACK_ESTABLISHED);
@@ -270,6 +453,37 @@ int janus_wsevh_init(const char *config_path) {
 		JANUS_LOG(LOG_FATAL, "  -- Path:     %s\n", path);
 		goto error;
 	}
+	/* How many events can we keep around while the backend is slow or away? */
+	item = janus_config_get(config, config_general, janus_config_type_item, "buffer_size");
+	if(item && item->value) {
+		int size = atoi(item->value);
+		if(size < 0)
+			JANUS_LOG(LOG_WARN, "Invalid buffer_size '%s', using default (%zu)\n", item->value, buffer_size);
+		else
+			buffer_size = size;
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "spill_file");
+	if(item && item->value) {
+		spill_file = fopen(item->value, "w+b");
+		if(spill_file == NULL) {
+			JANUS_LOG(LOG_WARN, "Couldn't open spill file %s: %d (%s), events will be dropped when the buffer is full\n",
+				item->value, errno, strerror(errno));
+		} else {
+			spill_path = g_strdup(item->value);
+			item = janus_config_get(config, config_general, janus_config_type_item, "spill_size");
+			if(item && item->value) {
+				long long size = atoll(item->value);
+				if(size <= 0)
+					JANUS_LOG(LOG_WARN, "Invalid spill_size '%s', using default (%lld)\n", item->value, (long long)spill_size);
+				else
+					spill_size = size;
+			}
+		}
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "compress");
+	if(item && item->value)
+		compress = janus_is_true(item->value);
+
 	/* Before connecting, let's check if the server expects a subprotocol */
 	item = janus_config_get(config, config_general, janus_config_type_item, "subprotocol");
 	if(item && item->value)
@@ -289,20 +503,9 @@ int janus_wsevh_init(const char *config_path) {
 		JANUS_LOG(LOG_FATAL, "Creating libwebsocket context failed\n");
 		goto error;
 	}
-	struct lws_client_connect_info i;
-	memset(&i, 0, sizeof(i));
-	i.host = address;
-	i.origin = address;
-	i.address = address;
-	i.port = port;
-	i.path = path;
-	i.context = context;
-	i.ssl_connection = 0;
-	i.ietf_version_or_minus_one = -1;
-	i.client_exts = exts;
-	i.protocol = protocols[0].name;
-	i.method = NULL;
-	wsi = lws_client_connect_via_info(&i);
+	janus_mutex_init(&buffer_mutex);
+	buffered = g_queue_new();
+	wsi = janus_wsevh_connect();
 	if(wsi == NULL) {
 		JANUS_LOG(LOG_FATAL, "Error initializing WebSocket connection\n");
 		goto error;
@@ -311,7 +514,6 @@ int janus_wsevh_init(const char *config_path) {
 
 	/* Initialize the events queue */
 	events = g_async_queue_new_full((GDestroyNotify) janus_wsevh_event_free);
-	messages = g_async_queue_new();
 	g_atomic_int_set(&initialized, 1);
 
 	/* Start a thread to handle the WebSockets event loop */
@@ -371,11 +573,22 @@ void janus_wsevh_destroy(void) {
 	g_async_queue_unref(events);
 	events = NULL;
 
-	char *message = NULL;
-	while((message = g_async_queue_try_pop(messages)) != NULL) {
-		g_free(message);
+	janus_wsevh_message *message = NULL;
+	while((message = g_queue_pop_head(buffered)) != NULL)
+		janus_wsevh_message_free(message);
+	g_queue_free(buffered);
+	buffered = NULL;
+	buffered_bytes = 0;
+	if(spill_file != NULL) {
+		fclose(spill_file);
+		spill_file = NULL;
+		unlink(spill_path);
 	}
-	g_async_queue_unref(messages);
+	g_free(spill_path);
+	spill_path = NULL;
+	spill_read = 0;
+	spill_write = 0;
+	spill_pending = 0;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -455,6 +668,17 @@ json_t *janus_wsevh_handle_request(json_t *request) {
 		/* Grouping */
 		if(json_object_get(request, "grouping"))
 			group_events = json_is_true(json_object_get(request, "grouping"));
+		/* Buffer */
+		if(json_object_get(request, "buffer_size")) {
+			janus_mutex_lock(&buffer_mutex);
+			buffer_size = json_integer_value(json_object_get(request, "buffer_size"));
+			janus_mutex_unlock(&buffer_mutex);
+		}
+	} else if(!strcasecmp(request_text, "info")) {
+		/* Return info on the buffer, and how far behind the backend is */
+		json_t *response = janus_wsevh_buffer_info();
+		json_object_set_new(response, "result", json_integer(200));
+		return response;
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
 		error_code = JANUS_WSEVH_ERROR_INVALID_REQUEST;
@@ -501,20 +725,7 @@ static void *janus_wsevh_thread(void *data) {
 				reconnect_retries);
 			ws_client = NULL;
 			wsi = NULL;
-			struct lws_client_connect_info i;
-			memset(&i, 0, sizeof(i));
-			i.host = address;
-			i.origin = address;
-			i.address = address;
-			i.port = port;
-			i.path = path;
-			i.context = context;
-			i.ssl_connection = 0;
-			i.ietf_version_or_minus_one = -1;
-			i.client_exts = exts;
-			i.protocol = protocols[0].name;
-			i.method = NULL;
-			wsi = lws_client_connect_via_info(&i);
+			wsi = janus_wsevh_connect();
 			if(wsi == NULL) {
 				JANUS_LOG(LOG_WARN, "Error attempting reconnection...\n");
 				continue;
@@ -571,7 +782,8 @@ static void *janus_wsevh_handler(void *data) {
 		if(!g_atomic_int_get(&stopping)) {
 			/* Since this a simple plugin, it does the same for all events: so just convert to string... */
 			event_text = json_dumps(output, json_format);
-			g_async_queue_push(messages, event_text);
+			if(event_text != NULL)
+				janus_wsevh_buffer_push(event_text);
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 			if(context != NULL)
 				lws_cancel_service(context);
@@ -605,6 +817,9 @@ static int janus_wsevh_callback(struct lws *wsi, enum lws_callback_reasons reaso
 			ws_client->bufoffset = 0;
 			reconnect_retries = 0;
 			janus_mutex_init(&ws_client->mutex);
+			/* If events piled up while we were away, start sending them */
+			if(!janus_wsevh_buffer_is_empty())
+				lws_callback_on_writable(wsi);
 			return 0;
 		}
 		case LWS_CALLBACK_CLIENT_CONNECTION_ERROR: {
@@ -655,9 +870,10 @@ static int janus_wsevh_callback(struct lws *wsi, enum lws_callback_reasons reaso
 					return 0;
 				}
 				/* Shoot all the pending messages */
-				char *event = g_async_queue_try_pop(messages);
-				if(event && !g_atomic_int_get(&stopping)) {
+				janus_wsevh_message *message = g_atomic_int_get(&stopping) ? NULL : janus_wsevh_buffer_pop();
+				if(message != NULL) {
 					/* Gotcha! */
+					char *event = message->text;
 					int buflen = LWS_PRE + strlen(event);
 					if(ws_client->buffer == NULL) {
 						/* Let's allocate a shared buffer */
@@ -683,7 +899,12 @@ static int janus_wsevh_callback(struct lws *wsi, enum lws_callback_reasons reaso
 							ws_client->bufpending, ws_client->bufoffset);
 					}
 					/* We can get rid of the message */
-					g_free(event);
+					if(sent > -1) {
+						janus_mutex_lock(&buffer_mutex);
+						delivered++;
+						janus_mutex_unlock(&buffer_mutex);
+					}
+					janus_wsevh_message_free(message);
 					/* Done for this round, check the next response/notification later */
 					lws_callback_on_writable(wsi);
 					janus_mutex_unlock(&ws_client->mutex);
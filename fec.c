@@ -0,0 +1,206 @@
+/*! \file    fec.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    RED and ULPFEC generation for outgoing media
+ * \details  Helpers the core uses to protect the media it sends to peers
+ * that negotiated it. RED packets (RFC 2198) for audio carry the previous
+ * frames as redundant blocks, in front of the primary one. ULPFEC packets
+ * (RFC 5109) use a single protection level and the short 16 bits mask:
+ * the fixed part of the headers and everything that follows them in the
+ * media packets of a group are XORed together, so that the receiver can
+ * rebuild any one of them that didn't make it. Browsers only accept
+ * ULPFEC as a RED block, which is why video needs RED as well.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "fec.h"
+#include "rtp.h"
+
+/* ULPFEC headers: FEC header (RFC 5109, 7.3) and level 0 header with the short mask (7.4) */
+#define JANUS_ULPFEC_HEADER_SIZE	10
+#define JANUS_ULPFEC_LEVEL_SIZE		4
+
+void janus_ulpfec_encoder_reset(janus_ulpfec_encoder *enc) {
+	if(enc == NULL)
+		return;
+	memset(enc, 0, sizeof(*enc));
+}
+
+int janus_ulpfec_encoder_add(janus_ulpfec_encoder *enc, const char *packet, int len) {
+	if(enc == NULL || packet == NULL || len < RTP_HEADER_SIZE || len - RTP_HEADER_SIZE > JANUS_FEC_MAX_PACKET)
+		return -1;
+	const janus_rtp_header *rtp = (const janus_rtp_header *)packet;
+	const uint8_t *buf = (const uint8_t *)packet;
+	uint16_t seq = ntohs(rtp->seq_number);
+	if(enc->count == 0)
+		enc->sn_base = seq;
+	uint16_t offset = seq - enc->sn_base;
+	if(offset >= JANUS_ULPFEC_MAX_GROUP || (enc->mask & (1 << (15-offset))))
+		return -1;
+	/* P, X, CC, M and PT first, then the timestamp and the length */
+	enc->recovery[0] ^= buf[0];
+	enc->recovery[1] ^= buf[1];
+	enc->recovery[2] ^= buf[4];
+	enc->recovery[3] ^= buf[5];
+	enc->recovery[4] ^= buf[6];
+	enc->recovery[5] ^= buf[7];
+	uint16_t plen = len - RTP_HEADER_SIZE;
+	enc->recovery[6] ^= (plen >> 8);
+	enc->recovery[7] ^= (plen & 0xFF);
+	/* Then the rest (CSRCs and extensions included) */
+	int i = 0;
+	for(i=0; i<plen; i++)
+		enc->payload[i] ^= buf[RTP_HEADER_SIZE+i];
+	if(plen > enc->protection_length)
+		enc->protection_length = plen;
+	enc->mask |= (1 << (15-offset));
+	enc->timestamp = ntohl(rtp->timestamp);
+	enc->count++;
+	return enc->count;
+}
+
+int janus_ulpfec_encoder_generate(janus_ulpfec_encoder *enc, uint32_t ssrc, uint16_t seq,
+		int red_pt, int ulpfec_pt, char *buffer, int size) {
+	if(enc == NULL || enc->count == 0 || buffer == NULL)
+		return -1;
+	int total = RTP_HEADER_SIZE + 1 + JANUS_ULPFEC_HEADER_SIZE + JANUS_ULPFEC_LEVEL_SIZE + enc->protection_length;
+	if(total > size)
+		return -1;
+	memset(buffer, 0, RTP_HEADER_SIZE);
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	rtp->version = 2;
+	rtp->type = red_pt;
+	rtp->seq_number = htons(seq);
+	rtp->timestamp = htonl(enc->timestamp);
+	rtp->ssrc = htonl(ssrc);
+	uint8_t *red = (uint8_t *)buffer + RTP_HEADER_SIZE;
+	*red = (ulpfec_pt & 0x7F);
+	uint8_t *fec = red + 1;
+	/* E and L are both 0, as we only use the short mask */
+	fec[0] = (enc->recovery[0] & 0x3F);
+	fec[1] = enc->recovery[1];
+	fec[2] = (enc->sn_base >> 8);
+	fec[3] = (enc->sn_base & 0xFF);
+	memcpy(fec+4, enc->recovery+2, 6);
+	uint8_t *level = fec + JANUS_ULPFEC_HEADER_SIZE;
+	level[0] = (enc->protection_length >> 8);
+	level[1] = (enc->protection_length & 0xFF);
+	level[2] = (enc->mask >> 8);
+	level[3] = (enc->mask & 0xFF);
+	memcpy(level + JANUS_ULPFEC_LEVEL_SIZE, enc->payload, enc->protection_length);
+	janus_ulpfec_encoder_reset(enc);
+	return total;
+}
+
+int janus_ulpfec_group_size(uint32_t loss) {
+	/* One FEC packet can only recover a single loss in its group, so the
+	 * more losses the peer sees, the smaller the groups we protect */
+	if(loss < 1)
+		return 0;
+	else if(loss < 3)
+		return 10;
+	else if(loss < 6)
+		return 6;
+	else if(loss < 10)
+		return 4;
+	else if(loss < 20)
+		return 3;
+	return 2;
+}
+
+int janus_red_encode(janus_red_encoder *enc, char *packet, int len, int size, int red_pt, int distance) {
+	if(enc == NULL || packet == NULL || len < RTP_HEADER_SIZE)
+		return len;
+	janus_rtp_header *rtp = (janus_rtp_header *)packet;
+	int plen = 0;
+	char *payload = janus_rtp_payload(packet, len, &plen);
+	if(payload == NULL || plen <= 0)
+		return len;
+	int hlen = payload - packet;
+	uint32_t timestamp = ntohl(rtp->timestamp);
+	uint8_t pt = rtp->type;
+	if(enc->count > 0 && (int32_t)(timestamp - enc->blocks[enc->count-1].timestamp) <= 0) {
+		/* Out of order or repeated timestamp (e.g., a different source), start over */
+		enc->count = 0;
+	}
+	/* Prepare the RED payload, if we have frames to add */
+	char red[JANUS_FEC_MAX_PACKET];
+	int red_len = 0, blocks = 0, i = 0;
+	if(distance > 0 && red_pt > 0) {
+		int first = enc->count > distance ? enc->count - distance : 0;
+		int needed = 1 + plen;
+		for(i=first; i<enc->count; i++) {
+			if(timestamp - enc->blocks[i].timestamp >= 16384 || enc->blocks[i].pt != pt) {
+				/* The offset wouldn't fit in 14 bits, skip this frame */
+				first = i+1;
+				needed = 1 + plen;
+				continue;
+			}
+			needed += 4 + enc->blocks[i].length;
+		}
+		if(first < enc->count && needed <= (int)sizeof(red) && hlen + needed <= size) {
+			/* Block headers first (F=1), and the primary one last (F=0) */
+			for(i=first; i<enc->count; i++) {
+				uint32_t offset = timestamp - enc->blocks[i].timestamp;
+				red[red_len++] = 0x80 | (pt & 0x7F);
+				red[red_len++] = (offset >> 6) & 0xFF;
+				red[red_len++] = ((offset & 0x3F) << 2) | ((enc->blocks[i].length >> 8) & 0x03);
+				red[red_len++] = enc->blocks[i].length & 0xFF;
+				blocks++;
+			}
+			red[red_len++] = (pt & 0x7F);
+			for(i=first; i<enc->count; i++) {
+				memcpy(red+red_len, enc->blocks[i].data, enc->blocks[i].length);
+				red_len += enc->blocks[i].length;
+			}
+			memcpy(red+red_len, payload, plen);
+			red_len += plen;
+		}
+	}
+	/* Remember this frame for the next packets */
+	if(plen > JANUS_RED_MAX_BLOCK) {
+		enc->count = 0;
+	} else {
+		if(enc->count == JANUS_RED_MAX_DISTANCE) {
+			memmove(&enc->blocks[0], &enc->blocks[1], sizeof(enc->blocks[0]) * (JANUS_RED_MAX_DISTANCE-1));
+			enc->count--;
+		}
+		enc->blocks[enc->count].timestamp = timestamp;
+		enc->blocks[enc->count].pt = pt;
+		enc->blocks[enc->count].length = plen;
+		memcpy(enc->blocks[enc->count].data, payload, plen);
+		enc->count++;
+	}
+	if(blocks == 0)
+		return len;
+	memcpy(payload, red, red_len);
+	rtp->type = red_pt;
+	return hlen + red_len;
+}
+
+int janus_red_wrap(char *packet, int len, int size, int red_pt) {
+	if(packet == NULL || len < RTP_HEADER_SIZE || len + 1 > size)
+		return -1;
+	janus_rtp_header *rtp = (janus_rtp_header *)packet;
+	int plen = 0;
+	char *payload = janus_rtp_payload(packet, len, &plen);
+	if(payload == NULL)
+		return -1;
+	memmove(payload+1, payload, plen);
+	*payload = (rtp->type & 0x7F);
+	rtp->type = red_pt;
+	return len + 1;
+}
+
+int janus_red_distance(uint32_t loss) {
+	if(loss < 1)
+		return 0;
+	else if(loss < 5)
+		return 1;
+	return JANUS_RED_MAX_DISTANCE;
+}
@@ -0,0 +1,133 @@
+/*! \file    fec.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    RED and ULPFEC generation for outgoing media (headers)
+ * \details  Helpers the core uses to protect the media it sends to peers
+ * that negotiated it, so that losses can be recovered without waiting for
+ * a retransmission (which on high RTT links may arrive too late to be of
+ * any use). Opus audio is sent as RED (RFC 2198), where each packet also
+ * carries the previous one or two frames. Video is sent as RED as well,
+ * with XOR based ULPFEC packets (RFC 5109) protecting groups of media
+ * packets interleaved in the same SSRC and sequence number space, which
+ * is what browsers expect. How much protection is added depends on the
+ * packet loss the peer reports in its RTCP receiver reports.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_FEC_H
+#define JANUS_FEC_H
+
+#include <glib.h>
+
+#include <inttypes.h>
+
+/*! \brief Largest media packet we can protect or encapsulate */
+#define JANUS_FEC_MAX_PACKET	1500
+/*! \brief Maximum number of media packets a single ULPFEC packet can protect (short mask) */
+#define JANUS_ULPFEC_MAX_GROUP	16
+/*! \brief Maximum number of previous frames a RED packet can carry */
+#define JANUS_RED_MAX_DISTANCE	2
+/*! \brief Largest frame RED can carry as a redundant block (10 bits length) */
+#define JANUS_RED_MAX_BLOCK		1023
+
+/*! \brief ULPFEC encoder, XORing the media packets of the current group */
+typedef struct janus_ulpfec_encoder {
+	/*! \brief XOR of the first two bytes, timestamps and payload lengths of the packets */
+	uint8_t recovery[8];
+	/*! \brief XOR of everything that follows the fixed RTP header of the packets */
+	uint8_t payload[JANUS_FEC_MAX_PACKET];
+	/*! \brief Length of the longest payload in the group */
+	uint16_t protection_length;
+	/*! \brief Sequence number of the first packet in the group */
+	uint16_t sn_base;
+	/*! \brief Which packets (relative to the base) the group contains */
+	uint16_t mask;
+	/*! \brief Timestamp of the latest packet in the group */
+	uint32_t timestamp;
+	/*! \brief Number of packets in the group */
+	int count;
+} janus_ulpfec_encoder;
+
+/*! \brief Reset an ULPFEC encoder, to start a new group
+ * @param[in] enc The janus_ulpfec_encoder instance */
+void janus_ulpfec_encoder_reset(janus_ulpfec_encoder *enc);
+/*! \brief Add an (unencrypted, not RED encapsulated) RTP packet to the current group
+ * @param[in] enc The janus_ulpfec_encoder instance
+ * @param[in] packet The RTP packet
+ * @param[in] len The length of the packet
+ * @returns The number of packets in the group, or a negative integer if the packet can't be protected */
+int janus_ulpfec_encoder_add(janus_ulpfec_encoder *enc, const char *packet, int len);
+/*! \brief Write the RED encapsulated ULPFEC packet protecting the current group, and reset the encoder
+ * @param[in] enc The janus_ulpfec_encoder instance
+ * @param[in] ssrc The SSRC of the media
+ * @param[in] seq The sequence number to use for the FEC packet
+ * @param[in] red_pt The RED payload type
+ * @param[in] ulpfec_pt The ULPFEC payload type
+ * @param[out] buffer Where to write the packet
+ * @param[in] size The size of the buffer
+ * @returns The length of the packet, or a negative integer in case of errors */
+int janus_ulpfec_encoder_generate(janus_ulpfec_encoder *enc, uint32_t ssrc, uint16_t seq,
+	int red_pt, int ulpfec_pt, char *buffer, int size);
+/*! \brief Pick how many media packets a single ULPFEC packet should protect
+ * @param[in] loss The packet loss the peer reported, in percentage
+ * @returns The size of the groups, or 0 if no protection is needed */
+int janus_ulpfec_group_size(uint32_t loss);
+
+/*! \brief RED encoder, remembering the latest frames to repeat them */
+typedef struct janus_red_encoder {
+	/*! \brief The latest frames, oldest first */
+	struct {
+		uint32_t timestamp;
+		uint8_t pt;
+		uint16_t length;
+		char data[JANUS_RED_MAX_BLOCK];
+	} blocks[JANUS_RED_MAX_DISTANCE];
+	/*! \brief Number of frames we have */
+	int count;
+} janus_red_encoder;
+
+/*! \brief Encapsulate an RTP packet in RED, in place, adding up to \c distance previous frames
+ * \note The packet is always remembered for the next calls: if \c distance is 0,
+ * or the RED packet wouldn't fit in the buffer, it's left as it is
+ * @param[in] enc The janus_red_encoder instance
+ * @param[in,out] packet The RTP packet
+ * @param[in] len The length of the packet
+ * @param[in] size The size of the buffer containing the packet
+ * @param[in] red_pt The RED payload type
+ * @param[in] distance How many previous frames to add
+ * @returns The new length of the packet */
+int janus_red_encode(janus_red_encoder *enc, char *packet, int len, int size, int red_pt, int distance);
+/*! \brief Encapsulate an RTP packet in RED, in place, as a single block (e.g., for video)
+ * @param[in,out] packet The RTP packet
+ * @param[in] len The length of the packet
+ * @param[in] size The size of the buffer containing the packet
+ * @param[in] red_pt The RED payload type
+ * @returns The new length of the packet, or a negative integer if it doesn't fit */
+int janus_red_wrap(char *packet, int len, int size, int red_pt);
+/*! \brief Pick how many previous frames RED packets should carry
+ * @param[in] loss The packet loss the peer reported, in percentage
+ * @returns The redundancy distance, or 0 if no protection is needed */
+int janus_red_distance(uint32_t loss);
+
+/*! \brief Protection state of a PeerConnection */
+typedef struct janus_fec_context {
+	/*! \brief RED and ULPFEC payload types, if the peer negotiated them (0 otherwise) */
+	int audio_red_pt, video_red_pt, video_ulpfec_pt;
+	/*! \brief Audio RED encoder */
+	janus_red_encoder red;
+	/*! \brief Video ULPFEC encoder */
+	janus_ulpfec_encoder ulpfec;
+	/*! \brief How many sequence numbers the ULPFEC packets took so far */
+	uint16_t seq_offset;
+	/*! \brief Current video group size and audio redundancy distance */
+	int group_size, distance;
+	/*! \brief ULPFEC packet waiting to be sent, if any */
+	char packet[JANUS_FEC_MAX_PACKET];
+	int packet_length;
+	/*! \brief Number of ULPFEC packets and of RED packets with redundancy we sent */
+	guint64 fec_packets, red_packets;
+} janus_fec_context;
+
+#endif
@@ -0,0 +1,1017 @@
+/*! \file    ice-mux.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    ICE-Lite on shared ports
+ * \details  Implementation of the shared ports static event loops can use
+ * when ICE-Lite is enabled. Each loop binds the same port on all local
+ * addresses, and polls the sockets from its own context: STUN requests
+ * are validated and answered with the libnice STUN library (which means
+ * we get short-term credentials, FINGERPRINT and role conflicts right
+ * for free), while all other packets are passed to the core as if they
+ * came from libnice. PeerConnections are found by ufrag, and addresses
+ * that passed a check routed to them, in global tables: each loop keeps
+ * its own cache of the routes it uses, though, so that the media path
+ * only needs the mutex of the loop, which is only contended when routes
+ * come and go.
+ *
+ * Optionally, all loops can bind the same port, using SO_REUSEPORT: in
+ * that case it's the kernel that decides which loop gets the packets of
+ * each flow, which may not be the loop serving the handle. When that
+ * happens, packets are copied and handed over to the right loop, until
+ * the core migrates the handle to the loop that actually receives them.
+ *
+ * On Linux, a classic BPF filter can also be attached to the sockets, so
+ * that the kernel drops whatever can't be STUN, DTLS, RTP or RTCP (RFC 7983)
+ * before it's queued: junk sent to the shared ports by scanners then never
+ * wakes up the loops. Packets that look right but come from addresses that
+ * never passed a check still get to us, and are dropped when routing them.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
+#include <stun/stunagent.h>
+#include <stun/usages/ice.h>
+
+#include "ice-mux.h"
+#include "debug.h"
+#include "mutex.h"
+#include "refcount.h"
+#include "utils.h"
+
+/* How many packets we try to read at once, and how many times in a row */
+#define JANUS_ICE_MUX_BATCH			32
+#define JANUS_ICE_MUX_BATCH_ROUNDS	4
+/* Size of the kernel buffers of the shared sockets, since many PeerConnections use them */
+#define JANUS_ICE_MUX_SOCKET_BUFFER	(4*1024*1024)
+/* How many remote addresses we route to the same PeerConnection, at most */
+#define JANUS_ICE_MUX_MAX_ADDRESSES	8
+/* Consent is lost if we don't get any valid check for this long (RFC 7675) */
+#define JANUS_ICE_MUX_CONSENT_TIMEOUT	(30*G_USEC_PER_SEC)
+#define JANUS_ICE_MUX_CONSENT_CHECK		5
+
+/* Configuration */
+static gboolean mux_enabled = FALSE;
+static uint16_t mux_min_port = 0, mux_max_port = 0;
+static GList *mux_addresses = NULL;
+static int mux_tos = 0;
+static gboolean mux_reuseport = FALSE;
+static gboolean mux_filter = FALSE;
+static janus_ice_mux_recv_cb mux_recv = NULL;
+static janus_ice_mux_nominated_cb mux_nominated = NULL;
+static janus_ice_mux_expired_cb mux_expired = NULL;
+/* Ports currently bound by a loop (unless they're all sharing the same) */
+static GHashTable *mux_ports = NULL;
+/* Loops, PeerConnections by local ufrag, and PeerConnections by remote
+ * address: the mutex also protects the consent and nomination state */
+static GSList *mux_loops = NULL;
+static GHashTable *mux_ufrags = NULL, *mux_routes = NULL;
+static janus_mutex mux_mutex = JANUS_MUTEX_INITIALIZER;
+
+/* Remote address, in a form we can use as a key: the structure has no
+ * padding, and unused bytes are always zeroed, so we can just memcmp it */
+typedef struct janus_ice_mux_address {
+	guint16 family, port;
+	guint8 addr[16];
+} janus_ice_mux_address;
+static void janus_ice_mux_address_from_sockaddr(janus_ice_mux_address *key, const struct sockaddr_storage *ss) {
+	memset(key, 0, sizeof(*key));
+	key->family = ss->ss_family;
+	if(ss->ss_family == AF_INET) {
+		const struct sockaddr_in *sin = (const struct sockaddr_in *)ss;
+		key->port = sin->sin_port;
+		memcpy(key->addr, &sin->sin_addr, sizeof(sin->sin_addr));
+	} else if(ss->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+		key->port = sin6->sin6_port;
+		memcpy(key->addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+	}
+}
+static guint janus_ice_mux_address_hash(gconstpointer v) {
+	const janus_ice_mux_address *key = (const janus_ice_mux_address *)v;
+	guint hash = key->family * 31 + key->port;
+	int i = 0;
+	for(i=0; i<16; i++)
+		hash = hash * 31 + key->addr[i];
+	return hash;
+}
+static gboolean janus_ice_mux_address_equal(gconstpointer a, gconstpointer b) {
+	return memcmp(a, b, sizeof(janus_ice_mux_address)) == 0;
+}
+
+/* Socket bound to the shared port on one of the local addresses */
+typedef struct janus_ice_mux_socket {
+	janus_ice_mux_loop *mux;
+	int fd;
+	char address[INET6_ADDRSTRLEN];
+	struct sockaddr_storage local;
+	GSource *source;
+	/* Set when the loop goes away, and the socket left the SO_REUSEPORT group */
+	volatile gint retired;
+} janus_ice_mux_socket;
+/* Source polling a socket from the context of the loop */
+typedef struct janus_ice_mux_source {
+	GSource parent;
+	janus_ice_mux_socket *socket;
+} janus_ice_mux_source;
+
+/* Buffers we read packets in: there's one per loop, as only its thread uses it */
+typedef struct janus_ice_mux_batch {
+	char buffers[JANUS_ICE_MUX_BATCH][1500];
+	int lengths[JANUS_ICE_MUX_BATCH];
+	struct sockaddr_storage addresses[JANUS_ICE_MUX_BATCH];
+	socklen_t addrlens[JANUS_ICE_MUX_BATCH];
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[JANUS_ICE_MUX_BATCH];
+	struct iovec iovecs[JANUS_ICE_MUX_BATCH];
+#endif
+} janus_ice_mux_batch;
+
+/* Packet received by a loop other than the one serving its PeerConnection */
+typedef struct janus_ice_mux_handoff {
+	janus_ice_component *component;
+	int len;
+	char buf[];
+} janus_ice_mux_handoff;
+/* Source processing the packets handed over to a loop */
+typedef struct janus_ice_mux_handoff_source {
+	GSource parent;
+	janus_ice_mux_loop *mux;
+} janus_ice_mux_handoff_source;
+
+struct janus_ice_mux_loop {
+	/* ID of the loop, and port we bound to */
+	int id;
+	uint16_t port;
+	/* Context of the loop, the sockets it polls, and the consent timer */
+	GMainContext *mainctx;
+	GSList *sockets;
+	GSource *consent_source;
+	/* Packets other loops received for PeerConnections we serve */
+	GAsyncQueue *handoff;
+	GSource *handoff_source;
+	/* STUN agent we validate and answer checks with, and our tie-breaker */
+	StunAgent stun;
+	guint64 tie;
+	janus_ice_mux_batch *batch;
+	/* Cache of the routes this loop received packets on */
+	GHashTable *addresses;
+	janus_mutex mutex;
+	volatile gint destroyed;
+	janus_refcount ref;
+};
+
+struct janus_ice_mux_peer {
+	/* Loop serving this PeerConnection (also protected by mutex), and component we route packets to */
+	janus_ice_mux_loop *mux;
+	janus_ice_component *component;
+	/* Local credentials */
+	char *ufrag, *pwd;
+	/* Remote addresses routed to this PeerConnection */
+	GSList *addresses;
+	/* Nominated address, and socket to send to it from (also protected by mutex) */
+	gboolean nominated;
+	janus_ice_mux_socket *socket;
+	janus_ice_mux_address selected;
+	struct sockaddr_storage remote;
+	/* Last time we got a valid check, and whether consent expired */
+	gint64 last_consent;
+	gboolean expired;
+	janus_mutex mutex;
+};
+
+#ifdef SO_ATTACH_FILTER
+/* Socket filter demultiplexing on the first byte as RFC 7983 does: STUN (with the
+ * magic cookie), DTLS, RTP and RTCP are accepted, and anything else is dropped.
+ * Notice that UDP socket filters see the UDP header too, hence the offsets */
+#define JANUS_ICE_MUX_UDP_HEADER	8
+static struct sock_filter janus_ice_mux_filter_code[] = {
+	/* Anything shorter than an RTP header is dropped */
+	BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, JANUS_ICE_MUX_UDP_HEADER+12, 0, 11),
+	BPF_STMT(BPF_LD|BPF_B|BPF_ABS, JANUS_ICE_MUX_UDP_HEADER),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 4, 4, 0),
+	/* [0..3] STUN, but only if there's a full header with the magic cookie */
+	BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, JANUS_ICE_MUX_UDP_HEADER+20, 0, 7),
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, JANUS_ICE_MUX_UDP_HEADER+4),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x2112A442, 4, 5),
+	/* [128..191] RTP and RTCP */
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 192, 4, 0),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 128, 2, 0),
+	/* [20..63] DTLS */
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 64, 2, 0),
+	BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 20, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, 0xFFFFFFFF),
+	BPF_STMT(BPF_RET|BPF_K, 0)
+};
+#endif
+
+static socklen_t janus_ice_mux_sockaddr_len(const struct sockaddr_storage *ss) {
+	return ss->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+/* Initialization */
+int janus_ice_mux_init(uint16_t min_port, uint16_t max_port, GList *addresses, int tos, gboolean reuseport, gboolean filter,
+		janus_ice_mux_recv_cb recv_cb, janus_ice_mux_nominated_cb nominated_cb, janus_ice_mux_expired_cb expired_cb) {
+	if(min_port == 0 || max_port < min_port) {
+		JANUS_LOG(LOG_ERR, "Invalid port range for ICE-Lite shared ports: %"SCNu16"-%"SCNu16"\n", min_port, max_port);
+		return -1;
+	}
+	if(addresses == NULL) {
+		JANUS_LOG(LOG_ERR, "No local address for ICE-Lite shared ports\n");
+		return -1;
+	}
+	if(recv_cb == NULL || nominated_cb == NULL || expired_cb == NULL) {
+		JANUS_LOG(LOG_ERR, "Missing callbacks for ICE-Lite shared ports\n");
+		return -1;
+	}
+#ifndef SO_REUSEPORT
+	if(reuseport) {
+		JANUS_LOG(LOG_WARN, "SO_REUSEPORT not available, each loop will bind its own port\n");
+		reuseport = FALSE;
+	}
+#endif
+#ifndef SO_ATTACH_FILTER
+	if(filter) {
+		JANUS_LOG(LOG_WARN, "Socket filters not available, unsolicited traffic will be dropped in user space\n");
+		filter = FALSE;
+	}
+#endif
+	janus_mutex_lock(&mux_mutex);
+	mux_min_port = min_port;
+	mux_max_port = max_port;
+	GList *a = addresses;
+	while(a) {
+		mux_addresses = g_list_append(mux_addresses, g_strdup((char *)a->data));
+		a = a->next;
+	}
+	mux_tos = tos;
+	mux_reuseport = reuseport;
+	mux_filter = filter;
+	mux_recv = recv_cb;
+	mux_nominated = nominated_cb;
+	mux_expired = expired_cb;
+	mux_ports = g_hash_table_new(NULL, NULL);
+	mux_ufrags = g_hash_table_new(g_str_hash, g_str_equal);
+	mux_routes = g_hash_table_new_full(janus_ice_mux_address_hash, janus_ice_mux_address_equal,
+		(GDestroyNotify)g_free, NULL);
+	mux_enabled = TRUE;
+	janus_mutex_unlock(&mux_mutex);
+	JANUS_LOG(LOG_INFO, "ICE-Lite shared ports enabled: %"SCNu16"-%"SCNu16" on %d address(es)%s%s\n",
+		min_port, max_port, g_list_length(mux_addresses), reuseport ? ", shared by all loops" : "",
+		filter ? ", filtered in the kernel" : "");
+	return 0;
+}
+
+void janus_ice_mux_deinit(void) {
+	janus_mutex_lock(&mux_mutex);
+	mux_enabled = FALSE;
+	g_list_free_full(mux_addresses, (GDestroyNotify)g_free);
+	mux_addresses = NULL;
+	if(mux_ports != NULL)
+		g_hash_table_destroy(mux_ports);
+	mux_ports = NULL;
+	if(mux_ufrags != NULL)
+		g_hash_table_destroy(mux_ufrags);
+	mux_ufrags = NULL;
+	if(mux_routes != NULL)
+		g_hash_table_destroy(mux_routes);
+	mux_routes = NULL;
+	janus_mutex_unlock(&mux_mutex);
+}
+
+gboolean janus_ice_mux_is_enabled(void) {
+	return mux_enabled;
+}
+
+/* Reading packets */
+static int janus_ice_mux_batch_recv(janus_ice_mux_batch *batch, int fd) {
+	int i = 0;
+#ifdef HAVE_RECVMMSG
+	for(i=0; i<JANUS_ICE_MUX_BATCH; i++) {
+		batch->msgs[i].msg_len = 0;
+		batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addresses[i]);
+	}
+	int count = recvmmsg(fd, batch->msgs, JANUS_ICE_MUX_BATCH, MSG_DONTWAIT, NULL);
+	if(count < 1)
+		return 0;
+	for(i=0; i<count; i++) {
+		batch->lengths[i] = batch->msgs[i].msg_len;
+		batch->addrlens[i] = batch->msgs[i].msg_hdr.msg_namelen;
+	}
+	return count;
+#else
+	for(i=0; i<JANUS_ICE_MUX_BATCH; i++) {
+		batch->addrlens[i] = sizeof(batch->addresses[i]);
+		int bytes = recvfrom(fd, batch->buffers[i], sizeof(batch->buffers[i]), MSG_DONTWAIT,
+			(struct sockaddr *)&batch->addresses[i], &batch->addrlens[i]);
+		if(bytes < 0)
+			break;
+		batch->lengths[i] = bytes;
+	}
+	return i;
+#endif
+}
+
+/* Stop routing a remote address to a PeerConnection, in the global table
+ * and in the caches of all loops: must be called with mux_mutex locked */
+static void janus_ice_mux_route_remove(const janus_ice_mux_address *key, janus_ice_mux_peer *peer) {
+	if(g_hash_table_lookup(mux_routes, key) == peer)
+		g_hash_table_remove(mux_routes, key);
+	GSList *l = mux_loops;
+	while(l) {
+		janus_ice_mux_loop *mux = (janus_ice_mux_loop *)l->data;
+		janus_mutex_lock(&mux->mutex);
+		if(g_hash_table_lookup(mux->addresses, key) == peer)
+			g_hash_table_remove(mux->addresses, key);
+		janus_mutex_unlock(&mux->mutex);
+		l = l->next;
+	}
+}
+
+/* Route a remote address to a PeerConnection: must be called with mux_mutex locked */
+static void janus_ice_mux_peer_add_address(janus_ice_mux_peer *peer, const janus_ice_mux_address *key) {
+	janus_ice_mux_peer *owner = g_hash_table_lookup(mux_routes, key);
+	if(owner == peer)
+		return;
+	GSList *l = NULL;
+	if(owner != NULL) {
+		/* The address was used by another PeerConnection (e.g., a NAT reused a port) */
+		janus_ice_mux_route_remove(key, owner);
+		for(l = owner->addresses; l; l = l->next) {
+			if(janus_ice_mux_address_equal(l->data, key)) {
+				g_free(l->data);
+				owner->addresses = g_slist_delete_link(owner->addresses, l);
+				break;
+			}
+		}
+	}
+	janus_ice_mux_address *copy = g_malloc(sizeof(janus_ice_mux_address));
+	memcpy(copy, key, sizeof(janus_ice_mux_address));
+	g_hash_table_insert(mux_routes, copy, peer);
+	copy = g_malloc(sizeof(janus_ice_mux_address));
+	memcpy(copy, key, sizeof(janus_ice_mux_address));
+	peer->addresses = g_slist_append(peer->addresses, copy);
+	if(g_slist_length(peer->addresses) <= JANUS_ICE_MUX_MAX_ADDRESSES)
+		return;
+	/* Too many addresses, forget the oldest one (unless it's the nominated one) */
+	for(l = peer->addresses; l; l = l->next) {
+		if(peer->nominated && janus_ice_mux_address_equal(l->data, &peer->selected))
+			continue;
+		janus_ice_mux_route_remove(l->data, peer);
+		g_free(l->data);
+		peer->addresses = g_slist_delete_link(peer->addresses, l);
+		break;
+	}
+}
+
+/* Callback the STUN agent invokes to get the password to validate a check with:
+ * this is invoked with mux_mutex locked, so the password is safe */
+typedef struct janus_ice_mux_check {
+	janus_ice_mux_peer *peer;
+} janus_ice_mux_check;
+static bool janus_ice_mux_stun_credentials(StunAgent *agent, StunMessage *message,
+		uint8_t *username, uint16_t username_len, uint8_t **password, size_t *password_len, void *user_data) {
+	janus_ice_mux_check *check = (janus_ice_mux_check *)user_data;
+	/* The USERNAME of a check is "<our ufrag>:<their ufrag>" */
+	char ufrag[257];
+	uint16_t i = 0;
+	while(i < username_len && username[i] != ':')
+		i++;
+	if(i == 0 || i == username_len || i >= sizeof(ufrag))
+		return false;
+	memcpy(ufrag, username, i);
+	ufrag[i] = '\0';
+	janus_ice_mux_peer *peer = g_hash_table_lookup(mux_ufrags, ufrag);
+	if(peer == NULL || peer->component == NULL)
+		return false;
+	check->peer = peer;
+	*password = (uint8_t *)peer->pwd;
+	*password_len = strlen(peer->pwd);
+	return true;
+}
+
+/* Pass a packet to the core, from the thread of the loop serving its PeerConnection */
+static void janus_ice_mux_deliver(janus_ice_mux_loop *mux, janus_ice_component *component, char *buf, int len) {
+	janus_ice_mux_peer *peer = component->mux;
+	janus_ice_mux_loop *home = NULL;
+	if(peer != NULL) {
+		janus_mutex_lock(&peer->mutex);
+		if(peer->mux != mux) {
+			home = peer->mux;
+			janus_refcount_increase(&home->ref);
+		}
+		janus_mutex_unlock(&peer->mutex);
+	}
+	if(home == NULL) {
+		mux_recv(component, buf, len);
+		return;
+	}
+	/* Another loop is serving this PeerConnection, hand the packet over */
+	if(!g_atomic_int_get(&home->destroyed)) {
+		janus_ice_mux_handoff *pkt = g_malloc(sizeof(janus_ice_mux_handoff) + len);
+		janus_refcount_increase(&component->ref);
+		pkt->component = component;
+		pkt->len = len;
+		memcpy(pkt->buf, buf, len);
+		g_async_queue_push(home->handoff, pkt);
+		g_main_context_wakeup(home->mainctx);
+	}
+	janus_refcount_decrease(&home->ref);
+}
+static void janus_ice_mux_handoff_free(janus_ice_mux_handoff *pkt) {
+	janus_refcount_decrease(&pkt->component->ref);
+	g_free(pkt);
+}
+
+static gboolean janus_ice_mux_handoff_prepare(GSource *source, gint *timeout) {
+	janus_ice_mux_loop *mux = ((janus_ice_mux_handoff_source *)source)->mux;
+	return g_async_queue_length(mux->handoff) > 0;
+}
+static gboolean janus_ice_mux_handoff_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+	janus_ice_mux_loop *mux = ((janus_ice_mux_handoff_source *)source)->mux;
+	janus_ice_mux_handoff *pkt = NULL;
+	while((pkt = g_async_queue_try_pop(mux->handoff)) != NULL) {
+		/* The handle may have been migrated meanwhile, in which case this hands it over again */
+		janus_ice_mux_deliver(mux, pkt->component, pkt->buf, pkt->len);
+		janus_ice_mux_handoff_free(pkt);
+	}
+	return G_SOURCE_CONTINUE;
+}
+static GSourceFuncs janus_ice_mux_handoff_funcs = {
+	janus_ice_mux_handoff_prepare,
+	NULL,	/* We don't need check */
+	janus_ice_mux_handoff_dispatch,
+	NULL,
+	NULL, NULL
+};
+
+/* Handle a STUN message: we only care about binding requests, i.e., connectivity and consent checks */
+static void janus_ice_mux_incoming_stun(janus_ice_mux_socket *s, char *buf, int len,
+		struct sockaddr_storage *from, socklen_t fromlen) {
+	janus_ice_mux_loop *mux = s->mux;
+	StunMessage msg, reply;
+	uint8_t rbuf[1280];
+	size_t rlen = sizeof(rbuf);
+	bool control = false;
+	janus_ice_mux_check check = { .peer = NULL };
+	janus_ice_component *nominated = NULL;
+	struct sockaddr_storage local, remote;
+	janus_mutex_lock(&mux_mutex);
+	StunValidationStatus status = stun_agent_validate(&mux->stun, &msg, (uint8_t *)buf, len,
+		janus_ice_mux_stun_credentials, &check);
+	if(status != STUN_VALIDATION_SUCCESS || check.peer == NULL ||
+			stun_message_get_class(&msg) != STUN_REQUEST || stun_message_get_method(&msg) != STUN_BINDING) {
+		janus_mutex_unlock(&mux_mutex);
+		JANUS_LOG(LOG_HUGE, "[mux#%d] Ignoring STUN message (validation status %d)\n", mux->id, status);
+		return;
+	}
+	janus_ice_mux_peer *peer = check.peer;
+	StunUsageIceReturn ret = stun_usage_ice_conncheck_create_reply(&mux->stun, &msg, &reply, rbuf, &rlen,
+		from, fromlen, &control, mux->tie, STUN_USAGE_ICE_COMPATIBILITY_RFC5245);
+	if(ret == STUN_USAGE_ICE_RETURN_SUCCESS && !control) {
+		/* Valid check: route this address to the PeerConnection, and refresh consent */
+		janus_ice_mux_address key;
+		janus_ice_mux_address_from_sockaddr(&key, from);
+		janus_ice_mux_peer_add_address(peer, &key);
+		peer->last_consent = janus_get_monotonic_time();
+		gboolean was_expired = peer->expired;
+		peer->expired = FALSE;
+		/* Sockets of different loops bound to the same address and port are equivalent */
+		gboolean same_pair = peer->nominated && janus_ice_mux_address_equal(&peer->selected, &key) &&
+			!memcmp(&peer->socket->local, &s->local, janus_ice_mux_sockaddr_len(&s->local));
+		if(same_pair && peer->socket != s) {
+			/* The kernel is giving this flow to another loop now: send from its socket too */
+			janus_mutex_lock(&peer->mutex);
+			peer->socket = s;
+			janus_mutex_unlock(&peer->mutex);
+		}
+		if(stun_usage_ice_conncheck_use_candidate(&msg) && !same_pair) {
+			/* We're ICE-Lite, so the pair the peer nominates is the one we use */
+			janus_mutex_lock(&peer->mutex);
+			peer->nominated = TRUE;
+			peer->socket = s;
+			memcpy(&peer->selected, &key, sizeof(key));
+			memcpy(&peer->remote, from, fromlen);
+			janus_mutex_unlock(&peer->mutex);
+			nominated = peer->component;
+		} else if(was_expired && peer->nominated) {
+			/* Consent is back before the handle went away: notify the pair again */
+			nominated = peer->component;
+		}
+		if(nominated != NULL) {
+			janus_refcount_increase(&nominated->ref);
+			memcpy(&local, &peer->socket->local, sizeof(local));
+			memcpy(&remote, &peer->remote, sizeof(remote));
+		}
+	}
+	janus_mutex_unlock(&mux_mutex);
+	if(ret == STUN_USAGE_ICE_RETURN_SUCCESS || ret == STUN_USAGE_ICE_RETURN_ROLE_CONFLICT) {
+		if(sendto(s->fd, rbuf, rlen, 0, (struct sockaddr *)from, fromlen) < 0) {
+			JANUS_LOG(LOG_HUGE, "[mux#%d] Error sending STUN response: %d (%s)\n",
+				mux->id, errno, g_strerror(errno));
+		}
+	}
+	if(nominated != NULL) {
+		mux_nominated(nominated, (struct sockaddr *)&local, (struct sockaddr *)&remote);
+		janus_refcount_decrease(&nominated->ref);
+	}
+}
+
+static void janus_ice_mux_incoming(janus_ice_mux_socket *s, char *buf, int len,
+		struct sockaddr_storage *from, socklen_t fromlen) {
+	/* STUN messages start with a byte in [0..3], DTLS records with one in [20..63] (RFC 7983) */
+	if(len >= 20 && (guint8)buf[0] < 4) {
+		janus_ice_mux_incoming_stun(s, buf, len, from, fromlen);
+		return;
+	}
+	janus_ice_mux_loop *mux = s->mux;
+	janus_ice_mux_address key;
+	janus_ice_mux_address_from_sockaddr(&key, from);
+	janus_mutex_lock(&mux->mutex);
+	janus_ice_mux_peer *peer = g_hash_table_lookup(mux->addresses, &key);
+	janus_ice_component *component = peer ? peer->component : NULL;
+	if(component != NULL)
+		janus_refcount_increase(&component->ref);
+	janus_mutex_unlock(&mux->mutex);
+	if(peer == NULL) {
+		/* Not a route we used yet: the check may have been received by
+		 * another loop, e.g., because the SO_REUSEPORT group changed */
+		janus_mutex_lock(&mux_mutex);
+		peer = g_hash_table_lookup(mux_routes, &key);
+		component = peer ? peer->component : NULL;
+		if(component != NULL) {
+			janus_refcount_increase(&component->ref);
+			janus_ice_mux_address *copy = g_malloc(sizeof(janus_ice_mux_address));
+			memcpy(copy, &key, sizeof(janus_ice_mux_address));
+			janus_mutex_lock(&mux->mutex);
+			g_hash_table_insert(mux->addresses, copy, peer);
+			janus_mutex_unlock(&mux->mutex);
+		}
+		janus_mutex_unlock(&mux_mutex);
+	}
+	if(component == NULL) {
+		/* Not from an address that passed a check */
+		return;
+	}
+	janus_ice_mux_deliver(mux, component, buf, len);
+	janus_refcount_decrease(&component->ref);
+}
+
+static gboolean janus_ice_mux_socket_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+	janus_ice_mux_socket *s = ((janus_ice_mux_source *)source)->socket;
+	janus_ice_mux_loop *mux = s->mux;
+	janus_ice_mux_batch *batch = mux->batch;
+	/* Don't starve the other sources of the loop: whatever we don't read
+	 * now will still be there at the next iteration */
+	int rounds = 0;
+	for(rounds=0; rounds<JANUS_ICE_MUX_BATCH_ROUNDS; rounds++) {
+		int count = janus_ice_mux_batch_recv(batch, s->fd);
+		int i = 0;
+		for(i=0; i<count; i++) {
+			janus_ice_mux_incoming(s, batch->buffers[i], batch->lengths[i],
+				&batch->addresses[i], batch->addrlens[i]);
+		}
+		if(count < JANUS_ICE_MUX_BATCH)
+			break;
+	}
+	return G_SOURCE_CONTINUE;
+}
+static GSourceFuncs janus_ice_mux_socket_funcs = {
+	NULL,
+	NULL,
+	janus_ice_mux_socket_dispatch,
+	NULL,
+	NULL, NULL
+};
+
+/* Check which of the PeerConnections we serve stopped sending consent checks */
+static gboolean janus_ice_mux_consent_check(gpointer user_data) {
+	janus_ice_mux_loop *mux = (janus_ice_mux_loop *)user_data;
+	gint64 now = janus_get_monotonic_time();
+	GSList *expired = NULL;
+	janus_mutex_lock(&mux_mutex);
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, mux_ufrags);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_ice_mux_peer *peer = value;
+		if(peer->mux != mux || peer->component == NULL || !peer->nominated || peer->expired ||
+				now - peer->last_consent < JANUS_ICE_MUX_CONSENT_TIMEOUT)
+			continue;
+		peer->expired = TRUE;
+		janus_refcount_increase(&peer->component->ref);
+		expired = g_slist_prepend(expired, peer->component);
+	}
+	janus_mutex_unlock(&mux_mutex);
+	while(expired) {
+		janus_ice_component *component = (janus_ice_component *)expired->data;
+		mux_expired(component);
+		janus_refcount_decrease(&component->ref);
+		expired = g_slist_delete_link(expired, expired);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+/* Shared ports */
+static void janus_ice_mux_loop_free(const janus_refcount *mux_ref) {
+	janus_ice_mux_loop *mux = janus_refcount_containerof(mux_ref, janus_ice_mux_loop, ref);
+	/* This shared port is not used by anyone anymore, close the sockets */
+	GSList *l = mux->sockets;
+	while(l) {
+		janus_ice_mux_socket *s = (janus_ice_mux_socket *)l->data;
+		close(s->fd);
+		g_free(s);
+		l = l->next;
+	}
+	g_slist_free(mux->sockets);
+	janus_mutex_lock(&mux_mutex);
+	mux_loops = g_slist_remove(mux_loops, mux);
+	if(mux_ports != NULL && !mux_reuseport)
+		g_hash_table_remove(mux_ports, GUINT_TO_POINTER(mux->port));
+	janus_mutex_unlock(&mux_mutex);
+	janus_ice_mux_handoff *pkt = NULL;
+	while((pkt = g_async_queue_try_pop(mux->handoff)) != NULL)
+		janus_ice_mux_handoff_free(pkt);
+	g_async_queue_unref(mux->handoff);
+	g_hash_table_destroy(mux->addresses);
+	g_free(mux->batch);
+	g_free(mux);
+}
+
+/* Bind a non-blocking socket to an address and port: must be called with the mux_mutex lock held */
+static int janus_ice_mux_bind(const char *address, uint16_t port, struct sockaddr_storage *local) {
+	memset(local, 0, sizeof(*local));
+	struct sockaddr_in *sin = (struct sockaddr_in *)local;
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)local;
+	if(inet_pton(AF_INET, address, &sin->sin_addr) == 1) {
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+	} else if(inet_pton(AF_INET6, address, &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+	int fd = socket(local->ss_family, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd < 0)
+		return -1;
+	if(local->ss_family == AF_INET6) {
+		int v6only = 1;
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+	}
+#ifdef SO_REUSEPORT
+	if(mux_reuseport) {
+		/* All loops bind the same port, and the kernel spreads the flows among them */
+		int reuse = 1;
+		if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+			int error = errno;
+			close(fd);
+			errno = error;
+			return -1;
+		}
+	}
+#endif
+	if(bind(fd, (struct sockaddr *)local, janus_ice_mux_sockaddr_len(local)) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	/* These are best effort, the kernel may cap the buffers */
+	int size = JANUS_ICE_MUX_SOCKET_BUFFER;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	if(mux_tos > 0) {
+		if(local->ss_family == AF_INET)
+			setsockopt(fd, IPPROTO_IP, IP_TOS, &mux_tos, sizeof(mux_tos));
+		else
+			setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, &mux_tos, sizeof(mux_tos));
+	}
+#ifdef SO_ATTACH_FILTER
+	if(mux_filter) {
+		struct sock_fprog prog = {
+			.len = G_N_ELEMENTS(janus_ice_mux_filter_code),
+			.filter = janus_ice_mux_filter_code
+		};
+		if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+			JANUS_LOG(LOG_WARN, "Error attaching the filter to the shared port %"SCNu16": %d (%s)\n",
+				port, errno, g_strerror(errno));
+		}
+	}
+#endif
+	return fd;
+}
+
+janus_ice_mux_loop *janus_ice_mux_loop_create(int id, GMainContext *mainctx) {
+	if(!mux_enabled || mainctx == NULL)
+		return NULL;
+	janus_ice_mux_loop *mux = g_malloc0(sizeof(janus_ice_mux_loop));
+	mux->id = id;
+	mux->mainctx = mainctx;
+	/* Look for a port we can bind on all addresses */
+	janus_mutex_lock(&mux_mutex);
+	guint port = 0;
+	for(port = mux_min_port; port <= mux_max_port && mux->sockets == NULL; port++) {
+		if(!mux_reuseport && g_hash_table_contains(mux_ports, GUINT_TO_POINTER(port)))
+			continue;
+		GList *a = mux_addresses;
+		while(a) {
+			const char *address = (const char *)a->data;
+			janus_ice_mux_socket *s = g_malloc0(sizeof(janus_ice_mux_socket));
+			s->mux = mux;
+			s->fd = janus_ice_mux_bind(address, port, &s->local);
+			if(s->fd < 0) {
+				JANUS_LOG(LOG_VERB, "[mux#%d] Couldn't bind to %s:%u: %d (%s)\n",
+					id, address, port, errno, g_strerror(errno));
+				g_free(s);
+				break;
+			}
+			g_strlcpy(s->address, address, sizeof(s->address));
+			mux->sockets = g_slist_append(mux->sockets, s);
+			a = a->next;
+		}
+		if(a != NULL) {
+			/* Not all addresses are available on this port, try the next one */
+			GSList *l = mux->sockets;
+			while(l) {
+				janus_ice_mux_socket *s = (janus_ice_mux_socket *)l->data;
+				close(s->fd);
+				g_free(s);
+				l = l->next;
+			}
+			g_slist_free(mux->sockets);
+			mux->sockets = NULL;
+			continue;
+		}
+		mux->port = port;
+		if(!mux_reuseport)
+			g_hash_table_insert(mux_ports, GUINT_TO_POINTER(port), GUINT_TO_POINTER(port));
+	}
+	janus_mutex_unlock(&mux_mutex);
+	if(mux->sockets == NULL) {
+		JANUS_LOG(LOG_WARN, "[mux#%d] No shared port available in %"SCNu16"-%"SCNu16", handles of this loop will use libnice\n",
+			id, mux_min_port, mux_max_port);
+		g_free(mux);
+		return NULL;
+	}
+	stun_agent_init(&mux->stun, STUN_ALL_KNOWN_ATTRIBUTES, STUN_COMPATIBILITY_RFC5389,
+		STUN_AGENT_USAGE_SHORT_TERM_CREDENTIALS | STUN_AGENT_USAGE_USE_FINGERPRINT);
+	mux->tie = janus_random_uint64();
+	mux->batch = g_malloc0(sizeof(janus_ice_mux_batch));
+#ifdef HAVE_RECVMMSG
+	int i = 0;
+	for(i=0; i<JANUS_ICE_MUX_BATCH; i++) {
+		mux->batch->iovecs[i].iov_base = mux->batch->buffers[i];
+		mux->batch->iovecs[i].iov_len = sizeof(mux->batch->buffers[i]);
+		mux->batch->msgs[i].msg_hdr.msg_iov = &mux->batch->iovecs[i];
+		mux->batch->msgs[i].msg_hdr.msg_iovlen = 1;
+		mux->batch->msgs[i].msg_hdr.msg_name = &mux->batch->addresses[i];
+	}
+#endif
+	mux->addresses = g_hash_table_new_full(janus_ice_mux_address_hash, janus_ice_mux_address_equal,
+		(GDestroyNotify)g_free, NULL);
+	mux->handoff = g_async_queue_new();
+	janus_mutex_init(&mux->mutex);
+	janus_refcount_init(&mux->ref, janus_ice_mux_loop_free);
+	janus_mutex_lock(&mux_mutex);
+	mux_loops = g_slist_append(mux_loops, mux);
+	janus_mutex_unlock(&mux_mutex);
+	/* Start polling the sockets from the loop */
+	GSList *l = mux->sockets;
+	while(l) {
+		janus_ice_mux_socket *s = (janus_ice_mux_socket *)l->data;
+		s->source = g_source_new(&janus_ice_mux_socket_funcs, sizeof(janus_ice_mux_source));
+		((janus_ice_mux_source *)s->source)->socket = s;
+		g_source_set_priority(s->source, G_PRIORITY_DEFAULT);
+		g_source_add_unix_fd(s->source, s->fd, G_IO_IN | G_IO_ERR);
+		g_source_attach(s->source, mainctx);
+		JANUS_LOG(LOG_VERB, "[mux#%d] Listening on %s:%"SCNu16"\n", id, s->address, mux->port);
+		l = l->next;
+	}
+	mux->handoff_source = g_source_new(&janus_ice_mux_handoff_funcs, sizeof(janus_ice_mux_handoff_source));
+	((janus_ice_mux_handoff_source *)mux->handoff_source)->mux = mux;
+	g_source_set_priority(mux->handoff_source, G_PRIORITY_DEFAULT);
+	g_source_attach(mux->handoff_source, mainctx);
+	mux->consent_source = g_timeout_source_new_seconds(JANUS_ICE_MUX_CONSENT_CHECK);
+	g_source_set_callback(mux->consent_source, janus_ice_mux_consent_check, mux, NULL);
+	g_source_attach(mux->consent_source, mainctx);
+	JANUS_LOG(LOG_INFO, "[mux#%d] Static event loop bound to shared port %"SCNu16"\n", id, mux->port);
+	return mux;
+}
+
+void janus_ice_mux_loop_destroy(janus_ice_mux_loop *mux) {
+	if(mux == NULL || !g_atomic_int_compare_and_exchange(&mux->destroyed, 0, 1))
+		return;
+	GSList *l = mux->sockets;
+	while(l) {
+		janus_ice_mux_socket *s = (janus_ice_mux_socket *)l->data;
+		if(s->source != NULL) {
+			g_source_destroy(s->source);
+			g_source_unref(s->source);
+			s->source = NULL;
+		}
+		if(mux_reuseport) {
+			/* A socket in a SO_REUSEPORT group keeps on getting its share of the
+			 * flows until it's closed, even if nobody reads from it: we replace it
+			 * with an unbound one instead, so that the descriptor remains valid
+			 * for PeerConnections still sending through it until they move */
+			g_atomic_int_set(&s->retired, 1);
+			int fd = socket(s->local.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+			if(fd >= 0) {
+				dup2(fd, s->fd);
+				close(fd);
+			}
+		}
+		l = l->next;
+	}
+	if(mux->handoff_source != NULL) {
+		g_source_destroy(mux->handoff_source);
+		g_source_unref(mux->handoff_source);
+		mux->handoff_source = NULL;
+	}
+	if(mux->consent_source != NULL) {
+		g_source_destroy(mux->consent_source);
+		g_source_unref(mux->consent_source);
+		mux->consent_source = NULL;
+	}
+	janus_refcount_decrease(&mux->ref);
+}
+
+uint16_t janus_ice_mux_loop_get_port(janus_ice_mux_loop *mux) {
+	return mux ? mux->port : 0;
+}
+
+/* PeerConnections */
+janus_ice_mux_peer *janus_ice_mux_peer_create(janus_ice_mux_loop *mux, janus_ice_component *component,
+		const char *ufrag, const char *pwd) {
+	if(mux == NULL || component == NULL || ufrag == NULL || pwd == NULL)
+		return NULL;
+	if(g_atomic_int_get(&mux->destroyed))
+		return NULL;
+	janus_mutex_lock(&mux_mutex);
+	if(g_hash_table_lookup(mux_ufrags, ufrag) != NULL) {
+		janus_mutex_unlock(&mux_mutex);
+		JANUS_LOG(LOG_WARN, "[mux#%d] Local ufrag %s already in use\n", mux->id, ufrag);
+		return NULL;
+	}
+	janus_ice_mux_peer *peer = g_malloc0(sizeof(janus_ice_mux_peer));
+	janus_refcount_increase(&mux->ref);
+	peer->mux = mux;
+	janus_refcount_increase(&component->ref);
+	peer->component = component;
+	peer->ufrag = g_strdup(ufrag);
+	peer->pwd = g_strdup(pwd);
+	janus_mutex_init(&peer->mutex);
+	g_hash_table_insert(mux_ufrags, peer->ufrag, peer);
+	janus_mutex_unlock(&mux_mutex);
+	return peer;
+}
+
+int janus_ice_mux_peer_set_credentials(janus_ice_mux_peer *peer, const char *ufrag, const char *pwd) {
+	if(peer == NULL || ufrag == NULL || pwd == NULL)
+		return -1;
+	janus_mutex_lock(&mux_mutex);
+	if(peer->component == NULL) {
+		janus_mutex_unlock(&mux_mutex);
+		return -1;
+	}
+	janus_ice_mux_peer *owner = g_hash_table_lookup(mux_ufrags, ufrag);
+	if(owner != NULL && owner != peer) {
+		janus_mutex_unlock(&mux_mutex);
+		JANUS_LOG(LOG_WARN, "[mux#%d] Local ufrag %s already in use\n", peer->mux->id, ufrag);
+		return -2;
+	}
+	g_hash_table_remove(mux_ufrags, peer->ufrag);
+	g_free(peer->ufrag);
+	g_free(peer->pwd);
+	peer->ufrag = g_strdup(ufrag);
+	peer->pwd = g_strdup(pwd);
+	g_hash_table_insert(mux_ufrags, peer->ufrag, peer);
+	janus_mutex_unlock(&mux_mutex);
+	return 0;
+}
+
+int janus_ice_mux_peer_move(janus_ice_mux_peer *peer, janus_ice_mux_loop *mux) {
+	if(peer == NULL || mux == NULL || g_atomic_int_get(&mux->destroyed))
+		return -1;
+	janus_mutex_lock(&mux_mutex);
+	janus_ice_mux_loop *old = peer->mux;
+	if(old == mux) {
+		janus_mutex_unlock(&mux_mutex);
+		return 0;
+	}
+	if(!mux_reuseport || old->port != mux->port) {
+		/* The candidates we advertised have the port of the old loop */
+		janus_mutex_unlock(&mux_mutex);
+		return -1;
+	}
+	janus_refcount_increase(&mux->ref);
+	janus_mutex_lock(&peer->mutex);
+	peer->mux = mux;
+	janus_mutex_unlock(&peer->mutex);
+	janus_mutex_unlock(&mux_mutex);
+	janus_refcount_decrease(&old->ref);
+	return 0;
+}
+
+int janus_ice_mux_peer_get_receiving_loop(janus_ice_mux_peer *peer) {
+	if(peer == NULL)
+		return -1;
+	int id = -1;
+	janus_mutex_lock(&peer->mutex);
+	if(peer->nominated && peer->socket != NULL && !g_atomic_int_get(&peer->socket->retired))
+		id = peer->socket->mux->id;
+	janus_mutex_unlock(&peer->mutex);
+	return id;
+}
+
+void janus_ice_mux_peer_remove(janus_ice_mux_peer *peer) {
+	if(peer == NULL)
+		return;
+	janus_mutex_lock(&mux_mutex);
+	janus_ice_component *component = peer->component;
+	if(component == NULL) {
+		janus_mutex_unlock(&mux_mutex);
+		return;
+	}
+	peer->component = NULL;
+	if(g_hash_table_lookup(mux_ufrags, peer->ufrag) == peer)
+		g_hash_table_remove(mux_ufrags, peer->ufrag);
+	while(peer->addresses) {
+		janus_ice_mux_route_remove(peer->addresses->data, peer);
+		g_free(peer->addresses->data);
+		peer->addresses = g_slist_delete_link(peer->addresses, peer->addresses);
+	}
+	janus_mutex_unlock(&mux_mutex);
+	janus_refcount_decrease(&component->ref);
+}
+
+void janus_ice_mux_peer_destroy(janus_ice_mux_peer *peer) {
+	if(peer == NULL)
+		return;
+	janus_ice_mux_peer_remove(peer);
+	janus_ice_mux_loop *mux = peer->mux;
+	janus_mutex_destroy(&peer->mutex);
+	g_free(peer->ufrag);
+	g_free(peer->pwd);
+	g_free(peer);
+	janus_refcount_decrease(&mux->ref);
+}
+
+GSList *janus_ice_mux_peer_get_local_candidates(janus_ice_mux_peer *peer, guint stream_id, guint component_id) {
+	if(peer == NULL)
+		return NULL;
+	janus_mutex_lock(&peer->mutex);
+	janus_ice_mux_loop *mux = peer->mux;
+	janus_mutex_unlock(&peer->mutex);
+	GSList *candidates = NULL, *l = mux->sockets;
+	guint index = 0;
+	while(l) {
+		janus_ice_mux_socket *s = (janus_ice_mux_socket *)l->data;
+		NiceCandidate *c = nice_candidate_new(NICE_CANDIDATE_TYPE_HOST);
+		c->transport = NICE_CANDIDATE_TRANSPORT_UDP;
+		c->stream_id = stream_id;
+		c->component_id = component_id;
+		nice_address_set_from_string(&c->addr, s->address);
+		nice_address_set_port(&c->addr, mux->port);
+		c->base_addr = c->addr;
+		/* Host candidates, with the local preference decreasing with the order of the addresses (RFC 8445) */
+		c->priority = (126 << 24) + ((65535 - index) << 8) + (256 - component_id);
+		g_snprintf(c->foundation, NICE_CANDIDATE_MAX_FOUNDATION, "%u", index+1);
+		candidates = g_slist_append(candidates, c);
+		index++;
+		l = l->next;
+	}
+	return candidates;
+}
+
+int janus_ice_mux_peer_send(janus_ice_mux_peer *peer, const char *buf, int len) {
+	if(peer == NULL || buf == NULL || len < 1)
+		return -1;
+	janus_mutex_lock(&peer->mutex);
+	if(!peer->nominated || peer->socket == NULL || g_atomic_int_get(&peer->socket->retired)) {
+		/* Nothing to send to yet, or the loop of the socket went away and we're waiting for a check on another one */
+		janus_mutex_unlock(&peer->mutex);
+		return -1;
+	}
+	int fd = peer->socket->fd;
+	struct sockaddr_storage remote;
+	memcpy(&remote, &peer->remote, sizeof(remote));
+	janus_mutex_unlock(&peer->mutex);
+	return sendto(fd, buf, len, 0, (struct sockaddr *)&remote, janus_ice_mux_sockaddr_len(&remote));
+}
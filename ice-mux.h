@@ -0,0 +1,134 @@
+/*! \file    ice-mux.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    ICE-Lite on shared ports (headers)
+ * \details  Optional ICE-Lite implementation that doesn't need a socket
+ * per PeerConnection: each static event loop binds a single UDP port on
+ * all the addresses Janus gathers candidates for, and all the handles
+ * served by that loop share it. Janus answers the STUN connectivity and
+ * consent checks itself, finding the PeerConnection they're for by the
+ * local ufrag in the USERNAME attribute, and then routes everything else
+ * (DTLS, SRTP and SRTCP) by the address it comes from, bypassing the
+ * libnice agent completely: agents are still created, but only to keep
+ * track of credentials and remote candidates. Loops can also all bind
+ * the same port with SO_REUSEPORT, and let the kernel spread the flows
+ * among them: packets a loop gets for a PeerConnection another loop is
+ * serving are handed over to it, until the handle is migrated.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_ICE_MUX_H
+#define JANUS_ICE_MUX_H
+
+#include <glib.h>
+#include <sys/socket.h>
+
+#include "ice.h"
+
+/*! \brief Callback the shared ports use to pass incoming packets that are not STUN to the core
+ * @param[in] component The component the packet is for
+ * @param[in] buf The packet
+ * @param[in] len The length of the packet */
+typedef void (*janus_ice_mux_recv_cb)(janus_ice_component *component, char *buf, guint len);
+/*! \brief Callback invoked when the peer nominates a (new) pair, which means media can flow
+ * @param[in] component The component the pair is for
+ * @param[in] local Our local address for the pair
+ * @param[in] remote The address of the peer */
+typedef void (*janus_ice_mux_nominated_cb)(janus_ice_component *component,
+	const struct sockaddr *local, const struct sockaddr *remote);
+/*! \brief Callback invoked when the peer stopped sending consent checks
+ * @param[in] component The component that lost consent */
+typedef void (*janus_ice_mux_expired_cb)(janus_ice_component *component);
+
+/*! \brief Initialize the ICE-Lite shared ports stack
+ * @param[in] min_port Lowest port the loops can bind to
+ * @param[in] max_port Highest port the loops can bind to
+ * @param[in] addresses List of local IP addresses (as strings) to bind on
+ * @param[in] tos TOS value to set on the sockets (or 0 to leave the default)
+ * @param[in] reuseport Whether all loops should bind the same port, using SO_REUSEPORT
+ * @param[in] filter Whether the kernel should drop packets that can't be STUN, DTLS, RTP or RTCP
+ * @param[in] recv_cb Callback for incoming packets
+ * @param[in] nominated_cb Callback for nominated pairs
+ * @param[in] expired_cb Callback for consent expirations
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_ice_mux_init(uint16_t min_port, uint16_t max_port, GList *addresses, int tos, gboolean reuseport, gboolean filter,
+	janus_ice_mux_recv_cb recv_cb, janus_ice_mux_nominated_cb nominated_cb, janus_ice_mux_expired_cb expired_cb);
+/*! \brief De-initialize the ICE-Lite shared ports stack */
+void janus_ice_mux_deinit(void);
+/*! \brief Check whether the ICE-Lite shared ports stack has been initialized
+ * @returns TRUE if it has, FALSE otherwise */
+gboolean janus_ice_mux_is_enabled(void);
+
+/*! \brief Shared port of a static event loop */
+typedef struct janus_ice_mux_loop janus_ice_mux_loop;
+/*! \brief PeerConnection using a shared port */
+typedef struct janus_ice_mux_peer janus_ice_mux_peer;
+
+/*! \brief Bind a new shared port for a static event loop
+ * @note The sockets are polled by the context of the loop, which means
+ * that packets are received, and STUN checks answered, by its thread
+ * @param[in] id The ID of the loop (just for logging purposes)
+ * @param[in] mainctx The context of the loop
+ * @returns A pointer to the new janus_ice_mux_loop instance, or NULL if
+ * no port was available in the configured range */
+janus_ice_mux_loop *janus_ice_mux_loop_create(int id, GMainContext *mainctx);
+/*! \brief Stop polling the shared port of a static event loop
+ * @note The sockets are only closed when the last PeerConnection using
+ * them goes away, so this must be called after the loop thread has been
+ * joined, or from the loop thread itself
+ * @param[in] mux The janus_ice_mux_loop instance to destroy */
+void janus_ice_mux_loop_destroy(janus_ice_mux_loop *mux);
+/*! \brief Get the port a static event loop is bound to
+ * @param[in] mux The janus_ice_mux_loop instance
+ * @returns The port */
+uint16_t janus_ice_mux_loop_get_port(janus_ice_mux_loop *mux);
+
+/*! \brief Start receiving and answering checks for a component on the shared port of its loop
+ * @param[in] mux The janus_ice_mux_loop instance of the loop serving the handle
+ * @param[in] component The component to route packets to (a reference is kept until janus_ice_mux_peer_remove)
+ * @param[in] ufrag Our local ICE ufrag
+ * @param[in] pwd Our local ICE pwd
+ * @returns A pointer to the new janus_ice_mux_peer instance, or NULL in case of errors (e.g., the ufrag is in use) */
+janus_ice_mux_peer *janus_ice_mux_peer_create(janus_ice_mux_loop *mux, janus_ice_component *component,
+	const char *ufrag, const char *pwd);
+/*! \brief Update the local credentials of a PeerConnection, e.g., after an ICE restart
+ * \note Packets keep on being routed to the currently nominated address
+ * until the peer nominates a new one with the new credentials
+ * @param[in] peer The janus_ice_mux_peer instance
+ * @param[in] ufrag Our new local ICE ufrag
+ * @param[in] pwd Our new local ICE pwd
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_ice_mux_peer_set_credentials(janus_ice_mux_peer *peer, const char *ufrag, const char *pwd);
+/*! \brief Have a PeerConnection served by another loop, e.g., because the handle was migrated
+ * \note This only works when all loops share the same port, as the candidates stay the same
+ * @param[in] peer The janus_ice_mux_peer instance
+ * @param[in] mux The janus_ice_mux_loop instance of the new loop
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_ice_mux_peer_move(janus_ice_mux_peer *peer, janus_ice_mux_loop *mux);
+/*! \brief Get the ID of the loop the kernel gives the packets of the nominated pair to
+ * \note This is only different from the loop serving the PeerConnection when using SO_REUSEPORT
+ * @param[in] peer The janus_ice_mux_peer instance
+ * @returns The ID of the loop, or -1 if nothing has been nominated yet */
+int janus_ice_mux_peer_get_receiving_loop(janus_ice_mux_peer *peer);
+/*! \brief Stop routing packets to a PeerConnection, and release the reference to its component
+ * @param[in] peer The janus_ice_mux_peer instance */
+void janus_ice_mux_peer_remove(janus_ice_mux_peer *peer);
+/*! \brief Release a PeerConnection, after it has been removed
+ * @param[in] peer The janus_ice_mux_peer instance */
+void janus_ice_mux_peer_destroy(janus_ice_mux_peer *peer);
+/*! \brief Get the list of host candidates of a PeerConnection, one per address of the shared port
+ * @param[in] peer The janus_ice_mux_peer instance
+ * @param[in] stream_id The stream ID to put in the candidates
+ * @param[in] component_id The component ID to put in the candidates
+ * @returns A list of NiceCandidate instances, that the caller must free */
+GSList *janus_ice_mux_peer_get_local_candidates(janus_ice_mux_peer *peer, guint stream_id, guint component_id);
+/*! \brief Send a packet to the address the peer nominated
+ * @param[in] peer The janus_ice_mux_peer instance
+ * @param[in] buf The packet to send
+ * @param[in] len The length of the packet
+ * @returns The number of bytes sent, or a negative integer in case of errors (e.g., nothing nominated yet) */
+int janus_ice_mux_peer_send(janus_ice_mux_peer *peer, const char *buf, int len);
+
+#endif
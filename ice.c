@@ -20,7 +20,12 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include <stun/usages/bind.h>
 #include <nice/debug.h>
 
@@ -28,12 +33,14 @@
 #include "debug.h"
 #include "ice.h"
 #include "turnrest.h"
+#include "ice-mux.h"
 #include "sdp.h"
 #include "rtpsrtp.h"
 #include "rtcp.h"
 #include "apierror.h"
 #include "ip-utils.h"
 #include "events.h"
+#include "metrics.h"
 
 /* STUN server/port, if any */
 static char *janus_stun_server = NULL;
@@ -94,6 +101,38 @@ static gboolean janus_mdns_enabled;
 gboolean janus_ice_is_mdns_enabled(void) {
 	return janus_mdns_enabled;
 }
+/* How long resolved mDNS addresses are cached for (default=120s) */
+#define DEFAULT_MDNS_CACHE_TTL	120
+static uint mdns_cache_ttl = DEFAULT_MDNS_CACHE_TTL;
+void janus_ice_set_mdns_cache_ttl(uint ttl) {
+	mdns_cache_ttl = ttl;
+	if(ttl == 0)
+		JANUS_LOG(LOG_VERB, "Disabling the mDNS cache\n");
+	else
+		JANUS_LOG(LOG_VERB, "Caching mDNS resolutions for %us\n", ttl);
+}
+uint janus_ice_get_mdns_cache_ttl(void) {
+	return mdns_cache_ttl;
+}
+/* Whether mDNS candidates can ever be reached: they're host addresses of the
+ * peers, which means a private network, so we check if we're on one too */
+static gboolean janus_mdns_reachable = TRUE;
+static gboolean janus_ice_address_is_private(const char *ip) {
+	struct in_addr addr4;
+	struct in6_addr addr6;
+	if(inet_pton(AF_INET, ip, &addr4) == 1) {
+		guint32 addr = ntohl(addr4.s_addr);
+		return ((addr & 0xFF000000) == 0x0A000000 ||	/* 10.0.0.0/8 */
+			(addr & 0xFFF00000) == 0xAC100000 ||		/* 172.16.0.0/12 */
+			(addr & 0xFFFF0000) == 0xC0A80000 ||		/* 192.168.0.0/16 */
+			(addr & 0xFFC00000) == 0x64400000 ||		/* 100.64.0.0/10 */
+			(addr & 0xFFFF0000) == 0xA9FE0000);			/* 169.254.0.0/16 */
+	} else if(inet_pton(AF_INET6, ip, &addr6) == 1) {
+		return ((addr6.s6_addr[0] & 0xFE) == 0xFC ||	/* fc00::/7 */
+			(addr6.s6_addr[0] == 0xFE && (addr6.s6_addr[1] & 0xC0) == 0x80));	/* fe80::/10 */
+	}
+	return FALSE;
+}
 
 /* IPv6 support (still mostly WIP) */
 static gboolean janus_ipv6_enabled;
@@ -112,16 +151,242 @@ gboolean janus_is_opaqueid_in_api_enabled(void) {
 	return opaqueid_in_api;
 }
 
-/* Only needed in case we're using static event loops spawned at startup (disabled by default) */
+/* Whether handles can ask for a dedicated loop even when static event loops are in use */
+static gboolean dedicated_loops_allowed = FALSE;
+void janus_ice_allow_dedicated_loops(void) {
+	dedicated_loops_allowed = TRUE;
+}
+gboolean janus_ice_is_dedicated_loops_allowed(void) {
+	return dedicated_loops_allowed;
+}
+
+/* Static event loops handles share, rather than having a loop and thread each */
 typedef struct janus_ice_static_event_loop {
 	int id;
 	GMainContext *mainctx;
 	GMainLoop *mainloop;
 	GThread *thread;
+	/* Whether this loop was added dynamically because of the load (and so can go away
+	 * when it's not needed anymore), whether it did go away, and since when it's empty */
+	gboolean dynamic, retired;
+	gint64 empty_since;
+	/* CPU set this loop thread is pinned to, if any */
+	const char *cpus;
+	/* Shared port the handles of this loop use, when ICE-Lite shared ports are enabled */
+	janus_ice_mux_loop *mux;
+	/* Load tracking: these are only updated by the loop thread itself... */
+	gint64 last_update, idle;
+	guint packets, bytes;
+	/* ...while these are what we publish once per second */
+	volatile gint busy, packets_lastsec, bytes_lastsec;
+	/* Handles served by this loop, and how many we assigned since the last update */
+	volatile gint handles, assigned;
+	/* Latency histograms aggregated for all the handles served by this loop */
+	janus_ice_latency_histogram latency[JANUS_ICE_LATENCY_TYPES];
+	/* How late the last load update fired, in microseconds */
+	volatile gint lag;
 } janus_ice_static_event_loop;
 static int static_event_loops = 0;
-static GSList *event_loops = NULL, *current_loop = NULL;
+static GSList *event_loops = NULL, *retired_event_loops = NULL;
 static janus_mutex event_loops_mutex = JANUS_MUTEX_INITIALIZER;
+/* When sizing the pool automatically, we start with a loop per core, add more (up
+ * to a maximum) when all loops are busy, and retire the extra ones once they're empty */
+static gboolean event_loops_dynamic = FALSE;
+static int event_loops_max = 0, event_loops_next_id = 0;
+#define JANUS_ICE_EVENT_LOOP_GROW_LOAD	(G_USEC_PER_SEC*7/10)
+#define JANUS_ICE_EVENT_LOOP_RETIRE_TIME	(30*G_USEC_PER_SEC)
+/* CPU sets to pin the static event loop threads to, if configured */
+static gchar **event_loops_affinity = NULL;
+static int event_loops_affinity_num = 0;
+/* Static event loop the current thread is running, if any */
+static GPrivate static_loop_current;
+/* Signals for the overload protection in the core: the worst value each of
+ * them had since the core last collected them (see janus_ice_overload_collect) */
+static volatile guint overload_lag = 0, overload_residency = 0, overload_depth = 0;
+static void janus_ice_overload_track(volatile guint *worst, gint64 value) {
+	if(value <= 0)
+		return;
+	guint v = value > G_MAXUINT ? G_MAXUINT : (guint)value, current = 0;
+	do {
+		current = g_atomic_int_get(worst);
+		if(v <= current)
+			return;
+	} while(!g_atomic_int_compare_and_exchange((volatile gint *)worst, (gint)current, (gint)v));
+}
+void janus_ice_overload_collect(guint *lag, guint *residency, guint *depth) {
+	if(lag)
+		*lag = g_atomic_int_and(&overload_lag, 0);
+	if(residency)
+		*residency = g_atomic_int_and(&overload_residency, 0);
+	if(depth)
+		*depth = g_atomic_int_and(&overload_depth, 0);
+}
+/* Custom poll function for the static loops: any time spent outside of
+ * the poll is time the loop thread has been busy doing something */
+static gint janus_ice_static_event_loop_poll(GPollFD *ufds, guint nfds, gint timeout) {
+	janus_ice_static_event_loop *loop = g_private_get(&static_loop_current);
+	if(loop == NULL)
+		return g_poll(ufds, nfds, timeout);
+	gint64 before = janus_get_monotonic_time();
+	gint res = g_poll(ufds, nfds, timeout);
+	loop->idle += (janus_get_monotonic_time() - before);
+	return res;
+}
+static gboolean janus_ice_static_event_loop_update(gpointer user_data) {
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)user_data;
+	gint64 now = janus_get_monotonic_time();
+	gint64 elapsed = now - loop->last_update;
+	if(elapsed <= 0)
+		return G_SOURCE_CONTINUE;
+	gint64 busy = elapsed - loop->idle;
+	if(busy < 0)
+		busy = 0;
+	/* The timer fires once per second: if it took longer, the loop is lagging */
+	gint64 lag = elapsed > G_USEC_PER_SEC ? elapsed - G_USEC_PER_SEC : 0;
+	g_atomic_int_set(&loop->lag, (gint)MIN(lag, G_MAXINT));
+	janus_ice_overload_track(&overload_lag, lag);
+	/* Normalize everything to one second */
+	g_atomic_int_set(&loop->busy, (gint)(busy * G_USEC_PER_SEC / elapsed));
+	g_atomic_int_set(&loop->packets_lastsec, (gint)((gint64)loop->packets * G_USEC_PER_SEC / elapsed));
+	g_atomic_int_set(&loop->bytes_lastsec, (gint)((gint64)loop->bytes * G_USEC_PER_SEC / elapsed));
+	g_atomic_int_set(&loop->assigned, 0);
+	loop->last_update = now;
+	loop->idle = 0;
+	loop->packets = 0;
+	loop->bytes = 0;
+	/* If this loop was added because of the load, check if we still need it */
+	if(loop->dynamic) {
+		if(g_atomic_int_get(&loop->handles) > 0) {
+			loop->empty_since = 0;
+		} else if(loop->empty_since == 0) {
+			loop->empty_since = now;
+		} else if(now - loop->empty_since >= JANUS_ICE_EVENT_LOOP_RETIRE_TIME) {
+			/* Handles are only assigned with the lock held, so check again with it */
+			janus_mutex_lock(&event_loops_mutex);
+			if(event_loops_dynamic && g_atomic_int_get(&loop->handles) == 0) {
+				loop->retired = TRUE;
+				event_loops = g_slist_remove(event_loops, loop);
+				retired_event_loops = g_slist_append(retired_event_loops, loop);
+				static_event_loops--;
+			}
+			janus_mutex_unlock(&event_loops_mutex);
+			if(loop->retired) {
+				JANUS_LOG(LOG_INFO, "[loop#%d] Static event loop not needed anymore, retiring it (%d left)\n",
+					loop->id, static_event_loops);
+				janus_ice_mux_loop *mux = loop->mux;
+				loop->mux = NULL;
+				janus_ice_mux_loop_destroy(mux);
+				g_main_loop_quit(loop->mainloop);
+				return G_SOURCE_REMOVE;
+			}
+		}
+	}
+	return G_SOURCE_CONTINUE;
+}
+/* Keep track of a packet the current static loop sent or received */
+static void janus_ice_static_event_loop_account(guint bytes) {
+	janus_ice_static_event_loop *loop = g_private_get(&static_loop_current);
+	if(loop == NULL)
+		return;
+	loop->packets++;
+	loop->bytes += bytes;
+}
+/* How loaded a static loop is, in usec of busy time per second: handles we
+ * assigned since the last update haven't contributed to that yet, so we
+ * assume each of them will cost as much as the average handle there */
+static gint64 janus_ice_static_event_loop_load(janus_ice_static_event_loop *loop) {
+	gint64 busy = g_atomic_int_get(&loop->busy);
+	gint handles = g_atomic_int_get(&loop->handles);
+	gint assigned = g_atomic_int_get(&loop->assigned);
+	if(assigned > 0 && handles > assigned)
+		busy += (busy / (handles - assigned)) * assigned;
+	return busy;
+}
+/* Pick the least loaded static loop for a new handle: loads are compared
+ * with a 1% granularity, so that the number of handles each loop serves
+ * breaks the ties (e.g., when all loops are mostly idle). Must be called
+ * with the event_loops_mutex lock held */
+static janus_ice_static_event_loop *janus_ice_static_event_loop_pick(void) {
+	janus_ice_static_event_loop *best = NULL;
+	gint64 best_load = 0;
+	gint best_handles = 0;
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		gint64 load = janus_ice_static_event_loop_load(loop) / (G_USEC_PER_SEC/100);
+		gint handles = g_atomic_int_get(&loop->handles);
+		if(best == NULL || load < best_load || (load == best_load && handles < best_handles)) {
+			best = loop;
+			best_load = load;
+			best_handles = handles;
+		}
+		l = l->next;
+	}
+	return best;
+}
+static janus_ice_static_event_loop *janus_ice_static_event_loop_find(int id) {
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		if(loop->id == id)
+			return loop;
+		l = l->next;
+	}
+	return NULL;
+}
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/* Parse a CPU set like "0-3,8,10-11" */
+static gboolean janus_ice_parse_cpu_set(const char *cpus, cpu_set_t *set) {
+	CPU_ZERO(set);
+	gchar **ranges = g_strsplit(cpus, ",", -1);
+	int i = 0, found = 0;
+	gboolean ok = TRUE;
+	for(i=0; ranges[i] != NULL && ok; i++) {
+		char *range = g_strstrip(ranges[i]), *end = NULL;
+		if(*range == '\0')
+			continue;
+		long first = strtol(range, &end, 10), last = first;
+		if(end == range || first < 0) {
+			ok = FALSE;
+			break;
+		}
+		if(*end == '-') {
+			char *start = end+1;
+			last = strtol(start, &end, 10);
+			if(end == start || last < first)
+				ok = FALSE;
+		}
+		if(*end != '\0' || last >= CPU_SETSIZE)
+			ok = FALSE;
+		for(; ok && first <= last; first++) {
+			CPU_SET(first, set);
+			found++;
+		}
+	}
+	g_strfreev(ranges);
+	return ok && found > 0;
+}
+#endif
+/* Pin the current thread to the CPU set of the static loop it's running: this
+ * is done before the loop allocates anything, so that (with the default first
+ * touch policy) memory allocated from this thread, e.g., the SRTP contexts that
+ * are created when the DTLS handshake completes, is local to its NUMA node */
+static void janus_ice_static_event_loop_pin(janus_ice_static_event_loop *loop) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t set;
+	if(!janus_ice_parse_cpu_set(loop->cpus, &set)) {
+		JANUS_LOG(LOG_WARN, "[loop#%d] Invalid CPU set '%s', not pinning the loop thread\n", loop->id, loop->cpus);
+		return;
+	}
+	int res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if(res != 0) {
+		JANUS_LOG(LOG_WARN, "[loop#%d] Couldn't pin the loop thread to CPU set '%s': %d (%s)\n",
+			loop->id, loop->cpus, res, g_strerror(res));
+	} else {
+		JANUS_LOG(LOG_VERB, "[loop#%d] Loop thread pinned to CPU set '%s'\n", loop->id, loop->cpus);
+	}
+#endif
+}
 static void *janus_ice_static_event_loop_thread(void *data) {
 	janus_ice_static_event_loop *loop = data;
 	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread started\n", loop->id);
@@ -130,17 +395,101 @@ static void *janus_ice_static_event_loop_thread(void *data) {
 		g_thread_unref(g_thread_self());
 		return NULL;
 	}
+	if(loop->cpus != NULL)
+		janus_ice_static_event_loop_pin(loop);
+	g_private_set(&static_loop_current, loop);
+	loop->last_update = janus_get_monotonic_time();
+	/* Update the load of this loop once per second */
+	GSource *update = g_timeout_source_new(1000);
+	g_source_set_priority(update, G_PRIORITY_DEFAULT);
+	g_source_set_callback(update, janus_ice_static_event_loop_update, loop, NULL);
+	g_source_attach(update, loop->mainctx);
+	g_source_unref(update);
 	JANUS_LOG(LOG_DBG, "[loop#%d] Looping...\n", loop->id);
 	g_main_loop_run(loop->mainloop);
-	/* When the loop quits, we can unref it */
-	g_main_loop_unref(loop->mainloop);
-	g_main_context_unref(loop->mainctx);
+	/* The loop and context are unref'd when the thread is joined, as handles
+	 * that were served by a retired dynamic loop may still point to them */
 	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread ended!\n", loop->id);
 	return NULL;
 }
+/* Create a new static event loop and its thread: must be called with the
+ * event_loops_mutex lock held, or at startup */
+static janus_ice_static_event_loop *janus_ice_static_event_loop_create(gboolean dynamic) {
+	janus_ice_static_event_loop *loop = g_malloc0(sizeof(janus_ice_static_event_loop));
+	loop->id = event_loops_next_id;
+	loop->dynamic = dynamic;
+	loop->mainctx = g_main_context_new();
+	loop->mainloop = g_main_loop_new(loop->mainctx, FALSE);
+	g_main_context_set_poll_func(loop->mainctx, janus_ice_static_event_loop_poll);
+	if(event_loops_affinity_num > 0)
+		loop->cpus = event_loops_affinity[loop->id % event_loops_affinity_num];
+	/* Now spawn a thread for this loop */
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "hloop %d", loop->id);
+	loop->thread = g_thread_try_new(tname, &janus_ice_static_event_loop_thread, loop, &error);
+	if(error != NULL) {
+		g_main_loop_unref(loop->mainloop);
+		g_main_context_unref(loop->mainctx);
+		g_free(loop);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a new event loop thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		return NULL;
+	}
+	event_loops_next_id++;
+	if(janus_ice_mux_is_enabled())
+		loop->mux = janus_ice_mux_loop_create(loop->id, loop->mainctx);
+	event_loops = g_slist_append(event_loops, loop);
+	static_event_loops++;
+	return loop;
+}
+/* Pick a loop for a new handle, adding a new one if all are busy and we
+ * can: must be called with the event_loops_mutex lock held */
+static janus_ice_static_event_loop *janus_ice_static_event_loop_assign(void) {
+	janus_ice_static_event_loop *loop = janus_ice_static_event_loop_pick();
+	if(event_loops_dynamic && static_event_loops < event_loops_max &&
+			(loop == NULL || janus_ice_static_event_loop_load(loop) >= JANUS_ICE_EVENT_LOOP_GROW_LOAD)) {
+		janus_ice_static_event_loop *added = janus_ice_static_event_loop_create(TRUE);
+		if(added != NULL) {
+			JANUS_LOG(LOG_INFO, "[loop#%d] All static event loops are busy, added a new one (%d/%d)\n",
+				added->id, static_event_loops, event_loops_max);
+			loop = added;
+		}
+	}
+	return loop;
+}
 int janus_ice_get_static_event_loops(void) {
 	return static_event_loops;
 }
+void janus_ice_set_static_event_loops_affinity(const char *affinity) {
+	if(affinity == NULL || strlen(affinity) == 0)
+		return;
+#ifndef HAVE_PTHREAD_SETAFFINITY_NP
+	JANUS_LOG(LOG_WARN, "CPU affinity for static event loops not supported on this platform, ignoring\n");
+#else
+	if(event_loops_affinity != NULL) {
+		g_strfreev(event_loops_affinity);
+		event_loops_affinity = NULL;
+		event_loops_affinity_num = 0;
+	}
+	/* Each loop gets its own CPU set: if there are fewer sets than loops, we cycle */
+	gchar **sets = g_strsplit(affinity, ";", -1);
+	int i = 0;
+	for(i=0; sets[i] != NULL; i++) {
+		g_strstrip(sets[i]);
+		cpu_set_t set;
+		if(!janus_ice_parse_cpu_set(sets[i], &set)) {
+			JANUS_LOG(LOG_WARN, "Invalid CPU set '%s' for static event loops, ignoring affinity\n", sets[i]);
+			g_strfreev(sets);
+			return;
+		}
+	}
+	event_loops_affinity = sets;
+	event_loops_affinity_num = i;
+	JANUS_LOG(LOG_INFO, "Static event loops will be pinned to %d CPU set(s)\n", event_loops_affinity_num);
+#endif
+}
 void janus_ice_set_static_event_loops(int loops) {
 	if(loops == 0)
 		return;
@@ -150,48 +499,128 @@ void janus_ice_set_static_event_loops(int loops) {
 	}
 	/* Create a pool of new event loops */
 	int i = 0;
-	for(i=0; i<loops; i++) {
-		janus_ice_static_event_loop *loop = g_malloc0(sizeof(janus_ice_static_event_loop));
-		loop->id = static_event_loops;
-		loop->mainctx = g_main_context_new();
-		loop->mainloop = g_main_loop_new(loop->mainctx, FALSE);
-		/* Now spawn a thread for this loop */
-		GError *error = NULL;
-		char tname[16];
-		g_snprintf(tname, sizeof(tname), "hloop %d", loop->id);
-		loop->thread = g_thread_try_new(tname, &janus_ice_static_event_loop_thread, loop, &error);
-		if(error != NULL) {
-			g_main_loop_unref(loop->mainloop);
-			g_main_context_unref(loop->mainctx);
-			g_free(loop);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a new event loop thread...\n",
-				error->code, error->message ? error->message : "??");
-			g_error_free(error);
-		} else {
-			event_loops = g_slist_append(event_loops, loop);
-			static_event_loops++;
-		}
-	}
-	current_loop = event_loops;
+	for(i=0; i<loops; i++)
+		janus_ice_static_event_loop_create(FALSE);
 	JANUS_LOG(LOG_INFO, "Spawned %d static event loops (handles won't have a dedicated loop)\n", static_event_loops);
 	return;
 }
+void janus_ice_set_static_event_loops_auto(int max) {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if(cores < 1)
+		cores = 1;
+	if(max < 1)
+		max = cores*2;
+	else if(max < cores)
+		cores = max;
+	event_loops_max = max;
+	event_loops_dynamic = (max > cores);
+	janus_ice_set_static_event_loops(cores);
+	if(static_event_loops > 0 && event_loops_dynamic)
+		JANUS_LOG(LOG_INFO, "  -- More loops will be added when all are busy (up to %d)\n", event_loops_max);
+}
 void janus_ice_stop_static_event_loops(void) {
 	if(static_event_loops < 1)
 		return;
 	/* Quit all the static loops and wait for the threads to leave */
 	janus_mutex_lock(&event_loops_mutex);
-	GSList *l = event_loops;
+	event_loops_dynamic = FALSE;
+	GSList *loops = g_slist_concat(event_loops, retired_event_loops);
+	event_loops = NULL;
+	retired_event_loops = NULL;
+	static_event_loops = 0;
+	/* We don't hold the lock while joining, as loop threads may need it */
+	janus_mutex_unlock(&event_loops_mutex);
+	GSList *l = loops;
 	while(l) {
 		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
-		if(loop->mainloop != NULL && g_main_loop_is_running(loop->mainloop))
+		if(!loop->retired && loop->mainloop != NULL && g_main_loop_is_running(loop->mainloop))
 			g_main_loop_quit(loop->mainloop);
 		g_thread_join(loop->thread);
+		janus_ice_mux_loop_destroy(loop->mux);
+		loop->mux = NULL;
+		g_main_loop_unref(loop->mainloop);
+		g_main_context_unref(loop->mainctx);
+		l = l->next;
+	}
+	g_slist_free_full(loops, (GDestroyNotify)g_free);
+	janus_mutex_lock(&event_loops_mutex);
+	g_strfreev(event_loops_affinity);
+	event_loops_affinity = NULL;
+	event_loops_affinity_num = 0;
+	janus_mutex_unlock(&event_loops_mutex);
+}
+json_t *janus_ice_static_event_loops_info(void) {
+	json_t *list = json_array();
+	if(static_event_loops < 1)
+		return list;
+	janus_mutex_lock(&event_loops_mutex);
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		json_t *info = json_object();
+		json_object_set_new(info, "id", json_integer(loop->id));
+		if(loop->cpus != NULL)
+			json_object_set_new(info, "cpus", json_string(loop->cpus));
+		if(loop->dynamic)
+			json_object_set_new(info, "dynamic", json_true());
+		if(loop->mux != NULL)
+			json_object_set_new(info, "shared-port", json_integer(janus_ice_mux_loop_get_port(loop->mux)));
+		json_object_set_new(info, "handles", json_integer(g_atomic_int_get(&loop->handles)));
+		json_object_set_new(info, "busy", json_integer(g_atomic_int_get(&loop->busy)));
+		json_object_set_new(info, "load", json_integer(janus_ice_static_event_loop_load(loop)));
+		json_object_set_new(info, "lag", json_integer(g_atomic_int_get(&loop->lag)));
+		json_object_set_new(info, "packets-per-second", json_integer(g_atomic_int_get(&loop->packets_lastsec)));
+		json_object_set_new(info, "bytes-per-second", json_integer(g_atomic_int_get(&loop->bytes_lastsec)));
+		if(janus_get_latency_sampling() > 0)
+			json_object_set_new(info, "latency", janus_ice_latency_summary(loop->latency));
+		json_array_append_new(list, info);
 		l = l->next;
 	}
-	g_slist_free_full(event_loops, (GDestroyNotify)g_free);
+	janus_mutex_unlock(&event_loops_mutex);
+	return list;
+}
+void janus_ice_static_event_loops_metrics(GString *text) {
+	if(static_event_loops < 1 || text == NULL)
+		return;
+	/* Dynamic loops may come and go, so we hold the lock while going through them */
+	janus_mutex_lock(&event_loops_mutex);
+	const char *families[] = { "janus_event_loop_handles", "janus_event_loop_busy_ratio",
+		"janus_event_loop_packets_per_second", "janus_event_loop_bytes_per_second" };
+	const char *help[] = { "Handles served by the static event loop", "Fraction of time the static event loop was busy in the last second",
+		"Packets handled by the static event loop in the last second", "Bytes handled by the static event loop in the last second" };
+	int i = 0;
+	for(i=0; i<4; i++) {
+		janus_metrics_append_family(text, families[i], "gauge", help[i]);
+		GSList *l = event_loops;
+		while(l) {
+			janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+			if(i == 0)
+				g_string_append_printf(text, "%s{loop=\"%d\"} %d\n", families[i], loop->id, g_atomic_int_get(&loop->handles));
+			else if(i == 1)
+				g_string_append_printf(text, "%s{loop=\"%d\"} %.3f\n", families[i], loop->id, (double)g_atomic_int_get(&loop->busy)/G_USEC_PER_SEC);
+			else if(i == 2)
+				g_string_append_printf(text, "%s{loop=\"%d\"} %d\n", families[i], loop->id, g_atomic_int_get(&loop->packets_lastsec));
+			else
+				g_string_append_printf(text, "%s{loop=\"%d\"} %d\n", families[i], loop->id, g_atomic_int_get(&loop->bytes_lastsec));
+			l = l->next;
+		}
+	}
 	janus_mutex_unlock(&event_loops_mutex);
 }
+void janus_ice_handle_get_snapshot(janus_ice_handle *handle, janus_ice_handle_snapshot *snapshot) {
+	if(handle == NULL || snapshot == NULL)
+		return;
+	janus_mutex_lock(&handle->snapshot_mutex);
+	*snapshot = handle->snapshot;
+	janus_mutex_unlock(&handle->snapshot_mutex);
+}
+
+int janus_ice_get_static_event_loop_id(janus_ice_handle *handle) {
+	if(handle == NULL || handle->static_loop == NULL)
+		return -1;
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)g_atomic_pointer_get(&handle->static_loop);
+	return loop->id;
+}
 
 /* libnice debugging */
 static gboolean janus_ice_debugging_enabled;
@@ -285,6 +714,81 @@ gboolean janus_ice_is_ignored(const char *ip) {
 	return false;
 }
 
+/* Get the local addresses we can gather candidates for, taking into account
+ * the enforce/ignore lists: returns a list of strings the caller must free */
+static GList *janus_ice_get_local_addresses(void);
+void janus_ice_set_ignore_unreachable_mdns(gboolean ignore) {
+	janus_mdns_reachable = TRUE;
+	if(!ignore)
+		return;
+	GList *addresses = janus_ice_get_local_addresses(), *temp = addresses;
+	gboolean reachable = FALSE;
+	while(temp) {
+		if(janus_ice_address_is_private((char *)temp->data)) {
+			reachable = TRUE;
+			break;
+		}
+		temp = temp->next;
+	}
+	g_list_free_full(addresses, (GDestroyNotify)g_free);
+	janus_mdns_reachable = reachable;
+	if(!reachable)
+		JANUS_LOG(LOG_WARN, "No private address to gather candidates on, mDNS candidates will be ignored\n");
+}
+gboolean janus_ice_is_mdns_reachable(void) {
+	return janus_mdns_reachable;
+}
+static GList *janus_ice_get_local_addresses(void) {
+	struct ifaddrs *ifaddr, *ifa;
+	int family, s, n;
+	char host[NI_MAXHOST];
+	GList *addresses = NULL;
+	if(getifaddrs(&ifaddr) == -1) {
+		JANUS_LOG(LOG_ERR, "Error getting list of interfaces... %d (%s)\n", errno, strerror(errno));
+		return NULL;
+	}
+	for(ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
+		if(ifa->ifa_addr == NULL)
+			continue;
+		/* Skip interfaces which are not up and running */
+		if(!((ifa->ifa_flags & IFF_UP) && (ifa->ifa_flags & IFF_RUNNING)))
+			continue;
+		/* Skip loopback interfaces */
+		if(ifa->ifa_flags & IFF_LOOPBACK)
+			continue;
+		family = ifa->ifa_addr->sa_family;
+		if(family != AF_INET && family != AF_INET6)
+			continue;
+		/* We only add IPv6 addresses if support for them has been explicitly enabled (still WIP, mostly) */
+		if(family == AF_INET6 && !janus_ipv6_enabled)
+			continue;
+		/* Check the interface name first, we can ignore that as well: enforce list would be checked later */
+		if(janus_ice_enforce_list == NULL && ifa->ifa_name != NULL && janus_ice_is_ignored(ifa->ifa_name))
+			continue;
+		s = getnameinfo(ifa->ifa_addr,
+				(family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
+				host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
+		if(s != 0) {
+			JANUS_LOG(LOG_ERR, "getnameinfo() failed: %s\n", gai_strerror(s));
+			continue;
+		}
+		/* Skip 0.0.0.0, :: and local scoped addresses  */
+		if(!strcmp(host, "0.0.0.0") || !strcmp(host, "::") || !strncmp(host, "fe80:", 5))
+			continue;
+		/* Check if this IP address is in the ignore/enforce list, now: the enforce list has the precedence */
+		if(janus_ice_enforce_list != NULL) {
+			if(ifa->ifa_name != NULL && !janus_ice_is_enforced(ifa->ifa_name) && !janus_ice_is_enforced(host))
+				continue;
+		} else {
+			if(janus_ice_is_ignored(host))
+				continue;
+		}
+		addresses = g_list_append(addresses, g_strdup(host));
+	}
+	freeifaddrs(ifaddr);
+	return addresses;
+}
+
 
 /* Frequency of statistics via event handlers (one second by default) */
 static int janus_ice_event_stats_period = 1;
@@ -295,6 +799,44 @@ int janus_ice_get_event_stats_period(void) {
 	return janus_ice_event_stats_period;
 }
 
+/* Whether media statistics are sent per handle (the default) or rolled up
+ * in periodic summaries, plus the thresholds that trigger per-handle events
+ * when crossed in summary mode (loss in percentage, RTT in ms, 0 disables) */
+static gboolean janus_ice_event_stats_summary = FALSE;
+static int janus_ice_event_stats_loss_threshold = 0, janus_ice_event_stats_rtt_threshold = 0;
+void janus_ice_set_event_stats_summary(gboolean summary, int loss_threshold, int rtt_threshold) {
+	janus_ice_event_stats_summary = summary;
+	janus_ice_event_stats_loss_threshold = loss_threshold > 0 ? loss_threshold : 0;
+	janus_ice_event_stats_rtt_threshold = rtt_threshold > 0 ? rtt_threshold : 0;
+}
+gboolean janus_ice_is_event_stats_summary(void) {
+	return janus_ice_event_stats_summary;
+}
+
+/* Media statistics we keep for each handle, in summary mode: one row per
+ * medium (audio, and up to three video substreams) */
+#define JANUS_ICE_STATS_MEDIA	4
+static const char *janus_ice_stats_media[JANUS_ICE_STATS_MEDIA] = { "audio", "video", "video-sim1", "video-sim2" };
+typedef struct janus_ice_stats_row {
+	gboolean valid;
+	guint32 rtt, lost, lost_remote, jitter_local, jitter_remote;
+	guint32 in_link_quality, out_link_quality;
+	guint64 packets_received, packets_sent, bytes_received_lastsec, bytes_sent_lastsec;
+	guint32 nacks_received, nacks_sent;
+	/* To check the thresholds, we need the previous values too */
+	guint32 prev_lost;
+	guint64 prev_packets_received;
+	gboolean above_threshold;
+} janus_ice_stats_row;
+typedef struct janus_ice_stats_entry {
+	guint64 session_id, handle_id;
+	gint64 updated;
+	janus_ice_stats_row rows[JANUS_ICE_STATS_MEDIA];
+} janus_ice_stats_entry;
+static GHashTable *janus_ice_stats_entries = NULL;
+static janus_mutex janus_ice_stats_mutex = JANUS_MUTEX_INITIALIZER;
+static gint64 janus_ice_stats_next_summary = 0;
+
 
 /* RTP/RTCP port range */
 uint16_t rtp_range_min = 0;
@@ -317,6 +859,17 @@ typedef struct janus_ice_queued_packet {
 	gboolean retransmission;
 	gboolean encrypted;
 	gint64 added;
+	/* Size of the buffer (which may be larger than the packet) */
+	gint size;
+	/* When the pacer queued the packet, if it did */
+	gint64 paced;
+	/* Shared RTP payload, if any, which we copy right before encrypting */
+	janus_plugin_rtp_payload *shared;
+	/* If the packet comes from the pool, this is the inline buffer and its pool */
+	char *buffer;
+	gint pool;
+	/* Next packet in the pool free list, or in the handle media queue */
+	struct janus_ice_queued_packet *next;
 } janus_ice_queued_packet;
 /* A few static, fake, messages we use as a trigger: e.g., to start a
  * new DTLS handshake, hangup a PeerConnection or close a handle */
@@ -326,7 +879,8 @@ static janus_ice_queued_packet
 	janus_ice_dtls_handshake,
 	janus_ice_hangup_peerconnection,
 	janus_ice_detach_handle,
-	janus_ice_data_ready;
+	janus_ice_data_ready,
+	janus_ice_migrate_loop;
 
 /* Janus NACKed packet we're tracking (to avoid duplicates) */
 typedef struct janus_ice_nacked_packet {
@@ -360,29 +914,121 @@ typedef struct janus_ice_outgoing_traffic {
 	GSource parent;
 	janus_ice_handle *handle;
 	GDestroyNotify destroy;
+	/* Whether the handle moved to another static loop, and so to a new source */
+	gboolean migrated;
 } janus_ice_outgoing_traffic;
 static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data);
 static gboolean janus_ice_outgoing_stats_handle(gpointer user_data);
 static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janus_ice_queued_packet *pkt);
+static gboolean janus_ice_queued_packet_is_trigger(janus_ice_queued_packet *pkt);
+static void janus_ice_egress_batch_flush(void);
+static void janus_ice_incoming_batch_flush(janus_ice_handle *handle);
+static gboolean janus_ice_incoming_batch_pending(janus_ice_handle *handle);
+static gboolean janus_ice_pacer_enqueue(janus_ice_handle *handle, janus_ice_queued_packet *pkt);
+static void janus_ice_pacer_stop(janus_ice_component *component, gboolean flush);
+static gboolean janus_ice_static_event_loop_switch(janus_ice_outgoing_traffic *t);
+/* Media packets sent by plugins don't go through the queued_packets
+ * GAsyncQueue, which is only used for control messages (triggers) and
+ * retransmissions, but through a lock-free list: producers push to its
+ * head with a CAS, and the loop takes the whole list at once and reverses
+ * it, which works the same whether there's a single producer (the most
+ * common case) or more. Since the loop always empties the list, the
+ * producer that makes it non-empty is the only one that needs to wake
+ * the loop up, which saves a wakeup per packet when sending in bursts */
+static gboolean janus_ice_queued_media_push(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	janus_ice_queued_packet *head = NULL;
+	do {
+		head = (janus_ice_queued_packet *)g_atomic_pointer_get(&handle->queued_media);
+		pkt->next = head;
+	} while(!g_atomic_pointer_compare_and_exchange(&handle->queued_media, head, pkt));
+	return (head == NULL);
+}
+static janus_ice_queued_packet *janus_ice_queued_media_take(janus_ice_handle *handle) {
+	janus_ice_queued_packet *head = NULL;
+	do {
+		head = (janus_ice_queued_packet *)g_atomic_pointer_get(&handle->queued_media);
+	} while(head != NULL && !g_atomic_pointer_compare_and_exchange(&handle->queued_media, head, NULL));
+	/* The list is newest first, reverse it */
+	janus_ice_queued_packet *list = NULL, *next = NULL;
+	while(head != NULL) {
+		next = head->next;
+		head->next = list;
+		list = head;
+		head = next;
+	}
+	return list;
+}
+static void janus_ice_outgoing_media_dispatch(janus_ice_handle *handle) {
+	janus_ice_queued_packet *list = janus_ice_queued_media_take(handle), *pkt = NULL;
+	/* The oldest packet comes first, and tells us how long the queue made it wait */
+	if(list != NULL && list->added > 0)
+		janus_ice_overload_track(&overload_residency, janus_get_monotonic_time() - list->added);
+	while(list != NULL) {
+		pkt = list;
+		list = list->next;
+		pkt->next = NULL;
+		janus_ice_static_event_loop_account(pkt->length);
+		if(janus_ice_pacer_enqueue(handle, pkt))
+			continue;
+		janus_ice_outgoing_traffic_handle(handle, pkt);
+	}
+}
 static gboolean janus_ice_outgoing_traffic_prepare(GSource *source, gint *timeout) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
-	return (g_async_queue_length(t->handle->queued_packets) > 0);
+	return (g_async_queue_length(t->handle->queued_packets) > 0 ||
+		g_atomic_pointer_get(&t->handle->queued_media) != NULL ||
+		janus_ice_incoming_batch_pending(t->handle));
 }
 static gboolean janus_ice_outgoing_traffic_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
 	int ret = G_SOURCE_CONTINUE;
 	janus_ice_queued_packet *pkt = NULL;
+	/* If we received RTP the plugin takes in batches, pass it what we have */
+	janus_ice_incoming_batch_flush(t->handle);
+	/* Control messages and retransmissions come first */
 	while((pkt = g_async_queue_try_pop(t->handle->queued_packets)) != NULL) {
+		/* Triggers may change the state of the PeerConnection, so make sure
+		 * we send whatever we batched so far before handling them */
+		if(janus_ice_queued_packet_is_trigger(pkt))
+			janus_ice_egress_batch_flush();
+		else
+			janus_ice_static_event_loop_account(pkt->length);
+		if(pkt == &janus_ice_migrate_loop) {
+			/* We're moving to another static loop: if that works, a new source
+			 * there will take care of whatever is still in the queue */
+			if(janus_ice_static_event_loop_switch(t)) {
+				ret = G_SOURCE_REMOVE;
+				break;
+			}
+			continue;
+		}
+		if(pkt == &janus_ice_detach_handle) {
+			/* This is queued after the media the plugin sent so far, deliver that first */
+			janus_ice_outgoing_media_dispatch(t->handle);
+			if(t->handle->stream && t->handle->stream->component)
+				janus_ice_pacer_stop(t->handle->stream->component, TRUE);
+			janus_ice_egress_batch_flush();
+		}
 		if(janus_ice_outgoing_traffic_handle(t->handle, pkt) == G_SOURCE_REMOVE)
 			ret = G_SOURCE_REMOVE;
 	}
+	/* Now the media packets plugins sent */
+	if(ret == G_SOURCE_CONTINUE)
+		janus_ice_outgoing_media_dispatch(t->handle);
+	/* If we batched outgoing packets, send them all now */
+	janus_ice_egress_batch_flush();
 	return ret;
 }
 static void janus_ice_outgoing_traffic_finalize(GSource *source) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Finalizing loop source\n", t->handle->handle_id);
-	if(static_event_loops > 0) {
+	if(t->migrated) {
+		/* The handle has been moved to another static loop, nothing to do */
+	} else if(t->handle->static_loop != NULL) {
 		/* This handle was sharing an event loop with others */
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)t->handle->static_loop;
+		if(loop != NULL)
+			g_atomic_int_dec_and_test(&loop->handles);
 		janus_ice_webrtc_free(t->handle);
 		janus_refcount_decrease(&t->handle->ref);
 	} else if(t->handle->mainloop != NULL && g_main_loop_is_running(t->handle->mainloop)) {
@@ -407,6 +1053,7 @@ static GSource *janus_ice_outgoing_traffic_create(janus_ice_handle *handle, GDes
 	janus_refcount_increase(&handle->ref);
 	t->handle = handle;
 	t->destroy = destroy;
+	t->migrated = FALSE;
 	return source;
 }
 
@@ -442,6 +1089,9 @@ uint janus_get_slowlink_threshold(void) {
 
 /* Period, in milliseconds, to refer to for sending TWCC feedback */
 #define DEFAULT_TWCC_PERIOD		200
+/* Size of the ring of transport wide cc arrival times, i.e., how many packets we
+ * can receive between two feedbacks (must be a power of 2) */
+#define JANUS_ICE_TWCC_RING_SIZE	4096
 static uint twcc_period = DEFAULT_TWCC_PERIOD;
 void janus_set_twcc_period(uint period) {
 	twcc_period = period;
@@ -468,6 +1118,87 @@ int janus_get_dscp(void) {
 	return dscp_ef;
 }
 
+/* Latency histograms: to keep this cheap enough to leave enabled, only one
+ * RTP packet out of latency_sampling (in each direction) is measured */
+static uint latency_sampling = 0;
+void janus_set_latency_sampling(uint rate) {
+	latency_sampling = rate;
+	if(latency_sampling == 0)
+		JANUS_LOG(LOG_VERB, "Disabling latency histograms\n");
+	else
+		JANUS_LOG(LOG_VERB, "Sampling latencies every %u packets\n", latency_sampling);
+}
+uint janus_get_latency_sampling(void) {
+	return latency_sampling;
+}
+static gboolean janus_ice_latency_sample(guint *counter) {
+	uint rate = latency_sampling;
+	if(rate == 0)
+		return FALSE;
+	(*counter)++;
+	if(*counter < rate)
+		return FALSE;
+	*counter = 0;
+	return TRUE;
+}
+static void janus_ice_latency_histogram_add(janus_ice_latency_histogram *h, gint64 usec) {
+	if(usec < 0)
+		usec = 0;
+	guint bucket = usec > 0 ? g_bit_storage((gulong)usec) : 0;
+	if(bucket >= JANUS_ICE_LATENCY_BUCKETS)
+		bucket = JANUS_ICE_LATENCY_BUCKETS-1;
+	h->buckets[bucket]++;
+	h->count++;
+	h->sum += usec;
+	if(usec > h->max)
+		h->max = usec;
+}
+/* Samples are collected by the loop serving the handle, so there's no need for
+ * locking: the Admin API may read slightly inconsistent values, but that's fine */
+static void janus_ice_latency_record(janus_ice_component *component, janus_ice_latency_type type, gint64 usec) {
+	janus_ice_latency_histogram_add(&component->latency[type], usec);
+	janus_ice_static_event_loop *loop = g_private_get(&static_loop_current);
+	if(loop != NULL)
+		janus_ice_latency_histogram_add(&loop->latency[type], usec);
+}
+/* Percentiles can only be as precise as the buckets: we return the upper bound of the one they fall in */
+static gint64 janus_ice_latency_percentile(janus_ice_latency_histogram *h, guint64 count, int percentile) {
+	guint64 target = (count * percentile + 99) / 100, seen = 0;
+	int i = 0;
+	for(i=0; i<JANUS_ICE_LATENCY_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if(seen >= target)
+			return (i == JANUS_ICE_LATENCY_BUCKETS-1) ? h->max : ((gint64)1 << i);
+	}
+	return h->max;
+}
+json_t *janus_ice_latency_summary(janus_ice_latency_histogram *latency) {
+	static const char *names[JANUS_ICE_LATENCY_TYPES] = { "unprotect", "plugin", "queue", "send" };
+	json_t *summary = json_object();
+	int i = 0, j = 0;
+	for(i=0; i<JANUS_ICE_LATENCY_TYPES; i++) {
+		janus_ice_latency_histogram *h = &latency[i];
+		guint64 count = 0;
+		for(j=0; j<JANUS_ICE_LATENCY_BUCKETS; j++)
+			count += h->buckets[j];
+		json_t *info = json_object();
+		json_object_set_new(info, "samples", json_integer(count));
+		if(count > 0) {
+			json_object_set_new(info, "avg", json_integer(h->sum / h->count));
+			json_object_set_new(info, "max", json_integer(h->max));
+			json_object_set_new(info, "p50", json_integer(janus_ice_latency_percentile(h, count, 50)));
+			json_object_set_new(info, "p90", json_integer(janus_ice_latency_percentile(h, count, 90)));
+			json_object_set_new(info, "p99", json_integer(janus_ice_latency_percentile(h, count, 99)));
+			json_t *buckets = json_array();
+			for(j=0; j<JANUS_ICE_LATENCY_BUCKETS; j++)
+				json_array_append_new(buckets, json_integer(h->buckets[j]));
+			json_object_set_new(info, "buckets", buckets);
+		}
+		json_object_set_new(summary, names[i], info);
+	}
+	return summary;
+}
+
 
 static inline void janus_ice_free_rtp_packet(janus_rtp_packet *pkt) {
 	if(pkt == NULL) {
@@ -478,19 +1209,666 @@ static inline void janus_ice_free_rtp_packet(janus_rtp_packet *pkt) {
 	g_free(pkt);
 }
 
+/* Pool of preallocated outgoing packets: each slot contains the
+ * janus_ice_queued_packet instance and an MTU-sized buffer right after
+ * it, so that relaying a packet doesn't need a g_malloc/g_free pair.
+ * Packets are allocated by plugin threads and freed by the loop that
+ * sends them, so we split the pool in a few shards, each protected by
+ * its own mutex: a thread always allocates from the same shard, while
+ * packets are returned to the shard they were taken from. Packets that
+ * don't fit in a slot, or needed when the shard is empty, fall back to
+ * plain heap allocations, and are accounted as misses */
+#define JANUS_ICE_PACKET_POOL_SHARDS	8
+#define JANUS_ICE_PACKET_POOL_BUFSIZE	1536
+#define DEFAULT_PACKET_POOL_SIZE		1024
+typedef struct janus_ice_packet_pool {
+	janus_ice_queued_packet *free;
+	guint available, allocated;
+	guint64 hits, misses;
+	janus_mutex mutex;
+} janus_ice_packet_pool;
+static janus_ice_packet_pool packet_pools[JANUS_ICE_PACKET_POOL_SHARDS];
+static volatile gint packet_pool_next = 0;
+static GPrivate packet_pool_shard = G_PRIVATE_INIT(NULL);
+static uint packet_pool_size = DEFAULT_PACKET_POOL_SIZE;
+void janus_set_packet_pool_size(uint size) {
+	packet_pool_size = size;
+	if(packet_pool_size == 0)
+		JANUS_LOG(LOG_VERB, "Disabling the outgoing packets pool\n");
+	else
+		JANUS_LOG(LOG_VERB, "Setting the outgoing packets pool size to %u buffers\n", packet_pool_size);
+}
+uint janus_get_packet_pool_size(void) {
+	return packet_pool_size;
+}
+static inline guint janus_ice_packet_pool_shard_max(void) {
+	return packet_pool_size > 0 ? (packet_pool_size/JANUS_ICE_PACKET_POOL_SHARDS)+1 : 0;
+}
+json_t *janus_ice_packet_pool_summary(void) {
+	guint64 hits = 0, misses = 0;
+	guint available = 0, allocated = 0;
+	int i = 0;
+	for(i=0; i<JANUS_ICE_PACKET_POOL_SHARDS; i++) {
+		janus_ice_packet_pool *pool = &packet_pools[i];
+		janus_mutex_lock(&pool->mutex);
+		hits += pool->hits;
+		misses += pool->misses;
+		available += pool->available;
+		allocated += pool->allocated;
+		janus_mutex_unlock(&pool->mutex);
+	}
+	json_t *info = json_object();
+	json_object_set_new(info, "size", json_integer(packet_pool_size));
+	json_object_set_new(info, "buffer-size", json_integer(JANUS_ICE_PACKET_POOL_BUFSIZE));
+	json_object_set_new(info, "allocated", json_integer(allocated));
+	json_object_set_new(info, "available", json_integer(available));
+	json_object_set_new(info, "hits", json_integer(hits));
+	json_object_set_new(info, "misses", json_integer(misses));
+	return info;
+}
+static void janus_ice_packet_pool_init(void) {
+	int i = 0;
+	for(i=0; i<JANUS_ICE_PACKET_POOL_SHARDS; i++) {
+		packet_pools[i].free = NULL;
+		packet_pools[i].available = 0;
+		packet_pools[i].allocated = 0;
+		packet_pools[i].hits = 0;
+		packet_pools[i].misses = 0;
+		janus_mutex_init(&packet_pools[i].mutex);
+	}
+}
+static void janus_ice_packet_pool_deinit(void) {
+	int i = 0;
+	for(i=0; i<JANUS_ICE_PACKET_POOL_SHARDS; i++) {
+		janus_ice_packet_pool *pool = &packet_pools[i];
+		janus_mutex_lock(&pool->mutex);
+		while(pool->free != NULL) {
+			janus_ice_queued_packet *pkt = pool->free;
+			pool->free = pkt->next;
+			g_free(pkt);
+		}
+		pool->available = 0;
+		janus_mutex_unlock(&pool->mutex);
+	}
+}
+/* Allocate a new packet, with a buffer of at least the provided size */
+static janus_ice_queued_packet *janus_ice_queued_packet_new(gint size) {
+	janus_ice_queued_packet *pkt = NULL;
+	if(packet_pool_size > 0 && size <= JANUS_ICE_PACKET_POOL_BUFSIZE) {
+		gint shard = GPOINTER_TO_INT(g_private_get(&packet_pool_shard));
+		if(shard == 0) {
+			/* First time this thread allocates a packet, pick a shard */
+			shard = (g_atomic_int_add(&packet_pool_next, 1) % JANUS_ICE_PACKET_POOL_SHARDS) + 1;
+			g_private_set(&packet_pool_shard, GINT_TO_POINTER(shard));
+		}
+		janus_ice_packet_pool *pool = &packet_pools[shard-1];
+		janus_mutex_lock(&pool->mutex);
+		if(pool->free != NULL) {
+			pkt = pool->free;
+			pool->free = pkt->next;
+			pool->available--;
+			pool->hits++;
+		} else if(pool->allocated < janus_ice_packet_pool_shard_max()) {
+			/* The pool can still grow, allocate a new slot we'll keep around */
+			pool->allocated++;
+			pool->misses++;
+			janus_mutex_unlock(&pool->mutex);
+			pkt = g_malloc(sizeof(janus_ice_queued_packet) + JANUS_ICE_PACKET_POOL_BUFSIZE);
+			pkt->buffer = (char *)pkt + sizeof(janus_ice_queued_packet);
+			pkt->size = JANUS_ICE_PACKET_POOL_BUFSIZE;
+			pkt->pool = shard-1;
+			janus_mutex_lock(&pool->mutex);
+		} else {
+			pool->misses++;
+		}
+		janus_mutex_unlock(&pool->mutex);
+	}
+	if(pkt == NULL) {
+		/* Pool disabled, exhausted, or packet too large */
+		pkt = g_malloc(sizeof(janus_ice_queued_packet));
+		pkt->buffer = g_malloc(size);
+		pkt->size = size;
+		pkt->pool = -1;
+	}
+	pkt->data = pkt->buffer;
+	pkt->label = NULL;
+	pkt->protocol = NULL;
+	pkt->shared = NULL;
+	pkt->next = NULL;
+	return pkt;
+}
+
+/* How much a packet accounts for, in the memory of its handle, while it's queued */
+#define JANUS_ICE_QUEUED_PACKET_SIZE(pkt)	((gint)sizeof(janus_ice_queued_packet) + (pkt)->size)
+
+/* If a packet references a shared payload, copy it at the end of the headers */
+static void janus_ice_queued_packet_unshare(janus_ice_queued_packet *pkt) {
+	if(pkt == NULL || pkt->shared == NULL)
+		return;
+	memcpy(pkt->data + pkt->length - pkt->shared->length, pkt->shared->buffer, pkt->shared->length);
+	janus_plugin_rtp_payload_unref(pkt->shared);
+	pkt->shared = NULL;
+}
+
+static gboolean janus_ice_queued_packet_is_trigger(janus_ice_queued_packet *pkt) {
+	return (pkt == &janus_ice_start_gathering ||
+		pkt == &janus_ice_add_candidates ||
+		pkt == &janus_ice_dtls_handshake ||
+		pkt == &janus_ice_hangup_peerconnection ||
+		pkt == &janus_ice_detach_handle ||
+		pkt == &janus_ice_data_ready ||
+		pkt == &janus_ice_migrate_loop);
+}
+
 static void janus_ice_free_queued_packet(janus_ice_queued_packet *pkt) {
-	if(pkt == NULL || pkt == &janus_ice_start_gathering ||
-			pkt == &janus_ice_add_candidates ||
-			pkt == &janus_ice_dtls_handshake ||
-			pkt == &janus_ice_hangup_peerconnection ||
-			pkt == &janus_ice_detach_handle ||
-			pkt == &janus_ice_data_ready) {
+	if(pkt == NULL || janus_ice_queued_packet_is_trigger(pkt))
 		return;
-	}
-	g_free(pkt->data);
+	/* The data may have been replaced in the meanwhile (e.g., REMB+RR) */
+	janus_plugin_rtp_payload_unref(pkt->shared);
+	if(pkt->data != pkt->buffer)
+		g_free(pkt->data);
 	g_free(pkt->label);
 	g_free(pkt->protocol);
-	g_free(pkt);
+	if(pkt->pool < 0) {
+		g_free(pkt->buffer);
+		g_free(pkt);
+		return;
+	}
+	/* Return the slot to the pool it came from */
+	janus_ice_packet_pool *pool = &packet_pools[pkt->pool];
+	janus_mutex_lock(&pool->mutex);
+	if(pool->allocated > janus_ice_packet_pool_shard_max()) {
+		/* The pool was shrunk in the meanwhile, get rid of this slot */
+		pool->allocated--;
+		janus_mutex_unlock(&pool->mutex);
+		g_free(pkt);
+		return;
+	}
+	pkt->label = NULL;
+	pkt->protocol = NULL;
+	pkt->next = pool->free;
+	pool->free = pkt;
+	pool->available++;
+	janus_mutex_unlock(&pool->mutex);
+}
+
+/* Batching of outgoing packets: rather than doing a nice_agent_send (and
+ * so a syscall) for each packet we protect, we copy the SRTP/SRTCP data
+ * to a per-thread batch, and flush it with nice_agent_send_messages_nonblocking
+ * when the loop is done dispatching the packets queued for a handle (or
+ * when the batch is full): on Linux this ends up in a single sendmmsg */
+#define JANUS_ICE_EGRESS_BATCH_BUFSIZE	JANUS_ICE_PACKET_POOL_BUFSIZE
+#define JANUS_ICE_EGRESS_BATCH_MAX		64
+static uint egress_batch = 0;
+static volatile gint egress_batches = 0, egress_batched_packets = 0;
+void janus_set_egress_batch(uint packets) {
+#ifndef HAVE_LIBNICE_SEND_MESSAGES
+	if(packets > 0) {
+		JANUS_LOG(LOG_WARN, "libnice doesn't support nice_agent_send_messages_nonblocking, egress batching disabled\n");
+		packets = 0;
+	}
+#endif
+	if(packets > JANUS_ICE_EGRESS_BATCH_MAX) {
+		JANUS_LOG(LOG_WARN, "Egress batch too large (%u), capping to %d\n", packets, JANUS_ICE_EGRESS_BATCH_MAX);
+		packets = JANUS_ICE_EGRESS_BATCH_MAX;
+	}
+	egress_batch = packets;
+	if(egress_batch < 2)
+		JANUS_LOG(LOG_VERB, "Disabling egress batching\n");
+	else
+		JANUS_LOG(LOG_VERB, "Setting egress batching to %u packets\n", egress_batch);
+}
+uint janus_get_egress_batch(void) {
+	return egress_batch;
+}
+json_t *janus_ice_egress_batch_summary(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "size", json_integer(egress_batch));
+	int batches = g_atomic_int_get(&egress_batches);
+	int packets = g_atomic_int_get(&egress_batched_packets);
+	json_object_set_new(info, "batches", json_integer(batches));
+	json_object_set_new(info, "packets", json_integer(packets));
+	if(batches > 0)
+		json_object_set_new(info, "average", json_real((double)packets/(double)batches));
+	return info;
+}
+#ifdef HAVE_LIBNICE_SEND_MESSAGES
+typedef struct janus_ice_egress_batch {
+	/* Where the batched packets need to be sent */
+	janus_ice_handle *handle;
+	guint stream_id, component_id;
+	/* The batched packets */
+	NiceOutputMessage messages[JANUS_ICE_EGRESS_BATCH_MAX];
+	GOutputVector vectors[JANUS_ICE_EGRESS_BATCH_MAX];
+	char buffers[JANUS_ICE_EGRESS_BATCH_MAX][JANUS_ICE_EGRESS_BATCH_BUFSIZE];
+	guint count;
+} janus_ice_egress_batch;
+static GPrivate egress_batch_private = G_PRIVATE_INIT(g_free);
+#endif
+static void janus_ice_egress_batch_flush(void) {
+#ifdef HAVE_LIBNICE_SEND_MESSAGES
+	janus_ice_egress_batch *batch = g_private_get(&egress_batch_private);
+	if(batch == NULL || batch->count == 0)
+		return;
+	janus_ice_handle *handle = batch->handle;
+	GError *error = NULL;
+	gint sent = nice_agent_send_messages_nonblocking(handle->agent, batch->stream_id, batch->component_id,
+		batch->messages, batch->count, NULL, &error);
+	if(sent < (gint)batch->count) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d packets out of %u? (%s)\n", handle->handle_id,
+			sent, batch->count, error ? error->message : "??");
+	}
+	if(error)
+		g_error_free(error);
+	g_atomic_int_inc(&egress_batches);
+	g_atomic_int_add(&egress_batched_packets, batch->count);
+	batch->count = 0;
+	batch->handle = NULL;
+#endif
+}
+/* Send a packet, or add it to the current batch if batching is enabled */
+static gint janus_ice_egress_send(janus_ice_handle *handle, janus_ice_component *component, gint length, const gchar *data) {
+	if(component->mux != NULL)
+		return janus_ice_mux_peer_send(component->mux, data, length);
+#ifdef HAVE_LIBNICE_SEND_MESSAGES
+	if(egress_batch > 1 && length <= JANUS_ICE_EGRESS_BATCH_BUFSIZE) {
+		janus_ice_egress_batch *batch = g_private_get(&egress_batch_private);
+		if(batch == NULL) {
+			batch = g_malloc0(sizeof(janus_ice_egress_batch));
+			g_private_set(&egress_batch_private, batch);
+		}
+		if(batch->count > 0 && (batch->handle != handle || batch->stream_id != component->stream_id ||
+				batch->component_id != component->component_id))
+			janus_ice_egress_batch_flush();
+		guint index = batch->count;
+		memcpy(batch->buffers[index], data, length);
+		batch->vectors[index].buffer = batch->buffers[index];
+		batch->vectors[index].size = length;
+		batch->messages[index].buffers = &batch->vectors[index];
+		batch->messages[index].n_buffers = 1;
+		batch->handle = handle;
+		batch->stream_id = component->stream_id;
+		batch->component_id = component->component_id;
+		batch->count++;
+		if(batch->count >= egress_batch)
+			janus_ice_egress_batch_flush();
+		return length;
+	}
+	/* Not batching this packet: make sure we don't send it out of order */
+	janus_ice_egress_batch_flush();
+#endif
+	return nice_agent_send(handle->agent, component->stream_id, component->component_id, length, data);
+}
+
+/* Batching of incoming packets: plugins that implement incoming_rtp_batch
+ * can get the RTP packets received for a handle several at a time, so that
+ * they look up their session (and take its locks) once per batch rather
+ * than once per packet. The buffers libnice gives us are only valid for the
+ * duration of the callback, so we copy the packets to a per-handle batch,
+ * which is passed to the plugin when it's full, or as soon as the loop is
+ * done with what it received in this iteration (the outgoing traffic
+ * source is ready whenever there's something in the batch) */
+#define JANUS_ICE_INCOMING_BATCH_BUFSIZE	JANUS_ICE_PACKET_POOL_BUFSIZE
+#define JANUS_ICE_INCOMING_BATCH_MAX		64
+static uint incoming_batch = 0;
+static volatile gint incoming_batches = 0, incoming_batched_packets = 0;
+struct janus_ice_incoming_batch {
+	/* The batched packets, and the copies of their data and extensions maps */
+	janus_plugin_rtp packets[JANUS_ICE_INCOMING_BATCH_MAX];
+	janus_plugin_rtp *list[JANUS_ICE_INCOMING_BATCH_MAX];
+	janus_rtp_header_extensions_map maps[JANUS_ICE_INCOMING_BATCH_MAX];
+	char *buffers;
+	guint size, count;
+};
+void janus_set_incoming_batch(uint packets) {
+	if(packets > JANUS_ICE_INCOMING_BATCH_MAX) {
+		JANUS_LOG(LOG_WARN, "Incoming batch too large (%u), capping to %d\n", packets, JANUS_ICE_INCOMING_BATCH_MAX);
+		packets = JANUS_ICE_INCOMING_BATCH_MAX;
+	}
+	incoming_batch = packets;
+	if(incoming_batch < 2)
+		JANUS_LOG(LOG_VERB, "Disabling incoming batching\n");
+	else
+		JANUS_LOG(LOG_VERB, "Setting incoming batching to %u packets\n", incoming_batch);
+}
+uint janus_get_incoming_batch(void) {
+	return incoming_batch;
+}
+json_t *janus_ice_incoming_batch_summary(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "size", json_integer(incoming_batch));
+	int batches = g_atomic_int_get(&incoming_batches);
+	int packets = g_atomic_int_get(&incoming_batched_packets);
+	json_object_set_new(info, "batches", json_integer(batches));
+	json_object_set_new(info, "packets", json_integer(packets));
+	if(batches > 0)
+		json_object_set_new(info, "average", json_real((double)packets/(double)batches));
+	return info;
+}
+#define JANUS_ICE_INCOMING_BATCH_MEMORY(batch)	((gint)sizeof(janus_ice_incoming_batch) + (gint)(batch)->size*JANUS_ICE_INCOMING_BATCH_BUFSIZE)
+static void janus_ice_incoming_batch_free(janus_ice_handle *handle) {
+	janus_ice_incoming_batch *batch = handle->incoming_batch;
+	if(batch == NULL)
+		return;
+	handle->incoming_batch = NULL;
+	janus_memory_add(&handle->memory, JANUS_MEMORY_MEDIA_QUEUE, -JANUS_ICE_INCOMING_BATCH_MEMORY(batch));
+	g_free(batch->buffers);
+	g_free(batch);
+}
+static gboolean janus_ice_incoming_batch_pending(janus_ice_handle *handle) {
+	return (handle->incoming_batch != NULL && handle->incoming_batch->count > 0);
+}
+/* Pass the packets we batched to the plugin: must be called by the loop thread */
+static void janus_ice_incoming_batch_flush(janus_ice_handle *handle) {
+	janus_ice_incoming_batch *batch = handle->incoming_batch;
+	if(batch == NULL || batch->count == 0)
+		return;
+	janus_plugin *plugin = (janus_plugin *)handle->app;
+	if(plugin && plugin->incoming_rtp_batch && handle->app_handle &&
+			!g_atomic_int_get(&handle->app_handle->stopped) &&
+			!g_atomic_int_get(&handle->destroyed)) {
+		plugin->incoming_rtp_batch(handle->app_handle, batch->list, batch->count);
+		g_atomic_int_inc(&incoming_batches);
+		g_atomic_int_add(&incoming_batched_packets, batch->count);
+	}
+	batch->count = 0;
+}
+/* Add a packet to the batch for the plugin, if it takes them in batches: returns FALSE
+ * if the packet should be passed to incoming_rtp instead (after flushing the batch) */
+static gboolean janus_ice_incoming_batch_add(janus_ice_handle *handle, janus_plugin_rtp *packet) {
+	janus_plugin *plugin = (janus_plugin *)handle->app;
+	if(incoming_batch < 2 || plugin == NULL || plugin->incoming_rtp_batch == NULL ||
+			packet->length > JANUS_ICE_INCOMING_BATCH_BUFSIZE)
+		return FALSE;
+	janus_ice_incoming_batch *batch = handle->incoming_batch;
+	if(batch != NULL && batch->size != incoming_batch) {
+		/* The size was changed in the meanwhile, start over */
+		janus_ice_incoming_batch_flush(handle);
+		janus_ice_incoming_batch_free(handle);
+		batch = NULL;
+	}
+	if(batch == NULL) {
+		batch = g_malloc0(sizeof(janus_ice_incoming_batch));
+		batch->size = incoming_batch;
+		batch->buffers = g_malloc(batch->size * JANUS_ICE_INCOMING_BATCH_BUFSIZE);
+		handle->incoming_batch = batch;
+		janus_memory_add(&handle->memory, JANUS_MEMORY_MEDIA_QUEUE, JANUS_ICE_INCOMING_BATCH_MEMORY(batch));
+	}
+	guint index = batch->count;
+	janus_plugin_rtp *copy = &batch->packets[index];
+	*copy = *packet;
+	copy->buffer = batch->buffers + index*JANUS_ICE_INCOMING_BATCH_BUFSIZE;
+	memcpy(copy->buffer, packet->buffer, packet->length);
+	if(packet->extensions.map != NULL) {
+		batch->maps[index] = *packet->extensions.map;
+		copy->extensions.map = &batch->maps[index];
+	}
+	batch->list[index] = copy;
+	batch->count++;
+	if(batch->count >= batch->size)
+		janus_ice_incoming_batch_flush(handle);
+	return TRUE;
+}
+
+/* Pacing of outgoing video: plugins relay video as they get it, which
+ * means a keyframe (or a frame sent after a stall) leaves as a burst of
+ * packets at line rate, which shallow buffers along the path may drop.
+ * When enabled, we pass plugin video through a leaky bucket per component,
+ * filled at a multiple of the bitrate we think the peer can take (the
+ * REMB it sends, or what we actually sent in the last second if higher)
+ * and as deep as a few milliseconds worth of that: packets that find it
+ * empty wait in a queue a timer drains. Audio, RTCP and retransmissions
+ * are never delayed, and neither are packets waiting for too long, which
+ * are sent anyway: the pacer never drops anything */
+#define JANUS_ICE_PACING_INTERVAL	5
+#define JANUS_ICE_PACING_MIN_RATE	1000000
+#define JANUS_ICE_PACING_MIN_BURST	(4*1500)
+#define JANUS_ICE_PACING_MAX_DELAY	500
+static gboolean pacing_enabled = FALSE;
+static uint pacing_burst = 40, pacing_factor = 250, pacing_max_delay = 100;
+void janus_set_pacing(gboolean enabled, uint burst, uint factor, uint max_delay) {
+	if(factor < 100) {
+		JANUS_LOG(LOG_WARN, "Pacing factor too low (%u%%), using 100%%\n", factor);
+		factor = 100;
+	}
+	if(max_delay > JANUS_ICE_PACING_MAX_DELAY) {
+		JANUS_LOG(LOG_WARN, "Pacing delay too large (%ums), capping to %dms\n", max_delay, JANUS_ICE_PACING_MAX_DELAY);
+		max_delay = JANUS_ICE_PACING_MAX_DELAY;
+	}
+	pacing_enabled = enabled;
+	pacing_burst = burst;
+	pacing_factor = factor;
+	pacing_max_delay = max_delay;
+	if(!pacing_enabled)
+		JANUS_LOG(LOG_VERB, "Disabling pacing of outgoing video\n");
+	else
+		JANUS_LOG(LOG_VERB, "Pacing outgoing video at %u%% of the estimated bitrate (burst=%ums, max delay=%ums)\n",
+			pacing_factor, pacing_burst, pacing_max_delay);
+}
+gboolean janus_is_pacing_enabled(void) {
+	return pacing_enabled;
+}
+json_t *janus_ice_pacing_summary(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "enabled", pacing_enabled ? json_true() : json_false());
+	json_object_set_new(info, "burst", json_integer(pacing_burst));
+	json_object_set_new(info, "factor", json_integer(pacing_factor));
+	json_object_set_new(info, "max-delay", json_integer(pacing_max_delay));
+	return info;
+}
+json_t *janus_ice_pacer_summary(janus_ice_pacer *pacer) {
+	json_t *info = json_object();
+	json_object_set_new(info, "rate", json_integer(pacer->rate));
+	json_object_set_new(info, "remb", json_integer(pacer->remb));
+	json_object_set_new(info, "queued", json_integer(g_queue_get_length(&pacer->queue)));
+	json_object_set_new(info, "queue-max", json_integer(pacer->queue_max));
+	json_object_set_new(info, "packets-paced", json_integer(pacer->paced));
+	json_object_set_new(info, "packets-forced", json_integer(pacer->forced));
+	if(pacer->paced > 0)
+		json_object_set_new(info, "delay-avg", json_integer(pacer->delay_sum/pacer->paced));
+	json_object_set_new(info, "delay-max", json_integer(pacer->delay_max));
+	return info;
+}
+static void janus_ice_pacer_refill(janus_ice_component *component, gint64 now) {
+	janus_ice_pacer *pacer = &component->pacer;
+	guint64 rate = (guint64)component->out_stats.video[0].bytes_lastsec * 8;
+	if(pacer->remb > rate)
+		rate = pacer->remb;
+	if(rate < JANUS_ICE_PACING_MIN_RATE)
+		rate = JANUS_ICE_PACING_MIN_RATE;
+	rate = rate * pacing_factor / 100;
+	if(rate > G_MAXUINT32)
+		rate = G_MAXUINT32;
+	pacer->rate = rate;
+	gint64 burst = (gint64)rate * pacing_burst / 8000;
+	if(burst < JANUS_ICE_PACING_MIN_BURST)
+		burst = JANUS_ICE_PACING_MIN_BURST;
+	if(pacer->updated == 0) {
+		/* Start with a full bucket */
+		pacer->tokens = burst;
+	} else if(now > pacer->updated) {
+		pacer->tokens += (now - pacer->updated) * (gint64)rate / (8 * G_USEC_PER_SEC);
+		if(pacer->tokens > burst)
+			pacer->tokens = burst;
+	}
+	pacer->updated = now;
+}
+static void janus_ice_pacer_drain(janus_ice_handle *handle, janus_ice_component *component) {
+	janus_ice_pacer *pacer = &component->pacer;
+	gint64 now = janus_get_monotonic_time();
+	janus_ice_pacer_refill(component, now);
+	janus_ice_queued_packet *pkt = NULL;
+	while((pkt = g_queue_peek_head(&pacer->queue)) != NULL) {
+		if(pacer->tokens <= 0) {
+			/* Out of tokens: only send the packet if it waited too long already */
+			if(now - pkt->added < (gint64)pacing_max_delay*1000)
+				break;
+			pacer->forced++;
+		}
+		g_queue_pop_head(&pacer->queue);
+		janus_memory_add(pacer->account, JANUS_MEMORY_MEDIA_QUEUE, -JANUS_ICE_QUEUED_PACKET_SIZE(pkt));
+		pacer->tokens -= pkt->length;
+		gint64 delay = now - pkt->paced;
+		pacer->delay_sum += delay;
+		if(delay > pacer->delay_max)
+			pacer->delay_max = delay;
+		janus_ice_outgoing_traffic_handle(handle, pkt);
+	}
+}
+static gboolean janus_ice_pacer_timer(gpointer user_data) {
+	janus_ice_component *component = (janus_ice_component *)user_data;
+	janus_ice_handle *handle = component->stream ? component->stream->handle : NULL;
+	if(handle != NULL) {
+		janus_ice_pacer_drain(handle, component);
+		janus_ice_egress_batch_flush();
+	}
+	if(handle != NULL && !g_queue_is_empty(&component->pacer.queue))
+		return G_SOURCE_CONTINUE;
+	g_source_unref(component->pacer.timer);
+	component->pacer.timer = NULL;
+	return G_SOURCE_REMOVE;
+}
+/* Returns TRUE if the pacer took care of the packet, FALSE if it must be sent right away */
+static gboolean janus_ice_pacer_enqueue(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	if(!pacing_enabled || pkt->type != JANUS_ICE_PACKET_VIDEO || pkt->control || pkt->retransmission)
+		return FALSE;
+	janus_ice_component *component = handle->stream ? handle->stream->component : NULL;
+	if(component == NULL)
+		return FALSE;
+	janus_ice_pacer *pacer = &component->pacer;
+	gint64 now = janus_get_monotonic_time();
+	janus_ice_pacer_refill(component, now);
+	if(g_queue_is_empty(&pacer->queue) && pacer->tokens > 0) {
+		pacer->tokens -= pkt->length;
+		return FALSE;
+	}
+	pkt->paced = now;
+	g_queue_push_tail(&pacer->queue, pkt);
+	pacer->account = &handle->memory;
+	janus_memory_add(pacer->account, JANUS_MEMORY_MEDIA_QUEUE, JANUS_ICE_QUEUED_PACKET_SIZE(pkt));
+	pacer->paced++;
+	if(g_queue_get_length(&pacer->queue) > pacer->queue_max)
+		pacer->queue_max = g_queue_get_length(&pacer->queue);
+	/* Tokens may be available for what was queued before this packet */
+	janus_ice_pacer_drain(handle, component);
+	if(!g_queue_is_empty(&pacer->queue) && pacer->timer == NULL) {
+		pacer->timer = g_timeout_source_new(JANUS_ICE_PACING_INTERVAL);
+		g_source_set_priority(pacer->timer, G_PRIORITY_DEFAULT);
+		g_source_set_callback(pacer->timer, janus_ice_pacer_timer, component, NULL);
+		g_source_attach(pacer->timer, handle->mainctx);
+	}
+	return TRUE;
+}
+/* Get rid of the pacer timer, and either send or discard what's still queued */
+static void janus_ice_pacer_stop(janus_ice_component *component, gboolean flush) {
+	janus_ice_pacer *pacer = &component->pacer;
+	if(pacer->timer != NULL) {
+		g_source_destroy(pacer->timer);
+		g_source_unref(pacer->timer);
+		pacer->timer = NULL;
+	}
+	janus_ice_handle *handle = (flush && component->stream) ? component->stream->handle : NULL;
+	janus_ice_queued_packet *pkt = NULL;
+	while((pkt = g_queue_pop_head(&pacer->queue)) != NULL) {
+		janus_memory_add(pacer->account, JANUS_MEMORY_MEDIA_QUEUE, -JANUS_ICE_QUEUED_PACKET_SIZE(pkt));
+		if(handle != NULL)
+			janus_ice_outgoing_traffic_handle(handle, pkt);
+		else
+			janus_ice_free_queued_packet(pkt);
+	}
+}
+
+/* RED and ULPFEC: when enabled, the sendonly m-lines of the offers we
+ * send include RED for Opus, and RED+ULPFEC for video (see fec.h): if the
+ * peer accepts them, we protect what we send with an amount of redundancy
+ * that depends on the losses it reports, so that it can recover them
+ * without waiting for a retransmission */
+static gboolean fec_enabled = FALSE;
+void janus_set_fec(gboolean enabled) {
+	fec_enabled = enabled;
+	JANUS_LOG(LOG_VERB, "%s RED and ULPFEC for outgoing media\n", fec_enabled ? "Enabling" : "Disabling");
+}
+gboolean janus_is_fec_enabled(void) {
+	return fec_enabled;
+}
+static uint32_t janus_ice_fec_loss(janus_rtcp_context *ctx) {
+	uint32_t quality = janus_rtcp_context_get_out_media_link_quality(ctx);
+	return (quality > 0 && quality < 100) ? (100 - quality) : 0;
+}
+/* Protect an (unencrypted) outgoing RTP packet, before it's saved for retransmissions */
+static void janus_ice_fec_protect(janus_ice_stream *stream, janus_ice_queued_packet *pkt, gboolean video) {
+	janus_fec_context *fec = stream->fec;
+	if(fec == NULL || pkt->data != pkt->buffer)
+		return;
+	int size = pkt->size - SRTP_MAX_TAG_LEN;
+	if(!video) {
+		if(fec->audio_red_pt <= 0)
+			return;
+		fec->distance = janus_red_distance(janus_ice_fec_loss(stream->audio_rtcp_ctx));
+		int len = janus_red_encode(&fec->red, pkt->data, pkt->length, size, fec->audio_red_pt, fec->distance);
+		if(len != pkt->length) {
+			pkt->length = len;
+			fec->red_packets++;
+		}
+		return;
+	}
+	if(fec->video_red_pt <= 0 || fec->video_ulpfec_pt <= 0)
+		return;
+	if(fec->ulpfec.count == 0) {
+		/* We only change the amount of protection between groups */
+		fec->group_size = janus_ulpfec_group_size(janus_ice_fec_loss(stream->video_rtcp_ctx[0]));
+	}
+	if(fec->group_size == 0)
+		return;
+	int count = janus_ulpfec_encoder_add(&fec->ulpfec, pkt->data, pkt->length);
+	if(count < 0) {
+		/* Sequence number jump (or packet too large), start a new group */
+		janus_ulpfec_encoder_reset(&fec->ulpfec);
+		count = janus_ulpfec_encoder_add(&fec->ulpfec, pkt->data, pkt->length);
+	}
+	janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+	gboolean marker = header->markerbit;
+	uint16_t seq = ntohs(header->seq_number);
+	int len = janus_red_wrap(pkt->data, pkt->length, size, fec->video_red_pt);
+	if(len > 0)
+		pkt->length = len;
+	/* Protect the group when it's full, or at the end of a frame if it's half full */
+	if(count > 0 && (count >= fec->group_size || (marker && count >= (fec->group_size+1)/2))) {
+		len = janus_ulpfec_encoder_generate(&fec->ulpfec, stream->video_ssrc, seq+1,
+			fec->video_red_pt, fec->video_ulpfec_pt, fec->packet, sizeof(fec->packet));
+		if(len > 0) {
+			/* The FEC packet takes a sequence number, the next media packets move forward */
+			fec->packet_length = len;
+			fec->seq_offset++;
+		} else {
+			janus_ulpfec_encoder_reset(&fec->ulpfec);
+		}
+	}
+}
+/* Send the ULPFEC packet the last media packet completed, if any */
+static void janus_ice_fec_send(janus_ice_handle *handle, janus_ice_component *component, janus_ice_stream *stream) {
+	janus_fec_context *fec = stream->fec;
+	if(fec == NULL || fec->packet_length == 0)
+		return;
+	char buffer[JANUS_FEC_MAX_PACKET+SRTP_MAX_TAG_LEN];
+	int protected = fec->packet_length;
+	memcpy(buffer, fec->packet, protected);
+	fec->packet_length = 0;
+	int res = janus_is_webrtc_encryption_enabled() ?
+		srtp_protect(component->dtls->srtp_out, buffer, &protected) : srtp_err_status_ok;
+	if(janus_is_webrtc_encryption_enabled())
+		component->srtp_protected++;
+	if(res != srtp_err_status_ok) {
+		handle->srtp_errors_count++;
+		handle->last_srtp_error = res;
+		return;
+	}
+	int sent = janus_ice_egress_send(handle, component, protected, buffer);
+	if(sent > 0) {
+		fec->fec_packets++;
+		if(stream->video_rtcp_ctx[0])
+			g_atomic_int_inc(&stream->video_rtcp_ctx[0]->sent_packets_since_last_rr);
+	}
 }
 
 /* Minimum and maximum value, in milliseconds, for the NACK queue/retransmissions (default=200ms/1000ms) */
@@ -507,41 +1885,137 @@ void janus_set_min_nack_queue(uint16_t mnq) {
 	else
 		JANUS_LOG(LOG_VERB, "Setting min NACK queue to %dms\n", min_nack_queue);
 }
-uint16_t janus_get_min_nack_queue(void) {
-	return min_nack_queue;
+uint16_t janus_get_min_nack_queue(void) {
+	return min_nack_queue;
+}
+
+/* Capacity of the rings we keep sent packets in for retransmissions: they
+ * must be powers of two, and large enough to cover DEFAULT_MAX_NACK_QUEUE
+ * worth of packets (~1000pps is around 10mbps of video); if we send more
+ * than that, the oldest packets are simply evicted before they expire */
+#define JANUS_ICE_RETRANSMIT_AUDIO_SLOTS	256
+#define JANUS_ICE_RETRANSMIT_VIDEO_SLOTS	1024
+/* When a handle goes over its memory soft limit, we divide its NACK window
+ * by this factor, without going below the minimum (in microseconds) */
+#define JANUS_ICE_MEMORY_DEGRADE_FACTOR		4
+#define JANUS_ICE_MEMORY_MIN_NACK_WINDOW	100000
+/* How much a stored packet accounts for, in the memory of its handle */
+#define JANUS_ICE_RETRANSMIT_PACKET_SIZE(p)	((gint)sizeof(janus_rtp_packet) + (p)->length)
+static janus_ice_retransmit_buffer *janus_ice_retransmit_buffer_create(guint16 slots, janus_memory_account *account) {
+	janus_ice_retransmit_buffer *rb = g_malloc0(sizeof(janus_ice_retransmit_buffer));
+	rb->slots = g_malloc0(slots * sizeof(janus_ice_retransmit_slot));
+	rb->mask = slots-1;
+	rb->account = account;
+	janus_memory_add(rb->account, JANUS_MEMORY_RETRANSMIT,
+		sizeof(janus_ice_retransmit_buffer) + slots * sizeof(janus_ice_retransmit_slot));
+	return rb;
+}
+static void janus_ice_retransmit_buffer_drop(janus_ice_retransmit_buffer *rb, janus_rtp_packet *p) {
+	janus_memory_add(rb->account, JANUS_MEMORY_RETRANSMIT, -JANUS_ICE_RETRANSMIT_PACKET_SIZE(p));
+	janus_ice_free_rtp_packet(p);
+}
+static janus_rtp_packet *janus_ice_retransmit_buffer_lookup(janus_ice_retransmit_buffer *rb, guint16 seq) {
+	if(rb == NULL || rb->count == 0)
+		return NULL;
+	janus_ice_retransmit_slot *slot = &rb->slots[seq & rb->mask];
+	return (slot->packet != NULL && slot->seq == seq) ? slot->packet : NULL;
+}
+/* Get rid of the packets from the oldest one on: if now is 0, we drop them all,
+ * otherwise we stop at the first packet that is still in the time window */
+static void janus_ice_retransmit_buffer_expire(janus_ice_retransmit_buffer *rb, gint64 now, gint64 window) {
+	if(rb == NULL)
+		return;
+	while(rb->count > 0) {
+		janus_ice_retransmit_slot *slot = &rb->slots[rb->first & rb->mask];
+		if(slot->packet != NULL && slot->seq == rb->first) {
+			if(now && now - slot->packet->created < window)
+				break;
+			/* Packet is too old, get rid of it */
+			janus_ice_retransmit_buffer_drop(rb, slot->packet);
+			slot->packet = NULL;
+			rb->count--;
+		}
+		/* This also skips holes, e.g., sequence numbers we never stored */
+		rb->first++;
+	}
+}
+static void janus_ice_retransmit_buffer_insert(janus_ice_retransmit_buffer *rb, guint16 seq, janus_rtp_packet *p) {
+	if(rb->count == 0) {
+		rb->first = seq;
+		rb->last = seq;
+	} else {
+		gint16 diff = (gint16)(seq - rb->last);
+		if(diff > 0 && (guint)diff > rb->mask) {
+			/* Big jump forward, anything we had is way too old now */
+			janus_ice_retransmit_buffer_expire(rb, 0, 0);
+			rb->first = seq;
+		} else if((gint16)(seq - rb->first) < 0) {
+			/* Older than anything we have, we're not going to need it */
+			janus_ice_free_rtp_packet(p);
+			return;
+		}
+		if(diff > 0)
+			rb->last = seq;
+		/* Keep the ring within its capacity, evicting the oldest packets */
+		while((guint16)(rb->last - rb->first) > rb->mask) {
+			janus_ice_retransmit_slot *slot = &rb->slots[rb->first & rb->mask];
+			if(slot->packet != NULL && slot->seq == rb->first) {
+				janus_ice_retransmit_buffer_drop(rb, slot->packet);
+				slot->packet = NULL;
+				rb->count--;
+			}
+			rb->first++;
+		}
+	}
+	janus_ice_retransmit_slot *slot = &rb->slots[seq & rb->mask];
+	if(slot->packet != NULL) {
+		/* Same sequence number sent twice, replace it */
+		janus_ice_retransmit_buffer_drop(rb, slot->packet);
+		rb->count--;
+	}
+	slot->packet = p;
+	slot->seq = seq;
+	rb->count++;
+	janus_memory_add(rb->account, JANUS_MEMORY_RETRANSMIT, JANUS_ICE_RETRANSMIT_PACKET_SIZE(p));
+	if(rb->count == 1)
+		rb->first = seq;
+}
+static void janus_ice_retransmit_buffer_destroy(janus_ice_retransmit_buffer *rb) {
+	if(rb == NULL)
+		return;
+	janus_ice_retransmit_buffer_expire(rb, 0, 0);
+	janus_memory_add(rb->account, JANUS_MEMORY_RETRANSMIT,
+		-(gint)(sizeof(janus_ice_retransmit_buffer) + (rb->mask+1) * sizeof(janus_ice_retransmit_slot)));
+	g_free(rb->slots);
+	g_free(rb);
 }
+
 /* Helper to clean old NACK packets in the buffer when they exceed the queue time limit */
 static void janus_cleanup_nack_buffer(gint64 now, janus_ice_stream *stream, gboolean audio, gboolean video) {
 	if(stream && stream->component) {
 		janus_ice_component *component = stream->component;
-		if(audio && component->audio_retransmit_buffer) {
-			janus_rtp_packet *p = (janus_rtp_packet *)g_queue_peek_head(component->audio_retransmit_buffer);
-			while(p && (!now || (now - p->created >= (gint64)stream->nack_queue_ms*1000))) {
-				/* Packet is too old, get rid of it */
-				g_queue_pop_head(component->audio_retransmit_buffer);
-				/* Remove from hashtable too */
-				janus_rtp_header *header = (janus_rtp_header *)p->data;
-				guint16 seq = ntohs(header->seq_number);
-				g_hash_table_remove(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq));
-				/* Free the packet */
-				janus_ice_free_rtp_packet(p);
-				p = (janus_rtp_packet *)g_queue_peek_head(component->audio_retransmit_buffer);
+		gint64 window = (gint64)stream->nack_queue_ms*1000;
+		janus_ice_handle *handle = stream->handle;
+		if(now > 0 && handle != NULL) {
+			/* If the handle is using more memory than it should, keep a shorter
+			 * history of what we sent, until it's back below the soft limit */
+			gboolean changed = FALSE;
+			if(janus_memory_account_check_limit(&handle->memory, &changed)) {
+				window /= JANUS_ICE_MEMORY_DEGRADE_FACTOR;
+				if(window < JANUS_ICE_MEMORY_MIN_NACK_WINDOW)
+					window = JANUS_ICE_MEMORY_MIN_NACK_WINDOW;
 			}
-		}
-		if(video && component->video_retransmit_buffer) {
-			janus_rtp_packet *p = (janus_rtp_packet *)g_queue_peek_head(component->video_retransmit_buffer);
-			while(p && (!now || (now - p->created >= (gint64)stream->nack_queue_ms*1000))) {
-				/* Packet is too old, get rid of it */
-				g_queue_pop_head(component->video_retransmit_buffer);
-				/* Remove from hashtable too */
-				janus_rtp_header *header = (janus_rtp_header *)p->data;
-				guint16 seq = ntohs(header->seq_number);
-				g_hash_table_remove(component->video_retransmit_seqs, GUINT_TO_POINTER(seq));
-				/* Free the packet */
-				janus_ice_free_rtp_packet(p);
-				p = (janus_rtp_packet *)g_queue_peek_head(component->video_retransmit_buffer);
+			if(changed) {
+				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Handle is %s its memory soft limit (%"SCNi64" bytes), %s NACK history\n",
+					handle->handle_id, g_atomic_int_get(&handle->memory.over_limit) ? "over" : "back below",
+					janus_memory_account_total(&handle->memory),
+					g_atomic_int_get(&handle->memory.over_limit) ? "shrinking" : "restoring");
 			}
 		}
+		if(audio)
+			janus_ice_retransmit_buffer_expire(component->audio_retransmit_buffer, now, window);
+		if(video)
+			janus_ice_retransmit_buffer_expire(component->video_retransmit_buffer, now, window);
 	}
 }
 
@@ -641,6 +2115,12 @@ static void janus_ice_clear_queued_packets(janus_ice_handle *handle) {
 		pkt = g_async_queue_try_pop(handle->queued_packets);
 		janus_ice_free_queued_packet(pkt);
 	}
+	janus_ice_queued_packet *list = janus_ice_queued_media_take(handle);
+	while(list != NULL) {
+		pkt = list;
+		list = list->next;
+		janus_ice_free_queued_packet(pkt);
+	}
 }
 
 
@@ -698,7 +2178,7 @@ static void janus_ice_notify_media(janus_ice_handle *handle, gboolean video, gbo
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...\n", handle->handle_id);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_wanted(JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_STATE)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "media", json_string(video ? "video" : "audio"));
 		json_object_set_new(info, "receiving", up ? json_true() : json_false());
@@ -729,7 +2209,7 @@ void janus_ice_notify_hangup(janus_ice_handle *handle, const char *reason) {
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_wanted(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_STATE)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "connection", json_string("hangup"));
 		if(reason != NULL)
@@ -874,6 +2354,9 @@ void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle,
 	plugin_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_plugin_session_dereference);
 	janus_mutex_init(&plugin_sessions_mutex);
 
+	/* Initialize the pool of outgoing packets */
+	janus_ice_packet_pool_init();
+
 #ifdef HAVE_TURNRESTAPI
 	/* Initialize the TURN REST API client stack, whether we're going to use it or not */
 	janus_turnrest_init();
@@ -885,6 +2368,13 @@ void janus_ice_deinit(void) {
 #ifdef HAVE_TURNRESTAPI
 	janus_turnrest_deinit();
 #endif
+	janus_ice_mux_deinit();
+	janus_ice_packet_pool_deinit();
+	janus_mutex_lock(&janus_ice_stats_mutex);
+	if(janus_ice_stats_entries != NULL)
+		g_hash_table_destroy(janus_ice_stats_entries);
+	janus_ice_stats_entries = NULL;
+	janus_mutex_unlock(&janus_ice_stats_mutex);
 }
 
 int janus_ice_test_stun_server(janus_network_address *addr, uint16_t port,
@@ -1133,6 +2623,29 @@ int janus_ice_set_turn_rest_api(gchar *api_server, gchar *api_key, gchar *api_me
 	return 0;
 }
 
+void janus_ice_set_turn_rest_api_cache(gboolean cache, gboolean nonblocking) {
+#ifdef HAVE_TURNRESTAPI
+	janus_turnrest_set_cache(cache, nonblocking);
+	if(cache) {
+		JANUS_LOG(LOG_INFO, "TURN REST API credentials will be cached%s\n",
+			nonblocking ? " (PeerConnections won't wait for the backend)" : "");
+	}
+#endif
+}
+
+#ifdef HAVE_TURNRESTAPI
+/* When using the TURN REST API, we use the handle's opaque_id as a username
+ * by default, and fall back to the session_id when it's missing. Refer to this
+ * issue for more context: https://github.com/meetecho/janus-gateway/issues/2199 */
+static const char *janus_ice_turnrest_username(janus_ice_handle *handle, char *buffer, size_t len) {
+	if(handle->opaque_id != NULL)
+		return handle->opaque_id;
+	janus_session *session = (janus_session *)handle->session;
+	g_snprintf(buffer, len, "%"SCNu64, session->session_id);
+	return buffer;
+}
+#endif
+
 
 /* ICE stuff */
 static const gchar *janus_ice_state_name[] =
@@ -1203,7 +2716,14 @@ janus_ice_handle *janus_ice_handle_create(void *core_session, const char *opaque
 	handle->queued_candidates = g_async_queue_new();
 	handle->queued_packets = g_async_queue_new();
 	janus_mutex_init(&handle->mutex);
+	janus_mutex_init(&handle->snapshot_mutex);
+#ifdef HAVE_TURNRESTAPI
+	/* If we're caching TURN REST API credentials, start getting them now */
+	char turnrest_username[20];
+	janus_turnrest_prefetch(janus_ice_turnrest_username(handle, turnrest_username, sizeof(turnrest_username)));
+#endif
 	janus_session_handles_insert(session, handle);
+	janus_metrics_handle_created();
 	return handle;
 }
 
@@ -1241,25 +2761,31 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 	g_hash_table_insert(plugin_sessions, session_handle, session_handle);
 	janus_mutex_unlock(&plugin_sessions_mutex);
 	/* Create a new context, loop, and source */
-	if(static_event_loops == 0) {
-		handle->mainctx = g_main_context_new();
-		handle->mainloop = g_main_loop_new(handle->mainctx, FALSE);
-	} else {
-		/* We're actually using static event loops, pick one from the list */
-		janus_refcount_increase(&handle->ref);
+	if(static_event_loops > 0 && !handle->dedicated_loop) {
+		/* We're actually using static event loops, pick the least loaded one */
 		janus_mutex_lock(&event_loops_mutex);
-		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)current_loop->data;
-		handle->mainctx = loop->mainctx;
-		handle->mainloop = loop->mainloop;
-		current_loop = current_loop->next;
-		if(current_loop == NULL)
-			current_loop = event_loops;
+		janus_ice_static_event_loop *loop = janus_ice_static_event_loop_assign();
+		if(loop != NULL) {
+			janus_refcount_increase(&handle->ref);
+			handle->mainctx = loop->mainctx;
+			handle->mainloop = loop->mainloop;
+			handle->static_loop = loop;
+			g_atomic_int_inc(&loop->handles);
+			g_atomic_int_inc(&loop->assigned);
+		}
 		janus_mutex_unlock(&event_loops_mutex);
+		if(loop != NULL)
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Assigned to static loop #%d\n", handle->handle_id, loop->id);
+	}
+	if(handle->static_loop == NULL) {
+		/* This handle gets a loop (and a thread) of its own */
+		handle->mainctx = g_main_context_new();
+		handle->mainloop = g_main_loop_new(handle->mainctx, FALSE);
 	}
 	handle->rtp_source = janus_ice_outgoing_traffic_create(handle, (GDestroyNotify)g_free);
 	g_source_set_priority(handle->rtp_source, G_PRIORITY_DEFAULT);
 	g_source_attach(handle->rtp_source, handle->mainctx);
-	if(static_event_loops == 0) {
+	if(handle->static_loop == NULL) {
 		/* Now spawn a thread for this loop */
 		GError *terror = NULL;
 		char tname[16];
@@ -1277,7 +2803,7 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 		}
 	}
 	/* Notify event handlers */
-	if(janus_events_is_enabled())
+	if(janus_events_is_wanted(JANUS_EVENT_TYPE_HANDLE, JANUS_EVENT_SUBTYPE_NONE))
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_HANDLE, JANUS_EVENT_SUBTYPE_NONE,
 			session->session_id, handle->handle_id, "attached", plugin->get_package(), handle->opaque_id, handle->token);
 	return 0;
@@ -1309,7 +2835,7 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
 		janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT);
 		janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP);
 		if(handle->mainloop != NULL) {
-			if(static_event_loops == 0 && handle->mainloop != NULL && g_main_loop_is_running(handle->mainloop)) {
+			if(handle->static_loop == NULL && handle->mainloop != NULL && g_main_loop_is_running(handle->mainloop)) {
 				g_main_loop_quit(handle->mainloop);
 			}
 		}
@@ -1339,6 +2865,7 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
 static void janus_ice_handle_free(const janus_refcount *handle_ref) {
 	janus_ice_handle *handle = janus_refcount_containerof(handle_ref, janus_ice_handle, ref);
 	/* This stack can be destroyed, free all the resources */
+	janus_metrics_handle_destroyed();
 	janus_mutex_lock(&handle->mutex);
 	if(handle->queued_candidates != NULL) {
 		janus_ice_clear_queued_candidates(handle);
@@ -1348,16 +2875,19 @@ static void janus_ice_handle_free(const janus_refcount *handle_ref) {
 		janus_ice_clear_queued_packets(handle);
 		g_async_queue_unref(handle->queued_packets);
 	}
-	if(static_event_loops == 0 && handle->mainloop != NULL) {
+	if(handle->static_loop == NULL && handle->mainloop != NULL) {
 		g_main_loop_unref(handle->mainloop);
 		handle->mainloop = NULL;
 	}
-	if(static_event_loops == 0 && handle->mainctx != NULL) {
+	if(handle->static_loop == NULL && handle->mainctx != NULL) {
 		g_main_context_unref(handle->mainctx);
 		handle->mainctx = NULL;
 	}
 	janus_mutex_unlock(&handle->mutex);
 	janus_ice_webrtc_free(handle);
+	janus_ice_incoming_batch_free(handle);
+	/* Whatever the plugin didn't account back is not ours to track anymore */
+	janus_memory_account_clear(&handle->memory);
 	JANUS_LOG(LOG_INFO, "[%"SCNu64"] Handle and related resources freed; %p %p\n", handle->handle_id, handle, handle->session);
 	/* Finally, unref the session and free the handle */
 	if(handle->session != NULL) {
@@ -1423,6 +2953,11 @@ static void janus_ice_webrtc_free(janus_ice_handle *handle) {
 		return;
 	}
 	handle->agent_created = 0;
+	/* Packets of this PeerConnection the plugin didn't get yet are of no use anymore */
+	if(handle->incoming_batch != NULL)
+		handle->incoming_batch->count = 0;
+	if(handle->stream != NULL && handle->stream->component != NULL)
+		janus_ice_mux_peer_remove(handle->stream->component->mux);
 	if(handle->stream != NULL) {
 		janus_ice_stream_destroy(handle->stream);
 		handle->stream = NULL;
@@ -1521,6 +3056,8 @@ static void janus_ice_stream_free(const janus_refcount *stream_ref) {
 	if(stream->rtx_payload_types != NULL)
 		g_hash_table_destroy(stream->rtx_payload_types);
 	stream->rtx_payload_types = NULL;
+	g_free(stream->fec);
+	stream->fec = NULL;
 	if(stream->clock_rates != NULL)
 		g_hash_table_destroy(stream->clock_rates);
 	stream->clock_rates = NULL;
@@ -1545,8 +3082,9 @@ static void janus_ice_stream_free(const janus_refcount *stream_ref) {
 	if(stream->rtx_nacked[2])
 		g_hash_table_destroy(stream->rtx_nacked[2]);
 	stream->rtx_nacked[2] = NULL;
-	g_slist_free_full(stream->transport_wide_received_seq_nums, (GDestroyNotify)g_free);
-	stream->transport_wide_received_seq_nums = NULL;
+	g_free(stream->transport_wide_received_times);
+	stream->transport_wide_received_times = NULL;
+	stream->transport_wide_cc_pending = FALSE;
 	stream->audio_first_ntp_ts = 0;
 	stream->audio_first_rtp_ts = 0;
 	stream->video_first_ntp_ts[0] = 0;
@@ -1577,6 +3115,7 @@ void janus_ice_component_destroy(janus_ice_component *component) {
 
 static void janus_ice_component_free(const janus_refcount *component_ref) {
 	janus_ice_component *component = janus_refcount_containerof(component_ref, janus_ice_component, ref);
+	janus_ice_pacer_stop(component, FALSE);
 	if(component->icestate_source != NULL) {
 		g_source_destroy(component->icestate_source);
 		g_source_unref(component->icestate_source);
@@ -1592,32 +3131,12 @@ static void janus_ice_component_free(const janus_refcount *component_ref) {
 		janus_refcount_decrease(&component->dtls->ref);
 		component->dtls = NULL;
 	}
-	if(component->audio_retransmit_buffer != NULL) {
-		janus_rtp_packet *p = NULL;
-		while((p = (janus_rtp_packet *)g_queue_pop_head(component->audio_retransmit_buffer)) != NULL) {
-			/* Remove from hashtable too */
-			janus_rtp_header *header = (janus_rtp_header *)p->data;
-			guint16 seq = ntohs(header->seq_number);
-			g_hash_table_remove(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq));
-			/* Free the packet */
-			janus_ice_free_rtp_packet(p);
-		}
-		g_queue_free(component->audio_retransmit_buffer);
-		g_hash_table_destroy(component->audio_retransmit_seqs);
-	}
-	if(component->video_retransmit_buffer != NULL) {
-		janus_rtp_packet *p = NULL;
-		while((p = (janus_rtp_packet *)g_queue_pop_head(component->video_retransmit_buffer)) != NULL) {
-			/* Remove from hashtable too */
-			janus_rtp_header *header = (janus_rtp_header *)p->data;
-			guint16 seq = ntohs(header->seq_number);
-			g_hash_table_remove(component->video_retransmit_seqs, GUINT_TO_POINTER(seq));
-			/* Free the packet */
-			janus_ice_free_rtp_packet(p);
-		}
-		g_queue_free(component->video_retransmit_buffer);
-		g_hash_table_destroy(component->video_retransmit_seqs);
-	}
+	janus_ice_mux_peer_destroy(component->mux);
+	component->mux = NULL;
+	janus_ice_retransmit_buffer_destroy(component->audio_retransmit_buffer);
+	component->audio_retransmit_buffer = NULL;
+	janus_ice_retransmit_buffer_destroy(component->video_retransmit_buffer);
+	component->video_retransmit_buffer = NULL;
 	if(component->candidates != NULL) {
 		GSList *i = NULL, *candidates = component->candidates;
 		for(i = candidates; i; i = i->next) {
@@ -1696,7 +3215,7 @@ janus_slow_link_update(janus_ice_component *component, janus_ice_handle *handle,
 			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 			janus_session_notify_event(session, event);
 			/* Finally, notify event handlers */
-			if(janus_events_is_enabled()) {
+			if(janus_events_is_wanted(JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_SLOWLINK)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "media", json_string(video ? "video" : "audio"));
 				json_object_set_new(info, "slow_link", json_string(uplink ? "uplink" : "downlink"));
@@ -1820,7 +3339,7 @@ static void janus_ice_cb_component_state_changed(NiceAgent *agent, guint stream_
 	}
 	component->state = state;
 	/* Notify event handlers */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_wanted(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_ICE)) {
 		janus_session *session = (janus_session *)handle->session;
 		json_t *info = json_object();
 		json_object_set_new(info, "ice", json_string(janus_get_ice_state_name(state)));
@@ -1935,7 +3454,7 @@ static void janus_ice_cb_new_selected_pair (NiceAgent *agent, guint stream_id, g
 		g_clear_pointer(&prev_selected_pair, g_free);
 	}
 	/* Notify event handlers */
-	if(newpair && janus_events_is_enabled()) {
+	if(newpair && janus_events_is_wanted(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_PAIR)) {
 		janus_session *session = (janus_session *)handle->session;
 		json_t *info = json_object();
 		json_object_set_new(info, "selected-pair", json_string(sp));
@@ -2252,6 +3771,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		JANUS_LOG(LOG_ERR, "No handle for stream %d??\n", stream_id);
 		return;
 	}
+	janus_ice_static_event_loop_account(len);
 	janus_session *session = (janus_session *)handle->session;
 	if(!component->dtls) {	/* Still waiting for the DTLS stack */
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Still waiting for the DTLS stack for component %d in stream %d...\n", handle->handle_id, component_id, stream_id);
@@ -2279,6 +3799,9 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		} else {
 			janus_rtp_header *header = (janus_rtp_header *)buf;
 			guint32 packet_ssrc = ntohl(header->ssrc);
+			/* Find where the RTP extensions are once, rather than for each one we look for */
+			janus_rtp_header_extensions_map extmap;
+			janus_rtp_header_extensions_map_parse(buf, len, &extmap);
 			/* Is this audio or video? */
 			int video = 0, vindex = 0, rtx = 0;
 			/* Bundled streams, check SSRC */
@@ -2293,7 +3816,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				gboolean found = FALSE;
 				if(handle->stream->mid_ext_id > 0) {
 					char sdes_item[16];
-					if(janus_rtp_header_extension_parse_mid(buf, len, handle->stream->mid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
+					if(janus_rtp_header_extension_map_parse_mid(&extmap, buf, len, handle->stream->mid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
 						if(handle->audio_mid && !strcmp(handle->audio_mid, sdes_item)) {
 							/* It's audio */
 							JANUS_LOG(LOG_VERB, "[%"SCNu64"] Unadvertized SSRC (%"SCNu32") is audio! (mid %s)\n", handle->handle_id, packet_ssrc, sdes_item);
@@ -2309,7 +3832,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 								stream->video_ssrc_peer[0] = packet_ssrc;
 								found = TRUE;
 							} else {
-								if(janus_rtp_header_extension_parse_rid(buf, len, stream->rid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
+								if(janus_rtp_header_extension_map_parse_rid(&extmap, buf, len, stream->rid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
 									/* Try the RTP stream ID */
 									if(stream->rid[2] != NULL && !strcmp(stream->rid[2], sdes_item)) {
 										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting: rid=%s\n", handle->handle_id, sdes_item);
@@ -2330,7 +3853,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 										JANUS_LOG(LOG_WARN, "[%"SCNu64"]  -- Simulcasting: unknown rid %s..?\n", handle->handle_id, sdes_item);
 									}
 								} else if(stream->ridrtx_ext_id > 0 &&
-										janus_rtp_header_extension_parse_rid(buf, len, stream->ridrtx_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
+										janus_rtp_header_extension_map_parse_rid(&extmap, buf, len, stream->ridrtx_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
 									/* Try the repaired RTP stream ID */
 									if(stream->rid[2] != NULL && !strcmp(stream->rid[2], sdes_item)) {
 										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting: rid=%s (rtx)\n", handle->handle_id, sdes_item);
@@ -2398,14 +3921,21 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 			}
 
 			int buflen = len;
+			gboolean sample = janus_ice_latency_sample(&component->latency_in_count);
+			gint64 sample_start = sample ? janus_get_monotonic_time() : 0;
 			srtp_err_status_t res = janus_is_webrtc_encryption_enabled() ?
 				srtp_unprotect(component->dtls->srtp_in, buf, &buflen) : srtp_err_status_ok;
+			if(janus_is_webrtc_encryption_enabled())
+				component->srtp_unprotected++;
+			if(sample)
+				janus_ice_latency_record(component, JANUS_ICE_LATENCY_UNPROTECT, janus_get_monotonic_time() - sample_start);
 			if(res != srtp_err_status_ok) {
 				if(res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
 					/* Only print the error if it's not a 'replay fail' or 'replay old' (which is probably just the result of us NACKing a packet) */
 					guint32 timestamp = ntohl(header->timestamp);
 					guint16 seq = ntohs(header->seq_number);
 					JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n", handle->handle_id, janus_srtp_error_str(res), len, buflen, timestamp, seq);
+					janus_metrics_add_srtp_errors(1);
 				}
 			} else {
 				if(video) {
@@ -2446,7 +3976,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						header = (janus_rtp_header *)buf;
 						if(stream->rid_ext_id > 1 && stream->ridrtx_ext_id > 1) {
 							/* Replace the 'repaired' extension ID as well with the 'regular' one */
-							janus_rtp_header_extension_replace_id(buf, buflen, stream->ridrtx_ext_id, stream->rid_ext_id);
+							janus_rtp_header_extension_map_replace_id(&extmap, buf, buflen, stream->ridrtx_ext_id, stream->rid_ext_id);
 						}
 					}
 				}
@@ -2454,12 +3984,10 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(stream->do_transport_wide_cc) {
 					guint16 transport_seq_num;
 					/* Get transport wide seq num */
-					if(janus_rtp_header_extension_parse_transport_wide_cc(buf, buflen, stream->transport_wide_cc_ext_id, &transport_seq_num)==0) {
+					if(janus_rtp_header_extension_map_parse_transport_wide_cc(&extmap, buf, buflen, stream->transport_wide_cc_ext_id, &transport_seq_num)==0) {
 						/* Get current timestamp */
 						struct timeval now;
 						gettimeofday(&now,0);
-						/* Create <seq num, time> pair */
-						janus_rtcp_transport_wide_cc_stats *stats = g_malloc0(sizeof(janus_rtcp_transport_wide_cc_stats));
 						/* Check if we have a sequence wrap */
 						if(transport_seq_num<0x0FFF && (stream->transport_wide_cc_last_seq_num&0xFFFF)>0xF000) {
 							/* Increase cycles */
@@ -2469,12 +3997,34 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						guint32 transport_ext_seq_num = stream->transport_wide_cc_cycles<<16 | transport_seq_num;
 						/* Store last received transport seq num */
 						stream->transport_wide_cc_last_seq_num = transport_seq_num;
-						/* Set stats values */
-						stats->transport_seq_num = transport_ext_seq_num;
-						stats->timestamp = (((guint64)now.tv_sec)*1E6+now.tv_usec);
-						/* Lock and append to received list */
+						/* Lock and take note of when it arrived in the ring */
 						janus_mutex_lock(&stream->mutex);
-						stream->transport_wide_received_seq_nums = g_slist_prepend(stream->transport_wide_received_seq_nums, stats);
+						guint32 last_feedback = stream->transport_wide_cc_last_feedback_seq_num;
+						if(last_feedback == 0 || transport_ext_seq_num > last_feedback) {
+							if(stream->transport_wide_received_times == NULL)
+								stream->transport_wide_received_times = g_malloc0(JANUS_ICE_TWCC_RING_SIZE * sizeof(guint64));
+							if(!stream->transport_wide_cc_pending) {
+								stream->transport_wide_cc_first_seq_num = last_feedback ? last_feedback+1 : transport_ext_seq_num;
+								stream->transport_wide_cc_highest_seq_num = transport_ext_seq_num;
+								stream->transport_wide_cc_pending = TRUE;
+							} else if(last_feedback == 0 && transport_ext_seq_num < stream->transport_wide_cc_first_seq_num) {
+								/* Out of order, before we sent any feedback */
+								stream->transport_wide_cc_first_seq_num = transport_ext_seq_num;
+							}
+							if(transport_ext_seq_num > stream->transport_wide_cc_highest_seq_num)
+								stream->transport_wide_cc_highest_seq_num = transport_ext_seq_num;
+							if(stream->transport_wide_cc_highest_seq_num - stream->transport_wide_cc_first_seq_num >= JANUS_ICE_TWCC_RING_SIZE) {
+								/* Way more packets than the ring can hold since the last feedback: start over from this one */
+								JANUS_LOG(LOG_WARN, "[%"SCNu64"] Too many packets to report in transport wide cc feedback, skipping some\n", handle->handle_id);
+								memset(stream->transport_wide_received_times, 0, JANUS_ICE_TWCC_RING_SIZE * sizeof(guint64));
+								stream->transport_wide_cc_first_seq_num = transport_ext_seq_num;
+								stream->transport_wide_cc_highest_seq_num = transport_ext_seq_num;
+								stream->transport_wide_cc_last_feedback_seq_num = transport_ext_seq_num ? transport_ext_seq_num-1 : 0;
+							}
+							stream->transport_wide_received_times[transport_ext_seq_num & (JANUS_ICE_TWCC_RING_SIZE-1)] =
+								(((guint64)now.tv_sec)*1E6+now.tv_usec);
+						}
+						/* Otherwise, it was already reported as lost */
 						janus_mutex_unlock(&stream->mutex);
 					}
 				}
@@ -2553,13 +4103,17 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					}
 				}
 				/* Prepare the data to pass to the responsible plugin */
-				janus_plugin_rtp rtp = { .video = video, .buffer = buf, .length = buflen };
+				janus_plugin_rtp rtp = { .video = video, .buffer = buf, .length = buflen, .keyframe = -1 };
 				janus_plugin_rtp_extensions_reset(&rtp.extensions);
+				rtp.extensions.map = &extmap;
+				/* Check if this is a keyframe once here, so that plugins don't have to */
+				if(video && stream->video_is_keyframe && payload != NULL)
+					rtp.keyframe = stream->video_is_keyframe(payload, plen) ? 1 : 0;
 				/* Parse RTP extensions before involving the plugin */
 				if(stream->audiolevel_ext_id != -1) {
 					gboolean vad = FALSE;
 					int level = -1;
-					if(janus_rtp_header_extension_parse_audio_level(buf, buflen,
+					if(janus_rtp_header_extension_map_parse_audio_level(&extmap, buf, buflen,
 							stream->audiolevel_ext_id, &vad, &level) == 0) {
 						rtp.extensions.audio_level = level;
 						rtp.extensions.audio_level_vad = vad;
@@ -2567,7 +4121,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				}
 				if(stream->videoorientation_ext_id != -1) {
 					gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
-					if(janus_rtp_header_extension_parse_video_orientation(buf, buflen,
+					if(janus_rtp_header_extension_map_parse_video_orientation(&extmap, buf, buflen,
 							stream->videoorientation_ext_id, &c, &f, &r1, &r0) == 0) {
 						rtp.extensions.video_rotation = 0;
 						if(r1 && r0)
@@ -2580,12 +4134,20 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						rtp.extensions.video_flipped = f;
 					}
 				}
-				/* Pass the packet to the plugin */
+				/* Pass the packet to the plugin, or add it to the batch for it */
 				janus_plugin *plugin = (janus_plugin *)handle->app;
 				if(plugin && plugin->incoming_rtp && handle->app_handle &&
 						!g_atomic_int_get(&handle->app_handle->stopped) &&
-						!g_atomic_int_get(&handle->destroyed))
+						!g_atomic_int_get(&handle->destroyed) &&
+						!janus_ice_incoming_batch_add(handle, &rtp)) {
+					/* Make sure the plugin doesn't get packets out of order */
+					janus_ice_incoming_batch_flush(handle);
+					if(sample)
+						sample_start = janus_get_monotonic_time();
 					plugin->incoming_rtp(handle->app_handle, &rtp);
+					if(sample)
+						janus_ice_latency_record(component, JANUS_ICE_LATENCY_PLUGIN, janus_get_monotonic_time() - sample_start);
+				}
 				/* Restore the header for the stats (plugins may have messed with it) */
 				*header = backup;
 				/* Update stats (overall data received, and data received in the last second) */
@@ -2649,12 +4211,10 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				}
 				guint16 new_seqn = ntohs(header->seq_number);
 				/* If this is video, check if this is a keyframe: if so, we empty our NACK queue */
-				if(video && stream->video_is_keyframe) {
-					if(stream->video_is_keyframe(payload, plen)) {
-						if(rtcp_ctx && (int16_t)(new_seqn - rtcp_ctx->max_seq_nr) > 0) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe received with a highest sequence number, resetting NACK queue\n", handle->handle_id);
-							janus_seq_list_free(&component->last_seqs_video[vindex]);
-						}
+				if(video && rtp.keyframe == 1) {
+					if(rtcp_ctx && (int16_t)(new_seqn - rtcp_ctx->max_seq_nr) > 0) {
+						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe received with a highest sequence number, resetting NACK queue\n", handle->handle_id);
+						janus_seq_list_free(&component->last_seqs_video[vindex]);
 					}
 				}
 				guint16 cur_seqn;
@@ -2791,15 +4351,22 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 			int buflen = len;
 			srtp_err_status_t res = janus_is_webrtc_encryption_enabled() ?
 				srtp_unprotect_rtcp(component->dtls->srtp_in, buf, &buflen) : srtp_err_status_ok;
+			if(janus_is_webrtc_encryption_enabled())
+				component->srtp_unprotected++;
 			if(res != srtp_err_status_ok) {
 				JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTCP unprotect error: %s (len=%d-->%d)\n", handle->handle_id, janus_srtp_error_str(res), len, buflen);
+				janus_metrics_add_srtp_errors(1);
 			} else {
 				/* Do we need to dump this packet for debugging? */
 				if(g_atomic_int_get(&handle->dump_packets))
 					janus_text2pcap_dump(handle->text2pcap, JANUS_TEXT2PCAP_RTCP, TRUE, buf, buflen,
 						"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
+				/* Collect what's in the packet in one go, rather than looking for
+				 * BYE, PLI, NACKs, etc. separately (plugins get this summary too) */
+				janus_rtcp_summary summary;
+				janus_rtcp_summarize(buf, buflen, &summary);
 				/* Check if there's an RTCP BYE: in case, let's log it */
-				if(janus_rtcp_has_bye(buf, buflen)) {
+				if(summary.has_bye) {
 					/* Note: we used to use this as a trigger to close the PeerConnection, but not anymore
 					 * Discussion here, https://groups.google.com/forum/#!topic/meetecho-janus/4XtfbYB7Jvc */
 					JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got RTCP BYE on stream %u (component %u)\n", handle->handle_id, stream->stream_id, component->component_id);
@@ -2835,7 +4402,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						} else if(rtcp_ssrc == stream->video_ssrc_rtx) {
 							/* rtx SSRC, we don't care */
 							return;
-						} else if(janus_rtcp_has_fir(buf, buflen) || janus_rtcp_has_pli(buf, buflen) || janus_rtcp_get_remb(buf, buflen)) {
+						} else if(summary.has_fir || summary.has_pli || summary.remb) {
 							/* Mh, no SR or RR? Try checking if there's any FIR, PLI or REMB */
 							video = 1;
 						} else {
@@ -2896,31 +4463,37 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					stream->nack_queue_ms = mavg;
 				}
 				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Got %s RTCP (%d bytes)\n", handle->handle_id, video ? "video" : "audio", buflen);
+				/* Keep track of the bandwidth the peer says it can take, if we need to pace video */
+				if(pacing_enabled && video && summary.remb > 0)
+					component->pacer.remb = summary.remb;
 
 				/* Now let's see if there are any NACKs to handle */
 				gint64 now = janus_get_monotonic_time();
-				GSList *nacks = janus_rtcp_get_nacks(buf, buflen);
-				guint nacks_count = g_slist_length(nacks);
+				GSList *nacks = summary.nacks_truncated ? janus_rtcp_get_nacks(buf, buflen) : NULL;
+				guint nacks_count = nacks ? g_slist_length(nacks) : summary.nacks_count;
 				if(nacks_count && ((!video && component->do_audio_nacks) || (video && component->do_video_nacks))) {
 					/* Handle NACK */
 					JANUS_LOG(LOG_HUGE, "[%"SCNu64"]     Just got some NACKS (%d) we should handle...\n", handle->handle_id, nacks_count);
-					GHashTable *retransmit_seqs = (video ? component->video_retransmit_seqs : component->audio_retransmit_seqs);
-					GSList *list = (retransmit_seqs != NULL ? nacks : NULL);
+					janus_ice_retransmit_buffer *retransmit_buffer = (video ? component->video_retransmit_buffer : component->audio_retransmit_buffer);
+					GSList *list = nacks;
+					guint nack_index = 0;
 					int retransmits_cnt = 0;
 					janus_mutex_lock(&component->mutex);
-					while(list) {
-						unsigned int seqnr = GPOINTER_TO_UINT(list->data);
+					while(retransmit_buffer != NULL && (nacks ? list != NULL : nack_index < summary.nacks_count)) {
+						unsigned int seqnr = nacks ? GPOINTER_TO_UINT(list->data) : summary.nacks[nack_index];
+						nack_index++;
 						JANUS_LOG(LOG_DBG, "[%"SCNu64"]   >> %u\n", handle->handle_id, seqnr);
 						int in_rb = 0;
 						/* Check if we have the packet */
-						janus_rtp_packet *p = g_hash_table_lookup(retransmit_seqs, GUINT_TO_POINTER(seqnr));
+						janus_rtp_packet *p = janus_ice_retransmit_buffer_lookup(retransmit_buffer, seqnr);
 						if(p == NULL) {
 							JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Can't retransmit packet %u, we don't have it...\n", handle->handle_id, seqnr);
 						} else {
 							/* Should we retransmit this packet? */
 							if((p->last_retransmit > 0) && (now-p->last_retransmit < MAX_NACK_IGNORE)) {
 								JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Packet %u was retransmitted just %"SCNi64"ms ago, skipping\n", handle->handle_id, seqnr, now-p->last_retransmit);
-								list = list->next;
+								if(list)
+									list = list->next;
 								continue;
 							}
 							in_rb = 1;
@@ -2928,8 +4501,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 							p->last_retransmit = now;
 							retransmits_cnt++;
 							/* Enqueue it */
-							janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-							pkt->data = g_malloc(p->length+SRTP_MAX_TAG_LEN);
+							janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(p->length+SRTP_MAX_TAG_LEN);
 							memcpy(pkt->data, p->data, p->length);
 							pkt->length = p->length;
 							pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
@@ -2946,7 +4518,10 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 								/* We are: overwrite the RTP header (which means we'll need a new SRTP encrypt) */
 								pkt->encrypted = FALSE;
 								janus_rtp_header *header = (janus_rtp_header *)pkt->data;
-								header->type = stream->video_rtx_payload_type;
+								/* RED packets have an rtx payload type of their own */
+								int rtx_pt = stream->fec && header->type == stream->fec->video_red_pt ?
+									GPOINTER_TO_INT(g_hash_table_lookup(stream->rtx_payload_types, GINT_TO_POINTER(header->type))) : 0;
+								header->type = rtx_pt > 0 ? rtx_pt : stream->video_rtx_payload_type;
 								header->ssrc = htonl(stream->video_ssrc_rtx);
 								component->rtx_seq_number++;
 								header->seq_number = htons(component->rtx_seq_number);
@@ -2963,7 +4538,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						if(rtcp_ctx != NULL && in_rb) {
 							g_atomic_int_inc(&rtcp_ctx->nack_count);
 						}
-						list = list->next;
+						if(list)
+							list = list->next;
 					}
 					component->retransmit_recent_cnt += retransmits_cnt;
 					/* FIXME Remove the NACK compound packet, we've handled it */
@@ -2975,9 +4551,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						component->in_stats.audio.nacks += nacks_count;
 					}
 					janus_mutex_unlock(&component->mutex);
-					g_slist_free(nacks);
-					nacks = NULL;
 				}
+				g_slist_free(nacks);
 				if(component->retransmit_recent_cnt &&
 						now - component->retransmit_log_ts > 5*G_USEC_PER_SEC) {
 					JANUS_LOG(LOG_VERB, "[%"SCNu64"] Retransmitted %u packets due to NACK (%s stream #%d)\n",
@@ -3000,7 +4575,9 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					return;
 				}
 
-				janus_plugin_rtcp rtcp = { .video = video, .buffer = buf, .length = buflen };
+				janus_plugin_rtcp rtcp = { .video = video, .buffer = buf, .length = buflen, .summary = &summary };
+				if(video && summary.has_pli)
+					janus_metrics_add_pli(TRUE);
 				janus_plugin *plugin = (janus_plugin *)handle->app;
 				if(plugin && plugin->incoming_rtcp && handle->app_handle &&
 						!g_atomic_int_get(&handle->app_handle->stopped) &&
@@ -3021,6 +4598,127 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 	}
 }
 
+/* ICE-Lite shared ports: the callbacks are invoked by the thread of the loop serving the handle */
+static void janus_ice_mux_cb_recv(janus_ice_component *component, char *buf, guint len) {
+	janus_ice_cb_nice_recv(NULL, component->stream_id, component->component_id, len, buf, component);
+}
+static void janus_ice_mux_cb_nominated(janus_ice_component *component, const struct sockaddr *local, const struct sockaddr *remote) {
+	janus_ice_stream *stream = component->stream;
+	janus_ice_handle *handle = stream ? stream->handle : NULL;
+	if(handle == NULL || handle->agent == NULL)
+		return;
+	/* Notify the same state changes a libnice ICE-Lite agent would */
+	if(component->state != NICE_COMPONENT_STATE_READY) {
+		janus_ice_cb_component_state_changed(handle->agent, component->stream_id, component->component_id,
+			NICE_COMPONENT_STATE_CONNECTED, handle);
+		janus_ice_cb_component_state_changed(handle->agent, component->stream_id, component->component_id,
+			NICE_COMPONENT_STATE_READY, handle);
+	}
+	/* The remote address is the one the checks came from, so we don't know its type */
+	NiceCandidate *lcand = nice_candidate_new(NICE_CANDIDATE_TYPE_HOST);
+	NiceCandidate *rcand = nice_candidate_new(NICE_CANDIDATE_TYPE_PEER_REFLEXIVE);
+	lcand->transport = NICE_CANDIDATE_TRANSPORT_UDP;
+	rcand->transport = NICE_CANDIDATE_TRANSPORT_UDP;
+	nice_address_set_from_sockaddr(&lcand->addr, local);
+	nice_address_set_from_sockaddr(&rcand->addr, remote);
+#ifndef HAVE_LIBNICE_TCP
+	gchar laddress[NICE_ADDRESS_STRING_LEN], raddress[NICE_ADDRESS_STRING_LEN];
+	gchar lpair[NICE_ADDRESS_STRING_LEN+8], rpair[NICE_ADDRESS_STRING_LEN+8];
+	nice_address_to_string(&lcand->addr, laddress);
+	nice_address_to_string(&rcand->addr, raddress);
+	g_snprintf(lpair, sizeof(lpair), "%s:%u", laddress, nice_address_get_port(&lcand->addr));
+	g_snprintf(rpair, sizeof(rpair), "%s:%u", raddress, nice_address_get_port(&rcand->addr));
+	janus_ice_cb_new_selected_pair(handle->agent, component->stream_id, component->component_id, lpair, rpair, handle);
+#else
+	janus_ice_cb_new_selected_pair(handle->agent, component->stream_id, component->component_id, lcand, rcand, handle);
+#endif
+	nice_candidate_free(lcand);
+	nice_candidate_free(rcand);
+}
+static void janus_ice_mux_cb_expired(janus_ice_component *component) {
+	janus_ice_stream *stream = component->stream;
+	janus_ice_handle *handle = stream ? stream->handle : NULL;
+	if(handle == NULL || handle->agent == NULL)
+		return;
+	/* Treat this as a failure: if checks resume in time, it will be nominated again */
+	JANUS_LOG(LOG_WARN, "[%"SCNu64"] No consent checks received on the shared port for a while\n", handle->handle_id);
+	janus_ice_cb_component_state_changed(handle->agent, component->stream_id, component->component_id,
+		NICE_COMPONENT_STATE_FAILED, handle);
+}
+
+/* Register (or update, after an ICE restart) the local credentials of a
+ * handle on the shared port of its loop: libnice ufrags are quite short,
+ * so when we can, we pick longer ones, to make collisions unlikely */
+static int janus_ice_mux_set_credentials(janus_ice_handle *handle, janus_ice_mux_loop *mux) {
+	janus_ice_stream *stream = handle->stream;
+	janus_ice_component *component = stream ? stream->component : NULL;
+	if(component == NULL || mux == NULL)
+		return -1;
+	int res = -1, attempt = 0;
+	for(attempt=0; attempt<3 && res < 0; attempt++) {
+#ifdef HAVE_LIBNICE_SET_LOCAL_CREDENTIALS
+		static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789+/";
+		char lufrag[17], lpwd[33];
+		guint i = 0;
+		for(i=0; i<sizeof(lufrag)-1; i++)
+			lufrag[i] = chars[janus_random_uint32() % 64];
+		lufrag[i] = '\0';
+		for(i=0; i<sizeof(lpwd)-1; i++)
+			lpwd[i] = chars[janus_random_uint32() % 64];
+		lpwd[i] = '\0';
+		if(!nice_agent_set_local_credentials(handle->agent, stream->stream_id, lufrag, lpwd))
+			break;
+#else
+		/* We can't pick the credentials, so there's no point in trying again */
+		attempt = 3;
+#endif
+		gchar *ufrag = NULL, *pwd = NULL;
+		if(!nice_agent_get_local_credentials(handle->agent, stream->stream_id, &ufrag, &pwd))
+			break;
+		if(component->mux == NULL) {
+			component->mux = janus_ice_mux_peer_create(mux, component, ufrag, pwd);
+			res = component->mux ? 0 : -1;
+		} else {
+			res = janus_ice_mux_peer_set_credentials(component->mux, ufrag, pwd);
+		}
+		g_free(ufrag);
+		g_free(pwd);
+	}
+	return res;
+}
+
+int janus_ice_enable_shared_ports(uint16_t min_port, uint16_t max_port, gboolean reuseport, gboolean filter) {
+	if(!janus_ice_lite_enabled) {
+		JANUS_LOG(LOG_WARN, "ICE-Lite shared ports need ICE-Lite, ignoring\n");
+		return -1;
+	}
+	if(janus_full_trickle_enabled) {
+		JANUS_LOG(LOG_WARN, "ICE-Lite shared ports don't support full-trickle, ignoring\n");
+		return -1;
+	}
+	if(static_event_loops < 1) {
+		JANUS_LOG(LOG_WARN, "ICE-Lite shared ports need static event loops, ignoring\n");
+		return -1;
+	}
+	GList *addresses = janus_ice_get_local_addresses();
+	int res = janus_ice_mux_init(min_port, max_port, addresses, dscp_ef << 2, reuseport, filter,
+		janus_ice_mux_cb_recv, janus_ice_mux_cb_nominated, janus_ice_mux_cb_expired);
+	g_list_free_full(addresses, (GDestroyNotify)g_free);
+	if(res < 0)
+		return res;
+	/* Bind a port for the loops we have already, new ones will do it when created */
+	janus_mutex_lock(&event_loops_mutex);
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		if(loop->mux == NULL)
+			loop->mux = janus_ice_mux_loop_create(loop->id, loop->mainctx);
+		l = l->next;
+	}
+	janus_mutex_unlock(&event_loops_mutex);
+	return 0;
+}
+
 void janus_ice_incoming_data(janus_ice_handle *handle, char *label, char *protocol, gboolean textdata, char *buffer, int length) {
 	if(handle == NULL || buffer == NULL || length <= 0)
 		return;
@@ -3179,7 +4877,7 @@ static int janus_ice_candidate_to_string(janus_ice_handle *handle, NiceCandidate
 		/* Save for the summary, in case we need it */
 		component->local_candidates = g_slist_append(component->local_candidates, g_strdup(buffer));
 		/* Notify event handlers */
-		if(janus_events_is_enabled()) {
+		if(janus_events_is_wanted(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_LCAND)) {
 			janus_session *session = (janus_session *)handle->session;
 			json_t *info = json_object();
 			json_object_set_new(info, "local-candidate", json_string(buffer));
@@ -3209,7 +4907,10 @@ void janus_ice_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mlin
 	/* Iterate on all */
 	gchar buffer[200];
 	GSList *candidates, *i;
-	candidates = nice_agent_get_local_candidates (agent, stream_id, component_id);
+	if(component->mux != NULL)
+		candidates = janus_ice_mux_peer_get_local_candidates(component->mux, stream_id, component_id);
+	else
+		candidates = nice_agent_get_local_candidates (agent, stream_id, component_id);
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] We have %d candidates for Stream #%d, Component #%d\n", handle->handle_id, g_slist_length(candidates), stream_id, component_id);
 	gboolean log_candidates = (component->local_candidates == NULL);
 	for(i = candidates; i; i = i->next) {
@@ -3377,16 +5078,9 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 	/* Any dynamic TURN credentials to retrieve via REST API? */
 	gboolean have_turnrest_credentials = FALSE;
 #ifdef HAVE_TURNRESTAPI
-	/* When using the TURN REST API, we use the handle's opaque_id as a username
-	 * by default, and fall back to the session_id when it's missing. Refer to this
-	 * issue for more context: https://github.com/meetecho/janus-gateway/issues/2199 */
 	char turnrest_username[20];
-	if(handle->opaque_id == NULL) {
-		janus_session *session = (janus_session *)handle->session;
-		g_snprintf(turnrest_username, sizeof(turnrest_username), "%"SCNu64, session->session_id);
-	}
-	janus_turnrest_response *turnrest_credentials = janus_turnrest_request((const char *)(handle->opaque_id ?
-		handle->opaque_id : turnrest_username));
+	janus_turnrest_response *turnrest_credentials = janus_turnrest_request(
+		janus_ice_turnrest_username(handle, turnrest_username, sizeof(turnrest_username)));
 	if(turnrest_credentials != NULL) {
 		have_turnrest_credentials = TRUE;
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got credentials from the TURN REST API backend!\n", handle->handle_id);
@@ -3430,61 +5124,21 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 		G_CALLBACK (janus_ice_cb_new_remote_candidate), handle);
 
 	/* Add all local addresses, except those in the ignore list */
-	struct ifaddrs *ifaddr, *ifa;
-	int family, s, n;
-	char host[NI_MAXHOST];
-	if(getifaddrs(&ifaddr) == -1) {
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error getting list of interfaces... %d (%s)\n",
-			handle->handle_id, errno, strerror(errno));
-	} else {
-		for(ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
-			if(ifa->ifa_addr == NULL)
-				continue;
-			/* Skip interfaces which are not up and running */
-			if(!((ifa->ifa_flags & IFF_UP) && (ifa->ifa_flags & IFF_RUNNING)))
-				continue;
-			/* Skip loopback interfaces */
-			if(ifa->ifa_flags & IFF_LOOPBACK)
-				continue;
-			family = ifa->ifa_addr->sa_family;
-			if(family != AF_INET && family != AF_INET6)
-				continue;
-			/* We only add IPv6 addresses if support for them has been explicitly enabled (still WIP, mostly) */
-			if(family == AF_INET6 && !janus_ipv6_enabled)
-				continue;
-			/* Check the interface name first, we can ignore that as well: enforce list would be checked later */
-			if(janus_ice_enforce_list == NULL && ifa->ifa_name != NULL && janus_ice_is_ignored(ifa->ifa_name))
-				continue;
-			s = getnameinfo(ifa->ifa_addr,
-					(family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
-					host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
-			if(s != 0) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"] getnameinfo() failed: %s\n", handle->handle_id, gai_strerror(s));
-				continue;
-			}
-			/* Skip 0.0.0.0, :: and local scoped addresses  */
-			if(!strcmp(host, "0.0.0.0") || !strcmp(host, "::") || !strncmp(host, "fe80:", 5))
-				continue;
-			/* Check if this IP address is in the ignore/enforce list, now: the enforce list has the precedence */
-			if(janus_ice_enforce_list != NULL) {
-				if(ifa->ifa_name != NULL && !janus_ice_is_enforced(ifa->ifa_name) && !janus_ice_is_enforced(host))
-					continue;
-			} else {
-				if(janus_ice_is_ignored(host))
-					continue;
-			}
-			/* Ok, add interface to the ICE agent */
-			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Adding %s to the addresses to gather candidates for\n", handle->handle_id, host);
-			NiceAddress addr_local;
-			nice_address_init (&addr_local);
-			if(!nice_address_set_from_string (&addr_local, host)) {
-				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Skipping invalid address %s\n", handle->handle_id, host);
-				continue;
-			}
+	GList *addresses = janus_ice_get_local_addresses(), *temp = addresses;
+	while(temp) {
+		const char *host = (const char *)temp->data;
+		/* Ok, add interface to the ICE agent */
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Adding %s to the addresses to gather candidates for\n", handle->handle_id, host);
+		NiceAddress addr_local;
+		nice_address_init (&addr_local);
+		if(!nice_address_set_from_string (&addr_local, host)) {
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Skipping invalid address %s\n", handle->handle_id, host);
+		} else {
 			nice_agent_add_local_address (handle->agent, &addr_local);
 		}
-		freeifaddrs(ifaddr);
+		temp = temp->next;
 	}
+	g_list_free_full(addresses, (GDestroyNotify)g_free);
 
 	handle->cdone = 0;
 	handle->stream_id = 0;
@@ -3585,15 +5239,25 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 	/* FIXME: libnice supports this since 0.1.0, but the 0.1.3 on Fedora fails with an undefined reference! */
 	nice_agent_set_port_range(handle->agent, handle->stream_id, 1, rtp_range_min, rtp_range_max);
 #endif
-	/* Gather now only if we're doing hanf-trickle */
-	if(!janus_full_trickle_enabled && !nice_agent_gather_candidates(handle->agent, handle->stream_id)) {
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error gathering candidates...\n", handle->handle_id);
-		janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AGENT);
-		janus_ice_webrtc_hangup(handle, "Gathering error");
-		return -1;
+	/* If the loop serving this handle has a shared port, we'll answer the checks
+	 * ourselves on that, and there's nothing for libnice to gather or receive */
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_loop;
+	if(loop != NULL && loop->mux != NULL && janus_ice_mux_set_credentials(handle, loop->mux) == 0) {
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Using the shared port %"SCNu16" of static loop #%d\n",
+			handle->handle_id, janus_ice_mux_loop_get_port(loop->mux), loop->id);
+		handle->cdone = 1;
+		stream->cdone = 1;
+	} else {
+		/* Gather now only if we're doing hanf-trickle */
+		if(!janus_full_trickle_enabled && !nice_agent_gather_candidates(handle->agent, handle->stream_id)) {
+			JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error gathering candidates...\n", handle->handle_id);
+			janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AGENT);
+			janus_ice_webrtc_hangup(handle, "Gathering error");
+			return -1;
+		}
+		nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context(handle->mainloop),
+			janus_ice_cb_nice_recv, component);
 	}
-	nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context(handle->mainloop),
-		janus_ice_cb_nice_recv, component);
 #ifdef HAVE_TURNRESTAPI
 	if(turnrest_credentials != NULL) {
 		janus_turnrest_response_destroy(turnrest_credentials);
@@ -3628,6 +5292,11 @@ void janus_ice_restart(janus_ice_handle *handle) {
 	/* Restart ICE */
 	if(nice_agent_restart(handle->agent) == FALSE) {
 		JANUS_LOG(LOG_WARN, "[%"SCNu64"] ICE restart failed...\n", handle->handle_id);
+	} else if(handle->stream->component != NULL && handle->stream->component->mux != NULL) {
+		/* libnice generated new credentials, the shared port needs to know */
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_loop;
+		if(loop == NULL || janus_ice_mux_set_credentials(handle, loop->mux) < 0)
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Couldn't update the credentials on the shared port...\n", handle->handle_id);
 	}
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ICE_RESTART);
 }
@@ -3676,93 +5345,47 @@ void janus_ice_resend_trickles(janus_ice_handle *handle) {
 	janus_ice_notify_trickle(handle, NULL);
 }
 
-static gint rtcp_transport_wide_cc_stats_comparator(gconstpointer item1, gconstpointer item2) {
-	return ((rtcp_transport_wide_cc_stats*)item1)->transport_seq_num - ((rtcp_transport_wide_cc_stats*)item2)->transport_seq_num;
-}
 static gboolean janus_ice_outgoing_transport_wide_cc_feedback(gpointer user_data) {
 	janus_ice_handle *handle = (janus_ice_handle *)user_data;
 	janus_ice_stream *stream = handle->stream;
 	if(stream && stream->video_recv && stream->do_transport_wide_cc) {
-		/* Create a transport wide feedback message */
+		/* Create transport wide feedback messages straight from the ring of arrival times,
+		 * splitting them if we have more than JANUS_RTCP_TWCC_FEEDBACK_MAX packets to report */
 		size_t size = 1300;
 		char rtcpbuf[1300];
-		/* Order packet list */
-		stream->transport_wide_received_seq_nums = g_slist_sort(stream->transport_wide_received_seq_nums,
-			rtcp_transport_wide_cc_stats_comparator);
-		/* Create full stats queue */
-		GQueue *packets = g_queue_new();
-		/* For all packets */
-		GSList *it = NULL;
-		for(it = stream->transport_wide_received_seq_nums; it; it = it->next) {
-			/* Get stat */
-			janus_rtcp_transport_wide_cc_stats *stats = (janus_rtcp_transport_wide_cc_stats *)it->data;
-			/* Get transport seq */
-			guint32 transport_seq_num = stats->transport_seq_num;
-			/* Check if it is an out of order  */
-			if(transport_seq_num < stream->transport_wide_cc_last_feedback_seq_num) {
-				/* Skip, it was already reported as lost */
-				g_free(stats);
-				continue;
-			}
-			/* If not first */
-			if(stream->transport_wide_cc_last_feedback_seq_num) {
-				/* For each lost */
-				guint32 i = 0;
-				for(i = stream->transport_wide_cc_last_feedback_seq_num+1; i<transport_seq_num; ++i) {
-					/* Create new stat */
-					janus_rtcp_transport_wide_cc_stats *missing = g_malloc(sizeof(janus_rtcp_transport_wide_cc_stats));
-					/* Add missing packet */
-					missing->transport_seq_num = i;
-					missing->timestamp = 0;
-					/* Add it */
-					g_queue_push_tail(packets, missing);
-				}
-			}
-			/* Store last */
-			stream->transport_wide_cc_last_feedback_seq_num = transport_seq_num;
-			/* Add this one */
-			g_queue_push_tail(packets, stats);
-		}
-		/* Free and reset stats list */
-		g_slist_free(stream->transport_wide_received_seq_nums);
-		stream->transport_wide_received_seq_nums = NULL;
-		/* Create and enqueue RTCP packets */
-		guint packets_len = 0;
-		while((packets_len = g_queue_get_length(packets)) > 0) {
-			GQueue *packets_to_process;
-			/* If we have more than 400 packets to acknowledge, let's send more than one message */
-			if(packets_len > 400) {
-				/* Split the queue into two */
-				GList *new_head = g_queue_peek_nth_link(packets, 400);
-				GList *new_tail = new_head->prev;
-				new_head->prev = NULL;
-				new_tail->next = NULL;
-				packets_to_process = g_queue_new();
-				packets_to_process->head = packets->head;
-				packets_to_process->tail = new_tail;
-				packets_to_process->length = 400;
-				packets->head = new_head;
-				/* packets->tail is unchanged */
-				packets->length = packets_len - 400;
-			} else {
-				packets_to_process = packets;
+		gboolean done = FALSE;
+		while(!done) {
+			janus_mutex_lock(&stream->mutex);
+			if(!stream->transport_wide_cc_pending || stream->transport_wide_received_times == NULL) {
+				janus_mutex_unlock(&stream->mutex);
+				break;
 			}
+			guint32 first = stream->transport_wide_cc_first_seq_num;
+			guint32 total = stream->transport_wide_cc_highest_seq_num - first + 1;
+			guint count = total > JANUS_RTCP_TWCC_FEEDBACK_MAX ? JANUS_RTCP_TWCC_FEEDBACK_MAX : total;
 			/* Get feedback packet count and increase it for next one */
 			guint8 feedback_packet_count = stream->transport_wide_cc_feedback_count++;
-			/* Create RTCP packet */
-			int len = janus_rtcp_transport_wide_cc_feedback(rtcpbuf, size,
-				stream->video_ssrc, stream->video_ssrc_peer[0], feedback_packet_count, packets_to_process);
+			int len = janus_rtcp_transport_wide_cc_feedback_ring(rtcpbuf, size,
+				stream->video_ssrc, stream->video_ssrc_peer[0], feedback_packet_count,
+				stream->transport_wide_received_times, JANUS_ICE_TWCC_RING_SIZE-1, first, count);
+			/* Clear what we reported, so that the ring can be reused */
+			guint i = 0;
+			for(i=0; i<count; i++)
+				stream->transport_wide_received_times[(first+i) & (JANUS_ICE_TWCC_RING_SIZE-1)] = 0;
+			stream->transport_wide_cc_last_feedback_seq_num = first + count - 1;
+			if(count == total) {
+				stream->transport_wide_cc_pending = FALSE;
+				done = TRUE;
+			} else {
+				stream->transport_wide_cc_first_seq_num = first + count;
+			}
+			janus_mutex_unlock(&stream->mutex);
 			/* Enqueue it, we'll send it later */
 			if(len > 0) {
 				janus_plugin_rtcp rtcp = { .video = TRUE, .buffer = rtcpbuf, .length = len };
 				janus_ice_relay_rtcp_internal(handle, &rtcp, FALSE);
 			}
-			if(packets_to_process != packets) {
-				g_queue_free(packets_to_process);
-			}
 		}
-		/* Free mem */
-		g_queue_free(packets);
 	}
 	return G_SOURCE_CONTINUE;
 }
@@ -3905,6 +5528,222 @@ static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 	return G_SOURCE_CONTINUE;
 }
 
+/* Helper to add the traffic of a component since the last time we checked
+ * to the core metrics: counters are reset when the component is, so if
+ * the totals went down we just add what we have now */
+static void janus_ice_stats_metrics(janus_ice_stats *stats, gboolean incoming) {
+	guint64 packets = stats->audio.packets + stats->data.packets;
+	guint64 bytes = stats->audio.bytes + stats->data.bytes;
+	guint64 nacks = stats->audio.nacks;
+	int vindex = 0;
+	for(vindex=0; vindex<3; vindex++) {
+		packets += stats->video[vindex].packets;
+		bytes += stats->video[vindex].bytes;
+		nacks += stats->video[vindex].nacks;
+	}
+	janus_metrics_add_traffic(incoming,
+		packets >= stats->metrics_packets ? packets - stats->metrics_packets : packets,
+		bytes >= stats->metrics_bytes ? bytes - stats->metrics_bytes : bytes,
+		nacks >= stats->metrics_nacks ? nacks - stats->metrics_nacks : nacks);
+	stats->metrics_packets = packets;
+	stats->metrics_bytes = bytes;
+	stats->metrics_nacks = nacks;
+}
+
+/* Helper to prepare the statistics of a medium (0 is audio, 1-3 are the
+ * video substreams) in the format of JANUS_EVENT_SUBTYPE_MEDIA_STATS events */
+static json_t *janus_ice_stats_event_info(janus_ice_stream *stream, int medium) {
+	if(stream == NULL || medium < 0 || medium >= JANUS_ICE_STATS_MEDIA)
+		return NULL;
+	int vindex = medium - 1;
+	janus_rtcp_context *rtcp_ctx = medium == 0 ? stream->audio_rtcp_ctx : stream->video_rtcp_ctx[vindex];
+	if(rtcp_ctx == NULL)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "media", json_string(janus_ice_stats_media[medium]));
+	json_object_set_new(info, "base", json_integer(rtcp_ctx->tb));
+	if(medium < 2)
+		json_object_set_new(info, "rtt", json_integer(janus_rtcp_context_get_rtt(rtcp_ctx)));
+	json_object_set_new(info, "lost", json_integer(janus_rtcp_context_get_lost_all(rtcp_ctx, FALSE)));
+	json_object_set_new(info, "lost-by-remote", json_integer(janus_rtcp_context_get_lost_all(rtcp_ctx, TRUE)));
+	json_object_set_new(info, "jitter-local", json_integer(janus_rtcp_context_get_jitter(rtcp_ctx, FALSE)));
+	json_object_set_new(info, "jitter-remote", json_integer(janus_rtcp_context_get_jitter(rtcp_ctx, TRUE)));
+	json_object_set_new(info, "in-link-quality", json_integer(janus_rtcp_context_get_in_link_quality(rtcp_ctx)));
+	json_object_set_new(info, "in-media-link-quality", json_integer(janus_rtcp_context_get_in_media_link_quality(rtcp_ctx)));
+	json_object_set_new(info, "out-link-quality", json_integer(janus_rtcp_context_get_out_link_quality(rtcp_ctx)));
+	json_object_set_new(info, "out-media-link-quality", json_integer(janus_rtcp_context_get_out_media_link_quality(rtcp_ctx)));
+	if(stream->component) {
+		janus_ice_stats_info *in = medium == 0 ? &stream->component->in_stats.audio : &stream->component->in_stats.video[vindex];
+		janus_ice_stats_info *out = medium == 0 ? &stream->component->out_stats.audio : &stream->component->out_stats.video[vindex];
+		json_object_set_new(info, "packets-received", json_integer(in->packets));
+		json_object_set_new(info, "packets-sent", json_integer(out->packets));
+		json_object_set_new(info, "bytes-received", json_integer(in->bytes));
+		json_object_set_new(info, "bytes-sent", json_integer(out->bytes));
+		json_object_set_new(info, "bytes-received-lastsec", json_integer(in->bytes_lastsec));
+		json_object_set_new(info, "bytes-sent-lastsec", json_integer(out->bytes_lastsec));
+		json_object_set_new(info, "nacks-received", json_integer(in->nacks));
+		json_object_set_new(info, "nacks-sent", json_integer(out->nacks));
+		json_object_set_new(info, "retransmissions-received", json_integer(rtcp_ctx->retransmitted));
+	}
+	return info;
+}
+
+/* Summary mode: update the row of each medium of a handle, and notify a
+ * regular stats event for the media that crossed a threshold (either way) */
+static void janus_ice_stats_update(janus_ice_handle *handle, gint64 now) {
+	janus_ice_stream *stream = handle->stream;
+	janus_session *session = (janus_session *)handle->session;
+	if(stream == NULL || stream->component == NULL || session == NULL)
+		return;
+	gboolean crossed[JANUS_ICE_STATS_MEDIA] = { FALSE, FALSE, FALSE, FALSE };
+	gboolean exceeded[JANUS_ICE_STATS_MEDIA] = { FALSE, FALSE, FALSE, FALSE };
+	janus_mutex_lock(&janus_ice_stats_mutex);
+	if(janus_ice_stats_entries == NULL)
+		janus_ice_stats_entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, (GDestroyNotify)g_free);
+	janus_ice_stats_entry *entry = g_hash_table_lookup(janus_ice_stats_entries, &handle->handle_id);
+	if(entry == NULL) {
+		entry = g_malloc0(sizeof(janus_ice_stats_entry));
+		entry->session_id = session->session_id;
+		entry->handle_id = handle->handle_id;
+		g_hash_table_insert(janus_ice_stats_entries, &entry->handle_id, entry);
+	}
+	entry->updated = now;
+	int medium = 0;
+	for(medium=0; medium<JANUS_ICE_STATS_MEDIA; medium++) {
+		janus_ice_stats_row *row = &entry->rows[medium];
+		int vindex = medium - 1;
+		gboolean has = medium == 0 ? janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO) :
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO);
+		janus_rtcp_context *rtcp_ctx = medium == 0 ? stream->audio_rtcp_ctx : stream->video_rtcp_ctx[vindex];
+		if(!has || rtcp_ctx == NULL) {
+			row->valid = FALSE;
+			continue;
+		}
+		janus_ice_stats_info *in = medium == 0 ? &stream->component->in_stats.audio : &stream->component->in_stats.video[vindex];
+		janus_ice_stats_info *out = medium == 0 ? &stream->component->out_stats.audio : &stream->component->out_stats.video[vindex];
+		row->prev_lost = row->valid ? row->lost : 0;
+		row->prev_packets_received = row->valid ? row->packets_received : 0;
+		row->valid = TRUE;
+		row->rtt = medium < 2 ? janus_rtcp_context_get_rtt(rtcp_ctx) : 0;
+		row->lost = janus_rtcp_context_get_lost_all(rtcp_ctx, FALSE);
+		row->lost_remote = janus_rtcp_context_get_lost_all(rtcp_ctx, TRUE);
+		row->jitter_local = janus_rtcp_context_get_jitter(rtcp_ctx, FALSE);
+		row->jitter_remote = janus_rtcp_context_get_jitter(rtcp_ctx, TRUE);
+		row->in_link_quality = janus_rtcp_context_get_in_link_quality(rtcp_ctx);
+		row->out_link_quality = janus_rtcp_context_get_out_link_quality(rtcp_ctx);
+		row->packets_received = in->packets;
+		row->packets_sent = out->packets;
+		row->bytes_received_lastsec = in->bytes_lastsec;
+		row->bytes_sent_lastsec = out->bytes_lastsec;
+		row->nacks_received = in->nacks;
+		row->nacks_sent = out->nacks;
+		/* Check the thresholds, looking at what happened since the last update */
+		gboolean above = FALSE;
+		if(janus_ice_event_stats_rtt_threshold > 0 && row->rtt > (guint32)janus_ice_event_stats_rtt_threshold)
+			above = TRUE;
+		if(janus_ice_event_stats_loss_threshold > 0 && row->lost > row->prev_lost) {
+			guint64 lost = row->lost - row->prev_lost;
+			guint64 received = row->packets_received > row->prev_packets_received ?
+				row->packets_received - row->prev_packets_received : 0;
+			if(lost*100 > (guint64)janus_ice_event_stats_loss_threshold * (lost + received))
+				above = TRUE;
+		}
+		if(above != row->above_threshold) {
+			row->above_threshold = above;
+			crossed[medium] = TRUE;
+			exceeded[medium] = above;
+		}
+	}
+	janus_mutex_unlock(&janus_ice_stats_mutex);
+	for(medium=0; medium<JANUS_ICE_STATS_MEDIA; medium++) {
+		if(!crossed[medium])
+			continue;
+		json_t *info = janus_ice_stats_event_info(stream, medium);
+		if(info == NULL)
+			continue;
+		json_object_set_new(info, "threshold", json_string(exceeded[medium] ? "exceeded" : "recovered"));
+		janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_STATS,
+			session->session_id, handle->handle_id, handle->opaque_id, info);
+	}
+}
+
+/* Summary mode: whoever gets here first when a period is over notifies a
+ * summary of all the rows, in a column oriented format, e.g.:
+ * { "media": ["audio","video",..], "session_id": [..], "handle_id": [..], "rtt": [..], .. } */
+static void janus_ice_stats_summary_check(gint64 now) {
+	gint64 period = (gint64)janus_ice_event_stats_period * G_USEC_PER_SEC;
+	janus_mutex_lock(&janus_ice_stats_mutex);
+	if(janus_ice_stats_entries == NULL || now < janus_ice_stats_next_summary) {
+		janus_mutex_unlock(&janus_ice_stats_mutex);
+		return;
+	}
+	janus_ice_stats_next_summary = now + period;
+	json_t *sessions = json_array(), *handles = json_array(), *media = json_array(),
+		*rtt = json_array(), *lost = json_array(), *lost_remote = json_array(),
+		*jitter_local = json_array(), *jitter_remote = json_array(),
+		*in_lq = json_array(), *out_lq = json_array(),
+		*packets_received = json_array(), *packets_sent = json_array(),
+		*bytes_received = json_array(), *bytes_sent = json_array(),
+		*nacks_received = json_array(), *nacks_sent = json_array();
+	int count = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, janus_ice_stats_entries);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_ice_stats_entry *entry = (janus_ice_stats_entry *)value;
+		if(now - entry->updated > 2*period) {
+			/* Handle gone, or not sending/receiving media anymore */
+			g_hash_table_iter_remove(&iter);
+			continue;
+		}
+		int medium = 0;
+		for(medium=0; medium<JANUS_ICE_STATS_MEDIA; medium++) {
+			janus_ice_stats_row *row = &entry->rows[medium];
+			if(!row->valid)
+				continue;
+			count++;
+			json_array_append_new(sessions, json_integer(entry->session_id));
+			json_array_append_new(handles, json_integer(entry->handle_id));
+			json_array_append_new(media, json_string(janus_ice_stats_media[medium]));
+			json_array_append_new(rtt, json_integer(row->rtt));
+			json_array_append_new(lost, json_integer(row->lost));
+			json_array_append_new(lost_remote, json_integer(row->lost_remote));
+			json_array_append_new(jitter_local, json_integer(row->jitter_local));
+			json_array_append_new(jitter_remote, json_integer(row->jitter_remote));
+			json_array_append_new(in_lq, json_integer(row->in_link_quality));
+			json_array_append_new(out_lq, json_integer(row->out_link_quality));
+			json_array_append_new(packets_received, json_integer(row->packets_received));
+			json_array_append_new(packets_sent, json_integer(row->packets_sent));
+			json_array_append_new(bytes_received, json_integer(row->bytes_received_lastsec));
+			json_array_append_new(bytes_sent, json_integer(row->bytes_sent_lastsec));
+			json_array_append_new(nacks_received, json_integer(row->nacks_received));
+			json_array_append_new(nacks_sent, json_integer(row->nacks_sent));
+		}
+	}
+	janus_mutex_unlock(&janus_ice_stats_mutex);
+	json_t *info = json_object();
+	json_object_set_new(info, "period", json_integer(janus_ice_event_stats_period));
+	json_object_set_new(info, "count", json_integer(count));
+	json_object_set_new(info, "media", media);
+	json_object_set_new(info, "session_id", sessions);
+	json_object_set_new(info, "handle_id", handles);
+	json_object_set_new(info, "rtt", rtt);
+	json_object_set_new(info, "lost", lost);
+	json_object_set_new(info, "lost-by-remote", lost_remote);
+	json_object_set_new(info, "jitter-local", jitter_local);
+	json_object_set_new(info, "jitter-remote", jitter_remote);
+	json_object_set_new(info, "in-link-quality", in_lq);
+	json_object_set_new(info, "out-link-quality", out_lq);
+	json_object_set_new(info, "packets-received", packets_received);
+	json_object_set_new(info, "packets-sent", packets_sent);
+	json_object_set_new(info, "bytes-received-lastsec", bytes_received);
+	json_object_set_new(info, "bytes-sent-lastsec", bytes_sent);
+	json_object_set_new(info, "nacks-received", nacks_received);
+	json_object_set_new(info, "nacks-sent", nacks_sent);
+	janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_SUMMARY,
+		0, (guint64)0, NULL, info);
+}
+
 static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 	janus_ice_handle *handle = (janus_ice_handle *)user_data;
 	/* This callback is for stats and other things we need to do on a regular basis (typically called once per second) */
@@ -3915,6 +5754,12 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 	if(stream == NULL || stream->component == NULL)
 		return G_SOURCE_CONTINUE;
 	janus_ice_component *component = stream->component;
+	/* Static loops measure their lag themselves, handle threads do it here */
+	if(handle->static_loop == NULL && handle->last_stats_tick > 0 && now - handle->last_stats_tick > G_USEC_PER_SEC)
+		janus_ice_overload_track(&overload_lag, now - handle->last_stats_tick - G_USEC_PER_SEC);
+	handle->last_stats_tick = now;
+	if(handle->queued_packets != NULL)
+		janus_ice_overload_track(&overload_depth, g_async_queue_length(handle->queued_packets));
 	/* Audio */
 	gint64 last = component->in_stats.audio.updated;
 	if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->in_stats.audio.bytes_lastsec_temp > 0) {
@@ -3963,77 +5808,63 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 			janus_ice_notify_media(handle, TRUE, FALSE);
 		}
 	}
-	/* We also send live stats to event handlers every tot-seconds (configurable) */
+	/* Add what we sent and received in the last second to the core metrics */
+	janus_ice_stats_metrics(&component->in_stats, TRUE);
+	janus_ice_stats_metrics(&component->out_stats, FALSE);
+	/* Refresh the summary monitoring tools can poll: the totals are the ones we just added to the metrics */
+	guint32 lastsec_in = component->in_stats.audio.bytes_lastsec, lastsec_out = component->out_stats.audio.bytes_lastsec;
+	for(vindex=0; vindex<3; vindex++) {
+		lastsec_in += component->in_stats.video[vindex].bytes_lastsec;
+		lastsec_out += component->out_stats.video[vindex].bytes_lastsec;
+	}
+	janus_mutex_lock(&handle->snapshot_mutex);
+	handle->snapshot.updated = now;
+	handle->snapshot.packets_in = component->in_stats.metrics_packets;
+	handle->snapshot.packets_out = component->out_stats.metrics_packets;
+	handle->snapshot.bytes_in = component->in_stats.metrics_bytes;
+	handle->snapshot.bytes_out = component->out_stats.metrics_bytes;
+	handle->snapshot.nacks_in = component->in_stats.metrics_nacks;
+	handle->snapshot.nacks_out = component->out_stats.metrics_nacks;
+	handle->snapshot.bytes_lastsec_in = lastsec_in;
+	handle->snapshot.bytes_lastsec_out = lastsec_out;
+	janus_mutex_unlock(&handle->snapshot_mutex);
+	/* When all loops share the same port, it's the kernel that picks the loop
+	 * that gets our packets: if it's not ours, move there, so that it can stop
+	 * handing them over to us (this is a no-op while a migration is pending) */
+	if(component->mux != NULL && g_atomic_pointer_get(&handle->static_loop_target) == NULL) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_loop;
+		int id = janus_ice_mux_peer_get_receiving_loop(component->mux);
+		if(loop != NULL && id >= 0 && id != loop->id)
+			janus_ice_handle_migrate(handle, id);
+	}
+	/* We also send live stats to event handlers every tot-seconds (configurable),
+	 * unless the server is overloaded, in which case that's work we can skip */
 	handle->last_event_stats++;
 	if(janus_ice_event_stats_period > 0 && handle->last_event_stats >= janus_ice_event_stats_period) {
 		handle->last_event_stats = 0;
-		/* Audio */
-		if(janus_events_is_enabled() && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO)) {
-			if(stream && stream->audio_rtcp_ctx) {
-				json_t *info = json_object();
-				json_object_set_new(info, "media", json_string("audio"));
-				json_object_set_new(info, "base", json_integer(stream->audio_rtcp_ctx->tb));
-				json_object_set_new(info, "rtt", json_integer(janus_rtcp_context_get_rtt(stream->audio_rtcp_ctx)));
-				json_object_set_new(info, "lost", json_integer(janus_rtcp_context_get_lost_all(stream->audio_rtcp_ctx, FALSE)));
-				json_object_set_new(info, "lost-by-remote", json_integer(janus_rtcp_context_get_lost_all(stream->audio_rtcp_ctx, TRUE)));
-				json_object_set_new(info, "jitter-local", json_integer(janus_rtcp_context_get_jitter(stream->audio_rtcp_ctx, FALSE)));
-				json_object_set_new(info, "jitter-remote", json_integer(janus_rtcp_context_get_jitter(stream->audio_rtcp_ctx, TRUE)));
-				json_object_set_new(info, "in-link-quality", json_integer(janus_rtcp_context_get_in_link_quality(stream->audio_rtcp_ctx)));
-				json_object_set_new(info, "in-media-link-quality", json_integer(janus_rtcp_context_get_in_media_link_quality(stream->audio_rtcp_ctx)));
-				json_object_set_new(info, "out-link-quality", json_integer(janus_rtcp_context_get_out_link_quality(stream->audio_rtcp_ctx)));
-				json_object_set_new(info, "out-media-link-quality", json_integer(janus_rtcp_context_get_out_media_link_quality(stream->audio_rtcp_ctx)));
-				if(stream->component) {
-					json_object_set_new(info, "packets-received", json_integer(stream->component->in_stats.audio.packets));
-					json_object_set_new(info, "packets-sent", json_integer(stream->component->out_stats.audio.packets));
-					json_object_set_new(info, "bytes-received", json_integer(stream->component->in_stats.audio.bytes));
-					json_object_set_new(info, "bytes-sent", json_integer(stream->component->out_stats.audio.bytes));
-					json_object_set_new(info, "bytes-received-lastsec", json_integer(stream->component->in_stats.audio.bytes_lastsec));
-					json_object_set_new(info, "bytes-sent-lastsec", json_integer(stream->component->out_stats.audio.bytes_lastsec));
-					json_object_set_new(info, "nacks-received", json_integer(stream->component->in_stats.audio.nacks));
-					json_object_set_new(info, "nacks-sent", json_integer(stream->component->out_stats.audio.nacks));
-					json_object_set_new(info, "retransmissions-received", json_integer(stream->audio_rtcp_ctx->retransmitted));
-				}
-				janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_STATS,
-					session->session_id, handle->handle_id, handle->opaque_id, info);
-			}
-		}
-		/* Do the same for video */
-		if(janus_events_is_enabled() && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO)) {
-			int vindex=0;
-			for(vindex=0; vindex<3; vindex++) {
-				if(stream && stream->video_rtcp_ctx[vindex]) {
-					json_t *info = json_object();
-					if(vindex == 0)
-						json_object_set_new(info, "media", json_string("video"));
-					else if(vindex == 1)
-						json_object_set_new(info, "media", json_string("video-sim1"));
-					else
-						json_object_set_new(info, "media", json_string("video-sim2"));
-					json_object_set_new(info, "base", json_integer(stream->video_rtcp_ctx[vindex]->tb));
-					if(vindex == 0)
-						json_object_set_new(info, "rtt", json_integer(janus_rtcp_context_get_rtt(stream->video_rtcp_ctx[vindex])));
-					json_object_set_new(info, "lost", json_integer(janus_rtcp_context_get_lost_all(stream->video_rtcp_ctx[vindex], FALSE)));
-					json_object_set_new(info, "lost-by-remote", json_integer(janus_rtcp_context_get_lost_all(stream->video_rtcp_ctx[vindex], TRUE)));
-					json_object_set_new(info, "jitter-local", json_integer(janus_rtcp_context_get_jitter(stream->video_rtcp_ctx[vindex], FALSE)));
-					json_object_set_new(info, "jitter-remote", json_integer(janus_rtcp_context_get_jitter(stream->video_rtcp_ctx[vindex], TRUE)));
-					json_object_set_new(info, "in-link-quality", json_integer(janus_rtcp_context_get_in_link_quality(stream->video_rtcp_ctx[vindex])));
-					json_object_set_new(info, "in-media-link-quality", json_integer(janus_rtcp_context_get_in_media_link_quality(stream->video_rtcp_ctx[vindex])));
-					json_object_set_new(info, "out-link-quality", json_integer(janus_rtcp_context_get_out_link_quality(stream->video_rtcp_ctx[vindex])));
-					json_object_set_new(info, "out-media-link-quality", json_integer(janus_rtcp_context_get_out_media_link_quality(stream->video_rtcp_ctx[vindex])));
-					if(stream->component) {
-						json_object_set_new(info, "packets-received", json_integer(stream->component->in_stats.video[vindex].packets));
-						json_object_set_new(info, "packets-sent", json_integer(stream->component->out_stats.video[vindex].packets));
-						json_object_set_new(info, "bytes-received", json_integer(stream->component->in_stats.video[vindex].bytes));
-						json_object_set_new(info, "bytes-sent", json_integer(stream->component->out_stats.video[vindex].bytes));
-						json_object_set_new(info, "bytes-received-lastsec", json_integer(stream->component->in_stats.video[vindex].bytes_lastsec));
-						json_object_set_new(info, "bytes-sent-lastsec", json_integer(stream->component->out_stats.video[vindex].bytes_lastsec));
-						json_object_set_new(info, "nacks-received", json_integer(stream->component->in_stats.video[vindex].nacks));
-						json_object_set_new(info, "nacks-sent", json_integer(stream->component->out_stats.video[vindex].nacks));
-						json_object_set_new(info, "retransmissions-received", json_integer(stream->video_rtcp_ctx[vindex]->retransmitted));
-					}
+		if(!janus_is_overloaded() && janus_events_is_wanted(JANUS_EVENT_TYPE_MEDIA,
+				janus_ice_event_stats_summary ? JANUS_EVENT_SUBTYPE_MEDIA_SUMMARY : JANUS_EVENT_SUBTYPE_MEDIA_STATS)) {
+			if(janus_ice_event_stats_summary) {
+				/* Take note of the numbers, they'll be part of the next summary */
+				janus_ice_stats_update(handle, now);
+				janus_ice_stats_summary_check(now);
+			} else {
+				/* Audio */
+				json_t *info = NULL;
+				if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO) &&
+						(info = janus_ice_stats_event_info(stream, 0)) != NULL) {
 					janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_STATS,
 						session->session_id, handle->handle_id, handle->opaque_id, info);
 				}
+				/* Do the same for video */
+				int medium = 0;
+				for(medium=1; medium<JANUS_ICE_STATS_MEDIA; medium++) {
+					if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO) &&
+							(info = janus_ice_stats_event_info(stream, medium)) != NULL) {
+						janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_STATS,
+							session->session_id, handle->handle_id, handle->opaque_id, info);
+					}
+				}
 			}
 		}
 	}
@@ -4043,6 +5874,7 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 	handle->last_srtp_summary++;
 	if(handle->last_srtp_summary == 0 || handle->last_srtp_summary == 2) {
 		if(handle->srtp_errors_count > 0) {
+			janus_metrics_add_srtp_errors(handle->srtp_errors_count);
 			JANUS_LOG(LOG_ERR, "[%"SCNu64"] Got %d SRTP/SRTCP errors in the last few seconds (last error: %s)\n",
 				handle->handle_id, handle->srtp_errors_count, janus_srtp_error_str(handle->last_srtp_error));
 			handle->srtp_errors_count = 0;
@@ -4053,6 +5885,149 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 	return G_SOURCE_CONTINUE;
 }
 
+int janus_ice_handle_migrate(janus_ice_handle *handle, int id) {
+	if(handle == NULL)
+		return -1;
+	if(static_event_loops < 1 || handle->static_loop == NULL) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Can't migrate handle, it's not served by a static event loop\n", handle->handle_id);
+		return -1;
+	}
+	janus_mutex_lock(&event_loops_mutex);
+	janus_ice_static_event_loop *loop = janus_ice_static_event_loop_find(id);
+	janus_mutex_unlock(&event_loops_mutex);
+	if(loop == NULL) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Can't migrate handle, no such static loop #%d\n", handle->handle_id, id);
+		return -1;
+	}
+	if(loop == g_atomic_pointer_get(&handle->static_loop))
+		return 0;
+	if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY) ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) ||
+			handle->queued_packets == NULL) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Can't migrate handle, no PeerConnection established\n", handle->handle_id);
+		return -2;
+	}
+	/* Let's message the loop, we'll do the actual migration from there */
+	g_atomic_pointer_set(&handle->static_loop_target, loop);
+#if GLIB_CHECK_VERSION(2, 46, 0)
+	g_async_queue_push_front(handle->queued_packets, &janus_ice_migrate_loop);
+#else
+	g_async_queue_push(handle->queued_packets, &janus_ice_migrate_loop);
+#endif
+	g_main_context_wakeup(handle->mainctx);
+	return 0;
+}
+
+/* Move a handle to the static loop it has been asked to migrate to: this is
+ * called by the current loop thread, from the outgoing traffic source, which
+ * means nothing else can be running on behalf of this handle in the meanwhile */
+static gboolean janus_ice_static_event_loop_switch(janus_ice_outgoing_traffic *t) {
+	janus_ice_handle *handle = t->handle;
+	janus_ice_static_event_loop *from = (janus_ice_static_event_loop *)handle->static_loop;
+	janus_ice_static_event_loop *to = (janus_ice_static_event_loop *)g_atomic_pointer_get(&handle->static_loop_target);
+	g_atomic_pointer_set(&handle->static_loop_target, NULL);
+	if(from == NULL || to == NULL || to == from)
+		return FALSE;
+	janus_ice_stream *stream = handle->stream;
+	janus_ice_component *component = stream ? stream->component : NULL;
+	if(component == NULL || handle->agent == NULL ||
+			!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY) ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP) ||
+			component->dtlsrt_source != NULL || component->icestate_source != NULL) {
+		/* The PeerConnection is not in a state we can move */
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Can't migrate handle to static loop #%d right now\n",
+			handle->handle_id, to->id);
+		return FALSE;
+	}
+	/* Dynamic loops are only retired while empty and with the lock held, so
+	 * make sure the target is still there, and account for us right away */
+	janus_mutex_lock(&event_loops_mutex);
+	gboolean retired = to->retired;
+	/* On a shared port, the new loop must be bound to the same one */
+	gboolean moved = (component->mux == NULL || (!retired && janus_ice_mux_peer_move(component->mux, to->mux) == 0));
+	if(!retired && moved)
+		g_atomic_int_inc(&to->handles);
+	janus_mutex_unlock(&event_loops_mutex);
+	if(retired) {
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Can't migrate handle, static loop #%d has been retired\n",
+			handle->handle_id, to->id);
+		return FALSE;
+	}
+	if(!moved) {
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Can't migrate handle, static loop #%d doesn't share our port\n",
+			handle->handle_id, to->id);
+		return FALSE;
+	}
+	JANUS_LOG(LOG_INFO, "[%"SCNu64"] Migrating handle from static loop #%d to #%d\n",
+		handle->handle_id, from->id, to->id);
+	/* The pacer timer is attached to this loop: just send what it's holding */
+	janus_ice_pacer_stop(component, TRUE);
+	janus_mutex_lock(&handle->mutex);
+	handle->mainctx = to->mainctx;
+	handle->mainloop = to->mainloop;
+	g_atomic_pointer_set(&handle->static_loop, to);
+	/* Pending cleanups of NACKed packets were attached to the old loop: we
+	 * just get rid of them, at worst we'll retransmit a duplicate or two */
+	if(stream->pending_nacked_cleanup && g_hash_table_size(stream->pending_nacked_cleanup) > 0) {
+		GHashTableIter iter;
+		gpointer val;
+		g_hash_table_iter_init(&iter, stream->pending_nacked_cleanup);
+		while(g_hash_table_iter_next(&iter, NULL, &val)) {
+			GSource *source = val;
+			g_source_destroy(source);
+		}
+		g_hash_table_remove_all(stream->pending_nacked_cleanup);
+	}
+	int vindex = 0;
+	for(vindex=0; vindex<3; vindex++) {
+		if(stream->rtx_nacked[vindex] != NULL)
+			g_hash_table_remove_all(stream->rtx_nacked[vindex]);
+	}
+	/* Recreate the recurring sources on the new loop */
+	if(handle->rtcp_source) {
+		g_source_destroy(handle->rtcp_source);
+		g_source_unref(handle->rtcp_source);
+		handle->rtcp_source = g_timeout_source_new_seconds(1);
+		g_source_set_priority(handle->rtcp_source, G_PRIORITY_DEFAULT);
+		g_source_set_callback(handle->rtcp_source, janus_ice_outgoing_rtcp_handle, handle, NULL);
+		g_source_attach(handle->rtcp_source, handle->mainctx);
+	}
+	if(handle->twcc_source) {
+		g_source_destroy(handle->twcc_source);
+		g_source_unref(handle->twcc_source);
+		handle->twcc_source = g_timeout_source_new(twcc_period);
+		g_source_set_priority(handle->twcc_source, G_PRIORITY_DEFAULT);
+		g_source_set_callback(handle->twcc_source, janus_ice_outgoing_transport_wide_cc_feedback, handle, NULL);
+		g_source_attach(handle->twcc_source, handle->mainctx);
+	}
+	if(handle->stats_source) {
+		g_source_destroy(handle->stats_source);
+		g_source_unref(handle->stats_source);
+		handle->stats_source = g_timeout_source_new_seconds(1);
+		g_source_set_callback(handle->stats_source, janus_ice_outgoing_stats_handle, handle, NULL);
+		g_source_set_priority(handle->stats_source, G_PRIORITY_DEFAULT);
+		g_source_attach(handle->stats_source, handle->mainctx);
+	}
+	/* Have libnice deliver incoming packets to the new loop (unless we use a shared port) */
+	if(component->mux == NULL) {
+		nice_agent_attach_recv(handle->agent, handle->stream_id, 1, handle->mainctx,
+			janus_ice_cb_nice_recv, component);
+	}
+	/* Finally, replace the source for outgoing traffic: the old one will go
+	 * away as soon as we return, without tearing down the PeerConnection */
+	t->migrated = TRUE;
+	g_source_unref(handle->rtp_source);
+	handle->rtp_source = janus_ice_outgoing_traffic_create(handle, (GDestroyNotify)g_free);
+	g_source_set_priority(handle->rtp_source, G_PRIORITY_DEFAULT);
+	g_source_attach(handle->rtp_source, handle->mainctx);
+	janus_mutex_unlock(&handle->mutex);
+	g_atomic_int_dec_and_test(&from->handles);
+	/* Packets may have been queued while we were busy, wake the new loop up */
+	g_main_context_wakeup(handle->mainctx);
+	return TRUE;
+}
+
 static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
 	janus_session *session = (janus_session *)handle->session;
 	janus_ice_stream *stream = handle->stream;
@@ -4075,7 +6050,8 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			candidates = g_slist_append(candidates, c);
 		}
 		guint count = g_slist_length(candidates);
-		if(stream != NULL && component != NULL && count > 0) {
+		/* On a shared port we learn the addresses from the checks, libnice doesn't need them */
+		if(stream != NULL && component != NULL && component->mux == NULL && count > 0) {
 			int added = nice_agent_set_remote_candidates(handle->agent, stream->stream_id, component->component_id, candidates);
 			if(added < 0 || (guint)added != count) {
 				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Failed to add some remote candidates (added %u, expected %u)\n",
@@ -4116,7 +6092,9 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		if(plugin != NULL && handle->app_handle != NULL) {
 			plugin->hangup_media(handle->app_handle);
 		}
-		/* Get rid of the attached sources */
+		/* Get rid of the attached sources, and of the video we were still pacing */
+		if(handle->stream && handle->stream->component)
+			janus_ice_pacer_stop(handle->stream->component, FALSE);
 		if(handle->rtcp_source) {
 			g_source_destroy(handle->rtcp_source);
 			g_source_unref(handle->rtcp_source);
@@ -4133,7 +6111,8 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			handle->stats_source = NULL;
 		}
 		/* If event handlers are active, send stats one last time */
-		if(janus_events_is_enabled()) {
+		if(janus_events_is_wanted(JANUS_EVENT_TYPE_MEDIA,
+				janus_ice_event_stats_summary ? JANUS_EVENT_SUBTYPE_MEDIA_SUMMARY : JANUS_EVENT_SUBTYPE_MEDIA_STATS)) {
 			handle->last_event_stats = janus_ice_event_stats_period;
 			(void)janus_ice_outgoing_stats_handle(handle);
 		}
@@ -4166,14 +6145,23 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 		janus_session_notify_event(session, event);
 		/* Notify event handlers as well */
-		if(janus_events_is_enabled())
+		if(janus_events_is_wanted(JANUS_EVENT_TYPE_HANDLE, JANUS_EVENT_SUBTYPE_NONE))
 			janus_events_notify_handlers(JANUS_EVENT_TYPE_HANDLE, JANUS_EVENT_SUBTYPE_NONE,
 				session->session_id, handle->handle_id, "detached",
 				plugin ? plugin->get_package() : NULL, handle->opaque_id, handle->token);
 		return G_SOURCE_REMOVE;
 	} else if(pkt == &janus_ice_data_ready) {
-		/* Data is writable on this PeerConnection, notify the plugin */
+		/* Data is writable on this PeerConnection: send what we had to queue
+		 * first, and then notify the plugin (if the policy says so) */
 		janus_plugin *plugin = (janus_plugin *)handle->app;
+#ifdef HAVE_SCTP
+		if(component != NULL && component->dtls != NULL && component->dtls->sctp != NULL &&
+				!janus_sctp_notify_writable(component->dtls->sctp)) {
+			JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Data channel messages still queued, not notifying the plugin yet\n",
+				handle->handle_id);
+			return G_SOURCE_CONTINUE;
+		}
+#endif
 		if(plugin != NULL && plugin->data_ready != NULL && handle->app_handle != NULL) {
 			JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Telling the plugin about the data channel being ready (%s)\n",
 				handle->handle_id, plugin ? plugin->get_name() : "??");
@@ -4221,7 +6209,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		component->noerrorlog = FALSE;
 		if(pkt->encrypted) {
 			/* Already SRTCP */
-			int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, pkt->length, (const gchar *)pkt->data);
+			int sent = janus_ice_egress_send(handle, component, pkt->length, (const gchar *)pkt->data);
 			if(sent < pkt->length) {
 				JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
 			}
@@ -4249,11 +6237,12 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 						remb->ssrc[2] = htonl(stream->video_ssrc_peer[2]);
 					}
 				}
-				/* Free old packet and update */
+				/* Free old packet and update (unless it's the pooled buffer) */
 				char *prev_data = pkt->data;
 				pkt->data = rtcpbuf;
 				pkt->length = rrlen+pkt->length;
-				g_clear_pointer(&prev_data, g_free);
+				if(prev_data != pkt->buffer)
+					g_free(prev_data);
 			}
 			/* Do we need to dump this packet for debugging? */
 			if(g_atomic_int_get(&handle->dump_packets))
@@ -4263,6 +6252,8 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			int protected = pkt->length;
 			int res = janus_is_webrtc_encryption_enabled() ?
 				srtp_protect_rtcp(component->dtls->srtp_out, pkt->data, &protected) : srtp_err_status_ok;
+			if(janus_is_webrtc_encryption_enabled())
+				component->srtp_protected++;
 			if(res != srtp_err_status_ok) {
 				/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
 				handle->srtp_errors_count++;
@@ -4271,7 +6262,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				JANUS_LOG(LOG_DBG, "[%"SCNu64"] ... SRTCP protect error... %s (len=%d-->%d)...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected);
 			} else {
 				/* Shoot! */
-				int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, protected, pkt->data);
+				int sent = janus_ice_egress_send(handle, component, protected, pkt->data);
 				if(sent < protected) {
 					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
 				}
@@ -4297,11 +6288,13 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				return G_SOURCE_CONTINUE;
 			}
 			component->noerrorlog = FALSE;
+			/* If the payload is shared with other legs, this is where we get our own copy */
+			janus_ice_queued_packet_unshare(pkt);
 			if(pkt->encrypted) {
 				/* Already RTP (probably a retransmission?) */
 				janus_rtp_header *header = (janus_rtp_header *)pkt->data;
 				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] ... Retransmitting seq.nr %"SCNu16"\n\n", handle->handle_id, ntohs(header->seq_number));
-				int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, pkt->length, (const gchar *)pkt->data);
+				int sent = janus_ice_egress_send(handle, component, pkt->length, (const gchar *)pkt->data);
 				if(sent < pkt->length) {
 					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
 				}
@@ -4311,6 +6304,9 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				if(!pkt->retransmission) {
 					/* ... but only if this isn't a retransmission (for those we already set it before) */
 					header->ssrc = htonl(video ? stream->video_ssrc : stream->audio_ssrc);
+					/* If we sent ULPFEC packets, make room for their sequence numbers */
+					if(video && stream->fec && stream->fec->seq_offset > 0)
+						header->seq_number = htons(ntohs(header->seq_number) + stream->fec->seq_offset);
 				}
 				/* Set the transport-wide sequence number, if needed */
 				if(video && stream->transport_wide_cc_ext_id > 0) {
@@ -4367,6 +6363,9 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 						janus_cleanup_nack_buffer(0, stream, FALSE, TRUE);
 					}
 				}
+				/* Add RED and/or ULPFEC protection, if negotiated */
+				if(!pkt->retransmission && stream->fec)
+					janus_ice_fec_protect(stream, pkt, video);
 				/* Before encrypting, check if we need to copy the unencrypted payload (e.g., for rtx/90000) */
 				janus_rtp_packet *p = NULL;
 				if(stream->nack_queue_ms > 0 && !pkt->retransmission && pkt->type == JANUS_ICE_PACKET_VIDEO && component->do_video_nacks &&
@@ -4396,9 +6395,18 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 					memcpy(p->data+hsize+2, payload, pkt->length - hsize);
 				}
 				/* Encrypt SRTP */
+				gboolean sample = janus_ice_latency_sample(&component->latency_out_count);
+				gint64 sample_start = 0;
+				if(sample) {
+					sample_start = janus_get_monotonic_time();
+					if(!pkt->retransmission)
+						janus_ice_latency_record(component, JANUS_ICE_LATENCY_QUEUE, sample_start - pkt->added);
+				}
 				int protected = pkt->length;
 				int res = janus_is_webrtc_encryption_enabled() ?
 					srtp_protect(component->dtls->srtp_out, pkt->data, &protected) : srtp_err_status_ok;
+				if(janus_is_webrtc_encryption_enabled())
+					component->srtp_protected++;
 				if(res != srtp_err_status_ok) {
 					/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
 					handle->srtp_errors_count++;
@@ -4412,7 +6420,11 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 					janus_ice_free_rtp_packet(p);
 				} else {
 					/* Shoot! */
-					int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, protected, pkt->data);
+					int sent = janus_ice_egress_send(handle, component, protected, pkt->data);
+					if(sample)
+						janus_ice_latency_record(component, JANUS_ICE_LATENCY_SEND, janus_get_monotonic_time() - sample_start);
+					if(video && !pkt->retransmission)
+						janus_ice_fec_send(handle, component, stream);
 					if(sent < protected) {
 						JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
 					}
@@ -4493,30 +6505,30 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 						if(p == NULL) {
 							/* If we're not doing RFC4588, we're saving the SRTP packet as it is */
 							p = g_malloc(sizeof(janus_rtp_packet));
-							p->data = g_malloc(protected);
-							memcpy(p->data, pkt->data, protected);
+							if(pkt->pool < 0 && pkt->data == pkt->buffer) {
+								/* The packet has a heap buffer of its own, which we don't
+								 * need anymore: take it over, rather than copying it */
+								p->data = pkt->buffer;
+								pkt->buffer = NULL;
+								pkt->data = NULL;
+							} else {
+								p->data = g_malloc(protected);
+								memcpy(p->data, pkt->data, protected);
+							}
 							p->length = protected;
 						}
 						p->created = janus_get_monotonic_time();
 						p->last_retransmit = 0;
-						janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+						janus_rtp_header *header = (janus_rtp_header *)p->data;
 						guint16 seq = ntohs(header->seq_number);
 						if(!video) {
-							if(component->audio_retransmit_buffer == NULL) {
-								component->audio_retransmit_buffer = g_queue_new();
-								component->audio_retransmit_seqs = g_hash_table_new(NULL, NULL);
-							}
-							g_queue_push_tail(component->audio_retransmit_buffer, p);
-							/* Insert in the table too, for quick lookup */
-							g_hash_table_insert(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq), p);
+							if(component->audio_retransmit_buffer == NULL)
+								component->audio_retransmit_buffer = janus_ice_retransmit_buffer_create(JANUS_ICE_RETRANSMIT_AUDIO_SLOTS, &handle->memory);
+							janus_ice_retransmit_buffer_insert(component->audio_retransmit_buffer, seq, p);
 						} else {
-							if(component->video_retransmit_buffer == NULL) {
-								component->video_retransmit_buffer = g_queue_new();
-								component->video_retransmit_seqs = g_hash_table_new(NULL, NULL);
-							}
-							g_queue_push_tail(component->video_retransmit_buffer, p);
-							/* Insert in the table too, for quick lookup */
-							g_hash_table_insert(component->video_retransmit_seqs, GUINT_TO_POINTER(seq), p);
+							if(component->video_retransmit_buffer == NULL)
+								component->video_retransmit_buffer = janus_ice_retransmit_buffer_create(JANUS_ICE_RETRANSMIT_VIDEO_SLOTS, &handle->memory);
+							janus_ice_retransmit_buffer_insert(component->video_retransmit_buffer, seq, p);
 						}
 					} else {
 						janus_ice_free_rtp_packet(p);
@@ -4541,7 +6553,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			component->noerrorlog = FALSE;
 			/* TODO Support binary data */
 			janus_dtls_wrap_sctp_data(component->dtls, pkt->label, pkt->protocol,
-				pkt->type == JANUS_ICE_PACKET_TEXT, pkt->data, pkt->length);
+				pkt->type == JANUS_ICE_PACKET_TEXT, pkt->shared ? pkt->shared->buffer : pkt->data, pkt->length);
 #endif
 		} else if(pkt->type == JANUS_ICE_PACKET_SCTP) {
 			/* SCTP data to push */
@@ -4574,14 +6586,14 @@ static void janus_ice_queue_packet(janus_ice_handle *handle, janus_ice_queued_pa
 	/* TODO: There is a potential race condition where the "queued_packets"
 	 * could get released between the condition and pushing the packet. */
 	if(handle->queued_packets != NULL) {
-		g_async_queue_push(handle->queued_packets, pkt);
-		g_main_context_wakeup(handle->mainctx);
+		if(janus_ice_queued_media_push(handle, pkt))
+			g_main_context_wakeup(handle->mainctx);
 	} else {
 		janus_ice_free_queued_packet(pkt);
 	}
 }
 
-void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
+static void janus_ice_relay_rtp_internal(janus_ice_handle *handle, janus_plugin_rtp *packet, janus_plugin_rtp_payload *shared) {
 	if(!handle || !handle->stream || handle->queued_packets == NULL || packet == NULL || packet->buffer == NULL ||
 			!janus_is_rtp(packet->buffer, packet->length))
 		return;
@@ -4589,11 +6601,17 @@ void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
 			|| (packet->video && !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO)))
 		return;
 	uint16_t totlen = RTP_HEADER_SIZE;
-	/* Check how large the payload is */
+	/* Check how large the payload is: if it's shared, we only use the header from the packet */
 	int plen = 0;
-	char *payload = janus_rtp_payload(packet->buffer, packet->length, &plen);
-	if(payload != NULL)
-		totlen += plen;
+	char *payload = NULL;
+	if(shared != NULL) {
+		plen = shared->length;
+	} else {
+		payload = janus_rtp_payload(packet->buffer, packet->length, &plen);
+		if(payload == NULL)
+			plen = 0;
+	}
+	totlen += plen;
 	/* We need to strip extensions, here, and add those that need to be there manually */
 	uint16_t extlen = 0;
 	char extensions[50];
@@ -4676,16 +6694,19 @@ void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
 		totlen += extlen;
 	}
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(totlen + SRTP_MAX_TAG_LEN);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(totlen + SRTP_MAX_TAG_LEN);
 	/* RTP header first */
 	memcpy(pkt->data, packet->buffer, RTP_HEADER_SIZE);
 	/* Then RTP extensions, if any */
 	if(extlen > 0)
 		memcpy(pkt->data + RTP_HEADER_SIZE, extensions, extlen);
-	/* Finally the RTP payload, if available */
-	if(payload != NULL && plen > 0)
+	/* Finally the RTP payload, if available: a shared one will be copied later */
+	if(shared != NULL && plen > 0) {
+		janus_plugin_rtp_payload_ref(shared);
+		pkt->shared = shared;
+	} else if(payload != NULL && plen > 0) {
 		memcpy(pkt->data + RTP_HEADER_SIZE + extlen, payload, plen);
+	}
 	pkt->length = totlen;
 	pkt->type = packet->video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 	pkt->control = FALSE;
@@ -4699,6 +6720,14 @@ void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
 	header->extension = origext;
 }
 
+void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
+	janus_ice_relay_rtp_internal(handle, packet, NULL);
+}
+
+void janus_ice_relay_rtp_shared(janus_ice_handle *handle, janus_plugin_rtp *packet, janus_plugin_rtp_payload *payload) {
+	janus_ice_relay_rtp_internal(handle, packet, payload);
+}
+
 void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, janus_plugin_rtcp *packet, gboolean filter_rtcp) {
 	if(!handle || handle->queued_packets == NULL || packet == NULL || packet->buffer == NULL ||
 			!janus_is_rtcp(packet->buffer, packet->length))
@@ -4727,8 +6756,7 @@ void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, janus_plugin_rtcp *
 			packet->video ? stream->video_ssrc_peer[0] : stream->audio_ssrc_peer);
 	}
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(rtcp_len+SRTP_MAX_TAG_LEN+4);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(rtcp_len+SRTP_MAX_TAG_LEN+4);
 	memcpy(pkt->data, rtcp_buf, rtcp_len);
 	pkt->length = rtcp_len;
 	pkt->type = packet->video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
@@ -4749,6 +6777,7 @@ void janus_ice_relay_rtcp(janus_ice_handle *handle, janus_plugin_rtcp *packet) {
 	janus_ice_relay_rtcp_internal(handle, packet, TRUE);
 	/* If this is a PLI and we're simulcasting, send a PLI on other layers as well */
 	if(janus_rtcp_has_pli(packet->buffer, packet->length)) {
+		janus_metrics_add_pli(FALSE);
 		janus_ice_stream *stream = handle->stream;
 		if(stream == NULL)
 			return;
@@ -4793,8 +6822,7 @@ void janus_ice_relay_data(janus_ice_handle *handle, janus_plugin_data *packet) {
 	if(!handle || handle->queued_packets == NULL || packet == NULL || packet->buffer == NULL || packet->length < 1)
 		return;
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(packet->length);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(packet->length);
 	memcpy(pkt->data, packet->buffer, packet->length);
 	pkt->length = packet->length;
 	pkt->type = packet->binary ? JANUS_ICE_PACKET_BINARY : JANUS_ICE_PACKET_TEXT;
@@ -4806,6 +6834,24 @@ void janus_ice_relay_data(janus_ice_handle *handle, janus_plugin_data *packet) {
 	pkt->added = janus_get_monotonic_time();
 	janus_ice_queue_packet(handle, pkt);
 }
+
+void janus_ice_relay_data_shared(janus_ice_handle *handle, janus_plugin_data *packet, janus_plugin_rtp_payload *payload) {
+	if(!handle || handle->queued_packets == NULL || packet == NULL || payload == NULL || payload->length < 1)
+		return;
+	/* Queue this packet: we only keep a reference to the content, no copy */
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(0);
+	janus_plugin_rtp_payload_ref(payload);
+	pkt->shared = payload;
+	pkt->length = payload->length;
+	pkt->type = packet->binary ? JANUS_ICE_PACKET_BINARY : JANUS_ICE_PACKET_TEXT;
+	pkt->control = FALSE;
+	pkt->encrypted = FALSE;
+	pkt->retransmission = FALSE;
+	pkt->label = packet->label ? g_strdup(packet->label) : NULL;
+	pkt->protocol = packet->protocol ? g_strdup(packet->protocol) : NULL;
+	pkt->added = janus_get_monotonic_time();
+	janus_ice_queue_packet(handle, pkt);
+}
 #endif
 
 void janus_ice_relay_sctp(janus_ice_handle *handle, char *buffer, int length) {
@@ -4813,8 +6859,7 @@ void janus_ice_relay_sctp(janus_ice_handle *handle, char *buffer, int length) {
 	if(!handle || handle->queued_packets == NULL || buffer == NULL || length < 1)
 		return;
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(length);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(length);
 	memcpy(pkt->data, buffer, length);
 	pkt->length = length;
 	pkt->type = JANUS_ICE_PACKET_SCTP;
@@ -4904,7 +6949,7 @@ void janus_ice_dtls_handshake_done(janus_ice_handle *handle, janus_ice_component
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_wanted(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_STATE)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "connection", json_string("webrtcup"));
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_STATE,
@@ -25,6 +25,8 @@
 #include "sctp.h"
 #include "rtcp.h"
 #include "text2pcap.h"
+#include "fec.h"
+#include "memory.h"
 #include "utils.h"
 #include "ip-utils.h"
 #include "refcount.h"
@@ -72,6 +74,12 @@ int janus_ice_set_turn_server(gchar *turn_server, uint16_t turn_port, gchar *tur
  * @param[in] api_method HTTP method to use (POST by default)
  * @returns 0 in case of success, a negative integer on errors */
 int janus_ice_set_turn_rest_api(gchar *api_server, gchar *api_key, gchar *api_method);
+/*! \brief Method to configure whether credentials from the TURN REST API should be cached
+ * @note Credentials are cached per username, and prefetched when handles are created (see turnrest.h)
+ * @param[in] cache Whether credentials should be cached and reused, until they get close to their TTL
+ * @param[in] nonblocking Whether a PeerConnection should go on without TURN REST API credentials,
+ * rather than waiting for the backend, when there's nothing cached for its username yet */
+void janus_ice_set_turn_rest_api_cache(gboolean cache, gboolean nonblocking);
 /*! \brief Method to get the STUN server IP address
  * @returns The currently used STUN server IP address, if available, or NULL if not */
 char *janus_ice_get_stun_server(void);
@@ -113,6 +121,19 @@ void janus_ice_ignore_interface(const char *ip);
  * @param[in] ip Interface/IP to check (e.g., 192.168.244.1 or eth1)
  * @returns true if the interface/IP is in the ignore list, false otherwise */
 gboolean janus_ice_is_ignored(const char *ip);
+/*! \brief Method to have the handles of each static event loop share a single UDP port, rather than have libnice bind one per PeerConnection
+ * \note This needs ICE Lite, half-trickle and static event loops: each loop binds the first free port
+ * in the range on all the addresses we'd gather candidates for, and answers the checks on it by itself.
+ * Handles on loops that couldn't find a free port, and handles with a dedicated loop, still use libnice.
+ * With \c reuseport all loops bind the same port instead, and handles are migrated to the loop the kernel
+ * picked for the packets of their PeerConnection. With \c filter the kernel drops whatever is sent to
+ * the shared ports that can't be STUN, DTLS, RTP or RTCP, before it wakes up the loops.
+ * @param[in] min_port Lowest port in the range
+ * @param[in] max_port Highest port in the range
+ * @param[in] reuseport Whether all loops should bind the same port, using SO_REUSEPORT
+ * @param[in] filter Whether to attach a socket filter to the shared ports (Linux only)
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_ice_enable_shared_ports(uint16_t min_port, uint16_t max_port, gboolean reuseport, gboolean filter);
 /*! \brief Method to check whether ICE Lite mode is enabled or not (still WIP)
  * @returns true if ICE-TCP support is enabled/supported, false otherwise */
 gboolean janus_ice_is_ice_lite_enabled(void);
@@ -125,6 +146,20 @@ gboolean janus_ice_is_full_trickle_enabled(void);
 /*! \brief Method to check whether mDNS resolution is enabled or not
  * @returns true if mDNS resolution is enabled, false otherwise */
 gboolean janus_ice_is_mdns_enabled(void);
+/*! \brief Method to configure how long the addresses of mDNS candidates are cached after resolving them
+ * @param[in] ttl How long to cache the addresses, in seconds (0 disables the cache) */
+void janus_ice_set_mdns_cache_ttl(uint ttl);
+/*! \brief Method to get how long the addresses of mDNS candidates are cached after resolving them
+ * @returns How long the addresses are cached, in seconds (0 means the cache is disabled) */
+uint janus_ice_get_mdns_cache_ttl(void);
+/*! \brief Method to have mDNS candidates dropped without resolving them, if they can't be reachable
+ * \note mDNS candidates are always host addresses, which we consider reachable only if
+ * at least one of the addresses we gather candidates on is a private one as well
+ * @param[in] ignore Whether mDNS candidates that can't be reachable should be ignored */
+void janus_ice_set_ignore_unreachable_mdns(gboolean ignore);
+/*! \brief Method to check whether mDNS candidates could be reachable at all
+ * @returns true unless the mDNS candidates should be ignored as unreachable, false otherwise */
+gboolean janus_ice_is_mdns_reachable(void);
 /*! \brief Method to check whether IPv6 candidates are enabled/supported or not (still WIP)
  * @returns true if IPv6 candidates are enabled/supported, false otherwise */
 gboolean janus_ice_is_ipv6_enabled(void);
@@ -152,6 +187,58 @@ void janus_set_twcc_period(uint period);
 /*! \brief Method to get the current TWCC period (see above)
  * @returns The current TWCC period */
 uint janus_get_twcc_period(void);
+/*! \brief Method to modify the size of the pool of outgoing packets buffers
+ * @param[in] size The new maximum number of pooled buffers (0 to disable the pool) */
+void janus_set_packet_pool_size(uint size);
+/*! \brief Method to get the current size of the pool of outgoing packets buffers (see above)
+ * @returns The current maximum number of pooled buffers */
+uint janus_get_packet_pool_size(void);
+/*! \brief Method to get a summary of the pool of outgoing packet buffers (size, hits, misses)
+ * @returns A pointer to a JSON object containing the pool info */
+json_t *janus_ice_packet_pool_summary(void);
+/*! \brief Method to modify how many outgoing packets can be batched in a single send
+ * @param[in] packets The new maximum number of packets per batch (0 or 1 to disable batching) */
+void janus_set_egress_batch(uint packets);
+/*! \brief Method to get the current egress batching size (see above)
+ * @returns The current maximum number of packets per batch */
+uint janus_get_egress_batch(void);
+/*! \brief Method to get a summary of the egress batching (size, batches, average packets per batch)
+ * @returns A pointer to a JSON object containing the batching info */
+json_t *janus_ice_egress_batch_summary(void);
+/*! \brief Method to modify how many incoming RTP packets can be passed to plugins in a single call
+ * \note This only affects plugins that implement \c incoming_rtp_batch
+ * @param[in] packets The new maximum number of packets per batch (0 or 1 to disable batching) */
+void janus_set_incoming_batch(uint packets);
+/*! \brief Method to get the current incoming batching size (see above)
+ * @returns The current maximum number of packets per batch */
+uint janus_get_incoming_batch(void);
+/*! \brief Method to get a summary of the incoming batching (size, batches, average packets per batch)
+ * @returns A pointer to a JSON object containing the batching info */
+json_t *janus_ice_incoming_batch_summary(void);
+/*! \brief Method to enable or disable the pacing of outgoing video
+ * @param[in] enabled Whether video packets plugins send should be paced
+ * @param[in] burst How many milliseconds worth of data can be sent in a single burst
+ * @param[in] factor Pacing rate, as a percentage of the bitrate we estimate for the peer
+ * @param[in] max_delay Maximum time, in milliseconds, a packet can wait in the pacer */
+void janus_set_pacing(gboolean enabled, uint burst, uint factor, uint max_delay);
+/*! \brief Method to check whether outgoing video is paced
+ * @returns TRUE if it is, FALSE otherwise */
+gboolean janus_is_pacing_enabled(void);
+/*! \brief Method to get a summary of the pacing settings (burst, factor, max delay)
+ * @returns A pointer to a JSON object containing the pacing info */
+json_t *janus_ice_pacing_summary(void);
+/*! \brief Method to enable or disable RED and ULPFEC on the sendonly m-lines of the offers Janus sends
+ * @param[in] enabled Whether RED and ULPFEC should be offered (and generated, if the peer accepts) */
+void janus_set_fec(gboolean enabled);
+/*! \brief Method to check whether RED and ULPFEC are offered
+ * @returns TRUE if they are, FALSE otherwise */
+gboolean janus_is_fec_enabled(void);
+/*! \brief Method to modify how often RTP packets are sampled for the latency histograms
+ * @param[in] rate Sample one packet out of \c rate (0 disables the histograms) */
+void janus_set_latency_sampling(uint rate);
+/*! \brief Method to get the current latency sampling rate (see above)
+ * @returns The current sampling rate, or 0 if disabled */
+uint janus_get_latency_sampling(void);
 /*! \brief Method to modify the DSCP value to set, which is disabled by default
  * @param[in] dscp The new DSCP value (0 to disable) */
 void janus_set_dscp(int dscp);
@@ -164,6 +251,14 @@ void janus_ice_set_event_stats_period(int period);
 /*! \brief Method to get the current event handler statistics period (see above)
  * @returns The current event handler stats period */
 int janus_ice_get_event_stats_period(void);
+/*! \brief Method to have media statistics for event handlers rolled up in periodic summaries, rather than sent per handle
+ * @param[in] summary Whether summaries should be used
+ * @param[in] loss_threshold Packet loss (percentage) that, once crossed, triggers a per-handle event anyway (0 to disable)
+ * @param[in] rtt_threshold RTT (milliseconds) that, once crossed, triggers a per-handle event anyway (0 to disable) */
+void janus_ice_set_event_stats_summary(gboolean summary, int loss_threshold, int rtt_threshold);
+/*! \brief Method to check whether media statistics are rolled up in periodic summaries (see above)
+ * @returns TRUE if summaries are used, FALSE otherwise */
+gboolean janus_ice_is_event_stats_summary(void);
 /*! \brief Method to check whether libnice debugging has been enabled (http://nice.freedesktop.org/libnice/libnice-Debug-messages.html)
  * @returns True if libnice debugging is enabled, FALSE otherwise */
 gboolean janus_ice_is_ice_debugging_enabled(void);
@@ -176,6 +271,11 @@ void janus_enable_opaqueid_in_api(void);
 /*! \brief Method to check whether opaque ID have to be added to Janus API responses/events
  * @returns TRUE if they need to be present, FALSE otherwise */
 gboolean janus_is_opaqueid_in_api_enabled(void);
+/*! \brief Method to let handles ask for a dedicated event loop (and thread) when attaching, even when static event loops are in use */
+void janus_ice_allow_dedicated_loops(void);
+/*! \brief Method to check whether handles can ask for a dedicated event loop when attaching
+ * @returns TRUE if they can, FALSE otherwise */
+gboolean janus_ice_is_dedicated_loops_allowed(void);
 
 
 /*! \brief Helper method to get a string representation of a libnice ICE state
@@ -192,6 +292,8 @@ typedef struct janus_ice_stream janus_ice_stream;
 typedef struct janus_ice_component janus_ice_component;
 /*! \brief Helper to handle pending trickle candidates (e.g., when we're still waiting for an offer) */
 typedef struct janus_ice_trickle janus_ice_trickle;
+/*! \brief Incoming RTP packets waiting to be passed to a plugin in a single call */
+typedef struct janus_ice_incoming_batch janus_ice_incoming_batch;
 
 #define JANUS_ICE_HANDLE_WEBRTC_PROCESSING_OFFER	(1 << 0)
 #define JANUS_ICE_HANDLE_WEBRTC_START				(1 << 1)
@@ -233,6 +335,71 @@ typedef struct janus_ice_stats_info {
 	guint32 nacks;
 } janus_ice_stats_info;
 
+/*! \brief Number of buckets in a janus_ice_latency_histogram */
+#define JANUS_ICE_LATENCY_BUCKETS	21
+/*! \brief Log2-bucketed histogram of latencies on the media path
+ * \note Bucket \c n counts samples between 2^(n-1) (included) and 2^n (excluded)
+ * microseconds, with bucket 0 for samples below 1us and the last one also
+ * counting anything that exceeds its range (i.e., more than ~0.5s) */
+typedef struct janus_ice_latency_histogram {
+	/*! \brief Samples per bucket */
+	guint32 buckets[JANUS_ICE_LATENCY_BUCKETS];
+	/*! \brief Number of samples */
+	guint64 count;
+	/*! \brief Sum of all samples, in microseconds */
+	guint64 sum;
+	/*! \brief Highest sample, in microseconds */
+	gint64 max;
+} janus_ice_latency_histogram;
+/*! \brief Points of the media path we can collect latency samples for */
+typedef enum janus_ice_latency_type {
+	/*! \brief SRTP unprotect of incoming RTP packets */
+	JANUS_ICE_LATENCY_UNPROTECT = 0,
+	/*! \brief Plugin incoming_rtp callback */
+	JANUS_ICE_LATENCY_PLUGIN,
+	/*! \brief Time outgoing packets spent in the queue to the handle loop */
+	JANUS_ICE_LATENCY_QUEUE,
+	/*! \brief SRTP protect of outgoing RTP packets, and the send itself */
+	JANUS_ICE_LATENCY_SEND,
+	JANUS_ICE_LATENCY_TYPES
+} janus_ice_latency_type;
+
+/*! \brief Method to get a summary of a set of latency histograms (count, average, max and percentiles)
+ * @param[in] latency Array of JANUS_ICE_LATENCY_TYPES histograms
+ * @returns A pointer to a JSON object containing the latency info */
+json_t *janus_ice_latency_summary(janus_ice_latency_histogram *latency);
+
+/*! \brief Leaky bucket smoothing the video a component sends, when pacing is enabled
+ * \note This is only accessed by the loop serving the handle: packets that
+ * find the bucket empty are queued, and a timer sends them as tokens come in */
+typedef struct janus_ice_pacer {
+	/*! \brief Video packets waiting to be sent, in order */
+	GQueue queue;
+	/*! \brief Bytes we can still send right now (negative if we're in debt) */
+	gint64 tokens;
+	/*! \brief Monotonic time of when the tokens were last refilled */
+	gint64 updated;
+	/*! \brief Latest REMB the peer sent us, if any */
+	guint32 remb;
+	/*! \brief Current pacing rate, in bits per second */
+	guint32 rate;
+	/*! \brief Timer draining the queue, when there's something in it */
+	GSource *timer;
+	/*! \brief Number of packets that had to wait, and how many of them were sent because they had waited too much */
+	guint64 paced, forced;
+	/*! \brief Sum and maximum of the time packets waited, in microseconds */
+	guint64 delay_sum;
+	gint64 delay_max;
+	/*! \brief Maximum number of packets that were in the queue at the same time */
+	guint queue_max;
+	/*! \brief Memory account of the handle, for the packets in the queue */
+	janus_memory_account *account;
+} janus_ice_pacer;
+/*! \brief Method to get a summary of the pacer of a component
+ * @param[in] pacer The janus_ice_pacer instance
+ * @returns A pointer to a JSON object containing the pacer info */
+json_t *janus_ice_pacer_summary(janus_ice_pacer *pacer);
+
 /*! \brief Janus media statistics container
  * \note To improve with more stuff */
 typedef struct janus_ice_stats {
@@ -246,8 +413,27 @@ typedef struct janus_ice_stats {
 	guint sl_lost_count_audio;
 	/*! \brief Last known count of lost video packets (for slow_link) */
 	guint sl_lost_count_video;
+	/*! \brief Totals (all media) already added to the core metrics */
+	guint64 metrics_packets, metrics_bytes, metrics_nacks;
 } janus_ice_stats;
 
+/*! \brief Lightweight summary of the traffic of a handle
+ * \note This is refreshed by the loop of the handle once per second, and has
+ * its own lock, so that monitoring tools can poll it (e.g., with the Admin API
+ * \c handles_summary request) without touching the locks of the media path */
+typedef struct janus_ice_handle_snapshot {
+	/*! \brief Monotonic time of the last update (0 if the PeerConnection was never up) */
+	gint64 updated;
+	/*! \brief Packets received and sent so far (all media) */
+	guint64 packets_in, packets_out;
+	/*! \brief Bytes received and sent so far (all media) */
+	guint64 bytes_in, bytes_out;
+	/*! \brief NACKs received and sent so far */
+	guint64 nacks_in, nacks_out;
+	/*! \brief Audio and video bytes received and sent in the last second */
+	guint32 bytes_lastsec_in, bytes_lastsec_out;
+} janus_ice_handle_snapshot;
+
 /*! \brief Quick helper method to notify a WebRTC hangup through the Janus API
  * @param handle The janus_ice_handle instance this event refers to
  * @param reason A description of why this happened */
@@ -276,6 +462,29 @@ enum {
 	SEQ_RECVED
 };
 
+/*! \brief Slot of a janus_ice_retransmit_buffer */
+typedef struct janus_ice_retransmit_slot {
+	/*! \brief Packet stored in this slot, if any */
+	janus_rtp_packet *packet;
+	/*! \brief Sequence number of the stored packet */
+	guint16 seq;
+} janus_ice_retransmit_slot;
+/*! \brief Fixed-capacity ring of previously sent RTP packets, in case we receive NACKs
+ * @note Packets are indexed by their sequence number modulo the capacity (which
+ * is a power of two), so lookups and expiry don't need any hashing: a newer
+ * packet mapping to an occupied slot simply evicts the older one there */
+typedef struct janus_ice_retransmit_buffer {
+	/*! \brief Array of slots */
+	janus_ice_retransmit_slot *slots;
+	/*! \brief Capacity of the ring minus one, used to map sequence numbers to slots */
+	guint16 mask;
+	/*! \brief Sequence numbers of the oldest and newest packets in the ring */
+	guint16 first, last;
+	/*! \brief Number of packets currently in the ring */
+	guint count;
+	/*! \brief Memory account of the handle, for the ring and the packets in it */
+	janus_memory_account *account;
+} janus_ice_retransmit_buffer;
 
 /*! \brief Janus ICE handle */
 struct janus_ice_handle {
@@ -303,6 +512,12 @@ struct janus_ice_handle {
 	GMainLoop *mainloop;
 	/*! \brief GLib thread for the handle and libnice */
 	GThread *thread;
+	/*! \brief Opaque pointer to the static event loop serving this handle, if static loops are enabled */
+	void *static_loop;
+	/*! \brief Whether this handle asked for a loop and thread of its own, even if static loops are enabled */
+	gboolean dedicated_loop;
+	/*! \brief Opaque pointer to the static event loop this handle has been asked to migrate to, if any */
+	void *static_loop_target;
 	/*! \brief GLib sources for outgoing traffic, recurring RTCP, and stats (and optionally TWCC) */
 	GSource *rtp_source, *rtcp_source, *stats_source, *twcc_source;
 	/*! \brief libnice ICE agent */
@@ -335,36 +550,57 @@ struct janus_ice_handle {
 	GList *pending_trickles;
 	/*! \brief Queue of remote candidates that still need to be processed */
 	GAsyncQueue *queued_candidates;
-	/*! \brief Queue of events in the loop and outgoing packets to send */
+	/*! \brief Queue of events in the loop and outgoing retransmissions to send */
 	GAsyncQueue *queued_packets;
+	/*! \brief Lock-free list of outgoing media packets to send (opaque, newest first) */
+	void *queued_media;
 	/*! \brief Count of the recent SRTP replay errors, in order to avoid spamming the logs */
 	guint srtp_errors_count;
 	/*! \brief Count of the recent SRTP replay errors, in order to avoid spamming the logs */
 	gint last_srtp_error, last_srtp_summary;
 	/*! \brief Count of how many seconds passed since the last stats passed to event handlers */
 	gint last_event_stats;
+	/*! \brief When the stats timer last fired, to measure how late the loop of the handle is */
+	gint64 last_stats_tick;
 	/*! \brief Flag to decide whether or not packets need to be dumped to a text2pcap file */
 	volatile gint dump_packets;
 	/*! \brief In case this session must be saved to text2pcap, the instance to dump packets to */
 	janus_text2pcap *text2pcap;
 	/*! \brief Mutex to lock/unlock the ICE session */
 	janus_mutex mutex;
+	/*! \brief Summary of the traffic, for monitoring purposes */
+	janus_ice_handle_snapshot snapshot;
+	/*! \brief Mutex to lock/unlock the summary (only held to copy it) */
+	janus_mutex snapshot_mutex;
 	/*! \brief Whether a close_pc was requested recently on the PeerConnection */
 	volatile gint closepc;
+	/*! \brief How many bytes of data channel messages are queued in the SCTP association, waiting to be sent */
+	volatile gint data_pending;
+	/*! \brief Memory the core and the plugin are using on behalf of this handle */
+	janus_memory_account memory;
+	/*! \brief Incoming RTP packets waiting to be passed to the plugin, if it takes them in batches */
+	janus_ice_incoming_batch *incoming_batch;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
 	volatile gint destroyed;
 	/*! \brief Reference counter for this instance */
 	janus_refcount ref;
 };
 
+/*! \brief Size of a cache line, to keep fields that different threads write apart
+ * \note This is used as padding rather than as an alignment, since instances
+ * are allocated with g_malloc0 and so aren't aligned to cache lines anyway */
+#define JANUS_ICE_CACHELINE_SIZE	64
+
 /*! \brief Janus ICE stream */
 struct janus_ice_stream {
+	/* Negotiated when the PeerConnection is set up, and then only read, also by
+	 * the plugin threads relaying media to this stream (janus_ice_relay_rtp) */
 	/*! \brief Janus ICE handle this stream belongs to */
 	janus_ice_handle *handle;
 	/*! \brief libnice ICE stream ID */
 	guint stream_id;
-	/*! \brief Whether this stream is ready to be used */
-	gint cdone:1;
+	/*! \brief ICE component */
+	janus_ice_component *component;
 	/*! \brief Audio SSRC of the server for this stream */
 	guint32 audio_ssrc;
 	/*! \brief Video SSRC of the server for this stream */
@@ -377,12 +613,6 @@ struct janus_ice_stream {
 	guint32 video_ssrc_peer[3], video_ssrc_peer_new[3], video_ssrc_peer_orig[3], video_ssrc_peer_temp;
 	/*! \brief Video retransmissions SSRC(s) of the peer for this stream */
 	guint32 video_ssrc_peer_rtx[3], video_ssrc_peer_rtx_new[3], video_ssrc_peer_rtx_orig[3];
-	/*! \brief Array of RTP Stream IDs (for Firefox simulcasting, if enabled) */
-	char *rid[3];
-	/*! \brief Whether we should use the legacy simulcast syntax (a=simulcast:recv rid=..) or the proper one (a=simulcast:recv ..) */
-	gboolean legacy_rid;
-	/*! \brief RTP switching context(s) in case of renegotiations (audio+video and/or simulcast) */
-	janus_rtp_switching_context rtp_ctx[3];
 	/*! \brief List of payload types we can expect for audio */
 	GList *audio_payload_types;
 	/*! \brief List of payload types we can expect for video */
@@ -393,38 +623,14 @@ struct janus_ice_stream {
 	GHashTable *clock_rates;
 	/*! \brief RTP payload types of this stream */
 	gint audio_payload_type, video_payload_type, video_rtx_payload_type;
+	/*! \brief RED and ULPFEC payload types we offered, if any */
+	gint audio_red_pt, video_red_pt, video_ulpfec_pt;
 	/*! \brief Codecs used by this stream */
 	char *audio_codec, *video_codec;
 	/*! \brief Pointer to function to check if a packet is a keyframe (depends on negotiated codec) */
 	gboolean (* video_is_keyframe)(const char* buffer, int len);
 	/*! \brief Media direction */
 	gboolean audio_send, audio_recv, video_send, video_recv;
-	/*! \brief RTCP context for the audio stream */
-	janus_rtcp_context *audio_rtcp_ctx;
-	/*! \brief RTCP context(s) for the video stream (may be simulcasting) */
-	janus_rtcp_context *video_rtcp_ctx[3];
-	/*! \brief Size of the NACK queue (in ms), dynamically updated per the RTT */
-	uint16_t nack_queue_ms;
-	/*! \brief Map(s) of the NACKed packets (to track retransmissions and avoid duplicates) */
-	GHashTable *rtx_nacked[3];
-	/*! \brief Map of the pending NACKed cleanup callback */
-	GHashTable *pending_nacked_cleanup;
-	/*! \brief First received audio NTP timestamp */
-	gint64 audio_first_ntp_ts;
-	/*! \brief First received audio RTP timestamp */
-	guint32 audio_first_rtp_ts;
-	/*! \brief First received video NTP timestamp (for all simulcast video streams) */
-	gint64 video_first_ntp_ts[3];
-	/*! \brief First received video NTP RTP timestamp (for all simulcast video streams) */
-	guint32 video_first_rtp_ts[3];
-	/*! \brief Last sent audio NTP timestamp */
-	gint64 audio_last_ntp_ts;
-	/*! \brief Last sent audio RTP timestamp */
-	guint32 audio_last_rtp_ts;
-	/*! \brief Last sent video NTP timestamp */
-	gint64 video_last_ntp_ts;
-	/*! \brief Last sent video RTP timestamp */
-	guint32 video_last_rtp_ts;
 	/*! \brief SDES mid RTP extension ID */
 	gint mid_ext_id;
 	/*! \brief RTP Stream extension ID, and the related rtx one */
@@ -439,18 +645,65 @@ struct janus_ice_stream {
 	gboolean do_transport_wide_cc;
 	/*! \brief Transport wide cc rtp ext ID */
 	gint transport_wide_cc_ext_id;
+	/*! \brief Padding, so that the fields above and below never share a cache line */
+	char padding_relay[JANUS_ICE_CACHELINE_SIZE];
+	/* Updated by the loop of the handle for (almost) every packet */
+	/*! \brief RTP switching context(s) in case of renegotiations (audio+video and/or simulcast) */
+	janus_rtp_switching_context rtp_ctx[3];
+	/*! \brief RED and ULPFEC state, once the peer answered an offer that had them */
+	janus_fec_context *fec;
+	/*! \brief RTCP context for the audio stream */
+	janus_rtcp_context *audio_rtcp_ctx;
+	/*! \brief RTCP context(s) for the video stream (may be simulcasting) */
+	janus_rtcp_context *video_rtcp_ctx[3];
+	/*! \brief Size of the NACK queue (in ms), dynamically updated per the RTT */
+	uint16_t nack_queue_ms;
+	/*! \brief Map(s) of the NACKed packets (to track retransmissions and avoid duplicates) */
+	GHashTable *rtx_nacked[3];
 	/*! \brief Last sent transport wide seq num */
 	guint16 transport_wide_cc_out_seq_num;
+	/*! \brief Transport wide cc transport seq num wrap cycles */
+	guint16 transport_wide_cc_cycles;
 	/*! \brief Last received transport wide seq num */
 	guint32 transport_wide_cc_last_seq_num;
 	/*! \brief Last transport wide seq num sent on feedback */
 	guint32 transport_wide_cc_last_feedback_seq_num;
-	/*! \brief Transport wide cc transport seq num wrap cycles */
-	guint16 transport_wide_cc_cycles;
 	/*! \brief Transport wide cc rtp ext ID */
 	guint transport_wide_cc_feedback_count;
-	/*! \brief GLib list of transport wide cc stats in reverse received order */
-	GSList *transport_wide_received_seq_nums;
+	/*! \brief Ring of arrival times of the packets that still have to be reported, indexed by
+	 * (extended) transport wide seq num, with 0 for packets that weren't received */
+	guint64 *transport_wide_received_times;
+	/*! \brief First and highest transport wide seq num that still have to be reported */
+	guint32 transport_wide_cc_first_seq_num, transport_wide_cc_highest_seq_num;
+	/*! \brief Whether there's anything to report in the next feedback */
+	gboolean transport_wide_cc_pending;
+	/*! \brief First received audio NTP timestamp */
+	gint64 audio_first_ntp_ts;
+	/*! \brief First received video NTP timestamp (for all simulcast video streams) */
+	gint64 video_first_ntp_ts[3];
+	/*! \brief Last sent audio NTP timestamp */
+	gint64 audio_last_ntp_ts;
+	/*! \brief Last sent video NTP timestamp */
+	gint64 video_last_ntp_ts;
+	/*! \brief First received audio RTP timestamp */
+	guint32 audio_first_rtp_ts;
+	/*! \brief First received video NTP RTP timestamp (for all simulcast video streams) */
+	guint32 video_first_rtp_ts[3];
+	/*! \brief Last sent audio RTP timestamp */
+	guint32 audio_last_rtp_ts;
+	/*! \brief Last sent video RTP timestamp */
+	guint32 video_last_rtp_ts;
+	/*! \brief Padding, so that the fields above and below never share a cache line */
+	char padding_media[JANUS_ICE_CACHELINE_SIZE];
+	/* Setup, signalling and lifecycle */
+	/*! \brief Whether this stream is ready to be used */
+	gint cdone:1;
+	/*! \brief Array of RTP Stream IDs (for Firefox simulcasting, if enabled) */
+	char *rid[3];
+	/*! \brief Whether we should use the legacy simulcast syntax (a=simulcast:recv rid=..) or the proper one (a=simulcast:recv ..) */
+	gboolean legacy_rid;
+	/*! \brief Map of the pending NACKed cleanup callback */
+	GHashTable *pending_nacked_cleanup;
 	/*! \brief DTLS role of the server for this stream */
 	janus_dtls_role dtls_role;
 	/*! \brief Hashing algorhitm used by the peer for the DTLS certificate (e.g., "SHA-256") */
@@ -463,8 +716,6 @@ struct janus_ice_stream {
 	gchar *rpass;
 	/*! \brief GLib hash table of components (IDs are the keys) */
 	GHashTable *components;
-	/*! \brief ICE component */
-	janus_ice_component *component;
 	/*! \brief Helper flag to avoid flooding the console with the same error all over again */
 	gboolean noerrorlog;
 	/*! \brief Mutex to lock/unlock this stream */
@@ -478,8 +729,36 @@ struct janus_ice_stream {
 #define LAST_SEQS_MAX_LEN 160
 /*! \brief Janus ICE component */
 struct janus_ice_component {
+	/* Used by the loop of the handle for every packet it sends or receives */
 	/*! \brief Janus ICE stream this component belongs to */
 	janus_ice_stream *stream;
+	/*! \brief DTLS-SRTP stack */
+	janus_dtls_srtp *dtls;
+	/*! \brief Shared port this component uses, if any (in that case, libnice is only used for the credentials) */
+	struct janus_ice_mux_peer *mux;
+	/*! \brief Whether we should do NACKs (in or out) for audio */
+	gboolean do_audio_nacks;
+	/*! \brief Whether we should do NACKs (in or out) for video */
+	gboolean do_video_nacks;
+	/*! \brief Rings of previously sent janus_rtp_packet RTP packets, in case we receive NACKs */
+	janus_ice_retransmit_buffer *audio_retransmit_buffer, *video_retransmit_buffer;
+	/*! \brief Current sequence number for the RFC4588 rtx SSRC session */
+	guint16 rtx_seq_number;
+	/*! \brief Number of SRTP/SRTCP packets protected and unprotected for this component */
+	guint64 srtp_protected, srtp_unprotected;
+	/*! \brief List of recently received audio sequence numbers (as a support to NACK generation) */
+	janus_seq_info *last_seqs_audio;
+	/*! \brief List of recently received video sequence numbers (as a support to NACK generation, for each simulcast SSRC) */
+	janus_seq_info *last_seqs_video[3];
+	/*! \brief Counters of incoming and outgoing RTP packets, used for sampling latencies */
+	guint latency_in_count, latency_out_count;
+	/*! \brief Stats for incoming data (audio/video/data) */
+	janus_ice_stats in_stats;
+	/*! \brief Stats for outgoing data (audio/video/data) */
+	janus_ice_stats out_stats;
+	/*! \brief Pacer for the outgoing video, if pacing is enabled */
+	janus_ice_pacer pacer;
+	/* ICE and DTLS setup, logging, and lifecycle */
 	/*! \brief libnice ICE stream ID */
 	guint stream_id;
 	/*! \brief libnice ICE component ID */
@@ -504,18 +783,6 @@ struct janus_ice_component {
 	gint64 icefailed_detected;
 	/*! \brief Re-transmission timer for DTLS */
 	GSource *dtlsrt_source;
-	/*! \brief DTLS-SRTP stack */
-	janus_dtls_srtp *dtls;
-	/*! \brief Whether we should do NACKs (in or out) for audio */
-	gboolean do_audio_nacks;
-	/*! \brief Whether we should do NACKs (in or out) for video */
-	gboolean do_video_nacks;
-	/*! \brief List of previously sent janus_rtp_packet RTP packets, in case we receive NACKs */
-	GQueue *audio_retransmit_buffer, *video_retransmit_buffer;
-	/*! \brief HashTable of retransmittable sequence numbers, in case we receive NACKs */
-	GHashTable *audio_retransmit_seqs, *video_retransmit_seqs;
-	/*! \brief Current sequence number for the RFC4588 rtx SSRC session */
-	guint16 rtx_seq_number;
 	/*! \brief Last time a log message about sending retransmits was printed */
 	gint64 retransmit_log_ts;
 	/*! \brief Number of retransmitted packets since last log message */
@@ -524,14 +791,8 @@ struct janus_ice_component {
 	gint64 nack_sent_log_ts;
 	/*! \brief Number of NACKs sent since last log message */
 	guint nack_sent_recent_cnt;
-	/*! \brief List of recently received audio sequence numbers (as a support to NACK generation) */
-	janus_seq_info *last_seqs_audio;
-	/*! \brief List of recently received video sequence numbers (as a support to NACK generation, for each simulcast SSRC) */
-	janus_seq_info *last_seqs_video[3];
-	/*! \brief Stats for incoming data (audio/video/data) */
-	janus_ice_stats in_stats;
-	/*! \brief Stats for outgoing data (audio/video/data) */
-	janus_ice_stats out_stats;
+	/*! \brief Latency histograms for the media path of this component, if sampling is enabled */
+	janus_ice_latency_histogram latency[JANUS_ICE_LATENCY_TYPES];
 	/*! \brief Helper flag to avoid flooding the console with the same error all over again */
 	gboolean noerrorlog;
 	/*! \brief Mutex to lock/unlock this component */
@@ -599,6 +860,11 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle);
  * @param[in] handle The Janus ICE handle instance managing the WebRTC PeerConnection to hangup
  * @param[in] reason A description of why this happened */
 void janus_ice_webrtc_hangup(janus_ice_handle *handle, const char *reason);
+/*! \brief Method to get a copy of the traffic summary of a Janus ICE handle
+ * \note This only takes the lock of the summary, never the locks of the handle or its media
+ * @param[in] handle The Janus ICE handle instance to get the summary of
+ * @param[out] snapshot Where to copy the summary to */
+void janus_ice_handle_get_snapshot(janus_ice_handle *handle, janus_ice_handle_snapshot *snapshot);
 /*! \brief Method to only free resources related to a specific ICE stream allocated by a Janus ICE handle
  * @param[in] stream The Janus ICE stream instance to free */
 void janus_ice_stream_destroy(janus_ice_stream *stream);
@@ -615,6 +881,12 @@ void janus_ice_component_destroy(janus_ice_component *component);
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] packet The RTP packet to send */
 void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet);
+/*! \brief Core RTP callback, called when a plugin has an RTP packet with a shared payload to send to a peer
+ * @note The payload is only copied when the packet is actually encrypted and sent
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] packet The RTP packet to send (only the header is used)
+ * @param[in] payload The shared RTP payload */
+void janus_ice_relay_rtp_shared(janus_ice_handle *handle, janus_plugin_rtp *packet, janus_plugin_rtp_payload *payload);
 /*! \brief Core RTCP callback, called when a plugin has an RTCP message to send to a peer
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] packet The RTCP message to send */
@@ -623,6 +895,12 @@ void janus_ice_relay_rtcp(janus_ice_handle *handle, janus_plugin_rtcp *packet);
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] packet The message to send */
 void janus_ice_relay_data(janus_ice_handle *handle, janus_plugin_data *packet);
+/*! \brief Core SCTP/DataChannel callback, called when a plugin has a message with a shared content to send to a peer
+ * @note The content is never copied: it's passed as it is to the SCTP stack when the message is sent
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] packet The message to send (the buffer is ignored)
+ * @param[in] payload The shared message content */
+void janus_ice_relay_data_shared(janus_ice_handle *handle, janus_plugin_data *packet, janus_plugin_rtp_payload *payload);
 /*! \brief Helper core callback, called when a plugin wants to send a RTCP PLI to a peer
  * @param[in] handle The Janus ICE handle associated with the peer */
 void janus_ice_send_pli(janus_ice_handle *handle);
@@ -695,11 +973,54 @@ void janus_ice_resend_trickles(janus_ice_handle *handle);
  * for an explanation of this feature, and the possible impact on Janus and users
  * @param[in] loops The number of static event loops to start (0 to disable the feature) */
 void janus_ice_set_static_event_loops(int loops);
+/*! \brief Method to configure the static event loops mechanism at startup, sizing the pool automatically
+ * \details This starts a loop per CPU core, and adds more (up to \c max) when all of them
+ * are busy: the loops added this way are stopped when they haven't served any handle for a while
+ * @param[in] max The maximum number of loops (0 means twice the number of cores) */
+void janus_ice_set_static_event_loops_auto(int max);
 /*! \brief Method to return the number of static event loops, if enabled
  * @returns The number of static event loops, if configured, or 0 if the feature is disabled */
 int janus_ice_get_static_event_loops(void);
+/*! \brief Method to configure the CPU sets the static event loop threads should be pinned to
+ * @note Must be called before janus_ice_set_static_event_loops. Check the \c event_loops_affinity
+ * property in the \c janus.jcfg configuration for the syntax of the CPU sets
+ * @param[in] affinity Semicolon separated list of CPU sets, assigned to loops in order */
+void janus_ice_set_static_event_loops_affinity(const char *affinity);
 /*! \brief Method to stop all the static event loops, if enabled
  * @note This will wait for the related threads to exit, and so may delay the shutdown process */
 void janus_ice_stop_static_event_loops(void);
+/*! \brief Method to get a summary of the static event loops and their load, if enabled
+ * @note The load of each loop is updated once per second, and is expressed in
+ * microseconds per second the loop thread spent doing something other than waiting
+ * @returns A JSON array with one object per static event loop (empty if the feature is disabled) */
+json_t *janus_ice_static_event_loops_info(void);
+/*! \brief Helper to append the load of the static event loops to the core metrics (OpenMetrics text format)
+ * @param[in] text The buffer to append to */
+void janus_ice_static_event_loops_metrics(GString *text);
+/*! \brief Method to collect the signals the core overload protection is based on
+ * \details Loops are expected to run their timers on time, and packets to leave
+ * the queues to the loops soon after they're added: on a saturated machine neither
+ * happens. The media path keeps track of the worst event loop lag (how late the
+ * periodic timers of static loops and handle threads fired), the worst residency
+ * of outgoing packets in the queues to the handle loops, and the deepest of those
+ * queues, as seen since the last time this method was called, which resets them.
+ * @note This is meant to be called once per second by the core
+ * @param[out] lag Highest event loop lag, in microseconds
+ * @param[out] residency Highest time an outgoing packet waited in a queue, in microseconds
+ * @param[out] depth Highest number of packets waiting in the queue of a handle */
+void janus_ice_overload_collect(guint *lag, guint *residency, guint *depth);
+/*! \brief Method to return the identifier of the static event loop a handle is assigned to
+ * @param[in] handle The Janus ICE handle to check
+ * @returns The loop identifier, or -1 if the handle isn't served by a static event loop */
+int janus_ice_get_static_event_loop_id(janus_ice_handle *handle);
+/*! \brief Method to move a handle to a different static event loop at runtime
+ * @note The migration is performed asynchronously by the loop currently serving the
+ * handle, and only for handles with an established PeerConnection: in case the
+ * PeerConnection is in a state that can't be moved, the request is ignored
+ * @param[in] handle The Janus ICE handle to migrate
+ * @param[in] id The identifier of the static event loop to move the handle to
+ * @returns 0 if the migration was scheduled (or the handle is already there), -1 if the
+ * loop doesn't exist or static loops are disabled, -2 if there's no PeerConnection to migrate */
+int janus_ice_handle_migrate(janus_ice_handle *handle, int id);
 
 #endif
@@ -23,6 +23,8 @@
 #include <glib.h>
 
 #include "ip-utils.h"
+#include "metrics.h"
+#include "mutex.h"
 
 static int janus_ip_compare_byte_arrays(const uint8_t *b1, const uint8_t *b2, const size_t size) {
 	size_t i;
@@ -321,3 +323,152 @@ char *janus_network_detect_local_ip_as_string(janus_network_query_options addr_t
 		return NULL;
 	return g_strdup(janus_network_address_string_from_buffer(&buf));
 }
+
+
+/* Port pools */
+struct janus_network_port_pool {
+	char *name;
+	uint16_t min, max;
+	/* Ring of the even ports of the free pairs */
+	uint16_t *free;
+	int pairs, head, count;
+	/* Which pairs were taken from this pool */
+	guint8 *taken;
+	volatile gint used;
+};
+/* Ports taken from any pool, one bit per pair */
+static guint32 ports_in_use[65536/64];
+static GList *port_pools = NULL;
+static janus_mutex port_pools_mutex = JANUS_MUTEX_INITIALIZER;
+
+#define janus_port_bit(port)		(((port) >> 1) & 31)
+#define janus_port_word(port)		((port) >> 6)
+#define janus_port_in_use(port)	(ports_in_use[janus_port_word(port)] & (1U << janus_port_bit(port)))
+
+janus_network_port_pool *janus_network_port_pool_new(const char *name, uint16_t min, uint16_t max) {
+	if(min % 2)
+		min++;	/* RTP goes on the even port */
+	if(min == 0 || max <= min)
+		return NULL;
+	janus_network_port_pool *pool = g_malloc0(sizeof(janus_network_port_pool));
+	pool->name = g_strdup(name ? name : "ports");
+	pool->min = min;
+	pool->max = max;
+	/* The RTCP port of the last pair must be in the range too */
+	pool->pairs = (max - min + 1) / 2;
+	pool->free = g_malloc(pool->pairs * sizeof(uint16_t));
+	pool->taken = g_malloc0(pool->pairs);
+	/* Start from a random pair, as the plugins used to: this makes reusing
+	 * the same ports right after a restart less likely */
+	int i = 0, start = g_random_int_range(0, pool->pairs);
+	for(i = 0; i < pool->pairs; i++)
+		pool->free[i] = min + 2 * ((start + i) % pool->pairs);
+	pool->count = pool->pairs;
+	janus_mutex_lock(&port_pools_mutex);
+	port_pools = g_list_append(port_pools, pool);
+	janus_mutex_unlock(&port_pools_mutex);
+	return pool;
+}
+
+void janus_network_port_pool_destroy(janus_network_port_pool *pool) {
+	if(pool == NULL)
+		return;
+	janus_mutex_lock(&port_pools_mutex);
+	port_pools = g_list_remove(port_pools, pool);
+	int i = 0;
+	for(i = 0; i < pool->pairs; i++) {
+		if(pool->taken[i]) {
+			uint16_t port = pool->min + 2 * i;
+			ports_in_use[janus_port_word(port)] &= ~(1U << janus_port_bit(port));
+		}
+	}
+	janus_mutex_unlock(&port_pools_mutex);
+	g_free(pool->name);
+	g_free(pool->free);
+	g_free(pool->taken);
+	g_free(pool);
+}
+
+int janus_network_port_pool_get(janus_network_port_pool *pool) {
+	if(pool == NULL)
+		return -1;
+	int port = -1;
+	janus_mutex_lock(&port_pools_mutex);
+	int left = pool->count;
+	while(left > 0) {
+		left--;
+		uint16_t candidate = pool->free[pool->head];
+		pool->head = (pool->head + 1) % pool->pairs;
+		if(janus_port_in_use(candidate)) {
+			/* Another pool with an overlapping range has it: keep it for later */
+			pool->free[(pool->head + pool->count - 1) % pool->pairs] = candidate;
+			continue;
+		}
+		pool->count--;
+		ports_in_use[janus_port_word(candidate)] |= (1U << janus_port_bit(candidate));
+		pool->taken[(candidate - pool->min) / 2] = 1;
+		g_atomic_int_inc(&pool->used);
+		port = candidate;
+		break;
+	}
+	janus_mutex_unlock(&port_pools_mutex);
+	return port;
+}
+
+void janus_network_port_pool_release(janus_network_port_pool *pool, int port) {
+	if(pool == NULL || port < pool->min || port > pool->max)
+		return;
+	port -= (port - pool->min) % 2;
+	int index = (port - pool->min) / 2;
+	if(index >= pool->pairs)
+		return;
+	janus_mutex_lock(&port_pools_mutex);
+	if(pool->taken[index]) {
+		pool->taken[index] = 0;
+		ports_in_use[janus_port_word(port)] &= ~(1U << janus_port_bit(port));
+		pool->free[(pool->head + pool->count) % pool->pairs] = port;
+		pool->count++;
+		g_atomic_int_add(&pool->used, -1);
+	}
+	janus_mutex_unlock(&port_pools_mutex);
+}
+
+void janus_network_port_pool_release_socket(janus_network_port_pool *pool, int fd) {
+	if(pool == NULL || fd < 0)
+		return;
+	struct sockaddr_storage address;
+	socklen_t len = sizeof(address);
+	if(getsockname(fd, (struct sockaddr *)&address, &len) < 0)
+		return;
+	if(address.ss_family == AF_INET)
+		janus_network_port_pool_release(pool, ntohs(((struct sockaddr_in *)&address)->sin_port));
+	else if(address.ss_family == AF_INET6)
+		janus_network_port_pool_release(pool, ntohs(((struct sockaddr_in6 *)&address)->sin6_port));
+}
+
+int janus_network_port_pool_size(janus_network_port_pool *pool) {
+	return pool ? pool->pairs : 0;
+}
+
+void janus_network_port_pools_metrics(GString *text) {
+	if(text == NULL)
+		return;
+	janus_mutex_lock(&port_pools_mutex);
+	if(port_pools != NULL) {
+		janus_metrics_append_family(text, "janus_port_pool_pairs", "gauge", "RTP/RTCP port pairs in the range of the pool");
+		GList *l = port_pools;
+		while(l) {
+			janus_network_port_pool *pool = (janus_network_port_pool *)l->data;
+			g_string_append_printf(text, "janus_port_pool_pairs{pool=\"%s\"} %d\n", pool->name, pool->pairs);
+			l = l->next;
+		}
+		janus_metrics_append_family(text, "janus_port_pool_pairs_used", "gauge", "RTP/RTCP port pairs currently taken from the pool");
+		l = port_pools;
+		while(l) {
+			janus_network_port_pool *pool = (janus_network_port_pool *)l->data;
+			g_string_append_printf(text, "janus_port_pool_pairs_used{pool=\"%s\"} %d\n", pool->name, g_atomic_int_get(&pool->used));
+			l = l->next;
+		}
+	}
+	janus_mutex_unlock(&port_pools_mutex);
+}
@@ -20,6 +20,8 @@
 #include <ifaddrs.h>
 #include <netinet/in.h>
 
+#include <glib.h>
+
 
 /** @name Janus helper methods to match names and addresses with network interfaces/devices.
  */
@@ -247,4 +249,69 @@ int janus_network_detect_local_ip(janus_network_query_options addr_type, janus_n
 char *janus_network_detect_local_ip_as_string(janus_network_query_options addr_type);
 ///@}
 
+/** @name Janus helper methods to allocate RTP/RTCP ports from a range.
+ */
+///@{
+/*!
+ * \brief Pool of even/odd (RTP/RTCP) port pairs in a range, e.g., the rtp_port_range of a plugin.
+ * \details Free pairs are kept in a FIFO, so that getting and releasing one doesn't
+ * depend on how many are in use, and ports that were just released are the last
+ * to be handed out again. All pools share which ports are in use, so that plugins
+ * with overlapping ranges don't get the same pair: since binding to the wildcard
+ * address conflicts with any specific address, that is tracked for all interfaces
+ * at once. Ports may still be in use by other applications, so binding can fail.
+ */
+typedef struct janus_network_port_pool janus_network_port_pool;
+
+/*!
+ * \brief Create a new pool of port pairs
+ * \param name Name of the pool, for the metrics (e.g., "sip")
+ * \param min The lowest port in the range (rounded up to an even port if needed)
+ * \param max The highest port in the range
+ * \return A new janus_network_port_pool instance, or NULL if the range is invalid
+ */
+janus_network_port_pool *janus_network_port_pool_new(const char *name, uint16_t min, uint16_t max);
+
+/*!
+ * \brief Destroy a pool, releasing any pair still taken from it
+ * \param pool The pool to destroy
+ */
+void janus_network_port_pool_destroy(janus_network_port_pool *pool);
+
+/*!
+ * \brief Take a free pair from a pool
+ * \param pool The pool to take the pair from
+ * \return The even (RTP) port of the pair, whose RTCP port is the next one, or -1 if there's none left
+ */
+int janus_network_port_pool_get(janus_network_port_pool *pool);
+
+/*!
+ * \brief Give a pair back to a pool, e.g., because binding failed or the sockets were closed
+ * \note Either port of the pair can be passed, and ports that weren't taken from this pool are ignored
+ * \param pool The pool to give the pair back to
+ * \param port One of the ports of the pair
+ */
+void janus_network_port_pool_release(janus_network_port_pool *pool, int port);
+
+/*!
+ * \brief Same as janus_network_port_pool_release, but with the port a socket is bound to
+ * \param pool The pool to give the pair back to
+ * \param fd The socket, which must still be open
+ */
+void janus_network_port_pool_release_socket(janus_network_port_pool *pool, int fd);
+
+/*!
+ * \brief Get how many pairs a pool has in total
+ * \param pool The pool to query
+ * \return The number of pairs in the range of the pool
+ */
+int janus_network_port_pool_size(janus_network_port_pool *pool);
+
+/*!
+ * \brief Helper to append how full each pool is, in the OpenMetrics text format
+ * \param text The buffer to append to
+ */
+void janus_network_port_pools_metrics(GString *text);
+///@}
+
 #endif
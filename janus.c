@@ -40,6 +40,8 @@
 #include "auth.h"
 #include "record.h"
 #include "events.h"
+#include "metrics.h"
+#include "memory.h"
 
 
 #define JANUS_NAME				"Janus WebRTC Server"
@@ -68,6 +70,8 @@ static GHashTable *loggers_so = NULL;
 
 static GHashTable *plugins = NULL;
 static GHashTable *plugins_so = NULL;
+/* Memory plugins account without a handle, created before they're initialized */
+static GHashTable *plugins_memory = NULL;
 
 
 /* Daemonization */
@@ -96,6 +100,7 @@ static struct janus_json_parameter incoming_request_parameters[] = {
 static struct janus_json_parameter attach_parameters[] = {
 	{"plugin", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"opaque_id", JSON_STRING, 0},
+	{"dedicated_loop", JANUS_JSON_BOOL, 0},
 };
 static struct janus_json_parameter body_parameters[] = {
 	{"body", JSON_OBJECT, JANUS_JSON_PARAM_REQUIRED}
@@ -123,6 +128,12 @@ static struct janus_json_parameter debug_parameters[] = {
 static struct janus_json_parameter timeout_parameters[] = {
 	{"timeout", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
 };
+static struct janus_json_parameter ls_parameters[] = {
+	{"latency_sampling", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
+};
+static struct janus_json_parameter loop_parameters[] = {
+	{"loop", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
+};
 static struct janus_json_parameter level_parameters[] = {
 	{"level", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
 };
@@ -167,11 +178,32 @@ static struct janus_json_parameter customlogline_parameters[] = {
 static struct janus_json_parameter text2pcap_parameters[] = {
 	{"folder", JSON_STRING, 0},
 	{"filename", JSON_STRING, 0},
-	{"truncate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+	{"truncate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"format", JSON_STRING, 0},
+	{"headers_only", JANUS_JSON_BOOL, 0},
+	{"window", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+static struct janus_json_parameter dumppcap_parameters[] = {
+	{"filename", JSON_STRING, 0}
 };
 static struct janus_json_parameter handleinfo_parameters[] = {
 	{"plugin_only", JANUS_JSON_BOOL, 0}
 };
+static struct janus_json_parameter handlessummary_parameters[] = {
+	{"after", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"fields", JSON_ARRAY, 0}
+};
+static struct janus_json_parameter memoryinfo_parameters[] = {
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+#ifdef JANUS_MUTEX_PROFILING
+static struct janus_json_parameter mutexprofile_parameters[] = {
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"sort", JSON_STRING, 0},
+	{"reset", JANUS_JSON_BOOL, 0}
+};
+#endif
 static struct janus_json_parameter resaddr_parameters[] = {
 	{"address", JSON_STRING, JANUS_JSON_PARAM_REQUIRED}
 };
@@ -224,6 +256,9 @@ static gint stop_signal = 0;
 gint janus_is_stopping(void) {
 	return g_atomic_int_get(&stop);
 }
+/* Whether startup is complete, and how long it took (in ms) */
+static volatile gint ready = 0;
+static gint64 startup_time = 0;
 static GMainLoop *mainloop = NULL;
 
 
@@ -264,6 +299,23 @@ static uint reclaim_session_timeout = DEFAULT_RECLAIM_SESSION_TIMEOUT;
  * server to grow too much, or because we're draining the server. */
 static gboolean accept_new_sessions = TRUE;
 
+/* Overload protection, if enabled: when the media path is lagging (event
+ * loops firing their timers late, packets waiting too long in the queues to
+ * the handle loops, or those queues growing too much) or requests pile up in
+ * the lanes, we stop accepting new sessions and handles and shed optional
+ * work (stats events and new recordings), until things settle down again */
+static guint overload_lag = 0, overload_queue_depth = 0;
+static gboolean overload_shed_recordings = TRUE;
+static volatile gint overloaded = 0;
+static int overload_hot = 0, overload_cool = 0;
+/* How many seconds in a row the signals need to be over (or under) the thresholds */
+#define JANUS_OVERLOAD_ENTER	2
+#define JANUS_OVERLOAD_LEAVE	10
+static void janus_overload_check(void);
+gboolean janus_is_overloaded(void) {
+	return g_atomic_int_get(&overloaded);
+}
+
 /* We don't hold (trickle) candidates indefinitely either: by default, we
  * only store them for 45 seconds. After that, they're discarded, in order
  * to avoid leaks or orphaned media details. This means that, if for instance
@@ -304,6 +356,8 @@ static json_t *janus_info(const char *transaction) {
 	json_object_set_new(info, "data_channels", json_false());
 #endif
 	json_object_set_new(info, "accepting-new-sessions", accept_new_sessions ? json_true() : json_false());
+	json_object_set_new(info, "overloaded", janus_is_overloaded() ? json_true() : json_false());
+	json_object_set_new(info, "ready", g_atomic_int_get(&ready) ? json_true() : json_false());
 	json_object_set_new(info, "session-timeout", json_integer(session_timeout));
 	json_object_set_new(info, "reclaim-session-timeout", json_integer(reclaim_session_timeout));
 	json_object_set_new(info, "candidates-timeout", json_integer(candidates_timeout));
@@ -528,6 +582,7 @@ gboolean janus_transport_is_api_secret_valid(janus_transport *plugin, const char
 gboolean janus_transport_is_auth_token_needed(janus_transport *plugin);
 gboolean janus_transport_is_auth_token_valid(janus_transport *plugin, const char *token);
 void janus_transport_notify_event(janus_transport *plugin, void *transport, json_t *event);
+char *janus_transport_get_metrics(janus_transport *plugin);
 
 static janus_transport_callbacks janus_handler_transport =
 	{
@@ -539,10 +594,25 @@ static janus_transport_callbacks janus_handler_transport =
 		.is_auth_token_valid = janus_transport_is_auth_token_valid,
 		.events_is_enabled = janus_events_is_enabled,
 		.notify_event = janus_transport_notify_event,
+		.get_metrics = janus_transport_get_metrics,
 	};
 static GAsyncQueue *requests = NULL;
 static janus_request exit_message;
-static GThreadPool *tasks = NULL;
+/* Requests are served in lanes: keepalives and trickles are handled right
+ * away by the requests thread, other core requests are served in order by
+ * a dedicated lane, while messages for plugins go to a pool per plugin, so
+ * that a plugin that is slow handling requests can't starve the others.
+ * When the queue of a lane is full, requests are rejected right away */
+typedef struct janus_request_lane {
+	char *name;
+	GThreadPool *pool;
+	volatile gint served, rejected;
+} janus_request_lane;
+static janus_request_lane *core_lane = NULL;
+static GHashTable *plugin_lanes = NULL;
+static janus_mutex lanes_mutex = JANUS_MUTEX_INITIALIZER;
+static int request_threads = 32, request_queue = 1024;
+static json_t *janus_request_lanes_info(void);
 void janus_transport_task(gpointer data, gpointer user_data);
 ///@}
 
@@ -554,40 +624,98 @@ void janus_transport_task(gpointer data, gpointer user_data);
  */
 ///@{
 int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep);
+int janus_plugin_push_event_shared(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, janus_plugin_event *event);
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart);
 void janus_plugin_relay_rtp(janus_plugin_session *plugin_session, janus_plugin_rtp *packet);
+void janus_plugin_relay_rtp_shared(janus_plugin_session *plugin_session, janus_plugin_rtp *packet, janus_plugin_rtp_payload *payload);
 void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, janus_plugin_rtcp *packet);
 void janus_plugin_relay_data(janus_plugin_session *plugin_session, janus_plugin_data *message);
+size_t janus_plugin_get_data_pending(janus_plugin_session *plugin_session);
 void janus_plugin_send_pli(janus_plugin_session *plugin_session);
 void janus_plugin_send_remb(janus_plugin_session *plugin_session, uint32_t bitrate);
 void janus_plugin_close_pc(janus_plugin_session *plugin_session);
 void janus_plugin_end_session(janus_plugin_session *plugin_session);
+gboolean janus_plugin_events_is_wanted(janus_plugin *plugin);
 void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugin_session, json_t *event);
 gboolean janus_plugin_auth_is_signature_valid(janus_plugin *plugin, const char *token);
 gboolean janus_plugin_auth_signature_contains(janus_plugin *plugin, const char *token, const char *desc);
+void janus_plugin_account_memory(janus_plugin *plugin, janus_plugin_session *plugin_session, int bytes);
+void janus_plugin_relay_data_shared(janus_plugin_session *plugin_session, janus_plugin_data *packet, janus_plugin_rtp_payload *payload);
 static janus_callbacks janus_handler_plugin =
 	{
 		.push_event = janus_plugin_push_event,
+		.push_event_shared = janus_plugin_push_event_shared,
 		.relay_rtp = janus_plugin_relay_rtp,
+		.relay_rtp_shared = janus_plugin_relay_rtp_shared,
 		.relay_rtcp = janus_plugin_relay_rtcp,
 		.relay_data = janus_plugin_relay_data,
+		.get_data_pending = janus_plugin_get_data_pending,
 		.send_pli = janus_plugin_send_pli,
 		.send_remb = janus_plugin_send_remb,
 		.close_pc = janus_plugin_close_pc,
 		.end_session = janus_plugin_end_session,
 		.events_is_enabled = janus_events_is_enabled,
+		.events_is_wanted = janus_plugin_events_is_wanted,
 		.notify_event = janus_plugin_notify_event,
 		.auth_is_signature_valid = janus_plugin_auth_is_signature_valid,
 		.auth_signature_contains = janus_plugin_auth_signature_contains,
+		.account_memory = janus_plugin_account_memory,
+		.relay_data_shared = janus_plugin_relay_data_shared,
 	};
 ///@}
 
 
-/* Core Sessions */
-static janus_mutex sessions_mutex;
-static GHashTable *sessions = NULL;
+/* Core Sessions: the table is split in shards, each with its own lock,
+ * so that lookups for different sessions don't contend with each other */
+#define JANUS_SESSIONS_SHARDS	64
+typedef struct janus_sessions_shard {
+	GHashTable *sessions;
+	janus_mutex mutex;
+} janus_sessions_shard;
+static janus_sessions_shard sessions_shards[JANUS_SESSIONS_SHARDS];
 static GMainContext *sessions_watchdog_context = NULL;
 
+static janus_sessions_shard *janus_sessions_shard_get(guint64 session_id) {
+	/* Session IDs can be chosen by applications, so mix the bits before picking a shard */
+	guint64 h = session_id * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+	return &sessions_shards[(h >> 32) % JANUS_SESSIONS_SHARDS];
+}
+
+static void janus_sessions_init(void) {
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		sessions_shards[i].sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
+		janus_mutex_init(&sessions_shards[i].mutex);
+	}
+}
+
+static void janus_sessions_deinit(void) {
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_mutex_lock(&sessions_shards[i].mutex);
+		g_clear_pointer(&sessions_shards[i].sessions, g_hash_table_destroy);
+		janus_mutex_unlock(&sessions_shards[i].mutex);
+	}
+}
+
+/* Removes a session from the table, unless the ID now belongs to a different session */
+static gboolean janus_sessions_remove(janus_session *session) {
+	janus_sessions_shard *shard = janus_sessions_shard_get(session->session_id);
+	gboolean removed = FALSE;
+	janus_mutex_lock(&shard->mutex);
+	if(shard->sessions != NULL && g_hash_table_lookup(shard->sessions, &session->session_id) == session)
+		removed = g_hash_table_remove(shard->sessions, &session->session_id);
+	janus_mutex_unlock(&shard->mutex);
+	return removed;
+}
+
+/* Session timeouts are tracked with a timer wheel, so that the watchdog
+ * only needs to look at the sessions that are due. Activity on a session
+ * doesn't touch the wheel: when a timer fires, the deadline is computed
+ * again from the last activity, and the session either expires or the
+ * timer is scheduled again. Scheduled timers hold a session reference. */
+static janus_timerwheel *sessions_wheel = NULL;
+
 
 static void janus_ice_handle_dereference(janus_ice_handle *handle) {
 	if(handle)
@@ -605,6 +733,7 @@ static void janus_session_free(const janus_refcount *session_ref) {
 		janus_request_destroy(session->source);
 		session->source = NULL;
 	}
+	janus_metrics_session_destroyed();
 	g_free(session);
 }
 
@@ -626,50 +755,90 @@ static void janus_request_unref(janus_request *request) {
 		janus_refcount_decrease(&request->ref);
 }
 
-static gboolean janus_check_sessions(gpointer user_data) {
-	if(session_timeout < 1 && reclaim_session_timeout < 1)		/* Session timeouts are disabled */
-		return G_SOURCE_CONTINUE;
-	janus_mutex_lock(&sessions_mutex);
-	if(sessions && g_hash_table_size(sessions) > 0) {
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, sessions);
-		while (g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_session *session = (janus_session *) value;
-			if (!session || g_atomic_int_get(&session->destroyed)) {
-				continue;
-			}
-			gint64 now = janus_get_monotonic_time();
-			if ((session_timeout > 0 && (now - session->last_activity >= (gint64)session_timeout * G_USEC_PER_SEC) &&
-					!g_atomic_int_compare_and_exchange(&session->timeout, 0, 1)) ||
-					((g_atomic_int_get(&session->transport_gone) && now - session->last_activity >= (gint64)reclaim_session_timeout * G_USEC_PER_SEC) &&
-							!g_atomic_int_compare_and_exchange(&session->timeout, 0, 1))) {
-				JANUS_LOG(LOG_INFO, "Timeout expired for session %"SCNu64"...\n", session->session_id);
-				/* Mark the session as over, we'll deal with it later */
-				janus_session_handles_clear(session);
-				/* Notify the transport */
-				janus_request *source = janus_session_get_request(session);
-				if(source) {
-					json_t *event = janus_create_message("timeout", session->session_id, NULL);
-					/* Send this to the transport client and notify the session's over */
-					source->transport->send_message(source->instance, NULL, FALSE, event);
-					source->transport->session_over(source->instance, session->session_id, TRUE, FALSE);
-				}
-				janus_request_unref(source);
-				/* Notify event handlers as well */
-				if(janus_events_is_enabled())
-					janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, JANUS_EVENT_SUBTYPE_NONE,
-						session->session_id, "timeout", NULL);
+/* Helper to compute when a session should expire, or 0 if it never should */
+static gint64 janus_session_deadline(janus_session *session) {
+	gint64 deadline = 0;
+	if(session_timeout > 0)
+		deadline = session->last_activity + (gint64)session_timeout * G_USEC_PER_SEC;
+	if(g_atomic_int_get(&session->transport_gone)) {
+		gint64 reclaim = session->last_activity + (gint64)reclaim_session_timeout * G_USEC_PER_SEC;
+		if(deadline == 0 || reclaim < deadline)
+			deadline = reclaim;
+	}
+	return deadline;
+}
+
+/* Makes sure the session timer fires by the current deadline of the session at the latest */
+static void janus_session_schedule_timeout(janus_session *session) {
+	if(session == NULL || g_atomic_int_get(&session->destroyed))
+		return;
+	gint64 deadline = janus_session_deadline(session);
+	if(deadline == 0)
+		return;
+	janus_refcount_increase(&session->ref);
+	if(janus_timerwheel_schedule(sessions_wheel, &session->timeout_timer, deadline, TRUE)) {
+		/* The timer was scheduled already, and holds a reference of its own */
+		janus_refcount_decrease(&session->ref);
+	}
+}
 
-				/* FIXME Is this safe? apparently it causes hash table errors on the console */
-				g_hash_table_iter_remove(&iter);
+/* Helper to check again all the sessions, e.g., because the timeouts changed */
+static void janus_sessions_reschedule_timeouts(void) {
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
+		if(shard->sessions != NULL) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->sessions);
+			while(g_hash_table_iter_next(&iter, NULL, &value))
+				janus_session_schedule_timeout((janus_session *)value);
+		}
+		janus_mutex_unlock(&shard->mutex);
+	}
+}
 
-				janus_session_destroy(session);
-			}
+static void janus_session_expire(janus_session *session) {
+	JANUS_LOG(LOG_INFO, "Timeout expired for session %"SCNu64"...\n", session->session_id);
+	/* Mark the session as over, we'll deal with it later */
+	janus_session_handles_clear(session);
+	/* Notify the transport */
+	janus_request *source = janus_session_get_request(session);
+	if(source) {
+		json_t *event = janus_create_message("timeout", session->session_id, NULL);
+		/* Send this to the transport client and notify the session's over */
+		source->transport->send_message(source->instance, NULL, FALSE, event);
+		source->transport->session_over(source->instance, session->session_id, TRUE, FALSE);
+	}
+	janus_request_unref(source);
+	/* Notify event handlers as well */
+	if(janus_events_is_enabled())
+		janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, JANUS_EVENT_SUBTYPE_NONE,
+			session->session_id, "timeout", NULL);
+	janus_sessions_remove(session);
+	janus_session_destroy(session);
+}
+
+/* Callback invoked by the wheel when the timer of a session fires */
+static void janus_session_timeout_fired(janus_timerwheel_timer *timer, gpointer user_data) {
+	janus_session *session = (janus_session *)user_data;
+	if(!g_atomic_int_get(&session->destroyed)) {
+		gint64 deadline = janus_session_deadline(session);
+		if(deadline > janus_get_monotonic_time()) {
+			/* There's been some activity in the meanwhile, check again later */
+			janus_session_schedule_timeout(session);
+		} else if(deadline > 0 && g_atomic_int_compare_and_exchange(&session->timeout, 0, 1)) {
+			janus_session_expire(session);
 		}
 	}
-	janus_mutex_unlock(&sessions_mutex);
+	/* Get rid of the reference the timer was holding */
+	janus_refcount_decrease(&session->ref);
+}
 
+static gboolean janus_check_sessions(gpointer user_data) {
+	janus_timerwheel_advance(sessions_wheel, janus_get_monotonic_time());
+	janus_overload_check();
 	return G_SOURCE_CONTINUE;
 }
 
@@ -678,7 +847,7 @@ static gpointer janus_sessions_watchdog(gpointer user_data) {
 	GMainContext *watchdog_context = g_main_loop_get_context(loop);
 	GSource *timeout_source;
 
-	timeout_source = g_timeout_source_new_seconds(2);
+	timeout_source = g_timeout_source_new_seconds(1);
 	g_source_set_callback(timeout_source, janus_check_sessions, watchdog_context, NULL);
 	g_source_attach(timeout_source, watchdog_context);
 	g_source_unref(timeout_source);
@@ -715,23 +884,28 @@ janus_session *janus_session_create(guint64 session_id) {
 	g_atomic_int_set(&session->timeout, 0);
 	g_atomic_int_set(&session->transport_gone, 0);
 	session->last_activity = janus_get_monotonic_time();
+	janus_timerwheel_timer_init(&session->timeout_timer, janus_session_timeout_fired, session);
 	session->ice_handles = NULL;
 	janus_mutex_init(&session->mutex);
-	janus_mutex_lock(&sessions_mutex);
-	g_hash_table_insert(sessions, janus_uint64_dup(session->session_id), session);
-	janus_mutex_unlock(&sessions_mutex);
+	janus_sessions_shard *shard = janus_sessions_shard_get(session->session_id);
+	janus_mutex_lock(&shard->mutex);
+	g_hash_table_insert(shard->sessions, janus_uint64_dup(session->session_id), session);
+	janus_mutex_unlock(&shard->mutex);
+	janus_metrics_session_created();
+	janus_session_schedule_timeout(session);
 	return session;
 }
 
 janus_session *janus_session_find(guint64 session_id) {
-	janus_mutex_lock(&sessions_mutex);
-	janus_session *session = g_hash_table_lookup(sessions, &session_id);
+	janus_sessions_shard *shard = janus_sessions_shard_get(session_id);
+	janus_mutex_lock(&shard->mutex);
+	janus_session *session = shard->sessions ? g_hash_table_lookup(shard->sessions, &session_id) : NULL;
 	if(session != NULL) {
 		/* A successful find automatically increases the reference counter:
 		 * it's up to the caller to decrease it again when done */
 		janus_refcount_increase(&session->ref);
 	}
-	janus_mutex_unlock(&sessions_mutex);
+	janus_mutex_unlock(&shard->mutex);
 	return session;
 }
 
@@ -753,6 +927,29 @@ void janus_session_notify_event(janus_session *session, json_t *event) {
 	}
 }
 
+static void janus_session_notify_shared_event(janus_session *session, json_t *envelope, janus_transport_shared_body *body) {
+	if(session != NULL && !g_atomic_int_get(&session->destroyed)) {
+		janus_request *source = janus_session_get_request(session);
+		if(source != NULL && source->transport != NULL) {
+			JANUS_LOG(LOG_HUGE, "Sending shared event to %s (%p)\n", source->transport->get_package(), source->instance);
+			if(source->transport->send_shared_message != NULL) {
+				source->transport->send_shared_message(source->instance, FALSE, envelope, body);
+			} else {
+				/* This transport doesn't know about shared bodies, merge the message */
+				json_object_set(envelope, body->name, body->body);
+				source->transport->send_message(source->instance, NULL, FALSE, envelope);
+			}
+		} else {
+			/* No transport, free the event */
+			json_decref(envelope);
+		}
+		janus_request_unref(source);
+	} else {
+		/* No session, free the event */
+		json_decref(envelope);
+	}
+}
+
 
 /* Destroys a session but does not remove it from the sessions hash table. */
 gint janus_session_destroy(janus_session *session) {
@@ -761,6 +958,9 @@ gint janus_session_destroy(janus_session *session) {
 	if(!g_atomic_int_compare_and_exchange(&session->destroyed, 0, 1))
 		return 0;
 	janus_session_handles_clear(session);
+	/* No need to keep track of its timeouts anymore */
+	if(janus_timerwheel_cancel(sessions_wheel, &session->timeout_timer))
+		janus_refcount_decrease(&session->ref);
 	/* The session will actually be destroyed when the counter gets to 0 */
 	janus_refcount_decrease(&session->ref);
 
@@ -834,6 +1034,238 @@ json_t *janus_session_handles_list_json(janus_session *session) {
 	return list;
 }
 
+/* Lightweight summary of all handles, for monitoring tools: sessions are
+ * only locked to find the handles, and for the traffic we use the summary
+ * the loops refresh once per second, so handle and media locks are never
+ * touched. Handles are ordered by ID, and can be paged with "after" */
+#define JANUS_HANDLES_SUMMARY_OPAQUE_ID	(1 << 0)
+#define JANUS_HANDLES_SUMMARY_PLUGIN	(1 << 1)
+#define JANUS_HANDLES_SUMMARY_LOOP		(1 << 2)
+#define JANUS_HANDLES_SUMMARY_STATE		(1 << 3)
+#define JANUS_HANDLES_SUMMARY_MEDIA		(1 << 4)
+#define JANUS_HANDLES_SUMMARY_MEMORY	(1 << 5)
+#define JANUS_HANDLES_SUMMARY_ALL		0x3F
+static int janus_handles_summary_field(const char *field) {
+	if(field == NULL)
+		return 0;
+	if(!strcasecmp(field, "opaque_id"))
+		return JANUS_HANDLES_SUMMARY_OPAQUE_ID;
+	if(!strcasecmp(field, "plugin"))
+		return JANUS_HANDLES_SUMMARY_PLUGIN;
+	if(!strcasecmp(field, "loop-id"))
+		return JANUS_HANDLES_SUMMARY_LOOP;
+	if(!strcasecmp(field, "state"))
+		return JANUS_HANDLES_SUMMARY_STATE;
+	if(!strcasecmp(field, "media"))
+		return JANUS_HANDLES_SUMMARY_MEDIA;
+	if(!strcasecmp(field, "memory"))
+		return JANUS_HANDLES_SUMMARY_MEMORY;
+	return 0;
+}
+static const char *janus_handles_summary_state(janus_ice_handle *handle) {
+	if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP))
+		return "hangup";
+	if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY))
+		return "up";
+	if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_GOT_OFFER) ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_GOT_ANSWER))
+		return "negotiating";
+	return "idle";
+}
+static gint janus_handles_summary_compare(gconstpointer a, gconstpointer b) {
+	const janus_ice_handle *ha = (const janus_ice_handle *)a, *hb = (const janus_ice_handle *)b;
+	return ha->handle_id < hb->handle_id ? -1 : (ha->handle_id > hb->handle_id ? 1 : 0);
+}
+static json_t *janus_handles_summary_json(guint64 after, guint limit, int fields, guint64 *next) {
+	GList *handles = NULL;
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
+		if(shard->sessions != NULL) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->sessions);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_session *session = value;
+				if(session == NULL)
+					continue;
+				janus_mutex_lock(&session->mutex);
+				if(session->ice_handles != NULL) {
+					GHashTableIter hiter;
+					gpointer hvalue;
+					g_hash_table_iter_init(&hiter, session->ice_handles);
+					while(g_hash_table_iter_next(&hiter, NULL, &hvalue)) {
+						janus_ice_handle *handle = hvalue;
+						if(handle == NULL || handle->handle_id <= after || g_atomic_int_get(&handle->destroyed))
+							continue;
+						janus_refcount_increase(&handle->ref);
+						handles = g_list_prepend(handles, handle);
+					}
+				}
+				janus_mutex_unlock(&session->mutex);
+			}
+		}
+		janus_mutex_unlock(&shard->mutex);
+	}
+	handles = g_list_sort(handles, janus_handles_summary_compare);
+	json_t *list = json_array();
+	guint count = 0;
+	*next = 0;
+	GList *temp = handles;
+	while(temp) {
+		janus_ice_handle *handle = (janus_ice_handle *)temp->data;
+		if(limit > 0 && count == limit) {
+			/* There's more, tell the caller where to start from next time */
+			*next = ((janus_ice_handle *)temp->prev->data)->handle_id;
+			break;
+		}
+		json_t *h = json_object();
+		janus_session *session = (janus_session *)handle->session;
+		if(session != NULL)
+			json_object_set_new(h, "session_id", json_integer(session->session_id));
+		json_object_set_new(h, "handle_id", json_integer(handle->handle_id));
+		if((fields & JANUS_HANDLES_SUMMARY_OPAQUE_ID) && handle->opaque_id != NULL)
+			json_object_set_new(h, "opaque_id", json_string(handle->opaque_id));
+		if((fields & JANUS_HANDLES_SUMMARY_PLUGIN) && handle->app != NULL)
+			json_object_set_new(h, "plugin", json_string(((janus_plugin *)handle->app)->get_package()));
+		if((fields & JANUS_HANDLES_SUMMARY_LOOP) && janus_ice_get_static_event_loops() > 0)
+			json_object_set_new(h, "loop-id", json_integer(janus_ice_get_static_event_loop_id(handle)));
+		if(fields & JANUS_HANDLES_SUMMARY_STATE)
+			json_object_set_new(h, "state", json_string(janus_handles_summary_state(handle)));
+		if(fields & JANUS_HANDLES_SUMMARY_MEDIA) {
+			janus_ice_handle_snapshot snapshot;
+			janus_ice_handle_get_snapshot(handle, &snapshot);
+			if(snapshot.updated > 0) {
+				json_t *media = json_object();
+				json_object_set_new(media, "updated", json_integer(snapshot.updated));
+				json_object_set_new(media, "packets-received", json_integer(snapshot.packets_in));
+				json_object_set_new(media, "packets-sent", json_integer(snapshot.packets_out));
+				json_object_set_new(media, "bytes-received", json_integer(snapshot.bytes_in));
+				json_object_set_new(media, "bytes-sent", json_integer(snapshot.bytes_out));
+				json_object_set_new(media, "bytes-received-lastsec", json_integer(snapshot.bytes_lastsec_in));
+				json_object_set_new(media, "bytes-sent-lastsec", json_integer(snapshot.bytes_lastsec_out));
+				json_object_set_new(media, "nacks-received", json_integer(snapshot.nacks_in));
+				json_object_set_new(media, "nacks-sent", json_integer(snapshot.nacks_out));
+				json_object_set_new(h, "media", media);
+			}
+		}
+		if(fields & JANUS_HANDLES_SUMMARY_MEMORY)
+			json_object_set_new(h, "memory", json_integer(janus_memory_account_total(&handle->memory)));
+		json_array_append_new(list, h);
+		count++;
+		temp = temp->next;
+	}
+	temp = handles;
+	while(temp) {
+		janus_ice_handle *handle = (janus_ice_handle *)temp->data;
+		janus_refcount_decrease(&handle->ref);
+		temp = temp->next;
+	}
+	g_list_free(handles);
+	return list;
+}
+
+/* Memory usage aggregated per session and per plugin, from the handles */
+typedef struct janus_memory_info_entry {
+	guint64 session_id;
+	gint64 bytes;
+	guint handles;
+} janus_memory_info_entry;
+static gint janus_memory_info_compare(gconstpointer a, gconstpointer b) {
+	const janus_memory_info_entry *ea = (const janus_memory_info_entry *)a;
+	const janus_memory_info_entry *eb = (const janus_memory_info_entry *)b;
+	return (ea->bytes < eb->bytes) ? 1 : (ea->bytes > eb->bytes ? -1 : 0);
+}
+static json_t *janus_memory_info_json(guint limit) {
+	GList *sessions = NULL;
+	GHashTable *per_plugin = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
+		if(shard->sessions != NULL) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->sessions);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_session *session = value;
+				if(session == NULL)
+					continue;
+				janus_memory_info_entry *entry = g_malloc0(sizeof(janus_memory_info_entry));
+				entry->session_id = session->session_id;
+				janus_mutex_lock(&session->mutex);
+				if(session->ice_handles != NULL) {
+					GHashTableIter hiter;
+					gpointer hvalue;
+					g_hash_table_iter_init(&hiter, session->ice_handles);
+					while(g_hash_table_iter_next(&hiter, NULL, &hvalue)) {
+						janus_ice_handle *handle = hvalue;
+						if(handle == NULL)
+							continue;
+						gint64 bytes = janus_memory_account_total(&handle->memory);
+						entry->bytes += bytes;
+						entry->handles++;
+						if(handle->app == NULL)
+							continue;
+						janus_memory_info_entry *pentry = g_hash_table_lookup(per_plugin, handle->app);
+						if(pentry == NULL) {
+							pentry = g_malloc0(sizeof(janus_memory_info_entry));
+							g_hash_table_insert(per_plugin, handle->app, pentry);
+						}
+						pentry->bytes += bytes;
+						pentry->handles++;
+					}
+				}
+				janus_mutex_unlock(&session->mutex);
+				sessions = g_list_prepend(sessions, entry);
+			}
+		}
+		janus_mutex_unlock(&shard->mutex);
+	}
+	json_t *info = json_object();
+	json_object_set_new(info, "totals", janus_memory_summary());
+	/* Plugins are only added at startup, so we can go through the list without locking */
+	json_t *list = json_object();
+	if(plugins != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, plugins);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_plugin *p = (janus_plugin *)value;
+			janus_memory_info_entry *pentry = g_hash_table_lookup(per_plugin, p);
+			json_t *pl = json_object();
+			json_object_set_new(pl, "handles", json_integer(pentry ? pentry->handles : 0));
+			json_object_set_new(pl, "handles-memory", json_integer(pentry ? pentry->bytes : 0));
+			janus_memory_account *account = plugins_memory ? g_hash_table_lookup(plugins_memory, p) : NULL;
+			if(account != NULL)
+				json_object_set_new(pl, "plugin-memory", json_integer(janus_memory_account_total(account)));
+			json_object_set_new(list, p->get_package(), pl);
+		}
+	}
+	json_object_set_new(info, "plugins", list);
+	g_hash_table_destroy(per_plugin);
+	/* Heaviest sessions first */
+	sessions = g_list_sort(sessions, janus_memory_info_compare);
+	list = json_array();
+	guint count = 0;
+	GList *temp = sessions;
+	while(temp && (limit == 0 || count < limit)) {
+		janus_memory_info_entry *entry = (janus_memory_info_entry *)temp->data;
+		json_t *se = json_object();
+		json_object_set_new(se, "session_id", json_integer(entry->session_id));
+		json_object_set_new(se, "handles", json_integer(entry->handles));
+		json_object_set_new(se, "memory", json_integer(entry->bytes));
+		json_array_append_new(list, se);
+		count++;
+		temp = temp->next;
+	}
+	g_list_free_full(sessions, (GDestroyNotify)g_free);
+	json_object_set_new(info, "sessions", list);
+	return info;
+}
+
 /* Requests management */
 static void janus_request_free(const janus_refcount *request_ref) {
 	janus_request *request = janus_refcount_containerof(request_ref, janus_request, ref);
@@ -1014,6 +1446,10 @@ int janus_process_incoming_request(janus_request *request) {
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_NOT_ACCEPTING_SESSIONS, NULL);
 			goto jsondone;
 		}
+		if(janus_is_overloaded()) {
+			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_OVERLOADED, NULL);
+			goto jsondone;
+		}
 		/* Any secret/token to check? */
 		ret = janus_request_check_secret(request, session_id, transaction_text);
 		if(ret != 0) {
@@ -1045,7 +1481,7 @@ int janus_process_incoming_request(janus_request *request) {
 		/* Notify the source that a new session has been created */
 		request->transport->session_created(request->instance, session->session_id);
 		/* Notify event handlers */
-		if(janus_events_is_enabled()) {
+		if(janus_events_is_wanted(JANUS_EVENT_TYPE_SESSION, JANUS_EVENT_SUBTYPE_NONE)) {
 			/* Session created, add info on the transport that originated it */
 			json_t *transport = json_object();
 			json_object_set_new(transport, "transport", json_string(session->source->transport->get_package()));
@@ -1125,6 +1561,11 @@ int janus_process_incoming_request(janus_request *request) {
 			ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
 			goto jsondone;
 		}
+		if(janus_is_overloaded()) {
+			/* New handles would only make things worse for the existing ones */
+			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_OVERLOADED, NULL);
+			goto jsondone;
+		}
 		json_t *plugin = json_object_get(root, "plugin");
 		const gchar *plugin_text = json_string_value(plugin);
 		janus_plugin *plugin_t = janus_plugin_find(plugin_text);
@@ -1156,6 +1597,13 @@ int janus_process_incoming_request(janus_request *request) {
 		handle_id = handle->handle_id;
 		/* We increase the counter as this request is using the handle */
 		janus_refcount_increase(&handle->ref);
+		/* Does this handle want an event loop of its own? */
+		if(json_is_true(json_object_get(root, "dedicated_loop"))) {
+			if(janus_ice_is_dedicated_loops_allowed())
+				handle->dedicated_loop = TRUE;
+			else
+				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Dedicated event loop requested, but they're not allowed\n", handle_id);
+		}
 		/* Attach to the plugin */
 		int error = 0;
 		if((error = janus_ice_handle_attach_plugin(session, handle, plugin_t)) != 0) {
@@ -1178,9 +1626,7 @@ int janus_process_incoming_request(janus_request *request) {
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Unhandled request '%s' at this path", message_text);
 			goto jsondone;
 		}
-		janus_mutex_lock(&sessions_mutex);
-		g_hash_table_remove(sessions, &session->session_id);
-		janus_mutex_unlock(&sessions_mutex);
+		janus_sessions_remove(session);
 		/* Notify the source that the session has been destroyed */
 		janus_request *source = janus_session_get_request(session);
 		if(source && source->transport)
@@ -1366,7 +1812,7 @@ int janus_process_incoming_request(janus_request *request) {
 				goto jsondone;
 			}
 			/* Notify event handlers */
-			if(janus_events_is_enabled()) {
+			if(janus_events_is_wanted(JANUS_EVENT_TYPE_JSEP, JANUS_EVENT_SUBTYPE_NONE)) {
 				janus_events_notify_handlers(JANUS_EVENT_TYPE_JSEP, JANUS_EVENT_SUBTYPE_NONE,
 					session_id, handle_id, handle->opaque_id, "remote", jsep_type, jsep_sdp);
 			}
@@ -1933,6 +2379,9 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Return some info on the settings (mostly debug-related, at the moment) */
 			json_t *reply = janus_create_message("success", 0, transaction_text);
 			json_t *status = json_object();
+			json_object_set_new(status, "ready", g_atomic_int_get(&ready) ? json_true() : json_false());
+			if(g_atomic_int_get(&ready))
+				json_object_set_new(status, "startup_time", json_integer(startup_time));
 			json_object_set_new(status, "token_auth", janus_auth_is_enabled() ? json_true() : json_false());
 			json_object_set_new(status, "session_timeout", json_integer(session_timeout));
 			json_object_set_new(status, "reclaim_session_timeout", json_integer(reclaim_session_timeout));
@@ -1946,10 +2395,96 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			json_object_set_new(status, "min_nack_queue", json_integer(janus_get_min_nack_queue()));
 			json_object_set_new(status, "no_media_timer", json_integer(janus_get_no_media_timer()));
 			json_object_set_new(status, "slowlink_threshold", json_integer(janus_get_slowlink_threshold()));
+			json_object_set_new(status, "packet_pool", janus_ice_packet_pool_summary());
+			json_object_set_new(status, "egress_batch", janus_ice_egress_batch_summary());
+			json_object_set_new(status, "incoming_batch", janus_ice_incoming_batch_summary());
+			json_object_set_new(status, "pacing", janus_ice_pacing_summary());
+			json_object_set_new(status, "mdns", janus_sdp_mdns_summary());
+			json_object_set_new(status, "memory_handle_limit", json_integer(janus_memory_get_handle_limit()));
+			json_object_set_new(status, "recordings_async", janus_recorder_async_summary());
+			json_object_set_new(status, "dtls_handshakes", janus_dtls_handshake_summary());
+			json_object_set_new(status, "latency_sampling", json_integer(janus_get_latency_sampling()));
 			json_object_set_new(reply, "status", status);
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "event_loops_info")) {
+			/* Return info on the static event loops, and how loaded they are */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "event_loops", json_integer(janus_ice_get_static_event_loops()));
+			json_object_set_new(reply, "loops", janus_ice_static_event_loops_info());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "request_lanes_info")) {
+			/* Return info on the lanes requests are served in, and how busy they are */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "request_threads", json_integer(request_threads));
+			json_object_set_new(reply, "request_queue", json_integer(request_queue));
+			json_object_set_new(reply, "lanes", janus_request_lanes_info());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "memory_info")) {
+			/* Return info on the memory the core accounted, and who's using it */
+			JANUS_VALIDATE_JSON_OBJECT(root, memoryinfo_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			guint limit = json_integer_value(json_object_get(root, "limit"));
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_t *memory = janus_memory_info_json(limit);
+			json_object_update(reply, memory);
+			json_decref(memory);
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "mutex_profile")) {
+			/* Return the callsites that waited for or held mutexes the most */
+#ifndef JANUS_MUTEX_PROFILING
+			ret = janus_process_error_string(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
+				(char *)"Mutex profiling not available (needs --enable-mutex-profiling)");
+			goto jsondone;
+#else
+			JANUS_VALIDATE_JSON_OBJECT(root, mutexprofile_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			guint limit = json_integer_value(json_object_get(root, "limit"));
+			const char *sort = json_string_value(json_object_get(root, "sort"));
+			gboolean reset = json_is_true(json_object_get(root, "reset"));
+			json_t *profile = janus_mutex_profile_report(limit, sort, reset);
+			if(profile == NULL) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+					"Invalid element (unsupported sort criteria)");
+				goto jsondone;
+			}
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "mutexes", profile);
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+#endif
+		} else if(!strcasecmp(message_text, "event_queues_info")) {
+			/* Return info on the queues of events of the handlers, and whether we're dropping any */
+			if(!janus_events_is_enabled()) {
+				ret = janus_process_error_string(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN, (char *)"Event handlers disabled");
+				goto jsondone;
+			}
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_t *overflow = janus_events_overflow_info();
+			json_object_update(reply, overflow);
+			json_decref(overflow);
+			json_object_set_new(reply, "queues", janus_events_queues_info());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		} else if(!strcasecmp(message_text, "set_session_timeout")) {
 			/* Change the session timeout value */
 			JANUS_VALIDATE_JSON_OBJECT(root, timeout_parameters,
@@ -1966,6 +2501,8 @@ int janus_process_incoming_admin_request(janus_request *request) {
 				goto jsondone;
 			}
 			session_timeout = timeout_num;
+			/* Sessions may have to expire sooner (or at all) now */
+			janus_sessions_reschedule_timeouts();
 			/* Prepare JSON reply */
 			json_t *reply = json_object();
 			json_object_set_new(reply, "janus", json_string("success"));
@@ -2147,6 +2684,26 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "set_latency_sampling")) {
+			/* Change how often packets are sampled for the latency histograms */
+			JANUS_VALIDATE_JSON_OBJECT(root, ls_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			json_t *ls = json_object_get(root, "latency_sampling");
+			int ls_num = json_integer_value(ls);
+			janus_set_latency_sampling(ls_num);
+			/* Prepare JSON reply */
+			json_t *reply = json_object();
+			json_object_set_new(reply, "janus", json_string("success"));
+			json_object_set_new(reply, "transaction", json_string(transaction_text));
+			json_object_set_new(reply, "latency_sampling", json_integer(janus_get_latency_sampling()));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		} else if(!strcasecmp(message_text, "accept_new_sessions")) {
 			/* Configure whether we should accept new incoming sessions or not:
 			 * this can be particularly useful whenever, e.g., we want to stop
@@ -2323,19 +2880,23 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* List sessions */
 			session_id = 0;
 			json_t *list = json_array();
-			if(sessions != NULL && g_hash_table_size(sessions) > 0) {
-				janus_mutex_lock(&sessions_mutex);
-				GHashTableIter iter;
-				gpointer value;
-				g_hash_table_iter_init(&iter, sessions);
-				while (g_hash_table_iter_next(&iter, NULL, &value)) {
-					janus_session *session = value;
-					if(session == NULL) {
-						continue;
+			int i = 0;
+			for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+				janus_sessions_shard *shard = &sessions_shards[i];
+				janus_mutex_lock(&shard->mutex);
+				if(shard->sessions != NULL) {
+					GHashTableIter iter;
+					gpointer value;
+					g_hash_table_iter_init(&iter, shard->sessions);
+					while (g_hash_table_iter_next(&iter, NULL, &value)) {
+						janus_session *session = value;
+						if(session == NULL) {
+							continue;
+						}
+						json_array_append_new(list, json_integer(session->session_id));
 					}
-					json_array_append_new(list, json_integer(session->session_id));
 				}
-				janus_mutex_unlock(&sessions_mutex);
+				janus_mutex_unlock(&shard->mutex);
 			}
 			/* Prepare JSON reply */
 			json_t *reply = janus_create_message("success", 0, transaction_text);
@@ -2343,6 +2904,41 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "handles_summary")) {
+			/* Lightweight summary of all handles, optionally paged */
+			JANUS_VALIDATE_JSON_OBJECT(root, handlessummary_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			int fields = JANUS_HANDLES_SUMMARY_ALL;
+			json_t *list = json_object_get(root, "fields");
+			if(list != NULL) {
+				fields = 0;
+				size_t i = 0;
+				for(i=0; i<json_array_size(list); i++) {
+					int field = janus_handles_summary_field(json_string_value(json_array_get(list, i)));
+					if(field == 0) {
+						ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+							"Invalid element (unsupported field)");
+						goto jsondone;
+					}
+					fields |= field;
+				}
+			}
+			guint64 after = json_integer_value(json_object_get(root, "after")), next = 0;
+			guint limit = json_integer_value(json_object_get(root, "limit"));
+			json_t *handles = janus_handles_summary_json(after, limit, fields, &next);
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "handles", handles);
+			if(next > 0)
+				json_object_set_new(reply, "next", json_integer(next));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		} else if(!strcasecmp(message_text, "add_token")) {
 			/* Add a token valid for authentication */
 			ret = janus_request_allow_token(request, session_id, transaction_text, TRUE, TRUE);
@@ -2549,9 +3145,7 @@ int janus_process_incoming_admin_request(janus_request *request) {
 	if(handle == NULL) {
 		/* Session-related */
 		if(!strcasecmp(message_text, "destroy_session")) {
-			janus_mutex_lock(&sessions_mutex);
-			g_hash_table_remove(sessions, &session->session_id);
-			janus_mutex_unlock(&sessions_mutex);
+			janus_sessions_remove(session);
 			/* Notify the source that the session has been destroyed */
 			janus_request *source = janus_session_get_request(session);
 			if(source && source->transport)
@@ -2613,6 +3207,32 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "migrate_handle")) {
+			/* Move this handle to a different static event loop */
+			JANUS_VALIDATE_JSON_OBJECT(root, loop_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			int loop = json_integer_value(json_object_get(root, "loop"));
+			int res = janus_ice_handle_migrate(handle, loop);
+			if(res == -1) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+					"No such static event loop (%d)", loop);
+				goto jsondone;
+			} else if(res < 0) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
+					"No PeerConnection to migrate");
+				goto jsondone;
+			}
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", session_id, transaction_text);
+			json_object_set_new(reply, "loop", json_integer(loop));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		} else if(!strcasecmp(message_text, "start_pcap") || !strcasecmp(message_text, "start_text2pcap")) {
 			/* Start dumping RTP and RTCP packets to a pcap or text2pcap file */
 			JANUS_VALIDATE_JSON_OBJECT(root, text2pcap_parameters,
@@ -2626,12 +3246,33 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			const char *folder = json_string_value(json_object_get(root, "folder"));
 			const char *filename = json_string_value(json_object_get(root, "filename"));
 			int truncate = json_integer_value(json_object_get(root, "truncate"));
+			const char *format_text = json_string_value(json_object_get(root, "format"));
+			gboolean headers_only = json_is_true(json_object_get(root, "headers_only"));
+			guint window = json_integer_value(json_object_get(root, "window"));
+			janus_text2pcap_format format = text ? JANUS_TEXT2PCAP_FORMAT_TEXT : JANUS_TEXT2PCAP_FORMAT_PCAP;
+			if(format_text != NULL && (text || (strcasecmp(format_text, "pcap") && strcasecmp(format_text, "pcapng")))) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+					"Invalid format (should be pcap or pcapng)");
+				goto jsondone;
+			}
+			if(format_text != NULL && !strcasecmp(format_text, "pcapng"))
+				format = JANUS_TEXT2PCAP_FORMAT_PCAPNG;
+			if(text && (headers_only || window > 0)) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+					"headers_only and window are only supported by start_pcap");
+				goto jsondone;
+			}
+			if(window > JANUS_TEXT2PCAP_MAX_WINDOW) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+					"Invalid window (should be at most %d seconds)", JANUS_TEXT2PCAP_MAX_WINDOW);
+				goto jsondone;
+			}
 			if(handle->text2pcap != NULL) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
 					text ? "text2pcap already started" : "pcap already started");
 				goto jsondone;
 			}
-			handle->text2pcap = janus_text2pcap_create(folder, filename, truncate, text);
+			handle->text2pcap = janus_text2pcap_create_full(folder, filename, truncate, format, headers_only, window);
 			if(handle->text2pcap == NULL) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
 					text ? "Error starting text2pcap dump" : "Error starting pcap dump");
@@ -2663,6 +3304,38 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "dump_pcap")) {
+			/* Save the rolling window of a pcap capture to a file */
+			JANUS_VALIDATE_JSON_OBJECT(root, dumppcap_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			if(handle->text2pcap == NULL || handle->text2pcap->window == 0) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
+					"No capture with a rolling window started");
+				goto jsondone;
+			}
+			const char *filename = json_string_value(json_object_get(root, "filename"));
+			char *path = NULL;
+			int packets = janus_text2pcap_dump_window(handle->text2pcap, filename, &path);
+			if(packets < 0) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
+					"Error dumping the rolling window");
+				goto jsondone;
+			}
+			/* Prepare JSON reply */
+			json_t *reply = json_object();
+			json_object_set_new(reply, "janus", json_string("success"));
+			json_object_set_new(reply, "transaction", json_string(transaction_text));
+			json_object_set_new(reply, "filename", json_string(path));
+			json_object_set_new(reply, "packets", json_integer(packets));
+			g_free(path);
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		}
 		/* If this is not a request to start/stop debugging to text2pcap, it must be a handle_info */
 		if(strcasecmp(message_text, "handle_info")) {
@@ -2694,6 +3367,8 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			json_object_set_new(info, "token", json_string(handle->token));
 		json_object_set_new(info, "loop-running", (handle->mainloop != NULL &&
 			g_main_loop_is_running(handle->mainloop)) ? json_true() : json_false());
+		if(janus_ice_get_static_event_loops() > 0)
+			json_object_set_new(info, "loop-id", json_integer(janus_ice_get_static_event_loop_id(handle)));
 		json_object_set_new(info, "created", json_integer(handle->created));
 		json_object_set_new(info, "current_time", json_integer(janus_get_monotonic_time()));
 		if(handle->app && janus_plugin_session_is_alive(handle->app_handle)) {
@@ -2755,6 +3430,7 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			json_object_set_new(info, "pending-trickles", json_integer(g_list_length(handle->pending_trickles)));
 		if(handle->queued_packets)
 			json_object_set_new(info, "queued-packets", json_integer(g_async_queue_length(handle->queued_packets)));
+		json_object_set_new(info, "memory", janus_memory_account_summary(&handle->memory));
 		if(g_atomic_int_get(&handle->dump_packets) && handle->text2pcap) {
 			if(handle->text2pcap->text) {
 				json_object_set_new(info, "dump-to-text2pcap", json_true());
@@ -2762,6 +3438,12 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			} else {
 				json_object_set_new(info, "dump-to-pcap", json_true());
 				json_object_set_new(info, "pcap-file", json_string(handle->text2pcap->filename));
+				json_object_set_new(info, "pcap-format", json_string(janus_text2pcap_format_string(handle->text2pcap->format)));
+				if(handle->text2pcap->headers_only)
+					json_object_set_new(info, "pcap-headers-only", json_true());
+				if(handle->text2pcap->window > 0)
+					json_object_set_new(info, "pcap-window", json_integer(handle->text2pcap->window));
+				json_object_set_new(info, "pcap-dropped", json_integer(g_atomic_int_get(&handle->text2pcap->dropped)));
 			}
 		}
 		json_t *streams = json_array();
@@ -2921,6 +3603,22 @@ json_t *janus_admin_stream_summary(janus_ice_stream *stream) {
 		json_object_set_new(bwe, "twcc-ext-id", json_integer(stream->transport_wide_cc_ext_id));
 	json_object_set_new(s, "bwe", bwe);
 	json_object_set_new(s, "nack-queue-ms", json_integer(stream->nack_queue_ms));
+	janus_fec_context *fec = stream->fec;
+	if(fec != NULL && (fec->audio_red_pt > 0 || fec->video_red_pt > 0)) {
+		json_t *sf = json_object();
+		if(fec->audio_red_pt > 0) {
+			json_object_set_new(sf, "audio-red-pt", json_integer(fec->audio_red_pt));
+			json_object_set_new(sf, "red-distance", json_integer(fec->distance));
+			json_object_set_new(sf, "red-packets", json_integer(fec->red_packets));
+		}
+		if(fec->video_red_pt > 0) {
+			json_object_set_new(sf, "video-red-pt", json_integer(fec->video_red_pt));
+			json_object_set_new(sf, "video-ulpfec-pt", json_integer(fec->video_ulpfec_pt));
+			json_object_set_new(sf, "ulpfec-group", json_integer(fec->group_size));
+			json_object_set_new(sf, "ulpfec-packets", json_integer(fec->fec_packets));
+		}
+		json_object_set_new(s, "fec", sf);
+	}
 	json_t *components = json_array();
 	if(stream->component) {
 		json_t *c = janus_admin_component_summary(stream->component);
@@ -3028,6 +3726,8 @@ json_t *janus_admin_component_summary(janus_ice_component *component) {
 		json_object_set_new(d, "valid", dtls->srtp_valid ? json_true() : json_false());
 		const char *srtp_profile = janus_get_dtls_srtp_profile(dtls->srtp_profile);
 		json_object_set_new(d, "srtp-profile", json_string(srtp_profile ? srtp_profile : "none"));
+		json_object_set_new(d, "srtp-protected", json_integer(component->srtp_protected));
+		json_object_set_new(d, "srtp-unprotected", json_integer(component->srtp_unprotected));
 		json_object_set_new(d, "ready", dtls->ready ? json_true() : json_false());
 		if(dtls->dtls_started > 0)
 			json_object_set_new(d, "handshake-started", json_integer(dtls->dtls_started));
@@ -3085,11 +3785,17 @@ json_t *janus_admin_component_summary(janus_ice_component *component) {
 #ifdef HAVE_SCTP
 		/* FIXME Actually check if this succeeded? */
 		json_object_set_new(d, "sctp-association", dtls->sctp ? json_true() : json_false());
+		if(dtls->sctp)
+			json_object_set_new(d, "sctp-pending", janus_sctp_pending_summary(dtls->sctp));
 #endif
 	}
 	json_object_set_new(c, "dtls", d);
 	json_object_set_new(c, "in_stats", in_stats);
 	json_object_set_new(c, "out_stats", out_stats);
+	if(janus_get_latency_sampling() > 0)
+		json_object_set_new(c, "latency", janus_ice_latency_summary(component->latency));
+	if(janus_is_pacing_enabled())
+		json_object_set_new(c, "pacer", janus_ice_pacer_summary(&component->pacer));
 	return c;
 }
 
@@ -3122,30 +3828,35 @@ void janus_transport_incoming_request(janus_transport *plugin, janus_transport_s
 void janus_transport_gone(janus_transport *plugin, janus_transport_session *transport) {
 	/* Get rid of sessions this transport was handling */
 	JANUS_LOG(LOG_VERB, "A %s transport instance has gone away (%p)\n", plugin->get_package(), transport);
-	janus_mutex_lock(&sessions_mutex);
-	if(sessions && g_hash_table_size(sessions) > 0) {
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, sessions);
-		while(g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_session *session = (janus_session *) value;
-			if(!session || g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->timeout) || session->last_activity == 0)
-				continue;
-			if(session->source && session->source->instance == transport) {
-				JANUS_LOG(LOG_VERB, "  -- Session %"SCNu64" will be over if not reclaimed\n", session->session_id);
-				JANUS_LOG(LOG_VERB, "  -- Marking Session %"SCNu64" as over\n", session->session_id);
-				if(reclaim_session_timeout < 1) { /* Reclaim session timeouts are disabled */
-					/* Mark the session as destroyed */
-					janus_session_destroy(session);
-					g_hash_table_iter_remove(&iter);
-				} else {
-					/* Set flag for transport_gone. The Janus sessions watchdog will clean this up if not reclaimed */
-					g_atomic_int_set(&session->transport_gone, 1);
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
+		if(shard->sessions && g_hash_table_size(shard->sessions) > 0) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->sessions);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_session *session = (janus_session *) value;
+				if(!session || g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->timeout) || session->last_activity == 0)
+					continue;
+				if(session->source && session->source->instance == transport) {
+					JANUS_LOG(LOG_VERB, "  -- Session %"SCNu64" will be over if not reclaimed\n", session->session_id);
+					JANUS_LOG(LOG_VERB, "  -- Marking Session %"SCNu64" as over\n", session->session_id);
+					if(reclaim_session_timeout < 1) { /* Reclaim session timeouts are disabled */
+						/* Mark the session as destroyed */
+						janus_session_destroy(session);
+						g_hash_table_iter_remove(&iter);
+					} else {
+						/* Set flag for transport_gone. The Janus sessions watchdog will clean this up if not reclaimed */
+						g_atomic_int_set(&session->transport_gone, 1);
+						janus_session_schedule_timeout(session);
+					}
 				}
 			}
 		}
+		janus_mutex_unlock(&shard->mutex);
 	}
-	janus_mutex_unlock(&sessions_mutex);
 }
 
 gboolean janus_transport_is_api_secret_needed(janus_transport *plugin) {
@@ -3181,8 +3892,71 @@ void janus_transport_notify_event(janus_transport *plugin, void *transport, json
 	}
 }
 
+static void janus_transport_metrics_free(GString *samples) {
+	g_string_free(samples, TRUE);
+}
+
+char *janus_transport_get_metrics(janus_transport *plugin) {
+	GString *text = g_string_new(NULL);
+	/* Core counters first */
+	janus_metrics_append(text);
+	janus_memory_metrics(text);
+	janus_ice_static_event_loops_metrics(text);
+	janus_network_port_pools_metrics(text);
+	janus_dtls_handshake_metrics(text);
+	if(overload_lag > 0) {
+		janus_metrics_append_family(text, "janus_overloaded", "gauge", "Whether the overload protection kicked in");
+		g_string_append_printf(text, "janus_overloaded %d\n", janus_is_overloaded() ? 1 : 0);
+	}
+	/* Then the gauges plugins keep (e.g., rooms), if any: plugins are only
+	 * added at startup, so we can go through the list without locking */
+	GHashTable *families = NULL;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, plugins);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_plugin *p = (janus_plugin *)value;
+		if(p == NULL || p->query_metrics == NULL)
+			continue;
+		json_t *metrics = p->query_metrics();
+		if(metrics == NULL)
+			continue;
+		const char *name = NULL;
+		json_t *number = NULL;
+		json_object_foreach(metrics, name, number) {
+			if(!json_is_number(number))
+				continue;
+			if(families == NULL)
+				families = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)janus_transport_metrics_free);
+			GString *samples = g_hash_table_lookup(families, name);
+			if(samples == NULL) {
+				samples = g_string_new(NULL);
+				g_hash_table_insert(families, g_strdup(name), samples);
+			}
+			g_string_append_printf(samples, "janus_plugin_%s{plugin=\"%s\"} %g\n",
+				name, p->get_package(), json_number_value(number));
+		}
+		json_decref(metrics);
+	}
+	if(families != NULL) {
+		/* Samples of the same family must be grouped together */
+		g_hash_table_iter_init(&iter, families);
+		gpointer key;
+		while(g_hash_table_iter_next(&iter, &key, &value)) {
+			char family[256];
+			g_snprintf(family, sizeof(family), "janus_plugin_%s", (char *)key);
+			janus_metrics_append_family(text, family, "gauge", "Plugin specific gauge");
+			g_string_append(text, ((GString *)value)->str);
+		}
+		g_hash_table_destroy(families);
+	}
+	g_string_append(text, "# EOF\n");
+	return g_string_free(text, FALSE);
+}
+
 void janus_transport_task(gpointer data, gpointer user_data) {
-	JANUS_LOG(LOG_VERB, "Transport task pool, serving request\n");
+	janus_request_lane *lane = (janus_request_lane *)user_data;
+	JANUS_LOG(LOG_VERB, "Transport task pool (%s), serving request\n", lane ? lane->name : "??");
 	janus_request *request = (janus_request *)data;
 	if(request == NULL) {
 		JANUS_LOG(LOG_ERR, "Missing request\n");
@@ -3192,10 +3966,159 @@ void janus_transport_task(gpointer data, gpointer user_data) {
 		janus_process_incoming_request(request);
 	else
 		janus_process_incoming_admin_request(request);
+	if(lane != NULL)
+		g_atomic_int_inc(&lane->served);
 	/* Done */
 	janus_request_destroy(request);
 }
 
+static janus_request_lane *janus_request_lane_new(const char *name, int threads) {
+	GError *error = NULL;
+	janus_request_lane *lane = g_malloc0(sizeof(janus_request_lane));
+	lane->name = g_strdup(name);
+	lane->pool = g_thread_pool_new(janus_transport_task, lane, threads > 0 ? threads : -1, FALSE, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the %s request pool...\n",
+			error->code, error->message ? error->message : "??", name);
+		g_error_free(error);
+		g_free(lane->name);
+		g_free(lane);
+		return NULL;
+	}
+	return lane;
+}
+
+static void janus_request_lane_destroy(janus_request_lane *lane) {
+	if(lane == NULL)
+		return;
+	g_thread_pool_free(lane->pool, FALSE, FALSE);
+	g_free(lane->name);
+	g_free(lane);
+}
+
+static json_t *janus_request_lane_info(janus_request_lane *lane) {
+	json_t *info = json_object();
+	json_object_set_new(info, "threads", json_integer(g_thread_pool_get_num_threads(lane->pool)));
+	json_object_set_new(info, "queued", json_integer(g_thread_pool_unprocessed(lane->pool)));
+	json_object_set_new(info, "served", json_integer(g_atomic_int_get(&lane->served)));
+	json_object_set_new(info, "rejected", json_integer(g_atomic_int_get(&lane->rejected)));
+	return info;
+}
+
+static json_t *janus_request_lanes_info(void) {
+	json_t *lanes = json_object();
+	janus_mutex_lock(&lanes_mutex);
+	if(core_lane != NULL)
+		json_object_set_new(lanes, core_lane->name, janus_request_lane_info(core_lane));
+	if(plugin_lanes != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, plugin_lanes);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_request_lane *lane = (janus_request_lane *)value;
+			json_object_set_new(lanes, lane->name, janus_request_lane_info(lane));
+		}
+	}
+	janus_mutex_unlock(&lanes_mutex);
+	return lanes;
+}
+
+/* How many requests are waiting in the busiest lane */
+static guint janus_request_lanes_depth(void) {
+	guint depth = 0, queued = 0;
+	janus_mutex_lock(&lanes_mutex);
+	if(core_lane != NULL)
+		depth = g_thread_pool_unprocessed(core_lane->pool);
+	if(plugin_lanes != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, plugin_lanes);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_request_lane *lane = (janus_request_lane *)value;
+			queued = g_thread_pool_unprocessed(lane->pool);
+			if(queued > depth)
+				depth = queued;
+		}
+	}
+	janus_mutex_unlock(&lanes_mutex);
+	return depth;
+}
+
+/* Check the signals the overload protection is based on (called once per second) */
+static void janus_overload_check(void) {
+	guint lag = 0, residency = 0, depth = 0;
+	janus_ice_overload_collect(&lag, &residency, &depth);
+	if(overload_lag == 0)
+		return;
+	guint requests = janus_request_lanes_depth();
+	gboolean hot = (lag > overload_lag*1000 || residency > overload_lag*1000 ||
+		(overload_queue_depth > 0 && (depth > overload_queue_depth || requests > overload_queue_depth)));
+	if(hot) {
+		overload_hot++;
+		overload_cool = 0;
+	} else {
+		overload_cool++;
+		overload_hot = 0;
+	}
+	gboolean was = janus_is_overloaded();
+	if(was == hot || (hot && overload_hot < JANUS_OVERLOAD_ENTER) || (!hot && overload_cool < JANUS_OVERLOAD_LEAVE))
+		return;
+	g_atomic_int_set(&overloaded, hot);
+	if(hot) {
+		JANUS_LOG(LOG_WARN, "Server overloaded (lag %"SCNu32"us, queue residency %"SCNu32"us, queue depth %"SCNu32", queued requests %"SCNu32"): "
+			"rejecting new sessions and handles\n", lag, residency, depth, requests);
+	} else {
+		JANUS_LOG(LOG_INFO, "Server not overloaded anymore, accepting new sessions and handles again\n");
+	}
+	if(overload_shed_recordings)
+		janus_recorder_set_accepting(!hot);
+	/* Notify event handlers as well */
+	if(janus_events_is_enabled()) {
+		json_t *info = json_object();
+		json_object_set_new(info, "status", json_string(hot ? "overloaded" : "recovered"));
+		json_object_set_new(info, "lag", json_integer(lag));
+		json_object_set_new(info, "residency", json_integer(residency));
+		json_object_set_new(info, "depth", json_integer(depth));
+		json_object_set_new(info, "requests", json_integer(requests));
+		janus_events_notify_handlers(JANUS_EVENT_TYPE_CORE, JANUS_EVENT_SUBTYPE_CORE_OVERLOAD, 0, info);
+	}
+}
+
+/* Helper to figure out which plugin a message is for, so that we can pick its lane */
+static janus_plugin *janus_request_get_plugin(janus_request *request) {
+	if(request->admin)
+		return janus_plugin_find(json_string_value(json_object_get(request->message, "plugin")));
+	json_t *s = json_object_get(request->message, "session_id");
+	json_t *h = json_object_get(request->message, "handle_id");
+	if(!json_is_integer(s) || !json_is_integer(h))
+		return NULL;
+	janus_session *session = janus_session_find(json_integer_value(s));
+	if(session == NULL)
+		return NULL;
+	janus_plugin *plugin = NULL;
+	janus_ice_handle *handle = janus_session_handles_find(session, json_integer_value(h));
+	if(handle != NULL) {
+		plugin = (janus_plugin *)handle->app;
+		janus_refcount_decrease(&handle->ref);
+	}
+	janus_refcount_decrease(&session->ref);
+	return plugin;
+}
+
+/* Helper to get (or create) the lane of a plugin, only invoked by the requests thread */
+static janus_request_lane *janus_request_get_plugin_lane(janus_plugin *plugin) {
+	const char *package = plugin->get_package();
+	janus_mutex_lock(&lanes_mutex);
+	janus_request_lane *lane = g_hash_table_lookup(plugin_lanes, package);
+	if(lane == NULL) {
+		lane = janus_request_lane_new(package, request_threads);
+		if(lane != NULL)
+			g_hash_table_insert(plugin_lanes, lane->name, lane);
+	}
+	janus_mutex_unlock(&lanes_mutex);
+	return lane;
+}
+
 
 /* Thread to handle incoming requests: may involve an asynchronous task for plugin messaging */
 static void *janus_transport_requests(void *data) {
@@ -3206,32 +4129,52 @@ static void *janus_transport_requests(void *data) {
 		request = g_async_queue_pop(requests);
 		if(request == &exit_message)
 			break;
-		/* Should we process the request synchronously or with a task from the thread pool? */
+		/* Should we process the request synchronously or in one of the lanes? */
 		destroy = TRUE;
-		/* Process the request synchronously only it's not a message for a plugin */
 		json_t *message = json_object_get(request->message, "janus");
 		const gchar *message_text = json_string_value(message);
-		if(message_text && !strcasecmp(message_text, request->admin ? "message_plugin" : "message")) {
+		janus_request_lane *lane = core_lane;
+		if(message_text && !request->admin &&
+				(!strcasecmp(message_text, "keepalive") || !strcasecmp(message_text, "trickle"))) {
+			/* Fast lane, process the request synchronously */
+			lane = NULL;
+		} else if(message_text && !strcasecmp(message_text, request->admin ? "message_plugin" : "message")) {
+			/* Messages for plugins use the lane of the plugin they're addressed to */
+			janus_plugin *plugin = janus_request_get_plugin(request);
+			if(plugin != NULL) {
+				janus_request_lane *plugin_lane = janus_request_get_plugin_lane(plugin);
+				if(plugin_lane != NULL)
+					lane = plugin_lane;
+			}
+		}
+		if(lane == NULL) {
+			if(!request->admin)
+				janus_process_incoming_request(request);
+			else
+				janus_process_incoming_admin_request(request);
+		} else if(request_queue > 0 && g_thread_pool_unprocessed(lane->pool) >= (guint)request_queue) {
+			/* Too many requests waiting in this lane already */
+			JANUS_LOG(LOG_WARN, "Too many requests queued in the %s lane, rejecting request\n", lane->name);
+			g_atomic_int_inc(&lane->rejected);
+			json_t *transaction = json_object_get(request->message, "transaction");
+			const char *transaction_text = json_is_string(transaction) ? json_string_value(transaction) : NULL;
+			janus_process_error(request, 0, transaction_text, JANUS_ERROR_SERVER_BUSY, "Too many requests queued, try again later");
+		} else {
 			/* Spawn a task thread */
 			GError *tperror = NULL;
-			g_thread_pool_push(tasks, request, &tperror);
+			g_thread_pool_push(lane->pool, request, &tperror);
 			if(tperror != NULL) {
 				/* Something went wrong... */
 				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to push task in thread pool...\n",
 					tperror->code, tperror->message ? tperror->message : "??");
 				g_error_free(tperror);
-				json_t *transaction = json_object_get(message, "transaction");
+				json_t *transaction = json_object_get(request->message, "transaction");
 				const char *transaction_text = json_is_string(transaction) ? json_string_value(transaction) : NULL;
 				janus_process_error(request, 0, transaction_text, JANUS_ERROR_UNKNOWN, "Thread pool error");
 			} else {
 				/* Don't destroy the request now, the task will take care of that */
 				destroy = FALSE;
 			}
-		} else {
-			if(!request->admin)
-				janus_process_incoming_request(request);
-			else
-				janus_process_incoming_admin_request(request);
 		}
 		/* Done */
 		if(destroy)
@@ -3364,7 +4307,7 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 			json_object_set_new(merged_jsep, "e2ee", json_true());
 		json_object_set_new(event, "jsep", merged_jsep);
 		/* In case event handlers are enabled, push the local SDP to all handlers */
-		if(janus_events_is_enabled()) {
+		if(janus_events_is_wanted(JANUS_EVENT_TYPE_JSEP, JANUS_EVENT_SUBTYPE_NONE)) {
 			const char *merged_sdp_type = json_string_value(json_object_get(merged_jsep, "type"));
 			const char *merged_sdp = json_string_value(json_object_get(merged_jsep, "sdp"));
 			/* Notify event handlers as well */
@@ -3387,6 +4330,60 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 	return JANUS_OK;
 }
 
+static void janus_plugin_event_shared_free(void *shared) {
+	janus_transport_shared_body_unref((janus_transport_shared_body *)shared);
+}
+
+int janus_plugin_push_event_shared(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, janus_plugin_event *event) {
+	if(!plugin || !event || !event->message)
+		return -1;
+	if(!janus_plugin_session_is_alive(plugin_session))
+		return -2;
+	janus_refcount_increase(&plugin_session->ref);
+	janus_ice_handle *ice_handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!ice_handle || janus_flags_is_set(&ice_handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)) {
+		janus_refcount_decrease(&plugin_session->ref);
+		return JANUS_ERROR_SESSION_NOT_FOUND;
+	}
+	janus_refcount_increase(&ice_handle->ref);
+	janus_session *session = ice_handle->session;
+	if(!session || g_atomic_int_get(&session->destroyed)) {
+		janus_refcount_decrease(&plugin_session->ref);
+		janus_refcount_decrease(&ice_handle->ref);
+		return JANUS_ERROR_SESSION_NOT_FOUND;
+	}
+	if(!json_is_object(event->message)) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Cannot push event (JSON error: not an object)\n", ice_handle->handle_id);
+		janus_refcount_decrease(&plugin_session->ref);
+		janus_refcount_decrease(&ice_handle->ref);
+		return JANUS_ERROR_INVALID_JSON_OBJECT;
+	}
+	/* The plugindata part is the same for all recipients: build it the first time */
+	janus_mutex_lock(&event->mutex);
+	if(event->shared == NULL) {
+		json_t *plugin_data = json_object();
+		json_object_set_new(plugin_data, "plugin", json_string(plugin->get_package()));
+		json_object_set(plugin_data, "data", event->message);
+		event->shared = janus_transport_shared_body_new("plugindata", plugin_data);
+		event->shared_free = janus_plugin_event_shared_free;
+	}
+	janus_transport_shared_body *body = (janus_transport_shared_body *)event->shared;
+	janus_transport_shared_body_ref(body);
+	janus_mutex_unlock(&event->mutex);
+	/* Only the envelope is specific to this recipient */
+	json_t *envelope = janus_create_message("event", session->session_id, transaction);
+	json_object_set_new(envelope, "sender", json_integer(ice_handle->handle_id));
+	if(janus_is_opaqueid_in_api_enabled() && ice_handle->opaque_id != NULL)
+		json_object_set_new(envelope, "opaque_id", json_string(ice_handle->opaque_id));
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending shared event to transport...\n", ice_handle->handle_id);
+	janus_session_notify_shared_event(session, envelope, body);
+	janus_transport_shared_body_unref(body);
+
+	janus_refcount_decrease(&plugin_session->ref);
+	janus_refcount_decrease(&ice_handle->ref);
+	return JANUS_OK;
+}
+
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart) {
 	if(!janus_plugin_session_is_alive(plugin_session) ||
 			plugin == NULL || sdp_type == NULL || sdp == NULL) {
@@ -3667,6 +4664,9 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 			g_list_free(rtx_ptypes);
 		}
 	}
+	/* If configured, offer to protect what we send with RED and ULPFEC */
+	if(offer && janus_is_fec_enabled())
+		janus_sdp_add_fec(ice_handle, parsed_sdp);
 	/* Enrich the SDP the plugin gave us with all the WebRTC related stuff */
 	char *sdp_merged = janus_sdp_merge(ice_handle, parsed_sdp, offer ? TRUE : FALSE);
 	if(sdp_merged == NULL) {
@@ -3724,6 +4724,17 @@ void janus_plugin_relay_rtp(janus_plugin_session *plugin_session, janus_plugin_r
 	janus_ice_relay_rtp(handle, packet);
 }
 
+void janus_plugin_relay_rtp_shared(janus_plugin_session *plugin_session, janus_plugin_rtp *packet, janus_plugin_rtp_payload *payload) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped) ||
+			packet == NULL || packet->buffer == NULL || packet->length < 1)
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return;
+	janus_ice_relay_rtp_shared(handle, packet, payload);
+}
+
 void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, janus_plugin_rtcp *packet) {
 	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped) ||
 			packet == NULL || packet->buffer == NULL || packet->length < 1)
@@ -3750,6 +4761,46 @@ void janus_plugin_relay_data(janus_plugin_session *plugin_session, janus_plugin_
 #endif
 }
 
+void janus_plugin_relay_data_shared(janus_plugin_session *plugin_session, janus_plugin_data *packet, janus_plugin_rtp_payload *payload) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped) ||
+			packet == NULL || payload == NULL || payload->buffer == NULL || payload->length < 1)
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return;
+#ifdef HAVE_SCTP
+	janus_ice_relay_data_shared(handle, packet, payload);
+#else
+	JANUS_LOG(LOG_WARN, "Asked to relay data, but Data Channels support has not been compiled...\n");
+#endif
+}
+
+size_t janus_plugin_get_data_pending(janus_plugin_session *plugin_session) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped))
+		return 0;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle)
+		return 0;
+	return (size_t)g_atomic_int_get(&handle->data_pending);
+}
+
+void janus_plugin_account_memory(janus_plugin *plugin, janus_plugin_session *plugin_session, int bytes) {
+	if(plugin_session == NULL) {
+		/* Plugin-wide memory */
+		janus_memory_account *account = (plugin && plugins_memory) ? g_hash_table_lookup(plugins_memory, plugin) : NULL;
+		if(account != NULL)
+			janus_memory_add(account, JANUS_MEMORY_PLUGIN, bytes);
+		return;
+	}
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped))
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle)
+		return;
+	janus_memory_add(&handle->memory, JANUS_MEMORY_PLUGIN, bytes);
+}
+
 void janus_plugin_send_pli(janus_plugin_session *plugin_session) {
 	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped))
 		return;
@@ -3847,6 +4898,10 @@ void janus_plugin_end_session(janus_plugin_session *plugin_session) {
 	g_source_unref(timeout_source);
 }
 
+gboolean janus_plugin_events_is_wanted(janus_plugin *plugin) {
+	return plugin ? janus_events_is_plugin_wanted(plugin->get_package()) : FALSE;
+}
+
 void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugin_session, json_t *event) {
 	/* A plugin asked to notify an event to the handlers */
 	if(!plugin || !event || !json_is_object(event))
@@ -3873,7 +4928,7 @@ void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugi
 		session_id = session->session_id;
 	}
 	/* Notify event handlers */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_plugin_wanted(plugin->get_package())) {
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_PLUGIN, JANUS_EVENT_SUBTYPE_NONE,
 			session_id, handle_id, opaque_id, plugin->get_package(), event);
 	} else {
@@ -3890,6 +4945,77 @@ gboolean janus_plugin_auth_signature_contains(janus_plugin *plugin, const char *
 }
 
 
+/* Plugins don't depend on each other, and neither do transports, which
+ * means their init() can be invoked in parallel when it's slow (e.g.,
+ * because a plugin has many rooms or recordings to set up): we first open
+ * all the shared objects, then initialize them, and then register them */
+typedef struct janus_module_init {
+	gboolean transport;
+	gpointer module;
+	void *so;
+	int result;
+	GThread *thread;
+} janus_module_init;
+
+static janus_module_init *janus_module_init_create(gboolean transport, gpointer module, void *so) {
+	janus_module_init *m = g_malloc0(sizeof(janus_module_init));
+	m->transport = transport;
+	m->module = module;
+	m->so = so;
+	return m;
+}
+
+static void *janus_module_init_thread(void *data) {
+	janus_module_init *m = (janus_module_init *)data;
+	if(m->transport) {
+		janus_transport *transport = (janus_transport *)m->module;
+		m->result = transport->init(&janus_handler_transport, configs_folder);
+	} else {
+		janus_plugin *plugin = (janus_plugin *)m->module;
+		m->result = plugin->init(&janus_handler_plugin, configs_folder);
+	}
+	return NULL;
+}
+
+static void janus_modules_init(const char *type, GList *modules, gboolean parallel) {
+	gint64 start = janus_get_monotonic_time();
+	GList *l = modules;
+	while(l) {
+		janus_module_init *m = (janus_module_init *)l->data;
+		if(parallel && g_list_length(modules) > 1) {
+			GError *error = NULL;
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "init %s", m->transport ?
+				((janus_transport *)m->module)->get_package() : ((janus_plugin *)m->module)->get_package());
+			m->thread = g_thread_try_new(tname, &janus_module_init_thread, m, &error);
+			if(error != NULL) {
+				/* Initialize this one here, then */
+				JANUS_LOG(LOG_WARN, "Got error %d (%s) trying to launch the init thread, initializing synchronously...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				m->thread = NULL;
+				janus_module_init_thread(m);
+			}
+		} else {
+			janus_module_init_thread(m);
+		}
+		l = l->next;
+	}
+	/* Wait for all of them */
+	l = modules;
+	while(l) {
+		janus_module_init *m = (janus_module_init *)l->data;
+		if(m->thread != NULL)
+			g_thread_join(m->thread);
+		m->thread = NULL;
+		l = l->next;
+	}
+	JANUS_LOG(LOG_INFO, "Initialized %d %s %sin %"SCNi64"ms\n", g_list_length(modules), type,
+		(parallel && g_list_length(modules) > 1) ? "in parallel " : "",
+		(janus_get_monotonic_time() - start)/1000);
+}
+
+
 /* Main */
 gint main(int argc, char *argv[])
 {
@@ -4384,6 +5510,10 @@ gint main(int argc, char *argv[])
 	if(item && item->value)
 		janus_log_colors = janus_is_true(item->value);
 	JANUS_PRINT("Debug/log colors are %s\n", janus_log_colors ? "enabled" : "disabled");
+	item = janus_config_get(config, config_general, janus_config_type_item, "debug_deferred");
+	if(item && item->value)
+		janus_log_deferred = janus_is_true(item->value);
+	JANUS_PRINT("Deferred log formatting is %s\n", janus_log_deferred ? "enabled" : "disabled");
 	item = janus_config_get(config, config_general, janus_config_type_item, "debug_locks");
 	if(item && item->value)
 		lock_debug = janus_is_true(item->value);
@@ -4495,6 +5625,53 @@ gint main(int argc, char *argv[])
 		}
 	}
 
+	/* Check how many threads and queued requests the lane of each plugin can have */
+	item = janus_config_get(config, config_general, janus_config_type_item, "request_threads");
+	if(item && item->value) {
+		int rt = atoi(item->value);
+		if(rt < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring request_threads value as it's not a positive integer\n");
+		} else {
+			request_threads = rt;
+		}
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "request_queue");
+	if(item && item->value) {
+		int rq = atoi(item->value);
+		if(rq < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring request_queue value as it's not a positive integer\n");
+		} else {
+			request_queue = rq;
+		}
+	}
+
+	/* Check if the overload protection should be enabled */
+	item = janus_config_get(config, config_general, janus_config_type_item, "overload_lag");
+	if(item && item->value) {
+		int ol = atoi(item->value);
+		if(ol < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring overload_lag value as it's not a positive integer\n");
+		} else {
+			overload_lag = ol;
+		}
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "overload_queue_depth");
+	if(item && item->value) {
+		int oqd = atoi(item->value);
+		if(oqd < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring overload_queue_depth value as it's not a positive integer\n");
+		} else {
+			overload_queue_depth = oqd;
+		}
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "overload_shed_recordings");
+	if(item && item->value)
+		overload_shed_recordings = janus_is_true(item->value);
+	if(overload_lag > 0) {
+		JANUS_LOG(LOG_INFO, "Overload protection enabled (lag threshold %"SCNu32"ms, queue depth threshold %"SCNu32"%s)\n",
+			overload_lag, overload_queue_depth, overload_shed_recordings ? ", shedding recordings" : "");
+	}
+
 	/* Check if a custom candidates timeout value was specified */
 	item = janus_config_get(config, config_general, janus_config_type_item, "candidates_timeout");
 	if(item && item->value) {
@@ -4539,6 +5716,47 @@ gint main(int argc, char *argv[])
 	} else {
 		janus_recorder_init(FALSE, NULL);
 	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "recordings_index");
+	if(item && item->value && janus_is_true(item->value))
+		janus_recorder_set_indexing(TRUE);
+	item = janus_config_get(config, config_general, janus_config_type_item, "recordings_segment_duration");
+	if(item && item->value) {
+		int seconds = atoi(item->value);
+		if(seconds < 0)
+			JANUS_LOG(LOG_WARN, "Ignoring recordings_segment_duration value as it's not a positive integer\n");
+		else
+			janus_recorder_set_segment_duration(seconds);
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "recordings_async");
+	if(item && item->value && janus_is_true(item->value)) {
+		/* Frames will be written to disk by a dedicated thread */
+		size_t backlog = 16*1024*1024;
+		item = janus_config_get(config, config_general, janus_config_type_item, "recordings_async_backlog");
+		if(item && item->value) {
+			int kb = atoi(item->value);
+			if(kb <= 0)
+				JANUS_LOG(LOG_WARN, "Ignoring recordings_async_backlog value as it's not a positive integer\n");
+			else
+				backlog = (size_t)kb*1024;
+		}
+		gboolean drop = TRUE;
+		item = janus_config_get(config, config_general, janus_config_type_item, "recordings_async_policy");
+		if(item && item->value) {
+			if(!strcasecmp(item->value, "wait"))
+				drop = FALSE;
+			else if(strcasecmp(item->value, "drop"))
+				JANUS_LOG(LOG_WARN, "Unsupported recordings_async_policy value '%s', using 'drop'\n", item->value);
+		}
+		gboolean uring = FALSE;
+		item = janus_config_get(config, config_general, janus_config_type_item, "recordings_async_backend");
+		if(item && item->value) {
+			if(!strcasecmp(item->value, "io_uring"))
+				uring = TRUE;
+			else if(strcasecmp(item->value, "stdio"))
+				JANUS_LOG(LOG_WARN, "Unsupported recordings_async_backend value '%s', using 'stdio'\n", item->value);
+		}
+		janus_recorder_set_async(backlog, drop, uring);
+	}
 
 	/* Check if we should hide dependencies in "info" requests */
 	item = janus_config_get(config, config_general, janus_config_type_item, "hide_dependencies");
@@ -4552,6 +5770,7 @@ gint main(int argc, char *argv[])
 	char *turn_rest_api = NULL, *turn_rest_api_key = NULL;
 #ifdef HAVE_TURNRESTAPI
 	char *turn_rest_api_method = NULL;
+	gboolean turn_rest_api_cache = FALSE, turn_rest_api_nonblocking = FALSE;
 #endif
 	const char *nat_1_1_mapping = NULL;
 	uint16_t rtp_min_port = 0, rtp_max_port = 0;
@@ -4667,13 +5886,46 @@ gint main(int argc, char *argv[])
 	item = janus_config_get(config, config_nat, janus_config_type_item, "turn_rest_api_method");
 	if(item && item->value)
 		turn_rest_api_method = (char *)item->value;
+	item = janus_config_get(config, config_nat, janus_config_type_item, "turn_rest_api_cache");
+	if(item && item->value)
+		turn_rest_api_cache = janus_is_true(item->value);
+	item = janus_config_get(config, config_nat, janus_config_type_item, "turn_rest_api_nonblocking");
+	if(item && item->value)
+		turn_rest_api_nonblocking = janus_is_true(item->value);
 #endif
-	/* Do we need a limited number of static event loops, or is it ok to have one per handle (the default)? */
-	item = janus_config_get(config, config_general, janus_config_type_item, "event_loops");
+	/* Do we need a pool of static event loops (the default), or should each handle have its own? */
+	item = janus_config_get(config, config_general, janus_config_type_item, "event_loops_affinity");
 	if(item && item->value)
+		janus_ice_set_static_event_loops_affinity(item->value);
+	item = janus_config_get(config, config_general, janus_config_type_item, "allow_dedicated_loops");
+	if(item && item->value && janus_is_true(item->value))
+		janus_ice_allow_dedicated_loops();
+	item = janus_config_get(config, config_general, janus_config_type_item, "event_loops");
+	if(item && item->value && strcasecmp(item->value, "auto")) {
 		janus_ice_set_static_event_loops(atoi(item->value));
+	} else {
+		/* By default, we size the pool of loops automatically */
+		int max = 0;
+		item = janus_config_get(config, config_general, janus_config_type_item, "event_loops_max");
+		if(item && item->value)
+			max = atoi(item->value);
+		janus_ice_set_static_event_loops_auto(max);
+	}
 	/* Initialize the ICE stack now */
 	janus_ice_init(ice_lite, ice_tcp, full_trickle, ignore_mdns, ipv6, rtp_min_port, rtp_max_port);
+	/* How should mDNS candidates be resolved? */
+	item = janus_config_get(config, config_nat, janus_config_type_item, "mdns_cache_ttl");
+	if(item && item->value) {
+		int ttl = atoi(item->value);
+		if(ttl < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring mdns_cache_ttl value as it's not a positive integer\n");
+		} else {
+			janus_ice_set_mdns_cache_ttl(ttl);
+		}
+	}
+	item = janus_config_get(config, config_nat, janus_config_type_item, "ignore_unreachable_mdns");
+	if(item && item->value && janus_is_true(item->value))
+		janus_ice_set_ignore_unreachable_mdns(TRUE);
 	if(janus_ice_set_stun_server(stun_server, stun_port) < 0) {
 		if(!ignore_unreachable_ice_server) {
 			JANUS_LOG(LOG_FATAL, "Invalid STUN address %s:%u\n", stun_server, stun_port);
@@ -4699,6 +5951,7 @@ gint main(int argc, char *argv[])
 		JANUS_LOG(LOG_FATAL, "Invalid TURN REST API configuration: %s (%s, %s)\n", turn_rest_api, turn_rest_api_key, turn_rest_api_method);
 		exit(1);
 	}
+	janus_ice_set_turn_rest_api_cache(turn_rest_api_cache, turn_rest_api_nonblocking);
 #endif
 	item = janus_config_get(config, config_nat, janus_config_type_item, "nice_debug");
 	if(item && item->value && janus_is_true(item->value)) {
@@ -4748,6 +6001,34 @@ gint main(int argc, char *argv[])
 			janus_set_dscp(dscp);
 		}
 	}
+	/* Should the handles of each static loop share the same port? (ICE-Lite only) */
+	item = janus_config_get(config, config_nat, janus_config_type_item, "ice_lite_shared_ports");
+	if(item && item->value) {
+		uint16_t shared_min_port = 0, shared_max_port = 0;
+		char *maxport = strrchr(item->value, '-');
+		if(maxport != NULL) {
+			*maxport = '\0';
+			maxport++;
+			if(janus_string_to_uint16(item->value, &shared_min_port) < 0 ||
+					janus_string_to_uint16(maxport, &shared_max_port) < 0)
+				shared_min_port = shared_max_port = 0;
+			maxport--;
+			*maxport = '-';
+		} else if(janus_string_to_uint16(item->value, &shared_min_port) == 0) {
+			shared_max_port = shared_min_port;
+		}
+		if(shared_min_port == 0 || shared_max_port < shared_min_port) {
+			JANUS_LOG(LOG_WARN, "Invalid ICE-Lite shared ports range: %s (ignoring)\n", item->value);
+		} else {
+			/* Should all loops share the same port, and let the kernel spread the flows? */
+			item = janus_config_get(config, config_nat, janus_config_type_item, "ice_lite_reuseport");
+			gboolean reuseport = item && item->value && janus_is_true(item->value);
+			/* Should the kernel drop what can't be media or STUN before we see it? */
+			item = janus_config_get(config, config_nat, janus_config_type_item, "ice_lite_filter");
+			gboolean filter = item && item->value && janus_is_true(item->value);
+			janus_ice_enable_shared_ports(shared_min_port, shared_max_port, reuseport, filter);
+		}
+	}
 
 	/* NACK related stuff */
 	item = janus_config_get(config, config_media, janus_config_type_item, "min_nack_queue");
@@ -4779,6 +6060,90 @@ gint main(int argc, char *argv[])
 			janus_set_slowlink_threshold(st);
 		}
 	}
+	/* Latency histograms */
+	item = janus_config_get(config, config_media, janus_config_type_item, "latency_sampling");
+	if(item && item->value) {
+		int ls = atoi(item->value);
+		if(ls < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring latency_sampling value as it's not a positive integer\n");
+		} else {
+			janus_set_latency_sampling(ls);
+		}
+	}
+	/* Egress batching */
+	item = janus_config_get(config, config_media, janus_config_type_item, "egress_batch");
+	if(item && item->value) {
+		int eb = atoi(item->value);
+		if(eb < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring egress_batch value as it's not a positive integer\n");
+		} else {
+			janus_set_egress_batch(eb);
+		}
+	}
+	/* Incoming batching */
+	item = janus_config_get(config, config_media, janus_config_type_item, "incoming_batch");
+	if(item && item->value) {
+		int ib = atoi(item->value);
+		if(ib < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring incoming_batch value as it's not a positive integer\n");
+		} else {
+			janus_set_incoming_batch(ib);
+		}
+	}
+	/* RED and ULPFEC for outgoing media */
+	item = janus_config_get(config, config_media, janus_config_type_item, "fec");
+	if(item && item->value)
+		janus_set_fec(janus_is_true(item->value));
+	/* Pacing of outgoing video */
+	item = janus_config_get(config, config_media, janus_config_type_item, "pacing");
+	if(item && item->value && janus_is_true(item->value)) {
+		int burst = 40, factor = 250, max_delay = 100;
+		item = janus_config_get(config, config_media, janus_config_type_item, "pacing_burst");
+		if(item && item->value) {
+			int pb = atoi(item->value);
+			if(pb < 0)
+				JANUS_LOG(LOG_WARN, "Ignoring pacing_burst value as it's not a positive integer\n");
+			else
+				burst = pb;
+		}
+		item = janus_config_get(config, config_media, janus_config_type_item, "pacing_factor");
+		if(item && item->value) {
+			int pf = atoi(item->value);
+			if(pf <= 0)
+				JANUS_LOG(LOG_WARN, "Ignoring pacing_factor value as it's not a positive integer\n");
+			else
+				factor = pf;
+		}
+		item = janus_config_get(config, config_media, janus_config_type_item, "pacing_max_delay");
+		if(item && item->value) {
+			int pd = atoi(item->value);
+			if(pd < 0)
+				JANUS_LOG(LOG_WARN, "Ignoring pacing_max_delay value as it's not a positive integer\n");
+			else
+				max_delay = pd;
+		}
+		janus_set_pacing(TRUE, burst, factor, max_delay);
+	}
+	/* Memory soft limit per handle */
+	item = janus_config_get(config, config_media, janus_config_type_item, "memory_handle_limit");
+	if(item && item->value) {
+		int mhl = atoi(item->value);
+		if(mhl < 0 || mhl > 4*1024*1024-1) {
+			JANUS_LOG(LOG_WARN, "Ignoring memory_handle_limit value as it's not a valid size in kilobytes\n");
+		} else {
+			janus_memory_set_handle_limit((guint)mhl*1024);
+		}
+	}
+	/* Outgoing packets pool */
+	item = janus_config_get(config, config_media, janus_config_type_item, "packet_pool_size");
+	if(item && item->value) {
+		int pps = atoi(item->value);
+		if(pps < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring packet_pool_size value as it's not a positive integer\n");
+		} else {
+			janus_set_packet_pool_size(pps);
+		}
+	}
 	/* TWCC period */
 	item = janus_config_get(config, config_media, janus_config_type_item, "twcc_period");
 	if(item && item->value) {
@@ -4822,6 +6187,10 @@ gint main(int argc, char *argv[])
 	item = janus_config_get(config, config_certs, janus_config_type_item, "dtls_ciphers");
 	if(item && item->value)
 		dtls_ciphers = item->value;
+	const char *srtp_profiles = NULL;
+	item = janus_config_get(config, config_certs, janus_config_type_item, "srtp_profiles");
+	if(item && item->value)
+		srtp_profiles = item->value;
 	guint16 dtls_timeout = 1000;
 	item = janus_config_get(config, config_media, janus_config_type_item, "dtls_timeout");
 	if(item && item->value && janus_string_to_uint16(item->value, &dtls_timeout) < 0) {
@@ -4836,26 +6205,61 @@ gint main(int argc, char *argv[])
 	item = janus_config_get(config, config_certs, janus_config_type_item, "dtls_accept_selfsigned");
 	if(item && item->value)
 		dtls_accept_selfsigned = janus_is_true(item->value);
-	if(janus_dtls_srtp_init(server_pem, server_key, password, dtls_ciphers, dtls_timeout, rsa_private_key, dtls_accept_selfsigned) < 0) {
+	if(janus_dtls_srtp_init(server_pem, server_key, password, dtls_ciphers, srtp_profiles, dtls_timeout, rsa_private_key, dtls_accept_selfsigned) < 0) {
 		exit(1);
 	}
+	item = janus_config_get(config, config_certs, janus_config_type_item, "dtls_session_cache");
+	if(item && item->value)
+		janus_dtls_set_session_cache(janus_is_true(item->value));
 	/* Check if there's any custom value for the starting MTU to use in the BIO filter */
 	item = janus_config_get(config, config_media, janus_config_type_item, "dtls_mtu");
 	if(item && item->value)
 		janus_dtls_bio_agent_set_mtu(atoi(item->value));
+	/* Check if DTLS handshakes should be offloaded to dedicated threads */
+	item = janus_config_get(config, config_media, janus_config_type_item, "dtls_handshake_workers");
+	if(item && item->value && atoi(item->value) > 0) {
+		int dtls_hs_backlog = 256;
+		janus_config_item *backlog = janus_config_get(config, config_media, janus_config_type_item, "dtls_handshake_backlog");
+		if(backlog && backlog->value && atoi(backlog->value) > 0)
+			dtls_hs_backlog = atoi(backlog->value);
+		janus_dtls_set_handshake_pool(atoi(item->value), dtls_hs_backlog);
+	}
 
 #ifdef HAVE_SCTP
 	/* Initialize SCTP for DataChannels */
-	if(janus_sctp_init() < 0) {
+	int sctp_timer_interval = 0;
+	item = janus_config_get(config, config_media, janus_config_type_item, "sctp_timer_interval");
+	if(item && item->value && atoi(item->value) > 0)
+		sctp_timer_interval = atoi(item->value);
+	if(janus_sctp_init(sctp_timer_interval) < 0) {
 		exit(1);
 	}
+	/* Check how many bytes we can queue per association, if the peer is slow */
+	item = janus_config_get(config, config_media, janus_config_type_item, "sctp_pending_limit");
+	janus_config_item *sctp_policy = janus_config_get(config, config_media, janus_config_type_item, "sctp_pending_policy");
+	if((item && item->value) || (sctp_policy && sctp_policy->value)) {
+		uint32_t sctp_pending_limit = JANUS_SCTP_DEFAULT_PENDING_LIMIT;
+		if(item && item->value && janus_string_to_uint32(item->value, &sctp_pending_limit) < 0) {
+			JANUS_LOG(LOG_WARN, "Invalid SCTP pending limit '%s', using the default\n", item->value);
+			sctp_pending_limit = JANUS_SCTP_DEFAULT_PENDING_LIMIT;
+		}
+		janus_sctp_pending_policy policy = janus_sctp_pending_drop;
+		if(sctp_policy && sctp_policy->value) {
+			if(!strcasecmp(sctp_policy->value, "notify")) {
+				policy = janus_sctp_pending_notify;
+			} else if(strcasecmp(sctp_policy->value, "drop")) {
+				JANUS_LOG(LOG_WARN, "Unsupported SCTP pending policy '%s', using 'drop'\n", sctp_policy->value);
+			}
+		}
+		janus_sctp_set_pending_limit(sctp_pending_limit, policy);
+	}
 #else
 	JANUS_LOG(LOG_WARN, "Data Channels support not compiled\n");
 #endif
 
 	/* Sessions */
-	sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
-	janus_mutex_init(&sessions_mutex);
+	janus_sessions_init();
+	sessions_wheel = janus_timerwheel_new(G_USEC_PER_SEC);
 	/* Start the sessions timeout watchdog */
 	sessions_watchdog_context = g_main_context_new();
 	GMainLoop *watchdog_loop = g_main_loop_new(sessions_watchdog_context, FALSE);
@@ -4876,16 +6280,14 @@ gint main(int argc, char *argv[])
 		g_error_free(error);
 		exit(1);
 	}
-	/* Create a thread pool to handle asynchronous requests, no matter what the transport */
-	error = NULL;
-	tasks = g_thread_pool_new(janus_transport_task, NULL, -1, FALSE, &error);
-	if(error != NULL) {
-		/* Something went wrong... */
-		JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the request pool task thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
+	/* Create the lanes to handle asynchronous requests, no matter what the transport:
+	 * the core lane has a single thread, as those requests must be served in order */
+	core_lane = janus_request_lane_new("core", 1);
+	if(core_lane == NULL)
 		exit(1);
-	}
+	plugin_lanes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_request_lane_destroy);
+	JANUS_LOG(LOG_INFO, "Plugin request lanes: up to %d threads and %d queued requests each\n",
+		request_threads, request_queue);
 	/* Wait 120 seconds before stopping idle threads to avoid the creation of too many threads for AddressSanitizer. */
 	g_thread_pool_set_max_idle_time(120 * 1000);
 
@@ -4925,6 +6327,30 @@ gint main(int argc, char *argv[])
 					JANUS_LOG(LOG_INFO, "Setting event handlers statistics period to %d seconds\n", period);
 				}
 			}
+			item = janus_config_get(config, config_events, janus_config_type_item, "stats_mode");
+			if(item && item->value && !strcasecmp(item->value, "summary")) {
+				/* Statistics should be rolled up in periodic summaries, rather than sent per handle */
+				int loss_threshold = 0, rtt_threshold = 0;
+				item = janus_config_get(config, config_events, janus_config_type_item, "stats_loss_threshold");
+				if(item && item->value)
+					loss_threshold = atoi(item->value);
+				item = janus_config_get(config, config_events, janus_config_type_item, "stats_rtt_threshold");
+				if(item && item->value)
+					rtt_threshold = atoi(item->value);
+				if(loss_threshold < 0 || loss_threshold > 100) {
+					JANUS_LOG(LOG_WARN, "Invalid statistics loss threshold, disabling it\n");
+					loss_threshold = 0;
+				}
+				if(rtt_threshold < 0) {
+					JANUS_LOG(LOG_WARN, "Invalid statistics RTT threshold, disabling it\n");
+					rtt_threshold = 0;
+				}
+				janus_ice_set_event_stats_summary(TRUE, loss_threshold, rtt_threshold);
+				JANUS_LOG(LOG_INFO, "Sending media statistics to event handlers as summaries (loss threshold: %d%%, RTT threshold: %dms)\n",
+					loss_threshold, rtt_threshold);
+			} else if(item && item->value && strcasecmp(item->value, "handles")) {
+				JANUS_LOG(LOG_WARN, "Unsupported statistics mode '%s', sending statistics per handle\n", item->value);
+			}
 			/* Any event handlers to ignore? */
 			item = janus_config_get(config, config_events, janus_config_type_item, "disable");
 			if(item && item->value)
@@ -5034,6 +6460,42 @@ gint main(int argc, char *argv[])
 		if(disabled_eventhandlers != NULL)
 			g_strfreev(disabled_eventhandlers);
 		disabled_eventhandlers = NULL;
+		/* Check how many events we can queue for each handler, and what to do when full */
+		guint events_queue_size = 0, events_overflow_sample = 10;
+		janus_events_overflow_policy events_overflow = janus_events_overflow_drop_oldest;
+		item = janus_config_get(config, config_events, janus_config_type_item, "queue_size");
+		if(item && item->value) {
+			int size = atoi(item->value);
+			if(size < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid event handlers queue size, using default value (unlimited)\n");
+			} else {
+				events_queue_size = size;
+			}
+		}
+		item = janus_config_get(config, config_events, janus_config_type_item, "overflow_policy");
+		if(item && item->value) {
+			events_overflow = janus_events_overflow_policy_from_string(item->value);
+			if(events_overflow == janus_events_overflow_invalid) {
+				JANUS_LOG(LOG_WARN, "Invalid event handlers overflow policy '%s', using default value (drop_oldest)\n", item->value);
+				events_overflow = janus_events_overflow_drop_oldest;
+			}
+		}
+		janus_config_item *overflow_types = janus_config_get(config, config_events, janus_config_type_item, "overflow_types");
+		item = janus_config_get(config, config_events, janus_config_type_item, "overflow_sample");
+		if(item && item->value) {
+			int sample = atoi(item->value);
+			if(sample < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid event handlers overflow sample, using default value (10)\n");
+			} else {
+				events_overflow_sample = sample;
+			}
+		}
+		janus_events_set_overflow(events_queue_size, events_overflow,
+			(overflow_types && overflow_types->value) ? overflow_types->value : "media", events_overflow_sample);
+		/* Any event subtypes or plugins nobody should receive events for? */
+		item = janus_config_get(config, config_events, janus_config_type_item, "exclude");
+		if(item && item->value)
+			janus_events_set_excluded(item->value);
 		/* Initialize the event broadcaster */
 		if(janus_events_init(enable_events, (server_name ? server_name : (char *)JANUS_SERVER_NAME), eventhandlers) < 0) {
 			JANUS_LOG(LOG_FATAL, "Error initializing the Event handlers mechanism...\n");
@@ -5042,6 +6504,7 @@ gint main(int argc, char *argv[])
 	}
 
 	/* Load plugins */
+	gint64 startup = janus_get_monotonic_time();
 	path = PLUGINDIR;
 	item = janus_config_get(config, config_general, janus_config_type_item, "plugins_folder");
 	if(item && item->value)
@@ -5057,6 +6520,10 @@ gint main(int argc, char *argv[])
 	item = janus_config_get(config, config_plugins, janus_config_type_item, "disable");
 	if(item && item->value)
 		disabled_plugins = g_strsplit(item->value, ",", -1);
+	/* Should we initialize them in parallel? */
+	item = janus_config_get(config, config_plugins, janus_config_type_item, "parallel_init");
+	gboolean parallel_init = item && item->value && janus_is_true(item->value);
+	GList *modules = NULL, *ml = NULL;
 	/* Open the shared objects */
 	struct dirent *pluginent = NULL;
 	char pluginpath[1024];
@@ -5129,35 +6596,62 @@ gint main(int argc, char *argv[])
 					janus_plugin->get_package(), janus_plugin->get_api_compatibility(), JANUS_PLUGIN_API_VERSION);
 				continue;
 			}
-			if(janus_plugin->init(&janus_handler_plugin, configs_folder) < 0) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_plugin->get_package());
-				dlclose(plugin);
-				continue;
-			}
-			JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_plugin->get_version(), janus_plugin->get_version_string());
-			JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_plugin->get_package(), janus_plugin->get_name());
-			JANUS_LOG(LOG_VERB, "\t   %s\n", janus_plugin->get_description());
-			JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_plugin->get_api_compatibility());
-			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && !janus_plugin->incoming_data) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin doesn't implement any callback for RTP/RTCP/data... is this on purpose?\n",
-					janus_plugin->get_package());
-			}
-			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && janus_plugin->incoming_data) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin will only handle data channels (no RTP/RTCP)... is this on purpose?\n",
-					janus_plugin->get_package());
-			}
-			if(plugins == NULL)
-				plugins = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(plugins, (gpointer)janus_plugin->get_package(), janus_plugin);
-			if(plugins_so == NULL)
-				plugins_so = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(plugins_so, (gpointer)janus_plugin->get_package(), plugin);
+			modules = g_list_append(modules, janus_module_init_create(FALSE, janus_plugin, plugin));
 		}
 	}
 	closedir(dir);
 	if(disabled_plugins != NULL)
 		g_strfreev(disabled_plugins);
 	disabled_plugins = NULL;
+	/* Plugins may account memory as soon as they're initialized (possibly
+	 * in parallel), so prepare their accounts first */
+	plugins_memory = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+	ml = modules;
+	while(ml) {
+		janus_module_init *m = (janus_module_init *)ml->data;
+		ml = ml->next;
+		g_hash_table_insert(plugins_memory, m->module, g_malloc0(sizeof(janus_memory_account)));
+	}
+	/* Now initialize the plugins we loaded */
+	janus_modules_init("plugins", modules, parallel_init);
+	ml = modules;
+	while(ml) {
+		janus_module_init *m = (janus_module_init *)ml->data;
+		ml = ml->next;
+		janus_plugin *janus_plugin = m->module;
+		void *plugin = m->so;
+		if(m->result < 0) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_plugin->get_package());
+			janus_memory_account *account = g_hash_table_lookup(plugins_memory, janus_plugin);
+			janus_memory_account_clear(account);
+			g_hash_table_remove(plugins_memory, janus_plugin);
+			/* Deferred log lines may still point to the plugin's strings */
+			janus_log_flush();
+			dlclose(plugin);
+			continue;
+		}
+		JANUS_LOG(LOG_VERB, "Plugin '%s':\n", janus_plugin->get_package());
+		JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_plugin->get_version(), janus_plugin->get_version_string());
+		JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_plugin->get_package(), janus_plugin->get_name());
+		JANUS_LOG(LOG_VERB, "\t   %s\n", janus_plugin->get_description());
+		JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_plugin->get_api_compatibility());
+		if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && !janus_plugin->incoming_data) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin doesn't implement any callback for RTP/RTCP/data... is this on purpose?\n",
+				janus_plugin->get_package());
+		}
+		if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && janus_plugin->incoming_data) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin will only handle data channels (no RTP/RTCP)... is this on purpose?\n",
+				janus_plugin->get_package());
+		}
+		if(plugins == NULL)
+			plugins = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(plugins, (gpointer)janus_plugin->get_package(), janus_plugin);
+		if(plugins_so == NULL)
+			plugins_so = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(plugins_so, (gpointer)janus_plugin->get_package(), plugin);
+	}
+	g_list_free_full(modules, (GDestroyNotify)g_free);
+	modules = NULL;
 
 	/* Load transports */
 	gboolean janus_api_enabled = FALSE, admin_api_enabled = FALSE;
@@ -5176,6 +6670,9 @@ gint main(int argc, char *argv[])
 	item = janus_config_get(config, config_transports, janus_config_type_item, "disable");
 	if(item && item->value)
 		disabled_transports = g_strsplit(item->value, ",", -1);
+	/* Should we initialize them in parallel? */
+	item = janus_config_get(config, config_transports, janus_config_type_item, "parallel_init");
+	parallel_init = item && item->value && janus_is_true(item->value);
 	/* Open the shared objects */
 	struct dirent *transportent = NULL;
 	char transportpath[1024];
@@ -5248,31 +6745,46 @@ gint main(int argc, char *argv[])
 					janus_transport->get_package(), janus_transport->get_api_compatibility(), JANUS_TRANSPORT_API_VERSION);
 				continue;
 			}
-			if(janus_transport->init(&janus_handler_transport, configs_folder) < 0) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_transport->get_package());
-				dlclose(transport);
-				continue;
-			}
-			JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_transport->get_version(), janus_transport->get_version_string());
-			JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_transport->get_package(), janus_transport->get_name());
-			JANUS_LOG(LOG_VERB, "\t   %s\n", janus_transport->get_description());
-			JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_transport->get_api_compatibility());
-			JANUS_LOG(LOG_VERB, "\t   Janus API: %s\n", janus_transport->is_janus_api_enabled() ? "enabled" : "disabled");
-			JANUS_LOG(LOG_VERB, "\t   Admin API: %s\n", janus_transport->is_admin_api_enabled() ? "enabled" : "disabled");
-			janus_api_enabled = janus_api_enabled || janus_transport->is_janus_api_enabled();
-			admin_api_enabled = admin_api_enabled || janus_transport->is_admin_api_enabled();
-			if(transports == NULL)
-				transports = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(transports, (gpointer)janus_transport->get_package(), janus_transport);
-			if(transports_so == NULL)
-				transports_so = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(transports_so, (gpointer)janus_transport->get_package(), transport);
+			modules = g_list_append(modules, janus_module_init_create(TRUE, janus_transport, transport));
 		}
 	}
 	closedir(dir);
 	if(disabled_transports != NULL)
 		g_strfreev(disabled_transports);
 	disabled_transports = NULL;
+	/* Now initialize the transports we loaded: as soon as they're up they
+	 * may start passing requests, which is why we do this after the plugins */
+	janus_modules_init("transport plugins", modules, parallel_init);
+	ml = modules;
+	while(ml) {
+		janus_module_init *m = (janus_module_init *)ml->data;
+		ml = ml->next;
+		janus_transport *janus_transport = m->module;
+		void *transport = m->so;
+		if(m->result < 0) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_transport->get_package());
+			janus_log_flush();
+			dlclose(transport);
+			continue;
+		}
+		JANUS_LOG(LOG_VERB, "Transport plugin '%s':\n", janus_transport->get_package());
+		JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_transport->get_version(), janus_transport->get_version_string());
+		JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_transport->get_package(), janus_transport->get_name());
+		JANUS_LOG(LOG_VERB, "\t   %s\n", janus_transport->get_description());
+		JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_transport->get_api_compatibility());
+		JANUS_LOG(LOG_VERB, "\t   Janus API: %s\n", janus_transport->is_janus_api_enabled() ? "enabled" : "disabled");
+		JANUS_LOG(LOG_VERB, "\t   Admin API: %s\n", janus_transport->is_admin_api_enabled() ? "enabled" : "disabled");
+		janus_api_enabled = janus_api_enabled || janus_transport->is_janus_api_enabled();
+		admin_api_enabled = admin_api_enabled || janus_transport->is_admin_api_enabled();
+		if(transports == NULL)
+			transports = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(transports, (gpointer)janus_transport->get_package(), janus_transport);
+		if(transports_so == NULL)
+			transports_so = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(transports_so, (gpointer)janus_transport->get_package(), transport);
+	}
+	g_list_free_full(modules, (GDestroyNotify)g_free);
+	modules = NULL;
 	/* Make sure at least a Janus API transport is available */
 	if(!janus_api_enabled) {
 		JANUS_LOG(LOG_FATAL, "No Janus API transport is available... enable at least one and restart Janus\n");
@@ -5294,6 +6806,9 @@ gint main(int argc, char *argv[])
 	}
 
 	/* Ok, Janus has started! Let the parent now about this if we're daemonizing */
+	startup_time = (janus_get_monotonic_time() - startup)/1000;
+	g_atomic_int_set(&ready, 1);
+	JANUS_LOG(LOG_INFO, "Janus is ready (plugins and transports initialized in %"SCNi64"ms)\n", startup_time);
 	if(daemonize) {
 		int code = 0;
 		ssize_t res = 0;
@@ -5343,16 +6858,21 @@ gint main(int argc, char *argv[])
 		g_hash_table_foreach(transports_so, janus_transportso_close, NULL);
 		g_hash_table_destroy(transports_so);
 	}
-	/* Get rid of requests tasks and thread too */
-	g_thread_pool_free(tasks, FALSE, FALSE);
+	/* Get rid of requests thread and lanes too */
 	JANUS_LOG(LOG_INFO, "Ending requests thread...\n");
 	g_async_queue_push(requests, &exit_message);
 	g_thread_join(requests_thread);
 	requests_thread = NULL;
+	janus_mutex_lock(&lanes_mutex);
+	g_clear_pointer(&plugin_lanes, g_hash_table_destroy);
+	g_clear_pointer(&core_lane, janus_request_lane_destroy);
+	janus_mutex_unlock(&lanes_mutex);
 	g_async_queue_unref(requests);
 
 	JANUS_LOG(LOG_INFO, "Destroying sessions...\n");
-	g_clear_pointer(&sessions, g_hash_table_destroy);
+	janus_sessions_deinit();
+	janus_timerwheel_destroy(sessions_wheel);
+	sessions_wheel = NULL;
 	janus_ice_deinit();
 	JANUS_LOG(LOG_INFO, "Freeing crypto resources...\n");
 	janus_dtls_srtp_cleanup();
@@ -5373,6 +6893,9 @@ gint main(int argc, char *argv[])
 		g_hash_table_foreach(plugins_so, janus_pluginso_close, NULL);
 		g_hash_table_destroy(plugins_so);
 	}
+	if(plugins_memory != NULL)
+		g_hash_table_destroy(plugins_memory);
+	plugins_memory = NULL;
 
 	JANUS_LOG(LOG_INFO, "Closing event handlers:\n");
 	janus_events_deinit();
@@ -5386,6 +6909,7 @@ gint main(int argc, char *argv[])
 	}
 
 	janus_recorder_deinit();
+	janus_text2pcap_deinit();
 	g_free(local_ip);
 	if (public_ips) {
 		g_list_free(public_ips);
@@ -31,6 +31,7 @@
 #include "mutex.h"
 #include "ice.h"
 #include "refcount.h"
+#include "timerwheel.h"
 #include "transports/transport.h"
 #include "events/eventhandler.h"
 #include "loggers/logger.h"
@@ -50,6 +51,8 @@ typedef struct janus_session {
 	GHashTable *ice_handles;
 	/*! \brief Time of the last activity on the session */
 	gint64 last_activity;
+	/*! \brief Timer used to check whether the session timed out */
+	janus_timerwheel_timer timeout_timer;
 	/*! \brief Pointer to the request instance (and the transport that originated the session) */
 	janus_request *source;
 	/*! \brief Flag to notify there's been a session timeout */
@@ -279,6 +282,11 @@ guint janus_get_public_ip_count(void);
 void janus_add_public_ip(const char *ip);
 /*! \brief Helper method to check whether the server is being shut down */
 gint janus_is_stopping(void);
+/*! \brief Helper method to check whether the overload protection kicked in
+ * \note While the server is overloaded, new sessions and handles are rejected
+ * with a JANUS_ERROR_OVERLOADED error, and optional work (e.g., stats events) is skipped
+ * @returns TRUE if the server is overloaded, FALSE otherwise (or if the protection is disabled) */
+gboolean janus_is_overloaded(void);
 
 /*! \brief Helper method to check whether WebRTC encryption is (as it should) enabled
  * \note This is required by the ICE and DTLS portions of the code to decide whether
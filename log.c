@@ -3,35 +3,94 @@
  * \copyright GNU General Public License v3
  * \brief     Buffered logging
  * \details   Implementation of a simple buffered logger designed to remove
- * I/O wait from threads that may be sensitive to such delays. Buffers are
- * saved and reused to reduce allocation calls. The logger output can then
- * be printed to stdout and/or a log file. If external loggers are added
- * to the core, the logger output is passed to those as well.
+ * I/O wait from threads that may be sensitive to such delays. Lines are
+ * passed to the log thread through a lock-free ring, so that threads
+ * logging a lot don't contend on a lock: if the ring is full, lines are
+ * dropped (and counted) instead. The logger output can then be printed
+ * to stdout and/or a log file. If external loggers are added to the
+ * core, the logger output is passed to those as well.
  *
  * \ingroup core
  * \ref core
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "log.h"
+#include "debug.h"
 #include "utils.h"
 #include "loggers/logger.h"
 
 #define THREAD_NAME "log"
 
-typedef struct janus_log_buffer janus_log_buffer;
-struct janus_log_buffer {
+/* Log lines are passed to the log thread through a bounded ring of slots
+ * (a multiple producers, single consumer version of Dmitry Vyukov's
+ * bounded queue): producers claim a slot with a CAS on the write position,
+ * format the line in place and then publish it by updating the sequence
+ * number of the slot, so no lock is ever taken. Lines that don't fit in
+ * the slot are formatted in a separate allocation. When the ring is full,
+ * lines are dropped and counted, and the log thread reports how many were
+ * lost as soon as there's room again, rather than slowing threads down */
+#define JANUS_LOG_RING_SIZE		4096
+#define JANUS_LOG_SLOT_SIZE		512
+
+/* In deferred mode, JANUS_LOG only copies the arguments in the slot, and
+ * the log thread does all the formatting (prefixes and timestamps too):
+ * strings are copied in the slot buffer, as they may be gone by the time
+ * the line is printed, while the format string is only referenced, as
+ * it's always a literal. Lines with more arguments than we can store, or
+ * conversions we don't handle, are formatted right away as usual */
+#define JANUS_LOG_MAX_ARGS		16
+gboolean janus_log_deferred = FALSE;
+
+typedef enum janus_log_arg_type {
+	janus_log_arg_none = 0,		/* Unsupported conversion */
+	janus_log_arg_percent,		/* A literal %, no argument */
+	janus_log_arg_int,
+	janus_log_arg_long,
+	janus_log_arg_llong,
+	janus_log_arg_size,
+	janus_log_arg_intmax,
+	janus_log_arg_ptrdiff,
+	janus_log_arg_double,
+	janus_log_arg_pointer,
+	janus_log_arg_string		/* Offset in the slot buffer, or -1 for NULL */
+} janus_log_arg_type;
+
+typedef union janus_log_arg {
+	int i;
+	long l;
+	long long ll;
+	size_t z;
+	intmax_t j;
+	ptrdiff_t t;
+	double d;
+	const void *p;
+} janus_log_arg;
+
+typedef struct janus_log_slot {
+	/* Sequence number: equal to the position when the slot is free, to position+1 when published */
+	guint64 sequence;
 	int64_t timestamp;
-	size_t allocated;
-	janus_log_buffer *next;
-	/* str is grown by allocating beyond the struct */
-	char str[1];
-};
+	/* Either the inline buffer, or an allocated one for long lines: NULL for deferred lines */
+	char *str;
+	/* Deferred lines only */
+	const char *format, *file, *function;
+	int level, lineno;
+	janus_log_arg args[JANUS_LOG_MAX_ARGS];
+	char line[JANUS_LOG_SLOT_SIZE];
+} janus_log_slot;
 
-#define INITIAL_BUFSZ		2000
+static janus_log_slot ring[JANUS_LOG_RING_SIZE];
+/* Whether the log thread is consuming the ring */
+static gint ready = 0;
+static guint64 write_pos = 0, read_pos = 0;
+static guint64 dropped = 0;
 
 static gboolean janus_log_console = TRUE;
 static char *janus_log_filepath = NULL;
@@ -41,16 +100,12 @@ static GHashTable *external_loggers = NULL;
 
 static volatile gint initialized = 0;
 static gint stopping = 0;
-static gint poolsz = 0;
-static gint maxpoolsz = 32;
-/* Buffers over this size will be freed */
-static size_t maxbuffersz = 8000;
+/* Set by the log thread when it's about to sleep: only the producer that
+ * resets it needs to take the lock and wake the thread up */
+static gint sleeping = 0;
 static GMutex lock;
 static GCond cond;
 static GThread *printthread = NULL;
-static janus_log_buffer *printhead = NULL;
-static janus_log_buffer *printtail = NULL;
-static janus_log_buffer *bufferpool = NULL;
 
 
 gboolean janus_log_is_stdout_enabled(void) {
@@ -66,113 +121,259 @@ char *janus_log_get_logfile_path(void) {
 }
 
 
-static void janus_log_freebuffers(janus_log_buffer **list) {
-	janus_log_buffer *b, *head = *list;
+static void janus_log_print(int64_t timestamp, const char *str) {
+	if(janus_log_console)
+		fputs(str, stdout);
+	if(janus_log_file)
+		fputs(str, janus_log_file);
+	/* External loggers may be changed at any time, so check under the lock */
+	g_mutex_lock(&lock);
+	if(external_loggers != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, external_loggers);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_logger *l = value;
+			if(l == NULL)
+				continue;
+			l->incoming_logline(timestamp, str);
+		}
+	}
+	g_mutex_unlock(&lock);
+}
 
-	while (head) {
-		b = head;
-		head = b->next;
-		g_free(b);
+/* Finds the next conversion in a format string: returns where it starts
+ * (or NULL if there are no more), where it ends, how many '*' widths and
+ * precisions it uses and which type of argument it takes */
+static const char *janus_log_next_spec(const char *f, const char **end, int *stars, janus_log_arg_type *type) {
+	const char *start = strchr(f, '%');
+	if(start == NULL)
+		return NULL;
+	*stars = 0;
+	*type = janus_log_arg_none;
+	const char *p = start+1;
+	if(*p == '%') {
+		*end = p+1;
+		*type = janus_log_arg_percent;
+		return start;
+	}
+	while(*p && strchr("-+ #0'", *p))
+		p++;
+	if(*p == '*') {
+		(*stars)++;
+		p++;
 	}
-	*list = NULL;
+	while(g_ascii_isdigit(*p))
+		p++;
+	if(*p == '.') {
+		p++;
+		if(*p == '*') {
+			(*stars)++;
+			p++;
+		}
+		while(g_ascii_isdigit(*p))
+			p++;
+	}
+	janus_log_arg_type integer = janus_log_arg_int;
+	gboolean wide = FALSE;
+	if(*p == 'h') {
+		p += (p[1] == 'h') ? 2 : 1;
+	} else if(*p == 'l') {
+		if(p[1] == 'l') {
+			integer = janus_log_arg_llong;
+			p += 2;
+		} else {
+			integer = janus_log_arg_long;
+			wide = TRUE;
+			p++;
+		}
+	} else if(*p == 'q') {
+		integer = janus_log_arg_llong;
+		p++;
+	} else if(*p == 'z') {
+		integer = janus_log_arg_size;
+		p++;
+	} else if(*p == 'j') {
+		integer = janus_log_arg_intmax;
+		p++;
+	} else if(*p == 't') {
+		integer = janus_log_arg_ptrdiff;
+		p++;
+	} else if(*p == 'L') {
+		/* long double: not worth a bigger slot, format these right away */
+		*end = p+1;
+		return start;
+	}
+	if(*p == '\0') {
+		*end = p;
+		return start;
+	}
+	if(strchr("diouxX", *p)) {
+		*type = integer;
+	} else if(*p == 'c') {
+		*type = wide ? janus_log_arg_none : janus_log_arg_int;
+	} else if(strchr("eEfFgGaA", *p)) {
+		*type = janus_log_arg_double;
+	} else if(*p == 's') {
+		*type = wide ? janus_log_arg_none : janus_log_arg_string;
+	} else if(*p == 'p') {
+		*type = janus_log_arg_pointer;
+	}
+	*end = p+1;
+	return start;
 }
 
-static janus_log_buffer *janus_log_getbuf(void) {
-	janus_log_buffer *b;
+/* Adds a single conversion to the line, with its '*' arguments if any */
+#define janus_log_render_arg(out, spec, stars, w, value) \
+	do { \
+		if(stars == 0) \
+			g_string_append_printf(out, spec, value); \
+		else if(stars == 1) \
+			g_string_append_printf(out, spec, w[0], value); \
+		else \
+			g_string_append_printf(out, spec, w[0], w[1], value); \
+	} while(0)
 
-	g_mutex_lock(&lock);
-	b = bufferpool;
-	if (b) {
-		bufferpool = b->next;
-		b->next = NULL;
-	} else {
-		poolsz++;
+/* Formats a deferred line, the same way JANUS_LOG does for the others */
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static void janus_log_render(janus_log_slot *slot, GString *out) {
+	g_string_truncate(out, 0);
+	if(janus_log_global_prefix)
+		g_string_append(out, janus_log_global_prefix);
+	if(janus_log_timestamps) {
+		char ts[64];
+		struct tm tmresult;
+		time_t ltime = slot->timestamp / G_USEC_PER_SEC;
+		localtime_r(&ltime, &tmresult);
+		strftime(ts, sizeof(ts), "[%a %b %e %T %Y] ", &tmresult);
+		g_string_append(out, ts);
 	}
-	g_mutex_unlock(&lock);
-	if (b == NULL) {
-		b = g_malloc(INITIAL_BUFSZ + sizeof(*b));
-		b->allocated = INITIAL_BUFSZ;
-		b->next = NULL;
+	g_string_append(out, janus_log_prefix[slot->level | ((int)janus_log_colors << 3)]);
+	if(slot->level == LOG_FATAL || slot->level == LOG_ERR || slot->level == LOG_DBG)
+		g_string_append_printf(out, "[%s:%s:%d] ", slot->file, slot->function, slot->lineno);
+	/* Now the line itself */
+	const char *f = slot->format, *start = NULL, *end = NULL;
+	int stars = 0, arg = 0, w[2] = { 0, 0 };
+	janus_log_arg_type type;
+	char spec[32];
+	while((start = janus_log_next_spec(f, &end, &stars, &type)) != NULL) {
+		g_string_append_len(out, f, start - f);
+		f = end;
+		if(type == janus_log_arg_percent) {
+			g_string_append_c(out, '%');
+			continue;
+		}
+		/* Conversions were validated when the line was stored */
+		g_strlcpy(spec, start, MIN((size_t)(end - start + 1), sizeof(spec)));
+		int i = 0;
+		for(i=0; i<stars; i++)
+			w[i] = slot->args[arg++].i;
+		janus_log_arg *a = &slot->args[arg++];
+		switch(type) {
+			case janus_log_arg_int:
+				janus_log_render_arg(out, spec, stars, w, a->i);
+				break;
+			case janus_log_arg_long:
+				janus_log_render_arg(out, spec, stars, w, a->l);
+				break;
+			case janus_log_arg_llong:
+				janus_log_render_arg(out, spec, stars, w, a->ll);
+				break;
+			case janus_log_arg_size:
+				janus_log_render_arg(out, spec, stars, w, a->z);
+				break;
+			case janus_log_arg_intmax:
+				janus_log_render_arg(out, spec, stars, w, a->j);
+				break;
+			case janus_log_arg_ptrdiff:
+				janus_log_render_arg(out, spec, stars, w, a->t);
+				break;
+			case janus_log_arg_double:
+				janus_log_render_arg(out, spec, stars, w, a->d);
+				break;
+			case janus_log_arg_pointer:
+				janus_log_render_arg(out, spec, stars, w, a->p);
+				break;
+			case janus_log_arg_string:
+				janus_log_render_arg(out, spec, stars, w, a->i < 0 ? "(null)" : slot->line + a->i);
+				break;
+			default:
+				break;
+		}
 	}
-	return b;
+	g_string_append(out, f);
 }
+#pragma GCC diagnostic warning "-Wformat-nonliteral"
 
-static void *janus_log_thread(void *ctx) {
-	janus_log_buffer *head, *b, *tofree = NULL;
-
-	while (!g_atomic_int_get(&stopping)) {
-		g_mutex_lock(&lock);
-		if (!printhead) {
-			g_cond_wait(&cond, &lock);
+/* Print all the published lines in the ring, and returns how many there were */
+static int janus_log_drain(void) {
+	static GString *deferred = NULL;
+	if(deferred == NULL)
+		deferred = g_string_sized_new(JANUS_LOG_SLOT_SIZE);
+	int count = 0;
+	while(TRUE) {
+		janus_log_slot *slot = &ring[read_pos & (JANUS_LOG_RING_SIZE-1)];
+		if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != read_pos + 1)
+			break;
+		if(slot->str == NULL) {
+			janus_log_render(slot, deferred);
+			janus_log_print(slot->timestamp, deferred->str);
+		} else {
+			janus_log_print(slot->timestamp, slot->str);
+			if(slot->str != slot->line)
+				g_free(slot->str);
 		}
-		head = printhead;
-		printhead = printtail = NULL;
-		g_mutex_unlock(&lock);
+		slot->str = NULL;
+		/* Give the slot back to the producers, for the next round */
+		__atomic_store_n(&slot->sequence, read_pos + JANUS_LOG_RING_SIZE, __ATOMIC_RELEASE);
+		read_pos++;
+		count++;
+	}
+	/* Did we lose anything because the ring was full? */
+	guint64 lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+	if(lost > 0) {
+		char line[128];
+		g_snprintf(line, sizeof(line), "[WARN] Log ring full, %"G_GUINT64_FORMAT" lines dropped\n", lost);
+		janus_log_print(janus_get_real_time(), line);
+		count++;
+	}
+	return count;
+}
 
-		if (head) {
-			for (b = head; b; b = b->next) {
-				if(janus_log_console)
-					fputs(b->str, stdout);
-				if(janus_log_file)
-					fputs(b->str, janus_log_file);
-				if(external_loggers != NULL) {
-					GHashTableIter iter;
-					gpointer value;
-					g_hash_table_iter_init(&iter, external_loggers);
-					while(g_hash_table_iter_next(&iter, NULL, &value)) {
-						janus_logger *l = value;
-						if(l == NULL)
-							continue;
-						l->incoming_logline(b->timestamp, b->str);
-					}
-				}
-			}
-			g_mutex_lock(&lock);
-			while (head) {
-				b = head;
-				head = b->next;
-				if (poolsz >= maxpoolsz || b->allocated > maxbuffersz) {
-					b->next = tofree;
-					tofree = b;
-					poolsz--;
-				} else {
-					b->next = bufferpool;
-					bufferpool = b;
-				}
-			}
-			g_mutex_unlock(&lock);
+static void *janus_log_thread(void *ctx) {
+	while(!g_atomic_int_get(&stopping)) {
+		if(janus_log_drain() > 0) {
 			if(janus_log_console)
 				fflush(stdout);
 			if(janus_log_file)
 				fflush(janus_log_file);
-			janus_log_freebuffers(&tofree);
+			continue;
 		}
-	}
-	/* print any remaining messages, stdout flushed on exit */
-	for (b = printhead; b; b = b->next) {
-		if(janus_log_console)
-			fputs(b->str, stdout);
-		if(janus_log_file)
-			fputs(b->str, janus_log_file);
-		if(external_loggers != NULL) {
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, external_loggers);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_logger *l = value;
-				if(l == NULL)
-					continue;
-				l->incoming_logline(b->timestamp, b->str);
-			}
+		/* Nothing to print: tell producers we're going to sleep, and check
+		 * again in case something was published in the meanwhile */
+		g_atomic_int_set(&sleeping, 1);
+		if(janus_log_drain() > 0) {
+			g_atomic_int_set(&sleeping, 0);
+			continue;
 		}
+		g_mutex_lock(&lock);
+		gint64 end = g_get_monotonic_time() + G_USEC_PER_SEC;
+		while(g_atomic_int_get(&sleeping) && !g_atomic_int_get(&stopping)) {
+			if(!g_cond_wait_until(&cond, &lock, end))
+				break;
+		}
+		g_atomic_int_set(&sleeping, 0);
+		g_mutex_unlock(&lock);
 	}
+	/* print any remaining messages, stdout flushed on exit: lines logged
+	 * from now on are printed directly */
+	g_atomic_int_set(&ready, 0);
+	janus_log_drain();
 	janus_log_set_loggers(NULL);
 	if(janus_log_console)
 		fflush(stdout);
 	if(janus_log_file)
 		fflush(janus_log_file);
-	janus_log_freebuffers(&printhead);
-	janus_log_freebuffers(&bufferpool);
 	g_mutex_clear(&lock);
 	g_cond_clear(&cond);
 
@@ -185,34 +386,219 @@ static void *janus_log_thread(void *ctx) {
 	return NULL;
 }
 
-void janus_vprintf(const char *format, ...) {
-	int len;
-	va_list ap, ap2;
-	janus_log_buffer *b = janus_log_getbuf();
-	b->timestamp = janus_get_real_time();
+/* Claims the next free slot in the ring: returns NULL if the ring is full */
+static janus_log_slot *janus_log_claim(guint64 *claimed) {
+	guint64 pos = __atomic_load_n(&write_pos, __ATOMIC_RELAXED);
+	while(TRUE) {
+		janus_log_slot *slot = &ring[pos & (JANUS_LOG_RING_SIZE-1)];
+		guint64 seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		gint64 diff = (gint64)(seq - pos);
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(&write_pos, &pos, pos + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				*claimed = pos;
+				return slot;
+			}
+			/* Somebody else got it, pos now has the new write position */
+		} else if(diff < 0) {
+			/* The ring is full: drop the line, rather than waiting */
+			__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&write_pos, __ATOMIC_RELAXED);
+		}
+	}
+}
 
+/* Publishes a slot, and wakes the log thread up if it was sleeping */
+static void janus_log_publish(janus_log_slot *slot, guint64 pos) {
+	__atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+	if(g_atomic_int_get(&sleeping) && g_atomic_int_compare_and_exchange(&sleeping, 1, 0)) {
+		g_mutex_lock(&lock);
+		g_cond_signal(&cond);
+		g_mutex_unlock(&lock);
+	}
+}
+
+/* Formats a line in a slot we claimed */
+static void janus_log_format(janus_log_slot *slot, const char *format, va_list ap) G_GNUC_PRINTF(2, 0);
+static void janus_log_format(janus_log_slot *slot, const char *format, va_list ap) {
+	va_list aq;
+	va_copy(aq, ap);
+	slot->str = slot->line;
+	int len = vsnprintf(slot->line, sizeof(slot->line), format, ap);
+	if(len >= (int)sizeof(slot->line)) {
+		/* Line too long for the slot */
+		slot->str = g_malloc(len + 1);
+		vsnprintf(slot->str, len + 1, format, aq);
+	} else if(len < 0) {
+		slot->line[0] = '\0';
+	}
+	va_end(aq);
+}
+
+void janus_vprintf(const char *format, ...) {
+	va_list ap;
 	va_start(ap, format);
-	va_copy(ap2, ap);
-	/* first try */
-	len = vsnprintf(b->str, b->allocated, format, ap);
+	if(!g_atomic_int_get(&ready)) {
+		/* The logger isn't ready (or is gone already), print directly */
+		vprintf(format, ap);
+		va_end(ap);
+		return;
+	}
+	guint64 pos = 0;
+	janus_log_slot *slot = janus_log_claim(&pos);
+	if(slot != NULL) {
+		slot->timestamp = janus_get_real_time();
+		janus_log_format(slot, format, ap);
+		janus_log_publish(slot, pos);
+	}
 	va_end(ap);
-	if (len >= (int) b->allocated) {
-		/* buffer wasn't big enough */
-		b = g_realloc(b, len + 1 + sizeof(*b));
-		b->allocated = len + 1;
-		vsnprintf(b->str, b->allocated, format, ap2);
+}
+
+/* Copies the arguments of a deferred line in a slot: returns FALSE if we
+ * can't, in which case the line must be formatted right away */
+static gboolean janus_log_store(janus_log_slot *slot, const char *format, va_list ap) {
+	const char *f = format, *start = NULL, *end = NULL;
+	int stars = 0, arg = 0, offset = 0, i = 0;
+	janus_log_arg_type type;
+	while((start = janus_log_next_spec(f, &end, &stars, &type)) != NULL) {
+		f = end;
+		if(type == janus_log_arg_percent)
+			continue;
+		if(type == janus_log_arg_none || (end - start) >= 32 || arg + stars + 1 > JANUS_LOG_MAX_ARGS)
+			return FALSE;
+		for(i=0; i<stars; i++)
+			slot->args[arg++].i = va_arg(ap, int);
+		janus_log_arg *a = &slot->args[arg++];
+		switch(type) {
+			case janus_log_arg_int:
+				a->i = va_arg(ap, int);
+				break;
+			case janus_log_arg_long:
+				a->l = va_arg(ap, long);
+				break;
+			case janus_log_arg_llong:
+				a->ll = va_arg(ap, long long);
+				break;
+			case janus_log_arg_size:
+				a->z = va_arg(ap, size_t);
+				break;
+			case janus_log_arg_intmax:
+				a->j = va_arg(ap, intmax_t);
+				break;
+			case janus_log_arg_ptrdiff:
+				a->t = va_arg(ap, ptrdiff_t);
+				break;
+			case janus_log_arg_double:
+				a->d = va_arg(ap, double);
+				break;
+			case janus_log_arg_pointer:
+				a->p = va_arg(ap, void *);
+				break;
+			case janus_log_arg_string: {
+				const char *str = va_arg(ap, const char *);
+				if(str == NULL) {
+					a->i = -1;
+					break;
+				}
+				/* Take the precision into account, as the string may not be terminated */
+				const char *dot = memchr(start, '.', end - start);
+				size_t len = 0;
+				if(dot == NULL)
+					len = strlen(str);
+				else if(dot[1] == '*')
+					len = slot->args[arg-2].i < 0 ? strlen(str) : strnlen(str, slot->args[arg-2].i);
+				else
+					len = strnlen(str, atoi(dot+1));
+				if(offset + len + 1 > sizeof(slot->line))
+					return FALSE;
+				memcpy(slot->line + offset, str, len);
+				slot->line[offset + len] = '\0';
+				a->i = offset;
+				offset += len + 1;
+				break;
+			}
+			default:
+				return FALSE;
+		}
 	}
-	va_end(ap2);
+	return TRUE;
+}
 
-	g_mutex_lock(&lock);
-	if (!printhead) {
-		printhead = printtail = b;
+void janus_log_deferred_printf(int level, const char *file, const char *function, int line, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	guint64 pos = 0;
+	janus_log_slot *slot = g_atomic_int_get(&ready) ? janus_log_claim(&pos) : NULL;
+	if(slot == NULL && g_atomic_int_get(&ready)) {
+		/* Ring full, the line was dropped */
+		va_end(ap);
+		return;
+	}
+	janus_log_slot local;
+	if(slot == NULL)
+		slot = &local;
+	slot->timestamp = janus_get_real_time();
+	slot->format = format;
+	slot->file = file;
+	slot->function = function;
+	slot->level = level;
+	slot->lineno = line;
+	slot->str = NULL;
+	va_list aq;
+	va_copy(aq, ap);
+	if(!janus_log_store(slot, format, aq)) {
+		/* Format the line right away (our own part first, then the rest) */
+		janus_log_slot copy;
+		copy.timestamp = slot->timestamp;
+		copy.format = "";
+		copy.file = file;
+		copy.function = function;
+		copy.level = level;
+		copy.lineno = line;
+		GString *line = g_string_sized_new(JANUS_LOG_SLOT_SIZE);
+		janus_log_render(&copy, line);
+		g_string_append_vprintf(line, format, ap);
+		if(line->len < sizeof(slot->line)) {
+			memcpy(slot->line, line->str, line->len + 1);
+			slot->str = slot->line;
+			g_string_free(line, TRUE);
+		} else {
+			slot->str = g_string_free(line, FALSE);
+		}
+	}
+	va_end(aq);
+	va_end(ap);
+	if(slot != &local) {
+		janus_log_publish(slot, pos);
+		return;
+	}
+	/* The logger isn't ready (or is gone already), print directly */
+	if(slot->str == NULL) {
+		GString *line = g_string_sized_new(JANUS_LOG_SLOT_SIZE);
+		janus_log_render(slot, line);
+		fputs(line->str, stdout);
+		g_string_free(line, TRUE);
 	} else {
-		printtail->next = b;
-		printtail = b;
+		fputs(slot->str, stdout);
+		if(slot->str != slot->line)
+			g_free(slot->str);
+	}
+}
+
+void janus_log_flush(void) {
+	if(!g_atomic_int_get(&ready))
+		return;
+	/* Wait for the log thread to go past all the lines claimed so far */
+	guint64 pos = __atomic_load_n(&write_pos, __ATOMIC_ACQUIRE);
+	if(pos == 0)
+		return;
+	while(g_atomic_int_get(&ready)) {
+		guint64 seq = __atomic_load_n(&ring[(pos - 1) & (JANUS_LOG_RING_SIZE-1)].sequence, __ATOMIC_ACQUIRE);
+		if((gint64)(seq - (pos - 1 + JANUS_LOG_RING_SIZE)) >= 0)
+			break;
+		g_usleep(1000);
 	}
-	g_cond_signal(&cond);
-	g_mutex_unlock(&lock);
 }
 
 int janus_log_init(gboolean daemon, gboolean console, const char *logfile) {
@@ -221,6 +607,9 @@ int janus_log_init(gboolean daemon, gboolean console, const char *logfile) {
 	}
 	g_mutex_init(&lock);
 	g_cond_init(&cond);
+	guint64 i = 0;
+	for(i=0; i<JANUS_LOG_RING_SIZE; i++)
+		ring[i].sequence = i;
 	if(console) {
 		/* Set stdout to block buffering, see BUFSIZ in stdio.h */
 		setvbuf(stdout, NULL, _IOFBF, 0);
@@ -254,6 +643,7 @@ int janus_log_init(gboolean daemon, gboolean console, const char *logfile) {
 			return -1;
 		}
 	}
+	g_atomic_int_set(&ready, 1);
 	printthread = g_thread_new(THREAD_NAME, &janus_log_thread, NULL);
 	return 0;
 }
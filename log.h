@@ -3,10 +3,11 @@
  * \copyright GNU General Public License v3
  * \brief    Buffered logging (headers)
  * \details  Implementation of a simple buffered logger designed to remove
- * I/O wait from threads that may be sensitive to such delays. Buffers are
- * saved and reused to reduce allocation calls. The logger output can then
- * be printed to stdout and/or a log file. If external loggers are added
- * to the core, the logger output is passed to those as well.
+ * I/O wait from threads that may be sensitive to such delays. Lines are
+ * handed to a log thread through a lock-free ring, or dropped and counted
+ * if the ring is full. The logger output can then be printed to stdout
+ * and/or a log file. If external loggers are added to the core, the logger
+ * output is passed to those as well.
  *
  * \ingroup core
  * \ref core
@@ -21,12 +22,33 @@
 /*! \brief Buffered vprintf
 * @param[in] format Format string as defined by glib, followed by the
 * optional parameters to insert into formatted string (printf style)
-* \note This output is buffered and may not appear immediately on stdout. */
+* \note This output is buffered and may not appear immediately on stdout.
+* Lines logged while the log ring is full are dropped, and their number is
+* reported by the logger as soon as there's room again. */
 void janus_vprintf(const char *format, ...) G_GNUC_PRINTF(1, 2);
 
+/*! \brief Whether JANUS_LOG should defer the formatting of lines to the log thread */
+extern gboolean janus_log_deferred;
+/*! \brief Deferred version of JANUS_LOG, used when janus_log_deferred is TRUE
+* \note The caller thread only copies the arguments (strings included),
+* while the prefixes, the timestamp and the line itself are formatted by
+* the log thread: lines using conversions that can't be deferred (e.g.,
+* \c long \c double ones) or too many arguments are formatted right away.
+* The format string, file and function are not copied, which means they
+* must be string literals (as in JANUS_LOG), and that janus_log_flush must
+* be called before unloading the code they belong to.
+* @param[in] level The log level
+* @param[in] file The source file (__FILE__)
+* @param[in] function The function (__FUNCTION__)
+* @param[in] line The line (__LINE__)
+* @param[in] format Format string, followed by the arguments (printf style) */
+void janus_log_deferred_printf(int level, const char *file, const char *function, int line, const char *format, ...) G_GNUC_PRINTF(5, 6);
+/*! \brief Wait for the log thread to print all the lines logged so far */
+void janus_log_flush(void);
+
 /*! \brief Log initialization
-* \note This should be called before attempting to use the logger. A buffer
-* pool and processing thread are created.
+* \note This should be called before attempting to use the logger. The log
+* ring and processing thread are created.
 * @param daemon Whether the Janus is running as a daemon or not
 * @param console Whether the output should be printed on stdout or not
 * @param logfile Log file to save the output to, if any
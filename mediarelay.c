@@ -0,0 +1,599 @@
+/*! \file    mediarelay.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared pool of plain RTP relay workers
+ * \details  Implementation of the pool of relay workers plugins can use
+ * to wait for packets from plain RTP peers. Each worker has its own epoll
+ * instance (or, where that's not available, rebuilds a poll array at each
+ * iteration), and a pipe other threads use to wake it up when a call is
+ * added or needs attention. Calls are only ever touched by their worker,
+ * except for the few atomic flags other threads set to ask for an update.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef HAVE_EPOLL_CREATE1
+#include <sys/epoll.h>
+#endif
+
+#include "mediarelay.h"
+#include "debug.h"
+#include "mutex.h"
+#include "refcount.h"
+#include "utils.h"
+
+/* How many events we get out of each epoll_wait, at most */
+#define JANUS_MEDIARELAY_MAX_EVENTS	64
+
+typedef struct janus_mediarelay_worker janus_mediarelay_worker;
+
+/* A watched socket: this is what we ask epoll to give back to us */
+typedef struct janus_mediarelay_fd {
+	/* The call this socket belongs to */
+	janus_mediarelay_call *call;
+	/* The socket itself, or -1 if this slot is free */
+	int fd;
+} janus_mediarelay_fd;
+
+struct janus_mediarelay_call {
+	/* Worker this call was assigned to */
+	janus_mediarelay_worker *worker;
+	/* Callbacks to invoke, and opaque pointer to pass them */
+	const janus_mediarelay_callbacks *callbacks;
+	gpointer user_data;
+	/* Sockets we're watching for this call */
+	janus_mediarelay_fd watched[JANUS_MEDIARELAY_MAX_FDS];
+	/* Whether the worker picked this call up already, and whether it's over (only used by the worker) */
+	gboolean attached, over;
+	/* Whether prepare needs to be invoked again, whether we've been asked
+	 * to end the call, and whether it's in the pending list of the worker */
+	volatile gint updated, stopped, queued;
+	/* Whether done has not been invoked yet */
+	volatile gint active;
+	/* Reference counter for this instance */
+	janus_refcount ref;
+};
+
+struct janus_mediarelay_worker {
+	/* The pool this worker belongs to, and its index there */
+	janus_mediarelay_pool *pool;
+	int id;
+	/* The worker thread */
+	GThread *thread;
+#ifdef HAVE_EPOLL_CREATE1
+	/* The epoll instance */
+	int epfd;
+#else
+	/* The poll array, and the watched sockets each item refers to */
+	struct pollfd *fds;
+	janus_mediarelay_fd **entries;
+	guint fds_size;
+#endif
+	/* Pipe other threads use to wake the worker up */
+	int pipefd[2];
+	/* Calls with pending requests, and mutex to protect the list */
+	GList *pending;
+	janus_mutex mutex;
+	/* Calls handled by this worker, and the ones that are over (only used by the worker) */
+	GHashTable *calls;
+	GList *ended;
+	/* Which watched socket each file descriptor currently belongs to (only used by the worker) */
+	GHashTable *owners;
+	/* How many calls this worker is handling */
+	volatile gint load;
+	/* Traffic plugins accounted since the last check (only used by the
+	 * worker), and the per-second rates computed out of it at each check */
+	guint64 packets, bytes;
+	volatile gint packets_per_second, bytes_per_second;
+};
+
+struct janus_mediarelay_pool {
+	/* Name of the pool */
+	char *name;
+	/* The workers */
+	janus_mediarelay_worker *workers;
+	int num_workers;
+	/* Whether the pool is being destroyed */
+	volatile gint stopping;
+};
+
+static void janus_mediarelay_call_free(const janus_refcount *call_ref) {
+	janus_mediarelay_call *call = janus_refcount_containerof(call_ref, janus_mediarelay_call, ref);
+	g_free(call);
+}
+
+/* Helper to wake a worker up: the pipe is non-blocking, and a full pipe means a wakeup is pending anyway */
+static void janus_mediarelay_worker_wakeup(janus_mediarelay_worker *worker) {
+	int code = 1;
+	ssize_t res = 0;
+	do {
+		res = write(worker->pipefd[1], &code, sizeof(int));
+	} while(res == -1 && errno == EINTR);
+}
+
+static void janus_mediarelay_worker_drain(janus_mediarelay_worker *worker) {
+	int codes[16];
+	ssize_t res = 0;
+	do {
+		res = read(worker->pipefd[0], codes, sizeof(codes));
+	} while(res > 0 || (res == -1 && errno == EINTR));
+}
+
+/* Helper to put a call in the pending list of its worker */
+static void janus_mediarelay_call_queue(janus_mediarelay_call *call) {
+	if(!g_atomic_int_compare_and_exchange(&call->queued, 0, 1))
+		return;
+	janus_mediarelay_worker *worker = call->worker;
+	janus_refcount_increase(&call->ref);
+	janus_mutex_lock(&worker->mutex);
+	worker->pending = g_list_prepend(worker->pending, call);
+	janus_mutex_unlock(&worker->mutex);
+	janus_mediarelay_worker_wakeup(worker);
+}
+
+/* Helpers to start and stop watching a socket */
+static void janus_mediarelay_watch(janus_mediarelay_worker *worker, janus_mediarelay_fd *entry) {
+#ifdef HAVE_EPOLL_CREATE1
+	/* The socket may have been closed and recreated with the same number since
+	 * we last saw it, in which case epoll forgot about it: adding it again
+	 * covers both cases, and modifying it updates who it belongs to */
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.ptr = entry;
+	if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, entry->fd, &event) < 0 &&
+			(errno != EEXIST || epoll_ctl(worker->epfd, EPOLL_CTL_MOD, entry->fd, &event) < 0)) {
+		JANUS_LOG(LOG_ERR, "[%s-%d] Couldn't watch socket %d: %d (%s)\n",
+			worker->pool->name, worker->id, entry->fd, errno, g_strerror(errno));
+		entry->fd = -1;
+		return;
+	}
+#endif
+	/* If a different call thought this socket was its own, it's a stale
+	 * leftover of a socket that was closed: make sure it forgets about it */
+	janus_mediarelay_fd *previous = g_hash_table_lookup(worker->owners, GINT_TO_POINTER(entry->fd));
+	if(previous != NULL && previous != entry)
+		previous->fd = -1;
+	g_hash_table_insert(worker->owners, GINT_TO_POINTER(entry->fd), entry);
+}
+
+static void janus_mediarelay_unwatch(janus_mediarelay_worker *worker, janus_mediarelay_fd *entry, gboolean closed) {
+	if(entry->fd < 0)
+		return;
+	if(g_hash_table_lookup(worker->owners, GINT_TO_POINTER(entry->fd)) == entry) {
+		g_hash_table_remove(worker->owners, GINT_TO_POINTER(entry->fd));
+#ifdef HAVE_EPOLL_CREATE1
+		/* Closed sockets are removed from the epoll instance automatically */
+		if(!closed) {
+			struct epoll_event event = { 0 };
+			epoll_ctl(worker->epfd, EPOLL_CTL_DEL, entry->fd, &event);
+		}
+#else
+		(void)closed;
+#endif
+	}
+	entry->fd = -1;
+}
+
+/* Helper to ask the plugin which sockets to watch for a call */
+static void janus_mediarelay_call_prepare(janus_mediarelay_worker *worker, janus_mediarelay_call *call) {
+	int fds[JANUS_MEDIARELAY_MAX_FDS];
+	int num = call->callbacks->prepare(call->user_data, fds, JANUS_MEDIARELAY_MAX_FDS);
+	if(num < 0)
+		num = 0;
+	else if(num > JANUS_MEDIARELAY_MAX_FDS)
+		num = JANUS_MEDIARELAY_MAX_FDS;
+	/* Stop watching the sockets that are gone */
+	int i = 0, j = 0;
+	for(i=0; i<JANUS_MEDIARELAY_MAX_FDS; i++) {
+		janus_mediarelay_fd *entry = &call->watched[i];
+		if(entry->fd < 0)
+			continue;
+		for(j=0; j<num; j++) {
+			if(fds[j] == entry->fd)
+				break;
+		}
+		if(j == num)
+			janus_mediarelay_unwatch(worker, entry, FALSE);
+	}
+	/* Watch the new ones, and the old ones again */
+	for(j=0; j<num; j++) {
+		if(fds[j] < 0)
+			continue;
+		janus_mediarelay_fd *entry = NULL, *available = NULL;
+		for(i=0; i<JANUS_MEDIARELAY_MAX_FDS; i++) {
+			if(call->watched[i].fd == fds[j]) {
+				entry = &call->watched[i];
+				break;
+			}
+			if(available == NULL && call->watched[i].fd < 0)
+				available = &call->watched[i];
+		}
+		if(entry == NULL) {
+			if(available == NULL)
+				continue;
+			entry = available;
+			entry->fd = fds[j];
+		}
+		janus_mediarelay_watch(worker, entry);
+	}
+}
+
+/* Helper to mark a call as over: done is only invoked later, as there may still be events referring to it */
+static void janus_mediarelay_call_end(janus_mediarelay_worker *worker, janus_mediarelay_call *call) {
+	if(call->over)
+		return;
+	call->over = TRUE;
+	int i = 0;
+	for(i=0; i<JANUS_MEDIARELAY_MAX_FDS; i++)
+		janus_mediarelay_unwatch(worker, &call->watched[i], FALSE);
+	worker->ended = g_list_prepend(worker->ended, call);
+}
+
+/* Helper to get rid of the calls that are over */
+static void janus_mediarelay_worker_finalize(janus_mediarelay_worker *worker) {
+	while(worker->ended != NULL) {
+		janus_mediarelay_call *call = (janus_mediarelay_call *)worker->ended->data;
+		worker->ended = g_list_delete_link(worker->ended, worker->ended);
+		g_hash_table_remove(worker->calls, call);
+		call->callbacks->done(call->user_data);
+		g_atomic_int_set(&call->active, 0);
+		g_atomic_int_add(&worker->load, -1);
+		janus_refcount_decrease(&call->ref);
+	}
+}
+
+/* Helper to take care of the requests other threads made */
+static void janus_mediarelay_worker_pending(janus_mediarelay_worker *worker) {
+	janus_mutex_lock(&worker->mutex);
+	GList *pending = g_list_reverse(worker->pending);
+	worker->pending = NULL;
+	janus_mutex_unlock(&worker->mutex);
+	GList *temp = pending;
+	while(temp != NULL) {
+		janus_mediarelay_call *call = (janus_mediarelay_call *)temp->data;
+		g_atomic_int_set(&call->queued, 0);
+		if(!call->attached) {
+			/* This is a new call */
+			call->attached = TRUE;
+			g_hash_table_insert(worker->calls, call, call);
+		}
+		if(!call->over && g_atomic_int_get(&call->stopped)) {
+			janus_mediarelay_call_end(worker, call);
+		} else if(!call->over && !g_atomic_int_get(&worker->pool->stopping)) {
+			if(g_atomic_int_compare_and_exchange(&call->updated, 1, 0))
+				janus_mediarelay_call_prepare(worker, call);
+			if(!call->callbacks->check(call->user_data))
+				janus_mediarelay_call_end(worker, call);
+		}
+		janus_refcount_decrease(&call->ref);
+		temp = temp->next;
+	}
+	g_list_free(pending);
+}
+
+/* Helper to notify the plugin about something happening on a socket */
+static void janus_mediarelay_dispatch(janus_mediarelay_worker *worker, janus_mediarelay_fd *entry,
+		gboolean error, gboolean readable) {
+	janus_mediarelay_call *call = entry->call;
+	if(entry->fd < 0 || call->over)
+		return;
+	if(error) {
+		janus_mediarelay_error_action action = call->callbacks->error(call->user_data, entry->fd);
+		if(action == janus_mediarelay_error_closed)
+			janus_mediarelay_unwatch(worker, entry, TRUE);
+		else if(action == janus_mediarelay_error_hangup)
+			janus_mediarelay_call_end(worker, call);
+	} else if(readable) {
+		call->callbacks->incoming(call->user_data, entry->fd);
+	}
+}
+
+/* Helper to wait for something to happen, and dispatch it */
+static int janus_mediarelay_worker_wait(janus_mediarelay_worker *worker, int timeout) {
+	int i = 0;
+#ifdef HAVE_EPOLL_CREATE1
+	struct epoll_event events[JANUS_MEDIARELAY_MAX_EVENTS];
+	int num = epoll_wait(worker->epfd, events, JANUS_MEDIARELAY_MAX_EVENTS, timeout);
+	if(num < 0)
+		return errno == EINTR ? 0 : -1;
+	for(i=0; i<num; i++) {
+		janus_mediarelay_fd *entry = (janus_mediarelay_fd *)events[i].data.ptr;
+		if(entry == NULL) {
+			janus_mediarelay_worker_drain(worker);
+			continue;
+		}
+		janus_mediarelay_dispatch(worker, entry, (events[i].events & (EPOLLERR | EPOLLHUP)) != 0,
+			(events[i].events & EPOLLIN) != 0);
+	}
+#else
+	/* No epoll, so put all the sockets we know about in a poll array */
+	guint needed = 1 + g_hash_table_size(worker->owners);
+	if(needed > worker->fds_size) {
+		worker->fds_size = needed * 2;
+		worker->fds = g_realloc(worker->fds, worker->fds_size * sizeof(struct pollfd));
+		worker->entries = g_realloc(worker->entries, worker->fds_size * sizeof(janus_mediarelay_fd *));
+	}
+	guint num = 0;
+	worker->fds[num].fd = worker->pipefd[0];
+	worker->fds[num].events = POLLIN;
+	worker->fds[num].revents = 0;
+	worker->entries[num] = NULL;
+	num++;
+	GHashTableIter iter;
+	gpointer value = NULL;
+	g_hash_table_iter_init(&iter, worker->owners);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_mediarelay_fd *entry = (janus_mediarelay_fd *)value;
+		worker->fds[num].fd = entry->fd;
+		worker->fds[num].events = POLLIN;
+		worker->fds[num].revents = 0;
+		worker->entries[num] = entry;
+		num++;
+	}
+	int res = poll(worker->fds, num, timeout);
+	if(res < 0)
+		return errno == EINTR ? 0 : -1;
+	for(i=0; res > 0 && i<(int)num; i++) {
+		if(worker->fds[i].revents == 0)
+			continue;
+		res--;
+		if(worker->entries[i] == NULL) {
+			janus_mediarelay_worker_drain(worker);
+			continue;
+		}
+		/* The socket may have been closed or handed over while dispatching the previous ones */
+		if(worker->entries[i]->fd != worker->fds[i].fd)
+			continue;
+		janus_mediarelay_dispatch(worker, worker->entries[i], (worker->fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) != 0,
+			(worker->fds[i].revents & POLLIN) != 0);
+	}
+#endif
+	return 0;
+}
+
+/* Worker thread */
+static void *janus_mediarelay_worker_thread(void *data) {
+	janus_mediarelay_worker *worker = (janus_mediarelay_worker *)data;
+	janus_mediarelay_pool *pool = worker->pool;
+	JANUS_LOG(LOG_VERB, "[%s-%d] Joining media relay worker\n", pool->name, worker->id);
+	gint64 now = 0, last_check = janus_get_monotonic_time(), next_check = last_check + G_USEC_PER_SEC;
+	GHashTableIter iter;
+	gpointer key = NULL;
+	while(!g_atomic_int_get(&pool->stopping)) {
+		/* Start from calls that were added, updated or woken up */
+		janus_mediarelay_worker_pending(worker);
+		/* Check all calls once per second */
+		now = janus_get_monotonic_time();
+		if(now >= next_check) {
+			g_hash_table_iter_init(&iter, worker->calls);
+			while(g_hash_table_iter_next(&iter, &key, NULL)) {
+				janus_mediarelay_call *call = (janus_mediarelay_call *)key;
+				if(!call->over && !call->callbacks->check(call->user_data))
+					janus_mediarelay_call_end(worker, call);
+			}
+			/* Turn the traffic of the last period into rates */
+			gint64 elapsed = now - last_check;
+			if(elapsed > 0) {
+				g_atomic_int_set(&worker->packets_per_second, (gint)(worker->packets * G_USEC_PER_SEC / elapsed));
+				g_atomic_int_set(&worker->bytes_per_second, (gint)MIN(worker->bytes * G_USEC_PER_SEC / elapsed, G_MAXINT));
+			}
+			worker->packets = 0;
+			worker->bytes = 0;
+			last_check = now;
+			next_check = now + G_USEC_PER_SEC;
+		}
+		janus_mediarelay_worker_finalize(worker);
+		/* Wait for packets */
+		int timeout = (int)((next_check - now + 999) / 1000);
+		if(janus_mediarelay_worker_wait(worker, timeout) < 0) {
+			JANUS_LOG(LOG_ERR, "[%s-%d] Error waiting for media: %d (%s)\n",
+				pool->name, worker->id, errno, g_strerror(errno));
+			break;
+		}
+		janus_mediarelay_worker_finalize(worker);
+	}
+	/* Get rid of the calls that are still here */
+	janus_mediarelay_worker_pending(worker);
+	g_hash_table_iter_init(&iter, worker->calls);
+	while(g_hash_table_iter_next(&iter, &key, NULL))
+		janus_mediarelay_call_end(worker, (janus_mediarelay_call *)key);
+	janus_mediarelay_worker_finalize(worker);
+	JANUS_LOG(LOG_VERB, "[%s-%d] Leaving media relay worker\n", pool->name, worker->id);
+	return NULL;
+}
+
+/* Helpers to set up and tear down a worker */
+static void janus_mediarelay_worker_deinit(janus_mediarelay_worker *worker) {
+#ifdef HAVE_EPOLL_CREATE1
+	if(worker->epfd > -1)
+		close(worker->epfd);
+	worker->epfd = -1;
+#else
+	g_free(worker->fds);
+	worker->fds = NULL;
+	g_free(worker->entries);
+	worker->entries = NULL;
+#endif
+	if(worker->pipefd[0] > -1)
+		close(worker->pipefd[0]);
+	if(worker->pipefd[1] > -1)
+		close(worker->pipefd[1]);
+	worker->pipefd[0] = -1;
+	worker->pipefd[1] = -1;
+	if(worker->calls != NULL)
+		g_hash_table_destroy(worker->calls);
+	worker->calls = NULL;
+	if(worker->owners != NULL)
+		g_hash_table_destroy(worker->owners);
+	worker->owners = NULL;
+	janus_mutex_destroy(&worker->mutex);
+}
+
+static int janus_mediarelay_worker_init(janus_mediarelay_pool *pool, int id) {
+	janus_mediarelay_worker *worker = &pool->workers[id];
+	worker->pool = pool;
+	worker->id = id;
+	worker->pipefd[0] = -1;
+	worker->pipefd[1] = -1;
+	janus_mutex_init(&worker->mutex);
+	worker->calls = g_hash_table_new(NULL, NULL);
+	worker->owners = g_hash_table_new(NULL, NULL);
+#ifdef HAVE_EPOLL_CREATE1
+	worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(worker->epfd < 0) {
+		JANUS_LOG(LOG_ERR, "[%s-%d] Couldn't create epoll instance: %d (%s)\n", pool->name, id, errno, g_strerror(errno));
+		janus_mediarelay_worker_deinit(worker);
+		return -1;
+	}
+#endif
+	if(pipe(worker->pipefd) < 0) {
+		JANUS_LOG(LOG_ERR, "[%s-%d] Couldn't create pipe: %d (%s)\n", pool->name, id, errno, g_strerror(errno));
+		worker->pipefd[0] = -1;
+		worker->pipefd[1] = -1;
+		janus_mediarelay_worker_deinit(worker);
+		return -1;
+	}
+	fcntl(worker->pipefd[0], F_SETFL, fcntl(worker->pipefd[0], F_GETFL) | O_NONBLOCK);
+	fcntl(worker->pipefd[1], F_SETFL, fcntl(worker->pipefd[1], F_GETFL) | O_NONBLOCK);
+#ifdef HAVE_EPOLL_CREATE1
+	/* The pipe has no janus_mediarelay_fd associated with it */
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->pipefd[0], &event) < 0) {
+		JANUS_LOG(LOG_ERR, "[%s-%d] Couldn't watch pipe: %d (%s)\n", pool->name, id, errno, g_strerror(errno));
+		janus_mediarelay_worker_deinit(worker);
+		return -1;
+	}
+#endif
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "%s %d", pool->name, id);
+	worker->thread = g_thread_try_new(tname, janus_mediarelay_worker_thread, worker, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "[%s-%d] Got error %d (%s) trying to launch the media relay worker...\n",
+			pool->name, id, error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		worker->thread = NULL;
+		janus_mediarelay_worker_deinit(worker);
+		return -1;
+	}
+	return 0;
+}
+
+janus_mediarelay_pool *janus_mediarelay_pool_new(const char *name, int workers) {
+	if(workers < 1)
+		workers = 1;
+	janus_mediarelay_pool *pool = g_malloc0(sizeof(janus_mediarelay_pool));
+	pool->name = g_strdup(name ? name : "mediarelay");
+	pool->workers = g_malloc0(workers * sizeof(janus_mediarelay_worker));
+	int i = 0;
+	for(i=0; i<workers; i++) {
+		if(janus_mediarelay_worker_init(pool, i) < 0) {
+			janus_mediarelay_pool_destroy(pool);
+			return NULL;
+		}
+		pool->num_workers++;
+	}
+	JANUS_LOG(LOG_INFO, "Started %d media relay workers (%s)\n", pool->num_workers, pool->name);
+	return pool;
+}
+
+void janus_mediarelay_pool_destroy(janus_mediarelay_pool *pool) {
+	if(pool == NULL)
+		return;
+	g_atomic_int_set(&pool->stopping, 1);
+	int i = 0;
+	for(i=0; i<pool->num_workers; i++)
+		janus_mediarelay_worker_wakeup(&pool->workers[i]);
+	for(i=0; i<pool->num_workers; i++) {
+		janus_mediarelay_worker *worker = &pool->workers[i];
+		g_thread_join(worker->thread);
+		worker->thread = NULL;
+		janus_mediarelay_worker_deinit(worker);
+	}
+	g_free(pool->workers);
+	g_free(pool->name);
+	g_free(pool);
+}
+
+janus_mediarelay_call *janus_mediarelay_call_add(janus_mediarelay_pool *pool,
+		const janus_mediarelay_callbacks *callbacks, gpointer user_data) {
+	if(pool == NULL || callbacks == NULL || g_atomic_int_get(&pool->stopping))
+		return NULL;
+	if(!callbacks->prepare || !callbacks->incoming || !callbacks->error || !callbacks->check || !callbacks->done) {
+		JANUS_LOG(LOG_ERR, "[%s] Missing mandatory media relay callbacks\n", pool->name);
+		return NULL;
+	}
+	/* Pick the worker that's handling the fewest calls */
+	janus_mediarelay_worker *worker = &pool->workers[0];
+	int i = 0;
+	for(i=1; i<pool->num_workers; i++) {
+		if(g_atomic_int_get(&pool->workers[i].load) < g_atomic_int_get(&worker->load))
+			worker = &pool->workers[i];
+	}
+	janus_mediarelay_call *call = g_malloc0(sizeof(janus_mediarelay_call));
+	call->worker = worker;
+	call->callbacks = callbacks;
+	call->user_data = user_data;
+	for(i=0; i<JANUS_MEDIARELAY_MAX_FDS; i++) {
+		call->watched[i].call = call;
+		call->watched[i].fd = -1;
+	}
+	g_atomic_int_set(&call->active, 1);
+	g_atomic_int_set(&call->updated, 1);
+	janus_refcount_init(&call->ref, janus_mediarelay_call_free);
+	/* The worker has a reference of its own, which it releases after invoking done */
+	janus_refcount_increase(&call->ref);
+	g_atomic_int_inc(&worker->load);
+	janus_mediarelay_call_queue(call);
+	return call;
+}
+
+void janus_mediarelay_call_update(janus_mediarelay_call *call) {
+	if(call == NULL || !g_atomic_int_get(&call->active))
+		return;
+	g_atomic_int_set(&call->updated, 1);
+	janus_mediarelay_call_queue(call);
+}
+
+void janus_mediarelay_call_stop(janus_mediarelay_call *call) {
+	if(call == NULL || !g_atomic_int_get(&call->active))
+		return;
+	g_atomic_int_set(&call->stopped, 1);
+	janus_mediarelay_call_queue(call);
+}
+
+gboolean janus_mediarelay_call_is_active(janus_mediarelay_call *call) {
+	return call != NULL && g_atomic_int_get(&call->active);
+}
+
+void janus_mediarelay_call_add_traffic(janus_mediarelay_call *call, guint packets, guint bytes) {
+	if(call == NULL)
+		return;
+	call->worker->packets += packets;
+	call->worker->bytes += bytes;
+}
+
+int janus_mediarelay_pool_get_stats(janus_mediarelay_pool *pool, janus_mediarelay_worker_stats *stats, int max) {
+	if(pool == NULL || stats == NULL || max < 1)
+		return 0;
+	int i = 0;
+	for(i=0; i<pool->num_workers && i<max; i++) {
+		janus_mediarelay_worker *worker = &pool->workers[i];
+		stats[i].calls = g_atomic_int_get(&worker->load);
+		stats[i].packets_per_second = g_atomic_int_get(&worker->packets_per_second);
+		stats[i].bytes_per_second = g_atomic_int_get(&worker->bytes_per_second);
+	}
+	return i;
+}
+
+void janus_mediarelay_call_unref(janus_mediarelay_call *call) {
+	if(call != NULL)
+		janus_refcount_decrease(&call->ref);
+}
@@ -0,0 +1,140 @@
+/*! \file    mediarelay.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared pool of plain RTP relay workers (headers)
+ * \details  Plugins that gateway WebRTC to plain RTP peers (e.g., the SIP
+ * and NoSIP plugins) need to wait for packets on a handful of sockets for
+ * each call. Rather than spawning a thread per call, they can create a
+ * pool with a fixed number of workers, each waiting on the sockets of many
+ * calls at the same time (using epoll, where available). Calls are given
+ * to the worker that has the fewest when they're added, and stay there
+ * until they're over.
+ *
+ * Plugins provide a set of callbacks the worker invokes to get the sockets
+ * to watch, to notify them about incoming packets or socket errors, and
+ * to periodically ask whether the call is over. All callbacks for a call
+ * are invoked by the same worker, and so never concurrently: since the
+ * worker is shared, though, a callback that blocks delays the packets of
+ * all the other calls handled by the same worker.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_MEDIARELAY_H
+#define JANUS_MEDIARELAY_H
+
+#include <glib.h>
+
+/*! \brief Maximum number of sockets a single call can ask to be watched */
+#define JANUS_MEDIARELAY_MAX_FDS	8
+
+typedef struct janus_mediarelay_pool janus_mediarelay_pool;
+typedef struct janus_mediarelay_call janus_mediarelay_call;
+
+/*! \brief What a worker should do after notifying a socket error */
+typedef enum janus_mediarelay_error_action {
+	/*! \brief Keep on watching the socket */
+	janus_mediarelay_error_ignore = 0,
+	/*! \brief The callback closed the socket, so stop watching it */
+	janus_mediarelay_error_closed,
+	/*! \brief The call is over */
+	janus_mediarelay_error_hangup
+} janus_mediarelay_error_action;
+
+/*! \brief Load and throughput of a worker, as returned by janus_mediarelay_pool_get_stats */
+typedef struct janus_mediarelay_worker_stats {
+	/*! \brief How many calls the worker is handling */
+	int calls;
+	/*! \brief Packets per second plugins accounted on this worker, over the last check period */
+	int packets_per_second;
+	/*! \brief Bytes per second plugins accounted on this worker, over the last check period */
+	int bytes_per_second;
+} janus_mediarelay_worker_stats;
+
+/*! \brief Callbacks a worker invokes for the calls it handles */
+typedef struct janus_mediarelay_callbacks {
+	/*! \brief Invoked when the call is picked up by its worker, and every
+	 * time janus_mediarelay_call_update is called: this is where sockets can
+	 * be (re)connected, and where the worker learns which ones to watch
+	 * @param[in] user_data The opaque pointer the call was added with
+	 * @param[out] fds Array to fill with the sockets to watch
+	 * @param[in] max Size of the array
+	 * @returns How many sockets were put in the array */
+	int (* const prepare)(gpointer user_data, int *fds, int max);
+	/*! \brief Invoked when a watched socket is readable
+	 * @param[in] user_data The opaque pointer the call was added with
+	 * @param[in] fd The readable socket */
+	void (* const incoming)(gpointer user_data, int fd);
+	/*! \brief Invoked when a watched socket reported an error or hangup
+	 * @param[in] user_data The opaque pointer the call was added with
+	 * @param[in] fd The socket in error
+	 * @returns What the worker should do next */
+	janus_mediarelay_error_action (* const error)(gpointer user_data, int fd);
+	/*! \brief Invoked at least once per second, and right after prepare,
+	 * to figure out if the call is still going on
+	 * @param[in] user_data The opaque pointer the call was added with
+	 * @returns TRUE if the call is still going on, FALSE if it's over */
+	gboolean (* const check)(gpointer user_data);
+	/*! \brief Invoked once, when the call is over: its sockets are not
+	 * watched anymore at this point, so they can be closed
+	 * @param[in] user_data The opaque pointer the call was added with */
+	void (* const done)(gpointer user_data);
+} janus_mediarelay_callbacks;
+
+/*! \brief Method to create a new pool of workers
+ * @param[in] name Name of the pool, used to name the worker threads (e.g., "siprtp")
+ * @param[in] workers How many worker threads to start
+ * @returns A new janus_mediarelay_pool instance, or NULL in case of errors */
+janus_mediarelay_pool *janus_mediarelay_pool_new(const char *name, int workers);
+
+/*! \brief Method to stop and destroy a pool
+ * @note The done callback is invoked for all the calls that were still
+ * handled by the pool, before its workers go away
+ * @param[in] pool The pool to destroy */
+void janus_mediarelay_pool_destroy(janus_mediarelay_pool *pool);
+
+/*! \brief Method to add a new call to a pool
+ * @note Callbacks will start to be invoked on the worker the call is
+ * assigned to even before this function returns
+ * @param[in] pool The pool to add the call to
+ * @param[in] callbacks The callbacks to invoke for this call (must stay valid until done is invoked)
+ * @param[in] user_data An opaque pointer to pass to the callbacks
+ * @returns A reference to the new call, to release with janus_mediarelay_call_unref, or NULL in case of errors */
+janus_mediarelay_call *janus_mediarelay_call_add(janus_mediarelay_pool *pool,
+	const janus_mediarelay_callbacks *callbacks, gpointer user_data);
+
+/*! \brief Method to ask the worker to invoke the prepare callback of a call again, e.g., because sockets changed
+ * @param[in] call The call to update */
+void janus_mediarelay_call_update(janus_mediarelay_call *call);
+
+/*! \brief Method to ask the worker to end a call as soon as possible, whatever the check callback says
+ * @note The done callback is invoked by the worker, as usual
+ * @param[in] call The call to stop */
+void janus_mediarelay_call_stop(janus_mediarelay_call *call);
+
+/*! \brief Method to check whether a call is still handled by its worker
+ * @param[in] call The call to check
+ * @returns TRUE if the done callback has not been invoked yet, FALSE otherwise */
+gboolean janus_mediarelay_call_is_active(janus_mediarelay_call *call);
+
+/*! \brief Method to account traffic relayed for a call, to compute the throughput of its worker
+ * @note This must only be called from the callbacks of the call itself,
+ * since the counters belong to the worker and are not updated atomically
+ * @param[in] call The call the traffic was relayed for (NULL is ignored)
+ * @param[in] packets How many packets were relayed
+ * @param[in] bytes How many bytes were relayed */
+void janus_mediarelay_call_add_traffic(janus_mediarelay_call *call, guint packets, guint bytes);
+
+/*! \brief Method to get the load and throughput of the workers of a pool
+ * @param[in] pool The pool to query
+ * @param[out] stats Array to fill, one item per worker
+ * @param[in] max Size of the array
+ * @returns How many items were put in the array */
+int janus_mediarelay_pool_get_stats(janus_mediarelay_pool *pool, janus_mediarelay_worker_stats *stats, int max);
+
+/*! \brief Method to release a reference to a call
+ * @param[in] call The call to release */
+void janus_mediarelay_call_unref(janus_mediarelay_call *call);
+
+#endif
@@ -0,0 +1,147 @@
+/*! \file    memory.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Memory accounting
+ * \details  Lightweight accounting of the memory the core (and plugins)
+ * keep around on behalf of handles. Accounts only hold atomic per
+ * subsystem counters, updated where the buffers they track are allocated
+ * and released, and the global totals are updated at the same time:
+ * there's no list of accounts to walk, and aggregating per session or
+ * plugin is left to whoever's asking, which is rare compared to how
+ * often packets are stored and released.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <inttypes.h>
+
+#include "memory.h"
+#include "metrics.h"
+#include "debug.h"
+
+/* Global totals, per subsystem (64-bit, so we use the GCC atomic builtins rather than glib's) */
+static gint64 totals[JANUS_MEMORY_SUBSYSTEMS];
+/* Soft limit for handles */
+static guint handle_limit = 0;
+
+const char *janus_memory_subsystem_str(janus_memory_subsystem subsystem) {
+	switch(subsystem) {
+		case JANUS_MEMORY_RETRANSMIT:
+			return "retransmit";
+		case JANUS_MEMORY_MEDIA_QUEUE:
+			return "media-queue";
+		case JANUS_MEMORY_SCTP_PENDING:
+			return "sctp-pending";
+		case JANUS_MEMORY_RECORDER:
+			return "recorder";
+		case JANUS_MEMORY_PLUGIN:
+			return "plugin";
+		default:
+			break;
+	}
+	return NULL;
+}
+
+void janus_memory_add(janus_memory_account *account, janus_memory_subsystem subsystem, gint bytes) {
+	if(subsystem >= JANUS_MEMORY_SUBSYSTEMS || bytes == 0)
+		return;
+	if(account != NULL)
+		g_atomic_int_add(&account->bytes[subsystem], bytes);
+	__atomic_fetch_add(&totals[subsystem], (gint64)bytes, __ATOMIC_RELAXED);
+}
+
+void janus_memory_account_clear(janus_memory_account *account) {
+	if(account == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++) {
+		gint bytes = g_atomic_int_get(&account->bytes[i]);
+		if(bytes != 0)
+			janus_memory_add(account, i, -bytes);
+	}
+}
+
+gint64 janus_memory_account_total(janus_memory_account *account) {
+	if(account == NULL)
+		return 0;
+	gint64 total = 0;
+	int i = 0;
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++)
+		total += g_atomic_int_get(&account->bytes[i]);
+	if(total > g_atomic_int_get(&account->peak))
+		g_atomic_int_set(&account->peak, (gint)total);
+	return total;
+}
+
+json_t *janus_memory_account_summary(janus_memory_account *account) {
+	json_t *info = json_object();
+	if(account == NULL)
+		return info;
+	json_object_set_new(info, "total", json_integer(janus_memory_account_total(account)));
+	json_object_set_new(info, "peak", json_integer(g_atomic_int_get(&account->peak)));
+	int i = 0;
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++) {
+		gint bytes = g_atomic_int_get(&account->bytes[i]);
+		if(bytes != 0)
+			json_object_set_new(info, janus_memory_subsystem_str(i), json_integer(bytes));
+	}
+	if(handle_limit > 0) {
+		json_object_set_new(info, "over-limit", g_atomic_int_get(&account->over_limit) ? json_true() : json_false());
+		json_object_set_new(info, "limit-hits", json_integer(g_atomic_int_get(&account->limit_hits)));
+	}
+	return info;
+}
+
+void janus_memory_set_handle_limit(guint limit) {
+	handle_limit = limit;
+	if(limit > 0)
+		JANUS_LOG(LOG_INFO, "Memory soft limit per handle: %u bytes\n", limit);
+}
+
+guint janus_memory_get_handle_limit(void) {
+	return handle_limit;
+}
+
+gboolean janus_memory_account_check_limit(janus_memory_account *account, gboolean *changed) {
+	if(changed)
+		*changed = FALSE;
+	if(account == NULL)
+		return FALSE;
+	gint64 total = janus_memory_account_total(account);
+	gboolean over = (handle_limit > 0 && total > handle_limit);
+	gboolean was = g_atomic_int_get(&account->over_limit);
+	if(over != was) {
+		g_atomic_int_set(&account->over_limit, over);
+		if(over)
+			g_atomic_int_inc(&account->limit_hits);
+		if(changed)
+			*changed = TRUE;
+	}
+	return over;
+}
+
+json_t *janus_memory_summary(void) {
+	json_t *info = json_object();
+	gint64 total = 0;
+	int i = 0;
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++) {
+		gint64 bytes = __atomic_load_n(&totals[i], __ATOMIC_RELAXED);
+		json_object_set_new(info, janus_memory_subsystem_str(i), json_integer(bytes));
+		total += bytes;
+	}
+	json_object_set_new(info, "total", json_integer(total));
+	json_object_set_new(info, "handle-limit", json_integer(handle_limit));
+	return info;
+}
+
+void janus_memory_metrics(GString *text) {
+	if(text == NULL)
+		return;
+	janus_metrics_append_family(text, "janus_memory_bytes", "gauge", "Memory the core accounted, per subsystem");
+	int i = 0;
+	for(i=0; i<JANUS_MEMORY_SUBSYSTEMS; i++) {
+		g_string_append_printf(text, "janus_memory_bytes{subsystem=\"%s\"} %"SCNi64"\n",
+			janus_memory_subsystem_str(i), __atomic_load_n(&totals[i], __ATOMIC_RELAXED));
+	}
+}
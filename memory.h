@@ -0,0 +1,101 @@
+/*! \file    memory.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Memory accounting (headers)
+ * \details  Lightweight accounting of the memory the core (and plugins)
+ * keep around on behalf of handles, so that it's possible to see where
+ * the resident memory of an instance is going: the buffers that hold
+ * sent packets in case of retransmissions, the queue of the pacer, the
+ * data channel messages waiting to be sent, and so on. Each handle has
+ * its own janus_memory_account, which tracks bytes per subsystem, while
+ * the totals are kept globally; sessions and plugins are aggregated from
+ * the handles, when asked. This is not a replacement for a real memory
+ * profiler: only the buffers that are known to grow with the traffic are
+ * accounted, and only when they're allocated or released, which is why
+ * the overhead is a couple of atomic additions and nothing more.
+ *
+ * A soft limit can be configured for handles: when a handle goes over it,
+ * the core starts keeping a shorter history of sent packets for it, which
+ * is usually where most of the memory goes, until it's back below it.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_MEMORY_H
+#define JANUS_MEMORY_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief What memory is being used for */
+typedef enum janus_memory_subsystem {
+	/*! \brief Packets kept for retransmissions */
+	JANUS_MEMORY_RETRANSMIT = 0,
+	/*! \brief Packets waiting to be sent (e.g., by the pacer) */
+	JANUS_MEMORY_MEDIA_QUEUE,
+	/*! \brief Data channel messages waiting to be sent */
+	JANUS_MEMORY_SCTP_PENDING,
+	/*! \brief Recordings waiting to be written to disk */
+	JANUS_MEMORY_RECORDER,
+	/*! \brief Anything plugins accounted themselves */
+	JANUS_MEMORY_PLUGIN,
+	/*! \brief Number of subsystems (not a valid subsystem) */
+	JANUS_MEMORY_SUBSYSTEMS
+} janus_memory_subsystem;
+/*! \brief Helper to get a string representation of a subsystem
+ * @param[in] subsystem The janus_memory_subsystem value
+ * @returns The subsystem name, or NULL if invalid */
+const char *janus_memory_subsystem_str(janus_memory_subsystem subsystem);
+
+/*! \brief Memory used on behalf of a handle (or a plugin) */
+typedef struct janus_memory_account {
+	/*! \brief Bytes in use, per subsystem */
+	volatile gint bytes[JANUS_MEMORY_SUBSYSTEMS];
+	/*! \brief Highest total we've seen (sampled when checking it) */
+	volatile gint peak;
+	/*! \brief Whether we're over the soft limit, and how many times it happened */
+	volatile gint over_limit, limit_hits;
+} janus_memory_account;
+
+/*! \brief Account bytes that were allocated (positive) or released (negative)
+ * @note The global totals are always updated, even when there's no account
+ * @param[in] account The janus_memory_account to update, if any
+ * @param[in] subsystem What the memory is used for
+ * @param[in] bytes How many bytes were allocated or released */
+void janus_memory_add(janus_memory_account *account, janus_memory_subsystem subsystem, gint bytes);
+/*! \brief Remove whatever an account still has from the global totals,
+ * and reset it (e.g., when the handle it belongs to goes away)
+ * @param[in] account The janus_memory_account to clear */
+void janus_memory_account_clear(janus_memory_account *account);
+/*! \brief Get the bytes currently in use by an account
+ * @param[in] account The janus_memory_account to check
+ * @returns The total of all the subsystems */
+gint64 janus_memory_account_total(janus_memory_account *account);
+/*! \brief Get a JSON summary of an account (total, peak and per subsystem)
+ * @param[in] account The janus_memory_account to summarize
+ * @returns A JSON object */
+json_t *janus_memory_account_summary(janus_memory_account *account);
+
+/*! \brief Configure the soft limit for handles
+ * @param[in] limit How many bytes a handle can use before the core starts
+ * to degrade what it keeps for it (0 disables the limit) */
+void janus_memory_set_handle_limit(guint limit);
+/*! \brief Get the soft limit for handles
+ * @returns The limit in bytes, or 0 if disabled */
+guint janus_memory_get_handle_limit(void);
+/*! \brief Check whether an account is over the handle soft limit, and
+ * take note of when it goes above or back below it
+ * @param[in] account The janus_memory_account to check
+ * @param[out] changed Whether this changed since the last check (optional)
+ * @returns TRUE if the account is over the limit, FALSE otherwise */
+gboolean janus_memory_account_check_limit(janus_memory_account *account, gboolean *changed);
+
+/*! \brief Get a JSON summary of the global totals, per subsystem
+ * @returns A JSON object */
+json_t *janus_memory_summary(void);
+/*! \brief Append the global totals in the OpenMetrics text format
+ * @param[in] text The buffer to append to */
+void janus_memory_metrics(GString *text);
+
+#endif
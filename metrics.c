@@ -0,0 +1,99 @@
+/*! \file    metrics.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Core metrics
+ * \details  Counters and gauges the core keeps up to date as things
+ * happen, so that they can be exported (e.g., in the OpenMetrics text
+ * format Prometheus scrapes) without walking sessions and handles. Media
+ * traffic is not accounted per packet: the per-handle stats timer adds
+ * what each handle sent and received in the last second, which keeps
+ * atomic operations out of the media path.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <inttypes.h>
+
+#include "metrics.h"
+
+/* Gauges */
+static volatile gint sessions = 0, handles = 0;
+/* Counters (64-bit, so we use the GCC atomic builtins rather than glib's) */
+static guint64 sessions_total = 0, handles_total = 0;
+static guint64 packets_in = 0, packets_out = 0, bytes_in = 0, bytes_out = 0;
+static guint64 nacks_in = 0, nacks_out = 0, plis_in = 0, plis_out = 0;
+static guint64 srtp_errors = 0;
+
+#define janus_metrics_add(counter, value) __atomic_fetch_add(&counter, value, __ATOMIC_RELAXED)
+#define janus_metrics_get(counter) __atomic_load_n(&counter, __ATOMIC_RELAXED)
+
+void janus_metrics_session_created(void) {
+	g_atomic_int_inc(&sessions);
+	janus_metrics_add(sessions_total, 1);
+}
+
+void janus_metrics_session_destroyed(void) {
+	g_atomic_int_add(&sessions, -1);
+}
+
+void janus_metrics_handle_created(void) {
+	g_atomic_int_inc(&handles);
+	janus_metrics_add(handles_total, 1);
+}
+
+void janus_metrics_handle_destroyed(void) {
+	g_atomic_int_add(&handles, -1);
+}
+
+void janus_metrics_add_traffic(gboolean incoming, guint64 packets, guint64 bytes, guint64 nacks) {
+	if(packets > 0)
+		janus_metrics_add(*(incoming ? &packets_in : &packets_out), packets);
+	if(bytes > 0)
+		janus_metrics_add(*(incoming ? &bytes_in : &bytes_out), bytes);
+	if(nacks > 0)
+		janus_metrics_add(*(incoming ? &nacks_in : &nacks_out), nacks);
+}
+
+void janus_metrics_add_pli(gboolean incoming) {
+	janus_metrics_add(*(incoming ? &plis_in : &plis_out), 1);
+}
+
+void janus_metrics_add_srtp_errors(guint errors) {
+	if(errors > 0)
+		janus_metrics_add(srtp_errors, errors);
+}
+
+void janus_metrics_append_family(GString *text, const char *name, const char *type, const char *help) {
+	g_string_append_printf(text, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/* Helper to add the two samples (in and out) of a directional counter */
+static void janus_metrics_append_directions(GString *text, const char *name, const char *help, guint64 in, guint64 out) {
+	janus_metrics_append_family(text, name, "counter", help);
+	g_string_append_printf(text, "%s_total{direction=\"in\"} %"SCNu64"\n", name, in);
+	g_string_append_printf(text, "%s_total{direction=\"out\"} %"SCNu64"\n", name, out);
+}
+
+void janus_metrics_append(GString *text) {
+	if(text == NULL)
+		return;
+	janus_metrics_append_family(text, "janus_sessions", "gauge", "Active Janus API sessions");
+	g_string_append_printf(text, "janus_sessions %d\n", g_atomic_int_get(&sessions));
+	janus_metrics_append_family(text, "janus_sessions_created", "counter", "Janus API sessions created");
+	g_string_append_printf(text, "janus_sessions_created_total %"SCNu64"\n", janus_metrics_get(sessions_total));
+	janus_metrics_append_family(text, "janus_handles", "gauge", "Active handles");
+	g_string_append_printf(text, "janus_handles %d\n", g_atomic_int_get(&handles));
+	janus_metrics_append_family(text, "janus_handles_created", "counter", "Handles created");
+	g_string_append_printf(text, "janus_handles_created_total %"SCNu64"\n", janus_metrics_get(handles_total));
+	janus_metrics_append_directions(text, "janus_media_packets", "RTP packets and data messages exchanged with peers",
+		janus_metrics_get(packets_in), janus_metrics_get(packets_out));
+	janus_metrics_append_directions(text, "janus_media_bytes", "Bytes of media and data exchanged with peers",
+		janus_metrics_get(bytes_in), janus_metrics_get(bytes_out));
+	janus_metrics_append_directions(text, "janus_nacks", "NACKs received from and sent to peers",
+		janus_metrics_get(nacks_in), janus_metrics_get(nacks_out));
+	janus_metrics_append_directions(text, "janus_plis", "PLIs received from and sent to peers",
+		janus_metrics_get(plis_in), janus_metrics_get(plis_out));
+	janus_metrics_append_family(text, "janus_srtp_errors", "counter", "SRTP/SRTCP errors");
+	g_string_append_printf(text, "janus_srtp_errors_total %"SCNu64"\n", janus_metrics_get(srtp_errors));
+}
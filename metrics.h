@@ -0,0 +1,53 @@
+/*! \file    metrics.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Core metrics (headers)
+ * \details  Counters and gauges the core keeps up to date as things
+ * happen, so that they can be exported (e.g., in the OpenMetrics text
+ * format Prometheus scrapes) without walking sessions and handles. All
+ * values are updated atomically, and reading them takes no lock.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_METRICS_H
+#define JANUS_METRICS_H
+
+#include <glib.h>
+
+/*! \brief Take note of a new session */
+void janus_metrics_session_created(void);
+/*! \brief Take note of a session that went away */
+void janus_metrics_session_destroyed(void);
+/*! \brief Take note of a new handle */
+void janus_metrics_handle_created(void);
+/*! \brief Take note of a handle that went away */
+void janus_metrics_handle_destroyed(void);
+/*! \brief Add media traffic to the totals
+ * @note This is meant to be called periodically with what happened since
+ * the last time (e.g., by the per-handle stats timer), not per packet
+ * @param[in] incoming Whether this is traffic we received or sent
+ * @param[in] packets How many packets
+ * @param[in] bytes How many bytes
+ * @param[in] nacks How many NACKs */
+void janus_metrics_add_traffic(gboolean incoming, guint64 packets, guint64 bytes, guint64 nacks);
+/*! \brief Take note of a PLI
+ * @param[in] incoming Whether the PLI was received from a peer, or sent to one */
+void janus_metrics_add_pli(gboolean incoming);
+/*! \brief Add SRTP/SRTCP errors to the totals
+ * @param[in] errors How many errors */
+void janus_metrics_add_srtp_errors(guint errors);
+
+/*! \brief Helper to add the TYPE and HELP lines of a metric family
+ * @param[in] text The buffer to append to
+ * @param[in] name Name of the metric family (e.g., janus_sessions)
+ * @param[in] type Type of the metric family (e.g., gauge or counter)
+ * @param[in] help Description of the metric family */
+void janus_metrics_append_family(GString *text, const char *name, const char *type, const char *help);
+/*! \brief Helper to append all the core metrics in the OpenMetrics text format
+ * @note The caller is responsible for the final "# EOF" line
+ * @param[in] text The buffer to append to */
+void janus_metrics_append(GString *text);
+
+#endif
@@ -0,0 +1,313 @@
+/*! \file    mutex.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Mutex contention profiling
+ * \details  Only built when configuring with \c --enable-mutex-profiling ,
+ * in which case all the janus_mutex locks of the core and of the plugins,
+ * transports, event handlers and loggers built with it go through here.
+ * Each thread keeps its own counters, per callsite (the file and line the
+ * lock was taken at): how many times the lock was taken, how many times
+ * we had to wait for it and for how long, and for how long it was held
+ * before being released. Since the mutexes themselves have no room to keep
+ * where and when they were locked, each thread keeps a small stack of the
+ * mutexes it's holding for the purpose. The counters of a thread are only
+ * ever updated by the thread itself, which means the mutex protecting them
+ * is only contended when a report is being generated: when threads go away,
+ * their counters are merged with those of the threads that came before.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include "mutex.h"
+#include "utils.h"
+
+#ifdef JANUS_MUTEX_PROFILING
+
+#include <string.h>
+
+/* Stats of a single callsite */
+typedef struct janus_mutex_callsite {
+	const char *file;
+	int line;
+	guint64 locks, contended;
+	gint64 wait_total, wait_max;
+	gint64 hold_total, hold_max;
+} janus_mutex_callsite;
+static guint janus_mutex_callsite_hash(gconstpointer v) {
+	const janus_mutex_callsite *site = (const janus_mutex_callsite *)v;
+	return GPOINTER_TO_UINT(site->file) ^ ((guint)site->line * 2654435761u);
+}
+static gboolean janus_mutex_callsite_equal(gconstpointer a, gconstpointer b) {
+	const janus_mutex_callsite *s1 = (const janus_mutex_callsite *)a, *s2 = (const janus_mutex_callsite *)b;
+	return s1->file == s2->file && s1->line == s2->line;
+}
+static void janus_mutex_callsite_merge(janus_mutex_callsite *dst, const janus_mutex_callsite *src) {
+	dst->locks += src->locks;
+	dst->contended += src->contended;
+	dst->wait_total += src->wait_total;
+	if(src->wait_max > dst->wait_max)
+		dst->wait_max = src->wait_max;
+	dst->hold_total += src->hold_total;
+	if(src->hold_max > dst->hold_max)
+		dst->hold_max = src->hold_max;
+}
+
+/* Mutexes a thread is holding, and where and when it locked them */
+#define JANUS_MUTEX_PROFILE_DEPTH	32
+typedef struct janus_mutex_held {
+	janus_mutex *mutex;
+	janus_mutex_callsite *site;
+	gint64 acquired;
+} janus_mutex_held;
+
+/* Counters of a thread */
+typedef struct janus_mutex_profile_thread {
+	GMutex mutex;
+	GHashTable *sites;
+	janus_mutex_held held[JANUS_MUTEX_PROFILE_DEPTH];
+	int depth;
+} janus_mutex_profile_thread;
+
+/* Threads we have counters for, and counters of the threads that went away:
+ * these use GMutex directly, as janus_mutex would end up profiling itself */
+static GMutex threads_mutex;
+static GSList *threads = NULL;
+static GHashTable *retired = NULL;
+static void janus_mutex_profile_thread_free(gpointer data) {
+	janus_mutex_profile_thread *thread = (janus_mutex_profile_thread *)data;
+	g_mutex_lock(&threads_mutex);
+	threads = g_slist_remove(threads, thread);
+	if(retired == NULL)
+		retired = g_hash_table_new_full(janus_mutex_callsite_hash, janus_mutex_callsite_equal, NULL, g_free);
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, thread->sites);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_mutex_callsite *site = (janus_mutex_callsite *)value;
+		janus_mutex_callsite *old = g_hash_table_lookup(retired, site);
+		if(old == NULL) {
+			/* Move it as it is */
+			g_hash_table_iter_steal(&iter);
+			g_hash_table_add(retired, site);
+		} else {
+			janus_mutex_callsite_merge(old, site);
+		}
+	}
+	g_mutex_unlock(&threads_mutex);
+	g_hash_table_destroy(thread->sites);
+	g_mutex_clear(&thread->mutex);
+	g_free(thread);
+}
+static GPrivate thread_private = G_PRIVATE_INIT(janus_mutex_profile_thread_free);
+static janus_mutex_profile_thread *janus_mutex_profile_thread_get(void) {
+	janus_mutex_profile_thread *thread = g_private_get(&thread_private);
+	if(thread == NULL) {
+		thread = g_malloc0(sizeof(janus_mutex_profile_thread));
+		g_mutex_init(&thread->mutex);
+		thread->sites = g_hash_table_new_full(janus_mutex_callsite_hash, janus_mutex_callsite_equal, NULL, g_free);
+		g_private_set(&thread_private, thread);
+		g_mutex_lock(&threads_mutex);
+		threads = g_slist_prepend(threads, thread);
+		g_mutex_unlock(&threads_mutex);
+	}
+	return thread;
+}
+
+/* The actual locking */
+#ifdef USE_PTHREAD_MUTEX
+#define janus_mutex_raw_lock(a) pthread_mutex_lock(a)
+#define janus_mutex_raw_trylock(a) (pthread_mutex_trylock(a) == 0)
+#define janus_mutex_raw_unlock(a) pthread_mutex_unlock(a)
+#else
+#define janus_mutex_raw_lock(a) g_mutex_lock(a)
+#define janus_mutex_raw_trylock(a) g_mutex_trylock(a)
+#define janus_mutex_raw_unlock(a) g_mutex_unlock(a)
+#endif
+
+void janus_mutex_profile_acquired(janus_mutex *mutex, const char *file, int line, gboolean contended, gint64 waited) {
+	janus_mutex_profile_thread *thread = janus_mutex_profile_thread_get();
+	janus_mutex_callsite key = { .file = file, .line = line };
+	g_mutex_lock(&thread->mutex);
+	janus_mutex_callsite *site = g_hash_table_lookup(thread->sites, &key);
+	if(site == NULL) {
+		site = g_malloc0(sizeof(janus_mutex_callsite));
+		site->file = file;
+		site->line = line;
+		g_hash_table_add(thread->sites, site);
+	}
+	site->locks++;
+	if(contended) {
+		site->contended++;
+		site->wait_total += waited;
+		if(waited > site->wait_max)
+			site->wait_max = waited;
+	}
+	g_mutex_unlock(&thread->mutex);
+	/* If we're holding too many mutexes already, we don't track the hold time of this one */
+	if(thread->depth < JANUS_MUTEX_PROFILE_DEPTH) {
+		thread->held[thread->depth].mutex = mutex;
+		thread->held[thread->depth].site = site;
+		thread->held[thread->depth].acquired = janus_get_monotonic_time();
+		thread->depth++;
+	}
+}
+
+void janus_mutex_profile_release(janus_mutex *mutex) {
+	janus_mutex_profile_thread *thread = g_private_get(&thread_private);
+	if(thread == NULL)
+		return;
+	/* Mutexes are usually released in the reverse order they were locked */
+	int i = 0;
+	for(i = thread->depth-1; i >= 0; i--) {
+		if(thread->held[i].mutex == mutex)
+			break;
+	}
+	if(i < 0)
+		return;
+	gint64 held = janus_get_monotonic_time() - thread->held[i].acquired;
+	janus_mutex_callsite *site = thread->held[i].site;
+	g_mutex_lock(&thread->mutex);
+	site->hold_total += held;
+	if(held > site->hold_max)
+		site->hold_max = held;
+	g_mutex_unlock(&thread->mutex);
+	thread->depth--;
+	if(i < thread->depth)
+		memmove(&thread->held[i], &thread->held[i+1], (thread->depth-i)*sizeof(janus_mutex_held));
+}
+
+void janus_mutex_profile_lock(janus_mutex *mutex, const char *file, int line) {
+	gboolean contended = FALSE;
+	gint64 waited = 0;
+	if(!janus_mutex_raw_trylock(mutex)) {
+		/* Somebody else has it, measure how long we wait */
+		contended = TRUE;
+		gint64 start = janus_get_monotonic_time();
+		janus_mutex_raw_lock(mutex);
+		waited = janus_get_monotonic_time() - start;
+	}
+	janus_mutex_profile_acquired(mutex, file, line, contended, waited);
+}
+
+gboolean janus_mutex_profile_trylock(janus_mutex *mutex, const char *file, int line) {
+	if(!janus_mutex_raw_trylock(mutex))
+		return FALSE;
+	janus_mutex_profile_acquired(mutex, file, line, FALSE, 0);
+	return TRUE;
+}
+
+void janus_mutex_profile_unlock(janus_mutex *mutex) {
+	janus_mutex_profile_release(mutex);
+	janus_mutex_raw_unlock(mutex);
+}
+
+/* Reports */
+static void janus_mutex_profile_aggregate(GHashTable *report, GHashTable *sites, gboolean reset) {
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, sites);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_mutex_callsite *site = (janus_mutex_callsite *)value;
+		if(site->locks == 0)
+			continue;
+		/* Callsites are merged by name, as the same file may end up in different objects */
+		char name[256];
+		g_snprintf(name, sizeof(name), "%s:%d", site->file, site->line);
+		janus_mutex_callsite *total = g_hash_table_lookup(report, name);
+		if(total == NULL) {
+			total = g_malloc0(sizeof(janus_mutex_callsite));
+			total->file = site->file;
+			total->line = site->line;
+			g_hash_table_insert(report, g_strdup(name), total);
+		}
+		janus_mutex_callsite_merge(total, site);
+		if(reset) {
+			site->locks = site->contended = 0;
+			site->wait_total = site->wait_max = 0;
+			site->hold_total = site->hold_max = 0;
+		}
+	}
+}
+static gint janus_mutex_profile_compare_wait(gconstpointer a, gconstpointer b) {
+	const janus_mutex_callsite *s1 = *(janus_mutex_callsite * const *)a, *s2 = *(janus_mutex_callsite * const *)b;
+	return s1->wait_total < s2->wait_total ? 1 : (s1->wait_total > s2->wait_total ? -1 : 0);
+}
+static gint janus_mutex_profile_compare_hold(gconstpointer a, gconstpointer b) {
+	const janus_mutex_callsite *s1 = *(janus_mutex_callsite * const *)a, *s2 = *(janus_mutex_callsite * const *)b;
+	return s1->hold_total < s2->hold_total ? 1 : (s1->hold_total > s2->hold_total ? -1 : 0);
+}
+static gint janus_mutex_profile_compare_contended(gconstpointer a, gconstpointer b) {
+	const janus_mutex_callsite *s1 = *(janus_mutex_callsite * const *)a, *s2 = *(janus_mutex_callsite * const *)b;
+	return s1->contended < s2->contended ? 1 : (s1->contended > s2->contended ? -1 : 0);
+}
+static gint janus_mutex_profile_compare_locks(gconstpointer a, gconstpointer b) {
+	const janus_mutex_callsite *s1 = *(janus_mutex_callsite * const *)a, *s2 = *(janus_mutex_callsite * const *)b;
+	return s1->locks < s2->locks ? 1 : (s1->locks > s2->locks ? -1 : 0);
+}
+
+json_t *janus_mutex_profile_report(guint limit, const char *sort, gboolean reset) {
+	GCompareFunc compare = janus_mutex_profile_compare_wait;
+	if(sort == NULL || !strcasecmp(sort, "wait")) {
+		sort = "wait";
+	} else if(!strcasecmp(sort, "hold")) {
+		compare = janus_mutex_profile_compare_hold;
+	} else if(!strcasecmp(sort, "contended")) {
+		compare = janus_mutex_profile_compare_contended;
+	} else if(!strcasecmp(sort, "locks")) {
+		compare = janus_mutex_profile_compare_locks;
+	} else {
+		return NULL;
+	}
+	GHashTable *report = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	g_mutex_lock(&threads_mutex);
+	guint count = g_slist_length(threads);
+	GSList *temp = threads;
+	while(temp) {
+		janus_mutex_profile_thread *thread = (janus_mutex_profile_thread *)temp->data;
+		g_mutex_lock(&thread->mutex);
+		janus_mutex_profile_aggregate(report, thread->sites, reset);
+		g_mutex_unlock(&thread->mutex);
+		temp = temp->next;
+	}
+	if(retired != NULL) {
+		janus_mutex_profile_aggregate(report, retired, FALSE);
+		if(reset)
+			g_hash_table_remove_all(retired);
+	}
+	g_mutex_unlock(&threads_mutex);
+	/* Rank the callsites */
+	GPtrArray *sites = g_ptr_array_sized_new(g_hash_table_size(report));
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, report);
+	while(g_hash_table_iter_next(&iter, NULL, &value))
+		g_ptr_array_add(sites, value);
+	g_ptr_array_sort(sites, compare);
+	json_t *info = json_object();
+	json_object_set_new(info, "sort", json_string(sort));
+	json_object_set_new(info, "threads", json_integer(count));
+	json_t *list = json_array();
+	guint i = 0;
+	for(i = 0; i < sites->len && (limit == 0 || i < limit); i++) {
+		janus_mutex_callsite *site = g_ptr_array_index(sites, i);
+		json_t *s = json_object();
+		char name[256];
+		g_snprintf(name, sizeof(name), "%s:%d", site->file, site->line);
+		json_object_set_new(s, "callsite", json_string(name));
+		json_object_set_new(s, "locks", json_integer(site->locks));
+		json_object_set_new(s, "contended", json_integer(site->contended));
+		json_object_set_new(s, "wait-total", json_integer(site->wait_total));
+		json_object_set_new(s, "wait-max", json_integer(site->wait_max));
+		json_object_set_new(s, "hold-total", json_integer(site->hold_total));
+		json_object_set_new(s, "hold-max", json_integer(site->hold_max));
+		json_object_set_new(s, "hold-avg", json_integer(site->hold_total/site->locks));
+		json_array_append_new(list, s);
+	}
+	json_object_set_new(info, "callsites", list);
+	g_ptr_array_free(sites, TRUE);
+	g_hash_table_destroy(report);
+	return info;
+}
+
+#endif
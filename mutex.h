@@ -33,6 +33,8 @@ typedef pthread_mutex_t janus_mutex;
 #define janus_mutex_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:lock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); pthread_mutex_lock(a); };
 /*! \brief Janus mutex lock wrapper (selective locking debug) */
 #define janus_mutex_lock(a) { if(!lock_debug) { janus_mutex_lock_nodebug(a); } else { janus_mutex_lock_debug(a); } };
+/*! \brief Janus mutex lock attempt (no debug): evaluates to TRUE if the mutex was locked */
+#define janus_mutex_trylock(a) (pthread_mutex_trylock(a) == 0)
 /*! \brief Janus mutex unlock without debug */
 #define janus_mutex_unlock_nodebug(a) pthread_mutex_unlock(a);
 /*! \brief Janus mutex unlock with debug (prints the line that unlocked a mutex) */
@@ -71,6 +73,8 @@ typedef GMutex janus_mutex;
 #define janus_mutex_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:lock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); g_mutex_lock(a); };
 /*! \brief Janus mutex lock wrapper (selective locking debug) */
 #define janus_mutex_lock(a) { if(!lock_debug) { janus_mutex_lock_nodebug(a); } else { janus_mutex_lock_debug(a); } };
+/*! \brief Janus mutex lock attempt (no debug): evaluates to TRUE if the mutex was locked */
+#define janus_mutex_trylock(a) g_mutex_trylock(a)
 /*! \brief Janus mutex unlock without debug */
 #define janus_mutex_unlock_nodebug(a) g_mutex_unlock(a);
 /*! \brief Janus mutex unlock with debug (prints the line that unlocked a mutex) */
@@ -95,4 +99,68 @@ typedef GCond janus_condition;
 
 #endif
 
+#ifdef JANUS_MUTEX_PROFILING
+/* When profiling, locks and unlocks go through the functions in mutex.c,
+ * which keep track of where (file and line) mutexes are locked, and how
+ * long they're waited for and held there. Condition waits release the
+ * mutex while waiting, so that's accounted for as well */
+#include <jansson.h>
+
+/*! \brief Lock a mutex, taking note of how long we waited for it
+ * @param[in] mutex The mutex to lock
+ * @param[in] file The file the mutex is locked in
+ * @param[in] line The line the mutex is locked at */
+void janus_mutex_profile_lock(janus_mutex *mutex, const char *file, int line);
+/*! \brief Try locking a mutex, taking note of it if we succeeded
+ * @param[in] mutex The mutex to lock
+ * @param[in] file The file the mutex is locked in
+ * @param[in] line The line the mutex is locked at
+ * @returns TRUE if the mutex was locked, FALSE otherwise */
+gboolean janus_mutex_profile_trylock(janus_mutex *mutex, const char *file, int line);
+/*! \brief Unlock a mutex, taking note of how long it was held
+ * @param[in] mutex The mutex to unlock */
+void janus_mutex_profile_unlock(janus_mutex *mutex);
+/*! \brief Take note of a mutex that was just locked (e.g., after a condition wait)
+ * @param[in] mutex The mutex that was locked
+ * @param[in] file The file the mutex was locked in
+ * @param[in] line The line the mutex was locked at
+ * @param[in] contended Whether we had to wait to get the mutex
+ * @param[in] waited How long we waited, in microseconds */
+void janus_mutex_profile_acquired(janus_mutex *mutex, const char *file, int line, gboolean contended, gint64 waited);
+/*! \brief Take note of a mutex that is about to be unlocked (e.g., before a condition wait)
+ * @param[in] mutex The mutex that will be unlocked */
+void janus_mutex_profile_release(janus_mutex *mutex);
+/*! \brief Get a report of the callsites that locked mutexes, ranked
+ * @param[in] limit How many callsites to return at most (0 means all of them)
+ * @param[in] sort What to rank callsites by (wait, hold, contended or locks; wait if NULL)
+ * @param[in] reset Whether the statistics should be reset after generating the report
+ * @returns A JSON object, or NULL if the sort criteria is invalid */
+json_t *janus_mutex_profile_report(guint limit, const char *sort, gboolean reset);
+
+#undef janus_mutex_lock_nodebug
+#define janus_mutex_lock_nodebug(a) janus_mutex_profile_lock(a, __FILE__, __LINE__);
+#undef janus_mutex_lock_debug
+#define janus_mutex_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:lock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); janus_mutex_profile_lock(a, __FILE__, __LINE__); };
+#undef janus_mutex_trylock
+#define janus_mutex_trylock(a) janus_mutex_profile_trylock(a, __FILE__, __LINE__)
+#undef janus_mutex_unlock_nodebug
+#define janus_mutex_unlock_nodebug(a) janus_mutex_profile_unlock(a);
+#undef janus_mutex_unlock_debug
+#define janus_mutex_unlock_debug(a) { JANUS_PRINT("[%s:%s:%d:unlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); janus_mutex_profile_unlock(a); };
+
+#undef janus_condition_wait
+#ifdef USE_PTHREAD_MUTEX
+#define janus_condition_wait(a, b) { janus_mutex_profile_release(b); pthread_cond_wait(a, b); janus_mutex_profile_acquired(b, __FILE__, __LINE__, FALSE, 0); };
+#undef janus_condition_timedwait
+#define janus_condition_timedwait(a, b, c) ({ janus_mutex_profile_release(b); int janus_cond_res = pthread_cond_timedwait(a, b, c); \
+	janus_mutex_profile_acquired(b, __FILE__, __LINE__, FALSE, 0); janus_cond_res; });
+#else
+#define janus_condition_wait(a, b) { janus_mutex_profile_release(b); g_cond_wait(a, b); janus_mutex_profile_acquired(b, __FILE__, __LINE__, FALSE, 0); };
+#undef janus_condition_wait_until
+#define janus_condition_wait_until(a, b, c) ({ janus_mutex_profile_release(b); gboolean janus_cond_res = g_cond_wait_until(a, b, c); \
+	janus_mutex_profile_acquired(b, __FILE__, __LINE__, FALSE, 0); janus_cond_res; });
+#endif
+
+#endif
+
 #endif
@@ -38,8 +38,18 @@ room-<unique room ID>: {
 	audio_active_packets = 100 (number of packets with audio level, default=100, 2 seconds)
 	audio_level_average = 25 (average value of audio level, 127=muted, 0='too loud', default=25)
 	default_prebuffering = number of packets to buffer before decoding each participant (default=DEFAULT_PREBUFFERING)
+	shared_encoding = true|false (whether participants that are not contributing any audio, and so all hear
+		the same mix, should share a single Opus encoder when their settings match, default=false)
+	mix_loudest = <only mix the N loudest participants, ranked by audio level; participants using the
+		ssrc-audio-level extension are not even decoded when out of the ranking, default=0, mix everybody>
+	adaptive_quality = true|false (whether the mixer should lower the encoding quality of participants
+		when it falls behind, and restore it when it catches up, default=false)
+	adaptive_threshold = <smoothed lateness of the mixer, in milliseconds, above which the quality
+		is lowered, when adaptive_quality is enabled, default=5>
 	record = true|false (whether this room should be recorded, default=false)
 	record_file =	/path/to/recording.wav (where to save the recording)
+	record_filter = true|false (whether padding-only packets and Opus DTX runs should be left out
+		of the .mjr recordings of individual participants, when requested, default=false)
 
 		[The following lines are only needed if you want the mixed audio
 		to be automatically forwarded via plain RTP to an external component
@@ -68,6 +78,7 @@ room-<unique room ID>: {
  * \c create , \c edit , \c destroy , \c exists, \c allowed, \c kick, \c list,
  * \c mute , \c unmute , \c mute_room , \c unmute_room , \c listparticipants ,
  * \c resetdecoder , \c rtp_forward, \c stop_rtp_forward , \c list_forwarders ,
+ * \c add_link , \c remove_link , \c listlinks ,
  * \c play_file , \c is_playing and \c stop_file are synchronous requests,
  * which means you'll get a response directly within the context of the
  * transaction. \c create allows you to create a new audio conference bridge
@@ -101,6 +112,11 @@ room-<unique room ID>: {
  * recreate it again (useful for sidebars and "waiting rooms"); finally,
  * \c leave allows you to leave an audio conference bridge for good.
  *
+ * Packets that carry no audio (Opus DTX frames, or packets whose audio
+ * level extension reports -127dBov) are not decoded at all, since they
+ * wouldn't contribute anything to the mix: the info on participants the
+ * Admin API returns includes how many decodes were skipped this way.
+ *
  * The AudioBridge plugin also allows you to forward the mix to an
  * external listener, e.g., a gstreamer/ffmpeg pipeline waiting to
  * process the mixer audio stream. You can add new RTP forwarders with
@@ -110,6 +126,19 @@ room-<unique room ID>: {
  * you can configure a single static RTP forwarder in the plugin
  * configuration file.
  *
+ * The same mechanism can be used to have a room span several Janus
+ * instances, e.g., for very large conferences. Each node mixes its own
+ * participants, and sends this local mix to every peer node by means of
+ * an RTP forwarder with \c local_only set to \c true ; each node also
+ * creates a link for every peer node via \c add_link , which returns the
+ * port the mix of that peer should be sent to. The mixes received on
+ * links are added to what local participants hear (and to the recording
+ * of the room, if any), but not to what \c local_only forwarders send,
+ * which means remote audio is never sent back where it came from; regular
+ * forwarders still get the whole mix. Links only support Opus, and
+ * \c remove_link and \c listlinks can be used to manage them. The
+ * mixing cost of each node only depends on its own participants.
+ *
  * \c create can be used to create a new audio room, and has to be
  * formatted as follows:
  *
@@ -129,8 +158,13 @@ room-<unique room ID>: {
 	"audio_active_packets" : <number of packets with audio level (default=100, 2 seconds)>,
 	"audio_level_average" : <average value of audio level (127=muted, 0='too loud', default=25)>,
 	"default_prebuffering" : <number of packets to buffer before decoding each participant (default=DEFAULT_PREBUFFERING)>,
+	"shared_encoding" : <true|false, whether participants hearing the same mix should share an Opus encoder, default=false>,
+	"mix_loudest" : <only mix the N loudest participants, default=0 (mix everybody)>,
+	"adaptive_quality" : <true|false, whether the mixer should lower the encoding quality when it falls behind, default=false>,
+	"adaptive_threshold" : <smoothed lateness of the mixer (ms) above which the quality is lowered, default=5>,
 	"record" : <true|false, whether to record the room or not, default=false>,
 	"record_file" : "</path/to/the/recording.wav, optional>",
+	"record_filter" : <true|false, whether DTX runs and padding should be left out of participants' recordings, default=false>
 }
 \endverbatim
  *
@@ -322,6 +356,14 @@ room-<unique room ID>: {
 			"pin_required" : <true|false, whether a PIN is required to join this room>,
 			"sampling_rate" : <sampling rate of the mixer>,
 			"record" : <true|false, whether the room is being recorded>,
+			"record_filter" : <true|false, whether DTX runs and padding are left out of participants' recordings>,
+			"late_ticks" : <how many times the mixer fell behind by more than a frame>,
+			"tick_lateness" : <smoothed lateness of the mixer ticks, in microseconds>,
+			"tick_lateness_histogram" : { <how many mixer ticks were late by 0-1ms, 1-2ms, 2-5ms, 5-10ms, 10-20ms and 20ms+> },
+			"degradation" : <0 if the quality is not lowered, 1 when the encoders complexity is lowered, 2 when shared encoders are used too>,
+			"late_frames" : <how many mixed frames were dropped by encoding threads for missing their deadline>,
+			"resampled_frames" : <how many frames the mixer had to resample, e.g., for G.711 participants>,
+			"resampling_time" : <how long the mixer spent resampling those frames overall, in microseconds>,
 			"num_participants" : <count of the participants>
 		},
 		// Other rooms
@@ -392,7 +434,8 @@ room-<unique room ID>: {
 	"port" : <port to forward the RTP packets to>,
 	"srtp_suite" : <length of authentication tag (32 or 80); optional>,
 	"srtp_crypto" : "<key to use as crypto (base64 encoded key as in SDES); optional>",
-	"always_on" : <true|false, whether silence should be forwarded when the room is empty>
+	"always_on" : <true|false, whether silence should be forwarded when the room is empty>,
+	"local_only" : <true|false, whether only the mix of local participants should be forwarded, excluding links; default=false>
 }
 \endverbatim
  *
@@ -461,11 +504,70 @@ room-<unique room ID>: {
 			"codec" : <codec this forwarder is using, if any>,
 			"ptype" : <payload type this forwarder is using, if any>,
 			"srtp" : <true|false, whether the RTP stream is encrypted>,
-			"always_on" : <true|false, whether this forwarder works even when no participant is in or not>
+			"always_on" : <true|false, whether this forwarder works even when no participant is in or not>,
+			"local_only" : <true, only present if this forwarder excludes links from the mix>
 		},
 		// Other forwarders
 	]
 }
+\endverbatim
+ *
+ * To receive the mix of the same room from a peer node, you can add a
+ * link with the \c add_link request, which has to be formatted as follows:
+ *
+\verbatim
+{
+	"request" : "add_link",
+	"room" : <unique numeric ID of the room to add the link to>,
+	"link_id" : <unique numeric ID to assign to the link; optional, random if missing>,
+	"port" : <port to receive the RTP packets of the peer mix on; optional, random if missing>
+}
+\endverbatim
+ *
+ * As for \c rtp_forward , an \c admin_key may be required. A successful
+ * request will result in a \c success response:
+ *
+\verbatim
+{
+	"audiobridge" : "success",
+	"room" : <unique numeric ID, same as request>,
+	"link_id" : <unique numeric ID of the new link>,
+	"port" : <port the peer node should send its local mix to>
+}
+\endverbatim
+ *
+ * The peer node is then expected to create a \c local_only Opus RTP
+ * forwarder towards that port. A link can be removed with the
+ * \c remove_link request:
+ *
+\verbatim
+{
+	"request" : "remove_link",
+	"room" : <unique numeric ID of the room to remove the link from>,
+	"link_id" : <unique numeric ID of the link>
+}
+\endverbatim
+ *
+ * which will result in a \c success response with the same \c room
+ * and \c link_id properties. The current links of a room can be
+ * retrieved with a \c listlinks request, formatted as a \c listforwarders
+ * request, which will return a \c links response:
+ *
+\verbatim
+{
+	"audiobridge" : "links",
+	"room" : <unique numeric ID of the room>,
+	"links" : [		// Array of link objects
+		{	// Link #1
+			"link_id" : <unique numeric ID of the link>,
+			"port" : <port the link is receiving on>,
+			"packets" : <number of packets received so far>,
+			"queue" : <number of decoded frames waiting to be mixed>,
+			"underruns" : <number of times there was nothing to mix>
+		},
+		// Other links
+	]
+}
 \endverbatim
  *
  * As anticipated, while the AudioBridge is mainly meant to allow real users
@@ -808,7 +910,16 @@ room-<unique room ID>: {
 #include <ogg/ogg.h>
 #endif
 #include <netdb.h>
+#include <math.h>
+#include <poll.h>
 #include <sys/time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JANUS_AUDIOBRIDGE_MIX_AVX2
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define JANUS_AUDIOBRIDGE_MIX_NEON
+#include <arm_neon.h>
+#endif
 
 #include "../debug.h"
 #include "../apierror.h"
@@ -854,6 +965,7 @@ void janus_audiobridge_incoming_rtcp(janus_plugin_session *handle, janus_plugin_
 void janus_audiobridge_hangup_media(janus_plugin_session *handle);
 void janus_audiobridge_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_audiobridge_query_session(janus_plugin_session *handle);
+json_t *janus_audiobridge_query_metrics(void);
 
 /* Plugin setup */
 static janus_plugin janus_audiobridge_plugin =
@@ -878,6 +990,7 @@ static janus_plugin janus_audiobridge_plugin =
 		.hangup_media = janus_audiobridge_hangup_media,
 		.destroy_session = janus_audiobridge_destroy_session,
 		.query_session = janus_audiobridge_query_session,
+		.query_metrics = janus_audiobridge_query_metrics,
 	);
 
 /* Plugin creator */
@@ -932,7 +1045,12 @@ static struct janus_json_parameter create_parameters[] = {
 	{"audiolevel_event", JANUS_JSON_BOOL, 0},
 	{"audio_active_packets", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audio_level_average", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
-	{"default_prebuffering", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+	{"default_prebuffering", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"shared_encoding", JANUS_JSON_BOOL, 0},
+	{"mix_loudest", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"record_filter", JANUS_JSON_BOOL, 0},
+	{"adaptive_quality", JANUS_JSON_BOOL, 0},
+	{"adaptive_threshold", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 static struct janus_json_parameter edit_parameters[] = {
 	{"secret", JSON_STRING, 0},
@@ -984,11 +1102,19 @@ static struct janus_json_parameter rtp_forward_parameters[] = {
 	{"host_family", JSON_STRING, 0},
 	{"srtp_suite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtp_crypto", JSON_STRING, 0},
-	{"always_on", JANUS_JSON_BOOL, 0}
+	{"always_on", JANUS_JSON_BOOL, 0},
+	{"local_only", JANUS_JSON_BOOL, 0}
 };
 static struct janus_json_parameter stop_rtp_forward_parameters[] = {
 	{"stream_id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
 };
+static struct janus_json_parameter add_link_parameters[] = {
+	{"link_id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+static struct janus_json_parameter remove_link_parameters[] = {
+	{"link_id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
+};
 static struct janus_json_parameter play_file_parameters[] = {
 	{"filename", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"file_id", JSON_STRING, 0},
@@ -1007,12 +1133,14 @@ static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static gboolean string_ids = FALSE;
+static int resampling_quality = 3;
 static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
 static void *janus_audiobridge_handler(void *data);
 static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data);
 static void *janus_audiobridge_mixer_thread(void *data);
 static void *janus_audiobridge_participant_thread(void *data);
+static void janus_audiobridge_dbov_energy_init(void);
 static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle);
 
 /* Extension to add while recording (e.g., "tmp" --> ".wav.tmp") */
@@ -1028,7 +1156,31 @@ static GAsyncQueue *messages = NULL;
 static janus_audiobridge_message exit_message;
 
 
+/* Mixer settings */
+#define DEFAULT_PREBUFFERING	6
+#define MAX_PREBUFFERING		50
+
+
+/* Opus settings */
+#define	OPUS_SAMPLES	960
+#define	G711_SAMPLES	160
+#define	BUFFER_SAMPLES	OPUS_SAMPLES*6
+#define DEFAULT_COMPLEXITY	4
+
+
 /* Structs */
+/* Histogram of the lateness of the mixer ticks: upper bounds of the buckets, in ms */
+#define JANUS_AUDIOBRIDGE_LATENESS_BUCKETS	6
+static const int janus_audiobridge_lateness_bounds[JANUS_AUDIOBRIDGE_LATENESS_BUCKETS-1] = { 1, 2, 5, 10, 20 };
+static const char *janus_audiobridge_lateness_names[JANUS_AUDIOBRIDGE_LATENESS_BUCKETS] = {
+	"0-1ms", "1-2ms", "2-5ms", "5-10ms", "10-20ms", "20ms+"
+};
+/* Default lateness threshold for adaptive quality, in ms, and the complexity we lower encoders to */
+#define JANUS_AUDIOBRIDGE_ADAPTIVE_THRESHOLD	5
+#define JANUS_AUDIOBRIDGE_DEGRADED_COMPLEXITY	1
+
+typedef struct janus_audiobridge_resampler janus_audiobridge_resampler;
+
 typedef struct janus_audiobridge_room {
 	guint64 room_id;			/* Unique room ID (when using integers) */
 	gchar *room_id_str;			/* Unique room ID (when using strings) */
@@ -1043,9 +1195,22 @@ typedef struct janus_audiobridge_room {
 	uint default_prebuffering;	/* Number of packets to buffer before decoding each participant */
 	int audio_active_packets;	/* Amount of packets with audio level for checkup */
 	int audio_level_average;	/* Average audio level */
+	gboolean shared_encoding;	/* Whether participants hearing the same mix should share the same Opus encoder */
+	uint mix_loudest;			/* If set, only the N loudest participants are mixed */
+	gboolean record_filter;		/* Whether padding-only packets and Opus DTX runs should be left out of participants' recordings */
+	volatile gint late_ticks;	/* Number of times the mixer fell behind by more than a full frame */
+	gboolean adaptive_quality;	/* Whether the mixer should lower the encoding quality when it falls behind */
+	uint adaptive_threshold;	/* Smoothed lateness of the mixer (ms) above which the quality is lowered */
+	volatile gint degradation;	/* How much the quality is currently lowered (0=not at all, see janus_audiobridge_adapt_quality) */
+	volatile gint tick_lateness;	/* Smoothed lateness of the mixer ticks, in microseconds */
+	volatile gint lateness_histogram[JANUS_AUDIOBRIDGE_LATENESS_BUCKETS];	/* How many ticks were late, by how much */
+	volatile gint late_frames;	/* Number of mixed frames dropped by encoding workers as they missed their deadline */
+	volatile gint resampled_frames;	/* Number of frames the mixer resampled */
+	gint64 resampling_time;		/* Time the mixer spent resampling them, in nanoseconds (only written by the mixer) */
 	gboolean record;			/* Whether this room has to be recorded or not */
 	gchar *record_file;			/* Path of the recording file */
 	FILE *recording;			/* File to record the room into */
+	janus_recorder_stream *recording_writer;	/* Writer for the mix, which may queue it to the asynchronous writer */
 	gint64 record_lastupdate;	/* Time when we last updated the wav header */
 	gboolean destroy;			/* Value to flag the room for destruction */
 	GHashTable *participants;	/* Map of participants */
@@ -1059,11 +1224,16 @@ typedef struct janus_audiobridge_room {
 	/* RTP forwarders for this room's mix */
 	GHashTable *rtp_forwarders;	/* RTP forwarders list (as a hashmap) */
 	OpusEncoder *rtp_encoder;	/* Opus encoder instance to use for all RTP forwarders */
-	janus_mutex rtp_mutex;		/* Mutex to lock the RTP forwarders list */
+	OpusEncoder *rtp_local_encoder;	/* Opus encoder instance to use for RTP forwarders of the local mix only */
+	GHashTable *links;			/* Links receiving the mix of this room from peer nodes (as a hashmap) */
+	janus_mutex rtp_mutex;		/* Mutex to lock the RTP forwarders and links lists */
 	int rtp_udp_sock;			/* UDP socket to use to forward RTP packets */
+	janus_audiobridge_resampler *rtp_resamplers[2];	/* Resamplers for G.711 RTP forwarders (whole and local mix) */
 	janus_refcount ref;			/* Reference counter for this room */
 } janus_audiobridge_room;
 static GHashTable *rooms;
+/* Kept up to date when rooms are added or removed, for the core metrics */
+static volatile gint rooms_count = 0;
 static janus_mutex rooms_mutex = JANUS_MUTEX_INITIALIZER;
 static char *admin_key = NULL;
 static gboolean lock_rtpfwd = FALSE;
@@ -1234,6 +1404,115 @@ static void janus_audiobridge_file_free(janus_audiobridge_file *ctx) {
 }
 #endif
 
+/* Resampler, used when G.711 participants or forwarders are in rooms whose
+ * mix is not at 8kHz: it's a polyphase windowed-sinc filter for the L/M ratio
+ * between the two rates, whose state is kept between frames, so that each
+ * participant can reuse the same instance every time; the quality (0-10)
+ * sets the number of taps of each branch, and so the CPU cost */
+#define JANUS_AUDIOBRIDGE_RESAMPLER_MAX_TAPS	(4+2*10)*6
+struct janus_audiobridge_resampler {
+	int input_rate, output_rate;
+	int up, down;			/* Interpolation and decimation factors */
+	int taps;				/* Length of each of the `up` branches of the filter */
+	float *filter;			/* Branches of the filter, with their coefficients reversed */
+	float history[JANUS_AUDIOBRIDGE_RESAMPLER_MAX_TAPS+OPUS_SAMPLES];	/* Previous input samples, followed by the new ones */
+};
+
+static janus_audiobridge_resampler *janus_audiobridge_resampler_create(int input_rate, int output_rate, int quality) {
+	if(input_rate <= 0 || output_rate <= 0 || input_rate == output_rate ||
+			input_rate > 48000 || output_rate > 48000)
+		return NULL;
+	int a = input_rate, b = output_rate;
+	while(b != 0) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	int up = output_rate/a, down = input_rate/a;
+	if(up > 6 || down > 6) {
+		/* We only need ratios between the rates we support (8, 12, 16, 24 and 48kHz) and 8kHz */
+		return NULL;
+	}
+	if(quality < 0)
+		quality = 0;
+	else if(quality > 10)
+		quality = 10;
+	janus_audiobridge_resampler *rs = g_malloc0(sizeof(janus_audiobridge_resampler));
+	rs->input_rate = input_rate;
+	rs->output_rate = output_rate;
+	rs->up = up;
+	rs->down = down;
+	/* The prototype filter works at input_rate*up, with a cutoff right below the lowest Nyquist */
+	int factor = up > down ? up : down;
+	rs->taps = ((4+2*quality)*factor + up - 1) / up;
+	int length = rs->taps * up;
+	double cutoff = (0.85 + 0.01*quality) * 0.5 / factor, sum = 0.0;
+	double *h = g_malloc(length * sizeof(double));
+	int i = 0;
+	for(i=0; i<length; i++) {
+		double x = i - (length-1)/2.0;
+		double sinc = (x == 0.0) ? 2.0*cutoff : sin(2.0*G_PI*cutoff*x)/(G_PI*x);
+		double window = length > 1 ? (0.42 - 0.5*cos(2.0*G_PI*i/(length-1)) + 0.08*cos(4.0*G_PI*i/(length-1))) : 1.0;
+		h[i] = sinc * window;
+		sum += h[i];
+	}
+	/* Each branch gets a gain of `up` to compensate for the interpolation */
+	rs->filter = g_malloc(length * sizeof(float));
+	int phase = 0, j = 0;
+	for(phase=0; phase<up; phase++) {
+		for(j=0; j<rs->taps; j++)
+			rs->filter[phase*rs->taps + j] = (float)(up * h[(rs->taps-1-j)*up + phase] / sum);
+	}
+	g_free(h);
+	return rs;
+}
+
+static void janus_audiobridge_resampler_destroy(janus_audiobridge_resampler *rs) {
+	if(rs == NULL)
+		return;
+	g_free(rs->filter);
+	g_free(rs);
+}
+
+/* Resamples a 20ms frame, returning the number of output samples */
+static int janus_audiobridge_resampler_process(janus_audiobridge_resampler *rs, const int16_t *input, int input_num, int16_t *output) {
+	if(rs == NULL || input == NULL || output == NULL || input_num <= 0 || input_num > OPUS_SAMPLES ||
+			(input_num % rs->down) != 0)
+		return 0;
+	float *x = rs->history;
+	int offset = rs->taps - 1, i = 0, j = 0;
+	for(i=0; i<input_num; i++)
+		x[offset+i] = input[i];
+	int output_num = input_num * rs->up / rs->down;
+	for(i=0; i<output_num; i++) {
+		int t = i * rs->down, n = t / rs->up;
+		const float *f = rs->filter + (t % rs->up) * rs->taps, *w = x + n;
+		float y = 0.0f;
+		for(j=0; j<rs->taps; j++)
+			y += f[j] * w[j];
+		output[i] = y > 32767.0f ? 32767 : (y < -32768.0f ? -32768 : (int16_t)lrintf(y));
+	}
+	/* Keep the last input samples for the next frame */
+	memmove(x, x + input_num, offset * sizeof(float));
+	return output_num;
+}
+
+/* Jitter buffer for the decoded audio of a participant: packets are stored in
+ * a ring indexed by sequence number, and recycled in a pool once played out */
+#define JANUS_AUDIOBRIDGE_JITTER_SLOTS	128
+typedef struct janus_audiobridge_jitter {
+	struct janus_audiobridge_rtp_relay_packet *slots[JANUS_AUDIOBRIDGE_JITTER_SLOTS];
+	struct janus_audiobridge_rtp_relay_packet *pool[JANUS_AUDIOBRIDGE_JITTER_SLOTS];
+	guint pool_size;		/* Number of packets available in the pool */
+	gboolean started;		/* Whether we have a valid head yet */
+	uint16_t head;			/* Sequence number of the next packet to play out */
+	guint count;			/* Number of packets currently in the ring */
+	guint depth;			/* Extra depth we added because of underruns */
+	guint underruns;		/* Number of times there was nothing to play out */
+	gint64 last_insert;		/* When we last received a packet */
+	gint64 last_adapt;		/* When we last changed the depth */
+} janus_audiobridge_jitter;
+
 typedef struct janus_audiobridge_participant {
 	janus_audiobridge_session *session;
 	janus_audiobridge_room *room;	/* Room */
@@ -1245,18 +1524,26 @@ typedef struct janus_audiobridge_participant {
 	uint prebuffer_count;	/* Number of packets to buffer before decoding this participant */
 	volatile gint active;	/* Whether this participant can receive media at all */
 	volatile gint encoding;	/* Whether this participant is currently encoding */
+	guint encoding_worker;	/* Index of the encoding worker serving this participant, if we have a pool */
 	volatile gint decoding;	/* Whether this participant is currently decoding */
 	gboolean muted;			/* Whether this participant is muted */
 	int volume_gain;		/* Gain to apply to the input audio (in percentage) */
 	int opus_complexity;	/* Complexity to use in the encoder (by default, DEFAULT_COMPLEXITY) */
+	int applied_complexity;	/* Complexity the encoder is actually using (lower, if the mixer is degrading the quality) */
+	volatile gint degraded;	/* Whether the mixer wants the encoder complexity of this participant lowered */
 	/* RTP stuff */
-	GList *inbuf;			/* Incoming audio from this participant, as an ordered list of packets */
+	janus_audiobridge_jitter inbuf;	/* Incoming audio from this participant, as a jitter buffer */
 	GAsyncQueue *outbuf;	/* Mixed audio for this participant */
 	gint64 last_drop;		/* When we last dropped a packet because the imcoming queue was full */
 	janus_mutex qmutex;		/* Incoming queue mutex */
 	int opus_pt;			/* Opus payload type */
 	int extmap_id;			/* Audio level RTP extension id, if any */
 	int dBov_level;			/* Value in dBov of the audio level (last value from extension) */
+	volatile gint mix_level;	/* Smoothed audio level in -dBov (0=loudest, 127=silence), for ranking speakers */
+	volatile gint ranked_out;	/* Whether this participant is currently not in the loudest speakers, and so not decoded */
+	volatile gint silent;		/* Whether the last packet from this participant was silence or DTX, and so not decoded */
+	guint32 decodes_skipped;	/* How many packets we didn't decode because they were silence or DTX */
+	gboolean mixed;			/* Whether the mixer is adding this participant to the mix in this iteration */
 	int audio_active_packets;	/* Participant's number of audio packets to accumulate */
 	int audio_dBov_sum;	    /* Participant's accumulated dBov value for audio level */
 	int user_audio_active_packets; /* Participant's number of audio packets to evaluate */
@@ -1267,6 +1554,8 @@ typedef struct janus_audiobridge_participant {
 	/* Opus stuff */
 	OpusEncoder *encoder;		/* Opus encoder instance */
 	OpusDecoder *decoder;		/* Opus decoder instance */
+	janus_audiobridge_resampler *upsampler;		/* G.711 only: from 8kHz to the rate of the room */
+	janus_audiobridge_resampler *downsampler;	/* G.711 only: from the rate of the room to 8kHz */
 	gboolean fec;				/* Opus FEC status */
 	uint16_t expected_seq;		/* Expected sequence number */
 	uint16_t probation; 		/* Used to determine new ssrc validity */
@@ -1289,8 +1578,191 @@ typedef struct janus_audiobridge_rtp_relay_packet {
 	uint32_t timestamp;
 	uint16_t seq_number;
 	gboolean silence;
+	gboolean encoded;	/* Whether the mixer already encoded this for the participant */
 } janus_audiobridge_rtp_relay_packet;
 
+/* Jitter buffer helpers: all of them must be called with the qmutex of the participant locked */
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_jitter_packet(janus_audiobridge_jitter *jb) {
+	janus_audiobridge_rtp_relay_packet *pkt = NULL;
+	if(jb->pool_size > 0) {
+		jb->pool_size--;
+		pkt = jb->pool[jb->pool_size];
+		jb->pool[jb->pool_size] = NULL;
+	} else {
+		pkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
+		pkt->data = g_malloc0(BUFFER_SAMPLES*sizeof(opus_int16));
+	}
+	pkt->length = 0;
+	pkt->ssrc = 0;
+	pkt->timestamp = 0;
+	pkt->seq_number = 0;
+	pkt->silence = FALSE;
+	pkt->encoded = FALSE;
+	return pkt;
+}
+
+static void janus_audiobridge_jitter_release(janus_audiobridge_jitter *jb, janus_audiobridge_rtp_relay_packet *pkt) {
+	if(pkt == NULL)
+		return;
+	if(jb->pool_size < JANUS_AUDIOBRIDGE_JITTER_SLOTS) {
+		jb->pool[jb->pool_size] = pkt;
+		jb->pool_size++;
+		return;
+	}
+	g_free(pkt->data);
+	g_free(pkt);
+}
+
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_jitter_peek(janus_audiobridge_jitter *jb) {
+	if(jb->count == 0)
+		return NULL;
+	/* Skip holes: if we didn't get those packets by now, they're lost */
+	while(jb->slots[jb->head % JANUS_AUDIOBRIDGE_JITTER_SLOTS] == NULL)
+		jb->head++;
+	return jb->slots[jb->head % JANUS_AUDIOBRIDGE_JITTER_SLOTS];
+}
+
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_jitter_pop(janus_audiobridge_jitter *jb) {
+	janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_jitter_peek(jb);
+	if(pkt != NULL) {
+		jb->slots[jb->head % JANUS_AUDIOBRIDGE_JITTER_SLOTS] = NULL;
+		jb->head++;
+		jb->count--;
+	}
+	return pkt;
+}
+
+static void janus_audiobridge_jitter_trim(janus_audiobridge_jitter *jb, guint count) {
+	while(jb->count > count)
+		janus_audiobridge_jitter_release(jb, janus_audiobridge_jitter_pop(jb));
+}
+
+static void janus_audiobridge_jitter_flush(janus_audiobridge_jitter *jb) {
+	janus_audiobridge_jitter_trim(jb, 0);
+	jb->started = FALSE;
+	jb->depth = 0;
+}
+
+static void janus_audiobridge_jitter_destroy(janus_audiobridge_jitter *jb) {
+	janus_audiobridge_jitter_flush(jb);
+	while(jb->pool_size > 0) {
+		jb->pool_size--;
+		g_free(jb->pool[jb->pool_size]->data);
+		g_free(jb->pool[jb->pool_size]);
+		jb->pool[jb->pool_size] = NULL;
+	}
+}
+
+/* Returns FALSE if the packet was not added (too late or a duplicate), in which case it's released */
+static gboolean janus_audiobridge_jitter_insert(janus_audiobridge_jitter *jb, janus_audiobridge_rtp_relay_packet *pkt) {
+	jb->last_insert = janus_get_monotonic_time();
+	if(!jb->started || jb->count == 0) {
+		int16_t offset = (int16_t)(pkt->seq_number - jb->head);
+		if(!jb->started || offset > 0 || offset < -JANUS_AUDIOBRIDGE_JITTER_SLOTS) {
+			/* First packet, or a packet past the last one we played out (or a reset) */
+			jb->started = TRUE;
+			jb->head = pkt->seq_number;
+		}
+	}
+	int16_t offset = (int16_t)(pkt->seq_number - jb->head);
+	if(offset < 0) {
+		/* We already played out something more recent */
+		janus_audiobridge_jitter_release(jb, pkt);
+		return FALSE;
+	}
+	while(offset >= JANUS_AUDIOBRIDGE_JITTER_SLOTS) {
+		/* Too far in the future: make room by dropping the oldest packets */
+		if(jb->count == 0) {
+			jb->head = pkt->seq_number;
+			offset = 0;
+			break;
+		}
+		janus_audiobridge_rtp_relay_packet *old = jb->slots[jb->head % JANUS_AUDIOBRIDGE_JITTER_SLOTS];
+		if(old != NULL) {
+			jb->slots[jb->head % JANUS_AUDIOBRIDGE_JITTER_SLOTS] = NULL;
+			jb->count--;
+			janus_audiobridge_jitter_release(jb, old);
+		}
+		jb->head++;
+		offset--;
+	}
+	janus_audiobridge_rtp_relay_packet **slot = &jb->slots[pkt->seq_number % JANUS_AUDIOBRIDGE_JITTER_SLOTS];
+	if(*slot != NULL) {
+		/* Duplicate */
+		janus_audiobridge_jitter_release(jb, pkt);
+		return FALSE;
+	}
+	*slot = pkt;
+	jb->count++;
+	return TRUE;
+}
+
+/* Called by the mixer when there's nothing to play out for an active participant:
+ * if we're still receiving packets, the buffer is too shallow, so we make it deeper */
+static void janus_audiobridge_jitter_underrun(janus_audiobridge_jitter *jb) {
+	gint64 now = janus_get_monotonic_time();
+	if(now - jb->last_insert > 60000) {
+		/* Not receiving anything (e.g., DTX), not an underrun */
+		return;
+	}
+	jb->underruns++;
+	if(jb->depth < MAX_PREBUFFERING) {
+		jb->depth++;
+		jb->last_adapt = now;
+	}
+}
+
+/* Helpers to get and release packets from the pool of a participant, locking its mutex */
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_participant_packet(janus_audiobridge_participant *participant) {
+	janus_mutex_lock(&participant->qmutex);
+	janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_jitter_packet(&participant->inbuf);
+	janus_mutex_unlock(&participant->qmutex);
+	return pkt;
+}
+
+static void janus_audiobridge_participant_release(janus_audiobridge_participant *participant, janus_audiobridge_rtp_relay_packet *pkt) {
+	janus_mutex_lock(&participant->qmutex);
+	janus_audiobridge_jitter_release(&participant->inbuf, pkt);
+	janus_mutex_unlock(&participant->qmutex);
+}
+
+/* When configured, a bounded pool of workers encodes and sends mixed frames
+ * instead of a thread per participant: each participant is always served by
+ * the same worker (which keeps its Opus encoder single threaded), while each
+ * worker serves its frames earliest deadline first, across all rooms */
+typedef struct janus_audiobridge_encoding_job {
+	janus_audiobridge_room *room;
+	janus_audiobridge_participant *participant;
+	janus_audiobridge_rtp_relay_packet *packet;
+	gint64 deadline;
+} janus_audiobridge_encoding_job;
+static janus_audiobridge_encoding_job encoding_exit_job;
+static guint encoding_workers = 0;
+static GAsyncQueue **encoding_queues = NULL;
+static GThread **encoding_threads = NULL;
+static volatile gint encoding_next = 0;
+static void *janus_audiobridge_encoding_thread(void *data);
+
+static gint janus_audiobridge_encoding_job_compare(gconstpointer a, gconstpointer b, gpointer user_data) {
+	const janus_audiobridge_encoding_job *ja = (const janus_audiobridge_encoding_job *)a;
+	const janus_audiobridge_encoding_job *jb = (const janus_audiobridge_encoding_job *)b;
+	if(ja->deadline < jb->deadline)
+		return -1;
+	return (ja->deadline > jb->deadline) ? 1 : 0;
+}
+
+static void janus_audiobridge_encoding_job_free(janus_audiobridge_encoding_job *job) {
+	if(job == NULL || job == &encoding_exit_job)
+		return;
+	if(job->packet != NULL) {
+		g_free(job->packet->data);
+		g_free(job->packet);
+	}
+	janus_refcount_decrease(&job->participant->ref);
+	janus_refcount_decrease(&job->room->ref);
+	g_free(job);
+}
+
 
 static void janus_audiobridge_participant_destroy(janus_audiobridge_participant *participant) {
 	if(!participant)
@@ -1317,14 +1789,9 @@ static void janus_audiobridge_participant_free(const janus_refcount *participant
 		opus_encoder_destroy(participant->encoder);
 	if(participant->decoder)
 		opus_decoder_destroy(participant->decoder);
-	while(participant->inbuf) {
-		GList *first = g_list_first(participant->inbuf);
-		janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-		participant->inbuf = g_list_delete_link(participant->inbuf, first);
-		if(pkt)
-			g_free(pkt->data);
-		g_free(pkt);
-	}
+	janus_audiobridge_resampler_destroy(participant->upsampler);
+	janus_audiobridge_resampler_destroy(participant->downsampler);
+	janus_audiobridge_jitter_destroy(&participant->inbuf);
 	if(participant->outbuf != NULL) {
 		while(g_async_queue_length(participant->outbuf) > 0) {
 			janus_audiobridge_rtp_relay_packet *pkt = g_async_queue_pop(participant->outbuf);
@@ -1379,7 +1846,12 @@ static void janus_audiobridge_room_free(const janus_refcount *audiobridge_ref) {
 		close(audiobridge->rtp_udp_sock);
 	if(audiobridge->rtp_encoder)
 		opus_encoder_destroy(audiobridge->rtp_encoder);
+	if(audiobridge->rtp_local_encoder)
+		opus_encoder_destroy(audiobridge->rtp_local_encoder);
 	g_hash_table_destroy(audiobridge->rtp_forwarders);
+	g_hash_table_destroy(audiobridge->links);
+	janus_audiobridge_resampler_destroy(audiobridge->rtp_resamplers[0]);
+	janus_audiobridge_resampler_destroy(audiobridge->rtp_resamplers[1]);
 	g_free(audiobridge);
 }
 
@@ -1415,6 +1887,7 @@ typedef struct janus_audiobridge_rtp_forwarder {
 	uint16_t seq_number;
 	uint32_t timestamp;
 	gboolean always_on;
+	gboolean local_only;	/* Whether only the mix of local participants should be forwarded (e.g., to a peer node) */
 	/* Only needed for SRTP forwarders */
 	gboolean is_srtp;
 	srtp_t srtp_ctx;
@@ -1439,7 +1912,7 @@ static void janus_audiobridge_rtp_forwarder_free(const janus_refcount *f_ref) {
 static guint32 janus_audiobridge_rtp_forwarder_add_helper(janus_audiobridge_room *room,
 		const gchar *host, uint16_t port, uint32_t ssrc, int pt,
 		janus_audiocodec codec, int srtp_suite, const char *srtp_crypto,
-		gboolean always_on, guint32 stream_id) {
+		gboolean always_on, gboolean local_only, guint32 stream_id) {
 	if(room == NULL || host == NULL)
 		return 0;
 	janus_audiobridge_rtp_forwarder *rf = g_malloc0(sizeof(janus_audiobridge_rtp_forwarder));
@@ -1498,6 +1971,7 @@ static guint32 janus_audiobridge_rtp_forwarder_add_helper(janus_audiobridge_room
 	rf->seq_number = 0;
 	rf->timestamp = 0;
 	rf->always_on = always_on;
+	rf->local_only = local_only;
 
 	janus_mutex_lock(&room->rtp_mutex);
 
@@ -1523,25 +1997,6 @@ static guint32 janus_audiobridge_rtp_forwarder_add_helper(janus_audiobridge_room
 }
 
 
-/* Helper to sort incoming RTP packets by sequence numbers */
-static gint janus_audiobridge_rtp_sort(gconstpointer a, gconstpointer b) {
-	janus_audiobridge_rtp_relay_packet *pkt1 = (janus_audiobridge_rtp_relay_packet *)a;
-	janus_audiobridge_rtp_relay_packet *pkt2 = (janus_audiobridge_rtp_relay_packet *)b;
-	if(pkt1->seq_number < 100 && pkt2->seq_number > 65000) {
-		/* Sequence number was probably reset, pkt2 is older */
-		return 1;
-	} else if(pkt2->seq_number < 100 && pkt1->seq_number > 65000) {
-		/* Sequence number was probably reset, pkt1 is older */
-		return -1;
-	}
-	/* Simply compare timestamps */
-	if(pkt1->seq_number < pkt2->seq_number)
-		return -1;
-	else if(pkt1->seq_number > pkt2->seq_number)
-		return 1;
-	return 0;
-}
-
 /* Helper struct to generate and parse WAVE headers */
 typedef struct wav_header {
 	char riff[4];
@@ -1696,51 +2151,193 @@ static uint8_t janus_audiobridge_g711_alaw_encode(int16_t sample) {
 }
 
 /* Ugly helper code to quickly resample (in case we're using G.711 anywhere) */
-static int janus_audiobridge_resample(int16_t *input, int input_num, int input_rate, int16_t *output, int output_rate) {
+/* Helper to resample a frame in the mixer, reusing (or creating) the resampler
+ * instance that was passed, and keeping track of how much this costs us */
+static int janus_audiobridge_resample(janus_audiobridge_room *audiobridge, janus_audiobridge_resampler **rs,
+		int16_t *input, int input_num, int input_rate, int16_t *output, int output_rate) {
 	if(input == NULL || output == NULL)
 		return 0;
-	if((input_rate != 8000 && input_rate != 16000 && input_rate != 24000 && input_rate != 48000) ||
-			(output_rate != 8000 && output_rate != 16000 && output_rate != 24000 && output_rate != 48000)) {
-		/* Invalid sampling rate */
-		return 0;
-	}
-	if(input_rate != 8000 && output_rate != 8000) {
-		/* We only use this for G.711, so one of the two MUST be 8000 */
-		return 0;
-	}
 	if(input_rate == output_rate) {
 		/* Easy enough */
 		memcpy(output, input, input_num*sizeof(int16_t));
 		return input_num;
-	} else if(input_rate < output_rate) {
-		/* Upsample */
-		int up = output_rate/input_rate, i = 0;
-		memset(output, 0, input_num*up);
-		for(i=0; i<input_num; i++) {
-			*(output + i*up) = *(input + i);
-		}
-		return input_num*up;
+	}
+	if(*rs == NULL || (*rs)->input_rate != input_rate || (*rs)->output_rate != output_rate) {
+		/* First time, or the rate of the room changed */
+		janus_audiobridge_resampler_destroy(*rs);
+		*rs = janus_audiobridge_resampler_create(input_rate, output_rate, resampling_quality);
+		if(*rs == NULL)
+			return 0;
+	}
+	struct timespec before, after;
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	int output_num = janus_audiobridge_resampler_process(*rs, input, input_num, output);
+	clock_gettime(CLOCK_MONOTONIC, &after);
+	audiobridge->resampling_time += (after.tv_sec - before.tv_sec)*G_GINT64_CONSTANT(1000000000) + (after.tv_nsec - before.tv_nsec);
+	g_atomic_int_inc(&audiobridge->resampled_frames);
+	return output_num;
+}
+
+
+/* Mixing kernels: the mixer thread adds the contribution of each participant
+ * to a 32-bit mix (accumulate), and then removes the participant's own
+ * contribution from it, saturating the result to 16-bit (subtract), before
+ * encoding; a NULL input in subtract just saturates the mix. A gain other
+ * than 100 (the volume_gain percentage) scales the input first. We have
+ * a scalar implementation, plus AVX2 and NEON ones picked at startup */
+typedef struct janus_audiobridge_mix_kernels {
+	const char *name;
+	void (*accumulate)(opus_int32 *mix, const opus_int16 *input, int samples, int gain);
+	void (*subtract)(opus_int16 *output, const opus_int32 *mix, const opus_int16 *input, int samples, int gain);
+} janus_audiobridge_mix_kernels;
+
+static inline opus_int16 janus_audiobridge_mix_saturate(opus_int32 sample) {
+	if(sample > 32767)
+		return 32767;
+	if(sample < -32768)
+		return -32768;
+	return (opus_int16)sample;
+}
+
+static void janus_audiobridge_mix_accumulate_scalar(opus_int32 *mix, const opus_int16 *input, int samples, int gain) {
+	int i = 0;
+	if(gain == 100) {
+		for(i=0; i<samples; i++)
+			mix[i] += input[i];
 	} else {
-		/* Downsample */
-		int down = input_rate/output_rate, i = 0;
-		for(i=0; i<input_num; i++) {
-			*(output + i) = *(input + i*down);
-		}
-		return input_num/down;
+		for(i=0; i<samples; i++)
+			mix[i] += (input[i]*gain)/100;
 	}
 }
 
+static void janus_audiobridge_mix_subtract_scalar(opus_int16 *output, const opus_int32 *mix, const opus_int16 *input, int samples, int gain) {
+	int i = 0;
+	if(input == NULL) {
+		for(i=0; i<samples; i++)
+			output[i] = janus_audiobridge_mix_saturate(mix[i]);
+	} else if(gain == 100) {
+		for(i=0; i<samples; i++)
+			output[i] = janus_audiobridge_mix_saturate(mix[i] - input[i]);
+	} else {
+		for(i=0; i<samples; i++)
+			output[i] = janus_audiobridge_mix_saturate(mix[i] - (input[i]*gain)/100);
+	}
+}
 
-/* Mixer settings */
-#define DEFAULT_PREBUFFERING	6
-#define MAX_PREBUFFERING		50
+static janus_audiobridge_mix_kernels janus_audiobridge_mix_scalar = {
+	"scalar", janus_audiobridge_mix_accumulate_scalar, janus_audiobridge_mix_subtract_scalar
+};
 
+#ifdef JANUS_AUDIOBRIDGE_MIX_AVX2
+/* Scale 8 samples by gain/100: we divide in double precision, as that makes
+ * truncation match the integer division of the scalar code exactly */
+__attribute__((target("avx2")))
+static inline __m256i janus_audiobridge_mix_gain_avx2(__m256i samples, int gain) {
+	__m256i scaled = _mm256_mullo_epi32(samples, _mm256_set1_epi32(gain));
+	__m256d hundred = _mm256_set1_pd(100.0);
+	__m128i lo = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(scaled)), hundred));
+	__m128i hi = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(scaled, 1)), hundred));
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
 
-/* Opus settings */
-#define	OPUS_SAMPLES	960
-#define	G711_SAMPLES	160
-#define	BUFFER_SAMPLES	OPUS_SAMPLES*6
-#define DEFAULT_COMPLEXITY	4
+__attribute__((target("avx2")))
+static void janus_audiobridge_mix_accumulate_avx2(opus_int32 *mix, const opus_int16 *input, int samples, int gain) {
+	int i = 0;
+	for(; i+8 <= samples; i += 8) {
+		__m256i in = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(input+i)));
+		if(gain != 100)
+			in = janus_audiobridge_mix_gain_avx2(in, gain);
+		__m256i sum = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(mix+i)), in);
+		_mm256_storeu_si256((__m256i *)(mix+i), sum);
+	}
+	janus_audiobridge_mix_accumulate_scalar(mix+i, input+i, samples-i, gain);
+}
+
+__attribute__((target("avx2")))
+static void janus_audiobridge_mix_subtract_avx2(opus_int16 *output, const opus_int32 *mix, const opus_int16 *input, int samples, int gain) {
+	int i = 0;
+	for(; i+8 <= samples; i += 8) {
+		__m256i sum = _mm256_loadu_si256((const __m256i *)(mix+i));
+		if(input != NULL) {
+			__m256i in = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(input+i)));
+			if(gain != 100)
+				in = janus_audiobridge_mix_gain_avx2(in, gain);
+			sum = _mm256_sub_epi32(sum, in);
+		}
+		/* The pack works on 128-bit lanes, so we need to put the halves back together */
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum, sum), 0x08);
+		_mm_storeu_si128((__m128i *)(output+i), _mm256_castsi256_si128(packed));
+	}
+	janus_audiobridge_mix_subtract_scalar(output+i, mix+i, input ? input+i : NULL, samples-i, gain);
+}
+
+static janus_audiobridge_mix_kernels janus_audiobridge_mix_avx2 = {
+	"AVX2", janus_audiobridge_mix_accumulate_avx2, janus_audiobridge_mix_subtract_avx2
+};
+#endif
+
+#ifdef JANUS_AUDIOBRIDGE_MIX_NEON
+/* Scale 4 samples by gain/100, dividing in double precision as in the AVX2 code */
+static inline int32x4_t janus_audiobridge_mix_gain_neon(int32x4_t samples, int gain) {
+	int32x4_t scaled = vmulq_n_s32(samples, gain);
+	float64x2_t hundred = vdupq_n_f64(100.0);
+	int64x2_t lo = vcvtq_s64_f64(vdivq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(scaled))), hundred));
+	int64x2_t hi = vcvtq_s64_f64(vdivq_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(scaled))), hundred));
+	return vcombine_s32(vmovn_s64(lo), vmovn_s64(hi));
+}
+
+static void janus_audiobridge_mix_accumulate_neon(opus_int32 *mix, const opus_int16 *input, int samples, int gain) {
+	int i = 0;
+	for(; i+8 <= samples; i += 8) {
+		int16x8_t in = vld1q_s16(input+i);
+		int32x4_t lo = vmovl_s16(vget_low_s16(in)), hi = vmovl_high_s16(in);
+		if(gain != 100) {
+			lo = janus_audiobridge_mix_gain_neon(lo, gain);
+			hi = janus_audiobridge_mix_gain_neon(hi, gain);
+		}
+		vst1q_s32(mix+i, vaddq_s32(vld1q_s32(mix+i), lo));
+		vst1q_s32(mix+i+4, vaddq_s32(vld1q_s32(mix+i+4), hi));
+	}
+	janus_audiobridge_mix_accumulate_scalar(mix+i, input+i, samples-i, gain);
+}
+
+static void janus_audiobridge_mix_subtract_neon(opus_int16 *output, const opus_int32 *mix, const opus_int16 *input, int samples, int gain) {
+	int i = 0;
+	for(; i+8 <= samples; i += 8) {
+		int32x4_t lo = vld1q_s32(mix+i), hi = vld1q_s32(mix+i+4);
+		if(input != NULL) {
+			int16x8_t in = vld1q_s16(input+i);
+			int32x4_t inlo = vmovl_s16(vget_low_s16(in)), inhi = vmovl_high_s16(in);
+			if(gain != 100) {
+				inlo = janus_audiobridge_mix_gain_neon(inlo, gain);
+				inhi = janus_audiobridge_mix_gain_neon(inhi, gain);
+			}
+			lo = vsubq_s32(lo, inlo);
+			hi = vsubq_s32(hi, inhi);
+		}
+		vst1q_s16(output+i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+	}
+	janus_audiobridge_mix_subtract_scalar(output+i, mix+i, input ? input+i : NULL, samples-i, gain);
+}
+
+static janus_audiobridge_mix_kernels janus_audiobridge_mix_neon = {
+	"NEON", janus_audiobridge_mix_accumulate_neon, janus_audiobridge_mix_subtract_neon
+};
+#endif
+
+static janus_audiobridge_mix_kernels *mix_kernels = &janus_audiobridge_mix_scalar;
+static void janus_audiobridge_mix_kernels_init(void) {
+	mix_kernels = &janus_audiobridge_mix_scalar;
+#if defined(JANUS_AUDIOBRIDGE_MIX_AVX2)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		mix_kernels = &janus_audiobridge_mix_avx2;
+#elif defined(JANUS_AUDIOBRIDGE_MIX_NEON)
+	/* NEON is always available on aarch64 */
+	mix_kernels = &janus_audiobridge_mix_neon;
+#endif
+	JANUS_LOG(LOG_INFO, "AudioBridge mixer using %s kernels\n", mix_kernels->name);
+}
 
 
 /* Error codes */
@@ -1779,36 +2376,314 @@ static int janus_audiobridge_create_udp_socket_if_needed(janus_audiobridge_room
 	return 0;
 }
 
-static int janus_audiobridge_create_opus_encoder_if_needed(janus_audiobridge_room *audiobridge) {
-	if(audiobridge->rtp_encoder != NULL) {
+static int janus_audiobridge_create_opus_encoder_if_needed(janus_audiobridge_room *audiobridge, gboolean local_only) {
+	/* Forwarders of the local mix only use an encoder of their own, as they send a different stream */
+	OpusEncoder **rtp_encoder = local_only ? &audiobridge->rtp_local_encoder : &audiobridge->rtp_encoder;
+	if(*rtp_encoder != NULL) {
 		return 0;
 	}
 
 	int error = 0;
-	audiobridge->rtp_encoder = opus_encoder_create(audiobridge->sampling_rate, 1, OPUS_APPLICATION_VOIP, &error);
+	*rtp_encoder = opus_encoder_create(audiobridge->sampling_rate, 1, OPUS_APPLICATION_VOIP, &error);
 	if(error != OPUS_OK) {
 		JANUS_LOG(LOG_ERR, "Error creating Opus encoder for RTP forwarder (room %s)\n", audiobridge->room_id_str);
 		return -1;
 	}
 
 	if(audiobridge->sampling_rate == 8000) {
-		opus_encoder_ctl(audiobridge->rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_NARROWBAND));
+		opus_encoder_ctl(*rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_NARROWBAND));
 	} else if(audiobridge->sampling_rate == 12000) {
-		opus_encoder_ctl(audiobridge->rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_MEDIUMBAND));
+		opus_encoder_ctl(*rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_MEDIUMBAND));
 	} else if(audiobridge->sampling_rate == 16000) {
-		opus_encoder_ctl(audiobridge->rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_WIDEBAND));
+		opus_encoder_ctl(*rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_WIDEBAND));
 	} else if(audiobridge->sampling_rate == 24000) {
-		opus_encoder_ctl(audiobridge->rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_SUPERWIDEBAND));
+		opus_encoder_ctl(*rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_SUPERWIDEBAND));
 	} else if(audiobridge->sampling_rate == 48000) {
-		opus_encoder_ctl(audiobridge->rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND));
+		opus_encoder_ctl(*rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND));
 	} else {
 		JANUS_LOG(LOG_WARN, "Unsupported sampling rate %d, setting 16kHz\n", audiobridge->sampling_rate);
-		opus_encoder_ctl(audiobridge->rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_WIDEBAND));
+		opus_encoder_ctl(*rtp_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_WIDEBAND));
 	}
 
 	return 0;
 }
 
+/* Link instance: the local-only mix of this room on a peer node, that we
+ * receive via RTP (Opus) and add to what our participants hear, but not
+ * to what our local-only RTP forwarders send, which is what avoids echoes */
+typedef struct janus_audiobridge_link {
+	guint32 link_id;			/* Unique ID of the link in the room */
+	gchar *room_id_str;			/* ID of the room this link belongs to (for logging purposes) */
+	int fd;						/* UDP socket we receive the RTP packets on */
+	uint16_t port;				/* Port we bound to */
+	OpusDecoder *decoder;		/* Opus decoder instance */
+	janus_audiobridge_jitter jitter;	/* Decoded frames waiting for the mixer */
+	gboolean prebuffering;		/* Whether we're still buffering before handing frames to the mixer */
+	guint32 packets;			/* Number of packets we received so far */
+	GThread *thread;			/* Thread receiving and decoding the remote mix */
+	janus_mutex mutex;			/* Mutex to lock the jitter buffer */
+	volatile gint destroyed;	/* Whether this link has been destroyed */
+	janus_refcount ref;			/* Reference counter for this link */
+} janus_audiobridge_link;
+static void janus_audiobridge_link_destroy(janus_audiobridge_link *link) {
+	if(link && g_atomic_int_compare_and_exchange(&link->destroyed, 0, 1))
+		janus_refcount_decrease(&link->ref);
+}
+static void janus_audiobridge_link_free(const janus_refcount *link_ref) {
+	janus_audiobridge_link *link = janus_refcount_containerof(link_ref, janus_audiobridge_link, ref);
+	if(link->fd > -1)
+		close(link->fd);
+	if(link->decoder)
+		opus_decoder_destroy(link->decoder);
+	janus_audiobridge_jitter_destroy(&link->jitter);
+	g_free(link->room_id_str);
+	g_free(link);
+}
+
+static void *janus_audiobridge_link_thread(void *data) {
+	janus_audiobridge_link *link = (janus_audiobridge_link *)data;
+	JANUS_LOG(LOG_VERB, "[%s] Link %"SCNu32" thread starting (port %"SCNu16")\n",
+		link->room_id_str, link->link_id, link->port);
+	char buf[1500];
+	struct pollfd fds;
+	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&link->destroyed)) {
+		fds.fd = link->fd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+		int res = poll(&fds, 1, 100);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[%s] Error polling link %"SCNu32"... %d (%s)\n",
+				link->room_id_str, link->link_id, errno, strerror(errno));
+			break;
+		}
+		if(res == 0 || !(fds.revents & POLLIN))
+			continue;
+		int len = recvfrom(link->fd, buf, sizeof(buf), 0, NULL, NULL);
+		if(len <= 0 || !janus_is_rtp(buf, len))
+			continue;
+		int plen = 0;
+		char *payload = janus_rtp_payload(buf, len, &plen);
+		if(payload == NULL || plen == 0)
+			continue;
+		janus_rtp_header *rtp = (janus_rtp_header *)buf;
+		janus_mutex_lock(&link->mutex);
+		janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_jitter_packet(&link->jitter);
+		janus_mutex_unlock(&link->mutex);
+		pkt->ssrc = ntohl(rtp->ssrc);
+		pkt->timestamp = ntohl(rtp->timestamp);
+		pkt->seq_number = ntohs(rtp->seq_number);
+		pkt->length = opus_decode(link->decoder, (const unsigned char *)payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, 0);
+		janus_mutex_lock(&link->mutex);
+		if(pkt->length < 0) {
+			JANUS_LOG(LOG_ERR, "[%s] Ops! got an error decoding the Opus frame of link %"SCNu32": %d (%s)\n",
+				link->room_id_str, link->link_id, pkt->length, opus_strerror(pkt->length));
+			janus_audiobridge_jitter_release(&link->jitter, pkt);
+			janus_mutex_unlock(&link->mutex);
+			continue;
+		}
+		link->packets++;
+		janus_audiobridge_jitter_insert(&link->jitter, pkt);
+		if(link->prebuffering) {
+			if(link->jitter.count >= DEFAULT_PREBUFFERING)
+				link->prebuffering = FALSE;
+		} else if(link->jitter.count > 2*DEFAULT_PREBUFFERING) {
+			/* The mixer isn't keeping up (e.g., it's idle), don't let the delay grow */
+			janus_audiobridge_jitter_trim(&link->jitter, DEFAULT_PREBUFFERING);
+		}
+		janus_mutex_unlock(&link->mutex);
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Link %"SCNu32" thread leaving\n", link->room_id_str, link->link_id);
+	janus_refcount_decrease(&link->ref);
+	return NULL;
+}
+
+/* Helper to create a new link in a room: port can be 0, in which case a random one is picked */
+static janus_audiobridge_link *janus_audiobridge_link_add(janus_audiobridge_room *audiobridge, guint32 link_id, uint16_t port) {
+	int fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd < 0) {
+		JANUS_LOG(LOG_ERR, "Could not open UDP socket for link (room %s)\n", audiobridge->room_id_str);
+		return NULL;
+	}
+	int v6only = 0;
+	if(setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) != 0) {
+		JANUS_LOG(LOG_ERR, "Could not configure UDP socket for link (room %s)\n", audiobridge->room_id_str);
+		close(fd);
+		return NULL;
+	}
+	struct sockaddr_in6 address = { 0 };
+	socklen_t addrlen = sizeof(address);
+	address.sin6_family = AF_INET6;
+	address.sin6_port = htons(port);
+	address.sin6_addr = in6addr_any;
+	if(bind(fd, (struct sockaddr *)&address, addrlen) < 0 ||
+			getsockname(fd, (struct sockaddr *)&address, &addrlen) < 0) {
+		JANUS_LOG(LOG_ERR, "Could not bind UDP socket for link to port %"SCNu16" (room %s)... %d (%s)\n",
+			port, audiobridge->room_id_str, errno, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	int error = 0;
+	OpusDecoder *decoder = opus_decoder_create(audiobridge->sampling_rate, 1, &error);
+	if(error != OPUS_OK) {
+		JANUS_LOG(LOG_ERR, "Error creating Opus decoder for link (room %s)\n", audiobridge->room_id_str);
+		close(fd);
+		return NULL;
+	}
+	janus_audiobridge_link *link = g_malloc0(sizeof(janus_audiobridge_link));
+	link->room_id_str = g_strdup(audiobridge->room_id_str);
+	link->fd = fd;
+	link->port = ntohs(address.sin6_port);
+	link->decoder = decoder;
+	link->prebuffering = TRUE;
+	janus_mutex_init(&link->mutex);
+	janus_refcount_init(&link->ref, janus_audiobridge_link_free);
+	janus_mutex_lock(&audiobridge->rtp_mutex);
+	if(link_id == 0)
+		link_id = janus_random_uint32();
+	while(link_id == 0 || g_hash_table_lookup(audiobridge->links, GUINT_TO_POINTER(link_id)) != NULL)
+		link_id = janus_random_uint32();
+	link->link_id = link_id;
+	/* The thread gets a reference of its own */
+	janus_refcount_increase(&link->ref);
+	GError *gerror = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "link %"SCNu32, link_id);
+	link->thread = g_thread_try_new(tname, &janus_audiobridge_link_thread, link, &gerror);
+	if(gerror != NULL) {
+		janus_mutex_unlock(&audiobridge->rtp_mutex);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the link thread...\n",
+			gerror->code, gerror->message ? gerror->message : "??");
+		g_error_free(gerror);
+		janus_refcount_decrease(&link->ref);
+		janus_refcount_decrease(&link->ref);
+		return NULL;
+	}
+	g_hash_table_insert(audiobridge->links, GUINT_TO_POINTER(link_id), link);
+	janus_mutex_unlock(&audiobridge->rtp_mutex);
+	JANUS_LOG(LOG_VERB, "Added link to room %s on port %"SCNu16" (ID: %"SCNu32")\n",
+		audiobridge->room_id_str, link->port, link_id);
+	return link;
+}
+
+/* Helper to send a mix to the RTP forwarders of a room: local_only tells us whether
+ * we're sending the whole mix, or the local mix to peer nodes; must be called with
+ * the rtp_mutex of the room locked */
+static void janus_audiobridge_rtp_forward_mix(janus_audiobridge_room *audiobridge,
+		opus_int32 *mix, int samples, gboolean local_only, gboolean empty) {
+	opus_int16 outBuffer[OPUS_SAMPLES], resampled[OPUS_SAMPLES];
+	unsigned char rtpbuffer[1500];
+	uint8_t rtpalaw[12+G711_SAMPLES], rtpulaw[12+G711_SAMPLES];
+	char sbuf[1500];
+	OpusEncoder *encoder = local_only ? audiobridge->rtp_local_encoder : audiobridge->rtp_encoder;
+	gboolean have_mix = FALSE, have_opus = FALSE, have_g711 = FALSE, have_alaw = FALSE, have_ulaw = FALSE;
+	opus_int32 opus_length = 0;
+	int i = 0;
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
+	while(g_hash_table_iter_next(&iter, &key, &value)) {
+		guint32 stream_id = GPOINTER_TO_UINT(key);
+		janus_audiobridge_rtp_forwarder *forwarder = (janus_audiobridge_rtp_forwarder *)value;
+		if(forwarder->local_only != local_only)
+			continue;
+		/* If the room is empty, only forward silence if the forwarder is "always on" */
+		if(empty && !forwarder->always_on)
+			continue;
+		if(!have_mix) {
+			/* FIXME Smoothen/Normalize instead of saturating? */
+			mix_kernels->subtract(outBuffer, mix, NULL, samples, 100);
+			have_mix = TRUE;
+		}
+		janus_rtp_header *rtph = NULL;
+		int length = 0;
+		if(forwarder->codec == JANUS_AUDIOCODEC_OPUS) {
+			if(encoder == NULL)
+				continue;
+			if(!have_opus) {
+				/* This is an Opus forwarder and we don't have a version for that yet */
+				opus_length = opus_encode(encoder, outBuffer, samples, rtpbuffer+12, 1500-12);
+				if(opus_length < 0) {
+					JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", opus_length, opus_strerror(opus_length));
+					continue;
+				}
+				have_opus = TRUE;
+			}
+			rtph = (janus_rtp_header *)rtpbuffer;
+			length = opus_length;
+		} else {
+			/* This is a G.711 forwarder */
+			if(!have_g711) {
+				if(audiobridge->sampling_rate != 8000) {
+					/* Downsample this from whatever the mixer uses */
+					i = janus_audiobridge_resample(audiobridge, &audiobridge->rtp_resamplers[local_only ? 1 : 0],
+						outBuffer, samples, audiobridge->sampling_rate, resampled, 8000);
+					if(i == 0) {
+						JANUS_LOG(LOG_WARN, "[G.711] Error downsampling from %d, skipping audio packet\n", audiobridge->sampling_rate);
+						continue;
+					}
+				} else {
+					/* Just copy */
+					memcpy(resampled, outBuffer, samples*2);
+				}
+				have_g711 = TRUE;
+			}
+			if(forwarder->codec == JANUS_AUDIOCODEC_PCMA) {
+				if(!have_alaw) {
+					for(i=0; i<160; i++)
+						rtpalaw[12+i] = janus_audiobridge_g711_alaw_encode(resampled[i]);
+					have_alaw = TRUE;
+				}
+				rtph = (janus_rtp_header *)rtpalaw;
+			} else {
+				if(!have_ulaw) {
+					for(i=0; i<160; i++)
+						rtpulaw[12+i] = janus_audiobridge_g711_ulaw_encode(resampled[i]);
+					have_ulaw = TRUE;
+				}
+				rtph = (janus_rtp_header *)rtpulaw;
+			}
+			length = 160;
+		}
+		/* Update header */
+		memset(rtph, 0, 12);
+		rtph->version = 2;
+		rtph->type = forwarder->payload_type;
+		rtph->ssrc = htonl(forwarder->ssrc ? forwarder->ssrc : stream_id);
+		forwarder->seq_number++;
+		rtph->seq_number = htons(forwarder->seq_number);
+		forwarder->timestamp += (forwarder->codec == JANUS_AUDIOCODEC_OPUS ? OPUS_SAMPLES : G711_SAMPLES);
+		rtph->timestamp = htonl(forwarder->timestamp);
+		/* Check if this packet needs to be encrypted */
+		char *payload = (char *)rtph;
+		int plen = length+12;
+		if(forwarder->is_srtp) {
+			memcpy(sbuf, payload, plen);
+			int protected = plen;
+			int res = srtp_protect(forwarder->srtp_ctx, sbuf, &protected);
+			if(res != srtp_err_status_ok) {
+				janus_rtp_header *header = (janus_rtp_header *)sbuf;
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "Error encrypting RTP packet for room %s... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
+					audiobridge->room_id_str, janus_srtp_error_str(res), plen, protected, timestamp, seq);
+			} else {
+				payload = (char *)&sbuf;
+				plen = protected;
+			}
+		}
+		/* No encryption, send the RTP packet as it is */
+		struct sockaddr *address = (forwarder->serv_addr.sin_family == AF_INET ?
+			(struct sockaddr *)&forwarder->serv_addr : (struct sockaddr *)&forwarder->serv_addr6);
+		size_t addrlen = (forwarder->serv_addr.sin_family == AF_INET ? sizeof(forwarder->serv_addr) : sizeof(forwarder->serv_addr6));
+		if(sendto(audiobridge->rtp_udp_sock, payload, plen, 0, address, addrlen) < 0) {
+			JANUS_LOG(LOG_HUGE, "Error forwarding mixed RTP packet for room %s... %s (len=%d)...\n",
+				audiobridge->room_id_str, strerror(errno), plen);
+		}
+	}
+}
+
 static int janus_audiobridge_create_static_rtp_forwarder(janus_config_category *cat, janus_audiobridge_room *audiobridge) {
 	guint32 forwarder_id = 0;
 	janus_config_item *forwarder_id_item = janus_config_get(config, cat, janus_config_type_item, "rtp_forward_id");
@@ -1936,7 +2811,7 @@ static int janus_audiobridge_create_static_rtp_forwarder(janus_config_category *
 		return -1;
 	}
 
-	if(janus_audiobridge_create_opus_encoder_if_needed(audiobridge)) {
+	if(janus_audiobridge_create_opus_encoder_if_needed(audiobridge, FALSE)) {
 		janus_mutex_unlock(&audiobridge->mutex);
 		janus_mutex_unlock(&rooms_mutex);
 		return -1;
@@ -1944,7 +2819,7 @@ static int janus_audiobridge_create_static_rtp_forwarder(janus_config_category *
 
 	janus_audiobridge_rtp_forwarder_add_helper(audiobridge,
 		host, port, ssrc_value, ptype, codec, srtp_suite, srtp_crypto,
-		always_on, forwarder_id);
+		always_on, FALSE, forwarder_id);
 
 	janus_mutex_unlock(&audiobridge->mutex);
 	janus_mutex_unlock(&rooms_mutex);
@@ -2011,6 +2886,24 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "AudioBridge will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *rq = janus_config_get(config, config_general, janus_config_type_item, "resampling_quality");
+		if(rq != NULL && rq->value != NULL) {
+			int quality = atoi(rq->value);
+			if(quality < 0 || quality > 10) {
+				JANUS_LOG(LOG_WARN, "Invalid resampling_quality value (%s), using %d\n", rq->value, resampling_quality);
+			} else {
+				resampling_quality = quality;
+			}
+		}
+		janus_config_item *et = janus_config_get(config, config_general, janus_config_type_item, "encoding_threads");
+		if(et != NULL && et->value != NULL) {
+			int workers = atoi(et->value);
+			if(workers < 0 || workers > 64) {
+				JANUS_LOG(LOG_WARN, "Invalid encoding_threads value (%s), using one thread per participant\n", et->value);
+			} else {
+				encoding_workers = workers;
+			}
+		}
 	}
 	/* Iterate on all rooms */
 	rooms = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
@@ -2032,6 +2925,11 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *audio_active_packets = janus_config_get(config, cat, janus_config_type_item, "audio_active_packets");
 			janus_config_item *audio_level_average = janus_config_get(config, cat, janus_config_type_item, "audio_level_average");
 			janus_config_item *default_prebuffering = janus_config_get(config, cat, janus_config_type_item, "default_prebuffering");
+			janus_config_item *shared_encoding = janus_config_get(config, cat, janus_config_type_item, "shared_encoding");
+			janus_config_item *mix_loudest = janus_config_get(config, cat, janus_config_type_item, "mix_loudest");
+			janus_config_item *record_filter = janus_config_get(config, cat, janus_config_type_item, "record_filter");
+			janus_config_item *adaptive_quality = janus_config_get(config, cat, janus_config_type_item, "adaptive_quality");
+			janus_config_item *adaptive_threshold = janus_config_get(config, cat, janus_config_type_item, "adaptive_threshold");
 			janus_config_item *secret = janus_config_get(config, cat, janus_config_type_item, "secret");
 			janus_config_item *pin = janus_config_get(config, cat, janus_config_type_item, "pin");
 			janus_config_item *record = janus_config_get(config, cat, janus_config_type_item, "record");
@@ -2103,6 +3001,17 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			audiobridge->audiolevel_event = FALSE;
 			if(audiolevel_event != NULL && audiolevel_event->value != NULL)
 				audiobridge->audiolevel_event = janus_is_true(audiolevel_event->value);
+			audiobridge->shared_encoding = FALSE;
+			if(shared_encoding != NULL && shared_encoding->value != NULL)
+				audiobridge->shared_encoding = janus_is_true(shared_encoding->value);
+			audiobridge->mix_loudest = 0;
+			if(mix_loudest != NULL && mix_loudest->value != NULL && atoi(mix_loudest->value) > 0)
+				audiobridge->mix_loudest = atoi(mix_loudest->value);
+			audiobridge->record_filter = record_filter && record_filter->value && janus_is_true(record_filter->value);
+			audiobridge->adaptive_quality = adaptive_quality && adaptive_quality->value && janus_is_true(adaptive_quality->value);
+			audiobridge->adaptive_threshold = JANUS_AUDIOBRIDGE_ADAPTIVE_THRESHOLD;
+			if(adaptive_threshold != NULL && adaptive_threshold->value != NULL && atoi(adaptive_threshold->value) > 0)
+				audiobridge->adaptive_threshold = atoi(adaptive_threshold->value);
 			if(audiobridge->audiolevel_event) {
 				audiobridge->audio_active_packets = 100;
 				if(audio_active_packets != NULL && audio_active_packets->value != NULL){
@@ -2143,6 +3052,7 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			if(recfile && recfile->value)
 				audiobridge->record_file = g_strdup(recfile->value);
 			audiobridge->recording = NULL;
+			audiobridge->recording_writer = NULL;
 			audiobridge->destroy = 0;
 			audiobridge->participants = g_hash_table_new_full(
 				string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
@@ -2155,6 +3065,8 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			janus_mutex_init(&audiobridge->mutex);
 			audiobridge->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_audiobridge_rtp_forwarder_destroy);
 			audiobridge->rtp_encoder = NULL;
+			audiobridge->rtp_local_encoder = NULL;
+			audiobridge->links = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_audiobridge_link_destroy);
 			audiobridge->rtp_udp_sock = -1;
 			janus_mutex_init(&audiobridge->rtp_mutex);
 			janus_refcount_init(&audiobridge->ref, janus_audiobridge_room_free);
@@ -2185,6 +3097,7 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 				g_hash_table_insert(rooms,
 					string_ids ? (gpointer)g_strdup(audiobridge->room_id_str) : (gpointer)janus_uint64_dup(audiobridge->room_id),
 					audiobridge);
+				g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 				janus_mutex_unlock(&rooms_mutex);
 			}
 			cl = cl->next;
@@ -2205,6 +3118,9 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 	}
 	janus_mutex_unlock(&rooms_mutex);
 
+	janus_audiobridge_mix_kernels_init();
+	janus_audiobridge_dbov_energy_init();
+
 	g_atomic_int_set(&initialized, 1);
 
 	/* Launch the thread that will handle incoming messages */
@@ -2218,9 +3134,30 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_destroy(config);
 		return -1;
 	}
-	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_AUDIOBRIDGE_NAME);
-	return 0;
-}
+	/* Launch the encoding workers, if we need a pool */
+	if(encoding_workers > 0) {
+		encoding_queues = g_malloc0(encoding_workers * sizeof(GAsyncQueue *));
+		encoding_threads = g_malloc0(encoding_workers * sizeof(GThread *));
+		guint w = 0;
+		for(w=0; w<encoding_workers; w++) {
+			encoding_queues[w] = g_async_queue_new_full((GDestroyNotify)janus_audiobridge_encoding_job_free);
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "abridge enc %u", w+1);
+			error = NULL;
+			encoding_threads[w] = g_thread_try_new(tname, janus_audiobridge_encoding_thread, encoding_queues[w], &error);
+			if(error != NULL) {
+				/* Shouldn't happen, but if it does we can't go on with a broken pool */
+				JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch AudioBridge encoding thread #%u...\n",
+					error->code, error->message ? error->message : "??", w+1);
+				g_error_free(error);
+				exit(1);
+			}
+		}
+		JANUS_LOG(LOG_INFO, "AudioBridge will encode mixed frames using %u threads\n", encoding_workers);
+	}
+	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_AUDIOBRIDGE_NAME);
+	return 0;
+}
 
 void janus_audiobridge_destroy(void) {
 	if(!g_atomic_int_get(&initialized))
@@ -2232,6 +3169,19 @@ void janus_audiobridge_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	if(encoding_threads != NULL) {
+		guint w = 0;
+		for(w=0; w<encoding_workers; w++) {
+			/* The exit job has no deadline, so it's going to be served first */
+			g_async_queue_push_sorted(encoding_queues[w], &encoding_exit_job, janus_audiobridge_encoding_job_compare, NULL);
+			g_thread_join(encoding_threads[w]);
+			g_async_queue_unref(encoding_queues[w]);
+		}
+		g_free(encoding_threads);
+		encoding_threads = NULL;
+		g_free(encoding_queues);
+		encoding_queues = NULL;
+	}
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -2346,6 +3296,14 @@ static void janus_audiobridge_notify_participants(janus_audiobridge_participant
 	}
 }
 
+json_t *janus_audiobridge_query_metrics(void) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return NULL;
+	json_t *metrics = json_object();
+	json_object_set_new(metrics, "rooms", json_integer(g_atomic_int_get(&rooms_count)));
+	return metrics;
+}
+
 json_t *janus_audiobridge_query_session(janus_plugin_session *handle) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -2377,12 +3335,15 @@ json_t *janus_audiobridge_query_session(janus_plugin_session *handle) {
 		json_object_set_new(info, "muted", participant->muted ? json_true() : json_false());
 		json_object_set_new(info, "active", g_atomic_int_get(&participant->active) ? json_true() : json_false());
 		json_object_set_new(info, "pre-buffering", participant->prebuffering ? json_true() : json_false());
-		if(participant->inbuf) {
-			janus_mutex_lock(&participant->qmutex);
-			json_object_set_new(info, "queue-in", json_integer(g_list_length(participant->inbuf)));
-			janus_mutex_unlock(&participant->qmutex);
-		}
-		if(participant->outbuf)
+		janus_mutex_lock(&participant->qmutex);
+		json_object_set_new(info, "queue-in", json_integer(participant->inbuf.count));
+		json_object_set_new(info, "jitter-depth", json_integer(MAX(participant->prebuffer_count, participant->inbuf.depth)));
+		json_object_set_new(info, "jitter-underruns", json_integer(participant->inbuf.underruns));
+		json_object_set_new(info, "decodes-skipped", json_integer(participant->decodes_skipped));
+		janus_mutex_unlock(&participant->qmutex);
+		if(encoding_workers > 0)
+			json_object_set_new(info, "encoding-worker", json_integer(participant->encoding_worker + 1));
+		else if(participant->outbuf)
 			json_object_set_new(info, "queue-out", json_integer(g_async_queue_length(participant->outbuf)));
 		if(participant->last_drop > 0)
 			json_object_set_new(info, "last-drop", json_integer(participant->last_drop));
@@ -2456,6 +3417,11 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		json_t *audio_active_packets = json_object_get(root, "audio_active_packets");
 		json_t *audio_level_average = json_object_get(root, "audio_level_average");
 		json_t *default_prebuffering = json_object_get(root, "default_prebuffering");
+		json_t *shared_encoding = json_object_get(root, "shared_encoding");
+		json_t *mix_loudest = json_object_get(root, "mix_loudest");
+		json_t *record_filter = json_object_get(root, "record_filter");
+		json_t *adaptive_quality = json_object_get(root, "adaptive_quality");
+		json_t *adaptive_threshold = json_object_get(root, "adaptive_threshold");
 		json_t *record = json_object_get(root, "record");
 		json_t *recfile = json_object_get(root, "record_file");
 		json_t *permanent = json_object_get(root, "permanent");
@@ -2557,6 +3523,12 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			audiobridge->sampling_rate = 16000;
 		audiobridge->audiolevel_ext = audiolevel_ext ? json_is_true(audiolevel_ext) : TRUE;
 		audiobridge->audiolevel_event = audiolevel_event ? json_is_true(audiolevel_event) : FALSE;
+		audiobridge->shared_encoding = shared_encoding ? json_is_true(shared_encoding) : FALSE;
+		audiobridge->mix_loudest = mix_loudest ? json_integer_value(mix_loudest) : 0;
+		audiobridge->record_filter = record_filter ? json_is_true(record_filter) : FALSE;
+		audiobridge->adaptive_quality = adaptive_quality ? json_is_true(adaptive_quality) : FALSE;
+		audiobridge->adaptive_threshold = json_integer_value(adaptive_threshold) > 0 ?
+			json_integer_value(adaptive_threshold) : JANUS_AUDIOBRIDGE_ADAPTIVE_THRESHOLD;
 		if(audiobridge->audiolevel_event) {
 			audiobridge->audio_active_packets = 100;
 			if(json_integer_value(audio_active_packets) > 0) {
@@ -2604,6 +3576,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		if(recfile)
 			audiobridge->record_file = g_strdup(json_string_value(recfile));
 		audiobridge->recording = NULL;
+		audiobridge->recording_writer = NULL;
 		audiobridge->destroy = 0;
 		audiobridge->participants = g_hash_table_new_full(
 			string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
@@ -2627,12 +3600,15 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		janus_mutex_init(&audiobridge->mutex);
 		audiobridge->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_audiobridge_rtp_forwarder_destroy);
 		audiobridge->rtp_encoder = NULL;
+		audiobridge->rtp_local_encoder = NULL;
+		audiobridge->links = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_audiobridge_link_destroy);
 		audiobridge->rtp_udp_sock = -1;
 		janus_mutex_init(&audiobridge->rtp_mutex);
 		janus_refcount_init(&audiobridge->ref, janus_audiobridge_room_free);
 		g_hash_table_insert(rooms,
 			string_ids ? (gpointer)g_strdup(audiobridge->room_id_str) : (gpointer)janus_uint64_dup(audiobridge->room_id),
 			audiobridge);
+		g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 		JANUS_LOG(LOG_VERB, "Created AudioBridge: %s (%s, %s, secret: %s, pin: %s)\n",
 			audiobridge->room_id_str, audiobridge->room_name,
 			audiobridge->is_private ? "private" : "public",
@@ -2653,6 +3629,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			g_error_free(error);
 			janus_refcount_decrease(&audiobridge->ref);
 			g_hash_table_remove(rooms, string_ids ? (gpointer)audiobridge->room_id_str : (gpointer)&audiobridge->room_id);
+			g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 			janus_mutex_unlock(&rooms_mutex);
 			if(room_id_allocated)
 				g_free(room_id_str);
@@ -2677,6 +3654,19 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				janus_config_add(config, c, janus_config_item_create("secret", audiobridge->room_secret));
 			if(audiobridge->room_pin)
 				janus_config_add(config, c, janus_config_item_create("pin", audiobridge->room_pin));
+			if(audiobridge->shared_encoding)
+				janus_config_add(config, c, janus_config_item_create("shared_encoding", "yes"));
+			if(audiobridge->mix_loudest > 0) {
+				g_snprintf(value, BUFSIZ, "%u", audiobridge->mix_loudest);
+				janus_config_add(config, c, janus_config_item_create("mix_loudest", value));
+			}
+			if(audiobridge->record_filter)
+				janus_config_add(config, c, janus_config_item_create("record_filter", "yes"));
+			if(audiobridge->adaptive_quality) {
+				janus_config_add(config, c, janus_config_item_create("adaptive_quality", "yes"));
+				g_snprintf(value, BUFSIZ, "%u", audiobridge->adaptive_threshold);
+				janus_config_add(config, c, janus_config_item_create("adaptive_threshold", value));
+			}
 			if(audiobridge->audiolevel_ext) {
 				janus_config_add(config, c, janus_config_item_create("audiolevel_ext", "yes"));
 				if(audiobridge->audiolevel_event)
@@ -2706,7 +3696,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			string_ids ? json_string(audiobridge->room_id_str) : json_integer(audiobridge->room_id));
 		json_object_set_new(response, "permanent", save ? json_true() : json_false());
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("created"));
 			json_object_set_new(info, "room",
@@ -2819,6 +3809,19 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				janus_config_add(config, c, janus_config_item_create("secret", audiobridge->room_secret));
 			if(audiobridge->room_pin)
 				janus_config_add(config, c, janus_config_item_create("pin", audiobridge->room_pin));
+			if(audiobridge->shared_encoding)
+				janus_config_add(config, c, janus_config_item_create("shared_encoding", "yes"));
+			if(audiobridge->mix_loudest > 0) {
+				g_snprintf(value, BUFSIZ, "%u", audiobridge->mix_loudest);
+				janus_config_add(config, c, janus_config_item_create("mix_loudest", value));
+			}
+			if(audiobridge->record_filter)
+				janus_config_add(config, c, janus_config_item_create("record_filter", "yes"));
+			if(audiobridge->adaptive_quality) {
+				janus_config_add(config, c, janus_config_item_create("adaptive_quality", "yes"));
+				g_snprintf(value, BUFSIZ, "%u", audiobridge->adaptive_threshold);
+				janus_config_add(config, c, janus_config_item_create("adaptive_threshold", value));
+			}
 			if(audiobridge->audiolevel_ext) {
 				janus_config_add(config, c, janus_config_item_create("audiolevel_ext", "yes"));
 				if(audiobridge->audiolevel_event)
@@ -2848,7 +3851,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			string_ids ? json_string(audiobridge->room_id_str) : json_integer(audiobridge->room_id));
 		json_object_set_new(response, "permanent", save ? json_true() : json_false());
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("edited"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -2917,6 +3920,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		/* Remove room */
 		janus_refcount_increase(&audiobridge->ref);
 		g_hash_table_remove(rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
+		g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 		if(save) {
 			/* This change is permanent: save to the configuration file too
 			 * FIXME: We should check if anything fails... */
@@ -2952,18 +3956,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				/* Get rid of queued packets */
 				janus_mutex_lock(&p->qmutex);
 				g_atomic_int_set(&p->active, 0);
-				while(p->inbuf) {
-					GList *first = g_list_first(p->inbuf);
-					janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-					p->inbuf = g_list_delete_link(p->inbuf, first);
-					first = NULL;
-					if(pkt == NULL)
-						continue;
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-				}
+				janus_audiobridge_jitter_flush(&p->inbuf);
 				janus_mutex_unlock(&p->qmutex);
 				/* Request a WebRTC hangup */
 				gateway->close_pc(p->session->handle);
@@ -2971,7 +3964,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		}
 		json_decref(destroyed);
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("destroyed"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3026,7 +4019,22 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			json_object_set_new(rl, "sampling_rate", json_integer(room->sampling_rate));
 			json_object_set_new(rl, "pin_required", room->room_pin ? json_true() : json_false());
 			json_object_set_new(rl, "record", room->record ? json_true() : json_false());
+			json_object_set_new(rl, "record_filter", room->record_filter ? json_true() : json_false());
 			json_object_set_new(rl, "muted", room->muted ? json_true() : json_false());
+			json_object_set_new(rl, "late_ticks", json_integer(g_atomic_int_get(&room->late_ticks)));
+			json_object_set_new(rl, "tick_lateness", json_integer(g_atomic_int_get(&room->tick_lateness)));
+			json_t *histogram = json_object();
+			int b = 0;
+			for(b=0; b<JANUS_AUDIOBRIDGE_LATENESS_BUCKETS; b++) {
+				json_object_set_new(histogram, janus_audiobridge_lateness_names[b],
+					json_integer(g_atomic_int_get(&room->lateness_histogram[b])));
+			}
+			json_object_set_new(rl, "tick_lateness_histogram", histogram);
+			if(room->adaptive_quality)
+				json_object_set_new(rl, "degradation", json_integer(g_atomic_int_get(&room->degradation)));
+			json_object_set_new(rl, "late_frames", json_integer(g_atomic_int_get(&room->late_frames)));
+			json_object_set_new(rl, "resampled_frames", json_integer(g_atomic_int_get(&room->resampled_frames)));
+			json_object_set_new(rl, "resampling_time", json_integer(room->resampling_time/1000));
 			json_object_set_new(rl, "num_participants", json_integer(g_hash_table_size(room->participants)));
 			json_array_append_new(list, rl);
 			janus_refcount_decrease(&room->ref);
@@ -3292,18 +4300,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				participant->muted ? "true" : "false", participant->room->room_id_str, participant->user_id_str);
 			/* Clear the queued packets waiting to be handled */
 			janus_mutex_lock(&participant->qmutex);
-			while(participant->inbuf) {
-				GList *first = g_list_first(participant->inbuf);
-				janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-				participant->inbuf = g_list_delete_link(participant->inbuf, first);
-				first = NULL;
-				if(pkt == NULL)
-					continue;
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
-				pkt = NULL;
-			}
+			janus_audiobridge_jitter_flush(&participant->inbuf);
 			janus_mutex_unlock(&participant->qmutex);
 		}
 
@@ -3335,7 +4332,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		}
 
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string(request_text));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3437,7 +4434,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		json_decref(event);
 
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string(request_text));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3551,7 +4548,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		}
 		json_decref(event);
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("kicked"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3753,24 +4750,287 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			g_snprintf(error_cause, 512, "Could not resolve address (%s)...", host);
 			goto prepare_response;
 		}
-		host = resolved_host;
-		json_t *always = json_object_get(root, "always_on");
-		gboolean always_on = always ? json_is_true(always) : FALSE;
-		/* Besides, we may need to SRTP-encrypt this stream */
-		int srtp_suite = 0;
-		const char *srtp_crypto = NULL;
-		json_t *s_suite = json_object_get(root, "srtp_suite");
-		json_t *s_crypto = json_object_get(root, "srtp_crypto");
-		if(s_suite && s_crypto) {
-			srtp_suite = json_integer_value(s_suite);
-			if(srtp_suite != 32 && srtp_suite != 80) {
-				JANUS_LOG(LOG_ERR, "Invalid SRTP suite (%d)\n", srtp_suite);
-				error_code = JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT;
-				g_snprintf(error_cause, 512, "Invalid SRTP suite (%d)", srtp_suite);
+		host = resolved_host;
+		json_t *always = json_object_get(root, "always_on");
+		gboolean always_on = always ? json_is_true(always) : FALSE;
+		json_t *local = json_object_get(root, "local_only");
+		gboolean local_only = local ? json_is_true(local) : FALSE;
+		/* Besides, we may need to SRTP-encrypt this stream */
+		int srtp_suite = 0;
+		const char *srtp_crypto = NULL;
+		json_t *s_suite = json_object_get(root, "srtp_suite");
+		json_t *s_crypto = json_object_get(root, "srtp_crypto");
+		if(s_suite && s_crypto) {
+			srtp_suite = json_integer_value(s_suite);
+			if(srtp_suite != 32 && srtp_suite != 80) {
+				JANUS_LOG(LOG_ERR, "Invalid SRTP suite (%d)\n", srtp_suite);
+				error_code = JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, 512, "Invalid SRTP suite (%d)", srtp_suite);
+				goto prepare_response;
+			}
+			srtp_crypto = json_string_value(s_crypto);
+		}
+		/* Update room */
+		janus_mutex_lock(&rooms_mutex);
+		janus_audiobridge_room *audiobridge = g_hash_table_lookup(rooms,
+			string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
+		if(audiobridge == NULL) {
+			janus_mutex_unlock(&rooms_mutex);
+			JANUS_LOG(LOG_ERR, "No such room (%s)\n", room_id_str);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_ROOM;
+			g_snprintf(error_cause, 512, "No such room (%s", room_id_str);
+			goto prepare_response;
+		}
+		/* A secret may be required for this action */
+		JANUS_CHECK_SECRET(audiobridge->room_secret, root, "secret", error_code, error_cause,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_UNAUTHORIZED);
+		if(error_code != 0) {
+			janus_mutex_unlock(&rooms_mutex);
+			goto prepare_response;
+		}
+		janus_mutex_lock(&audiobridge->mutex);
+		if(audiobridge->destroyed) {
+			janus_mutex_unlock(&audiobridge->mutex);
+			janus_mutex_unlock(&rooms_mutex);
+			JANUS_LOG(LOG_ERR, "No such room (%s)\n", room_id_str);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_ROOM;
+			g_snprintf(error_cause, 512, "No such room (%s)", room_id_str);
+			goto prepare_response;
+		}
+
+		if(janus_audiobridge_create_udp_socket_if_needed(audiobridge)) {
+			janus_mutex_unlock(&audiobridge->mutex);
+			janus_mutex_unlock(&rooms_mutex);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "Could not open UDP socket for RTP forwarder");
+			goto prepare_response;
+		}
+
+		if(janus_audiobridge_create_opus_encoder_if_needed(audiobridge, local_only)) {
+			janus_mutex_unlock(&audiobridge->mutex);
+			janus_mutex_unlock(&rooms_mutex);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_LIBOPUS_ERROR;
+			g_snprintf(error_cause, 512, "Error creating Opus encoder for RTP forwarder");
+			goto prepare_response;
+		}
+
+		guint32 stream_id = janus_audiobridge_rtp_forwarder_add_helper(audiobridge,
+			host, port, ssrc_value, ptype, codec, srtp_suite, srtp_crypto, always_on, local_only, 0);
+		janus_mutex_unlock(&audiobridge->mutex);
+		janus_mutex_unlock(&rooms_mutex);
+
+		/* Done, prepare response */
+		response = json_object();
+		json_object_set_new(response, "audiobridge", json_string("success"));
+		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
+		json_object_set_new(response, "stream_id", json_integer(stream_id));
+		json_object_set_new(response, "host", json_string(host));
+		json_object_set_new(response, "port", json_integer(port));
+		goto prepare_response;
+	} else if(!strcasecmp(request_text, "stop_rtp_forward")) {
+		JANUS_VALIDATE_JSON_OBJECT(root, stop_rtp_forward_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto prepare_response;
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		if(lock_rtpfwd && admin_key != NULL) {
+			/* An admin key was specified: make sure it was provided, and that it's valid */
+			JANUS_VALIDATE_JSON_OBJECT(root, adminkey_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+			if(error_code != 0)
+				goto prepare_response;
+			JANUS_CHECK_SECRET(admin_key, root, "admin_key", error_code, error_cause,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_UNAUTHORIZED);
+			if(error_code != 0)
+				goto prepare_response;
+		}
+		/* Parse parameters */
+		json_t *room = json_object_get(root, "room");
+		guint64 room_id = 0;
+		char room_id_num[30], *room_id_str = NULL;
+		if(!string_ids) {
+			room_id = json_integer_value(room);
+			g_snprintf(room_id_num, sizeof(room_id_num), "%"SCNu64, room_id);
+			room_id_str = room_id_num;
+		} else {
+			room_id_str = (char *)json_string_value(room);
+		}
+		guint32 stream_id = json_integer_value(json_object_get(root, "stream_id"));
+		/* Update room */
+		janus_mutex_lock(&rooms_mutex);
+		janus_audiobridge_room *audiobridge = g_hash_table_lookup(rooms,
+			string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
+		if(audiobridge == NULL) {
+			janus_mutex_unlock(&rooms_mutex);
+			JANUS_LOG(LOG_ERR, "No such room (%s)\n", room_id_str);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_ROOM;
+			g_snprintf(error_cause, 512, "No such room (%s)", room_id_str);
+			goto prepare_response;
+		}
+		/* A secret may be required for this action */
+		JANUS_CHECK_SECRET(audiobridge->room_secret, root, "secret", error_code, error_cause,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_UNAUTHORIZED);
+		if(error_code != 0) {
+			janus_mutex_unlock(&rooms_mutex);
+			goto prepare_response;
+		}
+		janus_mutex_lock(&audiobridge->mutex);
+		if(audiobridge->destroyed) {
+			janus_mutex_unlock(&audiobridge->mutex);
+			janus_mutex_unlock(&rooms_mutex);
+			JANUS_LOG(LOG_ERR, "No such room (%s)\n", room_id_str);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_ROOM;
+			g_snprintf(error_cause, 512, "No such room (%s)", room_id_str);
+			goto prepare_response;
+		}
+		janus_mutex_lock(&audiobridge->rtp_mutex);
+		g_hash_table_remove(audiobridge->rtp_forwarders, GUINT_TO_POINTER(stream_id));
+		janus_mutex_unlock(&audiobridge->rtp_mutex);
+		janus_mutex_unlock(&audiobridge->mutex);
+		janus_mutex_unlock(&rooms_mutex);
+		response = json_object();
+		json_object_set_new(response, "audiobridge", json_string("success"));
+		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
+		json_object_set_new(response, "stream_id", json_integer(stream_id));
+		goto prepare_response;
+	} else if(!strcasecmp(request_text, "listforwarders")) {
+		/* List all forwarders in a room */
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		json_t *room = json_object_get(root, "room");
+		guint64 room_id = 0;
+		char room_id_num[30], *room_id_str = NULL;
+		if(!string_ids) {
+			room_id = json_integer_value(room);
+			g_snprintf(room_id_num, sizeof(room_id_num), "%"SCNu64, room_id);
+			room_id_str = room_id_num;
+		} else {
+			room_id_str = (char *)json_string_value(room);
+		}
+		janus_mutex_lock(&rooms_mutex);
+		janus_audiobridge_room *audiobridge = g_hash_table_lookup(rooms,
+			string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
+		if(audiobridge == NULL) {
+			janus_mutex_unlock(&rooms_mutex);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_ROOM;
+			JANUS_LOG(LOG_ERR, "No such room (%s)\n", room_id_str);
+			g_snprintf(error_cause, 512, "No such room (%s)", room_id_str);
+			goto prepare_response;
+		}
+		if(audiobridge->destroyed) {
+			JANUS_LOG(LOG_ERR, "No such room (%s)\n", room_id_str);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_ROOM;
+			g_snprintf(error_cause, 512, "No such room (%s)", room_id_str);
+			janus_mutex_unlock(&rooms_mutex);
+			goto prepare_response;
+		}
+		/* A secret may be required for this action */
+		JANUS_CHECK_SECRET(audiobridge->room_secret, root, "secret", error_code, error_cause,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_UNAUTHORIZED);
+		if(error_code != 0) {
+			janus_mutex_unlock(&rooms_mutex);
+			goto prepare_response;
+		}
+		/* Return a list of all forwarders */
+		json_t *list = json_array();
+		GHashTableIter iter;
+		gpointer key, value;
+		janus_mutex_lock(&audiobridge->rtp_mutex);
+		g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
+		while(g_hash_table_iter_next(&iter, &key, &value)) {
+			guint32 stream_id = GPOINTER_TO_UINT(key);
+			janus_audiobridge_rtp_forwarder *rf = (janus_audiobridge_rtp_forwarder *)value;
+			json_t *fl = json_object();
+			json_object_set_new(fl, "stream_id", json_integer(stream_id));
+			char address[100];
+			if(rf->serv_addr.sin_family == AF_INET) {
+				json_object_set_new(fl, "ip", json_string(
+					inet_ntop(AF_INET, &rf->serv_addr.sin_addr, address, sizeof(address))));
+			} else {
+				json_object_set_new(fl, "ip", json_string(
+					inet_ntop(AF_INET6, &rf->serv_addr6.sin6_addr, address, sizeof(address))));
+			}
+			json_object_set_new(fl, "port", json_integer(ntohs(rf->serv_addr.sin_port)));
+			json_object_set_new(fl, "ssrc", json_integer(rf->ssrc ? rf->ssrc : stream_id));
+			json_object_set_new(fl, "codec", json_string(janus_audiocodec_name(rf->codec)));
+			json_object_set_new(fl, "ptype", json_integer(rf->payload_type));
+			if(rf->is_srtp)
+				json_object_set_new(fl, "srtp", json_true());
+			json_object_set_new(fl, "always_on", rf->always_on ? json_true() : json_false());
+			if(rf->local_only)
+				json_object_set_new(fl, "local_only", json_true());
+			json_array_append_new(list, fl);
+		}
+		janus_mutex_unlock(&audiobridge->rtp_mutex);
+		janus_mutex_unlock(&rooms_mutex);
+		response = json_object();
+		json_object_set_new(response, "audiobridge", json_string("forwarders"));
+		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
+		json_object_set_new(response, "rtp_forwarders", list);
+		goto prepare_response;
+	} else if(!strcasecmp(request_text, "add_link")) {
+		JANUS_VALIDATE_JSON_OBJECT(root, add_link_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto prepare_response;
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		if(lock_rtpfwd && admin_key != NULL) {
+			/* An admin key was specified: make sure it was provided, and that it's valid */
+			JANUS_VALIDATE_JSON_OBJECT(root, adminkey_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+			if(error_code != 0)
 				goto prepare_response;
-			}
-			srtp_crypto = json_string_value(s_crypto);
+			JANUS_CHECK_SECRET(admin_key, root, "admin_key", error_code, error_cause,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_UNAUTHORIZED);
+			if(error_code != 0)
+				goto prepare_response;
+		}
+		/* Parse parameters */
+		json_t *room = json_object_get(root, "room");
+		guint64 room_id = 0;
+		char room_id_num[30], *room_id_str = NULL;
+		if(!string_ids) {
+			room_id = json_integer_value(room);
+			g_snprintf(room_id_num, sizeof(room_id_num), "%"SCNu64, room_id);
+			room_id_str = room_id_num;
+		} else {
+			room_id_str = (char *)json_string_value(room);
 		}
+		guint32 link_id = json_integer_value(json_object_get(root, "link_id"));
+		uint16_t port = json_integer_value(json_object_get(root, "port"));
 		/* Update room */
 		janus_mutex_lock(&rooms_mutex);
 		janus_audiobridge_room *audiobridge = g_hash_table_lookup(rooms,
@@ -3779,7 +5039,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			janus_mutex_unlock(&rooms_mutex);
 			JANUS_LOG(LOG_ERR, "No such room (%s)\n", room_id_str);
 			error_code = JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_ROOM;
-			g_snprintf(error_cause, 512, "No such room (%s", room_id_str);
+			g_snprintf(error_cause, 512, "No such room (%s)", room_id_str);
 			goto prepare_response;
 		}
 		/* A secret may be required for this action */
@@ -3798,38 +5058,39 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			g_snprintf(error_cause, 512, "No such room (%s)", room_id_str);
 			goto prepare_response;
 		}
-
-		if(janus_audiobridge_create_udp_socket_if_needed(audiobridge)) {
-			janus_mutex_unlock(&audiobridge->mutex);
-			janus_mutex_unlock(&rooms_mutex);
-			error_code = JANUS_AUDIOBRIDGE_ERROR_UNKNOWN_ERROR;
-			g_snprintf(error_cause, 512, "Could not open UDP socket for RTP forwarder");
-			goto prepare_response;
+		if(link_id > 0) {
+			janus_mutex_lock(&audiobridge->rtp_mutex);
+			gboolean exists = (g_hash_table_lookup(audiobridge->links, GUINT_TO_POINTER(link_id)) != NULL);
+			janus_mutex_unlock(&audiobridge->rtp_mutex);
+			if(exists) {
+				janus_mutex_unlock(&audiobridge->mutex);
+				janus_mutex_unlock(&rooms_mutex);
+				JANUS_LOG(LOG_ERR, "Link %"SCNu32" already exists\n", link_id);
+				error_code = JANUS_AUDIOBRIDGE_ERROR_ID_EXISTS;
+				g_snprintf(error_cause, 512, "Link %"SCNu32" already exists", link_id);
+				goto prepare_response;
+			}
 		}
-
-		if(janus_audiobridge_create_opus_encoder_if_needed(audiobridge)) {
+		janus_audiobridge_link *link = janus_audiobridge_link_add(audiobridge, link_id, port);
+		if(link == NULL) {
 			janus_mutex_unlock(&audiobridge->mutex);
 			janus_mutex_unlock(&rooms_mutex);
-			error_code = JANUS_AUDIOBRIDGE_ERROR_LIBOPUS_ERROR;
-			g_snprintf(error_cause, 512, "Error creating Opus encoder for RTP forwarder");
+			error_code = JANUS_AUDIOBRIDGE_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "Could not create link");
 			goto prepare_response;
 		}
-
-		guint32 stream_id = janus_audiobridge_rtp_forwarder_add_helper(audiobridge,
-			host, port, ssrc_value, ptype, codec, srtp_suite, srtp_crypto, always_on, 0);
+		link_id = link->link_id;
+		port = link->port;
 		janus_mutex_unlock(&audiobridge->mutex);
 		janus_mutex_unlock(&rooms_mutex);
-
-		/* Done, prepare response */
 		response = json_object();
 		json_object_set_new(response, "audiobridge", json_string("success"));
 		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
-		json_object_set_new(response, "stream_id", json_integer(stream_id));
-		json_object_set_new(response, "host", json_string(host));
+		json_object_set_new(response, "link_id", json_integer(link_id));
 		json_object_set_new(response, "port", json_integer(port));
 		goto prepare_response;
-	} else if(!strcasecmp(request_text, "stop_rtp_forward")) {
-		JANUS_VALIDATE_JSON_OBJECT(root, stop_rtp_forward_parameters,
+	} else if(!strcasecmp(request_text, "remove_link")) {
+		JANUS_VALIDATE_JSON_OBJECT(root, remove_link_parameters,
 			error_code, error_cause, TRUE,
 			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
 		if(error_code != 0)
@@ -3868,7 +5129,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		guint32 stream_id = json_integer_value(json_object_get(root, "stream_id"));
+		guint32 link_id = json_integer_value(json_object_get(root, "link_id"));
 		/* Update room */
 		janus_mutex_lock(&rooms_mutex);
 		janus_audiobridge_room *audiobridge = g_hash_table_lookup(rooms,
@@ -3897,17 +5158,23 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			goto prepare_response;
 		}
 		janus_mutex_lock(&audiobridge->rtp_mutex);
-		g_hash_table_remove(audiobridge->rtp_forwarders, GUINT_TO_POINTER(stream_id));
+		gboolean removed = g_hash_table_remove(audiobridge->links, GUINT_TO_POINTER(link_id));
 		janus_mutex_unlock(&audiobridge->rtp_mutex);
 		janus_mutex_unlock(&audiobridge->mutex);
 		janus_mutex_unlock(&rooms_mutex);
+		if(!removed) {
+			JANUS_LOG(LOG_ERR, "No such link (%"SCNu32")\n", link_id);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "No such link (%"SCNu32")", link_id);
+			goto prepare_response;
+		}
 		response = json_object();
 		json_object_set_new(response, "audiobridge", json_string("success"));
 		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
-		json_object_set_new(response, "stream_id", json_integer(stream_id));
+		json_object_set_new(response, "link_id", json_integer(link_id));
 		goto prepare_response;
-	} else if(!strcasecmp(request_text, "listforwarders")) {
-		/* List all forwarders in a room */
+	} else if(!strcasecmp(request_text, "listlinks")) {
+		/* List all links in a room */
 		if(!string_ids) {
 			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
 				error_code, error_cause, TRUE,
@@ -3953,40 +5220,30 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			janus_mutex_unlock(&rooms_mutex);
 			goto prepare_response;
 		}
-		/* Return a list of all forwarders */
+		/* Return a list of all links */
 		json_t *list = json_array();
 		GHashTableIter iter;
-		gpointer key, value;
+		gpointer value;
 		janus_mutex_lock(&audiobridge->rtp_mutex);
-		g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
-		while(g_hash_table_iter_next(&iter, &key, &value)) {
-			guint32 stream_id = GPOINTER_TO_UINT(key);
-			janus_audiobridge_rtp_forwarder *rf = (janus_audiobridge_rtp_forwarder *)value;
-			json_t *fl = json_object();
-			json_object_set_new(fl, "stream_id", json_integer(stream_id));
-			char address[100];
-			if(rf->serv_addr.sin_family == AF_INET) {
-				json_object_set_new(fl, "ip", json_string(
-					inet_ntop(AF_INET, &rf->serv_addr.sin_addr, address, sizeof(address))));
-			} else {
-				json_object_set_new(fl, "ip", json_string(
-					inet_ntop(AF_INET6, &rf->serv_addr6.sin6_addr, address, sizeof(address))));
-			}
-			json_object_set_new(fl, "port", json_integer(ntohs(rf->serv_addr.sin_port)));
-			json_object_set_new(fl, "ssrc", json_integer(rf->ssrc ? rf->ssrc : stream_id));
-			json_object_set_new(fl, "codec", json_string(janus_audiocodec_name(rf->codec)));
-			json_object_set_new(fl, "ptype", json_integer(rf->payload_type));
-			if(rf->is_srtp)
-				json_object_set_new(fl, "srtp", json_true());
-			json_object_set_new(fl, "always_on", rf->always_on ? json_true() : json_false());
-			json_array_append_new(list, fl);
+		g_hash_table_iter_init(&iter, audiobridge->links);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_audiobridge_link *link = (janus_audiobridge_link *)value;
+			json_t *ll = json_object();
+			json_object_set_new(ll, "link_id", json_integer(link->link_id));
+			json_object_set_new(ll, "port", json_integer(link->port));
+			janus_mutex_lock(&link->mutex);
+			json_object_set_new(ll, "packets", json_integer(link->packets));
+			json_object_set_new(ll, "queue", json_integer(link->jitter.count));
+			json_object_set_new(ll, "underruns", json_integer(link->jitter.underruns));
+			janus_mutex_unlock(&link->mutex);
+			json_array_append_new(list, ll);
 		}
 		janus_mutex_unlock(&audiobridge->rtp_mutex);
 		janus_mutex_unlock(&rooms_mutex);
 		response = json_object();
-		json_object_set_new(response, "audiobridge", json_string("forwarders"));
+		json_object_set_new(response, "audiobridge", json_string("links"));
 		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
-		json_object_set_new(response, "rtp_forwarders", list);
+		json_object_set_new(response, "links", list);
 		goto prepare_response;
 	} else if(!strcasecmp(request_text, "play_file")) {
 #ifndef HAVE_LIBOGG
@@ -4319,7 +5576,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			janus_audiobridge_notify_participants(p, event, TRUE);
 			json_decref(event);
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("announcement-stopped"));
 				json_object_set_new(info, "room",
@@ -4564,6 +5821,17 @@ void janus_audiobridge_setup_media(janus_plugin_session *handle) {
 	janus_mutex_unlock(&rooms_mutex);
 }
 
+/* Helper to check whether an Opus packet is DTX: empty frames only carry the TOC byte
+ * (which, for code 1 and 2 packets, may be followed by the length of the second frame) */
+static gboolean janus_audiobridge_opus_is_dtx(const unsigned char *payload, int plen) {
+	if(plen < 1)
+		return FALSE;
+	if(plen == 1)
+		return TRUE;
+	int code = payload[0] & 0x03;
+	return plen == 2 && code != 3;
+}
+
 void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet) {
 	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
@@ -4605,22 +5873,17 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 				rtp->type, participant->codec == JANUS_AUDIOCODEC_PCMA ? 8 : 0);
 			return;
 		}
-		janus_audiobridge_rtp_relay_packet *pkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-		pkt->data = g_malloc0(BUFFER_SAMPLES*sizeof(opus_int16));
-		pkt->ssrc = 0;
+		janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_participant_packet(participant);
 		pkt->timestamp = ntohl(rtp->timestamp);
 		pkt->seq_number = ntohs(rtp->seq_number);
 		/* We might check the audio level extension to see if this is silence */
-		pkt->silence = FALSE;
-		pkt->length = 0;
 
 		/* First check if probation period */
 		if(participant->probation == MIN_SEQUENTIAL) {
 			participant->probation--;
 			participant->expected_seq = pkt->seq_number + 1;
 			JANUS_LOG(LOG_VERB, "Probation started with ssrc = %"SCNu32", seq = %"SCNu16" \n", ntohl(rtp->ssrc), pkt->seq_number);
-			g_free(pkt->data);
-			g_free(pkt);
+			janus_audiobridge_participant_release(participant, pkt);
 			return;
 		} else if(participant->probation != 0) {
 			/* Decrease probation */
@@ -4631,8 +5894,7 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 				JANUS_LOG(LOG_VERB, "Probation ended with ssrc = %"SCNu32", seq = %"SCNu16" \n", ntohl(rtp->ssrc), pkt->seq_number);
 			}
 			participant->expected_seq = pkt->seq_number + 1;
-			g_free(pkt->data);
-			g_free(pkt);
+			janus_audiobridge_participant_release(participant, pkt);
 			return;
 		}
 
@@ -4642,6 +5904,8 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 			if(level != -1) {
 				/* Is this silence? */
 				pkt->silence = (level == 127);
+				/* Keep track of a smoothed level too, in case we're ranking speakers */
+				g_atomic_int_set(&participant->mix_level, (g_atomic_int_get(&participant->mix_level)*7 + level)/8);
 				if(participant->room && participant->room->audiolevel_event) {
 					/* We also need to detect who's talking: update our monitoring stuff */
 					int audio_active_packets = participant->room ? participant->room->audio_active_packets : 100;
@@ -4684,7 +5948,7 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 							json_decref(event);
 							janus_mutex_unlock(&participant->room->mutex);
 							/* Also notify event handlers */
-							if(notify_events && gateway->events_is_enabled()) {
+							if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 								json_t *info = json_object();
 								json_object_set_new(info, "audiobridge", json_string(participant->talking ? "talking" : "stopped-talking"));
 								json_object_set_new(info, "room",
@@ -4699,10 +5963,16 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 				}
 			}
 		}
+		if(participant->extmap_id > 0 && g_atomic_int_get(&participant->ranked_out)) {
+			/* Not one of the loudest speakers, so we won't mix this: no need to decode */
+			participant->last_timestamp = pkt->timestamp;
+			participant->expected_seq = pkt->seq_number + 1;
+			janus_audiobridge_participant_release(participant, pkt);
+			return;
+		}
 		if(!g_atomic_int_compare_and_exchange(&participant->decoding, 0, 1)) {
 			/* This means we're cleaning up, so don't try to decode */
-			g_free(pkt->data);
-			g_free(pkt);
+			janus_audiobridge_participant_release(participant, pkt);
 			return;
 		}
 		int plen = 0;
@@ -4711,22 +5981,30 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 			g_atomic_int_set(&participant->decoding, 0);
 			JANUS_LOG(LOG_ERR, "[%s] Ops! got an error accessing the RTP payload\n",
 				participant->codec == JANUS_AUDIOCODEC_OPUS ? "Opus" : "G.711");
-			g_free(pkt->data);
-			g_free(pkt);
+			janus_audiobridge_participant_release(participant, pkt);
 			return;
 		}
+		/* If this is silence or DTX, there's nothing to mix, so no need to decode it: we still
+		 * queue the packet, though, so that the mixer knows this participant is still there */
+		gboolean silent = pkt->silence ||
+			(participant->codec == JANUS_AUDIOCODEC_OPUS && janus_audiobridge_opus_is_dtx(payload, plen));
+		g_atomic_int_set(&participant->silent, silent ? 1 : 0);
 		/* Check sequence number received, verify if it's relevant to the expected one */
 		if(pkt->seq_number == participant->expected_seq) {
 			/* Regular decode */
-			if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
+			if(silent) {
+				/* Silence, skip the decode */
+				pkt->silence = TRUE;
+				pkt->length = 0;
+				participant->decodes_skipped++;
+			} else if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
 				/* Opus */
 				pkt->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, 0);
 			} else if(participant->codec == JANUS_AUDIOCODEC_PCMA || participant->codec == JANUS_AUDIOCODEC_PCMU) {
 				/* G.711 */
 				if(plen != 160) {
 					JANUS_LOG(LOG_WARN, "[G.711] Wrong packet size (expected 160, got %d), skipping audio packet\n", plen);
-					g_free(pkt->data);
-					g_free(pkt);
+					janus_audiobridge_participant_release(participant, pkt);
 					return;
 				}
 				int i = 0;
@@ -4754,17 +6032,13 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 
 			/* Use FEC if sequence lost < DEFAULT_PREBUFFERING (or any custom value) */
 			uint16_t start_lost_seq = participant->expected_seq;
-			if(participant->codec == JANUS_AUDIOCODEC_OPUS && participant->fec && gap < participant->prebuffer_count) {
+			if(!silent && participant->codec == JANUS_AUDIOCODEC_OPUS && participant->fec && gap < participant->prebuffer_count) {
 				uint8_t i=0;
 				for(i=1; i<=gap ; i++) {
 					int32_t output_samples;
-					janus_audiobridge_rtp_relay_packet *lost_pkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-					lost_pkt->data = g_malloc0(BUFFER_SAMPLES*sizeof(opus_int16));
-					lost_pkt->ssrc = 0;
+					janus_audiobridge_rtp_relay_packet *lost_pkt = janus_audiobridge_participant_packet(participant);
 					lost_pkt->timestamp = participant->last_timestamp + (i * OPUS_SAMPLES);
 					lost_pkt->seq_number = start_lost_seq++;
-					lost_pkt->silence = FALSE;
-					lost_pkt->length = 0;
 					if(i == gap) {
 						/* Attempt to decode with in-band FEC from next packet */
 						opus_decoder_ctl(participant->decoder, OPUS_GET_LAST_PACKET_DURATION(&output_samples));
@@ -4776,19 +6050,22 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 					if(lost_pkt->length < 0) {
 						g_atomic_int_set(&participant->decoding, 0);
 						JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error decoding the Opus frame: %d (%s)\n", lost_pkt->length, opus_strerror(lost_pkt->length));
-						g_free(lost_pkt->data);
-						g_free(lost_pkt);
+						janus_audiobridge_participant_release(participant, lost_pkt);
 						return;
 					}
 					/* Enqueue the decoded frame */
 					janus_mutex_lock(&participant->qmutex);
-					/* Insert packets sorting by sequence number */
-					participant->inbuf = g_list_insert_sorted(participant->inbuf, lost_pkt, &janus_audiobridge_rtp_sort);
+					janus_audiobridge_jitter_insert(&participant->inbuf, lost_pkt);
 					janus_mutex_unlock(&participant->qmutex);
 				}
 			}
 			/* Then go with the regular decode (no FEC) */
-			if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
+			if(silent) {
+				/* Silence, skip the decode */
+				pkt->silence = TRUE;
+				pkt->length = 0;
+				participant->decodes_skipped++;
+			} else if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
 				/* Opus */
 				pkt->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, 0);
 			} else if(participant->codec == JANUS_AUDIOCODEC_PCMA || participant->codec == JANUS_AUDIOCODEC_PCMU) {
@@ -4796,8 +6073,7 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 				if(plen != 160) {
 					g_atomic_int_set(&participant->decoding, 0);
 					JANUS_LOG(LOG_WARN, "[G.711] Wrong packet size (expected 160, got %d), skipping audio packet\n", plen);
-					g_free(pkt->data);
-					g_free(pkt);
+					janus_audiobridge_participant_release(participant, pkt);
 					return;
 				}
 				int i = 0;
@@ -4824,8 +6100,7 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 			} else {
 				JANUS_LOG(LOG_WARN, "IN LATE SN seq =  %"SCNu16", expected_seq = %"SCNu16"\n", pkt->seq_number, participant->expected_seq);
 			}
-			g_free(pkt->data);
-			g_free(pkt);
+			janus_audiobridge_participant_release(participant, pkt);
 			return;
 		}
 		g_atomic_int_set(&participant->decoding, 0);
@@ -4835,46 +6110,39 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 			} else {
 				JANUS_LOG(LOG_ERR, "[G.711] Ops! got an error decoding the audio frame\n");
 			}
-			g_free(pkt->data);
-			g_free(pkt);
+			janus_audiobridge_participant_release(participant, pkt);
 			return;
 		}
 		/* Enqueue the decoded frame */
 		janus_mutex_lock(&participant->qmutex);
-		/* Insert packets sorting by sequence number */
-		participant->inbuf = g_list_insert_sorted(participant->inbuf, pkt, &janus_audiobridge_rtp_sort);
+		if(!janus_audiobridge_jitter_insert(&participant->inbuf, pkt)) {
+			janus_mutex_unlock(&participant->qmutex);
+			return;
+		}
+		guint depth = MAX(participant->prebuffer_count, participant->inbuf.depth);
 		if(participant->prebuffering) {
 			/* Still pre-buffering: do we have enough packets now? */
-			if(g_list_length(participant->inbuf) > participant->prebuffer_count) {
+			if(participant->inbuf.count > participant->prebuffer_count) {
 				participant->prebuffering = FALSE;
 				JANUS_LOG(LOG_VERB, "Prebuffering done! Finally adding the user to the mix\n");
 			} else {
-				JANUS_LOG(LOG_VERB, "Still prebuffering (got %d packets), not adding the user to the mix yet\n", g_list_length(participant->inbuf));
+				JANUS_LOG(LOG_VERB, "Still prebuffering (got %d packets), not adding the user to the mix yet\n", participant->inbuf.count);
 			}
 		} else {
 			/* Make sure we're not queueing too many packets: if so, get rid of the older ones */
-			if(g_list_length(participant->inbuf) >= participant->prebuffer_count*2) {
-				gint64 now = janus_get_monotonic_time();
+			gint64 now = janus_get_monotonic_time();
+			if(participant->inbuf.count >= depth*2) {
 				if(now - participant->last_drop > 5*G_USEC_PER_SEC) {
 					JANUS_LOG(LOG_VERB, "Too many packets in queue (%d > %d), removing older ones\n",
-						g_list_length(participant->inbuf), participant->prebuffer_count*2);
+						participant->inbuf.count, depth*2);
 					participant->last_drop = now;
 				}
-				while(g_list_length(participant->inbuf) > participant->prebuffer_count) {
-					/* Remove this packet: it's too old */
-					GList *first = g_list_first(participant->inbuf);
-					janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-					JANUS_LOG(LOG_WARN, "list length = %d, Remove sequence = %d\n",
-						g_list_length(participant->inbuf), pkt->seq_number);
-					participant->inbuf = g_list_delete_link(participant->inbuf, first);
-					first = NULL;
-					if(pkt == NULL)
-						continue;
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-				}
+				janus_audiobridge_jitter_trim(&participant->inbuf, depth);
+			}
+			/* If we haven't had underruns in a while, try making the buffer shallower */
+			if(participant->inbuf.depth > 0 && now - participant->inbuf.last_adapt > 10*G_USEC_PER_SEC) {
+				participant->inbuf.depth--;
+				participant->inbuf.last_adapt = now;
 			}
 		}
 		janus_mutex_unlock(&participant->qmutex);
@@ -4948,7 +6216,7 @@ static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle
 		}
 		json_decref(event);
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("left"));
 			json_object_set_new(info, "room",
@@ -4988,18 +6256,7 @@ static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle
 	participant->audio_dBov_sum = 0;
 	participant->talking = FALSE;
 	/* Get rid of queued packets */
-	while(participant->inbuf) {
-		GList *first = g_list_first(participant->inbuf);
-		janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-		participant->inbuf = g_list_delete_link(participant->inbuf, first);
-		first = NULL;
-		if(pkt == NULL)
-			continue;
-		g_free(pkt->data);
-		pkt->data = NULL;
-		g_free(pkt);
-		pkt = NULL;
-	}
+	janus_audiobridge_jitter_flush(&participant->inbuf);
 	participant->last_drop = 0;
 	janus_mutex_unlock(&participant->qmutex);
 	if(audiobridge != NULL) {
@@ -5246,11 +6503,12 @@ static void *janus_audiobridge_handler(void *data) {
 			if(participant == NULL) {
 				participant = g_malloc0(sizeof(janus_audiobridge_participant));
 				janus_refcount_init(&participant->ref, janus_audiobridge_participant_free);
+				g_atomic_int_set(&participant->mix_level, 127);
 				g_atomic_int_set(&participant->active, 0);
 				participant->codec = codec;
 				participant->prebuffering = TRUE;
 				participant->display = NULL;
-				participant->inbuf = NULL;
+				memset(&participant->inbuf, 0, sizeof(participant->inbuf));
 				participant->outbuf = NULL;
 				participant->last_drop = 0;
 				participant->encoder = NULL;
@@ -5323,6 +6581,7 @@ static void *janus_audiobridge_handler(void *data) {
 				opus_encoder_ctl(participant->encoder, OPUS_SET_INBAND_FEC(participant->fec));
 			}
 			opus_encoder_ctl(participant->encoder, OPUS_SET_COMPLEXITY(participant->opus_complexity));
+			participant->applied_complexity = participant->opus_complexity;
 			if(participant->decoder == NULL) {
 				/* Opus decoder */
 				error = 0;
@@ -5347,8 +6606,10 @@ static void *janus_audiobridge_handler(void *data) {
 				}
 			}
 			participant->reset = FALSE;
-			/* Finally, start the encoding thread if it hasn't already */
-			if(participant->thread == NULL) {
+			/* Finally, start the encoding thread if it hasn't already (or pick an encoding worker) */
+			if(encoding_workers > 0) {
+				participant->encoding_worker = (guint)g_atomic_int_add(&encoding_next, 1) % encoding_workers;
+			} else if(participant->thread == NULL) {
 				GError *error = NULL;
 				char roomtrunc[5], parttrunc[5];
 				g_snprintf(roomtrunc, sizeof(roomtrunc), "%s", audiobridge->room_id_str);
@@ -5427,7 +6688,7 @@ static void *janus_audiobridge_handler(void *data) {
 			json_object_set_new(event, "id", string_ids ? json_string(user_id_str) : json_integer(user_id));
 			json_object_set_new(event, "participants", list);
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("joined"));
 				json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -5471,15 +6732,7 @@ static void *janus_audiobridge_handler(void *data) {
 					janus_mutex_lock(&participant->qmutex);
 					if(prebuffer_count < participant->prebuffer_count) {
 						/* We're switching to a shorter prebuffer, trim the incoming buffer */
-						while(g_list_length(participant->inbuf) > prebuffer_count) {
-							GList *first = g_list_first(participant->inbuf);
-							janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-							participant->inbuf = g_list_delete_link(participant->inbuf, first);
-							if(pkt == NULL)
-								continue;
-							g_free(pkt->data);
-							g_free(pkt);
-						}
+						janus_audiobridge_jitter_trim(&participant->inbuf, prebuffer_count);
 					}
 					participant->prebuffer_count = prebuffer_count;
 					janus_mutex_unlock(&participant->qmutex);
@@ -5498,6 +6751,7 @@ static void *janus_audiobridge_handler(void *data) {
 				participant->opus_complexity = complexity;
 				if(participant->encoder)
 					opus_encoder_ctl(participant->encoder, OPUS_SET_COMPLEXITY(participant->opus_complexity));
+					participant->applied_complexity = participant->opus_complexity;
 			}
 			if(muted || display) {
 				if(muted) {
@@ -5507,19 +6761,7 @@ static void *janus_audiobridge_handler(void *data) {
 					if(participant->muted) {
 						/* Clear the queued packets waiting to be handled */
 						janus_mutex_lock(&participant->qmutex);
-						while(participant->inbuf) {
-							GList *first = g_list_first(participant->inbuf);
-							janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-							participant->inbuf = g_list_delete_link(participant->inbuf, first);
-							first = NULL;
-							if(pkt == NULL)
-								continue;
-							if(pkt->data)
-								g_free(pkt->data);
-							pkt->data = NULL;
-							g_free(pkt);
-							pkt = NULL;
-						}
+						janus_audiobridge_jitter_flush(&participant->inbuf);
 						janus_mutex_unlock(&participant->qmutex);
 					}
 				}
@@ -5600,6 +6842,8 @@ static void *janus_audiobridge_handler(void *data) {
 								JANUS_LOG(LOG_ERR, "Couldn't open an audio recording file for this participant!\n");
 							}
 						}
+						if(participant->arc && participant->room->record_filter)
+							janus_recorder_filter(participant->arc, TRUE);
 					}
 				} else {
 					/* Stop recording (ignore if not recording) */
@@ -5616,7 +6860,7 @@ static void *janus_audiobridge_handler(void *data) {
 			json_object_set_new(event, "audiobridge", json_string("event"));
 			json_object_set_new(event, "result", json_string("ok"));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 				janus_audiobridge_room *audiobridge = participant->room;
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("configured"));
@@ -5839,6 +7083,7 @@ static void *janus_audiobridge_handler(void *data) {
 				}
 				opus_encoder_ctl(new_encoder, OPUS_SET_INBAND_FEC(participant->fec));
 				opus_encoder_ctl(new_encoder, OPUS_SET_COMPLEXITY(participant->opus_complexity));
+				participant->applied_complexity = participant->opus_complexity;
 				/* Opus decoder */
 				error = 0;
 				OpusDecoder *new_decoder = opus_decoder_create(audiobridge->sampling_rate, 1, &error);
@@ -5894,7 +7139,7 @@ static void *janus_audiobridge_handler(void *data) {
 			}
 			json_decref(event);
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("left"));
 				json_object_set_new(info, "room",
@@ -5927,6 +7172,7 @@ static void *janus_audiobridge_handler(void *data) {
 				participant->opus_complexity = complexity;
 				if(participant->encoder)
 					opus_encoder_ctl(participant->encoder, OPUS_SET_COMPLEXITY(participant->opus_complexity));
+					participant->applied_complexity = participant->opus_complexity;
 			}
 			g_hash_table_insert(audiobridge->participants,
 				string_ids ? (gpointer)g_strdup(participant->user_id_str) : (gpointer)janus_uint64_dup(participant->user_id),
@@ -5982,7 +7228,7 @@ static void *janus_audiobridge_handler(void *data) {
 			json_object_set_new(event, "id", string_ids ? json_string(user_id_str) : json_integer(user_id));
 			json_object_set_new(event, "participants", list);
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("joined"));
 				json_object_set_new(info, "room",
@@ -6041,25 +7287,14 @@ static void *janus_audiobridge_handler(void *data) {
 			janus_mutex_lock(&participant->qmutex);
 			g_atomic_int_set(&participant->active, 0);
 			participant->prebuffering = TRUE;
-			while(participant->inbuf) {
-				GList *first = g_list_first(participant->inbuf);
-				janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-				participant->inbuf = g_list_delete_link(participant->inbuf, first);
-				first = NULL;
-				if(pkt == NULL)
-					continue;
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
-				pkt = NULL;
-			}
+			janus_audiobridge_jitter_flush(&participant->inbuf);
 			janus_mutex_unlock(&participant->qmutex);
 			/* Stop recording, if we were */
 			janus_mutex_lock(&participant->rec_mutex);
 			janus_audiobridge_recorder_close(participant);
 			janus_mutex_unlock(&participant->rec_mutex);
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("left"));
 				json_object_set_new(info, "room",
@@ -6236,6 +7471,137 @@ error:
 	return NULL;
 }
 
+/* Energy thresholds for each -dBov value, to estimate the level of participants
+ * that don't send us the audio level extension from their decoded audio */
+static double janus_audiobridge_dbov_energy[128];
+static void janus_audiobridge_dbov_energy_init(void) {
+	/* Each dB is a 10^(1/10) factor in energy, starting from a full scale signal */
+	double energy = 32768.0 * 32768.0;
+	int i = 0;
+	for(i=0; i<128; i++) {
+		janus_audiobridge_dbov_energy[i] = energy;
+		energy /= 1.2589254117941673;
+	}
+}
+static int janus_audiobridge_level_from_samples(opus_int16 *samples, int count) {
+	if(samples == NULL || count <= 0)
+		return 127;
+	double energy = 0;
+	int i = 0;
+	for(i=0; i<count; i++)
+		energy += (double)samples[i] * samples[i];
+	energy /= count;
+	for(i=0; i<127; i++) {
+		if(energy >= janus_audiobridge_dbov_energy[i])
+			break;
+	}
+	return i;
+}
+
+static gint janus_audiobridge_level_compare(gconstpointer a, gconstpointer b) {
+	janus_audiobridge_participant *pa = (janus_audiobridge_participant *)a;
+	janus_audiobridge_participant *pb = (janus_audiobridge_participant *)b;
+	/* Lower values mean louder participants, which we want first */
+	return g_atomic_int_get(&pa->mix_level) - g_atomic_int_get(&pb->mix_level);
+}
+
+/* Pick the participants to mix in this iteration, ranking them if needed */
+static void janus_audiobridge_rank_speakers(janus_audiobridge_room *audiobridge, GList *participants) {
+	GList *candidates = NULL, *ps = participants;
+	while(ps) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
+		p->mixed = (audiobridge->mix_loudest == 0);
+		if(audiobridge->mix_loudest > 0 && p->session && g_atomic_int_get(&p->session->started) &&
+				g_atomic_int_get(&p->active) && !p->muted)
+			candidates = g_list_insert_sorted(candidates, p, janus_audiobridge_level_compare);
+		else
+			g_atomic_int_set(&p->ranked_out, 0);
+		ps = ps->next;
+	}
+	uint n = 0;
+	for(ps = candidates; ps != NULL; ps = ps->next) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
+		p->mixed = (n < audiobridge->mix_loudest);
+		g_atomic_int_set(&p->ranked_out, p->mixed ? 0 : 1);
+		n++;
+	}
+	g_list_free(candidates);
+}
+
+/* Opus encoder shared by all participants in a room that hear the same mix
+ * (that is, that are not contributing any audio) and use the same settings */
+typedef struct janus_audiobridge_shared_encoder {
+	OpusEncoder *encoder;
+	guint32 tick;			/* Mixer iteration we last encoded a frame in */
+	opus_int32 length;		/* Length of the frame we encoded (negative in case of errors) */
+	uint8_t payload[1500-12];
+} janus_audiobridge_shared_encoder;
+
+static janus_audiobridge_shared_encoder *janus_audiobridge_shared_encoder_create(uint32_t sampling_rate, gboolean fec, int complexity) {
+	int error = 0;
+	OpusEncoder *encoder = opus_encoder_create(sampling_rate, 1, OPUS_APPLICATION_VOIP, &error);
+	if(error != OPUS_OK) {
+		JANUS_LOG(LOG_ERR, "Error creating shared Opus encoder: %d (%s)\n", error, opus_strerror(error));
+		return NULL;
+	}
+	if(sampling_rate == 8000) {
+		opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_NARROWBAND));
+	} else if(sampling_rate == 12000) {
+		opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_MEDIUMBAND));
+	} else if(sampling_rate == 24000) {
+		opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_SUPERWIDEBAND));
+	} else if(sampling_rate == 48000) {
+		opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND));
+	} else {
+		opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_WIDEBAND));
+	}
+	opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(fec));
+	opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity));
+	janus_audiobridge_shared_encoder *se = g_malloc0(sizeof(janus_audiobridge_shared_encoder));
+	se->encoder = encoder;
+	return se;
+}
+
+static void janus_audiobridge_shared_encoder_free(janus_audiobridge_shared_encoder *se) {
+	if(se == NULL)
+		return;
+	opus_encoder_destroy(se->encoder);
+	g_free(se);
+}
+
+/* Helper to keep track of how late the mixer ticks are and, if adaptive quality is
+ * enabled, to lower the quality when they're too late (and restore it when they aren't
+ * anymore): level 1 lowers the complexity of all Opus encoders, while level 2 also
+ * has participants hearing the whole mix share encoders, even if shared_encoding is off */
+static void janus_audiobridge_adapt_quality(janus_audiobridge_room *audiobridge, gint64 lateness, gint64 *last_change) {
+	int b = 0;
+	while(b < JANUS_AUDIOBRIDGE_LATENESS_BUCKETS-1 && lateness >= janus_audiobridge_lateness_bounds[b]*1000)
+		b++;
+	g_atomic_int_inc(&audiobridge->lateness_histogram[b]);
+	int smoothed = (g_atomic_int_get(&audiobridge->tick_lateness)*15 + lateness)/16;
+	g_atomic_int_set(&audiobridge->tick_lateness, smoothed);
+	if(!audiobridge->adaptive_quality)
+		return;
+	gint64 now = janus_get_monotonic_time();
+	int level = g_atomic_int_get(&audiobridge->degradation);
+	gint64 threshold = (gint64)audiobridge->adaptive_threshold*1000;
+	if(smoothed > threshold && level < 2 && now - *last_change >= 2*G_USEC_PER_SEC) {
+		/* We're falling behind, lower the quality */
+		level++;
+		JANUS_LOG(LOG_WARN, "[%s] Mixer is late (%d us), lowering the quality (level %d)\n",
+			audiobridge->room_id_str, smoothed, level);
+	} else if(smoothed < threshold/2 && level > 0 && now - *last_change >= 10*G_USEC_PER_SEC) {
+		/* We caught up, try restoring the quality */
+		level--;
+		JANUS_LOG(LOG_INFO, "[%s] Mixer is on time again (%d us), restoring the quality (level %d)\n",
+			audiobridge->room_id_str, smoothed, level);
+	} else {
+		return;
+	}
+	g_atomic_int_set(&audiobridge->degradation, level);
+	*last_change = now;
+}
+
 /* Thread to mix the contributions from all participants */
 static void *janus_audiobridge_mixer_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Audio bridge thread starting...\n");
@@ -6282,26 +7648,20 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 				JANUS_LOG(LOG_ERR, "Error writing WAV header...\n");
 			}
 			fflush(audiobridge->recording);
+			/* Samples will be written by the mixer, possibly asynchronously */
+			audiobridge->recording_writer = janus_recorder_stream_new(audiobridge->recording, filename);
 			audiobridge->record_lastupdate = janus_get_monotonic_time();
 		}
 	}
 
 	/* Buffer (we allocate assuming 48kHz, although we'll likely use less than that) */
 	int samples = audiobridge->sampling_rate/50;
-	opus_int32 buffer[OPUS_SAMPLES], sumBuffer[OPUS_SAMPLES];
+	opus_int32 buffer[OPUS_SAMPLES], localBuffer[OPUS_SAMPLES], *localMix = buffer;
 	opus_int16 outBuffer[OPUS_SAMPLES], resampled[OPUS_SAMPLES], *curBuffer = NULL;
 	memset(buffer, 0, OPUS_SAMPLES*4);
-	memset(sumBuffer, 0, OPUS_SAMPLES*4);
 	memset(outBuffer, 0, OPUS_SAMPLES*2);
 	memset(resampled, 0, OPUS_SAMPLES*2);
 
-	/* Base RTP packet, in case there are forwarders involved */
-	unsigned char *rtpbuffer = g_malloc0(1500);
-	janus_rtp_header *rtph = (janus_rtp_header *)rtpbuffer;
-	rtph->version = 2;
-	/* In case we need G.711 forwarders */
-	uint8_t rtpalaw[12+G711_SAMPLES], rtpulaw[12+G711_SAMPLES];
-
 	/* Timer */
 	struct timeval now, before;
 	gettimeofday(&before, NULL);
@@ -6312,12 +7672,20 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 	/* RTP */
 	gint16 seq = 0;
 	gint32 ts = 0;
-	/* SRTP buffer, if needed */
-	char sbuf[1500];
+
+	/* Shared encoders, indexed by FEC and complexity settings, if enabled (or if we degraded the quality) */
+	GHashTable *shared_encoders = NULL;
+	int degradation = 0;
+	gint64 last_change = 0;
+	guint32 tick = 0;
+	if(audiobridge->shared_encoding) {
+		shared_encoders = g_hash_table_new_full(NULL, NULL, NULL,
+			(GDestroyNotify)janus_audiobridge_shared_encoder_free);
+	}
 
 	/* Loop */
 	int i=0;
-	int count = 0, rf_count = 0, pf_count = 0, prev_count = 0;
+	int count = 0, rf_count = 0, pf_count = 0, lk_count = 0, prev_count = 0;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&audiobridge->destroyed)) {
 		/* See if it's time to prepare a frame */
 		gettimeofday(&now, NULL);
@@ -6332,6 +7700,16 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 			g_usleep(5000);
 			continue;
 		}
+		/* If we're more than a full frame behind, we're late */
+		if(passed >= 40000 && prev_count > 0)
+			g_atomic_int_inc(&audiobridge->late_ticks);
+		if(prev_count > 0)
+			janus_audiobridge_adapt_quality(audiobridge, passed > 20000 ? passed - 20000 : 0, &last_change);
+		degradation = g_atomic_int_get(&audiobridge->degradation);
+		if(shared_encoders == NULL && degradation >= 2) {
+			shared_encoders = g_hash_table_new_full(NULL, NULL, NULL,
+				(GDestroyNotify)janus_audiobridge_shared_encoder_free);
+		}
 		/* Update the reference time */
 		before.tv_usec += 20000;
 		if(before.tv_usec > 1000000) {
@@ -6359,6 +7737,7 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 		/* Update RTP header information */
 		seq++;
 		ts += OPUS_SAMPLES;
+		tick++;
 		/* Mix all contributions */
 		GList *participants_list = g_hash_table_get_values(audiobridge->participants);
 		/* Add a reference to all these participants, in case some leave while we're mixing */
@@ -6369,39 +7748,49 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 			ps = ps->next;
 		}
 		janus_mutex_unlock_nodebug(&audiobridge->mutex);
+		janus_audiobridge_rank_speakers(audiobridge, participants_list);
 		for(i=0; i<samples; i++)
 			buffer[i] = 0;
 		ps = participants_list;
 		while(ps) {
 			janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
 			janus_mutex_lock(&p->qmutex);
-			if(!p->session || !g_atomic_int_get(&p->session->started) || !g_atomic_int_get(&p->active) || p->muted || p->prebuffering || !p->inbuf) {
+			if(!p->session || !g_atomic_int_get(&p->session->started) || !g_atomic_int_get(&p->active) || p->muted || p->prebuffering) {
+				janus_mutex_unlock(&p->qmutex);
+				ps = ps->next;
+				continue;
+			}
+			if(p->inbuf.count == 0) {
+				/* Nothing to play out, check if the buffer needs to be deeper (unless the
+				 * participant is not decoded, or is silent and so may be using DTX) */
+				if(!g_atomic_int_get(&p->ranked_out) && !g_atomic_int_get(&p->silent))
+					janus_audiobridge_jitter_underrun(&p->inbuf);
 				janus_mutex_unlock(&p->qmutex);
 				ps = ps->next;
 				continue;
 			}
-			GList *peek = g_list_first(p->inbuf);
-			janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)(peek ? peek->data : NULL);
-			if(pkt != NULL && !pkt->silence) {
+			janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_jitter_peek(&p->inbuf);
+			if(pkt != NULL && audiobridge->mix_loudest > 0 && p->extmap_id == 0) {
+				/* No audio level extension, so estimate the level from the decoded audio */
+				int level = pkt->silence ? 127 : janus_audiobridge_level_from_samples((opus_int16 *)pkt->data,
+					p->codec == JANUS_AUDIOCODEC_OPUS ? pkt->length : 160);
+				g_atomic_int_set(&p->mix_level, (g_atomic_int_get(&p->mix_level)*7 + level)/8);
+			}
+			if(pkt != NULL && !pkt->silence && p->mixed) {
 				if(p->codec != JANUS_AUDIOCODEC_OPUS && audiobridge->sampling_rate != 8000) {
 					/* Upsample this to whatever the mixer needs */
-					pkt->length = janus_audiobridge_resample((opus_int16 *)pkt->data, 160, 8000, resampled, audiobridge->sampling_rate);
+					pkt->length = janus_audiobridge_resample(audiobridge, &p->upsampler,
+						(opus_int16 *)pkt->data, 160, 8000, resampled, audiobridge->sampling_rate);
 					if(pkt->length == 0) {
 						JANUS_LOG(LOG_WARN, "[G.711] Error upsampling to %d, skipping audio packet\n", audiobridge->sampling_rate);
 						janus_mutex_unlock(&p->qmutex);
 						ps = ps->next;
 						continue;
 					}
-					memcpy((opus_int16 *)pkt->data, resampled, pkt->length);
+					memcpy((opus_int16 *)pkt->data, resampled, pkt->length*sizeof(opus_int16));
 				}
 				curBuffer = (opus_int16 *)pkt->data;
-				for(i=0; i<samples; i++) {
-					if(p->volume_gain == 100) {
-						buffer[i] += curBuffer[i];
-					} else {
-						buffer[i] += (curBuffer[i]*p->volume_gain)/100;
-					}
-				}
+				mix_kernels->accumulate(buffer, curBuffer, samples, p->volume_gain);
 			}
 			janus_mutex_unlock(&p->qmutex);
 			ps = ps->next;
@@ -6432,7 +7821,7 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 						janus_audiobridge_notify_participants(p, event, TRUE);
 						json_decref(event);
 						/* Also notify event handlers */
-						if(notify_events && gateway->events_is_enabled()) {
+						if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 							json_t *info = json_object();
 							json_object_set_new(info, "event", json_string("announcement-stopped"));
 							json_object_set_new(info, "room",
@@ -6461,7 +7850,7 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 					json_decref(event);
 					janus_mutex_unlock_nodebug(&audiobridge->mutex);
 					/* Also notify event handlers */
-					if(notify_events && gateway->events_is_enabled()) {
+					if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 						json_t *info = json_object();
 						json_object_set_new(info, "event", json_string("announcement-started"));
 						json_object_set_new(info, "room",
@@ -6470,40 +7859,59 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 						gateway->notify_event(&janus_audiobridge_plugin, NULL, info);
 					}
 				}
-				for(i=0; i<samples; i++) {
-					if(p->volume_gain == 100) {
-						buffer[i] += resampled[i];
-					} else {
-						buffer[i] += (resampled[i]*p->volume_gain)/100;
-					}
-				}
+				mix_kernels->accumulate(buffer, resampled, samples, p->volume_gain);
 				ps = ps->next;
 			}
 		}
 #endif
+		/* If we're linked to the same room on peer nodes, add their mixes too: we keep
+		 * a copy of the local mix first, as that's what we forward to those nodes */
+		localMix = buffer;
+		lk_count = 0;
+		janus_mutex_lock(&audiobridge->rtp_mutex);
+		if(g_hash_table_size(audiobridge->links) > 0) {
+			memcpy(localBuffer, buffer, samples*sizeof(opus_int32));
+			localMix = localBuffer;
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, audiobridge->links);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_audiobridge_link *link = (janus_audiobridge_link *)value;
+				janus_mutex_lock(&link->mutex);
+				janus_audiobridge_rtp_relay_packet *pkt = NULL;
+				if(!link->prebuffering) {
+					pkt = janus_audiobridge_jitter_pop(&link->jitter);
+					if(pkt == NULL) {
+						/* Nothing to play out, buffer again */
+						link->prebuffering = TRUE;
+						link->jitter.underruns++;
+					}
+				}
+				if(pkt != NULL && pkt->length >= samples) {
+					mix_kernels->accumulate(buffer, (opus_int16 *)pkt->data, samples, 100);
+					lk_count++;
+				}
+				janus_audiobridge_jitter_release(&link->jitter, pkt);
+				janus_mutex_unlock(&link->mutex);
+			}
+		}
+		janus_mutex_unlock(&audiobridge->rtp_mutex);
 		/* Are we recording the mix? (only do it if there's someone in, though...) */
 		if(audiobridge->recording != NULL && g_list_length(participants_list) > 0) {
-			for(i=0; i<samples; i++) {
-				/* FIXME Smoothen/Normalize instead of truncating? */
-				outBuffer[i] = buffer[i];
-			}
-			fwrite(outBuffer, sizeof(opus_int16), samples, audiobridge->recording);
+			/* FIXME Smoothen/Normalize instead of saturating? */
+			mix_kernels->subtract(outBuffer, buffer, NULL, samples, 100);
+			janus_recorder_stream_write(audiobridge->recording_writer, outBuffer, samples*sizeof(opus_int16));
 			/* Every 5 seconds we update the wav header */
 			gint64 now = janus_get_monotonic_time();
 			if(now - audiobridge->record_lastupdate >= 5*G_USEC_PER_SEC) {
 				audiobridge->record_lastupdate = now;
-				/* Update the length in the header */
-				fseek(audiobridge->recording, 0, SEEK_END);
-				long int size = ftell(audiobridge->recording);
+				/* Update the length in the header (the writer knows the size, including what's still queued) */
+				uint32_t size = janus_recorder_stream_get_size(audiobridge->recording_writer);
 				if(size >= 8) {
 					size -= 8;
-					fseek(audiobridge->recording, 4, SEEK_SET);
-					fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
+					janus_recorder_stream_write_at(audiobridge->recording_writer, 4, &size, sizeof(uint32_t));
 					size += 8;
-					fseek(audiobridge->recording, 40, SEEK_SET);
-					fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-					fflush(audiobridge->recording);
-					fseek(audiobridge->recording, 0, SEEK_END);
+					janus_recorder_stream_write_at(audiobridge->recording_writer, 40, &size, sizeof(uint32_t));
 				}
 			}
 		}
@@ -6518,30 +7926,57 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 			}
 			janus_audiobridge_rtp_relay_packet *pkt = NULL;
 			janus_mutex_lock(&p->qmutex);
-			if(g_atomic_int_get(&p->active) && !p->muted && !p->prebuffering && p->inbuf) {
-				GList *first = g_list_first(p->inbuf);
-				pkt = (janus_audiobridge_rtp_relay_packet *)(first ? first->data : NULL);
-				p->inbuf = g_list_delete_link(p->inbuf, first);
-			}
+			if(g_atomic_int_get(&p->active) && !p->muted && !p->prebuffering)
+				pkt = janus_audiobridge_jitter_pop(&p->inbuf);
 			janus_mutex_unlock(&p->qmutex);
-			curBuffer = (opus_int16 *)((pkt && pkt->length && !pkt->silence) ? pkt->data : NULL);
-			for(i=0; i<samples; i++) {
-				if(p->volume_gain == 100)
-					sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]) : 0);
-				else
-					sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]*p->volume_gain)/100 : 0);
-			}
-			for(i=0; i<samples; i++)
-				/* FIXME Smoothen/Normalize instead of truncating? */
-				outBuffer[i] = sumBuffer[i];
+			curBuffer = (opus_int16 *)((pkt && pkt->length && !pkt->silence && p->mixed) ? pkt->data : NULL);
+			/* FIXME Smoothen/Normalize instead of saturating? */
+			mix_kernels->subtract(outBuffer, buffer, curBuffer, samples, p->volume_gain);
+			/* If this participant is hearing the whole mix, check if we can use a shared encoder */
+			janus_audiobridge_shared_encoder *se = NULL;
+			g_atomic_int_set(&p->degraded, degradation > 0 ? 1 : 0);
+			if(shared_encoders != NULL && (audiobridge->shared_encoding || degradation >= 2) &&
+					curBuffer == NULL && p->codec == JANUS_AUDIOCODEC_OPUS) {
+				int complexity = degradation > 0 ?
+					MIN(p->opus_complexity, JANUS_AUDIOBRIDGE_DEGRADED_COMPLEXITY) : p->opus_complexity;
+				gpointer key = GUINT_TO_POINTER(((p->fec ? 1 : 0) << 8) + (complexity & 0xFF) + 1);
+				se = g_hash_table_lookup(shared_encoders, key);
+				if(se == NULL) {
+					se = janus_audiobridge_shared_encoder_create(audiobridge->sampling_rate, p->fec, complexity);
+					if(se != NULL)
+						g_hash_table_insert(shared_encoders, key, se);
+				}
+				if(se != NULL && se->tick != tick) {
+					/* First participant needing this in this iteration, encode the mix */
+					se->tick = tick;
+					se->length = opus_encode(se->encoder, outBuffer, samples, se->payload, sizeof(se->payload));
+					if(se->length < 0) {
+						JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the shared Opus frame: %d (%s)\n",
+							se->length, opus_strerror(se->length));
+					}
+				}
+				if(se != NULL && se->length < 0)
+					se = NULL;
+			}
 			/* Enqueue this mixed frame for encoding in the participant thread */
 			janus_audiobridge_rtp_relay_packet *mixedpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-			mixedpkt->data = g_malloc(samples*2);
-			if(p->codec != JANUS_AUDIOCODEC_OPUS && audiobridge->sampling_rate != 8000) {
+			mixedpkt->data = g_malloc(se ? se->length : samples*2);
+			mixedpkt->length = samples;	/* We set the number of samples here, not the data length */
+			mixedpkt->encoded = (se != NULL);
+			if(se != NULL) {
+				/* Already encoded, so the participant thread will only need to send it */
+				memcpy(mixedpkt->data, se->payload, se->length);
+				mixedpkt->length = se->length;
+			} else if(p->codec != JANUS_AUDIOCODEC_OPUS && audiobridge->sampling_rate != 8000) {
 				/* Downsample this from whatever the mixer uses */
-				i = janus_audiobridge_resample(outBuffer, samples, audiobridge->sampling_rate, (int16_t *)mixedpkt->data, 8000);
+				i = janus_audiobridge_resample(audiobridge, &p->downsampler,
+					outBuffer, samples, audiobridge->sampling_rate, (int16_t *)mixedpkt->data, 8000);
 				if(i == 0) {
 					JANUS_LOG(LOG_WARN, "[G.711] Error downsampling from %d, skipping audio packet\n", audiobridge->sampling_rate);
+					g_free(mixedpkt->data);
+					g_free(mixedpkt);
+					if(pkt)
+						janus_audiobridge_participant_release(p, pkt);
 					janus_refcount_decrease(&p->ref);
 					ps = ps->next;
 					continue;
@@ -6550,132 +7985,44 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 				/* Just copy */
 				memcpy(mixedpkt->data, outBuffer, samples*2);
 			}
-			mixedpkt->length = samples;	/* We set the number of samples here, not the data length */
 			mixedpkt->timestamp = ts;
 			mixedpkt->seq_number = seq;
 			mixedpkt->ssrc = audiobridge->room_ssrc;
 			mixedpkt->silence = FALSE;
-			g_async_queue_push(p->outbuf, mixedpkt);
-			if(pkt) {
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
-				pkt = NULL;
+			if(encoding_workers > 0) {
+				/* Let the encoding worker of this participant take care of it within the next tick */
+				janus_audiobridge_encoding_job *job = g_malloc(sizeof(janus_audiobridge_encoding_job));
+				janus_refcount_increase(&audiobridge->ref);
+				janus_refcount_increase(&p->ref);
+				job->room = audiobridge;
+				job->participant = p;
+				job->packet = mixedpkt;
+				job->deadline = janus_get_monotonic_time() + 20000;
+				g_async_queue_push_sorted(encoding_queues[p->encoding_worker % encoding_workers],
+					job, janus_audiobridge_encoding_job_compare, NULL);
+			} else {
+				g_async_queue_push(p->outbuf, mixedpkt);
 			}
+			if(pkt)
+				janus_audiobridge_participant_release(p, pkt);
 			janus_refcount_decrease(&p->ref);
 			ps = ps->next;
 		}
 		g_list_free(participants_list);
-		/* Forward the mixed packet as RTP to any RTP forwarder that may be listening */
+		/* Forward the mixed packet as RTP to any RTP forwarder that may be listening:
+		 * forwarders to peer nodes only get the mix of our own participants */
 		janus_mutex_lock(&audiobridge->rtp_mutex);
-		if(g_hash_table_size(audiobridge->rtp_forwarders) > 0 && audiobridge->rtp_encoder) {
-			/* If the room is empty, check if there's any RTP forwarder with an "always on" option */
-			gboolean go_on = FALSE;
-			if(count == 0 && pf_count == 0) {
-				GHashTableIter iter;
-				gpointer value;
-				g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
-				while(g_hash_table_iter_next(&iter, NULL, &value)) {
-					janus_audiobridge_rtp_forwarder *forwarder = (janus_audiobridge_rtp_forwarder *)value;
-					if(forwarder->always_on) {
-						go_on = TRUE;
-						break;
-					}
-				}
-			} else {
-				go_on = TRUE;
-			}
-			if(go_on) {
-				/* Send the mixed frame to everybody */
-				for(i=0; i<samples; i++)
-					outBuffer[i] = buffer[i];
-				GHashTableIter iter;
-				gpointer key, value;
-				g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
-				opus_int32 length = 0;
-				gboolean have_opus = FALSE, have_alaw = FALSE, have_ulaw = FALSE;
-				while(audiobridge->rtp_udp_sock > 0 && g_hash_table_iter_next(&iter, &key, &value)) {
-					guint32 stream_id = GPOINTER_TO_UINT(key);
-					janus_audiobridge_rtp_forwarder *forwarder = (janus_audiobridge_rtp_forwarder *)value;
-					if(count == 0 && pf_count == 0 && !forwarder->always_on)
-						continue;
-					if(forwarder->codec == JANUS_AUDIOCODEC_OPUS && !have_opus) {
-						/* This is an Opus forwarder and we don't have a version for that yet */
-						length = opus_encode(audiobridge->rtp_encoder, outBuffer, samples, rtpbuffer+12, 1500-12);
-						if(length < 0) {
-							JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", length, opus_strerror(length));
-							continue;
-						}
-						have_opus = TRUE;
-						rtph = (janus_rtp_header *)rtpbuffer;
-					} else if((forwarder->codec == JANUS_AUDIOCODEC_PCMA && !have_alaw) ||
-							(forwarder->codec == JANUS_AUDIOCODEC_PCMU && !have_ulaw)) {
-						/* This is a G.711 forwarder and we don't have a version for that yet */
-						if(audiobridge->sampling_rate != 8000) {
-							/* Downsample this from whatever the mixer uses */
-							i = janus_audiobridge_resample(outBuffer, samples, audiobridge->sampling_rate, resampled, 8000);
-							if(i == 0) {
-								JANUS_LOG(LOG_WARN, "[G.711] Error downsampling from %d, skipping audio packet\n", audiobridge->sampling_rate);
-								continue;
-							}
-						} else {
-							/* Just copy */
-							memcpy(resampled, outBuffer, samples*2);
-						}
-						int i = 0;
-						if(forwarder->codec == JANUS_AUDIOCODEC_PCMA) {
-							for(i=0; i<160; i++)
-								rtpalaw[12+i] = janus_audiobridge_g711_alaw_encode(resampled[i]);
-							have_alaw = TRUE;
-							rtph = (janus_rtp_header *)rtpalaw;
-						} else {
-							for(i=0; i<160; i++)
-								rtpulaw[12+i] = janus_audiobridge_g711_ulaw_encode(resampled[i]);
-							have_ulaw = TRUE;
-							rtph = (janus_rtp_header *)rtpulaw;
-						}
-						rtph->version = 2;
-						length = 160;
-					}
-					/* Update header */
-					rtph->type = forwarder->payload_type;
-					rtph->ssrc = htonl(forwarder->ssrc ? forwarder->ssrc : stream_id);
-					forwarder->seq_number++;
-					rtph->seq_number = htons(forwarder->seq_number);
-					forwarder->timestamp += (forwarder->codec == JANUS_AUDIOCODEC_OPUS ? OPUS_SAMPLES : G711_SAMPLES);
-					rtph->timestamp = htonl(forwarder->timestamp);
-					/* Check if this packet needs to be encrypted */
-					char *payload = (char *)rtph;
-					int plen = length+12;
-					if(forwarder->is_srtp) {
-						memcpy(sbuf, payload, plen);
-						int protected = plen;
-						int res = srtp_protect(forwarder->srtp_ctx, sbuf, &protected);
-						if(res != srtp_err_status_ok) {
-							janus_rtp_header *header = (janus_rtp_header *)sbuf;
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "Error encrypting RTP packet for room %s... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
-								audiobridge->room_id_str, janus_srtp_error_str(res), plen, protected, timestamp, seq);
-						} else {
-							payload = (char *)&sbuf;
-							plen = protected;
-						}
-					}
-					/* No encryption, send the RTP packet as it is */
-					struct sockaddr *address = (forwarder->serv_addr.sin_family == AF_INET ?
-						(struct sockaddr *)&forwarder->serv_addr : (struct sockaddr *)&forwarder->serv_addr6);
-					size_t addrlen = (forwarder->serv_addr.sin_family == AF_INET ? sizeof(forwarder->serv_addr) : sizeof(forwarder->serv_addr6));
-					if(sendto(audiobridge->rtp_udp_sock, payload, plen, 0, address, addrlen) < 0) {
-						JANUS_LOG(LOG_HUGE, "Error forwarding mixed RTP packet for room %s... %s (len=%d)...\n",
-							audiobridge->room_id_str, strerror(errno), plen);
-					}
-				}
-			}
+		if(g_hash_table_size(audiobridge->rtp_forwarders) > 0 && audiobridge->rtp_udp_sock > 0) {
+			gboolean empty = (count == 0 && pf_count == 0);
+			janus_audiobridge_rtp_forward_mix(audiobridge, buffer, samples, FALSE, empty && lk_count == 0);
+			janus_audiobridge_rtp_forward_mix(audiobridge, localMix, samples, TRUE, empty);
 		}
 		janus_mutex_unlock(&audiobridge->rtp_mutex);
 	}
 	if(audiobridge->recording) {
+		/* Wait for the writer to be done with the mix, if needed */
+		janus_recorder_stream_close(audiobridge->recording_writer);
+		audiobridge->recording_writer = NULL;
 		/* Update the length in the header */
 		fseek(audiobridge->recording, 0, SEEK_END);
 		long int size = ftell(audiobridge->recording);
@@ -6710,7 +8057,7 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 			}
 		}
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_audiobridge_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("recordingdone"));
 			json_object_set_new(info, "room",
@@ -6719,7 +8066,8 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 			gateway->notify_event(&janus_audiobridge_plugin, NULL, info);
 		}
 	}
-	g_free(rtpbuffer);
+	if(shared_encoders != NULL)
+		g_hash_table_destroy(shared_encoders);
 	JANUS_LOG(LOG_VERB, "Leaving mixer thread for room %s (%s)...\n", audiobridge->room_id_str, audiobridge->room_name);
 
 	janus_refcount_decrease(&audiobridge->ref);
@@ -6727,6 +8075,84 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 	return NULL;
 }
 
+/* Encode (if needed) and send a mixed frame to a participant: outpkt is the buffer to use */
+static void janus_audiobridge_participant_send(janus_audiobridge_participant *participant,
+		janus_audiobridge_rtp_relay_packet *mixedpkt, janus_audiobridge_rtp_relay_packet *outpkt) {
+	uint8_t *payload = (uint8_t *)outpkt->data;
+	if(g_atomic_int_get(&participant->active) && (participant->codec == JANUS_AUDIOCODEC_PCMA ||
+			participant->codec == JANUS_AUDIOCODEC_PCMU) && g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
+		/* Encode using G.711 */
+		if(mixedpkt->length != 320) {
+			/* TODO Resample */
+		}
+		int i = 0;
+		opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
+		if(participant->codec == JANUS_AUDIOCODEC_PCMA) {
+			/* A-law */
+			for(i=0; i<160; i++)
+				*(payload+12+i) = janus_audiobridge_g711_alaw_encode(outBuffer[i]);
+		} else {
+			/* Mu-Law */
+			for(i=0; i<160; i++)
+				*(payload+12+i) = janus_audiobridge_g711_ulaw_encode(outBuffer[i]);
+		}
+		g_atomic_int_set(&participant->encoding, 0);
+		outpkt->length = 172;	/* Take the RTP header into consideration */
+		/* Update RTP header */
+		outpkt->data->version = 2;
+		outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
+		outpkt->data->seq_number = htons(mixedpkt->seq_number);
+		outpkt->data->timestamp = htonl(mixedpkt->timestamp/6);
+		outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The Janus core will fix this anyway */
+		/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
+		outpkt->ssrc = mixedpkt->ssrc;
+		outpkt->timestamp = mixedpkt->timestamp/6;
+		outpkt->seq_number = mixedpkt->seq_number;
+		janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
+	} else if(g_atomic_int_get(&participant->active) && mixedpkt->encoded) {
+		/* The mixer already encoded this using a shared encoder, just send it */
+		memcpy(payload+12, mixedpkt->data, mixedpkt->length);
+		outpkt->length = mixedpkt->length + 12;
+		outpkt->data->version = 2;
+		outpkt->data->markerbit = 0;
+		outpkt->data->seq_number = htons(mixedpkt->seq_number);
+		outpkt->data->timestamp = htonl(mixedpkt->timestamp);
+		outpkt->data->ssrc = htonl(mixedpkt->ssrc);
+		outpkt->ssrc = mixedpkt->ssrc;
+		outpkt->timestamp = mixedpkt->timestamp;
+		outpkt->seq_number = mixedpkt->seq_number;
+		janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
+	} else if(g_atomic_int_get(&participant->active) && participant->encoder &&
+			g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
+		/* Encode raw frame to Opus, first checking if the mixer wants the quality lowered */
+		int complexity = g_atomic_int_get(&participant->degraded) ?
+			MIN(participant->opus_complexity, JANUS_AUDIOBRIDGE_DEGRADED_COMPLEXITY) : participant->opus_complexity;
+		if(complexity != participant->applied_complexity) {
+			opus_encoder_ctl(participant->encoder, OPUS_SET_COMPLEXITY(complexity));
+			participant->applied_complexity = complexity;
+		}
+		opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
+		outpkt->length = opus_encode(participant->encoder, outBuffer, mixedpkt->length, payload+12, 1500-12);
+		g_atomic_int_set(&participant->encoding, 0);
+		if(outpkt->length < 0) {
+			JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", outpkt->length, opus_strerror(outpkt->length));
+		} else {
+			outpkt->length += 12;	/* Take the RTP header into consideration */
+			/* Update RTP header */
+			outpkt->data->version = 2;
+			outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
+			outpkt->data->seq_number = htons(mixedpkt->seq_number);
+			outpkt->data->timestamp = htonl(mixedpkt->timestamp);
+			outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The Janus core will fix this anyway */
+			/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
+			outpkt->ssrc = mixedpkt->ssrc;
+			outpkt->timestamp = mixedpkt->timestamp;
+			outpkt->seq_number = mixedpkt->seq_number;
+			janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
+		}
+	}
+}
+
 /* Thread to encode a mixed frame and send it to a specific participant */
 static void *janus_audiobridge_participant_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "AudioBridge Participant thread starting...\n");
@@ -6748,7 +8174,6 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	outpkt->seq_number = 0;
 	outpkt->length = 0;
 	outpkt->silence = FALSE;
-	uint8_t *payload = (uint8_t *)outpkt->data;
 
 	janus_audiobridge_rtp_relay_packet *mixedpkt = NULL;
 
@@ -6756,59 +8181,7 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	while(!g_atomic_int_get(&stopping) && g_atomic_int_get(&session->destroyed) == 0) {
 		mixedpkt = g_async_queue_timeout_pop(participant->outbuf, 100000);
 		if(mixedpkt != NULL && g_atomic_int_get(&session->destroyed) == 0 && g_atomic_int_get(&session->started)) {
-			if(g_atomic_int_get(&participant->active) && (participant->codec == JANUS_AUDIOCODEC_PCMA ||
-					participant->codec == JANUS_AUDIOCODEC_PCMU) && g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
-				/* Encode using G.711 */
-				if(mixedpkt->length != 320) {
-					/* TODO Resample */
-				}
-				int i = 0;
-				opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
-				if(participant->codec == JANUS_AUDIOCODEC_PCMA) {
-					/* A-law */
-					for(i=0; i<160; i++)
-						*(payload+12+i) = janus_audiobridge_g711_alaw_encode(outBuffer[i]);
-				} else {
-					/* Mu-Law */
-					for(i=0; i<160; i++)
-						*(payload+12+i) = janus_audiobridge_g711_ulaw_encode(outBuffer[i]);
-				}
-				g_atomic_int_set(&participant->encoding, 0);
-				outpkt->length = 172;	/* Take the RTP header into consideration */
-				/* Update RTP header */
-				outpkt->data->version = 2;
-				outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
-				outpkt->data->seq_number = htons(mixedpkt->seq_number);
-				outpkt->data->timestamp = htonl(mixedpkt->timestamp/6);
-				outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The Janus core will fix this anyway */
-				/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
-				outpkt->ssrc = mixedpkt->ssrc;
-				outpkt->timestamp = mixedpkt->timestamp/6;
-				outpkt->seq_number = mixedpkt->seq_number;
-				janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
-			} else if(g_atomic_int_get(&participant->active) && participant->encoder &&
-					g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
-				/* Encode raw frame to Opus */
-				opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
-				outpkt->length = opus_encode(participant->encoder, outBuffer, mixedpkt->length, payload+12, 1500-12);
-				g_atomic_int_set(&participant->encoding, 0);
-				if(outpkt->length < 0) {
-					JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", outpkt->length, opus_strerror(outpkt->length));
-				} else {
-					outpkt->length += 12;	/* Take the RTP header into consideration */
-					/* Update RTP header */
-					outpkt->data->version = 2;
-					outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
-					outpkt->data->seq_number = htons(mixedpkt->seq_number);
-					outpkt->data->timestamp = htonl(mixedpkt->timestamp);
-					outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The Janus core will fix this anyway */
-					/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
-					outpkt->ssrc = mixedpkt->ssrc;
-					outpkt->timestamp = mixedpkt->timestamp;
-					outpkt->seq_number = mixedpkt->seq_number;
-					janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
-				}
-			}
+			janus_audiobridge_participant_send(participant, mixedpkt, outpkt);
 			g_free(mixedpkt->data);
 			g_free(mixedpkt);
 		}
@@ -6824,6 +8197,36 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	return NULL;
 }
 
+/* Worker encoding and sending mixed frames for the participants assigned to it */
+static void *janus_audiobridge_encoding_thread(void *data) {
+	GAsyncQueue *queue = (GAsyncQueue *)data;
+	JANUS_LOG(LOG_VERB, "Joining AudioBridge encoding thread\n");
+	/* Output buffer */
+	janus_audiobridge_rtp_relay_packet *outpkt = g_malloc0(sizeof(janus_audiobridge_rtp_relay_packet));
+	outpkt->data = g_malloc0(1500);
+	janus_audiobridge_encoding_job *job = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		job = g_async_queue_pop(queue);
+		if(job == &encoding_exit_job)
+			break;
+		janus_audiobridge_participant *participant = job->participant;
+		janus_audiobridge_session *session = participant->session;
+		if(session != NULL && !g_atomic_int_get(&session->destroyed) && g_atomic_int_get(&session->started)) {
+			if(janus_get_monotonic_time() > job->deadline) {
+				/* Too late, sending this now would only add delay */
+				g_atomic_int_inc(&job->room->late_frames);
+			} else {
+				janus_audiobridge_participant_send(participant, job->packet, outpkt);
+			}
+		}
+		janus_audiobridge_encoding_job_free(job);
+	}
+	g_free(outpkt->data);
+	g_free(outpkt);
+	JANUS_LOG(LOG_VERB, "Leaving AudioBridge encoding thread\n");
+	return NULL;
+}
+
 static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_audiobridge_rtp_relay_packet *packet = (janus_audiobridge_rtp_relay_packet *)user_data;
 	if(!packet || !packet->data || packet->length < 1) {
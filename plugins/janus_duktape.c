@@ -59,7 +59,12 @@
  * with \c incomingTextData() or \c incomingBinaryData
  * though, the performance impact of directly processing and manipulating
  * RTP an RTCP packets is probably too high, and so their usage is currently
- * discouraged. The \c dataReady() callback can be used to figure out when
+ * discouraged. If a script only needs to look at some of the media (e.g.,
+ * for analysis), it can keep the routing in C and get a sample with
+ * \c setRtpTap(): with a value of N, \c incomingRtp() gets one packet
+ * every N (skipping it if the JS engine is busy), with 0 it gets none,
+ * and the default (-1) means it gets them all in place of the C routing.
+ * The \c dataReady() callback can be used to figure out when
  * data can be sent. As an additional note, JavaScript scripts can also decide to
  * implement the functions that return information about the plugin itself,
  * namely \c getVersion() \c getVersionString() \c getDescription()
@@ -91,11 +96,15 @@
  * - \c removeRecipient(): specify which user should not receive a user's media anymore;
  * - \c setBitrate(): specify the bitrate to force on a user via REMB feedback;
  * - \c setPliFreq(): specify how often the plugin should send a PLI to this user;
+ * - \c setRtpTap(): specify how many of a user's RTP packets \c incomingRtp() should get;
  * - \c sendPli(): send a PLI (keyframe request);
  * - \c startRecording(): start recording audio, video and or data for a user;
  * - \c stopRecording(): start recording audio, video and or data for a user;
  * - \c pokeScheduler(): notify the C code that there's a coroutine to resume;
- * - \c timeCallback(): trigger the execution of a JavaScript function after X milliseconds.
+ * - \c timeCallback(): trigger the execution of a JavaScript function after X milliseconds;
+ * - \c setSharedValue(): set (or remove, if null) a string all Duktape contexts can see;
+ * - \c getSharedValue(): get a value set by any Duktape context (null if missing);
+ * - \c incrementSharedValue(): add to a numeric shared value, and get the result.
  *
  * As anticipated in the previous section, almost all these methods also
  * expect the unique session identifier to address a specific user in the
@@ -103,6 +112,25 @@
  * and, more importantly, both \c timeCallback() and \c pokeScheduler() which,
  * together with JavaScript's \c resumeScheduler(), will be clearer in the next section.
  *
+ * \section jscontexts Multiple contexts and bytecode cache
+ *
+ * All calls into a Duktape heap are serialized. To use more than one
+ * core, the \c contexts property in the plugin configuration can load
+ * the same script in several independent heaps: sessions are pinned to
+ * one of them by their ID, and each has its own lock and scheduler. The
+ * \c init() and \c destroy() functions are invoked in all of them,
+ * while admin messages and the functions returning information on the
+ * plugin are handled by the first one. Globals are NOT shared across
+ * contexts: scripts that need sessions to see each other (e.g., a
+ * videoroom) should either stick to the default single context, or use
+ * the shared values functions listed above.
+ *
+ * Setting \c bytecode_cache to a folder, instead, makes the plugin save
+ * the compiled script there (see \c duk_dump_function), and load it
+ * from there, rather than compiling the source again, as long as neither
+ * the script nor the Duktape version changed. Duktape doesn't validate
+ * bytecode it loads, so make sure nobody else can write to that folder.
+ *
  * \section jcoroutines JavaScript/C coroutines scheduler
  *
  * Duktape is a single threaded environment. While it has a concept similar
@@ -184,6 +212,10 @@ timeCallback("resumeScheduler", null, 0);
  * can register your own C functions.
  */
 
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <jansson.h>
 
 /* Session definition and hashtable */
@@ -263,9 +295,11 @@ volatile gint duktape_initialized = 0, duktape_stopping = 0;
 janus_callbacks *janus_core = NULL;
 static char *duktape_folder = NULL;
 
-/* Duktape stuff */
-duk_context *duktape_ctx = NULL;
-janus_mutex duktape_mutex = JANUS_MUTEX_INITIALIZER;
+/* Duktape stuff: the script is loaded in all the contexts, and each session is pinned to one of them */
+janus_duktape_context *duktape_contexts = NULL;
+int duktape_contexts_num = 1;
+/* Folder where to cache the compiled script, if enabled */
+static char *duktape_bytecode_cache = NULL;
 static const char *duktape_functions[] = {
 	"init", "destroy", "resumeScheduler",
 	"createSession", "destroySession", "querySession",
@@ -294,10 +328,8 @@ static gboolean has_incoming_data_legacy = FALSE,	/* Legacy callback */
 	has_incoming_binary_data = FALSE;
 static gboolean has_data_ready = FALSE;
 static gboolean has_slow_link = FALSE;
-/* JavaScript C scheduler (for coroutines) */
-static GThread *scheduler_thread = NULL;
+/* JavaScript C scheduler (for coroutines): each context has its own */
 static void *janus_duktape_scheduler(void *data);
-static GAsyncQueue *events = NULL;
 typedef enum janus_duktape_event {
 	janus_duktape_event_none = 0,
 	janus_duktape_event_resume,		/* Resume one or more pending coroutines */
@@ -311,6 +343,7 @@ static void *janus_duktape_timer(void *data);
 static gboolean janus_duktape_timer_cb(void *data);
 typedef struct janus_duktape_callback {
 	guint id;
+	janus_duktape_context *dcontext;
 	uint32_t ms;
 	GSource *source;
 	char *function;
@@ -342,9 +375,68 @@ static void janus_duktape_session_free(const janus_refcount *session_ref) {
 	janus_recorder_destroy(session->arc);
 	janus_recorder_destroy(session->vrc);
 	janus_recorder_destroy(session->drc);
+	if(session->relay_recipients != NULL)
+		g_ptr_array_unref(session->relay_recipients);
 	g_free(session);
 }
 
+static void janus_duktape_session_dereference(gpointer data) {
+	janus_duktape_session *session = (janus_duktape_session *)data;
+	janus_refcount_decrease(&session->ref);
+}
+
+/* Helper to rebuild the snapshot of recipients the media path uses, called
+ * with recipients_mutex locked any time the list changes: this way incoming
+ * packets only need the mutex to get a reference to the current snapshot,
+ * and the JS script never waits for a packet to be relayed to all
+ * recipients when it adds or removes one */
+static void janus_duktape_session_update_relay_recipients(janus_duktape_session *session) {
+	GPtrArray *relay_recipients = NULL;
+	if(session->recipients != NULL) {
+		relay_recipients = g_ptr_array_new_with_free_func((GDestroyNotify)janus_duktape_session_dereference);
+		GSList *temp = session->recipients;
+		while(temp) {
+			janus_duktape_session *recipient = (janus_duktape_session *)temp->data;
+			janus_refcount_increase(&recipient->ref);
+			g_ptr_array_add(relay_recipients, recipient);
+			temp = temp->next;
+		}
+	}
+	GPtrArray *old = session->relay_recipients;
+	session->relay_recipients = relay_recipients;
+	if(old != NULL)
+		g_ptr_array_unref(old);
+}
+
+/* Helper to get a reference to the current snapshot of recipients, if any */
+static GPtrArray *janus_duktape_session_get_relay_recipients(janus_duktape_session *session) {
+	janus_mutex_lock_nodebug(&session->recipients_mutex);
+	GPtrArray *relay_recipients = session->relay_recipients ? g_ptr_array_ref(session->relay_recipients) : NULL;
+	janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	return relay_recipients;
+}
+
+/* Sessions are pinned to a context by their ID */
+janus_duktape_context *janus_duktape_session_context(janus_duktape_session *session) {
+	return &duktape_contexts[session->id % duktape_contexts_num];
+}
+
+/* Key we use to store a pointer to our janus_duktape_context in the heap stash of each Duktape heap */
+#define JANUS_DUKTAPE_CONTEXT_KEY	"janus_duktape_context"
+
+janus_duktape_context *janus_duktape_get_context(duk_context *ctx) {
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, JANUS_DUKTAPE_CONTEXT_KEY);
+	janus_duktape_context *dc = (janus_duktape_context *)duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
+	return dc ? dc : &duktape_contexts[0];
+}
+
+/* Values shared by all the contexts, as strings: this is the only way
+ * the script running in a context can see what happens in the others */
+static GHashTable *shared_values = NULL;
+static janus_mutex shared_values_mutex = JANUS_MUTEX_INITIALIZER;
+
 /* Packet data and routing */
 typedef struct janus_duktape_rtp_relay_packet {
 	rtp_header *data;
@@ -465,7 +557,8 @@ static duk_ret_t janus_duktape_method_readfile(duk_context *ctx) {
 
 static duk_ret_t janus_duktape_method_pokescheduler(duk_context *ctx) {
 	/* This method allows the JavaScript script to poke the scheduler and have it wake up ASAP */
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_duktape_event_resume));
+	janus_duktape_context *dc = janus_duktape_get_context(ctx);
+	g_async_queue_push(dc->events, GUINT_TO_POINTER(janus_duktape_event_resume));
 	duk_push_int(ctx, 0);
 	return 1;
 }
@@ -492,6 +585,7 @@ static duk_ret_t janus_duktape_method_timecallback(duk_context *ctx) {
 	uint32_t ms = (uint32_t)duk_get_number(ctx, 2);
 	/* Create a callback instance */
 	janus_duktape_callback *cb = g_malloc0(sizeof(janus_duktape_callback));
+	cb->dcontext = janus_duktape_get_context(ctx);
 	cb->function = g_strdup(function);
 	if(argument != NULL)
 		cb->argument = g_strdup(argument);
@@ -505,6 +599,72 @@ static duk_ret_t janus_duktape_method_timecallback(duk_context *ctx) {
 	return 1;
 }
 
+static duk_ret_t janus_duktape_method_setsharedvalue(duk_context *ctx) {
+	/* This method allows the JS script to set (or, with a null value, remove) a value all contexts can see */
+	if(duk_get_type(ctx, 0) != DUK_TYPE_STRING) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_STRING), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_STRING &&
+			duk_get_type(ctx, 1) != DUK_TYPE_UNDEFINED && duk_get_type(ctx, 1) != DUK_TYPE_NULL) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_STRING), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	const char *key = duk_get_string(ctx, 0);
+	const char *value = duk_get_string(ctx, 1);
+	janus_mutex_lock(&shared_values_mutex);
+	if(value != NULL)
+		g_hash_table_insert(shared_values, g_strdup(key), g_strdup(value));
+	else
+		g_hash_table_remove(shared_values, key);
+	janus_mutex_unlock(&shared_values_mutex);
+	duk_push_int(ctx, 0);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_getsharedvalue(duk_context *ctx) {
+	/* This method allows the JS script to get a value set by any context (null if missing) */
+	if(duk_get_type(ctx, 0) != DUK_TYPE_STRING) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_STRING), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	const char *key = duk_get_string(ctx, 0);
+	janus_mutex_lock(&shared_values_mutex);
+	const char *value = g_hash_table_lookup(shared_values, key);
+	if(value != NULL)
+		duk_push_string(ctx, value);
+	else
+		duk_push_null(ctx);
+	janus_mutex_unlock(&shared_values_mutex);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_incrementsharedvalue(duk_context *ctx) {
+	/* This method allows the JS script to atomically add to a numeric shared value, e.g., for counters */
+	if(duk_get_type(ctx, 0) != DUK_TYPE_STRING) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_STRING), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	const char *key = duk_get_string(ctx, 0);
+	gint64 delta = (gint64)duk_get_number(ctx, 1);
+	janus_mutex_lock(&shared_values_mutex);
+	const char *value = g_hash_table_lookup(shared_values, key);
+	gint64 result = (value ? g_ascii_strtoll(value, NULL, 10) : 0) + delta;
+	g_hash_table_insert(shared_values, g_strdup(key), g_strdup_printf("%"SCNi64, result));
+	janus_mutex_unlock(&shared_values_mutex);
+	duk_push_number(ctx, (duk_double_t)result);
+	return 1;
+}
+
 static duk_ret_t janus_duktape_method_pushevent(duk_context *ctx) {
 	/* Get the arguments from the provided context */
 	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
@@ -617,8 +777,8 @@ static duk_ret_t janus_duktape_method_notifyevent(duk_context *ctx) {
 	if(event_text == NULL)
 		return duk_throw(ctx);
 	/* Get the arguments from the provided context */
-	if(!janus_core->events_is_enabled()) {
-		/* Event handlers are disabled in the core, ignoring */
+	if(!janus_core->events_is_wanted(&janus_duktape_plugin)) {
+		/* Event handlers are disabled in the core, or nobody wants our events: ignoring */
 		duk_push_int(ctx, 0);
 		return 1;
 	}
@@ -796,6 +956,7 @@ static duk_ret_t janus_duktape_method_addrecipient(duk_context *ctx) {
 		janus_refcount_increase(&recipient->ref);
 		session->recipients = g_slist_append(session->recipients, recipient);
 		recipient->sender = session;
+		janus_duktape_session_update_relay_recipients(session);
 	}
 	janus_mutex_unlock(&session->recipients_mutex);
 	/* Done */
@@ -844,6 +1005,7 @@ static duk_ret_t janus_duktape_method_removerecipient(duk_context *ctx) {
 		session->recipients = g_slist_remove(session->recipients, recipient);
 		recipient->sender = NULL;
 		unref = TRUE;
+		janus_duktape_session_update_relay_recipients(session);
 	}
 	janus_mutex_unlock(&session->recipients_mutex);
 	if(unref) {
@@ -922,6 +1084,36 @@ static duk_ret_t janus_duktape_method_setplifreq(duk_context *ctx) {
 	return 1;
 }
 
+static duk_ret_t janus_duktape_method_setrtptap(duk_context *ctx) {
+	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	uint32_t id = (uint32_t)duk_get_number(ctx, 0);
+	int every = (int)duk_get_number(ctx, 1);
+	/* Find the session */
+	janus_mutex_lock(&duktape_sessions_mutex);
+	janus_duktape_session *session = g_hash_table_lookup(duktape_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&duktape_sessions_mutex);
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Session %"SCNu32" doesn't exist", id);
+		return duk_throw(ctx);
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&duktape_sessions_mutex);
+	g_atomic_int_set(&session->rtp_tap, every < 0 ? -1 : every);
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	duk_push_int(ctx, 0);
+	return 1;
+}
+
 static duk_ret_t janus_duktape_method_sendpli(duk_context *ctx) {
 	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
 		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
@@ -1329,6 +1521,256 @@ static duk_ret_t janus_duktape_method_stoprecording(duk_context *ctx) {
 }
 
 
+/* Bytecode cache: what we write before the output of duk_dump_function, so
+ * that we can tell when the cache is stale (script or Duktape changed) */
+typedef struct janus_duktape_bytecode_header {
+	char magic[4];
+	guint32 version;
+	gint64 mtime;
+	gint64 size;
+} janus_duktape_bytecode_header;
+
+static void janus_duktape_bytecode_header_init(janus_duktape_bytecode_header *header, struct stat *st) {
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, "JDBC", 4);
+	header->version = DUK_VERSION;
+	header->mtime = (gint64)st->st_mtime;
+	header->size = (gint64)st->st_size;
+}
+
+/* duk_load_function throws on invalid input, so we call it in protected mode */
+static duk_ret_t janus_duktape_load_function(duk_context *ctx, void *udata) {
+	duk_load_function(ctx);
+	return 1;
+}
+
+/* Helper to push the compiled script from the bytecode cache, if it's there and up to date */
+static gboolean janus_duktape_bytecode_load(duk_context *ctx, const char *path, struct stat *st) {
+	FILE *f = fopen(path, "rb");
+	if(f == NULL)
+		return FALSE;
+	janus_duktape_bytecode_header header, expected;
+	janus_duktape_bytecode_header_init(&expected, st);
+	if(fread(&header, 1, sizeof(header), f) != sizeof(header) || memcmp(&header, &expected, sizeof(header))) {
+		JANUS_LOG(LOG_VERB, "Bytecode cache %s is stale, ignoring it\n", path);
+		fclose(f);
+		return FALSE;
+	}
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f) - (long)sizeof(header);
+	if(len < 1) {
+		fclose(f);
+		return FALSE;
+	}
+	fseek(f, sizeof(header), SEEK_SET);
+	void *buf = duk_push_fixed_buffer(ctx, len);
+	size_t read = fread(buf, 1, len, f);
+	fclose(f);
+	if(read != (size_t)len || duk_safe_call(ctx, janus_duktape_load_function, NULL, 1, 1) != DUK_EXEC_SUCCESS) {
+		JANUS_LOG(LOG_WARN, "Error loading bytecode cache %s, ignoring it\n", path);
+		duk_pop(ctx);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Helper to save the compiled script on top of the stack to the bytecode cache */
+static void janus_duktape_bytecode_save(duk_context *ctx, const char *path, struct stat *st) {
+	janus_duktape_bytecode_header header;
+	janus_duktape_bytecode_header_init(&header, st);
+	duk_dup_top(ctx);
+	duk_dump_function(ctx);
+	duk_size_t len = 0;
+	void *buf = duk_get_buffer(ctx, -1, &len);
+	/* Write to a temporary file first, so that nobody ever reads a partial cache */
+	char *temp = g_strdup_printf("%s.tmp", path);
+	FILE *f = fopen(temp, "wb");
+	if(f == NULL) {
+		JANUS_LOG(LOG_WARN, "Couldn't write bytecode cache %s: %s\n", temp, g_strerror(errno));
+	} else {
+		gboolean ok = (fwrite(&header, 1, sizeof(header), f) == sizeof(header) && fwrite(buf, 1, len, f) == len);
+		if(fclose(f) != 0 || !ok || rename(temp, path) < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't write bytecode cache %s\n", path);
+			unlink(temp);
+		} else {
+			JANUS_LOG(LOG_VERB, "Saved bytecode cache %s (%zu bytes)\n", path, (size_t)len);
+		}
+	}
+	g_free(temp);
+	duk_pop(ctx);
+}
+
+/* Helper to create a Duktape heap, register our functions and load the script in it */
+static int janus_duktape_context_load(janus_duktape_context *dc, const char *duktape_file) {
+	dc->ctx = duk_create_heap_default();
+	if(dc->ctx == NULL) {
+		JANUS_LOG(LOG_ERR, "Error creating Duktape heap...\n");
+		return -1;
+	}
+	duk_console_init(dc->ctx, DUK_CONSOLE_PROXY_WRAPPER);
+	duk_module_duktape_init(dc->ctx);
+	/* Functions like pokeScheduler need to know which context they were called from */
+	duk_push_heap_stash(dc->ctx);
+	duk_push_pointer(dc->ctx, dc);
+	duk_put_prop_string(dc->ctx, -2, JANUS_DUKTAPE_CONTEXT_KEY);
+	duk_pop(dc->ctx);
+
+	/* Register our functions */
+	duk_push_c_function(dc->ctx, janus_duktape_method_getmodulesfolder, 0);
+	duk_put_global_string(dc->ctx, "getModulesFolder");
+	duk_push_c_function(dc->ctx, janus_duktape_method_readfile, 1);
+	duk_put_global_string(dc->ctx, "readFile");
+	duk_push_c_function(dc->ctx, janus_duktape_method_pokescheduler, 0);
+	duk_put_global_string(dc->ctx, "pokeScheduler");
+	duk_push_c_function(dc->ctx, janus_duktape_method_timecallback, 3);
+	duk_put_global_string(dc->ctx, "timeCallback");
+	duk_push_c_function(dc->ctx, janus_duktape_method_setsharedvalue, 2);
+	duk_put_global_string(dc->ctx, "setSharedValue");
+	duk_push_c_function(dc->ctx, janus_duktape_method_getsharedvalue, 1);
+	duk_put_global_string(dc->ctx, "getSharedValue");
+	duk_push_c_function(dc->ctx, janus_duktape_method_incrementsharedvalue, 2);
+	duk_put_global_string(dc->ctx, "incrementSharedValue");
+	duk_push_c_function(dc->ctx, janus_duktape_method_pushevent, 4);
+	duk_put_global_string(dc->ctx, "pushEvent");
+	duk_push_c_function(dc->ctx, janus_duktape_method_notifyevent, 2);
+	duk_put_global_string(dc->ctx, "notifyEvent");
+	duk_push_c_function(dc->ctx, janus_duktape_method_eventsisenabled, 0);
+	duk_put_global_string(dc->ctx, "eventsIsEnabled");
+	duk_push_c_function(dc->ctx, janus_duktape_method_closepc, 1);
+	duk_put_global_string(dc->ctx, "closePc");
+	duk_push_c_function(dc->ctx, janus_duktape_method_endsession, 1);
+	duk_put_global_string(dc->ctx, "endSession");
+	duk_push_c_function(dc->ctx, janus_duktape_method_configuremedium, 4);
+	duk_put_global_string(dc->ctx, "configureMedium");
+	duk_push_c_function(dc->ctx, janus_duktape_method_addrecipient, 2);
+	duk_put_global_string(dc->ctx, "addRecipient");
+	duk_push_c_function(dc->ctx, janus_duktape_method_removerecipient, 2);
+	duk_put_global_string(dc->ctx, "removeRecipient");
+	duk_push_c_function(dc->ctx, janus_duktape_method_setbitrate, 2);
+	duk_put_global_string(dc->ctx, "setBitrate");
+	duk_push_c_function(dc->ctx, janus_duktape_method_setplifreq, 2);
+	duk_put_global_string(dc->ctx, "setPliFreq");
+	duk_push_c_function(dc->ctx, janus_duktape_method_setrtptap, 2);
+	duk_put_global_string(dc->ctx, "setRtpTap");
+	duk_push_c_function(dc->ctx, janus_duktape_method_sendpli, 1);
+	duk_put_global_string(dc->ctx, "sendPli");
+	duk_push_c_function(dc->ctx, janus_duktape_method_relayrtp, 4);
+	duk_put_global_string(dc->ctx, "relayRtp");
+	duk_push_c_function(dc->ctx, janus_duktape_method_relayrtcp, 4);
+	duk_put_global_string(dc->ctx, "relayRtcp");
+	duk_push_c_function(dc->ctx, janus_duktape_method_relaydata, 3);	/* Legacy function, deprecated */
+	duk_put_global_string(dc->ctx, "relayData");
+	duk_push_c_function(dc->ctx, janus_duktape_method_relaytextdata, 3);
+	duk_put_global_string(dc->ctx, "relayTextData");
+	duk_push_c_function(dc->ctx, janus_duktape_method_relaybinarydata, 3);
+	duk_put_global_string(dc->ctx, "relayBinaryData");
+	duk_push_c_function(dc->ctx, janus_duktape_method_startrecording, 13);
+	duk_put_global_string(dc->ctx, "startRecording");
+	duk_push_c_function(dc->ctx, janus_duktape_method_stoprecording, 4);
+	duk_put_global_string(dc->ctx, "stopRecording");
+	duk_push_c_function(dc->ctx, janus_duktape_method_getversion, 0);
+	duk_put_global_string(dc->ctx, "getDuktapeVersion");
+	/* Register all extra functions, if any were added */
+	janus_duktape_register_extra_functions(dc->ctx);
+
+	/* Now load the script: if we have an up to date compiled version, we use that */
+	struct stat st;
+	if(stat(duktape_file, &st) < 0) {
+		JANUS_LOG(LOG_ERR, "Error loading JS script %s: %s\n", duktape_file, g_strerror(errno));
+		duk_destroy_heap(dc->ctx);
+		dc->ctx = NULL;
+		return -1;
+	}
+	char *cache = NULL;
+	if(duktape_bytecode_cache != NULL) {
+		char *name = g_path_get_basename(duktape_file);
+		cache = g_strdup_printf("%s/%s.bin", duktape_bytecode_cache, name);
+		g_free(name);
+	}
+	if(cache == NULL || !janus_duktape_bytecode_load(dc->ctx, cache, &st)) {
+		/* Compile from source (FIXME badly) */
+		FILE *f = fopen(duktape_file, "rb");
+		if(f == NULL) {
+			JANUS_LOG(LOG_ERR, "Error loading JS script %s: no such file\n", duktape_file);
+			duk_destroy_heap(dc->ctx);
+			dc->ctx = NULL;
+			g_free(cache);
+			return -1;
+		}
+		fseek(f, 0, SEEK_END);
+		size_t len = ftell(f);
+		if(len < 1) {
+			JANUS_LOG(LOG_ERR, "Error loading JS script %s: empty file\n", duktape_file);
+			fclose(f);
+			duk_destroy_heap(dc->ctx);
+			dc->ctx = NULL;
+			g_free(cache);
+			return -1;
+		}
+		char *buf = (char *)g_malloc0(len);
+		fseek(f, 0, SEEK_SET);
+		fread((void *)buf, 1, len, f);
+		fclose(f);
+		duk_push_lstring(dc->ctx, (const char *)buf, (duk_size_t)len);
+		g_free(buf);
+		duk_push_string(dc->ctx, duktape_file);
+		if(duk_pcompile(dc->ctx, 0) != 0) {
+			JANUS_LOG(LOG_ERR, "Error loading JS script %s: %s\n", duktape_file, duk_safe_to_string(dc->ctx, -1));
+			duk_destroy_heap(dc->ctx);
+			dc->ctx = NULL;
+			g_free(cache);
+			return -1;
+		}
+		if(cache != NULL)
+			janus_duktape_bytecode_save(dc->ctx, cache, &st);
+	}
+	g_free(cache);
+	/* Run the script */
+	if(duk_pcall(dc->ctx, 0) != DUK_EXEC_SUCCESS) {
+		JANUS_LOG(LOG_ERR, "Error loading JS script %s: %s\n", duktape_file, duk_safe_to_string(dc->ctx, -1));
+		duk_destroy_heap(dc->ctx);
+		dc->ctx = NULL;
+		return -1;
+	}
+	duk_pop(dc->ctx);
+	/* Make sure that all the functions we need are there */
+	uint i=0;
+	for(i=0; i<duktape_funcsize; i++) {
+		duk_get_global_string(dc->ctx, duktape_functions[i]);
+		if(duk_is_function(dc->ctx, duk_get_top(dc->ctx)-1) == 0) {
+			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", duktape_functions[i], duktape_file);
+			duk_destroy_heap(dc->ctx);
+			dc->ctx = NULL;
+			return -1;
+		}
+		duk_pop(dc->ctx);
+	}
+	return 0;
+}
+
+/* Helper to stop the schedulers and destroy all the Duktape heaps */
+static void janus_duktape_contexts_free(void) {
+	int i = 0;
+	for(i=0; i<duktape_contexts_num; i++) {
+		janus_duktape_context *dc = &duktape_contexts[i];
+		if(dc->scheduler != NULL) {
+			g_async_queue_push(dc->events, GUINT_TO_POINTER(janus_duktape_event_exit));
+			g_thread_join(dc->scheduler);
+			dc->scheduler = NULL;
+		}
+		if(dc->events != NULL)
+			g_async_queue_unref(dc->events);
+		if(dc->ctx != NULL) {
+			janus_mutex_lock(&dc->mutex);
+			duk_destroy_heap(dc->ctx);
+			dc->ctx = NULL;
+			janus_mutex_unlock(&dc->mutex);
+		}
+	}
+	g_free(duktape_contexts);
+	duktape_contexts = NULL;
+}
+
 /* Plugin implementation */
 int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	if(g_atomic_int_get(&duktape_stopping)) {
@@ -1373,181 +1815,118 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	janus_config_item *conf = janus_config_get(config, config_general, janus_config_type_item, "config");
 	if(conf && conf->value)
 		duktape_config = g_strdup(conf->value);
-	janus_config_destroy(config);
-
-	/* Initialize Duktape */
-	duktape_ctx = duk_create_heap_default();
-	if(duktape_ctx == NULL) {
-		JANUS_LOG(LOG_ERR, "Error creating Duktape heap...\n");
-		g_free(duktape_folder);
-		return -1;
+	janus_config_item *contexts = janus_config_get(config, config_general, janus_config_type_item, "contexts");
+	if(contexts && contexts->value) {
+		int num = atoi(contexts->value);
+		if(num < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid number of Duktape contexts (%s), using 1\n", contexts->value);
+			num = 1;
+		}
+		duktape_contexts_num = num;
+	}
+	janus_config_item *cache = janus_config_get(config, config_general, janus_config_type_item, "bytecode_cache");
+	if(cache && cache->value) {
+		if(g_mkdir_with_parents(cache->value, 0755) < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't create bytecode cache folder %s, not caching the compiled script\n", cache->value);
+		} else {
+			duktape_bytecode_cache = g_strdup(cache->value);
+		}
 	}
-	duk_console_init(duktape_ctx, DUK_CONSOLE_PROXY_WRAPPER);
-	duk_module_duktape_init(duktape_ctx);
-
-	/* Register our functions */
-	duk_push_c_function(duktape_ctx, janus_duktape_method_getmodulesfolder, 0);
-	duk_put_global_string(duktape_ctx, "getModulesFolder");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_readfile, 1);
-	duk_put_global_string(duktape_ctx, "readFile");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_pokescheduler, 0);
-	duk_put_global_string(duktape_ctx, "pokeScheduler");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_timecallback, 3);
-	duk_put_global_string(duktape_ctx, "timeCallback");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_pushevent, 4);
-	duk_put_global_string(duktape_ctx, "pushEvent");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_notifyevent, 2);
-	duk_put_global_string(duktape_ctx, "notifyEvent");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_eventsisenabled, 0);
-	duk_put_global_string(duktape_ctx, "eventsIsEnabled");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_closepc, 1);
-	duk_put_global_string(duktape_ctx, "closePc");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_endsession, 1);
-	duk_put_global_string(duktape_ctx, "endSession");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_configuremedium, 4);
-	duk_put_global_string(duktape_ctx, "configureMedium");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_addrecipient, 2);
-	duk_put_global_string(duktape_ctx, "addRecipient");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_removerecipient, 2);
-	duk_put_global_string(duktape_ctx, "removeRecipient");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_setbitrate, 2);
-	duk_put_global_string(duktape_ctx, "setBitrate");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_setplifreq, 2);
-	duk_put_global_string(duktape_ctx, "setPliFreq");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_sendpli, 1);
-	duk_put_global_string(duktape_ctx, "sendPli");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relayrtp, 4);
-	duk_put_global_string(duktape_ctx, "relayRtp");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relayrtcp, 4);
-	duk_put_global_string(duktape_ctx, "relayRtcp");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relaydata, 3);	/* Legacy function, deprecated */
-	duk_put_global_string(duktape_ctx, "relayData");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relaytextdata, 3);
-	duk_put_global_string(duktape_ctx, "relayTextData");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relaybinarydata, 3);
-	duk_put_global_string(duktape_ctx, "relayBinaryData");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_startrecording, 13);
-	duk_put_global_string(duktape_ctx, "startRecording");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_stoprecording, 4);
-	duk_put_global_string(duktape_ctx, "stopRecording");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_getversion, 0);
-	duk_put_global_string(duktape_ctx, "getDuktapeVersion");
-	/* Register all extra functions, if any were added */
-	janus_duktape_register_extra_functions(duktape_ctx);
+	janus_config_destroy(config);
 
-	/* Now load the script (FIXME badly) */
-	FILE *f = fopen(duktape_file, "rb");
-	if(f == NULL) {
-		JANUS_LOG(LOG_ERR, "Error loading JS script %s: no such file\n", duktape_file);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		return -1;
-	}
-	fseek(f, 0, SEEK_END);
-	size_t len = ftell(f);
-	if(len < 1) {
-		JANUS_LOG(LOG_ERR, "Error loading JS script %s: empty file\n", duktape_file);
-		fclose(f);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		return -1;
-	}
-	char *buf = (char *)g_malloc0(len);
-	fseek(f, 0, SEEK_SET);
-	fread((void *)buf, 1, len, f);
-	fclose(f);
-	duk_push_lstring(duktape_ctx, (const char *)buf, (duk_size_t)len);
-	g_free(buf);
-	if(duk_peval(duktape_ctx) != 0) {
-		JANUS_LOG(LOG_ERR, "Error loading JS script %s: %s\n", duktape_file, duk_safe_to_string(duktape_ctx, -1));
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		return -1;
-	}
-	duk_pop(duktape_ctx);
-	/* Make sure that all the functions we need are there */
-	uint i=0;
-	for(i=0; i<duktape_funcsize; i++) {
-		duk_get_global_string(duktape_ctx, duktape_functions[i]);
-		if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) == 0) {
-			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", duktape_functions[i], duktape_file);
-			duk_destroy_heap(duktape_ctx);
+	/* Initialize the Duktape contexts */
+	duktape_contexts = g_malloc0(duktape_contexts_num * sizeof(janus_duktape_context));
+	int i = 0;
+	for(i=0; i<duktape_contexts_num; i++) {
+		duktape_contexts[i].id = i;
+		janus_mutex_init(&duktape_contexts[i].mutex);
+		if(janus_duktape_context_load(&duktape_contexts[i], duktape_file) < 0) {
+			janus_duktape_contexts_free();
 			g_free(duktape_folder);
+			g_free(duktape_bytecode_cache);
 			g_free(duktape_file);
+			g_free(duktape_config);
 			return -1;
 		}
 	}
+	if(duktape_contexts_num > 1)
+		JANUS_LOG(LOG_INFO, "Loaded %s in %d Duktape contexts\n", duktape_file, duktape_contexts_num);
+	duk_context *ctx = duktape_contexts[0].ctx;
 	/* Some JS functions are optional (e.g., those to directly handle RTP, RTCP and
 	 * data, as those will typically be kept at a C level, with JavaScript only dictating
 	 * the logic, or those overriding the plugin namespace and versioning information */
-	duk_get_global_string(duktape_ctx, "getVersion");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "getVersion");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_get_version = TRUE;
-	duk_get_global_string(duktape_ctx, "getVersionString");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "getVersionString");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_get_version_string = TRUE;
-	duk_get_global_string(duktape_ctx, "getDescription");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "getDescription");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_get_description = TRUE;
-	duk_get_global_string(duktape_ctx, "getName");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "getName");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_get_name = TRUE;
-	duk_get_global_string(duktape_ctx, "getAuthor");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "getAuthor");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_get_author = TRUE;
-	duk_get_global_string(duktape_ctx, "getPackage");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "getPackage");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_get_package = TRUE;
-	duk_get_global_string(duktape_ctx, "handleAdminMessage");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "handleAdminMessage");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_handle_admin_message = TRUE;
-	duk_get_global_string(duktape_ctx, "incomingRtp");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "incomingRtp");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_incoming_rtp = TRUE;
-	duk_get_global_string(duktape_ctx, "incomingRtcp");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "incomingRtcp");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_incoming_rtcp = TRUE;
-	duk_get_global_string(duktape_ctx, "incomingData");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0) {
+	duk_get_global_string(ctx, "incomingData");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0) {
 		has_incoming_data_legacy = TRUE;
 		JANUS_LOG(LOG_WARN, "The Duktape script contains the deprecated 'incomingData' callback: update it "
 			"to use 'incomingTextData' and/or 'incomingBinaryData' in the future (see PR #1878)\n");
 	}
-	duk_get_global_string(duktape_ctx, "incomingTextData");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "incomingTextData");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_incoming_text_data = TRUE;
-	duk_get_global_string(duktape_ctx, "incomingBinaryData");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "incomingBinaryData");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_incoming_binary_data = TRUE;
-	duk_get_global_string(duktape_ctx, "dataReady");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "dataReady");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_data_ready = TRUE;
-	duk_get_global_string(duktape_ctx, "slowLink");
-	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+	duk_get_global_string(ctx, "slowLink");
+	if(duk_is_function(ctx, duk_get_top(ctx)-1) != 0)
 		has_slow_link = TRUE;
 
 	duktape_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_duktape_session_destroy);
 	duktape_ids = g_hash_table_new(NULL, NULL);
-	events = g_async_queue_new();
+	shared_values = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
 
 	g_atomic_int_set(&duktape_initialized, 1);
 
-	/* Launch the scheduler thread (which will be responsible for resuming asynchronous coroutines) */
+	/* Launch the scheduler threads (which will be responsible for resuming asynchronous coroutines) */
 	GError *error = NULL;
-	scheduler_thread = g_thread_try_new("duktape scheduler", janus_duktape_scheduler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&duktape_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Duktape scheduler thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		g_free(duktape_config);
-		return -1;
+	for(i=0; i<duktape_contexts_num; i++) {
+		janus_duktape_context *dc = &duktape_contexts[i];
+		dc->events = g_async_queue_new();
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "duktape sched %d", i);
+		dc->scheduler = g_thread_try_new(tname, janus_duktape_scheduler, dc, &error);
+		if(error != NULL) {
+			g_atomic_int_set(&duktape_initialized, 0);
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Duktape scheduler thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_duktape_contexts_free();
+			g_free(duktape_folder);
+			g_free(duktape_bytecode_cache);
+			g_free(duktape_file);
+			g_free(duktape_config);
+			return -1;
+		}
 	}
 	/* Launch the timer loop thread (which will be responsible for scheduling timed callbacks) */
 	timer_context = g_main_context_new();
@@ -1562,8 +1941,9 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 			g_main_loop_unref(timer_loop);
 		if(timer_context != NULL)
 			g_main_context_unref(timer_context);
-		duk_destroy_heap(duktape_ctx);
+		janus_duktape_contexts_free();
 		g_free(duktape_folder);
+		g_free(duktape_bytecode_cache);
 		g_free(duktape_file);
 		g_free(duktape_config);
 		return -1;
@@ -1572,20 +1952,28 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	janus_core = callback;
 
-	/* Init the JS script, in case it's needed */
-	duk_get_global_string(duktape_ctx, "init");
-	duk_push_string(duktape_ctx, duktape_config);
-	int res = duk_pcall(duktape_ctx, 1);
+	/* Init the JS script in all contexts, in case it's needed */
+	int res = DUK_EXEC_SUCCESS;
+	for(i=0; i<duktape_contexts_num && res == DUK_EXEC_SUCCESS; i++) {
+		janus_duktape_context *dc = &duktape_contexts[i];
+		janus_mutex_lock(&dc->mutex);
+		duk_get_global_string(dc->ctx, "init");
+		duk_push_string(dc->ctx, duktape_config);
+		res = duk_pcall(dc->ctx, 1);
+		if(res != DUK_EXEC_SUCCESS)
+			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(dc->ctx, -1));
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
+	}
 	if(res != DUK_EXEC_SUCCESS) {
 		g_atomic_int_set(&duktape_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
-		duk_pop(duktape_ctx);
 		if(timer_loop != NULL)
 			g_main_loop_unref(timer_loop);
 		if(timer_context != NULL)
 			g_main_context_unref(timer_context);
-		duk_destroy_heap(duktape_ctx);
+		janus_duktape_contexts_free();
 		g_free(duktape_folder);
+		g_free(duktape_bytecode_cache);
 		g_free(duktape_file);
 		g_free(duktape_config);
 		return -1;
@@ -1603,10 +1991,14 @@ void janus_duktape_destroy(void) {
 		return;
 	g_atomic_int_set(&duktape_stopping, 1);
 
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_duktape_event_exit));
-	if(scheduler_thread != NULL) {
-		g_thread_join(scheduler_thread);
-		scheduler_thread = NULL;
+	int i = 0;
+	for(i=0; i<duktape_contexts_num; i++) {
+		janus_duktape_context *dc = &duktape_contexts[i];
+		g_async_queue_push(dc->events, GUINT_TO_POINTER(janus_duktape_event_exit));
+		if(dc->scheduler != NULL) {
+			g_thread_join(dc->scheduler);
+			dc->scheduler = NULL;
+		}
 	}
 	if(timer_loop != NULL)
 		g_main_loop_quit(timer_loop);
@@ -1623,29 +2015,31 @@ void janus_duktape_destroy(void) {
 		timer_context = NULL;
 	}
 
-	/* Deinit the JS script, in case it's needed */
-	janus_mutex_lock(&duktape_mutex);
-	duk_get_global_string(duktape_ctx, "destroy");
-	int res = duk_pcall(duktape_ctx, 0);
-	if(res != DUK_EXEC_SUCCESS) {
-		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
-		duk_pop(duktape_ctx);
+	/* Deinit the JS script in all contexts, in case it's needed */
+	for(i=0; i<duktape_contexts_num; i++) {
+		janus_duktape_context *dc = &duktape_contexts[i];
+		janus_mutex_lock(&dc->mutex);
+		duk_get_global_string(dc->ctx, "destroy");
+		int res = duk_pcall(dc->ctx, 0);
+		if(res != DUK_EXEC_SUCCESS) {
+			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(dc->ctx, -1));
+			duk_pop(dc->ctx);
+		}
+		janus_mutex_unlock(&dc->mutex);
 	}
-	janus_mutex_unlock(&duktape_mutex);
 
 	janus_mutex_lock(&duktape_sessions_mutex);
 	g_hash_table_destroy(duktape_sessions);
 	duktape_sessions = NULL;
 	g_hash_table_destroy(duktape_ids);
 	duktape_ids = NULL;
-	g_async_queue_unref(events);
-	events = NULL;
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
-	janus_mutex_lock(&duktape_mutex);
-	duk_destroy_heap(duktape_ctx);
-	duktape_ctx = NULL;
-	janus_mutex_unlock(&duktape_mutex);
+	janus_duktape_contexts_free();
+	janus_mutex_lock(&shared_values_mutex);
+	g_hash_table_destroy(shared_values);
+	shared_values = NULL;
+	janus_mutex_unlock(&shared_values_mutex);
 
 	g_free(duktape_script_version_string);
 	g_free(duktape_script_description);
@@ -1654,6 +2048,9 @@ void janus_duktape_destroy(void) {
 	g_free(duktape_script_package);
 
 	g_free(duktape_folder);
+	duktape_folder = NULL;
+	g_free(duktape_bytecode_cache);
+	duktape_bytecode_cache = NULL;
 
 	g_atomic_int_set(&duktape_initialized, 0);
 	g_atomic_int_set(&duktape_stopping, 0);
@@ -1673,23 +2070,24 @@ int janus_duktape_get_version(void) {
 			/* Unless we asked already */
 			return duktape_script_version;
 		}
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = &duktape_contexts[0];
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "getVersion");
 		int res = duk_pcall(t, 0);
 		if(res != DUK_EXEC_SUCCESS) {
 			/* Something went wrong... return the Janus Duktape plugin info */
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 			duk_pop(t);
-			duk_pop(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
+			duk_pop(dc->ctx);
+			janus_mutex_unlock(&dc->mutex);
 			return JANUS_DUKTAPE_VERSION;
 		}
 		duktape_script_version = (int)duk_get_number(t, -1);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return duktape_script_version;
 	}
 	/* No override, return the Janus Duktape plugin info */
@@ -1704,25 +2102,26 @@ const char *janus_duktape_get_version_string(void) {
 			/* Unless we asked already */
 			return duktape_script_version_string;
 		}
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = &duktape_contexts[0];
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "getVersionString");
 		int res = duk_pcall(t, 0);
 		if(res != DUK_EXEC_SUCCESS) {
 			/* Something went wrong... return the Janus Duktape plugin info */
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 			duk_pop(t);
-			duk_pop(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
+			duk_pop(dc->ctx);
+			janus_mutex_unlock(&dc->mutex);
 			return JANUS_DUKTAPE_VERSION_STRING;
 		}
 		const char *version = duk_get_string(t, -1);
 		if(version != NULL)
 			duktape_script_version_string = g_strdup(version);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return duktape_script_version_string;
 	}
 	/* No override, return the Janus Duktape plugin info */
@@ -1737,25 +2136,26 @@ const char *janus_duktape_get_description(void) {
 			/* Unless we asked already */
 			return duktape_script_description;
 		}
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = &duktape_contexts[0];
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "getDescription");
 		int res = duk_pcall(t, 0);
 		if(res != DUK_EXEC_SUCCESS) {
 			/* Something went wrong... return the Janus Duktape plugin info */
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 			duk_pop(t);
-			duk_pop(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
+			duk_pop(dc->ctx);
+			janus_mutex_unlock(&dc->mutex);
 			return JANUS_DUKTAPE_DESCRIPTION;
 		}
 		const char *description = duk_get_string(t, -1);
 		if(description != NULL)
 			duktape_script_description = g_strdup(description);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return duktape_script_description;
 	}
 	/* No override, return the Janus Duktape plugin info */
@@ -1770,25 +2170,26 @@ const char *janus_duktape_get_name(void) {
 			/* Unless we asked already */
 			return duktape_script_name;
 		}
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = &duktape_contexts[0];
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "getName");
 		int res = duk_pcall(t, 0);
 		if(res != DUK_EXEC_SUCCESS) {
 			/* Something went wrong... return the Janus Duktape plugin info */
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 			duk_pop(t);
-			duk_pop(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
+			duk_pop(dc->ctx);
+			janus_mutex_unlock(&dc->mutex);
 			return JANUS_DUKTAPE_NAME;
 		}
 		const char *name = duk_get_string(t, -1);
 		if(name != NULL)
 			duktape_script_name = g_strdup(name);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return duktape_script_name;
 	}
 	/* No override, return the Janus Duktape plugin info */
@@ -1803,25 +2204,26 @@ const char *janus_duktape_get_author(void) {
 			/* Unless we asked already */
 			return duktape_script_author;
 		}
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = &duktape_contexts[0];
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "getAuthor");
 		int res = duk_pcall(t, 0);
 		if(res != DUK_EXEC_SUCCESS) {
 			/* Something went wrong... return the Janus Duktape plugin info */
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 			duk_pop(t);
-			duk_pop(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
+			duk_pop(dc->ctx);
+			janus_mutex_unlock(&dc->mutex);
 			return JANUS_DUKTAPE_AUTHOR;
 		}
 		const char *author = duk_get_string(t, -1);
 		if(author != NULL)
 			duktape_script_author = g_strdup(author);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return duktape_script_author;
 	}
 	/* No override, return the Janus Duktape plugin info */
@@ -1836,25 +2238,26 @@ const char *janus_duktape_get_package(void) {
 			/* Unless we asked already */
 			return duktape_script_package;
 		}
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = &duktape_contexts[0];
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "getPackage");
 		int res = duk_pcall(t, 0);
 		if(res != DUK_EXEC_SUCCESS) {
 			/* Something went wrong... return the Janus Duktape plugin info */
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 			duk_pop(t);
-			duk_pop(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
+			duk_pop(dc->ctx);
+			janus_mutex_unlock(&dc->mutex);
 			return JANUS_DUKTAPE_PACKAGE;
 		}
 		const char *package = duk_get_string(t, -1);
 		if(package != NULL)
 			duktape_script_package = g_strdup(package);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return duktape_script_package;
 	}
 	/* No override, return the Janus Duktape plugin info */
@@ -1888,6 +2291,7 @@ void janus_duktape_create_session(janus_plugin_session *handle, int *error) {
 	session->handle = handle;
 	session->id = id;
 	janus_rtp_switching_context_reset(&session->rtpctx);
+	g_atomic_int_set(&session->rtp_tap, -1);
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
 	janus_refcount_init(&session->ref, janus_duktape_session_free);
@@ -1897,9 +2301,10 @@ void janus_duktape_create_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_context *dc = janus_duktape_session_context(session);
+	janus_mutex_lock(&dc->mutex);
+	duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+	duk_context *t = duk_get_context(dc->ctx, thr_idx);
 	duk_get_global_string(t, "createSession");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -1908,8 +2313,8 @@ void janus_duktape_create_session(janus_plugin_session *handle, int *error) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(dc->ctx);
+	janus_mutex_unlock(&dc->mutex);
 
 	return;
 }
@@ -1933,9 +2338,10 @@ void janus_duktape_destroy_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_context *dc = janus_duktape_session_context(session);
+	janus_mutex_lock(&dc->mutex);
+	duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+	duk_context *t = duk_get_context(dc->ctx, thr_idx);
 	duk_get_global_string(t, "destroySession");
 	duk_push_number(t, id);
 	int res = duk_pcall(t, 1);
@@ -1944,8 +2350,8 @@ void janus_duktape_destroy_session(janus_plugin_session *handle, int *error) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(dc->ctx);
+	janus_mutex_unlock(&dc->mutex);
 
 	/* Get any rid references recipients of this sessions may have */
 	janus_mutex_lock(&session->recipients_mutex);
@@ -1958,6 +2364,7 @@ void janus_duktape_destroy_session(janus_plugin_session *handle, int *error) {
 		}
 		session->recipients = g_slist_remove(session->recipients, recipient);
 	}
+	janus_duktape_session_update_relay_recipients(session);
 	janus_mutex_unlock(&session->recipients_mutex);
 
 	/* Finally, remove from the hashtable */
@@ -1983,9 +2390,10 @@ json_t *janus_duktape_query_session(janus_plugin_session *handle) {
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&duktape_sessions_mutex);
 	/* Ask the JS script for information on this session */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_context *dc = janus_duktape_session_context(session);
+	janus_mutex_lock(&dc->mutex);
+	duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+	duk_context *t = duk_get_context(dc->ctx, thr_idx);
 	duk_get_global_string(t, "querySession");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -1995,18 +2403,18 @@ json_t *janus_duktape_query_session(janus_plugin_session *handle) {
 		json_t *json = json_object();
 		json_object_set_new(json, "error", json_string(duk_safe_to_string(t, -1)));
 		duk_pop(t);
-		duk_pop(duktape_ctx);
+		duk_pop(dc->ctx);
 		janus_refcount_decrease(&session->ref);
 		return json;
 	}
 	janus_refcount_decrease(&session->ref);
 	const char *info = duk_get_string(t, -1);
 	duk_pop(t);
-	duk_pop(duktape_ctx);
+	duk_pop(dc->ctx);
 	/* We need a Jansson object */
 	json_error_t error;
 	json_t *json = json_loads(info, 0, &error);
-	janus_mutex_unlock(&duktape_mutex);
+	janus_mutex_unlock(&dc->mutex);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s", error.line, error.text);
 		return NULL;
@@ -2044,9 +2452,10 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		json_decref(jsep);
 	}
 	/* Invoke the script function */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_context *dc = janus_duktape_session_context(session);
+	janus_mutex_lock(&dc->mutex);
+	duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+	duk_context *t = duk_get_context(dc->ctx, thr_idx);
 	duk_get_global_string(t, "handleMessage");
 	duk_push_number(t, session->id);
 	duk_push_string(t, transaction);
@@ -2057,8 +2466,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		/* Something went wrong... */
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
 	}
 	janus_refcount_decrease(&session->ref);
@@ -2072,8 +2481,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		/* Either an error or an asynchronous response */
 		int res = (int)duk_get_number(t, 0);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		if(res < 0) {
 			/* We got an error */
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
@@ -2086,8 +2495,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		json_error_t error;
 		json_t *json = json_loads(response, 0, &error);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		if(!json) {
 			JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
@@ -2096,8 +2505,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 	}
 	/* If we got here, we didn't get what we expect */
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(dc->ctx);
+	janus_mutex_unlock(&dc->mutex);
 	return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
 }
 
@@ -2106,9 +2515,10 @@ json_t *janus_duktape_handle_admin_message(json_t *message) {
 		return NULL;
 	char *message_text = json_dumps(message, JSON_INDENT(0) | JSON_PRESERVE_ORDER);
 	/* Invoke the script function */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_context *dc = &duktape_contexts[0];
+	janus_mutex_lock(&dc->mutex);
+	duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+	duk_context *t = duk_get_context(dc->ctx, thr_idx);
 	duk_get_global_string(t, "handleAdminMessage");
 	duk_push_string(t, message_text);
 	int res = duk_pcall(t, 1);
@@ -2116,8 +2526,8 @@ json_t *janus_duktape_handle_admin_message(json_t *message) {
 		/* Something went wrong... */
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return NULL;
 	}
 	if(message_text != NULL)
@@ -2127,8 +2537,8 @@ json_t *janus_duktape_handle_admin_message(json_t *message) {
 	json_error_t error;
 	json_t *json = json_loads(response, 0, &error);
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(dc->ctx);
+	janus_mutex_unlock(&dc->mutex);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 		return NULL;
@@ -2158,9 +2568,10 @@ void janus_duktape_setup_media(janus_plugin_session *handle) {
 	session->pli_latest = janus_get_monotonic_time();
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_context *dc = janus_duktape_session_context(session);
+	janus_mutex_lock(&dc->mutex);
+	duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+	duk_context *t = duk_get_context(dc->ctx, thr_idx);
 	duk_get_global_string(t, "setupMedia");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2169,8 +2580,8 @@ void janus_duktape_setup_media(janus_plugin_session *handle) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(dc->ctx);
+	janus_mutex_unlock(&dc->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2187,12 +2598,14 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 	gboolean video = rtp_packet->video;
 	char *buf = rtp_packet->buffer;
 	uint16_t len = rtp_packet->length;
+	janus_duktape_context *dc = janus_duktape_session_context(session);
 	/* Check if the JS script wants to handle/manipulate RTP packets itself */
-	if(has_incoming_rtp) {
+	int tap = has_incoming_rtp ? g_atomic_int_get(&session->rtp_tap) : 0;
+	if(tap < 0) {
 		/* Yep, pass the data to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "incomingRtp");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, video);
@@ -2204,8 +2617,8 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return;
 	}
 	/* Is this session allowed to send media? */
@@ -2213,6 +2626,26 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 		return;
 	/* Are we recording? */
 	janus_recorder_save_frame(video ? session->vrc : session->arc, buf, len);
+	/* Is the JS script sampling the media? We never wait for the context,
+	 * though: if it's busy, this packet is simply not part of the sample */
+	if(tap > 0 && ++session->rtp_tap_count >= (guint32)tap && janus_mutex_trylock(&dc->mutex)) {
+		session->rtp_tap_count = 0;
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
+		duk_get_global_string(t, "incomingRtp");
+		duk_push_number(t, session->id);
+		duk_push_boolean(t, video);
+		duk_push_lstring(t, buf, len);
+		duk_push_number(t, len);
+		int res = duk_pcall(t, 4);
+		if(res != DUK_EXEC_SUCCESS) {
+			/* Something went wrong... */
+			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
+		}
+		duk_pop(t);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock_nodebug(&dc->mutex);
+	}
 	/* Handle the packet */
 	rtp_header *rtp = (rtp_header *)buf;
 	janus_duktape_rtp_relay_packet packet;
@@ -2223,9 +2656,11 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 	packet.timestamp = ntohl(packet.data->timestamp);
 	packet.seq_number = ntohs(packet.data->seq_number);
 	/* Relay to all recipients */
-	janus_mutex_lock_nodebug(&session->recipients_mutex);
-	g_slist_foreach(session->recipients, janus_duktape_relay_rtp_packet, &packet);
-	janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	GPtrArray *relay_recipients = janus_duktape_session_get_relay_recipients(session);
+	if(relay_recipients != NULL) {
+		g_ptr_array_foreach(relay_recipients, janus_duktape_relay_rtp_packet, &packet);
+		g_ptr_array_unref(relay_recipients);
+	}
 
 	/* Check if we need to send any PLI to this media source */
 	if(video && session->pli_freq > 0) {
@@ -2254,9 +2689,10 @@ void janus_duktape_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp
 	/* Check if the JS script wants to handle/manipulate RTCP packets itself */
 	if(has_incoming_rtcp) {
 		/* Yep, pass the data to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = janus_duktape_session_context(session);
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "incomingRtcp");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, video);
@@ -2268,18 +2704,24 @@ void janus_duktape_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return;
 	}
+	janus_rtcp_summary local;
+	const janus_rtcp_summary *summary = packet->summary;
+	if(summary == NULL) {
+		janus_rtcp_summarize(buf, len, &local);
+		summary = &local;
+	}
 	/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
-	uint32_t bitrate = janus_rtcp_get_remb(buf, len);
+	uint32_t bitrate = summary->remb;
 	if(bitrate > 0) {
 		/* No limit ~= 10000000 */
 		janus_core->send_remb(handle, session->bitrate ? session->bitrate : 10000000);
 	}
 	/* If there's an incoming PLI, instead, relay it to the source of the media if any */
-	if(janus_rtcp_has_pli(buf, len)) {
+	if(summary->has_pli) {
 		if(session->sender != NULL) {
 			janus_mutex_lock_nodebug(&session->sender->recipients_mutex);
 			/* Send a PLI */
@@ -2310,9 +2752,10 @@ void janus_duktape_incoming_data(janus_plugin_session *handle, janus_plugin_data
 		/* Yep, pass the data to the JS script and return */
 		if(packet->binary && !has_incoming_text_data)
 			JANUS_LOG(LOG_WARN, "Missing 'incomingTextData', invoking deprecated function 'incomingData' instead\n");
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = janus_duktape_session_context(session);
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, packet->binary ? "incomingBinaryData" : (has_incoming_text_data ? "incomingTextData" : "incomingData"));
 		duk_push_number(t, session->id);
 		/* We use a string for both text and binary data */
@@ -2324,8 +2767,8 @@ void janus_duktape_incoming_data(janus_plugin_session *handle, janus_plugin_data
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return;
 	}
 	/* Is this session allowed to send data? */
@@ -2339,10 +2782,12 @@ void janus_duktape_incoming_data(janus_plugin_session *handle, janus_plugin_data
 	pkt.length = len;
 	pkt.is_rtp = FALSE;
 	pkt.textdata = !packet->binary;
-	janus_mutex_lock_nodebug(&session->recipients_mutex);
 	/* FIXME We should add support for labels, here */
-	g_slist_foreach(session->recipients, janus_duktape_relay_data_packet, &pkt);
-	janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	GPtrArray *relay_recipients = janus_duktape_session_get_relay_recipients(session);
+	if(relay_recipients != NULL) {
+		g_ptr_array_foreach(relay_recipients, janus_duktape_relay_data_packet, &pkt);
+		g_ptr_array_unref(relay_recipients);
+	}
 }
 
 void janus_duktape_data_ready(janus_plugin_session *handle) {
@@ -2361,9 +2806,10 @@ void janus_duktape_data_ready(janus_plugin_session *handle) {
 	/* Check if the JS script wants to receive this event */
 	if(has_data_ready) {
 		/* Yep, pass the event to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = janus_duktape_session_context(session);
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "dataReady");
 		duk_push_number(t, session->id);
 		int res = duk_pcall(t, 1);
@@ -2372,8 +2818,8 @@ void janus_duktape_data_ready(janus_plugin_session *handle) {
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 		return;
 	}
 }
@@ -2395,9 +2841,10 @@ void janus_duktape_slow_link(janus_plugin_session *handle, int uplink, int video
 	janus_refcount_increase(&session->ref);
 	if(has_slow_link) {
 		/* Notify the JS script */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_context *dc = janus_duktape_session_context(session);
+		janus_mutex_lock(&dc->mutex);
+		duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+		duk_context *t = duk_get_context(dc->ctx, thr_idx);
 		duk_get_global_string(t, "slowLink");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, uplink);
@@ -2408,8 +2855,8 @@ void janus_duktape_slow_link(janus_plugin_session *handle, int uplink, int video
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(dc->ctx);
+		janus_mutex_unlock(&dc->mutex);
 	}
 	janus_refcount_decrease(&session->ref);
 }
@@ -2449,6 +2896,8 @@ void janus_duktape_hangup_media(janus_plugin_session *handle) {
 	session->pli_freq = 0;
 	session->pli_latest = 0;
 	session->e2ee = FALSE;
+	g_atomic_int_set(&session->rtp_tap, -1);
+	session->rtp_tap_count = 0;
 	janus_rtp_switching_context_reset(&session->rtpctx);
 
 	/* Get rid of the recipients */
@@ -2460,12 +2909,14 @@ void janus_duktape_hangup_media(janus_plugin_session *handle) {
 		janus_refcount_decrease(&session->ref);
 		janus_refcount_decrease(&recipient->ref);
 	}
+	janus_duktape_session_update_relay_recipients(session);
 	janus_mutex_unlock(&session->recipients_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_context *dc = janus_duktape_session_context(session);
+	janus_mutex_lock(&dc->mutex);
+	duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+	duk_context *t = duk_get_context(dc->ctx, thr_idx);
 	duk_get_global_string(t, "hangupMedia");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2474,8 +2925,8 @@ void janus_duktape_hangup_media(janus_plugin_session *handle) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(dc->ctx);
+	janus_mutex_unlock(&dc->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2540,28 +2991,29 @@ static void janus_duktape_relay_data_packet(gpointer data, gpointer user_data) {
 /* This is a scheduler thread: if we know there are coroutines to resume in
  * JavaScript (e.g., for asynchronous requests), we do that ourselves here */
 static void *janus_duktape_scheduler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Duktape scheduler thread\n");
+	janus_duktape_context *dc = (janus_duktape_context *)data;
+	JANUS_LOG(LOG_VERB, "Joining Duktape scheduler thread #%d\n", dc->id);
 	janus_duktape_event *event = NULL;
 	/* Wait until there are events to process */
 	while(g_atomic_int_get(&duktape_initialized) && !g_atomic_int_get(&duktape_stopping)) {
-		event = g_async_queue_pop(events);
+		event = g_async_queue_pop(dc->events);
 		if(event == GUINT_TO_POINTER(janus_duktape_event_exit))
 			break;
 		if(event == GUINT_TO_POINTER(janus_duktape_event_resume)) {
 			/* There are coroutines to resume */
-			janus_mutex_lock(&duktape_mutex);
-			duk_get_global_string(duktape_ctx, "resumeScheduler");
-			int res = duk_pcall(duktape_ctx, 0);
+			janus_mutex_lock(&dc->mutex);
+			duk_get_global_string(dc->ctx, "resumeScheduler");
+			int res = duk_pcall(dc->ctx, 0);
 			if(res != DUK_EXEC_SUCCESS) {
-				JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
+				JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(dc->ctx, -1));
 			}
-			duk_pop(duktape_ctx);
+			duk_pop(dc->ctx);
 			/* Print the count of elements into Duktape stack */
-			janus_duktape_stackdump(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
+			janus_duktape_stackdump(dc->ctx);
+			janus_mutex_unlock(&dc->mutex);
 		}
 	}
-	JANUS_LOG(LOG_VERB, "Leaving Duktape scheduler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving Duktape scheduler thread #%d\n", dc->id);
 	return NULL;
 }
 
@@ -2586,9 +3038,10 @@ static gboolean janus_duktape_timer_cb(void *data) {
 		return FALSE;
 	/* Invoke the callback with the provided argument, if available */
 	JANUS_LOG(LOG_VERB, "Invoking scheduled callback (waited %"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_context *dc = cb->dcontext;
+	janus_mutex_lock(&dc->mutex);
+	duk_idx_t thr_idx = duk_push_thread(dc->ctx);
+	duk_context *t = duk_get_context(dc->ctx, thr_idx);
 	duk_get_global_string(t, cb->function);
 	if(cb->argument) {
 		duk_push_string(t, cb->argument);
@@ -2598,8 +3051,8 @@ static gboolean janus_duktape_timer_cb(void *data) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(dc->ctx);
+	janus_mutex_unlock(&dc->mutex);
 	/* Done */
 	g_source_destroy(cb->source);
 	g_source_unref(cb->source);
@@ -43,9 +43,18 @@
 extern volatile gint duktape_initialized, duktape_stopping;
 extern janus_callbacks *janus_core;
 
-/* Duktape context: we define context and mutex as extern */
-extern duk_context *duktape_ctx;
-extern janus_mutex duktape_mutex;
+/* Duktape contexts: the script can be loaded in more than one heap, each with its own mutex and scheduler */
+typedef struct janus_duktape_context {
+	int id;								/* Index of this context */
+	duk_context *ctx;					/* The Duktape heap itself */
+	janus_mutex mutex;					/* Mutex to use whenever we access the heap */
+	GThread *scheduler;					/* Scheduler thread, to resume coroutines in this heap */
+	GAsyncQueue *events;				/* Queue to wake up the scheduler */
+} janus_duktape_context;
+extern janus_duktape_context *duktape_contexts;
+extern int duktape_contexts_num;
+/* Helper to find the janus_duktape_context a Duktape context (or one of its threads) belongs to */
+janus_duktape_context *janus_duktape_get_context(duk_context *ctx);
 
 /* Duktape session: we keep only the barebone stuff here, the rest will be in the JavaScript script */
 typedef struct janus_duktape_session {
@@ -65,6 +74,9 @@ typedef struct janus_duktape_session {
 	GSList *recipients;					/* Sessions that should receive media from this session */
 	struct janus_duktape_session *sender;	/* Other session this session is receiving media from */
 	janus_mutex recipients_mutex;		/* Mutex to lock the recipients list */
+	GPtrArray *relay_recipients;		/* Snapshot of the recipients list the media path uses (holds references) */
+	volatile gint rtp_tap;				/* Whether the JS script gets RTP packets (-1=all, the default, 0=none, N=one every N) */
+	guint32 rtp_tap_count;				/* How many packets we relayed since the last one the JS script got */
 	janus_recorder *arc;				/* The Janus recorder instance for audio, if enabled */
 	janus_recorder *vrc;				/* The Janus recorder instance for video, if enabled */
 	janus_recorder *drc;				/* The Janus recorder instance for data, if enabled */
@@ -79,6 +91,8 @@ typedef struct janus_duktape_session {
 	/* Reference counter */
 	janus_refcount ref;
 } janus_duktape_session;
+/* Helper to get the janus_duktape_context a session is pinned to */
+janus_duktape_context *janus_duktape_session_context(janus_duktape_session *session);
 extern GHashTable *duktape_sessions, *duktape_ids;
 extern janus_mutex duktape_sessions_mutex;
 janus_duktape_session *janus_duktape_lookup_session(janus_plugin_session *handle);
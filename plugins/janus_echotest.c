@@ -634,7 +634,8 @@ void janus_echotest_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtc
 		}
 		if(g_atomic_int_get(&session->destroyed))
 			return;
-		guint32 bitrate = janus_rtcp_get_remb(packet->buffer, packet->length);
+		guint32 bitrate = packet->summary ? packet->summary->remb :
+			janus_rtcp_get_remb(packet->buffer, packet->length);
 		if(bitrate > 0) {
 			/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
 			session->peer_bitrate = bitrate;
@@ -1243,7 +1244,7 @@ static void *janus_echotest_handler(void *data) {
 		}
 		janus_echotest_message_free(msg);
 
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_echotest_plugin)) {
 			/* Just to showcase how you can notify handlers, let's update them on our configuration */
 			json_t *info = json_object();
 			json_object_set_new(info, "audio_active", session->audio_active ? json_true() : json_false());
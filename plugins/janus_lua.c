@@ -59,7 +59,12 @@
  * with \c incomingTextData() or \c incomingBinaryData
  * though, the performance impact of directly processing and manipulating
  * RTP an RTCP packets is probably too high, and so their usage is currently
- * discouraged. The \c dataReady() callback can be used to figure out when
+ * discouraged. If a script only needs to look at some of the media (e.g.,
+ * for analysis), it can keep the routing in C and get a sample with
+ * \c setRtpTap(): with a value of N, \c incomingRtp() gets one packet
+ * every N (skipping it if the Lua engine is busy), with 0 it gets none,
+ * and the default (-1) means it gets them all in place of the C routing.
+ * The \c dataReady() callback can be used to figure out when
  * data can be sent. As an additional note, Lua scripts can also decide to
  * implement the functions that return information about the plugin itself,
  * namely \c getVersion() \c getVersionString() \c getDescription()
@@ -72,6 +77,23 @@
  * the bitrate of a video sender if they, or their viewers, are experiencing
  * issues.
  *
+ * \section luajit LuaJIT and FFI
+ *
+ * The plugin can be built against LuaJIT instead of the stock Lua, by
+ * passing \c --enable-luajit to the configure script. Scripts work the
+ * same way, but they can also use LuaJIT's FFI to make the media path
+ * cheaper: if a script implements \c incomingRtpFfi() and/or
+ * \c incomingDataFfi() , they're invoked in place of \c incomingRtp()
+ * and the data callbacks, and they get a pointer to the buffer (a light
+ * userdata to cast, e.g., to <code>uint8_t *</code>) rather than a copy
+ * of it as a Lua string. The arguments are the session identifier,
+ * whether it's video (or binary, for data), the pointer and the length.
+ * The pointer is only valid until the callback returns. The relay
+ * functions are available as C functions too, called via \c ffi.C
+ * without involving the Lua stack: \c plugins/lua/janus-ffi.lua
+ * contains their declarations, along with wrappers that fall back to
+ * the regular functions when FFI is not available.
+ *
  * \section capi C interfaces
  *
  * Just as the Lua script needs to expose callbacks that the C code can
@@ -92,11 +114,15 @@
  * - \c removeRecipient(): specify which user should not receive a user's media anymore;
  * - \c setBitrate(): specify the bitrate to force on a user via REMB feedback;
  * - \c setPliFreq(): specify how often the plugin should send a PLI to this user;
+ * - \c setRtpTap(): specify how many of a user's RTP packets \c incomingRtp() should get;
  * - \c sendPli(): send a PLI (keyframe request);
  * - \c startRecording(): start recording audio, video and or data for a user;
  * - \c stopRecording(): start recording audio, video and or data for a user;
  * - \c pokeScheduler(): notify the C code that there's a coroutine to resume;
- * - \c timeCallback(): trigger the execution of a Lua function after X milliseconds.
+ * - \c timeCallback(): trigger the execution of a Lua function after X milliseconds;
+ * - \c setSharedValue(): set (or remove, if nil) a string all Lua states can see;
+ * - \c getSharedValue(): get a value set by any Lua state (nil if missing);
+ * - \c incrementSharedValue(): add to a numeric shared value, and get the result.
  *
  * As anticipated in the previous section, almost all these methods also
  * expect the unique session identifier to address a specific user in the
@@ -104,6 +130,22 @@
  * and, more importantly, both \c timeCallback() and \c pokeScheduler() which,
  * together with Lua's \c resumeScheduler(), will be clearer in the next section.
  *
+ * \section states Multiple Lua states
+ *
+ * Since a Lua state can only be used by one thread at a time, every call
+ * into the script is serialized. To make better use of multiple cores,
+ * the \c states property in the plugin configuration can be used to load
+ * the same script in more than one independent Lua state: each session is
+ * pinned to one of them (using its ID), and each state has its own lock
+ * and scheduler, which means sessions on different states are handled in
+ * parallel. The \c init() and \c destroy() functions are invoked in all
+ * states, while admin messages and the functions returning information on
+ * the plugin are always handled by the first one. Notice that Lua globals
+ * are NOT shared across states: a script that needs sessions to see each
+ * other (e.g., a videoroom) should either stick to a single state (the
+ * default), or use the shared values functions listed above, which is a
+ * simple key/value store of strings that all states can access.
+ *
  * \section coroutines Lua/C coroutines scheduler
  *
  * Lua is a single threaded environment. While it has a concept similar
@@ -263,9 +305,9 @@ janus_plugin *create(void) {
 volatile gint lua_initialized = 0, lua_stopping = 0;
 janus_callbacks *janus_core = NULL;
 
-/* Lua stuff */
-lua_State *lua_state = NULL;
-janus_mutex lua_mutex = JANUS_MUTEX_INITIALIZER;
+/* Lua stuff: the script is loaded in all the states, and each session is pinned to one of them */
+janus_lua_state *lua_states = NULL;
+int lua_states_num = 1;
 static const char *lua_functions[] = {
 	"init", "destroy", "resumeScheduler",
 	"createSession", "destroySession", "querySession",
@@ -292,12 +334,14 @@ static gboolean has_incoming_rtcp = FALSE;
 static gboolean has_incoming_data_legacy = FALSE,	/* Legacy callback */
 	has_incoming_text_data = FALSE,
 	has_incoming_binary_data = FALSE;
+#ifdef HAVE_LUAJIT
+/* Only checked when built against LuaJIT, as they pass pointers to buffers */
+static gboolean has_incoming_rtp_ffi = FALSE, has_incoming_data_ffi = FALSE;
+#endif
 static gboolean has_data_ready = FALSE;
 static gboolean has_slow_link = FALSE;
-/* Lua C scheduler (for coroutines) */
-static GThread *scheduler_thread = NULL;
+/* Lua C scheduler (for coroutines): each state has its own */
 static void *janus_lua_scheduler(void *data);
-static GAsyncQueue *events = NULL;
 typedef enum janus_lua_event {
 	janus_lua_event_none = 0,
 	janus_lua_event_resume,		/* Resume one or more pending coroutines */
@@ -311,6 +355,7 @@ static void *janus_lua_timer(void *data);
 static gboolean janus_lua_timer_cb(void *data);
 typedef struct janus_lua_callback {
 	guint id;
+	janus_lua_state *lstate;
 	uint32_t ms;
 	GSource *source;
 	char *function;
@@ -342,9 +387,67 @@ static void janus_lua_session_free(const janus_refcount *session_ref) {
 	janus_recorder_destroy(session->arc);
 	janus_recorder_destroy(session->vrc);
 	janus_recorder_destroy(session->drc);
+	if(session->relay_recipients != NULL)
+		g_ptr_array_unref(session->relay_recipients);
 	g_free(session);
 }
 
+static void janus_lua_session_dereference(gpointer data) {
+	janus_lua_session *session = (janus_lua_session *)data;
+	janus_refcount_decrease(&session->ref);
+}
+
+/* Helper to rebuild the snapshot of recipients the media path uses, called
+ * with recipients_mutex locked any time the list changes: this way incoming
+ * packets only need the mutex to get a reference to the current snapshot,
+ * and the Lua script never waits for a packet to be relayed to all
+ * recipients when it adds or removes one */
+static void janus_lua_session_update_relay_recipients(janus_lua_session *session) {
+	GPtrArray *relay_recipients = NULL;
+	if(session->recipients != NULL) {
+		relay_recipients = g_ptr_array_new_with_free_func((GDestroyNotify)janus_lua_session_dereference);
+		GSList *temp = session->recipients;
+		while(temp) {
+			janus_lua_session *recipient = (janus_lua_session *)temp->data;
+			janus_refcount_increase(&recipient->ref);
+			g_ptr_array_add(relay_recipients, recipient);
+			temp = temp->next;
+		}
+	}
+	GPtrArray *old = session->relay_recipients;
+	session->relay_recipients = relay_recipients;
+	if(old != NULL)
+		g_ptr_array_unref(old);
+}
+
+/* Helper to get a reference to the current snapshot of recipients, if any */
+static GPtrArray *janus_lua_session_get_relay_recipients(janus_lua_session *session) {
+	janus_mutex_lock_nodebug(&session->recipients_mutex);
+	GPtrArray *relay_recipients = session->relay_recipients ? g_ptr_array_ref(session->relay_recipients) : NULL;
+	janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	return relay_recipients;
+}
+
+/* Sessions are pinned to a state by their ID */
+janus_lua_state *janus_lua_session_state(janus_lua_session *session) {
+	return &lua_states[session->id % lua_states_num];
+}
+
+/* Key we use to store a pointer to our janus_lua_state in the registry of each Lua state */
+#define JANUS_LUA_STATE_KEY	"janus_lua_state"
+
+janus_lua_state *janus_lua_get_state(lua_State *s) {
+	lua_getfield(s, LUA_REGISTRYINDEX, JANUS_LUA_STATE_KEY);
+	janus_lua_state *st = (janus_lua_state *)lua_touserdata(s, -1);
+	lua_pop(s, 1);
+	return st ? st : &lua_states[0];
+}
+
+/* Values shared by all the states, as strings: this is the only way
+ * the script running in a state can see what happens in the others */
+static GHashTable *shared_values = NULL;
+static janus_mutex shared_values_mutex = JANUS_MUTEX_INITIALIZER;
+
 /* Packet data and routing */
 typedef struct janus_lua_rtp_relay_packet {
 	rtp_header *data;
@@ -412,7 +515,8 @@ static int janus_lua_method_januslog(lua_State *s) {
 
 static int janus_lua_method_pokescheduler(lua_State *s) {
 	/* This method allows the Lua script to poke the scheduler and have it wake up ASAP */
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_lua_event_resume));
+	janus_lua_state *st = janus_lua_get_state(s);
+	g_async_queue_push(st->events, GUINT_TO_POINTER(janus_lua_event_resume));
 	lua_pushnumber(s, 0);
 	return 1;
 }
@@ -435,6 +539,7 @@ static int janus_lua_method_timecallback(lua_State *s) {
 	guint32 ms = lua_tonumber(s, 3);
 	/* Create a callback instance */
 	janus_lua_callback *cb = g_malloc0(sizeof(janus_lua_callback));
+	cb->lstate = janus_lua_get_state(s);
 	cb->function = g_strdup(function);
 	if(argument != NULL)
 		cb->argument = g_strdup(argument);
@@ -448,6 +553,74 @@ static int janus_lua_method_timecallback(lua_State *s) {
 	return 1;
 }
 
+static int janus_lua_method_setsharedvalue(lua_State *s) {
+	/* This method allows the Lua script to set (or, with a nil value, remove) a value all states can see */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	const char *key = lua_tostring(s, 1);
+	if(key == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid argument (missing key)\n");
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	const char *value = lua_isnil(s, 2) ? NULL : lua_tostring(s, 2);
+	janus_mutex_lock(&shared_values_mutex);
+	if(value != NULL)
+		g_hash_table_insert(shared_values, g_strdup(key), g_strdup(value));
+	else
+		g_hash_table_remove(shared_values, key);
+	janus_mutex_unlock(&shared_values_mutex);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
+static int janus_lua_method_getsharedvalue(lua_State *s) {
+	/* This method allows the Lua script to get a value set by any state (nil if missing) */
+	int n = lua_gettop(s);
+	if(n != 1) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 1)\n", n);
+		lua_pushnil(s);
+		return 1;
+	}
+	const char *key = lua_tostring(s, 1);
+	janus_mutex_lock(&shared_values_mutex);
+	const char *value = key ? g_hash_table_lookup(shared_values, key) : NULL;
+	if(value != NULL)
+		lua_pushstring(s, value);
+	else
+		lua_pushnil(s);
+	janus_mutex_unlock(&shared_values_mutex);
+	return 1;
+}
+
+static int janus_lua_method_incrementsharedvalue(lua_State *s) {
+	/* This method allows the Lua script to atomically add to a numeric shared value, e.g., for counters */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnil(s);
+		return 1;
+	}
+	const char *key = lua_tostring(s, 1);
+	if(key == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid argument (missing key)\n");
+		lua_pushnil(s);
+		return 1;
+	}
+	gint64 delta = (gint64)lua_tonumber(s, 2);
+	janus_mutex_lock(&shared_values_mutex);
+	const char *value = g_hash_table_lookup(shared_values, key);
+	gint64 result = (value ? g_ascii_strtoll(value, NULL, 10) : 0) + delta;
+	g_hash_table_insert(shared_values, g_strdup(key), g_strdup_printf("%"SCNi64, result));
+	janus_mutex_unlock(&shared_values_mutex);
+	lua_pushnumber(s, result);
+	return 1;
+}
+
 static int janus_lua_method_pushevent(lua_State *s) {
 	/* Get the arguments from the provided state */
 	int n = lua_gettop(s);
@@ -534,8 +707,8 @@ static int janus_lua_method_notifyevent(lua_State *s) {
 		lua_pushnumber(s, -1);
 		return 1;
 	}
-	if(!janus_core->events_is_enabled()) {
-		/* Event handlers are disabled in the core, ignoring */
+	if(!janus_core->events_is_wanted(&janus_lua_plugin)) {
+		/* Event handlers are disabled in the core, or nobody wants our events: ignoring */
 		lua_pushnumber(s, 0);
 		return 1;
 	}
@@ -711,6 +884,7 @@ static int janus_lua_method_addrecipient(lua_State *s) {
 		janus_refcount_increase(&recipient->ref);
 		session->recipients = g_slist_append(session->recipients, recipient);
 		recipient->sender = session;
+		janus_lua_session_update_relay_recipients(session);
 	}
 	janus_mutex_unlock(&session->recipients_mutex);
 	/* Done */
@@ -756,6 +930,7 @@ static int janus_lua_method_removerecipient(lua_State *s) {
 		session->recipients = g_slist_remove(session->recipients, recipient);
 		recipient->sender = NULL;
 		unref = TRUE;
+		janus_lua_session_update_relay_recipients(session);
 	}
 	janus_mutex_unlock(&session->recipients_mutex);
 	if(unref) {
@@ -828,6 +1003,33 @@ static int janus_lua_method_setplifreq(lua_State *s) {
 	return 1;
 }
 
+static int janus_lua_method_setrtptap(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	int every = lua_tonumber(s, 2);
+	/* Find the session */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	g_atomic_int_set(&session->rtp_tap, every < 0 ? -1 : every);
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
 static int janus_lua_method_sendpli(lua_State *s) {
 	/* Get the arguments from the provided state */
 	int n = lua_gettop(s);
@@ -857,164 +1059,163 @@ static int janus_lua_method_sendpli(lua_State *s) {
 	return 1;
 }
 
-static int janus_lua_method_relayrtp(lua_State *s) {
-	/* Get the arguments from the provided state */
-	int n = lua_gettop(s);
-	if(n != 4) {
-		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 4)\n", n);
-		lua_pushnumber(s, -1);
-		return 1;
-	}
-	guint32 id = lua_tonumber(s, 1);
-	int is_video = lua_toboolean(s, 2);
-	const char *payload = lua_tostring(s, 3);
-	int len = lua_tonumber(s, 4);
+/* Helpers to relay packets on behalf of the Lua script, shared by the Lua
+ * functions and, when built against LuaJIT, by the FFI bindings */
+static int janus_lua_relay_rtp(guint32 id, int is_video, const char *payload, int len) {
 	if(!payload || len < 1) {
 		JANUS_LOG(LOG_ERR, "Invalid payload\n");
-		lua_pushnumber(s, -1);
-		return 1;
+		return -1;
 	}
 	/* Find the session */
 	janus_mutex_lock(&lua_sessions_mutex);
 	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
 	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
 		janus_mutex_unlock(&lua_sessions_mutex);
-		lua_pushnumber(s, -1);
-		return 1;
+		return -1;
 	}
 	janus_mutex_unlock(&lua_sessions_mutex);
 	/* Send the RTP packet */
 	janus_plugin_rtp rtp = { .video = is_video, .buffer = (char *)payload, .length = len };
 	janus_plugin_rtp_extensions_reset(&rtp.extensions);
 	janus_core->relay_rtp(session->handle, &rtp);
-	lua_pushnumber(s, 0);
-	return 1;
+	return 0;
 }
 
-static int janus_lua_method_relayrtcp(lua_State *s) {
-	/* Get the arguments from the provided state */
-	int n = lua_gettop(s);
-	if(n != 4) {
-		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 4)\n", n);
-		lua_pushnumber(s, -1);
-		return 1;
-	}
-	guint32 id = lua_tonumber(s, 1);
-	int is_video = lua_toboolean(s, 2);
-	const char *payload = lua_tostring(s, 3);
-	int len = lua_tonumber(s, 4);
+static int janus_lua_relay_rtcp(guint32 id, int is_video, const char *payload, int len) {
 	if(!payload || len < 1) {
 		JANUS_LOG(LOG_ERR, "Invalid payload\n");
-		lua_pushnumber(s, -1);
-		return 1;
+		return -1;
 	}
 	/* Find the session */
 	janus_mutex_lock(&lua_sessions_mutex);
 	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
 	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
 		janus_mutex_unlock(&lua_sessions_mutex);
-		lua_pushnumber(s, -1);
-		return 1;
+		return -1;
 	}
 	janus_mutex_unlock(&lua_sessions_mutex);
 	/* Send the RTCP packet */
 	janus_plugin_rtcp rtcp = { .video = is_video, .buffer = (char *)payload, .length = len };
 	janus_core->relay_rtcp(session->handle, &rtcp);
-	lua_pushnumber(s, 0);
-	return 1;
+	return 0;
 }
 
-static int janus_lua_method_relaytextdata(lua_State *s) {
-	/* Get the arguments from the provided state */
-	int n = lua_gettop(s);
-	if(n != 3) {
-		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 3)\n", n);
-		lua_pushnumber(s, -1);
-		return 1;
-	}
-	/* FIXME We should add support for labels, here */
-	guint32 id = lua_tonumber(s, 1);
-	const char *payload = lua_tostring(s, 2);
-	int len = lua_tonumber(s, 3);
+static int janus_lua_relay_data(guint32 id, gboolean binary, const char *payload, int len) {
 	if(!payload || len < 1) {
 		JANUS_LOG(LOG_ERR, "Invalid data\n");
-		lua_pushnumber(s, -1);
-		return 1;
+		return -1;
 	}
 	/* Find the session */
 	janus_mutex_lock(&lua_sessions_mutex);
 	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
 	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
 		janus_mutex_unlock(&lua_sessions_mutex);
-		lua_pushnumber(s, -1);
-		return 1;
+		return -1;
 	}
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&lua_sessions_mutex);
 	if(!g_atomic_int_get(&session->dataready)) {
 		janus_refcount_decrease(&session->ref);
 		JANUS_LOG(LOG_WARN, "Datachannel not ready yet for session %"SCNu32", dropping data\n", id);
-		lua_pushnumber(s, -1);
-		return 1;
+		return -1;
 	}
 	/* Send the data */
 	janus_plugin_data data = {
 		.label = NULL,
 		.protocol = NULL,
-		.binary = FALSE,
+		.binary = binary,
 		.buffer = (char *)payload,
 		.length = len
 	};
 	janus_core->relay_data(session->handle, &data);
 	janus_refcount_decrease(&session->ref);
-	lua_pushnumber(s, 0);
-	return 1;
+	return 0;
 }
 
-static int janus_lua_method_relaybinarydata(lua_State *s) {
+#ifdef HAVE_LUAJIT
+/* FFI bindings: these are plain C functions the Lua script can call via
+ * LuaJIT's ffi.C (the plugin is loaded with RTLD_GLOBAL), which means no
+ * Lua stack is involved, and buffers can be passed as pointers obtained
+ * from the *Ffi callbacks without copying them into Lua strings first:
+ * plugins/lua/janus-ffi.lua contains the declarations and some wrappers */
+int janus_lua_ffi_relay_rtp(uint32_t id, int video, const char *buf, int len) {
+	return janus_lua_relay_rtp(id, video, buf, len);
+}
+
+int janus_lua_ffi_relay_rtcp(uint32_t id, int video, const char *buf, int len) {
+	return janus_lua_relay_rtcp(id, video, buf, len);
+}
+
+int janus_lua_ffi_relay_text_data(uint32_t id, const char *buf, int len) {
+	return janus_lua_relay_data(id, FALSE, buf, len);
+}
+
+int janus_lua_ffi_relay_binary_data(uint32_t id, const char *buf, int len) {
+	return janus_lua_relay_data(id, TRUE, buf, len);
+}
+#endif
+
+static int janus_lua_method_relayrtp(lua_State *s) {
 	/* Get the arguments from the provided state */
 	int n = lua_gettop(s);
-	if(n != 3) {
-		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 3)\n", n);
+	if(n != 4) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 4)\n", n);
 		lua_pushnumber(s, -1);
 		return 1;
 	}
 	guint32 id = lua_tonumber(s, 1);
-	/* FIXME We should add support for labels, here */
-	const char *payload = lua_tostring(s, 2);
-	int len = lua_tonumber(s, 3);
-	if(!payload || len < 1) {
-		JANUS_LOG(LOG_ERR, "Invalid data\n");
+	int is_video = lua_toboolean(s, 2);
+	const char *payload = lua_tostring(s, 3);
+	int len = lua_tonumber(s, 4);
+	lua_pushnumber(s, janus_lua_relay_rtp(id, is_video, payload, len));
+	return 1;
+}
+
+static int janus_lua_method_relayrtcp(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 4) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 4)\n", n);
 		lua_pushnumber(s, -1);
 		return 1;
 	}
-	/* Find the session */
-	janus_mutex_lock(&lua_sessions_mutex);
-	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
-	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
-		janus_mutex_unlock(&lua_sessions_mutex);
+	guint32 id = lua_tonumber(s, 1);
+	int is_video = lua_toboolean(s, 2);
+	const char *payload = lua_tostring(s, 3);
+	int len = lua_tonumber(s, 4);
+	lua_pushnumber(s, janus_lua_relay_rtcp(id, is_video, payload, len));
+	return 1;
+}
+
+static int janus_lua_method_relaytextdata(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 3) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 3)\n", n);
 		lua_pushnumber(s, -1);
 		return 1;
 	}
-	janus_refcount_increase(&session->ref);
-	janus_mutex_unlock(&lua_sessions_mutex);
-	if(!g_atomic_int_get(&session->dataready)) {
-		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_WARN, "Datachannel not ready yet for session %"SCNu32", dropping data\n", id);
+	/* FIXME We should add support for labels, here */
+	guint32 id = lua_tonumber(s, 1);
+	const char *payload = lua_tostring(s, 2);
+	int len = lua_tonumber(s, 3);
+	lua_pushnumber(s, janus_lua_relay_data(id, FALSE, payload, len));
+	return 1;
+}
+
+static int janus_lua_method_relaybinarydata(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 3) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 3)\n", n);
 		lua_pushnumber(s, -1);
 		return 1;
 	}
-	/* Send the data */
-	janus_plugin_data data = {
-		.label = NULL,
-		.protocol = NULL,
-		.binary = TRUE,
-		.buffer = (char *)payload,
-		.length = len
-	};
-	janus_core->relay_data(session->handle, &data);
-	janus_refcount_decrease(&session->ref);
-	lua_pushnumber(s, 0);
+	guint32 id = lua_tonumber(s, 1);
+	/* FIXME We should add support for labels, here */
+	const char *payload = lua_tostring(s, 2);
+	int len = lua_tonumber(s, 3);
+	lua_pushnumber(s, janus_lua_relay_data(id, TRUE, payload, len));
 	return 1;
 }
 
@@ -1199,6 +1400,103 @@ static int janus_lua_method_stoprecording(lua_State *s) {
 }
 
 
+/* Helper to create a Lua state, register our functions and load the script in it */
+static int janus_lua_state_load(janus_lua_state *st, const char *lua_folder, const char *lua_file) {
+	st->state = luaL_newstate();
+	luaL_openlibs(st->state);
+
+	if(lua_folder != NULL) {
+		/* Add the script folder to the path, so that we can load other scripts from there */
+		lua_getglobal(st->state, "package");
+		lua_getfield(st->state, -1, "path");
+		const char *cur_path = lua_tostring(st->state, -1);
+		char new_path[1024];
+		memset(new_path, 0, sizeof(new_path));
+		g_snprintf(new_path, sizeof(new_path), "%s;%s/?.lua", cur_path, lua_folder);
+		lua_pop(st->state, 1);
+		lua_pushstring(st->state, new_path);
+		lua_setfield(st->state, -2, "path");
+		lua_pop(st->state, 1);
+	}
+	/* Functions like pokeScheduler need to know which state they were called from */
+	lua_pushlightuserdata(st->state, st);
+	lua_setfield(st->state, LUA_REGISTRYINDEX, JANUS_LUA_STATE_KEY);
+
+	/* Register our functions */
+	lua_register(st->state, "janusLog", janus_lua_method_januslog);
+	lua_register(st->state, "pokeScheduler", janus_lua_method_pokescheduler);
+	lua_register(st->state, "timeCallback", janus_lua_method_timecallback);
+	lua_register(st->state, "setSharedValue", janus_lua_method_setsharedvalue);
+	lua_register(st->state, "getSharedValue", janus_lua_method_getsharedvalue);
+	lua_register(st->state, "incrementSharedValue", janus_lua_method_incrementsharedvalue);
+	lua_register(st->state, "pushEvent", janus_lua_method_pushevent);
+	lua_register(st->state, "notifyEvent", janus_lua_method_notifyevent);
+	lua_register(st->state, "eventsIsEnabled", janus_lua_method_eventsisenabled);
+	lua_register(st->state, "closePc", janus_lua_method_closepc);
+	lua_register(st->state, "endSession", janus_lua_method_endsession);
+	lua_register(st->state, "configureMedium", janus_lua_method_configuremedium);
+	lua_register(st->state, "addRecipient", janus_lua_method_addrecipient);
+	lua_register(st->state, "removeRecipient", janus_lua_method_removerecipient);
+	lua_register(st->state, "setBitrate", janus_lua_method_setbitrate);
+	lua_register(st->state, "setPliFreq", janus_lua_method_setplifreq);
+	lua_register(st->state, "setRtpTap", janus_lua_method_setrtptap);
+	lua_register(st->state, "sendPli", janus_lua_method_sendpli);
+	lua_register(st->state, "relayRtp", janus_lua_method_relayrtp);
+	lua_register(st->state, "relayRtcp", janus_lua_method_relayrtcp);
+	lua_register(st->state, "relayData", janus_lua_method_relaydata);	/* Legacy function, deprecated */
+	lua_register(st->state, "relayTextData", janus_lua_method_relaytextdata);
+	lua_register(st->state, "relayBinaryData", janus_lua_method_relaybinarydata);
+	lua_register(st->state, "startRecording", janus_lua_method_startrecording);
+	lua_register(st->state, "stopRecording", janus_lua_method_stoprecording);
+	/* Register all extra functions, if any were added */
+	janus_lua_register_extra_functions(st->state);
+
+	/* Now load the script */
+	int err = luaL_dofile(st->state, lua_file);
+	if(err) {
+		JANUS_LOG(LOG_ERR, "Error loading Lua script %s: %s\n", lua_file, lua_tostring(st->state, -1));
+		lua_close(st->state);
+		st->state = NULL;
+		return -1;
+	}
+	/* Make sure that all the functions we need are there */
+	uint i=0;
+	for(i=0; i<lua_funcsize; i++) {
+		lua_getglobal(st->state, lua_functions[i]);
+		if(lua_isfunction(st->state, lua_gettop(st->state)) == 0) {
+			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", lua_functions[i], lua_file);
+			lua_close(st->state);
+			st->state = NULL;
+			return -1;
+		}
+	}
+	lua_settop(st->state, 0);
+	return 0;
+}
+
+/* Helper to stop the schedulers and close all the Lua states */
+static void janus_lua_states_free(void) {
+	int i = 0;
+	for(i=0; i<lua_states_num; i++) {
+		janus_lua_state *st = &lua_states[i];
+		if(st->scheduler != NULL) {
+			g_async_queue_push(st->events, GUINT_TO_POINTER(janus_lua_event_exit));
+			g_thread_join(st->scheduler);
+			st->scheduler = NULL;
+		}
+		if(st->events != NULL)
+			g_async_queue_unref(st->events);
+		if(st->state != NULL) {
+			janus_mutex_lock(&st->mutex);
+			lua_close(st->state);
+			st->state = NULL;
+			janus_mutex_unlock(&st->mutex);
+		}
+	}
+	g_free(lua_states);
+	lua_states = NULL;
+}
+
 /* Plugin implementation */
 int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	if(g_atomic_int_get(&lua_stopping)) {
@@ -1244,140 +1542,121 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	janus_config_item *conf = janus_config_get(config, config_general, janus_config_type_item, "config");
 	if(conf && conf->value)
 		lua_config = g_strdup(conf->value);
-	janus_config_destroy(config);
-
-	/* Initialize Lua */
-	lua_state = luaL_newstate();
-	luaL_openlibs(lua_state);
-
-	if(lua_folder != NULL) {
-		/* Add the script folder to the path, so that we can load other scripts from there */
-		lua_getglobal(lua_state, "package");
-		lua_getfield(lua_state, -1, "path");
-		const char *cur_path = lua_tostring(lua_state, -1);
-		char new_path[1024];
-		memset(new_path, 0, sizeof(new_path));
-		g_snprintf(new_path, sizeof(new_path), "%s;%s/?.lua", cur_path, lua_folder);
-		lua_pop(lua_state, 1);
-		lua_pushstring(lua_state, new_path);
-		lua_setfield(lua_state, -2, "path");
-		lua_pop(lua_state, 1);
+	janus_config_item *states = janus_config_get(config, config_general, janus_config_type_item, "states");
+	if(states && states->value) {
+		int num = atoi(states->value);
+		if(num < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid number of Lua states (%s), using 1\n", states->value);
+			num = 1;
+		}
+		lua_states_num = num;
 	}
+	janus_config_destroy(config);
 
-	/* Register our functions */
-	lua_register(lua_state, "janusLog", janus_lua_method_januslog);
-	lua_register(lua_state, "pokeScheduler", janus_lua_method_pokescheduler);
-	lua_register(lua_state, "timeCallback", janus_lua_method_timecallback);
-	lua_register(lua_state, "pushEvent", janus_lua_method_pushevent);
-	lua_register(lua_state, "notifyEvent", janus_lua_method_notifyevent);
-	lua_register(lua_state, "eventsIsEnabled", janus_lua_method_eventsisenabled);
-	lua_register(lua_state, "closePc", janus_lua_method_closepc);
-	lua_register(lua_state, "endSession", janus_lua_method_endsession);
-	lua_register(lua_state, "configureMedium", janus_lua_method_configuremedium);
-	lua_register(lua_state, "addRecipient", janus_lua_method_addrecipient);
-	lua_register(lua_state, "removeRecipient", janus_lua_method_removerecipient);
-	lua_register(lua_state, "setBitrate", janus_lua_method_setbitrate);
-	lua_register(lua_state, "setPliFreq", janus_lua_method_setplifreq);
-	lua_register(lua_state, "sendPli", janus_lua_method_sendpli);
-	lua_register(lua_state, "relayRtp", janus_lua_method_relayrtp);
-	lua_register(lua_state, "relayRtcp", janus_lua_method_relayrtcp);
-	lua_register(lua_state, "relayData", janus_lua_method_relaydata);	/* Legacy function, deprecated */
-	lua_register(lua_state, "relayTextData", janus_lua_method_relaytextdata);
-	lua_register(lua_state, "relayBinaryData", janus_lua_method_relaybinarydata);
-	lua_register(lua_state, "startRecording", janus_lua_method_startrecording);
-	lua_register(lua_state, "stopRecording", janus_lua_method_stoprecording);
-	/* Register all extra functions, if any were added */
-	janus_lua_register_extra_functions(lua_state);
-
-	/* Now load the script */
-	int err = luaL_dofile(lua_state, lua_file);
-	if(err) {
-		JANUS_LOG(LOG_ERR, "Error loading Lua script %s: %s\n", lua_file, lua_tostring(lua_state, -1));
-		lua_close(lua_state);
-		g_free(lua_folder);
-		g_free(lua_file);
-		return -1;
-	}
-	/* Make sure that all the functions we need are there */
-	uint i=0;
-	for(i=0; i<lua_funcsize; i++) {
-		lua_getglobal(lua_state, lua_functions[i]);
-		if(lua_isfunction(lua_state, lua_gettop(lua_state)) == 0) {
-			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", lua_functions[i], lua_file);
-			lua_close(lua_state);
+	/* Initialize the Lua states */
+	lua_states = g_malloc0(lua_states_num * sizeof(janus_lua_state));
+	int i = 0;
+	for(i=0; i<lua_states_num; i++) {
+		lua_states[i].id = i;
+		janus_mutex_init(&lua_states[i].mutex);
+		if(janus_lua_state_load(&lua_states[i], lua_folder, lua_file) < 0) {
+			janus_lua_states_free();
 			g_free(lua_folder);
 			g_free(lua_file);
+			g_free(lua_config);
 			return -1;
 		}
 	}
+	if(lua_states_num > 1)
+		JANUS_LOG(LOG_INFO, "Loaded %s in %d Lua states\n", lua_file, lua_states_num);
 	/* Some Lua functions are optional (e.g., those to directly handle RTP, RTCP and
 	 * data, as those will typically be kept at a C level, with Lua only dictating
 	 * the logic, or those overriding the plugin namespace and versioning information */
-	lua_getglobal(lua_state, "getVersion");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "getVersion");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_get_version = TRUE;
-	lua_getglobal(lua_state, "getVersionString");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "getVersionString");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_get_version_string = TRUE;
-	lua_getglobal(lua_state, "getDescription");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "getDescription");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_get_description = TRUE;
-	lua_getglobal(lua_state, "getName");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "getName");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_get_name = TRUE;
-	lua_getglobal(lua_state, "getAuthor");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "getAuthor");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_get_author = TRUE;
-	lua_getglobal(lua_state, "getPackage");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "getPackage");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_get_package = TRUE;
-	lua_getglobal(lua_state, "handleAdminMessage");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "handleAdminMessage");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_handle_admin_message = TRUE;
-	lua_getglobal(lua_state, "incomingRtp");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "incomingRtp");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_incoming_rtp = TRUE;
-	lua_getglobal(lua_state, "incomingRtcp");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "incomingRtcp");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_incoming_rtcp = TRUE;
-	lua_getglobal(lua_state, "incomingData");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0) {
+	lua_getglobal(lua_states[0].state, "incomingData");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0) {
 		has_incoming_data_legacy = TRUE;
 		JANUS_LOG(LOG_WARN, "The Lua script contains the deprecated 'incomingData' callback: update it "
 			"to use 'incomingTextData' and/or 'incomingBinaryData' in the future (see PR #1878)\n");
 	}
-	lua_getglobal(lua_state, "incomingTextData");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "incomingTextData");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_incoming_text_data = TRUE;
-	lua_getglobal(lua_state, "incomingBinaryData");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "incomingBinaryData");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_incoming_binary_data = TRUE;
-	lua_getglobal(lua_state, "dataReady");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+#ifdef HAVE_LUAJIT
+	lua_getglobal(lua_states[0].state, "incomingRtpFfi");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0) {
+		/* Taps work the same way, whatever the callback */
+		has_incoming_rtp_ffi = TRUE;
+		has_incoming_rtp = TRUE;
+	}
+	lua_getglobal(lua_states[0].state, "incomingDataFfi");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
+		has_incoming_data_ffi = TRUE;
+	if(has_incoming_rtp_ffi || has_incoming_data_ffi)
+		JANUS_LOG(LOG_INFO, "The Lua script uses the FFI callbacks for incoming%s%s\n",
+			has_incoming_rtp_ffi ? " RTP" : "", has_incoming_data_ffi ? " data" : "");
+#endif
+	lua_getglobal(lua_states[0].state, "dataReady");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_data_ready = TRUE;
-	lua_getglobal(lua_state, "slowLink");
-	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+	lua_getglobal(lua_states[0].state, "slowLink");
+	if(lua_isfunction(lua_states[0].state, lua_gettop(lua_states[0].state)) != 0)
 		has_slow_link = TRUE;
 
 	lua_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_lua_session_destroy);
 	lua_ids = g_hash_table_new(NULL, NULL);
-	events = g_async_queue_new();
+	shared_values = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
 
 	g_atomic_int_set(&lua_initialized, 1);
 
-	/* Launch the scheduler thread (which will be responsible for resuming asynchronous coroutines) */
+	/* Launch the scheduler threads (which will be responsible for resuming asynchronous coroutines) */
 	GError *error = NULL;
-	scheduler_thread = g_thread_try_new("lua scheduler", janus_lua_scheduler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&lua_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua scheduler thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		lua_close(lua_state);
-		g_free(lua_folder);
-		g_free(lua_file);
-		g_free(lua_config);
-		return -1;
+	for(i=0; i<lua_states_num; i++) {
+		janus_lua_state *st = &lua_states[i];
+		st->events = g_async_queue_new();
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "lua sched %d", i);
+		st->scheduler = g_thread_try_new(tname, janus_lua_scheduler, st, &error);
+		if(error != NULL) {
+			g_atomic_int_set(&lua_initialized, 0);
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua scheduler thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_lua_states_free();
+			g_free(lua_folder);
+			g_free(lua_file);
+			g_free(lua_config);
+			return -1;
+		}
 	}
 	/* Launch the timer loop thread (which will be responsible for scheduling timed callbacks) */
 	timer_context = g_main_context_new();
@@ -1392,7 +1671,7 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 			g_main_loop_unref(timer_loop);
 		if(timer_context != NULL)
 			g_main_context_unref(timer_context);
-		lua_close(lua_state);
+		janus_lua_states_free();
 		g_free(lua_folder);
 		g_free(lua_file);
 		g_free(lua_config);
@@ -1402,10 +1681,15 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	janus_core = callback;
 
-	/* Init the Lua script, in case it's needed */
-	lua_getglobal(lua_state, "init");
-	lua_pushstring(lua_state, lua_config);
-	lua_call(lua_state, 1, 0);
+	/* Init the Lua script in all states, in case it's needed */
+	for(i=0; i<lua_states_num; i++) {
+		janus_lua_state *st = &lua_states[i];
+		janus_mutex_lock(&st->mutex);
+		lua_getglobal(st->state, "init");
+		lua_pushstring(st->state, lua_config);
+		lua_call(st->state, 1, 0);
+		janus_mutex_unlock(&st->mutex);
+	}
 
 	g_free(lua_folder);
 	g_free(lua_file);
@@ -1420,10 +1704,14 @@ void janus_lua_destroy(void) {
 		return;
 	g_atomic_int_set(&lua_stopping, 1);
 
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_lua_event_exit));
-	if(scheduler_thread != NULL) {
-		g_thread_join(scheduler_thread);
-		scheduler_thread = NULL;
+	int i = 0;
+	for(i=0; i<lua_states_num; i++) {
+		janus_lua_state *st = &lua_states[i];
+		g_async_queue_push(st->events, GUINT_TO_POINTER(janus_lua_event_exit));
+		if(st->scheduler != NULL) {
+			g_thread_join(st->scheduler);
+			st->scheduler = NULL;
+		}
 	}
 	if(timer_loop != NULL)
 		g_main_loop_quit(timer_loop);
@@ -1440,25 +1728,27 @@ void janus_lua_destroy(void) {
 		timer_context = NULL;
 	}
 
-	/* Deinit the Lua script, in case it's needed */
-	janus_mutex_lock(&lua_mutex);
-	lua_getglobal(lua_state, "destroy");
-	lua_call(lua_state, 0, 0);
-	janus_mutex_unlock(&lua_mutex);
+	/* Deinit the Lua script in all states, in case it's needed */
+	for(i=0; i<lua_states_num; i++) {
+		janus_lua_state *st = &lua_states[i];
+		janus_mutex_lock(&st->mutex);
+		lua_getglobal(st->state, "destroy");
+		lua_call(st->state, 0, 0);
+		janus_mutex_unlock(&st->mutex);
+	}
 
 	janus_mutex_lock(&lua_sessions_mutex);
 	g_hash_table_destroy(lua_sessions);
 	lua_sessions = NULL;
 	g_hash_table_destroy(lua_ids);
 	lua_ids = NULL;
-	g_async_queue_unref(events);
-	events = NULL;
 	janus_mutex_unlock(&lua_sessions_mutex);
 
-	janus_mutex_lock(&lua_mutex);
-	lua_close(lua_state);
-	lua_state = NULL;
-	janus_mutex_unlock(&lua_mutex);
+	janus_lua_states_free();
+	janus_mutex_lock(&shared_values_mutex);
+	g_hash_table_destroy(shared_values);
+	shared_values = NULL;
+	janus_mutex_unlock(&shared_values_mutex);
 
 	g_free(lua_script_version_string);
 	g_free(lua_script_description);
@@ -1484,13 +1774,14 @@ int janus_lua_get_version(void) {
 			/* Unless we asked already */
 			return lua_script_version;
 		}
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = &lua_states[0];
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "getVersion");
 		lua_call(t, 0, 1);
 		lua_script_version = (int)lua_tonumber(t, -1);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		return lua_script_version;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1505,15 +1796,16 @@ const char *janus_lua_get_version_string(void) {
 			/* Unless we asked already */
 			return lua_script_version_string;
 		}
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = &lua_states[0];
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "getVersionString");
 		lua_call(t, 0, 1);
 		const char *version = lua_tostring(t, -1);
 		if(version != NULL)
 			lua_script_version_string = g_strdup(version);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		return lua_script_version_string;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1528,15 +1820,16 @@ const char *janus_lua_get_description(void) {
 			/* Unless we asked already */
 			return lua_script_description;
 		}
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = &lua_states[0];
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "getDescription");
 		lua_call(t, 0, 1);
 		const char *description = lua_tostring(t, -1);
 		if(description != NULL)
 			lua_script_description = g_strdup(description);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		return lua_script_description;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1551,15 +1844,16 @@ const char *janus_lua_get_name(void) {
 			/* Unless we asked already */
 			return lua_script_name;
 		}
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = &lua_states[0];
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "getName");
 		lua_call(t, 0, 1);
 		const char *name = lua_tostring(t, -1);
 		if(name != NULL)
 			lua_script_name = g_strdup(name);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		return lua_script_name;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1574,15 +1868,16 @@ const char *janus_lua_get_author(void) {
 			/* Unless we asked already */
 			return lua_script_author;
 		}
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = &lua_states[0];
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "getAuthor");
 		lua_call(t, 0, 1);
 		const char *author = lua_tostring(t, -1);
 		if(author != NULL)
 			lua_script_author = g_strdup(author);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		return lua_script_author;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1597,15 +1892,16 @@ const char *janus_lua_get_package(void) {
 			/* Unless we asked already */
 			return lua_script_package;
 		}
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = &lua_states[0];
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "getPackage");
 		lua_call(t, 0, 1);
 		const char *package = lua_tostring(t, -1);
 		if(package != NULL)
 			lua_script_package = g_strdup(package);
 		lua_pop(t, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		return lua_script_package;
 	}
 	/* No override, return the Janus Lua plugin info */
@@ -1639,6 +1935,7 @@ void janus_lua_create_session(janus_plugin_session *handle, int *error) {
 	session->handle = handle;
 	session->id = id;
 	janus_rtp_switching_context_reset(&session->rtpctx);
+	g_atomic_int_set(&session->rtp_tap, -1);
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
 	janus_refcount_init(&session->ref, janus_lua_session_free);
@@ -1648,13 +1945,14 @@ void janus_lua_create_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&lua_sessions_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *st = janus_lua_session_state(session);
+	janus_mutex_lock(&st->mutex);
+	lua_State *t = lua_newthread(st->state);
 	lua_getglobal(t, "createSession");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(st->state, 1);
+	janus_mutex_unlock(&st->mutex);
 
 	return;
 }
@@ -1678,13 +1976,14 @@ void janus_lua_destroy_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&lua_sessions_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *st = janus_lua_session_state(session);
+	janus_mutex_lock(&st->mutex);
+	lua_State *t = lua_newthread(st->state);
 	lua_getglobal(t, "destroySession");
 	lua_pushnumber(t, id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(st->state, 1);
+	janus_mutex_unlock(&st->mutex);
 
 	/* Get any rid references recipients of this sessions may have */
 	janus_mutex_lock(&session->recipients_mutex);
@@ -1697,6 +1996,7 @@ void janus_lua_destroy_session(janus_plugin_session *handle, int *error) {
 		}
 		session->recipients = g_slist_remove(session->recipients, recipient);
 	}
+	janus_lua_session_update_relay_recipients(session);
 	janus_mutex_unlock(&session->recipients_mutex);
 
 	/* Finally, remove from the hashtable */
@@ -1722,19 +2022,20 @@ json_t *janus_lua_query_session(janus_plugin_session *handle) {
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&lua_sessions_mutex);
 	/* Ask the Lua script for information on this session */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *st = janus_lua_session_state(session);
+	janus_mutex_lock(&st->mutex);
+	lua_State *t = lua_newthread(st->state);
 	lua_getglobal(t, "querySession");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 1);
-	lua_pop(lua_state, 1);
+	lua_pop(st->state, 1);
 	janus_refcount_decrease(&session->ref);
 	const char *info = lua_tostring(t, -1);
 	lua_pop(t, 1);
 	/* We need a Jansson object */
 	json_error_t error;
 	json_t *json = json_loads(info, 0, &error);
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(&st->mutex);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s", error.line, error.text);
 		return NULL;
@@ -1772,15 +2073,16 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 		json_decref(jsep);
 	}
 	/* Invoke the script function */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *st = janus_lua_session_state(session);
+	janus_mutex_lock(&st->mutex);
+	lua_State *t = lua_newthread(st->state);
 	lua_getglobal(t, "handleMessage");
 	lua_pushnumber(t, session->id);
 	lua_pushstring(t, transaction);
 	lua_pushstring(t, message_text);
 	lua_pushstring(t, jsep_text);
 	lua_call(t, 4, 2);
-	lua_pop(lua_state, 1);
+	lua_pop(st->state, 1);
 	janus_refcount_decrease(&session->ref);
 	if(message_text != NULL)
 		free(message_text);
@@ -1789,7 +2091,7 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 	g_free(transaction);
 	int n = lua_gettop(t);
 	if(n != 2) {
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Lua error", NULL);
 	}
@@ -1799,20 +2101,20 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 	lua_pop(t, 2);
 	if(res < 0) {
 		/* We got an error */
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, response ? response : "Lua error", NULL);
 	} else if(res == 0) {
 		/* Synchronous response: we need a Jansson object */
 		json_error_t error;
 		json_t *json = json_loads(response, 0, &error);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		if(!json) {
 			JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Lua error", NULL);
 		}
 		return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, json);
 	}
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(&st->mutex);
 	/* If we got here, it's an asynchronous response */
 	return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 }
@@ -1822,17 +2124,18 @@ json_t *janus_lua_handle_admin_message(json_t *message) {
 		return NULL;
 	char *message_text = json_dumps(message, JSON_INDENT(0) | JSON_PRESERVE_ORDER);
 	/* Invoke the script function */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *st = &lua_states[0];
+	janus_mutex_lock(&st->mutex);
+	lua_State *t = lua_newthread(st->state);
 	lua_getglobal(t, "handleAdminMessage");
 	lua_pushstring(t, message_text);
 	lua_call(t, 1, 1);
-	lua_pop(lua_state, 1);
+	lua_pop(st->state, 1);
 	if(message_text != NULL)
 		free(message_text);
 	int n = lua_gettop(t);
 	if(n != 1) {
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(&st->mutex);
 		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 1)\n", n);
 		return NULL;
 	}
@@ -1840,7 +2143,7 @@ json_t *janus_lua_handle_admin_message(json_t *message) {
 	const char *response = lua_tostring(t, 1);
 	json_error_t error;
 	json_t *json = json_loads(response, 0, &error);
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(&st->mutex);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 		return NULL;
@@ -1870,16 +2173,39 @@ void janus_lua_setup_media(janus_plugin_session *handle) {
 	session->pli_latest = janus_get_monotonic_time();
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *st = janus_lua_session_state(session);
+	janus_mutex_lock(&st->mutex);
+	lua_State *t = lua_newthread(st->state);
 	lua_getglobal(t, "setupMedia");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(st->state, 1);
+	janus_mutex_unlock(&st->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
+/* Pass an RTP packet to the Lua script: with LuaJIT, a script can ask for
+ * a pointer to the buffer instead of a copy, to use it via FFI */
+static void janus_lua_call_incoming_rtp(lua_State *t, janus_lua_session *session, gboolean video, char *buf, uint16_t len) {
+#ifdef HAVE_LUAJIT
+	if(has_incoming_rtp_ffi) {
+		lua_getglobal(t, "incomingRtpFfi");
+		lua_pushnumber(t, session->id);
+		lua_pushboolean(t, video);
+		lua_pushlightuserdata(t, buf);
+		lua_pushnumber(t, len);
+		lua_call(t, 4, 0);
+		return;
+	}
+#endif
+	lua_getglobal(t, "incomingRtp");
+	lua_pushnumber(t, session->id);
+	lua_pushboolean(t, video);
+	lua_pushlstring(t, buf, len);
+	lua_pushnumber(t, len);
+	lua_call(t, 4, 0);
+}
+
 void janus_lua_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *rtp_packet) {
 	if(handle == NULL || handle->stopped || g_atomic_int_get(&lua_stopping) || !g_atomic_int_get(&lua_initialized))
 		return;
@@ -1894,18 +2220,15 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *rtp_
 	char *buf = rtp_packet->buffer;
 	uint16_t len = rtp_packet->length;
 	/* Check if the Lua script wants to handle/manipulate RTP packets itself */
-	if(has_incoming_rtp) {
+	int tap = has_incoming_rtp ? g_atomic_int_get(&session->rtp_tap) : 0;
+	if(tap < 0) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
-		lua_getglobal(t, "incomingRtp");
-		lua_pushnumber(t, session->id);
-		lua_pushboolean(t, video);
-		lua_pushlstring(t, buf, len);
-		lua_pushnumber(t, len);
-		lua_call(t, 4, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_state *st = janus_lua_session_state(session);
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
+		janus_lua_call_incoming_rtp(t, session, video, buf, len);
+		lua_pop(st->state, 1);
+		janus_mutex_unlock(&st->mutex);
 		return;
 	}
 	/* Is this session allowed to send media? */
@@ -1913,6 +2236,18 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *rtp_
 		return;
 	/* Are we recording? */
 	janus_recorder_save_frame(video ? session->vrc : session->arc, buf, len);
+	/* Is the Lua script sampling the media? We never wait for its state,
+	 * though: if it's busy, this packet is simply not part of the sample */
+	if(tap > 0 && ++session->rtp_tap_count >= (guint32)tap) {
+		janus_lua_state *st = janus_lua_session_state(session);
+		if(janus_mutex_trylock(&st->mutex)) {
+			session->rtp_tap_count = 0;
+			lua_State *t = lua_newthread(st->state);
+			janus_lua_call_incoming_rtp(t, session, video, buf, len);
+			lua_pop(st->state, 1);
+			janus_mutex_unlock_nodebug(&st->mutex);
+		}
+	}
 	/* Handle the packet */
 	rtp_header *rtp = (rtp_header *)buf;
 	janus_lua_rtp_relay_packet packet;
@@ -1924,9 +2259,11 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *rtp_
 	packet.timestamp = ntohl(packet.data->timestamp);
 	packet.seq_number = ntohs(packet.data->seq_number);
 	/* Relay to all recipients */
-	janus_mutex_lock_nodebug(&session->recipients_mutex);
-	g_slist_foreach(session->recipients, janus_lua_relay_rtp_packet, &packet);
-	janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	GPtrArray *relay_recipients = janus_lua_session_get_relay_recipients(session);
+	if(relay_recipients != NULL) {
+		g_ptr_array_foreach(relay_recipients, janus_lua_relay_rtp_packet, &packet);
+		g_ptr_array_unref(relay_recipients);
+	}
 
 	/* Check if we need to send any PLI to this media source */
 	if(video && session->pli_freq > 0) {
@@ -1956,26 +2293,33 @@ void janus_lua_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *pa
 	/* Check if the Lua script wants to handle/manipulate RTCP packets itself */
 	if(has_incoming_rtcp) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = janus_lua_session_state(session);
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "incomingRtcp");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, video);
 		lua_pushlstring(t, buf, len);
 		lua_pushnumber(t, len);
 		lua_call(t, 4, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(st->state, 1);
+		janus_mutex_unlock(&st->mutex);
 		return;
 	}
+	janus_rtcp_summary local;
+	const janus_rtcp_summary *summary = packet->summary;
+	if(summary == NULL) {
+		janus_rtcp_summarize(buf, len, &local);
+		summary = &local;
+	}
 	/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
-	guint32 bitrate = janus_rtcp_get_remb(buf, len);
+	guint32 bitrate = summary->remb;
 	if(bitrate > 0) {
 		/* No limit ~= 10000000 */
 		janus_core->send_remb(handle, session->bitrate ? session->bitrate : 10000000);
 	}
 	/* If there's an incoming PLI, instead, relay it to the source of the media if any */
-	if(janus_rtcp_has_pli(buf, len)) {
+	if(summary->has_pli) {
 		if(session->sender != NULL) {
 			janus_mutex_lock_nodebug(&session->sender->recipients_mutex);
 			/* Send a PLI */
@@ -2002,20 +2346,38 @@ void janus_lua_incoming_data(janus_plugin_session *handle, janus_plugin_data *pa
 	/* Are we recording? */
 	janus_recorder_save_frame(session->drc, buf, len);
 	/* Check if the Lua script wants to handle/manipulate data channel packets itself */
+#ifdef HAVE_LUAJIT
+	if(has_incoming_data_ffi) {
+		/* Pass a pointer to the buffer, rather than a copy, for both text and binary data */
+		janus_lua_state *st = janus_lua_session_state(session);
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
+		lua_getglobal(t, "incomingDataFfi");
+		lua_pushnumber(t, session->id);
+		lua_pushboolean(t, packet->binary);
+		lua_pushlightuserdata(t, buf);
+		lua_pushnumber(t, len);
+		lua_call(t, 4, 0);
+		lua_pop(st->state, 1);
+		janus_mutex_unlock(&st->mutex);
+		return;
+	}
+#endif
 	if((!packet->binary && (has_incoming_data_legacy || has_incoming_text_data)) || (packet->binary && has_incoming_binary_data)) {
 		/* Yep, pass the data to the Lua script and return */
 		if(!packet->binary && !has_incoming_text_data)
 			JANUS_LOG(LOG_WARN, "Missing 'incomingTextData', invoking deprecated function 'incomingData' instead\n");
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = janus_lua_session_state(session);
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, packet->binary ? "incomingBinaryData" : (has_incoming_text_data ? "incomingTextData" : "incomingData"));
 		lua_pushnumber(t, session->id);
 		/* We use a string for both text and binary data */
 		lua_pushlstring(t, buf, len);
 		lua_pushnumber(t, len);
 		lua_call(t, 3, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(st->state, 1);
+		janus_mutex_unlock(&st->mutex);
 		return;
 	}
 	/* Is this session allowed to send data? */
@@ -2029,10 +2391,12 @@ void janus_lua_incoming_data(janus_plugin_session *handle, janus_plugin_data *pa
 	pkt.length = len;
 	pkt.is_rtp = FALSE;
 	pkt.textdata = !packet->binary;
-	janus_mutex_lock_nodebug(&session->recipients_mutex);
 	/* FIXME We should add support for labels, here */
-	g_slist_foreach(session->recipients, janus_lua_relay_data_packet, &pkt);
-	janus_mutex_unlock_nodebug(&session->recipients_mutex);
+	GPtrArray *relay_recipients = janus_lua_session_get_relay_recipients(session);
+	if(relay_recipients != NULL) {
+		g_ptr_array_foreach(relay_recipients, janus_lua_relay_data_packet, &pkt);
+		g_ptr_array_unref(relay_recipients);
+	}
 }
 
 void janus_lua_data_ready(janus_plugin_session *handle) {
@@ -2051,13 +2415,14 @@ void janus_lua_data_ready(janus_plugin_session *handle) {
 	/* Check if the Lua script wants to receive this event */
 	if(has_data_ready) {
 		/* Yep, pass the event to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = janus_lua_session_state(session);
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "dataReady");
 		lua_pushnumber(t, session->id);
 		lua_call(t, 1, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(st->state, 1);
+		janus_mutex_unlock(&st->mutex);
 		return;
 	}
 }
@@ -2079,15 +2444,16 @@ void janus_lua_slow_link(janus_plugin_session *handle, int uplink, int video) {
 	janus_refcount_increase(&session->ref);
 	if(has_slow_link) {
 		/* Notify the Lua script */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_state *st = janus_lua_session_state(session);
+		janus_mutex_lock(&st->mutex);
+		lua_State *t = lua_newthread(st->state);
 		lua_getglobal(t, "slowLink");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, uplink);
 		lua_pushboolean(t, video);
 		lua_call(t, 3, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(st->state, 1);
+		janus_mutex_unlock(&st->mutex);
 	}
 	janus_refcount_decrease(&session->ref);
 }
@@ -2127,6 +2493,8 @@ void janus_lua_hangup_media(janus_plugin_session *handle) {
 	session->pli_freq = 0;
 	session->pli_latest = 0;
 	session->e2ee = FALSE;
+	g_atomic_int_set(&session->rtp_tap, -1);
+	session->rtp_tap_count = 0;
 	janus_rtp_switching_context_reset(&session->rtpctx);
 
 	/* Get rid of the recipients */
@@ -2138,16 +2506,18 @@ void janus_lua_hangup_media(janus_plugin_session *handle) {
 		janus_refcount_decrease(&session->ref);
 		janus_refcount_decrease(&recipient->ref);
 	}
+	janus_lua_session_update_relay_recipients(session);
 	janus_mutex_unlock(&session->recipients_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *st = janus_lua_session_state(session);
+	janus_mutex_lock(&st->mutex);
+	lua_State *t = lua_newthread(st->state);
 	lua_getglobal(t, "hangupMedia");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(st->state, 1);
+	janus_mutex_unlock(&st->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2212,24 +2582,25 @@ static void janus_lua_relay_data_packet(gpointer data, gpointer user_data) {
 /* This is a scheduler thread: if we know there are coroutines to resume
  * in Lua (e.g., for asynchronous requests), we do that ourselves here */
 static void *janus_lua_scheduler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Lua scheduler thread\n");
+	janus_lua_state *st = (janus_lua_state *)data;
+	JANUS_LOG(LOG_VERB, "Joining Lua scheduler thread #%d\n", st->id);
 	janus_lua_event *event = NULL;
 	/* Wait until there are events to process */
 	while(g_atomic_int_get(&lua_initialized) && !g_atomic_int_get(&lua_stopping)) {
-		event = g_async_queue_pop(events);
+		event = g_async_queue_pop(st->events);
 		if(event == GUINT_TO_POINTER(janus_lua_event_exit))
 			break;
 		if(event == GUINT_TO_POINTER(janus_lua_event_resume)) {
 			/* There are coroutines to resume */
-			janus_mutex_lock(&lua_mutex);
-			lua_getglobal(lua_state, "resumeScheduler");
-			lua_call(lua_state, 0, 0);
+			janus_mutex_lock(&st->mutex);
+			lua_getglobal(st->state, "resumeScheduler");
+			lua_call(st->state, 0, 0);
 			/* Print the count of elements into Lua stack */
-			janus_lua_stackdump(lua_state);
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_stackdump(st->state);
+			janus_mutex_unlock(&st->mutex);
 		}
 	}
-	JANUS_LOG(LOG_VERB, "Leaving Lua scheduler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving Lua scheduler thread #%d\n", st->id);
 	return NULL;
 }
 
@@ -2254,8 +2625,9 @@ static gboolean janus_lua_timer_cb(void *data) {
 		return FALSE;
 	/* Invoke the callback with the provided argument, if available */
 	JANUS_LOG(LOG_VERB, "Invoking scheduled callback (waited %"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_state *st = cb->lstate;
+	janus_mutex_lock(&st->mutex);
+	lua_State *t = lua_newthread(st->state);
 	lua_getglobal(t, cb->function);
 	if(cb->argument == NULL) {
 		lua_call(t, 0, 0);
@@ -2263,8 +2635,8 @@ static gboolean janus_lua_timer_cb(void *data) {
 		lua_pushstring(t, cb->argument);
 		lua_call(t, 1, 0);
 	}
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(st->state, 1);
+	janus_mutex_unlock(&st->mutex);
 	/* Done */
 	g_source_destroy(cb->source);
 	g_source_unref(cb->source);
@@ -43,9 +43,18 @@
 extern volatile gint lua_initialized, lua_stopping;
 extern janus_callbacks *janus_core;
 
-/* Lua state: we define state and mutex as extern */
-extern lua_State *lua_state;
-extern janus_mutex lua_mutex;
+/* Lua states: the script can be loaded in more than one, each with its own mutex and scheduler */
+typedef struct janus_lua_state {
+	int id;								/* Index of this state */
+	lua_State *state;					/* The Lua state itself */
+	janus_mutex mutex;					/* Mutex to use whenever we access the state */
+	GThread *scheduler;					/* Scheduler thread, to resume coroutines in this state */
+	GAsyncQueue *events;				/* Queue to wake up the scheduler */
+} janus_lua_state;
+extern janus_lua_state *lua_states;
+extern int lua_states_num;
+/* Helper to find the janus_lua_state a Lua state (or one of its threads) belongs to */
+janus_lua_state *janus_lua_get_state(lua_State *s);
 
 /* Lua session: we keep only the barebone stuff here, the rest will be in the Lua script */
 typedef struct janus_lua_session {
@@ -65,6 +74,9 @@ typedef struct janus_lua_session {
 	GSList *recipients;					/* Sessions that should receive media from this session */
 	struct janus_lua_session *sender;	/* Other session this session is receiving media from */
 	janus_mutex recipients_mutex;		/* Mutex to lock the recipients list */
+	GPtrArray *relay_recipients;		/* Snapshot of the recipients list the media path uses (holds references) */
+	volatile gint rtp_tap;				/* Whether the Lua script gets RTP packets (-1=all, the default, 0=none, N=one every N) */
+	guint32 rtp_tap_count;				/* How many packets we relayed since the last one the Lua script got */
 	janus_recorder *arc;				/* The Janus recorder instance for audio, if enabled */
 	janus_recorder *vrc;				/* The Janus recorder instance for video, if enabled */
 	janus_recorder *drc;				/* The Janus recorder instance for data, if enabled */
@@ -79,6 +91,8 @@ typedef struct janus_lua_session {
 	/* Reference counter */
 	janus_refcount ref;
 } janus_lua_session;
+/* Helper to get the janus_lua_state a session is pinned to */
+janus_lua_state *janus_lua_session_state(janus_lua_session *session);
 extern GHashTable *lua_sessions, *lua_ids;
 extern janus_mutex lua_sessions_mutex;
 janus_lua_session *janus_lua_lookup_session(janus_plugin_session *handle);
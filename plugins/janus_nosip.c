@@ -170,6 +170,7 @@
 #include "../ip-utils.h"
 #include "../sdp-utils.h"
 #include "../utils.h"
+#include "../mediarelay.h"
 
 
 /* Plugin information */
@@ -267,9 +268,11 @@ static char *local_ip = NULL, *sdp_ip = NULL;
 #define DEFAULT_RTP_RANGE_MAX 60000
 static uint16_t rtp_range_min = DEFAULT_RTP_RANGE_MIN;
 static uint16_t rtp_range_max = DEFAULT_RTP_RANGE_MAX;
-static uint16_t rtp_range_slider = DEFAULT_RTP_RANGE_MIN;
+static janus_network_port_pool *port_pool = NULL;
 static int dscp_audio_rtp = 0;
 static int dscp_video_rtp = 0;
+#define JANUS_DEFAULT_RELAY_WORKERS	4
+static int relay_workers = JANUS_DEFAULT_RELAY_WORKERS;
 
 static GThread *handler_thread;
 static void *janus_nosip_handler(void *data);
@@ -315,8 +318,8 @@ typedef struct janus_nosip_media {
 	char *video_srtp_local_profile, *video_srtp_local_crypto;
 	gboolean video_send;
 	janus_rtp_switching_context context;
-	int pipefd[2];
 	gboolean updated;
+	int pollerrs;
 	int video_orientation_extension_id;
 	int audio_level_extension_id;
 } janus_nosip_media;
@@ -331,7 +334,7 @@ typedef struct janus_nosip_session {
 	janus_recorder *vrc;		/* The Janus recorder instance for this user's video, if enabled */
 	janus_recorder *vrc_peer;	/* The Janus recorder instance for the peer's video, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorders from race conditions */
-	GThread *relayer_thread;
+	janus_mediarelay_call *relayer;	/* The session as handled by the media relay worker, if any */
 	volatile gint hangingup;
 	volatile gint destroyed;
 	janus_refcount ref;
@@ -361,6 +364,7 @@ static void janus_nosip_session_free(const janus_refcount *session_ref) {
 	g_free(session->media.remote_video_ip);
 	session->media.remote_video_ip = NULL;
 	janus_nosip_srtp_cleanup(session);
+	janus_mediarelay_call_unref(session->relayer);
 	session->handle = NULL;
 	g_free(session);
 	session = NULL;
@@ -635,8 +639,22 @@ void janus_nosip_sdp_process(janus_nosip_session *session, janus_sdp *sdp, gbool
 char *janus_nosip_sdp_manipulate(janus_nosip_session *session, janus_sdp *sdp, gboolean answer);
 /* Media */
 static int janus_nosip_allocate_local_ports(janus_nosip_session *session, gboolean update);
-static void *janus_nosip_relay_thread(void *data);
 static void janus_nosip_media_cleanup(janus_nosip_session *session);
+static gboolean janus_nosip_relay_start(janus_nosip_session *session);
+static int janus_nosip_relay_prepare(gpointer user_data, int *fds, int max);
+static void janus_nosip_relay_incoming(gpointer user_data, int fd);
+static janus_mediarelay_error_action janus_nosip_relay_error(gpointer user_data, int fd);
+static gboolean janus_nosip_relay_check(gpointer user_data);
+static void janus_nosip_relay_done(gpointer user_data);
+static const janus_mediarelay_callbacks janus_nosip_relay_callbacks = {
+	.prepare = janus_nosip_relay_prepare,
+	.incoming = janus_nosip_relay_incoming,
+	.error = janus_nosip_relay_error,
+	.check = janus_nosip_relay_check,
+	.done = janus_nosip_relay_done,
+};
+/* Shared pool of workers relaying the RTP/RTCP media of all sessions */
+static janus_mediarelay_pool *relay_pool = NULL;
 
 
 /* Error codes */
@@ -738,7 +756,6 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 			}
 			if(rtp_range_max == 0)
 				rtp_range_max = 65535;
-			rtp_range_slider = rtp_range_min;
 			JANUS_LOG(LOG_VERB, "NoSIP RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
 		}
 
@@ -769,6 +786,16 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 			}
 		}
 
+		item = janus_config_get(config, config_general, janus_config_type_item, "relay_workers");
+		if(item && item->value) {
+			int val = atoi(item->value);
+			if(val < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid relay_workers value, using default (%d)\n", JANUS_DEFAULT_RELAY_WORKERS);
+			} else {
+				relay_workers = val;
+			}
+		}
+
 		janus_config_destroy(config);
 	}
 	config = NULL;
@@ -792,6 +819,21 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	gateway = callback;
 
+	/* Ports for RTP/RTCP are taken from a pool, shared with other plugins */
+	port_pool = janus_network_port_pool_new("nosip", rtp_range_min, rtp_range_max);
+	if(port_pool == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
+		return -1;
+	}
+	/* Start the workers that will relay the RTP/RTCP media of sessions */
+	relay_pool = janus_mediarelay_pool_new("nosiprtp", relay_workers);
+	if(relay_pool == NULL) {
+		JANUS_LOG(LOG_ERR, "Couldn't start the NoSIP media relay workers...\n");
+		janus_network_port_pool_destroy(port_pool);
+		port_pool = NULL;
+		return -1;
+	}
+
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
@@ -818,6 +860,11 @@ void janus_nosip_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* Stop relaying media: this gets rid of the sessions that were still in progress */
+	janus_mediarelay_pool_destroy(relay_pool);
+	relay_pool = NULL;
+	janus_network_port_pool_destroy(port_pool);
+	port_pool = NULL;
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -919,8 +966,6 @@ void janus_nosip_create_session(janus_plugin_session *handle, int *error) {
 	session->media.audio_level_extension_id = -1;
 	/* Initialize the RTP context */
 	janus_rtp_switching_context_reset(&session->media.context);
-	session->media.pipefd[0] = -1;
-	session->media.pipefd[1] = -1;
 	session->media.updated = FALSE;
 	session->media.audio_remote_policy.ssrc.type = ssrc_any_inbound;
 	session->media.audio_local_policy.ssrc.type = ssrc_any_inbound;
@@ -1228,16 +1273,10 @@ static void janus_nosip_hangup_media_internal(janus_plugin_session *handle) {
 	if(!g_atomic_int_compare_and_exchange(&session->hangingup, 0, 1))
 		return;
 	session->media.simulcast_ssrc = 0;
-	/* Notify the thread that it's time to go */
-	if(session->media.pipefd[1] > 0) {
-		int code = 1;
-		ssize_t res = 0;
-		do {
-			res = write(session->media.pipefd[1], &code, sizeof(int));
-		} while(res == -1 && errno == EINTR);
-	}
-	/* Do cleanup if media thread has not been created */
-	if(!session->media.ready && !session->relayer_thread) {
+	/* Notify the relay worker that it's time to go */
+	janus_mediarelay_call_stop(session->relayer);
+	/* Do cleanup if media relaying has not been started */
+	if(!session->media.ready && !janus_mediarelay_call_is_active(session->relayer)) {
 		janus_nosip_media_cleanup(session);
 	}
 	/* Get rid of the recorders, if available */
@@ -1460,7 +1499,7 @@ static void *janus_nosip_handler(void *data) {
 				JANUS_LOG(LOG_VERB, "Prepared SDP %s for (%p)\n%s", msg_sdp_type, info, sdp);
 				g_atomic_int_set(&session->hangingup, 0);
 				/* Also notify event handlers */
-				if(!sdp_update && notify_events && gateway->events_is_enabled()) {
+				if(!sdp_update && notify_events && gateway->events_is_wanted(&janus_nosip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("generated"));
 					json_object_set_new(info, "type", json_string(offer ? "offer" : "answer"));
@@ -1513,7 +1552,7 @@ static void *janus_nosip_handler(void *data) {
 				janus_sdp_destroy(session->sdp);
 				session->sdp = parsed_sdp;
 				/* Also notify event handlers */
-				if(!sdp_update && notify_events && gateway->events_is_enabled()) {
+				if(!sdp_update && notify_events && gateway->events_is_wanted(&janus_nosip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("processed"));
 					json_object_set_new(info, "type", json_string(offer ? "offer" : "answer"));
@@ -1535,18 +1574,9 @@ static void *janus_nosip_handler(void *data) {
 			if(!sdp_update && !offer) {
 				/* Start the media */
 				session->media.ready = 1;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "nosiprtp %p", session);
-				janus_refcount_increase(&session->ref);
-				session->relayer_thread = g_thread_try_new(tname, janus_nosip_relay_thread, session, &error);
-				if(error != NULL) {
-					session->relayer_thread = NULL;
+				if(!janus_nosip_relay_start(session)) {
 					session->media.ready = 0;
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
-						error->code, error->message ? error->message : "??");
-					g_error_free(error);
+					JANUS_LOG(LOG_ERR, "Couldn't start relaying the RTP/RTCP media...\n");
 				}
 			}
 		} else if(!strcasecmp(request_text, "hangup")) {
@@ -1866,15 +1896,9 @@ void janus_nosip_sdp_process(janus_nosip_session *session, janus_sdp *sdp, gbool
 		temp = temp->next;
 	}
 	if(update && changed && *changed) {
-		/* Something changed: mark this on the session, so that the thread can update the sockets */
+		/* Something changed: mark this on the session, so that the relay worker can update the sockets */
 		session->media.updated = TRUE;
-		if(session->media.pipefd[1] > 0) {
-			int code = 1;
-			ssize_t res = 0;
-			do {
-				res = write(session->media.pipefd[1], &code, sizeof(int));
-			} while(res == -1 && errno == EINTR);
-		}
+		janus_mediarelay_call_update(session->relayer);
 	}
 }
 
@@ -1946,17 +1970,12 @@ static int janus_nosip_bind_socket(int fd, int port) {
 
 /* Bind RTP/RTCP port pair */
 static int janus_nosip_allocate_port_pair(gboolean video, int fds[2], int ports[2]) {
-	uint16_t rtp_port_next = rtp_range_slider; 					/* Read global slider */
-	uint16_t rtp_port_start = rtp_port_next;
-	gboolean rtp_port_wrap = FALSE;
+	/* If a pair from the pool can't be bound (e.g., some other application
+	 * is using it), we give it back and try the next one, up to the whole range */
+	int attempts = janus_network_port_pool_size(port_pool);
 
 	int rtp_fd = -1, rtcp_fd = -1;
-	while(1) {
-		if(rtp_port_wrap && rtp_port_next >= rtp_port_start) {	/* Full range scanned */
-			JANUS_LOG(LOG_ERR, "No ports available for %s channel in range: %u -- %u\n",
-				  video ? "video" : "audio", rtp_range_min, rtp_range_max);
-			break;
-		}
+	while(attempts-- > 0) {
 		if(rtp_fd == -1) {
 			rtp_fd = socket(AF_INET, SOCK_DGRAM, 0);
 			/* Set the DSCP value if set in the config file */
@@ -1983,27 +2002,26 @@ static int janus_nosip_allocate_port_pair(gboolean video, int fds[2], int ports[
 			JANUS_LOG(LOG_ERR, "Error creating %s sockets...\n", video ? "video" : "audio");
 			break;
 		}
-	 	int rtp_port = rtp_port_next;
-		int rtcp_port = rtp_port+1;
-		if((uint32_t)(rtp_port_next + 2UL) < rtp_range_max) {
-			/* Advance to next pair */
-			rtp_port_next += 2;
-		} else {
-			rtp_port_next = rtp_range_min;
-			rtp_port_wrap = TRUE;
+		int rtp_port = janus_network_port_pool_get(port_pool);
+		if(rtp_port < 0) {
+			JANUS_LOG(LOG_ERR, "No ports available for %s channel in range: %u -- %u\n",
+				  video ? "video" : "audio", rtp_range_min, rtp_range_max);
+			break;
 		}
+		int rtcp_port = rtp_port+1;
 		if(janus_nosip_bind_socket(rtp_fd, rtp_port)) {
 			/* rtp_fd still unbound, reuse it */
+			janus_network_port_pool_release(port_pool, rtp_port);
 		} else if(janus_nosip_bind_socket(rtcp_fd, rtcp_port)) {
 			close(rtp_fd);
 			rtp_fd = -1;
 			/* rtcp_fd still unbound, reuse it */
+			janus_network_port_pool_release(port_pool, rtp_port);
 		} else {
 			fds[0] = rtp_fd;
 			fds[1] = rtcp_fd;
 			ports[0] = rtp_port;
 			ports[1] = rtcp_port;
-			rtp_range_slider = rtp_port_next;		/* Write global slider */
 			return 0;
 		}
 	}
@@ -2031,6 +2049,7 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session, gboole
 			close(session->media.audio_rtcp_fd);
 			session->media.audio_rtcp_fd = -1;
 		}
+		janus_network_port_pool_release(port_pool, session->media.local_audio_rtp_port);
 		session->media.local_audio_rtp_port = 0;
 		session->media.local_audio_rtcp_port = 0;
 		session->media.audio_ssrc = 0;
@@ -2042,17 +2061,10 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session, gboole
 			close(session->media.video_rtcp_fd);
 			session->media.video_rtcp_fd = -1;
 		}
+		janus_network_port_pool_release(port_pool, session->media.local_video_rtp_port);
 		session->media.local_video_rtp_port = 0;
 		session->media.local_video_rtcp_port = 0;
 		session->media.video_ssrc = 0;
-		if(session->media.pipefd[0] > 0) {
-			close(session->media.pipefd[0]);
-			session->media.pipefd[0] = -1;
-		}
-		if(session->media.pipefd[1] > 0) {
-			close(session->media.pipefd[1]);
-			session->media.pipefd[1] = -1;
-		}
 	}
 	/* Start */
 	if(session->media.has_audio &&
@@ -2103,19 +2115,10 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session, gboole
 		session->media.local_video_rtp_port = ports[0];
 		session->media.local_video_rtcp_port = ports[1];
 	}
-	/* We need this to quickly interrupt the poll when it's time to update a session or wrap up */
-	if(!update) {
-		pipe(session->media.pipefd);
-	} else {
-		/* Something changed: mark this on the session, so that the thread can update the sockets */
+	if(update) {
+		/* Something changed: mark this on the session, so that the relay worker can update the sockets */
 		session->media.updated = TRUE;
-		if(session->media.pipefd[1] > 0) {
-			int code = 1;
-			ssize_t res = 0;
-			do {
-				res = write(session->media.pipefd[1], &code, sizeof(int));
-			} while(res == -1 && errno == EINTR);
-		}
+		janus_mediarelay_call_update(session->relayer);
 	}
 	return 0;
 }
@@ -2170,6 +2173,7 @@ static void janus_nosip_media_cleanup(janus_nosip_session *session) {
 		close(session->media.audio_rtcp_fd);
 		session->media.audio_rtcp_fd = -1;
 	}
+	janus_network_port_pool_release(port_pool, session->media.local_audio_rtp_port);
 	session->media.local_audio_rtp_port = 0;
 	session->media.local_audio_rtcp_port = 0;
 	session->media.remote_audio_rtp_port = 0;
@@ -2184,6 +2188,7 @@ static void janus_nosip_media_cleanup(janus_nosip_session *session) {
 		close(session->media.video_rtcp_fd);
 		session->media.video_rtcp_fd = -1;
 	}
+	janus_network_port_pool_release(port_pool, session->media.local_video_rtp_port);
 	session->media.local_video_rtp_port = 0;
 	session->media.local_video_rtcp_port = 0;
 	session->media.remote_video_rtp_port = 0;
@@ -2191,14 +2196,6 @@ static void janus_nosip_media_cleanup(janus_nosip_session *session) {
 	session->media.video_ssrc = 0;
 	session->media.video_ssrc_peer = 0;
 	session->media.simulcast_ssrc = 0;
-	if(session->media.pipefd[0] > 0) {
-		close(session->media.pipefd[0]);
-		session->media.pipefd[0] = -1;
-	}
-	if(session->media.pipefd[1] > 0) {
-		close(session->media.pipefd[1]);
-		session->media.pipefd[1] = -1;
-	}
 	/* Clean up SRTP stuff, if needed */
 	janus_nosip_srtp_cleanup(session);
 
@@ -2206,288 +2203,243 @@ static void janus_nosip_media_cleanup(janus_nosip_session *session) {
 	janus_nosip_media_reset(session);
 }
 
-/* Thread to relay RTP/RTCP frames coming from the peer */
-static void *janus_nosip_relay_thread(void *data) {
-	janus_nosip_session *session = (janus_nosip_session *)data;
-	if(!session) {
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* Media relay callbacks: one of the workers in the pool reads the RTP/RTCP frames coming from the peer */
+static gboolean janus_nosip_relay_start(janus_nosip_session *session) {
+	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Starting relaying media\n", session);
+	/* Get rid of the reference to the previous session, if any */
+	janus_mediarelay_call_unref(session->relayer);
+	session->media.pollerrs = 0;
+	janus_refcount_increase(&session->ref);
+	session->relayer = janus_mediarelay_call_add(relay_pool, &janus_nosip_relay_callbacks, session);
+	if(session->relayer == NULL) {
+		janus_refcount_decrease(&session->ref);
+		return FALSE;
 	}
-	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Starting relay thread\n", session);
+	return TRUE;
+}
 
-	/* File descriptors */
-	socklen_t addrlen;
-	struct sockaddr_in remote = { 0 };
-	int resfd = 0, bytes = 0, pollerrs = 0;
-	struct pollfd fds[5];
-	int pipe_fd = session->media.pipefd[0];
-	char buffer[1500];
-	memset(buffer, 0, 1500);
-	/* Loop */
-	int num = 0;
-	gboolean goon = TRUE;
-
-	session->media.updated = TRUE; /* Connect UDP sockets upon loop entry */
-	gboolean have_audio_server_ip = TRUE;
-	gboolean have_video_server_ip = TRUE;
-
-	while(goon && session != NULL &&
-			!g_atomic_int_get(&session->destroyed) && !g_atomic_int_get(&session->hangingup)) {
-
-		if(session->media.updated) {
-			/* Apparently there was a session update, or the loop has just been entered */
-			session->media.updated = FALSE;
-
-			have_audio_server_ip = session->media.remote_audio_ip != NULL;
-			struct sockaddr_in audio_server_addr = { 0 };
-			memset(&audio_server_addr, 0, sizeof(struct sockaddr_in));
-			audio_server_addr.sin_family = AF_INET;
-
-			have_video_server_ip = session->media.remote_video_ip != NULL;
-			struct sockaddr_in video_server_addr = { 0 };
-			memset(&video_server_addr, 0, sizeof(struct sockaddr_in));
-			video_server_addr.sin_family = AF_INET;
-
-			if(session->media.remote_audio_ip && inet_aton(session->media.remote_audio_ip, &audio_server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
-				/* Note that gethostbyname() may block waiting for response if it triggers on the wire request.*/
-				struct hostent *host = gethostbyname(session->media.remote_audio_ip);	/* ...resolve name */
-				if(!host) {
-					JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't get host (%s)\n", session, session->media.remote_audio_ip);
-					have_audio_server_ip = FALSE;
-				} else {
-					audio_server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
-				}
-			}
+static int janus_nosip_relay_prepare(gpointer user_data, int *fds, int max) {
+	janus_nosip_session *session = (janus_nosip_session *)user_data;
+	/* Apparently there was a session update, or we've just been added to a worker */
+	session->media.updated = FALSE;
 
-			if(session->media.remote_video_ip && inet_aton(session->media.remote_video_ip, &video_server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
-				/* Note that gethostbyname() may block waiting for response if it triggers on the wire request.*/
-				struct hostent *host = gethostbyname(session->media.remote_audio_ip);	/* ...resolve name */
-				if(!host) {
-					JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't get host (%s)\n", session, session->media.remote_video_ip);
-					have_video_server_ip = FALSE;
-				} else {
-					video_server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
-				}
-			}
+	gboolean have_audio_server_ip = session->media.remote_audio_ip != NULL;
+	struct sockaddr_in audio_server_addr = { 0 };
+	memset(&audio_server_addr, 0, sizeof(struct sockaddr_in));
+	audio_server_addr.sin_family = AF_INET;
+
+	gboolean have_video_server_ip = session->media.remote_video_ip != NULL;
+	struct sockaddr_in video_server_addr = { 0 };
+	memset(&video_server_addr, 0, sizeof(struct sockaddr_in));
+	video_server_addr.sin_family = AF_INET;
+
+	if(session->media.remote_audio_ip && inet_aton(session->media.remote_audio_ip, &audio_server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
+		/* Note that gethostbyname() may block waiting for response if it triggers on the wire request,
+		 * which would delay the media of all the other sessions handled by the same worker */
+		struct hostent *host = gethostbyname(session->media.remote_audio_ip);	/* ...resolve name */
+		if(!host) {
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't get host (%s)\n", session, session->media.remote_audio_ip);
+			have_audio_server_ip = FALSE;
+		} else {
+			audio_server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
+		}
+	}
 
-			if(have_audio_server_ip || have_video_server_ip) {
-				janus_nosip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
-					have_video_server_ip ? &video_server_addr : NULL);
-			} else if (session->media.remote_audio_ip == NULL &&  session->media.remote_video_ip == NULL) {
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n", session);
-			} else {
-				if (session->media.remote_audio_ip)
-					JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
-						session, session->media.remote_audio_ip);
-				if (session->media.remote_video_ip)
-					JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
-						session, session->media.remote_video_ip);
-			}
+	if(session->media.remote_video_ip && inet_aton(session->media.remote_video_ip, &video_server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
+		/* Same considerations as above on gethostbyname() */
+		struct hostent *host = gethostbyname(session->media.remote_audio_ip);	/* ...resolve name */
+		if(!host) {
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't get host (%s)\n", session, session->media.remote_video_ip);
+			have_video_server_ip = FALSE;
+		} else {
+			video_server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
 		}
+	}
 
-		/* Prepare poll */
-		num = 0;
-		if(session->media.audio_rtp_fd != -1) {
-			fds[num].fd = session->media.audio_rtp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+	if(have_audio_server_ip || have_video_server_ip) {
+		janus_nosip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
+			have_video_server_ip ? &video_server_addr : NULL);
+	} else if (session->media.remote_audio_ip == NULL &&  session->media.remote_video_ip == NULL) {
+		JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n", session);
+	} else {
+		if (session->media.remote_audio_ip)
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
+				session, session->media.remote_audio_ip);
+		if (session->media.remote_video_ip)
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
+				session, session->media.remote_video_ip);
+	}
+
+	/* Tell the worker which sockets to watch */
+	int media_fds[4] = {
+		session->media.audio_rtp_fd, session->media.audio_rtcp_fd,
+		session->media.video_rtp_fd, session->media.video_rtcp_fd
+	};
+	int i = 0, num = 0;
+	for(i=0; i<4 && num<max; i++) {
+		if(media_fds[i] != -1)
+			fds[num++] = media_fds[i];
+	}
+	return num;
+}
+
+static void janus_nosip_relay_incoming(gpointer user_data, int fd) {
+	janus_nosip_session *session = (janus_nosip_session *)user_data;
+	if(g_atomic_int_get(&session->destroyed))
+		return;
+	socklen_t addrlen;
+	struct sockaddr_in remote = { 0 };
+	char buffer[1500];
+	/* Got an RTP/RTCP packet */
+	addrlen = sizeof(remote);
+	int bytes = recvfrom(fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
+	if(bytes < 0) {
+		/* Failed to read? */
+		return;
+	}
+	/* Let's check what this is */
+	gboolean video = fd == session->media.video_rtp_fd || fd == session->media.video_rtcp_fd;
+	gboolean rtcp = fd == session->media.audio_rtcp_fd || fd == session->media.video_rtcp_fd;
+	if(!rtcp) {
+		/* Audio or Video RTP */
+		if(!janus_is_rtp(buffer, bytes)) {
+			/* Not an RTP packet? */
+			return;
 		}
-		if(session->media.audio_rtcp_fd != -1) {
-			fds[num].fd = session->media.audio_rtcp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		session->media.pollerrs = 0;
+		rtp_header *header = (rtp_header *)buffer;
+		if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
+				(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
+			if(video) {
+				session->media.video_ssrc_peer = ntohl(header->ssrc);
+			} else {
+				session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			}
+			JANUS_LOG(LOG_VERB, "[NoSIP-%p] Got SIP peer %s SSRC: %"SCNu32"\n",
+				session, video ? "video" : "audio", session->media.audio_ssrc_peer);
 		}
-		if(session->media.video_rtp_fd != -1) {
-			fds[num].fd = session->media.video_rtp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
 		}
-		if(session->media.video_rtcp_fd != -1) {
-			fds[num].fd = session->media.video_rtcp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.context, video, 0);
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
+		/* Relay to browser */
+		janus_plugin_rtp rtp = { .video = video, .buffer = buffer, .length = bytes };
+		/* Add audio-level extension, if present */
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		if(!video && session->media.audio_level_extension_id != -1) {
+			gboolean vad = FALSE;
+			int level = -1;
+			if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
+					session->media.audio_level_extension_id, &vad, &level) == 0) {
+				rtp.extensions.audio_level = level;
+				rtp.extensions.audio_level_vad = vad;
+			}
+		} else if(video && session->media.video_orientation_extension_id > 0) {
+			gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
+			if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
+					session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
+				rtp.extensions.video_rotation = 0;
+				if(r1 && r0)
+					rtp.extensions.video_rotation = 270;
+				else if(r1)
+					rtp.extensions.video_rotation = 180;
+				else if(r0)
+					rtp.extensions.video_rotation = 90;
+				rtp.extensions.video_back_camera = c;
+				rtp.extensions.video_flipped = f;
+			}
 		}
-		if(pipe_fd != -1) {
-			fds[num].fd = pipe_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		gateway->relay_rtp(session->handle, &rtp);
+	} else {
+		/* Audio or Video RTCP */
+		if(!janus_is_rtcp(buffer, bytes)) {
+			/* Not an RTCP packet? */
+			return;
 		}
-		/* Wait for some data */
-		resfd = poll(fds, num, 1000);
-		if(resfd < 0) {
-			if(errno == EINTR) {
-				JANUS_LOG(LOG_HUGE, "[NoSIP-%p] Got an EINTR (%s), ignoring...\n", session, strerror(errno));
-				continue;
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
+				return;
 			}
-			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Error polling...\n", session);
-			JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, errno, strerror(errno));
-			break;
-		} else if(resfd == 0) {
-			/* No data, keep going */
-			continue;
+			bytes = buflen;
 		}
-		if(session == NULL || g_atomic_int_get(&session->destroyed))
-			break;
-		int i = 0;
-		for(i=0; i<num; i++) {
-			if(fds[i].revents & (POLLERR | POLLHUP)) {
-				/* If we just updated the session, let's wait until things have calmed down */
-				if(session->media.updated)
-					break;
-				/* Check the socket error */
-				int error = 0;
-				socklen_t errlen = sizeof(error);
-				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the audio RTCP socket, closing it\n",
-							session, strerror(error));
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the video RTCP socket, closing it\n",
-							session, strerror(error));
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-					}
-				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Too many errors polling %d (socket #%d): %s...\n", session,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, error, strerror(error));
-				/* Can we assume it's pretty much over, after a POLLERR? */
-				goon = FALSE;
-				/* FIXME Close the PeerConnection */
-				gateway->close_pc(session->handle);
-				break;
-			} else if(fds[i].revents & POLLIN) {
-				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
-					/* Poll interrupted for a reason, go on */
-					int code = 0;
-					(void)read(pipe_fd, &code, sizeof(int));
-					break;
-				}
-				/* Got an RTP/RTCP packet */
-				addrlen = sizeof(remote);
-				bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-				if(bytes < 0) {
-					/* Failed to read? */
-					continue;
-				}
-				/* Let's check what this is */
-				gboolean video = fds[i].fd == session->media.video_rtp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				gboolean rtcp = fds[i].fd == session->media.audio_rtcp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				if(!rtcp) {
-					/* Audio or Video RTP */
-					if(!janus_is_rtp(buffer, bytes)) {
-						/* Not an RTP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					rtp_header *header = (rtp_header *)buffer;
-					if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
-							(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
-						if(video) {
-							session->media.video_ssrc_peer = ntohl(header->ssrc);
-						} else {
-							session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						}
-						JANUS_LOG(LOG_VERB, "[NoSIP-%p] Got SIP peer %s SSRC: %"SCNu32"\n",
-							session, video ? "video" : "audio", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.context, video, 0);
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
-					/* Relay to browser */
-					janus_plugin_rtp rtp = { .video = video, .buffer = buffer, .length = bytes };
-					/* Add audio-level extension, if present */
-					janus_plugin_rtp_extensions_reset(&rtp.extensions);
-					if(!video && session->media.audio_level_extension_id != -1) {
-						gboolean vad = FALSE;
-						int level = -1;
-						if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
-								session->media.audio_level_extension_id, &vad, &level) == 0) {
-							rtp.extensions.audio_level = level;
-							rtp.extensions.audio_level_vad = vad;
-						}
-					} else if(video && session->media.video_orientation_extension_id > 0) {
-						gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
-						if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
-								session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
-							rtp.extensions.video_rotation = 0;
-							if(r1 && r0)
-								rtp.extensions.video_rotation = 270;
-							else if(r1)
-								rtp.extensions.video_rotation = 180;
-							else if(r0)
-								rtp.extensions.video_rotation = 90;
-							rtp.extensions.video_back_camera = c;
-							rtp.extensions.video_flipped = f;
-						}
-					}
-					gateway->relay_rtp(session->handle, &rtp);
-					continue;
-				} else {
-					/* Audio or Video RTCP */
-					if(!janus_is_rtcp(buffer, bytes)) {
-						/* Not an RTCP packet? */
-						continue;
-					}
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					janus_plugin_rtcp rtcp = { .video = video, .buffer = buffer, bytes };
-					gateway->relay_rtcp(session->handle, &rtcp);
-					continue;
-				}
-			}
+		/* Relay to browser */
+		janus_plugin_rtcp rtcp = { .video = video, .buffer = buffer, bytes };
+		gateway->relay_rtcp(session->handle, &rtcp);
+	}
+}
+
+static janus_mediarelay_error_action janus_nosip_relay_error(gpointer user_data, int fd) {
+	janus_nosip_session *session = (janus_nosip_session *)user_data;
+	/* If we just updated the session, let's wait until things have calmed down */
+	if(session->media.updated)
+		return janus_mediarelay_error_ignore;
+	/* Check the socket error */
+	int error = 0;
+	socklen_t errlen = sizeof(error);
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return janus_mediarelay_error_ignore;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(fd == session->media.audio_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the audio RTCP socket, closing it\n",
+				session, strerror(error));
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			return janus_mediarelay_error_closed;
+		} else if(fd == session->media.video_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the video RTCP socket, closing it\n",
+				session, strerror(error));
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			return janus_mediarelay_error_closed;
 		}
 	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.pollerrs++;
+	if(session->media.pollerrs < 100)
+		return janus_mediarelay_error_ignore;
+	JANUS_LOG(LOG_ERR, "[NoSIP-%p] Too many errors on socket %d...\n", session, fd);
+	JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, error, strerror(error));
+	/* Can we assume it's pretty much over, after a POLLERR? */
+	/* FIXME Close the PeerConnection */
+	gateway->close_pc(session->handle);
+	return janus_mediarelay_error_hangup;
+}
+
+static gboolean janus_nosip_relay_check(gpointer user_data) {
+	janus_nosip_session *session = (janus_nosip_session *)user_data;
+	return !g_atomic_int_get(&session->destroyed) && !g_atomic_int_get(&session->hangingup);
+}
+
+static void janus_nosip_relay_done(gpointer user_data) {
+	janus_nosip_session *session = (janus_nosip_session *)user_data;
 	/* Cleanup the media session */
 	janus_nosip_media_cleanup(session);
 	/* Done */
-	JANUS_LOG(LOG_INFO, "Leaving NoSIP relay thread\n");
-	session->relayer_thread = NULL;
+	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Done relaying media\n", session);
 	janus_refcount_decrease(&session->ref);
-	g_thread_unref(g_thread_self());
-	return NULL;
 }
 
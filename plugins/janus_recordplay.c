@@ -53,7 +53,13 @@
  * get a response directly within the context of the transaction. \c list
  * lists all the available recordings, while \c update forces the plugin
  * to scan the folder of recordings again in case some were added manually
- * and not indexed in the meanwhile.
+ * and not indexed in the meanwhile. Only the .nfo files that were added
+ * or modified since the previous scan are actually parsed (possibly by
+ * multiple threads, see \c scan_threads in the configuration file), and
+ * if you set \c catalog to \c true what was found in them is saved to
+ * a \c .recordplay-catalog.json file in the same folder, so that even
+ * restarting the plugin with many recordings around doesn't mean parsing
+ * all of them again.
  *
  * The \c record , \c play , \c start and \c stop requests instead are
  * all asynchronous, which means you'll get a notification about their
@@ -260,7 +266,10 @@
 #include "plugin.h"
 
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <jansson.h>
@@ -392,6 +401,21 @@ typedef struct janus_recordplay_frame_packet {
 } janus_recordplay_frame_packet;
 janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename);
 
+/* Recordings are memory-mapped and indexed only once, the first time they're
+ * played: all the viewers of the same recording then share both the mapping
+ * and the index, and packets are copied from there rather than read from disk */
+typedef struct janus_recordplay_media {
+	char *path;								/* Path of the .mjr file */
+	char *data;								/* Memory-mapped file contents */
+	size_t size;							/* Size of the mapping */
+	janus_recordplay_frame_packet *frames;	/* Index of the packets in the file */
+	janus_refcount ref;						/* Reference counter */
+} janus_recordplay_media;
+static janus_recordplay_media *janus_recordplay_media_create(const char *dir, const char *filename);
+static void janus_recordplay_media_free(const janus_refcount *media_ref);
+static int janus_recordplay_media_read(janus_recordplay_media *media,
+	janus_recordplay_frame_packet *frame, char *buffer, int size);
+
 typedef struct janus_recordplay_recording {
 	guint64 id;					/* Recording unique ID */
 	char *name;					/* Name of the recording */
@@ -405,6 +429,8 @@ typedef struct janus_recordplay_recording {
 	char *vfmtp;				/* Video fmtp, if any */
 	int video_pt;				/* Payload types to use for audio when playing recordings */
 	char *offer;				/* The SDP offer that will be sent to watchers */
+	janus_recordplay_media *amedia;	/* Mapped and indexed audio file, once played */
+	janus_recordplay_media *vmedia;	/* Mapped and indexed video file, once played */
 	gboolean e2ee;				/* Whether media in the recording is encrypted, e.g., using Insertable Streams */
 	GList *viewers;				/* List of users watching this recording */
 	volatile gint completed;	/* Whether this recording was completed or still going on */
@@ -415,6 +441,46 @@ typedef struct janus_recordplay_recording {
 static GHashTable *recordings = NULL;
 static janus_mutex recordings_mutex = JANUS_MUTEX_INITIALIZER;
 
+/* Catalog of the .nfo files we've scanned already, and what we found in
+ * them: this way, updating the list of recordings only means parsing the
+ * .nfo files (and .mjr headers) that were added or modified since then */
+typedef struct janus_recordplay_catalog_entry {
+	char *nfo;					/* Name of the .nfo file */
+	gint64 mtime;				/* Modification time of the .nfo file, when we parsed it */
+	gint64 size;				/* Size of the .nfo file, when we parsed it */
+	guint64 id;					/* Recording unique ID (0 if the .nfo file is not valid) */
+	char *name;					/* Name of the recording */
+	char *date;					/* Time of the recording */
+	char *arc_file;				/* Audio file name, if any */
+	char *acodec;				/* Audio codec, if any */
+	char *afmtp;				/* Audio fmtp, if any */
+	char *vrc_file;				/* Video file name, if any */
+	char *vcodec;				/* Video codec, if any */
+	char *vfmtp;				/* Video fmtp, if any */
+	gboolean e2ee;				/* Whether media in the recording is encrypted */
+} janus_recordplay_catalog_entry;
+static void janus_recordplay_catalog_entry_free(janus_recordplay_catalog_entry *entry) {
+	if(entry == NULL)
+		return;
+	g_free(entry->nfo);
+	g_free(entry->name);
+	g_free(entry->date);
+	g_free(entry->arc_file);
+	g_free(entry->acodec);
+	g_free(entry->afmtp);
+	g_free(entry->vrc_file);
+	g_free(entry->vcodec);
+	g_free(entry->vfmtp);
+	g_free(entry);
+}
+static GHashTable *catalog = NULL;
+static janus_mutex catalog_mutex = JANUS_MUTEX_INITIALIZER;
+/* Name of the file the catalog is saved to in the recordings folder, if persistent */
+#define JANUS_RECORDPLAY_CATALOG	".recordplay-catalog.json"
+static gboolean catalog_persistent = FALSE;
+/* How many threads to parse new .nfo files with */
+static int scan_threads = 1;
+
 typedef struct janus_recordplay_session {
 	janus_plugin_session *handle;
 	gint64 sdp_sessid;
@@ -427,8 +493,10 @@ typedef struct janus_recordplay_session {
 	janus_recorder *arc;	/* Audio recorder */
 	janus_recorder *vrc;	/* Video recorder */
 	janus_mutex rec_mutex;	/* Mutex to protect the recorders from race conditions */
-	janus_recordplay_frame_packet *aframes;	/* Audio frames (for playout) */
-	janus_recordplay_frame_packet *vframes;	/* Video frames (for playout) */
+	janus_recordplay_media *amedia;			/* Audio file, mapped (for playout) */
+	janus_recordplay_media *vmedia;			/* Video file, mapped (for playout) */
+	janus_recordplay_frame_packet *aframes;	/* Audio frames (for playout, owned by amedia) */
+	janus_recordplay_frame_packet *vframes;	/* Video frames (for playout, owned by vmedia) */
 	guint video_remb_startup;
 	gint64 video_remb_last;
 	guint32 video_bitrate;
@@ -458,6 +526,10 @@ static void janus_recordplay_session_free(const janus_refcount *session_ref) {
 	/* Remove the reference to the core plugin session */
 	janus_refcount_decrease(&session->handle->ref);
 	/* This session can be destroyed, free all the resources */
+	if(session->amedia)
+		janus_refcount_decrease(&session->amedia->ref);
+	if(session->vmedia)
+		janus_refcount_decrease(&session->vmedia->ref);
 	g_free(session->video_profile);
 	g_free(session);
 }
@@ -478,6 +550,10 @@ static void janus_recordplay_recording_free(const janus_refcount *recording_ref)
 	g_free(recording->afmtp);
 	g_free(recording->vfmtp);
 	g_free(recording->offer);
+	if(recording->amedia)
+		janus_refcount_decrease(&recording->amedia->ref);
+	if(recording->vmedia)
+		janus_refcount_decrease(&recording->vmedia->ref);
 	g_free(recording);
 }
 
@@ -741,6 +817,17 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_RECORDPLAY_NAME);
 		}
+		janus_config_item *persist = janus_config_get(config, config_general, janus_config_type_item, "catalog");
+		if(persist != NULL && persist->value != NULL)
+			catalog_persistent = janus_is_true(persist->value);
+		janus_config_item *threads = janus_config_get(config, config_general, janus_config_type_item, "scan_threads");
+		if(threads != NULL && threads->value != NULL) {
+			scan_threads = atoi(threads->value);
+			if(scan_threads < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid number of scanning threads %d, using 1\n", scan_threads);
+				scan_threads = 1;
+			}
+		}
 		/* Done */
 		janus_config_destroy(config);
 		config = NULL;
@@ -800,6 +887,11 @@ void janus_recordplay_destroy(void) {
 	g_hash_table_destroy(recordings);
 	recordings = NULL;
 	janus_mutex_unlock(&sessions_mutex);
+	janus_mutex_lock(&catalog_mutex);
+	if(catalog != NULL)
+		g_hash_table_destroy(catalog);
+	catalog = NULL;
+	janus_mutex_unlock(&catalog_mutex);
 	g_async_queue_unref(messages);
 	messages = NULL;
 	g_atomic_int_set(&initialized, 0);
@@ -1713,7 +1805,7 @@ recdone:
 			json_object_set_new(result, "status", json_string("recording"));
 			json_object_set_new(result, "id", json_integer(id));
 			/* Also notify event handlers */
-			if(!sdp_update && notify_events && gateway->events_is_enabled()) {
+			if(!sdp_update && notify_events && gateway->events_is_wanted(&janus_recordplay_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("recording"));
 				json_object_set_new(info, "id", json_integer(id));
@@ -1786,16 +1878,38 @@ recdone:
 				g_snprintf(error_cause, 512, "No such recording");
 				goto error;
 			}
-			/* Access the frames */
+			/* Access the frames: the files are only mapped and indexed the first time */
+			if(session->amedia)
+				janus_refcount_decrease(&session->amedia->ref);
+			if(session->vmedia)
+				janus_refcount_decrease(&session->vmedia->ref);
+			session->amedia = NULL;
+			session->vmedia = NULL;
+			session->aframes = NULL;
+			session->vframes = NULL;
+			janus_mutex_lock(&rec->mutex);
+			if(rec->arc_file && rec->amedia == NULL)
+				rec->amedia = janus_recordplay_media_create(recordings_path, rec->arc_file);
+			if(rec->vrc_file && rec->vmedia == NULL)
+				rec->vmedia = janus_recordplay_media_create(recordings_path, rec->vrc_file);
+			if(rec->amedia) {
+				janus_refcount_increase(&rec->amedia->ref);
+				session->amedia = rec->amedia;
+				session->aframes = rec->amedia->frames;
+			}
+			if(rec->vmedia) {
+				janus_refcount_increase(&rec->vmedia->ref);
+				session->vmedia = rec->vmedia;
+				session->vframes = rec->vmedia->frames;
+			}
+			janus_mutex_unlock(&rec->mutex);
 			if(rec->arc_file) {
-				session->aframes = janus_recordplay_get_frames(recordings_path, rec->arc_file);
 				if(session->aframes == NULL) {
 					JANUS_LOG(LOG_WARN, "Error opening audio recording, trying to go on anyway\n");
 					warning = "Broken audio file, playing video only";
 				}
 			}
 			if(rec->vrc_file) {
-				session->vframes = janus_recordplay_get_frames(recordings_path, rec->vrc_file);
 				if(session->vframes == NULL) {
 					JANUS_LOG(LOG_WARN, "Error opening video recording, trying to go on anyway\n");
 					warning = "Broken video file, playing audio only";
@@ -1821,7 +1935,7 @@ playdone:
 			if(warning)
 				json_object_set_new(result, "warning", json_string(warning));
 			/* Also notify event handlers */
-			if(!sdp_update && notify_events && gateway->events_is_enabled()) {
+			if(!sdp_update && notify_events && gateway->events_is_wanted(&janus_recordplay_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("playout"));
 				json_object_set_new(info, "id", json_integer(id_value));
@@ -1847,7 +1961,7 @@ playdone:
 			result = json_object();
 			json_object_set_new(result, "status", json_string("playing"));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_recordplay_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("playing"));
 				json_object_set_new(info, "id", json_integer(session->recording->id));
@@ -1860,7 +1974,7 @@ playdone:
 			if(session->recording) {
 				json_object_set_new(result, "id", json_integer(session->recording->id));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_recordplay_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("stopped"));
 					if(session->recording)
@@ -1923,167 +2037,450 @@ error:
 	return NULL;
 }
 
+/* Helper to parse a .nfo file, and the headers of the .mjr files it
+ * refers to: this may be called by different threads at the same time */
+static void janus_recordplay_catalog_scan(gpointer data, gpointer user_data) {
+	janus_recordplay_catalog_entry *entry = (janus_recordplay_catalog_entry *)data;
+	JANUS_LOG(LOG_VERB, "Importing recording '%s'...\n", entry->nfo);
+	char recpath[1024];
+	g_snprintf(recpath, 1024, "%s/%s", recordings_path, entry->nfo);
+	janus_config *nfo = janus_config_parse(recpath);
+	if(nfo == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid recording '%s'...\n", entry->nfo);
+		return;
+	}
+	GList *cl = janus_config_get_categories(nfo, NULL);
+	if(cl == NULL || cl->data == NULL) {
+		JANUS_LOG(LOG_WARN, "No recording info in '%s', skipping...\n", entry->nfo);
+		janus_config_destroy(nfo);
+		return;
+	}
+	janus_config_category *cat = (janus_config_category *)cl->data;
+	guint64 id = g_ascii_strtoull(cat->name, NULL, 0);
+	if(id == 0) {
+		JANUS_LOG(LOG_WARN, "Invalid ID, skipping...\n");
+		g_list_free(cl);
+		janus_config_destroy(nfo);
+		return;
+	}
+	janus_config_item *name = janus_config_get(nfo, cat, janus_config_type_item, "name");
+	janus_config_item *date = janus_config_get(nfo, cat, janus_config_type_item, "date");
+	janus_config_item *audio = janus_config_get(nfo, cat, janus_config_type_item, "audio");
+	janus_config_item *video = janus_config_get(nfo, cat, janus_config_type_item, "video");
+	g_list_free(cl);
+	if(!name || !name->value || strlen(name->value) == 0 || !date || !date->value || strlen(date->value) == 0) {
+		JANUS_LOG(LOG_WARN, "Invalid info for recording %"SCNu64", skipping...\n", id);
+		janus_config_destroy(nfo);
+		return;
+	}
+	if((!audio || !audio->value) && (!video || !video->value)) {
+		JANUS_LOG(LOG_WARN, "No audio and no video in recording %"SCNu64", skipping...\n", id);
+		janus_config_destroy(nfo);
+		return;
+	}
+	entry->name = g_strdup(name->value);
+	entry->date = g_strdup(date->value);
+	gboolean e2ee = FALSE;
+	char fmtp[256];
+	if(audio && audio->value) {
+		entry->arc_file = g_strdup(audio->value);
+		char *ext = strstr(entry->arc_file, ".mjr");
+		if(ext != NULL)
+			*ext = '\0';
+		/* Check which codec is in this recording (and if it's end-to-end encrypted) */
+		fmtp[0] = '\0';
+		entry->acodec = g_strdup(janus_recordplay_parse_codec(recordings_path,
+			entry->arc_file, fmtp, sizeof(fmtp), &e2ee));
+		if(strlen(fmtp) > 0)
+			entry->afmtp = g_strdup(fmtp);
+		if(e2ee)
+			entry->e2ee = TRUE;
+	}
+	if(video && video->value) {
+		entry->vrc_file = g_strdup(video->value);
+		char *ext = strstr(entry->vrc_file, ".mjr");
+		if(ext != NULL)
+			*ext = '\0';
+		/* Check which codec is in this recording (and if it's end-to-end encrypted) */
+		fmtp[0] = '\0';
+		entry->vcodec = g_strdup(janus_recordplay_parse_codec(recordings_path,
+			entry->vrc_file, fmtp, sizeof(fmtp), &e2ee));
+		if(strlen(fmtp) > 0)
+			entry->vfmtp = g_strdup(fmtp);
+		if(e2ee)
+			entry->e2ee = TRUE;
+	}
+	janus_config_destroy(nfo);
+	/* Done, mark the entry as valid */
+	entry->id = id;
+}
+
+/* Helper to create a recording instance out of an entry in the catalog */
+static janus_recordplay_recording *janus_recordplay_recording_from_entry(janus_recordplay_catalog_entry *entry) {
+	janus_recordplay_recording *rec = g_malloc0(sizeof(janus_recordplay_recording));
+	rec->id = entry->id;
+	rec->name = g_strdup(entry->name);
+	rec->date = g_strdup(entry->date);
+	rec->arc_file = g_strdup(entry->arc_file);
+	if(entry->arc_file)
+		rec->acodec = janus_audiocodec_from_name(entry->acodec);
+	rec->afmtp = g_strdup(entry->afmtp);
+	rec->vrc_file = g_strdup(entry->vrc_file);
+	if(entry->vrc_file)
+		rec->vcodec = janus_videocodec_from_name(entry->vcodec);
+	rec->vfmtp = g_strdup(entry->vfmtp);
+	rec->e2ee = entry->e2ee;
+	rec->audio_pt = AUDIO_PT;
+	if(rec->acodec != JANUS_AUDIOCODEC_NONE) {
+		/* Some audio codecs have a fixed payload type that we can't mess with */
+		if(rec->acodec == JANUS_AUDIOCODEC_PCMU)
+			rec->audio_pt = 0;
+		else if(rec->acodec == JANUS_AUDIOCODEC_PCMA)
+			rec->audio_pt = 8;
+		else if(rec->acodec == JANUS_AUDIOCODEC_G722)
+			rec->audio_pt = 9;
+	}
+	rec->video_pt = VIDEO_PT;
+	rec->viewers = NULL;
+	if(janus_recordplay_generate_offer(rec) < 0) {
+		JANUS_LOG(LOG_WARN, "Could not generate offer for recording %"SCNu64"...\n", rec->id);
+	}
+	g_atomic_int_set(&rec->destroyed, 0);
+	g_atomic_int_set(&rec->completed, 1);
+	janus_refcount_init(&rec->ref, janus_recordplay_recording_free);
+	janus_mutex_init(&rec->mutex);
+	return rec;
+}
+
+/* Helpers to load and save the catalog from/to the recordings folder */
+static void janus_recordplay_catalog_load(void) {
+	char path[1024];
+	g_snprintf(path, sizeof(path), "%s/%s", recordings_path, JANUS_RECORDPLAY_CATALOG);
+	json_error_t error;
+	json_t *list = json_load_file(path, 0, &error);
+	if(list == NULL) {
+		JANUS_LOG(LOG_VERB, "No catalog of recordings to load (%s), scanning the whole folder\n", error.text);
+		return;
+	}
+	size_t i = 0;
+	for(i=0; i<(json_is_array(list) ? json_array_size(list) : 0); i++) {
+		json_t *item = json_array_get(list, i);
+		const char *nfo = json_string_value(json_object_get(item, "nfo"));
+		if(nfo == NULL)
+			continue;
+		janus_recordplay_catalog_entry *entry = g_malloc0(sizeof(janus_recordplay_catalog_entry));
+		entry->nfo = g_strdup(nfo);
+		entry->mtime = json_integer_value(json_object_get(item, "mtime"));
+		entry->size = json_integer_value(json_object_get(item, "size"));
+		entry->id = json_integer_value(json_object_get(item, "id"));
+		entry->name = g_strdup(json_string_value(json_object_get(item, "name")));
+		entry->date = g_strdup(json_string_value(json_object_get(item, "date")));
+		entry->arc_file = g_strdup(json_string_value(json_object_get(item, "audio")));
+		entry->acodec = g_strdup(json_string_value(json_object_get(item, "acodec")));
+		entry->afmtp = g_strdup(json_string_value(json_object_get(item, "afmtp")));
+		entry->vrc_file = g_strdup(json_string_value(json_object_get(item, "video")));
+		entry->vcodec = g_strdup(json_string_value(json_object_get(item, "vcodec")));
+		entry->vfmtp = g_strdup(json_string_value(json_object_get(item, "vfmtp")));
+		entry->e2ee = json_is_true(json_object_get(item, "e2ee"));
+		if(entry->id > 0 && (entry->name == NULL || entry->date == NULL || (entry->arc_file == NULL && entry->vrc_file == NULL))) {
+			/* Broken entry, we'll parse the .nfo file again */
+			entry->mtime = 0;
+		}
+		g_hash_table_insert(catalog, entry->nfo, entry);
+	}
+	json_decref(list);
+	JANUS_LOG(LOG_INFO, "Loaded %u entries from the catalog of recordings\n", g_hash_table_size(catalog));
+}
+
+static void janus_recordplay_catalog_save(void) {
+	json_t *list = json_array();
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, catalog);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_recordplay_catalog_entry *entry = value;
+		json_t *item = json_object();
+		json_object_set_new(item, "nfo", json_string(entry->nfo));
+		json_object_set_new(item, "mtime", json_integer(entry->mtime));
+		json_object_set_new(item, "size", json_integer(entry->size));
+		json_object_set_new(item, "id", json_integer(entry->id));
+		if(entry->id > 0) {
+			json_object_set_new(item, "name", json_string(entry->name));
+			json_object_set_new(item, "date", json_string(entry->date));
+			if(entry->arc_file)
+				json_object_set_new(item, "audio", json_string(entry->arc_file));
+			if(entry->acodec)
+				json_object_set_new(item, "acodec", json_string(entry->acodec));
+			if(entry->afmtp)
+				json_object_set_new(item, "afmtp", json_string(entry->afmtp));
+			if(entry->vrc_file)
+				json_object_set_new(item, "video", json_string(entry->vrc_file));
+			if(entry->vcodec)
+				json_object_set_new(item, "vcodec", json_string(entry->vcodec));
+			if(entry->vfmtp)
+				json_object_set_new(item, "vfmtp", json_string(entry->vfmtp));
+			if(entry->e2ee)
+				json_object_set_new(item, "e2ee", json_true());
+		}
+		json_array_append_new(list, item);
+	}
+	/* Write to a temporary file first, so that we never leave a broken catalog around */
+	char path[1024], tmppath[1024];
+	g_snprintf(path, sizeof(path), "%s/%s", recordings_path, JANUS_RECORDPLAY_CATALOG);
+	g_snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if(json_dump_file(list, tmppath, JSON_COMPACT) < 0) {
+		JANUS_LOG(LOG_ERR, "Error saving the catalog of recordings to %s...\n", tmppath);
+	} else if(rename(tmppath, path) < 0) {
+		JANUS_LOG(LOG_ERR, "Error renaming %s to %s: %s\n", tmppath, path, strerror(errno));
+	}
+	json_decref(list);
+}
+
 void janus_recordplay_update_recordings_list(void) {
 	if(recordings_path == NULL)
 		return;
 	JANUS_LOG(LOG_VERB, "Updating recordings list in %s\n", recordings_path);
-	janus_mutex_lock(&recordings_mutex);
-	/* First of all, let's keep track of which recordings are currently available */
-	GList *old_recordings = NULL;
-	if(recordings != NULL && g_hash_table_size(recordings) > 0) {
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, recordings);
-		while(g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_recordplay_recording *rec = value;
-			if(rec) {
-				janus_refcount_increase(&rec->ref);
-				old_recordings = g_list_append(old_recordings, &rec->id);
-			}
-		}
+	/* Updates are serialized, but don't block the recordings list while we scan the folder */
+	janus_mutex_lock(&catalog_mutex);
+	if(catalog == NULL) {
+		catalog = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_recordplay_catalog_entry_free);
+		if(catalog_persistent)
+			janus_recordplay_catalog_load();
 	}
 	/* Open dir */
 	DIR *dir = opendir(recordings_path);
 	if(!dir) {
 		JANUS_LOG(LOG_ERR, "Couldn't open folder...\n");
-		g_list_free(old_recordings);
-		janus_mutex_unlock(&recordings_mutex);
+		janus_mutex_unlock(&catalog_mutex);
 		return;
 	}
+	/* Only the .nfo files that are new, or that changed since the last time, need to be parsed */
+	GHashTable *found = g_hash_table_new(g_str_hash, g_str_equal);
+	GList *changed = NULL, *tmp = NULL;
+	guint scanned = 0;
 	struct dirent *recent = NULL;
 	char recpath[1024];
+	struct stat st;
 	while((recent = readdir(dir))) {
 		int len = strlen(recent->d_name);
 		if(len < 4)
 			continue;
 		if(strcasecmp(recent->d_name+len-4, ".nfo"))
 			continue;
-		JANUS_LOG(LOG_VERB, "Importing recording '%s'...\n", recent->d_name);
-		memset(recpath, 0, 1024);
 		g_snprintf(recpath, 1024, "%s/%s", recordings_path, recent->d_name);
-		janus_config *nfo = janus_config_parse(recpath);
-		if(nfo == NULL) {
-			JANUS_LOG(LOG_ERR, "Invalid recording '%s'...\n", recent->d_name);
+		if(stat(recpath, &st) < 0)
 			continue;
-		}
-		GList *cl = janus_config_get_categories(nfo, NULL);
-		if(cl == NULL || cl->data == NULL) {
-			JANUS_LOG(LOG_WARN, "No recording info in '%s', skipping...\n", recent->d_name);
-			janus_config_destroy(nfo);
+		janus_recordplay_catalog_entry *entry = g_hash_table_lookup(catalog, recent->d_name);
+		if(entry != NULL && entry->mtime == (gint64)st.st_mtime && entry->size == (gint64)st.st_size) {
+			/* Nothing changed */
+			g_hash_table_insert(found, entry->nfo, entry);
 			continue;
 		}
-		janus_config_category *cat = (janus_config_category *)cl->data;
-		guint64 id = g_ascii_strtoull(cat->name, NULL, 0);
-		if(id == 0) {
-			JANUS_LOG(LOG_WARN, "Invalid ID, skipping...\n");
-			g_list_free(cl);
-			janus_config_destroy(nfo);
-			continue;
-		}
-		janus_recordplay_recording *rec = g_hash_table_lookup(recordings, &id);
-		if(rec != NULL) {
-			JANUS_LOG(LOG_VERB, "Skipping recording with ID %"SCNu64", it's already in the list...\n", id);
-			g_list_free(cl);
-			janus_config_destroy(nfo);
-			/* Mark that we updated this recording */
-			old_recordings = g_list_remove(old_recordings, &rec->id);
-			janus_refcount_decrease(&rec->ref);
-			continue;
-		}
-		janus_config_item *name = janus_config_get(nfo, cat, janus_config_type_item, "name");
-		janus_config_item *date = janus_config_get(nfo, cat, janus_config_type_item, "date");
-		janus_config_item *audio = janus_config_get(nfo, cat, janus_config_type_item, "audio");
-		janus_config_item *video = janus_config_get(nfo, cat, janus_config_type_item, "video");
-		if(!name || !name->value || strlen(name->value) == 0 || !date || !date->value || strlen(date->value) == 0) {
-			JANUS_LOG(LOG_WARN, "Invalid info for recording %"SCNu64", skipping...\n", id);
-			g_list_free(cl);
-			janus_config_destroy(nfo);
-			continue;
-		}
-		if((!audio || !audio->value) && (!video || !video->value)) {
-			JANUS_LOG(LOG_WARN, "No audio and no video in recording %"SCNu64", skipping...\n", id);
-			janus_config_destroy(nfo);
-			continue;
+		entry = g_malloc0(sizeof(janus_recordplay_catalog_entry));
+		entry->nfo = g_strdup(recent->d_name);
+		entry->mtime = st.st_mtime;
+		entry->size = st.st_size;
+		changed = g_list_prepend(changed, entry);
+	}
+	closedir(dir);
+	if(changed != NULL) {
+		/* Parse the new files, in parallel if we've been configured to */
+		scanned = g_list_length(changed);
+		GThreadPool *pool = NULL;
+		if(scan_threads > 1 && scanned > 1) {
+			GError *error = NULL;
+			pool = g_thread_pool_new(janus_recordplay_catalog_scan, NULL, scan_threads, FALSE, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_WARN, "Couldn't create the pool of scanning threads (%s), scanning serially\n",
+					error->message ? error->message : "??");
+				g_error_free(error);
+				pool = NULL;
+			}
 		}
-		rec = g_malloc0(sizeof(janus_recordplay_recording));
-		rec->id = id;
-		rec->name = g_strdup(name->value);
-		rec->date = g_strdup(date->value);
-		if(audio && audio->value) {
-			rec->arc_file = g_strdup(audio->value);
-			char *ext = strstr(rec->arc_file, ".mjr");
-			if(ext != NULL)
-				*ext = '\0';
-			/* Check which codec is in this recording (and if it's end-to-end encrypted) */
-			gboolean e2ee = FALSE;
-			char fmtp[256];
-			fmtp[0] = '\0';
-			rec->acodec = janus_audiocodec_from_name(janus_recordplay_parse_codec(recordings_path,
-				rec->arc_file, fmtp, sizeof(fmtp), &e2ee));
-			if(strlen(fmtp) > 0)
-				rec->afmtp = g_strdup(fmtp);
-			if(e2ee)
-				rec->e2ee = TRUE;
+		for(tmp = changed; tmp != NULL; tmp = tmp->next) {
+			if(pool != NULL)
+				g_thread_pool_push(pool, tmp->data, NULL);
+			else
+				janus_recordplay_catalog_scan(tmp->data, NULL);
 		}
-		if(video && video->value) {
-			rec->vrc_file = g_strdup(video->value);
-			char *ext = strstr(rec->vrc_file, ".mjr");
-			if(ext != NULL)
-				*ext = '\0';
-			/* Check which codec is in this recording (and if it's end-to-end encrypted) */
-			gboolean e2ee = FALSE;
-			char fmtp[256];
-			fmtp[0] = '\0';
-			rec->vcodec = janus_videocodec_from_name(janus_recordplay_parse_codec(recordings_path,
-				rec->vrc_file, fmtp, sizeof(fmtp), &e2ee));
-			if(strlen(fmtp) > 0)
-				rec->vfmtp = g_strdup(fmtp);
-			if(e2ee)
-				rec->e2ee = TRUE;
+		if(pool != NULL)
+			g_thread_pool_free(pool, FALSE, TRUE);
+		/* Update the catalog */
+		for(tmp = changed; tmp != NULL; tmp = tmp->next) {
+			janus_recordplay_catalog_entry *entry = (janus_recordplay_catalog_entry *)tmp->data;
+			g_hash_table_replace(catalog, entry->nfo, entry);
+			g_hash_table_insert(found, entry->nfo, entry);
 		}
-		rec->audio_pt = AUDIO_PT;
-		if(rec->acodec != JANUS_AUDIOCODEC_NONE) {
-			/* Some audio codecs have a fixed payload type that we can't mess with */
-			if(rec->acodec == JANUS_AUDIOCODEC_PCMU)
-				rec->audio_pt = 0;
-			else if(rec->acodec == JANUS_AUDIOCODEC_PCMA)
-				rec->audio_pt = 8;
-			else if(rec->acodec == JANUS_AUDIOCODEC_G722)
-				rec->audio_pt = 9;
+		g_list_free(changed);
+	}
+	/* Get rid of the files that don't exist anymore */
+	guint removed = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, catalog);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_recordplay_catalog_entry *entry = value;
+		if(!g_hash_table_contains(found, entry->nfo)) {
+			g_hash_table_iter_remove(&iter);
+			removed++;
 		}
-		rec->video_pt = VIDEO_PT;
-		rec->viewers = NULL;
-		if(janus_recordplay_generate_offer(rec) < 0) {
-			JANUS_LOG(LOG_WARN, "Could not generate offer for recording %"SCNu64"...\n", rec->id);
+	}
+	g_hash_table_destroy(found);
+	if(catalog_persistent && (scanned > 0 || removed > 0))
+		janus_recordplay_catalog_save();
+	/* Now update the list of recordings */
+	janus_mutex_lock(&recordings_mutex);
+	GHashTable *ids = g_hash_table_new(g_int64_hash, g_int64_equal);
+	g_hash_table_iter_init(&iter, catalog);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_recordplay_catalog_entry *entry = value;
+		if(entry->id == 0)
+			continue;
+		g_hash_table_insert(ids, &entry->id, entry);
+		if(g_hash_table_lookup(recordings, &entry->id) != NULL) {
+			JANUS_LOG(LOG_HUGE, "Skipping recording with ID %"SCNu64", it's already in the list...\n", entry->id);
+			continue;
 		}
-		g_atomic_int_set(&rec->destroyed, 0);
-		g_atomic_int_set(&rec->completed, 1);
-		janus_refcount_init(&rec->ref, janus_recordplay_recording_free);
-		janus_mutex_init(&rec->mutex);
-
-		g_list_free(cl);
-		janus_config_destroy(nfo);
-
 		/* Add to the list of recordings */
+		janus_recordplay_recording *rec = janus_recordplay_recording_from_entry(entry);
 		g_hash_table_insert(recordings, janus_uint64_dup(rec->id), rec);
 	}
-	closedir(dir);
 	/* Now let's check if any of the previously existing recordings was removed */
-	if(old_recordings != NULL) {
-		while(old_recordings != NULL) {
-			guint64 id = *((guint64 *)old_recordings->data);
-			JANUS_LOG(LOG_VERB, "Recording %"SCNu64" is not available anymore, removing...\n", id);
-			janus_recordplay_recording *old_rec = g_hash_table_lookup(recordings, &id);
-			if(old_rec != NULL) {
-				/* Remove it */
-				g_hash_table_remove(recordings, &id);
-				janus_refcount_decrease(&old_rec->ref);
+	g_hash_table_iter_init(&iter, recordings);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_recordplay_recording *rec = value;
+		if(!g_atomic_int_get(&rec->completed) || g_hash_table_contains(ids, &rec->id))
+			continue;
+		JANUS_LOG(LOG_VERB, "Recording %"SCNu64" is not available anymore, removing...\n", rec->id);
+		g_hash_table_iter_remove(&iter);
+	}
+	g_hash_table_destroy(ids);
+	JANUS_LOG(LOG_VERB, "Recordings list updated: %u recordings (%u files parsed, %u removed)\n",
+		g_hash_table_size(recordings), scanned, removed);
+	janus_mutex_unlock(&recordings_mutex);
+	janus_mutex_unlock(&catalog_mutex);
+}
+
+/* Helper to insert a frame packet in the list, ordered by timestamp and sequence number */
+static void janus_recordplay_frame_insert(janus_recordplay_frame_packet **list,
+		janus_recordplay_frame_packet **last, janus_recordplay_frame_packet *p) {
+	if((*list) == NULL) {
+		/* First element becomes the list itself (and the last item), at least for now */
+		(*list) = p;
+		*last = p;
+	} else {
+		/* Check where we should insert this, starting from the end */
+		int added = 0;
+		janus_recordplay_frame_packet *tmp = *last;
+		while(tmp) {
+			if(tmp->ts < p->ts) {
+				/* The new timestamp is greater than the last one we have, append */
+				added = 1;
+				if(tmp->next != NULL) {
+					/* We're inserting */
+					tmp->next->prev = p;
+					p->next = tmp->next;
+				} else {
+					/* Update the last packet */
+					*last = p;
+				}
+				tmp->next = p;
+				p->prev = tmp;
+				break;
+			} else if(tmp->ts == p->ts) {
+				/* Same timestamp, check the sequence number */
+				if(tmp->seq < p->seq && (abs(tmp->seq - p->seq) < 10000)) {
+					/* The new sequence number is greater than the last one we have, append */
+					added = 1;
+					if(tmp->next != NULL) {
+						/* We're inserting */
+						tmp->next->prev = p;
+						p->next = tmp->next;
+					} else {
+						/* Update the last packet */
+						*last = p;
+					}
+					tmp->next = p;
+					p->prev = tmp;
+					break;
+				} else if(tmp->seq > p->seq && (abs(tmp->seq - p->seq) > 10000)) {
+					/* The new sequence number (resetted) is greater than the last one we have, append */
+					added = 1;
+					if(tmp->next != NULL) {
+						/* We're inserting */
+						tmp->next->prev = p;
+						p->next = tmp->next;
+					} else {
+						/* Update the last packet */
+						*last = p;
+					}
+					tmp->next = p;
+					p->prev = tmp;
+					break;
+				}
 			}
-			old_recordings = old_recordings->next;
+			/* If either the timestamp ot the sequence number we just got is smaller, keep going back */
+			tmp = tmp->prev;
+		}
+		if(!added) {
+			/* We reached the start */
+			p->next = (*list);
+			(*list)->prev = p;
+			(*list) = p;
 		}
-		g_list_free(old_recordings);
 	}
-	janus_mutex_unlock(&recordings_mutex);
+}
+
+/* Helper to build the ordered list of frame packets from the index saved next to a recording, if any */
+static janus_recordplay_frame_packet *janus_recordplay_get_frames_from_index(const char *source) {
+	size_t count = 0, i = 0;
+	janus_recorder_index_entry *entries = janus_recorder_index_read(source, &count);
+	if(entries == NULL)
+		return NULL;
+	if(count == 0) {
+		g_free(entries);
+		return NULL;
+	}
+	JANUS_LOG(LOG_VERB, "Using index of %s to generate ordered list (%zu packets)...\n", source, count);
+	/* Let's look for timestamp resets first */
+	uint32_t first_ts = 0, last_ts = 0, reset = 0;
+	for(i=0; i<count; i++) {
+		uint32_t ts = entries[i].timestamp;
+		if(last_ts == 0) {
+			first_ts = ts;
+			if(first_ts > 1000*1000)	/* Just used to check whether a packet is pre- or post-reset */
+				first_ts -= 1000*1000;
+		} else {
+			if(ts < last_ts) {
+				/* The new timestamp is smaller than the next one, is it a timestamp reset or simply out of order? */
+				if(last_ts-ts > 2*1000*1000*1000)
+					reset = ts;
+			} else if(ts < reset) {
+				reset = ts;
+			}
+		}
+		last_ts = ts;
+	}
+	/* Now let's order the frames */
+	janus_recordplay_frame_packet *list = NULL, *last = NULL;
+	for(i=0; i<count; i++) {
+		janus_recordplay_frame_packet *p = g_malloc(sizeof(janus_recordplay_frame_packet));
+		p->seq = entries[i].seq;
+		p->ts = entries[i].timestamp;
+		if(reset != 0 && entries[i].timestamp <= first_ts) {
+			/* Post-reset... */
+			uint64_t max32 = UINT32_MAX;
+			max32++;
+			p->ts += max32;
+		}
+		p->len = entries[i].length;
+		p->offset = entries[i].offset;
+		p->next = NULL;
+		p->prev = NULL;
+		janus_recordplay_frame_insert(&list, &last, p);
+	}
+	g_free(entries);
+	return list;
 }
 
 janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename) {
@@ -2095,6 +2492,10 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 		g_snprintf(source, 1024, "%s/%s", dir, filename);
 	else
 		g_snprintf(source, 1024, "%s/%s.mjr", dir, filename);
+	/* If the recording was saved with an index, use that instead of scanning the file */
+	janus_recordplay_frame_packet *indexed = janus_recordplay_get_frames_from_index(source);
+	if(indexed != NULL)
+		return indexed;
 	FILE *file = fopen(source, "rb");
 	if(file == NULL) {
 		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
@@ -2311,71 +2712,7 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 		p->offset = offset;
 		p->next = NULL;
 		p->prev = NULL;
-		if(list == NULL) {
-			/* First element becomes the list itself (and the last item), at least for now */
-			list = p;
-			last = p;
-		} else {
-			/* Check where we should insert this, starting from the end */
-			int added = 0;
-			janus_recordplay_frame_packet *tmp = last;
-			while(tmp) {
-				if(tmp->ts < p->ts) {
-					/* The new timestamp is greater than the last one we have, append */
-					added = 1;
-					if(tmp->next != NULL) {
-						/* We're inserting */
-						tmp->next->prev = p;
-						p->next = tmp->next;
-					} else {
-						/* Update the last packet */
-						last = p;
-					}
-					tmp->next = p;
-					p->prev = tmp;
-					break;
-				} else if(tmp->ts == p->ts) {
-					/* Same timestamp, check the sequence number */
-					if(tmp->seq < p->seq && (abs(tmp->seq - p->seq) < 10000)) {
-						/* The new sequence number is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					} else if(tmp->seq > p->seq && (abs(tmp->seq - p->seq) > 10000)) {
-						/* The new sequence number (resetted) is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					}
-				}
-				/* If either the timestamp ot the sequence number we just got is smaller, keep going back */
-				tmp = tmp->prev;
-			}
-			if(!added) {
-				/* We reached the start */
-				p->next = list;
-				list->prev = p;
-				list = p;
-			}
-		}
+		janus_recordplay_frame_insert(&list, &last, p);
 		/* Skip data for now */
 		offset += len;
 		count++;
@@ -2396,6 +2733,73 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 	return list;
 }
 
+static janus_recordplay_media *janus_recordplay_media_create(const char *dir, const char *filename) {
+	if(!dir || !filename)
+		return NULL;
+	/* Build the index first */
+	janus_recordplay_frame_packet *frames = janus_recordplay_get_frames(dir, filename);
+	if(frames == NULL)
+		return NULL;
+	char source[1024];
+	if(strstr(filename, ".mjr"))
+		g_snprintf(source, 1024, "%s/%s", dir, filename);
+	else
+		g_snprintf(source, 1024, "%s/%s.mjr", dir, filename);
+	janus_recordplay_media *media = g_malloc0(sizeof(janus_recordplay_media));
+	media->path = g_strdup(source);
+	media->frames = frames;
+	janus_refcount_init(&media->ref, janus_recordplay_media_free);
+	/* Now map the file */
+	struct stat st;
+	int fd = open(source, O_RDONLY);
+	if(fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
+		if(fd > -1)
+			close(fd);
+		janus_refcount_decrease(&media->ref);
+		return NULL;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		JANUS_LOG(LOG_ERR, "Could not map file %s: %s\n", source, g_strerror(errno));
+		janus_refcount_decrease(&media->ref);
+		return NULL;
+	}
+	media->data = data;
+	media->size = st.st_size;
+	JANUS_LOG(LOG_VERB, "Mapped %s (%zu bytes)\n", source, media->size);
+	return media;
+}
+
+static void janus_recordplay_media_free(const janus_refcount *media_ref) {
+	janus_recordplay_media *media = janus_refcount_containerof(media_ref, janus_recordplay_media, ref);
+	/* This file is not played anymore, unmap it and get rid of the index */
+	if(media->data != NULL)
+		munmap(media->data, media->size);
+	janus_recordplay_frame_packet *tmp = NULL, *frame = media->frames;
+	while(frame) {
+		tmp = frame->next;
+		g_free(frame);
+		frame = tmp;
+	}
+	g_free(media->path);
+	g_free(media);
+}
+
+/* Helper to copy a packet from a mapped file: we still need a copy of our
+ * own, as both we and the core update the RTP header before sending it */
+static int janus_recordplay_media_read(janus_recordplay_media *media,
+		janus_recordplay_frame_packet *frame, char *buffer, int size) {
+	if(media == NULL || frame == NULL || frame->offset < 0 || frame->len < 0)
+		return 0;
+	if((size_t)frame->offset + frame->len > media->size)
+		return 0;
+	int len = frame->len > size ? size : frame->len;
+	memcpy(buffer, media->data + frame->offset, len);
+	return len;
+}
+
 static void *janus_recordplay_playout_thread(void *data) {
 	janus_recordplay_session *session = (janus_recordplay_session *)data;
 	if(!session) {
@@ -2426,41 +2830,7 @@ static void *janus_recordplay_playout_thread(void *data) {
 		return NULL;
 	}
 	JANUS_LOG(LOG_INFO, "Joining playout thread\n");
-	/* Open the files */
-	FILE *afile = NULL, *vfile = NULL;
-	if(session->aframes) {
-		char source[1024];
-		if(strstr(rec->arc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->arc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->arc_file);
-		afile = fopen(source, "rb");
-		if(afile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open audio file %s, can't start playout thread...\n", source);
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
-	}
-	if(session->vframes) {
-		char source[1024];
-		if(strstr(rec->vrc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->vrc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->vrc_file);
-		vfile = fopen(source, "rb");
-		if(vfile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open video file %s, can't start playout thread...\n", source);
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
-	}
+	janus_recordplay_media *amedia = session->amedia, *vmedia = session->vmedia;
 
 	/* Timer */
 	gboolean asent = FALSE, vsent = FALSE;
@@ -2494,8 +2864,7 @@ static void *janus_recordplay_playout_thread(void *data) {
 		if(audio) {
 			if(audio == session->aframes) {
 				/* First packet, send now */
-				fseek(afile, audio->offset, SEEK_SET);
-				bytes = fread(buffer, sizeof(char), audio->len, afile);
+				bytes = janus_recordplay_media_read(amedia, audio, buffer, 1500);
 				if(bytes != audio->len)
 					JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
 				/* Update payload type */
@@ -2536,8 +2905,7 @@ static void *janus_recordplay_playout_thread(void *data) {
 						abefore.tv_usec -= ts_diff/1000000;
 					}
 					/* Send now */
-					fseek(afile, audio->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), audio->len, afile);
+					bytes = janus_recordplay_media_read(amedia, audio, buffer, 1500);
 					if(bytes != audio->len)
 						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
 					/* Update payload type */
@@ -2556,8 +2924,7 @@ static void *janus_recordplay_playout_thread(void *data) {
 				/* First packets: there may be many of them with the same timestamp, send them all */
 				uint64_t ts = video->ts;
 				while(video && video->ts == ts) {
-					fseek(vfile, video->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), video->len, vfile);
+					bytes = janus_recordplay_media_read(vmedia, video, buffer, 1500);
 					if(bytes != video->len)
 						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
 					/* Update payload type */
@@ -2602,8 +2969,7 @@ static void *janus_recordplay_playout_thread(void *data) {
 					uint64_t ts = video->ts;
 					while(video && video->ts == ts) {
 						/* Send now */
-						fseek(vfile, video->offset, SEEK_SET);
-						bytes = fread(buffer, sizeof(char), video->len, vfile);
+						bytes = janus_recordplay_media_read(vmedia, video, buffer, 1500);
 						if(bytes != video->len)
 							JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
 						/* Update payload type */
@@ -2622,29 +2988,15 @@ static void *janus_recordplay_playout_thread(void *data) {
 
 	g_free(buffer);
 
-	/* Get rid of the indexes */
-	janus_recordplay_frame_packet *tmp = NULL;
-	audio = session->aframes;
-	while(audio) {
-		tmp = audio->next;
-		g_free(audio);
-		audio = tmp;
-	}
+	/* We don't need the mapped files anymore: they're shared, so we just release our references */
 	session->aframes = NULL;
-	video = session->vframes;
-	while(video) {
-		tmp = video->next;
-		g_free(video);
-		video = tmp;
-	}
 	session->vframes = NULL;
-
-	if(afile)
-		fclose(afile);
-	afile = NULL;
-	if(vfile)
-		fclose(vfile);
-	vfile = NULL;
+	session->amedia = NULL;
+	session->vmedia = NULL;
+	if(amedia)
+		janus_refcount_decrease(&amedia->ref);
+	if(vmedia)
+		janus_refcount_decrease(&vmedia->ref);
 
 	/* Remove from the list of viewers */
 	janus_mutex_lock(&rec->mutex);
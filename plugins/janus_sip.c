@@ -472,7 +472,8 @@
 	"video" : <true|false; whether or not our video should be recorded>,
 	"peer_audio" : <true|false; whether or not our peer's audio should be recorded>,
 	"peer_video" : <true|false; whether or not our peer's video should be recorded>,
-	"filename" : "<base path/filename to use for all the recordings>"
+	"filename" : "<base path/filename to use for all the recordings>",
+	"filter" : <true|false; whether padding-only packets and Opus DTX runs should be left out of the recordings, default=false>
 }
 \endverbatim
  *
@@ -629,6 +630,7 @@
 #include "../sdp-utils.h"
 #include "../utils.h"
 #include "../ip-utils.h"
+#include "../mediarelay.h"
 
 
 /* Plugin information */
@@ -658,6 +660,7 @@ void janus_sip_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *pa
 void janus_sip_hangup_media(janus_plugin_session *handle);
 void janus_sip_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_sip_query_session(janus_plugin_session *handle);
+json_t *janus_sip_query_metrics(void);
 
 /* Plugin setup */
 static janus_plugin janus_sip_plugin =
@@ -681,6 +684,7 @@ static janus_plugin janus_sip_plugin =
 		.hangup_media = janus_sip_hangup_media,
 		.destroy_session = janus_sip_destroy_session,
 		.query_session = janus_sip_query_session,
+		.query_metrics = janus_sip_query_metrics,
 	);
 
 /* Plugin creator */
@@ -752,7 +756,8 @@ static struct janus_json_parameter recording_parameters[] = {
 	{"video", JANUS_JSON_BOOL, 0},
 	{"peer_audio", JANUS_JSON_BOOL, 0},
 	{"peer_video", JANUS_JSON_BOOL, 0},
-	{"filename", JSON_STRING, 0}
+	{"filename", JSON_STRING, 0},
+	{"filter", JANUS_JSON_BOOL, 0}
 };
 static struct janus_json_parameter dtmf_info_parameters[] = {
 	{"digit", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
@@ -779,8 +784,13 @@ static char *user_agent;
 static int register_ttl = JANUS_DEFAULT_REGISTER_TTL;
 static uint16_t rtp_range_min = 10000;
 static uint16_t rtp_range_max = 60000;
+static janus_network_port_pool *port_pool = NULL;
 static int dscp_audio_rtp = 0;
 static int dscp_video_rtp = 0;
+#define JANUS_DEFAULT_RELAY_WORKERS	4
+static int relay_workers = JANUS_DEFAULT_RELAY_WORKERS;
+static int shared_stacks = 0;
+static gboolean fast_relay = FALSE;
 
 static GThread *handler_thread;
 static void *janus_sip_handler(void *data);
@@ -876,6 +886,12 @@ struct ssip_s {
 	GHashTable *subscriptions;
 	janus_mutex smutex;
 	struct janus_sip_session *session;
+	/* When the account uses one of the shared stacks, rather than its own */
+	struct janus_sip_shared_stack *shared;
+	/* Contact username incoming requests are routed to this account by */
+	char *route;
+	/* All the NUA handles of the account (and its helpers) on the shared stack */
+	GHashTable *handles;
 };
 
 typedef struct janus_sip_transfer {
@@ -947,8 +963,8 @@ typedef struct janus_sip_media {
 	gboolean video_send;
 	janus_sdp_mdirection pre_hold_video_dir;
 	janus_rtp_switching_context context;
-	int pipefd[2];
 	gboolean updated;
+	int pollerrs;
 	int video_orientation_extension_id;
 	int audio_level_extension_id;
 } janus_sip_media;
@@ -969,7 +985,7 @@ typedef struct janus_sip_session {
 	janus_recorder *vrc;		/* The Janus recorder instance for this user's video, if enabled */
 	janus_recorder *vrc_peer;	/* The Janus recorder instance for the peer's video, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorders from race conditions */
-	GThread *relayer_thread;
+	janus_mediarelay_call *relayer;	/* The call as handled by the media relay worker, if any */
 	volatile gint establishing, established;
 	volatile gint hangingup;
 	volatile gint destroyed;
@@ -1032,6 +1048,7 @@ static void janus_sip_session_free(const janus_refcount *session_ref) {
 			g_hash_table_unref(session->stack->subscriptions);
 		session->stack->subscriptions = NULL;
 		janus_mutex_unlock(&session->stack->smutex);
+		g_free(session->stack->route);
 		g_free(session->stack);
 		session->stack = NULL;
 	}
@@ -1097,6 +1114,7 @@ static void janus_sip_session_free(const janus_refcount *session_ref) {
 		session->incoming_header_prefixes = NULL;
 	}
 	janus_sip_srtp_cleanup(session);
+	janus_mediarelay_call_unref(session->relayer);
 	g_free(session);
 }
 
@@ -1390,8 +1408,49 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 char *janus_sip_sdp_manipulate(janus_sip_session *session, janus_sdp *sdp, gboolean answer);
 /* Media */
 static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean update);
-static void *janus_sip_relay_thread(void *data);
 static void janus_sip_media_cleanup(janus_sip_session *session);
+static gboolean janus_sip_relay_start(janus_sip_session *session);
+static int janus_sip_relay_prepare(gpointer user_data, int *fds, int max);
+static void janus_sip_relay_incoming(gpointer user_data, int fd);
+static janus_mediarelay_error_action janus_sip_relay_error(gpointer user_data, int fd);
+static gboolean janus_sip_relay_check(gpointer user_data);
+static void janus_sip_relay_done(gpointer user_data);
+static const janus_mediarelay_callbacks janus_sip_relay_callbacks = {
+	.prepare = janus_sip_relay_prepare,
+	.incoming = janus_sip_relay_incoming,
+	.error = janus_sip_relay_error,
+	.check = janus_sip_relay_check,
+	.done = janus_sip_relay_done,
+};
+/* Shared pool of workers relaying the RTP/RTCP media of all calls */
+static janus_mediarelay_pool *relay_pool = NULL;
+
+/* Sofia stacks shared by many accounts, when shared_stacks is set: each
+ * has its own thread, and incoming requests that don't belong to any
+ * existing handle are routed to accounts by the Contact username */
+typedef struct janus_sip_shared_stack {
+	int id;
+	GThread *thread;
+	su_root_t *s_root;
+	nua_t *s_nua;
+	su_timer_t *timer;
+	/* Contact username -> janus_sip_session */
+	GHashTable *routes;
+	janus_mutex mutex;
+	/* Accounts that went away, and which the stack thread must get rid of */
+	GAsyncQueue *detached;
+	volatile gint ready, stopping, shutdown;
+	/* Stats, for the metrics */
+	volatile gint sessions, handles, events, events_last, lag;
+	gint64 tick_expected;
+} janus_sip_shared_stack;
+static janus_sip_shared_stack **stacks = NULL;
+static int janus_sip_shared_stacks_start(int count);
+static void janus_sip_shared_stacks_stop(void);
+static gboolean janus_sip_shared_attach(struct janus_sip_session *session);
+static void janus_sip_shared_detach(struct janus_sip_session *session);
+static gboolean janus_sip_shared_reroute(struct janus_sip_session *session);
+static nua_handle_t *janus_sip_stack_handle(ssip_t *stack, struct janus_sip_session *session);
 
 
 /* URI parsing utilies */
@@ -1834,6 +1893,30 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 			}
 		}
 
+		item = janus_config_get(config, config_general, janus_config_type_item, "relay_workers");
+		if(item && item->value) {
+			int val = atoi(item->value);
+			if(val < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid relay_workers value, using default (%d)\n", JANUS_DEFAULT_RELAY_WORKERS);
+			} else {
+				relay_workers = val;
+			}
+		}
+
+		item = janus_config_get(config, config_general, janus_config_type_item, "shared_stacks");
+		if(item && item->value) {
+			int val = atoi(item->value);
+			if(val < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid shared_stacks value, disabling shared stacks\n");
+			} else {
+				shared_stacks = val;
+			}
+		}
+
+		item = janus_config_get(config, config_general, janus_config_type_item, "fast_relay");
+		if(item && item->value)
+			fast_relay = janus_is_true(item->value);
+
 		janus_config_destroy(config);
 	}
 	config = NULL;
@@ -1869,6 +1952,31 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	gateway = callback;
 
+	/* Ports for RTP/RTCP are taken from a pool, shared with other plugins */
+	port_pool = janus_network_port_pool_new("sip", rtp_range_min, rtp_range_max);
+	if(port_pool == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
+		return -1;
+	}
+
+	/* Start the workers that will relay the RTP/RTCP media of calls */
+	relay_pool = janus_mediarelay_pool_new("siprtp", relay_workers);
+	if(relay_pool == NULL) {
+		JANUS_LOG(LOG_ERR, "Couldn't start the SIP media relay workers...\n");
+		janus_network_port_pool_destroy(port_pool);
+		port_pool = NULL;
+		return -1;
+	}
+	/* If required, start the Sofia stacks accounts will share */
+	if(shared_stacks > 0 && janus_sip_shared_stacks_start(shared_stacks) < 0) {
+		JANUS_LOG(LOG_ERR, "Couldn't start the shared Sofia stacks...\n");
+		janus_mediarelay_pool_destroy(relay_pool);
+		relay_pool = NULL;
+		janus_network_port_pool_destroy(port_pool);
+		port_pool = NULL;
+		return -1;
+	}
+
 	g_atomic_int_set(&initialized, 1);
 
 	/* Launch the thread that will handle incoming messages */
@@ -1895,6 +2003,13 @@ void janus_sip_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* Shut the shared Sofia stacks down, if any */
+	janus_sip_shared_stacks_stop();
+	/* Stop relaying media: this gets rid of the calls that were still in progress */
+	janus_mediarelay_pool_destroy(relay_pool);
+	relay_pool = NULL;
+	janus_network_port_pool_destroy(port_pool);
+	port_pool = NULL;
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -2036,8 +2151,6 @@ void janus_sip_create_session(janus_plugin_session *handle, int *error) {
 	session->media.audio_level_extension_id = -1;
 	/* Initialize the RTP context */
 	janus_rtp_switching_context_reset(&session->media.context);
-	session->media.pipefd[0] = -1;
-	session->media.pipefd[1] = -1;
 	session->media.updated = FALSE;
 	session->media.audio_remote_policy.ssrc.type = ssrc_any_inbound;
 	session->media.audio_local_policy.ssrc.type = ssrc_any_inbound;
@@ -2113,8 +2226,10 @@ void janus_sip_destroy_session(janus_plugin_session *handle, int *error) {
 		g_hash_table_remove(transfers, GUINT_TO_POINTER(session->refer_id));
 		session->refer_id = 0;
 	}
-	/* Shutdown the NUA */
-	if(session->stack) {
+	/* Shutdown the NUA (or leave the shared stack, if that's what we're using) */
+	if(session->stack && session->stack->shared) {
+		janus_sip_shared_detach(session);
+	} else if(session->stack) {
 		janus_mutex_lock(&session->stack->smutex);
 		if(session->stack->s_nua)
 			nua_shutdown(session->stack->s_nua);
@@ -2493,7 +2608,7 @@ static void janus_sip_hangup_media_internal(janus_plugin_session *handle) {
 		return;
 	session->media.simulcast_ssrc = 0;
 	/* Do cleanup if media thread has not been created */
-	if(!session->media.ready && !session->relayer_thread) {
+	if(!session->media.ready && !janus_mediarelay_call_is_active(session->relayer)) {
 		janus_sip_media_cleanup(session);
 	}
 	/* Get rid of the recorders, if available */
@@ -2674,7 +2789,7 @@ static void *janus_sip_handler(void *data) {
 				json_object_set_new(result, "helper", json_true());
 				json_object_set_new(result, "master_id", json_integer(session->master_id));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("registered"));
 					json_object_set_new(info, "identity", json_string(ms->account.identity));
@@ -2931,7 +3046,19 @@ static void *janus_sip_handler(void *data) {
 			}
 
 			session->account.registration_status = janus_sip_registration_status_registering;
-			if(!refresh && session->stack == NULL) {
+			if(!refresh && session->stack != NULL && session->stack->shared != NULL) {
+				/* We're on a shared stack already, make sure incoming requests will still get to us */
+				if(!janus_sip_shared_reroute(session)) {
+					JANUS_LOG(LOG_ERR, "Contact username %s already in use on the shared SIP stack\n", session->account.authuser);
+					error_code = JANUS_SIP_ERROR_INVALID_ELEMENT;
+					g_snprintf(error_cause, 512, "Contact username %s already in use on the shared SIP stack", session->account.authuser);
+					goto error;
+				}
+			} else if(!refresh && session->stack == NULL && shared_stacks > 0 &&
+					!session->account.force_udp && !session->account.force_tcp && janus_sip_shared_attach(session)) {
+				/* We'll use one of the shared stacks: accounts forcing a transport still get their own */
+				JANUS_LOG(LOG_VERB, "Using shared SIP stack #%d for %s\n", session->stack->shared->id, session->account.username);
+			} else if(!refresh && session->stack == NULL) {
 				/* Start the thread first */
 				GError *error = NULL;
 				char tname[16];
@@ -2990,7 +3117,7 @@ static void *janus_sip_handler(void *data) {
 					g_snprintf(error_cause, 512, "Invalid NUA");
 					goto error;
 				}
-				session->stack->s_nh_r = nua_handle(session->stack->s_nua, session, TAG_END());
+				session->stack->s_nh_r = janus_sip_stack_handle(session->stack, session);
 				janus_mutex_unlock(&session->stack->smutex);
 				if(session->stack->s_nh_r == NULL) {
 					JANUS_LOG(LOG_ERR, "NUA Handle for REGISTER still null??\n");
@@ -3024,7 +3151,7 @@ static void *janus_sip_handler(void *data) {
 				json_object_set_new(result, "register_sent", json_false());
 				json_object_set_new(result, "master_id", json_integer(session->master_id));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("registered"));
 					json_object_set_new(info, "identity", json_string(session->account.identity));
@@ -3112,7 +3239,7 @@ static void *janus_sip_handler(void *data) {
 						g_snprintf(error_cause, 512, "Invalid NUA");
 						goto error;
 					}
-					nh = nua_handle(session->stack->s_nua, session, TAG_END());
+					nh = janus_sip_stack_handle(session->stack, session);
 					janus_mutex_unlock(&session->stack->smutex);
 				} else {
 					/* This is a helper, we need to use the master's SIP stack */
@@ -3129,7 +3256,7 @@ static void *janus_sip_handler(void *data) {
 						g_snprintf(error_cause, 512, "Invalid NUA");
 						goto error;
 					}
-					nh = nua_handle(session->master->stack->s_nua, session, TAG_END());
+					nh = janus_sip_stack_handle(session->master->stack, session);
 					janus_mutex_unlock(&session->master->stack->smutex);
 				}
 				if(session->stack->subscriptions == NULL) {
@@ -3367,7 +3494,7 @@ static void *janus_sip_handler(void *data) {
 					g_snprintf(error_cause, 512, "Invalid NUA");
 					goto error;
 				}
-				session->stack->s_nh_i = nua_handle(session->stack->s_nua, session, TAG_END());
+				session->stack->s_nh_i = janus_sip_stack_handle(session->stack, session);
 				janus_mutex_unlock(&session->stack->smutex);
 				if(session->account.display_name) {
 					g_snprintf(from_hdr, sizeof(from_hdr), "\"%s\" <%s>", session->account.display_name, session->account.identity);
@@ -3394,7 +3521,7 @@ static void *janus_sip_handler(void *data) {
 					g_snprintf(error_cause, 512, "Invalid NUA");
 					goto error;
 				}
-				session->stack->s_nh_i = nua_handle(session->master->stack->s_nua, session, TAG_END());
+				session->stack->s_nh_i = janus_sip_stack_handle(session->master->stack, session);
 				janus_mutex_unlock(&session->master->stack->smutex);
 				if(session->master->account.display_name) {
 					g_snprintf(from_hdr, sizeof(from_hdr), "\"%s\" <%s>", session->master->account.display_name, session->master->account.identity);
@@ -3424,7 +3551,7 @@ static void *janus_sip_handler(void *data) {
 				janus_sip_random_string(24, callid);
 			}
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("calling"));
 				json_object_set_new(info, "callee", json_string(uri_text));
@@ -3667,7 +3794,7 @@ static void *janus_sip_handler(void *data) {
 					session->media.simulcast_ssrc = json_integer_value(json_array_get(s, 0));
 			}
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string(answer ? "accepted" : "accepting"));
 				if(session->callid)
@@ -3702,18 +3829,9 @@ static void *janus_sip_handler(void *data) {
 			if(answer) {
 				/* Start the media */
 				session->media.ready = TRUE;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				session->relayer_thread = g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					session->relayer_thread = NULL;
+				if(!janus_sip_relay_start(session)) {
 					session->media.ready = FALSE;
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
-						error->code, error->message ? error->message : "??");
-					g_error_free(error);
+					JANUS_LOG(LOG_ERR, "Couldn't start relaying the RTP/RTCP media...\n");
 				}
 			}
 		} else if(!strcasecmp(request_text, "update")) {
@@ -3826,8 +3944,10 @@ static void *janus_sip_handler(void *data) {
 					g_snprintf(error_cause, 512, "Could not allocate RTP/RTCP ports");
 					goto error;
 				}
-				if(!offer)
+				if(!offer) {
 					session->media.updated = TRUE;
+					janus_mediarelay_call_update(session->relayer);
+				}
 			}
 			char *sdp = janus_sip_sdp_manipulate(session, parsed_sdp, !offer);
 			if(sdp == NULL) {
@@ -3891,7 +4011,7 @@ static void *janus_sip_handler(void *data) {
 						NUTAG_WITH_SAVED(transfer->saved),
 						TAG_END());
 					/* Also notify event handlers */
-					if(notify_events && gateway->events_is_enabled()) {
+					if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 						json_t *info = json_object();
 						json_object_set_new(info, "event", json_string("declined"));
 						json_object_set_new(info, "refer_id", json_integer(refer_id));
@@ -3955,7 +4075,7 @@ static void *janus_sip_handler(void *data) {
 			nua_respond(session->stack->s_nh_i, response_code, sip_status_phrase(response_code), TAG_END());
 			janus_mutex_lock(&session->mutex);
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("declined"));
 				json_object_set_new(info, "callee", json_string(session->callee));
@@ -4202,6 +4322,7 @@ static void *janus_sip_handler(void *data) {
 			}
 			json_t *recfile = json_object_get(root, "filename");
 			const char *recording_base = json_string_value(recfile);
+			gboolean filter = json_is_true(json_object_get(root, "filter"));
 			janus_mutex_lock(&session->rec_mutex);
 			if(!strcasecmp(action_text, "start")) {
 				/* Start recording something */
@@ -4323,6 +4444,17 @@ static void *janus_sip_handler(void *data) {
 						gateway->send_pli(session->handle);
 					}
 				}
+				if(filter) {
+					/* Leave packets with no actual media out of the recordings */
+					if(record_audio && session->arc)
+						janus_recorder_filter(session->arc, TRUE);
+					if(record_video && session->vrc)
+						janus_recorder_filter(session->vrc, TRUE);
+					if(record_peer_audio && session->arc_peer)
+						janus_recorder_filter(session->arc_peer, TRUE);
+					if(record_peer_video && session->vrc_peer)
+						janus_recorder_filter(session->vrc_peer, TRUE);
+				}
 			} else {
 				/* Stop recording something: notice that this never returns an error, even when we were not recording anything */
 				janus_sip_recorder_close(session, record_audio, record_peer_audio, record_video, record_peer_video);
@@ -4487,7 +4619,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 	ssip_t *ssip = session->stack;
 
 	/* Notify event handlers about the content of the whole incoming SIP message, if any */
-	if(notify_events && gateway->events_is_enabled() && ssip) {
+	if(notify_events && gateway->events_is_wanted(&janus_sip_plugin) && ssip) {
 		/* Print the incoming message */
 		size_t msg_size = 0;
 		msg_t *msg = nua_current_request(nua);
@@ -4540,7 +4672,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (%s)\n", ret, janus_get_api_error(ret));
 				json_decref(call);
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("proceeding"));
 					if(session->callid)
@@ -4571,7 +4703,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (%s)\n", ret, janus_get_api_error(ret));
 				json_decref(call);
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("hangup"));
 					if(session->callid)
@@ -4658,7 +4790,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 			}
 			gboolean reinvite = FALSE, busy = FALSE;
 			if(session->stack->s_nh_i == NULL) {
-				if(g_atomic_int_get(&session->establishing) || g_atomic_int_get(&session->established) || session->relayer_thread != NULL) {
+				if(g_atomic_int_get(&session->establishing) || g_atomic_int_get(&session->established) || janus_mediarelay_call_is_active(session->relayer)) {
 					/* Still busy establishing another call (or maybe still cleaning up the previous call) */
 					busy = TRUE;
 				}
@@ -4682,7 +4814,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				while(temp != NULL) {
 					helper = (janus_sip_session *)temp->data;
 					if(helper->stack->s_nh_i == NULL && !g_atomic_int_get(&helper->establishing) &&
-							!g_atomic_int_get(&helper->established) && helper->relayer_thread == NULL) {
+							!g_atomic_int_get(&helper->established) && !janus_mediarelay_call_is_active(helper->relayer)) {
 						/* Found! */
 						break;
 					}
@@ -4720,7 +4852,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				JANUS_LOG(LOG_VERB, "  >> Pushing event to peer: %d (%s)\n", ret, janus_get_api_error(ret));
 				json_decref(missed);
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("missed_call"));
 					json_object_set_new(info, "caller", json_string(caller_text));
@@ -4860,7 +4992,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				json_decref(jsep);
 			janus_sdp_destroy(sdp);
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string(reinvite ? "updatingcall" : "incomingcall"));
 				if(session->callid)
@@ -5341,18 +5473,9 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				break;
 			}
 			if(!session->media.earlymedia && !session->media.update) {
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				session->relayer_thread = g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					session->relayer_thread = NULL;
+				if(!janus_sip_relay_start(session)) {
 					session->media.ready = FALSE;
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
-						error->code, error->message ? error->message : "??");
-					g_error_free(error);
+					JANUS_LOG(LOG_ERR, "Couldn't start relaying the RTP/RTCP media...\n");
 				}
 			}
 			/* Check if there's an isfocus feature parameter in the Contact header */
@@ -5398,7 +5521,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 			json_decref(jsep);
 			janus_sdp_destroy(sdp);
 			/* Also notify event handlers */
-			if(!session->media.update && notify_events && gateway->events_is_enabled()) {
+			if(!session->media.update && notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string(in_progress ? "progress" : "accepted"));
 				if(session->callid)
@@ -5457,7 +5580,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 					janus_mutex_unlock(&session->mutex);
 				}
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string(event_name));
 					json_object_set_new(info, "identity", json_string(session->account.identity));
@@ -5561,7 +5684,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				JANUS_LOG(LOG_VERB, "  >> Pushing event to peer: %d (%s)\n", ret, janus_get_api_error(ret));
 				json_decref(event);
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_sip_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("registration_failed"));
 					json_object_set_new(info, "code", json_integer(status));
@@ -5807,15 +5930,9 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 	}
 
 	if(update && changed && *changed) {
-		/* Something changed: mark this on the session, so that the thread can update the sockets */
+		/* Something changed: mark this on the session, so that the relay worker can update the sockets */
 		session->media.updated = TRUE;
-		if(session->media.pipefd[1] > 0) {
-			int code = 1;
-			ssize_t res = 0;
-			do {
-				res = write(session->media.pipefd[1], &code, sizeof(int));
-			} while(res == -1 && errno == EINTR);
-		}
+		janus_mediarelay_call_update(session->relayer);
 	}
 }
 
@@ -5928,6 +6045,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 			close(session->media.audio_rtcp_fd);
 			session->media.audio_rtcp_fd = -1;
 		}
+		janus_network_port_pool_release(port_pool, session->media.local_audio_rtp_port);
 		session->media.local_audio_rtp_port = 0;
 		session->media.local_audio_rtcp_port = 0;
 		session->media.audio_ssrc = 0;
@@ -5939,17 +6057,10 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 			close(session->media.video_rtcp_fd);
 			session->media.video_rtcp_fd = -1;
 		}
+		janus_network_port_pool_release(port_pool, session->media.local_video_rtp_port);
 		session->media.local_video_rtp_port = 0;
 		session->media.local_video_rtcp_port = 0;
 		session->media.video_ssrc = 0;
-		if(session->media.pipefd[0] > 0) {
-			close(session->media.pipefd[0]);
-			session->media.pipefd[0] = -1;
-		}
-		if(session->media.pipefd[1] > 0) {
-			close(session->media.pipefd[1]);
-			session->media.pipefd[1] = -1;
-		}
 	}
 	/* Start */
 	int attempts = 100;	/* FIXME Don't retry forever */
@@ -5978,9 +6089,11 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 				JANUS_LOG(LOG_ERR, "Error creating audio sockets...\n");
 				return -1;
 			}
-			int rtp_port = g_random_int_range(rtp_range_min, rtp_range_max);
-			if(rtp_port % 2)
-				rtp_port++;	/* Pick an even port for RTP */
+			int rtp_port = janus_network_port_pool_get(port_pool);
+			if(rtp_port < 0) {
+				JANUS_LOG(LOG_ERR, "No ports available for audio in range: %u -- %u\n", rtp_range_min, rtp_range_max);
+				return -1;
+			}
 			audio_rtp_address.sin_family = AF_INET;
 			audio_rtp_address.sin_port = htons(rtp_port);
 			inet_pton(AF_INET, (local_media_ip ? local_media_ip : local_ip), &audio_rtp_address.sin_addr.s_addr);
@@ -5988,6 +6101,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 				JANUS_LOG(LOG_ERR, "Bind failed for audio RTP (port %d), trying a different one...\n", rtp_port);
 				close(session->media.audio_rtp_fd);
 				session->media.audio_rtp_fd = -1;
+				janus_network_port_pool_release(port_pool, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -6003,6 +6117,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 				session->media.audio_rtp_fd = -1;
 				close(session->media.audio_rtcp_fd);
 				session->media.audio_rtcp_fd = -1;
+				janus_network_port_pool_release(port_pool, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -6036,9 +6151,11 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 				JANUS_LOG(LOG_ERR, "Error creating video sockets...\n");
 				return -1;
 			}
-			int rtp_port = g_random_int_range(rtp_range_min, rtp_range_max);
-			if(rtp_port % 2)
-				rtp_port++;	/* Pick an even port for RTP */
+			int rtp_port = janus_network_port_pool_get(port_pool);
+			if(rtp_port < 0) {
+				JANUS_LOG(LOG_ERR, "No ports available for video in range: %u -- %u\n", rtp_range_min, rtp_range_max);
+				return -1;
+			}
 			video_rtp_address.sin_family = AF_INET;
 			video_rtp_address.sin_port = htons(rtp_port);
 			inet_pton(AF_INET, (local_media_ip ? local_media_ip : local_ip), &video_rtp_address.sin_addr.s_addr);
@@ -6046,6 +6163,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 				JANUS_LOG(LOG_ERR, "Bind failed for video RTP (port %d), trying a different one...\n", rtp_port);
 				close(session->media.video_rtp_fd);
 				session->media.video_rtp_fd = -1;
+				janus_network_port_pool_release(port_pool, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -6061,6 +6179,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 				session->media.video_rtp_fd = -1;
 				close(session->media.video_rtcp_fd);
 				session->media.video_rtcp_fd = -1;
+				janus_network_port_pool_release(port_pool, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -6069,8 +6188,6 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean u
 			session->media.local_video_rtcp_port = rtcp_port;
 		}
 	}
-	/* We need this to quickly interrupt the poll when it's time to update a session or wrap up */
-	pipe(session->media.pipefd);
 	return 0;
 }
 
@@ -6119,6 +6236,7 @@ static void janus_sip_media_cleanup(janus_sip_session *session) {
 		close(session->media.audio_rtcp_fd);
 		session->media.audio_rtcp_fd = -1;
 	}
+	janus_network_port_pool_release(port_pool, session->media.local_audio_rtp_port);
 	session->media.local_audio_rtp_port = 0;
 	session->media.local_audio_rtcp_port = 0;
 	session->media.remote_audio_rtp_port = 0;
@@ -6133,6 +6251,7 @@ static void janus_sip_media_cleanup(janus_sip_session *session) {
 		close(session->media.video_rtcp_fd);
 		session->media.video_rtcp_fd = -1;
 	}
+	janus_network_port_pool_release(port_pool, session->media.local_video_rtp_port);
 	session->media.local_video_rtp_port = 0;
 	session->media.local_video_rtcp_port = 0;
 	session->media.remote_video_rtp_port = 0;
@@ -6140,14 +6259,6 @@ static void janus_sip_media_cleanup(janus_sip_session *session) {
 	session->media.video_ssrc = 0;
 	session->media.video_ssrc_peer = 0;
 	session->media.simulcast_ssrc = 0;
-	if(session->media.pipefd[0] > 0) {
-		close(session->media.pipefd[0]);
-		session->media.pipefd[0] = -1;
-	}
-	if(session->media.pipefd[1] > 0) {
-		close(session->media.pipefd[1]);
-		session->media.pipefd[1] = -1;
-	}
 	/* Clean up SRTP stuff, if needed */
 	janus_sip_srtp_cleanup(session);
 
@@ -6155,362 +6266,779 @@ static void janus_sip_media_cleanup(janus_sip_session *session) {
 	janus_sip_media_reset(session);
 }
 
-/* Thread to relay RTP/RTCP frames coming from the SIP peer */
-static void *janus_sip_relay_thread(void *data) {
-	janus_sip_session *session = (janus_sip_session *)data;
-	if(!session) {
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
+/* Media relay callbacks: one of the workers in the pool reads the RTP/RTCP frames coming from the SIP peer */
+static gboolean janus_sip_relay_start(janus_sip_session *session) {
 	if(!session->account.username || !session->callee) {
+		JANUS_LOG(LOG_WARN, "[SIP-%s] No callee, not relaying media...\n", session->account.username);
+		return FALSE;
+	}
+	JANUS_LOG(LOG_VERB, "Starting relaying media (%s <--> %s)\n", session->account.username, session->callee);
+	/* Get rid of the reference to the previous call, if any */
+	janus_mediarelay_call_unref(session->relayer);
+	session->media.pollerrs = 0;
+	janus_refcount_increase(&session->ref);
+	session->relayer = janus_mediarelay_call_add(relay_pool, &janus_sip_relay_callbacks, session);
+	if(session->relayer == NULL) {
 		janus_refcount_decrease(&session->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
+		return FALSE;
 	}
-	JANUS_LOG(LOG_VERB, "Starting relay thread (%s <--> %s)\n", session->account.username, session->callee);
+	return TRUE;
+}
 
-	if(!session->callee) {
-		JANUS_LOG(LOG_VERB, "[SIP-%s] Leaving thread, no callee...\n", session->account.username);
-		janus_refcount_decrease(&session->ref);
-		g_thread_unref(g_thread_self());
-		return NULL;
+static int janus_sip_relay_prepare(gpointer user_data, int *fds, int max) {
+	janus_sip_session *session = (janus_sip_session *)user_data;
+	/* Apparently there was a session update, or we've just been added to a worker */
+	session->media.updated = FALSE;
+
+	gboolean have_audio_server_ip = session->media.remote_audio_ip != NULL;
+	struct sockaddr_in audio_server_addr;
+	memset(&audio_server_addr, 0, sizeof(struct sockaddr_in));
+	audio_server_addr.sin_family = AF_INET;
+
+	gboolean have_video_server_ip = session->media.remote_video_ip != NULL;
+	struct sockaddr_in video_server_addr;
+	memset(&video_server_addr, 0, sizeof(struct sockaddr_in));
+	video_server_addr.sin_family = AF_INET;
+
+	if(session->media.remote_audio_ip && inet_aton(session->media.remote_audio_ip, &audio_server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
+		/* Note that gethostbyname() may block waiting for response if it triggers on the wire request,
+		 * which would delay the media of all the other calls handled by the same worker */
+		struct hostent *host = gethostbyname(session->media.remote_audio_ip);	/* ...resolve name */
+		if(!host) {
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't get host (%s)\n", session->account.username, session->media.remote_audio_ip);
+			have_audio_server_ip = FALSE;
+		} else {
+			audio_server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
+		}
+	}
+
+	if(session->media.remote_video_ip && inet_aton(session->media.remote_video_ip, &video_server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
+		/* Same considerations as above on gethostbyname() */
+		struct hostent *host = gethostbyname(session->media.remote_video_ip);	/* ...resolve name */
+		if(!host) {
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't get host (%s)\n", session->account.username, session->media.remote_video_ip);
+			have_video_server_ip = FALSE;
+		} else {
+			video_server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
+		}
+	}
+
+	if(have_audio_server_ip || have_video_server_ip) {
+		janus_sip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
+			have_video_server_ip ? &video_server_addr : NULL);
+	} else if(session->media.remote_audio_ip == NULL &&  session->media.remote_video_ip == NULL) {
+		JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n",
+			session->account.username);
+	} else {
+		if(session->media.remote_audio_ip)
+			JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
+				session->account.username, session->media.remote_audio_ip);
+		if(session->media.remote_video_ip)
+			JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
+				session->account.username, session->media.remote_video_ip);
+	}
+
+	/* In case we're on hold (remote address is 0.0.0.0) set the send properties to FALSE */
+	if(have_audio_server_ip && !strcmp(session->media.remote_audio_ip, "0.0.0.0"))
+		session->media.audio_send = FALSE;
+	if(have_video_server_ip && !strcmp(session->media.remote_video_ip, "0.0.0.0"))
+		session->media.video_send = FALSE;
+
+	/* Tell the worker which sockets to watch */
+	int media_fds[4] = {
+		session->media.audio_rtp_fd, session->media.audio_rtcp_fd,
+		session->media.video_rtp_fd, session->media.video_rtcp_fd
+	};
+	int i = 0, num = 0;
+	for(i=0; i<4 && num<max; i++) {
+		if(media_fds[i] != -1)
+			fds[num++] = media_fds[i];
+	}
+	return num;
+}
+
+/* Fast path for RTP coming from the peer, used when there's nothing to do
+ * on packets but rewriting their headers (no SRTP, recording or extensions
+ * to parse): we drain the socket in batches, with no allocation per packet */
+#define JANUS_SIP_RELAY_BATCH	16
+static void janus_sip_relay_fast(janus_sip_session *session, int fd, gboolean video) {
+	char buffers[JANUS_SIP_RELAY_BATCH][1500];
+	int lengths[JANUS_SIP_RELAY_BATCH];
+	int i = 0, count = 0;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[JANUS_SIP_RELAY_BATCH];
+	struct iovec iovecs[JANUS_SIP_RELAY_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+	for(i=0; i<JANUS_SIP_RELAY_BATCH; i++) {
+		iovecs[i].iov_base = buffers[i];
+		iovecs[i].iov_len = sizeof(buffers[i]);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	count = recvmmsg(fd, msgs, JANUS_SIP_RELAY_BATCH, MSG_DONTWAIT, NULL);
+	for(i=0; i<count; i++)
+		lengths[i] = msgs[i].msg_len;
+#else
+	while(count < JANUS_SIP_RELAY_BATCH) {
+		int bytes = recvfrom(fd, buffers[count], sizeof(buffers[count]), MSG_DONTWAIT, NULL, NULL);
+		if(bytes < 0)
+			break;
+		lengths[count++] = bytes;
+	}
+#endif
+	if(count < 1)
+		return;
+	session->media.pollerrs = 0;
+	guint32 *ssrc_peer = video ? &session->media.video_ssrc_peer : &session->media.audio_ssrc_peer;
+	guint packets = 0, bytes = 0;
+	for(i=0; i<count; i++) {
+		if(!janus_is_rtp(buffers[i], lengths[i]))
+			continue;
+		janus_rtp_header *header = (janus_rtp_header *)buffers[i];
+		if(*ssrc_peer != ntohl(header->ssrc)) {
+			*ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer %s SSRC: %"SCNu32"\n", video ? "video" : "audio", *ssrc_peer);
+		}
+		janus_rtp_header_update(header, &session->media.context, video, 0);
+		janus_plugin_rtp rtp = { .video = video, .buffer = buffers[i], .length = lengths[i] };
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		gateway->relay_rtp(session->handle, &rtp);
+		packets++;
+		bytes += lengths[i];
+	}
+	janus_mediarelay_call_add_traffic(session->relayer, packets, bytes);
+}
+
+static void janus_sip_relay_incoming(gpointer user_data, int fd) {
+	janus_sip_session *session = (janus_sip_session *)user_data;
+	if(g_atomic_int_get(&session->destroyed))
+		return;
+	if(fast_relay && session->media.audio_rtp_fd != -1 && fd == session->media.audio_rtp_fd &&
+			!session->media.has_srtp_remote_audio && session->arc_peer == NULL &&
+			session->media.audio_level_extension_id <= 0) {
+		janus_sip_relay_fast(session, fd, FALSE);
+		return;
+	}
+	if(fast_relay && session->media.video_rtp_fd != -1 && fd == session->media.video_rtp_fd &&
+			!session->media.has_srtp_remote_video && session->vrc_peer == NULL &&
+			session->media.video_orientation_extension_id <= 0) {
+		janus_sip_relay_fast(session, fd, TRUE);
+		return;
 	}
-	/* File descriptors */
 	socklen_t addrlen;
 	struct sockaddr_in remote;
-	int resfd = 0, bytes = 0, pollerrs = 0;
-	struct pollfd fds[5];
-	int pipe_fd = session->media.pipefd[0];
+	int bytes = 0;
 	char buffer[1500];
-	memset(buffer, 0, 1500);
-	/* Loop */
-	int num = 0;
-	gboolean goon = TRUE;
-
-	session->media.updated = TRUE; /* Connect UDP sockets upon loop entry */
-	gboolean have_audio_server_ip = TRUE;
-	gboolean have_video_server_ip = TRUE;
-
-	while(goon && session != NULL && !g_atomic_int_get(&session->destroyed) &&
-			session->status > janus_sip_call_status_idle &&
-			session->status < janus_sip_call_status_closing) {	/* FIXME We need a per-call watchdog as well */
-
-		if(session->media.updated) {
-			/* Apparently there was a session update, or the loop has just been entered */
-			session->media.updated = FALSE;
-
-			have_audio_server_ip = session->media.remote_audio_ip != NULL;
-			struct sockaddr_in audio_server_addr;
-			memset(&audio_server_addr, 0, sizeof(struct sockaddr_in));
-			audio_server_addr.sin_family = AF_INET;
-
-			have_video_server_ip = session->media.remote_video_ip != NULL;
-			struct sockaddr_in video_server_addr;
-			memset(&video_server_addr, 0, sizeof(struct sockaddr_in));
-			video_server_addr.sin_family = AF_INET;
-
-			if(session->media.remote_audio_ip && inet_aton(session->media.remote_audio_ip, &audio_server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
-				/* Note that gethostbyname() may block waiting for response if it triggers on the wire request.*/
-				struct hostent *host = gethostbyname(session->media.remote_audio_ip);	/* ...resolve name */
-				if(!host) {
-					JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't get host (%s)\n", session->account.username, session->media.remote_audio_ip);
-					have_audio_server_ip = FALSE;
-				} else {
-					audio_server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
-				}
-			}
-
-			if(session->media.remote_video_ip && inet_aton(session->media.remote_video_ip, &video_server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
-				/* Note that gethostbyname() may block waiting for response if it triggers on the wire request.*/
-				struct hostent *host = gethostbyname(session->media.remote_video_ip);	/* ...resolve name */
-				if(!host) {
-					JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't get host (%s)\n", session->account.username, session->media.remote_video_ip);
-					have_video_server_ip = FALSE;
-				} else {
-					video_server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
-				}
+	/* Got an RTP/RTCP packet */
+	if(session->media.audio_rtp_fd != -1 && fd == session->media.audio_rtp_fd) {
+		/* Got something audio (RTP) */
+		addrlen = sizeof(remote);
+		bytes = recvfrom(session->media.audio_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
+		if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
+			/* Failed to read or not an RTP packet? */
+			return;
+		}
+		session->media.pollerrs = 0;
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		if(session->media.audio_ssrc_peer != ntohl(header->ssrc)) {
+			session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote_audio) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
 			}
-
-			if(have_audio_server_ip || have_video_server_ip) {
-				janus_sip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
-					have_video_server_ip ? &video_server_addr : NULL);
-			} else if(session->media.remote_audio_ip == NULL &&  session->media.remote_video_ip == NULL) {
-				JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n",
-					session->account.username);
-			} else {
-				if(session->media.remote_audio_ip)
-					JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
-						session->account.username, session->media.remote_audio_ip);
-				if(session->media.remote_video_ip)
-					JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
-						session->account.username, session->media.remote_video_ip);
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.context, FALSE, 0);
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(session->arc_peer, buffer, bytes);
+		/* Relay to application */
+		janus_plugin_rtp rtp = { .video = FALSE, .buffer = buffer, .length = bytes };
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		/* Add audio-level extension, if present */
+		if(session->media.audio_level_extension_id != -1) {
+			gboolean vad = FALSE;
+			int level = -1;
+			if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
+					session->media.audio_level_extension_id, &vad, &level) == 0) {
+				rtp.extensions.audio_level = level;
+				rtp.extensions.audio_level_vad = vad;
 			}
-
-			/* In case we're on hold (remote address is 0.0.0.0) set the send properties to FALSE */
-			if(have_audio_server_ip && !strcmp(session->media.remote_audio_ip, "0.0.0.0"))
-				session->media.audio_send = FALSE;
-			if(have_video_server_ip && !strcmp(session->media.remote_video_ip, "0.0.0.0"))
-				session->media.video_send = FALSE;
 		}
-
-		/* Prepare poll */
-		num = 0;
-		if(session->media.audio_rtp_fd != -1) {
-			fds[num].fd = session->media.audio_rtp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		gateway->relay_rtp(session->handle, &rtp);
+		janus_mediarelay_call_add_traffic(session->relayer, 1, bytes);
+	} else if(session->media.audio_rtcp_fd != -1 && fd == session->media.audio_rtcp_fd) {
+		/* Got something audio (RTCP) */
+		addrlen = sizeof(remote);
+		bytes = recvfrom(session->media.audio_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
+		if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
+			/* Failed to read or not an RTCP packet? */
+			return;
 		}
-		if(session->media.audio_rtcp_fd != -1) {
-			fds[num].fd = session->media.audio_rtcp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		session->media.pollerrs = 0;
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote_audio) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
 		}
-		if(session->media.video_rtp_fd != -1) {
-			fds[num].fd = session->media.video_rtp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		/* Relay to application */
+		janus_plugin_rtcp rtcp = { .video = FALSE, .buffer = buffer, bytes };
+		gateway->relay_rtcp(session->handle, &rtcp);
+	} else if(session->media.video_rtp_fd != -1 && fd == session->media.video_rtp_fd) {
+		/* Got something video (RTP) */
+		addrlen = sizeof(remote);
+		bytes = recvfrom(session->media.video_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
+		if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
+			/* Failed to read or not an RTP packet? */
+			return;
 		}
-		if(session->media.video_rtcp_fd != -1) {
-			fds[num].fd = session->media.video_rtcp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		session->media.pollerrs = 0;
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		if(session->media.video_ssrc_peer != ntohl(header->ssrc)) {
+			session->media.video_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
 		}
-		if(pipe_fd != -1) {
-			fds[num].fd = pipe_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote_video) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
 		}
-		/* Wait for some data */
-		resfd = poll(fds, num, 1000);
-		if(resfd < 0) {
-			if(errno == EINTR) {
-				JANUS_LOG(LOG_HUGE, "[SIP-%s] Got an EINTR (%s), ignoring...\n", session->account.username, strerror(errno));
-				continue;
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.context, TRUE, 0);
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
+		/* Relay to application */
+		janus_plugin_rtp rtp = { .video = TRUE, .buffer = buffer, .length = bytes };
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		/* Add video-orientation extension, if present */
+		if(session->media.video_orientation_extension_id > 0) {
+			gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
+			if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
+					session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
+				rtp.extensions.video_rotation = 0;
+				if(r1 && r0)
+					rtp.extensions.video_rotation = 270;
+				else if(r1)
+					rtp.extensions.video_rotation = 180;
+				else if(r0)
+					rtp.extensions.video_rotation = 90;
+				rtp.extensions.video_back_camera = c;
+				rtp.extensions.video_flipped = f;
 			}
-			JANUS_LOG(LOG_ERR, "[SIP-%s] Error polling...\n", session->account.username);
-			JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, errno, strerror(errno));
-			break;
-		} else if(resfd == 0) {
-			/* No data, keep going */
-			continue;
 		}
-		if(session == NULL || g_atomic_int_get(&session->destroyed) ||
-				session->status <= janus_sip_call_status_idle ||
-				session->status >= janus_sip_call_status_closing)
-			break;
-		int i = 0;
-		for(i=0; i<num; i++) {
-			if(fds[i].revents & (POLLERR | POLLHUP)) {
-				/* If we just updated the session, let's wait until things have calmed down */
-				if(session->media.updated)
-					break;
-				/* Check the socket error */
-				int error = 0;
-				socklen_t errlen = sizeof(error);
-				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
-							session->account.username, strerror(error));
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-						continue;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
-							session->account.username, strerror(error));
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-						continue;
-					}
-				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling %d (socket #%d): %s...\n", session->account.username,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, strerror(error));
-				goon = FALSE;	/* Can we assume it's pretty much over, after a POLLERR? */
-				/* FIXME Simulate a "hangup" coming from the application */
-				janus_sip_hangup_media(session->handle);
-				break;
-			} else if(fds[i].revents & POLLIN) {
-				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
-					/* Poll interrupted for a reason, go on */
-					int code = 0;
-					(void)read(pipe_fd, &code, sizeof(int));
-					break;
-				}
-				/* Got an RTP/RTCP packet */
-				if(session->media.audio_rtp_fd != -1 && fds[i].fd == session->media.audio_rtp_fd) {
-					/* Got something audio (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					if(session->media.audio_ssrc_peer != ntohl(header->ssrc)) {
-						session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote_audio) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.context, FALSE, 0);
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(session->arc_peer, buffer, bytes);
-					/* Relay to application */
-					janus_plugin_rtp rtp = { .video = FALSE, .buffer = buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&rtp.extensions);
-					/* Add audio-level extension, if present */
-					if(session->media.audio_level_extension_id != -1) {
-						gboolean vad = FALSE;
-						int level = -1;
-						if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
-								session->media.audio_level_extension_id, &vad, &level) == 0) {
-							rtp.extensions.audio_level = level;
-							rtp.extensions.audio_level_vad = vad;
-						}
-					}
-					gateway->relay_rtp(session->handle, &rtp);
-					continue;
-				} else if(session->media.audio_rtcp_fd != -1 && fds[i].fd == session->media.audio_rtcp_fd) {
-					/* Got something audio (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
-						/* Failed to read or not an RTCP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote_audio) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to application */
-					janus_plugin_rtcp rtcp = { .video = FALSE, .buffer = buffer, bytes };
-					gateway->relay_rtcp(session->handle, &rtcp);
-					continue;
-				} else if(session->media.video_rtp_fd != -1 && fds[i].fd == session->media.video_rtp_fd) {
-					/* Got something video (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					if(session->media.video_ssrc_peer != ntohl(header->ssrc)) {
-						session->media.video_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote_video) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.context, TRUE, 0);
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
-					/* Relay to application */
-					janus_plugin_rtp rtp = { .video = TRUE, .buffer = buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&rtp.extensions);
-					/* Add video-orientation extension, if present */
-					if(session->media.video_orientation_extension_id > 0) {
-						gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
-						if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
-								session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
-							rtp.extensions.video_rotation = 0;
-							if(r1 && r0)
-								rtp.extensions.video_rotation = 270;
-							else if(r1)
-								rtp.extensions.video_rotation = 180;
-							else if(r0)
-								rtp.extensions.video_rotation = 90;
-							rtp.extensions.video_back_camera = c;
-							rtp.extensions.video_flipped = f;
-						}
-					}
-					gateway->relay_rtp(session->handle, &rtp);
-					continue;
-				} else if(session->media.video_rtcp_fd != -1 && fds[i].fd == session->media.video_rtcp_fd) {
-					/* Got something video (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
-						/* Failed to read or not an RTCP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote_video) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to application */
-					janus_plugin_rtcp rtcp = { .video = TRUE, .buffer = buffer, bytes };
-					gateway->relay_rtcp(session->handle, &rtcp);
-					continue;
-				}
+		gateway->relay_rtp(session->handle, &rtp);
+		janus_mediarelay_call_add_traffic(session->relayer, 1, bytes);
+	} else if(session->media.video_rtcp_fd != -1 && fd == session->media.video_rtcp_fd) {
+		/* Got something video (RTCP) */
+		addrlen = sizeof(remote);
+		bytes = recvfrom(session->media.video_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
+		if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
+			/* Failed to read or not an RTCP packet? */
+			return;
+		}
+		session->media.pollerrs = 0;
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote_video) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return;
 			}
+			bytes = buflen;
 		}
+		/* Relay to application */
+		janus_plugin_rtcp rtcp = { .video = TRUE, .buffer = buffer, bytes };
+		gateway->relay_rtcp(session->handle, &rtcp);
 	}
+}
+
+static janus_mediarelay_error_action janus_sip_relay_error(gpointer user_data, int fd) {
+	janus_sip_session *session = (janus_sip_session *)user_data;
+	/* If we just updated the session, let's wait until things have calmed down */
+	if(session->media.updated)
+		return janus_mediarelay_error_ignore;
+	/* Check the socket error */
+	int error = 0;
+	socklen_t errlen = sizeof(error);
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return janus_mediarelay_error_ignore;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(fd == session->media.audio_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
+				session->account.username, strerror(error));
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			return janus_mediarelay_error_closed;
+		} else if(fd == session->media.video_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
+				session->account.username, strerror(error));
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			return janus_mediarelay_error_closed;
+		}
+	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.pollerrs++;
+	if(session->media.pollerrs < 100)
+		return janus_mediarelay_error_ignore;
+	JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors on socket %d...\n", session->account.username, fd);
+	JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, strerror(error));
+	/* Can we assume it's pretty much over, after a POLLERR? */
+	/* FIXME Simulate a "hangup" coming from the application */
+	janus_sip_hangup_media(session->handle);
+	return janus_mediarelay_error_hangup;
+}
+
+static gboolean janus_sip_relay_check(gpointer user_data) {
+	janus_sip_session *session = (janus_sip_session *)user_data;
+	/* FIXME We need a per-call watchdog as well */
+	return !g_atomic_int_get(&session->destroyed) &&
+		session->status > janus_sip_call_status_idle &&
+		session->status < janus_sip_call_status_closing;
+}
+
+static void janus_sip_relay_done(gpointer user_data) {
+	janus_sip_session *session = (janus_sip_session *)user_data;
 	/* Cleanup the media session */
 	janus_sip_media_cleanup(session);
 	/* Done */
-	JANUS_LOG(LOG_VERB, "Leaving SIP relay thread\n");
-	session->relayer_thread = NULL;
+	JANUS_LOG(LOG_VERB, "Done relaying SIP media\n");
 	janus_refcount_decrease(&session->ref);
-	g_thread_unref(g_thread_self());
+}
+
+
+/* Shared Sofia stacks */
+static void janus_sip_shared_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[]);
+static void *janus_sip_shared_thread(void *data);
+
+static int janus_sip_shared_stacks_start(int count) {
+	stacks = g_malloc0((count + 1) * sizeof(janus_sip_shared_stack *));
+	int i = 0;
+	for(i = 0; i < count; i++) {
+		janus_sip_shared_stack *stack = g_malloc0(sizeof(janus_sip_shared_stack));
+		stack->id = i;
+		stack->routes = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+		janus_mutex_init(&stack->mutex);
+		stack->detached = g_async_queue_new();
+		stacks[i] = stack;
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "sip stack %d", i);
+		stack->thread = g_thread_try_new(tname, janus_sip_shared_thread, stack, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the shared SIP Sofia thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_sip_shared_stacks_stop();
+			return -1;
+		}
+		/* Wait for the NUA to be there, as we do for accounts with their own stack */
+		long int timeout = 0;
+		while(g_atomic_int_get(&stack->ready) == 0 && timeout < 2000000) {
+			g_usleep(100000);
+			timeout += 100000;
+		}
+		if(g_atomic_int_get(&stack->ready) != 1) {
+			JANUS_LOG(LOG_ERR, "Shared SIP stack #%d didn't start\n", i);
+			janus_sip_shared_stacks_stop();
+			return -1;
+		}
+	}
+	JANUS_LOG(LOG_INFO, "Started %d shared SIP stacks\n", count);
+	return 0;
+}
+
+static void janus_sip_shared_stacks_stop(void) {
+	if(stacks == NULL)
+		return;
+	int i = 0;
+	for(i = 0; stacks[i] != NULL; i++) {
+		janus_sip_shared_stack *stack = stacks[i];
+		g_atomic_int_set(&stack->stopping, 1);
+		if(stack->thread != NULL)
+			g_thread_join(stack->thread);
+		g_async_queue_unref(stack->detached);
+		g_hash_table_destroy(stack->routes);
+		janus_mutex_destroy(&stack->mutex);
+		g_free(stack);
+	}
+	g_free(stacks);
+	stacks = NULL;
+}
+
+/* Helper to add a handle to those of an account (and its helpers) on a
+ * shared stack: must be called with the stack mutex of the account locked */
+static void janus_sip_shared_track(ssip_t *ssip, nua_handle_t *nh) {
+	if(nh == NULL || ssip->handles == NULL || g_hash_table_contains(ssip->handles, nh))
+		return;
+	/* Since this is a new one, let's prune those that were destroyed in the meanwhile */
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, ssip->handles);
+	while(g_hash_table_iter_next(&iter, &key, NULL)) {
+		if(nua_handle_magic((nua_handle_t *)key) == NULL) {
+			g_hash_table_iter_remove(&iter);
+			nua_handle_unref((nua_handle_t *)key);
+			g_atomic_int_add(&ssip->shared->handles, -1);
+		}
+	}
+	g_hash_table_add(ssip->handles, nua_handle_ref(nh));
+	g_atomic_int_inc(&ssip->shared->handles);
+}
+
+static nua_handle_t *janus_sip_stack_handle(ssip_t *stack, janus_sip_session *session) {
+	if(stack->shared == NULL)
+		return nua_handle(stack->s_nua, session, TAG_END());
+	/* The stack is not ours, so the handle needs what we'd have set on the NUA */
+	janus_sip_account *account = &stack->session->account;
+	nua_handle_t *nh = nua_handle(stack->s_nua, session,
+		NUTAG_M_USERNAME(account->username),
+		TAG_IF(account->user_agent, SIPTAG_USER_AGENT_STR(account->user_agent)),
+		TAG_END());
+	janus_sip_shared_track(stack, nh);
+	return nh;
+}
+
+static gboolean janus_sip_shared_attach(janus_sip_session *session) {
+	const char *route = session->account.authuser ? session->account.authuser : session->account.username;
+	if(stacks == NULL || route == NULL)
+		return FALSE;
+	/* Pick the least loaded stack where nobody uses the same Contact username */
+	janus_sip_shared_stack *stack = NULL;
+	int i = 0;
+	for(i = 0; stacks[i] != NULL; i++) {
+		janus_mutex_lock(&stacks[i]->mutex);
+		gboolean taken = g_hash_table_contains(stacks[i]->routes, route);
+		janus_mutex_unlock(&stacks[i]->mutex);
+		if(taken)
+			continue;
+		if(stack == NULL || g_atomic_int_get(&stacks[i]->sessions) < g_atomic_int_get(&stack->sessions))
+			stack = stacks[i];
+	}
+	if(stack == NULL) {
+		JANUS_LOG(LOG_WARN, "Contact username %s in use on all shared SIP stacks, starting a new one\n", route);
+		return FALSE;
+	}
+	ssip_t *ssip = g_malloc0(sizeof(ssip_t));
+	su_home_init(ssip->s_home);
+	ssip->session = session;
+	ssip->shared = stack;
+	ssip->s_root = stack->s_root;
+	ssip->s_nua = stack->s_nua;
+	ssip->route = g_strdup(route);
+	ssip->handles = g_hash_table_new(NULL, NULL);
+	janus_mutex_init(&ssip->smutex);
+	janus_mutex_lock(&stack->mutex);
+	g_hash_table_insert(stack->routes, g_strdup(route), session);
+	janus_mutex_unlock(&stack->mutex);
+	/* The stack keeps a reference until it's done with us, as the thread of a dedicated stack would */
+	janus_refcount_increase(&session->ref);
+	g_atomic_int_inc(&stack->sessions);
+	session->stack = ssip;
+	return TRUE;
+}
+
+static gboolean janus_sip_shared_reroute(janus_sip_session *session) {
+	ssip_t *ssip = session->stack;
+	janus_sip_shared_stack *stack = ssip->shared;
+	const char *route = session->account.authuser ? session->account.authuser : session->account.username;
+	if(route == NULL || (ssip->route != NULL && !strcmp(ssip->route, route)))
+		return TRUE;
+	janus_mutex_lock(&stack->mutex);
+	janus_sip_session *owner = g_hash_table_lookup(stack->routes, route);
+	if(owner != NULL && owner != session) {
+		janus_mutex_unlock(&stack->mutex);
+		return FALSE;
+	}
+	if(ssip->route != NULL && g_hash_table_lookup(stack->routes, ssip->route) == session)
+		g_hash_table_remove(stack->routes, ssip->route);
+	g_free(ssip->route);
+	ssip->route = g_strdup(route);
+	g_hash_table_insert(stack->routes, g_strdup(route), session);
+	janus_mutex_unlock(&stack->mutex);
+	return TRUE;
+}
+
+static void janus_sip_shared_detach(janus_sip_session *session) {
+	/* Handles can only be safely destroyed on the stack thread, so we let it do that */
+	janus_sip_shared_stack *stack = session->stack->shared;
+	janus_mutex_lock(&session->stack->smutex);
+	if(session->stack->s_nua == NULL) {
+		/* Already detached */
+		janus_mutex_unlock(&session->stack->smutex);
+		return;
+	}
+	/* No new handles from now on */
+	session->stack->s_nua = NULL;
+	janus_mutex_unlock(&session->stack->smutex);
+	g_async_queue_push(stack->detached, session);
+}
+
+/* Invoked on the stack thread when an account goes away (or the stack does) */
+static void janus_sip_shared_release(janus_sip_shared_stack *stack, janus_sip_session *session) {
+	ssip_t *ssip = session->stack;
+	JANUS_LOG(LOG_VERB, "Leaving shared SIP stack #%d (%s)...\n", stack->id, session->account.username);
+	janus_mutex_lock(&stack->mutex);
+	if(ssip->route != NULL && g_hash_table_lookup(stack->routes, ssip->route) == session)
+		g_hash_table_remove(stack->routes, ssip->route);
+	janus_mutex_unlock(&stack->mutex);
+	janus_mutex_lock(&ssip->smutex);
+	ssip->s_nua = NULL;
+	ssip->s_nh_r = NULL;
+	ssip->s_nh_i = NULL;
+	GHashTable *subscriptions = ssip->subscriptions;
+	ssip->subscriptions = NULL;
+	GHashTable *handles = ssip->handles;
+	ssip->handles = NULL;
+	janus_mutex_unlock(&ssip->smutex);
+	if(subscriptions != NULL)
+		g_hash_table_unref(subscriptions);
+	if(handles != NULL) {
+		GHashTableIter iter;
+		gpointer key;
+		g_hash_table_iter_init(&iter, handles);
+		while(g_hash_table_iter_next(&iter, &key, NULL)) {
+			nua_handle_t *nh = (nua_handle_t *)key;
+			gboolean call = nua_handle_has_active_call(nh), registered = nua_handle_has_registrations(nh);
+			if(!g_atomic_int_get(&stack->stopping) && nua_handle_magic(nh) != NULL && (call || registered)) {
+				/* A dedicated stack would hang up and unregister when shutting down: we
+				 * do the same, and only get rid of the handle when that's done */
+				nua_handle_bind(nh, (nua_hmagic_t *)stack);
+				if(call)
+					nua_bye(nh, TAG_END());
+				else
+					nua_unregister(nh, TAG_END());
+				continue;
+			}
+			nua_handle_destroy(nh);
+			nua_handle_unref(nh);
+			g_atomic_int_add(&stack->handles, -1);
+		}
+		g_hash_table_destroy(handles);
+	}
+	/* We won't receive other events for this account, so get rid of the
+	 * dangling references for ongoing calls, as nua_r_shutdown does */
+	janus_mutex_lock(&session->mutex);
+	while(session->active_calls) {
+		janus_sip_session *s = (janus_sip_session *)session->active_calls->data;
+		if(s != NULL) {
+			JANUS_LOG(LOG_VERB, "[%p] Removing reference\n", s);
+			janus_refcount_decrease(&s->ref);
+		}
+		session->active_calls = g_list_remove(session->active_calls, s);
+	}
+	janus_mutex_unlock(&session->mutex);
+	g_atomic_int_add(&stack->sessions, -1);
+	janus_refcount_decrease(&session->ref);
+}
+
+/* Helper to find the account an incoming request on a shared stack is for */
+static janus_sip_session *janus_sip_shared_route(janus_sip_shared_stack *stack, sip_t const *sip) {
+	if(sip == NULL)
+		return NULL;
+	janus_sip_session *session = NULL;
+	janus_mutex_lock(&stack->mutex);
+	/* The Request-URI should contain the Contact we registered, but try the To header too */
+	if(sip->sip_request && sip->sip_request->rq_url && sip->sip_request->rq_url->url_user)
+		session = g_hash_table_lookup(stack->routes, sip->sip_request->rq_url->url_user);
+	if(session == NULL && sip->sip_to && sip->sip_to->a_url && sip->sip_to->a_url->url_user)
+		session = g_hash_table_lookup(stack->routes, sip->sip_to->a_url->url_user);
+	janus_mutex_unlock(&stack->mutex);
+	return session;
+}
+
+/* Shared stacks get all events first, and pass those for accounts to the usual callback */
+static void janus_sip_shared_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[]) {
+	janus_sip_shared_stack *stack = (janus_sip_shared_stack *)magic;
+	g_atomic_int_inc(&stack->events);
+	if(hmagic == (nua_hmagic_t *)stack) {
+		/* A handle of an account that went away, hanging up or unregistering */
+		if(event == nua_i_terminated || ((event == nua_r_bye || event == nua_r_unregister) && status >= 200)) {
+			nua_handle_destroy(nh);
+			nua_handle_unref(nh);
+			g_atomic_int_add(&stack->handles, -1);
+		}
+		return;
+	}
+	janus_sip_session *session = (janus_sip_session *)hmagic;
+	if(session == NULL) {
+		if(nh == NULL) {
+			/* An event for the stack itself */
+			if(event == nua_r_shutdown && status >= 200)
+				g_atomic_int_set(&stack->shutdown, 1);
+			return;
+		}
+		/* A new incoming request: find out which account it's for */
+		session = janus_sip_shared_route(stack, sip);
+		if(session == NULL) {
+			JANUS_LOG(LOG_VERB, "[sip stack %d][%s]: no account for this request\n", stack->id, nua_event_name(event));
+			/* OPTIONS are answered by the stack itself */
+			if(event != nua_i_options && sip && sip->sip_request)
+				nua_respond(nh, 404, sip_status_phrase(404), NUTAG_WITH_CURRENT(nua), TAG_END());
+			nua_handle_destroy(nh);
+			return;
+		}
+		nua_handle_bind(nh, session);
+		nua_set_hparams(nh, NUTAG_M_USERNAME(session->account.username), TAG_END());
+		hmagic = (nua_hmagic_t *)session;
+	}
+	/* Make sure we know about this handle, e.g., to destroy it when the account goes away */
+	janus_sip_session *owner = session->master ? session->master : session;
+	if(nh != NULL && owner->stack != NULL) {
+		janus_mutex_lock(&owner->stack->smutex);
+		janus_sip_shared_track(owner->stack, nh);
+		janus_mutex_unlock(&owner->stack->smutex);
+	}
+	janus_sip_sofia_callback(event, status, phrase, nua, magic, nh, hmagic, sip, tags);
+}
+
+/* Timer measuring how late the stack thread is in handling its events */
+static void janus_sip_shared_tick(su_root_magic_t *magic, su_timer_t *timer, su_timer_arg_t *arg) {
+	janus_sip_shared_stack *stack = (janus_sip_shared_stack *)arg;
+	gint64 now = janus_get_monotonic_time();
+	gint64 lag = (now - stack->tick_expected) / 1000;
+	g_atomic_int_set(&stack->lag, lag > 0 ? (gint)lag : 0);
+	g_atomic_int_set(&stack->events_last, g_atomic_int_get(&stack->events));
+	g_atomic_int_set(&stack->events, 0);
+	stack->tick_expected = now + G_USEC_PER_SEC;
+	su_timer_set(timer, janus_sip_shared_tick, arg);
+}
+
+static void *janus_sip_shared_thread(void *data) {
+	janus_sip_shared_stack *stack = (janus_sip_shared_stack *)data;
+	JANUS_LOG(LOG_VERB, "Joining shared sofia loop thread #%d...\n", stack->id);
+	stack->s_root = su_root_create(NULL);
+	/* Same settings as the stacks accounts get, except for the account specific ones */
+	char sip_url[128];
+	char sips_url[128];
+	char *ipv6 = strstr(local_ip, ":");
+	g_snprintf(sip_url, sizeof(sip_url), "sip:%s%s%s:*", ipv6 ? "[" : "", local_ip, ipv6 ? "]" : "");
+	g_snprintf(sips_url, sizeof(sips_url), "sips:%s%s%s:*", ipv6 ? "[" : "", local_ip, ipv6 ? "]" : "");
+	char outbound_options[256] = "use-rport no-validate";
+	if(keepalive_interval > 0)
+		g_strlcat(outbound_options, " options-keepalive", sizeof(outbound_options));
+	if(!behind_nat)
+		g_strlcat(outbound_options, " no-natify", sizeof(outbound_options));
+	stack->s_nua = stack->s_root ? nua_create(stack->s_root,
+				janus_sip_shared_callback,
+				(nua_magic_t *)stack,
+				SIPTAG_ALLOW_STR("INVITE, ACK, BYE, CANCEL, OPTIONS, UPDATE, REFER, MESSAGE, INFO, NOTIFY"),
+				NUTAG_URL(sip_url),
+				NUTAG_SIPS_URL(sips_url),
+				SIPTAG_USER_AGENT_STR(user_agent),
+				NUTAG_KEEPALIVE(keepalive_interval * 1000),	/* Sofia expects it in milliseconds */
+				NUTAG_OUTBOUND(outbound_options),
+				NUTAG_APPL_METHOD("REFER"),			/* We'll respond to incoming REFER messages ourselves */
+				SIPTAG_SUPPORTED_STR("replaces"),	/* Advertise that we support the Replaces header */
+				SIPTAG_SUPPORTED(NULL),
+				TAG_NULL()) : NULL;
+	if(stack->s_nua == NULL) {
+		JANUS_LOG(LOG_ERR, "Error creating shared SIP stack #%d\n", stack->id);
+		if(stack->s_root != NULL)
+			su_root_destroy(stack->s_root);
+		stack->s_root = NULL;
+		g_atomic_int_set(&stack->ready, -1);
+		return NULL;
+	}
+	stack->timer = su_timer_create(su_root_task(stack->s_root), 1000);
+	stack->tick_expected = janus_get_monotonic_time() + G_USEC_PER_SEC;
+	su_timer_set(stack->timer, janus_sip_shared_tick, (su_timer_arg_t *)stack);
+	g_atomic_int_set(&stack->ready, 1);
+	janus_sip_session *session = NULL;
+	while(!g_atomic_int_get(&stack->stopping)) {
+		su_root_step(stack->s_root, 100);
+		while((session = g_async_queue_try_pop(stack->detached)) != NULL)
+			janus_sip_shared_release(stack, session);
+	}
+	/* Get rid of the accounts still here, and then of the stack */
+	while((session = g_async_queue_try_pop(stack->detached)) != NULL)
+		janus_sip_shared_release(stack, session);
+	janus_mutex_lock(&stack->mutex);
+	GList *left = g_hash_table_get_values(stack->routes);
+	janus_mutex_unlock(&stack->mutex);
+	GList *temp = left;
+	while(temp != NULL) {
+		session = (janus_sip_session *)temp->data;
+		janus_mutex_lock(&session->stack->smutex);
+		session->stack->s_nua = NULL;
+		janus_mutex_unlock(&session->stack->smutex);
+		janus_sip_shared_release(stack, session);
+		temp = temp->next;
+	}
+	g_list_free(left);
+	su_timer_destroy(stack->timer);
+	stack->timer = NULL;
+	nua_shutdown(stack->s_nua);
+	while(!g_atomic_int_get(&stack->shutdown))
+		su_root_step(stack->s_root, 100);
+	nua_destroy(stack->s_nua);
+	stack->s_nua = NULL;
+	su_root_destroy(stack->s_root);
+	stack->s_root = NULL;
+	JANUS_LOG(LOG_VERB, "Leaving shared sofia loop thread #%d...\n", stack->id);
 	return NULL;
 }
 
+json_t *janus_sip_query_metrics(void) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return NULL;
+	json_t *metrics = json_object();
+	char name[64];
+	int i = 0;
+	/* Load and throughput of each media relay worker (i.e., per core) */
+	janus_mediarelay_worker_stats *workers = g_malloc0(relay_workers * sizeof(janus_mediarelay_worker_stats));
+	int num = janus_mediarelay_pool_get_stats(relay_pool, workers, relay_workers);
+	for(i = 0; i < num; i++) {
+		g_snprintf(name, sizeof(name), "relay_worker%d_calls", i);
+		json_object_set_new(metrics, name, json_integer(workers[i].calls));
+		g_snprintf(name, sizeof(name), "relay_worker%d_packets_per_second", i);
+		json_object_set_new(metrics, name, json_integer(workers[i].packets_per_second));
+		g_snprintf(name, sizeof(name), "relay_worker%d_bytes_per_second", i);
+		json_object_set_new(metrics, name, json_integer(workers[i].bytes_per_second));
+	}
+	g_free(workers);
+	/* How busy each shared stack is: a growing lag means its thread can't keep up */
+	for(i = 0; stacks != NULL && stacks[i] != NULL; i++) {
+		g_snprintf(name, sizeof(name), "stack%d_sessions", i);
+		json_object_set_new(metrics, name, json_integer(g_atomic_int_get(&stacks[i]->sessions)));
+		g_snprintf(name, sizeof(name), "stack%d_handles", i);
+		json_object_set_new(metrics, name, json_integer(g_atomic_int_get(&stacks[i]->handles)));
+		g_snprintf(name, sizeof(name), "stack%d_events_per_second", i);
+		json_object_set_new(metrics, name, json_integer(g_atomic_int_get(&stacks[i]->events_last)));
+		g_snprintf(name, sizeof(name), "stack%d_lag_ms", i);
+		json_object_set_new(metrics, name, json_integer(g_atomic_int_get(&stacks[i]->lag)));
+	}
+	return metrics;
+}
+
 
 /* Sofia Event thread */
 gpointer janus_sip_sofia_thread(gpointer user_data) {
@@ -73,6 +73,10 @@ metadata = An optional string that can contain any metadata (e.g., JSON)
 			associated with the stream you want users to receive
 is_private = true|false (private streams don't appear when you do a 'list' request)
 filename = path to the local file to stream (only for live/ondemand)
+readers = <only for ondemand: if set, maximum number of shared readers of
+		the file, with viewers joining the one that started most recently
+		rather than getting a thread and playback of their own; default=0,
+		one reader per viewer, always starting from the beginning>
 secret = <optional password needed for manipulating (e.g., destroying
 		or enabling/disabling) the stream>
 pin = <optional password needed for watching the stream>
@@ -98,6 +102,11 @@ videortpmap = RTP map of the video codec (e.g., VP8/90000)
 videofmtp = Codec specific parameters, if any
 videobufferkf = true|false (whether the plugin should store the latest
 	keyframe and send it immediately for new viewers, EXPERIMENTAL)
+videobuffergop = maximum size in kB of a buffer containing all the video
+	packets since the latest keyframe, which new viewers will get in a burst
+	with squeezed timestamps, to start from a clean picture even on sources
+	with a long GOP (only for rtp; 0=disabled, default; if the GOP grows
+	larger than that, nothing is sent until the next keyframe)
 videosimulcast = true|false (do|don't enable video simulcasting)
 videoport2 = second local port for receiving video frames (only for rtp, and simulcasting)
 videoport3 = third local port for receiving video frames (only for rtp, and simulcasting)
@@ -107,6 +116,9 @@ videosvc = true|false (whether the video will have SVC support; works only for V
 collision = in case of collision (more than one SSRC hitting the same port), the plugin
 	will discard incoming RTP packets with a new SSRC unless this many milliseconds
 	passed, which would then change the current SSRC (0=disabled)
+batch = how many RTP packets to try and read at once (using recvmmsg, where
+	available) any time the audio or video sockets are readable, rather than
+	one syscall per packet (default=1, no batching; maximum is 64)
 dataport = local port for receiving data messages to relay
 dataiface = network interface or IP address to bind to, if any (binds to all otherwise)
 datatype = text|binary (type of data this mountpoint will relay, default=text)
@@ -114,7 +126,10 @@ databuffermsg = true|false (whether the plugin should store the latest
 	message and send it immediately for new viewers)
 threads = number of threads to assist with the relaying part, which can help
 	if you expect a lot of viewers that may cause the RTP receiving part
-	in the Streaming plugin to slow down and fail to catch up (default=0)
+	in the Streaming plugin to slow down and fail to catch up (default=0);
+	viewers are spread evenly across threads, and an "info" request with
+	the secret returns the queue depth and number of dropped packets of
+	each of them in a "helpers" array
 
 In case you want to use SRTP for your RTP-based mountpoint, you'll need
 to configure the SRTP-related properties as well, namely the suite to
@@ -125,6 +140,41 @@ feed the mountpoint, as you may risk getting SRTP decrypt errors:
 srtpsuite = 32
 srtpcrypto = WbTBosdVUZqEb6Htqhn+m3z7wUh4RJVR8nE15GbN
 
+In case your RTP mountpoint is fed across a lossy network, audio and
+video can be received via SRT instead of plain UDP, if the plugin was
+built with libsrt support. Each SRT message is expected to contain a
+single RTP packet: SRT takes care of loss recovery, and RTCP, multicast
+and simulcast are not available in this mode. The audioport and
+videoport properties are then the ports to listen on (listener mode,
+the default) or to connect to on srthost (caller mode):
+srt = true
+srtmode = listener|caller
+srthost = host to connect to (only for caller mode)
+srtlatency = SRT receiver latency in milliseconds (default=120)
+srtpassphrase = passphrase to decrypt the SRT stream, if any
+
+Rather than on ports of their own, RTP mountpoints can also receive
+audio and video on the shared ingest port, if one was configured in the
+general settings of the plugin: this makes it easier to have many
+mountpoints on a host with a restrictive firewall, and means one socket
+per ingest thread, rather than two or more per mountpoint. Packets are
+routed to the right mountpoint by SSRC first, then by who sent them (an
+address, with or without port, plus the payload type), and finally by
+payload type alone, which of course only works if no other mountpoint
+on the shared port uses the same one. SSRCs learned via sender or payload
+type are then checked against the sender of the packets. The audioport
+and videoport properties are not needed in this mode, and RTCP, multicast,
+SRT and data are not available on the shared port (data can still be
+received on a port of its own, though); simulcast needs the SSRC of all
+the substreams:
+ingest = true
+audiossrc = SSRC of the audio stream, if known
+audiosource = who sends audio (e.g., 192.0.2.1 or 192.0.2.1:5000, or [2001:db8::1]:5000), if known
+videossrc = SSRC of the video stream (or of the first substream), if known
+videossrc2 = SSRC of the second video substream (only for simulcasting)
+videossrc3 = SSRC of the third video substream (only for simulcasting)
+videosource = who sends video (not available for simulcasting), if known
+
 The Streaming plugin can also be used to (re)stream media that has been
 encrypted using something that can be consumed via Insertable Streams.
 In that case, we only need to be aware of it, so that we can send the
@@ -138,7 +188,8 @@ The following options are only valid for the 'rstp' type:
 url = RTSP stream URL
 rtsp_user = RTSP authorization username, if needed
 rtsp_pwd = RTSP authorization password, if needed
-rtsp_failcheck = whether an error should be returned if connecting to the RTSP server fails (default=true)
+rtsp_failcheck = whether an error should be returned if connecting to the RTSP server fails (default=true);
+	if false, the mountpoint is created anyway, and connects (and reconnects) in the background
 rtspiface = network interface IP address or device name to listen on when receiving RTSP streams
 \endverbatim
  *
@@ -692,6 +743,7 @@ rtspiface = network interface IP address or device name to listen on when receiv
 #include "plugin.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
@@ -710,6 +762,10 @@ rtspiface = network interface IP address or device name to listen on when receiv
 #include <ogg/ogg.h>
 #endif
 
+#ifdef HAVE_LIBSRT
+#include <srt/srt.h>
+#endif
+
 #include "../debug.h"
 #include "../apierror.h"
 #include "../config.h"
@@ -751,7 +807,9 @@ void janus_streaming_data_ready(janus_plugin_session *handle);
 void janus_streaming_hangup_media(janus_plugin_session *handle);
 void janus_streaming_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_streaming_query_session(janus_plugin_session *handle);
+json_t *janus_streaming_query_metrics(void);
 static int janus_streaming_get_fd_port(int fd);
+static void janus_streaming_close_fd(int fd);
 
 /* Plugin setup */
 static janus_plugin janus_streaming_plugin =
@@ -777,6 +835,7 @@ static janus_plugin janus_streaming_plugin =
 		.hangup_media = janus_streaming_hangup_media,
 		.destroy_session = janus_streaming_destroy_session,
 		.query_session = janus_streaming_query_session,
+		.query_metrics = janus_streaming_query_metrics,
 	);
 
 /* Plugin creator */
@@ -833,10 +892,23 @@ static struct janus_json_parameter create_parameters[] = {
 };
 static struct janus_json_parameter rtp_parameters[] = {
 	{"collision", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"batch", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtpsuite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtpcrypto", JSON_STRING, 0},
-	{"e2ee", JANUS_JSON_BOOL, 0}
+	{"e2ee", JANUS_JSON_BOOL, 0},
+	{"srt", JANUS_JSON_BOOL, 0},
+	{"srtmode", JSON_STRING, 0},
+	{"srthost", JSON_STRING, 0},
+	{"srtlatency", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"srtpassphrase", JSON_STRING, 0},
+	{"ingest", JANUS_JSON_BOOL, 0},
+	{"audiossrc", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"audiosource", JSON_STRING, 0},
+	{"videossrc", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"videossrc2", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"videossrc3", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"videosource", JSON_STRING, 0}
 };
 static struct janus_json_parameter live_parameters[] = {
 	{"filename", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
@@ -846,6 +918,7 @@ static struct janus_json_parameter live_parameters[] = {
 };
 static struct janus_json_parameter ondemand_parameters[] = {
 	{"filename", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
+	{"readers", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audiortpmap", JSON_STRING, 0},
 	{"audiofmtp", JSON_STRING, 0},
 	{"audiopt", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
@@ -869,7 +942,7 @@ static struct janus_json_parameter rtsp_parameters[] = {
 #endif
 static struct janus_json_parameter rtp_audio_parameters[] = {
 	{"audiomcast", JSON_STRING, 0},
-	{"audioport", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"audioport", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audiortcpport", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audiopt", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"audiortpmap", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
@@ -879,12 +952,13 @@ static struct janus_json_parameter rtp_audio_parameters[] = {
 };
 static struct janus_json_parameter rtp_video_parameters[] = {
 	{"videomcast", JSON_STRING, 0},
-	{"videoport", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"videoport", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"videortcpport", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"videopt", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"videortpmap", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"videofmtp", JSON_STRING, 0},
 	{"videobufferkf", JANUS_JSON_BOOL, 0},
+	{"videobuffergop", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"videoiface", JSON_STRING, 0},
 	{"videosimulcast", JANUS_JSON_BOOL, 0},
 	{"videoport2", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
@@ -948,6 +1022,7 @@ static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static gboolean string_ids = FALSE;
+static gboolean rtsp_async_connect = FALSE;
 static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
 static void *janus_streaming_handler(void *data);
@@ -957,10 +1032,17 @@ static void *janus_streaming_handler(void *data);
 #define DEFAULT_RTP_RANGE_MAX 60000
 static uint16_t rtp_range_min = DEFAULT_RTP_RANGE_MIN;
 static uint16_t rtp_range_max = DEFAULT_RTP_RANGE_MAX;
-static uint16_t rtp_range_slider = DEFAULT_RTP_RANGE_MIN;
+static janus_network_port_pool *port_pool = NULL;
 static janus_mutex fd_mutex = JANUS_MUTEX_INITIALIZER;
 
+/* Shared port RTP mountpoints can receive their audio and video on, if configured */
+#define DEFAULT_INGEST_BATCH	32
+static uint16_t ingest_port = 0;
+static janus_network_address ingest_iface;
+static int ingest_threads = 1, ingest_batch = DEFAULT_INGEST_BATCH;
+
 static void *janus_streaming_ondemand_thread(void *data);
+static void *janus_streaming_ondemand_reader_thread(void *data);
 static void *janus_streaming_filesource_thread(void *data);
 static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data);
 static void janus_streaming_relay_rtcp_packet(gpointer data, gpointer user_data);
@@ -986,8 +1068,16 @@ typedef struct janus_streaming_rtp_keyframe {
 	/* This is where we store packets while we're still collecting the whole keyframe */
 	GList *temp_keyframe;
 	guint32 temp_ts;
+	/* If a maximum size is set, we store all the packets since the last keyframe (the GOP) instead */
+	size_t gop_max;
+	GPtrArray *gop;
+	size_t gop_size;
+	guint32 gop_last_ts;
+	gboolean gop_overflow;	/* If the GOP got too large, we wait for the next keyframe */
 	janus_mutex mutex;
 } janus_streaming_rtp_keyframe;
+/* Timestamp step we use for the frames of a GOP we send to new viewers (1ms at 90kHz) */
+#define JANUS_STREAMING_GOP_TS_STEP	90
 
 typedef struct janus_streaming_rtp_relay_packet {
 	janus_rtp_header *data;
@@ -1000,17 +1090,20 @@ typedef struct janus_streaming_rtp_relay_packet {
 	uint32_t ssrc[3];
 	janus_videocodec codec;
 	int substream;
+	/* Simulcast decisions taken for this packet so far, shared by viewers in the same state (only used by the thread relaying it) */
+	janus_rtp_simulcasting_cache *sim_cache;
 	uint32_t timestamp;
 	uint16_t seq_number;
+	/* When the packet was received (0 if unknown), to rewrite headers for all viewers without asking the clock each time */
+	gint64 received;
 	/* The following are only relevant for VP9 SVC*/
 	gboolean svc;
 	janus_vp9_svc_info svc_info;
 	/* The following is only relevant for datachannels */
 	gboolean textdata;
 } janus_streaming_rtp_relay_packet;
-static janus_streaming_rtp_relay_packet exit_packet;
 static void janus_streaming_rtp_relay_packet_free(janus_streaming_rtp_relay_packet *pkt) {
-	if(pkt == NULL || pkt == &exit_packet)
+	if(pkt == NULL)
 		return;
 	g_free(pkt->data);
 	g_free(pkt);
@@ -1024,6 +1117,50 @@ typedef struct janus_streaming_buffer {
 } janus_streaming_buffer;
 #endif
 
+/* Maximum number of RTP packets we can read at once, when batching */
+#define JANUS_STREAMING_MAX_BATCH	64
+/* RTP mountpoints can get their audio and video over SRT, rather than
+ * plain UDP: SRT messages are expected to contain one RTP packet each */
+typedef struct janus_streaming_srt_config {
+	gboolean caller;	/* Whether we connect to the sender, or wait for it to connect to us */
+	char *host;			/* Only needed in caller mode */
+	int latency;		/* Receiver latency, in milliseconds */
+	char *passphrase;	/* Encryption passphrase, if any */
+} janus_streaming_srt_config;
+#define JANUS_STREAMING_SRT_DEFAULT_LATENCY	120
+/* RTP mountpoints can also get their audio and video on the shared ingest
+ * port, rather than on ports of their own: packets are then demultiplexed
+ * by SSRC, by sender address, or by payload type, in this order */
+typedef struct janus_streaming_ingest_config {
+	uint32_t audio_ssrc;	/* SSRC of the audio stream, if known */
+	uint32_t video_ssrc[3];	/* SSRCs of the video streams, if known (mandatory for simulcast) */
+	char *audio_source;		/* Who sends audio (an address, optionally with port), if known */
+	char *video_source;		/* Who sends video (an address, optionally with port), if known */
+} janus_streaming_ingest_config;
+static janus_streaming_ingest_config *janus_streaming_ingest_config_dup(const janus_streaming_ingest_config *config);
+static void janus_streaming_ingest_config_free(janus_streaming_ingest_config *config);
+#ifdef HAVE_LIBSRT
+typedef struct janus_streaming_srt_media {
+	const char *type;		/* "audio" or "video", for logging purposes */
+	int port;				/* Port we listen on, or connect to */
+	janus_network_address iface;
+	SRTSOCKET listener;		/* Only used in listener mode */
+	SRTSOCKET sock;			/* The SRT connection feeding us, if any */
+	int fd;					/* Where we write the RTP packets we receive */
+	gint64 reconnect;		/* When to try connecting again, in caller mode */
+} janus_streaming_srt_media;
+typedef struct janus_streaming_srt {
+	char *name;
+	janus_streaming_srt_config config;
+	janus_streaming_srt_media media[2];
+	int eid;
+	GThread *thread;
+	volatile gint destroyed;
+} janus_streaming_srt;
+static void janus_streaming_srt_destroy(janus_streaming_srt *srt);
+static json_t *janus_streaming_srt_info(janus_streaming_srt *srt, gboolean admin);
+#endif
+
 typedef struct janus_streaming_rtp_source {
 	char *audio_host;
 	gint audio_port, remote_audio_port;
@@ -1054,6 +1191,7 @@ typedef struct janus_streaming_rtp_source {
 	gint64 last_received_data;
 	uint32_t audio_ssrc;		/* Only needed for fixing outgoing RTCP packets */
 	uint32_t video_ssrc;		/* Only needed for fixing outgoing RTCP packets */
+	uint32_t audio_last_ssrc, video_last_ssrc[3];	/* Needed to detect new streams and collisions */
 	volatile gint need_pli;		/* Whether we need to send a PLI later */
 	volatile gint sending_pli;	/* Whether we're currently sending a PLI */
 	gint64 pli_latest;			/* Time of latest sent PLI (to avoid flooding) */
@@ -1068,7 +1206,8 @@ typedef struct janus_streaming_rtp_source {
 	char *rtsp_username, *rtsp_password;
 	int ka_timeout;
 	char *rtsp_ahost, *rtsp_vhost;
-	gboolean reconnecting;
+	volatile gint reconnecting;		/* Whether the RTSP thread is (re)connecting */
+	volatile gint rtsp_generation;	/* Incremented any time the RTSP thread connects */
 	gint64 reconnect_timer;
 	janus_mutex rtsp_mutex;
 #endif
@@ -1076,6 +1215,8 @@ typedef struct janus_streaming_rtp_source {
 	gboolean textdata;
 	gboolean buffermsg;
 	int rtp_collision;
+	int batch;
+	guint64 batch_reads, batch_packets;
 	void *last_msg;
 	janus_mutex buffermsg_mutex;
 	janus_network_address audio_iface;
@@ -1089,11 +1230,22 @@ typedef struct janus_streaming_rtp_source {
 	srtp_policy_t srtp_policy;
 	/* If the media is end-to-end encrypted, we may need to know */
 	gboolean e2ee;
+#ifdef HAVE_LIBSRT
+	/* Only needed if audio and video are received via SRT */
+	janus_streaming_srt *srt;
+#endif
+	/* Only needed if audio and video are received on the shared ingest port */
+	janus_streaming_ingest_config *ingest;
+	janus_mutex ingest_mutex;	/* Ingest threads may get audio and video at the same time */
 } janus_streaming_rtp_source;
 
 typedef struct janus_streaming_file_source {
 	char *filename;
 	gboolean opus;
+	/* For ondemand mountpoints, maximum number of shared readers (0 means one thread per viewer) */
+	int readers;
+	/* Shared readers currently running (protected by the mountpoint mutex) */
+	GList *active_readers;
 } janus_streaming_file_source;
 
 /* used for audio/video fd and RTCP fd */
@@ -1138,6 +1290,8 @@ typedef struct janus_streaming_mountpoint {
 	janus_refcount ref;
 } janus_streaming_mountpoint;
 GHashTable *mountpoints = NULL, *mountpoints_temp = NULL;
+/* Kept up to date when mountpoints are added or removed, for the core metrics */
+static volatile gint mountpoints_count = 0;
 janus_mutex mountpoints_mutex;
 static char *admin_key = NULL;
 
@@ -1148,10 +1302,32 @@ typedef struct janus_streaming_helper {
 	int num_viewers;
 	GList *viewers;
 	GAsyncQueue *queued_packets;
+	volatile gint dropped;
 	volatile gint destroyed;
 	janus_mutex mutex;
 	janus_refcount ref;
 } janus_streaming_helper;
+/* Maximum number of packets we queue for a helper thread, before we start dropping */
+#define JANUS_STREAMING_HELPER_MAX_QUEUE	1024
+/* Packets are queued once for all helper threads, which share the same copy */
+typedef struct janus_streaming_helper_packet {
+	janus_streaming_rtp_relay_packet packet;
+	janus_refcount ref;
+} janus_streaming_helper_packet;
+static janus_streaming_helper_packet exit_helper_packet;
+/* Queued packets are accounted in the memory the core reports for the plugin */
+#define JANUS_STREAMING_HELPER_PACKET_SIZE(pkt)	((int)sizeof(janus_streaming_helper_packet) + (pkt)->packet.length)
+static void janus_streaming_helper_packet_free(const janus_refcount *pkt_ref) {
+	janus_streaming_helper_packet *pkt = janus_refcount_containerof(pkt_ref, janus_streaming_helper_packet, ref);
+	gateway->account_memory(&janus_streaming_plugin, NULL, -JANUS_STREAMING_HELPER_PACKET_SIZE(pkt));
+	g_free(pkt->packet.data);
+	g_free(pkt);
+}
+static void janus_streaming_helper_packet_unref(janus_streaming_helper_packet *pkt) {
+	if(pkt == NULL || pkt == &exit_helper_packet)
+		return;
+	janus_refcount_decrease(&pkt->ref);
+}
 static void janus_streaming_helper_destroy(janus_streaming_helper *helper) {
 	if(helper && g_atomic_int_compare_and_exchange(&helper->destroyed, 0, 1))
 		janus_refcount_decrease(&helper->ref);
@@ -1165,7 +1341,18 @@ static void janus_streaming_helper_free(const janus_refcount *helper_ref) {
 	g_free(helper);
 }
 static void *janus_streaming_helper_thread(void *data);
-static void janus_streaming_helper_rtprtcp_packet(gpointer data, gpointer user_data);
+static void janus_streaming_helper_queue_packet(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet);
+
+/* Shared reader of an ondemand mountpoint: it reads the file once for all
+ * the viewers assigned to it, and their own contexts take care of fixing
+ * sequence numbers and timestamps, so each of them sees a stream of its own */
+typedef struct janus_streaming_ondemand_reader {
+	janus_streaming_mountpoint *mp;
+	guint id;
+	gint64 started;
+} janus_streaming_ondemand_reader;
+/* New viewers join the most recent reader, unless it started more than this long ago */
+#define JANUS_STREAMING_READER_STAGGER	(2*G_USEC_PER_SEC)
 
 /* Helper to create an RTP live source (e.g., from gstreamer/ffmpeg/vlc/etc.) */
 janus_streaming_mountpoint *janus_streaming_create_rtp_source(
@@ -1175,8 +1362,9 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 			uint16_t aport, uint16_t artcpport, uint8_t acodec, char *artpmap, char *afmtp, gboolean doaskew,
 		gboolean dovideo, gboolean dovideortcp, char *vmcast, const janus_network_address *viface,
 			uint16_t vport, uint16_t vrtcpport, uint8_t vcodec, char *vrtpmap, char *vfmtp, gboolean bufferkf,
-			gboolean simulcast, uint16_t vport2, uint16_t vport3, gboolean svc, gboolean dovskew, int rtp_collision,
-		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean textdata, gboolean buffermsg);
+			int buffergop, gboolean simulcast, uint16_t vport2, uint16_t vport3, gboolean svc, gboolean dovskew, int rtp_collision, int batch,
+		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean textdata, gboolean buffermsg,
+		const janus_streaming_srt_config *srt, const janus_streaming_ingest_config *ingest);
 /* Helper to create a file/ondemand live source */
 janus_streaming_mountpoint *janus_streaming_create_file_source(
 		uint64_t id, char *id_str, char *name, char *desc, char *metadata, char *filename, gboolean live,
@@ -1189,6 +1377,18 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		gboolean dovideo, int videopt, char *vrtpmap, char *vfmtp, gboolean bufferkf,
 		const janus_network_address *iface, int threads,
 		gboolean error_on_failure);
+#ifdef HAVE_LIBCURL
+/* Thread sending all RTSP requests */
+static int janus_streaming_rtsp_start(void);
+static void janus_streaming_rtsp_stop(void);
+#endif
+/* Threads receiving on the shared ingest port, and routing of what they get */
+static int janus_streaming_ingest_start(void);
+static void janus_streaming_ingest_stop(void);
+static int janus_streaming_ingest_add(janus_streaming_mountpoint *mp);
+static void janus_streaming_ingest_remove(janus_streaming_mountpoint *mp);
+static json_t *janus_streaming_ingest_info(janus_streaming_rtp_source *source);
+static void janus_streaming_ingest_save(janus_config_category *c, janus_streaming_rtp_source *source);
 
 
 typedef struct janus_streaming_message {
@@ -1216,8 +1416,13 @@ typedef struct janus_streaming_session {
 	int spatial_layer, target_spatial_layer;
 	gint64 last_spatial_layer[3];
 	int temporal_layer, target_temporal_layer;
+	/* If we sent a GOP when starting, live video packets we already sent that way are skipped */
+	gboolean gop_skip;
+	uint16_t gop_last_seq;
 	/* If the media is end-to-end encrypted, we may need to know */
 	gboolean e2ee;
+	/* Shared reader this viewer is assigned to, for ondemand mountpoints that use them */
+	janus_streaming_ondemand_reader *reader;
 	janus_mutex mutex;
 	volatile gint dataready;
 	volatile gint stopping;
@@ -1226,6 +1431,10 @@ typedef struct janus_streaming_session {
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_streaming_session;
+static void janus_streaming_helper_add_viewer(janus_streaming_mountpoint *mp, janus_streaming_session *session);
+static void janus_streaming_helper_remove_viewer(janus_streaming_mountpoint *mp, janus_streaming_session *session);
+static int janus_streaming_ondemand_reader_assign(janus_streaming_mountpoint *mp, janus_streaming_session *session);
+
 static GHashTable *sessions;
 static janus_mutex sessions_mutex = JANUS_MUTEX_INITIALIZER;
 
@@ -1257,6 +1466,9 @@ static void janus_streaming_mountpoint_destroy(janus_streaming_mountpoint *mount
 				res = write(source->pipefd[1], &code, sizeof(int));
 			} while(res == -1 && errno == EINTR);
 		}
+		/* Stop getting packets from the shared ingest port, if we were */
+		if(source != NULL && source->ingest != NULL)
+			janus_streaming_ingest_remove(mountpoint);
 	}
 	/* Wait for the thread to finish */
 	if(mountpoint->thread != NULL)
@@ -1266,7 +1478,7 @@ static void janus_streaming_mountpoint_destroy(janus_streaming_mountpoint *mount
 		GList *l = mountpoint->threads;
 		while(l) {
 			janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-			g_async_queue_push(ht->queued_packets, &exit_packet);
+			g_async_queue_push(ht->queued_packets, &exit_helper_packet);
 			janus_streaming_helper_destroy(ht);
 			l = l->next;
 		}
@@ -1563,6 +1775,9 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 #endif
 #ifndef HAVE_LIBOGG
 	JANUS_LOG(LOG_WARN, "libogg not available, Streaming plugin will not have file-based Opus streaming\n");
+#endif
+#ifdef HAVE_LIBSRT
+	srt_startup();
 #endif
 	if(g_atomic_int_get(&stopping)) {
 		/* Still stopping from before */
@@ -1596,6 +1811,7 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 
 	/* Threads will expect this to be set */
 	g_atomic_int_set(&initialized, 1);
+	janus_network_address_nullify(&ingest_iface);
 
 	/* Parse configuration to populate the mountpoints */
 	if(config != NULL) {
@@ -1633,7 +1849,6 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 			}
 			if(rtp_range_max == 0)
 				rtp_range_max = 65535;
-			rtp_range_slider = rtp_range_min;
 			JANUS_LOG(LOG_VERB, "Streaming RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
 		}
 		janus_config_item *events = janus_config_get(config, config_general, janus_config_type_item, "events");
@@ -1648,7 +1863,52 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "Streaming will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *rtsp_async = janus_config_get(config, config_general, janus_config_type_item, "rtsp_async_connect");
+		if(rtsp_async != NULL && rtsp_async->value != NULL)
+			rtsp_async_connect = janus_is_true(rtsp_async->value);
+		if(rtsp_async_connect) {
+			JANUS_LOG(LOG_INFO, "RTSP mountpoints in the configuration file will connect in the background\n");
+		}
+		janus_config_item *iport = janus_config_get(config, config_general, janus_config_type_item, "ingest_port");
+		if(iport != NULL && iport->value != NULL && janus_string_to_uint16(iport->value, &ingest_port) < 0) {
+			JANUS_LOG(LOG_WARN, "Invalid ingest port value: %s (disabling the shared ingest port)\n", iport->value);
+			ingest_port = 0;
+		}
+		janus_config_item *iiface = janus_config_get(config, config_general, janus_config_type_item, "ingest_iface");
+		if(ingest_port > 0 && iiface != NULL && iiface->value != NULL &&
+				(!ifas || janus_network_lookup_interface(ifas, iiface->value, &ingest_iface) != 0)) {
+			JANUS_LOG(LOG_WARN, "Invalid ingest interface '%s', binding to all interfaces\n", iiface->value);
+			janus_network_address_nullify(&ingest_iface);
+		}
+		janus_config_item *ithreads = janus_config_get(config, config_general, janus_config_type_item, "ingest_threads");
+		if(ithreads != NULL && ithreads->value != NULL) {
+			ingest_threads = atoi(ithreads->value);
+			if(ingest_threads < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid ingest threads value: %s (using 1)\n", ithreads->value);
+				ingest_threads = 1;
+			}
+		}
+		janus_config_item *ibatch = janus_config_get(config, config_general, janus_config_type_item, "ingest_batch");
+		if(ibatch != NULL && ibatch->value != NULL) {
+			ingest_batch = atoi(ibatch->value);
+			if(ingest_batch < 1 || ingest_batch > JANUS_STREAMING_MAX_BATCH) {
+				JANUS_LOG(LOG_WARN, "Invalid ingest batch value: %s (using %d)\n", ibatch->value, DEFAULT_INGEST_BATCH);
+				ingest_batch = DEFAULT_INGEST_BATCH;
+			}
+		}
 	}
+#ifdef HAVE_LIBCURL
+	/* All RTSP requests are sent by a dedicated thread */
+	if(janus_streaming_rtsp_start() < 0)
+		JANUS_LOG(LOG_WARN, "RTSP mountpoints won't be available\n");
+#endif
+	/* If configured, RTP mountpoints can share a port for their audio and video */
+	if(janus_streaming_ingest_start() < 0)
+		JANUS_LOG(LOG_WARN, "RTP mountpoints won't be able to use the shared ingest port\n");
+	/* Ports picked from the range are taken from a pool, shared with other plugins:
+	 * as mountpoints may give theirs back after we're destroyed, we never free it */
+	if(port_pool == NULL)
+		port_pool = janus_network_port_pool_new("streaming", rtp_range_min, rtp_range_max);
 	/* Iterate on all mountpoints */
 	mountpoints = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
 		(GDestroyNotify)g_free, (GDestroyNotify)janus_streaming_mountpoint_destroy);
@@ -1736,6 +1996,7 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				janus_config_item *vrtpmap = janus_config_get(config, cat, janus_config_type_item, "videortpmap");
 				janus_config_item *vfmtp = janus_config_get(config, cat, janus_config_type_item, "videofmtp");
 				janus_config_item *vkf = janus_config_get(config, cat, janus_config_type_item, "videobufferkf");
+				janus_config_item *vgop = janus_config_get(config, cat, janus_config_type_item, "videobuffergop");
 				janus_config_item *vsc = janus_config_get(config, cat, janus_config_type_item, "videosimulcast");
 				janus_config_item *vport2 = janus_config_get(config, cat, janus_config_type_item, "videoport2");
 				janus_config_item *vport3 = janus_config_get(config, cat, janus_config_type_item, "videoport3");
@@ -1743,10 +2004,23 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				janus_config_item *dbm = janus_config_get(config, cat, janus_config_type_item, "databuffermsg");
 				janus_config_item *dt = janus_config_get(config, cat, janus_config_type_item, "datatype");
 				janus_config_item *rtpcollision = janus_config_get(config, cat, janus_config_type_item, "collision");
+				janus_config_item *batch = janus_config_get(config, cat, janus_config_type_item, "batch");
 				janus_config_item *threads = janus_config_get(config, cat, janus_config_type_item, "threads");
 				janus_config_item *ssuite = janus_config_get(config, cat, janus_config_type_item, "srtpsuite");
 				janus_config_item *scrypto = janus_config_get(config, cat, janus_config_type_item, "srtpcrypto");
 				janus_config_item *e2ee = janus_config_get(config, cat, janus_config_type_item, "e2ee");
+				janus_config_item *srt = janus_config_get(config, cat, janus_config_type_item, "srt");
+				janus_config_item *srtmode = janus_config_get(config, cat, janus_config_type_item, "srtmode");
+				janus_config_item *srthost = janus_config_get(config, cat, janus_config_type_item, "srthost");
+				janus_config_item *srtlatency = janus_config_get(config, cat, janus_config_type_item, "srtlatency");
+				janus_config_item *srtpassphrase = janus_config_get(config, cat, janus_config_type_item, "srtpassphrase");
+				janus_config_item *ingest = janus_config_get(config, cat, janus_config_type_item, "ingest");
+				janus_config_item *assrc = janus_config_get(config, cat, janus_config_type_item, "audiossrc");
+				janus_config_item *asource = janus_config_get(config, cat, janus_config_type_item, "audiosource");
+				janus_config_item *vssrc = janus_config_get(config, cat, janus_config_type_item, "videossrc");
+				janus_config_item *vssrc2 = janus_config_get(config, cat, janus_config_type_item, "videossrc2");
+				janus_config_item *vssrc3 = janus_config_get(config, cat, janus_config_type_item, "videossrc3");
+				janus_config_item *vsource = janus_config_get(config, cat, janus_config_type_item, "videosource");
 				gboolean is_private = priv && priv->value && janus_is_true(priv->value);
 				gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
 				gboolean doaskew = audio && askew && askew->value && janus_is_true(askew->value);
@@ -1754,12 +2028,15 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				gboolean dovskew = video && vskew && vskew->value && janus_is_true(vskew->value);
 				gboolean dosvc = video && vsvc && vsvc->value && janus_is_true(vsvc->value);
 				gboolean dodata = data && data->value && janus_is_true(data->value);
+				gboolean doingest = ingest && ingest->value && janus_is_true(ingest->value);
 				gboolean bufferkf = video && vkf && vkf->value && janus_is_true(vkf->value);
+				int buffergop = (video && vgop && vgop->value) ? atoi(vgop->value) : 0;
 				gboolean simulcast = video && vsc && vsc->value && janus_is_true(vsc->value);
-				if(simulcast && bufferkf) {
+				if(simulcast && (bufferkf || buffergop > 0)) {
 					/* FIXME We'll need to take care of this */
 					JANUS_LOG(LOG_WARN, "Simulcasting enabled, so disabling buffering of keyframes\n");
 					bufferkf = FALSE;
+					buffergop = 0;
 				}
 				gboolean buffermsg = data && dbm && dbm->value && janus_is_true(dbm->value);
 				gboolean textdata = TRUE;
@@ -1781,8 +2058,8 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				}
 				uint16_t audio_port = 0, audio_rtcp_port = 0;
 				if(doaudio &&
-						(aport == NULL || aport->value == NULL ||
-						janus_string_to_uint16(aport->value, &audio_port) < 0 || audio_port == 0 ||
+						((!doingest && (aport == NULL || aport->value == NULL ||
+						janus_string_to_uint16(aport->value, &audio_port) < 0 || audio_port == 0)) ||
 						acodec == NULL || acodec->value == NULL ||
 						artpmap == NULL || artpmap->value == NULL)) {
 					JANUS_LOG(LOG_ERR, "Can't add 'rtp' mountpoint '%s', missing mandatory information for audio...\n", cat->name);
@@ -1810,8 +2087,8 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				}
 				uint16_t video_port = 0, video_port2 = 0, video_port3 = 0, video_rtcp_port = 0;
 				if(dovideo &&
-						(vport == NULL || vport->value == NULL ||
-						janus_string_to_uint16(vport->value, &video_port) < 0 || video_port == 0 ||
+						((!doingest && (vport == NULL || vport->value == NULL ||
+						janus_string_to_uint16(vport->value, &video_port) < 0 || video_port == 0)) ||
 						vcodec == NULL || vcodec->value == NULL ||
 						vrtpmap == NULL || vrtpmap->value == NULL)) {
 					JANUS_LOG(LOG_ERR, "Can't add 'rtp' mountpoint '%s', missing mandatory information for video...\n", cat->name);
@@ -1885,11 +2162,44 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 					cl = cl->next;
 					continue;
 				}
+				if(batch && batch->value && atoi(batch->value) < 0) {
+					JANUS_LOG(LOG_ERR, "Can't add 'rtp' mountpoint '%s', invalid batch configuration...\n", cat->name);
+					cl = cl->next;
+					continue;
+				}
 				if(threads && threads->value && atoi(threads->value) < 0) {
 					JANUS_LOG(LOG_ERR, "Can't add 'rtp' mountpoint '%s', invalid threads configuration...\n", cat->name);
 					cl = cl->next;
 					continue;
 				}
+				janus_streaming_srt_config srt_config = { 0 };
+				gboolean dosrt = srt && srt->value && janus_is_true(srt->value);
+				if(dosrt) {
+					if(srtmode && srtmode->value && strcasecmp(srtmode->value, "listener") &&
+							strcasecmp(srtmode->value, "caller")) {
+						JANUS_LOG(LOG_ERR, "Can't add 'rtp' mountpoint '%s', invalid SRT mode '%s'...\n", cat->name, srtmode->value);
+						cl = cl->next;
+						continue;
+					}
+					if(srtlatency && srtlatency->value && atoi(srtlatency->value) < 0) {
+						JANUS_LOG(LOG_ERR, "Can't add 'rtp' mountpoint '%s', invalid SRT latency...\n", cat->name);
+						cl = cl->next;
+						continue;
+					}
+					srt_config.caller = srtmode && srtmode->value && !strcasecmp(srtmode->value, "caller");
+					srt_config.host = srthost && srthost->value ? (char *)srthost->value : NULL;
+					srt_config.latency = srtlatency && srtlatency->value ? atoi(srtlatency->value) : 0;
+					srt_config.passphrase = srtpassphrase && srtpassphrase->value ? (char *)srtpassphrase->value : NULL;
+				}
+				janus_streaming_ingest_config ingest_config = { 0 };
+				if(doingest) {
+					ingest_config.audio_ssrc = (assrc && assrc->value) ? g_ascii_strtoull(assrc->value, NULL, 10) : 0;
+					ingest_config.video_ssrc[0] = (vssrc && vssrc->value) ? g_ascii_strtoull(vssrc->value, NULL, 10) : 0;
+					ingest_config.video_ssrc[1] = (vssrc2 && vssrc2->value) ? g_ascii_strtoull(vssrc2->value, NULL, 10) : 0;
+					ingest_config.video_ssrc[2] = (vssrc3 && vssrc3->value) ? g_ascii_strtoull(vssrc3->value, NULL, 10) : 0;
+					ingest_config.audio_source = asource && asource->value ? (char *)asource->value : NULL;
+					ingest_config.video_source = vsource && vsource->value ? (char *)vsource->value : NULL;
+				}
 				JANUS_LOG(LOG_VERB, "Audio %s, Video %s, Data %s\n",
 					doaudio ? "enabled" : "NOT enabled",
 					dovideo ? "enabled" : "NOT enabled",
@@ -1922,16 +2232,20 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 						vrtpmap ? (char *)vrtpmap->value : NULL,
 						vfmtp ? (char *)vfmtp->value : NULL,
 						bufferkf,
+						buffergop,
 						simulcast,
 						(vport2 && vport2->value) ? video_port2 : 0,
 						(vport3 && vport3->value) ? video_port3 : 0,
 						dosvc,
 						dovskew,
 						(rtpcollision && rtpcollision->value) ?  atoi(rtpcollision->value) : 0,
+						(batch && batch->value) ? atoi(batch->value) : 0,
 						dodata,
 						dodata && diface && diface->value ? &data_iface : NULL,
 						(dport && dport->value) ? data_port : 0,
-						textdata, buffermsg)) == NULL) {
+						textdata, buffermsg,
+						dosrt ? &srt_config : NULL,
+						doingest ? &ingest_config : NULL)) == NULL) {
 					JANUS_LOG(LOG_ERR, "Error creating 'rtp' mountpoint '%s'...\n", cat->name);
 					cl = cl->next;
 					continue;
@@ -2021,6 +2335,7 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				janus_config_item *artpmap = janus_config_get(config, cat, janus_config_type_item, "audiortpmap");
 				janus_config_item *afmtp = janus_config_get(config, cat, janus_config_type_item, "audiofmtp");
 				janus_config_item *video = janus_config_get(config, cat, janus_config_type_item, "video");
+				janus_config_item *readers = janus_config_get(config, cat, janus_config_type_item, "readers");
 				if(file == NULL || file->value == NULL) {
 					JANUS_LOG(LOG_ERR, "Can't add 'ondemand' mountpoint '%s', missing mandatory information...\n", cat->name);
 					cl = cl->next;
@@ -2071,6 +2386,12 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 					continue;
 				}
 				mp->is_private = is_private;
+				if(readers && readers->value) {
+					janus_streaming_file_source *source = mp->source;
+					source->readers = atoi(readers->value);
+					if(source->readers < 0)
+						source->readers = 0;
+				}
 				if(secret && secret->value)
 					mp->secret = g_strdup(secret->value);
 				if(pin && pin->value)
@@ -2114,6 +2435,9 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				gboolean error_on_failure = TRUE;
 				if(failerr && failerr->value)
 					error_on_failure = janus_is_true(failerr->value);
+				/* Connecting blocks, so we may have been asked to leave it to the relay thread */
+				if(rtsp_async_connect)
+					error_on_failure = FALSE;
 				if(threads && threads->value && atoi(threads->value) < 0) {
 					JANUS_LOG(LOG_ERR, "Can't add 'rtsp' mountpoint '%s', invalid threads configuration...\n", cat->name);
 					cl = cl->next;
@@ -2221,6 +2545,9 @@ void janus_streaming_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+#ifdef HAVE_LIBCURL
+	janus_streaming_rtsp_stop();
+#endif
 
 	/* Remove all mountpoints */
 	janus_mutex_lock(&mountpoints_mutex);
@@ -2229,6 +2556,7 @@ void janus_streaming_destroy(void) {
 	g_hash_table_destroy(mountpoints_temp);
 	mountpoints_temp = NULL;
 	janus_mutex_unlock(&mountpoints_mutex);
+	janus_streaming_ingest_stop();
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
 	sessions = NULL;
@@ -2236,8 +2564,13 @@ void janus_streaming_destroy(void) {
 	g_async_queue_unref(messages);
 	messages = NULL;
 
+	/* Fold the permanent changes we journaled back into the configuration file */
+	janus_config_compact(config, config_folder, JANUS_STREAMING_PACKAGE);
 	janus_config_destroy(config);
 	g_free(admin_key);
+#ifdef HAVE_LIBSRT
+	srt_cleanup();
+#endif
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -2323,6 +2656,14 @@ void janus_streaming_destroy_session(janus_plugin_session *handle, int *error) {
 	return;
 }
 
+json_t *janus_streaming_query_metrics(void) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return NULL;
+	json_t *metrics = json_object();
+	json_object_set_new(metrics, "mountpoints", json_integer(g_atomic_int_get(&mountpoints_count)));
+	return metrics;
+}
+
 json_t *janus_streaming_query_session(janus_plugin_session *handle) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -2541,6 +2882,12 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			janus_streaming_file_source *source = mp->source;
 			if(admin && source->filename)
 				json_object_set_new(ml, "filename", json_string(source->filename));
+			if(admin && source->readers > 0) {
+				json_object_set_new(ml, "readers", json_integer(source->readers));
+				janus_mutex_lock(&mp->mutex);
+				json_object_set_new(ml, "active_readers", json_integer(g_list_length(source->active_readers)));
+				janus_mutex_unlock(&mp->mutex);
+			}
 		} else if(mp->streaming_source == janus_streaming_source_rtp) {
 			janus_streaming_rtp_source *source = mp->source;
 			if(source->is_srtp) {
@@ -2563,6 +2910,9 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			if(source->keyframe.enabled) {
 				json_object_set_new(ml, "videobufferkf", json_true());
 			}
+			if(source->keyframe.gop_max > 0) {
+				json_object_set_new(ml, "videobuffergop", json_integer(source->keyframe.gop_max/1024));
+			}
 			if(source->simulcast) {
 				json_object_set_new(ml, "videosimulcast", json_true());
 			}
@@ -2575,8 +2925,35 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				json_object_set_new(ml, "videoskew", json_true());
 			if(source->rtp_collision > 0)
 				json_object_set_new(ml, "collision", json_integer(source->rtp_collision));
-			if(mp->helper_threads > 0)
+			if(source->batch > 1) {
+				json_object_set_new(ml, "batch", json_integer(source->batch));
+				if(admin && source->batch_reads > 0)
+					json_object_set_new(ml, "batch_average", json_real((double)source->batch_packets/(double)source->batch_reads));
+			}
+#ifdef HAVE_LIBSRT
+			if(source->srt)
+				json_object_set_new(ml, "srt", janus_streaming_srt_info(source->srt, admin));
+#endif
+			if(source->ingest != NULL)
+				json_object_set_new(ml, "ingest", janus_streaming_ingest_info(source));
+			if(mp->helper_threads > 0) {
 				json_object_set_new(ml, "threads", json_integer(mp->helper_threads));
+				if(admin) {
+					json_t *helpers = json_array();
+					GList *l = mp->threads;
+					while(l) {
+						janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+						json_t *helper = json_object();
+						json_object_set_new(helper, "id", json_integer(ht->id));
+						json_object_set_new(helper, "viewers", json_integer(ht->num_viewers));
+						json_object_set_new(helper, "queue", json_integer(g_async_queue_length(ht->queued_packets)));
+						json_object_set_new(helper, "dropped", json_integer(g_atomic_int_get(&ht->dropped)));
+						json_array_append_new(helpers, helper);
+						l = l->next;
+					}
+					json_object_set_new(ml, "helpers", helpers);
+				}
+			}
 			if(admin) {
 				if(mp->audio) {
 					if(source->audio_host)
@@ -2740,10 +3117,41 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			json_t *video = json_object_get(root, "video");
 			json_t *data = json_object_get(root, "data");
 			json_t *rtpcollision = json_object_get(root, "collision");
+			json_t *batch = json_object_get(root, "batch");
 			json_t *threads = json_object_get(root, "threads");
 			json_t *ssuite = json_object_get(root, "srtpsuite");
 			json_t *scrypto = json_object_get(root, "srtpcrypto");
 			json_t *e2ee = json_object_get(root, "e2ee");
+			json_t *srt = json_object_get(root, "srt");
+			janus_streaming_srt_config srt_config = { 0 };
+			gboolean dosrt = srt ? json_is_true(srt) : FALSE;
+			if(dosrt) {
+				const char *srtmode = json_string_value(json_object_get(root, "srtmode"));
+				if(srtmode && strcasecmp(srtmode, "listener") && strcasecmp(srtmode, "caller")) {
+					JANUS_LOG(LOG_ERR, "Invalid SRT mode '%s'\n", srtmode);
+					error_code = JANUS_STREAMING_ERROR_INVALID_ELEMENT;
+					g_snprintf(error_cause, 512, "Invalid SRT mode '%s'", srtmode);
+					janus_mutex_lock(&mountpoints_mutex);
+					g_hash_table_remove(mountpoints_temp, string_ids ? (gpointer)mpid_str : (gpointer)&mpid);
+					janus_mutex_unlock(&mountpoints_mutex);
+					goto prepare_response;
+				}
+				srt_config.caller = srtmode && !strcasecmp(srtmode, "caller");
+				srt_config.host = (char *)json_string_value(json_object_get(root, "srthost"));
+				srt_config.latency = json_integer_value(json_object_get(root, "srtlatency"));
+				srt_config.passphrase = (char *)json_string_value(json_object_get(root, "srtpassphrase"));
+			}
+			json_t *ingest = json_object_get(root, "ingest");
+			janus_streaming_ingest_config ingest_config = { 0 };
+			gboolean doingest = ingest ? json_is_true(ingest) : FALSE;
+			if(doingest) {
+				ingest_config.audio_ssrc = json_integer_value(json_object_get(root, "audiossrc"));
+				ingest_config.video_ssrc[0] = json_integer_value(json_object_get(root, "videossrc"));
+				ingest_config.video_ssrc[1] = json_integer_value(json_object_get(root, "videossrc2"));
+				ingest_config.video_ssrc[2] = json_integer_value(json_object_get(root, "videossrc3"));
+				ingest_config.audio_source = (char *)json_string_value(json_object_get(root, "audiosource"));
+				ingest_config.video_source = (char *)json_string_value(json_object_get(root, "videosource"));
+			}
 			gboolean doaudio = audio ? json_is_true(audio) : FALSE, doaudiortcp = FALSE;
 			gboolean dovideo = video ? json_is_true(video) : FALSE, dovideortcp = FALSE;
 			gboolean dodata = data ? json_is_true(data) : FALSE;
@@ -2783,6 +3191,15 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				json_t *audiomcast = json_object_get(root, "audiomcast");
 				amcast = (char *)json_string_value(audiomcast);
 				json_t *audioport = json_object_get(root, "audioport");
+				if(audioport == NULL && !doingest) {
+					JANUS_LOG(LOG_ERR, "Missing mandatory element (audioport)\n");
+					error_code = JANUS_STREAMING_ERROR_MISSING_ELEMENT;
+					g_snprintf(error_cause, 512, "Missing mandatory element (audioport)");
+					janus_mutex_lock(&mountpoints_mutex);
+					g_hash_table_remove(mountpoints_temp, string_ids ? (gpointer)mpid_str : (gpointer)&mpid);
+					janus_mutex_unlock(&mountpoints_mutex);
+					goto prepare_response;
+				}
 				aport = json_integer_value(audioport);
 				json_t *audiortcpport = json_object_get(root, "audiortcpport");
 				if(audiortcpport) {
@@ -2818,6 +3235,7 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			uint8_t vcodec = 0;
 			char *vrtpmap = NULL, *vfmtp = NULL, *vmcast = NULL;
 			gboolean bufferkf = FALSE, simulcast = FALSE;
+			int buffergop = 0;
 			if(dovideo) {
 				JANUS_VALIDATE_JSON_OBJECT(root, rtp_video_parameters,
 					error_code, error_cause, TRUE,
@@ -2827,6 +3245,15 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				json_t *videomcast = json_object_get(root, "videomcast");
 				vmcast = (char *)json_string_value(videomcast);
 				json_t *videoport = json_object_get(root, "videoport");
+				if(videoport == NULL && !doingest) {
+					JANUS_LOG(LOG_ERR, "Missing mandatory element (videoport)\n");
+					error_code = JANUS_STREAMING_ERROR_MISSING_ELEMENT;
+					g_snprintf(error_cause, 512, "Missing mandatory element (videoport)");
+					janus_mutex_lock(&mountpoints_mutex);
+					g_hash_table_remove(mountpoints_temp, string_ids ? (gpointer)mpid_str : (gpointer)&mpid);
+					janus_mutex_unlock(&mountpoints_mutex);
+					goto prepare_response;
+				}
 				vport = json_integer_value(videoport);
 				json_t *videortcpport = json_object_get(root, "videortcpport");
 				if(videortcpport) {
@@ -2841,12 +3268,15 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				vfmtp = (char *)json_string_value(videofmtp);
 				json_t *vkf = json_object_get(root, "videobufferkf");
 				bufferkf = vkf ? json_is_true(vkf) : FALSE;
+				json_t *vgop = json_object_get(root, "videobuffergop");
+				buffergop = vgop ? json_integer_value(vgop) : 0;
 				json_t *vsc = json_object_get(root, "videosimulcast");
 				simulcast = vsc ? json_is_true(vsc) : FALSE;
-				if(simulcast && bufferkf) {
+				if(simulcast && (bufferkf || buffergop > 0)) {
 					/* FIXME We'll need to take care of this */
 					JANUS_LOG(LOG_WARN, "Simulcasting enabled, so disabling buffering of keyframes\n");
 					bufferkf = FALSE;
+					buffergop = 0;
 				}
 				json_t *videoport2 = json_object_get(root, "videoport2");
 				vport2 = json_integer_value(videoport2);
@@ -2943,9 +3373,12 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 					e2ee ? json_is_true(e2ee) : FALSE,
 					doaudio, doaudiortcp, amcast, &audio_iface, aport, artcpport, acodec, artpmap, afmtp, doaskew,
 					dovideo, dovideortcp, vmcast, &video_iface, vport, vrtcpport, vcodec, vrtpmap, vfmtp, bufferkf,
-					simulcast, vport2, vport3, dosvc, dovskew,
+					buffergop, simulcast, vport2, vport3, dosvc, dovskew,
 					rtpcollision ? json_integer_value(rtpcollision) : 0,
-					dodata, &data_iface, dport, textdata, buffermsg);
+					batch ? json_integer_value(batch) : 0,
+					dodata, &data_iface, dport, textdata, buffermsg,
+					dosrt ? &srt_config : NULL,
+					doingest ? &ingest_config : NULL);
 			janus_mutex_lock(&mountpoints_mutex);
 			g_hash_table_remove(mountpoints_temp, string_ids ? (gpointer)mpid_str : (gpointer)&mpid);
 			janus_mutex_unlock(&mountpoints_mutex);
@@ -3125,6 +3558,11 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				goto prepare_response;
 			}
 			mp->is_private = is_private ? json_is_true(is_private) : FALSE;
+			json_t *readers = json_object_get(root, "readers");
+			if(readers) {
+				janus_streaming_file_source *source = mp->source;
+				source->readers = json_integer_value(readers);
+			}
 		} else if(!strcasecmp(type_text, "rtsp")) {
 #ifndef HAVE_LIBCURL
 			JANUS_LOG(LOG_ERR, "Can't create 'rtsp' mountpoint, libcurl support not compiled...\n");
@@ -3250,8 +3688,10 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				janus_config_add(config, c, janus_config_item_create("audio", mp->codecs.audio_pt >= 0 ? "yes" : "no"));
 				janus_streaming_rtp_source *source = mp->source;
 				if(mp->codecs.audio_pt >= 0) {
-					g_snprintf(value, BUFSIZ, "%d", source->audio_port);
-					janus_config_add(config, c, janus_config_item_create("audioport", value));
+					if(source->ingest == NULL) {
+						g_snprintf(value, BUFSIZ, "%d", source->audio_port);
+						janus_config_add(config, c, janus_config_item_create("audioport", value));
+					}
 					if(source->audio_rtcp_port > 0) {
 						g_snprintf(value, BUFSIZ, "%d", source->audio_rtcp_port);
 						janus_config_add(config, c, janus_config_item_create("audiortcpport", value));
@@ -3272,8 +3712,10 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				}
 				janus_config_add(config, c, janus_config_item_create("video", mp->codecs.video_pt > 0 ? "yes" : "no"));
 				if(mp->codecs.video_pt > 0) {
-					g_snprintf(value, BUFSIZ, "%d", source->video_port[0]);
-					janus_config_add(config, c, janus_config_item_create("videoport", value));
+					if(source->ingest == NULL) {
+						g_snprintf(value, BUFSIZ, "%d", source->video_port[0]);
+						janus_config_add(config, c, janus_config_item_create("videoport", value));
+					}
 					if(source->video_rtcp_port > 0) {
 						g_snprintf(value, BUFSIZ, "%d", source->video_rtcp_port);
 						janus_config_add(config, c, janus_config_item_create("videortcpport", value));
@@ -3288,6 +3730,10 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 						janus_config_add(config, c, janus_config_item_create("videofmtp", mp->codecs.video_fmtp));
 					if(source->keyframe.enabled)
 						janus_config_add(config, c, janus_config_item_create("videobufferkf", "yes"));
+					if(source->keyframe.gop_max > 0) {
+						g_snprintf(value, BUFSIZ, "%zu", source->keyframe.gop_max/1024);
+						janus_config_add(config, c, janus_config_item_create("videobuffergop", value));
+					}
 					if(source->simulcast) {
 						janus_config_add(config, c, janus_config_item_create("videosimulcast", "yes"));
 						if(source->video_port[1]) {
@@ -3311,6 +3757,10 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 					g_snprintf(value, BUFSIZ, "%d", source->rtp_collision);
 					janus_config_add(config, c, janus_config_item_create("collision", value));
 				}
+				if(source->batch > 1) {
+					g_snprintf(value, BUFSIZ, "%d", source->batch);
+					janus_config_add(config, c, janus_config_item_create("batch", value));
+				}
 				janus_config_add(config, c, janus_config_item_create("data", mp->data ? "yes" : "no"));
 				if(source->data_port > -1) {
 					g_snprintf(value, BUFSIZ, "%d", source->data_port);
@@ -3330,9 +3780,27 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 					g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
 					janus_config_add(config, c, janus_config_item_create("threads", value));
 				}
+#ifdef HAVE_LIBSRT
+				if(source->srt) {
+					janus_config_add(config, c, janus_config_item_create("srt", "yes"));
+					janus_config_add(config, c, janus_config_item_create("srtmode", source->srt->config.caller ? "caller" : "listener"));
+					if(source->srt->config.host)
+						janus_config_add(config, c, janus_config_item_create("srthost", source->srt->config.host));
+					g_snprintf(value, BUFSIZ, "%d", source->srt->config.latency);
+					janus_config_add(config, c, janus_config_item_create("srtlatency", value));
+					if(source->srt->config.passphrase)
+						janus_config_add(config, c, janus_config_item_create("srtpassphrase", source->srt->config.passphrase));
+				}
+#endif
+				if(source->ingest != NULL)
+					janus_streaming_ingest_save(c, source);
 			} else if(!strcasecmp(type_text, "live") || !strcasecmp(type_text, "ondemand")) {
 				janus_streaming_file_source *source = mp->source;
 				janus_config_add(config, c, janus_config_item_create("filename", source->filename));
+				if(source->readers > 0) {
+					g_snprintf(value, BUFSIZ, "%d", source->readers);
+					janus_config_add(config, c, janus_config_item_create("readers", value));
+				}
 				janus_config_add(config, c, janus_config_item_create("audio", mp->codecs.audio_pt >= 0 ? "yes" : "no"));
 				janus_config_add(config, c, janus_config_item_create("video", mp->codecs.video_pt > 0 ? "yes" : "no"));
 			} else if(!strcasecmp(type_text, "rtsp")) {
@@ -3372,8 +3840,8 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				janus_config_add(config, c, janus_config_item_create("secret", mp->secret));
 			if(mp->pin)
 				janus_config_add(config, c, janus_config_item_create("pin", mp->pin));
-			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
+			/* Save the change (to the journal, rather than rewriting the whole file) */
+			if(janus_config_journal(config, config_folder, JANUS_STREAMING_PACKAGE, mp->name) < 0)
 				save = FALSE;	/* This will notify the user the mountpoint is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -3389,6 +3857,8 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 		json_object_set_new(ml, "is_private", mp->is_private ? json_true() : json_false());
 		if(!strcasecmp(type_text, "rtp")) {
 			janus_streaming_rtp_source *source = mp->source;
+			if(source->ingest != NULL)
+				json_object_set_new(ml, "ingest_port", json_integer(ingest_port));
 			if(source->audio_fd != -1) {
 				if(source->audio_host)
 					json_object_set_new(ml, "audio_host", json_string(source->audio_host));
@@ -3419,7 +3889,7 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 		}
 		json_object_set_new(response, "stream", ml);
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_streaming_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("created"));
 			json_object_set_new(info, "id", string_ids ? json_string(mp->id_str) : json_integer(mp->id));
@@ -3585,8 +4055,10 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 					janus_config_add(config, c, janus_config_item_create("audio", mp->codecs.audio_pt >= 0 ? "yes" : "no"));
 					janus_streaming_rtp_source *source = mp->source;
 					if(mp->codecs.audio_pt >= 0) {
-						g_snprintf(value, BUFSIZ, "%d", source->audio_port);
-						janus_config_add(config, c, janus_config_item_create("audioport", value));
+						if(source->ingest == NULL) {
+							g_snprintf(value, BUFSIZ, "%d", source->audio_port);
+							janus_config_add(config, c, janus_config_item_create("audioport", value));
+						}
 						if(source->audio_rtcp_port > 0) {
 							g_snprintf(value, BUFSIZ, "%d", source->audio_rtcp_port);
 							janus_config_add(config, c, janus_config_item_create("audiortcpport", value));
@@ -3607,8 +4079,10 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 					}
 					janus_config_add(config, c, janus_config_item_create("video", mp->codecs.video_pt > 0 ? "yes" : "no"));
 					if(mp->codecs.video_pt > 0) {
-						g_snprintf(value, BUFSIZ, "%d", source->video_port[0]);
-						janus_config_add(config, c, janus_config_item_create("videoport", value));
+						if(source->ingest == NULL) {
+							g_snprintf(value, BUFSIZ, "%d", source->video_port[0]);
+							janus_config_add(config, c, janus_config_item_create("videoport", value));
+						}
 						if(source->video_rtcp_port > 0) {
 							g_snprintf(value, BUFSIZ, "%d", source->video_rtcp_port);
 							janus_config_add(config, c, janus_config_item_create("videortcpport", value));
@@ -3623,6 +4097,10 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 							janus_config_add(config, c, janus_config_item_create("videofmtp", mp->codecs.video_fmtp));
 						if(source->keyframe.enabled)
 							janus_config_add(config, c, janus_config_item_create("videobufferkf", "yes"));
+						if(source->keyframe.gop_max > 0) {
+							g_snprintf(value, BUFSIZ, "%zu", source->keyframe.gop_max/1024);
+							janus_config_add(config, c, janus_config_item_create("videobuffergop", value));
+						}
 						if(source->simulcast) {
 							janus_config_add(config, c, janus_config_item_create("videosimulcast", "yes"));
 							if(source->video_port[1]) {
@@ -3646,6 +4124,10 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 						g_snprintf(value, BUFSIZ, "%d", source->rtp_collision);
 						janus_config_add(config, c, janus_config_item_create("collision", value));
 					}
+					if(source->batch > 1) {
+						g_snprintf(value, BUFSIZ, "%d", source->batch);
+						janus_config_add(config, c, janus_config_item_create("batch", value));
+					}
 					janus_config_add(config, c, janus_config_item_create("data", mp->data ? "yes" : "no"));
 					if(source->data_port > -1) {
 						g_snprintf(value, BUFSIZ, "%d", source->data_port);
@@ -3665,11 +4147,29 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 						g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
 						janus_config_add(config, c, janus_config_item_create("threads", value));
 					}
+#ifdef HAVE_LIBSRT
+					if(source->srt) {
+						janus_config_add(config, c, janus_config_item_create("srt", "yes"));
+						janus_config_add(config, c, janus_config_item_create("srtmode", source->srt->config.caller ? "caller" : "listener"));
+						if(source->srt->config.host)
+							janus_config_add(config, c, janus_config_item_create("srthost", source->srt->config.host));
+						g_snprintf(value, BUFSIZ, "%d", source->srt->config.latency);
+						janus_config_add(config, c, janus_config_item_create("srtlatency", value));
+						if(source->srt->config.passphrase)
+							janus_config_add(config, c, janus_config_item_create("srtpassphrase", source->srt->config.passphrase));
+					}
+#endif
+					if(source->ingest != NULL)
+						janus_streaming_ingest_save(c, source);
 				}
 			} else {
 				janus_config_add(config, c, janus_config_item_create("type", (mp->streaming_type == janus_streaming_type_live) ? "live" : "ondemand"));
 				janus_streaming_file_source *source = mp->source;
 				janus_config_add(config, c, janus_config_item_create("filename", source->filename));
+				if(source->readers > 0) {
+					g_snprintf(value, BUFSIZ, "%d", source->readers);
+					janus_config_add(config, c, janus_config_item_create("readers", value));
+				}
 				janus_config_add(config, c, janus_config_item_create("audio", mp->codecs.audio_pt >= 0 ? "yes" : "no"));
 				janus_config_add(config, c, janus_config_item_create("video", mp->codecs.video_pt > 0 ? "yes" : "no"));
 			}
@@ -3678,8 +4178,8 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				janus_config_add(config, c, janus_config_item_create("secret", mp->secret));
 			if(mp->pin)
 				janus_config_add(config, c, janus_config_item_create("pin", mp->pin));
-			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
+			/* Save the change (to the journal, rather than rewriting the whole file) */
+			if(janus_config_journal(config, config_folder, JANUS_STREAMING_PACKAGE, mp->name) < 0)
 				save = FALSE;	/* This will notify the user the mountpoint is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -3689,7 +4189,7 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 		json_object_set_new(response, "id", string_ids ? json_string(mp->id_str) : json_integer(mp->id));
 		json_object_set_new(response, "permanent", save ? json_true() : json_false());
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_streaming_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("edited"));
 			json_object_set_new(info, "id", string_ids ? json_string(mp->id_str) : json_integer(mp->id));
@@ -3760,6 +4260,7 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 		/* Remove mountpoint from the hashtable: this will get it destroyed eventually */
 		g_hash_table_remove(mountpoints,
 			string_ids ? (gpointer)id_value_str : (gpointer)&id_value);
+		g_atomic_int_set(&mountpoints_count, g_hash_table_size(mountpoints));
 		/* FIXME Should we kick the current viewers as well? */
 		janus_mutex_lock(&mp->mutex);
 		GList *viewer = g_list_first(mp->viewers);
@@ -3794,22 +4295,8 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			janus_refcount_decrease(&mp->ref);
 			if(mp->streaming_source == janus_streaming_source_rtp) {
 				/* Remove the viewer from the helper threads too, if any */
-				if(mp->helper_threads > 0) {
-					GList *l = mp->threads;
-					while(l) {
-						janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-						janus_mutex_lock(&ht->mutex);
-						if(g_list_find(ht->viewers, s) != NULL) {
-							ht->num_viewers--;
-							ht->viewers = g_list_remove_all(ht->viewers, s);
-							janus_mutex_unlock(&ht->mutex);
-							JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d (destroy)\n", ht->id);
-							break;
-						}
-						janus_mutex_unlock(&ht->mutex);
-						l = l->next;
-					}
-				}
+				if(mp->helper_threads > 0)
+					janus_streaming_helper_remove_viewer(mp, s);
 			}
 			mp->viewers = g_list_remove_all(mp->viewers, s);
 			viewer = g_list_first(mp->viewers);
@@ -3824,14 +4311,14 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			janus_mutex_lock(&config_mutex);
 			/* The category to remove is the mountpoint name */
 			janus_config_remove(config, NULL, mp->name);
-			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
+			/* Save the change (to the journal, rather than rewriting the whole file) */
+			if(janus_config_journal(config, config_folder, JANUS_STREAMING_PACKAGE, mp->name) < 0)
 				save = FALSE;	/* This will notify the user the mountpoint is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
 		janus_refcount_decrease(&mp->ref);
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_streaming_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("destroyed"));
 			json_object_set_new(info, "id", string_ids ? json_string(id_value_str) : json_integer(id_value));
@@ -4365,6 +4852,7 @@ void janus_streaming_setup_media(janus_plugin_session *handle) {
 	g_atomic_int_set(&session->hangingup, 0);
 	/* We only start streaming towards this user when we get this event */
 	janus_rtp_switching_context_reset(&session->context);
+	session->gop_skip = FALSE;
 	/* If this is related to a live RTP mountpoint, any keyframe we can shoot already? */
 	janus_streaming_mountpoint *mountpoint = session->mountpoint;
 	if (!mountpoint) {
@@ -4374,7 +4862,35 @@ void janus_streaming_setup_media(janus_plugin_session *handle) {
 	}
 	if(mountpoint->streaming_source == janus_streaming_source_rtp) {
 		janus_streaming_rtp_source *source = mountpoint->source;
-		if(source->keyframe.enabled) {
+		if(source->keyframe.gop != NULL) {
+			janus_mutex_lock(&source->keyframe.mutex);
+			if(source->keyframe.gop->len > 0) {
+				/* Send the whole GOP right away: we squeeze the timestamps of its frames, so
+				 * that the decoder goes through them as fast as possible and catches up */
+				JANUS_LOG(LOG_HUGE, "Sending GOP: %u packets\n", source->keyframe.gop->len);
+				janus_streaming_rtp_relay_packet *pkt = g_ptr_array_index(source->keyframe.gop, 0);
+				guint32 last_ts = pkt->timestamp, ts = pkt->timestamp;
+				guint i = 0;
+				for(i=0; i<source->keyframe.gop->len; i++) {
+					pkt = g_ptr_array_index(source->keyframe.gop, i);
+					if(pkt->timestamp != last_ts) {
+						last_ts = pkt->timestamp;
+						ts += JANUS_STREAMING_GOP_TS_STEP;
+					}
+					pkt->timestamp = ts;
+					pkt->data->timestamp = htonl(ts);
+					janus_streaming_relay_rtp_packet(session, pkt);
+					pkt->timestamp = last_ts;
+					pkt->data->timestamp = htonl(last_ts);
+				}
+				/* Live packets we just sent as part of the GOP will have to be skipped: besides,
+				 * we start now, so that nothing added to the GOP after this can be missed */
+				session->gop_last_seq = pkt->seq_number;
+				session->gop_skip = TRUE;
+				g_atomic_int_set(&session->started, 1);
+			}
+			janus_mutex_unlock(&source->keyframe.mutex);
+		} else if(source->keyframe.enabled) {
 			JANUS_LOG(LOG_HUGE, "Any keyframe to send?\n");
 			janus_mutex_lock(&source->keyframe.mutex);
 			if(source->keyframe.latest_keyframe != NULL) {
@@ -4440,12 +4956,18 @@ void janus_streaming_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rt
 		JANUS_LOG(LOG_HUGE, "Got video RTCP feedback from a viewer: SSRC %"SCNu32"\n",
 			janus_rtcp_get_sender_ssrc(buf, len));
 		/* We only relay PLI/FIR and REMB packets, but in a selective way */
-		if(janus_rtcp_has_fir(buf, len) || janus_rtcp_has_pli(buf, len)) {
+		janus_rtcp_summary local;
+		const janus_rtcp_summary *summary = packet->summary;
+		if(summary == NULL) {
+			janus_rtcp_summarize(buf, len, &local);
+			summary = &local;
+		}
+		if(summary->has_fir || summary->has_pli) {
 			/* We got a PLI/FIR, pass it along unless we just sent one */
 			JANUS_LOG(LOG_HUGE, "  -- Keyframe request\n");
 			janus_streaming_rtcp_pli_send(source);
 		}
-		uint64_t bw = janus_rtcp_get_remb(buf, len);
+		uint64_t bw = summary->remb;
 		if(bw > 0) {
 			/* Keep track of this value, if this is the lowest right now */
 			JANUS_LOG(LOG_HUGE, "  -- REMB for this PeerConnection: %"SCNu64"\n", bw);
@@ -4517,22 +5039,8 @@ static void janus_streaming_hangup_media_internal(janus_plugin_session *handle)
 		mp->viewers = g_list_remove_all(mp->viewers, session);
 		if(mp->streaming_source == janus_streaming_source_rtp) {
 			/* Remove the viewer from the helper threads too, if any */
-			if(mp->helper_threads > 0) {
-				GList *l = mp->threads;
-				while(l) {
-					janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-					janus_mutex_lock(&ht->mutex);
-					if(g_list_find(ht->viewers, session) != NULL) {
-						ht->num_viewers--;
-						ht->viewers = g_list_remove_all(ht->viewers, session);
-						janus_mutex_unlock(&ht->mutex);
-						JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d\n", ht->id);
-						break;
-					}
-					janus_mutex_unlock(&ht->mutex);
-					l = l->next;
-				}
-			}
+			if(mp->helper_threads > 0)
+				janus_streaming_helper_remove_viewer(mp, session);
 		}
 		janus_mutex_unlock(&mp->mutex);
 	}
@@ -4739,7 +5247,19 @@ static void *janus_streaming_handler(void *data) {
 				g_snprintf(error_cause, 512, "Can't offer an SDP with no audio, video or data for this mountpoint");
 				goto error;
 			}
-			if(mp->streaming_type == janus_streaming_type_on_demand) {
+			if(mp->streaming_type == janus_streaming_type_on_demand &&
+					((janus_streaming_file_source *)mp->source)->readers > 0) {
+				/* Assign the viewer to one of the shared readers of the file */
+				if(janus_streaming_ondemand_reader_assign(mp, session) < 0) {
+					session->mountpoint = NULL;
+					janus_mutex_unlock(&session->mutex);
+					janus_mutex_unlock(&mp->mutex);
+					janus_refcount_decrease(&mp->ref);
+					error_code = JANUS_STREAMING_ERROR_UNKNOWN_ERROR;
+					g_snprintf(error_cause, 512, "Error launching the on-demand reader thread");
+					goto error;
+				}
+			} else if(mp->streaming_type == janus_streaming_type_on_demand) {
 				GError *error = NULL;
 				char tname[16];
 				g_snprintf(tname, sizeof(tname), "mp %s", mp->id_str);
@@ -4928,25 +5448,8 @@ done:
 				mp->viewers = g_list_append(mp->viewers, session);
 				if(mp->streaming_source == janus_streaming_source_rtp) {
 					/* If we're using helper threads, add the viewer to one of those */
-					if(mp->helper_threads > 0) {
-						int viewers = -1;
-						janus_streaming_helper *helper = NULL;
-						GList *l = mp->threads;
-						while(l) {
-							janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-							if(viewers == -1 || (helper == NULL && ht->num_viewers == 0) || ht->num_viewers < viewers) {
-								viewers = ht->num_viewers;
-								helper = ht;
-							}
-							l = l->next;
-						}
-						janus_mutex_lock(&helper->mutex);
-						helper->viewers = g_list_append(helper->viewers, session);
-						helper->num_viewers++;
-						janus_mutex_unlock(&helper->mutex);
-						JANUS_LOG(LOG_VERB, "Added viewer to helper thread #%d (%d viewers)\n",
-							helper->id, helper->num_viewers);
-					}
+					if(mp->helper_threads > 0)
+						janus_streaming_helper_add_viewer(mp, session);
 				}
 			}
 			janus_mutex_unlock(&session->mutex);
@@ -4964,7 +5467,7 @@ done:
 			/* We wait for the setup_media event to start: on the other hand, it may have already arrived */
 			json_object_set_new(result, "status", json_string(g_atomic_int_get(&session->started) ? "started" : "starting"));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_streaming_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "status", json_string("starting"));
 				if(session->mountpoint != NULL)
@@ -4984,7 +5487,7 @@ done:
 			result = json_object();
 			json_object_set_new(result, "status", json_string("pausing"));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_streaming_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "status", json_string("pausing"));
 				if(session->mountpoint != NULL)
@@ -5254,22 +5757,8 @@ done:
 			janus_mutex_lock(&oldmp->mutex);
 			oldmp->viewers = g_list_remove_all(oldmp->viewers, session);
 			/* Remove the viewer from the helper threads too, if any */
-			if(oldmp->helper_threads > 0) {
-				GList *l = oldmp->threads;
-				while(l) {
-					janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-					janus_mutex_lock(&ht->mutex);
-					if(g_list_find(ht->viewers, session) != NULL) {
-						ht->num_viewers--;
-						ht->viewers = g_list_remove_all(ht->viewers, session);
-						janus_mutex_unlock(&ht->mutex);
-						JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d (switching)\n", ht->id);
-						break;
-					}
-					janus_mutex_unlock(&ht->mutex);
-					l = l->next;
-				}
-			}
+			if(oldmp->helper_threads > 0)
+				janus_streaming_helper_remove_viewer(oldmp, session);
 			janus_refcount_decrease(&oldmp->ref);	/* This is for the user going away */
 			janus_mutex_unlock(&oldmp->mutex);
 			/* Subscribe to the new one */
@@ -5277,24 +5766,8 @@ done:
 			janus_mutex_lock(&session->mutex);
 			mp->viewers = g_list_append(mp->viewers, session);
 			/* If we're using helper threads, add the viewer to one of those */
-			if(mp->helper_threads > 0) {
-				int viewers = 0;
-				janus_streaming_helper *helper = NULL;
-				GList *l = mp->threads;
-				while(l) {
-					janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-					if(ht->num_viewers == 0 || ht->num_viewers < viewers) {
-						viewers = ht->num_viewers;
-						helper = ht;
-					}
-					l = l->next;
-				}
-				JANUS_LOG(LOG_VERB, "Adding viewer to helper thread #%d\n", helper->id);
-				janus_mutex_lock(&helper->mutex);
-				helper->viewers = g_list_append(helper->viewers, session);
-				helper->num_viewers++;
-				janus_mutex_unlock(&helper->mutex);
-			}
+			if(mp->helper_threads > 0)
+				janus_streaming_helper_add_viewer(mp, session);
 			session->mountpoint = mp;
 			/* Send a PLI too, in case the mountpoint supports video and RTCP */
 			janus_streaming_rtcp_pli_send(mp->source);
@@ -5307,7 +5780,7 @@ done:
 			json_object_set_new(result, "switched", json_string("ok"));
 			json_object_set_new(result, "id", string_ids ? json_string(id_value_str) : json_integer(id_value));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_streaming_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "status", json_string("switching"));
 				json_object_set_new(info, "id", string_ids ? json_string(id_value_str) : json_integer(id_value));
@@ -5323,7 +5796,7 @@ done:
 			result = json_object();
 			json_object_set_new(result, "status", json_string("stopping"));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_streaming_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "status", json_string("stopping"));
 				janus_streaming_mountpoint *mp = session->mountpoint;
@@ -5392,19 +5865,12 @@ static int janus_streaming_create_fd(int port, in_addr_t mcast, const janus_netw
 	struct sockaddr_in6 address6 = { 0 };
 	janus_network_address_string_buffer address_representation;
 
-	uint16_t rtp_port_next = rtp_range_slider; 					/* Read global slider */
-	uint16_t rtp_port_start = rtp_port_next;
-	gboolean use_range = (port == 0), rtp_port_wrap = FALSE;
+	gboolean use_range = (port == 0);
+	int attempts = janus_network_port_pool_size(port_pool);
 
 	int fd = -1, family = 0;
 	while(1) {
 		family = 0;	/* By default, we bind to both IPv4 and IPv6 */
-		if(use_range && rtp_port_wrap && rtp_port_next >= rtp_port_start) {
-			/* Full range scanned */
-			JANUS_LOG(LOG_ERR, "No ports available for RTP/RTCP in range: %u -- %u\n",
-				  rtp_range_min, rtp_range_max);
-			break;
-		}
 		if(!use_range) {
 			/* Use the port specified in the arguments */
 			if(IN_MULTICAST(ntohl(mcast))) {
@@ -5456,13 +5922,13 @@ static int janus_streaming_create_fd(int port, in_addr_t mcast, const janus_netw
 				JANUS_LOG(LOG_INFO, "[%s] %s listener IP_ADD_MEMBERSHIP ok\n", mountpointname, listenername);
 			}
 		} else {
-			/* Pick a port in the configured range */
-			port = rtp_port_next;
-			if((uint32_t)(rtp_port_next) < rtp_range_max) {
-				rtp_port_next++;
-			} else {
-				rtp_port_next = rtp_range_min;
-				rtp_port_wrap = TRUE;
+			/* Take a pair from the pool: we only use the first port, though */
+			port = attempts-- > 0 ? janus_network_port_pool_get(port_pool) : -1;
+			if(port < 0) {
+				port = 0;
+				JANUS_LOG(LOG_ERR, "No ports available for RTP/RTCP in range: %u -- %u\n",
+					  rtp_range_min, rtp_range_max);
+				break;
 			}
 		}
 		address.sin_family = AF_INET;
@@ -5503,6 +5969,10 @@ static int janus_streaming_create_fd(int port, in_addr_t mcast, const janus_netw
 						g_strlcpy(host, janus_network_address_string_from_buffer(&address_representation), hostlen);
 				} else {
 					JANUS_LOG(LOG_ERR, "[%s] %s listener: invalid address/restriction type\n", mountpointname, listenername);
+					if(use_range) {
+						janus_network_port_pool_release(port_pool, port);
+						port = 0;
+					}
 					continue;
 				}
 			}
@@ -5532,42 +6002,32 @@ static int janus_streaming_create_fd(int port, in_addr_t mcast, const janus_netw
 			}
 			if(!use_range)	/* Asked for a specific port but it's not available, give up */
 				break;
+			janus_network_port_pool_release(port_pool, port);
+			port = 0;
 		} else {
-			if(use_range)
-				rtp_range_slider = port;	/* Update global slider */
 			break;
 		}
 	}
+	if(fd == -1 && use_range && port > 0)
+		janus_network_port_pool_release(port_pool, port);
 	janus_mutex_unlock(&fd_mutex);
 	return fd;
 }
 /* Helper to bind RTP/RTCP port pair (for RTSP) */
 static int janus_streaming_allocate_port_pair(const char *name, const char *media,
 		in_addr_t mcast, const janus_network_address *iface, multiple_fds *fds, int ports[2]) {
-	/* Start from the global slider */
-	uint16_t rtp_port_next = rtp_range_slider;
-	if(rtp_port_next % 2 != 0)	/* We want an even port for RTP */
-		rtp_port_next++;
-	uint16_t rtp_port_start = rtp_port_next;
-	gboolean rtp_port_wrap = FALSE;
+	/* If a pair from the pool can't be bound, we give it back and try the next one */
+	int attempts = janus_network_port_pool_size(port_pool);
 
 	int rtp_fd = -1, rtcp_fd = -1;
-	while(1) {
-		if(rtp_port_wrap && rtp_port_next >= rtp_port_start) {
-			/* Full range scanned */
+	while(attempts-- > 0) {
+		int rtp_port = janus_network_port_pool_get(port_pool);
+		if(rtp_port < 0) {
 			JANUS_LOG(LOG_ERR, "No ports available for audio/video channel in range: %u -- %u\n",
 				rtp_range_min, rtp_range_max);
 			break;
 		}
-		int rtp_port = rtp_port_next;
 		int rtcp_port = rtp_port+1;
-		if((uint32_t)(rtp_port_next + 2UL) < rtp_range_max) {
-			/* Advance to next pair */
-			rtp_port_next += 2;
-		} else {
-			rtp_port_next = rtp_range_min;
-			rtp_port_wrap = TRUE;
-		}
 		rtp_fd = janus_streaming_create_fd(rtp_port, mcast, iface, NULL, 0, media, media, name, TRUE);
 		if(rtp_fd != -1) {
 			rtcp_fd = janus_streaming_create_fd(rtcp_port, mcast, iface, NULL, 0, media, media, name, TRUE);
@@ -5577,14 +6037,13 @@ static int janus_streaming_allocate_port_pair(const char *name, const char *medi
 				fds->rtcp_fd = rtcp_fd;
 				ports[0] = rtp_port;
 				ports[1] = rtcp_port;
-				/* Update global slider */
-				rtp_range_slider = rtp_port_next;
 				return 0;
 			}
 		}
 		/* If we got here, something failed: try again */
 		if(rtp_fd != -1)
 			close(rtp_fd);
+		janus_network_port_pool_release(port_pool, rtp_port);
 	}
 	return -1;
 }
@@ -5600,28 +6059,330 @@ static int janus_streaming_get_fd_port(int fd) {
 	return ntohs(server.sin6_port);
 }
 
+/* Helper to close a listener filedescriptor, giving its port back to the pool if it came from there */
+static void janus_streaming_close_fd(int fd) {
+	janus_network_port_pool_release_socket(port_pool, fd);
+	close(fd);
+}
+
 /* Helpers to destroy a streaming mountpoint. */
+#ifdef HAVE_LIBSRT
+/* Helper to configure an SRT socket the way we need it */
+static int janus_streaming_srt_setup_socket(janus_streaming_srt *srt, SRTSOCKET sock) {
+	int yes = 1, no = 0;
+	SRT_TRANSTYPE tt = SRTT_LIVE;
+	if(srt_setsockflag(sock, SRTO_TRANSTYPE, &tt, sizeof(tt)) == SRT_ERROR ||
+			srt_setsockflag(sock, SRTO_RCVLATENCY, &srt->config.latency, sizeof(int)) == SRT_ERROR ||
+			srt_setsockflag(sock, SRTO_REUSEADDR, &yes, sizeof(yes)) == SRT_ERROR) {
+		JANUS_LOG(LOG_ERR, "[%s] Error configuring SRT socket: %s\n", srt->name, srt_getlasterror_str());
+		return -1;
+	}
+	if(srt->config.passphrase != NULL && srt_setsockflag(sock, SRTO_PASSPHRASE,
+			srt->config.passphrase, strlen(srt->config.passphrase)) == SRT_ERROR) {
+		JANUS_LOG(LOG_ERR, "[%s] Invalid SRT passphrase: %s\n", srt->name, srt_getlasterror_str());
+		return -1;
+	}
+	/* Connecting is blocking, but receiving and accepting are not */
+	if(!srt->config.caller && srt_setsockflag(sock, SRTO_RCVSYN, &no, sizeof(no)) == SRT_ERROR) {
+		JANUS_LOG(LOG_ERR, "[%s] Error configuring SRT socket: %s\n", srt->name, srt_getlasterror_str());
+		return -1;
+	}
+	return 0;
+}
+
+/* Helper to start listening for SRT connections for a medium */
+static int janus_streaming_srt_listen(janus_streaming_srt *srt, janus_streaming_srt_media *m) {
+	struct sockaddr_in6 address = { 0 };
+	address.sin6_family = AF_INET6;
+	address.sin6_port = htons(m->port);
+	if(m->iface.family == AF_INET6) {
+		memcpy(&address.sin6_addr, &m->iface.ipv6, sizeof(struct in6_addr));
+	} else if(m->iface.family == AF_INET) {
+		/* Use an IPv4-mapped address */
+		address.sin6_addr.s6_addr[10] = 0xff;
+		address.sin6_addr.s6_addr[11] = 0xff;
+		memcpy(&address.sin6_addr.s6_addr[12], &m->iface.ipv4, sizeof(struct in_addr));
+	} else {
+		address.sin6_addr = in6addr_any;
+	}
+	int no = 0;
+	m->listener = srt_create_socket();
+	if(m->listener == SRT_INVALID_SOCK || janus_streaming_srt_setup_socket(srt, m->listener) < 0 ||
+			srt_setsockflag(m->listener, SRTO_IPV6ONLY, &no, sizeof(no)) == SRT_ERROR ||
+			srt_bind(m->listener, (struct sockaddr *)&address, sizeof(address)) == SRT_ERROR ||
+			srt_listen(m->listener, 1) == SRT_ERROR) {
+		JANUS_LOG(LOG_ERR, "[%s] Can't listen for SRT %s on port %d: %s\n",
+			srt->name, m->type, m->port, srt_getlasterror_str());
+		if(m->listener != SRT_INVALID_SOCK)
+			srt_close(m->listener);
+		m->listener = SRT_INVALID_SOCK;
+		return -1;
+	}
+	int addrlen = sizeof(address);
+	if(srt_getsockname(m->listener, (struct sockaddr *)&address, &addrlen) == 0)
+		m->port = ntohs(address.sin6_port);
+	int events = SRT_EPOLL_IN | SRT_EPOLL_ERR;
+	srt_epoll_add_usock(srt->eid, m->listener, &events);
+	JANUS_LOG(LOG_VERB, "[%s] Listening for SRT %s on port %d\n", srt->name, m->type, m->port);
+	return 0;
+}
+
+/* Helper to connect to an SRT sender for a medium (caller mode) */
+static int janus_streaming_srt_connect(janus_streaming_srt *srt, janus_streaming_srt_media *m) {
+	struct addrinfo hints = { 0 }, *res = NULL;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	char port[6];
+	g_snprintf(port, sizeof(port), "%d", m->port);
+	if(getaddrinfo(srt->config.host, port, &hints, &res) != 0 || res == NULL) {
+		JANUS_LOG(LOG_ERR, "[%s] Can't resolve SRT host %s\n", srt->name, srt->config.host);
+		if(res)
+			freeaddrinfo(res);
+		return -1;
+	}
+	SRTSOCKET sock = srt_create_socket();
+	int no = 0;
+	if(sock == SRT_INVALID_SOCK || janus_streaming_srt_setup_socket(srt, sock) < 0 ||
+			srt_connect(sock, res->ai_addr, res->ai_addrlen) == SRT_ERROR ||
+			srt_setsockflag(sock, SRTO_RCVSYN, &no, sizeof(no)) == SRT_ERROR) {
+		JANUS_LOG(LOG_WARN, "[%s] Can't connect to SRT %s on %s:%d: %s\n",
+			srt->name, m->type, srt->config.host, m->port, srt_getlasterror_str());
+		if(sock != SRT_INVALID_SOCK)
+			srt_close(sock);
+		freeaddrinfo(res);
+		return -1;
+	}
+	freeaddrinfo(res);
+	m->sock = sock;
+	int events = SRT_EPOLL_IN | SRT_EPOLL_ERR;
+	srt_epoll_add_usock(srt->eid, m->sock, &events);
+	JANUS_LOG(LOG_INFO, "[%s] Connected to SRT %s on %s:%d\n", srt->name, m->type, srt->config.host, m->port);
+	return 0;
+}
+
+/* Helper to get rid of the current SRT connection of a medium */
+static void janus_streaming_srt_disconnect(janus_streaming_srt *srt, janus_streaming_srt_media *m) {
+	if(m->sock == SRT_INVALID_SOCK)
+		return;
+	srt_epoll_remove_usock(srt->eid, m->sock);
+	srt_close(m->sock);
+	m->sock = SRT_INVALID_SOCK;
+	m->reconnect = janus_get_monotonic_time() + G_USEC_PER_SEC;
+}
+
+/* Thread receiving packets from SRT, and passing them to the relay thread */
+static void *janus_streaming_srt_thread(void *data) {
+	janus_streaming_srt *srt = (janus_streaming_srt *)data;
+	JANUS_LOG(LOG_VERB, "[%s] Joining SRT thread\n", srt->name);
+	char buffer[1500];
+	SRTSOCKET ready[4];
+	int i = 0, j = 0, rnum = 0, bytes = 0;
+	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&srt->destroyed)) {
+		int sockets = 0;
+		for(i=0; i<2; i++) {
+			janus_streaming_srt_media *m = &srt->media[i];
+			if(m->fd < 0)
+				continue;
+			if(srt->config.caller && m->sock == SRT_INVALID_SOCK &&
+					janus_get_monotonic_time() >= m->reconnect) {
+				if(janus_streaming_srt_connect(srt, m) < 0)
+					m->reconnect = janus_get_monotonic_time() + G_USEC_PER_SEC;
+			}
+			if(m->listener != SRT_INVALID_SOCK)
+				sockets++;
+			if(m->sock != SRT_INVALID_SOCK)
+				sockets++;
+		}
+		if(sockets == 0) {
+			/* Nothing to wait for, try again in a bit */
+			g_usleep(100000);
+			continue;
+		}
+		rnum = 4;
+		if(srt_epoll_wait(srt->eid, ready, &rnum, NULL, NULL, 100, NULL, NULL, NULL, NULL) < 0)
+			continue;
+		for(j=0; j<rnum && j<4; j++) {
+			for(i=0; i<2; i++) {
+				janus_streaming_srt_media *m = &srt->media[i];
+				if(m->listener != SRT_INVALID_SOCK && ready[j] == m->listener) {
+					/* New connection: it replaces the previous one, if any */
+					struct sockaddr_storage remote;
+					int addrlen = sizeof(remote);
+					SRTSOCKET sock = srt_accept(m->listener, (struct sockaddr *)&remote, &addrlen);
+					if(sock == SRT_INVALID_SOCK)
+						break;
+					janus_streaming_srt_disconnect(srt, m);
+					m->sock = sock;
+					int events = SRT_EPOLL_IN | SRT_EPOLL_ERR;
+					srt_epoll_add_usock(srt->eid, m->sock, &events);
+					JANUS_LOG(LOG_INFO, "[%s] Got a new SRT %s connection\n", srt->name, m->type);
+					break;
+				} else if(m->sock != SRT_INVALID_SOCK && ready[j] == m->sock) {
+					/* Read all the packets that are available */
+					while((bytes = srt_recvmsg(m->sock, buffer, sizeof(buffer))) > 0) {
+						if(send(m->fd, buffer, bytes, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+							JANUS_LOG(LOG_WARN, "[%s] Error passing SRT %s packet: %s\n",
+								srt->name, m->type, g_strerror(errno));
+						}
+					}
+					if(bytes == SRT_ERROR && srt_getlasterror(NULL) != SRT_EASYNCRCV) {
+						JANUS_LOG(LOG_WARN, "[%s] SRT %s connection lost: %s\n",
+							srt->name, m->type, srt_getlasterror_str());
+						janus_streaming_srt_disconnect(srt, m);
+					}
+					break;
+				}
+			}
+		}
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Leaving SRT thread\n", srt->name);
+	return NULL;
+}
+
+/* Helper to create the SRT context of an RTP mountpoint: the sockets the
+ * relay thread will read from are returned in audio_fd and video_fd */
+static janus_streaming_srt *janus_streaming_srt_create(const janus_streaming_srt_config *config, const char *name,
+		gboolean doaudio, uint16_t *aport, const janus_network_address *aiface, int *audio_fd,
+		gboolean dovideo, uint16_t *vport, const janus_network_address *viface, int *video_fd) {
+	if(config->caller && (config->host == NULL || (doaudio && *aport == 0) || (dovideo && *vport == 0))) {
+		JANUS_LOG(LOG_ERR, "[%s] SRT caller mode needs a host and the ports to connect to\n", name);
+		return NULL;
+	}
+	janus_streaming_srt *srt = g_malloc0(sizeof(janus_streaming_srt));
+	srt->name = g_strdup(name);
+	srt->config.caller = config->caller;
+	srt->config.host = config->host ? g_strdup(config->host) : NULL;
+	srt->config.latency = config->latency > 0 ? config->latency : JANUS_STREAMING_SRT_DEFAULT_LATENCY;
+	srt->config.passphrase = config->passphrase ? g_strdup(config->passphrase) : NULL;
+	srt->eid = srt_epoll_create();
+	int i = 0;
+	for(i=0; i<2; i++) {
+		janus_streaming_srt_media *m = &srt->media[i];
+		gboolean enabled = (i == 0 ? doaudio : dovideo);
+		const janus_network_address *iface = (i == 0 ? aiface : viface);
+		m->type = (i == 0 ? "audio" : "video");
+		m->port = (i == 0 ? *aport : *vport);
+		m->listener = SRT_INVALID_SOCK;
+		m->sock = SRT_INVALID_SOCK;
+		m->fd = -1;
+		janus_network_address_nullify(&m->iface);
+		if(iface != NULL && !janus_network_address_is_null(iface))
+			m->iface = *iface;
+		if(!enabled)
+			continue;
+		/* The relay thread reads from a local socket we feed */
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0) {
+			JANUS_LOG(LOG_ERR, "[%s] Error creating socket pair for SRT %s: %s\n", name, m->type, g_strerror(errno));
+			janus_streaming_srt_destroy(srt);
+			return NULL;
+		}
+		m->fd = fds[1];
+		if(!srt->config.caller && janus_streaming_srt_listen(srt, m) < 0) {
+			close(fds[0]);
+			janus_streaming_srt_destroy(srt);
+			return NULL;
+		}
+		if(i == 0) {
+			*audio_fd = fds[0];
+			*aport = m->port;
+		} else {
+			*video_fd = fds[0];
+			*vport = m->port;
+		}
+	}
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "srt %s", name);
+	srt->thread = g_thread_try_new(tname, &janus_streaming_srt_thread, srt, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the SRT thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		janus_streaming_srt_destroy(srt);
+		return NULL;
+	}
+	return srt;
+}
+
+static void janus_streaming_srt_destroy(janus_streaming_srt *srt) {
+	if(srt == NULL)
+		return;
+	g_atomic_int_set(&srt->destroyed, 1);
+	if(srt->thread != NULL)
+		g_thread_join(srt->thread);
+	int i = 0;
+	for(i=0; i<2; i++) {
+		janus_streaming_srt_media *m = &srt->media[i];
+		janus_streaming_srt_disconnect(srt, m);
+		if(m->listener != SRT_INVALID_SOCK)
+			srt_close(m->listener);
+		if(m->fd > -1)
+			close(m->fd);
+	}
+	srt_epoll_release(srt->eid);
+	g_free(srt->name);
+	g_free(srt->config.host);
+	g_free(srt->config.passphrase);
+	g_free(srt);
+}
+
+/* Helper to add SRT info and statistics to a mountpoint info */
+static json_t *janus_streaming_srt_info(janus_streaming_srt *srt, gboolean admin) {
+	json_t *info = json_object();
+	json_object_set_new(info, "mode", json_string(srt->config.caller ? "caller" : "listener"));
+	if(srt->config.host)
+		json_object_set_new(info, "host", json_string(srt->config.host));
+	json_object_set_new(info, "latency", json_integer(srt->config.latency));
+	if(!admin)
+		return info;
+	int i = 0;
+	for(i=0; i<2; i++) {
+		janus_streaming_srt_media *m = &srt->media[i];
+		if(m->fd < 0)
+			continue;
+		json_t *media = json_object();
+		SRTSOCKET sock = m->sock;
+		SRT_TRACEBSTATS stats;
+		gboolean connected = (sock != SRT_INVALID_SOCK && srt_bstats(sock, &stats, 0) == 0);
+		json_object_set_new(media, "connected", connected ? json_true() : json_false());
+		if(connected) {
+			json_object_set_new(media, "packets", json_integer(stats.pktRecvTotal));
+			json_object_set_new(media, "lost", json_integer(stats.pktRcvLossTotal));
+			json_object_set_new(media, "retransmitted", json_integer(stats.pktRcvRetrans));
+			json_object_set_new(media, "dropped", json_integer(stats.pktRcvDropTotal));
+			json_object_set_new(media, "rtt", json_real(stats.msRTT));
+		}
+		json_object_set_new(info, m->type, media);
+	}
+	return info;
+}
+#endif
+
 static void janus_streaming_rtp_source_free(janus_streaming_rtp_source *source) {
+#ifdef HAVE_LIBSRT
+	janus_streaming_srt_destroy(source->srt);
+#endif
 	if(source->audio_fd > -1) {
-		close(source->audio_fd);
+		janus_streaming_close_fd(source->audio_fd);
 	}
 	if(source->video_fd[0] > -1) {
-		close(source->video_fd[0]);
+		janus_streaming_close_fd(source->video_fd[0]);
 	}
 	if(source->video_fd[1] > -1) {
-		close(source->video_fd[1]);
+		janus_streaming_close_fd(source->video_fd[1]);
 	}
 	if(source->video_fd[2] > -1) {
-		close(source->video_fd[2]);
+		janus_streaming_close_fd(source->video_fd[2]);
 	}
 	if(source->data_fd > -1) {
-		close(source->data_fd);
+		janus_streaming_close_fd(source->data_fd);
 	}
 	if(source->audio_rtcp_fd > -1) {
-		close(source->audio_rtcp_fd);
+		janus_streaming_close_fd(source->audio_rtcp_fd);
 	}
 	if(source->video_rtcp_fd > -1) {
-		close(source->video_rtcp_fd);
+		janus_streaming_close_fd(source->video_rtcp_fd);
 	}
 	if(source->pipefd[0] > -1) {
 		close(source->pipefd[0]);
@@ -5636,6 +6397,9 @@ static void janus_streaming_rtp_source_free(janus_streaming_rtp_source *source)
 	if(source->keyframe.latest_keyframe != NULL)
 		g_list_free_full(source->keyframe.latest_keyframe, (GDestroyNotify)janus_streaming_rtp_relay_packet_free);
 	source->keyframe.latest_keyframe = NULL;
+	if(source->keyframe.gop != NULL)
+		g_ptr_array_free(source->keyframe.gop, TRUE);
+	source->keyframe.gop = NULL;
 	janus_mutex_unlock(&source->keyframe.mutex);
 	janus_mutex_lock(&source->buffermsg_mutex);
 	if(source->last_msg != NULL)
@@ -5670,11 +6434,13 @@ static void janus_streaming_rtp_source_free(janus_streaming_rtp_source *source)
 	g_free(source->rtsp_vhost);
 	janus_mutex_unlock(&source->rtsp_mutex);
 #endif
+	janus_streaming_ingest_config_free(source->ingest);
 	g_free(source);
 }
 
 static void janus_streaming_file_source_free(janus_streaming_file_source *source) {
 	g_free(source->filename);
+	g_list_free(source->active_readers);
 	g_free(source);
 }
 
@@ -5684,8 +6450,9 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		int srtpsuite, char *srtpcrypto, int threads, gboolean e2ee,
 		gboolean doaudio, gboolean doaudiortcp, char *amcast, const janus_network_address *aiface, uint16_t aport, uint16_t artcpport, uint8_t acodec, char *artpmap, char *afmtp, gboolean doaskew,
 		gboolean dovideo, gboolean dovideortcp, char *vmcast, const janus_network_address *viface, uint16_t vport, uint16_t vrtcpport, uint8_t vcodec, char *vrtpmap, char *vfmtp, gboolean bufferkf,
-			gboolean simulcast, uint16_t vport2, uint16_t vport3, gboolean svc, gboolean dovskew, int rtp_collision,
-		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean textdata, gboolean buffermsg) {
+			int buffergop, gboolean simulcast, uint16_t vport2, uint16_t vport3, gboolean svc, gboolean dovskew, int rtp_collision, int batch,
+		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean textdata, gboolean buffermsg,
+		const janus_streaming_srt_config *srt, const janus_streaming_ingest_config *ingest) {
 	char id_num[30];
 	if(!string_ids) {
 		g_snprintf(id_num, sizeof(id_num), "%"SCNu64, id);
@@ -5723,38 +6490,94 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		janus_mutex_unlock(&mountpoints_mutex);
 		return NULL;
 	}
-	JANUS_LOG(LOG_VERB, "Audio %s, Video %s, Data %s\n",
-		doaudio ? "enabled" : "NOT enabled",
-		dovideo ? "enabled" : "NOT enabled",
-		dodata ? "enabled" : "NOT enabled");
-	/* First of all, let's check if the requested ports are free */
-	int audio_fd = -1;
-	int audio_rtcp_fd = -1;
-	char audiohost[46];
-	audiohost[0] = '\0';
-	if(doaudio) {
-		audio_fd = janus_streaming_create_fd(aport, amcast ? inet_addr(amcast) : INADDR_ANY, aiface,
-			audiohost, sizeof(audiohost), "Audio", "audio", name ? name : tempname, aport == 0);
-		if(audio_fd < 0) {
-			JANUS_LOG(LOG_ERR, "Can't bind to port %d for audio...\n", aport);
+	if(srt != NULL) {
+#ifdef HAVE_LIBSRT
+		if(amcast || vmcast || simulcast) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream, multicast and simulcast are not supported with SRT...\n");
 			janus_mutex_lock(&mountpoints_mutex);
 			g_hash_table_remove(mountpoints_temp, &id);
 			janus_mutex_unlock(&mountpoints_mutex);
 			return NULL;
 		}
-		aport = janus_streaming_get_fd_port(audio_fd);
-		if(doaudiortcp) {
-			audio_rtcp_fd = janus_streaming_create_fd(artcpport, amcast ? inet_addr(amcast) : INADDR_ANY, aiface,
-				NULL, 0, "Audio", "audio", name ? name : tempname, artcpport == 0);
-			if(audio_rtcp_fd < 0) {
-				JANUS_LOG(LOG_ERR, "Can't bind to port %d for audio RTCP...\n", artcpport);
-				if(audio_fd > -1)
-					close(audio_fd);
-				janus_mutex_lock(&mountpoints_mutex);
-				g_hash_table_remove(mountpoints_temp, &id);
-				janus_mutex_unlock(&mountpoints_mutex);
-				return NULL;
-			}
+		if(doaudiortcp || dovideortcp) {
+			JANUS_LOG(LOG_WARN, "RTCP is not used with SRT, ignoring the RTCP ports\n");
+			doaudiortcp = FALSE;
+			dovideortcp = FALSE;
+		}
+#else
+		JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream, SRT support was not compiled...\n");
+		janus_mutex_lock(&mountpoints_mutex);
+		g_hash_table_remove(mountpoints_temp, &id);
+		janus_mutex_unlock(&mountpoints_mutex);
+		return NULL;
+#endif
+	}
+	if(ingest != NULL) {
+		if(ingest_port == 0) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream, the shared ingest port is not available...\n");
+			janus_mutex_lock(&mountpoints_mutex);
+			g_hash_table_remove(mountpoints_temp, &id);
+			janus_mutex_unlock(&mountpoints_mutex);
+			return NULL;
+		}
+		if(srt != NULL || amcast || vmcast) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream, multicast and SRT are not supported with the shared ingest port...\n");
+			janus_mutex_lock(&mountpoints_mutex);
+			g_hash_table_remove(mountpoints_temp, &id);
+			janus_mutex_unlock(&mountpoints_mutex);
+			return NULL;
+		}
+		if(dovideo && simulcast && (ingest->video_ssrc[0] == 0 || ingest->video_ssrc[1] == 0 || ingest->video_ssrc[2] == 0)) {
+			/* Nothing else can tell us which substream a packet belongs to */
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream, simulcast on the shared ingest port needs the SSRC of all substreams...\n");
+			janus_mutex_lock(&mountpoints_mutex);
+			g_hash_table_remove(mountpoints_temp, &id);
+			janus_mutex_unlock(&mountpoints_mutex);
+			return NULL;
+		}
+		if(doaudiortcp || dovideortcp) {
+			JANUS_LOG(LOG_WARN, "RTCP is not used with the shared ingest port, ignoring the RTCP ports\n");
+			doaudiortcp = FALSE;
+			dovideortcp = FALSE;
+		}
+		/* Whatever was configured, this is where the media is received */
+		aport = ingest_port;
+		vport = ingest_port;
+		vport2 = ingest_port;
+		vport3 = ingest_port;
+	}
+	JANUS_LOG(LOG_VERB, "Audio %s, Video %s, Data %s\n",
+		doaudio ? "enabled" : "NOT enabled",
+		dovideo ? "enabled" : "NOT enabled",
+		dodata ? "enabled" : "NOT enabled");
+	/* First of all, let's check if the requested ports are free */
+	int audio_fd = -1;
+	int audio_rtcp_fd = -1;
+	char audiohost[46];
+	audiohost[0] = '\0';
+	if(doaudio && srt == NULL && ingest == NULL) {
+		audio_fd = janus_streaming_create_fd(aport, amcast ? inet_addr(amcast) : INADDR_ANY, aiface,
+			audiohost, sizeof(audiohost), "Audio", "audio", name ? name : tempname, aport == 0);
+		if(audio_fd < 0) {
+			JANUS_LOG(LOG_ERR, "Can't bind to port %d for audio...\n", aport);
+			janus_mutex_lock(&mountpoints_mutex);
+			g_hash_table_remove(mountpoints_temp, &id);
+			janus_mutex_unlock(&mountpoints_mutex);
+			return NULL;
+		}
+		aport = janus_streaming_get_fd_port(audio_fd);
+		if(doaudiortcp) {
+			audio_rtcp_fd = janus_streaming_create_fd(artcpport, amcast ? inet_addr(amcast) : INADDR_ANY, aiface,
+				NULL, 0, "Audio", "audio", name ? name : tempname, artcpport == 0);
+			if(audio_rtcp_fd < 0) {
+				JANUS_LOG(LOG_ERR, "Can't bind to port %d for audio RTCP...\n", artcpport);
+				if(audio_fd > -1)
+					janus_streaming_close_fd(audio_fd);
+				janus_mutex_lock(&mountpoints_mutex);
+				g_hash_table_remove(mountpoints_temp, &id);
+				janus_mutex_unlock(&mountpoints_mutex);
+				return NULL;
+			}
 			artcpport = janus_streaming_get_fd_port(audio_rtcp_fd);
 		}
 	}
@@ -5762,15 +6585,15 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	int video_rtcp_fd = -1;
 	char videohost[46];
 	videohost[0] = '\0';
-	if(dovideo) {
+	if(dovideo && srt == NULL && ingest == NULL) {
 		video_fd[0] = janus_streaming_create_fd(vport, vmcast ? inet_addr(vmcast) : INADDR_ANY, viface,
 			videohost, sizeof(videohost), "Video", "video", name ? name : tempname, vport == 0);
 		if(video_fd[0] < 0) {
 			JANUS_LOG(LOG_ERR, "Can't bind to port %d for video...\n", vport);
 			if(audio_fd > -1)
-				close(audio_fd);
+				janus_streaming_close_fd(audio_fd);
 			if(audio_rtcp_fd > -1)
-				close(audio_rtcp_fd);
+				janus_streaming_close_fd(audio_rtcp_fd);
 			janus_mutex_lock(&mountpoints_mutex);
 			g_hash_table_remove(mountpoints_temp, &id);
 			janus_mutex_unlock(&mountpoints_mutex);
@@ -5783,11 +6606,11 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 			if(video_rtcp_fd < 0) {
 				JANUS_LOG(LOG_ERR, "Can't bind to port %d for video RTCP...\n", vrtcpport);
 				if(audio_fd > -1)
-					close(audio_fd);
+					janus_streaming_close_fd(audio_fd);
 				if(audio_rtcp_fd > -1)
-					close(audio_rtcp_fd);
+					janus_streaming_close_fd(audio_rtcp_fd);
 				if(video_fd[0] > -1)
-					close(video_fd[0]);
+					janus_streaming_close_fd(video_fd[0]);
 				janus_mutex_lock(&mountpoints_mutex);
 				g_hash_table_remove(mountpoints_temp, &id);
 				janus_mutex_unlock(&mountpoints_mutex);
@@ -5801,13 +6624,13 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 			if(video_fd[1] < 0) {
 				JANUS_LOG(LOG_ERR, "Can't bind to port %d for video (2nd port)...\n", vport2);
 				if(audio_fd > -1)
-					close(audio_fd);
+					janus_streaming_close_fd(audio_fd);
 				if(audio_rtcp_fd > -1)
-					close(audio_rtcp_fd);
+					janus_streaming_close_fd(audio_rtcp_fd);
 				if(video_fd[0] > -1)
-					close(video_fd[0]);
+					janus_streaming_close_fd(video_fd[0]);
 				if(video_rtcp_fd > -1)
-					close(video_rtcp_fd);
+					janus_streaming_close_fd(video_rtcp_fd);
 				janus_mutex_lock(&mountpoints_mutex);
 				g_hash_table_remove(mountpoints_temp, &id);
 				janus_mutex_unlock(&mountpoints_mutex);
@@ -5819,15 +6642,15 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 			if(video_fd[2] < 0) {
 				JANUS_LOG(LOG_ERR, "Can't bind to port %d for video (3rd port)...\n", vport3);
 				if(audio_fd > -1)
-					close(audio_fd);
+					janus_streaming_close_fd(audio_fd);
 				if(audio_rtcp_fd > -1)
-					close(audio_rtcp_fd);
+					janus_streaming_close_fd(audio_rtcp_fd);
 				if(video_rtcp_fd > -1)
-					close(video_rtcp_fd);
+					janus_streaming_close_fd(video_rtcp_fd);
 				if(video_fd[0] > -1)
-					close(video_fd[0]);
+					janus_streaming_close_fd(video_fd[0]);
 				if(video_fd[1] > -1)
-					close(video_fd[1]);
+					janus_streaming_close_fd(video_fd[1]);
 				janus_mutex_lock(&mountpoints_mutex);
 				g_hash_table_remove(mountpoints_temp, &id);
 				janus_mutex_unlock(&mountpoints_mutex);
@@ -5846,17 +6669,17 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		if(data_fd < 0) {
 			JANUS_LOG(LOG_ERR, "Can't bind to port %d for data...\n", dport);
 			if(audio_fd > -1)
-				close(audio_fd);
+				janus_streaming_close_fd(audio_fd);
 			if(audio_rtcp_fd > -1)
-				close(audio_rtcp_fd);
+				janus_streaming_close_fd(audio_rtcp_fd);
 			if(video_rtcp_fd > -1)
-				close(video_rtcp_fd);
+				janus_streaming_close_fd(video_rtcp_fd);
 			if(video_fd[0] > -1)
-				close(video_fd[0]);
+				janus_streaming_close_fd(video_fd[0]);
 			if(video_fd[1] > -1)
-				close(video_fd[1]);
+				janus_streaming_close_fd(video_fd[1]);
 			if(video_fd[2] > -1)
-				close(video_fd[2]);
+				janus_streaming_close_fd(video_fd[2]);
 			janus_mutex_lock(&mountpoints_mutex);
 			g_hash_table_remove(mountpoints_temp, &id);
 			janus_mutex_unlock(&mountpoints_mutex);
@@ -5900,19 +6723,19 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 			JANUS_LOG(LOG_ERR, "Invalid SRTP crypto (%s)\n", srtpcrypto);
 			g_free(decoded);
 			if(audio_fd > -1)
-				close(audio_fd);
+				janus_streaming_close_fd(audio_fd);
 			if(audio_rtcp_fd > -1)
-				close(audio_rtcp_fd);
+				janus_streaming_close_fd(audio_rtcp_fd);
 			if(video_rtcp_fd > -1)
-				close(video_rtcp_fd);
+				janus_streaming_close_fd(video_rtcp_fd);
 			if(video_fd[0] > -1)
-				close(video_fd[0]);
+				janus_streaming_close_fd(video_fd[0]);
 			if(video_fd[1] > -1)
-				close(video_fd[1]);
+				janus_streaming_close_fd(video_fd[1]);
 			if(video_fd[2] > -1)
-				close(video_fd[2]);
+				janus_streaming_close_fd(video_fd[2]);
 			if(data_fd > -1)
-				close(data_fd);
+				janus_streaming_close_fd(data_fd);
 			janus_mutex_lock(&mountpoints_mutex);
 			g_hash_table_remove(mountpoints_temp, &id);
 			janus_mutex_unlock(&mountpoints_mutex);
@@ -5941,19 +6764,19 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 			JANUS_LOG(LOG_ERR, "Error creating forwarder SRTP session: %d (%s)\n", res, janus_srtp_error_str(res));
 			g_free(decoded);
 			if(audio_fd > -1)
-				close(audio_fd);
+				janus_streaming_close_fd(audio_fd);
 			if(audio_rtcp_fd > -1)
-				close(audio_rtcp_fd);
+				janus_streaming_close_fd(audio_rtcp_fd);
 			if(video_rtcp_fd > -1)
-				close(video_rtcp_fd);
+				janus_streaming_close_fd(video_rtcp_fd);
 			if(video_fd[0] > -1)
-				close(video_fd[0]);
+				janus_streaming_close_fd(video_fd[0]);
 			if(video_fd[1] > -1)
-				close(video_fd[1]);
+				janus_streaming_close_fd(video_fd[1]);
 			if(video_fd[2] > -1)
-				close(video_fd[2]);
+				janus_streaming_close_fd(video_fd[2]);
 			if(data_fd > -1)
-				close(data_fd);
+				janus_streaming_close_fd(data_fd);
 			janus_mutex_lock(&mountpoints_mutex);
 			g_hash_table_remove(mountpoints_temp, &id);
 			janus_mutex_unlock(&mountpoints_mutex);
@@ -5968,6 +6791,35 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		live_rtp_source->srtpsuite = srtpsuite;
 		live_rtp_source->srtpcrypto = g_strdup(srtpcrypto);
 	}
+#ifdef HAVE_LIBSRT
+	/* If audio and video come via SRT, setup the SRT sockets and receiving thread */
+	if(srt != NULL) {
+		live_rtp_source->srt = janus_streaming_srt_create(srt, live_rtp->name,
+			doaudio, &aport, aiface, &audio_fd, dovideo, &vport, viface, &video_fd[0]);
+		if(live_rtp_source->srt == NULL) {
+			if(audio_fd > -1)
+				janus_streaming_close_fd(audio_fd);
+			if(video_fd[0] > -1)
+				janus_streaming_close_fd(video_fd[0]);
+			if(data_fd > -1)
+				janus_streaming_close_fd(data_fd);
+			janus_mutex_lock(&mountpoints_mutex);
+			g_hash_table_remove(mountpoints_temp, &id);
+			janus_mutex_unlock(&mountpoints_mutex);
+			if(live_rtp_source->is_srtp) {
+				srtp_dealloc(live_rtp_source->srtp_ctx);
+				g_free(live_rtp_source->srtp_policy.key);
+				g_free(live_rtp_source->srtpcrypto);
+			}
+			g_free(live_rtp_source);
+			g_free(live_rtp->name);
+			g_free(live_rtp->description);
+			g_free(live_rtp->metadata);
+			g_free(live_rtp);
+			return NULL;
+		}
+	}
+#endif
 	live_rtp_source->e2ee = e2ee;
 	live_rtp_source->audio_mcast = doaudio ? (amcast ? inet_addr(amcast) : INADDR_ANY) : INADDR_ANY;
 	live_rtp_source->audio_iface = doaudio && !janus_network_address_is_null(aiface) ? *aiface : nil;
@@ -6010,16 +6862,33 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	live_rtp_source->last_received_audio = janus_get_monotonic_time();
 	live_rtp_source->last_received_video = janus_get_monotonic_time();
 	live_rtp_source->last_received_data = janus_get_monotonic_time();
-	live_rtp_source->keyframe.enabled = bufferkf;
+	live_rtp_source->keyframe.enabled = bufferkf || buffergop > 0;
 	live_rtp_source->keyframe.latest_keyframe = NULL;
 	live_rtp_source->keyframe.temp_keyframe = NULL;
 	live_rtp_source->keyframe.temp_ts = 0;
+	if(buffergop > 0) {
+		live_rtp_source->keyframe.gop_max = (size_t)buffergop * 1024;
+		live_rtp_source->keyframe.gop = g_ptr_array_new_with_free_func((GDestroyNotify)janus_streaming_rtp_relay_packet_free);
+	}
 	janus_mutex_init(&live_rtp_source->keyframe.mutex);
 	live_rtp_source->rtp_collision = rtp_collision;
+	if(batch > JANUS_STREAMING_MAX_BATCH) {
+		JANUS_LOG(LOG_WARN, "[%s] Batch too large (%d), capping to %d\n", name, batch, JANUS_STREAMING_MAX_BATCH);
+		batch = JANUS_STREAMING_MAX_BATCH;
+	}
+#ifndef HAVE_RECVMMSG
+	if(batch > 1) {
+		JANUS_LOG(LOG_WARN, "[%s] recvmmsg not available, RTP batching disabled\n", name);
+		batch = 0;
+	}
+#endif
+	live_rtp_source->batch = batch;
 	live_rtp_source->textdata = textdata;
 	live_rtp_source->buffermsg = buffermsg;
 	live_rtp_source->last_msg = NULL;
 	janus_mutex_init(&live_rtp_source->buffermsg_mutex);
+	live_rtp_source->ingest = janus_streaming_ingest_config_dup(ingest);
+	janus_mutex_init(&live_rtp_source->ingest_mutex);
 	live_rtp->source = live_rtp_source;
 	live_rtp->source_destroy = (GDestroyNotify) janus_streaming_rtp_source_free;
 	live_rtp->codecs.audio_pt = doaudio ? acodec : -1;
@@ -6052,10 +6921,21 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	g_atomic_int_set(&live_rtp->destroyed, 0);
 	janus_refcount_init(&live_rtp->ref, janus_streaming_mountpoint_free);
 	janus_mutex_init(&live_rtp->mutex);
+	/* If we're using the shared ingest port, tell the ingest threads how to find us */
+	if(live_rtp_source->ingest != NULL && janus_streaming_ingest_add(live_rtp) < 0) {
+		JANUS_LOG(LOG_ERR, "[%s] Can't add 'rtp' stream, SSRC, source or payload type already in use on the shared ingest port...\n",
+			live_rtp->name);
+		janus_mutex_lock(&mountpoints_mutex);
+		g_hash_table_remove(mountpoints_temp, string_ids ? (gpointer)live_rtp->id_str : (gpointer)&live_rtp->id);
+		janus_mutex_unlock(&mountpoints_mutex);
+		janus_refcount_decrease(&live_rtp->ref);
+		return NULL;
+	}
 	janus_mutex_lock(&mountpoints_mutex);
 	g_hash_table_insert(mountpoints,
 		string_ids ? (gpointer)g_strdup(live_rtp->id_str) : (gpointer)janus_uint64_dup(live_rtp->id),
 		live_rtp);
+	g_atomic_int_set(&mountpoints_count, g_hash_table_size(mountpoints));
 	g_hash_table_remove(mountpoints_temp, string_ids ? (gpointer)live_rtp->id_str : (gpointer)&live_rtp->id);
 	janus_mutex_unlock(&mountpoints_mutex);
 	/* If we need helper threads, spawn them now */
@@ -6067,7 +6947,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 			janus_streaming_helper *helper = g_malloc0(sizeof(janus_streaming_helper));
 			helper->id = i+1;
 			helper->mp = live_rtp;
-			helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_streaming_rtp_relay_packet_free);
+			helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_streaming_helper_packet_unref);
 			janus_mutex_init(&helper->mutex);
 			janus_refcount_init(&helper->ref, janus_streaming_helper_free);
 			live_rtp->helper_threads++;
@@ -6210,6 +7090,7 @@ janus_streaming_mountpoint *janus_streaming_create_file_source(
 	g_hash_table_insert(mountpoints,
 		string_ids ? (gpointer)g_strdup(file_source->id_str) : (gpointer)janus_uint64_dup(file_source->id),
 		file_source);
+	g_atomic_int_set(&mountpoints_count, g_hash_table_size(mountpoints));
 	g_hash_table_remove(mountpoints_temp, string_ids ? (gpointer)file_source->id_str : (gpointer)&file_source->id);
 	janus_mutex_unlock(&mountpoints_mutex);
 	if(live) {
@@ -6323,23 +7204,263 @@ static int janus_streaming_rtsp_parse_sdp(const char *buffer, const char *name,
 	return 0;
 }
 
-/* Static helper to connect to an RTSP server, considering we might do this either
- * when creating a new mountpoint, or when reconnecting after some failure */
-static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp) {
-	if(mp == NULL)
-		return -1;
-	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
-	if(source == NULL)
+/* Helper method to send a latching packet on an RTSP media socket */
+static void janus_streaming_rtsp_latch(int fd, char *host, int port, struct sockaddr *remote) {
+	/* Resolve address to get an IP */
+	struct addrinfo *res = NULL;
+	janus_network_address addr;
+	janus_network_address_string_buffer addr_buf;
+	if(getaddrinfo(host, NULL, NULL, &res) != 0 ||
+			janus_network_address_from_sockaddr(res->ai_addr, &addr) != 0 ||
+			janus_network_address_to_string_buffer(&addr, &addr_buf) != 0) {
+		JANUS_LOG(LOG_ERR, "Could not resolve %s...\n", host);
+		if(res)
+			freeaddrinfo(res);
+	} else {
+		freeaddrinfo(res);
+		/* Prepare the recipient */
+		struct sockaddr_in remote4 = { 0 };
+		struct sockaddr_in6 remote6 = { 0 };
+		socklen_t addrlen = 0;
+		if(addr.family == AF_INET) {
+			memset(&remote4, 0, sizeof(remote4));
+			remote4.sin_family = AF_INET;
+			remote4.sin_port = htons(port);
+			memcpy(&remote4.sin_addr, &addr.ipv4, sizeof(addr.ipv4));
+			remote = (struct sockaddr *)(&remote4);
+			addrlen = sizeof(remote4);
+		} else if(addr.family == AF_INET6) {
+			memset(&remote6, 0, sizeof(remote6));
+			remote6.sin6_family = AF_INET6;
+			remote6.sin6_port = htons(port);
+			memcpy(&remote6.sin6_addr, &addr.ipv6, sizeof(addr.ipv6));
+			remote6.sin6_addr = addr.ipv6;
+			remote = (struct sockaddr *)(&remote6);
+			addrlen = sizeof(remote6);
+		}
+		/* Prepare an empty RTP packet */
+		janus_rtp_header rtp;
+		memset(&rtp, 0, sizeof(rtp));
+		rtp.version = 2;
+		/* Send a couple of latching packets */
+		(void)sendto(fd, &rtp, 12, 0, remote, addrlen);
+		(void)sendto(fd, &rtp, 12, 0, remote, addrlen);
+	}
+}
+
+/* RTSP requests are not sent by the relay threads, but by a single thread
+ * driving a curl multi handle: each RTSP mountpoint has a state machine that
+ * goes through DESCRIBE, SETUP (video and/or audio) and PLAY when connecting,
+ * and then sends OPTIONS as keep-alives, if the server asked for them. When
+ * connecting fails, we try again later, backing off exponentially, which
+ * means an RTSP server that goes away never blocks more than this thread */
+#define JANUS_STREAMING_RTSP_BACKOFF_MIN	G_USEC_PER_SEC
+#define JANUS_STREAMING_RTSP_BACKOFF_MAX	(60*G_USEC_PER_SEC)
+typedef enum janus_streaming_rtsp_state {
+	janus_streaming_rtsp_state_idle = 0,
+	janus_streaming_rtsp_state_backoff,
+	janus_streaming_rtsp_state_describe,
+	janus_streaming_rtsp_state_setup_video,
+	janus_streaming_rtsp_state_setup_audio,
+	janus_streaming_rtsp_state_play,
+	janus_streaming_rtsp_state_connected,
+	janus_streaming_rtsp_state_keepalive
+} janus_streaming_rtsp_state;
+static const char *janus_streaming_rtsp_state_request(janus_streaming_rtsp_state state) {
+	switch(state) {
+		case janus_streaming_rtsp_state_describe:
+			return "DESCRIBE";
+		case janus_streaming_rtsp_state_setup_video:
+		case janus_streaming_rtsp_state_setup_audio:
+			return "SETUP";
+		case janus_streaming_rtsp_state_play:
+			return "PLAY";
+		case janus_streaming_rtsp_state_keepalive:
+			return "OPTIONS";
+		default:
+			break;
+	}
+	return NULL;
+}
+
+/* Whoever needs to know how connecting went (e.g., a "create" with rtsp_failcheck) waits on this */
+typedef struct janus_streaming_rtsp_waiter {
+	janus_mutex mutex;
+	janus_condition cond;
+	gboolean done;
+	int result;
+} janus_streaming_rtsp_waiter;
+
+typedef struct janus_streaming_rtsp_request {
+	janus_streaming_mountpoint *mp;
+	janus_streaming_rtsp_waiter *waiter;
+} janus_streaming_rtsp_request;
+static janus_streaming_rtsp_request rtsp_exit_request;
+
+/* State of an RTSP mountpoint, only ever accessed by the RTSP thread */
+typedef struct janus_streaming_rtsp_conn {
+	janus_streaming_mountpoint *mp;
+	janus_streaming_rtsp_state state;
+	gboolean retry;			/* Whether we should keep on trying until we connect */
+	guint attempts;			/* How many times in a row we failed to connect */
+	gint64 next;			/* When we should try again, or send the next OPTIONS */
+	CURL *curl;				/* Handle we're connecting with, moved to the source on PLAY */
+	janus_streaming_buffer *curldata;
+	CURL *active;			/* Handle we have a request in flight on, if any */
+	GSList *waiters;
+	/* What we learned while negotiating */
+	int ka_timeout;
+	int vresult, aresult;
+	int vpt, apt;
+	char vrtpmap[2048], vfmtp[2048], vcontrol[2048], vtransport[1024], vhost[256], vbase[256];
+	char artpmap[2048], afmtp[2048], acontrol[2048], atransport[1024], ahost[256], abase[256];
+	int vsport, vsport_rtcp, asport, asport_rtcp;
+	multiple_fds video_fds, audio_fds;
+} janus_streaming_rtsp_conn;
+
+/* A TEARDOWN we're sending on behalf of a mountpoint that's gone */
+typedef struct janus_streaming_rtsp_orphan {
+	CURL *curl;
+	janus_streaming_buffer *curldata;
+} janus_streaming_rtsp_orphan;
+
+static GThread *rtsp_thread = NULL;
+static GAsyncQueue *rtsp_requests = NULL;
+static janus_mutex rtsp_requests_mutex = JANUS_MUTEX_INITIALIZER;
+static gboolean rtsp_running = FALSE;
+static int rtsp_wakeup[2] = {-1, -1};
+
+static void janus_streaming_rtsp_buffer_reset(janus_streaming_buffer *curldata) {
+	g_free(curldata->buffer);
+	curldata->buffer = g_malloc0(1);
+	curldata->size = 0;
+}
+
+static void janus_streaming_rtsp_buffer_free(janus_streaming_buffer *curldata) {
+	if(curldata == NULL)
+		return;
+	g_free(curldata->buffer);
+	g_free(curldata);
+}
+
+static void janus_streaming_rtsp_notify(janus_streaming_rtsp_conn *conn, int result) {
+	GSList *l = conn->waiters;
+	while(l) {
+		janus_streaming_rtsp_waiter *waiter = (janus_streaming_rtsp_waiter *)l->data;
+		janus_mutex_lock(&waiter->mutex);
+		waiter->result = result;
+		waiter->done = TRUE;
+		janus_condition_signal(&waiter->cond);
+		janus_mutex_unlock(&waiter->mutex);
+		l = l->next;
+	}
+	g_slist_free(conn->waiters);
+	conn->waiters = NULL;
+}
+
+/* Close the sockets of an RTSP source, e.g., because the server went away */
+static void janus_streaming_rtsp_source_close(janus_streaming_rtp_source *source) {
+	if(source->audio_fd > -1)
+		janus_streaming_close_fd(source->audio_fd);
+	source->audio_fd = -1;
+	if(source->video_fd[0] > -1)
+		janus_streaming_close_fd(source->video_fd[0]);
+	source->video_fd[0] = -1;
+	if(source->video_fd[1] > -1)
+		janus_streaming_close_fd(source->video_fd[1]);
+	source->video_fd[1] = -1;
+	if(source->video_fd[2] > -1)
+		janus_streaming_close_fd(source->video_fd[2]);
+	source->video_fd[2] = -1;
+	if(source->data_fd > -1)
+		janus_streaming_close_fd(source->data_fd);
+	source->data_fd = -1;
+	if(source->audio_rtcp_fd > -1)
+		janus_streaming_close_fd(source->audio_rtcp_fd);
+	source->audio_rtcp_fd = -1;
+	if(source->video_rtcp_fd > -1)
+		janus_streaming_close_fd(source->video_rtcp_fd);
+	source->video_rtcp_fd = -1;
+}
+
+/* Get rid of whatever a failed or interrupted connection attempt left behind */
+static void janus_streaming_rtsp_conn_reset(CURLM *multi, janus_streaming_rtsp_conn *conn) {
+	if(conn->active != NULL) {
+		curl_multi_remove_handle(multi, conn->active);
+		conn->active = NULL;
+	}
+	if(conn->curl != NULL) {
+		curl_easy_cleanup(conn->curl);
+		conn->curl = NULL;
+	}
+	janus_streaming_rtsp_buffer_free(conn->curldata);
+	conn->curldata = NULL;
+	if(conn->video_fds.fd != -1) janus_streaming_close_fd(conn->video_fds.fd);
+	if(conn->video_fds.rtcp_fd != -1) janus_streaming_close_fd(conn->video_fds.rtcp_fd);
+	if(conn->audio_fds.fd != -1) janus_streaming_close_fd(conn->audio_fds.fd);
+	if(conn->audio_fds.rtcp_fd != -1) janus_streaming_close_fd(conn->audio_fds.rtcp_fd);
+	conn->video_fds.fd = conn->video_fds.rtcp_fd = -1;
+	conn->audio_fds.fd = conn->audio_fds.rtcp_fd = -1;
+}
+
+static void janus_streaming_rtsp_conn_free(janus_streaming_rtsp_conn *conn) {
+	janus_refcount_decrease(&conn->mp->ref);
+	g_free(conn);
+}
+
+/* Put a request in flight on the multi handle */
+static int janus_streaming_rtsp_send(CURLM *multi, janus_streaming_rtsp_conn *conn,
+		CURL *curl, janus_streaming_buffer *curldata, long request) {
+	janus_streaming_rtsp_buffer_reset(curldata);
+	curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, request);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, conn);
+	CURLMcode res = curl_multi_add_handle(multi, curl);
+	if(res != CURLM_OK) {
+		JANUS_LOG(LOG_ERR, "[%s] Couldn't queue %s request: %s\n", conn->mp->name,
+			janus_streaming_rtsp_state_request(conn->state), curl_multi_strerror(res));
 		return -1;
+	}
+	conn->active = curl;
+	return 0;
+}
 
-	char *name = mp->name;
-	gboolean doaudio = mp->audio;
-	gboolean dovideo = mp->video;
+/* Connecting failed: let whoever is waiting know, and if needed try again later */
+static void janus_streaming_rtsp_failed(CURLM *multi, janus_streaming_rtsp_conn *conn) {
+	janus_streaming_rtsp_conn_reset(multi, conn);
+	janus_streaming_rtsp_notify(conn, -1);
+	if(!conn->retry) {
+		conn->state = janus_streaming_rtsp_state_idle;
+		return;
+	}
+	gint64 backoff = JANUS_STREAMING_RTSP_BACKOFF_MIN;
+	guint i = 0;
+	for(i=0; i<conn->attempts && backoff < JANUS_STREAMING_RTSP_BACKOFF_MAX; i++)
+		backoff *= 2;
+	if(backoff > JANUS_STREAMING_RTSP_BACKOFF_MAX)
+		backoff = JANUS_STREAMING_RTSP_BACKOFF_MAX;
+	conn->attempts++;
+	JANUS_LOG(LOG_WARN, "[%s] Couldn't connect to the RTSP server, trying again in %"SCNi64"s...\n",
+		conn->mp->name, backoff/G_USEC_PER_SEC);
+	conn->state = janus_streaming_rtsp_state_backoff;
+	conn->next = janus_get_monotonic_time() + backoff;
+}
 
+/* Start connecting, by sending a DESCRIBE */
+static void janus_streaming_rtsp_describe(CURLM *multi, janus_streaming_rtsp_conn *conn) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)conn->mp->source;
+	janus_streaming_rtsp_conn_reset(multi, conn);
+	conn->state = janus_streaming_rtsp_state_describe;
+	conn->ka_timeout = 0;
+	conn->vresult = conn->aresult = -1;
+	conn->vpt = conn->apt = -1;
+	conn->vrtpmap[0] = conn->vfmtp[0] = conn->vhost[0] = conn->vbase[0] = '\0';
+	conn->artpmap[0] = conn->afmtp[0] = conn->ahost[0] = conn->abase[0] = '\0';
+	conn->vsport = conn->vsport_rtcp = conn->asport = conn->asport_rtcp = 0;
 	CURL *curl = curl_easy_init();
 	if(curl == NULL) {
 		JANUS_LOG(LOG_ERR, "Can't init CURL\n");
-		return -1;
+		janus_streaming_rtsp_failed(multi, conn);
+		return;
 	}
 	if(janus_log_level > LOG_INFO)
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
@@ -6347,9 +7468,9 @@ static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp
 	curl_easy_setopt(curl, CURLOPT_URL, source->rtsp_url);
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
 	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L);
-	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 0L);
-	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
 #if CURL_AT_LEAST_VERSION(7, 66, 0)
+	curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_RTSP);
 	curl_easy_setopt(curl, CURLOPT_REDIR_PROTOCOLS, CURLPROTO_RTSP);
 	curl_easy_setopt(curl, CURLOPT_HTTP09_ALLOWED, 1L);
 #endif
@@ -6363,540 +7484,224 @@ static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp
 		curl_easy_setopt(curl, CURLOPT_USERNAME, source->rtsp_username);
 		curl_easy_setopt(curl, CURLOPT_PASSWORD, source->rtsp_password);
 	}
-	/* Send an RTSP DESCRIBE */
-	janus_streaming_buffer *curldata = g_malloc(sizeof(janus_streaming_buffer));
-	curldata->buffer = g_malloc0(1);
-	curldata->size = 0;
+	conn->curl = curl;
+	conn->curldata = g_malloc0(sizeof(janus_streaming_buffer));
 	curl_easy_setopt(curl, CURLOPT_RTSP_STREAM_URI, source->rtsp_url);
-	curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_DESCRIBE);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_streaming_rtsp_curl_callback);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, curldata);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, conn->curldata);
 	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, janus_streaming_rtsp_curl_callback);
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, curldata);
-	int res = curl_easy_perform(curl);
-	if(res != CURLE_OK) {
-		JANUS_LOG(LOG_ERR, "Couldn't send DESCRIBE request: %s\n", curl_easy_strerror(res));
-		curl_easy_cleanup(curl);
-		g_free(curldata->buffer);
-		g_free(curldata);
-		return -2;
-	}
-	long code = 0;
-	res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-	if(res != CURLE_OK) {
-		JANUS_LOG(LOG_ERR, "Couldn't get DESCRIBE answer: %s\n", curl_easy_strerror(res));
-		curl_easy_cleanup(curl);
-		g_free(curldata->buffer);
-		g_free(curldata);
-		return -3;
-	} else if(code != 200) {
-		JANUS_LOG(LOG_ERR, "Couldn't get DESCRIBE code: %ld\n", code);
-		curl_easy_cleanup(curl);
-		g_free(curldata->buffer);
-		g_free(curldata);
-		return -4;
-	}
-	JANUS_LOG(LOG_VERB, "DESCRIBE answer:%s\n", curldata->buffer);
-	/* Parse the SDP we just got to figure out the negotiated media */
-	int ka_timeout = 0;
-	int vpt = -1;
-	char vrtpmap[2048];
-	vrtpmap[0] = '\0';
-	char vfmtp[2048];
-	vfmtp[0] = '\0';
-	char vcontrol[2048];
-	char uri[1024];
-	char vtransport[1024];
-	char vhost[256];
-	vhost[0] = '\0';
-	char vbase[256];
-	vbase[0] = '\0';
-	int vsport = 0, vsport_rtcp = 0;
-	multiple_fds video_fds = {-1, -1};
-
-	int apt = -1;
-	char artpmap[2048];
-	artpmap[0] = '\0';
-	char afmtp[2048];
-	afmtp[0] = '\0';
-	char acontrol[2048];
-	char atransport[1024];
-	char ahost[256];
-	ahost[0] = '\0';
-	char abase[256];
-	abase[0] = '\0';
-	int asport = 0, asport_rtcp = 0;
-	multiple_fds audio_fds = {-1, -1};
-
-	janus_mutex_lock(&mountpoints_mutex);
-	/* Parse both video and audio first before proceed to setup as curldata will be reused */
-	int vresult = -1;
-	if(dovideo) {
-		vresult = janus_streaming_rtsp_parse_sdp(curldata->buffer, name, "video", vbase, &vpt,
-			vtransport, vhost, vrtpmap, vfmtp, vcontrol, &source->video_iface, &video_fds);
-	}
-	int aresult = -1;
-	if(doaudio) {
-		aresult = janus_streaming_rtsp_parse_sdp(curldata->buffer, name, "audio", abase, &apt,
-			atransport, ahost, artpmap, afmtp, acontrol, &source->audio_iface, &audio_fds);
-	}
-	janus_mutex_unlock(&mountpoints_mutex);
-
-	if(vresult == -1 && aresult == -1) {
-		/* Both audio and video failed? Give up... */
-		return -7;
-	}
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, conn->curldata);
+	if(janus_streaming_rtsp_send(multi, conn, curl, conn->curldata, (long)CURL_RTSPREQ_DESCRIBE) < 0)
+		janus_streaming_rtsp_failed(multi, conn);
+}
 
-	/* Check if a query string is part of the URL, as that may impact the SETUP request */
+/* Helper to build the URI of a SETUP, considering a query string may be part of the URL */
+static void janus_streaming_rtsp_setup_uri(janus_streaming_rtp_source *source,
+		const char *base, const char *control, char *uri, size_t len) {
 	char *rtsp_url = source->rtsp_url, *rtsp_querystring = NULL;
 	char **parts = g_strsplit(source->rtsp_url, "?", 2);
 	if(parts[0] != NULL) {
 		rtsp_url = parts[0];
 		rtsp_querystring = parts[1];
 	}
+	gboolean add_qs = (rtsp_querystring != NULL);
+	if(add_qs && strstr(control, rtsp_querystring) != NULL)
+		add_qs = FALSE;
+	if(strstr(control, (strlen(base) > 0 ? base : rtsp_url)) == control) {
+		/* The control attribute already contains the whole URL? */
+		g_snprintf(uri, len, "%s%s%s", control,
+			add_qs ? "?" : "", add_qs ? rtsp_querystring : "");
+	} else {
+		/* Append the control attribute to the URL */
+		g_snprintf(uri, len, "%s/%s%s%s", (strlen(base) > 0 ? base : rtsp_url),
+			control, add_qs ? "?" : "", add_qs ? rtsp_querystring : "");
+	}
+	g_strfreev(parts);
+}
 
-	if(vresult != -1) {
-		/* Identify video codec (useful for keyframe detection) */
-		mp->codecs.video_codec = JANUS_VIDEOCODEC_NONE;
-		if(strstr(vrtpmap, "vp8") || strstr(vrtpmap, "VP8"))
-			mp->codecs.video_codec = JANUS_VIDEOCODEC_VP8;
-		else if(strstr(vrtpmap, "vp9") || strstr(vrtpmap, "VP9"))
-			mp->codecs.video_codec = JANUS_VIDEOCODEC_VP9;
-		else if(strstr(vrtpmap, "h264") || strstr(vrtpmap, "H264"))
-			mp->codecs.video_codec = JANUS_VIDEOCODEC_H264;
+/* Send a SETUP for video or audio */
+static void janus_streaming_rtsp_setup(CURLM *multi, janus_streaming_rtsp_conn *conn, gboolean video) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)conn->mp->source;
+	char uri[1024];
+	janus_streaming_rtsp_setup_uri(source, video ? conn->vbase : conn->abase,
+		video ? conn->vcontrol : conn->acontrol, uri, sizeof(uri));
+	conn->state = video ? janus_streaming_rtsp_state_setup_video : janus_streaming_rtsp_state_setup_audio;
+	curl_easy_setopt(conn->curl, CURLOPT_RTSP_STREAM_URI, uri);
+	curl_easy_setopt(conn->curl, CURLOPT_RTSP_TRANSPORT, video ? conn->vtransport : conn->atransport);
+	if(janus_streaming_rtsp_send(multi, conn, conn->curl, conn->curldata, (long)CURL_RTSPREQ_SETUP) < 0)
+		janus_streaming_rtsp_failed(multi, conn);
+}
 
-		/* Send an RTSP SETUP for video */
-		g_free(curldata->buffer);
-		curldata->buffer = g_malloc0(1);
-		curldata->size = 0;
-		gboolean add_qs = (rtsp_querystring != NULL);
-		if(add_qs && strstr(vcontrol, rtsp_querystring) != NULL)
-			add_qs = FALSE;
-		if(strstr(vcontrol, (strlen(vbase) > 0 ? vbase : rtsp_url)) == vcontrol) {
-			/* The control attribute already contains the whole URL? */
-			g_snprintf(uri, sizeof(uri), "%s%s%s", vcontrol,
-				add_qs ? "?" : "", add_qs ? rtsp_querystring : "");
-		} else {
-			/* Append the control attribute to the URL */
-			g_snprintf(uri, sizeof(uri), "%s/%s%s%s", (strlen(vbase) > 0 ? vbase : rtsp_url),
-				vcontrol, add_qs ? "?" : "", add_qs ? rtsp_querystring : "");
-		}
-		curl_easy_setopt(curl, CURLOPT_RTSP_STREAM_URI, uri);
-		curl_easy_setopt(curl, CURLOPT_RTSP_TRANSPORT, vtransport);
-		curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_SETUP);
-		res = curl_easy_perform(curl);
-		if(res != CURLE_OK) {
-			JANUS_LOG(LOG_ERR, "Couldn't send SETUP request: %s\n", curl_easy_strerror(res));
-			g_strfreev(parts);
-			curl_easy_cleanup(curl);
-			g_free(curldata->buffer);
-			g_free(curldata);
-			if(video_fds.fd != -1) close(video_fds.fd);
-			if(video_fds.rtcp_fd != -1) close(video_fds.rtcp_fd);
-			if(audio_fds.fd != -1) close(audio_fds.fd);
-			if(audio_fds.rtcp_fd != -1) close(audio_fds.rtcp_fd);
-			return -5;
-		} else if(code != 200) {
-			JANUS_LOG(LOG_ERR, "Couldn't get SETUP code: %ld\n", code);
-			g_strfreev(parts);
-			curl_easy_cleanup(curl);
-			g_free(curldata->buffer);
-			g_free(curldata);
-			if(video_fds.fd != -1) close(video_fds.fd);
-			if(video_fds.rtcp_fd != -1) close(video_fds.rtcp_fd);
-			if(audio_fds.fd != -1) close(audio_fds.fd);
-			if(audio_fds.rtcp_fd != -1) close(audio_fds.rtcp_fd);
-			return -5;
-		}
-		JANUS_LOG(LOG_VERB, "SETUP answer:%s\n", curldata->buffer);
-		/* Parse the RTSP message: we may need Transport and Session */
-		gboolean success = TRUE;
-		gchar **parts = g_strsplit(curldata->buffer, "\n", -1);
-		if(parts) {
-			int index = 0;
-			char *line = NULL, *cr = NULL;
-			while(success && (line = parts[index]) != NULL) {
-				cr = strchr(line, '\r');
+/* Parse the answer to a SETUP: we may need Transport and Session */
+static void janus_streaming_rtsp_parse_setup(janus_streaming_rtsp_conn *conn, gboolean video) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)conn->mp->source;
+	const char *media = video ? "video" : "audio";
+	char *host = video ? conn->vhost : conn->ahost;
+	size_t hostlen = video ? sizeof(conn->vhost) : sizeof(conn->ahost);
+	int *sport = video ? &conn->vsport : &conn->asport;
+	int *sport_rtcp = video ? &conn->vsport_rtcp : &conn->asport_rtcp;
+	gboolean success = TRUE;
+	gchar **parts = g_strsplit(conn->curldata->buffer, "\n", -1);
+	if(parts) {
+		int index = 0;
+		char *line = NULL, *cr = NULL;
+		while(success && (line = parts[index]) != NULL) {
+			cr = strchr(line, '\r');
+			if(cr != NULL)
+				*cr = '\0';
+			if(*line == '\0') {
 				if(cr != NULL)
-					*cr = '\0';
-				if(*line == '\0') {
-					if(cr != NULL)
-						*cr = '\r';
-					index++;
-					continue;
-				}
-				if(strlen(line) < 3) {
-					JANUS_LOG(LOG_ERR, "Invalid RTSP line (%zu bytes): %s\n", strlen(line), line);
-					success = FALSE;
-					break;
-				}
-				/* Check if this is a Transport or Session header, and if so parse it */
-				gboolean is_transport = (strstr(line, "Transport:") == line || strstr(line, "transport:") == line);
-				gboolean is_session = (strstr(line, "Session:") == line || strstr(line, "session:") == line);
-				if(is_transport || is_session) {
-					/* There is, iterate on all params */
-					char *p = line, param[100], *pi = NULL;
-					int read = 0;
-					gboolean first = TRUE;
-					while(sscanf(p, "%99[^;]%n", param, &read) == 1) {
-						if(first) {
-							/* Skip */
-							first = FALSE;
-						} else {
-							pi = param;
-							while(*pi == ' ')
-								pi++;
-							char name[50], value[50];
-							if(sscanf(pi, "%49[a-zA-Z_0-9]=%49s", name, value) == 2) {
-								if(is_transport) {
-									if(!strcasecmp(name, "ssrc")) {
-										/* Take note of the video SSRC */
-										uint32_t ssrc = strtol(value, NULL, 16);
-										JANUS_LOG(LOG_VERB, "  -- SSRC (video): %"SCNu32"\n", ssrc);
+					*cr = '\r';
+				index++;
+				continue;
+			}
+			if(strlen(line) < 3) {
+				JANUS_LOG(LOG_ERR, "Invalid RTSP line (%zu bytes): %s\n", strlen(line), line);
+				success = FALSE;
+				break;
+			}
+			/* Check if this is a Transport or Session header, and if so parse it */
+			gboolean is_transport = (strstr(line, "Transport:") == line || strstr(line, "transport:") == line);
+			gboolean is_session = (strstr(line, "Session:") == line || strstr(line, "session:") == line);
+			if(is_transport || is_session) {
+				/* There is, iterate on all params */
+				char *p = line, param[100], *pi = NULL;
+				int read = 0;
+				gboolean first = TRUE;
+				while(sscanf(p, "%99[^;]%n", param, &read) == 1) {
+					if(first) {
+						/* Skip */
+						first = FALSE;
+					} else {
+						pi = param;
+						while(*pi == ' ')
+							pi++;
+						char name[50], value[50];
+						if(sscanf(pi, "%49[a-zA-Z_0-9]=%49s", name, value) == 2) {
+							if(is_transport) {
+								if(!strcasecmp(name, "ssrc")) {
+									/* Take note of the SSRC */
+									uint32_t ssrc = strtol(value, NULL, 16);
+									JANUS_LOG(LOG_VERB, "  -- SSRC (%s): %"SCNu32"\n", media, ssrc);
+									if(video)
 										source->video_ssrc = ssrc;
-									} else if(!strcasecmp(name, "source")) {
-										/* If we got an address via c-line, replace it */
-										g_snprintf(vhost, sizeof(vhost), "%s", value);
-										JANUS_LOG(LOG_VERB, "  -- Source (video): %s\n", vhost);
-									} else if(!strcasecmp(name, "server_port")) {
-										/* Take note of the server port */
-										char *dash = NULL;
-										vsport = strtol(value, &dash, 10);
-										vsport_rtcp = dash ? strtol(++dash, NULL, 10) : 0;
-										JANUS_LOG(LOG_VERB, "  -- RTP port (video): %d\n", vsport);
-										JANUS_LOG(LOG_VERB, "  -- RTCP port (video): %d\n", vsport_rtcp);
-									}
-								} else if(is_session) {
-									if(!strcasecmp(name, "timeout")) {
-										/* Take note of the timeout, for keep-alives */
-										ka_timeout = atoi(value);
-										JANUS_LOG(LOG_VERB, "  -- RTSP session timeout (video): %d\n", ka_timeout);
-									}
+									else
+										source->audio_ssrc = ssrc;
+								} else if(!strcasecmp(name, "source")) {
+									/* If we got an address via c-line, replace it */
+									g_snprintf(host, hostlen, "%s", value);
+									JANUS_LOG(LOG_VERB, "  -- Source (%s): %s\n", media, host);
+								} else if(!strcasecmp(name, "server_port")) {
+									/* Take note of the server port */
+									char *dash = NULL;
+									*sport = strtol(value, &dash, 10);
+									*sport_rtcp = dash ? strtol(++dash, NULL, 10) : 0;
+									JANUS_LOG(LOG_VERB, "  -- RTP port (%s): %d\n", media, *sport);
+									JANUS_LOG(LOG_VERB, "  -- RTCP port (%s): %d\n", media, *sport_rtcp);
+								}
+							} else if(is_session) {
+								if(!strcasecmp(name, "timeout")) {
+									/* Take note of the timeout, for keep-alives */
+									conn->ka_timeout = atoi(value);
+									JANUS_LOG(LOG_VERB, "  -- RTSP session timeout (%s): %d\n", media, conn->ka_timeout);
 								}
 							}
 						}
-						/* Move to the next param */
-						p += read;
-						if(*p != ';')
-							break;
-						while(*p == ';')
-							p++;
 					}
+					/* Move to the next param */
+					p += read;
+					if(*p != ';')
+						break;
+					while(*p == ';')
+						p++;
 				}
-				if(cr != NULL)
-					*cr = '\r';
-				index++;
 			}
 			if(cr != NULL)
 				*cr = '\r';
-			g_strfreev(parts);
+			index++;
 		}
-#ifdef HAVE_LIBCURL
+		if(cr != NULL)
+			*cr = '\r';
+		g_strfreev(parts);
+	}
+}
+
+/* If we don't have a host yet (no c-line, no source in Transport), use the server address */
+static void janus_streaming_rtsp_resolve_server(janus_streaming_rtp_source *source, char *host, size_t len) {
 #if CURL_AT_LEAST_VERSION(7, 62, 0)
-		/* If we don't have a host yet (no c-line, no source in Transport), use the server address */
-		if(strlen(vhost) == 0 || !strcmp(vhost, "0.0.0.0")) {
-			JANUS_LOG(LOG_WARN, "No c-line or source for RTSP video address, resolving server address...\n");
-			CURLU *url = curl_url();
-			if(url != NULL) {
-				CURLUcode code = curl_url_set(url, CURLUPART_URL, source->rtsp_url, 0);
-				if(code == 0) {
-					char *host = NULL;
-					code = curl_url_get(url, CURLUPART_HOST, &host, 0);
-					if(code == 0) {
-						/* Resolve the address */
-						struct addrinfo *info = NULL, *start = NULL;
-						janus_network_address addr;
-						janus_network_address_string_buffer addr_buf;
-						if(getaddrinfo(host, NULL, NULL, &info) == 0) {
-							start = info;
-							while(info != NULL) {
-								if(janus_network_address_from_sockaddr(info->ai_addr, &addr) == 0 &&
-										janus_network_address_to_string_buffer(&addr, &addr_buf) == 0) {
-									/* Resolved */
-									g_snprintf(vhost, sizeof(vhost), "%s",
-										janus_network_address_string_from_buffer(&addr_buf));
-									JANUS_LOG(LOG_VERB, "   -- %s\n", vhost);
-									break;
-								}
-								info = info->ai_next;
-							}
+	CURLU *url = curl_url();
+	if(url != NULL) {
+		CURLUcode code = curl_url_set(url, CURLUPART_URL, source->rtsp_url, 0);
+		if(code == 0) {
+			char *server = NULL;
+			code = curl_url_get(url, CURLUPART_HOST, &server, 0);
+			if(code == 0) {
+				/* Resolve the address */
+				struct addrinfo *info = NULL, *start = NULL;
+				janus_network_address addr;
+				janus_network_address_string_buffer addr_buf;
+				if(getaddrinfo(server, NULL, NULL, &info) == 0) {
+					start = info;
+					while(info != NULL) {
+						if(janus_network_address_from_sockaddr(info->ai_addr, &addr) == 0 &&
+								janus_network_address_to_string_buffer(&addr, &addr_buf) == 0) {
+							/* Resolved */
+							g_snprintf(host, len, "%s",
+								janus_network_address_string_from_buffer(&addr_buf));
+							JANUS_LOG(LOG_VERB, "   -- %s\n", host);
+							break;
 						}
-						if(start)
-							freeaddrinfo(start);
-						curl_free(host);
+						info = info->ai_next;
 					}
 				}
-				curl_url_cleanup(url);
+				if(start)
+					freeaddrinfo(start);
+				curl_free(server);
 			}
 		}
-#endif
-#endif
-		if(strlen(vhost) == 0 || !strcmp(vhost, "0.0.0.0")) {
-			/* Still nothing... */
-			JANUS_LOG(LOG_WARN, "No host address for the RTSP video stream, no latching will be performed\n");
-		}
+		curl_url_cleanup(url);
 	}
+#endif
+}
 
-	if(aresult != -1) {
-		/* Send an RTSP SETUP for audio */
-		g_free(curldata->buffer);
-		curldata->buffer = g_malloc0(1);
-		curldata->size = 0;
-		gboolean add_qs = (rtsp_querystring != NULL);
-		if(add_qs && strstr(acontrol, rtsp_querystring) != NULL)
-			add_qs = FALSE;
-		if(strstr(acontrol, (strlen(abase) > 0 ? abase : rtsp_url)) == acontrol) {
-			/* The control attribute already contains the whole URL? */
-			g_snprintf(uri, sizeof(uri), "%s%s%s", acontrol,
-				add_qs ? "?" : "", add_qs ? rtsp_querystring : "");
-		} else {
-			/* Append the control attribute to the URL */
-			g_snprintf(uri, sizeof(uri), "%s/%s%s%s", (strlen(abase) > 0 ? abase : rtsp_url),
-				acontrol, add_qs ? "?" : "", add_qs ? rtsp_querystring : "");
-		}
-		curl_easy_setopt(curl, CURLOPT_RTSP_STREAM_URI, uri);
-		curl_easy_setopt(curl, CURLOPT_RTSP_TRANSPORT, atransport);
-		curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_SETUP);
-		res = curl_easy_perform(curl);
-		if(res != CURLE_OK) {
-			JANUS_LOG(LOG_ERR, "Couldn't send SETUP request: %s\n", curl_easy_strerror(res));
-			g_strfreev(parts);
-			curl_easy_cleanup(curl);
-			g_free(curldata->buffer);
-			g_free(curldata);
-			if(video_fds.fd != -1) close(video_fds.fd);
-			if(video_fds.rtcp_fd != -1) close(video_fds.rtcp_fd);
-			if(audio_fds.fd != -1) close(audio_fds.fd);
-			if(audio_fds.rtcp_fd != -1) close(audio_fds.rtcp_fd);
-			return -6;
-		} else if(code != 200) {
-			JANUS_LOG(LOG_ERR, "Couldn't get SETUP code: %ld\n", code);
-			g_strfreev(parts);
-			curl_easy_cleanup(curl);
-			g_free(curldata->buffer);
-			g_free(curldata);
-			if(video_fds.fd != -1) close(video_fds.fd);
-			if(video_fds.rtcp_fd != -1) close(video_fds.rtcp_fd);
-			if(audio_fds.fd != -1) close(audio_fds.fd);
-			if(audio_fds.rtcp_fd != -1) close(audio_fds.rtcp_fd);
-			return -6;
-		}
-		JANUS_LOG(LOG_VERB, "SETUP answer:%s\n", curldata->buffer);
-		/* Parse the RTSP message: we may need Transport and Session */
-		gboolean success = TRUE;
-		gchar **parts = g_strsplit(curldata->buffer, "\n", -1);
-		if(parts) {
-			int index = 0;
-			char *line = NULL, *cr = NULL;
-			while(success && (line = parts[index]) != NULL) {
-				cr = strchr(line, '\r');
-				if(cr != NULL)
-					*cr = '\0';
-				if(*line == '\0') {
-					if(cr != NULL)
-						*cr = '\r';
-					index++;
-					continue;
-				}
-				if(strlen(line) < 3) {
-					JANUS_LOG(LOG_ERR, "Invalid RTSP line (%zu bytes): %s\n", strlen(line), line);
-					success = FALSE;
-					break;
-				}
-				/* Check if this is a Transport or Session header, and if so parse it */
-				gboolean is_transport = (strstr(line, "Transport:") == line || strstr(line, "transport:") == line);
-				gboolean is_session = (strstr(line, "Session:") == line || strstr(line, "session:") == line);
-				if(is_transport || is_session) {
-					/* There is, iterate on all params */
-					char *p = line, param[100], *pi = NULL;
-					int read = 0;
-					gboolean first = TRUE;
-					while(sscanf(p, "%99[^;]%n", param, &read) == 1) {
-						if(first) {
-							/* Skip */
-							first = FALSE;
-						} else {
-							pi = param;
-							while(*pi == ' ')
-								pi++;
-							char name[50], value[50];
-							if(sscanf(pi, "%49[a-zA-Z_0-9]=%49s", name, value) == 2) {
-								if(is_transport) {
-									if(!strcasecmp(name, "ssrc")) {
-										/* Take note of the audio SSRC */
-										uint32_t ssrc = strtol(value, NULL, 16);
-										JANUS_LOG(LOG_VERB, "  -- SSRC (audio): %"SCNu32"\n", ssrc);
-										source->audio_ssrc = ssrc;
-									} else if(!strcasecmp(name, "source")) {
-										/* If we got an address via c-line, replace it */
-										g_snprintf(ahost, sizeof(ahost), "%s", value);
-										JANUS_LOG(LOG_VERB, "  -- Source (audio): %s\n", ahost);
-									} else if(!strcasecmp(name, "server_port")) {
-										/* Take note of the server port */
-										char *dash = NULL;
-										asport = strtol(value, &dash, 10);
-										asport_rtcp = dash ? strtol(++dash, NULL, 10) : 0;
-										JANUS_LOG(LOG_VERB, "  -- RTP port (audio): %d\n", asport);
-										JANUS_LOG(LOG_VERB, "  -- RTCP port (audio): %d\n", asport_rtcp);
-									}
-								} else if(is_session) {
-									if(!strcasecmp(name, "timeout")) {
-										/* Take note of the timeout, for keep-alives */
-										ka_timeout = atoi(value);
-										JANUS_LOG(LOG_VERB, "  -- RTSP session timeout (audio): %d\n", ka_timeout);
-									}
-								}
-							}
-						}
-						/* Move to the next param */
-						p += read;
-						if(*p != ';')
-							break;
-						while(*p == ';')
-							p++;
-					}
-				}
-				if(cr != NULL)
-					*cr = '\r';
-				index++;
-			}
-			if(cr != NULL)
-				*cr = '\r';
-			g_strfreev(parts);
-		}
-		/* If we don't have a host yet (no c-line, no source in Transport), use the server address */
-		if(strlen(ahost) == 0 || !strcmp(ahost, "0.0.0.0")) {
-			if(strlen(vhost) > 0 && strcmp(vhost, "0.0.0.0")) {
-				JANUS_LOG(LOG_WARN, "No c-line or source for RTSP audio stream, copying the video address (%s)\n", vhost);
-				g_snprintf(ahost, sizeof(ahost), "%s", vhost);
-			} else {
-#ifdef HAVE_LIBCURL
-#if CURL_AT_LEAST_VERSION(7, 62, 0)
-				JANUS_LOG(LOG_WARN, "No c-line or source for RTSP audio stream, resolving server address...\n");
-				CURLU *url = curl_url();
-				if(url != NULL) {
-					CURLUcode code = curl_url_set(url, CURLUPART_URL, source->rtsp_url, 0);
-					if(code == 0) {
-						char *host = NULL;
-						code = curl_url_get(url, CURLUPART_HOST, &host, 0);
-						if(code == 0) {
-							/* Resolve the address */
-							struct addrinfo *info = NULL, *start = NULL;
-							janus_network_address addr;
-							janus_network_address_string_buffer addr_buf;
-							if(getaddrinfo(host, NULL, NULL, &info) == 0) {
-								start = info;
-								while(info != NULL) {
-									if(janus_network_address_from_sockaddr(info->ai_addr, &addr) == 0 &&
-											janus_network_address_to_string_buffer(&addr, &addr_buf) == 0) {
-										/* Resolved */
-										g_snprintf(ahost, sizeof(ahost), "%s",
-											janus_network_address_string_from_buffer(&addr_buf));
-										JANUS_LOG(LOG_VERB, "   -- %s\n", ahost);
-										break;
-									}
-									info = info->ai_next;
-								}
-							}
-							if(start)
-								freeaddrinfo(start);
-							curl_free(host);
-						}
-					}
-					curl_url_cleanup(url);
-				}
-#endif
-#endif
-			}
-		}
-		if(strlen(ahost) == 0 || !strcmp(ahost, "0.0.0.0")) {
-			/* Still nothing... */
-			JANUS_LOG(LOG_WARN, "No host address for the RTSP audio stream, no latching will be performed\n");
-		}
-	}
-	g_strfreev(parts);
-
+/* We negotiated everything: update the source, latch and send a PLAY */
+static void janus_streaming_rtsp_play(CURLM *multi, janus_streaming_rtsp_conn *conn) {
+	janus_streaming_mountpoint *mp = conn->mp;
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+	gboolean doaudio = mp->audio, dovideo = mp->video;
 	/* Update the source (but check if ptype/rtpmap/fmtp need to be overridden) */
 	if(mp->codecs.audio_pt == -1)
-		mp->codecs.audio_pt = doaudio ? apt : -1;
+		mp->codecs.audio_pt = doaudio ? conn->apt : -1;
 	if(mp->codecs.audio_rtpmap == NULL)
-		mp->codecs.audio_rtpmap = (doaudio && strlen(artpmap)) ? g_strdup(artpmap) : NULL;
+		mp->codecs.audio_rtpmap = (doaudio && strlen(conn->artpmap)) ? g_strdup(conn->artpmap) : NULL;
 	if(mp->codecs.audio_fmtp == NULL)
-		mp->codecs.audio_fmtp = (doaudio && strlen(afmtp)) ? g_strdup(afmtp) : NULL;
+		mp->codecs.audio_fmtp = (doaudio && strlen(conn->afmtp)) ? g_strdup(conn->afmtp) : NULL;
 	if(mp->codecs.video_pt == -1)
-		mp->codecs.video_pt = dovideo ? vpt : -1;
+		mp->codecs.video_pt = dovideo ? conn->vpt : -1;
 	if(mp->codecs.video_rtpmap == NULL)
-		mp->codecs.video_rtpmap = (dovideo && strlen(vrtpmap)) ? g_strdup(vrtpmap) : NULL;
+		mp->codecs.video_rtpmap = (dovideo && strlen(conn->vrtpmap)) ? g_strdup(conn->vrtpmap) : NULL;
 	if(mp->codecs.video_fmtp == NULL)
-		mp->codecs.video_fmtp = (dovideo && strlen(vfmtp)) ? g_strdup(vfmtp) : NULL;
-	source->audio_fd = audio_fds.fd;
-	source->audio_rtcp_fd = audio_fds.rtcp_fd;
-	source->remote_audio_port = asport;
-	source->remote_audio_rtcp_port = asport_rtcp;
+		mp->codecs.video_fmtp = (dovideo && strlen(conn->vfmtp)) ? g_strdup(conn->vfmtp) : NULL;
+	source->audio_fd = conn->audio_fds.fd;
+	source->audio_rtcp_fd = conn->audio_fds.rtcp_fd;
+	source->remote_audio_port = conn->asport;
+	source->remote_audio_rtcp_port = conn->asport_rtcp;
 	g_free(source->rtsp_ahost);
-	if(asport > 0)
-		source->rtsp_ahost = g_strdup(ahost);
-	source->video_fd[0] = video_fds.fd;
-	source->video_rtcp_fd = video_fds.rtcp_fd;
-	source->remote_video_port = vsport;
-	source->remote_video_rtcp_port = vsport_rtcp;
+	source->rtsp_ahost = NULL;
+	if(conn->asport > 0)
+		source->rtsp_ahost = g_strdup(conn->ahost);
+	source->video_fd[0] = conn->video_fds.fd;
+	source->video_rtcp_fd = conn->video_fds.rtcp_fd;
+	source->remote_video_port = conn->vsport;
+	source->remote_video_rtcp_port = conn->vsport_rtcp;
 	g_free(source->rtsp_vhost);
-	if(vsport > 0)
-		source->rtsp_vhost = g_strdup(vhost);
-	source->curl = curl;
-	source->curldata = curldata;
-	source->ka_timeout = ka_timeout;
-	return 0;
-}
-
-/* Helper method to send a latching packet on an RTSP media socket */
-static void janus_streaming_rtsp_latch(int fd, char *host, int port, struct sockaddr *remote) {
-	/* Resolve address to get an IP */
-	struct addrinfo *res = NULL;
-	janus_network_address addr;
-	janus_network_address_string_buffer addr_buf;
-	if(getaddrinfo(host, NULL, NULL, &res) != 0 ||
-			janus_network_address_from_sockaddr(res->ai_addr, &addr) != 0 ||
-			janus_network_address_to_string_buffer(&addr, &addr_buf) != 0) {
-		JANUS_LOG(LOG_ERR, "Could not resolve %s...\n", host);
-		if(res)
-			freeaddrinfo(res);
-	} else {
-		freeaddrinfo(res);
-		/* Prepare the recipient */
-		struct sockaddr_in remote4 = { 0 };
-		struct sockaddr_in6 remote6 = { 0 };
-		socklen_t addrlen = 0;
-		if(addr.family == AF_INET) {
-			memset(&remote4, 0, sizeof(remote4));
-			remote4.sin_family = AF_INET;
-			remote4.sin_port = htons(port);
-			memcpy(&remote4.sin_addr, &addr.ipv4, sizeof(addr.ipv4));
-			remote = (struct sockaddr *)(&remote4);
-			addrlen = sizeof(remote4);
-		} else if(addr.family == AF_INET6) {
-			memset(&remote6, 0, sizeof(remote6));
-			remote6.sin6_family = AF_INET6;
-			remote6.sin6_port = htons(port);
-			memcpy(&remote6.sin6_addr, &addr.ipv6, sizeof(addr.ipv6));
-			remote6.sin6_addr = addr.ipv6;
-			remote = (struct sockaddr *)(&remote6);
-			addrlen = sizeof(remote6);
-		}
-		/* Prepare an empty RTP packet */
-		janus_rtp_header rtp;
-		memset(&rtp, 0, sizeof(rtp));
-		rtp.version = 2;
-		/* Send a couple of latching packets */
-		(void)sendto(fd, &rtp, 12, 0, remote, addrlen);
-		(void)sendto(fd, &rtp, 12, 0, remote, addrlen);
-	}
-}
-
-/* Helper to send an RTSP PLAY (either when we create the mountpoint, or when we try reconnecting) */
-static int janus_streaming_rtsp_play(janus_streaming_rtp_source *source) {
-	if(source == NULL || source->curldata == NULL)
-		return -1;
+	source->rtsp_vhost = NULL;
+	if(conn->vsport > 0)
+		source->rtsp_vhost = g_strdup(conn->vhost);
+	source->ka_timeout = conn->ka_timeout;
+	/* The sockets belong to the source now */
+	conn->video_fds.fd = conn->video_fds.rtcp_fd = -1;
+	conn->audio_fds.fd = conn->audio_fds.rtcp_fd = -1;
 	/* First of all, send a latching packet to the RTSP server port(s) */
 	struct sockaddr_in6 remote = { 0 };
 	if(source->remote_audio_port > 0 && source->audio_fd >= 0) {
@@ -6920,25 +7725,431 @@ static int janus_streaming_rtsp_play(janus_streaming_rtp_source *source) {
 		}
 	}
 	/* Send an RTSP PLAY */
-	janus_mutex_lock(&source->rtsp_mutex);
-	g_free(source->curldata->buffer);
-	source->curldata->buffer = g_malloc0(1);
-	source->curldata->size = 0;
 	JANUS_LOG(LOG_VERB, "Sending PLAY request...\n");
+	conn->state = janus_streaming_rtsp_state_play;
+	curl_easy_setopt(conn->curl, CURLOPT_RTSP_STREAM_URI, source->rtsp_url);
+	curl_easy_setopt(conn->curl, CURLOPT_RANGE, "npt=0.000-");
+	if(janus_streaming_rtsp_send(multi, conn, conn->curl, conn->curldata, (long)CURL_RTSPREQ_PLAY) < 0) {
+		janus_streaming_rtsp_source_close(source);
+		janus_streaming_rtsp_failed(multi, conn);
+	}
+}
+
+/* Send an OPTIONS, to keep the RTSP session alive */
+static void janus_streaming_rtsp_keepalive(CURLM *multi, janus_streaming_rtsp_conn *conn) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)conn->mp->source;
+	JANUS_LOG(LOG_VERB, "[%s] Sending OPTIONS\n", conn->mp->name);
+	conn->state = janus_streaming_rtsp_state_keepalive;
 	curl_easy_setopt(source->curl, CURLOPT_RTSP_STREAM_URI, source->rtsp_url);
-	curl_easy_setopt(source->curl, CURLOPT_RANGE, "npt=0.000-");
-	curl_easy_setopt(source->curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_PLAY);
-	int res = curl_easy_perform(source->curl);
-	if(res != CURLE_OK) {
-		JANUS_LOG(LOG_ERR, "Couldn't send PLAY request: %s\n", curl_easy_strerror(res));
+	if(janus_streaming_rtsp_send(multi, conn, source->curl, source->curldata, (long)CURL_RTSPREQ_OPTIONS) < 0) {
+		conn->state = janus_streaming_rtsp_state_connected;
+		conn->next = janus_get_monotonic_time() + ((gint64)conn->ka_timeout*G_USEC_PER_SEC)/2;
+	}
+}
+
+/* A request we sent got an answer (or failed): move to the next state */
+static void janus_streaming_rtsp_step(CURLM *multi, janus_streaming_rtsp_conn *conn, CURL *curl, CURLcode result) {
+	janus_streaming_mountpoint *mp = conn->mp;
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+	const char *request = janus_streaming_rtsp_state_request(conn->state);
+	long code = 0;
+	if(result == CURLE_OK)
+		result = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	if(conn->state == janus_streaming_rtsp_state_keepalive) {
+		/* Failed keep-alives are not a problem per se: the relay thread
+		 * will have us reconnect, if media stops flowing because of that */
+		if(result != CURLE_OK)
+			JANUS_LOG(LOG_ERR, "[%s] Couldn't send OPTIONS request: %s\n", mp->name, curl_easy_strerror(result));
+		conn->state = janus_streaming_rtsp_state_connected;
+		conn->next = janus_get_monotonic_time() + ((gint64)conn->ka_timeout*G_USEC_PER_SEC)/2;
+		return;
+	}
+	if(result != CURLE_OK || code != 200) {
+		if(result != CURLE_OK) {
+			JANUS_LOG(LOG_ERR, "[%s] Couldn't send %s request: %s\n", mp->name, request, curl_easy_strerror(result));
+		} else {
+			JANUS_LOG(LOG_ERR, "[%s] Couldn't get %s code: %ld\n", mp->name, request, code);
+		}
+		if(conn->state == janus_streaming_rtsp_state_play)
+			janus_streaming_rtsp_source_close(source);
+		janus_streaming_rtsp_failed(multi, conn);
+		return;
+	}
+	JANUS_LOG(LOG_VERB, "%s answer:%s\n", request, conn->curldata->buffer);
+	if(conn->state == janus_streaming_rtsp_state_describe) {
+		/* Parse the SDP we just got to figure out the negotiated media */
+		janus_mutex_lock(&mountpoints_mutex);
+		if(mp->video) {
+			conn->vresult = janus_streaming_rtsp_parse_sdp(conn->curldata->buffer, mp->name, "video", conn->vbase, &conn->vpt,
+				conn->vtransport, conn->vhost, conn->vrtpmap, conn->vfmtp, conn->vcontrol, &source->video_iface, &conn->video_fds);
+		}
+		if(mp->audio) {
+			conn->aresult = janus_streaming_rtsp_parse_sdp(conn->curldata->buffer, mp->name, "audio", conn->abase, &conn->apt,
+				conn->atransport, conn->ahost, conn->artpmap, conn->afmtp, conn->acontrol, &source->audio_iface, &conn->audio_fds);
+		}
+		janus_mutex_unlock(&mountpoints_mutex);
+		if(conn->vresult == -1 && conn->aresult == -1) {
+			/* Both audio and video failed? Give up... */
+			janus_streaming_rtsp_failed(multi, conn);
+			return;
+		}
+		if(conn->vresult != -1) {
+			/* Identify video codec (useful for keyframe detection) */
+			mp->codecs.video_codec = JANUS_VIDEOCODEC_NONE;
+			if(strstr(conn->vrtpmap, "vp8") || strstr(conn->vrtpmap, "VP8"))
+				mp->codecs.video_codec = JANUS_VIDEOCODEC_VP8;
+			else if(strstr(conn->vrtpmap, "vp9") || strstr(conn->vrtpmap, "VP9"))
+				mp->codecs.video_codec = JANUS_VIDEOCODEC_VP9;
+			else if(strstr(conn->vrtpmap, "h264") || strstr(conn->vrtpmap, "H264"))
+				mp->codecs.video_codec = JANUS_VIDEOCODEC_H264;
+		}
+		janus_streaming_rtsp_setup(multi, conn, conn->vresult != -1);
+	} else if(conn->state == janus_streaming_rtsp_state_setup_video) {
+		janus_streaming_rtsp_parse_setup(conn, TRUE);
+		if(strlen(conn->vhost) == 0 || !strcmp(conn->vhost, "0.0.0.0")) {
+			JANUS_LOG(LOG_WARN, "No c-line or source for RTSP video address, resolving server address...\n");
+			janus_streaming_rtsp_resolve_server(source, conn->vhost, sizeof(conn->vhost));
+		}
+		if(strlen(conn->vhost) == 0 || !strcmp(conn->vhost, "0.0.0.0")) {
+			/* Still nothing... */
+			JANUS_LOG(LOG_WARN, "No host address for the RTSP video stream, no latching will be performed\n");
+		}
+		if(conn->aresult != -1)
+			janus_streaming_rtsp_setup(multi, conn, FALSE);
+		else
+			janus_streaming_rtsp_play(multi, conn);
+	} else if(conn->state == janus_streaming_rtsp_state_setup_audio) {
+		janus_streaming_rtsp_parse_setup(conn, FALSE);
+		if(strlen(conn->ahost) == 0 || !strcmp(conn->ahost, "0.0.0.0")) {
+			if(strlen(conn->vhost) > 0 && strcmp(conn->vhost, "0.0.0.0")) {
+				JANUS_LOG(LOG_WARN, "No c-line or source for RTSP audio stream, copying the video address (%s)\n", conn->vhost);
+				g_snprintf(conn->ahost, sizeof(conn->ahost), "%s", conn->vhost);
+			} else {
+				JANUS_LOG(LOG_WARN, "No c-line or source for RTSP audio stream, resolving server address...\n");
+				janus_streaming_rtsp_resolve_server(source, conn->ahost, sizeof(conn->ahost));
+			}
+		}
+		if(strlen(conn->ahost) == 0 || !strcmp(conn->ahost, "0.0.0.0")) {
+			/* Still nothing... */
+			JANUS_LOG(LOG_WARN, "No host address for the RTSP audio stream, no latching will be performed\n");
+		}
+		janus_streaming_rtsp_play(multi, conn);
+	} else if(conn->state == janus_streaming_rtsp_state_play) {
+		/* We're connected: the source can have the handle, for keep-alives and the TEARDOWN */
+		janus_mutex_lock(&source->rtsp_mutex);
+		source->curl = conn->curl;
+		source->curldata = conn->curldata;
 		janus_mutex_unlock(&source->rtsp_mutex);
-		return -1;
+		conn->curl = NULL;
+		conn->curldata = NULL;
+		conn->state = janus_streaming_rtsp_state_connected;
+		conn->attempts = 0;
+		conn->next = conn->ka_timeout > 0 ?
+			(janus_get_monotonic_time() + ((gint64)conn->ka_timeout*G_USEC_PER_SEC)/2) : 0;
+		JANUS_LOG(LOG_INFO, "[%s] Connected to the RTSP server\n", mp->name);
+		/* Let the relay thread know it can start polling the new sockets */
+		source->reconnect_timer = janus_get_monotonic_time();
+		g_atomic_int_inc(&source->rtsp_generation);
+		g_atomic_int_set(&source->reconnecting, 0);
+		janus_streaming_rtsp_notify(conn, 0);
+	}
+}
+
+/* Somebody wants a mountpoint to be connected */
+static void janus_streaming_rtsp_handle_request(CURLM *multi, GHashTable *conns, janus_streaming_rtsp_request *req) {
+	janus_streaming_mountpoint *mp = req->mp;
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+	janus_streaming_rtsp_conn *conn = g_hash_table_lookup(conns, mp);
+	if(conn == NULL) {
+		/* We keep the reference the request had */
+		conn = g_malloc0(sizeof(janus_streaming_rtsp_conn));
+		conn->mp = mp;
+		conn->video_fds.fd = conn->video_fds.rtcp_fd = -1;
+		conn->audio_fds.fd = conn->audio_fds.rtcp_fd = -1;
+		g_hash_table_insert(conns, mp, conn);
+	} else {
+		janus_refcount_decrease(&mp->ref);
+	}
+	if(req->waiter != NULL)
+		conn->waiters = g_slist_append(conn->waiters, req->waiter);
+	else
+		conn->retry = TRUE;
+	switch(conn->state) {
+		case janus_streaming_rtsp_state_idle:
+		case janus_streaming_rtsp_state_backoff:
+			janus_streaming_rtsp_describe(multi, conn);
+			break;
+		case janus_streaming_rtsp_state_connected:
+		case janus_streaming_rtsp_state_keepalive:
+			if(req->waiter != NULL) {
+				/* Already connected */
+				janus_streaming_rtsp_notify(conn, 0);
+				break;
+			}
+			/* The relay thread thinks the server is gone, start from scratch */
+			if(conn->active != NULL) {
+				curl_multi_remove_handle(multi, conn->active);
+				conn->active = NULL;
+			}
+			janus_mutex_lock(&source->rtsp_mutex);
+			if(source->curl != NULL)
+				curl_easy_cleanup(source->curl);
+			source->curl = NULL;
+			janus_streaming_rtsp_buffer_free(source->curldata);
+			source->curldata = NULL;
+			janus_mutex_unlock(&source->rtsp_mutex);
+			conn->attempts = 0;
+			janus_streaming_rtsp_describe(multi, conn);
+			break;
+		default:
+			/* We're connecting already, whoever is waiting will get the result */
+			break;
 	}
-	JANUS_LOG(LOG_VERB, "PLAY answer:%s\n", source->curldata->buffer);
+}
+
+/* A mountpoint is gone: get rid of its state, and TEARDOWN its session */
+static GList *janus_streaming_rtsp_teardown(CURLM *multi, janus_streaming_rtsp_conn *conn, GList *orphans) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)conn->mp->source;
+	janus_streaming_rtsp_conn_reset(multi, conn);
+	janus_streaming_rtsp_notify(conn, -1);
+	janus_mutex_lock(&source->rtsp_mutex);
+	CURL *curl = source->curl;
+	janus_streaming_buffer *curldata = source->curldata;
+	source->curl = NULL;
+	source->curldata = NULL;
 	janus_mutex_unlock(&source->rtsp_mutex);
+	if(curl == NULL) {
+		janus_streaming_rtsp_buffer_free(curldata);
+		return orphans;
+	}
+	janus_streaming_rtsp_buffer_reset(curldata);
+	curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_TEARDOWN);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+	if(curl_multi_add_handle(multi, curl) != CURLM_OK) {
+		curl_easy_cleanup(curl);
+		janus_streaming_rtsp_buffer_free(curldata);
+		return orphans;
+	}
+	janus_streaming_rtsp_orphan *orphan = g_malloc(sizeof(janus_streaming_rtsp_orphan));
+	orphan->curl = curl;
+	orphan->curldata = curldata;
+	return g_list_prepend(orphans, orphan);
+}
+
+static GList *janus_streaming_rtsp_orphan_done(CURLM *multi, GList *orphans, CURL *curl) {
+	GList *l = orphans;
+	while(l) {
+		janus_streaming_rtsp_orphan *orphan = (janus_streaming_rtsp_orphan *)l->data;
+		if(orphan->curl == curl) {
+			curl_multi_remove_handle(multi, curl);
+			curl_easy_cleanup(curl);
+			janus_streaming_rtsp_buffer_free(orphan->curldata);
+			g_free(orphan);
+			return g_list_delete_link(orphans, l);
+		}
+		l = l->next;
+	}
+	return orphans;
+}
+
+/* Thread sending all the RTSP requests */
+static void *janus_streaming_rtsp_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining Streaming RTSP thread\n");
+	CURLM *multi = curl_multi_init();
+	GHashTable *conns = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_streaming_rtsp_conn_free);
+	GList *orphans = NULL;
+	struct curl_waitfd wakeup;
+	wakeup.fd = rtsp_wakeup[0];
+	wakeup.events = CURL_WAIT_POLLIN;
+	wakeup.revents = 0;
+	GHashTableIter iter;
+	gpointer value;
+	char tmp[64];
+	janus_streaming_rtsp_request *req = NULL;
+	gboolean quit = FALSE;
+	while(!quit) {
+		/* Any new request? */
+		while(read(rtsp_wakeup[0], tmp, sizeof(tmp)) > 0);
+		while(!quit && (req = g_async_queue_try_pop(rtsp_requests)) != NULL) {
+			if(req == &rtsp_exit_request) {
+				quit = TRUE;
+				break;
+			}
+			janus_streaming_rtsp_handle_request(multi, conns, req);
+			g_free(req);
+		}
+		if(quit)
+			break;
+		/* Check the timers, and if any mountpoint went away */
+		gint64 now = janus_get_monotonic_time();
+		g_hash_table_iter_init(&iter, conns);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_streaming_rtsp_conn *conn = (janus_streaming_rtsp_conn *)value;
+			if(g_atomic_int_get(&conn->mp->destroyed)) {
+				orphans = janus_streaming_rtsp_teardown(multi, conn, orphans);
+				g_hash_table_iter_remove(&iter);
+				continue;
+			}
+			if(conn->state == janus_streaming_rtsp_state_backoff && now >= conn->next) {
+				janus_streaming_rtsp_describe(multi, conn);
+			} else if(conn->state == janus_streaming_rtsp_state_connected && conn->next > 0 && now >= conn->next) {
+				janus_streaming_rtsp_keepalive(multi, conn);
+			}
+		}
+		/* Let libcurl do its thing, and see which requests are done */
+		int running = 0, left = 0;
+		curl_multi_perform(multi, &running);
+		CURLMsg *msg = NULL;
+		while((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if(msg->msg != CURLMSG_DONE)
+				continue;
+			CURL *curl = msg->easy_handle;
+			CURLcode result = msg->data.result;
+			janus_streaming_rtsp_conn *conn = NULL;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&conn);
+			if(conn == NULL) {
+				/* A TEARDOWN for a mountpoint that's gone */
+				orphans = janus_streaming_rtsp_orphan_done(multi, orphans, curl);
+				continue;
+			}
+			curl_multi_remove_handle(multi, curl);
+			conn->active = NULL;
+			janus_streaming_rtsp_step(multi, conn, curl, result);
+			if(conn->state == janus_streaming_rtsp_state_idle)
+				g_hash_table_remove(conns, conn->mp);
+		}
+		/* Wait for something to happen, but not too long, as timers need checking */
+		int numfds = 0;
+		curl_multi_wait(multi, &wakeup, 1, 250, &numfds);
+	}
+	/* We're done: nobody can send requests anymore */
+	janus_mutex_lock(&rtsp_requests_mutex);
+	rtsp_running = FALSE;
+	janus_mutex_unlock(&rtsp_requests_mutex);
+	while((req = g_async_queue_try_pop(rtsp_requests)) != NULL) {
+		if(req == &rtsp_exit_request)
+			continue;
+		if(req->waiter != NULL) {
+			janus_mutex_lock(&req->waiter->mutex);
+			req->waiter->result = -1;
+			req->waiter->done = TRUE;
+			janus_condition_signal(&req->waiter->cond);
+			janus_mutex_unlock(&req->waiter->mutex);
+		}
+		janus_refcount_decrease(&req->mp->ref);
+		g_free(req);
+	}
+	/* Mountpoints that are still connected will send their TEARDOWN when destroyed */
+	g_hash_table_iter_init(&iter, conns);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_streaming_rtsp_conn *conn = (janus_streaming_rtsp_conn *)value;
+		janus_streaming_rtsp_conn_reset(multi, conn);
+		janus_streaming_rtsp_notify(conn, -1);
+	}
+	g_hash_table_destroy(conns);
+	while(orphans != NULL) {
+		janus_streaming_rtsp_orphan *orphan = (janus_streaming_rtsp_orphan *)orphans->data;
+		orphans = janus_streaming_rtsp_orphan_done(multi, orphans, orphan->curl);
+	}
+	curl_multi_cleanup(multi);
+	JANUS_LOG(LOG_VERB, "Leaving Streaming RTSP thread\n");
+	return NULL;
+}
+
+static int janus_streaming_rtsp_start(void) {
+	if(pipe(rtsp_wakeup) < 0) {
+		JANUS_LOG(LOG_ERR, "Error creating pipe for the RTSP thread: %d (%s)\n", errno, g_strerror(errno));
+		return -1;
+	}
+	fcntl(rtsp_wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(rtsp_wakeup[1], F_SETFL, O_NONBLOCK);
+	rtsp_requests = g_async_queue_new();
+	rtsp_running = TRUE;
+	GError *error = NULL;
+	rtsp_thread = g_thread_try_new("streaming rtsp", janus_streaming_rtsp_thread, NULL, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Streaming RTSP thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		rtsp_running = FALSE;
+		rtsp_thread = NULL;
+		g_async_queue_unref(rtsp_requests);
+		rtsp_requests = NULL;
+		close(rtsp_wakeup[0]);
+		close(rtsp_wakeup[1]);
+		rtsp_wakeup[0] = rtsp_wakeup[1] = -1;
+		return -1;
+	}
 	return 0;
 }
 
+static void janus_streaming_rtsp_stop(void) {
+	if(rtsp_thread == NULL)
+		return;
+	g_async_queue_push(rtsp_requests, &rtsp_exit_request);
+	char code = 1;
+	ssize_t res = 0;
+	do {
+		res = write(rtsp_wakeup[1], &code, sizeof(code));
+	} while(res == -1 && errno == EINTR);
+	g_thread_join(rtsp_thread);
+	rtsp_thread = NULL;
+	g_async_queue_unref(rtsp_requests);
+	rtsp_requests = NULL;
+	close(rtsp_wakeup[0]);
+	close(rtsp_wakeup[1]);
+	rtsp_wakeup[0] = rtsp_wakeup[1] = -1;
+}
+
+/* Static helper to ask the RTSP thread to connect (or reconnect) a mountpoint */
+static int janus_streaming_rtsp_request_connect(janus_streaming_mountpoint *mp, janus_streaming_rtsp_waiter *waiter) {
+	janus_mutex_lock(&rtsp_requests_mutex);
+	if(!rtsp_running) {
+		janus_mutex_unlock(&rtsp_requests_mutex);
+		return -1;
+	}
+	janus_streaming_rtsp_request *req = g_malloc(sizeof(janus_streaming_rtsp_request));
+	janus_refcount_increase(&mp->ref);
+	req->mp = mp;
+	req->waiter = waiter;
+	g_async_queue_push(rtsp_requests, req);
+	janus_mutex_unlock(&rtsp_requests_mutex);
+	char code = 1;
+	ssize_t res = 0;
+	do {
+		res = write(rtsp_wakeup[1], &code, sizeof(code));
+	} while(res == -1 && errno == EINTR);
+	return 0;
+}
+
+/* Connect to the RTSP server once, and wait for the result: used when creating
+ * a mountpoint that should fail if the server can't be reached right away */
+static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp) {
+	janus_streaming_rtsp_waiter waiter;
+	janus_mutex_init(&waiter.mutex);
+	janus_condition_init(&waiter.cond);
+	waiter.done = FALSE;
+	waiter.result = -1;
+	if(janus_streaming_rtsp_request_connect(mp, &waiter) == 0) {
+		janus_mutex_lock(&waiter.mutex);
+		while(!waiter.done)
+			janus_condition_wait(&waiter.cond, &waiter.mutex);
+		janus_mutex_unlock(&waiter.mutex);
+	}
+	janus_condition_destroy(&waiter.cond);
+	janus_mutex_destroy(&waiter.mutex);
+	return waiter.result;
+}
+
+/* Have the RTSP thread connect to the server in the background, until it
+ * succeeds: the relay thread will wait for it before polling the sockets */
+static void janus_streaming_rtsp_reconnect(janus_streaming_mountpoint *mp) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+	g_atomic_int_set(&source->reconnecting, 1);
+	if(janus_streaming_rtsp_request_connect(mp, NULL) < 0)
+		JANUS_LOG(LOG_ERR, "[%s] Can't connect to the RTSP server, RTSP thread not available\n", mp->name);
+}
+
 /* Helper to create an RTSP source */
 janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		uint64_t id, char *id_str, char *name, char *desc, char *metadata,
@@ -7038,7 +8249,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 	live_rtsp->codecs.video_fmtp = dovideo ? (vfmtp ? g_strdup(vfmtp) : NULL) : NULL;
 	/* If we need to return an error on failure, try connecting right now */
 	if(error_on_failure) {
-		/* Now connect to the RTSP server */
+		/* Now connect to the RTSP server (and send a PLAY) */
 		if(janus_streaming_rtsp_connect_to_server(live_rtsp) < 0) {
 			/* Error connecting, get rid of the mountpoint */
 			janus_mutex_lock(&mountpoints_mutex);
@@ -7047,15 +8258,9 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 			janus_refcount_decrease(&live_rtsp->ref);
 			return NULL;
 		}
-		/* Send an RTSP PLAY, now */
-		if(janus_streaming_rtsp_play(live_rtsp_source) < 0) {
-			/* Error trying to play, get rid of the mountpoint */
-			janus_mutex_lock(&mountpoints_mutex);
-			g_hash_table_remove(mountpoints_temp, &id);
-			janus_mutex_unlock(&mountpoints_mutex);
-			janus_refcount_decrease(&live_rtsp->ref);
-			return NULL;
-		}
+	} else {
+		/* Connect in the background: the relay thread will wait for it */
+		janus_streaming_rtsp_reconnect(live_rtsp);
 	}
 	/* If we need helper threads, spawn them now */
 	GError *error = NULL;
@@ -7066,7 +8271,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 			janus_streaming_helper *helper = g_malloc0(sizeof(janus_streaming_helper));
 			helper->id = i+1;
 			helper->mp = live_rtsp;
-			helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_streaming_rtp_relay_packet_free);
+			helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_streaming_helper_packet_unref);
 			janus_mutex_init(&helper->mutex);
 			janus_refcount_init(&helper->ref, janus_streaming_helper_free);
 			live_rtsp->helper_threads++;
@@ -7084,6 +8289,8 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 				janus_refcount_decrease(&helper->ref);
 				/* This extra unref is for the init */
 				janus_refcount_decrease(&helper->ref);
+				/* Have the RTSP thread let go of the mountpoint too */
+				g_atomic_int_set(&live_rtsp->destroyed, 1);
 				janus_mutex_lock(&mountpoints_mutex);
 				g_hash_table_remove(mountpoints_temp, &id);
 				janus_mutex_unlock(&mountpoints_mutex);
@@ -7102,6 +8309,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTSP thread...\n",
 			error->code, error->message ? error->message : "??");
 		g_error_free(error);
+		g_atomic_int_set(&live_rtsp->destroyed, 1);
 		janus_mutex_lock(&mountpoints_mutex);
 		g_hash_table_remove(mountpoints_temp, &id);
 		janus_mutex_unlock(&mountpoints_mutex);
@@ -7113,6 +8321,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 	g_hash_table_insert(mountpoints,
 		string_ids ? (gpointer)g_strdup(live_rtsp->id_str) : (gpointer)janus_uint64_dup(live_rtsp->id),
 		live_rtsp);
+	g_atomic_int_set(&mountpoints_count, g_hash_table_size(mountpoints));
 	g_hash_table_remove(mountpoints_temp, string_ids ? (gpointer)live_rtsp->id_str : (gpointer)&live_rtsp->id);
 	janus_mutex_unlock(&mountpoints_mutex);
 	return live_rtsp;
@@ -7221,6 +8430,7 @@ static void *janus_streaming_ondemand_thread(void *data) {
 	/* Loop */
 	gint read = 0, plen = (sizeof(buf)-RTP_HEADER_SIZE);
 	janus_streaming_rtp_relay_packet packet;
+	packet.received = 0;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mountpoint->destroyed) &&
 			!g_atomic_int_get(&session->stopping) && !g_atomic_int_get(&session->destroyed)) {
 		/* See if it's time to prepare a frame */
@@ -7295,6 +8505,198 @@ static void *janus_streaming_ondemand_thread(void *data) {
 	return NULL;
 }
 
+/* Helper to assign a viewer to a shared reader of an ondemand mountpoint,
+ * starting a new one if needed (called with the mountpoint mutex locked) */
+static int janus_streaming_ondemand_reader_assign(janus_streaming_mountpoint *mp, janus_streaming_session *session) {
+	janus_streaming_file_source *source = mp->source;
+	janus_streaming_ondemand_reader *reader = NULL, *r = NULL;
+	GList *l = source->active_readers;
+	while(l) {
+		r = (janus_streaming_ondemand_reader *)l->data;
+		if(reader == NULL || r->started > reader->started)
+			reader = r;
+		l = l->next;
+	}
+	gint64 now = janus_get_monotonic_time();
+	if(reader == NULL || (now - reader->started > JANUS_STREAMING_READER_STAGGER &&
+			(int)g_list_length(source->active_readers) < source->readers)) {
+		/* Start a new reader */
+		static volatile gint reader_ids = 0;
+		r = g_malloc0(sizeof(janus_streaming_ondemand_reader));
+		r->mp = mp;
+		r->id = (guint)g_atomic_int_add(&reader_ids, 1) + 1;
+		r->started = now;
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "mp %s r%u", mp->id_str, r->id);
+		janus_refcount_increase(&mp->ref);
+		g_thread_try_new(tname, &janus_streaming_ondemand_reader_thread, r, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "[%s] Got error %d (%s) trying to launch the on-demand reader thread...\n",
+				mp->name, error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_refcount_decrease(&mp->ref);
+			g_free(r);
+			/* If there are other readers, use the latest one */
+			if(reader == NULL)
+				return -1;
+		} else {
+			source->active_readers = g_list_prepend(source->active_readers, r);
+			reader = r;
+		}
+	}
+	session->reader = reader;
+	JANUS_LOG(LOG_VERB, "[%s] Viewer assigned to on-demand reader #%u (%d active)\n",
+		mp->name, reader->id, g_list_length(source->active_readers));
+	return 0;
+}
+
+/* Thread to send RTP packets from a file (on demand, shared reader) */
+static void *janus_streaming_ondemand_reader_thread(void *data) {
+	janus_streaming_ondemand_reader *reader = (janus_streaming_ondemand_reader *)data;
+	janus_streaming_mountpoint *mountpoint = reader->mp;
+	janus_streaming_file_source *source = mountpoint->source;
+	char *name = g_strdup(mountpoint->name ? mountpoint->name : "??");
+	JANUS_LOG(LOG_VERB, "[%s] Filesource (on demand) reader #%u starting...\n", name, reader->id);
+	FILE *audio = fopen(source->filename, "rb");
+	if(!audio)
+		JANUS_LOG(LOG_ERR, "[%s] Ooops, audio file missing!\n", name);
+#ifdef HAVE_LIBOGG
+	/* Make sure that, if this is an .opus file, we can open it */
+	janus_streaming_opus_context opusctx = { 0 };
+	if(audio && source->opus) {
+		opusctx.name = name;
+		opusctx.filename = source->filename;
+		opusctx.file = audio;
+		if(janus_streaming_opus_context_init(&opusctx) < 0) {
+			fclose(audio);
+			audio = NULL;
+		}
+	}
+#endif
+
+	/* Buffer */
+	char buf[1500];
+	memset(buf, 0, sizeof(buf));
+	/* Set up RTP */
+	gint16 seq = 1;
+	gint32 ts = 0;
+	janus_rtp_header *header = (janus_rtp_header *)buf;
+	header->version = 2;
+	header->markerbit = 1;
+	header->type = mountpoint->codecs.audio_pt;
+	header->seq_number = htons(seq);
+	header->timestamp = htonl(ts);
+	header->ssrc = htonl(1);	/* The Janus core will fix this anyway */
+	/* Timer */
+	struct timeval now, before;
+	gettimeofday(&before, NULL);
+	now.tv_sec = before.tv_sec;
+	now.tv_usec = before.tv_usec;
+	time_t passed, d_s, d_us;
+	/* Loop */
+	gint read = 0, plen = (sizeof(buf)-RTP_HEADER_SIZE);
+	janus_streaming_rtp_relay_packet packet = { 0 };
+	gboolean done = FALSE;
+	while(audio && !g_atomic_int_get(&stopping) && !g_atomic_int_get(&mountpoint->destroyed)) {
+		/* See if it's time to prepare a frame */
+		gettimeofday(&now, NULL);
+		d_s = now.tv_sec - before.tv_sec;
+		d_us = now.tv_usec - before.tv_usec;
+		if(d_us < 0) {
+			d_us += 1000000;
+			--d_s;
+		}
+		passed = d_s*1000000 + d_us;
+		if(passed < 18000) {	/* Let's wait about 18ms */
+			g_usleep(5000);
+			continue;
+		}
+		/* Update the reference time */
+		before.tv_usec += 20000;
+		if(before.tv_usec > 1000000) {
+			before.tv_sec++;
+			before.tv_usec -= 1000000;
+		}
+		/* If paused, wait some more */
+		if(!mountpoint->enabled)
+			continue;
+		if(source->opus) {
+#ifdef HAVE_LIBOGG
+			/* Get the next frame from the Opus file */
+			read = janus_streaming_opus_context_read(&opusctx, buf + RTP_HEADER_SIZE, plen);
+#endif
+		} else {
+			/* Read frame from file... */
+			read = fread(buf + RTP_HEADER_SIZE, sizeof(char), 160, audio);
+			if(feof(audio)) {
+				/* FIXME We're doing this forever... should this be configurable? */
+				JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", name, source->filename);
+				fseek(audio, 0, SEEK_SET);
+				continue;
+			}
+		}
+		if(read < 0)
+			break;
+		if(mountpoint->active == FALSE)
+			mountpoint->active = TRUE;
+		/* Relay to the viewers assigned to this reader */
+		packet.data = header;
+		packet.length = RTP_HEADER_SIZE + read;
+		packet.is_rtp = TRUE;
+		packet.is_video = FALSE;
+		packet.is_keyframe = FALSE;
+		/* Backup the actual timestamp and sequence number */
+		packet.timestamp = ntohl(packet.data->timestamp);
+		packet.seq_number = ntohs(packet.data->seq_number);
+		/* Go! */
+		guint viewers = 0;
+		janus_mutex_lock_nodebug(&mountpoint->mutex);
+		GList *l = mountpoint->viewers;
+		while(l) {
+			janus_streaming_session *session = (janus_streaming_session *)l->data;
+			l = l->next;
+			if(session->reader != reader)
+				continue;
+			viewers++;
+			janus_streaming_relay_rtp_packet(session, &packet);
+		}
+		if(viewers == 0) {
+			/* Nobody's listening anymore: we remove ourselves while holding
+			 * the lock, so that no new viewer can be assigned to us */
+			source->active_readers = g_list_remove(source->active_readers, reader);
+			done = TRUE;
+		}
+		janus_mutex_unlock_nodebug(&mountpoint->mutex);
+		if(done)
+			break;
+		/* Update header */
+		seq++;
+		header->seq_number = htons(seq);
+		ts += (source->opus ? 960 : 160);
+		header->timestamp = htonl(ts);
+		header->markerbit = 0;
+	}
+	if(!done) {
+		janus_mutex_lock(&mountpoint->mutex);
+		source->active_readers = g_list_remove(source->active_readers, reader);
+		janus_mutex_unlock(&mountpoint->mutex);
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Leaving filesource (ondemand) reader #%u\n", name, reader->id);
+	if(audio) {
+#ifdef HAVE_LIBOGG
+		if(source->opus)
+			janus_streaming_opus_context_cleanup(&opusctx);
+#endif
+		fclose(audio);
+	}
+	g_free(name);
+	g_free(reader);
+	janus_refcount_decrease(&mountpoint->ref);
+	g_thread_unref(g_thread_self());
+	return NULL;
+}
+
 /* Thread to send RTP packets from a file (live) */
 static void *janus_streaming_filesource_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Filesource (live) thread starting...\n");
@@ -7368,6 +8770,7 @@ static void *janus_streaming_filesource_thread(void *data) {
 	/* Loop */
 	gint read = 0, plen = (sizeof(buf)-RTP_HEADER_SIZE);
 	janus_streaming_rtp_relay_packet packet;
+	packet.received = 0;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mountpoint->destroyed)) {
 		/* See if it's time to prepare a frame */
 		gettimeofday(&now, NULL);
@@ -7397,51 +8800,468 @@ static void *janus_streaming_filesource_thread(void *data) {
 			read = janus_streaming_opus_context_read(&opusctx, buf + RTP_HEADER_SIZE, plen);
 #endif
 		} else {
-			/* Read frame from file... */
-			read = fread(buf + RTP_HEADER_SIZE, sizeof(char), 160, audio);
-			if(feof(audio)) {
-				/* FIXME We're doing this forever... should this be configurable? */
-				JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", name, source->filename);
-				fseek(audio, 0, SEEK_SET);
-				continue;
-			}
+			/* Read frame from file... */
+			read = fread(buf + RTP_HEADER_SIZE, sizeof(char), 160, audio);
+			if(feof(audio)) {
+				/* FIXME We're doing this forever... should this be configurable? */
+				JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", name, source->filename);
+				fseek(audio, 0, SEEK_SET);
+				continue;
+			}
+		}
+		if(read < 0)
+			break;
+		if(mountpoint->active == FALSE)
+			mountpoint->active = TRUE;
+		/* Relay on all sessions */
+		packet.data = header;
+		packet.length = RTP_HEADER_SIZE + read;
+		packet.is_rtp = TRUE;
+		packet.is_video = FALSE;
+		packet.is_keyframe = FALSE;
+		/* Backup the actual timestamp and sequence number */
+		packet.timestamp = ntohl(packet.data->timestamp);
+		packet.seq_number = ntohs(packet.data->seq_number);
+		/* Go! */
+		janus_mutex_lock_nodebug(&mountpoint->mutex);
+		g_list_foreach(mountpoint->viewers, janus_streaming_relay_rtp_packet, &packet);
+		janus_mutex_unlock_nodebug(&mountpoint->mutex);
+		/* Update header */
+		seq++;
+		header->seq_number = htons(seq);
+		ts += (source->opus ? 960 : 160);
+		header->timestamp = htonl(ts);
+		header->markerbit = 0;
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Leaving filesource (live) thread\n", name);
+#ifdef HAVE_LIBOGG
+	if(source->opus)
+		janus_streaming_opus_context_cleanup(&opusctx);
+#endif
+	g_free(name);
+	fclose(audio);
+	janus_refcount_decrease(&mountpoint->ref);
+	return NULL;
+}
+
+/* Thread to relay RTP frames coming from gstreamer/ffmpeg/others */
+/* Helper struct to read RTP packets in batches via recvmmsg */
+typedef struct janus_streaming_rtp_batch {
+	int size;
+	char buffers[JANUS_STREAMING_MAX_BATCH][1500];
+	int lengths[JANUS_STREAMING_MAX_BATCH];
+	/* Only filled in if we need to know who sent the packets */
+	gboolean senders;
+	struct sockaddr_storage addrs[JANUS_STREAMING_MAX_BATCH];
+	socklen_t addrlens[JANUS_STREAMING_MAX_BATCH];
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[JANUS_STREAMING_MAX_BATCH];
+	struct iovec iovecs[JANUS_STREAMING_MAX_BATCH];
+#endif
+} janus_streaming_rtp_batch;
+static janus_streaming_rtp_batch *janus_streaming_rtp_batch_create(int size, gboolean senders) {
+	janus_streaming_rtp_batch *batch = g_malloc0(sizeof(janus_streaming_rtp_batch));
+	batch->size = (size > 1 ? size : 1);
+	batch->senders = senders;
+#ifdef HAVE_RECVMMSG
+	int i = 0;
+	for(i=0; i<batch->size; i++) {
+		batch->iovecs[i].iov_base = batch->buffers[i];
+		batch->iovecs[i].iov_len = sizeof(batch->buffers[i]);
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+		if(senders)
+			batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+	}
+#endif
+	return batch;
+}
+/* Read as many packets as available (up to the batch size) from a socket we know is readable */
+static int janus_streaming_rtp_batch_recv(janus_streaming_rtp_source *source, janus_streaming_rtp_batch *batch, int fd) {
+#ifdef HAVE_RECVMMSG
+	if(batch->size > 1) {
+		int i = 0;
+		for(i=0; i<batch->size; i++) {
+			batch->msgs[i].msg_len = 0;
+			if(batch->senders)
+				batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+		}
+		int count = recvmmsg(fd, batch->msgs, batch->size, MSG_DONTWAIT, NULL);
+		if(count < 1)
+			return 0;
+		for(i=0; i<count; i++) {
+			batch->lengths[i] = batch->msgs[i].msg_len;
+			batch->addrlens[i] = batch->msgs[i].msg_hdr.msg_namelen;
+		}
+		if(source != NULL) {
+			source->batch_reads++;
+			source->batch_packets += count;
+		}
+		return count;
+	}
+#endif
+	batch->addrlens[0] = sizeof(batch->addrs[0]);
+	int bytes = recvfrom(fd, batch->buffers[0], sizeof(batch->buffers[0]), 0,
+		batch->senders ? (struct sockaddr *)&batch->addrs[0] : NULL, batch->senders ? &batch->addrlens[0] : NULL);
+	if(bytes < 0)
+		return 0;
+	batch->lengths[0] = bytes;
+	return 1;
+}
+
+/* Helper to store a video packet in the GOP buffer of a source, if we're buffering GOPs */
+static void janus_streaming_gop_add(janus_streaming_mountpoint *mountpoint, janus_streaming_rtp_source *source,
+		char *buffer, int bytes) {
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	guint32 timestamp = ntohl(rtp->timestamp);
+	gboolean kf = FALSE;
+	if(timestamp != source->keyframe.gop_last_ts || source->keyframe.gop->len == 0) {
+		/* First packet of a new frame, check if it's a keyframe */
+		source->keyframe.gop_last_ts = timestamp;
+		int plen = 0;
+		char *payload = janus_rtp_payload(buffer, bytes, &plen);
+		if(payload) {
+			switch(mountpoint->codecs.video_codec) {
+				case JANUS_VIDEOCODEC_VP8:
+					kf = janus_vp8_is_keyframe(payload, plen);
+					break;
+				case JANUS_VIDEOCODEC_VP9:
+					kf = janus_vp9_is_keyframe(payload, plen);
+					break;
+				case JANUS_VIDEOCODEC_H264:
+					kf = janus_h264_is_keyframe(payload, plen);
+					break;
+				case JANUS_VIDEOCODEC_AV1:
+					kf = janus_av1_is_keyframe(payload, plen);
+					break;
+				case JANUS_VIDEOCODEC_H265:
+					kf = janus_h265_is_keyframe(payload, plen);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	janus_mutex_lock(&source->keyframe.mutex);
+	if(kf) {
+		/* New keyframe, get rid of the previous GOP */
+		JANUS_LOG(LOG_HUGE, "[%s] New keyframe received, previous GOP was %u packets (%zu bytes)\n",
+			mountpoint->name, source->keyframe.gop->len, source->keyframe.gop_size);
+		g_ptr_array_set_size(source->keyframe.gop, 0);
+		source->keyframe.gop_size = 0;
+		source->keyframe.gop_overflow = FALSE;
+	} else if(source->keyframe.gop->len == 0 || source->keyframe.gop_overflow) {
+		/* Waiting for a keyframe */
+		janus_mutex_unlock(&source->keyframe.mutex);
+		return;
+	}
+	if(source->keyframe.gop_size + bytes > source->keyframe.gop_max) {
+		/* A partial GOP is of no use to new viewers, drop it all */
+		JANUS_LOG(LOG_WARN, "[%s] GOP larger than %zu bytes, not buffering it\n",
+			mountpoint->name, source->keyframe.gop_max);
+		g_ptr_array_set_size(source->keyframe.gop, 0);
+		source->keyframe.gop_size = 0;
+		source->keyframe.gop_overflow = TRUE;
+		janus_mutex_unlock(&source->keyframe.mutex);
+		return;
+	}
+	janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
+	pkt->data = g_malloc(bytes);
+	memcpy(pkt->data, buffer, bytes);
+	pkt->data->ssrc = htons(1);
+	pkt->data->type = mountpoint->codecs.video_pt;
+	pkt->is_rtp = TRUE;
+	pkt->is_video = TRUE;
+	pkt->is_keyframe = TRUE;
+	pkt->length = bytes;
+	pkt->timestamp = timestamp;
+	pkt->seq_number = ntohs(rtp->seq_number);
+	g_ptr_array_add(source->keyframe.gop, pkt);
+	source->keyframe.gop_size += bytes;
+	janus_mutex_unlock(&source->keyframe.mutex);
+}
+
+/* Helpers to process an incoming audio or video RTP packet: these are used
+ * by the thread of the mountpoint, and by the shared ingest threads */
+static void janus_streaming_rtp_incoming_audio(janus_streaming_mountpoint *mountpoint, janus_streaming_rtp_source *source,
+		char *buffer, int bytes, gint64 now) {
+	const char *name = mountpoint->name;
+	uint32_t ssrc = 0;
+	janus_streaming_rtp_relay_packet packet = { 0 };
+	if(!janus_is_rtp(buffer, bytes)) {
+		/* Not an RTP packet? */
+		return;
+	}
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	ssrc = ntohl(rtp->ssrc);
+	if(source->rtp_collision > 0 && source->audio_last_ssrc && ssrc != source->audio_last_ssrc &&
+			(now-source->last_received_audio) < (gint64)1000*source->rtp_collision) {
+		JANUS_LOG(LOG_WARN, "[%s] RTP collision on audio mountpoint, dropping packet (ssrc=%"SCNu32")\n", name, ssrc);
+		return;
+	}
+	source->last_received_audio = now;
+	//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the audio channel...\n", bytes);
+	/* Do we have a new stream? */
+	if(ssrc != source->audio_last_ssrc) {
+		source->audio_ssrc = source->audio_last_ssrc = ssrc;
+		JANUS_LOG(LOG_INFO, "[%s] New audio stream! (ssrc=%"SCNu32")\n", name, source->audio_last_ssrc);
+	}
+	/* If paused, ignore this packet */
+	if(!mountpoint->enabled && !source->arc)
+		return;
+	/* Is this SRTP? */
+	if(source->is_srtp) {
+		int buflen = bytes;
+		srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
+		//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+		if(res != srtp_err_status_ok) {
+			guint32 timestamp = ntohl(rtp->timestamp);
+			guint16 seq = ntohs(rtp->seq_number);
+			JANUS_LOG(LOG_ERR, "[%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+				name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+			return;
+		}
+		bytes = buflen;
+	}
+	//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
+		//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
+	/* Relay on all sessions */
+	packet.data = rtp;
+	packet.length = bytes;
+	packet.is_rtp = TRUE;
+	packet.is_video = FALSE;
+	packet.is_keyframe = FALSE;
+	packet.data->type = mountpoint->codecs.audio_pt;
+	/* Is there a recorder? */
+	janus_rtp_header_update(packet.data, &source->context[0], FALSE, 0);
+	if(source->askew) {
+		int ret = janus_rtp_skew_compensate_audio(packet.data, &source->context[0], now);
+		if(ret < 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, audio source clock is too fast (ssrc=%"SCNu32")\n",
+				name, -ret, source->audio_last_ssrc);
+			return;
+		} else if(ret > 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, audio source clock is too slow (ssrc=%"SCNu32")\n",
+				name, ret, source->audio_last_ssrc);
+		}
+	}
+	if(source->arc) {
+		packet.data->ssrc = htonl((uint32_t)mountpoint->id);
+		janus_recorder_save_frame(source->arc, buffer, bytes);
+	}
+	if(mountpoint->enabled) {
+		packet.data->ssrc = htonl(ssrc);
+		/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
+		packet.timestamp = ntohl(packet.data->timestamp);
+		packet.seq_number = ntohs(packet.data->seq_number);
+		packet.received = janus_get_monotonic_time();
+		/* Go! */
+
+		janus_mutex_lock(&mountpoint->mutex);
+		if(mountpoint->helper_threads == 0)
+			g_list_foreach(mountpoint->viewers, janus_streaming_relay_rtp_packet, &packet);
+		else
+			janus_streaming_helper_queue_packet(mountpoint, &packet);
+		janus_mutex_unlock(&mountpoint->mutex);
+	}
+}
+static void janus_streaming_rtp_incoming_video(janus_streaming_mountpoint *mountpoint, janus_streaming_rtp_source *source,
+		int index, char *buffer, int bytes, gint64 now) {
+	const char *name = mountpoint->name;
+	uint32_t ssrc = 0;
+	janus_streaming_rtp_relay_packet packet = { 0 };
+	janus_rtp_simulcasting_cache sim_cache;
+	if(!janus_is_rtp(buffer, bytes)) {
+		/* Not an RTP packet? */
+		return;
+	}
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	ssrc = ntohl(rtp->ssrc);
+	if(source->rtp_collision > 0 && source->video_last_ssrc[index] && ssrc != source->video_last_ssrc[index] &&
+			(now-source->last_received_video) < (gint64)1000*source->rtp_collision) {
+		JANUS_LOG(LOG_WARN, "[%s] RTP collision on video mountpoint, dropping packet (ssrc=%"SCNu32")\n",
+			name, ssrc);
+		return;
+	}
+	source->last_received_video = now;
+	//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the video channel...\n", bytes);
+	/* Do we have a new stream? */
+	if(ssrc != source->video_last_ssrc[index]) {
+		source->video_last_ssrc[index] = ssrc;
+		if(index == 0)
+			source->video_ssrc = ssrc;
+		JANUS_LOG(LOG_INFO, "[%s] New video stream! (ssrc=%"SCNu32", index %d)\n",
+			name, source->video_last_ssrc[index], index);
+	}
+	/* Is this SRTP? */
+	if(source->is_srtp) {
+		int buflen = bytes;
+		srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
+		//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+		if(res != srtp_err_status_ok) {
+			guint32 timestamp = ntohl(rtp->timestamp);
+			guint16 seq = ntohs(rtp->seq_number);
+			JANUS_LOG(LOG_ERR, "[%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+				name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+			return;
+		}
+		bytes = buflen;
+	}
+	/* First of all, let's check if this is (part of) a keyframe that we may need to save it for future reference */
+	if(source->keyframe.gop != NULL) {
+		/* We're buffering the whole GOP */
+		janus_streaming_gop_add(mountpoint, source, buffer, bytes);
+	} else if(source->keyframe.enabled) {
+		if(source->keyframe.temp_ts > 0 && ntohl(rtp->timestamp) != source->keyframe.temp_ts) {
+			/* We received the last part of the keyframe, get rid of the old one and use this from now on */
+			JANUS_LOG(LOG_HUGE, "[%s] ... ... last part of keyframe received! ts=%"SCNu32", %d packets\n",
+				name, source->keyframe.temp_ts, g_list_length(source->keyframe.temp_keyframe));
+			source->keyframe.temp_ts = 0;
+			janus_mutex_lock(&source->keyframe.mutex);
+			if(source->keyframe.latest_keyframe != NULL)
+				g_list_free_full(source->keyframe.latest_keyframe, (GDestroyNotify)janus_streaming_rtp_relay_packet_free);
+			source->keyframe.latest_keyframe = source->keyframe.temp_keyframe;
+			source->keyframe.temp_keyframe = NULL;
+			janus_mutex_unlock(&source->keyframe.mutex);
+		} else if(ntohl(rtp->timestamp) == source->keyframe.temp_ts) {
+			/* Part of the keyframe we're currently saving, store */
+			janus_mutex_lock(&source->keyframe.mutex);
+			JANUS_LOG(LOG_HUGE, "[%s] ... other part of keyframe received! ts=%"SCNu32"\n", name, source->keyframe.temp_ts);
+			janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
+			pkt->data = g_malloc(bytes);
+			memcpy(pkt->data, buffer, bytes);
+			pkt->data->ssrc = htons(1);
+			pkt->data->type = mountpoint->codecs.video_pt;
+			pkt->is_rtp = TRUE;
+			pkt->is_video = TRUE;
+			pkt->is_keyframe = TRUE;
+			pkt->length = bytes;
+			pkt->timestamp = source->keyframe.temp_ts;
+			pkt->seq_number = ntohs(rtp->seq_number);
+			source->keyframe.temp_keyframe = g_list_append(source->keyframe.temp_keyframe, pkt);
+			janus_mutex_unlock(&source->keyframe.mutex);
+		} else {
+			gboolean kf = FALSE;
+			/* Parse RTP header first */
+			janus_rtp_header *header = (janus_rtp_header *)buffer;
+			guint32 timestamp = ntohl(header->timestamp);
+			guint16 seq = ntohs(header->seq_number);
+			JANUS_LOG(LOG_HUGE, "Checking if packet (size=%d, seq=%"SCNu16", ts=%"SCNu32") is a key frame...\n",
+				bytes, seq, timestamp);
+			int plen = 0;
+			char *payload = janus_rtp_payload(buffer, bytes, &plen);
+			if(payload) {
+				switch(mountpoint->codecs.video_codec) {
+					case JANUS_VIDEOCODEC_VP8:
+						kf = janus_vp8_is_keyframe(payload, plen);
+						break;
+					case JANUS_VIDEOCODEC_VP9:
+						kf = janus_vp9_is_keyframe(payload, plen);
+						break;
+					case JANUS_VIDEOCODEC_H264:
+						kf = janus_h264_is_keyframe(payload, plen);
+						break;
+					case JANUS_VIDEOCODEC_AV1:
+						kf = janus_av1_is_keyframe(payload, plen);
+						break;
+					case JANUS_VIDEOCODEC_H265:
+						kf = janus_h265_is_keyframe(payload, plen);
+						break;
+					default:
+						break;
+				}
+				if(kf) {
+					/* New keyframe, start saving it */
+					source->keyframe.temp_ts = ntohl(rtp->timestamp);
+					JANUS_LOG(LOG_HUGE, "[%s] New keyframe received! ts=%"SCNu32"\n", name, source->keyframe.temp_ts);
+					janus_mutex_lock(&source->keyframe.mutex);
+					janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
+					pkt->data = g_malloc(bytes);
+					memcpy(pkt->data, buffer, bytes);
+					pkt->data->ssrc = htons(1);
+					pkt->data->type = mountpoint->codecs.video_pt;
+					pkt->is_rtp = TRUE;
+					pkt->is_video = TRUE;
+					pkt->is_keyframe = TRUE;
+					pkt->length = bytes;
+					pkt->timestamp = source->keyframe.temp_ts;
+					pkt->seq_number = ntohs(rtp->seq_number);
+					source->keyframe.temp_keyframe = g_list_append(source->keyframe.temp_keyframe, pkt);
+					janus_mutex_unlock(&source->keyframe.mutex);
+				}
+			}
+		}
+	}
+	/* If paused, ignore this packet */
+	if(!mountpoint->enabled && !source->vrc)
+		return;
+	//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
+		//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
+	/* Relay on all sessions */
+	packet.data = rtp;
+	packet.length = bytes;
+	packet.is_rtp = TRUE;
+	packet.is_video = TRUE;
+	packet.is_keyframe = FALSE;
+	packet.simulcast = source->simulcast;
+	packet.substream = index;
+	packet.codec = mountpoint->codecs.video_codec;
+	packet.svc = FALSE;
+	if(source->svc) {
+		/* We're doing SVC: let's parse this packet to see which layers are there */
+		int plen = 0;
+		char *payload = janus_rtp_payload(buffer, bytes, &plen);
+		if(payload) {
+			gboolean found = FALSE;
+			memset(&packet.svc_info, 0, sizeof(packet.svc_info));
+			if(janus_vp9_parse_svc(payload, plen, &found, &packet.svc_info) == 0) {
+				packet.svc = found;
+			}
+		}
+	}
+	packet.data->type = mountpoint->codecs.video_pt;
+	/* Is there a recorder? (FIXME notice we only record the first substream, if simulcasting) */
+	janus_rtp_header_update(packet.data, &source->context[index], TRUE, 0);
+	if(source->vskew) {
+		int ret = janus_rtp_skew_compensate_video(packet.data, &source->context[index], now);
+		if(ret < 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, video source clock is too fast (ssrc=%"SCNu32", index %d)\n",
+				name, -ret, source->video_last_ssrc[index], index);
+			return;
+		} else if(ret > 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, video source clock is too slow (ssrc=%"SCNu32", index %d)\n",
+				name, ret, source->video_last_ssrc[index], index);
 		}
-		if(read < 0)
-			break;
-		if(mountpoint->active == FALSE)
-			mountpoint->active = TRUE;
-		/* Relay on all sessions */
-		packet.data = header;
-		packet.length = RTP_HEADER_SIZE + read;
-		packet.is_rtp = TRUE;
-		packet.is_video = FALSE;
-		packet.is_keyframe = FALSE;
-		/* Backup the actual timestamp and sequence number */
+	}
+	if(index == 0 && source->vrc) {
+		packet.data->ssrc = htonl((uint32_t)mountpoint->id);
+		janus_recorder_save_frame(source->vrc, buffer, bytes);
+	}
+	if (mountpoint->enabled) {
+		packet.data->ssrc = htonl(ssrc);
+		/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
 		packet.timestamp = ntohl(packet.data->timestamp);
 		packet.seq_number = ntohs(packet.data->seq_number);
-		/* Go! */
-		janus_mutex_lock_nodebug(&mountpoint->mutex);
-		g_list_foreach(mountpoint->viewers, janus_streaming_relay_rtp_packet, &packet);
-		janus_mutex_unlock_nodebug(&mountpoint->mutex);
-		/* Update header */
-		seq++;
-		header->seq_number = htons(seq);
-		ts += (source->opus ? 960 : 160);
-		header->timestamp = htonl(ts);
-		header->markerbit = 0;
+		packet.received = janus_get_monotonic_time();
+		/* Take note of the simulcast SSRCs */
+		if(source->simulcast) {
+			packet.ssrc[0] = source->video_last_ssrc[0];
+			packet.ssrc[1] = source->video_last_ssrc[1];
+			packet.ssrc[2] = source->video_last_ssrc[2];
+		}
+		/* Go! Viewers in the same simulcast state share the decisions taken for this packet */
+		janus_rtp_simulcasting_cache_reset(&sim_cache);
+		packet.sim_cache = source->simulcast ? &sim_cache : NULL;
+		janus_mutex_lock(&mountpoint->mutex);
+		if(mountpoint->helper_threads == 0)
+			g_list_foreach(mountpoint->viewers, janus_streaming_relay_rtp_packet, &packet);
+		else
+			janus_streaming_helper_queue_packet(mountpoint, &packet);
+		janus_mutex_unlock(&mountpoint->mutex);
+		packet.sim_cache = NULL;
 	}
-	JANUS_LOG(LOG_VERB, "[%s] Leaving filesource (live) thread\n", name);
-#ifdef HAVE_LIBOGG
-	if(source->opus)
-		janus_streaming_opus_context_cleanup(&opusctx);
-#endif
-	g_free(name);
-	fclose(audio);
-	janus_refcount_decrease(&mountpoint->ref);
-	return NULL;
 }
 
-/* Thread to relay RTP frames coming from gstreamer/ffmpeg/others */
 static void *janus_streaming_relay_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Starting streaming relay thread\n");
 	janus_streaming_mountpoint *mountpoint = (janus_streaming_mountpoint *)data;
@@ -7478,8 +9298,6 @@ static void *janus_streaming_relay_thread(void *data) {
 	int audio_rtcp_fd = source->audio_rtcp_fd;
 	int video_rtcp_fd = source->video_rtcp_fd;
 	char *name = g_strdup(mountpoint->name ? mountpoint->name : "??");
-	/* Needed to fix seq and ts */
-	uint32_t ssrc = 0, a_last_ssrc = 0, v_last_ssrc[3] = {0, 0, 0};
 	/* File descriptors */
 	socklen_t addrlen;
 	struct sockaddr_storage remote;
@@ -7487,28 +9305,42 @@ static void *janus_streaming_relay_thread(void *data) {
 	struct pollfd fds[8];
 	char buffer[1500];
 	memset(buffer, 0, 1500);
+	/* RTP packets are read in batches, if the mountpoint was configured to */
+	janus_streaming_rtp_batch *rtp_batch = janus_streaming_rtp_batch_create(source->batch, FALSE);
 #ifdef HAVE_LIBCURL
-	/* In case this is an RTSP restreamer, we may have to send keep-alives from time to time */
-	gint64 now = janus_get_monotonic_time(), before = now, ka_timeout = 0;
+	/* In case this is an RTSP restreamer, the RTSP thread tells us when it (re)connects */
+	gint64 now = janus_get_monotonic_time();
+	gint rtsp_generation = 0;
 	if(source->rtsp) {
 		source->reconnect_timer = now;
-		ka_timeout = ((gint64)source->ka_timeout*G_USEC_PER_SEC)/2;
+		rtsp_generation = g_atomic_int_get(&source->rtsp_generation);
 	}
 #endif
 	/* Loop */
 	int num = 0;
 	janus_streaming_rtp_relay_packet packet;
+	packet.received = 0;
+	packet.sim_cache = NULL;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mountpoint->destroyed)) {
 #ifdef HAVE_LIBCURL
 		/* Let's check regularly if the RTSP server seems to be gone */
 		if(source->rtsp) {
-			if(source->reconnecting) {
-				/* We're still reconnecting, wait some more */
+			if(g_atomic_int_get(&source->reconnecting)) {
+				/* The RTSP thread is still connecting, wait some more */
 				g_usleep(250000);
 				continue;
 			}
+			if(g_atomic_int_get(&source->rtsp_generation) != rtsp_generation) {
+				/* We're connected again (or for the first time), let's update the file descriptors */
+				rtsp_generation = g_atomic_int_get(&source->rtsp_generation);
+				audio_fd = source->audio_fd;
+				video_fd[0] = source->video_fd[0];
+				data_fd = source->data_fd;
+				audio_rtcp_fd = source->audio_rtcp_fd;
+				video_rtcp_fd = source->video_rtcp_fd;
+			}
 			now = janus_get_monotonic_time();
-			if(!source->reconnecting && (now - source->reconnect_timer > 5*G_USEC_PER_SEC)) {
+			if(now - source->reconnect_timer > 5*G_USEC_PER_SEC) {
 				/* 5 seconds passed and no media? Assume the RTSP server has gone and schedule a reconnect */
 				JANUS_LOG(LOG_WARN, "[%s] %"SCNi64"s passed with no media, trying to reconnect the RTSP stream\n",
 					name, (now - source->reconnect_timer)/G_USEC_PER_SEC);
@@ -7517,94 +9349,20 @@ static void *janus_streaming_relay_thread(void *data) {
 				video_fd[1] = -1;
 				video_fd[2] = -1;
 				data_fd = -1;
+				audio_rtcp_fd = -1;
+				video_rtcp_fd = -1;
 				source->reconnect_timer = now;
-				source->reconnecting = TRUE;
-				/* Let's clean up the source first */
-				curl_easy_cleanup(source->curl);
-				source->curl = NULL;
-				if(source->curldata)
-					g_free(source->curldata->buffer);
-				g_free(source->curldata);
-				source->curldata = NULL;
-				if(source->audio_fd > -1) {
-					close(source->audio_fd);
-				}
-				source->audio_fd = -1;
-				if(source->video_fd[0] > -1) {
-					close(source->video_fd[0]);
-				}
-				source->video_fd[0] = -1;
-				if(source->video_fd[1] > -1) {
-					close(source->video_fd[1]);
-				}
-				source->video_fd[1] = -1;
-				if(source->video_fd[2] > -1) {
-					close(source->video_fd[2]);
-				}
-				source->video_fd[2] = -1;
-				if(source->data_fd > -1) {
-					close(source->data_fd);
-				}
-				source->data_fd = -1;
-				if(source->audio_rtcp_fd > -1) {
-					close(source->audio_rtcp_fd);
-				}
-				source->audio_rtcp_fd = -1;
-				if(source->video_rtcp_fd > -1) {
-					close(source->video_rtcp_fd);
-				}
-				source->video_rtcp_fd = -1;
-				/* Now let's try to reconnect */
-				if(janus_streaming_rtsp_connect_to_server(mountpoint) < 0) {
-					/* Reconnection failed? Let's try again later */
-					JANUS_LOG(LOG_WARN, "[%s] Reconnection of the RTSP stream failed, trying again in a few seconds...\n", name);
-				} else {
-					/* We're connected, let's send a PLAY */
-					if(janus_streaming_rtsp_play(source) < 0) {
-						/* Error trying to play? Let's try again later */
-						JANUS_LOG(LOG_WARN, "[%s] RTSP PLAY failed, trying again in a few seconds...\n", name);
-					} else {
-						/* Everything should be back to normal, let's update the file descriptors */
-						JANUS_LOG(LOG_INFO, "[%s] Reconnected to the RTSP server, streaming again\n", name);
-						audio_fd = source->audio_fd;
-						video_fd[0] = source->video_fd[0];
-						data_fd = source->data_fd;
-						audio_rtcp_fd = source->audio_rtcp_fd;
-						video_rtcp_fd = source->video_rtcp_fd;
-						ka_timeout = ((gint64)source->ka_timeout*G_USEC_PER_SEC)/2;
-					}
-				}
-				source->reconnect_timer = janus_get_monotonic_time();
-				source->reconnecting = FALSE;
+				/* Let's clean up the source first, the RTSP thread will take care of the rest */
+				janus_streaming_rtsp_source_close(source);
+				janus_streaming_rtsp_reconnect(mountpoint);
 				continue;
 			}
 		}
-		if(audio_fd < 0 && video_fd[0] < 0 && video_fd[1] < 0 && video_fd[2] < 0 && data_fd < 0) {
+		if(source->ingest == NULL && audio_fd < 0 && video_fd[0] < 0 && video_fd[1] < 0 && video_fd[2] < 0 && data_fd < 0) {
 			/* No socket, we may be in the process of reconnecting, or waiting to reconnect */
 			g_usleep(5000000);
 			continue;
 		}
-		/* We may also need to occasionally send a OPTIONS request as a keep-alive */
-		if(ka_timeout > 0) {
-			/* Let's be conservative and send a OPTIONS when half of the timeout has passed */
-			now = janus_get_monotonic_time();
-			if(now-before > ka_timeout && source->curldata) {
-				JANUS_LOG(LOG_VERB, "[%s] %"SCNi64"s passed, sending OPTIONS\n", name, (now-before)/G_USEC_PER_SEC);
-				before = now;
-				/* Send an RTSP OPTIONS */
-				janus_mutex_lock(&source->rtsp_mutex);
-				g_free(source->curldata->buffer);
-				source->curldata->buffer = g_malloc0(1);
-				source->curldata->size = 0;
-				curl_easy_setopt(source->curl, CURLOPT_RTSP_STREAM_URI, source->rtsp_url);
-				curl_easy_setopt(source->curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_OPTIONS);
-				resfd = curl_easy_perform(source->curl);
-				if(resfd != CURLE_OK) {
-					JANUS_LOG(LOG_ERR, "[%s] Couldn't send OPTIONS request: %s\n", name, curl_easy_strerror(resfd));
-				}
-				janus_mutex_unlock(&source->rtsp_mutex);
-			}
-		}
 #endif
 		/* Any PLI and/or REMB we should send back to the source? */
 		if(g_atomic_int_get(&source->need_pli))
@@ -7750,82 +9508,10 @@ static void *janus_streaming_relay_thread(void *data) {
 #ifdef HAVE_LIBCURL
 					source->reconnect_timer = now;
 #endif
-					addrlen = sizeof(remote);
-					bytes = recvfrom(audio_fd, buffer, 1500, 0, (struct sockaddr *)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
-						continue;
-					}
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					ssrc = ntohl(rtp->ssrc);
-					if(source->rtp_collision > 0 && a_last_ssrc && ssrc != a_last_ssrc &&
-							(now-source->last_received_audio) < (gint64)1000*source->rtp_collision) {
-						JANUS_LOG(LOG_WARN, "[%s] RTP collision on audio mountpoint, dropping packet (ssrc=%"SCNu32")\n", name, ssrc);
-						continue;
-					}
-					source->last_received_audio = now;
-					//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the audio channel...\n", bytes);
-					/* Do we have a new stream? */
-					if(ssrc != a_last_ssrc) {
-						source->audio_ssrc = a_last_ssrc = ssrc;
-						JANUS_LOG(LOG_INFO, "[%s] New audio stream! (ssrc=%"SCNu32")\n", name, a_last_ssrc);
-					}
-					/* If paused, ignore this packet */
-					if(!mountpoint->enabled && !source->arc)
-						continue;
-					/* Is this SRTP? */
-					if(source->is_srtp) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
-						//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-						if(res != srtp_err_status_ok) {
-							guint32 timestamp = ntohl(rtp->timestamp);
-							guint16 seq = ntohs(rtp->seq_number);
-							JANUS_LOG(LOG_ERR, "[%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
-						//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
-					/* Relay on all sessions */
-					packet.data = rtp;
-					packet.length = bytes;
-					packet.is_rtp = TRUE;
-					packet.is_video = FALSE;
-					packet.is_keyframe = FALSE;
-					packet.data->type = mountpoint->codecs.audio_pt;
-					/* Is there a recorder? */
-					janus_rtp_header_update(packet.data, &source->context[0], FALSE, 0);
-					if(source->askew) {
-						int ret = janus_rtp_skew_compensate_audio(packet.data, &source->context[0], now);
-						if(ret < 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, audio source clock is too fast (ssrc=%"SCNu32")\n",
-								name, -ret, a_last_ssrc);
-							continue;
-						} else if(ret > 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, audio source clock is too slow (ssrc=%"SCNu32")\n",
-								name, ret, a_last_ssrc);
-						}
-					}
-					if(source->arc) {
-						packet.data->ssrc = htonl((uint32_t)mountpoint->id);
-						janus_recorder_save_frame(source->arc, buffer, bytes);
-					}
-					if(mountpoint->enabled) {
-						packet.data->ssrc = htonl(ssrc);
-						/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
-						packet.timestamp = ntohl(packet.data->timestamp);
-						packet.seq_number = ntohs(packet.data->seq_number);
-						/* Go! */
-
-						janus_mutex_lock(&mountpoint->mutex);
-						g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-							mountpoint->helper_threads == 0 ? janus_streaming_relay_rtp_packet : janus_streaming_helper_rtprtcp_packet,
-							&packet);
-						janus_mutex_unlock(&mountpoint->mutex);
-					}
+					/* Read as many packets as we can (just one, if we're not batching) */
+					int received = janus_streaming_rtp_batch_recv(source, rtp_batch, audio_fd), r = 0;
+					for(r=0; r<received; r++)
+						janus_streaming_rtp_incoming_audio(mountpoint, source, rtp_batch->buffers[r], rtp_batch->lengths[r], now);
 					continue;
 				} else if((video_fd[0] != -1 && fds[i].fd == video_fd[0]) ||
 						(video_fd[1] != -1 && fds[i].fd == video_fd[1]) ||
@@ -7844,189 +9530,10 @@ static void *janus_streaming_relay_thread(void *data) {
 #ifdef HAVE_LIBCURL
 					source->reconnect_timer = now;
 #endif
-					addrlen = sizeof(remote);
-					bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr *)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
-						continue;
-					}
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					ssrc = ntohl(rtp->ssrc);
-					if(source->rtp_collision > 0 && v_last_ssrc[index] && ssrc != v_last_ssrc[index] &&
-							(now-source->last_received_video) < (gint64)1000*source->rtp_collision) {
-						JANUS_LOG(LOG_WARN, "[%s] RTP collision on video mountpoint, dropping packet (ssrc=%"SCNu32")\n",
-							name, ssrc);
-						continue;
-					}
-					source->last_received_video = now;
-					//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the video channel...\n", bytes);
-					/* Do we have a new stream? */
-					if(ssrc != v_last_ssrc[index]) {
-						v_last_ssrc[index] = ssrc;
-						if(index == 0)
-							source->video_ssrc = ssrc;
-						JANUS_LOG(LOG_INFO, "[%s] New video stream! (ssrc=%"SCNu32", index %d)\n",
-							name, v_last_ssrc[index], index);
-					}
-					/* Is this SRTP? */
-					if(source->is_srtp) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
-						//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-						if(res != srtp_err_status_ok) {
-							guint32 timestamp = ntohl(rtp->timestamp);
-							guint16 seq = ntohs(rtp->seq_number);
-							JANUS_LOG(LOG_ERR, "[%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* First of all, let's check if this is (part of) a keyframe that we may need to save it for future reference */
-					if(source->keyframe.enabled) {
-						if(source->keyframe.temp_ts > 0 && ntohl(rtp->timestamp) != source->keyframe.temp_ts) {
-							/* We received the last part of the keyframe, get rid of the old one and use this from now on */
-							JANUS_LOG(LOG_HUGE, "[%s] ... ... last part of keyframe received! ts=%"SCNu32", %d packets\n",
-								name, source->keyframe.temp_ts, g_list_length(source->keyframe.temp_keyframe));
-							source->keyframe.temp_ts = 0;
-							janus_mutex_lock(&source->keyframe.mutex);
-							if(source->keyframe.latest_keyframe != NULL)
-								g_list_free_full(source->keyframe.latest_keyframe, (GDestroyNotify)janus_streaming_rtp_relay_packet_free);
-							source->keyframe.latest_keyframe = source->keyframe.temp_keyframe;
-							source->keyframe.temp_keyframe = NULL;
-							janus_mutex_unlock(&source->keyframe.mutex);
-						} else if(ntohl(rtp->timestamp) == source->keyframe.temp_ts) {
-							/* Part of the keyframe we're currently saving, store */
-							janus_mutex_lock(&source->keyframe.mutex);
-							JANUS_LOG(LOG_HUGE, "[%s] ... other part of keyframe received! ts=%"SCNu32"\n", name, source->keyframe.temp_ts);
-							janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-							pkt->data = g_malloc(bytes);
-							memcpy(pkt->data, buffer, bytes);
-							pkt->data->ssrc = htons(1);
-							pkt->data->type = mountpoint->codecs.video_pt;
-							pkt->is_rtp = TRUE;
-							pkt->is_video = TRUE;
-							pkt->is_keyframe = TRUE;
-							pkt->length = bytes;
-							pkt->timestamp = source->keyframe.temp_ts;
-							pkt->seq_number = ntohs(rtp->seq_number);
-							source->keyframe.temp_keyframe = g_list_append(source->keyframe.temp_keyframe, pkt);
-							janus_mutex_unlock(&source->keyframe.mutex);
-						} else {
-							gboolean kf = FALSE;
-							/* Parse RTP header first */
-							janus_rtp_header *header = (janus_rtp_header *)buffer;
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_HUGE, "Checking if packet (size=%d, seq=%"SCNu16", ts=%"SCNu32") is a key frame...\n",
-								bytes, seq, timestamp);
-							int plen = 0;
-							char *payload = janus_rtp_payload(buffer, bytes, &plen);
-							if(payload) {
-								switch(mountpoint->codecs.video_codec) {
-									case JANUS_VIDEOCODEC_VP8:
-										kf = janus_vp8_is_keyframe(payload, plen);
-										break;
-									case JANUS_VIDEOCODEC_VP9:
-										kf = janus_vp9_is_keyframe(payload, plen);
-										break;
-									case JANUS_VIDEOCODEC_H264:
-										kf = janus_h264_is_keyframe(payload, plen);
-										break;
-									case JANUS_VIDEOCODEC_AV1:
-										kf = janus_av1_is_keyframe(payload, plen);
-										break;
-									case JANUS_VIDEOCODEC_H265:
-										kf = janus_h265_is_keyframe(payload, plen);
-										break;
-									default:
-										break;
-								}
-								if(kf) {
-									/* New keyframe, start saving it */
-									source->keyframe.temp_ts = ntohl(rtp->timestamp);
-									JANUS_LOG(LOG_HUGE, "[%s] New keyframe received! ts=%"SCNu32"\n", name, source->keyframe.temp_ts);
-									janus_mutex_lock(&source->keyframe.mutex);
-									janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-									pkt->data = g_malloc(bytes);
-									memcpy(pkt->data, buffer, bytes);
-									pkt->data->ssrc = htons(1);
-									pkt->data->type = mountpoint->codecs.video_pt;
-									pkt->is_rtp = TRUE;
-									pkt->is_video = TRUE;
-									pkt->is_keyframe = TRUE;
-									pkt->length = bytes;
-									pkt->timestamp = source->keyframe.temp_ts;
-									pkt->seq_number = ntohs(rtp->seq_number);
-									source->keyframe.temp_keyframe = g_list_append(source->keyframe.temp_keyframe, pkt);
-									janus_mutex_unlock(&source->keyframe.mutex);
-								}
-							}
-						}
-					}
-					/* If paused, ignore this packet */
-					if(!mountpoint->enabled && !source->vrc)
-						continue;
-					//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
-						//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
-					/* Relay on all sessions */
-					packet.data = rtp;
-					packet.length = bytes;
-					packet.is_rtp = TRUE;
-					packet.is_video = TRUE;
-					packet.is_keyframe = FALSE;
-					packet.simulcast = source->simulcast;
-					packet.substream = index;
-					packet.codec = mountpoint->codecs.video_codec;
-					packet.svc = FALSE;
-					if(source->svc) {
-						/* We're doing SVC: let's parse this packet to see which layers are there */
-						int plen = 0;
-						char *payload = janus_rtp_payload(buffer, bytes, &plen);
-						if(payload) {
-							gboolean found = FALSE;
-							memset(&packet.svc_info, 0, sizeof(packet.svc_info));
-							if(janus_vp9_parse_svc(payload, plen, &found, &packet.svc_info) == 0) {
-								packet.svc = found;
-							}
-						}
-					}
-					packet.data->type = mountpoint->codecs.video_pt;
-					/* Is there a recorder? (FIXME notice we only record the first substream, if simulcasting) */
-					janus_rtp_header_update(packet.data, &source->context[index], TRUE, 0);
-					if(source->vskew) {
-						int ret = janus_rtp_skew_compensate_video(packet.data, &source->context[index], now);
-						if(ret < 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, video source clock is too fast (ssrc=%"SCNu32", index %d)\n",
-								name, -ret, v_last_ssrc[index], index);
-							continue;
-						} else if(ret > 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, video source clock is too slow (ssrc=%"SCNu32", index %d)\n",
-								name, ret, v_last_ssrc[index], index);
-						}
-					}
-					if(index == 0 && source->vrc) {
-						packet.data->ssrc = htonl((uint32_t)mountpoint->id);
-						janus_recorder_save_frame(source->vrc, buffer, bytes);
-					}
-					if (mountpoint->enabled) {
-						packet.data->ssrc = htonl(ssrc);
-						/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
-						packet.timestamp = ntohl(packet.data->timestamp);
-						packet.seq_number = ntohs(packet.data->seq_number);
-						/* Take note of the simulcast SSRCs */
-						if(source->simulcast) {
-							packet.ssrc[0] = v_last_ssrc[0];
-							packet.ssrc[1] = v_last_ssrc[1];
-							packet.ssrc[2] = v_last_ssrc[2];
-						}
-						/* Go! */
-						janus_mutex_lock(&mountpoint->mutex);
-						g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-							mountpoint->helper_threads == 0 ? janus_streaming_relay_rtp_packet : janus_streaming_helper_rtprtcp_packet,
-							&packet);
-						janus_mutex_unlock(&mountpoint->mutex);
-					}
+					/* Read as many packets as we can (just one, if we're not batching) */
+					int received = janus_streaming_rtp_batch_recv(source, rtp_batch, fds[i].fd), r = 0;
+					for(r=0; r<received; r++)
+						janus_streaming_rtp_incoming_video(mountpoint, source, index, rtp_batch->buffers[r], rtp_batch->lengths[r], now);
 					continue;
 				} else if(data_fd != -1 && fds[i].fd == data_fd) {
 					/* Got something data (text) */
@@ -8070,9 +9577,10 @@ static void *janus_streaming_relay_thread(void *data) {
 						}
 						/* Go! */
 						janus_mutex_lock(&mountpoint->mutex);
-						g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-							mountpoint->helper_threads == 0 ? janus_streaming_relay_rtp_packet : janus_streaming_helper_rtprtcp_packet,
-							&packet);
+						if(mountpoint->helper_threads == 0)
+							g_list_foreach(mountpoint->viewers, janus_streaming_relay_rtp_packet, &packet);
+						else
+							janus_streaming_helper_queue_packet(mountpoint, &packet);
 						janus_mutex_unlock(&mountpoint->mutex);
 					}
 					g_free(packet.data);
@@ -8100,9 +9608,10 @@ static void *janus_streaming_relay_thread(void *data) {
 					packet.length = bytes;
 					/* Go! */
 					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-						mountpoint->helper_threads == 0 ? janus_streaming_relay_rtcp_packet : janus_streaming_helper_rtprtcp_packet,
-						&packet);
+					if(mountpoint->helper_threads == 0)
+						g_list_foreach(mountpoint->viewers, janus_streaming_relay_rtcp_packet, &packet);
+					else
+						janus_streaming_helper_queue_packet(mountpoint, &packet);
 					janus_mutex_unlock(&mountpoint->mutex);
 				} else if(video_rtcp_fd != -1 && fds[i].fd == video_rtcp_fd) {
 					addrlen = sizeof(remote);
@@ -8126,9 +9635,10 @@ static void *janus_streaming_relay_thread(void *data) {
 					packet.length = bytes;
 					/* Go! */
 					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-						mountpoint->helper_threads == 0 ? janus_streaming_relay_rtcp_packet : janus_streaming_helper_rtprtcp_packet,
-						&packet);
+					if(mountpoint->helper_threads == 0)
+						g_list_foreach(mountpoint->viewers, janus_streaming_relay_rtcp_packet, &packet);
+					else
+						janus_streaming_helper_queue_packet(mountpoint, &packet);
 					janus_mutex_unlock(&mountpoint->mutex);
 				}
 			}
@@ -8185,11 +9695,447 @@ static void *janus_streaming_relay_thread(void *data) {
 	}
 
 	JANUS_LOG(LOG_VERB, "[%s] Leaving streaming relay thread\n", name);
+	g_free(rtp_batch);
 	g_free(name);
 	janus_refcount_decrease(&mountpoint->ref);
 	return NULL;
 }
 
+/* Shared ingest port: any thread has a socket of its own bound to the same
+ * port (via SO_REUSEPORT, so that the kernel spreads senders across them),
+ * and routes the packets it receives to the mountpoint they belong to */
+typedef struct janus_streaming_ingest_worker {
+	int id;
+	int fd;
+	GThread *thread;
+	guint64 unmatched;	/* Packets that didn't match any mountpoint */
+} janus_streaming_ingest_worker;
+static janus_streaming_ingest_worker *ingest_workers = NULL;
+static int ingest_workers_num = 0;
+static volatile gint ingest_stopping = 0;
+/* Where packets should go, by SSRC, by sender (as "address/pt") and by payload type */
+typedef struct janus_streaming_ingest_route {
+	janus_streaming_mountpoint *mp;
+	int index;						/* 0 is audio, 1-3 are the video substreams */
+	gboolean learned;				/* Whether this is an SSRC we learned from the sender or payload type */
+	struct sockaddr_storage addr;	/* Only for learned SSRCs: who's sending it */
+	socklen_t addrlen;
+	uint32_t learned_ssrc;			/* Only for sender and payload type routes: latest SSRC we learned */
+} janus_streaming_ingest_route;
+static GHashTable *ingest_ssrcs = NULL, *ingest_senders = NULL, *ingest_pts = NULL;
+static janus_mutex ingest_mutex = JANUS_MUTEX_INITIALIZER;
+
+static janus_streaming_ingest_config *janus_streaming_ingest_config_dup(const janus_streaming_ingest_config *config) {
+	if(config == NULL)
+		return NULL;
+	janus_streaming_ingest_config *copy = g_malloc(sizeof(janus_streaming_ingest_config));
+	*copy = *config;
+	copy->audio_source = g_strdup(config->audio_source);
+	copy->video_source = g_strdup(config->video_source);
+	return copy;
+}
+
+static void janus_streaming_ingest_config_free(janus_streaming_ingest_config *config) {
+	if(config == NULL)
+		return;
+	g_free(config->audio_source);
+	g_free(config->video_source);
+	g_free(config);
+}
+
+static void janus_streaming_ingest_route_free(janus_streaming_ingest_route *route) {
+	janus_refcount_decrease(&route->mp->ref);
+	g_free(route);
+}
+
+static gboolean janus_streaming_ingest_route_is_from(gpointer key, gpointer value, gpointer user_data) {
+	janus_streaming_ingest_route *route = (janus_streaming_ingest_route *)value;
+	return route->mp == (janus_streaming_mountpoint *)user_data;
+}
+
+/* Helper to add a route, unless something else is using the same key (must be called with the mutex locked) */
+static int janus_streaming_ingest_route_add(GHashTable *table, gpointer key, janus_streaming_mountpoint *mp, int index) {
+	janus_streaming_ingest_route *route = g_hash_table_lookup(table, key);
+	if(route != NULL && !route->learned)
+		return -1;
+	route = g_malloc0(sizeof(janus_streaming_ingest_route));
+	janus_refcount_increase(&mp->ref);
+	route->mp = mp;
+	route->index = index;
+	g_hash_table_insert(table, table == ingest_senders ? g_strdup((char *)key) : key, route);
+	return 0;
+}
+
+static int janus_streaming_ingest_add(janus_streaming_mountpoint *mp) {
+	janus_streaming_rtp_source *source = mp->source;
+	janus_streaming_ingest_config *config = source->ingest;
+	char key[128];
+	int res = 0;
+	janus_mutex_lock(&ingest_mutex);
+	if(ingest_ssrcs == NULL) {
+		janus_mutex_unlock(&ingest_mutex);
+		return -1;
+	}
+	if(mp->audio) {
+		if(config->audio_ssrc)
+			res |= janus_streaming_ingest_route_add(ingest_ssrcs, GUINT_TO_POINTER(config->audio_ssrc), mp, 0);
+		if(config->audio_source) {
+			g_snprintf(key, sizeof(key), "%s/%d", config->audio_source, mp->codecs.audio_pt);
+			res |= janus_streaming_ingest_route_add(ingest_senders, key, mp, 0);
+		}
+		if(!config->audio_ssrc && !config->audio_source)
+			res |= janus_streaming_ingest_route_add(ingest_pts, GINT_TO_POINTER(mp->codecs.audio_pt), mp, 0);
+	}
+	if(mp->video) {
+		int i = 0;
+		for(i=0; i<(source->simulcast ? 3 : 1); i++) {
+			if(config->video_ssrc[i])
+				res |= janus_streaming_ingest_route_add(ingest_ssrcs, GUINT_TO_POINTER(config->video_ssrc[i]), mp, i+1);
+		}
+		if(config->video_source && !source->simulcast) {
+			g_snprintf(key, sizeof(key), "%s/%d", config->video_source, mp->codecs.video_pt);
+			res |= janus_streaming_ingest_route_add(ingest_senders, key, mp, 1);
+		}
+		if(!config->video_ssrc[0] && !config->video_source)
+			res |= janus_streaming_ingest_route_add(ingest_pts, GINT_TO_POINTER(mp->codecs.video_pt), mp, 1);
+	}
+	if(res < 0) {
+		/* Something was already taken, get rid of what we added */
+		g_hash_table_foreach_remove(ingest_ssrcs, janus_streaming_ingest_route_is_from, mp);
+		g_hash_table_foreach_remove(ingest_senders, janus_streaming_ingest_route_is_from, mp);
+		g_hash_table_foreach_remove(ingest_pts, janus_streaming_ingest_route_is_from, mp);
+	}
+	janus_mutex_unlock(&ingest_mutex);
+	return res < 0 ? -1 : 0;
+}
+
+static void janus_streaming_ingest_remove(janus_streaming_mountpoint *mp) {
+	janus_mutex_lock(&ingest_mutex);
+	if(ingest_ssrcs != NULL) {
+		g_hash_table_foreach_remove(ingest_ssrcs, janus_streaming_ingest_route_is_from, mp);
+		g_hash_table_foreach_remove(ingest_senders, janus_streaming_ingest_route_is_from, mp);
+		g_hash_table_foreach_remove(ingest_pts, janus_streaming_ingest_route_is_from, mp);
+	}
+	janus_mutex_unlock(&ingest_mutex);
+}
+
+/* Helper to find where a packet should go (must be called with the mutex locked) */
+static janus_streaming_ingest_route *janus_streaming_ingest_lookup(uint32_t ssrc, int pt,
+		struct sockaddr_storage *addr, socklen_t addrlen) {
+	janus_streaming_ingest_route *route = g_hash_table_lookup(ingest_ssrcs, GUINT_TO_POINTER(ssrc));
+	if(route != NULL && (!route->learned ||
+			(route->addrlen == addrlen && !memcmp(&route->addr, addr, addrlen))))
+		return route;
+	/* Not a stream we know (or not from who we learned it from): check the sender first */
+	janus_streaming_ingest_route *parent = NULL;
+	if(g_hash_table_size(ingest_senders) > 0) {
+		char host[INET6_ADDRSTRLEN], key[128];
+		int port = 0;
+		host[0] = '\0';
+		if(addr->ss_family == AF_INET) {
+			struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+			inet_ntop(AF_INET, &sin->sin_addr, host, sizeof(host));
+			port = ntohs(sin->sin_port);
+		} else if(addr->ss_family == AF_INET6) {
+			struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)addr;
+			if(IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr))
+				inet_ntop(AF_INET, &sin6->sin6_addr.s6_addr[12], host, sizeof(host));
+			else
+				inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof(host));
+			port = ntohs(sin6->sin6_port);
+		}
+		gboolean ipv6 = (strchr(host, ':') != NULL);
+		g_snprintf(key, sizeof(key), ipv6 ? "[%s]:%d/%d" : "%s:%d/%d", host, port, pt);
+		parent = g_hash_table_lookup(ingest_senders, key);
+		if(parent == NULL) {
+			g_snprintf(key, sizeof(key), "%s/%d", host, pt);
+			parent = g_hash_table_lookup(ingest_senders, key);
+		}
+	}
+	/* Then the payload type */
+	if(parent == NULL)
+		parent = g_hash_table_lookup(ingest_pts, GINT_TO_POINTER(pt));
+	if(parent == NULL)
+		return NULL;
+	/* Learn the SSRC, so that the next packets take the fast path: as the
+	 * sender may have restarted, forget the SSRC we learned before, if any */
+	if(parent->learned_ssrc != 0 && parent->learned_ssrc != ssrc) {
+		route = g_hash_table_lookup(ingest_ssrcs, GUINT_TO_POINTER(parent->learned_ssrc));
+		if(route != NULL && route->learned && route->mp == parent->mp && route->index == parent->index)
+			g_hash_table_remove(ingest_ssrcs, GUINT_TO_POINTER(parent->learned_ssrc));
+	}
+	parent->learned_ssrc = ssrc;
+	route = g_malloc0(sizeof(janus_streaming_ingest_route));
+	janus_refcount_increase(&parent->mp->ref);
+	route->mp = parent->mp;
+	route->index = parent->index;
+	route->learned = TRUE;
+	memcpy(&route->addr, addr, addrlen);
+	route->addrlen = addrlen;
+	g_hash_table_insert(ingest_ssrcs, GUINT_TO_POINTER(ssrc), route);
+	JANUS_LOG(LOG_VERB, "[%s] Learned %s SSRC %"SCNu32" on the shared ingest port\n",
+		route->mp->name, route->index == 0 ? "audio" : "video", ssrc);
+	return route;
+}
+
+/* Thread receiving packets on one of the sockets bound to the shared ingest port */
+static void *janus_streaming_ingest_thread(void *data) {
+	janus_streaming_ingest_worker *worker = (janus_streaming_ingest_worker *)data;
+	JANUS_LOG(LOG_VERB, "Starting Streaming ingest thread #%d\n", worker->id);
+	janus_streaming_rtp_batch *batch = janus_streaming_rtp_batch_create(ingest_batch, TRUE);
+	guint64 unmatched = 0;
+	gint64 last_check = janus_get_monotonic_time();
+	struct pollfd fds[1];
+	int resfd = 0;
+	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&ingest_stopping)) {
+		fds[0].fd = worker->fd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		resfd = poll(fds, 1, 1000);
+		if(resfd < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[ingest #%d] Error polling... %d (%s)\n", worker->id, errno, g_strerror(errno));
+			break;
+		}
+		gint64 now = janus_get_monotonic_time();
+		if(now - last_check >= 5*G_USEC_PER_SEC) {
+			/* Let's check regularly if we're getting stuff we don't know what to do with */
+			if(worker->unmatched > unmatched) {
+				JANUS_LOG(LOG_WARN, "[ingest #%d] Dropped %"SCNu64" packets not matching any mountpoint\n",
+					worker->id, worker->unmatched - unmatched);
+				unmatched = worker->unmatched;
+			}
+			last_check = now;
+		}
+		if(resfd == 0)
+			continue;
+		if(fds[0].revents & (POLLERR | POLLHUP)) {
+			JANUS_LOG(LOG_ERR, "[ingest #%d] Error polling: %s... %d (%s)\n", worker->id,
+				fds[0].revents & POLLERR ? "POLLERR" : "POLLHUP", errno, g_strerror(errno));
+			break;
+		}
+		/* Read as many packets as we can, and route them one by one */
+		int received = janus_streaming_rtp_batch_recv(NULL, batch, worker->fd), r = 0;
+		for(r=0; r<received; r++) {
+			char *buffer = batch->buffers[r];
+			int bytes = batch->lengths[r];
+			if(!janus_is_rtp(buffer, bytes)) {
+				/* Not an RTP packet? */
+				worker->unmatched++;
+				continue;
+			}
+			janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+			janus_mutex_lock(&ingest_mutex);
+			janus_streaming_ingest_route *route = janus_streaming_ingest_lookup(ntohl(rtp->ssrc), rtp->type,
+				&batch->addrs[r], batch->addrlens[r]);
+			janus_streaming_mountpoint *mp = route ? route->mp : NULL;
+			int index = route ? route->index : 0;
+			if(mp != NULL)
+				janus_refcount_increase(&mp->ref);
+			janus_mutex_unlock(&ingest_mutex);
+			if(mp == NULL) {
+				worker->unmatched++;
+				continue;
+			}
+			if(!g_atomic_int_get(&mp->destroyed)) {
+				janus_streaming_rtp_source *source = mp->source;
+				if(mp->active == FALSE)
+					mp->active = TRUE;
+				janus_mutex_lock(&source->ingest_mutex);
+				if(index == 0)
+					janus_streaming_rtp_incoming_audio(mp, source, buffer, bytes, now);
+				else
+					janus_streaming_rtp_incoming_video(mp, source, index-1, buffer, bytes, now);
+				janus_mutex_unlock(&source->ingest_mutex);
+			}
+			janus_refcount_decrease(&mp->ref);
+		}
+	}
+	JANUS_LOG(LOG_VERB, "Leaving Streaming ingest thread #%d\n", worker->id);
+	g_free(batch);
+	return NULL;
+}
+
+/* Helper to bind one of the sockets of the shared ingest port */
+static int janus_streaming_ingest_create_fd(void) {
+	int family = janus_network_address_is_null(&ingest_iface) ? AF_INET6 : ingest_iface.family;
+	int fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd < 0) {
+		JANUS_LOG(LOG_ERR, "Cannot create socket for the shared ingest port... %d (%s)\n", errno, g_strerror(errno));
+		return -1;
+	}
+	int v6only = 0;
+	if(family == AF_INET6 && janus_network_address_is_null(&ingest_iface) &&
+			setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) != 0) {
+		JANUS_LOG(LOG_ERR, "setsockopt on socket failed for the shared ingest port... %d (%s)\n", errno, g_strerror(errno));
+		close(fd);
+		return -1;
+	}
+#ifdef SO_REUSEPORT
+	int reuse = 1;
+	if(ingest_threads > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0) {
+		JANUS_LOG(LOG_ERR, "setsockopt SO_REUSEPORT failed for the shared ingest port... %d (%s)\n", errno, g_strerror(errno));
+		close(fd);
+		return -1;
+	}
+#endif
+	struct sockaddr_in address = { 0 };
+	struct sockaddr_in6 address6 = { 0 };
+	address.sin_family = AF_INET;
+	address.sin_port = htons(ingest_port);
+	address.sin_addr.s_addr = INADDR_ANY;
+	address6.sin6_family = AF_INET6;
+	address6.sin6_port = htons(ingest_port);
+	address6.sin6_addr = in6addr_any;
+	if(family == AF_INET)
+		address.sin_addr = ingest_iface.ipv4;
+	else if(!janus_network_address_is_null(&ingest_iface))
+		memcpy(&address6.sin6_addr, &ingest_iface.ipv6, sizeof(ingest_iface.ipv6));
+	if(bind(fd, (family == AF_INET ? (struct sockaddr *)&address : (struct sockaddr *)&address6),
+			(family == AF_INET ? sizeof(address) : sizeof(address6))) < 0) {
+		JANUS_LOG(LOG_ERR, "Bind failed for the shared ingest port (port %"SCNu16")... %d (%s)\n",
+			ingest_port, errno, g_strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void janus_streaming_ingest_stop_workers(void) {
+	/* Threads check the flag at least once per second */
+	g_atomic_int_set(&ingest_stopping, 1);
+	int i = 0;
+	for(i=0; i<ingest_workers_num; i++) {
+		janus_streaming_ingest_worker *worker = &ingest_workers[i];
+		g_thread_join(worker->thread);
+		worker->thread = NULL;
+		close(worker->fd);
+		worker->fd = -1;
+	}
+	g_free(ingest_workers);
+	ingest_workers = NULL;
+	ingest_workers_num = 0;
+	g_atomic_int_set(&ingest_stopping, 0);
+}
+
+static int janus_streaming_ingest_start(void) {
+	janus_mutex_lock(&ingest_mutex);
+	ingest_ssrcs = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_streaming_ingest_route_free);
+	ingest_senders = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)janus_streaming_ingest_route_free);
+	ingest_pts = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_streaming_ingest_route_free);
+	janus_mutex_unlock(&ingest_mutex);
+	if(ingest_port == 0)
+		return 0;
+#ifndef SO_REUSEPORT
+	if(ingest_threads > 1) {
+		JANUS_LOG(LOG_WARN, "SO_REUSEPORT not available, using a single thread for the shared ingest port\n");
+		ingest_threads = 1;
+	}
+#endif
+#ifndef HAVE_RECVMMSG
+	if(ingest_batch > 1) {
+		JANUS_LOG(LOG_WARN, "recvmmsg not available, batching disabled on the shared ingest port\n");
+		ingest_batch = 1;
+	}
+#endif
+	ingest_workers = g_malloc0(ingest_threads * sizeof(janus_streaming_ingest_worker));
+	GError *error = NULL;
+	char tname[16];
+	int i = 0;
+	for(i=0; i<ingest_threads; i++) {
+		janus_streaming_ingest_worker *worker = &ingest_workers[i];
+		worker->id = i+1;
+		worker->fd = janus_streaming_ingest_create_fd();
+		if(worker->fd < 0)
+			break;
+		g_snprintf(tname, sizeof(tname), "ingest %d", worker->id);
+		worker->thread = g_thread_try_new(tname, &janus_streaming_ingest_thread, worker, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Streaming ingest thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			close(worker->fd);
+			worker->fd = -1;
+			break;
+		}
+		ingest_workers_num++;
+	}
+	if(ingest_workers_num < ingest_threads) {
+		/* Something went wrong, no shared ingest port for us */
+		janus_streaming_ingest_stop_workers();
+		ingest_port = 0;
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "Shared ingest port for RTP mountpoints: %"SCNu16" (%d threads, batches of %d packets)\n",
+		ingest_port, ingest_threads, ingest_batch);
+	return 0;
+}
+
+static void janus_streaming_ingest_stop(void) {
+	janus_streaming_ingest_stop_workers();
+	janus_mutex_lock(&ingest_mutex);
+	if(ingest_ssrcs != NULL) {
+		g_hash_table_destroy(ingest_ssrcs);
+		g_hash_table_destroy(ingest_senders);
+		g_hash_table_destroy(ingest_pts);
+	}
+	ingest_ssrcs = NULL;
+	ingest_senders = NULL;
+	ingest_pts = NULL;
+	janus_mutex_unlock(&ingest_mutex);
+}
+
+static json_t *janus_streaming_ingest_info(janus_streaming_rtp_source *source) {
+	janus_streaming_ingest_config *config = source->ingest;
+	json_t *info = json_object();
+	json_object_set_new(info, "port", json_integer(ingest_port));
+	if(config->audio_ssrc)
+		json_object_set_new(info, "audiossrc", json_integer(config->audio_ssrc));
+	if(config->audio_source)
+		json_object_set_new(info, "audiosource", json_string(config->audio_source));
+	if(config->video_ssrc[0])
+		json_object_set_new(info, "videossrc", json_integer(config->video_ssrc[0]));
+	if(config->video_ssrc[1])
+		json_object_set_new(info, "videossrc2", json_integer(config->video_ssrc[1]));
+	if(config->video_ssrc[2])
+		json_object_set_new(info, "videossrc3", json_integer(config->video_ssrc[2]));
+	if(config->video_source)
+		json_object_set_new(info, "videosource", json_string(config->video_source));
+	return info;
+}
+
+static void janus_streaming_ingest_save(janus_config_category *c, janus_streaming_rtp_source *source) {
+	janus_streaming_ingest_config *ingest = source->ingest;
+	char value[BUFSIZ];
+	janus_config_add(config, c, janus_config_item_create("ingest", "yes"));
+	if(ingest->audio_ssrc) {
+		g_snprintf(value, BUFSIZ, "%"SCNu32, ingest->audio_ssrc);
+		janus_config_add(config, c, janus_config_item_create("audiossrc", value));
+	}
+	if(ingest->audio_source)
+		janus_config_add(config, c, janus_config_item_create("audiosource", ingest->audio_source));
+	if(ingest->video_ssrc[0]) {
+		g_snprintf(value, BUFSIZ, "%"SCNu32, ingest->video_ssrc[0]);
+		janus_config_add(config, c, janus_config_item_create("videossrc", value));
+	}
+	if(ingest->video_ssrc[1]) {
+		g_snprintf(value, BUFSIZ, "%"SCNu32, ingest->video_ssrc[1]);
+		janus_config_add(config, c, janus_config_item_create("videossrc2", value));
+	}
+	if(ingest->video_ssrc[2]) {
+		g_snprintf(value, BUFSIZ, "%"SCNu32, ingest->video_ssrc[2]);
+		janus_config_add(config, c, janus_config_item_create("videossrc3", value));
+	}
+	if(ingest->video_source)
+		janus_config_add(config, c, janus_config_item_create("videosource", ingest->video_source));
+}
+
+/* Time to use when rewriting the headers of a packet, if we know when we received it */
+static inline gint64 janus_streaming_packet_time(janus_streaming_rtp_relay_packet *packet) {
+	return packet->received > 0 ? packet->received : janus_get_monotonic_time();
+}
+
 static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_streaming_rtp_relay_packet *packet = (janus_streaming_rtp_relay_packet *)user_data;
 	if(!packet || !packet->data || packet->length < 1) {
@@ -8211,6 +10157,12 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 		if(packet->is_video) {
 			if(!session->video)
 				return;
+			if(session->gop_skip && !packet->is_keyframe) {
+				/* We may have sent this already, when sending the GOP */
+				if((int16_t)(packet->seq_number - session->gop_last_seq) <= 0)
+					return;
+				session->gop_skip = FALSE;
+			}
 			/* Check if there's any SVC info to take into account */
 			if(packet->svc) {
 				/* There is: check if this is a layer that can be dropped for this viewer
@@ -8345,7 +10297,7 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 				JANUS_LOG(LOG_HUGE, "Sending packet (spatial=%d, temporal=%d)\n",
 					packet->svc_info.spatial_layer, packet->svc_info.temporal_layer);
 				/* Fix sequence number and timestamp (publisher switching may be involved) */
-				janus_rtp_header_update(packet->data, &session->context, TRUE, 0);
+				janus_rtp_header_update_at(packet->data, &session->context, TRUE, janus_streaming_packet_time(packet));
 				if(override_mark_bit && !has_marker_bit) {
 					packet->data->markerbit = 1;
 				}
@@ -8366,7 +10318,7 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 				if(payload == NULL)
 					return;
 				/* Process this packet: don't relay if it's not the SSRC/layer we wanted to handle */
-				gboolean relay = janus_rtp_simulcasting_context_process_rtp(&session->sim_context,
+				gboolean relay = janus_rtp_simulcasting_context_process_rtp_cached(packet->sim_cache, &session->sim_context,
 					(char *)packet->data, packet->length, packet->ssrc, NULL, packet->codec, &session->context);
 				if(session->sim_context.need_pli) {
 					/* Schedule a PLI */
@@ -8402,7 +10354,7 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 					json_decref(event);
 				}
 				/* If we got here, update the RTP header and send the packet */
-				janus_rtp_header_update(packet->data, &session->context, TRUE, 0);
+				janus_rtp_header_update_at(packet->data, &session->context, TRUE, janus_streaming_packet_time(packet));
 				char vp8pd[6];
 				if(packet->codec == JANUS_VIDEOCODEC_VP8) {
 					/* For VP8, we save the original payload descriptor, to restore it after */
@@ -8424,7 +10376,7 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 				}
 			} else {
 				/* Fix sequence number and timestamp (switching may be involved) */
-				janus_rtp_header_update(packet->data, &session->context, TRUE, 0);
+				janus_rtp_header_update_at(packet->data, &session->context, TRUE, janus_streaming_packet_time(packet));
 				janus_plugin_rtp rtp = { .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length };
 				janus_plugin_rtp_extensions_reset(&rtp.extensions);
 				if(gateway != NULL)
@@ -8437,7 +10389,7 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 			if(!session->audio)
 				return;
 			/* Fix sequence number and timestamp (switching may be involved) */
-			janus_rtp_header_update(packet->data, &session->context, FALSE, 0);
+			janus_rtp_header_update_at(packet->data, &session->context, FALSE, janus_streaming_packet_time(packet));
 			janus_plugin_rtp rtp = { .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length };
 			janus_plugin_rtp_extensions_reset(&rtp.extensions);
 			if(gateway != NULL)
@@ -8489,54 +10441,146 @@ static void janus_streaming_relay_rtcp_packet(gpointer data, gpointer user_data)
 	return;
 }
 
-static void janus_streaming_helper_rtprtcp_packet(gpointer data, gpointer user_data) {
-	janus_streaming_rtp_relay_packet *packet = (janus_streaming_rtp_relay_packet *)user_data;
+/* Helper to pick the helper threads with the fewest and the most viewers */
+static void janus_streaming_helper_loads(janus_streaming_mountpoint *mp,
+		janus_streaming_helper **least, janus_streaming_helper **most) {
+	*least = NULL;
+	*most = NULL;
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+		if(*least == NULL || ht->num_viewers < (*least)->num_viewers)
+			*least = ht;
+		if(*most == NULL || ht->num_viewers > (*most)->num_viewers)
+			*most = ht;
+		l = l->next;
+	}
+}
+
+/* Add a viewer to the least loaded helper thread: called with mp->mutex locked */
+static void janus_streaming_helper_add_viewer(janus_streaming_mountpoint *mp, janus_streaming_session *session) {
+	janus_streaming_helper *helper = NULL, *most = NULL;
+	janus_streaming_helper_loads(mp, &helper, &most);
+	if(helper == NULL)
+		return;
+	janus_mutex_lock(&helper->mutex);
+	helper->viewers = g_list_append(helper->viewers, session);
+	helper->num_viewers++;
+	janus_mutex_unlock(&helper->mutex);
+	JANUS_LOG(LOG_VERB, "Added viewer to helper thread #%d (%d viewers)\n",
+		helper->id, helper->num_viewers);
+}
+
+/* Remove a viewer from its helper thread, and move another viewer around in
+ * case this left the helper threads unbalanced: called with mp->mutex locked */
+static void janus_streaming_helper_remove_viewer(janus_streaming_mountpoint *mp, janus_streaming_session *session) {
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+		janus_mutex_lock(&ht->mutex);
+		if(g_list_find(ht->viewers, session) != NULL) {
+			ht->num_viewers--;
+			ht->viewers = g_list_remove_all(ht->viewers, session);
+			janus_mutex_unlock(&ht->mutex);
+			JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d\n", ht->id);
+			break;
+		}
+		janus_mutex_unlock(&ht->mutex);
+		l = l->next;
+	}
+	if(l == NULL)
+		return;
+	/* Viewers are always added to the least loaded thread, so a single
+	 * move is enough to get the difference back to one viewer at most */
+	janus_streaming_helper *least = NULL, *most = NULL;
+	janus_streaming_helper_loads(mp, &least, &most);
+	if(least == NULL || most == NULL || most->num_viewers - least->num_viewers < 2)
+		return;
+	/* Helper threads only ever lock their own mutex, and we're serialized
+	 * by the mountpoint mutex, so locking both here is safe: this also
+	 * guarantees the viewer is never served by two threads at the same time */
+	janus_mutex_lock(&most->mutex);
+	janus_mutex_lock(&least->mutex);
+	GList *last = g_list_last(most->viewers);
+	if(last != NULL) {
+		janus_streaming_session *moved = (janus_streaming_session *)last->data;
+		most->viewers = g_list_delete_link(most->viewers, last);
+		most->num_viewers--;
+		least->viewers = g_list_append(least->viewers, moved);
+		least->num_viewers++;
+		JANUS_LOG(LOG_VERB, "Moved viewer from helper thread #%d to #%d (%d/%d viewers)\n",
+			most->id, least->id, most->num_viewers, least->num_viewers);
+	}
+	janus_mutex_unlock(&least->mutex);
+	janus_mutex_unlock(&most->mutex);
+}
+
+/* Queue a packet for all the helper threads of a mountpoint: a single copy is
+ * shared by all of them, which is why helper threads relay from a scratch
+ * buffer of their own (relaying rewrites the RTP headers in place) */
+static void janus_streaming_helper_queue_packet(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet) {
 	if(!packet || !packet->data || packet->length < 1) {
 		JANUS_LOG(LOG_ERR, "Invalid packet...\n");
 		return;
 	}
-	janus_streaming_helper *helper = (janus_streaming_helper *)data;
-	if(!helper) {
-		//~ JANUS_LOG(LOG_ERR, "Invalid session...\n");
-		return;
+	janus_streaming_helper_packet *shared = NULL;
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *helper = (janus_streaming_helper *)l->data;
+		l = l->next;
+		if(helper->num_viewers == 0)
+			continue;
+		if(g_async_queue_length(helper->queued_packets) >= JANUS_STREAMING_HELPER_MAX_QUEUE) {
+			/* This helper thread can't keep up, drop the packet */
+			g_atomic_int_inc(&helper->dropped);
+			continue;
+		}
+		if(shared == NULL) {
+			shared = g_malloc(sizeof(janus_streaming_helper_packet));
+			shared->packet = *packet;
+			shared->packet.data = g_malloc(packet->length);
+			memcpy(shared->packet.data, packet->data, packet->length);
+			janus_refcount_init(&shared->ref, janus_streaming_helper_packet_free);
+			gateway->account_memory(&janus_streaming_plugin, NULL, JANUS_STREAMING_HELPER_PACKET_SIZE(shared));
+		} else {
+			janus_refcount_increase(&shared->ref);
+		}
+		g_async_queue_push(helper->queued_packets, shared);
 	}
-	/* Clone the packet and queue it for delivery on the helper thread */
-	janus_streaming_rtp_relay_packet *copy = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-	copy->data = g_malloc(packet->length);
-	memcpy(copy->data, packet->data, packet->length);
-	copy->length = packet->length;
-	copy->is_rtp = packet->is_rtp;
-	copy->is_data = packet->is_data;
-	copy->textdata = packet->textdata;
-	copy->is_video = packet->is_video;
-	copy->is_keyframe = packet->is_keyframe;
-	copy->simulcast = packet->simulcast;
-	copy->ssrc[0] = packet->ssrc[0];
-	copy->ssrc[1] = packet->ssrc[1];
-	copy->ssrc[2] = packet->ssrc[2];
-	copy->codec = packet->codec;
-	copy->substream = packet->substream;
-	copy->timestamp = packet->timestamp;
-	copy->seq_number = packet->seq_number;
-	g_async_queue_push(helper->queued_packets, copy);
 }
 
 static void *janus_streaming_helper_thread(void *data) {
 	janus_streaming_helper *helper = (janus_streaming_helper *)data;
 	janus_streaming_mountpoint *mp = helper->mp;
 	JANUS_LOG(LOG_INFO, "[%s/#%d] Joining Streaming helper thread\n", mp->name, helper->id);
-	janus_streaming_rtp_relay_packet *pkt = NULL;
+	janus_streaming_helper_packet *shared = NULL;
+	janus_streaming_rtp_relay_packet pkt;
+	janus_rtp_simulcasting_cache sim_cache;
+	char *scratch = NULL;
+	gint scratch_size = 0;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mp->destroyed) && !g_atomic_int_get(&helper->destroyed)) {
-		pkt = g_async_queue_pop(helper->queued_packets);
-		if(pkt == &exit_packet)
+		shared = g_async_queue_pop(helper->queued_packets);
+		if(shared == &exit_helper_packet)
 			break;
+		/* The packet is shared with the other helper threads, so work on a copy */
+		if(scratch_size < shared->packet.length) {
+			scratch_size = shared->packet.length;
+			scratch = g_realloc(scratch, scratch_size);
+		}
+		pkt = shared->packet;
+		memcpy(scratch, shared->packet.data, shared->packet.length);
+		pkt.data = (janus_rtp_header *)scratch;
+		/* Each helper thread has its own cache of simulcast decisions */
+		janus_rtp_simulcasting_cache_reset(&sim_cache);
+		pkt.sim_cache = pkt.simulcast ? &sim_cache : NULL;
+		janus_streaming_helper_packet_unref(shared);
 		janus_mutex_lock(&helper->mutex);
 		g_list_foreach(helper->viewers,
-			pkt->is_rtp || pkt->is_data ? janus_streaming_relay_rtp_packet : janus_streaming_relay_rtcp_packet,
-			pkt);
+			pkt.is_rtp || pkt.is_data ? janus_streaming_relay_rtp_packet : janus_streaming_relay_rtcp_packet,
+			&pkt);
 		janus_mutex_unlock(&helper->mutex);
-		janus_streaming_rtp_relay_packet_free(pkt);
 	}
+	g_free(scratch);
 	JANUS_LOG(LOG_INFO, "[%s/#%d] Leaving Streaming helper thread\n", mp->name, helper->id);
 	janus_refcount_decrease(&helper->ref);
 	janus_refcount_decrease(&mp->ref);
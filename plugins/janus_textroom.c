@@ -63,10 +63,20 @@ is_private = true|false (whether this room should be in the public list, default
 secret = <optional password needed for manipulating (e.g. destroying) the room>
 pin = <optional password needed for joining the room>
 post = <optional backend to contact via HTTP post for all incoming messages>
+history = <optional size, in bytes, of the history of messages to keep for participants that join later; default=0, no history>
 \endverbatim
  *
  * As explained in the next section, you can also create rooms programmatically.
  *
+ * Rooms with a \c history keep the most recent public messages and
+ * announcements, dropping the oldest ones when the size gets past the
+ * configured amount of bytes. Participants joining such a room get the
+ * recent history in a single \c history event, and can fetch older
+ * messages page by page (see the \c history request below). If a
+ * \c history_folder is set in the general settings, the history of each
+ * room is also saved there, one file per room, and loaded back when the
+ * room is created again (e.g., after a restart).
+ *
  * \section textroomapi Text Room API
  *
  * All TextRoom API requests are addressed by a \c textroom named property,
@@ -145,6 +155,7 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 	"pin" : "<PIN required for participants to join room; optional>",
 	"is_private" : <true|false, whether the room should be listable; optional, true by default>,
 	"post" : "<backend to contact via HTTP post for all incoming messages; optional>",
+	"history" : <size, in bytes, of the history of messages to keep; optional, 0 (no history) by default>,
 	"permanent" : <true|false, whether the mountpoint should be saved to configuration file or not; false by default>
 }
 \endverbatim
@@ -332,7 +343,8 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 	"room" : <unique numeric ID of the room to join>,
 	"pin" : "<pin to join the room; mandatory if configured>",
 	"username" : "<unique username to have in the room; mandatory>",
-	"display" : "<display name to use in the room; optional>"
+	"display" : "<display name to use in the room; optional>",
+	"history" : <true|false, whether to get the recent history of the room, if any; optional, true by default>
 }
 \endverbatim
  *
@@ -367,6 +379,36 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 	"display" : "<display name of new participant, if any>"
 }
 \endverbatim
+ *
+ * If the room keeps a history, the new participant is also sent the
+ * most recent messages, oldest first, all in a single \c history event:
+ *
+\verbatim
+{
+	"textroom" : "history",
+	"room" : <room ID>,
+	"messages" : [
+		// Array of message and announcement objects, formatted as described below
+	],
+	"more" : <true|false, whether there are older messages that didn't fit>
+}
+\endverbatim
+ *
+ * Older messages can then be fetched with the \c history request, using
+ * the \c id of the oldest message received so far:
+ *
+\verbatim
+{
+	"textroom" : "history",
+	"room" : <unique numeric ID of the room>,
+	"before" : <only return messages older than the one with this ID; optional, most recent messages if missing>,
+	"limit" : <maximum number of messages to return; optional>
+}
+\endverbatim
+ *
+ * The response is a \c success with the same \c messages and \c more
+ * properties as the \c history event. Notice that pages are also capped
+ * in size, so they may contain fewer messages than requested.
  *
  * To leave a previously joined room, instead, the \c leave request can
  * be used, which must be formatted like this:
@@ -446,7 +488,8 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 	"from" : "<username of participant who sent the public message>",
 	"date" : "<date/time of when the message was sent>",
 	"text" : "<content of the message>",
-	"whisper" : <true|false, depending on whether it's a public or private message>
+	"whisper" : <true|false, depending on whether it's a public or private message>,
+	"id" : <incremental ID of the message in the room history; only for public messages in rooms with a history>
 }
 \endverbatim
  *
@@ -488,7 +531,8 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 	"textroom" : "announcement",
 	"room" : <room ID the announcement was sent to>,
 	"date" : "<date/time of when the announcement was sent>",
-	"text" : "<content of the announcement>"
+	"text" : "<content of the announcement>",
+	"id" : <incremental ID of the announcement in the room history; only in rooms with a history>
 }
 \endverbatim
  *
@@ -496,6 +540,8 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 
 #include "plugin.h"
 
+#include <errno.h>
+
 #include <jansson.h>
 
 #ifdef HAVE_LIBCURL
@@ -540,6 +586,7 @@ void janus_textroom_slow_link(janus_plugin_session *handle, int uplink, int vide
 void janus_textroom_hangup_media(janus_plugin_session *handle);
 void janus_textroom_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_textroom_query_session(janus_plugin_session *handle);
+json_t *janus_textroom_query_metrics(void);
 
 /* Plugin setup */
 static janus_plugin janus_textroom_plugin =
@@ -567,6 +614,7 @@ static janus_plugin janus_textroom_plugin =
 		.hangup_media = janus_textroom_hangup_media,
 		.destroy_session = janus_textroom_destroy_session,
 		.query_session = janus_textroom_query_session,
+		.query_metrics = janus_textroom_query_metrics,
 	);
 
 /* Plugin creator */
@@ -606,6 +654,7 @@ static struct janus_json_parameter create_parameters[] = {
 	{"post", JSON_STRING, 0},
 	{"is_private", JANUS_JSON_BOOL, 0},
 	{"allowed", JSON_ARRAY, 0},
+	{"history", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"permanent", JANUS_JSON_BOOL, 0}
 };
 static struct janus_json_parameter destroy_parameters[] = {
@@ -632,7 +681,12 @@ static struct janus_json_parameter kick_parameters[] = {
 static struct janus_json_parameter join_parameters[] = {
 	{"username", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"pin", JSON_STRING, 0},
-	{"display", JSON_STRING, 0}
+	{"display", JSON_STRING, 0},
+	{"history", JANUS_JSON_BOOL, 0}
+};
+static struct janus_json_parameter history_parameters[] = {
+	{"before", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 static struct janus_json_parameter message_parameters[] = {
 	{"text", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
@@ -654,6 +708,7 @@ static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static gboolean string_ids = FALSE;
+static char *history_folder = NULL;
 static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
 static void *janus_textroom_handler(void *data);
@@ -672,13 +727,22 @@ typedef struct janus_textroom_room {
 	gboolean is_private;		/* Whether this room is 'private' (as in hidden) or not */
 	gchar *http_backend;		/* Server to contact via HTTP POST for incoming messages, if any */
 	GHashTable *participants;	/* Map of participants */
+	GPtrArray *recipients;		/* Sessions of the participants, for broadcasts (built when needed, dropped when participants change) */
 	gboolean check_tokens;		/* Whether to check tokens when participants join (see below) */
 	GHashTable *allowed;		/* Map of participants (as tokens) allowed to join */
+	size_t history_size;		/* Maximum size of the history, in bytes (0 means no history) */
+	GQueue *history;			/* Recent public messages and announcements, oldest first */
+	size_t history_bytes;		/* Current size of the history, in bytes */
+	guint64 history_id;			/* ID of the last message added to the history */
+	FILE *history_file;			/* File the history is saved to, if any */
+	size_t history_file_bytes;	/* Bytes written to the file since it was last compacted */
 	volatile gint destroyed;	/* Whether this room has been destroyed */
 	janus_mutex mutex;			/* Mutex to lock this room instance */
 	janus_refcount ref;
 } janus_textroom_room;
 static GHashTable *rooms = NULL;
+/* Kept up to date when rooms are added or removed, for the core metrics */
+static volatile gint rooms_count = 0;
 static janus_mutex rooms_mutex = JANUS_MUTEX_INITIALIZER;
 static char *admin_key = NULL;
 
@@ -707,6 +771,19 @@ typedef struct janus_textroom_participant {
 	janus_refcount ref;
 } janus_textroom_participant;
 
+/* A message in the history of a room */
+typedef struct janus_textroom_history_entry {
+	guint64 id;
+	json_t *message;
+	size_t size;
+} janus_textroom_history_entry;
+static void janus_textroom_history_entry_free(janus_textroom_history_entry *entry) {
+	if(entry == NULL)
+		return;
+	json_decref(entry->message);
+	g_free(entry);
+}
+
 static void janus_textroom_room_destroy(janus_textroom_room *textroom) {
 	if(textroom && g_atomic_int_compare_and_exchange(&textroom->destroyed, 0, 1))
 		janus_refcount_decrease(&textroom->ref);
@@ -720,7 +797,13 @@ static void janus_textroom_room_free(const janus_refcount *textroom_ref) {
 	g_free(textroom->room_pin);
 	g_free(textroom->http_backend);
 	g_hash_table_destroy(textroom->participants);
+	if(textroom->recipients)
+		g_ptr_array_unref(textroom->recipients);
 	g_hash_table_destroy(textroom->allowed);
+	if(textroom->history)
+		g_queue_free_full(textroom->history, (GDestroyNotify)janus_textroom_history_entry_free);
+	if(textroom->history_file)
+		fclose(textroom->history_file);
 	g_free(textroom);
 }
 
@@ -737,6 +820,11 @@ static void janus_textroom_session_free(const janus_refcount *session_ref) {
 	g_free(session);
 }
 
+static void janus_textroom_session_dereference(janus_textroom_session *session) {
+	if(session)
+		janus_refcount_decrease(&session->ref);
+}
+
 static void janus_textroom_participant_dereference(janus_textroom_participant *p) {
 	if(p)
 		janus_refcount_decrease(&p->ref);
@@ -812,14 +900,226 @@ static void janus_textroom_message_free(janus_textroom_message *msg) {
 #define JANUS_TEXTROOM_ERROR_ALREADY_IN_ROOM	421
 #define JANUS_TEXTROOM_ERROR_NOT_IN_ROOM		422
 #define JANUS_TEXTROOM_ERROR_NO_SUCH_USER		423
+#define JANUS_TEXTROOM_ERROR_NO_HISTORY			424
 #define JANUS_TEXTROOM_ERROR_UNKNOWN_ERROR		499
 
 #ifdef HAVE_LIBCURL
 static size_t janus_textroom_write_data(void *buffer, size_t size, size_t nmemb, void *userp) {
 	return size*nmemb;
 }
+
+/* Helper to POST a message to the HTTP backend of a room */
+static void janus_textroom_backend_post(const char *backend, const char *text) {
+	/* Prepare the libcurl context */
+	CURLcode res;
+	CURL *curl = curl_easy_init();
+	if(curl == NULL) {
+		JANUS_LOG(LOG_ERR, "Error initializing CURL context\n");
+		return;
+	}
+	curl_easy_setopt(curl, CURLOPT_URL, backend);
+	struct curl_slist *headers = NULL;
+	headers = curl_slist_append(headers, "Accept: application/json");
+	headers = curl_slist_append(headers, "Content-Type: application/json");
+	headers = curl_slist_append(headers, "charsets: utf-8");
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, text);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_textroom_write_data);
+	/* Send the request */
+	res = curl_easy_perform(curl);
+	if(res != CURLE_OK) {
+		JANUS_LOG(LOG_ERR, "Couldn't relay event to the backend: %s\n", curl_easy_strerror(res));
+	} else {
+		JANUS_LOG(LOG_DBG, "Event sent!\n");
+	}
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
+}
 #endif
 
+/* Helper to get the sessions of all the participants of a room, to broadcast
+ * to them without holding the room mutex: the array is shared by all
+ * broadcasts until participants change. Must be called with the room mutex
+ * held, and the returned reference released with g_ptr_array_unref */
+static GPtrArray *janus_textroom_room_recipients(janus_textroom_room *textroom) {
+	if(textroom->recipients == NULL) {
+		textroom->recipients = g_ptr_array_new_with_free_func((GDestroyNotify)janus_textroom_session_dereference);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, textroom->participants);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_textroom_participant *p = value;
+			if(p->session == NULL)
+				continue;
+			janus_refcount_increase(&p->session->ref);
+			g_ptr_array_add(textroom->recipients, p->session);
+		}
+	}
+	return g_ptr_array_ref(textroom->recipients);
+}
+
+/* Helper to drop the recipients array when participants change (room mutex held) */
+static void janus_textroom_room_participants_changed(janus_textroom_room *textroom) {
+	if(textroom->recipients != NULL) {
+		g_ptr_array_unref(textroom->recipients);
+		textroom->recipients = NULL;
+	}
+}
+
+/* Helper to send the same (already serialized) message to a list of recipients */
+static void janus_textroom_broadcast(GPtrArray *recipients, char *text) {
+	janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = text, .length = strlen(text) };
+	guint i = 0;
+	for(i=0; i<recipients->len; i++) {
+		janus_textroom_session *top = g_ptr_array_index(recipients, i);
+		if(g_atomic_int_get(&top->destroyed))
+			continue;
+		gateway->relay_data(top->handle, &data);
+	}
+}
+
+/* History pages are capped both in number of messages and in size, so that
+ * they fit in a single data channel message any browser will accept */
+#define JANUS_TEXTROOM_HISTORY_PAGE_MESSAGES	100
+#define JANUS_TEXTROOM_HISTORY_PAGE_BYTES		60000
+
+/* Helper to get the path of the file the history of a room is saved to */
+static gboolean janus_textroom_history_path(janus_textroom_room *textroom, char *path, size_t len) {
+	if(history_folder == NULL || textroom->room_id_str == NULL)
+		return FALSE;
+	if(strchr(textroom->room_id_str, '/') || !strcmp(textroom->room_id_str, "..")) {
+		JANUS_LOG(LOG_WARN, "Can't save the history of room %s to a file, invalid ID\n", textroom->room_id_str);
+		return FALSE;
+	}
+	g_snprintf(path, len, "%s/%s.history", history_folder, textroom->room_id_str);
+	return TRUE;
+}
+
+/* Helper to drop the oldest messages until the history fits the room limits */
+static void janus_textroom_history_trim(janus_textroom_room *textroom) {
+	while(textroom->history_bytes > textroom->history_size && !g_queue_is_empty(textroom->history)) {
+		janus_textroom_history_entry *entry = g_queue_pop_head(textroom->history);
+		textroom->history_bytes -= entry->size;
+		janus_textroom_history_entry_free(entry);
+	}
+}
+
+/* Helper to (re)write the history file of a room, one message per line, and keep it open for appending */
+static void janus_textroom_history_save(janus_textroom_room *textroom) {
+	char path[1024];
+	if(!janus_textroom_history_path(textroom, path, sizeof(path)))
+		return;
+	if(textroom->history_file)
+		fclose(textroom->history_file);
+	textroom->history_file = fopen(path, "w");
+	textroom->history_file_bytes = 0;
+	if(textroom->history_file == NULL) {
+		JANUS_LOG(LOG_ERR, "Error opening history file %s: %d (%s)\n", path, errno, g_strerror(errno));
+		return;
+	}
+	GList *l = textroom->history->head;
+	while(l) {
+		janus_textroom_history_entry *entry = (janus_textroom_history_entry *)l->data;
+		char *line = json_dumps(entry->message, JSON_COMPACT | JSON_PRESERVE_ORDER);
+		if(line) {
+			fprintf(textroom->history_file, "%s\n", line);
+			textroom->history_file_bytes += strlen(line) + 1;
+			free(line);
+		}
+		l = l->next;
+	}
+	fflush(textroom->history_file);
+}
+
+/* Helper to prepare the history of a new room, loading it from file if we're saving histories */
+static void janus_textroom_history_init(janus_textroom_room *textroom) {
+	if(textroom->history_size == 0)
+		return;
+	textroom->history = g_queue_new();
+	char path[1024];
+	if(!janus_textroom_history_path(textroom, path, sizeof(path)))
+		return;
+	FILE *file = fopen(path, "r");
+	if(file != NULL) {
+		char *line = NULL;
+		size_t len = 0;
+		ssize_t read = 0;
+		while((read = getline(&line, &len, file)) > 0) {
+			json_error_t error;
+			json_t *message = json_loads(line, 0, &error);
+			json_t *id = message ? json_object_get(message, "id") : NULL;
+			if(!json_is_integer(id) || json_integer_value(id) < 1) {
+				JANUS_LOG(LOG_WARN, "Skipping invalid line in history file %s\n", path);
+				if(message)
+					json_decref(message);
+				continue;
+			}
+			janus_textroom_history_entry *entry = g_malloc(sizeof(janus_textroom_history_entry));
+			entry->id = json_integer_value(id);
+			entry->message = message;
+			entry->size = read;
+			if(entry->id > textroom->history_id)
+				textroom->history_id = entry->id;
+			g_queue_push_tail(textroom->history, entry);
+			textroom->history_bytes += entry->size;
+			janus_textroom_history_trim(textroom);
+		}
+		free(line);
+		fclose(file);
+		JANUS_LOG(LOG_VERB, "Loaded %u messages in the history of room %s\n",
+			g_queue_get_length(textroom->history), textroom->room_id_str);
+	}
+	/* Compact the file too, since we may have dropped messages */
+	janus_textroom_history_save(textroom);
+}
+
+/* Helper to add a message to the history of a room (room mutex held) */
+static void janus_textroom_history_add(janus_textroom_room *textroom, json_t *message, size_t size) {
+	janus_textroom_history_entry *entry = g_malloc(sizeof(janus_textroom_history_entry));
+	entry->id = textroom->history_id;
+	entry->message = json_incref(message);
+	entry->size = size;
+	g_queue_push_tail(textroom->history, entry);
+	textroom->history_bytes += size;
+	janus_textroom_history_trim(textroom);
+	if(textroom->history_file) {
+		char *line = json_dumps(message, JSON_COMPACT | JSON_PRESERVE_ORDER);
+		if(line) {
+			fprintf(textroom->history_file, "%s\n", line);
+			fflush(textroom->history_file);
+			textroom->history_file_bytes += strlen(line) + 1;
+			free(line);
+		}
+		/* Don't let the file grow much larger than the history itself */
+		if(textroom->history_file_bytes > 2*textroom->history_size)
+			janus_textroom_history_save(textroom);
+	}
+}
+
+/* Helper to get a page of the history of a room, most recent messages
+ * first if before is 0, oldest first in the array (room mutex held) */
+static json_t *janus_textroom_history_page(janus_textroom_room *textroom, guint64 before, guint limit, gboolean *more) {
+	json_t *messages = json_array();
+	*more = FALSE;
+	if(limit == 0 || limit > JANUS_TEXTROOM_HISTORY_PAGE_MESSAGES)
+		limit = JANUS_TEXTROOM_HISTORY_PAGE_MESSAGES;
+	size_t bytes = 0;
+	GList *l = textroom->history->tail;
+	while(l) {
+		janus_textroom_history_entry *entry = (janus_textroom_history_entry *)l->data;
+		l = l->prev;
+		if(before > 0 && entry->id >= before)
+			continue;
+		if(json_array_size(messages) == limit || bytes + entry->size > JANUS_TEXTROOM_HISTORY_PAGE_BYTES) {
+			*more = TRUE;
+			break;
+		}
+		json_array_insert(messages, 0, entry->message);
+		bytes += entry->size;
+	}
+	return messages;
+}
+
 /* We use this method to handle incoming requests. Since most of the requests
  * will arrive from data channels, but some may also arrive from the regular
  * plugin messaging (e.g., room management), we have the ability to pass
@@ -904,6 +1204,15 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "TextRoom will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *folder = janus_config_get(config, config_general, janus_config_type_item, "history_folder");
+		if(folder != NULL && folder->value != NULL) {
+			if(g_mkdir_with_parents(folder->value, 0755) < 0) {
+				JANUS_LOG(LOG_ERR, "Couldn't create history folder %s, histories won't be saved: %d (%s)\n",
+					folder->value, errno, g_strerror(errno));
+			} else {
+				history_folder = g_strdup(folder->value);
+			}
+		}
 	}
 	/* Iterate on all rooms */
 	rooms = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
@@ -922,6 +1231,7 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *secret = janus_config_get(config, cat, janus_config_type_item, "secret");
 			janus_config_item *pin = janus_config_get(config, cat, janus_config_type_item, "pin");
 			janus_config_item *post = janus_config_get(config, cat, janus_config_type_item, "post");
+			janus_config_item *history = janus_config_get(config, cat, janus_config_type_item, "history");
 			/* Create the text room */
 			janus_textroom_room *textroom = g_malloc0(sizeof(janus_textroom_room));
 			const char *room_num = cat->name;
@@ -978,6 +1288,14 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 				JANUS_LOG(LOG_WARN, "HTTP backend specified, but libcurl support was not built in...\n");
 #endif
 			}
+			if(history != NULL && history->value != NULL) {
+				int size = atoi(history->value);
+				if(size < 0)
+					JANUS_LOG(LOG_WARN, "Invalid history size for room %s, no history will be kept\n", room_num);
+				else
+					textroom->history_size = size;
+			}
+			janus_textroom_history_init(textroom);
 			textroom->participants = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_textroom_participant_dereference);
 			textroom->check_tokens = FALSE;	/* Static rooms can't have an "allowed" list yet, no hooks to the configuration file */
 			textroom->allowed = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
@@ -992,6 +1310,7 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 			g_hash_table_insert(rooms,
 				string_ids ? (gpointer)g_strdup(textroom->room_id_str) : (gpointer)janus_uint64_dup(textroom->room_id),
 				textroom);
+			g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 			cl = cl->next;
 		}
 		g_list_free(clist);
@@ -1058,6 +1377,8 @@ void janus_textroom_destroy(void) {
 
 	janus_config_destroy(config);
 	g_free(admin_key);
+	g_free(history_folder);
+	history_folder = NULL;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -1145,6 +1466,14 @@ void janus_textroom_destroy_session(janus_plugin_session *handle, int *error) {
 	return;
 }
 
+json_t *janus_textroom_query_metrics(void) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return NULL;
+	json_t *metrics = json_object();
+	json_object_set_new(metrics, "rooms", json_integer(g_atomic_int_get(&rooms_count)));
+	return metrics;
+}
+
 json_t *janus_textroom_query_session(janus_plugin_session *handle) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -1514,8 +1843,17 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		json_object_set_new(msg, "text", json_string(message));
 		if(username || usernames)
 			json_object_set_new(msg, "whisper", json_true());
+		gboolean keep = (username == NULL && usernames == NULL && textroom->history_size > 0);
+		if(keep)
+			json_object_set_new(msg, "id", json_integer(++textroom->history_id));
 		char *msg_text = json_dumps(msg, json_format);
+		if(keep)
+			janus_textroom_history_add(textroom, msg, strlen(msg_text));
 		json_decref(msg);
+		GPtrArray *recipients = NULL;
+#ifdef HAVE_LIBCURL
+		char *backend = NULL;
+#endif
 		/* Start preparing the response too */
 		reply = json_object();
 		json_object_set_new(reply, "textroom", json_string("success"));
@@ -1559,54 +1897,27 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			}
 			json_object_set_new(reply, "sent", sent);
 		} else {
-			/* Everybody in the room */
+			/* Everybody in the room: we don't need the room mutex for that */
 			JANUS_LOG(LOG_VERB, "To everybody in %s: %s\n", room_id_str, message);
-			if(textroom->participants) {
-				GHashTableIter iter;
-				gpointer value;
-				g_hash_table_iter_init(&iter, textroom->participants);
-				while(g_hash_table_iter_next(&iter, NULL, &value)) {
-					janus_textroom_participant *top = value;
-					JANUS_LOG(LOG_VERB, "  >> To %s in %s: %s\n", top->username, room_id_str, message);
-					janus_refcount_increase(&top->ref);
-					janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = msg_text, .length = strlen(msg_text) };
-					gateway->relay_data(top->session->handle, &data);
-					janus_refcount_decrease(&top->ref);
-				}
-			}
+			recipients = janus_textroom_room_recipients(textroom);
 #ifdef HAVE_LIBCURL
-			/* Is there a backend waiting for this message too? */
-			if(textroom->http_backend) {
-				/* Prepare the libcurl context */
-				CURLcode res;
-				CURL *curl = curl_easy_init();
-				if(curl == NULL) {
-					JANUS_LOG(LOG_ERR, "Error initializing CURL context\n");
-				} else {
-					curl_easy_setopt(curl, CURLOPT_URL, textroom->http_backend);
-					struct curl_slist *headers = NULL;
-					headers = curl_slist_append(headers, "Accept: application/json");
-					headers = curl_slist_append(headers, "Content-Type: application/json");
-					headers = curl_slist_append(headers, "charsets: utf-8");
-					curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-					curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg_text);
-					curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_textroom_write_data);
-					/* Send the request */
-					res = curl_easy_perform(curl);
-					if(res != CURLE_OK) {
-						JANUS_LOG(LOG_ERR, "Couldn't relay event to the backend: %s\n", curl_easy_strerror(res));
-					} else {
-						JANUS_LOG(LOG_DBG, "Event sent!\n");
-					}
-					curl_easy_cleanup(curl);
-					curl_slist_free_all(headers);
-				}
-			}
+			backend = g_strdup(textroom->http_backend);
 #endif
 		}
 		janus_refcount_decrease(&participant->ref);
-		free(msg_text);
 		janus_mutex_unlock(&textroom->mutex);
+		if(recipients != NULL) {
+			janus_textroom_broadcast(recipients, msg_text);
+			g_ptr_array_unref(recipients);
+		}
+#ifdef HAVE_LIBCURL
+		/* Is there a backend waiting for this message too? */
+		if(backend) {
+			janus_textroom_backend_post(backend, msg_text);
+			g_free(backend);
+		}
+#endif
+		free(msg_text);
 		janus_refcount_decrease(&textroom->ref);
 		/* By default we send a confirmation back to the user that sent this message:
 		 * if the user passed an ack=false, though, we don't do that */
@@ -1705,6 +2016,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			participant);
 		janus_refcount_increase(&participant->ref);
 		g_hash_table_insert(textroom->participants, participant->username, participant);
+		janus_textroom_room_participants_changed(textroom);
 		/* Notify all participants */
 		JANUS_LOG(LOG_VERB, "Notifying all participants about the new join\n");
 		json_t *list = json_array();
@@ -1741,6 +2053,21 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			}
 			free(event_text);
 		}
+		/* Send the recent history, if any, as a single message */
+		json_t *history = json_object_get(root, "history");
+		if(textroom->history && !g_queue_is_empty(textroom->history) && (history == NULL || json_is_true(history))) {
+			gboolean more = FALSE;
+			json_t *event = json_object();
+			json_object_set_new(event, "textroom", json_string("history"));
+			json_object_set_new(event, "room", string_ids ? json_string(textroom->room_id_str) : json_integer(textroom->room_id));
+			json_object_set_new(event, "messages", janus_textroom_history_page(textroom, 0, 0, &more));
+			json_object_set_new(event, "more", more ? json_true() : json_false());
+			char *event_text = json_dumps(event, json_format);
+			json_decref(event);
+			janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = event_text, .length = strlen(event_text) };
+			gateway->relay_data(handle, &data);
+			free(event_text);
+		}
 		janus_mutex_unlock(&session->mutex);
 		janus_mutex_unlock(&textroom->mutex);
 		janus_refcount_decrease(&textroom->ref);
@@ -1751,7 +2078,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_object_set_new(reply, "participants", list);
 		}
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_textroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("join"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -1810,6 +2137,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		janus_refcount_increase(&participant->ref);
 		g_hash_table_remove(session->rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
 		g_hash_table_remove(textroom->participants, participant->username);
+		janus_textroom_room_participants_changed(textroom);
 		participant->session = NULL;
 		participant->room = NULL;
 		/* Notify all participants */
@@ -1840,7 +2168,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			free(event_text);
 		}
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_textroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("leave"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -1857,6 +2185,78 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			reply = json_object();
 			json_object_set_new(reply, "textroom", json_string("success"));
 		}
+	} else if(!strcasecmp(request_text, "history")) {
+		JANUS_VALIDATE_JSON_OBJECT(root, history_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_TEXTROOM_ERROR_MISSING_ELEMENT, JANUS_TEXTROOM_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto msg_response;
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_TEXTROOM_ERROR_MISSING_ELEMENT, JANUS_TEXTROOM_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_TEXTROOM_ERROR_MISSING_ELEMENT, JANUS_TEXTROOM_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto msg_response;
+		json_t *room = json_object_get(root, "room");
+		guint64 room_id = 0;
+		char room_id_num[30], *room_id_str = NULL;
+		if(!string_ids) {
+			room_id = json_integer_value(room);
+			g_snprintf(room_id_num, sizeof(room_id_num), "%"SCNu64, room_id);
+			room_id_str = room_id_num;
+		} else {
+			room_id_str = (char *)json_string_value(room);
+		}
+		janus_mutex_lock(&rooms_mutex);
+		janus_textroom_room *textroom = g_hash_table_lookup(rooms,
+			string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
+		if(textroom == NULL) {
+			janus_mutex_unlock(&rooms_mutex);
+			JANUS_LOG(LOG_ERR, "No such room (%s)\n", room_id_str);
+			error_code = JANUS_TEXTROOM_ERROR_NO_SUCH_ROOM;
+			g_snprintf(error_cause, 512, "No such room (%s)", room_id_str);
+			goto msg_response;
+		}
+		janus_refcount_increase(&textroom->ref);
+		janus_mutex_unlock(&rooms_mutex);
+		janus_mutex_lock(&textroom->mutex);
+		if(g_hash_table_lookup(session->rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id) == NULL) {
+			janus_mutex_unlock(&textroom->mutex);
+			janus_refcount_decrease(&textroom->ref);
+			JANUS_LOG(LOG_ERR, "Not in room %s\n", room_id_str);
+			error_code = JANUS_TEXTROOM_ERROR_NOT_IN_ROOM;
+			g_snprintf(error_cause, 512, "Not in room %s", room_id_str);
+			goto msg_response;
+		}
+		if(textroom->history == NULL) {
+			janus_mutex_unlock(&textroom->mutex);
+			janus_refcount_decrease(&textroom->ref);
+			JANUS_LOG(LOG_ERR, "Room %s has no history\n", room_id_str);
+			error_code = JANUS_TEXTROOM_ERROR_NO_HISTORY;
+			g_snprintf(error_cause, 512, "Room %s has no history", room_id_str);
+			goto msg_response;
+		}
+		gboolean more = FALSE;
+		json_t *messages = janus_textroom_history_page(textroom,
+			json_integer_value(json_object_get(root, "before")),
+			json_integer_value(json_object_get(root, "limit")), &more);
+		janus_mutex_unlock(&textroom->mutex);
+		janus_refcount_decrease(&textroom->ref);
+		if(!internal) {
+			/* Send response back */
+			reply = json_object();
+			json_object_set_new(reply, "textroom", json_string("success"));
+			json_object_set_new(reply, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
+			json_object_set_new(reply, "messages", messages);
+			json_object_set_new(reply, "more", more ? json_true() : json_false());
+		} else {
+			json_decref(messages);
+		}
 	} else if(!strcasecmp(request_text, "list")) {
 		/* List all rooms (but private ones) and their details (except for the secret, of course...) */
 		JANUS_LOG(LOG_VERB, "Request for the list for all text rooms\n");
@@ -2164,7 +2564,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			free(event_text);
 		}
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_textroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "textroom", json_string("kicked"));
 			json_object_set_new(info, "room", string_ids ? json_string(textroom->room_id_str) : json_integer(textroom->room_id));
@@ -2174,6 +2574,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		/* Remove user from list */
 		g_hash_table_remove(participant->session->rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
 		g_hash_table_remove(textroom->participants, participant->username);
+		janus_textroom_room_participants_changed(textroom);
 		participant->session = NULL;
 		participant->room = NULL;
 		g_free(participant->username);
@@ -2249,53 +2650,29 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		strftime(msgTime, sizeof(msgTime), "%FT%T%z", tm_info);
 		json_object_set_new(msg, "date", json_string(msgTime));
 		json_object_set_new(msg, "text", json_string(message));
+		if(textroom->history_size > 0)
+			json_object_set_new(msg, "id", json_integer(++textroom->history_id));
 		char *msg_text = json_dumps(msg, json_format);
+		if(textroom->history_size > 0)
+			janus_textroom_history_add(textroom, msg, strlen(msg_text));
 		json_decref(msg);
-		/* Send the announcement to everybody in the room */
-		if(textroom->participants) {
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, textroom->participants);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_textroom_participant *top = value;
-				JANUS_LOG(LOG_VERB, "  >> To %s in %s: %s\n", top->username, room_id_str, message);
-				janus_refcount_increase(&top->ref);
-				janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = msg_text, .length = strlen(msg_text) };
-				gateway->relay_data(top->session->handle, &data);
-				janus_refcount_decrease(&top->ref);
-			}
-		}
+		/* Send the announcement to everybody in the room, without holding the room mutex */
+		JANUS_LOG(LOG_VERB, "Announcement to everybody in %s: %s\n", room_id_str, message);
+		GPtrArray *recipients = janus_textroom_room_recipients(textroom);
+#ifdef HAVE_LIBCURL
+		char *backend = g_strdup(textroom->http_backend);
+#endif
+		janus_mutex_unlock(&textroom->mutex);
+		janus_textroom_broadcast(recipients, msg_text);
+		g_ptr_array_unref(recipients);
 #ifdef HAVE_LIBCURL
 		/* Is there a backend waiting for this message too? */
-		if(textroom->http_backend) {
-			/* Prepare the libcurl context */
-			CURLcode res;
-			CURL *curl = curl_easy_init();
-			if(curl == NULL) {
-				JANUS_LOG(LOG_ERR, "Error initializing CURL context\n");
-			} else {
-				curl_easy_setopt(curl, CURLOPT_URL, textroom->http_backend);
-				struct curl_slist *headers = NULL;
-				headers = curl_slist_append(headers, "Accept: application/json");
-				headers = curl_slist_append(headers, "Content-Type: application/json");
-				headers = curl_slist_append(headers, "charsets: utf-8");
-				curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg_text);
-				curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_textroom_write_data);
-				/* Send the request */
-				res = curl_easy_perform(curl);
-				if(res != CURLE_OK) {
-					JANUS_LOG(LOG_ERR, "Couldn't relay event to the backend: %s\n", curl_easy_strerror(res));
-				} else {
-					JANUS_LOG(LOG_DBG, "Event sent!\n");
-				}
-				curl_easy_cleanup(curl);
-				curl_slist_free_all(headers);
-			}
+		if(backend) {
+			janus_textroom_backend_post(backend, msg_text);
+			g_free(backend);
 		}
 #endif
 		free(msg_text);
-		janus_mutex_unlock(&textroom->mutex);
 		janus_refcount_decrease(&textroom->ref);
 		if(!internal) {
 			/* Send response back */
@@ -2338,6 +2715,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		json_t *secret = json_object_get(root, "secret");
 		json_t *pin = json_object_get(root, "pin");
 		json_t *post = json_object_get(root, "post");
+		json_t *history = json_object_get(root, "history");
 		json_t *permanent = json_object_get(root, "permanent");
 		if(allowed) {
 			/* Make sure the "allowed" array only contains strings */
@@ -2438,6 +2816,8 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			JANUS_LOG(LOG_WARN, "HTTP backend specified, but libcurl support was not built in...\n");
 #endif
 		}
+		textroom->history_size = json_integer_value(history);
+		janus_textroom_history_init(textroom);
 		textroom->participants = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_textroom_participant_dereference);
 		textroom->allowed = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
 		if(allowed != NULL) {
@@ -2458,6 +2838,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		g_hash_table_insert(rooms,
 			string_ids ? (gpointer)g_strdup(textroom->room_id_str) : (gpointer)janus_uint64_dup(textroom->room_id),
 			textroom);
+		g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 		JANUS_LOG(LOG_VERB, "Created TextRoom: %s (%s, %s, secret: %s, pin: %s)\n",
 			textroom->room_id_str, textroom->room_name,
 			textroom->is_private ? "private" : "public",
@@ -2482,6 +2863,11 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_config_add(config, c, janus_config_item_create("pin", textroom->room_pin));
 			if(textroom->http_backend)
 				janus_config_add(config, c, janus_config_item_create("post", textroom->http_backend));
+			if(textroom->history_size > 0) {
+				char value[30];
+				g_snprintf(value, sizeof(value), "%zu", textroom->history_size);
+				janus_config_add(config, c, janus_config_item_create("history", value));
+			}
 			/* Save modified configuration */
 			if(janus_config_save(config, config_folder, JANUS_TEXTROOM_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room is not permanent */
@@ -2505,7 +2891,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_object_set_new(reply, "permanent", save ? json_true() : json_false());
 		}
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_textroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("created"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -2653,6 +3039,11 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_config_add(config, c, janus_config_item_create("pin", textroom->room_pin));
 			if(textroom->http_backend)
 				janus_config_add(config, c, janus_config_item_create("post", textroom->http_backend));
+			if(textroom->history_size > 0) {
+				char value[30];
+				g_snprintf(value, sizeof(value), "%zu", textroom->history_size);
+				janus_config_add(config, c, janus_config_item_create("history", value));
+			}
 			/* Save modified configuration */
 			if(janus_config_save(config, config_folder, JANUS_TEXTROOM_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room changes are not permanent */
@@ -2669,7 +3060,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_object_set_new(reply, "permanent", save ? json_true() : json_false());
 		}
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_textroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("edited"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -2733,6 +3124,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		}
 		/* Remove room */
 		g_hash_table_remove(rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
+		g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 		if(save) {
 			/* This change is permanent: save to the configuration file too
 			 * FIXME: We should check if anything fails... */
@@ -2746,6 +3138,10 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			if(janus_config_save(config, config_folder, JANUS_TEXTROOM_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room destruction is not permanent */
 			janus_mutex_unlock(&config_mutex);
+			/* The room won't come back, so neither will its history */
+			char path[1024];
+			if(textroom->history && janus_textroom_history_path(textroom, path, sizeof(path)))
+				unlink(path);
 		}
 		/* Notify all participants */
 		JANUS_LOG(LOG_VERB, "Notifying all participants about the destroy\n");
@@ -2787,7 +3183,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_object_set_new(reply, "permanent", save ? json_true() : json_false());
 		}
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_textroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("destroyed"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -846,7 +846,8 @@ void janus_videocall_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rt
 		}
 		if(g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&peer->destroyed))
 			return;
-		guint32 bitrate = janus_rtcp_get_remb(packet->buffer, packet->length);
+		guint32 bitrate = packet->summary ? packet->summary->remb :
+			janus_rtcp_get_remb(packet->buffer, packet->length);
 		if(bitrate > 0) {
 			/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
 			session->peer_bitrate = bitrate;
@@ -1013,7 +1014,7 @@ static void janus_videocall_hangup_media_internal(janus_plugin_session *handle)
 		JANUS_LOG(LOG_VERB, "  >> Pushing event to peer: %d (%s)\n", ret, janus_get_api_error(ret));
 		json_decref(call);
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_videocall_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("hangup"));
 			json_object_set_new(info, "reason", json_string("Remote WebRTC hangup"));
@@ -1160,7 +1161,7 @@ static void *janus_videocall_handler(void *data) {
 			json_object_set_new(result, "event", json_string("registered"));
 			json_object_set_new(result, "username", json_string(username_text));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_videocall_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("registered"));
 				json_object_set_new(info, "username", json_string(username_text));
@@ -1239,7 +1240,7 @@ static void *janus_videocall_handler(void *data) {
 				json_object_set_new(result, "username", json_string(session->username));
 				json_object_set_new(result, "reason", json_string("User busy"));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videocall_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("hangup"));
 					json_object_set_new(info, "reason", json_string("User busy"));
@@ -1317,7 +1318,7 @@ static void *janus_videocall_handler(void *data) {
 				result = json_object();
 				json_object_set_new(result, "event", json_string("calling"));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videocall_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("calling"));
 					gateway->notify_event(&janus_videocall_plugin, session->handle, info);
@@ -1414,7 +1415,7 @@ static void *janus_videocall_handler(void *data) {
 			result = json_object();
 			json_object_set_new(result, "event", json_string("accepted"));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_videocall_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("accepted"));
 				gateway->notify_event(&janus_videocall_plugin, session->handle, info);
@@ -1642,7 +1643,7 @@ static void *janus_videocall_handler(void *data) {
 				janus_mutex_unlock(&session->rec_mutex);
 			}
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_videocall_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("configured"));
 				json_object_set_new(info, "audio_active", session->audio_active ? json_true() : json_false());
@@ -1709,7 +1710,7 @@ static void *janus_videocall_handler(void *data) {
 			json_object_set_new(result, "reason", json_string(hangup_text));
 			json_object_set_new(result, "reason", json_string("Explicit hangup"));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_videocall_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("hangup"));
 				json_object_set_new(info, "reason", json_string("Explicit hangup"));
@@ -1731,7 +1732,7 @@ static void *janus_videocall_handler(void *data) {
 				JANUS_LOG(LOG_VERB, "  >> Pushing event to peer: %d (%s)\n", ret, janus_get_api_error(ret));
 				json_decref(call);
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videocall_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("hangup"));
 					json_object_set_new(info, "reason", json_string("Remote hangup"));
@@ -68,7 +68,8 @@ room-<unique room ID>: {
 	vp9_profile = VP9-specific profile to prefer (e.g., "2" for "profile-id=2")
 	h264_profile = H.264-specific profile to prefer (e.g., "42e01f" for "profile-level-id=42e01f")
 	opus_fec = true|false (whether inband FEC must be negotiated; only works for Opus, default=false)
-	video_svc = true|false (whether SVC support must be enabled; only works for VP9, default=false)
+	video_svc = true|false (whether SVC support must be enabled; only works for VP9, or for AV1
+		using the Dependency Descriptor RTP extension, default=false)
 	audiolevel_ext = true|false (whether the ssrc-audio-level RTP extension must be
 		negotiated/used or not for new publishers, default=true)
 	audiolevel_event = true|false (whether to emit event to other users or not, default=false)
@@ -84,6 +85,9 @@ room-<unique room ID>: {
 	rec_dir = <folder where recordings should be stored, when enabled>
 	lock_record = true|false (whether recording can only be started/stopped if the secret
 				is provided, or using the global enable_recording request, default=false)
+	record_filter = true|false (whether padding-only packets and Opus DTX runs should be left
+				out of the recordings, to save storage when participants are mostly silent,
+				default=false)
 	notify_joining = true|false (optional, whether to notify all participants when a new
 				participant joins the room. The Videoroom plugin by design only notifies
 				new feeds (publishers), and enabling this may result extra notification
@@ -91,6 +95,30 @@ room-<unique room ID>: {
 				for admin to manage listening only participants. default=false)
 	require_e2ee = true|false (whether all participants are required to publish and subscribe
 				using end-to-end media encryption, e.g., via Insertable Streams; default=false)
+	fanout = true|false (whether RTP packets from publishers with many subscribers should be
+				relayed in parallel by the fan-out workers, if enabled in the general
+				settings via \c fanout_workers; useful for webinars, default=false)
+	videobufferkf = true|false (whether the plugin should store the latest keyframe of each
+				publisher, and send it immediately to new subscribers, rather than having
+				them wait for a new keyframe; EXPERIMENTAL, default=false)
+	pli_interval = <minimum interval, in milliseconds, between keyframe requests sent to
+				each publisher: requests from subscribers in the meanwhile are coalesced
+				into a single PLI, and subscribers already waiting for a keyframe don't
+				trigger new ones; default=0, no limit>
+	simulcast_bwe = true|false (whether the simulcast substream and temporal layer sent to
+				each subscriber should automatically follow the bandwidth available to
+				them, as estimated from their REMB feedback and slow link notifications;
+				the substream and temporal layer subscribers ask for are then treated as
+				the highest ones they can get, default=false)
+	active_speakers = <number of active speakers to keep a ranking of, using the audio levels
+				publishers report via the ssrc-audio-level RTP extension; participants are
+				notified with a \c speakers event any time the ranking changes, default=0, disabled>
+	last_n = true|false (whether only the video of publishers in the active speakers ranking
+				should be relayed to subscribers, to save bandwidth in large rooms; only
+				works if active_speakers is set, default=false)
+	data_coalesce = <window, in milliseconds, small data channel messages from a publisher
+				are coalesced in before they're relayed to its subscribers, as a single
+				message (see below for the format); default=0, disabled>
 }
 \endverbatim
  *
@@ -103,7 +131,8 @@ room-<unique room ID>: {
  * (invalid JSON, invalid request) which will always result in a
  * synchronous error response even for asynchronous requests.
  *
- * \c create , \c destroy , \c edit , \c exists, \c list, \c allowed, \c kick
+ * \c create , \c destroy , \c edit , \c exists, \c list, \c allowed, \c kick ,
+ * \c add_remote_publisher , \c remove_remote_publisher
  * and \c listparticipants are synchronous requests, which means you'll
  * get a response directly within the context of the transaction.
  * \c create allows you to create a new video room dynamically, as an
@@ -114,6 +143,34 @@ room-<unique room ID>: {
  * exists; finally, \c list lists all the available rooms, while \c
  * listparticipants lists all the active (as in currently publishing
  * something) participants of a specific room and their details.
+ *
+ * Asynchronous requests are processed by one or more handler threads,
+ * depending on the \c handler_threads general setting: requests for the
+ * same room are always processed in order by the same thread, while
+ * different rooms may be processed in parallel. The Admin API (and only
+ * that) also supports a \c handlers request, to check how many requests
+ * each of the handler threads still has to process:
+ *
+\verbatim
+{
+	"request" : "handlers"
+}
+\endverbatim
+ *
+ * which returns something like this:
+ *
+\verbatim
+{
+	"videoroom" : "handlers",
+	"handlers" : [
+		{
+			"id" : <index of the handler thread>,
+			"queue" : <number of requests waiting to be processed>
+		},
+		// Other handler threads
+	]
+}
+\endverbatim
  *
  * The \c join , \c joinandconfigure , \c configure , \c publish ,
  * \c unpublish , \c start , \c pause , \c switch and \c leave
@@ -167,7 +224,11 @@ room-<unique room ID>: {
 \endverbatim
  *
  * If you requested a permanent room but a \c false value is returned
- * instead, good chances are that there are permission problems.
+ * instead, good chances are that there are permission problems. Notice
+ * that permanent changes are first appended to a journal next to the
+ * configuration file (\c janus.plugin.videoroom.jcfg.journal), which is
+ * folded back into the file periodically and when Janus shuts down, so
+ * that creating a room doesn't mean rewriting all the others as well.
  *
  * An error instead (and the same applies to all other requests, so this
  * won't be repeated) would provide both an error code and a more verbose
@@ -356,6 +417,7 @@ room-<unique room ID>: {
 			"record" : <true|false, whether the room is being recorded>,
 			"record_dir" : "<if recording, the path where the .mjr files are being saved>",
 			"lock_record" : <true|false, whether the room recording state can only be changed providing the secret>,
+			"record_filter" : <true|false, whether padding-only packets and Opus DTX runs are left out of recordings>,
 			"num_participants" : <count of the participants (publishers, active or not; not subscribers)>
 		},
 		// Other rooms
@@ -658,6 +720,35 @@ room-<unique room ID>: {
 	"audio-level-dBov-avg" : <average value of audio level, 127=muted, 0='too loud'>
 }
 \endverbatim
+ *
+ * If the room was created with \c active_speakers set, the plugin also
+ * keeps a ranking of the most active speakers, using a sliding window
+ * of the audio levels each publisher reports. Whenever the ranking changes,
+ * all participants get a compact event with the ordered list of speakers:
+ *
+\verbatim
+{
+	"videoroom" : "speakers",
+	"room" : <unique numeric ID of the room>,
+	"speakers" : [ <unique numeric ID of a publisher in the ranking, most active first>, ... ]
+}
+\endverbatim
+ *
+ * When \c last_n is set too, subscribers only get the video of the
+ * publishers in the ranking: the video of other publishers is paused
+ * until they make it to the ranking again.
+ *
+ * Rooms where publishers send many small data channel messages (e.g.,
+ * cursor positions or whiteboard updates) can be created with a
+ * \c data_coalesce window: messages up to 256 bytes are then held for
+ * at most that many milliseconds, and relayed to subscribers together,
+ * as a single message, rather than one SCTP message each. Text messages
+ * are joined with a newline, which means applications should only use
+ * this if their text messages don't contain any (as it happens, e.g.,
+ * with JSON serialized on a single line). Binary messages are each
+ * prefixed by their length, as a 16 bits integer in network byte order.
+ * Text and binary messages are never mixed, larger messages are relayed
+ * as they are (after whatever was waiting), and the order is preserved.
  *
  * An interesting feature VideoRoom publisher can take advantage of is
  * RTP forwarding. In fact, while the main purpose of this plugin is
@@ -817,6 +908,58 @@ room-<unique room ID>: {
 	]
 }
 \endverbatim *
+ *
+ * RTP forwarders can also be used to cascade a room across multiple
+ * Janus instances. In that case, rather than pairing forwarders with
+ * Streaming mountpoints, you can add the forwarded publisher to a room
+ * on another instance as a <i>remote publisher</i>: its packets are then
+ * received once, and local subscribers are served as if the publisher
+ * were local, simulcast included, with keyframe requests sent back
+ * upstream via RTCP. To do that, you use the \c add_remote_publisher
+ * request on the receiving instance, which has to be formatted as follows:
+ *
+\verbatim
+{
+	"request" : "add_remote_publisher",
+	"room" : <unique numeric ID of the room to add the remote publisher to>,
+	"secret" : "<room secret; mandatory if configured>",
+	"id" : <unique numeric ID to assign to the remote publisher; typically the same it has on the original instance>,
+	"display" : "<display name of the remote publisher; optional>",
+	"audio" : <true|false, whether the remote publisher will send audio; optional, default=true>,
+	"video" : <true|false, whether the remote publisher will send video; optional, default=true>,
+	"audiocodec" : "<audio codec the remote publisher is using; optional, default=first audio codec of the room>",
+	"videocodec" : "<video codec the remote publisher is using; optional, default=first video codec of the room>",
+	"audio_port" : <local port to receive audio RTP packets on; optional, default=random>,
+	"video_port" : <local port to receive video RTP packets on; optional, default=random>,
+	"video_rtcp_port" : <local port to exchange video RTCP packets on; optional, default=random>,
+	"video_ssrc" : <SSRC of the video stream, or of the first substream when simulcasting; optional>,
+	"video_ssrc_2" : <SSRC of the second substream, when simulcasting; optional>,
+	"video_ssrc_3" : <SSRC of the third substream, when simulcasting; optional>
+}
+\endverbatim
+ *
+ * A successful request will return the ports that were bound:
+ *
+\verbatim
+{
+	"videoroom" : "success",
+	"room" : <unique numeric ID, same as request>,
+	"id" : <unique numeric ID, same as request>,
+	"audio_port" : <local port audio RTP packets must be sent to, if audio is enabled>,
+	"video_port" : <local port video RTP packets must be sent to, if video is enabled>,
+	"video_rtcp_port" : <local port video RTCP must be exchanged with, if video is enabled>
+}
+\endverbatim
+ *
+ * On the original instance, you then create an \c rtp_forward for the
+ * publisher to those ports, setting \c video_rtcp_port to get keyframe
+ * requests back. To relay all simulcast layers over the same port, set
+ * \c video_port_2 and \c video_port_3 to the same value as \c video_port ,
+ * and use distinct \c video_ssrc , \c video_ssrc_2 and \c video_ssrc_3
+ * values: passing the same SSRCs to \c add_remote_publisher is what allows
+ * the receiving instance to tell the substreams apart. A remote publisher
+ * can be removed with a \c remove_remote_publisher request, that only
+ * needs the \c room , \c secret (if required) and \c id properties.
  *
  * To enable or disable recording on all participants while the conference
  * is in progress, you can make use of the \c enable_recording request,
@@ -916,8 +1059,8 @@ room-<unique room ID>: {
 	"substream" : <substream to receive (0-2), in case simulcasting is enabled; optional>,
 	"temporal" : <temporal layers to receive (0-2), in case simulcasting is enabled; optional>,
 	"fallback" : <How much time (in us, default 250000) without receiving packets will make us drop to the substream below>,
-	"spatial_layer" : <spatial layer to receive (0-2), in case VP9-SVC is enabled; optional>,
-	"temporal_layer" : <temporal layers to receive (0-2), in case VP9-SVC is enabled; optional>
+	"spatial_layer" : <spatial layer to receive (0-2), in case VP9-SVC or AV1-SVC is enabled; optional>,
+	"temporal_layer" : <temporal layers to receive (0-2), in case VP9-SVC or AV1-SVC is enabled; optional>
 }
 \endverbatim
  *
@@ -1030,8 +1173,8 @@ room-<unique room ID>: {
 	"substream" : <substream to receive (0-2), in case simulcasting is enabled; optional>,
 	"temporal" : <temporal layers to receive (0-2), in case simulcasting is enabled; optional>,
 	"fallback" : <How much time (in us, default 250000) without receiving packets will make us drop to the substream below>,
-	"spatial_layer" : <spatial layer to receive (0-2), in case VP9-SVC is enabled; optional>,
-	"temporal_layer" : <temporal layers to receive (0-2), in case VP9-SVC is enabled; optional>,
+	"spatial_layer" : <spatial layer to receive (0-2), in case VP9-SVC or AV1-SVC is enabled; optional>,
+	"temporal_layer" : <temporal layers to receive (0-2), in case VP9-SVC or AV1-SVC is enabled; optional>,
 	"audio_level_average" : "<if provided, overrides the room audio_level_average for this user; optional>",
 	"audio_active_packets" : "<if provided, overrides the room audio_active_packets for this user; optional>"
 }
@@ -1044,9 +1187,17 @@ room-<unique room ID>: {
  * when the mountpoint is configured with video simulcasting support, and
  * as such the viewer is interested in receiving a specific substream
  * or temporal layer, rather than any other of the available ones.
+ * If the room was created with \c simulcast_bwe set to \c true , the plugin
+ * will also automatically switch each viewer to the highest substream and
+ * temporal layer that fits the bandwidth they have, as estimated from their
+ * REMB feedback: in that case, \c substream and \c temporal only act as the
+ * highest layers the viewer is willing to receive.
  * The \c spatial_layer and \c temporal_layer have exactly the same meaning,
  * but within the context of VP9-SVC publishers, and will have no effect
- * on subscriptions associated to regular publishers.
+ * on subscriptions associated to regular publishers. The same properties
+ * are used for AV1-SVC publishers too, in rooms where only AV1 is allowed:
+ * in that case, the layers each packet belongs to are obtained from the
+ * Dependency Descriptor RTP extension, which is negotiated automatically.
  *
  * Another interesting feature that subscribers can take advantage of is the
  * so-called publisher "switching". Basically, when subscribed to a specific
@@ -1127,6 +1278,7 @@ room-<unique room ID>: {
 #include "../ip-utils.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <poll.h>
 
 
 /* Plugin information */
@@ -1153,6 +1305,7 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 json_t *janus_videoroom_handle_admin_message(json_t *message);
 void janus_videoroom_setup_media(janus_plugin_session *handle);
 void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet);
+void janus_videoroom_incoming_rtp_batch(janus_plugin_session *handle, janus_plugin_rtp **packets, int count);
 void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *packet);
 void janus_videoroom_incoming_data(janus_plugin_session *handle, janus_plugin_data *packet);
 void janus_videoroom_data_ready(janus_plugin_session *handle);
@@ -1160,6 +1313,7 @@ void janus_videoroom_slow_link(janus_plugin_session *handle, int uplink, int vid
 void janus_videoroom_hangup_media(janus_plugin_session *handle);
 void janus_videoroom_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_videoroom_query_session(janus_plugin_session *handle);
+json_t *janus_videoroom_query_metrics(void);
 
 /* Plugin setup */
 static janus_plugin janus_videoroom_plugin =
@@ -1180,6 +1334,7 @@ static janus_plugin janus_videoroom_plugin =
 		.handle_admin_message = janus_videoroom_handle_admin_message,
 		.setup_media = janus_videoroom_setup_media,
 		.incoming_rtp = janus_videoroom_incoming_rtp,
+		.incoming_rtp_batch = janus_videoroom_incoming_rtp_batch,
 		.incoming_rtcp = janus_videoroom_incoming_rtcp,
 		.incoming_data = janus_videoroom_incoming_data,
 		.data_ready = janus_videoroom_data_ready,
@@ -1187,6 +1342,7 @@ static janus_plugin janus_videoroom_plugin =
 		.hangup_media = janus_videoroom_hangup_media,
 		.destroy_session = janus_videoroom_destroy_session,
 		.query_session = janus_videoroom_query_session,
+		.query_metrics = janus_videoroom_query_metrics,
 	);
 
 /* Plugin creator */
@@ -1229,9 +1385,17 @@ static struct janus_json_parameter create_parameters[] = {
 	{"record", JANUS_JSON_BOOL, 0},
 	{"rec_dir", JSON_STRING, 0},
 	{"lock_record", JANUS_JSON_BOOL, 0},
+	{"record_filter", JANUS_JSON_BOOL, 0},
 	{"permanent", JANUS_JSON_BOOL, 0},
 	{"notify_joining", JANUS_JSON_BOOL, 0},
-	{"require_e2ee", JANUS_JSON_BOOL, 0}
+	{"require_e2ee", JANUS_JSON_BOOL, 0},
+	{"fanout", JANUS_JSON_BOOL, 0},
+	{"videobufferkf", JANUS_JSON_BOOL, 0},
+	{"pli_interval", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"simulcast_bwe", JANUS_JSON_BOOL, 0},
+	{"active_speakers", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"last_n", JANUS_JSON_BOOL, 0},
+	{"data_coalesce", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 static struct janus_json_parameter edit_parameters[] = {
 	{"secret", JSON_STRING, 0},
@@ -1292,6 +1456,20 @@ static struct janus_json_parameter allowed_parameters[] = {
 static struct janus_json_parameter kick_parameters[] = {
 	{"secret", JSON_STRING, 0}
 };
+static struct janus_json_parameter remote_publisher_parameters[] = {
+	{"secret", JSON_STRING, 0},
+	{"display", JSON_STRING, 0},
+	{"audio", JANUS_JSON_BOOL, 0},
+	{"video", JANUS_JSON_BOOL, 0},
+	{"audiocodec", JSON_STRING, 0},
+	{"videocodec", JSON_STRING, 0},
+	{"audio_port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"video_port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"video_rtcp_port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"video_ssrc", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"video_ssrc_2", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"video_ssrc_3", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
 static struct janus_json_parameter join_parameters[] = {
 	{"ptype", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"audio", JANUS_JSON_BOOL, 0},
@@ -1396,7 +1574,19 @@ static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static gboolean string_ids = FALSE;
 static janus_callbacks *gateway = NULL;
-static GThread *handler_thread;
+/* Optional pool of workers to relay packets to large audiences in parallel */
+#define JANUS_VIDEOROOM_FANOUT_THRESHOLD	32
+static guint fanout_workers = 0;
+static GThread **fanout_threads = NULL;
+static GAsyncQueue **fanout_queues = NULL;
+static volatile gint fanout_next = 0;
+static void *janus_videoroom_fanout_thread(void *data);
+/* Remote publishers each have a thread receiving their media */
+static volatile gint remote_threads = 0;
+static void *janus_videoroom_remote_publisher_thread(void *data);
+/* Asynchronous requests are sharded by room on a pool of handler threads */
+static guint handler_threads = 1;
+static GThread **handler_thread_list = NULL;
 static void *janus_videoroom_handler(void *data);
 static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data);
 static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data);
@@ -1414,7 +1604,7 @@ typedef struct janus_videoroom_message {
 	json_t *message;
 	json_t *jsep;
 } janus_videoroom_message;
-static GAsyncQueue *messages = NULL;
+static GAsyncQueue **messages = NULL;
 static janus_videoroom_message exit_message;
 
 
@@ -1436,7 +1626,7 @@ typedef struct janus_videoroom {
 	char *vp9_profile;			/* VP9 codec profile to prefer, if more are negotiated */
 	char *h264_profile;			/* H.264 codec profile to prefer, if more are negotiated */
 	gboolean do_opusfec;		/* Whether inband FEC must be negotiated (note: only available for Opus) */
-	gboolean do_svc;			/* Whether SVC must be done for video (note: only available for VP9 right now) */
+	gboolean do_svc;			/* Whether SVC must be done for video (note: only available for VP9 and AV1 right now) */
 	gboolean audiolevel_ext;	/* Whether the ssrc-audio-level extension must be negotiated or not for new publishers */
 	gboolean audiolevel_event;	/* Whether to emit event to other users about audiolevel */
 	int audio_active_packets;	/* Amount of packets with audio level for checkup */
@@ -1447,16 +1637,28 @@ typedef struct janus_videoroom {
 	gboolean record;			/* Whether the feeds from publishers in this room should be recorded */
 	char *rec_dir;				/* Where to save the recordings of this room, if enabled */
 	gboolean lock_record;		/* Whether recording state can only be changed providing the room secret */
+	gboolean record_filter;		/* Whether padding-only packets and Opus DTX runs should be left out of recordings */
 	GHashTable *participants;	/* Map of potential publishers (we get subscribers from them) */
 	GHashTable *private_ids;	/* Map of existing private IDs */
 	volatile gint destroyed;	/* Whether this room has been destroyed */
 	gboolean check_allowed;		/* Whether to check tokens when participants join (see below) */
 	GHashTable *allowed;		/* Map of participants (as tokens) allowed to join */
 	gboolean notify_joining;	/* Whether an event is sent to notify all participants if a new participant joins the room */
+	gboolean fanout;			/* Whether packets to large audiences should be relayed by the fan-out workers */
+	gboolean videobufferkf;		/* Whether the latest keyframe of publishers should be sent to new subscribers */
+	uint16_t pli_interval;		/* Minimum interval between keyframe requests to publishers, in ms (0=no limit) */
+	gboolean simulcast_bwe;		/* Whether simulcast layers sent to subscribers should follow their estimated bandwidth */
+	int active_speakers;		/* How many active speakers should be ranked (0=disabled) */
+	gboolean last_n;			/* Whether only the video of the active speakers should be relayed */
+	GList *speakers;			/* Current active speakers ranking (publishers, with a reference) */
+	uint16_t data_coalesce;		/* Window small data channel messages are coalesced in, in ms (0=disabled) */
+	gint64 speakers_latest;		/* When the ranking was last updated */
 	janus_mutex mutex;			/* Mutex to lock this room instance */
 	janus_refcount ref;			/* Reference counter for this room */
 } janus_videoroom;
 static GHashTable *rooms;
+/* Kept up to date when rooms are added or removed, for the core metrics */
+static volatile gint rooms_count = 0;
 static janus_mutex rooms_mutex = JANUS_MUTEX_INITIALIZER;
 static char *admin_key = NULL;
 static gboolean lock_rtpfwd = FALSE;
@@ -1471,6 +1673,8 @@ typedef struct janus_videoroom_session {
 	volatile gint dataready;
 	volatile gint hangingup;
 	volatile gint destroyed;
+	guint handler;		/* Index of the handler thread taking care of requests from this session */
+	janus_refcount_guard guard;	/* Lets the media path borrow the publisher without a reference */
 	janus_mutex mutex;
 	janus_refcount ref;
 } janus_videoroom_session;
@@ -1553,6 +1757,48 @@ static GMainLoop *rtcpfwd_loop = NULL;
 static GThread *rtcpfwd_thread = NULL;
 static void *janus_videoroom_rtp_forwarder_rtcp_thread(void *data);
 
+/* Immutable snapshot of the subscribers of a publisher: any time the list
+ * changes a new one is created, so that the RTP path can use it without
+ * holding the subscribers_mutex. Snapshots hold a reference to both the
+ * subscribers and their sessions, so they're safe to use even if some
+ * subscriber leaves while we're still relaying a packet to it */
+typedef struct janus_videoroom_subscribers {
+	guint count;
+	struct janus_videoroom_subscriber **list;
+	/* When fan-out workers are available, the list is grouped by worker,
+	 * and shards[i] is the offset of the first subscriber of worker i */
+	guint *shards;
+	janus_refcount ref;
+} janus_videoroom_subscribers;
+
+/* If enabled, we store the packets of the last keyframe of each substream
+ * of a publisher, to immediately send them to new subscribers */
+typedef struct janus_videoroom_keyframe {
+	GList *latest[3];
+	/* This is where we store packets while we're still collecting the whole keyframe */
+	GList *temp[3];
+	guint32 temp_ts[3];
+	janus_mutex mutex;
+} janus_videoroom_keyframe;
+
+/* Publisher on another Janus instance, whose media we receive via an RTP forwarder */
+typedef struct janus_videoroom_remote_publisher {
+	int audio_fd, video_fd, video_rtcp_fd;		/* Sockets we receive media on */
+	uint16_t audio_port, video_port, video_rtcp_port;	/* Local ports we bound to */
+	struct sockaddr_storage rtcp_addr;	/* Address of the forwarder to send keyframe requests to (latched) */
+	socklen_t rtcp_addrlen;
+	janus_mutex mutex;
+	volatile gint stop;
+} janus_videoroom_remote_publisher;
+
+/* How many audio levels we keep track of, per publisher, for the active speakers ranking (about 1 second) */
+#define JANUS_VIDEOROOM_SPEAKER_WINDOW		50
+/* Largest data channel message that can be coalesced, and largest batch of coalesced messages */
+#define JANUS_VIDEOROOM_DATA_COALESCE_MAX	256
+#define JANUS_VIDEOROOM_DATA_BATCH_MAX		1024
+/* How often the active speakers ranking is updated */
+#define JANUS_VIDEOROOM_SPEAKERS_INTERVAL	(500*1000)
+
 typedef struct janus_videoroom_publisher {
 	janus_videoroom_session *session;
 	janus_videoroom *room;	/* Room */
@@ -1563,6 +1809,7 @@ typedef struct janus_videoroom_publisher {
 	guint32 pvt_id;		/* This is sent to the publisher for mapping purposes, but shouldn't be shared with others */
 	gchar *display;		/* Display name (just for fun) */
 	gchar *sdp;			/* The SDP this publisher negotiated, if any */
+	gchar *subscriber_offers[8];	/* Offers for subscribers rendered out of sdp, one per subset of removed m-lines (protected by subscribers_mutex) */
 	gboolean audio, video, data;		/* Whether audio, video and/or data is going to be sent by this publisher */
 	janus_audiocodec acodec;	/* Audio codec this publisher is using */
 	janus_videocodec vcodec;	/* Video codec this publisher is using */
@@ -1579,21 +1826,40 @@ typedef struct janus_videoroom_publisher {
 	guint8 audio_level_extmap_id;		/* Audio level extmap ID */
 	guint8 video_orient_extmap_id;		/* Video orientation extmap ID */
 	guint8 playout_delay_extmap_id;		/* Playout delay extmap ID */
+	guint8 dependency_desc_extmap_id;	/* AV1 Dependency Descriptor extmap ID */
+	janus_av1_svc_context av1_svc;		/* Template dependency structure for AV1 SVC */
 	gboolean audio_active;
 	gboolean video_active;
 	int audio_dBov_level;		/* Value in dBov of the audio level (last value from extension) */
+	/* Sliding window of audio levels, if the room ranks active speakers */
+	guint8 speaker_levels[JANUS_VIDEOROOM_SPEAKER_WINDOW];
+	guint speaker_index, speaker_count, speaker_sum;
+	volatile gint speaker_active;	/* Whether this publisher is in the active speakers ranking */
 	int audio_active_packets;	/* Participant's number of audio packets to accumulate */
 	int audio_dBov_sum;			/* Participant's accumulated dBov value for audio level*/
 	int user_audio_active_packets;	/* Participant's audio_active_packets overwriting global room setting */
 	int user_audio_level_average;	/* Participant's audio_level_average overwriting global room setting */
 	gboolean talking; /* Whether this participant is currently talking (uses audio levels extension) */
 	gboolean data_active;
+	/* Small data channel messages waiting to be relayed, used when the room has a data_coalesce window */
+	janus_mutex data_mutex;
+	GByteArray *data_batch;
+	gboolean data_batch_text;	/* Whether the messages in the batch are text or binary */
+	gboolean data_scheduled;	/* Whether a flush of the batch has been scheduled already */
 	gboolean firefox;	/* We send Firefox users a different kind of FIR */
 	uint32_t bitrate;
 	gint64 remb_startup;/* Incremental changes on REMB to reach the target at startup */
 	gint64 remb_latest;	/* Time of latest sent REMB (to avoid flooding) */
 	gint64 fir_latest;	/* Time of latest sent FIR (to avoid flooding) */
 	gint fir_seq;		/* FIR sequence number */
+	/* Keyframe requests aggregator, used when the room has a pli_interval */
+	janus_mutex pli_mutex;
+	gint64 pli_latest;		/* Time of latest PLI we actually sent */
+	gboolean pli_pending;	/* Whether requests were coalesced and still need a PLI */
+	guint32 pli_forwarded, pli_suppressed;	/* Counters of sent and coalesced keyframe requests */
+	/* Bitrate of each simulcast substream, measured if the room has simulcast_bwe */
+	uint32_t sub_bytes[3], sub_bitrate[3];
+	gint64 sub_bitrate_ts;
 	gboolean recording_active;	/* Whether this publisher has to be recorded or not */
 	gchar *recording_base;	/* Base name for the recording (e.g., /path/to/filename, will generate /path/to/filename-audio.mjr and/or /path/to/filename-video.mjr */
 	janus_recorder *arc;	/* The Janus recorder instance for this publisher's audio, if enabled */
@@ -1605,6 +1871,10 @@ typedef struct janus_videoroom_publisher {
 	GSList *subscribers;	/* Subscriptions to this publisher (who's watching this publisher)  */
 	GSList *subscriptions;	/* Subscriptions this publisher has created (who this publisher is watching) */
 	janus_mutex subscribers_mutex;
+	janus_videoroom_subscribers *subscribers_snapshot;	/* Current snapshot of the subscribers list */
+	volatile gint subscribers_version;	/* Incremented any time the snapshot is replaced */
+	janus_videoroom_subscribers *rtp_subscribers;	/* Snapshot the RTP path is currently using */
+	gint rtp_subscribers_version;	/* Version of the snapshot the RTP path is currently using */
 	janus_mutex own_subscriptions_mutex;
 	GHashTable *rtp_forwarders;
 	GHashTable *srtp_contexts;
@@ -1612,6 +1882,8 @@ typedef struct janus_videoroom_publisher {
 	int udp_sock; /* The udp socket on which to forward rtp packets */
 	gboolean kicked;	/* Whether this participant has been kicked */
 	gboolean e2ee;		/* If media from this publisher is end-to-end encrypted */
+	janus_videoroom_remote_publisher *remote;	/* If this publisher is on another Janus instance */
+	janus_videoroom_keyframe keyframe;	/* Latest keyframe(s), if the room wants them to be buffered */
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_videoroom_publisher;
@@ -1619,6 +1891,8 @@ static guint32 janus_videoroom_rtp_forwarder_add_helper(janus_videoroom_publishe
 	const gchar *host, int port, int rtcp_port, int pt, uint32_t ssrc,
 	gboolean simulcast, int srtp_suite, const char *srtp_crypto,
 	int substream, gboolean is_video, gboolean is_data);
+static void janus_videoroom_incoming_rtp_internal(janus_videoroom_session *session,
+	janus_videoroom_publisher *participant, janus_plugin_rtp *pkt);
 
 typedef struct janus_videoroom_subscriber {
 	janus_videoroom_session *session;
@@ -1629,6 +1903,7 @@ typedef struct janus_videoroom_subscriber {
 	gboolean close_pc;		/* Whether we should automatically close the PeerConnection when the publisher goes away */
 	guint32 pvt_id;			/* Private ID of the participant that is subscribing (if available/provided) */
 	janus_sdp *sdp;			/* Offer we sent this listener (may be updated within renegotiations) */
+	gchar *sdp_offer;		/* First offer we sent this listener, only parsed into sdp if we need to renegotiate */
 	janus_rtp_switching_context context;	/* Needed in case there are publisher switches on this subscriber */
 	janus_rtp_simulcasting_context sim_context;
 	janus_vp8_simulcast_context vp8_context;
@@ -1643,6 +1918,13 @@ typedef struct janus_videoroom_subscriber {
 	gint64 last_spatial_layer[3];
 	int temporal_layer, target_temporal_layer;
 	gboolean e2ee;		/* If media for this subscriber is end-to-end encrypted */
+	volatile gint keyframe_replay;	/* Whether the buffered keyframe of the publisher should be sent first */
+	gint64 pli_pending;		/* When this subscriber asked for a keyframe it didn't get yet (0=none) */
+	/* Bandwidth estimation, if the room adapts simulcast layers to it */
+	uint32_t bwe_estimate;		/* Estimated bandwidth available to this subscriber (0=unknown) */
+	gint64 bwe_up_since;		/* When we first had enough room for a higher layer */
+	int bwe_substream_max, bwe_templayer_max;	/* Highest layers this subscriber asked for */
+	guint fanout_worker;	/* Fan-out worker this subscriber is relayed by, if any */
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_videoroom_subscriber;
@@ -1655,8 +1937,14 @@ typedef struct janus_videoroom_rtp_relay_packet {
 	uint32_t ssrc[3];
 	uint32_t timestamp;
 	uint16_t seq_number;
+	/* When the packet was received (0 if unknown), to rewrite headers for all subscribers without asking the clock each time */
+	gint64 received;
 	/* Extensions to add, if any */
 	janus_plugin_rtp_extensions extensions;
+	/* Copy of the payload we can share with the core, if any */
+	janus_plugin_rtp_payload *payload;
+	/* Whether this is (part of) a keyframe: only checked when limiting PLIs */
+	gboolean keyframe;
 	/* The following are only relevant if we're doing VP9 SVC*/
 	gboolean svc;
 	janus_vp9_svc_info svc_info;
@@ -1664,6 +1952,127 @@ typedef struct janus_videoroom_rtp_relay_packet {
 	gboolean textdata;
 } janus_videoroom_rtp_relay_packet;
 
+/* Packet to relay to the RTP forwarders of a publisher on the forwarder thread */
+typedef struct janus_videoroom_forwarder_job {
+	janus_videoroom_publisher *publisher;
+	gboolean video;
+	int substream;
+	int length;
+	char data[];
+} janus_videoroom_forwarder_job;
+static janus_videoroom_forwarder_job forwarder_exit_job;
+static GAsyncQueue *forwarder_queue = NULL;
+static GThread *forwarder_thread = NULL;
+static void *janus_videoroom_forwarder_thread(void *data);
+
+static void janus_videoroom_forwarder_job_free(janus_videoroom_forwarder_job *job) {
+	if(!job || job == &forwarder_exit_job)
+		return;
+	janus_refcount_decrease(&job->publisher->ref);
+	g_free(job);
+}
+
+static void janus_videoroom_rtp_relay_packet_free(janus_videoroom_rtp_relay_packet *pkt) {
+	if(pkt == NULL)
+		return;
+	g_free(pkt->data);
+	g_free(pkt);
+}
+
+/* Get rid of the buffered keyframes of a publisher */
+static void janus_videoroom_keyframe_reset(janus_videoroom_publisher *p) {
+	janus_mutex_lock(&p->keyframe.mutex);
+	int i=0;
+	for(i=0; i<3; i++) {
+		g_list_free_full(p->keyframe.latest[i], (GDestroyNotify)janus_videoroom_rtp_relay_packet_free);
+		p->keyframe.latest[i] = NULL;
+		g_list_free_full(p->keyframe.temp[i], (GDestroyNotify)janus_videoroom_rtp_relay_packet_free);
+		p->keyframe.temp[i] = NULL;
+		p->keyframe.temp_ts[i] = 0;
+	}
+	janus_mutex_unlock(&p->keyframe.mutex);
+}
+
+static gboolean janus_videoroom_is_keyframe(janus_videocodec vcodec, char *payload, int plen) {
+	switch(vcodec) {
+		case JANUS_VIDEOCODEC_VP8:
+			return janus_vp8_is_keyframe(payload, plen);
+		case JANUS_VIDEOCODEC_VP9:
+			return janus_vp9_is_keyframe(payload, plen);
+		case JANUS_VIDEOCODEC_H264:
+			return janus_h264_is_keyframe(payload, plen);
+		case JANUS_VIDEOCODEC_AV1:
+			return janus_av1_is_keyframe(payload, plen);
+		case JANUS_VIDEOCODEC_H265:
+			return janus_h265_is_keyframe(payload, plen);
+		default:
+			break;
+	}
+	return FALSE;
+}
+
+/* Check if this packet is (part of) a keyframe we need to store for new subscribers */
+static void janus_videoroom_keyframe_update(janus_videoroom_publisher *p, int substream, janus_videoroom_rtp_relay_packet *packet) {
+	if(substream < 0 || substream > 2)
+		return;
+	janus_mutex_lock(&p->keyframe.mutex);
+	if(p->keyframe.temp_ts[substream] > 0 && packet->timestamp != p->keyframe.temp_ts[substream]) {
+		/* We received the last part of the keyframe, get rid of the old one and use this from now on */
+		JANUS_LOG(LOG_HUGE, "[%s] Buffered keyframe (substream %d): ts=%"SCNu32", %d packets\n",
+			p->user_id_str, substream, p->keyframe.temp_ts[substream], g_list_length(p->keyframe.temp[substream]));
+		g_list_free_full(p->keyframe.latest[substream], (GDestroyNotify)janus_videoroom_rtp_relay_packet_free);
+		p->keyframe.latest[substream] = p->keyframe.temp[substream];
+		p->keyframe.temp[substream] = NULL;
+		p->keyframe.temp_ts[substream] = 0;
+	}
+	gboolean store = (p->keyframe.temp_ts[substream] > 0);
+	if(!store) {
+		if(packet->keyframe) {
+			/* New keyframe, start saving it */
+			p->keyframe.temp_ts[substream] = packet->timestamp;
+			store = TRUE;
+		}
+	}
+	if(store) {
+		janus_videoroom_rtp_relay_packet *pkt = g_malloc(sizeof(janus_videoroom_rtp_relay_packet));
+		*pkt = *packet;
+		pkt->data = g_malloc(packet->length);
+		memcpy(pkt->data, packet->data, packet->length);
+		pkt->payload = NULL;
+		pkt->received = 0;
+		p->keyframe.temp[substream] = g_list_append(p->keyframe.temp[substream], pkt);
+	}
+	janus_mutex_unlock(&p->keyframe.mutex);
+}
+
+/* Send the buffered keyframe of the publisher to a subscriber that just started:
+ * as it goes through the usual relay path, seq/ts are rewritten as for live packets */
+static void janus_videoroom_keyframe_replay(janus_videoroom_subscriber *subscriber) {
+	janus_videoroom_publisher *p = subscriber->feed;
+	if(p == NULL)
+		return;
+	janus_mutex_lock(&p->keyframe.mutex);
+	/* If the publisher is simulcasting, pick the best substream that doesn't exceed the target */
+	int substream = 0;
+	if(p->ssrc[0] != 0 || p->rid[0] != NULL) {
+		substream = subscriber->sim_context.substream_target;
+		if(substream < 0 || substream > 2)
+			substream = 2;
+		while(substream > 0 && p->keyframe.latest[substream] == NULL)
+			substream--;
+	}
+	GList *temp = p->keyframe.latest[substream];
+	if(temp != NULL) {
+		JANUS_LOG(LOG_VERB, "[%s] Sending buffered keyframe to new subscriber (%d packets)\n",
+			p->user_id_str, g_list_length(temp));
+	}
+	while(temp) {
+		janus_videoroom_relay_rtp_packet(subscriber, temp->data);
+		temp = temp->next;
+	}
+	janus_mutex_unlock(&p->keyframe.mutex);
+}
+
 /* Start / stop recording */
 static void janus_videoroom_recorder_create(janus_videoroom_publisher *participant, gboolean audio, gboolean video, gboolean data);
 static void janus_videoroom_recorder_close(janus_videoroom_publisher *participant);
@@ -1679,6 +2088,7 @@ static void janus_videoroom_subscriber_free(const janus_refcount *s_ref) {
 	/* This subscriber can be destroyed, free all the resources */
 	g_free(s->room_id_str);
 	janus_sdp_destroy(s->sdp);
+	g_free(s->sdp_offer);
 	g_free(s);
 }
 
@@ -1693,8 +2103,144 @@ static void janus_videoroom_publisher_dereference_by_subscriber(janus_videoroom_
 	janus_refcount_decrease(&p->ref);
 }
 
-static void janus_videoroom_publisher_dereference_nodebug(janus_videoroom_publisher *p) {
-	janus_refcount_decrease_nodebug(&p->ref);
+static void janus_videoroom_subscribers_free(const janus_refcount *s_ref) {
+	janus_videoroom_subscribers *s = janus_refcount_containerof(s_ref, janus_videoroom_subscribers, ref);
+	guint i = 0;
+	for(i=0; i<s->count; i++) {
+		janus_refcount_decrease(&s->list[i]->session->ref);
+		janus_refcount_decrease(&s->list[i]->ref);
+	}
+	g_free(s->list);
+	g_free(s->shards);
+	g_free(s);
+}
+
+/* Replace the snapshot of the subscribers of a publisher: this must be
+ * called with the subscribers_mutex held, any time the list changes */
+static void janus_videoroom_subscribers_update(janus_videoroom_publisher *p) {
+	janus_videoroom_subscribers *s = NULL;
+	guint count = g_slist_length(p->subscribers);
+	if(count > 0) {
+		s = g_malloc(sizeof(janus_videoroom_subscribers));
+		s->count = 0;
+		s->list = g_malloc(count * sizeof(janus_videoroom_subscriber *));
+		s->shards = NULL;
+		GSList *l = p->subscribers;
+		while(l) {
+			janus_videoroom_subscriber *subscriber = (janus_videoroom_subscriber *)l->data;
+			if(subscriber != NULL && subscriber->session != NULL) {
+				janus_refcount_increase(&subscriber->ref);
+				janus_refcount_increase(&subscriber->session->ref);
+				s->list[s->count++] = subscriber;
+			}
+			l = l->next;
+		}
+		if(fanout_workers > 0 && s->count > 0) {
+			/* Group subscribers by fan-out worker: a subscriber is always
+			 * handled by the same worker, so its packets stay in order */
+			janus_videoroom_subscriber **list = g_malloc(s->count * sizeof(janus_videoroom_subscriber *));
+			s->shards = g_malloc0((fanout_workers+1) * sizeof(guint));
+			guint i = 0, w = 0;
+			for(i=0; i<s->count; i++)
+				s->shards[s->list[i]->fanout_worker+1]++;
+			for(w=1; w<=fanout_workers; w++)
+				s->shards[w] += s->shards[w-1];
+			guint *next = g_malloc(fanout_workers * sizeof(guint));
+			memcpy(next, s->shards, fanout_workers * sizeof(guint));
+			for(i=0; i<s->count; i++)
+				list[next[s->list[i]->fanout_worker]++] = s->list[i];
+			g_free(next);
+			g_free(s->list);
+			s->list = list;
+		}
+		janus_refcount_init(&s->ref, janus_videoroom_subscribers_free);
+	}
+	janus_videoroom_subscribers *old = p->subscribers_snapshot;
+	p->subscribers_snapshot = s;
+	g_atomic_int_inc(&p->subscribers_version);
+	if(old != NULL)
+		janus_refcount_decrease(&old->ref);
+}
+
+/* Get the snapshot of subscribers to relay RTP packets to: this is only
+ * called by the publisher's loop, which keeps its own reference to the
+ * snapshot, so we only need to lock when the snapshot was replaced */
+static janus_videoroom_subscribers *janus_videoroom_subscribers_get(janus_videoroom_publisher *p) {
+	gint version = g_atomic_int_get(&p->subscribers_version);
+	if(version != p->rtp_subscribers_version) {
+		janus_mutex_lock_nodebug(&p->subscribers_mutex);
+		janus_videoroom_subscribers *old = p->rtp_subscribers;
+		p->rtp_subscribers = p->subscribers_snapshot;
+		if(p->rtp_subscribers != NULL)
+			janus_refcount_increase(&p->rtp_subscribers->ref);
+		p->rtp_subscribers_version = g_atomic_int_get(&p->subscribers_version);
+		janus_mutex_unlock_nodebug(&p->subscribers_mutex);
+		if(old != NULL)
+			janus_refcount_decrease(&old->ref);
+	}
+	return p->rtp_subscribers;
+}
+
+/* Packet to relay to a shard of the subscribers of a publisher */
+typedef struct janus_videoroom_fanout_job {
+	janus_videoroom_subscribers *subscribers;
+	guint first, last;
+	janus_videoroom_rtp_relay_packet packet;
+} janus_videoroom_fanout_job;
+static janus_videoroom_fanout_job fanout_exit_job;
+
+static void janus_videoroom_fanout_job_free(janus_videoroom_fanout_job *job) {
+	if(!job || job == &fanout_exit_job)
+		return;
+	janus_plugin_rtp_payload_unref(job->packet.payload);
+	janus_refcount_decrease(&job->subscribers->ref);
+	g_free(job);
+}
+
+/* Relay a packet to all the subscribers in a snapshot using the fan-out workers:
+ * as relaying rewrites the RTP header, each worker gets its own copy of the packet */
+static void janus_videoroom_fanout_relay(janus_videoroom_subscribers *subscribers, janus_videoroom_rtp_relay_packet *packet) {
+	guint w = 0;
+	for(w=0; w<fanout_workers; w++) {
+		guint first = subscribers->shards[w], last = subscribers->shards[w+1];
+		if(first == last)
+			continue;
+		janus_videoroom_fanout_job *job = g_malloc(sizeof(janus_videoroom_fanout_job) + packet->length);
+		janus_refcount_increase(&subscribers->ref);
+		job->subscribers = subscribers;
+		job->first = first;
+		job->last = last;
+		job->packet = *packet;
+		job->packet.data = (janus_rtp_header *)((char *)job + sizeof(janus_videoroom_fanout_job));
+		memcpy(job->packet.data, packet->data, packet->length);
+		if(job->packet.payload != NULL)
+			janus_plugin_rtp_payload_ref(job->packet.payload);
+		g_async_queue_push(fanout_queues[w], job);
+	}
+}
+
+static void *janus_videoroom_fanout_thread(void *data) {
+	GAsyncQueue *queue = (GAsyncQueue *)data;
+	JANUS_LOG(LOG_VERB, "Joining VideoRoom fan-out worker thread\n");
+	janus_videoroom_fanout_job *job = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		job = g_async_queue_pop(queue);
+		if(job == &fanout_exit_job)
+			break;
+		guint i = 0;
+		for(i=job->first; i<job->last; i++) {
+			janus_videoroom_subscriber *subscriber = job->subscribers->list[i];
+			if(g_atomic_int_get(&subscriber->destroyed) || g_atomic_int_get(&subscriber->session->destroyed))
+				continue;
+			janus_videoroom_relay_rtp_packet(subscriber, &job->packet);
+		}
+		janus_videoroom_fanout_job_free(job);
+	}
+	/* Get rid of packets we didn't get to relay */
+	while((job = g_async_queue_try_pop(queue)) != NULL)
+		janus_videoroom_fanout_job_free(job);
+	JANUS_LOG(LOG_VERB, "Leaving VideoRoom fan-out worker thread\n");
+	return NULL;
 }
 
 static void janus_videoroom_publisher_destroy(janus_videoroom_publisher *p) {
@@ -1702,6 +2248,46 @@ static void janus_videoroom_publisher_destroy(janus_videoroom_publisher *p) {
 		janus_refcount_decrease(&p->ref);
 }
 
+/* Subscribers of the same publisher all get the same offer, except for the
+ * m-lines they may have asked not to receive: we render each of those
+ * variants only once, rather than parsing and writing the publisher SDP
+ * again for each new subscriber. Must be called with subscribers_mutex */
+static const char *janus_videoroom_publisher_offer_get(janus_videoroom_publisher *p, janus_videoroom_subscriber *s) {
+	if(p->sdp == NULL)
+		return NULL;
+	gboolean no_audio = p->audio && !s->audio_offered,
+		no_video = p->video && !s->video_offered,
+		no_data = p->data && !s->data_offered;
+	int variant = (no_audio ? 1 : 0) | (no_video ? 2 : 0) | (no_data ? 4 : 0);
+	if(p->subscriber_offers[variant] == NULL) {
+		janus_sdp *offer = janus_sdp_parse(p->sdp, NULL, 0);
+		if(offer == NULL)
+			return NULL;
+		offer->o_version = 1;
+		if(variant) {
+			JANUS_LOG(LOG_VERB, "Munging SDP offer to adapt it to the subscriber's requirements\n");
+			if(no_audio)
+				janus_sdp_mline_remove(offer, JANUS_SDP_AUDIO);
+			if(no_video)
+				janus_sdp_mline_remove(offer, JANUS_SDP_VIDEO);
+			if(no_data)
+				janus_sdp_mline_remove(offer, JANUS_SDP_APPLICATION);
+		}
+		p->subscriber_offers[variant] = janus_sdp_write(offer);
+		janus_sdp_destroy(offer);
+	}
+	return p->subscriber_offers[variant];
+}
+
+/* Get rid of the cached subscriber offers, e.g., because the publisher SDP changed */
+static void janus_videoroom_publisher_offers_clear(janus_videoroom_publisher *p) {
+	int i = 0;
+	for(i=0; i<8; i++) {
+		g_free(p->subscriber_offers[i]);
+		p->subscriber_offers[i] = NULL;
+	}
+}
+
 static void janus_videoroom_publisher_free(const janus_refcount *p_ref) {
 	janus_videoroom_publisher *p = janus_refcount_containerof(p_ref, janus_videoroom_publisher, ref);
 	g_free(p->room_id_str);
@@ -1721,9 +2307,32 @@ static void janus_videoroom_publisher_free(const janus_refcount *p_ref) {
 	g_hash_table_destroy(p->srtp_contexts);
 	p->srtp_contexts = NULL;
 	g_slist_free(p->subscribers);
-
+	janus_videoroom_publisher_offers_clear(p);
+	if(p->subscribers_snapshot)
+		janus_refcount_decrease(&p->subscribers_snapshot->ref);
+	if(p->rtp_subscribers)
+		janus_refcount_decrease(&p->rtp_subscribers->ref);
+
+	janus_videoroom_keyframe_reset(p);
+	janus_mutex_destroy(&p->keyframe.mutex);
+	janus_mutex_destroy(&p->pli_mutex);
+	if(p->data_batch != NULL)
+		g_byte_array_free(p->data_batch, TRUE);
+	janus_mutex_destroy(&p->data_mutex);
 	janus_mutex_destroy(&p->subscribers_mutex);
 	janus_mutex_destroy(&p->rtp_forwarders_mutex);
+	if(p->remote != NULL) {
+		if(p->remote->audio_fd > -1)
+			close(p->remote->audio_fd);
+		if(p->remote->video_fd > -1)
+			close(p->remote->video_fd);
+		if(p->remote->video_rtcp_fd > -1)
+			close(p->remote->video_rtcp_fd);
+		janus_mutex_destroy(&p->remote->mutex);
+		g_free(p->remote);
+		/* Remote publishers own their (fake) session */
+		janus_refcount_decrease(&p->session->ref);
+	}
 	g_free(p);
 }
 
@@ -1734,8 +2343,9 @@ static void janus_videoroom_session_destroy(janus_videoroom_session *session) {
 
 static void janus_videoroom_session_free(const janus_refcount *session_ref) {
 	janus_videoroom_session *session = janus_refcount_containerof(session_ref, janus_videoroom_session, ref);
-	/* Remove the reference to the core plugin session */
-	janus_refcount_decrease(&session->handle->ref);
+	/* Remove the reference to the core plugin session, if any */
+	if(session->handle != NULL)
+		janus_refcount_decrease(&session->handle->ref);
 	/* This session can be destroyed, free all the resources */
 	janus_mutex_destroy(&session->mutex);
 	g_free(session);
@@ -1763,9 +2373,15 @@ static void janus_videoroom_room_free(const janus_refcount *room_ref) {
 	g_hash_table_destroy(room->participants);
 	g_hash_table_destroy(room->private_ids);
 	g_hash_table_destroy(room->allowed);
+	g_list_free_full(room->speakers, (GDestroyNotify)janus_videoroom_publisher_dereference);
 	g_free(room);
 }
 
+/* Queue an asynchronous request on the right handler thread: we pick it
+ * from the room the request refers to, if any, or keep on using the
+ * thread that handled the previous requests from the same session */
+static void janus_videoroom_message_enqueue(janus_videoroom_session *session, janus_videoroom_message *msg);
+
 static void janus_videoroom_message_free(janus_videoroom_message *msg) {
 	if(!msg || msg == &exit_message)
 		return;
@@ -1818,14 +2434,125 @@ static void janus_videoroom_codecstr(janus_videoroom *videoroom, char *audio_cod
 static void janus_videoroom_reqpli(janus_videoroom_publisher *publisher, const char *reason) {
 	if(publisher == NULL)
 		return;
+	janus_videoroom *room = publisher->room;
+	if(room && room->pli_interval > 0) {
+		/* Make sure we don't send keyframe requests more often than we're allowed to:
+		 * if we sent one too recently, we only take note that another one is needed */
+		gint64 now = janus_get_monotonic_time();
+		janus_mutex_lock(&publisher->pli_mutex);
+		if(publisher->pli_latest > 0 && (now - publisher->pli_latest) < (gint64)room->pli_interval*1000) {
+			publisher->pli_pending = TRUE;
+			publisher->pli_suppressed++;
+			janus_mutex_unlock(&publisher->pli_mutex);
+			JANUS_LOG(LOG_HUGE, "%s: coalescing PLI to %s (%s)\n", reason,
+				publisher->user_id_str, publisher->display ? publisher->display : "??");
+			return;
+		}
+		publisher->pli_latest = now;
+		publisher->pli_pending = FALSE;
+		publisher->pli_forwarded++;
+		janus_mutex_unlock(&publisher->pli_mutex);
+	}
 	/* Send a PLI */
 	JANUS_LOG(LOG_VERB, "%s sending PLI to %s (%s)\n", reason,
 		publisher->user_id_str, publisher->display ? publisher->display : "??");
-	gateway->send_pli(publisher->session->handle);
+	if(publisher->remote != NULL) {
+		/* Remote publisher: send the PLI to the RTP forwarder feeding us */
+		janus_videoroom_remote_publisher *remote = publisher->remote;
+		char rtcpbuf[12];
+		janus_rtcp_pli((char *)&rtcpbuf, sizeof(rtcpbuf));
+		janus_mutex_lock(&remote->mutex);
+		if(remote->video_rtcp_fd > -1 && remote->rtcp_addrlen > 0) {
+			if(sendto(remote->video_rtcp_fd, rtcpbuf, sizeof(rtcpbuf), 0,
+					(struct sockaddr *)&remote->rtcp_addr, remote->rtcp_addrlen) < 0) {
+				JANUS_LOG(LOG_HUGE, "Error sending PLI to remote publisher %s... %s\n",
+					publisher->user_id_str, strerror(errno));
+			}
+		}
+		janus_mutex_unlock(&remote->mutex);
+	} else {
+		gateway->send_pli(publisher->session->handle);
+	}
 	/* Update the time of when we last sent a keyframe request */
 	publisher->fir_latest = janus_get_monotonic_time();
 }
 
+/* How long we need to have enough bandwidth for a higher simulcast layer before switching to it */
+#define JANUS_VIDEOROOM_BWE_UPSWITCH_DELAY	(3*G_USEC_PER_SEC)
+
+/* Pick the simulcast substream and temporal layer that best fit the estimated
+ * bandwidth of a subscriber: we switch down as soon as the current layer doesn't
+ * fit anymore, while we only switch up after having some headroom for a while */
+static void janus_videoroom_bwe_update(janus_videoroom_subscriber *s, janus_videoroom_publisher *p) {
+	if(s == NULL || p == NULL || s->bwe_estimate == 0)
+		return;
+	if(p->ssrc[0] == 0 && p->rid[0] == NULL)
+		return;
+	/* Build the list of layers we can choose from, from the lowest to the highest */
+	gboolean temporal = (p->vcodec == JANUS_VIDEOCODEC_VP8);
+	int tlmax = (s->bwe_templayer_max > 2 ? 2 : s->bwe_templayer_max);
+	uint32_t rates[5];
+	int substreams[5], templayers[5];
+	int levels = 0, i = 0, tl = 0;
+	for(i=0; i<3 && i<=s->bwe_substream_max; i++) {
+		if(p->sub_bitrate[i] == 0)
+			continue;	/* We're not receiving this substream */
+		if(i == 0 && temporal) {
+			/* On the lowest substream we can drop temporal layers too: we assume
+			 * the base layer takes about 40% of the bitrate, the first two 60% */
+			for(tl=0; tl<tlmax; tl++) {
+				rates[levels] = p->sub_bitrate[i] * (tl == 0 ? 40 : 60) / 100;
+				substreams[levels] = i;
+				templayers[levels] = tl;
+				levels++;
+			}
+		}
+		rates[levels] = p->sub_bitrate[i];
+		substreams[levels] = i;
+		templayers[levels] = tlmax;
+		levels++;
+	}
+	if(levels == 0)
+		return;
+	int cur = -1, down = 0, up = 0;
+	for(i=0; i<levels; i++) {
+		if(substreams[i] == s->sim_context.substream_target &&
+				(!temporal || templayers[i] == s->sim_context.templayer_target))
+			cur = i;
+		if(rates[i] <= s->bwe_estimate)
+			down = i;
+		if((guint64)rates[i]*5/4 <= s->bwe_estimate)
+			up = i;
+	}
+	int target = cur;
+	if(cur < 0 || down < cur) {
+		/* Not enough bandwidth for what we're sending, switch down right away */
+		target = down;
+		s->bwe_up_since = 0;
+	} else if(up > cur) {
+		/* There's room for more, but let's make sure it's not just a spike */
+		gint64 now = janus_get_monotonic_time();
+		if(s->bwe_up_since == 0)
+			s->bwe_up_since = now;
+		if(now - s->bwe_up_since >= JANUS_VIDEOROOM_BWE_UPSWITCH_DELAY) {
+			target = up;
+			s->bwe_up_since = 0;
+		}
+	} else {
+		s->bwe_up_since = 0;
+	}
+	if(target == cur)
+		return;
+	JANUS_LOG(LOG_VERB, "Estimated bandwidth for subscriber of %s is %"SCNu32", switching to substream %d, temporal layer %d\n",
+		p->user_id_str, s->bwe_estimate, substreams[target], templayers[target]);
+	if(temporal)
+		s->sim_context.templayer_target = templayers[target];
+	if(substreams[target] != s->sim_context.substream_target) {
+		s->sim_context.substream_target = substreams[target];
+		janus_videoroom_reqpli(p, "Bandwidth estimation substream change");
+	}
+}
+
 /* Error codes */
 #define JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR		499
 #define JANUS_VIDEOROOM_ERROR_NO_MESSAGE		421
@@ -1847,6 +2574,35 @@ static void janus_videoroom_reqpli(janus_videoroom_publisher *publisher, const c
 #define JANUS_VIDEOROOM_ERROR_INVALID_SDP		437
 
 
+/* Bind a socket to receive media from a remote publisher on (port 0 means any) */
+static int janus_videoroom_remote_publisher_bind(uint16_t *port) {
+	int fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd < 0) {
+		JANUS_LOG(LOG_ERR, "Error creating socket for remote publisher... %d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	int v6only = 0;
+	if(setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) != 0) {
+		JANUS_LOG(LOG_ERR, "Error creating socket for remote publisher... %d (%s)\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	struct sockaddr_in6 address = { 0 };
+	socklen_t len = sizeof(address);
+	address.sin6_family = AF_INET6;
+	address.sin6_port = htons(*port);
+	address.sin6_addr = in6addr_any;
+	if(bind(fd, (struct sockaddr *)&address, len) < 0 ||
+			getsockname(fd, (struct sockaddr *)&address, &len) < 0) {
+		JANUS_LOG(LOG_ERR, "Error binding socket for remote publisher (port %"SCNu16")... %d (%s)\n",
+			*port, errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	*port = ntohs(address.sin6_port);
+	return fd;
+}
+
 static guint32 janus_videoroom_rtp_forwarder_add_helper(janus_videoroom_publisher *p,
 		const gchar *host, int port, int rtcp_port, int pt, uint32_t ssrc,
 		gboolean simulcast, int srtp_suite, const char *srtp_crypto,
@@ -2095,7 +2851,6 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_print(config);
 
 	sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_videoroom_session_destroy);
-	messages = g_async_queue_new_full((GDestroyNotify) janus_videoroom_message_free);
 
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	gateway = callback;
@@ -2122,7 +2877,32 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "VideoRoom will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *fw = janus_config_get(config, config_general, janus_config_type_item, "fanout_workers");
+		if(fw != NULL && fw->value != NULL) {
+			int workers = atoi(fw->value);
+			if(workers < 0 || workers > 64) {
+				JANUS_LOG(LOG_WARN, "Invalid number of fan-out workers (%d), disabling them\n", workers);
+			} else {
+				fanout_workers = workers;
+			}
+		}
+		janus_config_item *ft = janus_config_get(config, config_general, janus_config_type_item, "forwarder_thread");
+		if(ft != NULL && ft->value != NULL && janus_is_true(ft->value))
+			forwarder_queue = g_async_queue_new_full((GDestroyNotify)janus_videoroom_forwarder_job_free);
+		janus_config_item *ht = janus_config_get(config, config_general, janus_config_type_item, "handler_threads");
+		if(ht != NULL && ht->value != NULL) {
+			int threads = atoi(ht->value);
+			if(threads < 1 || threads > 64) {
+				JANUS_LOG(LOG_WARN, "Invalid number of handler threads (%d), using 1\n", threads);
+			} else {
+				handler_threads = threads;
+			}
+		}
 	}
+	guint h = 0;
+	messages = g_malloc0(handler_threads * sizeof(GAsyncQueue *));
+	for(h=0; h<handler_threads; h++)
+		messages[h] = g_async_queue_new_full((GDestroyNotify) janus_videoroom_message_free);
 	rooms = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
 		(GDestroyNotify)g_free, (GDestroyNotify)janus_videoroom_room_destroy);
 	/* Iterate on all rooms */
@@ -2159,9 +2939,17 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *transport_wide_cc_ext = janus_config_get(config, cat, janus_config_type_item, "transport_wide_cc_ext");
 			janus_config_item *notify_joining = janus_config_get(config, cat, janus_config_type_item, "notify_joining");
 			janus_config_item *req_e2ee = janus_config_get(config, cat, janus_config_type_item, "require_e2ee");
+			janus_config_item *fanout = janus_config_get(config, cat, janus_config_type_item, "fanout");
+			janus_config_item *vkf = janus_config_get(config, cat, janus_config_type_item, "videobufferkf");
+			janus_config_item *pli_interval = janus_config_get(config, cat, janus_config_type_item, "pli_interval");
+			janus_config_item *simulcast_bwe = janus_config_get(config, cat, janus_config_type_item, "simulcast_bwe");
+			janus_config_item *active_speakers = janus_config_get(config, cat, janus_config_type_item, "active_speakers");
+			janus_config_item *last_n = janus_config_get(config, cat, janus_config_type_item, "last_n");
+			janus_config_item *data_coalesce = janus_config_get(config, cat, janus_config_type_item, "data_coalesce");
 			janus_config_item *record = janus_config_get(config, cat, janus_config_type_item, "record");
 			janus_config_item *rec_dir = janus_config_get(config, cat, janus_config_type_item, "rec_dir");
 			janus_config_item *lock_record = janus_config_get(config, cat, janus_config_type_item, "lock_record");
+			janus_config_item *record_filter = janus_config_get(config, cat, janus_config_type_item, "record_filter");
 			/* Create the video room */
 			janus_videoroom *videoroom = g_malloc0(sizeof(janus_videoroom));
 			const char *room_num = cat->name;
@@ -2292,12 +3080,12 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 				}
 			}
 			if(svc && svc->value && janus_is_true(svc->value)) {
-				if(videoroom->vcodec[0] == JANUS_VIDEOCODEC_VP9 &&
+				if((videoroom->vcodec[0] == JANUS_VIDEOCODEC_VP9 || videoroom->vcodec[0] == JANUS_VIDEOCODEC_AV1) &&
 						videoroom->vcodec[1] == JANUS_VIDEOCODEC_NONE &&
 						videoroom->vcodec[2] == JANUS_VIDEOCODEC_NONE) {
 					videoroom->do_svc = TRUE;
 				} else {
-					JANUS_LOG(LOG_WARN, "SVC is only supported, in an experimental way, for VP9 only rooms: disabling it...\n");
+					JANUS_LOG(LOG_WARN, "SVC is only supported, in an experimental way, for VP9 only or AV1 only rooms: disabling it...\n");
 				}
 			}
 			videoroom->audiolevel_ext = TRUE;
@@ -2342,11 +3130,25 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			if(lock_record && lock_record->value) {
 				videoroom->lock_record = janus_is_true(lock_record->value);
 			}
+			videoroom->record_filter = record_filter && record_filter->value && janus_is_true(record_filter->value);
 			/* By default, the VideoRoom plugin does not notify about participants simply joining the room.
 			   It only notifies when the participant actually starts publishing media. */
 			videoroom->notify_joining = FALSE;
 			if(notify_joining != NULL && notify_joining->value != NULL)
 				videoroom->notify_joining = janus_is_true(notify_joining->value);
+			videoroom->fanout = fanout && fanout->value && janus_is_true(fanout->value);
+			videoroom->videobufferkf = vkf && vkf->value && janus_is_true(vkf->value);
+			videoroom->pli_interval = 0;
+			if(pli_interval != NULL && pli_interval->value != NULL)
+				videoroom->pli_interval = atol(pli_interval->value);
+			videoroom->simulcast_bwe = simulcast_bwe && simulcast_bwe->value && janus_is_true(simulcast_bwe->value);
+			videoroom->active_speakers = 0;
+			if(active_speakers != NULL && active_speakers->value != NULL && atoi(active_speakers->value) > 0)
+				videoroom->active_speakers = atoi(active_speakers->value);
+			videoroom->last_n = last_n && last_n->value && janus_is_true(last_n->value);
+			videoroom->data_coalesce = 0;
+			if(data_coalesce != NULL && data_coalesce->value != NULL && atoi(data_coalesce->value) > 0)
+				videoroom->data_coalesce = atoi(data_coalesce->value);
 			g_atomic_int_set(&videoroom->destroyed, 0);
 			janus_mutex_init(&videoroom->mutex);
 			janus_refcount_init(&videoroom->ref, janus_videoroom_room_free);
@@ -2359,6 +3161,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			g_hash_table_insert(rooms,
 				string_ids ? (gpointer)g_strdup(videoroom->room_id_str) : (gpointer)janus_uint64_dup(videoroom->room_id),
 				videoroom);
+			g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 			janus_mutex_unlock(&rooms_mutex);
 			/* Compute a list of the supported codecs for the summary */
 			char audio_codecs[100], video_codecs[100];
@@ -2410,19 +3213,76 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		g_error_free(error);
 	}
 
+	/* Thread for feeding RTP forwarders, if enabled */
+	if(forwarder_queue != NULL) {
+		error = NULL;
+		forwarder_thread = g_thread_try_new("videoroom rtpfwd", janus_videoroom_forwarder_thread, NULL, &error);
+		if(error != NULL) {
+			/* We show the error but it's not fatal, we'll feed forwarders inline */
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom RTP forwarder thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_async_queue_unref(forwarder_queue);
+			forwarder_queue = NULL;
+		} else {
+			JANUS_LOG(LOG_INFO, "VideoRoom will feed RTP forwarders on a dedicated thread\n");
+		}
+	}
+
+	/* Threads for relaying packets to large audiences in parallel, if enabled */
+	if(fanout_workers > 0) {
+		fanout_threads = g_malloc0(fanout_workers * sizeof(GThread *));
+		fanout_queues = g_malloc0(fanout_workers * sizeof(GAsyncQueue *));
+		guint w = 0;
+		for(w=0; w<fanout_workers; w++) {
+			fanout_queues[w] = g_async_queue_new();
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "vroom fanout %u", w);
+			error = NULL;
+			fanout_threads[w] = g_thread_try_new(tname, janus_videoroom_fanout_thread, fanout_queues[w], &error);
+			if(error != NULL) {
+				/* Not fatal, but we'll have to relay everything serially */
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a VideoRoom fan-out thread, disabling fan-out...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				g_async_queue_unref(fanout_queues[w]);
+				fanout_queues[w] = NULL;
+				fanout_workers = w;
+				break;
+			}
+		}
+		if(fanout_workers > 0) {
+			JANUS_LOG(LOG_INFO, "VideoRoom will use %u fan-out workers for large audiences\n", fanout_workers);
+		}
+	}
+
 	g_atomic_int_set(&initialized, 1);
 
-	/* Launch the thread that will handle incoming messages */
-	error = NULL;
-	handler_thread = g_thread_try_new("videoroom handler", janus_videoroom_handler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom handler thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		janus_config_destroy(config);
-		return -1;
+	/* Launch the threads that will handle incoming messages */
+	handler_thread_list = g_malloc0(handler_threads * sizeof(GThread *));
+	for(h=0; h<handler_threads; h++) {
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "videoroom hdl %u", h);
+		error = NULL;
+		handler_thread_list[h] = g_thread_try_new(tname, janus_videoroom_handler, messages[h], &error);
+		if(error != NULL) {
+			g_atomic_int_set(&initialized, 0);
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom handler thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			guint i = 0;
+			for(i=0; i<h; i++) {
+				g_async_queue_push(messages[i], &exit_message);
+				g_thread_join(handler_thread_list[i]);
+			}
+			g_free(handler_thread_list);
+			handler_thread_list = NULL;
+			janus_config_destroy(config);
+			return -1;
+		}
 	}
+	if(handler_threads > 1)
+		JANUS_LOG(LOG_INFO, "VideoRoom will use %u handler threads\n", handler_threads);
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_VIDEOROOM_NAME);
 	return 0;
 }
@@ -2432,10 +3292,17 @@ void janus_videoroom_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	g_async_queue_push(messages, &exit_message);
-	if(handler_thread != NULL) {
-		g_thread_join(handler_thread);
-		handler_thread = NULL;
+	/* Wait for the threads of remote publishers, if any, to notice */
+	while(g_atomic_int_get(&remote_threads) > 0)
+		g_usleep(10000);
+	guint h = 0;
+	if(handler_thread_list != NULL) {
+		for(h=0; h<handler_threads; h++) {
+			g_async_queue_push(messages[h], &exit_message);
+			g_thread_join(handler_thread_list[h]);
+		}
+		g_free(handler_thread_list);
+		handler_thread_list = NULL;
 	}
 	if(rtcpfwd_thread != NULL) {
 		if(g_main_loop_is_running(rtcpfwd_loop)) {
@@ -2445,6 +3312,28 @@ void janus_videoroom_destroy(void) {
 		g_thread_join(rtcpfwd_thread);
 		rtcpfwd_thread = NULL;
 	}
+	if(forwarder_thread != NULL) {
+		g_async_queue_push(forwarder_queue, &forwarder_exit_job);
+		g_thread_join(forwarder_thread);
+		forwarder_thread = NULL;
+	}
+	if(forwarder_queue != NULL) {
+		g_async_queue_unref(forwarder_queue);
+		forwarder_queue = NULL;
+	}
+	if(fanout_threads != NULL) {
+		guint w = 0;
+		for(w=0; w<fanout_workers; w++) {
+			g_async_queue_push(fanout_queues[w], &fanout_exit_job);
+			g_thread_join(fanout_threads[w]);
+		}
+		for(w=0; w<fanout_workers; w++)
+			g_async_queue_unref(fanout_queues[w]);
+		g_free(fanout_threads);
+		fanout_threads = NULL;
+		g_free(fanout_queues);
+		fanout_queues = NULL;
+	}
 
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
@@ -2457,9 +3346,14 @@ void janus_videoroom_destroy(void) {
 	rooms = NULL;
 	janus_mutex_unlock(&rooms_mutex);
 
-	g_async_queue_unref(messages);
+	for(h=0; h<handler_threads; h++)
+		g_async_queue_unref(messages[h]);
+	g_free(messages);
 	messages = NULL;
+	handler_threads = 1;
 
+	/* Fold the permanent changes we journaled back into the configuration file */
+	janus_config_compact(config, config_folder, JANUS_VIDEOROOM_PACKAGE);
 	janus_config_destroy(config);
 	g_free(admin_key);
 
@@ -2536,19 +3430,25 @@ static janus_videoroom_publisher *janus_videoroom_session_get_publisher(janus_vi
 	return publisher;
 }
 
-static janus_videoroom_publisher *janus_videoroom_session_get_publisher_nodebug(janus_videoroom_session *session) {
-	janus_mutex_lock(&session->mutex);
-	janus_videoroom_publisher *publisher = (janus_videoroom_publisher *)session->participant;
-	if(publisher)
-		janus_refcount_increase_nodebug(&publisher->ref);
-	janus_mutex_unlock(&session->mutex);
-	return publisher;
+/* Borrow the publisher of a session from the media path: this doesn't lock
+ * the session or take a reference, as the publisher can't go away until it
+ * has been detached from the session and the borrowers are done with it
+ * (see janus_videoroom_destroy_session), and must always be paired with a
+ * call to janus_videoroom_session_release_publisher, even when NULL */
+static janus_videoroom_publisher *janus_videoroom_session_borrow_publisher(janus_videoroom_session *session) {
+	janus_refcount_guard_enter(&session->guard);
+	return (janus_videoroom_publisher *)g_atomic_pointer_get(&session->participant);
+}
+static void janus_videoroom_session_release_publisher(janus_videoroom_session *session) {
+	janus_refcount_guard_leave(&session->guard);
 }
 
 static void janus_videoroom_notify_participants(janus_videoroom_publisher *participant, json_t *msg, gboolean notify_source_participant) {
 	/* participant->room->mutex has to be locked. */
 	if(participant->room == NULL)
 		return;
+	/* The same event goes to everybody, so the core only serializes it once */
+	janus_plugin_event *event = janus_plugin_event_new(msg);
 	GHashTableIter iter;
 	gpointer value;
 	g_hash_table_iter_init(&iter, participant->room->participants);
@@ -2556,10 +3456,116 @@ static void janus_videoroom_notify_participants(janus_videoroom_publisher *parti
 		janus_videoroom_publisher *p = value;
 		if(p && p->session && (p != participant || notify_source_participant)) {
 			JANUS_LOG(LOG_VERB, "Notifying participant %s (%s)\n", p->user_id_str, p->display ? p->display : "??");
-			int ret = gateway->push_event(p->session->handle, &janus_videoroom_plugin, NULL, msg, NULL);
+			int ret = gateway->push_event_shared(p->session->handle, &janus_videoroom_plugin, NULL, event);
 			JANUS_LOG(LOG_VERB, "  >> %d (%s)\n", ret, janus_get_api_error(ret));
 		}
 	}
+	janus_plugin_event_unref(event);
+}
+
+static gint janus_videoroom_speaker_compare(gconstpointer a, gconstpointer b) {
+	/* Loudest first */
+	const janus_videoroom_publisher *pa = a, *pb = b;
+	guint la = pa->speaker_count ? pa->speaker_sum/pa->speaker_count : 0;
+	guint lb = pb->speaker_count ? pb->speaker_sum/pb->speaker_count : 0;
+	return (la > lb) ? -1 : ((la < lb) ? 1 : 0);
+}
+
+static gboolean janus_videoroom_speaker_publishing(janus_videoroom_publisher *p) {
+	return (p && p->sdp && p->session && !g_atomic_int_get(&p->destroyed) &&
+		g_atomic_int_get(&p->session->started));
+}
+
+/* Update the active speakers ranking of a room: whoever is talking right now
+ * comes first, loudest first, followed by who was in the ranking already; any
+ * slot left is filled with the other publishers. Participants are only
+ * notified when the ranking actually changes. room->mutex has to be locked. */
+static void janus_videoroom_speakers_update(janus_videoroom *room) {
+	if(room == NULL || room->active_speakers <= 0 || g_atomic_int_get(&room->destroyed))
+		return;
+	int threshold = room->audio_level_average > 0 ? room->audio_level_average : 25;
+	GList *talking = NULL, *ranking = NULL, *l = NULL;
+	int count = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, room->participants);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_videoroom_publisher *p = value;
+		if(!janus_videoroom_speaker_publishing(p) || p->speaker_count == 0)
+			continue;
+		/* We store levels as loudness (127-dBov), so that louder is higher */
+		int avg = 127 - (int)(p->speaker_sum/p->speaker_count);
+		if(avg < threshold)
+			talking = g_list_insert_sorted(talking, p, janus_videoroom_speaker_compare);
+	}
+	for(l = talking; l != NULL && count < room->active_speakers; l = l->next) {
+		ranking = g_list_append(ranking, l->data);
+		count++;
+	}
+	g_list_free(talking);
+	for(l = room->speakers; l != NULL && count < room->active_speakers; l = l->next) {
+		janus_videoroom_publisher *p = l->data;
+		if(g_list_find(ranking, p) || !janus_videoroom_speaker_publishing(p) ||
+				g_hash_table_lookup(room->participants, string_ids ? (gpointer)p->user_id_str : (gpointer)&p->user_id) != p)
+			continue;
+		ranking = g_list_append(ranking, p);
+		count++;
+	}
+	g_hash_table_iter_init(&iter, room->participants);
+	while(count < room->active_speakers && g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_videoroom_publisher *p = value;
+		if(!janus_videoroom_speaker_publishing(p) || g_list_find(ranking, p))
+			continue;
+		ranking = g_list_append(ranking, p);
+		count++;
+	}
+	/* Did anything change? */
+	GList *a = ranking, *b = room->speakers;
+	while(a != NULL && b != NULL && a->data == b->data) {
+		a = a->next;
+		b = b->next;
+	}
+	if(a == NULL && b == NULL) {
+		g_list_free(ranking);
+		return;
+	}
+	for(l = room->speakers; l != NULL; l = l->next) {
+		janus_videoroom_publisher *p = l->data;
+		g_atomic_int_set(&p->speaker_active, 0);
+	}
+	json_t *list = json_array();
+	for(l = ranking; l != NULL; l = l->next) {
+		janus_videoroom_publisher *p = l->data;
+		janus_refcount_increase(&p->ref);
+		if(room->last_n && !g_list_find(room->speakers, p)) {
+			/* We're going to relay this publisher's video again, we need a keyframe */
+			janus_videoroom_reqpli(p, "Back in the last-N");
+		}
+		g_atomic_int_set(&p->speaker_active, 1);
+		json_array_append_new(list, string_ids ? json_string(p->user_id_str) : json_integer(p->user_id));
+	}
+	g_list_free_full(room->speakers, (GDestroyNotify)janus_videoroom_publisher_dereference);
+	room->speakers = ranking;
+	JANUS_LOG(LOG_VERB, "Active speakers in room %s changed (%zu)\n", room->room_id_str, json_array_size(list));
+	json_t *event = json_object();
+	json_object_set_new(event, "videoroom", json_string("speakers"));
+	json_object_set_new(event, "room", string_ids ? json_string(room->room_id_str) : json_integer(room->room_id));
+	json_object_set_new(event, "speakers", list);
+	g_hash_table_iter_init(&iter, room->participants);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_videoroom_publisher *p = value;
+		if(p && p->session && p->session->handle)
+			gateway->push_event(p->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
+	}
+	/* Also notify event handlers */
+	if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
+		json_t *info = json_object();
+		json_object_set_new(info, "event", json_string("speakers"));
+		json_object_set_new(info, "room", string_ids ? json_string(room->room_id_str) : json_integer(room->room_id));
+		json_object_set_new(info, "speakers", json_deep_copy(list));
+		gateway->notify_event(&janus_videoroom_plugin, NULL, info);
+	}
+	json_decref(event);
 }
 
 static void janus_videoroom_participant_joining(janus_videoroom_publisher *p) {
@@ -2609,8 +3615,16 @@ static void janus_videoroom_leave_or_unpublish(janus_videoroom_publisher *partic
 	json_object_set_new(event, is_leaving ? (kicked ? "kicked" : "leaving") : "unpublished",
 		string_ids ? json_string(participant->user_id_str) : json_integer(participant->user_id));
 	janus_videoroom_notify_participants(participant, event, FALSE);
+	/* If this publisher was an active speaker, it isn't anymore */
+	GList *speaker = g_list_find(room->speakers, participant);
+	if(speaker != NULL) {
+		room->speakers = g_list_delete_link(room->speakers, speaker);
+		g_atomic_int_set(&participant->speaker_active, 0);
+		janus_refcount_decrease(&participant->ref);
+		room->speakers_latest = 0;
+	}
 	/* Also notify event handlers */
-	if(notify_events && gateway->events_is_enabled()) {
+	if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "event", json_string(is_leaving ? (kicked ? "kicked" : "leaving") : "unpublished"));
 		json_object_set_new(info, "room", string_ids ? json_string(participant->room_id_str) : json_integer(participant->room_id));
@@ -2657,8 +3671,10 @@ void janus_videoroom_destroy_session(janus_plugin_session *handle, int *error) {
 		janus_videoroom_publisher *p = (janus_videoroom_publisher *)session->participant;
 		if(p)
 			janus_refcount_increase(&p->ref);
-		session->participant = NULL;
+		g_atomic_pointer_set(&session->participant, NULL);
 		janus_mutex_unlock(&session->mutex);
+		/* Make sure the media path isn't using the publisher anymore */
+		janus_refcount_guard_wait(&session->guard);
 		if(p && p->room) {
 			janus_videoroom_leave_or_unpublish(p, TRUE, FALSE);
 		}
@@ -2678,6 +3694,14 @@ void janus_videoroom_destroy_session(janus_plugin_session *handle, int *error) {
 	return;
 }
 
+json_t *janus_videoroom_query_metrics(void) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return NULL;
+	json_t *metrics = json_object();
+	json_object_set_new(metrics, "rooms", json_integer(g_atomic_int_get(&rooms_count)));
+	return metrics;
+}
+
 json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -2737,6 +3761,12 @@ json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 				}
 				if(participant->e2ee)
 					json_object_set_new(info, "e2ee", json_true());
+				if(room->pli_interval > 0) {
+					janus_mutex_lock(&participant->pli_mutex);
+					json_object_set_new(info, "pli-forwarded", json_integer(participant->pli_forwarded));
+					json_object_set_new(info, "pli-suppressed", json_integer(participant->pli_suppressed));
+					janus_mutex_unlock(&participant->pli_mutex);
+				}
 				janus_refcount_decrease(&participant->ref);
 			}
 		} else if(session->participant_type == janus_videoroom_p_type_subscriber) {
@@ -2769,6 +3799,8 @@ json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 					json_object_set_new(simulcast, "temporal-layer-target", json_integer(participant->sim_context.templayer_target));
 					if(participant->sim_context.drop_trigger > 0)
 						json_object_set_new(simulcast, "fallback", json_integer(participant->sim_context.drop_trigger));
+					if(participant->room && participant->room->simulcast_bwe)
+						json_object_set_new(simulcast, "bwe-estimate", json_integer(participant->bwe_estimate));
 					json_object_set_new(info, "simulcast", simulcast);
 				}
 				if(participant->room && participant->room->do_svc) {
@@ -2959,9 +3991,17 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		json_t *playoutdelay_ext = json_object_get(root, "playoutdelay_ext");
 		json_t *transport_wide_cc_ext = json_object_get(root, "transport_wide_cc_ext");
 		json_t *notify_joining = json_object_get(root, "notify_joining");
+		json_t *fanout = json_object_get(root, "fanout");
+		json_t *vkf = json_object_get(root, "videobufferkf");
+		json_t *pli_interval = json_object_get(root, "pli_interval");
+		json_t *simulcast_bwe = json_object_get(root, "simulcast_bwe");
+		json_t *active_speakers = json_object_get(root, "active_speakers");
+		json_t *last_n = json_object_get(root, "last_n");
+		json_t *data_coalesce = json_object_get(root, "data_coalesce");
 		json_t *record = json_object_get(root, "record");
 		json_t *rec_dir = json_object_get(root, "rec_dir");
 		json_t *lock_record = json_object_get(root, "lock_record");
+		json_t *record_filter = json_object_get(root, "record_filter");
 		json_t *permanent = json_object_get(root, "permanent");
 		if(allowed) {
 			/* Make sure the "allowed" array only contains strings */
@@ -3143,12 +4183,12 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			}
 		}
 		if(svc && json_is_true(svc)) {
-			if(videoroom->vcodec[0] == JANUS_VIDEOCODEC_VP9 &&
+			if((videoroom->vcodec[0] == JANUS_VIDEOCODEC_VP9 || videoroom->vcodec[0] == JANUS_VIDEOCODEC_AV1) &&
 					videoroom->vcodec[1] == JANUS_VIDEOCODEC_NONE &&
 					videoroom->vcodec[2] == JANUS_VIDEOCODEC_NONE) {
 				videoroom->do_svc = TRUE;
 			} else {
-				JANUS_LOG(LOG_WARN, "SVC is only supported, in an experimental way, for VP9 only rooms: disabling it...\n");
+				JANUS_LOG(LOG_WARN, "SVC is only supported, in an experimental way, for VP9 only or AV1 only rooms: disabling it...\n");
 			}
 		}
 		videoroom->audiolevel_ext = audiolevel_ext ? json_is_true(audiolevel_ext) : TRUE;
@@ -3173,6 +4213,13 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		/* By default, the VideoRoom plugin does not notify about participants simply joining the room.
 		   It only notifies when the participant actually starts publishing media. */
 		videoroom->notify_joining = notify_joining ? json_is_true(notify_joining) : FALSE;
+		videoroom->fanout = fanout ? json_is_true(fanout) : FALSE;
+		videoroom->videobufferkf = vkf ? json_is_true(vkf) : FALSE;
+		videoroom->pli_interval = pli_interval ? json_integer_value(pli_interval) : 0;
+		videoroom->simulcast_bwe = simulcast_bwe ? json_is_true(simulcast_bwe) : FALSE;
+		videoroom->active_speakers = active_speakers ? json_integer_value(active_speakers) : 0;
+		videoroom->last_n = last_n ? json_is_true(last_n) : FALSE;
+		videoroom->data_coalesce = data_coalesce ? json_integer_value(data_coalesce) : 0;
 		if(record) {
 			videoroom->record = json_is_true(record);
 		}
@@ -3182,6 +4229,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		if(lock_record) {
 			videoroom->lock_record = json_is_true(lock_record);
 		}
+		videoroom->record_filter = record_filter ? json_is_true(record_filter) : FALSE;
 		g_atomic_int_set(&videoroom->destroyed, 0);
 		janus_mutex_init(&videoroom->mutex);
 		janus_refcount_init(&videoroom->ref, janus_videoroom_room_free);
@@ -3281,14 +4329,36 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			janus_config_add(config, c, janus_config_item_create("transport_wide_cc_ext", videoroom->transport_wide_cc_ext ? "yes" : "no"));
 			if(videoroom->notify_joining)
 				janus_config_add(config, c, janus_config_item_create("notify_joining", "yes"));
+			if(videoroom->fanout)
+				janus_config_add(config, c, janus_config_item_create("fanout", "yes"));
+			if(videoroom->videobufferkf)
+				janus_config_add(config, c, janus_config_item_create("videobufferkf", "yes"));
+			if(videoroom->pli_interval) {
+				g_snprintf(value, BUFSIZ, "%"SCNu16, videoroom->pli_interval);
+				janus_config_add(config, c, janus_config_item_create("pli_interval", value));
+			}
+			if(videoroom->simulcast_bwe)
+				janus_config_add(config, c, janus_config_item_create("simulcast_bwe", "yes"));
+			if(videoroom->active_speakers > 0) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->active_speakers);
+				janus_config_add(config, c, janus_config_item_create("active_speakers", value));
+				if(videoroom->last_n)
+					janus_config_add(config, c, janus_config_item_create("last_n", "yes"));
+			}
+			if(videoroom->data_coalesce) {
+				g_snprintf(value, BUFSIZ, "%"SCNu16, videoroom->data_coalesce);
+				janus_config_add(config, c, janus_config_item_create("data_coalesce", value));
+			}
 			if(videoroom->record)
 				janus_config_add(config, c, janus_config_item_create("record", "yes"));
 			if(videoroom->rec_dir)
 				janus_config_add(config, c, janus_config_item_create("rec_dir", videoroom->rec_dir));
 			if(videoroom->lock_record)
 				janus_config_add(config, c, janus_config_item_create("lock_record", "yes"));
-			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
+			if(videoroom->record_filter)
+				janus_config_add(config, c, janus_config_item_create("record_filter", "yes"));
+			/* Save the change (to the journal, rather than rewriting the whole file) */
+			if(janus_config_journal(config, config_folder, JANUS_VIDEOROOM_PACKAGE, cat) < 0)
 				save = FALSE;	/* This will notify the user the room is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -3296,6 +4366,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		g_hash_table_insert(rooms,
 			string_ids ? (gpointer)g_strdup(videoroom->room_id_str) : (gpointer)janus_uint64_dup(videoroom->room_id),
 			videoroom);
+		g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 		/* Show updated rooms list */
 		GHashTableIter iter;
 		gpointer value;
@@ -3312,7 +4383,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		json_object_set_new(response, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
 		json_object_set_new(response, "permanent", save ? json_true() : json_false());
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("created"));
 			json_object_set_new(info, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
@@ -3463,14 +4534,36 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			janus_config_add(config, c, janus_config_item_create("transport_wide_cc_ext", videoroom->transport_wide_cc_ext ? "yes" : "no"));
 			if(videoroom->notify_joining)
 				janus_config_add(config, c, janus_config_item_create("notify_joining", "yes"));
+			if(videoroom->fanout)
+				janus_config_add(config, c, janus_config_item_create("fanout", "yes"));
+			if(videoroom->videobufferkf)
+				janus_config_add(config, c, janus_config_item_create("videobufferkf", "yes"));
+			if(videoroom->pli_interval) {
+				g_snprintf(value, BUFSIZ, "%"SCNu16, videoroom->pli_interval);
+				janus_config_add(config, c, janus_config_item_create("pli_interval", value));
+			}
+			if(videoroom->simulcast_bwe)
+				janus_config_add(config, c, janus_config_item_create("simulcast_bwe", "yes"));
+			if(videoroom->active_speakers > 0) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->active_speakers);
+				janus_config_add(config, c, janus_config_item_create("active_speakers", value));
+				if(videoroom->last_n)
+					janus_config_add(config, c, janus_config_item_create("last_n", "yes"));
+			}
+			if(videoroom->data_coalesce) {
+				g_snprintf(value, BUFSIZ, "%"SCNu16, videoroom->data_coalesce);
+				janus_config_add(config, c, janus_config_item_create("data_coalesce", value));
+			}
 			if(videoroom->record)
 				janus_config_add(config, c, janus_config_item_create("record", "yes"));
 			if(videoroom->rec_dir)
 				janus_config_add(config, c, janus_config_item_create("rec_dir", videoroom->rec_dir));
 			if(videoroom->lock_record)
 				janus_config_add(config, c, janus_config_item_create("lock_record", "yes"));
-			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
+			if(videoroom->record_filter)
+				janus_config_add(config, c, janus_config_item_create("record_filter", "yes"));
+			/* Save the change (to the journal, rather than rewriting the whole file) */
+			if(janus_config_journal(config, config_folder, JANUS_VIDEOROOM_PACKAGE, cat) < 0)
 				save = FALSE;	/* This will notify the user the room changes are not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -3481,7 +4574,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		json_object_set_new(response, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
 		json_object_set_new(response, "permanent", save ? json_true() : json_false());
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("edited"));
 			json_object_set_new(info, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
@@ -3534,6 +4627,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		/* Remove room, but add a reference until we're done */
 		janus_refcount_increase(&videoroom->ref);
 		g_hash_table_remove(rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
+		g_atomic_int_set(&rooms_count, g_hash_table_size(rooms));
 		/* Notify all participants that the fun is over, and that they'll be kicked */
 		JANUS_LOG(LOG_VERB, "Notifying all participants\n");
 		json_t *destroyed = json_object();
@@ -3557,7 +4651,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		json_decref(destroyed);
 		janus_mutex_unlock(&videoroom->mutex);
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("destroyed"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3573,8 +4667,8 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			/* The room ID is the category (prefixed by "room-") */
 			g_snprintf(cat, BUFSIZ, "room-%s", room_id_str);
 			janus_config_remove(config, NULL, cat);
-			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
+			/* Save the change (to the journal, rather than rewriting the whole file) */
+			if(janus_config_journal(config, config_folder, JANUS_VIDEOROOM_PACKAGE, cat) < 0)
 				save = FALSE;	/* This will notify the user the room destruction is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -3631,6 +4725,17 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				json_object_set_new(rl, "require_pvtid", room->require_pvtid ? json_true() : json_false());
 				json_object_set_new(rl, "require_e2ee", room->require_e2ee ? json_true() : json_false());
 				json_object_set_new(rl, "notify_joining", room->notify_joining ? json_true() : json_false());
+				json_object_set_new(rl, "fanout", room->fanout ? json_true() : json_false());
+				json_object_set_new(rl, "videobufferkf", room->videobufferkf ? json_true() : json_false());
+				if(room->pli_interval > 0)
+					json_object_set_new(rl, "pli_interval", json_integer(room->pli_interval));
+				json_object_set_new(rl, "simulcast_bwe", room->simulcast_bwe ? json_true() : json_false());
+				if(room->active_speakers > 0) {
+					json_object_set_new(rl, "active_speakers", json_integer(room->active_speakers));
+					json_object_set_new(rl, "last_n", room->last_n ? json_true() : json_false());
+				}
+				if(room->data_coalesce > 0)
+					json_object_set_new(rl, "data_coalesce", json_integer(room->data_coalesce));
 				char audio_codecs[100];
 				char video_codecs[100];
 				janus_videoroom_codecstr(room, audio_codecs, video_codecs, sizeof(audio_codecs), ",");
@@ -3643,6 +4748,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				json_object_set_new(rl, "record", room->record ? json_true() : json_false());
 				json_object_set_new(rl, "rec_dir", json_string(room->rec_dir));
 				json_object_set_new(rl, "lock_record", room->lock_record ? json_true() : json_false());
+				json_object_set_new(rl, "record_filter", room->record_filter ? json_true() : json_false());
 				/* TODO: Should we list participants as well? or should there be a separate API call on a specific room for this? */
 				json_object_set_new(rl, "num_participants", json_integer(g_hash_table_size(room->participants)));
 				json_object_set_new(rl, "audiolevel_ext", room->audiolevel_ext ? json_true() : json_false());
@@ -3917,7 +5023,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			if(audio_rtcp_port > 0)
 				json_object_set_new(rtp_stream, "audio_rtcp", json_integer(audio_rtcp_port));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("rtp_forward"));
 				json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3939,7 +5045,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				if(video_rtcp_port > 0)
 					json_object_set_new(rtp_stream, "video_rtcp", json_integer(video_rtcp_port));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("rtp_forward"));
 					json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3958,7 +5064,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				json_object_set_new(rtp_stream, "video_stream_id_2", json_integer(video_handle[1]));
 				json_object_set_new(rtp_stream, "video_2", json_integer(video_port[1]));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("rtp_forward"));
 					json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3976,7 +5082,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				json_object_set_new(rtp_stream, "video_stream_id_3", json_integer(video_handle[2]));
 				json_object_set_new(rtp_stream, "video_3", json_integer(video_port[2]));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("rtp_forward"));
 					json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -3995,7 +5101,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			json_object_set_new(rtp_stream, "data_stream_id", json_integer(data_handle));
 			json_object_set_new(rtp_stream, "data", json_integer(data_port));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("rtp_forward"));
 				json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -4119,7 +5225,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		json_object_set_new(response, "publisher_id", string_ids ? json_string(publisher_id_str) : json_integer(publisher_id));
 		json_object_set_new(response, "stream_id", json_integer(stream_id));
 		/* Also notify event handlers */
-		if(notify_events && gateway->events_is_enabled()) {
+		if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("stop_rtp_forward"));
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -4404,8 +5510,9 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		/* Done */
 		janus_refcount_decrease(&videoroom->ref);
 		goto prepare_response;
-	} else if(!strcasecmp(request_text, "listparticipants")) {
-		/* List all participants in a room, specifying whether they're publishers or just attendees */
+	} else if(!strcasecmp(request_text, "add_remote_publisher") || !strcasecmp(request_text, "remove_remote_publisher")) {
+		gboolean add = !strcasecmp(request_text, "add_remote_publisher");
+		JANUS_LOG(LOG_VERB, "Attempt to %s a remote publisher in an existing VideoRoom room\n", add ? "add" : "remove");
 		if(!string_ids) {
 			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
 				error_code, error_cause, TRUE,
@@ -4415,9 +5522,36 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				error_code, error_cause, TRUE,
 				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 		}
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, id_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, idstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		JANUS_VALIDATE_JSON_OBJECT(root, remote_publisher_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 		if(error_code != 0)
 			goto prepare_response;
+		if(lock_rtpfwd && admin_key != NULL) {
+			/* Remote publishers are fed by RTP forwarders, so the same restrictions apply */
+			JANUS_VALIDATE_JSON_OBJECT(root, adminkey_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+			if(error_code != 0)
+				goto prepare_response;
+			JANUS_CHECK_SECRET(admin_key, root, "admin_key", error_code, error_cause,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT, JANUS_VIDEOROOM_ERROR_UNAUTHORIZED);
+			if(error_code != 0)
+				goto prepare_response;
+		}
 		json_t *room = json_object_get(root, "room");
+		json_t *id = json_object_get(root, "id");
 		guint64 room_id = 0;
 		char room_id_num[30], *room_id_str = NULL;
 		if(!string_ids) {
@@ -4427,13 +5561,307 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		janus_mutex_lock(&rooms_mutex);
-		janus_videoroom *videoroom = NULL;
-		error_code = janus_videoroom_access_room(root, FALSE, FALSE, &videoroom, error_cause, sizeof(error_cause));
-		janus_mutex_unlock(&rooms_mutex);
-		if(error_code != 0)
-			goto prepare_response;
-		janus_refcount_increase(&videoroom->ref);
+		guint64 user_id = 0;
+		char user_id_num[30], *user_id_str = NULL;
+		if(!string_ids) {
+			user_id = json_integer_value(id);
+			g_snprintf(user_id_num, sizeof(user_id_num), "%"SCNu64, user_id);
+			user_id_str = user_id_num;
+		} else {
+			user_id_str = (char *)json_string_value(id);
+		}
+		janus_mutex_lock(&rooms_mutex);
+		janus_videoroom *videoroom = NULL;
+		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
+		if(error_code != 0) {
+			janus_mutex_unlock(&rooms_mutex);
+			goto prepare_response;
+		}
+		janus_refcount_increase(&videoroom->ref);
+		janus_mutex_unlock(&rooms_mutex);
+		janus_mutex_lock(&videoroom->mutex);
+		/* A secret may be required for this action */
+		JANUS_CHECK_SECRET(videoroom->room_secret, root, "secret", error_code, error_cause,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT, JANUS_VIDEOROOM_ERROR_UNAUTHORIZED);
+		if(error_code != 0) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			goto prepare_response;
+		}
+		janus_videoroom_publisher *publisher = g_hash_table_lookup(videoroom->participants,
+			string_ids ? (gpointer)user_id_str : (gpointer)&user_id);
+		if(!add) {
+			if(publisher == NULL || publisher->remote == NULL) {
+				janus_mutex_unlock(&videoroom->mutex);
+				janus_refcount_decrease(&videoroom->ref);
+				JANUS_LOG(LOG_ERR, "No such remote publisher %s in room %s\n", user_id_str, room_id_str);
+				error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
+				g_snprintf(error_cause, 512, "No such remote publisher %s in room %s", user_id_str, room_id_str);
+				goto prepare_response;
+			}
+			/* The thread receiving the media will take care of the rest */
+			g_atomic_int_set(&publisher->remote->stop, 1);
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			JANUS_LOG(LOG_INFO, "Removing remote publisher %s from room %s\n", user_id_str, room_id_str);
+			response = json_object();
+			json_object_set_new(response, "videoroom", json_string("success"));
+			goto prepare_response;
+		}
+		if(publisher != NULL) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			error_code = JANUS_VIDEOROOM_ERROR_ID_EXISTS;
+			JANUS_LOG(LOG_ERR, "User ID %s already exists\n", user_id_str);
+			g_snprintf(error_cause, 512, "User ID %s already exists", user_id_str);
+			goto prepare_response;
+		}
+		json_t *display = json_object_get(root, "display");
+		json_t *audio = json_object_get(root, "audio");
+		json_t *video = json_object_get(root, "video");
+		json_t *audiocodec = json_object_get(root, "audiocodec");
+		json_t *videocodec = json_object_get(root, "videocodec");
+		gboolean do_audio = audio ? json_is_true(audio) : TRUE;
+		gboolean do_video = video ? json_is_true(video) : TRUE;
+		janus_audiocodec acodec = videoroom->acodec[0];
+		janus_videocodec vcodec = videoroom->vcodec[0];
+		if(audiocodec) {
+			acodec = janus_audiocodec_from_name(json_string_value(audiocodec));
+			if(acodec == JANUS_AUDIOCODEC_NONE || (acodec != videoroom->acodec[0] &&
+					acodec != videoroom->acodec[1] && acodec != videoroom->acodec[2]))
+				error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+		}
+		if(videocodec) {
+			vcodec = janus_videocodec_from_name(json_string_value(videocodec));
+			if(vcodec == JANUS_VIDEOCODEC_NONE || (vcodec != videoroom->vcodec[0] &&
+					vcodec != videoroom->vcodec[1] && vcodec != videoroom->vcodec[2]))
+				error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+		}
+		if(error_code != 0 || (!do_audio && !do_video)) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			JANUS_LOG(LOG_ERR, "Invalid media or codecs for remote publisher %s\n", user_id_str);
+			g_snprintf(error_cause, 512, "Invalid media or codecs for remote publisher %s", user_id_str);
+			goto prepare_response;
+		}
+		/* Bind the sockets we'll receive media on */
+		janus_videoroom_remote_publisher *remote = g_malloc0(sizeof(janus_videoroom_remote_publisher));
+		remote->audio_fd = -1;
+		remote->video_fd = -1;
+		remote->video_rtcp_fd = -1;
+		janus_mutex_init(&remote->mutex);
+		json_t *port = json_object_get(root, "audio_port");
+		remote->audio_port = port ? json_integer_value(port) : 0;
+		port = json_object_get(root, "video_port");
+		remote->video_port = port ? json_integer_value(port) : 0;
+		port = json_object_get(root, "video_rtcp_port");
+		remote->video_rtcp_port = port ? json_integer_value(port) : 0;
+		if((do_audio && (remote->audio_fd = janus_videoroom_remote_publisher_bind(&remote->audio_port)) < 0) ||
+				(do_video && (remote->video_fd = janus_videoroom_remote_publisher_bind(&remote->video_port)) < 0) ||
+				(do_video && (remote->video_rtcp_fd = janus_videoroom_remote_publisher_bind(&remote->video_rtcp_port)) < 0)) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			if(remote->audio_fd > -1)
+				close(remote->audio_fd);
+			if(remote->video_fd > -1)
+				close(remote->video_fd);
+			janus_mutex_destroy(&remote->mutex);
+			g_free(remote);
+			error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "Could not bind sockets for remote publisher %s", user_id_str);
+			goto prepare_response;
+		}
+		/* Remote publishers don't have a handle, so we create a session just for them */
+		janus_videoroom_session *rsession = g_malloc0(sizeof(janus_videoroom_session));
+		rsession->handle = NULL;
+		rsession->participant_type = janus_videoroom_p_type_publisher;
+		g_atomic_int_set(&rsession->started, 1);
+		janus_mutex_init(&rsession->mutex);
+		janus_refcount_init(&rsession->ref, janus_videoroom_session_free);
+		publisher = g_malloc0(sizeof(janus_videoroom_publisher));
+		publisher->session = rsession;
+		publisher->remote = remote;
+		publisher->room_id = videoroom->room_id;
+		publisher->room_id_str = videoroom->room_id_str ? g_strdup(videoroom->room_id_str) : NULL;
+		janus_refcount_increase(&videoroom->ref);
+		publisher->room = videoroom;
+		publisher->user_id = user_id;
+		publisher->user_id_str = g_strdup(user_id_str);
+		publisher->display = display ? g_strdup(json_string_value(display)) : NULL;
+		publisher->audio = do_audio;
+		publisher->video = do_video;
+		publisher->acodec = do_audio ? acodec : JANUS_AUDIOCODEC_NONE;
+		publisher->vcodec = do_video ? vcodec : JANUS_VIDEOCODEC_NONE;
+		publisher->audio_pt = do_audio ? janus_audiocodec_pt(acodec) : -1;
+		publisher->video_pt = do_video ? janus_videocodec_pt(vcodec) : -1;
+		publisher->audio_active = do_audio;
+		publisher->video_active = do_video;
+		janus_mutex_init(&publisher->rec_mutex);
+		janus_mutex_init(&publisher->keyframe.mutex);
+		janus_mutex_init(&publisher->pli_mutex);
+		janus_mutex_init(&publisher->data_mutex);
+		publisher->bitrate = videoroom->bitrate;
+		janus_mutex_init(&publisher->subscribers_mutex);
+		janus_mutex_init(&publisher->own_subscriptions_mutex);
+		janus_mutex_init(&publisher->rtp_forwarders_mutex);
+		publisher->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_videoroom_rtp_forwarder_destroy);
+		publisher->srtp_contexts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_videoroom_srtp_context_free);
+		publisher->udp_sock = -1;
+		if(do_video) {
+			/* If we know the SSRCs of the substreams, the remote publisher is simulcasting */
+			json_t *ssrc = json_object_get(root, "video_ssrc");
+			json_t *ssrc2 = json_object_get(root, "video_ssrc_2");
+			json_t *ssrc3 = json_object_get(root, "video_ssrc_3");
+			publisher->video_ssrc = ssrc ? json_integer_value(ssrc) : 0;
+			if(ssrc && ssrc2 && (vcodec == JANUS_VIDEOCODEC_VP8 || vcodec == JANUS_VIDEOCODEC_H264)) {
+				publisher->ssrc[0] = json_integer_value(ssrc);
+				publisher->ssrc[1] = json_integer_value(ssrc2);
+				publisher->ssrc[2] = ssrc3 ? json_integer_value(ssrc3) : 0;
+			}
+		}
+		while(publisher->pvt_id == 0) {
+			publisher->pvt_id = janus_random_uint32();
+			if(g_hash_table_lookup(videoroom->private_ids, GUINT_TO_POINTER(publisher->pvt_id)) != NULL) {
+				/* Private ID already taken, try another one */
+				publisher->pvt_id = 0;
+			}
+		}
+		g_hash_table_insert(videoroom->private_ids, GUINT_TO_POINTER(publisher->pvt_id), publisher);
+		janus_refcount_init(&publisher->ref, janus_videoroom_publisher_free);
+		rsession->participant = publisher;
+		/* Prepare the SDP we'll offer subscribers, as we'd do for local publishers */
+		char s_name[100];
+		g_snprintf(s_name, sizeof(s_name), "VideoRoom %s", videoroom->room_id_str);
+		char video_fmtp[100], *video_profile = NULL;
+		if(vcodec == JANUS_VIDEOCODEC_VP9 && videoroom->vp9_profile) {
+			g_snprintf(video_fmtp, sizeof(video_fmtp), "profile-id=%s", videoroom->vp9_profile);
+			video_profile = video_fmtp;
+		} else if(vcodec == JANUS_VIDEOCODEC_H264 && videoroom->h264_profile) {
+			g_snprintf(video_fmtp, sizeof(video_fmtp), "profile-level-id=%s;packetization-mode=1", videoroom->h264_profile);
+			video_profile = video_fmtp;
+		}
+		janus_sdp *offer = janus_sdp_generate_offer(s_name, "127.0.0.1",
+			JANUS_SDP_OA_AUDIO, do_audio,
+			JANUS_SDP_OA_AUDIO_CODEC, janus_audiocodec_name(acodec),
+			JANUS_SDP_OA_AUDIO_PT, janus_audiocodec_pt(acodec),
+			JANUS_SDP_OA_AUDIO_DIRECTION, JANUS_SDP_SENDONLY,
+			JANUS_SDP_OA_AUDIO_EXTENSION, JANUS_RTP_EXTMAP_MID, 1,
+			JANUS_SDP_OA_VIDEO, do_video,
+			JANUS_SDP_OA_VIDEO_CODEC, janus_videocodec_name(vcodec),
+			JANUS_SDP_OA_VIDEO_PT, janus_videocodec_pt(vcodec),
+			JANUS_SDP_OA_VIDEO_FMTP, video_profile,
+			JANUS_SDP_OA_VIDEO_DIRECTION, JANUS_SDP_SENDONLY,
+			JANUS_SDP_OA_VIDEO_EXTENSION, JANUS_RTP_EXTMAP_MID, 1,
+			JANUS_SDP_OA_VIDEO_EXTENSION, JANUS_RTP_EXTMAP_TRANSPORT_WIDE_CC,
+				videoroom->transport_wide_cc_ext ? 2 : 0,
+			JANUS_SDP_OA_DATA, FALSE,
+			JANUS_SDP_OA_DONE);
+		publisher->sdp = janus_sdp_write(offer);
+		janus_sdp_destroy(offer);
+		if(video_profile != NULL)
+			publisher->vfmtp = g_strdup(video_profile);
+		janus_refcount_increase(&publisher->ref);
+		g_hash_table_insert(videoroom->participants,
+			string_ids ? (gpointer)g_strdup(publisher->user_id_str) : (gpointer)janus_uint64_dup(publisher->user_id),
+			publisher);
+		/* Notify all other participants that there's a new boy in town */
+		json_t *list = json_array();
+		json_t *pl = json_object();
+		json_object_set_new(pl, "id", string_ids ? json_string(publisher->user_id_str) : json_integer(publisher->user_id));
+		if(publisher->display)
+			json_object_set_new(pl, "display", json_string(publisher->display));
+		if(publisher->audio)
+			json_object_set_new(pl, "audio_codec", json_string(janus_audiocodec_name(publisher->acodec)));
+		if(publisher->video)
+			json_object_set_new(pl, "video_codec", json_string(janus_videocodec_name(publisher->vcodec)));
+		if(publisher->ssrc[0])
+			json_object_set_new(pl, "simulcast", json_true());
+		json_array_append_new(list, pl);
+		json_t *pub = json_object();
+		json_object_set_new(pub, "videoroom", json_string("event"));
+		json_object_set_new(pub, "room", string_ids ? json_string(publisher->room_id_str) : json_integer(publisher->room_id));
+		json_object_set_new(pub, "publishers", list);
+		janus_videoroom_notify_participants(publisher, pub, FALSE);
+		json_decref(pub);
+		janus_mutex_unlock(&videoroom->mutex);
+		/* Also notify event handlers */
+		if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
+			json_t *info = json_object();
+			json_object_set_new(info, "event", json_string("published"));
+			json_object_set_new(info, "room", string_ids ? json_string(publisher->room_id_str) : json_integer(publisher->room_id));
+			json_object_set_new(info, "id", string_ids ? json_string(publisher->user_id_str) : json_integer(publisher->user_id));
+			json_object_set_new(info, "remote", json_true());
+			json_object_set_new(info, "audio_codec", json_string(janus_audiocodec_name(publisher->acodec)));
+			json_object_set_new(info, "video_codec", json_string(janus_videocodec_name(publisher->vcodec)));
+			gateway->notify_event(&janus_videoroom_plugin, NULL, info);
+		}
+		/* Start the thread that will receive the media */
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "vroom remote %"SCNu32, publisher->pvt_id % 1000);
+		janus_refcount_increase(&publisher->ref);
+		g_atomic_int_inc(&remote_threads);
+		GThread *thread = g_thread_try_new(tname, janus_videoroom_remote_publisher_thread, publisher, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the remote publisher thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			/* Get rid of the remote publisher right away */
+			g_atomic_int_set(&remote->stop, 1);
+			janus_videoroom_remote_publisher_thread(publisher);
+			janus_refcount_decrease(&videoroom->ref);
+			error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "Could not start the thread for remote publisher %s", user_id_str);
+			goto prepare_response;
+		}
+		g_thread_unref(thread);
+		JANUS_LOG(LOG_INFO, "Added remote publisher %s to room %s (ports %"SCNu16"/%"SCNu16"/%"SCNu16")\n",
+			user_id_str, room_id_str, remote->audio_port, remote->video_port, remote->video_rtcp_port);
+		/* Prepare response */
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("success"));
+		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
+		json_object_set_new(response, "id", string_ids ? json_string(user_id_str) : json_integer(user_id));
+		if(do_audio)
+			json_object_set_new(response, "audio_port", json_integer(remote->audio_port));
+		if(do_video) {
+			json_object_set_new(response, "video_port", json_integer(remote->video_port));
+			json_object_set_new(response, "video_rtcp_port", json_integer(remote->video_rtcp_port));
+		}
+		/* Done */
+		janus_refcount_decrease(&videoroom->ref);
+		goto prepare_response;
+	} else if(!strcasecmp(request_text, "listparticipants")) {
+		/* List all participants in a room, specifying whether they're publishers or just attendees */
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		json_t *room = json_object_get(root, "room");
+		guint64 room_id = 0;
+		char room_id_num[30], *room_id_str = NULL;
+		if(!string_ids) {
+			room_id = json_integer_value(room);
+			g_snprintf(room_id_num, sizeof(room_id_num), "%"SCNu64, room_id);
+			room_id_str = room_id_num;
+		} else {
+			room_id_str = (char *)json_string_value(room);
+		}
+		janus_mutex_lock(&rooms_mutex);
+		janus_videoroom *videoroom = NULL;
+		error_code = janus_videoroom_access_room(root, FALSE, FALSE, &videoroom, error_cause, sizeof(error_cause));
+		janus_mutex_unlock(&rooms_mutex);
+		if(error_code != 0)
+			goto prepare_response;
+		janus_refcount_increase(&videoroom->ref);
 		/* Return a list of all participants (whether they're publishing or not) */
 		json_t *list = json_array();
 		GHashTableIter iter;
@@ -4447,6 +5875,8 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			if(p->display)
 				json_object_set_new(pl, "display", json_string(p->display));
 			json_object_set_new(pl, "publisher", (p->sdp && g_atomic_int_get(&p->session->started)) ? json_true() : json_false());
+			if(p->remote)
+				json_object_set_new(pl, "remote", json_true());
 			if(p->sdp && g_atomic_int_get(&p->session->started)) {
 				if(p->audio_level_extmap_id > 0)
 					json_object_set_new(pl, "talking", p->talking ? json_true() : json_false());
@@ -4717,7 +6147,7 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		msg->transaction = transaction;
 		msg->message = root;
 		msg->jsep = jsep;
-		g_async_queue_push(messages, msg);
+		janus_videoroom_message_enqueue(session, msg);
 
 		return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 	} else {
@@ -4766,7 +6196,21 @@ json_t *janus_videoroom_handle_admin_message(json_t *message) {
 		goto admin_response;
 	json_t *request = json_object_get(message, "request");
 	const char *request_text = json_string_value(request);
-	if((response = janus_videoroom_process_synchronous_request(NULL, message)) != NULL) {
+	if(!strcasecmp(request_text, "handlers")) {
+		/* Return how many requests each handler thread has to process */
+		json_t *list = json_array();
+		guint h = 0;
+		for(h=0; h<handler_threads; h++) {
+			json_t *hl = json_object();
+			json_object_set_new(hl, "id", json_integer(h));
+			json_object_set_new(hl, "queue", json_integer(MAX(0, g_async_queue_length(messages[h]))));
+			json_array_append_new(list, hl);
+		}
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("handlers"));
+		json_object_set_new(response, "handlers", list);
+		goto admin_response;
+	} else if((response = janus_videoroom_process_synchronous_request(NULL, message)) != NULL) {
 		/* We got a response, send it back */
 		goto admin_response;
 	} else {
@@ -4841,7 +6285,7 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 			}
 			json_decref(pub);
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("published"));
 				json_object_set_new(info, "room", string_ids ? json_string(participant->room_id_str) : json_integer(participant->room_id));
@@ -4856,9 +6300,20 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 			if(s && s->feed) {
 				janus_videoroom_publisher *p = s->feed;
 				if(p && p->session) {
-					janus_videoroom_reqpli(p, "New subscriber available");
+					gboolean buffered = FALSE;
+					if(p->room && p->room->videobufferkf) {
+						janus_mutex_lock(&p->keyframe.mutex);
+						buffered = (p->keyframe.latest[0] || p->keyframe.latest[1] || p->keyframe.latest[2]);
+						janus_mutex_unlock(&p->keyframe.mutex);
+						if(buffered)
+							g_atomic_int_set(&s->keyframe_replay, 1);
+					}
+					/* If we have a keyframe to send already, we only send a PLI if we
+					 * didn't recently, to avoid keyframe storms when many people join */
+					if(!buffered || (janus_get_monotonic_time() - p->fir_latest) >= G_USEC_PER_SEC)
+						janus_videoroom_reqpli(p, "New subscriber available");
 					/* Also notify event handlers */
-					if(notify_events && gateway->events_is_enabled()) {
+					if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 						json_t *info = json_object();
 						json_object_set_new(info, "event", json_string("subscribed"));
 						json_object_set_new(info, "room", string_ids ? json_string(p->room_id_str) : json_integer(p->room_id));
@@ -4878,18 +6333,225 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 	janus_videoroom_session *session = (janus_videoroom_session *)handle->plugin_handle;
 	if(!session || g_atomic_int_get(&session->destroyed) || session->participant_type != janus_videoroom_p_type_publisher)
 		return;
-	janus_videoroom_publisher *participant = janus_videoroom_session_get_publisher_nodebug(session);
-	if(participant == NULL)
+	janus_videoroom_publisher *participant = janus_videoroom_session_borrow_publisher(session);
+	if(participant == NULL || g_atomic_int_get(&participant->destroyed) || participant->kicked || participant->room == NULL) {
+		janus_videoroom_session_release_publisher(session);
+		return;
+	}
+	janus_videoroom_incoming_rtp_internal(session, participant, pkt);
+	janus_videoroom_session_release_publisher(session);
+}
+
+void janus_videoroom_incoming_rtp_batch(janus_plugin_session *handle, janus_plugin_rtp **packets, int count) {
+	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	janus_videoroom_session *session = (janus_videoroom_session *)handle->plugin_handle;
+	if(!session || g_atomic_int_get(&session->destroyed) || session->participant_type != janus_videoroom_p_type_publisher)
 		return;
-	if(g_atomic_int_get(&participant->destroyed) || participant->kicked || participant->room == NULL) {
-		janus_videoroom_publisher_dereference_nodebug(participant);
+	/* Same as above, but we only look up the publisher once for the whole batch */
+	janus_videoroom_publisher *participant = janus_videoroom_session_borrow_publisher(session);
+	int i = 0;
+	for(i=0; participant != NULL && i<count; i++) {
+		if(g_atomic_int_get(&participant->destroyed) || participant->kicked || participant->room == NULL)
+			break;
+		janus_videoroom_incoming_rtp_internal(session, participant, packets[i]);
+	}
+	janus_videoroom_session_release_publisher(session);
+}
+
+/* RTP forwarders of a publisher are fed in batches: each forwarder gets its
+ * own copy of the RTP header, which it may need to rewrite, while the rest of
+ * the packet is shared; the whole batch is then sent with a single sendmmsg */
+#define JANUS_VIDEOROOM_FORWARDER_BATCH	16
+typedef struct janus_videoroom_rtp_forwarder_batch {
+	int count;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[JANUS_VIDEOROOM_FORWARDER_BATCH];
+#else
+	struct msghdr msgs[JANUS_VIDEOROOM_FORWARDER_BATCH];
+#endif
+	struct iovec iovecs[JANUS_VIDEOROOM_FORWARDER_BATCH][2];
+	janus_rtp_header headers[JANUS_VIDEOROOM_FORWARDER_BATCH];
+} janus_videoroom_rtp_forwarder_batch;
+
+static void janus_videoroom_rtp_forwarder_batch_flush(janus_videoroom_rtp_forwarder_batch *batch,
+		janus_videoroom_publisher *participant, gboolean video) {
+	if(batch->count == 0)
 		return;
+	int i = 0;
+#ifdef HAVE_SENDMMSG
+	while(i < batch->count) {
+		int sent = sendmmsg(participant->udp_sock, &batch->msgs[i], batch->count - i, 0);
+		if(sent < 0) {
+			/* Skip the packet that failed, and try again with the next one */
+			JANUS_LOG(LOG_HUGE, "Error forwarding RTP %s packet for %s... %s\n",
+				(video ? "video" : "audio"), participant->display, strerror(errno));
+			sent = 1;
+		}
+		i += sent;
+	}
+#else
+	for(i=0; i<batch->count; i++) {
+		if(sendmsg(participant->udp_sock, &batch->msgs[i], 0) < 0) {
+			JANUS_LOG(LOG_HUGE, "Error forwarding RTP %s packet for %s... %s\n",
+				(video ? "video" : "audio"), participant->display, strerror(errno));
+		}
 	}
+#endif
+	batch->count = 0;
+}
+
+/* Add a packet for a forwarder to the batch: if rest is NULL, the header is not used */
+static void janus_videoroom_rtp_forwarder_batch_add(janus_videoroom_rtp_forwarder_batch *batch,
+		janus_videoroom_rtp_forwarder *rtp_forward, char *data, int len, char *rest, int rest_len) {
+#ifdef HAVE_SENDMMSG
+	struct msghdr *msg = &batch->msgs[batch->count].msg_hdr;
+#else
+	struct msghdr *msg = &batch->msgs[batch->count];
+#endif
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_name = (rtp_forward->serv_addr.sin_family == AF_INET ?
+		(void *)&rtp_forward->serv_addr : (void *)&rtp_forward->serv_addr6);
+	msg->msg_namelen = (rtp_forward->serv_addr.sin_family == AF_INET ? sizeof(rtp_forward->serv_addr) : sizeof(rtp_forward->serv_addr6));
+	struct iovec *iov = batch->iovecs[batch->count];
+	iov[0].iov_base = data;
+	iov[0].iov_len = len;
+	msg->msg_iov = iov;
+	msg->msg_iovlen = 1;
+	if(rest != NULL && rest_len > 0) {
+		iov[1].iov_base = rest;
+		iov[1].iov_len = rest_len;
+		msg->msg_iovlen = 2;
+	}
+	batch->count++;
+}
+
+/* Relay an RTP packet from a publisher to all its RTP forwarders */
+static void janus_videoroom_rtp_forwarders_relay(janus_videoroom_publisher *participant,
+		char *buf, int len, gboolean video, int sc) {
+	if(len < (int)RTP_HEADER_SIZE)
+		return;
+	janus_mutex_lock(&participant->rtp_forwarders_mutex);
+	if(participant->srtp_contexts && g_hash_table_size(participant->srtp_contexts) > 0) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, participant->srtp_contexts);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_videoroom_srtp_context *srtp_ctx = (janus_videoroom_srtp_context *)value;
+			srtp_ctx->slen = 0;
+		}
+	}
+	janus_videoroom_rtp_forwarder_batch batch;
+	batch.count = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, participant->rtp_forwarders);
+	while(participant->udp_sock > 0 && g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_videoroom_rtp_forwarder *rtp_forward = (janus_videoroom_rtp_forwarder *)value;
+		if(rtp_forward->is_data || (video && !rtp_forward->is_video) || (!video && rtp_forward->is_video))
+			continue;
+		/* First of all, check if we're simulcasting and if we need to forward or ignore this frame */
+		if(video && !rtp_forward->simulcast && rtp_forward->substream != sc)
+			continue;
+		if(video && rtp_forward->simulcast && !janus_rtp_simulcasting_context_process_rtp(&rtp_forward->sim_context,
+				buf, len, participant->ssrc, participant->rid, participant->vcodec, &rtp_forward->context))
+			continue;
+		if(batch.count == JANUS_VIDEOROOM_FORWARDER_BATCH)
+			janus_videoroom_rtp_forwarder_batch_flush(&batch, participant, video);
+		/* We rewrite a copy of the RTP header, and leave the packet alone */
+		janus_rtp_header *rtp = &batch.headers[batch.count];
+		memcpy(rtp, buf, RTP_HEADER_SIZE);
+		if(video && rtp_forward->simulcast) {
+			janus_rtp_header_update(rtp, &rtp_forward->context, TRUE, 0);
+			/* By default we use a fixed SSRC (it may be overwritten later) */
+			rtp->ssrc = htonl(participant->user_id & 0xffffffff);
+		}
+		/* Check if payload type and/or SSRC need to be overwritten for this forwarder */
+		if(rtp_forward->payload_type > 0)
+			rtp->type = rtp_forward->payload_type;
+		if(rtp_forward->ssrc > 0)
+			rtp->ssrc = htonl(rtp_forward->ssrc);
+		/* Check if this is an RTP or SRTP forwarder */
+		if(!rtp_forward->is_srtp) {
+			/* Plain RTP */
+			janus_videoroom_rtp_forwarder_batch_add(&batch, rtp_forward, (char *)rtp, RTP_HEADER_SIZE,
+				buf + RTP_HEADER_SIZE, len - RTP_HEADER_SIZE);
+		} else {
+			/* SRTP: check if we already encrypted the packet before */
+			if(rtp_forward->srtp_ctx->slen == 0) {
+				memcpy(&rtp_forward->srtp_ctx->sbuf, rtp, RTP_HEADER_SIZE);
+				memcpy(&rtp_forward->srtp_ctx->sbuf[RTP_HEADER_SIZE], buf + RTP_HEADER_SIZE, len - RTP_HEADER_SIZE);
+				int protected = len;
+				int res = srtp_protect(rtp_forward->srtp_ctx->ctx, &rtp_forward->srtp_ctx->sbuf, &protected);
+				if(res != srtp_err_status_ok) {
+					janus_rtp_header *header = (janus_rtp_header *)&rtp_forward->srtp_ctx->sbuf;
+					guint32 timestamp = ntohl(header->timestamp);
+					guint16 seq = ntohs(header->seq_number);
+					JANUS_LOG(LOG_ERR, "Error encrypting %s packet for %s... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
+						(video ? "Video" : "Audio"), participant->display, janus_srtp_error_str(res), len, protected, timestamp, seq);
+				} else {
+					rtp_forward->srtp_ctx->slen = protected;
+				}
+			}
+			if(rtp_forward->srtp_ctx->slen > 0) {
+				janus_videoroom_rtp_forwarder_batch_add(&batch, rtp_forward,
+					rtp_forward->srtp_ctx->sbuf, rtp_forward->srtp_ctx->slen, NULL, 0);
+			}
+		}
+	}
+	janus_videoroom_rtp_forwarder_batch_flush(&batch, participant, video);
+	janus_mutex_unlock(&participant->rtp_forwarders_mutex);
+}
+
+/* Thread feeding RTP forwarders, if we don't want to do that on the thread receiving the packets */
+static void *janus_videoroom_forwarder_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining VideoRoom RTP forwarder thread\n");
+	janus_videoroom_forwarder_job *job = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		job = g_async_queue_pop(forwarder_queue);
+		if(job == &forwarder_exit_job)
+			break;
+		janus_videoroom_publisher *participant = job->publisher;
+		if(!g_atomic_int_get(&participant->destroyed))
+			janus_videoroom_rtp_forwarders_relay(participant, job->data, job->length, job->video, job->substream);
+		janus_videoroom_forwarder_job_free(job);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving VideoRoom RTP forwarder thread\n");
+	return NULL;
+}
+
+/* Process a packet coming from a publisher, whether it's a local one or a remote one */
+static void janus_videoroom_incoming_rtp_internal(janus_videoroom_session *session,
+		janus_videoroom_publisher *participant, janus_plugin_rtp *pkt) {
+	janus_plugin_session *handle = session->handle;
 	janus_videoroom *videoroom = participant->room;
 
 	gboolean video = pkt->video;
 	char *buf = pkt->buffer;
 	uint16_t len = pkt->length;
+	if(videoroom->active_speakers > 0) {
+		/* Keep track of the audio levels for the active speakers ranking */
+		if(!video && participant->audio_active && pkt->extensions.audio_level != -1) {
+			guint8 loudness = 127 - (pkt->extensions.audio_level & 0x7F);
+			if(participant->speaker_count == JANUS_VIDEOROOM_SPEAKER_WINDOW)
+				participant->speaker_sum -= participant->speaker_levels[participant->speaker_index];
+			else
+				participant->speaker_count++;
+			participant->speaker_levels[participant->speaker_index] = loudness;
+			participant->speaker_sum += loudness;
+			participant->speaker_index = (participant->speaker_index + 1) % JANUS_VIDEOROOM_SPEAKER_WINDOW;
+		}
+		/* Is it time to update the ranking? */
+		gint64 now = janus_get_monotonic_time();
+		if(now - videoroom->speakers_latest >= JANUS_VIDEOROOM_SPEAKERS_INTERVAL) {
+			janus_mutex_lock(&videoroom->mutex);
+			if(now - videoroom->speakers_latest >= JANUS_VIDEOROOM_SPEAKERS_INTERVAL) {
+				videoroom->speakers_latest = now;
+				janus_videoroom_speakers_update(videoroom);
+			}
+			janus_mutex_unlock(&videoroom->mutex);
+		}
+	}
 	/* In case this is an audio packet and we're doing talk detection, check the audio level extension */
 	if(!video && videoroom->audiolevel_event && participant->audio_active) {
 		int level = pkt->extensions.audio_level;
@@ -4928,7 +6590,7 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 					json_decref(event);
 					janus_mutex_unlock(&videoroom->mutex);
 					/* Also notify event handlers */
-					if(notify_events && gateway->events_is_enabled()) {
+					if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 						json_t *info = json_object();
 						json_object_set_new(info, "videoroom", json_string(participant->talking ? "talking" : "stopped-talking"));
 						json_object_set_new(info, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
@@ -4956,7 +6618,8 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 			else if(participant->rid_extmap_id > 0) {
 				/* We may not know the SSRC yet, try the rid RTP extension */
 				char sdes_item[16];
-				if(janus_rtp_header_extension_parse_rid(buf, len, participant->rid_extmap_id, sdes_item, sizeof(sdes_item)) == 0) {
+				if(janus_rtp_header_extension_map_parse_rid(pkt->extensions.map, buf, len,
+						participant->rid_extmap_id, sdes_item, sizeof(sdes_item)) == 0) {
 					if(participant->rid[2] != NULL && !strcmp(participant->rid[2], sdes_item)) {
 						participant->ssrc[0] = ssrc;
 						sc = 0;
@@ -4971,88 +6634,19 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 			}
 		}
 		/* Forward RTP to the appropriate port for the rtp_forwarders associated with this publisher, if there are any */
-		janus_mutex_lock(&participant->rtp_forwarders_mutex);
-		if(participant->srtp_contexts && g_hash_table_size(participant->srtp_contexts) > 0) {
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, participant->srtp_contexts);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_videoroom_srtp_context *srtp_ctx = (janus_videoroom_srtp_context *)value;
-				srtp_ctx->slen = 0;
-			}
-		}
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, participant->rtp_forwarders);
-		while(participant->udp_sock > 0 && g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_videoroom_rtp_forwarder *rtp_forward = (janus_videoroom_rtp_forwarder *)value;
-			if(rtp_forward->is_data || (video && !rtp_forward->is_video) || (!video && rtp_forward->is_video))
-				continue;
-			/* Backup the RTP header info, as we may rewrite part of it */
-			uint32_t seq_number = ntohs(rtp->seq_number);
-			uint32_t timestamp = ntohl(rtp->timestamp);
-			int pt = rtp->type;
-			uint32_t ssrc = ntohl(rtp->ssrc);
-			/* First of all, check if we're simulcasting and if we need to forward or ignore this frame */
-			if(video && !rtp_forward->simulcast && rtp_forward->substream != sc) {
-				continue;
-			} else if(video && rtp_forward->simulcast) {
-				/* This is video and we're simulcasting, check if we need to forward this frame */
-				if(!janus_rtp_simulcasting_context_process_rtp(&rtp_forward->sim_context,
-						buf, len, participant->ssrc, participant->rid, participant->vcodec, &rtp_forward->context))
-					continue;
-				janus_rtp_header_update(rtp, &rtp_forward->context, TRUE, 0);
-				/* By default we use a fixed SSRC (it may be overwritten later) */
-				rtp->ssrc = htonl(participant->user_id & 0xffffffff);
-			}
-			/* Check if payload type and/or SSRC need to be overwritten for this forwarder */
-			if(rtp_forward->payload_type > 0)
-				rtp->type = rtp_forward->payload_type;
-			if(rtp_forward->ssrc > 0)
-				rtp->ssrc = htonl(rtp_forward->ssrc);
-			/* Check if this is an RTP or SRTP forwarder */
-			if(!rtp_forward->is_srtp) {
-				/* Plain RTP */
-				struct sockaddr *address = (rtp_forward->serv_addr.sin_family == AF_INET ?
-					(struct sockaddr *)&rtp_forward->serv_addr : (struct sockaddr *)&rtp_forward->serv_addr6);
-				size_t addrlen = (rtp_forward->serv_addr.sin_family == AF_INET ? sizeof(rtp_forward->serv_addr) : sizeof(rtp_forward->serv_addr6));
-				if(sendto(participant->udp_sock, buf, len, 0, address, addrlen) < 0) {
-					JANUS_LOG(LOG_HUGE, "Error forwarding RTP %s packet for %s... %s (len=%d)...\n",
-						(video ? "video" : "audio"), participant->display, strerror(errno), len);
-				}
-			} else {
-				/* SRTP: check if we already encrypted the packet before */
-				if(rtp_forward->srtp_ctx->slen == 0) {
-					memcpy(&rtp_forward->srtp_ctx->sbuf, buf, len);
-					int protected = len;
-					int res = srtp_protect(rtp_forward->srtp_ctx->ctx, &rtp_forward->srtp_ctx->sbuf, &protected);
-					if(res != srtp_err_status_ok) {
-						janus_rtp_header *header = (janus_rtp_header *)&rtp_forward->srtp_ctx->sbuf;
-						guint32 timestamp = ntohl(header->timestamp);
-						guint16 seq = ntohs(header->seq_number);
-						JANUS_LOG(LOG_ERR, "Error encrypting %s packet for %s... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
-							(video ? "Video" : "Audio"), participant->display, janus_srtp_error_str(res), len, protected, timestamp, seq);
-					} else {
-						rtp_forward->srtp_ctx->slen = protected;
-					}
-				}
-				if(rtp_forward->srtp_ctx->slen > 0) {
-					struct sockaddr *address = (rtp_forward->serv_addr.sin_family == AF_INET ?
-						(struct sockaddr *)&rtp_forward->serv_addr : (struct sockaddr *)&rtp_forward->serv_addr6);
-					size_t addrlen = (rtp_forward->serv_addr.sin_family == AF_INET ? sizeof(rtp_forward->serv_addr) : sizeof(rtp_forward->serv_addr6));
-					if(sendto(participant->udp_sock, rtp_forward->srtp_ctx->sbuf, rtp_forward->srtp_ctx->slen, 0, address, addrlen) < 0) {
-						JANUS_LOG(LOG_HUGE, "Error forwarding SRTP %s packet for %s... %s (len=%d)...\n",
-							(video ? "video" : "audio"), participant->display, strerror(errno), rtp_forward->srtp_ctx->slen);
-					}
-				}
-			}
-			/* Restore original values of payload type and SSRC before going on */
-			rtp->type = pt;
-			rtp->ssrc = htonl(ssrc);
-			rtp->timestamp = htonl(timestamp);
-			rtp->seq_number = htons(seq_number);
+		if(forwarder_queue != NULL && participant->udp_sock > 0 && g_hash_table_size(participant->rtp_forwarders) > 0) {
+			/* Let the forwarder thread take care of this */
+			janus_videoroom_forwarder_job *job = g_malloc(sizeof(janus_videoroom_forwarder_job) + len);
+			janus_refcount_increase(&participant->ref);
+			job->publisher = participant;
+			job->video = video;
+			job->substream = sc;
+			job->length = len;
+			memcpy(job->data, buf, len);
+			g_async_queue_push(forwarder_queue, job);
+		} else {
+			janus_videoroom_rtp_forwarders_relay(participant, buf, len, video, sc);
 		}
-		janus_mutex_unlock(&participant->rtp_forwarders_mutex);
 		/* Set the payload type of the publisher */
 		rtp->type = video ? participant->video_pt : participant->audio_pt;
 		/* Save the frame if we're recording */
@@ -5080,9 +6674,21 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 		janus_videoroom_rtp_relay_packet packet;
 		packet.data = rtp;
 		packet.length = len;
+		packet.received = janus_get_monotonic_time();
 		packet.extensions = pkt->extensions;
 		packet.is_rtp = TRUE;
 		packet.is_video = video;
+		packet.keyframe = FALSE;
+		if(video) {
+			/* Check if this is a keyframe once for all subscribers: the core may have done it for us already */
+			if(pkt->keyframe != -1) {
+				packet.keyframe = (pkt->keyframe == 1);
+			} else {
+				int plen = 0;
+				char *payload = janus_rtp_payload(buf, len, &plen);
+				packet.keyframe = (payload != NULL && janus_videoroom_is_keyframe(participant->vcodec, payload, plen));
+			}
+		}
 		packet.svc = FALSE;
 		if(video && videoroom->do_svc) {
 			/* We're doing SVC: let's parse this packet to see which layers are there */
@@ -5092,7 +6698,17 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 				return;
 			gboolean found = FALSE;
 			memset(&packet.svc_info, 0, sizeof(packet.svc_info));
-			if(janus_vp9_parse_svc(payload, plen, &found, &packet.svc_info) == 0) {
+			if(participant->vcodec == JANUS_VIDEOCODEC_AV1) {
+				/* For AV1, layers are in the Dependency Descriptor RTP extension */
+				uint8_t dd[256];
+				int dd_len = sizeof(dd);
+				if(participant->dependency_desc_extmap_id > 0 &&
+						janus_rtp_header_extension_parse_dependency_desc(buf, len,
+							participant->dependency_desc_extmap_id, dd, &dd_len) == 0 &&
+						janus_av1_parse_dependency_descriptor(dd, dd_len, &participant->av1_svc, &found, &packet.svc_info) == 0) {
+					packet.svc = found;
+				}
+			} else if(janus_vp9_parse_svc(payload, plen, &found, &packet.svc_info) == 0) {
 				packet.svc = found;
 			}
 		}
@@ -5102,10 +6718,68 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 		/* Backup the actual timestamp and sequence number set by the publisher, in case switching is involved */
 		packet.timestamp = ntohl(packet.data->timestamp);
 		packet.seq_number = ntohs(packet.data->seq_number);
+		/* Keep track of the latest keyframe for new subscribers, if needed */
+		if(video && videoroom->videobufferkf)
+			janus_videoroom_keyframe_update(participant, sc, &packet);
+		if(video && videoroom->simulcast_bwe && (participant->ssrc[0] != 0 || participant->rid[0] != NULL)) {
+			/* Keep track of the bitrate of each substream, so that we can adapt subscribers to their bandwidth */
+			participant->sub_bytes[sc] += len;
+			gint64 now = janus_get_monotonic_time();
+			if(participant->sub_bitrate_ts == 0) {
+				participant->sub_bitrate_ts = now;
+			} else if(now - participant->sub_bitrate_ts >= G_USEC_PER_SEC) {
+				int i = 0;
+				for(i=0; i<3; i++) {
+					participant->sub_bitrate[i] = (guint64)participant->sub_bytes[i]*8*G_USEC_PER_SEC/(now - participant->sub_bitrate_ts);
+					participant->sub_bytes[i] = 0;
+				}
+				participant->sub_bitrate_ts = now;
+			}
+		}
+		if(video && videoroom->pli_interval > 0) {
+			/* We're coalescing keyframe requests: a keyframe satisfies all the pending
+			 * ones, otherwise check if it's time to send the PLI we held back */
+			if(packet.keyframe) {
+				janus_mutex_lock(&participant->pli_mutex);
+				participant->pli_pending = FALSE;
+				janus_mutex_unlock(&participant->pli_mutex);
+			} else if(participant->pli_pending) {
+				gint64 now = janus_get_monotonic_time();
+				if((now - participant->pli_latest) >= (gint64)videoroom->pli_interval*1000)
+					janus_videoroom_reqpli(participant, "Coalesced keyframe requests");
+			}
+		}
 		/* Go: some viewers may decide to drop the packet, but that's up to them */
-		janus_mutex_lock_nodebug(&participant->subscribers_mutex);
-		g_slist_foreach(participant->subscribers, janus_videoroom_relay_rtp_packet, &packet);
-		janus_mutex_unlock_nodebug(&participant->subscribers_mutex);
+		packet.payload = NULL;
+		janus_videoroom_subscribers *subscribers = NULL;
+		if(!video || !videoroom->last_n || videoroom->active_speakers <= 0 ||
+				g_atomic_int_get(&participant->speaker_active)) {
+			/* In last-N mode, we only relay video for the active speakers */
+			subscribers = janus_videoroom_subscribers_get(participant);
+		}
+		if(subscribers != NULL && subscribers->count > 1) {
+			/* More than one subscriber: as most of them will only rewrite the RTP
+			 * header, we prepare a copy of the payload the core can share among them */
+			int plen = 0;
+			char *payload = janus_rtp_payload(buf, len, &plen);
+			if(payload != NULL && plen > 0)
+				packet.payload = janus_plugin_rtp_payload_new(payload, plen);
+		}
+		guint i = 0;
+		if(subscribers != NULL && subscribers->shards != NULL && videoroom->fanout &&
+				subscribers->count >= JANUS_VIDEOROOM_FANOUT_THRESHOLD) {
+			/* Large audience, let the fan-out workers take care of this */
+			janus_videoroom_fanout_relay(subscribers, &packet);
+			subscribers = NULL;
+		}
+		for(i=0; subscribers != NULL && i<subscribers->count; i++) {
+			janus_videoroom_subscriber *subscriber = subscribers->list[i];
+			/* The snapshot may be slightly stale, skip subscribers that are going away */
+			if(g_atomic_int_get(&subscriber->destroyed) || g_atomic_int_get(&subscriber->session->destroyed))
+				continue;
+			janus_videoroom_relay_rtp_packet(subscriber, &packet);
+		}
+		janus_plugin_rtp_payload_unref(packet.payload);
 
 		/* Check if we need to send any REMB, FIR or PLI back to this publisher */
 		if(video && participant->video_active) {
@@ -5119,7 +6793,7 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 				send_remb = TRUE;
 			}
 
-			if(send_remb && participant->bitrate) {
+			if(send_remb && participant->bitrate && handle != NULL) {
 				/* We send a few incremental REMB messages at startup */
 				uint32_t bitrate = participant->bitrate;
 				if(participant->remb_startup > 0) {
@@ -5136,26 +6810,8 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 				/* We generate RTCP every tot seconds/frames */
 				gint64 now = janus_get_monotonic_time();
 				/* First check if this is a keyframe, though: if so, we reset the timer */
-				int plen = 0;
-				char *payload = janus_rtp_payload(buf, len, &plen);
-				if(payload == NULL)
-					return;
-				if(participant->vcodec == JANUS_VIDEOCODEC_VP8) {
-					if(janus_vp8_is_keyframe(payload, plen))
-						participant->fir_latest = now;
-				} else if(participant->vcodec == JANUS_VIDEOCODEC_VP9) {
-					if(janus_vp9_is_keyframe(payload, plen))
-						participant->fir_latest = now;
-				} else if(participant->vcodec == JANUS_VIDEOCODEC_H264) {
-					if(janus_h264_is_keyframe(payload, plen))
-						participant->fir_latest = now;
-				} else if(participant->vcodec == JANUS_VIDEOCODEC_AV1) {
-					if(janus_av1_is_keyframe(payload, plen))
-						participant->fir_latest = now;
-				} else if(participant->vcodec == JANUS_VIDEOCODEC_H265) {
-					if(janus_h265_is_keyframe(payload, plen))
-						participant->fir_latest = now;
-				}
+				if(packet.keyframe)
+					participant->fir_latest = now;
 				if((now-participant->fir_latest) >= ((gint64)videoroom->fir_freq*G_USEC_PER_SEC)) {
 					/* FIXME We send a FIR every tot seconds */
 					janus_videoroom_reqpli(participant, "Regular keyframe request");
@@ -5163,7 +6819,6 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp
 			}
 		}
 	}
-	janus_videoroom_publisher_dereference_nodebug(participant);
 }
 
 void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *packet) {
@@ -5185,22 +6840,117 @@ void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rt
 			return;
 		if(!s->video)
 			return;	/* The only feedback we handle is video related anyway... */
-		if(janus_rtcp_has_fir(buf, len) || janus_rtcp_has_pli(buf, len)) {
+		janus_rtcp_summary local;
+		const janus_rtcp_summary *summary = packet->summary;
+		if(summary == NULL) {
+			janus_rtcp_summarize(buf, len, &local);
+			summary = &local;
+		}
+		if(summary->has_fir || summary->has_pli) {
 			/* We got a FIR or PLI, forward a PLI it to the publisher */
 			if(s->feed) {
 				janus_videoroom_publisher *p = s->feed;
 				if(p && p->session) {
-					janus_videoroom_reqpli(p, "PLI from subscriber");
+					/* If keyframe requests are limited, don't ask again for a
+					 * subscriber that is still waiting for the previous one */
+					gint64 now = janus_get_monotonic_time();
+					janus_videoroom *room = p->room;
+					if(room && room->pli_interval > 0 && s->pli_pending > 0 &&
+							(now - s->pli_pending) < (gint64)room->pli_interval*1000) {
+						janus_mutex_lock(&p->pli_mutex);
+						p->pli_suppressed++;
+						janus_mutex_unlock(&p->pli_mutex);
+					} else {
+						s->pli_pending = now;
+						janus_videoroom_reqpli(p, "PLI from subscriber");
+					}
 				}
 			}
 		}
-		uint32_t bitrate = janus_rtcp_get_remb(buf, len);
-		if(bitrate > 0) {
-			/* FIXME We got a REMB from this subscriber, should we do something about it? */
+		uint32_t bitrate = summary->remb;
+		if(bitrate > 0 && s->room && s->room->simulcast_bwe && s->feed) {
+			/* We got a REMB from this subscriber: check if we need a different simulcast
+			 * layer, applying drops immediately but smoothing increases a bit */
+			if(s->bwe_estimate == 0 || bitrate < s->bwe_estimate)
+				s->bwe_estimate = bitrate;
+			else
+				s->bwe_estimate = ((guint64)s->bwe_estimate*3 + bitrate)/4;
+			janus_videoroom_bwe_update(s, s->feed);
 		}
 	}
 }
 
+/* Relay a data channel message to all the subscribers of a publisher, sharing the same copy with all of them */
+static void janus_videoroom_relay_data_to_subscribers(janus_videoroom_publisher *participant, char *buf, uint16_t len, gboolean textdata) {
+	janus_videoroom_rtp_relay_packet pkt;
+	pkt.data = (struct rtp_header *)buf;
+	pkt.length = len;
+	pkt.is_rtp = FALSE;
+	pkt.textdata = textdata;
+	pkt.payload = NULL;
+	janus_mutex_lock_nodebug(&participant->subscribers_mutex);
+	if(participant->subscribers != NULL) {
+		pkt.payload = janus_plugin_rtp_payload_new(buf, len);
+		g_slist_foreach(participant->subscribers, janus_videoroom_relay_data_packet, &pkt);
+	}
+	janus_mutex_unlock_nodebug(&participant->subscribers_mutex);
+	janus_plugin_rtp_payload_unref(pkt.payload);
+}
+
+/* Relay the data channel messages coalesced so far, if any (called with the data_mutex locked) */
+static void janus_videoroom_data_batch_flush(janus_videoroom_publisher *participant) {
+	if(participant->data_batch == NULL || participant->data_batch->len == 0)
+		return;
+	janus_videoroom_relay_data_to_subscribers(participant, (char *)participant->data_batch->data,
+		participant->data_batch->len, participant->data_batch_text);
+	g_byte_array_set_size(participant->data_batch, 0);
+}
+
+static gboolean janus_videoroom_data_batch_timeout(gpointer user_data) {
+	janus_videoroom_publisher *participant = (janus_videoroom_publisher *)user_data;
+	janus_mutex_lock(&participant->data_mutex);
+	participant->data_scheduled = FALSE;
+	if(!g_atomic_int_get(&participant->destroyed))
+		janus_videoroom_data_batch_flush(participant);
+	janus_mutex_unlock(&participant->data_mutex);
+	return G_SOURCE_REMOVE;
+}
+
+/* Add a small data channel message to the batch of a publisher, and make sure it will be flushed in time */
+static void janus_videoroom_data_batch_add(janus_videoroom_publisher *participant, guint window,
+		char *buf, uint16_t len, gboolean textdata) {
+	janus_mutex_lock(&participant->data_mutex);
+	if(participant->data_batch == NULL)
+		participant->data_batch = g_byte_array_sized_new(JANUS_VIDEOROOM_DATA_BATCH_MAX);
+	GByteArray *batch = participant->data_batch;
+	/* Text and binary messages are never mixed, and batches can't grow too large */
+	if(batch->len > 0 && (participant->data_batch_text != textdata ||
+			batch->len + len + (textdata ? 1 : 2) > JANUS_VIDEOROOM_DATA_BATCH_MAX))
+		janus_videoroom_data_batch_flush(participant);
+	participant->data_batch_text = textdata;
+	if(textdata) {
+		/* Text messages are separated by a newline */
+		if(batch->len > 0)
+			g_byte_array_append(batch, (const guint8 *)"\n", 1);
+	} else {
+		/* Binary messages are prefixed by their length */
+		guint8 prefix[2] = { (len >> 8), (len & 0xFF) };
+		g_byte_array_append(batch, prefix, 2);
+	}
+	g_byte_array_append(batch, (const guint8 *)buf, len);
+	if(!participant->data_scheduled) {
+		/* The timer holds a reference to the publisher until it fires */
+		participant->data_scheduled = TRUE;
+		janus_refcount_increase(&participant->ref);
+		GSource *timer = g_timeout_source_new(window);
+		g_source_set_callback(timer, janus_videoroom_data_batch_timeout, participant,
+			(GDestroyNotify)janus_videoroom_publisher_dereference);
+		g_source_attach(timer, rtcpfwd_ctx);
+		g_source_unref(timer);
+	}
+	janus_mutex_unlock(&participant->data_mutex);
+}
+
 void janus_videoroom_incoming_data(janus_plugin_session *handle, janus_plugin_data *packet) {
 	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
@@ -5209,11 +6959,9 @@ void janus_videoroom_incoming_data(janus_plugin_session *handle, janus_plugin_da
 	janus_videoroom_session *session = (janus_videoroom_session *)handle->plugin_handle;
 	if(!session || g_atomic_int_get(&session->destroyed) || session->participant_type != janus_videoroom_p_type_publisher)
 		return;
-	janus_videoroom_publisher *participant = janus_videoroom_session_get_publisher_nodebug(session);
-	if(participant == NULL)
-		return;
-	if(g_atomic_int_get(&participant->destroyed) || !participant->data_active || participant->kicked) {
-		janus_videoroom_publisher_dereference_nodebug(participant);
+	janus_videoroom_publisher *participant = janus_videoroom_session_borrow_publisher(session);
+	if(participant == NULL || g_atomic_int_get(&participant->destroyed) || !participant->data_active || participant->kicked) {
+		janus_videoroom_session_release_publisher(session);
 		return;
 	}
 	char *buf = packet->buffer;
@@ -5241,16 +6989,21 @@ void janus_videoroom_incoming_data(janus_plugin_session *handle, janus_plugin_da
 		packet->binary ? "binary" : "text", len);
 	/* Save the message if we're recording */
 	janus_recorder_save_frame(participant->drc, buf, len);
-	/* Relay to all subscribers */
-	janus_videoroom_rtp_relay_packet pkt;
-	pkt.data = (struct rtp_header *)buf;
-	pkt.length = len;
-	pkt.is_rtp = FALSE;
-	pkt.textdata = !packet->binary;
-	janus_mutex_lock_nodebug(&participant->subscribers_mutex);
-	g_slist_foreach(participant->subscribers, janus_videoroom_relay_data_packet, &pkt);
-	janus_mutex_unlock_nodebug(&participant->subscribers_mutex);
-	janus_videoroom_publisher_dereference_nodebug(participant);
+	/* Relay to all subscribers, either now or coalesced with other small messages */
+	janus_videoroom *videoroom = participant->room;
+	guint window = videoroom ? videoroom->data_coalesce : 0;
+	if(window > 0 && len <= JANUS_VIDEOROOM_DATA_COALESCE_MAX && rtcpfwd_thread != NULL) {
+		janus_videoroom_data_batch_add(participant, window, buf, len, !packet->binary);
+	} else if(window > 0) {
+		/* Don't let this message overtake the ones waiting in the batch */
+		janus_mutex_lock(&participant->data_mutex);
+		janus_videoroom_data_batch_flush(participant);
+		janus_videoroom_relay_data_to_subscribers(participant, buf, len, !packet->binary);
+		janus_mutex_unlock(&participant->data_mutex);
+	} else {
+		janus_videoroom_relay_data_to_subscribers(participant, buf, len, !packet->binary);
+	}
+	janus_videoroom_session_release_publisher(session);
 }
 
 void janus_videoroom_data_ready(janus_plugin_session *handle) {
@@ -5307,6 +7060,11 @@ void janus_videoroom_slow_link(janus_plugin_session *handle, int uplink, int vid
 				janus_refcount_decrease(&session->ref);
 				return;
 			}
+			/* If we're adapting simulcast layers, lost packets mean we have less bandwidth than we thought */
+			if(viewer->room && viewer->room->simulcast_bwe && viewer->feed && viewer->bwe_estimate > 0) {
+				viewer->bwe_estimate = viewer->bwe_estimate*3/4;
+				janus_videoroom_bwe_update(viewer, viewer->feed);
+			}
 			/* Send an event on the handle to notify the application: it's
 			 * up to the application to then choose a policy and enforce it */
 			json_t *event = json_object();
@@ -5347,6 +7105,8 @@ static void janus_videoroom_recorder_create(janus_videoroom_publisher *participa
 		/* If media is encrypted, mark it in the recording */
 		if(participant->e2ee)
 			janus_recorder_encrypted(rc);
+		if(rc && participant->room->record_filter)
+			janus_recorder_filter(rc, TRUE);
 		participant->arc = rc;
 	}
 	if(video && participant->vrc == NULL) {
@@ -5376,6 +7136,8 @@ static void janus_videoroom_recorder_create(janus_videoroom_publisher *participa
 		/* If media is encrypted, mark it in the recording */
 		if(participant->e2ee)
 			janus_recorder_encrypted(rc);
+		if(rc && participant->room->record_filter)
+			janus_recorder_filter(rc, TRUE);
 		participant->vrc = rc;
 	}
 	if(data && participant->drc == NULL) {
@@ -5501,10 +7263,12 @@ static void janus_videoroom_hangup_media_internal(gpointer session_data) {
 		participant->recording_base = NULL;
 		janus_videoroom_recorder_close(participant);
 		janus_mutex_unlock(&participant->rec_mutex);
+		janus_videoroom_keyframe_reset(participant);
 		/* Use subscribers_mutex to protect fields used in janus_videoroom_incoming_rtp */
 		janus_mutex_lock(&participant->subscribers_mutex);
 		g_free(participant->sdp);
 		participant->sdp = NULL;
+		janus_videoroom_publisher_offers_clear(participant);
 		participant->firefox = FALSE;
 		participant->audio_active = FALSE;
 		participant->video_active = FALSE;
@@ -5531,6 +7295,7 @@ static void janus_videoroom_hangup_media_internal(gpointer session_data) {
 		}
 		GSList *subscribers = participant->subscribers;
 		participant->subscribers = NULL;
+		janus_videoroom_subscribers_update(participant);
 		/* Hangup all subscribers */
 		while(subscribers) {
 			janus_videoroom_subscriber *s = (janus_videoroom_subscriber *)subscribers->data;
@@ -5554,7 +7319,7 @@ static void janus_videoroom_hangup_media_internal(gpointer session_data) {
 			   by sessions_mutex */
 			if(publisher != NULL) {
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("unsubscribed"));
 					json_object_set_new(info, "room", string_ids ? json_string(publisher->room_id_str) : json_integer(publisher->room_id));
@@ -5563,6 +7328,7 @@ static void janus_videoroom_hangup_media_internal(gpointer session_data) {
 				}
 				janus_mutex_lock(&publisher->subscribers_mutex);
 				publisher->subscribers = g_slist_remove(publisher->subscribers, subscriber);
+				janus_videoroom_subscribers_update(publisher);
 				janus_videoroom_hangup_subscriber(subscriber);
 				janus_mutex_unlock(&publisher->subscribers_mutex);
 			}
@@ -5574,14 +7340,28 @@ static void janus_videoroom_hangup_media_internal(gpointer session_data) {
 }
 
 /* Thread to handle incoming messages */
+static void janus_videoroom_message_enqueue(janus_videoroom_session *session, janus_videoroom_message *msg) {
+	if(handler_threads > 1 && session != NULL) {
+		json_t *room = msg->message ? json_object_get(msg->message, "room") : NULL;
+		if(json_is_string(room)) {
+			session->handler = g_str_hash(json_string_value(room)) % handler_threads;
+		} else if(json_is_integer(room)) {
+			guint64 room_id = json_integer_value(room);
+			session->handler = (guint)(room_id ^ (room_id >> 32)) % handler_threads;
+		}
+	}
+	g_async_queue_push(messages[session ? session->handler : 0], msg);
+}
+
 static void *janus_videoroom_handler(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining VideoRoom handler thread\n");
+	GAsyncQueue *queue = (GAsyncQueue *)data;
 	janus_videoroom_message *msg = NULL;
 	int error_code = 0;
 	char error_cause[512];
 	json_t *root = NULL;
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		msg = g_async_queue_pop(messages);
+		msg = g_async_queue_pop(queue);
 		if(msg == &exit_message)
 			break;
 		if(msg->handle == NULL) {
@@ -5819,6 +7599,9 @@ static void *janus_videoroom_handler(void *data) {
 				publisher->vrc = NULL;
 				publisher->drc = NULL;
 				janus_mutex_init(&publisher->rec_mutex);
+				janus_mutex_init(&publisher->keyframe.mutex);
+				janus_mutex_init(&publisher->pli_mutex);
+				janus_mutex_init(&publisher->data_mutex);
 				publisher->firefox = FALSE;
 				publisher->bitrate = publisher->room->bitrate;
 				publisher->subscribers = NULL;
@@ -5830,6 +7613,8 @@ static void *janus_videoroom_handler(void *data) {
 				publisher->audio_level_extmap_id = 0;
 				publisher->video_orient_extmap_id = 0;
 				publisher->playout_delay_extmap_id = 0;
+				publisher->dependency_desc_extmap_id = 0;
+				janus_av1_svc_context_reset(&publisher->av1_svc);
 				publisher->remb_startup = 4;
 				publisher->remb_latest = 0;
 				publisher->fir_latest = 0;
@@ -5953,7 +7738,7 @@ static void *janus_videoroom_handler(void *data) {
 				janus_videoroom_participant_joining(publisher);
 
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("joined"));
 					json_object_set_new(info, "room", string_ids ? json_string(publisher->room->room_id_str) :
@@ -6106,6 +7891,8 @@ static void *janus_videoroom_handler(void *data) {
 					subscriber->e2ee = publisher->e2ee;
 					subscriber->pvt_id = pvt_id;
 					subscriber->close_pc = close_pc;
+					if(fanout_workers > 0)
+						subscriber->fanout_worker = (guint)g_atomic_int_add(&fanout_next, 1) % fanout_workers;
 					/* Initialize the subscriber context */
 					janus_rtp_switching_context_reset(&subscriber->context);
 					subscriber->audio_offered = offer_audio ? json_is_true(offer_audio) : TRUE;	/* True by default */
@@ -6147,6 +7934,9 @@ static void *janus_videoroom_handler(void *data) {
 					subscriber->sim_context.rid_ext_id = publisher->rid_extmap_id;
 					subscriber->sim_context.substream_target = sc_substream ? json_integer_value(sc_substream) : 2;
 					subscriber->sim_context.templayer_target = sc_temporal ? json_integer_value(sc_temporal) : 2;
+					subscriber->bwe_substream_max = subscriber->sim_context.substream_target;
+					subscriber->bwe_templayer_max = subscriber->sim_context.templayer_target;
+					subscriber->bwe_up_since = 0;
 					subscriber->sim_context.drop_trigger = sc_fallback ? json_integer_value(sc_fallback) : 0;
 					janus_vp8_simulcast_context_reset(&subscriber->vp8_context);
 					/* Check if a VP9 SVC-related request is involved */
@@ -6159,6 +7949,7 @@ static void *janus_videoroom_handler(void *data) {
 					session->participant = subscriber;
 					janus_mutex_lock(&publisher->subscribers_mutex);
 					publisher->subscribers = g_slist_append(publisher->subscribers, subscriber);
+					janus_videoroom_subscribers_update(publisher);
 					janus_mutex_unlock(&publisher->subscribers_mutex);
 					if(owner != NULL) {
 						/* Note: we should refcount these subscription-publisher mappings as well */
@@ -6182,26 +7973,12 @@ static void *janus_videoroom_handler(void *data) {
 					JANUS_LOG(LOG_VERB, "Preparing JSON event as a reply\n");
 					/* Negotiate by sending the selected publisher SDP back */
 					janus_mutex_lock(&publisher->subscribers_mutex);
-					if(publisher->sdp != NULL) {
-						/* Check if there's something the original SDP has that we should remove */
-						janus_sdp *offer = janus_sdp_parse(publisher->sdp, NULL, 0);
-						subscriber->sdp = offer;
+					const char *sdp = janus_videoroom_publisher_offer_get(publisher, subscriber);
+					if(sdp != NULL) {
+						/* Same offer as other subscribers that want the same media: we keep a copy in case of renegotiations */
 						session->sdp_version = 1;
-						subscriber->sdp->o_version = session->sdp_version;
-						if((publisher->audio && !subscriber->audio_offered) ||
-								(publisher->video && !subscriber->video_offered) ||
-								(publisher->data && !subscriber->data_offered)) {
-							JANUS_LOG(LOG_VERB, "Munging SDP offer to adapt it to the subscriber's requirements\n");
-							if(publisher->audio && !subscriber->audio_offered)
-								janus_sdp_mline_remove(offer, JANUS_SDP_AUDIO);
-							if(publisher->video && !subscriber->video_offered)
-								janus_sdp_mline_remove(offer, JANUS_SDP_VIDEO);
-							if(publisher->data && !subscriber->data_offered)
-								janus_sdp_mline_remove(offer, JANUS_SDP_APPLICATION);
-						}
-						char* sdp = janus_sdp_write(offer);
+						subscriber->sdp_offer = g_strdup(sdp);
 						json_t *jsep = json_pack("{ssss}", "type", "offer", "sdp", sdp);
-						g_free(sdp);
 						if(subscriber->e2ee)
 							json_object_set_new(jsep, "e2ee", json_true());
 						janus_mutex_unlock(&publisher->subscribers_mutex);
@@ -6211,7 +7988,7 @@ static void *janus_videoroom_handler(void *data) {
 						int res = gateway->push_event(msg->handle, &janus_videoroom_plugin, msg->transaction, event, jsep);
 						JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (took %"SCNu64" us)\n", res, janus_get_monotonic_time()-start);
 						/* Also notify event handlers */
-						if(notify_events && gateway->events_is_enabled()) {
+						if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 							json_t *info = json_object();
 							json_object_set_new(info, "event", json_string("subscribing"));
 							json_object_set_new(info, "room", string_ids ? json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
@@ -6462,7 +8239,7 @@ static void *janus_videoroom_handler(void *data) {
 				json_object_set_new(event, "room", string_ids ? json_string(participant->room_id_str) : json_integer(participant->room_id));
 				json_object_set_new(event, "configured", json_string("ok"));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("configured"));
 					json_object_set_new(info, "room", string_ids ? json_string(participant->room_id_str) : json_integer(participant->room_id));
@@ -6613,6 +8390,7 @@ static void *janus_videoroom_handler(void *data) {
 					/* Check if a simulcasting-related request is involved */
 					if(sc_substream && (publisher->ssrc[0] != 0 || publisher->rid[0] != NULL)) {
 						subscriber->sim_context.substream_target = json_integer_value(sc_substream);
+						subscriber->bwe_substream_max = subscriber->sim_context.substream_target;
 						JANUS_LOG(LOG_VERB, "Setting video SSRC to let through (simulcast): %"SCNu32" (index %d, was %d)\n",
 							publisher->ssrc[subscriber->sim_context.substream],
 							subscriber->sim_context.substream_target,
@@ -6633,6 +8411,7 @@ static void *janus_videoroom_handler(void *data) {
 					if(subscriber->feed && subscriber->feed->vcodec == JANUS_VIDEOCODEC_VP8 &&
 							sc_temporal && (publisher->ssrc[0] != 0 || publisher->rid[0] != NULL)) {
 						subscriber->sim_context.templayer_target = json_integer_value(sc_temporal);
+						subscriber->bwe_templayer_max = subscriber->sim_context.templayer_target;
 						JANUS_LOG(LOG_VERB, "Setting video temporal layer to let through (simulcast): %d (was %d)\n",
 							subscriber->sim_context.templayer_target, subscriber->sim_context.templayer);
 						if(subscriber->sim_context.templayer_target == subscriber->sim_context.templayer) {
@@ -6703,6 +8482,21 @@ static void *janus_videoroom_handler(void *data) {
 						char temp_error[512];
 						JANUS_LOG(LOG_VERB, "Munging SDP offer (update) to adapt it to the subscriber's requirements\n");
 						janus_sdp *offer = janus_sdp_parse(publisher->sdp, temp_error, sizeof(temp_error));
+						if(subscriber->sdp == NULL && subscriber->sdp_offer != NULL) {
+							/* First renegotiation, parse the offer we sent when subscribing */
+							subscriber->sdp = janus_sdp_parse(subscriber->sdp_offer, NULL, 0);
+							g_free(subscriber->sdp_offer);
+							subscriber->sdp_offer = NULL;
+						}
+						if(offer == NULL || subscriber->sdp == NULL) {
+							JANUS_LOG(LOG_ERR, "Error parsing SDP for the subscriber update: %s\n", offer ? "invalid subscriber SDP" : temp_error);
+							janus_sdp_destroy(offer);
+							json_decref(event);
+							error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+							g_snprintf(error_cause, 512, "Error parsing SDP");
+							janus_refcount_decrease(&subscriber->ref);
+							goto error;
+						}
 						if(publisher->audio && !subscriber->audio_offered)
 							janus_sdp_mline_remove(offer, JANUS_SDP_AUDIO);
 						if(publisher->video && !subscriber->video_offered)
@@ -6903,6 +8697,7 @@ static void *janus_videoroom_handler(void *data) {
 					/* Go on */
 					janus_mutex_lock(&prev_feed->subscribers_mutex);
 					prev_feed->subscribers = g_slist_remove(prev_feed->subscribers, subscriber);
+					janus_videoroom_subscribers_update(prev_feed);
 					janus_mutex_unlock(&prev_feed->subscribers_mutex);
 					janus_refcount_decrease(&prev_feed->session->ref);
 					g_clear_pointer(&subscriber->feed, janus_videoroom_publisher_dereference);
@@ -6922,6 +8717,9 @@ static void *janus_videoroom_handler(void *data) {
 				subscriber->sim_context.rid_ext_id = publisher->rid_extmap_id;
 				subscriber->sim_context.substream_target = sc_substream ? json_integer_value(sc_substream) : 2;
 				subscriber->sim_context.templayer_target = sc_temporal ? json_integer_value(sc_temporal) : 2;
+				subscriber->bwe_substream_max = subscriber->sim_context.substream_target;
+				subscriber->bwe_templayer_max = subscriber->sim_context.templayer_target;
+				subscriber->bwe_up_since = 0;
 				subscriber->sim_context.drop_trigger = sc_fallback ? json_integer_value(sc_fallback) : 0;
 				janus_vp8_simulcast_context_reset(&subscriber->vp8_context);
 				/* Check if a VP9 SVC-related request is involved */
@@ -6938,6 +8736,7 @@ static void *janus_videoroom_handler(void *data) {
 				}
 				janus_mutex_lock(&publisher->subscribers_mutex);
 				publisher->subscribers = g_slist_append(publisher->subscribers, subscriber);
+				janus_videoroom_subscribers_update(publisher);
 				janus_mutex_unlock(&publisher->subscribers_mutex);
 				subscriber->feed = publisher;
 				/* Send a FIR to the new publisher */
@@ -6952,7 +8751,7 @@ static void *janus_videoroom_handler(void *data) {
 				if(publisher->display)
 					json_object_set_new(event, "display", json_string(publisher->display));
 				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
+				if(notify_events && gateway->events_is_wanted(&janus_videoroom_plugin)) {
 					json_t *info = json_object();
 					json_object_set_new(info, "event", json_string("switched"));
 					json_object_set_new(info, "room", string_ids ? json_string(publisher->room_id_str) : json_integer(publisher->room_id));
@@ -7114,6 +8913,9 @@ static void *janus_videoroom_handler(void *data) {
 								} else if(videoroom->playoutdelay_ext && m->type == JANUS_SDP_VIDEO && strstr(a->value, JANUS_RTP_EXTMAP_PLAYOUT_DELAY)) {
 									if(janus_string_to_uint8(a->value, &participant->playout_delay_extmap_id) < 0)
 										JANUS_LOG(LOG_WARN, "Invalid playout-delay extension ID: %s\n", a->value);
+								} else if(videoroom->do_svc && m->type == JANUS_SDP_VIDEO && strstr(a->value, JANUS_RTP_EXTMAP_DEPENDENCY_DESC)) {
+									if(janus_string_to_uint8(a->value, &participant->dependency_desc_extmap_id) < 0)
+										JANUS_LOG(LOG_WARN, "Invalid dependency descriptor extension ID: %s\n", a->value);
 								} else if(m->type == JANUS_SDP_AUDIO && !strcasecmp(a->name, "fmtp")) {
 									if(strstr(a->value, "useinbandfec=1"))
 										participant->do_opusfec = videoroom->do_opusfec;
@@ -7201,6 +9003,8 @@ static void *janus_videoroom_handler(void *data) {
 					JANUS_SDP_OA_ACCEPT_EXTMAP, JANUS_RTP_EXTMAP_RID,
 					JANUS_SDP_OA_ACCEPT_EXTMAP, JANUS_RTP_EXTMAP_REPAIRED_RID,
 					JANUS_SDP_OA_ACCEPT_EXTMAP, JANUS_RTP_EXTMAP_FRAME_MARKING,
+					JANUS_SDP_OA_ACCEPT_EXTMAP, (videoroom->do_svc && videoroom->vcodec[0] == JANUS_VIDEOCODEC_AV1) ?
+						JANUS_RTP_EXTMAP_DEPENDENCY_DESC : NULL,
 					JANUS_SDP_OA_ACCEPT_EXTMAP, videoroom->audiolevel_ext ? JANUS_RTP_EXTMAP_AUDIO_LEVEL : NULL,
 					JANUS_SDP_OA_ACCEPT_EXTMAP, videoroom->videoorient_ext ? JANUS_RTP_EXTMAP_VIDEO_ORIENTATION : NULL,
 					JANUS_SDP_OA_ACCEPT_EXTMAP, videoroom->playoutdelay_ext ? JANUS_RTP_EXTMAP_PLAYOUT_DELAY : NULL,
@@ -7360,8 +9164,11 @@ static void *janus_videoroom_handler(void *data) {
 					g_free(offer_sdp);
 				} else {
 					/* Store the participant's SDP for interested subscribers */
+					janus_mutex_lock(&participant->subscribers_mutex);
 					g_free(participant->sdp);
 					participant->sdp = offer_sdp;
+					janus_videoroom_publisher_offers_clear(participant);
+					janus_mutex_unlock(&participant->subscribers_mutex);
 					/* We'll wait for the setup_media event before actually telling subscribers */
 				}
 				/* Unless this is an update, in which case schedule a new offer for all viewers */
@@ -7382,7 +9189,7 @@ static void *janus_videoroom_handler(void *data) {
 							msg->transaction = NULL;
 							msg->jsep = NULL;
 							json_incref(update);
-							g_async_queue_push(messages, msg);
+							janus_videoroom_message_enqueue(subscriber->session, msg);
 						}
 						s = s->next;
 					}
@@ -7416,6 +9223,24 @@ error:
 	return NULL;
 }
 
+/* Helper to send a packet to a subscriber, sharing the payload with the core if we can */
+static void janus_videoroom_relay_rtp_to_subscriber(janus_videoroom_session *session,
+		janus_videoroom_rtp_relay_packet *packet, gboolean payload_changed) {
+	if(gateway == NULL)
+		return;
+	janus_plugin_rtp rtp = { .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
+		.extensions = packet->extensions };
+	if(packet->payload != NULL && !payload_changed)
+		gateway->relay_rtp_shared(session->handle, &rtp, packet->payload);
+	else
+		gateway->relay_rtp(session->handle, &rtp);
+}
+
+/* Time to use when rewriting the headers of a packet, if we know when we received it */
+static inline gint64 janus_videoroom_packet_time(janus_videoroom_rtp_relay_packet *packet) {
+	return packet->received > 0 ? packet->received : janus_get_monotonic_time();
+}
+
 /* Helper to quickly relay RTP packets from publishers to subscribers */
 static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_videoroom_rtp_relay_packet *packet = (janus_videoroom_rtp_relay_packet *)user_data;
@@ -7449,14 +9274,18 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			/* Nope, don't relay */
 			return;
 		}
+		/* If this subscriber just started, send the buffered keyframe first, if any */
+		if(g_atomic_int_compare_and_exchange(&subscriber->keyframe_replay, 1, 0))
+			janus_videoroom_keyframe_replay(subscriber);
+		/* A keyframe satisfies any keyframe request this subscriber is waiting for */
+		if(packet->keyframe)
+			subscriber->pli_pending = 0;
 		/* Check if there's any SVC info to take into account */
 		if(packet->svc) {
 			/* There is: check if this is a layer that can be dropped for this viewer
 			 * Note: Following core inspired by the excellent job done by Sergio Garcia Murillo here:
 			 * https://github.com/medooze/media-server/blob/master/src/vp9/VP9LayerSelector.cpp */
-			int plen = 0;
-			char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
-			gboolean keyframe = janus_vp9_is_keyframe((const char *)payload, plen);
+			gboolean keyframe = packet->keyframe;
 			gboolean override_mark_bit = FALSE, has_marker_bit = packet->data->markerbit;
 			int spatial_layer = subscriber->spatial_layer;
 			gint64 now = janus_get_monotonic_time();
@@ -7579,15 +9408,11 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			JANUS_LOG(LOG_HUGE, "Sending packet (spatial=%d, temporal=%d)\n",
 				packet->svc_info.spatial_layer, packet->svc_info.temporal_layer);
 			/* Fix sequence number and timestamp (publisher switching may be involved) */
-			janus_rtp_header_update(packet->data, &subscriber->context, TRUE, 0);
+			janus_rtp_header_update_at(packet->data, &subscriber->context, TRUE, janus_videoroom_packet_time(packet));
 			if(override_mark_bit && !has_marker_bit) {
 				packet->data->markerbit = 1;
 			}
-			if(gateway != NULL) {
-				janus_plugin_rtp rtp = { .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
-					.extensions = packet->extensions };
-				gateway->relay_rtp(session->handle, &rtp);
-			}
+			janus_videoroom_relay_rtp_to_subscriber(session, packet, FALSE);
 			if(override_mark_bit && !has_marker_bit) {
 				packet->data->markerbit = 0;
 			}
@@ -7632,7 +9457,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 				json_decref(event);
 			}
 			/* If we got here, update the RTP header and send the packet */
-			janus_rtp_header_update(packet->data, &subscriber->context, TRUE, 0);
+			janus_rtp_header_update_at(packet->data, &subscriber->context, TRUE, janus_videoroom_packet_time(packet));
 			char vp8pd[6];
 			if(subscriber->feed && subscriber->feed->vcodec == JANUS_VIDEOCODEC_VP8) {
 				/* For VP8, we save the original payload descriptor, to restore it after */
@@ -7640,12 +9465,9 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 				janus_vp8_simulcast_descriptor_update(payload, plen, &subscriber->vp8_context,
 					subscriber->sim_context.changed_substream);
 			}
-			/* Send the packet */
-			if(gateway != NULL) {
-				janus_plugin_rtp rtp = { .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
-					.extensions = packet->extensions };
-				gateway->relay_rtp(session->handle, &rtp);
-			}
+			/* Send the packet (the VP8 payload descriptor may have been rewritten) */
+			janus_videoroom_relay_rtp_to_subscriber(session, packet,
+				subscriber->feed && subscriber->feed->vcodec == JANUS_VIDEOCODEC_VP8);
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
 			packet->data->seq_number = htons(packet->seq_number);
@@ -7655,13 +9477,9 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			}
 		} else {
 			/* Fix sequence number and timestamp (publisher switching may be involved) */
-			janus_rtp_header_update(packet->data, &subscriber->context, TRUE, 0);
+			janus_rtp_header_update_at(packet->data, &subscriber->context, TRUE, janus_videoroom_packet_time(packet));
 			/* Send the packet */
-			if(gateway != NULL) {
-				janus_plugin_rtp rtp = { .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
-					.extensions = packet->extensions };
-				gateway->relay_rtp(session->handle, &rtp);
-			}
+			janus_videoroom_relay_rtp_to_subscriber(session, packet, FALSE);
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
 			packet->data->seq_number = htons(packet->seq_number);
@@ -7673,13 +9491,9 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			return;
 		}
 		/* Fix sequence number and timestamp (publisher switching may be involved) */
-		janus_rtp_header_update(packet->data, &subscriber->context, FALSE, 0);
+		janus_rtp_header_update_at(packet->data, &subscriber->context, FALSE, janus_videoroom_packet_time(packet));
 		/* Send the packet */
-		if(gateway != NULL) {
-			janus_plugin_rtp rtp = { .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
-				.extensions = packet->extensions };
-			gateway->relay_rtp(session->handle, &rtp);
-		}
+		janus_videoroom_relay_rtp_to_subscriber(session, packet, FALSE);
 		/* Restore the timestamp and sequence number to what the publisher set them to */
 		packet->data->timestamp = htonl(packet->timestamp);
 		packet->data->seq_number = htons(packet->seq_number);
@@ -7715,7 +9529,10 @@ static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data)
 			.buffer = (char *)packet->data,
 			.length = packet->length
 		};
-		gateway->relay_data(session->handle, &data);
+		if(packet->payload != NULL)
+			gateway->relay_data_shared(session->handle, &data, packet->payload);
+		else
+			gateway->relay_data(session->handle, &data);
 	}
 	return;
 }
@@ -7735,6 +9552,92 @@ static void janus_videoroom_rtp_forwarder_rtcp_receive(janus_videoroom_rtp_forwa
 	}
 }
 
+/* Thread receiving media from a remote publisher: when it's told to stop,
+ * or the room goes away, it also takes care of removing the publisher */
+static void *janus_videoroom_remote_publisher_thread(void *data) {
+	janus_videoroom_publisher *publisher = (janus_videoroom_publisher *)data;
+	janus_videoroom_remote_publisher *remote = publisher->remote;
+	janus_videoroom_session *session = publisher->session;
+	JANUS_LOG(LOG_VERB, "[%s] Joining remote publisher thread\n", publisher->user_id_str);
+	char buffer[1500];
+	struct pollfd fds[3];
+	janus_plugin_rtp pkt;
+	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&remote->stop) &&
+			!g_atomic_int_get(&publisher->destroyed) && publisher->room != NULL) {
+		int num = 0;
+		if(remote->audio_fd > -1) {
+			fds[num].fd = remote->audio_fd;
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			num++;
+		}
+		if(remote->video_fd > -1) {
+			fds[num].fd = remote->video_fd;
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			num++;
+		}
+		if(remote->video_rtcp_fd > -1) {
+			fds[num].fd = remote->video_rtcp_fd;
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			num++;
+		}
+		int res = poll(fds, num, 200);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[%s] Error polling remote publisher sockets... %d (%s)\n",
+				publisher->user_id_str, errno, strerror(errno));
+			break;
+		}
+		int i = 0;
+		for(i=0; i<num; i++) {
+			if(!(fds[i].revents & POLLIN))
+				continue;
+			if(fds[i].fd == remote->video_rtcp_fd) {
+				/* Latch the address of the forwarder, that's where we'll send PLIs */
+				struct sockaddr_storage remote_addr;
+				socklen_t addrlen = sizeof(remote_addr);
+				int len = recvfrom(fds[i].fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&remote_addr, &addrlen);
+				if(len > 0) {
+					janus_mutex_lock(&remote->mutex);
+					if(remote->rtcp_addrlen == 0)
+						JANUS_LOG(LOG_VERB, "[%s] Got RTCP latching from remote publisher\n", publisher->user_id_str);
+					memcpy(&remote->rtcp_addr, &remote_addr, addrlen);
+					remote->rtcp_addrlen = addrlen;
+					janus_mutex_unlock(&remote->mutex);
+				}
+				continue;
+			}
+			int len = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+			if(len < 12 || !janus_is_rtp(buffer, len) || publisher->kicked || publisher->room == NULL)
+				continue;
+			pkt.video = (fds[i].fd == remote->video_fd);
+			pkt.buffer = buffer;
+			pkt.length = len;
+			pkt.keyframe = -1;
+			janus_plugin_rtp_extensions_reset(&pkt.extensions);
+			janus_videoroom_incoming_rtp_internal(session, publisher, &pkt);
+		}
+	}
+	if(!g_atomic_int_get(&stopping)) {
+		/* Get rid of the publisher, as we'd do for a local one that goes away */
+		janus_videoroom_hangup_media_internal(session);
+		janus_mutex_lock(&session->mutex);
+		session->participant = NULL;
+		janus_mutex_unlock(&session->mutex);
+		if(publisher->room)
+			janus_videoroom_leave_or_unpublish(publisher, TRUE, FALSE);
+		g_atomic_int_set(&session->destroyed, 1);
+		janus_videoroom_publisher_destroy(publisher);
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Leaving remote publisher thread\n", publisher->user_id_str);
+	janus_refcount_decrease(&publisher->ref);
+	g_atomic_int_dec_and_test(&remote_threads);
+	return NULL;
+}
+
 static void *janus_videoroom_rtp_forwarder_rtcp_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining RTCP thread for RTP forwarders...\n");
 	/* Run the main loop */
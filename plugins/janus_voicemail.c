@@ -24,6 +24,14 @@
  * this project, meaning that it can work out of the box with the VoiceMail
  * demo we provide in the same folder.
  *
+ * Ogg pages are written from the thread that receives the audio frames:
+ * when the asynchronous writer for recordings is enabled in the core
+ * configuration (\c recordings_async in the \c general section), pages are
+ * queued to that writer instead, so that a slow disk doesn't delay the
+ * media. If its backlog is full and it's configured to drop frames, pages
+ * are dropped as a whole, and how many were dropped can be checked via the
+ * Admin API (\c dropped_pages when querying the handle).
+ *
  * \section vmailapi VoiceMail API
  *
  * The VoiceMail API supports just two requests, \c record and \c stop
@@ -112,6 +120,7 @@
 #include "../mutex.h"
 #include "../rtp.h"
 #include "../utils.h"
+#include "../record.h"
 
 
 /* Plugin information */
@@ -203,6 +212,7 @@ typedef struct janus_voicemail_session {
 	gint64 start_time;
 	char *filename;
 	FILE *file;
+	janus_recorder_stream *writer;
 	ogg_stream_state *stream;
 	int seq;
 	volatile gint started;
@@ -225,8 +235,7 @@ static void janus_voicemail_session_free(const janus_refcount *session_ref) {
 	janus_refcount_decrease(&session->handle->ref);
 	/* This session can be destroyed, free all the resources */
 	g_free(session->filename);
-	if(session->file)
-		fclose(session->file);
+	janus_voicemail_close_file(session);
 	g_free(session);
 }
 static void janus_voicemail_message_free(janus_voicemail_message *msg) {
@@ -276,6 +285,7 @@ ogg_packet *op_from_pkt(const unsigned char *pkt, int len);
 void op_free(ogg_packet *op);
 int ogg_write(janus_voicemail_session *session);
 int ogg_flush(janus_voicemail_session *session);
+static void janus_voicemail_close_file(janus_voicemail_session *session);
 
 
 /* Error codes */
@@ -502,6 +512,8 @@ json_t *janus_voicemail_query_session(janus_plugin_session *handle) {
 		json_object_set_new(info, "id", json_integer(session->recording_id));
 		json_object_set_new(info, "start_time", json_integer(session->start_time));
 		json_object_set_new(info, "filename", session->filename ? json_string(session->filename) : NULL);
+		if(session->writer)
+			json_object_set_new(info, "dropped_pages", json_integer(janus_recorder_stream_get_dropped(session->writer)));
 	}
 	json_object_set_new(info, "hangingup", json_integer(g_atomic_int_get(&session->hangingup)));
 	json_object_set_new(info, "destroyed", json_integer(g_atomic_int_get(&session->destroyed)));
@@ -634,9 +646,7 @@ static void janus_voicemail_hangup_media_internal(janus_plugin_session *handle)
 	if(!g_atomic_int_compare_and_exchange(&session->hangingup, 0, 1))
 		return;
 	/* Close and reset stuff */
-	if(session->file)
-		fclose(session->file);
-	session->file = NULL;
+	janus_voicemail_close_file(session);
 	if(session->stream)
 		ogg_stream_destroy(session->stream);
 	session->stream = NULL;
@@ -730,12 +740,14 @@ static void *janus_voicemail_handler(void *data) {
 			ogg_stream_packetin(session->stream, op);
 			op_free(op);
 			ogg_flush(session);
+			/* The stream headers are written synchronously, the rest may be written asynchronously */
+			session->writer = janus_recorder_stream_new(session->file, session->filename);
 			/* Done: now wait for the setup_media callback to be called */
 			event = json_object();
 			json_object_set_new(event, "voicemail", json_string("event"));
 			json_object_set_new(event, "status", json_string(g_atomic_int_get(&session->started) ? "started" : "starting"));
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_voicemail_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("starting"));
 				gateway->notify_event(&janus_voicemail_plugin, session->handle, info);
@@ -757,9 +769,7 @@ static void *janus_voicemail_handler(void *data) {
 			/* Stop the recording */
 			g_atomic_int_set(&session->started, 0);
 			g_atomic_int_set(&session->stopping, 1);
-			if(session->file)
-				fclose(session->file);
-			session->file = NULL;
+			janus_voicemail_close_file(session);
 			if(session->stream)
 				ogg_stream_destroy(session->stream);
 			session->stream = NULL;
@@ -773,7 +783,7 @@ static void *janus_voicemail_handler(void *data) {
 				json_object_set_new(event, "recording", json_string(url));
 			}
 			/* Also notify event handlers */
-			if(notify_events && gateway->events_is_enabled()) {
+			if(notify_events && gateway->events_is_wanted(&janus_voicemail_plugin)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "event", json_string("done"));
 				gateway->notify_event(&janus_voicemail_plugin, session->handle, info);
@@ -956,26 +966,46 @@ void op_free(ogg_packet *op) {
 	}
 }
 
+/* Write a single ogg page, either directly or via the stream writer */
+static int ogg_write_page(janus_voicemail_session *session, ogg_page *page) {
+	if(session->writer != NULL) {
+		struct iovec iov[2] = {
+			{ .iov_base = page->header, .iov_len = page->header_len },
+			{ .iov_base = page->body, .iov_len = page->body_len }
+		};
+		/* A dropped page (-2) is accounted by the writer, and is not an error */
+		if(janus_recorder_stream_writev(session->writer, iov, 2) == -1) {
+			JANUS_LOG(LOG_ERR, "Error writing Ogg page\n");
+			return -2;
+		}
+		return 0;
+	}
+	size_t written = fwrite(page->header, 1, page->header_len, session->file);
+	if(written != (size_t)page->header_len) {
+		JANUS_LOG(LOG_ERR, "Error writing Ogg page header\n");
+		return -2;
+	}
+	written = fwrite(page->body, 1, page->body_len, session->file);
+	if(written != (size_t)page->body_len) {
+		JANUS_LOG(LOG_ERR, "Error writing Ogg page body\n");
+		return -3;
+	}
+	return 0;
+}
+
 /* Write out available ogg pages */
 int ogg_write(janus_voicemail_session *session) {
 	ogg_page page;
-	size_t written;
+	int res = 0;
 
 	if(!session || !session->stream || !session->file) {
 		return -1;
 	}
 
 	while (ogg_stream_pageout(session->stream, &page)) {
-		written = fwrite(page.header, 1, page.header_len, session->file);
-		if(written != (size_t)page.header_len) {
-			JANUS_LOG(LOG_ERR, "Error writing Ogg page header\n");
-			return -2;
-		}
-		written = fwrite(page.body, 1, page.body_len, session->file);
-		if(written != (size_t)page.body_len) {
-			JANUS_LOG(LOG_ERR, "Error writing Ogg page body\n");
-			return -3;
-		}
+		res = ogg_write_page(session, &page);
+		if(res < 0)
+			return res;
 	}
 	return 0;
 }
@@ -983,23 +1013,26 @@ int ogg_write(janus_voicemail_session *session) {
 /* Flush remaining ogg data */
 int ogg_flush(janus_voicemail_session *session) {
 	ogg_page page;
-	size_t written;
+	int res = 0;
 
 	if(!session || !session->stream || !session->file) {
 		return -1;
 	}
 
 	while (ogg_stream_flush(session->stream, &page)) {
-		written = fwrite(page.header, 1, page.header_len, session->file);
-		if(written != (size_t)page.header_len) {
-			JANUS_LOG(LOG_ERR, "Error writing Ogg page header\n");
-			return -2;
-		}
-		written = fwrite(page.body, 1, page.body_len, session->file);
-		if(written != (size_t)page.body_len) {
-			JANUS_LOG(LOG_ERR, "Error writing Ogg page body\n");
-			return -3;
-		}
+		res = ogg_write_page(session, &page);
+		if(res < 0)
+			return res;
 	}
 	return 0;
 }
+
+/* Wait for pending writes, if any, and close the recording */
+static void janus_voicemail_close_file(janus_voicemail_session *session) {
+	if(session->writer)
+		janus_recorder_stream_close(session->writer);
+	session->writer = NULL;
+	if(session->file)
+		fclose(session->file);
+	session->file = NULL;
+}
@@ -0,0 +1,61 @@
+-- Helpers to use the FFI bindings of the Lua plugin, which are only
+-- available when it's built against LuaJIT (--enable-luajit): the
+-- relay functions are called as C functions via ffi.C, and can be
+-- passed the pointers the incomingRtpFfi() and incomingDataFfi()
+-- callbacks get, without copying the packets into Lua strings. When
+-- FFI is not available, the wrappers invoke the regular functions,
+-- which expect Lua strings instead.
+
+local JANUSFFI = {}
+
+local hasFfi, ffi = pcall(require, "ffi")
+JANUSFFI.available = hasFfi
+
+if hasFfi then
+	ffi.cdef[[
+		int janus_lua_ffi_relay_rtp(uint32_t id, int video, const char *buf, int len);
+		int janus_lua_ffi_relay_rtcp(uint32_t id, int video, const char *buf, int len);
+		int janus_lua_ffi_relay_text_data(uint32_t id, const char *buf, int len);
+		int janus_lua_ffi_relay_binary_data(uint32_t id, const char *buf, int len);
+	]]
+end
+
+-- Get a byte pointer to a buffer passed to one of the FFI callbacks
+function JANUSFFI.bytes(buf)
+	return ffi.cast("uint8_t *", buf)
+end
+
+-- Get a copy of a buffer passed to one of the FFI callbacks as a Lua string
+function JANUSFFI.string(buf, len)
+	return ffi.string(buf, len)
+end
+
+function JANUSFFI.relayRtp(id, video, buf, len)
+	if hasFfi then
+		return ffi.C.janus_lua_ffi_relay_rtp(id, video and 1 or 0, buf, len)
+	end
+	return relayRtp(id, video, buf, len)
+end
+
+function JANUSFFI.relayRtcp(id, video, buf, len)
+	if hasFfi then
+		return ffi.C.janus_lua_ffi_relay_rtcp(id, video and 1 or 0, buf, len)
+	end
+	return relayRtcp(id, video, buf, len)
+end
+
+function JANUSFFI.relayTextData(id, buf, len)
+	if hasFfi then
+		return ffi.C.janus_lua_ffi_relay_text_data(id, buf, len)
+	end
+	return relayTextData(id, buf, len)
+end
+
+function JANUSFFI.relayBinaryData(id, buf, len)
+	if hasFfi then
+		return ffi.C.janus_lua_ffi_relay_binary_data(id, buf, len)
+	end
+	return relayBinaryData(id, buf, len)
+end
+
+return JANUSFFI
@@ -44,14 +44,63 @@ void janus_plugin_rtp_extensions_reset(janus_plugin_rtp_extensions *extensions)
 		extensions->video_rotation = -1;
 		extensions->video_back_camera = FALSE;
 		extensions->video_flipped = FALSE;
+		extensions->map = NULL;
 	}
 }
 void janus_plugin_rtp_reset(janus_plugin_rtp *packet) {
 	if(packet) {
 		memset(packet, 0, sizeof(janus_plugin_rtp));
+		packet->keyframe = -1;
 		janus_plugin_rtp_extensions_reset(&packet->extensions);
 	}
 }
+static void janus_plugin_rtp_payload_free(const janus_refcount *payload_ref) {
+	janus_plugin_rtp_payload *payload = janus_refcount_containerof(payload_ref, janus_plugin_rtp_payload, ref);
+	/* The data is allocated together with the struct */
+	g_free(payload);
+}
+janus_plugin_rtp_payload *janus_plugin_rtp_payload_new(const char *buffer, uint16_t length) {
+	janus_plugin_rtp_payload *payload = g_malloc(sizeof(janus_plugin_rtp_payload) + length);
+	payload->buffer = (char *)payload + sizeof(janus_plugin_rtp_payload);
+	payload->length = length;
+	if(buffer != NULL && length > 0)
+		memcpy(payload->buffer, buffer, length);
+	janus_refcount_init(&payload->ref, janus_plugin_rtp_payload_free);
+	return payload;
+}
+void janus_plugin_rtp_payload_ref(janus_plugin_rtp_payload *payload) {
+	if(payload)
+		janus_refcount_increase(&payload->ref);
+}
+void janus_plugin_rtp_payload_unref(janus_plugin_rtp_payload *payload) {
+	if(payload)
+		janus_refcount_decrease(&payload->ref);
+}
+static void janus_plugin_event_free(const janus_refcount *event_ref) {
+	janus_plugin_event *event = janus_refcount_containerof(event_ref, janus_plugin_event, ref);
+	/* This event can be destroyed, free all the resources */
+	if(event->shared && event->shared_free)
+		event->shared_free(event->shared);
+	json_decref(event->message);
+	g_free(event);
+}
+janus_plugin_event *janus_plugin_event_new(json_t *message) {
+	if(message == NULL)
+		return NULL;
+	janus_plugin_event *event = g_malloc0(sizeof(janus_plugin_event));
+	event->message = json_incref(message);
+	janus_mutex_init(&event->mutex);
+	janus_refcount_init(&event->ref, janus_plugin_event_free);
+	return event;
+}
+void janus_plugin_event_ref(janus_plugin_event *event) {
+	if(event)
+		janus_refcount_increase(&event->ref);
+}
+void janus_plugin_event_unref(janus_plugin_event *event) {
+	if(event)
+		janus_refcount_decrease(&event->ref);
+}
 void janus_plugin_rtcp_reset(janus_plugin_rtcp *packet) {
 	if(packet)
 		memset(packet, 0, sizeof(janus_plugin_rtcp));
@@ -18,9 +18,22 @@
  * the syntax of the message/event is completely up to you, the only
  * important thing is that it MUST be a JSON object, as it will be included
  * as such within the Janus session/handle protocol;
+ * - \c push_event_shared(): to send the same JSON event to many peers
+ * (e.g., all the participants in a room), so that the core can
+ * serialize it only once for all of them;
  * - \c relay_rtp(): to send/relay the peer an RTP packet;
+ * - \c relay_rtp_shared(): to send/relay the peer an RTP packet whose
+ * payload is shared with other peers (e.g., when fanning out the same
+ * media to many subscribers), without copying it upfront;
  * - \c relay_rtcp(): to send/relay the peer an RTCP message.
  * - \c relay_data(): to send/relay the peer a SCTP DataChannel message.
+ * - \c relay_data_shared(): to send/relay the peer a SCTP DataChannel
+ * message whose content is shared with other peers, without copying it.
+ * - \c get_data_pending(): to check how much data channel data is still
+ * queued in the core, e.g., to hold new messages back until \c data_ready().
+ * - \c account_memory(): to tell the core about buffers the plugin keeps
+ * (e.g., queues of packets), so that they're part of the memory the Admin
+ * API reports for the handle or the plugin they belong to.
  *
  * On the other hand, a plugin that wants to register at the Janus core
  * needs to implement the \c janus_plugin interface. Besides, as a
@@ -63,16 +76,20 @@ janus_plugin *create(void) {
  * - \c handle_admin_message(): a callback to notify you a message/request came from the Admin API;
  * - \c setup_media(): a callback to notify you the peer PeerConnection is now ready to be used;
  * - \c incoming_rtp(): a callback to notify you a peer has sent you a RTP packet;
+ * - \c incoming_rtp_batch(): a callback to notify you a peer has sent you
+ * several RTP packets, if batching is enabled in the core configuration;
  * - \c incoming_rtcp(): a callback to notify you a peer has sent you a RTCP message;
  * - \c incoming_data(): a callback to notify you a peer has sent you a message on a SCTP DataChannel;
  * - \c data_ready(): a callback to notify you data can be sent on the SCTP DataChannel;
  * - \c slow_link(): a callback to notify you a peer has sent a lot of NACKs recently, and the media path may be slow;
  * - \c hangup_media(): a callback to notify you the peer PeerConnection has been closed (e.g., after a DTLS alert);
  * - \c query_session(): this method is called by the core to get plugin-specific info on a session between you and a peer;
- * - \c destroy_session(): this method is called by the core to destroy a session between you and a peer.
+ * - \c destroy_session(): this method is called by the core to destroy a session between you and a peer;
+ * - \c query_metrics(): this method is called by the core to get plugin-specific gauges (e.g., how many rooms exist) for its metrics.
  *
  * All the above methods and callbacks, except for \c incoming_rtp ,
- * \c incoming_rtcp , \c incoming_data and \c slow_link , are mandatory:
+ * \c incoming_rtp_batch , \c incoming_rtcp , \c incoming_data , \c slow_link
+ * and \c query_metrics , are mandatory:
  * the Janus core will reject a plugin that doesn't implement any of the
  * mandatory callbacks. The previously mentioned ones, instead, are
  * optional, so you're free to implement only those you care about. If
@@ -171,7 +188,7 @@ janus_plugin *create(void) {
  * Janus instance or it will crash.
  *
  */
-#define JANUS_PLUGIN_API_VERSION	15
+#define JANUS_PLUGIN_API_VERSION	26
 
 /*! \brief Initialization of all plugin properties to NULL
  *
@@ -211,6 +228,8 @@ static janus_plugin janus_echotest_plugin =
 		.hangup_media = NULL,			\
 		.destroy_session = NULL,		\
 		.query_session = NULL, 			\
+		.query_metrics = NULL, 			\
+		.incoming_rtp_batch = NULL,		\
 		## __VA_ARGS__ }
 
 
@@ -227,6 +246,10 @@ typedef struct janus_plugin_result janus_plugin_result;
 typedef struct janus_plugin_rtp janus_plugin_rtp;
 /*! \brief RTP extensions parsed in an RTP packet */
 typedef struct janus_plugin_rtp_extensions janus_plugin_rtp_extensions;
+/*! \brief Refcounted RTP payload that can be shared by several RTP packets */
+typedef struct janus_plugin_rtp_payload janus_plugin_rtp_payload;
+/*! \brief Refcounted event that can be pushed to several peers */
+typedef struct janus_plugin_event janus_plugin_event;
 /*! \brief RTCP message exchanged with the core */
 typedef struct janus_plugin_rtcp janus_plugin_rtcp;
 /*! \brief Data message exchanged with the core */
@@ -347,6 +370,23 @@ struct janus_plugin {
 	 * @param[in] handle The plugin/gateway session used for this peer
 	 * @returns A json_t object with the requested info */
 	json_t *(* const query_session)(janus_plugin_session *handle);
+	/*! \brief Method to get plugin-specific gauges for the core metrics (optional)
+	 *  \note This may be called often, and while media is flowing: don't take
+	 * global locks here, return values you keep up to date as things change
+	 * @returns A json_t object where each property is a gauge (e.g., "rooms": 3), or NULL */
+	json_t *(* const query_metrics)(void);
+	/*! \brief Method to handle several incoming RTP packets from a peer at once (optional)
+	 * \note When a plugin implements this, and batching is enabled in the core
+	 * configuration, the core collects the packets it receives for the handle
+	 * in the same loop iteration (up to the configured size) and passes them
+	 * here, rather than calling incoming_rtp for each of them: packets that
+	 * can't be batched (e.g., because they're too large) still go through
+	 * incoming_rtp, so that one MUST be implemented as well. The packets and
+	 * their buffers are only valid for the duration of the callback.
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] packets The RTP packets, in the order they were received
+	 * @param[in] count How many packets there are */
+	void (* const incoming_rtp_batch)(janus_plugin_session *handle, janus_plugin_rtp **packets, int count);
 
 };
 
@@ -362,11 +402,37 @@ struct janus_callbacks {
 	 * @param[in] message The json_t object containing the JSON message
 	 * @param[in] jsep The json_t object containing the JSEP type, the SDP attached to the message/event, if any (offer/answer), and whether this is an update */
 	int (* const push_event)(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep);
+	/*! \brief Callback to push the same event/message to many peers
+	 * @note The core serializes the event the first time it's pushed, and
+	 * reuses the result for all the other peers, only changing the parts of
+	 * the Janus protocol envelope that are specific to each of them. As such,
+	 * the message MUST NOT be modified after the event has been created, and
+	 * no JSEP can be attached: use push_event for peer-specific content.
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] plugin The plugin instance that is sending the message/event
+	 * @param[in] transaction The transaction identifier this message refers to
+	 * @param[in] event The shared event, created with janus_plugin_event_new */
+	int (* const push_event_shared)(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, janus_plugin_event *event);
 
 	/*! \brief Callback to relay RTP packets to a peer
+	 * @note The core builds the packet it will send (with its own header
+	 * extensions) before this returns, so the plugin is free to modify the
+	 * buffer in place before the call and restore it right after, without
+	 * making copies of its own: that's what plugins forwarding the media
+	 * they receive (e.g., the EchoTest and VideoCall) do for simulcast
 	 * @param[in] handle The plugin/gateway session used for this peer
 	 * @param[in] packet The RTP packet and related data */
 	void (* const relay_rtp)(janus_plugin_session *handle, janus_plugin_rtp *packet);
+	/*! \brief Callback to relay RTP packets to a peer, using a shared payload
+	 * @note Only the RTP header in the packet buffer is used, while the payload
+	 * is taken from the shared instance: the core keeps a reference to it until
+	 * the packet is encrypted, which is when it's copied, so the plugin can
+	 * pass the same payload to as many peers as needed and then unref it. The
+	 * payload MUST NOT be modified after it has been passed to the core.
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] packet The RTP packet and related data (only the header is used)
+	 * @param[in] payload The shared RTP payload */
+	void (* const relay_rtp_shared)(janus_plugin_session *handle, janus_plugin_rtp *packet, janus_plugin_rtp_payload *payload);
 	/*! \brief Callback to relay RTCP messages to a peer
 	 * @param[in] handle The plugin/gateway session that will be used for this peer
 	 * @param[in] packet The RTCP packet and related data */
@@ -378,6 +444,15 @@ struct janus_callbacks {
 	 * @param[in] handle The plugin/gateway session that will be used for this peer
 	 * @param[in] packet The message data and related info */
 	void (* const relay_data)(janus_plugin_session *handle, janus_plugin_data *packet);
+	/*! \brief Callback to check how many bytes of data channel messages the core
+	 * queued for a peer, because its SCTP association couldn't take them yet
+	 * \note The core only queues up to a configured limit, and drops messages
+	 * beyond that: plugins that don't want messages dropped can stop sending
+	 * when this is not zero, and resume when data_ready is invoked (which, with
+	 * the "notify" policy, only happens when the queue has been drained)
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @returns How many bytes are queued */
+	size_t (* const get_data_pending)(janus_plugin_session *handle);
 
 	/*! \brief Helper to ask for a keyframe via a RTCP PLI
 	 * @note This is a shortcut, as it is also possible to do the same by crafting
@@ -405,6 +480,13 @@ struct janus_callbacks {
 	/*! \brief Callback to check whether the event handlers mechanism is enabled
 	 * @returns TRUE if it is, FALSE if it isn't (which means notify_event should NOT be called) */
 	gboolean (* const events_is_enabled)(void);
+	/*! \brief Callback to check whether any event handler would receive an event from this plugin
+	 * \note Unlike events_is_enabled, this also takes into account the events each
+	 * handler subscribed to and the plugins that were excluded in the core
+	 * configuration: use it before preparing an event, to avoid building it for nobody
+	 * @param[in] plugin The plugin that would originate the event
+	 * @returns TRUE if at least a handler is interested, FALSE otherwise */
+	gboolean (* const events_is_wanted)(janus_plugin *plugin);
 	/*! \brief Callback to notify an event to the registered and subscribed event handlers
 	 * \note Don't unref the event object, the core will do that for you
 	 * @param[in] plugin The plugin originating the event
@@ -423,6 +505,26 @@ struct janus_callbacks {
 	 * @param[in] desc The descriptor to search for
 	 * @returns TRUE if the token is valid, not expired and contains the descriptor, FALSE otherwise */
 	gboolean (* const auth_signature_contains)(janus_plugin *plugin, const char *token, const char *descriptor);
+
+	/*! \brief Callback to account memory the plugin allocated or released
+	 * \note This is only bookkeeping, and is cheap enough to be called per
+	 * packet: the plugin is responsible for accounting back what it released.
+	 * Memory accounted for a handle stops being tracked when the handle goes away
+	 * @param[in] plugin The plugin using the memory
+	 * @param[in] handle The plugin/gateway session the memory is used for, or NULL if it's plugin-wide
+	 * @param[in] bytes How many bytes were allocated (positive) or released (negative) */
+	void (* const account_memory)(janus_plugin *plugin, janus_plugin_session *handle, int bytes);
+
+	/*! \brief Callback to relay SCTP/DataChannel messages to a peer, using a shared payload
+	 * @note The content of the message is taken from the shared instance (the
+	 * buffer in the packet is ignored), which the core keeps a reference to
+	 * until the message has been handed to the SCTP stack: this means the plugin
+	 * can send the same message to as many peers as needed, and then unref it.
+	 * The payload MUST NOT be modified after it has been passed to the core.
+	 * @param[in] handle The plugin/gateway session that will be used for this peer
+	 * @param[in] packet The message info (label, protocol, binary or text)
+	 * @param[in] payload The shared message content */
+	void (* const relay_data_shared)(janus_plugin_session *handle, janus_plugin_data *packet, janus_plugin_rtp_payload *payload);
 };
 
 /*! \brief The hook that plugins need to implement to be created from the Janus core */
@@ -558,6 +660,12 @@ struct janus_plugin_rtp_extensions {
 	/*! \brief Whether the video orientation extension says it's flipped horizontally
 	 * @note Will be ignored if no rotation value is set */
 	gboolean video_flipped;
+	/*! \brief Where the extensions are in the packet, if the core already looked
+	 * (see janus_rtp_header_extensions_map in rtp.h), to use with the
+	 * janus_rtp_header_extension_map_* helpers; this is only set for packets
+	 * passed to incoming_rtp, and only valid for the duration of the callback.
+	 * The core ignores it for packets plugins send via relay_rtp */
+	const struct janus_rtp_header_extensions_map *map;
 };
 /*! \brief Helper method to initialise/reset the RTP extensions field
  * @note This is important because each of the supported extensions may
@@ -575,6 +683,12 @@ struct janus_plugin_rtp {
 	char *buffer;
 	/*! \brief The packet length */
 	uint16_t length;
+	/*! \brief Whether this packet carries (the start of) a video keyframe, as
+	 * detected by the core once for the negotiated codec: 1 if it does, 0 if it
+	 * doesn't, -1 if the core couldn't tell (e.g., unknown codec), in which case
+	 * plugins that care have to inspect the payload themselves
+	 * @note Only meaningful for packets the core passes to plugins */
+	int keyframe;
 	/*! \brief RTP extensions */
 	janus_plugin_rtp_extensions extensions;
 };
@@ -585,6 +699,57 @@ struct janus_plugin_rtp {
 */
 void janus_plugin_rtp_reset(janus_plugin_rtp *packet);
 
+/*! \brief Janus plugin shared RTP payload
+ * @note Instances are read-only once created, and are destroyed when the
+ * last reference (the plugin's or the packets queued by the core) goes away */
+struct janus_plugin_rtp_payload {
+	/*! \brief The payload data */
+	char *buffer;
+	/*! \brief The payload length */
+	uint16_t length;
+	/*! \brief Reference counter for this instance */
+	janus_refcount ref;
+};
+/*! \brief Helper method to create a new shared RTP payload
+ * @note The data is copied, so the provided buffer can be reused after this call
+ * @param[in] buffer The payload data to copy
+ * @param[in] length The payload length
+ * @returns A pointer to a new janus_plugin_rtp_payload instance, with a reference already held */
+janus_plugin_rtp_payload *janus_plugin_rtp_payload_new(const char *buffer, uint16_t length);
+/*! \brief Helper method to add a reference to a shared RTP payload
+ * @param[in] payload The janus_plugin_rtp_payload instance to reference */
+void janus_plugin_rtp_payload_ref(janus_plugin_rtp_payload *payload);
+/*! \brief Helper method to release a reference to a shared RTP payload
+ * @param[in] payload The janus_plugin_rtp_payload instance to unreference */
+void janus_plugin_rtp_payload_unref(janus_plugin_rtp_payload *payload);
+
+/*! \brief Janus plugin shared event
+ * @note Instances are read-only once created, and are destroyed when the
+ * last reference goes away: the core only uses them while pushing them */
+struct janus_plugin_event {
+	/*! \brief The event/message, as it would be passed to push_event */
+	json_t *message;
+	/*! \brief Opaque core-side data (the event serialized for transports), created on the first push */
+	void *shared;
+	/*! \brief Function the core set to free the shared data, if any */
+	void (*shared_free)(void *shared);
+	/*! \brief Mutex to protect the shared data */
+	janus_mutex mutex;
+	/*! \brief Reference counter for this instance */
+	janus_refcount ref;
+};
+/*! \brief Helper method to create a new shared event
+ * @note A reference to the message is added, so the plugin can decrease its own after this call
+ * @param[in] message The json_t object containing the JSON message
+ * @returns A pointer to a new janus_plugin_event instance, with a reference already held */
+janus_plugin_event *janus_plugin_event_new(json_t *message);
+/*! \brief Helper method to add a reference to a shared event
+ * @param[in] event The janus_plugin_event instance to reference */
+void janus_plugin_event_ref(janus_plugin_event *event);
+/*! \brief Helper method to release a reference to a shared event
+ * @param[in] event The janus_plugin_event instance to unreference */
+void janus_plugin_event_unref(janus_plugin_event *event);
+
 /*! \brief Janus plugin RTCP packet */
 struct janus_plugin_rtcp {
 	/*! \brief Whether this is an audio or video RTCP packet */
@@ -593,6 +758,12 @@ struct janus_plugin_rtcp {
 	char *buffer;
 	/*! \brief The packet length */
 	uint16_t length;
+	/*! \brief What the packet contained when the core received it, if
+	 * available (see janus_rtcp_summarize in rtcp.h): this is only set for
+	 * packets passed to incoming_rtcp, and is NULL for the packets plugins
+	 * send via relay_rtcp. Notice that the core may have removed the NACKs
+	 * it handled from the buffer already, so the two may not match there */
+	const struct janus_rtcp_summary *summary;
 };
 /*! \brief Helper method to initialise/reset the RTCP packet
  * @param[in] packet Pointer to the janus_plugin_rtcp packet to reset
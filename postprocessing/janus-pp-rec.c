@@ -46,7 +46,7 @@
  * show something like this:
  *
 \verbatim
-Usage: janus-pp-rec [OPTIONS] source.mjr [destination.[opus|wav|webm|mp4|srt]]
+Usage: janus-pp-rec [OPTIONS] source.mjr [destination.[opus|wav|webm|mp4|mkv|m3u8|srt]]
 
   -h, --help                    Print help and exit
   -V, --version                 Print version and exit
@@ -70,18 +70,61 @@ Usage: janus-pp-rec [OPTIONS] source.mjr [destination.[opus|wav|webm|mp4|srt]]
   -f, --format=STRING           Specifies the output format (overrides the
                                   format from the destination)  (possible
                                   values="opus", "wav", "webm", "mp4",
-                                  "srt")
+                                  "mkv", "m3u8", "srt")
   -t, --faststart               For mp4 files write the MOOV atom at the head
                                   of the file  (default=off)
   -S, --audioskew=milliseconds  Time threshold to trigger an audio skew
                                   compensation, disabled if 0 (default=0)
+  -A, --mux-audio=audio.mjr     Opus recording to mux with the video source in
+                                  the same file, in a single pass (only webm,
+                                  mkv, mp4 and m3u8)
+  -T, --hls-time=seconds        Target duration of the fMP4 segments when
+                                  generating an m3u8 playlist (default=6)
+  -P, --hls-append              Append the new segments to an existing m3u8
+                                  playlist, e.g., when processing consecutive
+                                  .mjr segments  (default=off)
 \endverbatim
+ *
+ * If you have an Opus recording and a VP8, VP9 or H.264 recording
+ * belonging to the same media session, you can also mux them in the same
+ * .webm, .mkv or .mp4 file by passing the audio recording via \c --mux-audio
+ * and the video recording as the source, e.g.:
+ *
+\verbatim
+./janus-pp-rec --mux-audio=/path/to/audio.mjr /path/to/video.mjr /path/to/destination.[webm|mkv|mp4]
+\endverbatim
+ *
+ * In that case the two recordings are parsed in parallel by two different
+ * threads and muxed in a single streaming pass: packets are reordered
+ * within a small window, rather than by indexing the whole recordings in
+ * memory first, so memory usage doesn't depend on how long they are. The
+ * two tracks are aligned using the time their first frame was written.
+ *
+ * The same single pass can generate an HLS playlist made of fragmented
+ * MP4 (CMAF) segments, rather than a single file, if you pass an \c .m3u8
+ * destination: in that case the audio recording is optional, and the
+ * video recording must be H.264 or VP9. The target duration of the
+ * segments can be set via \c --hls-time (segments are only cut on
+ * keyframes, though). When recordings are split in rolling .mjr segments,
+ * you can process them one after the other as they're closed, and pass
+ * \c --hls-append to add the new fMP4 segments to the same playlist: this
+ * gives you a near-live HLS version of the session, with no transcoding
+ * involved, e.g.:
+ *
+\verbatim
+./janus-pp-rec --hls-append --mux-audio=/path/to/audio-00003.mjr /path/to/video-00003.mjr /path/to/playlist.m3u8
+\endverbatim
+ *
+ * If you want to know how fast the post-processor is on your machine,
+ * e.g., to size the workers that will convert your recordings, you can
+ * use the \c postprocessing/pp-bench.sh script (or \c make \c bench-postprocessing ):
+ * it processes either synthetic recordings for all the supported codecs,
+ * or a folder of your own .mjr files, and reports MB/s, frames/s and the
+ * peak memory usage for each of them.
  *
  * \note This utility does not do any form of transcoding. It just
  * depacketizes the RTP frames in order to get the payload, and saves
- * the frames in a valid container. Any further post-processing (e.g.,
- * muxing audio and video belonging to the same media session in a single
- * .webm file) is up to third-party applications.
+ * the frames in a valid container.
  *
  * \ingroup postprocessing
  * \ref postprocessing
@@ -112,6 +155,7 @@ Usage: janus-pp-rec [OPTIONS] source.mjr [destination.[opus|wav|webm|mp4|srt]]
 #include "pp-g711.h"
 #include "pp-g722.h"
 #include "pp-srt.h"
+#include "pp-mux.h"
 
 #define htonll(x) ((1==htonl(1)) ? (x) : ((gint64)htonl((x) & 0xFFFFFFFF) << 32) | htonl((x) >> 32))
 #define ntohll(x) ((1==ntohl(1)) ? (x) : ((gint64)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32))
@@ -246,7 +290,9 @@ int main(int argc, char *argv[])
 				(strcmp(setting, "-v")) && (strcmp(setting, "--videoorient-ext")) &&
 				(strcmp(setting, "-d")) && (strcmp(setting, "--debug-level")) &&
 				(strcmp(setting, "-f")) && (strcmp(setting, "--format")) &&
-				(strcmp(setting, "-S")) && (strcmp(setting, "--audioskew"))
+				(strcmp(setting, "-S")) && (strcmp(setting, "--audioskew")) &&
+				(strcmp(setting, "-A")) && (strcmp(setting, "--mux-audio")) &&
+				(strcmp(setting, "-T")) && (strcmp(setting, "--hls-time"))
 		)) {
 			if(source == NULL)
 				source = argv[i];
@@ -302,6 +348,7 @@ int main(int argc, char *argv[])
 		extension++;
 		if(strcasecmp(extension, "opus") && strcasecmp(extension, "wav") &&
 				strcasecmp(extension, "webm") && strcasecmp(extension, "mp4") &&
+				strcasecmp(extension, "mkv") && strcasecmp(extension, "m3u8") &&
 				strcasecmp(extension, "srt")) {
 			/* Unsupported extension? */
 			JANUS_LOG(LOG_ERR, "Unsupported extension '%s'\n", extension);
@@ -316,6 +363,38 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	gboolean hls = !strcasecmp(extension ? extension : "", "m3u8");
+	if((args_info.mux_audio_given || hls) && !jsonheader_only && !header_only && !parse_only) {
+		/* Mux the audio and video recordings in a single pass */
+		if(extension == NULL || (strcasecmp(extension, "webm") && strcasecmp(extension, "mkv") &&
+				strcasecmp(extension, "mp4") && !hls)) {
+			JANUS_LOG(LOG_ERR, "Muxing audio and video is only supported for webm, mkv, mp4 and m3u8 files\n");
+			cmdline_parser_free(&args_info);
+			exit(1);
+		}
+		if(args_info.mux_audio_given)
+			JANUS_LOG(LOG_INFO, "Muxing with audio file: %s\n", args_info.mux_audio_arg);
+		int hls_time = args_info.hls_time_given ? args_info.hls_time_arg : 0;
+		if(hls && hls_time < 0) {
+			JANUS_LOG(LOG_ERR, "Invalid HLS segment duration %d\n", hls_time);
+			cmdline_parser_free(&args_info);
+			exit(1);
+		}
+		working = 1;
+		signal(SIGINT, janus_pp_handle_signal);
+		int res = janus_pp_mux_process(args_info.mux_audio_given ? args_info.mux_audio_arg : NULL,
+			source, destination, extension, metadata, janus_faststart,
+			hls_time, args_info.hls_append_given, &working);
+		g_free(metadata);
+		cmdline_parser_free(&args_info);
+		JANUS_LOG(LOG_INFO, "Bye!\n");
+		exit(res < 0 ? 1 : 0);
+	} else if(!strcasecmp(extension ? extension : "", "mkv")) {
+		JANUS_LOG(LOG_ERR, "mkv files are only supported when muxing audio and video (--mux-audio)\n");
+		cmdline_parser_free(&args_info);
+		exit(1);
+	}
+
 	FILE *file = fopen(source, "rb");
 	if(file == NULL) {
 		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
@@ -601,6 +680,15 @@ int main(int argc, char *argv[])
 				JANUS_LOG(LOG_INFO, "  -- Written: %"SCNi64"\n", w_time);
 				if(e2ee)
 					JANUS_LOG(LOG_INFO, "  -- Recording is end-to-end encrypted\n");
+				/* Is this a segment of a longer recording? */
+				json_t *segment = json_object_get(info, "g");
+				if(segment && json_is_integer(segment)) {
+					json_t *soffset = json_object_get(info, "go");
+					json_t *previous = json_object_get(info, "gp");
+					JANUS_LOG(LOG_INFO, "  -- Segment: %"JSON_INTEGER_FORMAT" (%"JSON_INTEGER_FORMAT"ms since start, previous: %s)\n",
+						json_integer_value(segment), json_integer_value(soffset),
+						json_is_string(previous) ? json_string_value(previous) : "none");
+				}
 				/* Save the original string as a metadata to save in the media container, if possible */
 				if(metadata == NULL)
 					metadata = g_strdup(prebuffer);
@@ -20,6 +20,12 @@
  *
  * An attempt to process a non-RTP recording will result in an error.
  *
+ * The recording is processed in a single sequential pass, with large
+ * buffers for both reading and writing and no per-packet allocations, so
+ * the memory footprint doesn't depend on the size of the recording; this
+ * also means multiple recordings can be converted in parallel by simply
+ * launching multiple instances of the tool (e.g., via \c xargs \c -P).
+ *
  * \ingroup postprocessing
  * \ref postprocessing
  */
@@ -54,6 +60,8 @@ int lock_debug = 0;
 
 int working = 0;
 
+/* Size of the buffers we read the recording and write the capture with */
+#define MJR2PCAP_BUFFER_SIZE	(4*1024*1024)
 
 /* Helper struct to define a libpcap global header
  * https://wiki.wireshark.org/Development/LibpcapFileFormat */
@@ -147,6 +155,12 @@ static void janus_pp_handle_signal(int signum) {
 }
 
 
+/* Helper to read exactly the bytes we need from the recording */
+static gboolean mjr2pcap_read(FILE *file, void *buffer, size_t size) {
+	return fread(buffer, sizeof(char), size, file) == size;
+}
+
+
 /* Main Code */
 int main(int argc, char *argv[])
 {
@@ -163,63 +177,56 @@ int main(int argc, char *argv[])
 	destination = argv[2];
 	JANUS_LOG(LOG_INFO, "%s --> %s\n", source, destination);
 
-	/* Open the source file */
+	/* Open the source file: we read it sequentially, with a large buffer */
 	FILE *file = fopen(source, "rb");
 	if(file == NULL) {
 		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
 		exit(1);
 	}
-	fseek(file, 0L, SEEK_END);
-	long fsize = ftell(file);
-	fseek(file, 0L, SEEK_SET);
-	JANUS_LOG(LOG_INFO, "File is %zu bytes\n", fsize);
+	setvbuf(file, NULL, _IOFBF, MJR2PCAP_BUFFER_SIZE);
+
+	/* Create the target file */
+	FILE *outfile = fopen(destination, "wb");
+	if(outfile == NULL) {
+		fclose(file);
+		JANUS_LOG(LOG_ERR, "Couldn't open output file\n");
+		exit(1);
+	}
+	setvbuf(outfile, NULL, _IOFBF, MJR2PCAP_BUFFER_SIZE);
+	/* Start with the PCAP header */
+	mjr2pcap_global_header pcap_header = {
+		0xa1b2c3d4, 2, 4, 0, 0, 65535, 1
+	};
+	fwrite(&pcap_header, sizeof(char), sizeof(pcap_header), outfile);
 
 	/* Handle SIGINT */
 	working = 1;
 	signal(SIGINT, janus_pp_handle_signal);
 
-	/* Pre-parse */
-	JANUS_LOG(LOG_INFO, "Pre-parsing file...\n");
+	/* Iterate on all packets in a single pass: the info header always comes
+	 * first, so we can parse it as we go and save RTP packets right away */
+	JANUS_LOG(LOG_INFO, "Traversing RTP packets...\n");
 	gboolean has_timestamps = FALSE;
 	gboolean parsed_header = FALSE;
 	json_t *mjr_header = NULL;
-	int bytes = 0;
 	long offset = 0;
 	uint16_t len = 0;
 	gint64 started = 0;
-	char prebuffer[1500];
-	memset(prebuffer, 0, 1500);
-	/* Let's look for timestamp resets first */
-	while(working && offset < fsize) {
-		/* Read frame header */
-		fseek(file, offset, SEEK_SET);
-		bytes = fread(prebuffer, sizeof(char), 8, file);
-		if(bytes != 8 || prebuffer[0] != 'M') {
-			JANUS_LOG(LOG_WARN, "Invalid header at offset %ld (%s), the processing will stop here...\n",
-				offset, bytes != 8 ? "not enough bytes" : "wrong prefix");
+	uint32_t pkt_ts = 0, count = 0;
+	/* Lengths are 16 bits, so any frame fits in here */
+	static char prebuffer[65536];
+	while(working) {
+		/* Read frame header (prefix and, for new recordings, timestamp, then length) */
+		if(!mjr2pcap_read(file, prebuffer, 10) || prebuffer[0] != 'M') {
+			if(!feof(file) || ftell(file) != offset) {
+				JANUS_LOG(LOG_WARN, "Invalid header at offset %ld, the processing will stop here...\n", offset);
+			}
 			break;
 		}
-		if(prebuffer[1] == 'E') {
-			/* Either the old .mjr format header ('MEETECHO' header followed by 'audio' or 'video'), or a frame */
-			offset += 8;
-			bytes = fread(&len, sizeof(uint16_t), 1, file);
-			len = ntohs(len);
-			offset += 2;
-			if(len == 5 && !parsed_header) {
-				/* Old .mjr format, check if this is an RTP recording */
-				bytes = fread(prebuffer, sizeof(char), 5, file);
-				if(prebuffer[0] != 'a' && prebuffer[0] != 'v') {
-					fclose(file);
-					JANUS_LOG(LOG_ERR, "Not an RTP recording (data currently unsupported)...\n");
-					exit(1);
-				}
-			} else if(len < 12) {
-				/* Not RTP, skip */
-				JANUS_LOG(LOG_VERB, "Skipping packet (not RTP?)\n");
-				offset += len;
-				continue;
-			}
-		} else if(prebuffer[1] == 'J') {
+		memcpy(&len, prebuffer+8, sizeof(uint16_t));
+		len = ntohs(len);
+		offset += 10;
+		if(prebuffer[1] == 'J') {
 			/* New .mjr format, check if this is an RTP recording */
 			if(prebuffer[2] == 'R' && prebuffer[3] == '0' && prebuffer[4] == '0' &&
 					prebuffer[5] == '0' && prebuffer[6] == '0' && prebuffer[7] == '2') {
@@ -227,107 +234,75 @@ int main(int argc, char *argv[])
 				has_timestamps = TRUE;
 				JANUS_LOG(LOG_VERB, "New .mjr format, will parse timestamps too\n");
 			}
-			offset += 8;
-			bytes = fread(&len, sizeof(uint16_t), 1, file);
-			len = ntohs(len);
-			offset += 2;
-			if(len > 0 && !parsed_header) {
-				/* This is the info header */
-				bytes = fread(prebuffer, sizeof(char), len, file);
-				prebuffer[len] = '\0';
-				json_error_t error;
-				mjr_header = json_loads(prebuffer, 0, &error);
-				if(!mjr_header) {
-					fclose(file);
-					JANUS_LOG(LOG_ERR, "Error parsing header, JSON error: on line %d: %s\n", error.line, error.text);
-					exit(1);
-				}
-				/* Make sure the content is RTP */
-				json_t *type = json_object_get(mjr_header, "t");
-				if(!type || !json_is_string(type)) {
-					json_decref(mjr_header);
-					fclose(file);
-					JANUS_LOG(LOG_ERR, "Missing/invalid recording type in info header...\n");
-					exit(1);
-				}
-				const char *t = json_string_value(type);
-				if(!strcasecmp(t, "d")) {
-					/* Data recordings are not supported yet */
-					json_decref(mjr_header);
-					fclose(file);
-					JANUS_LOG(LOG_ERR, "Not an RTP recording (data currently unsupported)...\n");
-					exit(1);
-				}
-				json_t *updated = json_object_get(mjr_header, "u");
-				if(!updated || !json_is_integer(updated)) {
-					json_decref(mjr_header);
-					fclose(file);
-					JANUS_LOG(LOG_ERR, "Missing/invalid updated time in info header...\n");
-					exit(1);
-				}
-				started = json_integer_value(updated);
+			if(!mjr2pcap_read(file, prebuffer, len)) {
+				JANUS_LOG(LOG_WARN, "Truncated info header, the processing will stop here...\n");
+				break;
 			}
-		} else {
+			offset += len;
+			if(len == 0 || parsed_header)
+				continue;
+			/* This is the info header */
+			parsed_header = TRUE;
+			prebuffer[len] = '\0';
+			json_error_t error;
+			mjr_header = json_loads(prebuffer, 0, &error);
+			if(!mjr_header) {
+				JANUS_LOG(LOG_ERR, "Error parsing header, JSON error: on line %d: %s\n", error.line, error.text);
+				goto error;
+			}
+			/* Make sure the content is RTP */
+			json_t *type = json_object_get(mjr_header, "t");
+			if(!type || !json_is_string(type)) {
+				JANUS_LOG(LOG_ERR, "Missing/invalid recording type in info header...\n");
+				goto error;
+			}
+			const char *t = json_string_value(type);
+			if(!strcasecmp(t, "d")) {
+				/* Data recordings are not supported yet */
+				JANUS_LOG(LOG_ERR, "Not an RTP recording (data currently unsupported)...\n");
+				goto error;
+			}
+			json_t *updated = json_object_get(mjr_header, "u");
+			if(!updated || !json_is_integer(updated)) {
+				JANUS_LOG(LOG_ERR, "Missing/invalid updated time in info header...\n");
+				goto error;
+			}
+			started = json_integer_value(updated);
+			continue;
+		} else if(prebuffer[1] != 'E') {
 			JANUS_LOG(LOG_ERR, "Invalid header...\n");
-			json_decref(mjr_header);
-			fclose(file);
-			exit(1);
-		}
-		/* Skip data for now */
-		offset += len;
-	}
-
-	/* Create the target file */
-	FILE *outfile = fopen(destination, "wb");
-	if(outfile == NULL) {
-		json_decref(mjr_header);
-		JANUS_LOG(LOG_ERR, "Couldn't open output file\n");
-		exit(1);
-	}
-	/* Start with the PCAP header */
-	mjr2pcap_global_header pcap_header = {
-		0xa1b2c3d4, 2, 4, 0, 0, 65535, 1
-	};
-	fwrite(&pcap_header, sizeof(char), sizeof(pcap_header), outfile);
-	/* Now iterate on all packets, and save them to the .pcap file */
-	offset = 0;
-	JANUS_LOG(LOG_INFO, "Traversing RTP packets...\n");
-	uint32_t pkt_ts = 0;
-	while(working && offset < fsize) {
-		/* Read frame header */
-		fseek(file, offset, SEEK_SET);
-		bytes = fread(prebuffer, sizeof(char), 8, file);
-		if(bytes != 8 || prebuffer[0] != 'M') {
-			/* Broken packet? Stop here */
-			break;
+			goto error;
 		}
+		/* Either the old .mjr format header ('MEETECHO' header followed by 'audio' or 'video'), or a frame */
 		if(has_timestamps) {
 			/* Read the packet timestamp */
 			memcpy(&pkt_ts, prebuffer+4, sizeof(uint32_t));
 			pkt_ts = ntohl(pkt_ts);
 		}
-		offset += 8;
-		bytes = fread(&len, sizeof(uint16_t), 1, file);
-		len = ntohs(len);
 		JANUS_LOG(LOG_VERB, "  -- Length: %"SCNu16"\n", len);
-		offset += 2;
-		if(prebuffer[1] == 'J' || len < 12) {
+		/* Get the whole frame */
+		if(!mjr2pcap_read(file, prebuffer, len)) {
+			JANUS_LOG(LOG_WARN, "  -- Failed to read packet (%"SCNu16" bytes), the processing will stop here...\n", len);
+			break;
+		}
+		offset += len;
+		if(len == 5 && !parsed_header) {
+			/* Old .mjr format, check if this is an RTP recording */
+			parsed_header = TRUE;
+			if(prebuffer[0] != 'a' && prebuffer[0] != 'v') {
+				JANUS_LOG(LOG_ERR, "Not an RTP recording (data currently unsupported)...\n");
+				goto error;
+			}
+			continue;
+		}
+		if(len < 12) {
 			/* Not RTP, skip */
 			JANUS_LOG(LOG_VERB, "  -- Not RTP, skipping\n");
-			offset += len;
 			continue;
 		}
 		if(len > 1500) {
 			/* Way too large, very likely not RTP, skip */
 			JANUS_LOG(LOG_VERB, "  -- Too large packet (%d bytes), skipping\n", len);
-			offset += len;
-			continue;
-		}
-		/* Get the whole packet */
-		bytes = fread(prebuffer, sizeof(char), len, file);
-		if(bytes != len) {
-			JANUS_LOG(LOG_WARN, "  -- Failed to read packet (%d != %d bytes), skipping\n", bytes, len);
-			offset += len;
 			continue;
 		}
 		/* Save the packet to PCAP */
@@ -361,30 +336,29 @@ int main(int argc, char *argv[])
 		/* The write the packet itself (or part of it) */
 		int temp = 0, tot = len;
 		while(tot > 0) {
-			temp = fwrite(prebuffer+len-tot, sizeof(char), len, outfile);
+			temp = fwrite(prebuffer+len-tot, sizeof(char), tot, outfile);
 			if(temp <= 0) {
 				JANUS_LOG(LOG_ERR, "Error dumping packet...\n");
 				break;
 			}
 			tot -= temp;
 		}
-		offset += len;
+		count++;
 	}
 	/* We're done */
+	JANUS_LOG(LOG_INFO, "Saved %"SCNu32" packets\n", count);
 	json_decref(mjr_header);
 	fclose(file);
+	long fsize = ftell(outfile);
 	fclose(outfile);
-	outfile = fopen(destination, "rb");
-	if(outfile == NULL) {
-		JANUS_LOG(LOG_INFO, "No destination file %s??\n", destination);
-	} else {
-		fseek(outfile, 0L, SEEK_END);
-		fsize = ftell(outfile);
-		fseek(outfile, 0L, SEEK_SET);
-		JANUS_LOG(LOG_INFO, "%s is %zu bytes\n", destination, fsize);
-		fclose(outfile);
-	}
+	JANUS_LOG(LOG_INFO, "%s is %ld bytes\n", destination, fsize);
 
 	JANUS_LOG(LOG_INFO, "Bye!\n");
 	return 0;
+
+error:
+	json_decref(mjr_header);
+	fclose(file);
+	fclose(outfile);
+	exit(1);
 }
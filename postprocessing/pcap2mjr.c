@@ -20,6 +20,21 @@
 \endverbatim
  *
  * If the tool can't detect any RTP packet with that SSRC, it will result in an error.
+ *
+ * The \c -s option can be passed more than once, to extract multiple RTP
+ * sessions from the same capture in a single pass: in that case, each SSRC
+ * is saved to its own recording, named after the destination and the SSRC
+ * (e.g., \c destination-12345678.mjr). The \c -f and \c -t options can
+ * be used to only save the packets in a specific time range, expressed in
+ * seconds since the first packet in the capture. The capture is read
+ * sequentially, and nothing is kept in memory besides the packet being
+ * processed, which means large captures can be converted with a bounded
+ * memory footprint, and different captures in parallel by launching
+ * multiple instances of the tool, e.g.:
+ *
+\verbatim
+ls *.pcap | xargs -P 4 -I{} ./pcap2mjr -c opus -s 12345678 {} {}.mjr
+\endverbatim
  *
  * \ingroup postprocessing
  * \ref postprocessing
@@ -75,6 +90,30 @@ typedef struct pcap2mjr_ethernet_header {
 	uint16_t type;
 } pcap2mjr_ethernet_header;
 
+/* Size of the buffers we read the capture and write the recordings with */
+#define PCAP2MJR_BUFFER_SIZE	(4*1024*1024)
+
+/* Recording we're writing the packets of an SSRC to */
+typedef struct pcap2mjr_output {
+	uint32_t ssrc;
+	char *path;
+	FILE *file;
+	gboolean header_written;
+	gint64 started;
+	uint32_t written;
+} pcap2mjr_output;
+
+static void pcap2mjr_outputs_free(pcap2mjr_output *outputs, guint num, GHashTable *ssrcs) {
+	guint i = 0;
+	for(i=0; i<num; i++) {
+		if(outputs[i].file != NULL)
+			fclose(outputs[i].file);
+		g_free(outputs[i].path);
+	}
+	g_free(outputs);
+	g_hash_table_destroy(ssrcs);
+}
+
 
 /* Signal handler */
 static void janus_p2m_handle_signal(int signum) {
@@ -93,7 +132,6 @@ int main(int argc, char *argv[])
 	atexit(janus_log_destroy);
 
 	/* Evaluate arguments to find source and target */
-	uint32_t ssrc = args_info.ssrc_arg;
 	const char *codec = args_info.codec_arg;
 	gboolean show_warnings = args_info.warnings_given;
 	gboolean video = FALSE;
@@ -127,7 +165,9 @@ int main(int argc, char *argv[])
 		}
 		if(setting == NULL || (
 				(strcmp(setting, "-c")) && (strcmp(setting, "--codec")) &&
-				(strcmp(setting, "-s")) && (strcmp(setting, "--ssrc"))
+				(strcmp(setting, "-s")) && (strcmp(setting, "--ssrc")) &&
+				(strcmp(setting, "-f")) && (strcmp(setting, "--from")) &&
+				(strcmp(setting, "-t")) && (strcmp(setting, "--to"))
 		)) {
 			if(source == NULL)
 				source = argv[i];
@@ -141,13 +181,52 @@ int main(int argc, char *argv[])
 		cmdline_parser_free(&args_info);
 		exit(1);
 	}
-	JANUS_LOG(LOG_INFO, "[%s/%"SCNu32"] %s --> %s\n", codec, ssrc, source, destination);
+	/* Time range to save, relative to the first packet in the capture */
+	gint64 from = args_info.from_given ? (gint64)args_info.from_arg*G_USEC_PER_SEC : 0;
+	gint64 to = args_info.to_given ? (gint64)args_info.to_arg*G_USEC_PER_SEC : 0;
+	if(from < 0 || to < 0 || (to > 0 && to <= from)) {
+		JANUS_LOG(LOG_ERR, "Invalid time range\n");
+		cmdline_parser_free(&args_info);
+		exit(1);
+	}
 
-	/* Open and parse the pcap file */
+	/* Prepare the recordings to write: when there's more than one SSRC,
+	 * each goes to its own file, named after the destination and the SSRC */
+	guint outputs_num = args_info.ssrc_given;
+	pcap2mjr_output *outputs = g_malloc0(outputs_num * sizeof(pcap2mjr_output));
+	GHashTable *ssrcs = g_hash_table_new(NULL, NULL);
+	guint o = 0;
+	for(o=0; o<outputs_num; o++) {
+		pcap2mjr_output *output = &outputs[o];
+		output->ssrc = args_info.ssrc_arg[o];
+		if(outputs_num == 1) {
+			output->path = g_strdup(destination);
+		} else {
+			size_t dlen = strlen(destination);
+			if(dlen > 4 && !strcasecmp(destination+dlen-4, ".mjr"))
+				dlen -= 4;
+			output->path = g_strdup_printf("%.*s-%"SCNu32".mjr", (int)dlen, destination, output->ssrc);
+		}
+		g_hash_table_insert(ssrcs, GUINT_TO_POINTER(output->ssrc), output);
+		JANUS_LOG(LOG_INFO, "[%s/%"SCNu32"] %s --> %s\n", codec, output->ssrc, source, output->path);
+	}
+
+	/* Open and parse the pcap file: we read it sequentially, with a large
+	 * buffer, so that large captures can be processed in a single pass */
+	FILE *infile = fopen(source, "rb");
+	if(infile == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s: %s\n", source, strerror(errno));
+		pcap2mjr_outputs_free(outputs, outputs_num, ssrcs);
+		cmdline_parser_free(&args_info);
+		exit(1);
+	}
+	setvbuf(infile, NULL, _IOFBF, PCAP2MJR_BUFFER_SIZE);
 	char errbuf[PCAP_ERRBUF_SIZE];
-	pcap_t *pcap = pcap_open_offline(source, errbuf);
+	pcap_t *pcap = pcap_fopen_offline(infile, errbuf);
 	if(pcap == NULL) {
 		JANUS_LOG(LOG_ERR, "Could not open file %s: %s\n", source, errbuf);
+		fclose(infile);
+		pcap2mjr_outputs_free(outputs, outputs_num, ssrcs);
 		cmdline_parser_free(&args_info);
 		exit(1);
 	}
@@ -155,43 +234,60 @@ int main(int argc, char *argv[])
 	if(link != DLT_LINUX_SLL && link != DLT_EN10MB) {
 		JANUS_LOG(LOG_ERR, "Unsupported link type %d (%s) in capture\n",
 			link, pcap_datalink_val_to_name(link));
+		pcap_close(pcap);
+		pcap2mjr_outputs_free(outputs, outputs_num, ssrcs);
 		cmdline_parser_free(&args_info);
 		exit(1);
 	}
 
-	/* Create the target file */
-	FILE *outfile = fopen(destination, "wb");
-	if(outfile == NULL) {
-		JANUS_LOG(LOG_ERR, "Couldn't open output file\n");
-		cmdline_parser_free(&args_info);
-		pcap_close(pcap);
-		exit(1);
-	}
-	/* Write the first part of the header */
-	size_t res = fwrite(header, sizeof(char), strlen(header), outfile);
-	if(res != strlen(header)) {
-		JANUS_LOG(LOG_ERR, "Couldn't write .mjr header (%zu != %zu, %s)\n",
-			res, strlen(header), strerror(errno));
-		cmdline_parser_free(&args_info);
-		pcap_close(pcap);
-		exit(1);
+	/* Create the target files */
+	for(o=0; o<outputs_num; o++) {
+		pcap2mjr_output *output = &outputs[o];
+		output->file = fopen(output->path, "wb");
+		if(output->file == NULL) {
+			JANUS_LOG(LOG_ERR, "Couldn't open output file %s\n", output->path);
+			pcap_close(pcap);
+			pcap2mjr_outputs_free(outputs, outputs_num, ssrcs);
+			cmdline_parser_free(&args_info);
+			exit(1);
+		}
+		setvbuf(output->file, NULL, _IOFBF, PCAP2MJR_BUFFER_SIZE);
+		/* Write the first part of the header */
+		size_t res = fwrite(header, sizeof(char), strlen(header), output->file);
+		if(res != strlen(header)) {
+			JANUS_LOG(LOG_ERR, "Couldn't write .mjr header (%zu != %zu, %s)\n",
+				res, strlen(header), strerror(errno));
+			pcap_close(pcap);
+			pcap2mjr_outputs_free(outputs, outputs_num, ssrcs);
+			cmdline_parser_free(&args_info);
+			exit(1);
+		}
 	}
 
 	/* Handle SIGINT */
 	working = 1;
 	signal(SIGINT, janus_p2m_handle_signal);
 
-	/* TODO Loop */
-    struct pcap_pkthdr *header = NULL;
-    const u_char *buffer = NULL, *temp = NULL;
-	uint32_t count = 0, written = 0, pssrc = 0;
-    int ret = 0;
-    size_t min_size = sizeof(pcap2mjr_ethernet_header) + sizeof(struct iphdr) +
+	/* Loop */
+	struct pcap_pkthdr *header = NULL;
+	const u_char *buffer = NULL, *temp = NULL;
+	uint32_t count = 0, pssrc = 0;
+	int ret = 0;
+	size_t min_size = sizeof(pcap2mjr_ethernet_header) + sizeof(struct iphdr) +
 		sizeof(struct udphdr) + 12, pkt_size = 0;
-	gboolean header_written = FALSE;
 	gint64 start_ts = 0, pkt_ts = 0;
-    while(working && (ret = pcap_next_ex(pcap, &header, &buffer)) >= 0) {
+	while(working && (ret = pcap_next_ex(pcap, &header, &buffer)) >= 0) {
 		count++;
+		pkt_ts = header->ts.tv_sec*G_USEC_PER_SEC + header->ts.tv_usec;
+		if(start_ts == 0)
+			start_ts = pkt_ts;
+		if(from > 0 && pkt_ts - start_ts < from)
+			continue;
+		if(to > 0 && pkt_ts - start_ts > to) {
+			/* Captures are written in order, so we're done */
+			JANUS_LOG(LOG_INFO, "Reached the end of the time range at packet #%"SCNu32"\n", count);
+			break;
+		}
 		if(header->len != header->caplen) {
 			if(show_warnings) {
 				JANUS_LOG(LOG_WARN, "Packet and capture lengths differ (%d != %d), skipping packet #%"SCNu32"\n",
@@ -207,9 +303,6 @@ int main(int argc, char *argv[])
 		}
 		temp = buffer;
 		pkt_size = header->len;
-		pkt_ts = header->ts.tv_sec*G_USEC_PER_SEC + header->ts.tv_usec;
-		if(start_ts == 0)
-			start_ts = pkt_ts;
 		/* Traverse all the headers */
 		int protocol = 0;
 		if(link == DLT_EN10MB) {
@@ -252,6 +345,12 @@ int main(int argc, char *argv[])
 		/* UDP */
 		temp += sizeof(struct udphdr);
 		pkt_size -= sizeof(struct udphdr);
+		if(pkt_size < 12) {
+			if(show_warnings) {
+				JANUS_LOG(LOG_WARN, "UDP payload too small, skipping packet #%"SCNu32"\n", count);
+			}
+			continue;
+		}
 		/* Make sure this is an RTP packet */
 		janus_pp_rtp_header *rtp = (janus_pp_rtp_header *)temp;
 		if(rtp->version != 2 || (rtp->type >= 64 && rtp->type < 96)) {
@@ -261,17 +360,19 @@ int main(int argc, char *argv[])
 			continue;
 		}
 		pssrc = htonl(rtp->ssrc);
-		if(pssrc != ssrc) {
+		pcap2mjr_output *output = g_hash_table_lookup(ssrcs, GUINT_TO_POINTER(pssrc));
+		if(output == NULL) {
 			if(show_warnings) {
-				JANUS_LOG(LOG_WARN, "Not the SSRC we need (%"SCNu32" != %"SCNu32"), skipping packet #%"SCNu32"\n",
-					pssrc, ssrc, count);
+				JANUS_LOG(LOG_WARN, "Not an SSRC we need (%"SCNu32"), skipping packet #%"SCNu32"\n",
+					pssrc, count);
 			}
 			continue;
 		}
 		/* Save the packet, but first check if we've written the .mjr header already */
-		if(!header_written) {
+		if(!output->header_written) {
 			/* Write info header as a JSON formatted info */
-			header_written = TRUE;
+			output->header_written = TRUE;
+			output->started = pkt_ts;
 			json_t *info = json_object();
 			/* FIXME Codecs should be configurable in the future */
 			const char *type = NULL;
@@ -286,42 +387,37 @@ int main(int argc, char *argv[])
 			gchar *info_text = json_dumps(info, JSON_PRESERVE_ORDER);
 			json_decref(info);
 			uint16_t info_bytes = htons(strlen(info_text));
-			size_t res = fwrite(&info_bytes, sizeof(uint16_t), 1, outfile);
+			size_t res = fwrite(&info_bytes, sizeof(uint16_t), 1, output->file);
 			if(res != 1) {
 				JANUS_LOG(LOG_WARN, "Couldn't write size of JSON header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
 					res, sizeof(uint16_t), strerror(errno));
 			}
-			res = fwrite(info_text, sizeof(char), strlen(info_text), outfile);
+			res = fwrite(info_text, sizeof(char), strlen(info_text), output->file);
 			if(res != strlen(info_text)) {
 				JANUS_LOG(LOG_WARN, "Couldn't write JSON header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
 					res, strlen(info_text), strerror(errno));
 			}
 			free(info_text);
 		}
-		/* Write frame header (fixed part[4], timestamp[4], length[2]) */
-		size_t res = fwrite(frame_header, sizeof(char), strlen(frame_header), outfile);
-		if(res != strlen(frame_header)) {
-			JANUS_LOG(LOG_WARN, "Couldn't write frame header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
-				res, strlen(frame_header), strerror(errno));
-		}
-		uint32_t timestamp = (uint32_t)(pkt_ts > start_ts ? ((pkt_ts - start_ts)/1000) : 0);
+		/* Write frame header (fixed part[4], timestamp[4], length[2]) all at once,
+		 * with timestamps relative to the first packet of this recording */
+		char frame[10];
+		memcpy(frame, frame_header, 4);
+		uint32_t timestamp = (uint32_t)(pkt_ts > output->started ? ((pkt_ts - output->started)/1000) : 0);
 		timestamp = htonl(timestamp);
-		res = fwrite(&timestamp, sizeof(uint32_t), 1, outfile);
-		if(res != 1) {
-			JANUS_LOG(LOG_WARN, "Couldn't write frame timestamp in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
-				res, sizeof(uint32_t), strerror(errno));
-		}
+		memcpy(frame+4, &timestamp, sizeof(uint32_t));
 		uint16_t header_bytes = htons(pkt_size);
-		res = fwrite(&header_bytes, sizeof(uint16_t), 1, outfile);
-		if(res != 1) {
-			JANUS_LOG(LOG_WARN, "Couldn't write size of frame in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
-				res, sizeof(uint16_t), strerror(errno));
+		memcpy(frame+8, &header_bytes, sizeof(uint16_t));
+		size_t res = fwrite(frame, sizeof(char), sizeof(frame), output->file);
+		if(res != sizeof(frame)) {
+			JANUS_LOG(LOG_WARN, "Couldn't write frame header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
+				res, sizeof(frame), strerror(errno));
 		}
 		/* Save packet on file */
-		written++;
+		output->written++;
 		int tmp = 0, tot = pkt_size;
 		while(tot > 0) {
-			tmp = fwrite(temp+pkt_size-tot, sizeof(char), tot, outfile);
+			tmp = fwrite(temp+pkt_size-tot, sizeof(char), tot, output->file);
 			if(tmp <= 0) {
 				JANUS_LOG(LOG_ERR, "Error saving frame, stopping here...\n");
 				goto done;
@@ -329,22 +425,24 @@ int main(int argc, char *argv[])
 			tot -= tmp;
 		}
 	}
-	JANUS_LOG(LOG_INFO, "Saved %"SCNu32" out of %"SCNu32" packets\n", written, count);
+	for(o=0; o<outputs_num; o++) {
+		JANUS_LOG(LOG_INFO, "[%"SCNu32"] Saved %"SCNu32" out of %"SCNu32" packets\n",
+			outputs[o].ssrc, outputs[o].written, count);
+	}
 
 done:
 	/* We're done */
 	pcap_close(pcap);
-	fclose(outfile);
-	outfile = fopen(destination, "rb");
-	if(outfile == NULL) {
-		JANUS_LOG(LOG_WARN, "No destination file %s??\n", destination);
-	} else {
-		fseek(outfile, 0L, SEEK_END);
-		size_t fsize = ftell(outfile);
-		fseek(outfile, 0L, SEEK_SET);
-		JANUS_LOG(LOG_INFO, "%s is %zu bytes\n", destination, fsize);
-		fclose(outfile);
+	for(o=0; o<outputs_num; o++) {
+		pcap2mjr_output *output = &outputs[o];
+		if(output->file == NULL)
+			continue;
+		long fsize = ftell(output->file);
+		fclose(output->file);
+		output->file = NULL;
+		JANUS_LOG(LOG_INFO, "%s is %ld bytes\n", output->path, fsize);
 	}
+	pcap2mjr_outputs_free(outputs, outputs_num, ssrcs);
 
 	cmdline_parser_free(&args_info);
 	JANUS_LOG(LOG_INFO, "Bye!\n");
@@ -0,0 +1,257 @@
+#!/bin/bash
+
+# Throughput benchmark for janus-pp-rec: each recording goes through the
+# whole parse, reorder and write pipeline, and for each of them we report
+# how many MB and .mjr frames (RTP packets) per second we processed, and
+# the peak RSS of the process. By default synthetic recordings are
+# generated for all the codecs the post-processor supports, but you can
+# pass a folder with your own .mjr files as well, which will give you a
+# more realistic idea of how real sessions perform, e.g.:
+#
+#	./postprocessing/pp-bench.sh
+#	./postprocessing/pp-bench.sh /path/to/recordings
+#
+# Synthetic payloads are not real media, they only carry the headers
+# the depacketizers look at (keyframe markers, resolution, etc.), so the
+# output files are not playable: compare the numbers with the ones of a
+# previous run on the same machine, rather than with the real thing.
+
+set -eu
+
+SCRIPTPATH="$( cd "$(dirname "$0")" ; pwd -P )"
+
+CORPUS=${1:-""}
+PPREC=${PPREC:-"$(dirname $SCRIPTPATH)/janus-pp-rec"}
+CODECS=${CODECS:-"opus pcmu vp8 vp9 h264 h265 av1"}
+DURATION=${DURATION:-120}
+RUNS=${RUNS:-3}
+OUT=${OUT:-"$SCRIPTPATH/bench"}
+
+if [ ! -x "$PPREC" ]; then
+	echo "Couldn't find janus-pp-rec at $PPREC, build it first (or set PPREC)"
+	exit 1
+fi
+mkdir -p "$OUT"
+
+echo "Post-processor: $PPREC"
+echo "Runs per recording: $RUNS"
+echo "Output dir: $OUT"
+
+# Helpers to write big endian integers as printf escapes
+u16() {
+	printf -v "$1" '\\x%02x\\x%02x' $((($2>>8)&255)) $(($2&255))
+}
+u32() {
+	printf -v "$1" '\\x%02x\\x%02x\\x%02x\\x%02x' $((($2>>24)&255)) $((($2>>16)&255)) $((($2>>8)&255)) $(($2&255))
+}
+
+# Filler for the payloads (the content doesn't matter, only the size does)
+printf -v FILL '\\xaa%.0s' $(seq 1 1200)
+
+# Prepare a single .mjr frame, as printf escapes in FRAME: time (ms),
+# marker, payload type, sequence number, RTP timestamp, payload prefix
+# and filler size (escapes, as bash variables can't contain zeros)
+frame() {
+	local when=$1 marker=$2 pt=$3 seq=$4 ts=$5 prefix=$6 fill=$7
+	local plen=$(( ${#prefix} / 4 + fill ))
+	u32 w "$when"
+	u16 l $((12 + plen))
+	u16 s "$seq"
+	u32 t "$ts"
+	printf -v m '\\x%02x' $(( (marker << 7) | pt ))
+	FRAME="MEET$w$l\x80$m$s$t\x12\x34\x56\x78$prefix${FILL:0:$((fill * 4))}"
+}
+
+# Generate a synthetic recording for the specified codec: video is
+# 30fps with a keyframe every two seconds, audio uses 20ms packets; every
+# 50th packet is swapped with the next one, to exercise the reordering too
+generate() {
+	local codec=$1 file=$2
+	local type="v" pt=96 step=3000 ptime=33 frames=$((DURATION * 30))
+	if [ "$codec" == "opus" ] || [ "$codec" == "pcmu" ]; then
+		type="a"
+		pt=111
+		step=960
+		ptime=20
+		frames=$((DURATION * 50))
+		if [ "$codec" == "pcmu" ]; then
+			pt=0
+			step=160
+		fi
+	fi
+	local now=$(( $(date +%s) * 1000000 ))
+	local info="{\"t\":\"$type\",\"c\":\"$codec\",\"s\":$now,\"u\":$now}"
+	u16 ilen ${#info}
+	{
+		printf 'MJR00002'
+		printf '%b' "$ilen"
+		printf '%s' "$info"
+		local seq=0 i p n key prefix fill pending=""
+		for (( i=0; i<frames; i++ )); do
+			local ts=$((i * step)) when=$((i * ptime))
+			if [ "$type" == "a" ]; then
+				if [ "$codec" == "opus" ]; then
+					prefix='\xfc'
+					fill=80
+				else
+					prefix=''
+					fill=160
+				fi
+				n=1
+			else
+				key=$(( i % 60 == 0 ))
+				n=$(( key ? 12 : 4 ))
+			fi
+			for (( p=0; p<n; p++ )); do
+				if [ "$type" == "v" ]; then
+					fill=1100
+					case "$codec" in
+					vp8)
+						if [ $p -eq 0 ]; then
+							if [ $key -eq 1 ]; then
+								prefix='\x10\x50\x42\x00\x9d\x01\x2a\x80\x02\xe0\x01'
+							else
+								prefix='\x10\x51\x42\x00'
+							fi
+						else
+							prefix='\x00'
+						fi
+						;;
+					vp9)
+						local e=$(( p == n - 1 ? 0x04 : 0 ))
+						if [ $p -eq 0 ] && [ $key -eq 1 ]; then
+							printf -v prefix '\\x%02x\\x10\\x02\\x80\\x01\\xe0' $(( 0x0a | e ))
+						elif [ $p -eq 0 ]; then
+							printf -v prefix '\\x%02x' $(( 0x48 | e ))
+						else
+							printf -v prefix '\\x%02x' $(( (key ? 0x00 : 0x40) | e ))
+						fi
+						;;
+					h264)
+						if [ $key -eq 1 ] && [ $p -eq 0 ]; then
+							prefix='\x67\x42\xc0\x1e\xda\x02\x80\xf6\x40'
+							fill=0
+						elif [ $key -eq 1 ] && [ $p -eq 1 ]; then
+							prefix='\x68\xce\x38\x80'
+							fill=0
+						elif [ $key -eq 1 ]; then
+							prefix='\x65\x88'
+						else
+							prefix='\x41\x9a'
+						fi
+						;;
+					h265)
+						if [ $key -eq 1 ] && [ $p -eq 0 ]; then
+							prefix='\x40\x01\x0c\x01\xff\xff'
+							fill=0
+						elif [ $key -eq 1 ]; then
+							prefix='\x26\x01'
+						else
+							prefix='\x02\x01'
+						fi
+						;;
+					av1)
+						if [ $key -eq 1 ] && [ $p -eq 0 ]; then
+							prefix='\x18\x30'
+						else
+							prefix='\x10\x30'
+						fi
+						;;
+					esac
+				fi
+				frame "$when" $(( p == n - 1 )) "$pt" $((seq & 0xFFFF)) $((ts & 0xFFFFFFFF)) "$prefix" "$fill"
+				seq=$((seq + 1))
+				if [ $((seq % 50)) -eq 0 ]; then
+					pending="$FRAME"
+					continue
+				fi
+				printf '%b' "$FRAME"
+				if [ -n "$pending" ]; then
+					printf '%b' "$pending"
+					pending=""
+				fi
+			done
+		done
+		if [ -n "$pending" ]; then
+			printf '%b' "$pending"
+		fi
+	} > "$file"
+}
+
+# Pick the extension of the target file from the codec of a recording
+extension() {
+	case "$("$PPREC" -j "$1" 2>/dev/null | sed -n 's/.*"c": *"\([a-z0-9]*\)".*/\1/p')" in
+	opus|multiopus) echo "opus" ;;
+	pcmu|pcma|g711|g722) echo "wav" ;;
+	vp8|vp9) echo "webm" ;;
+	h264|h265|av1) echo "mp4" ;;
+	text) echo "srt" ;;
+	*) echo "" ;;
+	esac
+}
+
+# Process a recording RUNS times, and print the numbers of the fastest run
+bench() {
+	local source=$1 ext target size packets best="" rss=0 run
+	ext=$(extension "$source")
+	if [ -z "$ext" ]; then
+		echo "Skipping $source (unsupported codec)"
+		return
+	fi
+	target="$OUT/$(basename "${source%.mjr}").$ext"
+	size=$(stat -c %s "$source")
+	for (( run=0; run<RUNS; run++ )); do
+		rm -f "$target"
+		local start end elapsed log peak
+		start=$(date +%s%N)
+		if [ -x /usr/bin/time ]; then
+			log=$(/usr/bin/time -f "RSS %M" "$PPREC" -o "$source" "$target" 2>&1) || true
+			peak=$(echo "$log" | sed -n 's/^RSS \([0-9]*\)$/\1/p' | tail -n 1)
+		else
+			log=$("$PPREC" -o "$source" "$target" 2>&1) || true
+			peak=0
+		fi
+		end=$(date +%s%N)
+		elapsed=$(( (end - start) / 1000 ))
+		packets=$(echo "$log" | sed -n 's/.*Counted \([0-9]*\) RTP packets.*/\1/p' | head -n 1)
+		if [ ! -s "$target" ] || [ -z "$packets" ]; then
+			echo "Error processing $source:"
+			echo "$log" | tail -n 5
+			return
+		fi
+		if [ -z "$best" ] || [ $elapsed -lt $best ]; then
+			best=$elapsed
+		fi
+		if [ -n "$peak" ] && [ "$peak" -gt $rss ]; then
+			rss=$peak
+		fi
+	done
+	[ $best -gt 0 ] || best=1
+	awk -v name="$(basename "$source")" -v size=$size -v packets=$packets -v usec=$best -v rss=$rss \
+		'BEGIN { printf "%-24s %10.2f MB %10d %10.2f MB/s %12.0f frames/s %10d KB\n",
+			name, size/1048576, packets, (size/1048576)/(usec/1000000), packets/(usec/1000000), rss }'
+}
+
+if [ -z "$CORPUS" ]; then
+	CORPUS="$OUT/corpus"
+	mkdir -p "$CORPUS"
+	for codec in $CODECS; do
+		if [ ! -f "$CORPUS/$codec-${DURATION}s.mjr" ]; then
+			echo "Generating synthetic $codec recording ($DURATION seconds)"
+			generate "$codec" "$CORPUS/$codec-${DURATION}s.mjr"
+		fi
+	done
+elif [ ! -d "$CORPUS" ]; then
+	echo "Invalid recordings folder specified!"
+	exit 1
+fi
+
+files=$(find "$CORPUS" -maxdepth 1 -type f -name "*.mjr" | sort)
+if [[ -z $files ]]; then
+	echo "No .mjr recordings in $CORPUS!"
+	exit 1
+fi
+printf "\n%-24s %13s %10s %15s %21s %13s\n" "Recording" "Size" "Frames" "Throughput" "" "Peak RSS"
+for file in $files; do
+	bench "$file"
+done
@@ -170,7 +170,7 @@ static uint32_t janus_pp_h264_eg_decode(uint8_t *base, uint32_t *offset) {
 }
 
 /* Helper to parse a SPS (only to get the video resolution) */
-static void janus_pp_h264_parse_sps(char *buffer, int *width, int *height) {
+void janus_pp_h264_parse_sps(char *buffer, int *width, int *height) {
 	/* Let's check if it's the right profile, first */
 	int index = 1;
 	int profile_idc = *(buffer+index);
@@ -21,6 +21,8 @@ int janus_pp_h264_create(char *destination, char *metadata, gboolean faststart);
 int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list);
 int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working);
 void janus_pp_h264_close(void);
+/* Helper to get the video resolution out of an SPS (buffer points to the NAL header) */
+void janus_pp_h264_parse_sps(char *buffer, int *width, int *height);
 
 
 #endif
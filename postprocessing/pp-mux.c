@@ -0,0 +1,790 @@
+/*! \file    pp-mux.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Post-processing to mux audio and video in a single pass
+ * \details  Implementation of the post-processing code (based on FFmpeg)
+ * needed to mux an Opus recording and a VP8, VP9 or H.264 recording in
+ * the same container (.webm, .mkv or .mp4), or to generate an HLS playlist
+ * with fragmented MP4 (CMAF) segments out of them. Differently from the other
+ * post-processors, recordings are not fully indexed in memory before
+ * being processed: each of them is parsed by a thread of its own, which
+ * only keeps a small window of RTP packets around to fix out of order
+ * packets, and hands the frames it depacketizes to the muxer via a
+ * bounded queue. The muxer then interleaves the frames of both tracks
+ * by timestamp, which means memory usage doesn't depend on how long the
+ * recordings are. The offset between the two tracks is computed from the
+ * time the first frame of each of them was written, as saved in the
+ * .mjr info header. Audio is optional when generating HLS playlists.
+ *
+ * \ingroup postprocessing
+ * \ref postprocessing
+ */
+
+#include <arpa/inet.h>
+#ifdef __MACH__
+#include <machine/endian.h>
+#else
+#include <endian.h>
+#endif
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <jansson.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "pp-mux.h"
+#include "pp-rtp.h"
+#include "pp-h264.h"
+#include "../debug.h"
+
+
+#define LIBAVCODEC_VER_AT_LEAST(major, minor) \
+	(LIBAVCODEC_VERSION_MAJOR > major || \
+	 (LIBAVCODEC_VERSION_MAJOR == major && \
+	  LIBAVCODEC_VERSION_MINOR >= minor))
+
+#if LIBAVCODEC_VER_AT_LEAST(56, 56)
+#ifndef FF_INPUT_BUFFER_PADDING_SIZE
+#define FF_INPUT_BUFFER_PADDING_SIZE AV_INPUT_BUFFER_PADDING_SIZE
+#endif
+#endif
+
+#if LIBAVCODEC_VER_AT_LEAST(57, 14)
+#define USE_CODECPAR
+#endif
+
+/* How many RTP packets we keep around, per track, to fix the order of packets */
+#define JANUS_PP_MUX_WINDOW		256
+/* How many frames a parser thread can be ahead of the muxer */
+#define JANUS_PP_MUX_QUEUE		128
+
+/* Codecs we can mux */
+typedef enum janus_pp_mux_codec {
+	JANUS_PP_MUX_OPUS = 0,
+	JANUS_PP_MUX_VP8,
+	JANUS_PP_MUX_VP9,
+	JANUS_PP_MUX_H264
+} janus_pp_mux_codec;
+
+/* RTP packet waiting in the reordering window */
+typedef struct janus_pp_mux_packet {
+	uint64_t seq;		/* Extended RTP sequence number */
+	uint64_t ts;		/* Extended RTP timestamp */
+	uint8_t *payload;	/* RTP payload */
+	int len;			/* Length of the RTP payload */
+} janus_pp_mux_packet;
+
+/* Frame ready to be muxed */
+typedef struct janus_pp_mux_frame {
+	int64_t pts;		/* Timestamp, in the clock rate of the track */
+	uint8_t *data;
+	int size;
+	gboolean keyframe;
+} janus_pp_mux_frame;
+static janus_pp_mux_frame eos_frame;
+
+/* Audio or video track we're muxing */
+typedef struct janus_pp_mux_track {
+	const char *path;
+	FILE *file;
+	long fsize, offset;
+	gboolean video;
+	janus_pp_mux_codec codec;
+	int clock;
+	/* Time the first frame was written, and the related offset in the muxed file */
+	gint64 written;
+	int64_t start;
+	/* Reordering window */
+	janus_pp_mux_packet window[JANUS_PP_MUX_WINDOW+1];
+	int count;
+	gboolean started, emitted;
+	uint64_t max_seq, max_ts, last_seq, first_ts;
+	/* Frame we're currently assembling (video only) */
+	GByteArray *frame;
+	uint64_t frame_ts;
+	gboolean frame_key, keyframe_found;
+	int width, height;
+	/* H.264 parameter sets (Annex B), to use as extradata */
+	GByteArray *extradata;
+	gboolean sps_found, pps_found;
+	/* Parser thread and queue of frames for the muxer */
+	GThread *thread;
+	GAsyncQueue *frames;
+	int *working;
+	/* Muxer stream */
+	AVStream *stream;
+	int64_t last_pts;
+	/* Stats */
+	guint32 packets, late, muxed;
+} janus_pp_mux_track;
+
+
+/* Helper to extend a sequence number (16 bits) or timestamp (32 bits) to 64 bits */
+static uint64_t janus_pp_mux_extend(uint64_t max, uint32_t value, int bits) {
+	uint64_t range = (uint64_t)1 << bits;
+	uint64_t candidate = (max & ~(range-1)) | value;
+	if(candidate + range/2 < max)
+		candidate += range;
+	else if(candidate > max + range/2 && candidate >= range)
+		candidate -= range;
+	return candidate;
+}
+
+/* Helper to hand a frame to the muxer, waiting if it's lagging behind */
+static void janus_pp_mux_queue_frame(janus_pp_mux_track *track, janus_pp_mux_frame *frame) {
+	while(*track->working && frame != &eos_frame && g_async_queue_length(track->frames) >= JANUS_PP_MUX_QUEUE)
+		g_usleep(5000);
+	g_async_queue_push(track->frames, frame);
+}
+
+/* Helper to queue the video frame we've been assembling, if there's one */
+static void janus_pp_mux_flush_frame(janus_pp_mux_track *track) {
+	if(track->frame->len == 0)
+		return;
+	if(track->frame_key && !track->keyframe_found) {
+		if(track->width == 0 || track->height == 0) {
+			JANUS_LOG(LOG_WARN, "[%s] Keyframe without resolution info, waiting for the next one\n", track->path);
+		} else {
+			track->keyframe_found = TRUE;
+			JANUS_LOG(LOG_INFO, "[%s] First keyframe: %"SCNu64" (%dx%d)\n", track->path,
+				track->frame_ts - track->first_ts, track->width, track->height);
+		}
+	}
+	if(track->keyframe_found) {
+		/* We only start muxing video from the first keyframe */
+		janus_pp_mux_frame *frame = g_malloc(sizeof(janus_pp_mux_frame));
+		frame->pts = (int64_t)(track->frame_ts - track->first_ts) + track->start;
+		frame->size = track->frame->len;
+		frame->data = g_malloc(frame->size + FF_INPUT_BUFFER_PADDING_SIZE);
+		memcpy(frame->data, track->frame->data, frame->size);
+		memset(frame->data + frame->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+		frame->keyframe = track->frame_key;
+		janus_pp_mux_queue_frame(track, frame);
+	}
+	g_byte_array_set_size(track->frame, 0);
+	track->frame_key = FALSE;
+}
+
+/* VP8 depacketizer (https://tools.ietf.org/html/rfc7741) */
+static void janus_pp_mux_vp8_depay(janus_pp_mux_track *track, uint8_t *buf, int len) {
+	if(len < 1)
+		return;
+	int skip = 1;
+	uint8_t xbit = (buf[0] & 0x80), sbit = (buf[0] & 0x10), pid = (buf[0] & 0x07);
+	if(xbit) {
+		if(len < 2)
+			return;
+		uint8_t ext = buf[1];
+		skip++;
+		if(ext & 0x80) {
+			/* PictureID, 7 or 15 bits */
+			if(len <= skip)
+				return;
+			skip += (buf[skip] & 0x80) ? 2 : 1;
+		}
+		if(ext & 0x40)	/* TL0PICIDX */
+			skip++;
+		if(ext & 0x30)	/* TID/KEYIDX */
+			skip++;
+	}
+	if(len <= skip)
+		return;
+	uint8_t *payload = buf + skip;
+	int plen = len - skip;
+	if(sbit && pid == 0 && plen >= 10 && !(payload[0] & 0x01)) {
+		/* Start of a keyframe, get the resolution too */
+		track->frame_key = TRUE;
+		if(payload[3] == 0x9d && payload[4] == 0x01 && payload[5] == 0x2a) {
+			track->width = (payload[6] | (payload[7] << 8)) & 0x3fff;
+			track->height = (payload[8] | (payload[9] << 8)) & 0x3fff;
+		}
+	}
+	g_byte_array_append(track->frame, payload, plen);
+}
+
+/* VP9 depacketizer (https://tools.ietf.org/html/draft-ietf-payload-vp9) */
+static void janus_pp_mux_vp9_depay(janus_pp_mux_track *track, uint8_t *buf, int len) {
+	if(len < 1)
+		return;
+	int skip = 1;
+	uint8_t ibit = (buf[0] & 0x80), pbit = (buf[0] & 0x40), lbit = (buf[0] & 0x20),
+		fbit = (buf[0] & 0x10), bbit = (buf[0] & 0x08), vbit = (buf[0] & 0x02);
+	if(ibit) {
+		if(len <= skip)
+			return;
+		skip += (buf[skip] & 0x80) ? 2 : 1;
+	}
+	if(lbit)
+		skip += fbit ? 1 : 2;
+	if(fbit && pbit) {
+		/* Skip reference indices */
+		uint8_t nbit = 1;
+		while(nbit && skip < len) {
+			nbit = (buf[skip] & 0x01);
+			skip++;
+		}
+	}
+	if(vbit && skip < len) {
+		/* Scalability structure: get the resolution of the highest spatial layer */
+		uint8_t ss = buf[skip];
+		int n_s = ((ss & 0xE0) >> 5) + 1, i = 0;
+		uint8_t ybit = (ss & 0x10), gbit = (ss & 0x08);
+		skip++;
+		if(ybit) {
+			for(i=0; i<n_s && skip+4 <= len; i++) {
+				track->width = (buf[skip] << 8) | buf[skip+1];
+				track->height = (buf[skip+2] << 8) | buf[skip+3];
+				skip += 4;
+			}
+		}
+		if(gbit && skip < len) {
+			uint8_t n_g = buf[skip];
+			skip++;
+			for(i=0; i<n_g && skip < len; i++)
+				skip += 1 + ((buf[skip] & 0x0C) >> 2);
+		}
+	}
+	if(len <= skip)
+		return;
+	if(bbit && !pbit)
+		track->frame_key = TRUE;
+	g_byte_array_append(track->frame, buf + skip, len - skip);
+}
+
+/* Helper to add a single H.264 NAL to the frame, with a start code */
+static void janus_pp_mux_h264_nal(janus_pp_mux_track *track, uint8_t *nal, int len) {
+	static const uint8_t start_code[3] = { 0x00, 0x00, 0x01 };
+	if(len < 1)
+		return;
+	uint8_t type = nal[0] & 0x1F;
+	if(type == 5)
+		track->frame_key = TRUE;
+	else if(type == 7 && len > 4)
+		janus_pp_h264_parse_sps((char *)nal, &track->width, &track->height);
+	if((type == 7 && !track->sps_found) || (type == 8 && !track->pps_found)) {
+		/* Keep the first SPS and PPS, containers need them in the codec extradata */
+		if(type == 7)
+			track->sps_found = TRUE;
+		else
+			track->pps_found = TRUE;
+		g_byte_array_append(track->extradata, start_code, sizeof(start_code));
+		g_byte_array_append(track->extradata, nal, len);
+	}
+	g_byte_array_append(track->frame, start_code, sizeof(start_code));
+	g_byte_array_append(track->frame, nal, len);
+}
+
+/* H.264 depacketizer (https://tools.ietf.org/html/rfc6184) */
+static void janus_pp_mux_h264_depay(janus_pp_mux_track *track, uint8_t *buf, int len) {
+	static const uint8_t start_code[3] = { 0x00, 0x00, 0x01 };
+	if(len < 1)
+		return;
+	uint8_t fragment = buf[0] & 0x1F;
+	if(fragment > 0 && fragment < 24) {
+		/* Single NAL */
+		janus_pp_mux_h264_nal(track, buf, len);
+	} else if(fragment == 24) {
+		/* STAP-A: de-aggregate the NALs */
+		int index = 1;
+		while(index + 2 <= len) {
+			uint16_t psize = (buf[index] << 8) | buf[index+1];
+			index += 2;
+			if(psize == 0 || index + psize > len)
+				break;
+			janus_pp_mux_h264_nal(track, buf + index, psize);
+			index += psize;
+		}
+	} else if(fragment == 28) {
+		/* FU-A */
+		if(len < 3)
+			return;
+		uint8_t indicator = buf[0], header = buf[1];
+		if(header & 0x80) {
+			/* First part of the fragmented NAL */
+			uint8_t nal = (indicator & 0xE0) | (header & 0x1F);
+			if((nal & 0x1F) == 5)
+				track->frame_key = TRUE;
+			g_byte_array_append(track->frame, start_code, sizeof(start_code));
+			g_byte_array_append(track->frame, &nal, 1);
+		}
+		g_byte_array_append(track->frame, buf + 2, len - 2);
+	}
+}
+
+/* Helper to process a packet that left the reordering window */
+static void janus_pp_mux_emit(janus_pp_mux_track *track, janus_pp_mux_packet *packet) {
+	if(!track->emitted) {
+		track->emitted = TRUE;
+		track->first_ts = packet->ts;
+		track->frame_ts = packet->ts;
+	}
+	track->last_seq = packet->seq;
+	if(packet->ts < track->first_ts) {
+		/* Older than the first packet we processed, ignore */
+		track->late++;
+	} else if(!track->video) {
+		/* Each Opus packet is a frame of its own */
+		janus_pp_mux_frame *frame = g_malloc(sizeof(janus_pp_mux_frame));
+		frame->pts = (int64_t)(packet->ts - track->first_ts) + track->start;
+		frame->size = packet->len;
+		frame->data = g_malloc(frame->size + FF_INPUT_BUFFER_PADDING_SIZE);
+		memcpy(frame->data, packet->payload, frame->size);
+		memset(frame->data + frame->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+		frame->keyframe = TRUE;
+		janus_pp_mux_queue_frame(track, frame);
+	} else {
+		/* Timestamp changed: the marker bit is not mandatory, and may be lost as well */
+		if(packet->ts != track->frame_ts) {
+			janus_pp_mux_flush_frame(track);
+			track->frame_ts = packet->ts;
+		}
+		if(track->codec == JANUS_PP_MUX_VP8)
+			janus_pp_mux_vp8_depay(track, packet->payload, packet->len);
+		else if(track->codec == JANUS_PP_MUX_VP9)
+			janus_pp_mux_vp9_depay(track, packet->payload, packet->len);
+		else if(track->codec == JANUS_PP_MUX_H264)
+			janus_pp_mux_h264_depay(track, packet->payload, packet->len);
+	}
+	g_free(packet->payload);
+	packet->payload = NULL;
+}
+
+/* Helper to add a packet to the reordering window, processing the oldest one if it's full */
+static void janus_pp_mux_reorder(janus_pp_mux_track *track, janus_pp_mux_packet *packet) {
+	if(track->emitted && packet->seq <= track->last_seq) {
+		/* Too late, we already processed what came after this */
+		track->late++;
+		g_free(packet->payload);
+		return;
+	}
+	int i = track->count;
+	while(i > 0 && track->window[i-1].seq > packet->seq)
+		i--;
+	if(i > 0 && track->window[i-1].seq == packet->seq) {
+		/* Duplicate */
+		g_free(packet->payload);
+		return;
+	}
+	memmove(&track->window[i+1], &track->window[i], (track->count - i) * sizeof(janus_pp_mux_packet));
+	track->window[i] = *packet;
+	track->count++;
+	if(track->count > JANUS_PP_MUX_WINDOW) {
+		janus_pp_mux_emit(track, &track->window[0]);
+		track->count--;
+		memmove(&track->window[0], &track->window[1], track->count * sizeof(janus_pp_mux_packet));
+	}
+}
+
+/* Thread parsing a recording, and handing the frames to the muxer */
+static void *janus_pp_mux_parser_thread(void *data) {
+	janus_pp_mux_track *track = (janus_pp_mux_track *)data;
+	uint8_t *buffer = g_malloc(65536);
+	char header[10];
+	long offset = track->offset;
+	while(*track->working && offset < track->fsize) {
+		/* Read frame header (fixed part[4], timestamp[4], length[2]) */
+		fseek(track->file, offset, SEEK_SET);
+		if(fread(header, sizeof(char), 10, track->file) != 10)
+			break;
+		if(header[0] != 'M' || header[1] != 'E') {
+			JANUS_LOG(LOG_ERR, "[%s] Invalid frame header at offset %ld, stopping here\n", track->path, offset);
+			break;
+		}
+		uint16_t len = 0;
+		memcpy(&len, header+8, sizeof(uint16_t));
+		len = ntohs(len);
+		offset += 10 + len;
+		if(len < 12)
+			continue;
+		if(fread(buffer, sizeof(char), len, track->file) != len)
+			break;
+		/* Parse the RTP header, skipping CSRCs and extensions */
+		janus_pp_rtp_header *rtp = (janus_pp_rtp_header *)buffer;
+		if(rtp->version != 2)
+			continue;
+		int skip = 12 + rtp->csrccount*4;
+		if(rtp->extension) {
+			if(len < skip + 4)
+				continue;
+			janus_pp_rtp_header_extension *ext = (janus_pp_rtp_header_extension *)(buffer + skip);
+			skip += 4 + ntohs(ext->length)*4;
+		}
+		int plen = len - skip;
+		if(rtp->padding && plen > 0)
+			plen -= buffer[len-1];
+		if(plen <= 0)
+			continue;
+		track->packets++;
+		uint16_t seq = ntohs(rtp->seq_number);
+		uint32_t ts = ntohl(rtp->timestamp);
+		if(!track->started) {
+			/* Start one cycle in, so that we can handle packets that precede the first one */
+			track->started = TRUE;
+			track->max_seq = ((uint64_t)1 << 16) + seq;
+			track->max_ts = ((uint64_t)1 << 32) + ts;
+		}
+		janus_pp_mux_packet packet;
+		packet.seq = janus_pp_mux_extend(track->max_seq, seq, 16);
+		packet.ts = janus_pp_mux_extend(track->max_ts, ts, 32);
+		if(packet.seq > track->max_seq)
+			track->max_seq = packet.seq;
+		if(packet.ts > track->max_ts)
+			track->max_ts = packet.ts;
+		packet.payload = g_malloc(plen);
+		memcpy(packet.payload, buffer + skip, plen);
+		packet.len = plen;
+		janus_pp_mux_reorder(track, &packet);
+	}
+	/* Done, process what's left in the window */
+	int i = 0;
+	for(i=0; i<track->count; i++) {
+		if(*track->working)
+			janus_pp_mux_emit(track, &track->window[i]);
+		else
+			g_free(track->window[i].payload);
+	}
+	track->count = 0;
+	if(track->video && *track->working)
+		janus_pp_mux_flush_frame(track);
+	g_free(buffer);
+	janus_pp_mux_queue_frame(track, &eos_frame);
+	return NULL;
+}
+
+/* Helper to open a recording and parse its info header */
+static int janus_pp_mux_track_open(janus_pp_mux_track *track, const char *path, gboolean video) {
+	track->path = path;
+	track->file = fopen(path, "rb");
+	if(track->file == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s\n", path);
+		return -1;
+	}
+	fseek(track->file, 0L, SEEK_END);
+	track->fsize = ftell(track->file);
+	fseek(track->file, 0L, SEEK_SET);
+	/* We only support the new .mjr format, as we need the info header */
+	char prebuffer[1500];
+	uint16_t len = 0;
+	if(fread(prebuffer, sizeof(char), 8, track->file) != 8 || memcmp(prebuffer, "MJR00002", 8) ||
+			fread(&len, sizeof(uint16_t), 1, track->file) != 1) {
+		JANUS_LOG(LOG_ERR, "[%s] Unsupported recording format (only MJR00002 can be muxed)\n", path);
+		return -1;
+	}
+	len = ntohs(len);
+	if(len == 0 || len >= sizeof(prebuffer) || fread(prebuffer, sizeof(char), len, track->file) != len) {
+		JANUS_LOG(LOG_ERR, "[%s] Invalid info header\n", path);
+		return -1;
+	}
+	prebuffer[len] = '\0';
+	track->offset = 8 + 2 + len;
+	json_error_t error;
+	json_t *info = json_loads(prebuffer, 0, &error);
+	if(!info) {
+		JANUS_LOG(LOG_ERR, "[%s] JSON error: on line %d: %s\n", path, error.line, error.text);
+		return -1;
+	}
+	json_t *type = json_object_get(info, "t");
+	json_t *codec = json_object_get(info, "c");
+	json_t *written = json_object_get(info, "u");
+	json_t *e2ee = json_object_get(info, "e");
+	if(!json_is_string(type) || !json_is_string(codec) || !json_is_integer(written)) {
+		JANUS_LOG(LOG_ERR, "[%s] Missing/invalid type, codec or written time in info header\n", path);
+		json_decref(info);
+		return -1;
+	}
+	if(json_is_true(e2ee)) {
+		JANUS_LOG(LOG_ERR, "[%s] End-to-end encrypted recordings can't be muxed\n", path);
+		json_decref(info);
+		return -1;
+	}
+	const char *t = json_string_value(type), *c = json_string_value(codec);
+	track->video = !strcasecmp(t, "v");
+	if(track->video != video) {
+		JANUS_LOG(LOG_ERR, "[%s] Not %s recording\n", path, video ? "a video" : "an audio");
+		json_decref(info);
+		return -1;
+	}
+	if(!video && !strcasecmp(c, "opus")) {
+		track->codec = JANUS_PP_MUX_OPUS;
+		track->clock = 48000;
+	} else if(video && !strcasecmp(c, "vp8")) {
+		track->codec = JANUS_PP_MUX_VP8;
+		track->clock = 90000;
+	} else if(video && !strcasecmp(c, "vp9")) {
+		track->codec = JANUS_PP_MUX_VP9;
+		track->clock = 90000;
+	} else if(video && !strcasecmp(c, "h264")) {
+		track->codec = JANUS_PP_MUX_H264;
+		track->clock = 90000;
+	} else {
+		JANUS_LOG(LOG_ERR, "[%s] Unsupported codec '%s' for muxing\n", path, c);
+		json_decref(info);
+		return -1;
+	}
+	track->written = json_integer_value(written);
+	JANUS_LOG(LOG_INFO, "[%s] %s track, codec %s (written: %"SCNi64")\n", path,
+		video ? "Video" : "Audio", c, track->written);
+	json_decref(info);
+	track->frame = g_byte_array_new();
+	track->extradata = g_byte_array_new();
+	track->frames = g_async_queue_new();
+	track->last_pts = -1;
+	return 0;
+}
+
+/* Helper to close a recording we muxed */
+static void janus_pp_mux_track_close(janus_pp_mux_track *track) {
+	if(track->thread != NULL) {
+		g_thread_join(track->thread);
+		track->thread = NULL;
+	}
+	if(track->frames != NULL) {
+		janus_pp_mux_frame *frame = NULL;
+		while((frame = g_async_queue_try_pop(track->frames)) != NULL) {
+			if(frame != &eos_frame) {
+				g_free(frame->data);
+				g_free(frame);
+			}
+		}
+		g_async_queue_unref(track->frames);
+		track->frames = NULL;
+	}
+	if(track->frame != NULL)
+		g_byte_array_free(track->frame, TRUE);
+	track->frame = NULL;
+	if(track->extradata != NULL)
+		g_byte_array_free(track->extradata, TRUE);
+	track->extradata = NULL;
+	if(track->file != NULL)
+		fclose(track->file);
+	track->file = NULL;
+}
+
+/* Helper to write a frame to the muxed file */
+static void janus_pp_mux_write(AVFormatContext *fctx, janus_pp_mux_track *track, janus_pp_mux_frame *frame) {
+	if(frame->pts <= track->last_pts) {
+		/* Timestamps must be increasing */
+		JANUS_LOG(LOG_HUGE, "[%s] Skipping frame with non-increasing timestamp %"SCNi64"\n", track->path, frame->pts);
+		return;
+	}
+	track->last_pts = frame->pts;
+	AVPacket *packet = av_packet_alloc();
+	packet->stream_index = track->stream->index;
+	packet->data = frame->data;
+	packet->size = frame->size;
+	if(frame->keyframe)
+		packet->flags |= AV_PKT_FLAG_KEY;
+	packet->pts = av_rescale_q(frame->pts, (AVRational){ 1, track->clock }, track->stream->time_base);
+	packet->dts = packet->pts;
+	/* Packets are not reference counted, so libavformat will make a copy if it needs to */
+	int res = av_interleaved_write_frame(fctx, packet);
+	if(res < 0)
+		JANUS_LOG(LOG_ERR, "[%s] Error writing frame to file... (error %d)\n", track->path, res);
+	else
+		track->muxed++;
+	av_packet_free(&packet);
+}
+
+int janus_pp_mux_process(const char *audio, const char *video, const char *destination,
+		const char *format, const char *metadata, gboolean faststart, int hls_time, gboolean hls_append, int *working) {
+	if(!video || !destination || !format || !working)
+		return -1;
+	gboolean hls = !strcasecmp(format, "m3u8");
+	if(audio == NULL && !hls) {
+		JANUS_LOG(LOG_ERR, "Missing audio recording to mux\n");
+		return -1;
+	}
+#ifndef USE_CODECPAR
+	JANUS_LOG(LOG_FATAL, "Your FFmpeg version does not support muxing in a single pass\n");
+	return -1;
+#else
+	janus_pp_mux_track *a = audio ? g_malloc0(sizeof(janus_pp_mux_track)) : NULL;
+	janus_pp_mux_track *v = g_malloc0(sizeof(janus_pp_mux_track));
+	AVFormatContext *fctx = NULL;
+	janus_pp_mux_frame *af = NULL, *vf = NULL;
+	int ret = -1;
+	if((a && janus_pp_mux_track_open(a, audio, FALSE) < 0) || janus_pp_mux_track_open(v, video, TRUE) < 0)
+		goto done;
+	if(!strcasecmp(format, "webm") && v->codec == JANUS_PP_MUX_H264) {
+		JANUS_LOG(LOG_ERR, "H.264 can't be muxed in a .webm file, use .mkv or .mp4 instead\n");
+		goto done;
+	}
+	if(hls && v->codec == JANUS_PP_MUX_VP8) {
+		JANUS_LOG(LOG_ERR, "VP8 can't be used in fragmented MP4 segments\n");
+		goto done;
+	}
+	/* Compute the offset of each track from when their first frames were written */
+	gint64 first = a ? MIN(a->written, v->written) : v->written;
+	if(a)
+		a->start = (a->written - first) * a->clock / G_USEC_PER_SEC;
+	v->start = (v->written - first) * v->clock / G_USEC_PER_SEC;
+	/* Start parsing the recordings */
+	GError *error = NULL;
+	if(a) {
+		a->working = working;
+		a->thread = g_thread_try_new("pp-mux audio", janus_pp_mux_parser_thread, a, &error);
+	}
+	v->working = working;
+	if(error == NULL)
+		v->thread = g_thread_try_new("pp-mux video", janus_pp_mux_parser_thread, v, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the parser threads...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		*working = 0;
+		goto done;
+	}
+	/* We need the first video keyframe to know the resolution, before writing the header */
+	vf = g_async_queue_pop(v->frames);
+	if(vf == &eos_frame) {
+		JANUS_LOG(LOG_ERR, "No video keyframe found, can't mux\n");
+		goto done;
+	}
+#if ( LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58,9,100) )
+	av_register_all();
+#endif
+	/* Adjust logging to match the postprocessor's */
+	av_log_set_level(janus_log_level <= LOG_NONE ? AV_LOG_QUIET :
+		(janus_log_level == LOG_FATAL ? AV_LOG_FATAL :
+			(janus_log_level == LOG_ERR ? AV_LOG_ERROR :
+				(janus_log_level == LOG_WARN ? AV_LOG_WARNING :
+					(janus_log_level == LOG_INFO ? AV_LOG_INFO :
+						(janus_log_level == LOG_VERB ? AV_LOG_VERBOSE : AV_LOG_DEBUG))))));
+	const char *oformat = format;
+	if(!strcasecmp(format, "mkv"))
+		oformat = "matroska";
+	else if(hls)
+		oformat = "hls";
+	if(avformat_alloc_output_context2(&fctx, NULL, oformat, destination) < 0 || fctx == NULL) {
+		JANUS_LOG(LOG_ERR, "Error allocating context\n");
+		goto done;
+	}
+	/* We save the metadata part as a comment (see #1189) */
+	if(metadata)
+		av_dict_set(&fctx->metadata, "comment", metadata, 0);
+	/* Opus in MP4 may still be considered experimental, depending on the FFmpeg version */
+	fctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+	/* Video stream */
+	v->stream = avformat_new_stream(fctx, NULL);
+	if(v->stream == NULL) {
+		JANUS_LOG(LOG_ERR, "Error adding video stream\n");
+		goto done;
+	}
+	v->stream->time_base = (AVRational){ 1, v->clock };
+	v->stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+	v->stream->codecpar->codec_id = (v->codec == JANUS_PP_MUX_VP8 ? AV_CODEC_ID_VP8 :
+		(v->codec == JANUS_PP_MUX_VP9 ? AV_CODEC_ID_VP9 : AV_CODEC_ID_H264));
+	v->stream->codecpar->width = v->width;
+	v->stream->codecpar->height = v->height;
+	if(v->extradata->len > 0) {
+		/* Fragmented MP4 needs the parameter sets before the first fragment */
+		v->stream->codecpar->extradata = av_mallocz(v->extradata->len + FF_INPUT_BUFFER_PADDING_SIZE);
+		memcpy(v->stream->codecpar->extradata, v->extradata->data, v->extradata->len);
+		v->stream->codecpar->extradata_size = v->extradata->len;
+	}
+	/* Audio stream */
+	if(a) {
+		a->stream = avformat_new_stream(fctx, NULL);
+		if(a->stream == NULL) {
+			JANUS_LOG(LOG_ERR, "Error adding audio stream\n");
+			goto done;
+		}
+		a->stream->time_base = (AVRational){ 1, a->clock };
+		a->stream->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+		a->stream->codecpar->codec_id = AV_CODEC_ID_OPUS;
+		a->stream->codecpar->sample_rate = 48000;
+#if LIBAVCODEC_VER_AT_LEAST(59, 24)
+		av_channel_layout_default(&a->stream->codecpar->ch_layout, 2);
+#else
+		a->stream->codecpar->channels = 2;
+		a->stream->codecpar->channel_layout = AV_CH_LAYOUT_STEREO;
+#endif
+		/* Containers need an OpusHead as extradata (https://tools.ietf.org/html/rfc7845#section-5.1) */
+		uint8_t opushead[19] = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd',
+			1, 2, 0x00, 0x00, 0x80, 0xBB, 0x00, 0x00, 0x00, 0x00, 0 };
+		a->stream->codecpar->extradata = av_mallocz(sizeof(opushead) + FF_INPUT_BUFFER_PADDING_SIZE);
+		memcpy(a->stream->codecpar->extradata, opushead, sizeof(opushead));
+		a->stream->codecpar->extradata_size = sizeof(opushead);
+	}
+	int res = 0;
+	if(!(fctx->oformat->flags & AVFMT_NOFILE)) {
+		/* The HLS muxer opens the playlist and segments itself */
+		res = avio_open(&fctx->pb, destination, AVIO_FLAG_WRITE);
+		if(res < 0) {
+			JANUS_LOG(LOG_ERR, "Error opening file for output (%d)\n", res);
+			goto done;
+		}
+	}
+	AVDictionary *options = NULL;
+	if(faststart)
+		av_dict_set(&options, "movflags", "+faststart", 0);
+	if(hls) {
+		/* Fragmented MP4 (CMAF) segments, and a playlist that lists all of them */
+		av_dict_set(&options, "hls_segment_type", "fmp4", 0);
+		av_dict_set_int(&options, "hls_time", hls_time > 0 ? hls_time : 6, 0);
+		av_dict_set(&options, "hls_list_size", "0", 0);
+		av_dict_set(&options, "hls_playlist_type", "event", 0);
+		/* When appending (e.g., the next segment of a recording), keep what's in the playlist already */
+		av_dict_set(&options, "hls_flags", hls_append ? "independent_segments+append_list" : "independent_segments", 0);
+		JANUS_LOG(LOG_INFO, "Generating HLS playlist with %ds fMP4 segments%s\n",
+			hls_time > 0 ? hls_time : 6, hls_append ? " (appending)" : "");
+	}
+	res = avformat_write_header(fctx, &options);
+	av_dict_free(&options);
+	if(res < 0) {
+		JANUS_LOG(LOG_ERR, "Error writing header\n");
+		goto done;
+	}
+	/* Interleave the frames of the tracks, by timestamp */
+	af = a ? g_async_queue_pop(a->frames) : &eos_frame;
+	while(*working && (af != &eos_frame || vf != &eos_frame)) {
+		gboolean use_audio = (vf == &eos_frame) || (af != &eos_frame &&
+			av_compare_ts(af->pts, (AVRational){ 1, a->clock }, vf->pts, (AVRational){ 1, v->clock }) <= 0);
+		if(use_audio) {
+			janus_pp_mux_write(fctx, a, af);
+			g_free(af->data);
+			g_free(af);
+			af = g_async_queue_pop(a->frames);
+		} else {
+			janus_pp_mux_write(fctx, v, vf);
+			g_free(vf->data);
+			g_free(vf);
+			vf = g_async_queue_pop(v->frames);
+		}
+	}
+	av_write_trailer(fctx);
+	if(a) {
+		JANUS_LOG(LOG_INFO, "Muxed %"SCNu32" audio frames (%"SCNu32" packets, %"SCNu32" late)\n",
+			a->muxed, a->packets, a->late);
+	}
+	JANUS_LOG(LOG_INFO, "Muxed %"SCNu32" video frames (%"SCNu32" packets, %"SCNu32" late)\n",
+		v->muxed, v->packets, v->late);
+	ret = 0;
+
+done:
+	/* Make sure the parser threads stop, if they're still going */
+	if(ret < 0)
+		*working = 0;
+	if(af != NULL && af != &eos_frame) {
+		g_free(af->data);
+		g_free(af);
+	}
+	if(vf != NULL && vf != &eos_frame) {
+		g_free(vf->data);
+		g_free(vf);
+	}
+	if(fctx != NULL) {
+		if(fctx->pb != NULL && !(fctx->oformat->flags & AVFMT_NOFILE))
+			avio_closep(&fctx->pb);
+		avformat_free_context(fctx);
+	}
+	if(a)
+		janus_pp_mux_track_close(a);
+	janus_pp_mux_track_close(v);
+	g_free(a);
+	g_free(v);
+	return ret;
+#endif
+}
@@ -0,0 +1,24 @@
+/*! \file    pp-mux.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Post-processing to mux audio and video in a single pass (headers)
+ * \details  Implementation of the post-processing code (based on FFmpeg)
+ * needed to mux an audio and a video recording in the same container
+ * in a single streaming pass, with bounded memory usage, or to generate
+ * an HLS playlist with fragmented MP4 segments.
+ *
+ * \ingroup postprocessing
+ * \ref postprocessing
+ */
+
+#ifndef JANUS_PP_MUX
+#define JANUS_PP_MUX
+
+#include <glib.h>
+
+/* Audio/video muxing stuff */
+int janus_pp_mux_process(const char *audio, const char *video, const char *destination,
+	const char *format, const char *metadata, gboolean faststart, int hls_time, gboolean hls_append, int *working);
+
+
+#endif
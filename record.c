@@ -21,13 +21,19 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <libgen.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <jansson.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 #include "record.h"
 #include "debug.h"
 #include "utils.h"
+#include "rtp.h"
+#include "memory.h"
 
 #define htonll(x) ((1==htonl(1)) ? (x) : ((gint64)htonl((x) & 0xFFFFFFFF) << 32) | htonl((x) >> 32))
 #define ntohll(x) ((1==ntohl(1)) ? (x) : ((gint64)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32))
@@ -42,6 +48,39 @@ static const char *frame_header = "MEET";
 static gboolean rec_tempname = FALSE;
 /* Extension to add in case tempnames is true (default="tmp" --> ".tmp") */
 static char *rec_tempext = NULL;
+/* Whether we should write an index file next to audio and video recordings (default=false) */
+static gboolean rec_index = FALSE;
+/* Whether new recordings should be split in segments of this many seconds (default=0, no segments) */
+static guint32 rec_segment_duration = 0;
+/* Whether new recorders can be created, which the core disables when overloaded (default=true) */
+static volatile gint rec_accepting = 1;
+
+/* Asynchronous writer, if enabled (default=false) */
+#define JANUS_RECORDER_CHUNK_SIZE		65536
+#define JANUS_RECORDER_CHUNK_MAX_AGE	G_USEC_PER_SEC
+typedef struct janus_recorder_chunk {
+	janus_recorder *recorder;
+	gboolean index;
+	char *data;
+	size_t size;
+	off_t offset;
+} janus_recorder_chunk;
+static janus_recorder_chunk exit_chunk;
+static gboolean rec_async = FALSE, rec_async_drop = TRUE;
+static size_t rec_async_backlog = 0;
+static GThread *rec_writer = NULL;
+static GAsyncQueue *rec_chunks = NULL;
+static janus_mutex rec_async_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition rec_async_cond;
+static volatile gint rec_queued = 0, rec_dropped = 0, rec_waits = 0, rec_errors = 0;
+static volatile gint rec_writes = 0, rec_max_write_time = 0, rec_streams = 0;
+#ifdef HAVE_LIBURING
+/* When io_uring is used, the writer thread submits the chunks it finds queued in batches */
+#define JANUS_RECORDER_URING_DEPTH		64
+static struct io_uring rec_ring;
+static gboolean rec_uring = FALSE;
+static volatile gint rec_batches = 0;
+#endif
 
 void janus_recorder_init(gboolean tempnames, const char *extension) {
 	JANUS_LOG(LOG_INFO, "Initializing recorder code\n");
@@ -60,6 +99,417 @@ void janus_recorder_init(gboolean tempnames, const char *extension) {
 void janus_recorder_deinit(void) {
 	rec_tempname = FALSE;
 	g_free(rec_tempext);
+	rec_index = FALSE;
+	rec_segment_duration = 0;
+	g_atomic_int_set(&rec_accepting, 1);
+	if(rec_writer != NULL) {
+		g_async_queue_push(rec_chunks, &exit_chunk);
+		g_thread_join(rec_writer);
+		rec_writer = NULL;
+		g_async_queue_unref(rec_chunks);
+		rec_chunks = NULL;
+		janus_condition_destroy(&rec_async_cond);
+	}
+#ifdef HAVE_LIBURING
+	if(rec_uring)
+		io_uring_queue_exit(&rec_ring);
+	rec_uring = FALSE;
+#endif
+	rec_async = FALSE;
+}
+
+void janus_recorder_set_segment_duration(guint32 seconds) {
+	rec_segment_duration = seconds;
+	if(rec_segment_duration > 0)
+		JANUS_LOG(LOG_INFO, "Recordings will be split in segments of %"SCNu32" seconds\n", rec_segment_duration);
+}
+
+void janus_recorder_set_indexing(gboolean enabled) {
+	rec_index = enabled;
+	JANUS_LOG(LOG_INFO, "Recording indexes %s\n", rec_index ? "enabled" : "disabled");
+}
+
+void janus_recorder_set_accepting(gboolean accept) {
+	g_atomic_int_set(&rec_accepting, accept ? 1 : 0);
+}
+
+janus_recorder_index_entry *janus_recorder_index_read(const char *path, size_t *count) {
+	if(path == NULL || count == NULL)
+		return NULL;
+	*count = 0;
+	struct stat st;
+	if(stat(path, &st) < 0)
+		return NULL;
+	char ipath[1024];
+	g_snprintf(ipath, sizeof(ipath), "%s.idx", path);
+	FILE *file = fopen(ipath, "rb");
+	if(file == NULL)
+		return NULL;
+	char header[8];
+	if(fread(header, sizeof(char), 8, file) != 8 || memcmp(header, JANUS_RECORDER_INDEX_HEADER, 8)) {
+		JANUS_LOG(LOG_WARN, "Invalid recording index %s\n", ipath);
+		fclose(file);
+		return NULL;
+	}
+	GArray *entries = g_array_new(FALSE, FALSE, sizeof(janus_recorder_index_entry));
+	guint8 buf[JANUS_RECORDER_INDEX_ENTRY_SIZE];
+	janus_recorder_index_entry entry;
+	while(fread(buf, sizeof(char), sizeof(buf), file) == sizeof(buf)) {
+		guint64 offset = 0;
+		guint32 when = 0, timestamp = 0;
+		guint16 seq = 0, length = 0;
+		memcpy(&offset, buf, sizeof(offset));
+		memcpy(&when, buf+8, sizeof(when));
+		memcpy(&timestamp, buf+12, sizeof(timestamp));
+		memcpy(&seq, buf+16, sizeof(seq));
+		memcpy(&length, buf+18, sizeof(length));
+		entry.offset = ntohll(offset);
+		entry.when = ntohl(when);
+		entry.timestamp = ntohl(timestamp);
+		entry.seq = ntohs(seq);
+		entry.length = ntohs(length);
+		entry.flags = buf[20];
+		if(entry.offset + entry.length > (guint64)st.st_size) {
+			/* The index doesn't match the recording, don't trust it */
+			JANUS_LOG(LOG_WARN, "Recording index %s doesn't match the recording, ignoring it\n", ipath);
+			g_array_free(entries, TRUE);
+			fclose(file);
+			return NULL;
+		}
+		g_array_append_val(entries, entry);
+	}
+	fclose(file);
+	*count = entries->len;
+	return (janus_recorder_index_entry *)g_array_free(entries, FALSE);
+}
+
+/* Helper to notify that a chunk has been written, and get rid of it */
+static void janus_recorder_chunk_done(janus_recorder_chunk *chunk, gint64 elapsed) {
+	janus_recorder *recorder = chunk->recorder;
+	if(elapsed > g_atomic_int_get(&rec_max_write_time))
+		g_atomic_int_set(&rec_max_write_time, (gint)elapsed);
+	g_atomic_int_inc(&rec_writes);
+	/* Notify whoever may be waiting for room in the backlog, or for this recorder to be drained */
+	janus_mutex_lock(&rec_async_mutex);
+	g_atomic_int_add(&rec_queued, -(gint)chunk->size);
+	janus_memory_add(NULL, JANUS_MEMORY_RECORDER, -(gint)chunk->size);
+	g_atomic_int_add(&recorder->pending, -1);
+	janus_condition_broadcast(&rec_async_cond);
+	janus_mutex_unlock(&rec_async_mutex);
+	janus_refcount_decrease(&recorder->ref);
+	g_free(chunk->data);
+	g_free(chunk);
+}
+
+#ifdef HAVE_LIBURING
+/* Helper to write (what's left of) a chunk at the right offset, when io_uring can't do it for us */
+static void janus_recorder_chunk_pwrite(janus_recorder_chunk *chunk, int fd, size_t written) {
+	while(written < chunk->size) {
+		ssize_t res = pwrite(fd, chunk->data + written, chunk->size - written, chunk->offset + written);
+		if(res < 0 && errno == EINTR)
+			continue;
+		if(res <= 0) {
+			g_atomic_int_inc(&rec_errors);
+			JANUS_LOG(LOG_ERR, "Error saving %zu bytes to %s%s (%s)\n", chunk->size - written,
+				chunk->recorder->filename, chunk->index ? ".idx" : "", strerror(errno));
+			return;
+		}
+		written += res;
+	}
+}
+
+/* Helper to write a batch of chunks via io_uring: returns TRUE if the thread should leave */
+static gboolean janus_recorder_uring_batch(janus_recorder_chunk *chunk) {
+	janus_recorder_chunk *batch[JANUS_RECORDER_URING_DEPTH];
+	int count = 0, i = 0;
+	gboolean leave = FALSE;
+	/* Queue as many of the chunks that are waiting as the ring allows */
+	while(chunk != NULL) {
+		if(chunk == &exit_chunk) {
+			leave = TRUE;
+			break;
+		}
+		FILE *file = chunk->index ? chunk->recorder->index : chunk->recorder->file;
+		struct io_uring_sqe *sqe = file ? io_uring_get_sqe(&rec_ring) : NULL;
+		if(sqe == NULL) {
+			if(file != NULL)
+				janus_recorder_chunk_pwrite(chunk, fileno(file), 0);
+			janus_recorder_chunk_done(chunk, 0);
+		} else {
+			io_uring_prep_write(sqe, fileno(file), chunk->data, chunk->size, chunk->offset);
+			io_uring_sqe_set_data(sqe, chunk);
+			batch[count] = chunk;
+			count++;
+			if(count == JANUS_RECORDER_URING_DEPTH)
+				break;
+		}
+		chunk = g_async_queue_try_pop(rec_chunks);
+	}
+	if(count == 0)
+		return leave;
+	gint64 start = janus_get_monotonic_time();
+	int res = io_uring_submit_and_wait(&rec_ring, count);
+	if(res < count) {
+		/* Something went wrong: writes are positional, so just do them all
+		 * again ourselves, and stop using io_uring from now on */
+		JANUS_LOG(LOG_ERR, "Error submitting %d writes via io_uring (%d), falling back to pwrite\n", count, res);
+		for(i=0; i<count; i++) {
+			FILE *file = batch[i]->index ? batch[i]->recorder->index : batch[i]->recorder->file;
+			janus_recorder_chunk_pwrite(batch[i], fileno(file), 0);
+		}
+		struct io_uring_cqe *cqe = NULL;
+		for(i=0; i<res; i++) {
+			if(io_uring_wait_cqe(&rec_ring, &cqe) < 0)
+				break;
+			io_uring_cqe_seen(&rec_ring, cqe);
+		}
+		rec_uring = FALSE;
+		gint64 elapsed = janus_get_monotonic_time() - start;
+		for(i=0; i<count; i++)
+			janus_recorder_chunk_done(batch[i], elapsed);
+		return leave;
+	}
+	/* Reap the completions */
+	for(i=0; i<count; i++) {
+		struct io_uring_cqe *cqe = NULL;
+		if(io_uring_wait_cqe(&rec_ring, &cqe) < 0) {
+			i--;
+			continue;
+		}
+		janus_recorder_chunk *done = io_uring_cqe_get_data(cqe);
+		int written = cqe->res;
+		io_uring_cqe_seen(&rec_ring, cqe);
+		if(written < 0 || (size_t)written < done->size) {
+			/* Short (or failed) write, complete it ourselves */
+			FILE *file = done->index ? done->recorder->index : done->recorder->file;
+			janus_recorder_chunk_pwrite(done, fileno(file), written < 0 ? 0 : written);
+		}
+		janus_recorder_chunk_done(done, janus_get_monotonic_time() - start);
+	}
+	g_atomic_int_inc(&rec_batches);
+	return leave;
+}
+#endif
+
+/* Thread writing the chunks of all recordings, when the asynchronous writer is enabled */
+static void *janus_recorder_writer_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Recordings writer thread started\n");
+	janus_recorder_chunk *chunk = NULL;
+	while((chunk = g_async_queue_pop(rec_chunks)) != &exit_chunk) {
+#ifdef HAVE_LIBURING
+		if(rec_uring) {
+			if(janus_recorder_uring_batch(chunk))
+				break;
+			continue;
+		}
+#endif
+		janus_recorder *recorder = chunk->recorder;
+		FILE *file = chunk->index ? recorder->index : recorder->file;
+		gint64 start = janus_get_monotonic_time();
+		if(file != NULL)
+			fseek(file, chunk->offset, SEEK_SET);
+		if(file != NULL && fwrite(chunk->data, sizeof(char), chunk->size, file) != chunk->size) {
+			g_atomic_int_inc(&rec_errors);
+			JANUS_LOG(LOG_ERR, "Error saving %zu bytes to %s%s (%s)\n", chunk->size,
+				recorder->filename, chunk->index ? ".idx" : "", strerror(errno));
+		}
+		janus_recorder_chunk_done(chunk, janus_get_monotonic_time() - start);
+	}
+	JANUS_LOG(LOG_VERB, "Recordings writer thread leaving\n");
+	return NULL;
+}
+
+/* Helper to return the name of the backend the writer thread is using */
+static const char *janus_recorder_async_backend(void) {
+#ifdef HAVE_LIBURING
+	if(rec_uring)
+		return "io_uring";
+#endif
+	return "stdio";
+}
+
+void janus_recorder_set_async(size_t backlog, gboolean drop, gboolean uring) {
+	if(rec_writer != NULL)
+		return;
+	if(uring) {
+#ifdef HAVE_LIBURING
+		int res = io_uring_queue_init(JANUS_RECORDER_URING_DEPTH, &rec_ring, 0);
+		if(res < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't setup io_uring (%s), using stdio for recordings\n", g_strerror(-res));
+		} else {
+			rec_uring = TRUE;
+		}
+#else
+		JANUS_LOG(LOG_WARN, "io_uring support not compiled, using stdio for recordings\n");
+#endif
+	}
+	if(backlog < JANUS_RECORDER_CHUNK_SIZE)
+		backlog = JANUS_RECORDER_CHUNK_SIZE;
+	if(backlog > G_MAXINT)
+		backlog = G_MAXINT;
+	rec_async_backlog = backlog;
+	rec_async_drop = drop;
+	janus_condition_init(&rec_async_cond);
+	rec_chunks = g_async_queue_new();
+	GError *error = NULL;
+	rec_writer = g_thread_try_new("recordings writer", &janus_recorder_writer_thread, NULL, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the recordings writer thread, writing synchronously\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		rec_writer = NULL;
+		g_async_queue_unref(rec_chunks);
+		rec_chunks = NULL;
+		janus_condition_destroy(&rec_async_cond);
+#ifdef HAVE_LIBURING
+		if(rec_uring)
+			io_uring_queue_exit(&rec_ring);
+		rec_uring = FALSE;
+#endif
+		return;
+	}
+	rec_async = TRUE;
+	JANUS_LOG(LOG_INFO, "Recordings asynchronous writer enabled (%s, backlog of %zu bytes, %s when full)\n",
+		janus_recorder_async_backend(), rec_async_backlog, rec_async_drop ? "dropping frames" : "waiting");
+}
+
+json_t *janus_recorder_async_summary(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "enabled", rec_async ? json_true() : json_false());
+	if(!rec_async)
+		return info;
+	json_object_set_new(info, "backend", json_string(janus_recorder_async_backend()));
+	json_object_set_new(info, "backlog", json_integer(rec_async_backlog));
+	json_object_set_new(info, "policy", json_string(rec_async_drop ? "drop" : "wait"));
+	json_object_set_new(info, "queued", json_integer(g_atomic_int_get(&rec_queued)));
+	json_object_set_new(info, "writes", json_integer(g_atomic_int_get(&rec_writes)));
+#ifdef HAVE_LIBURING
+	if(rec_uring)
+		json_object_set_new(info, "batches", json_integer(g_atomic_int_get(&rec_batches)));
+#endif
+	json_object_set_new(info, "max_write_time", json_integer(g_atomic_int_get(&rec_max_write_time)));
+	json_object_set_new(info, "dropped", json_integer(g_atomic_int_get(&rec_dropped)));
+	json_object_set_new(info, "waits", json_integer(g_atomic_int_get(&rec_waits)));
+	json_object_set_new(info, "errors", json_integer(g_atomic_int_get(&rec_errors)));
+	json_object_set_new(info, "streams", json_integer(g_atomic_int_get(&rec_streams)));
+	return info;
+}
+
+/* Helper to hand the current chunk of a recording (or of its index) to the writer thread */
+static void janus_recorder_push_chunk(janus_recorder *recorder, gboolean index) {
+	char **data = index ? &recorder->ichunk : &recorder->chunk;
+	size_t *len = index ? &recorder->ichunk_len : &recorder->chunk_len;
+	size_t *offset = index ? &recorder->ioffset : &recorder->offset;
+	if(*data == NULL || *len == 0)
+		return;
+	janus_recorder_chunk *chunk = g_malloc(sizeof(janus_recorder_chunk));
+	janus_refcount_increase(&recorder->ref);
+	chunk->recorder = recorder;
+	chunk->index = index;
+	chunk->data = *data;
+	chunk->size = *len;
+	chunk->offset = *offset;
+	*offset += *len;
+	*data = NULL;
+	*len = 0;
+	g_atomic_int_inc(&recorder->pending);
+	g_atomic_int_add(&rec_queued, (gint)chunk->size);
+	janus_memory_add(NULL, JANUS_MEMORY_RECORDER, (gint)chunk->size);
+	g_async_queue_push(rec_chunks, chunk);
+}
+
+/* Helper to serialize data in the current chunk of a recording (or of its index) */
+static void janus_recorder_append(janus_recorder *recorder, gboolean index, const void *data, size_t size) {
+	char **chunk = index ? &recorder->ichunk : &recorder->chunk;
+	size_t *len = index ? &recorder->ichunk_len : &recorder->chunk_len;
+	const char *src = (const char *)data;
+	while(size > 0) {
+		if(*chunk == NULL) {
+			*chunk = g_malloc(JANUS_RECORDER_CHUNK_SIZE);
+			*len = 0;
+		}
+		size_t room = JANUS_RECORDER_CHUNK_SIZE - *len;
+		size_t copy = size < room ? size : room;
+		memcpy(*chunk + *len, src, copy);
+		*len += copy;
+		src += copy;
+		size -= copy;
+		if(*len == JANUS_RECORDER_CHUNK_SIZE)
+			janus_recorder_push_chunk(recorder, index);
+	}
+}
+
+/* Helper to check if there's room in the backlog of the asynchronous writer, waiting for it if needed */
+static gboolean janus_recorder_reserve(size_t size) {
+	if((size_t)g_atomic_int_get(&rec_queued) + size <= rec_async_backlog)
+		return TRUE;
+	if(rec_async_drop) {
+		g_atomic_int_inc(&rec_dropped);
+		return FALSE;
+	}
+	g_atomic_int_inc(&rec_waits);
+	janus_mutex_lock(&rec_async_mutex);
+	while((size_t)g_atomic_int_get(&rec_queued) + size > rec_async_backlog)
+		janus_condition_wait(&rec_async_cond, &rec_async_mutex);
+	janus_mutex_unlock(&rec_async_mutex);
+	return TRUE;
+}
+
+/* Helper to wait for the asynchronous writer to write all the chunks of a recording, and write what's left ourselves */
+static void janus_recorder_drain(janus_recorder *recorder) {
+	janus_mutex_lock(&rec_async_mutex);
+	while(g_atomic_int_get(&recorder->pending) > 0)
+		janus_condition_wait(&rec_async_cond, &rec_async_mutex);
+	janus_mutex_unlock(&rec_async_mutex);
+	/* The writer may not have used stdio, so make sure we write at the right offset */
+	if(recorder->chunk != NULL && recorder->chunk_len > 0 && recorder->file != NULL) {
+		fseek(recorder->file, recorder->offset, SEEK_SET);
+		if(fwrite(recorder->chunk, sizeof(char), recorder->chunk_len, recorder->file) != recorder->chunk_len)
+			JANUS_LOG(LOG_ERR, "Error saving frames to %s (%s)\n", recorder->filename, strerror(errno));
+	}
+	if(recorder->ichunk != NULL && recorder->ichunk_len > 0 && recorder->index != NULL) {
+		fseek(recorder->index, recorder->ioffset, SEEK_SET);
+		if(fwrite(recorder->ichunk, sizeof(char), recorder->ichunk_len, recorder->index) != recorder->ichunk_len)
+			JANUS_LOG(LOG_ERR, "Error saving index of %s (%s)\n", recorder->filename, strerror(errno));
+	}
+	g_free(recorder->chunk);
+	recorder->chunk = NULL;
+	recorder->chunk_len = 0;
+	g_free(recorder->ichunk);
+	recorder->ichunk = NULL;
+	recorder->ichunk_len = 0;
+}
+
+static gboolean janus_recorder_is_keyframe(janus_recorder *recorder, char *buffer, uint length);
+
+/* Helper to add an entry to the index of a recording */
+static void janus_recorder_index_write(janus_recorder *recorder, guint32 when, char *buffer, uint length) {
+	if(recorder->index == NULL || length < RTP_HEADER_SIZE)
+		return;
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	guint8 flags = 0;
+	if(janus_recorder_is_keyframe(recorder, buffer, length))
+		flags |= JANUS_RECORDER_INDEX_KEYFRAME;
+	guint8 buf[JANUS_RECORDER_INDEX_ENTRY_SIZE];
+	memset(buf, 0, sizeof(buf));
+	guint64 offset = htonll((guint64)recorder->written);
+	when = htonl(when);
+	guint16 len = htons(length);
+	memcpy(buf, &offset, sizeof(offset));
+	memcpy(buf+8, &when, sizeof(when));
+	memcpy(buf+12, &rtp->timestamp, sizeof(rtp->timestamp));
+	memcpy(buf+16, &rtp->seq_number, sizeof(rtp->seq_number));
+	memcpy(buf+18, &len, sizeof(len));
+	buf[20] = flags;
+	if(rec_async) {
+		janus_recorder_append(recorder, TRUE, buf, sizeof(buf));
+		return;
+	}
+	if(fwrite(buf, sizeof(char), sizeof(buf), recorder->index) != sizeof(buf)) {
+		JANUS_LOG(LOG_WARN, "Couldn't write to recording index (%s), disabling it\n", strerror(errno));
+		fclose(recorder->index);
+		recorder->index = NULL;
+	}
 }
 
 static void janus_recorder_free(const janus_refcount *recorder_ref) {
@@ -73,6 +523,13 @@ static void janus_recorder_free(const janus_refcount *recorder_ref) {
 	if(recorder->file != NULL)
 		fclose(recorder->file);
 	recorder->file = NULL;
+	if(recorder->index != NULL)
+		fclose(recorder->index);
+	recorder->index = NULL;
+	g_free(recorder->chunk);
+	g_free(recorder->ichunk);
+	g_free(recorder->base);
+	g_free(recorder->previous);
 	g_free(recorder->codec);
 	recorder->codec = NULL;
 	g_free(recorder->fmtp);
@@ -80,6 +537,55 @@ static void janus_recorder_free(const janus_refcount *recorder_ref) {
 	g_free(recorder);
 }
 
+/* Helper to open a new file for a recorder (and its index, if needed), and write the .mjr header */
+static int janus_recorder_open(janus_recorder *rc, const char *newname) {
+	char path[1024];
+	memset(path, 0, 1024);
+	if(rc->dir == NULL)
+		g_snprintf(path, 1024, "%s", newname);
+	else
+		g_snprintf(path, 1024, "%s/%s", rc->dir, newname);
+	/* Make sure folder to save to is not protected */
+	if(janus_is_folder_protected(path)) {
+		JANUS_LOG(LOG_ERR, "Target recording path '%s' is in protected folder...\n", path);
+		return -1;
+	}
+	rc->file = fopen(path, "wb");
+	if(rc->file == NULL) {
+		JANUS_LOG(LOG_ERR, "fopen error: %d\n", errno);
+		return -1;
+	}
+	if(rec_index && rc->type != JANUS_RECORDER_DATA) {
+		char ipath[1024];
+		g_snprintf(ipath, sizeof(ipath), "%s.idx", path);
+		rc->index = fopen(ipath, "wb");
+	}
+	g_free(rc->filename);
+	rc->filename = g_strdup(newname);
+	/* Write the first part of the header */
+	size_t res = fwrite(header, sizeof(char), strlen(header), rc->file);
+	if(res != strlen(header)) {
+		JANUS_LOG(LOG_ERR, "Couldn't write .mjr header (%zu != %zu, %s)\n",
+			res, strlen(header), strerror(errno));
+		return -1;
+	}
+	rc->written = res;
+	rc->offset = res;
+	if(rc->index != NULL && fwrite(JANUS_RECORDER_INDEX_HEADER, sizeof(char), 8, rc->index) != 8) {
+		JANUS_LOG(LOG_WARN, "Couldn't write recording index header (%s), disabling it\n", strerror(errno));
+		fclose(rc->index);
+		rc->index = NULL;
+	}
+	rc->ioffset = 8;
+	if(rec_async) {
+		/* The writer thread may write at specific offsets, so don't keep the headers buffered */
+		fflush(rc->file);
+		if(rc->index != NULL)
+			fflush(rc->index);
+	}
+	return 0;
+}
+
 janus_recorder *janus_recorder_create(const char *dir, const char *codec, const char *filename) {
 	/* Same as janus_recorder_create_full, but with no fmtp */
 	return janus_recorder_create_full(dir, codec, NULL, filename);
@@ -90,6 +596,10 @@ janus_recorder *janus_recorder_create_full(const char *dir, const char *codec, c
 		JANUS_LOG(LOG_ERR, "Missing codec information\n");
 		return NULL;
 	}
+	if(!g_atomic_int_get(&rec_accepting)) {
+		JANUS_LOG(LOG_WARN, "Server overloaded, not starting a new recording\n");
+		return NULL;
+	}
 	if(!strcasecmp(codec, "vp8") || !strcasecmp(codec, "vp9") || !strcasecmp(codec, "h264")
 			 || !strcasecmp(codec, "av1") || !strcasecmp(codec, "h265")) {
 		type = JANUS_RECORDER_VIDEO;
@@ -196,52 +706,19 @@ janus_recorder *janus_recorder_create_full(const char *dir, const char *codec, c
 			g_snprintf(newname, 1024, "%s.mjr.%s", rec_file, rec_tempext);
 		}
 	}
-	/* Try opening the file now */
-	if(rec_dir == NULL) {
-		/* Make sure folder to save to is not protected */
-		if(janus_is_folder_protected(newname)) {
-			JANUS_LOG(LOG_ERR, "Target recording path '%s' is in protected folder...\n", newname);
-			janus_recorder_destroy(rc);
-			g_free(copy_for_parent);
-			g_free(copy_for_base);
-			return NULL;
-		}
-		rc->file = fopen(newname, "wb");
-	} else {
-		char path[1024];
-		memset(path, 0, 1024);
-		g_snprintf(path, 1024, "%s/%s", rec_dir, newname);
-		/* Make sure folder to save to is not protected */
-		if(janus_is_folder_protected(path)) {
-			JANUS_LOG(LOG_ERR, "Target recording path '%s' is in protected folder...\n", path);
-			janus_recorder_destroy(rc);
-			g_free(copy_for_parent);
-			g_free(copy_for_base);
-			return NULL;
-		}
-		rc->file = fopen(path, "wb");
-	}
-	if(rc->file == NULL) {
-		JANUS_LOG(LOG_ERR, "fopen error: %d\n", errno);
-		janus_recorder_destroy(rc);
-		g_free(copy_for_parent);
-		g_free(copy_for_base);
-		return NULL;
-	}
 	if(rec_dir)
 		rc->dir = g_strdup(rec_dir);
-	rc->filename = g_strdup(newname);
 	rc->type = type;
-	/* Write the first part of the header */
-	size_t res = fwrite(header, sizeof(char), strlen(header), rc->file);
-	if(res != strlen(header)) {
-		JANUS_LOG(LOG_ERR, "Couldn't write .mjr header (%zu != %zu, %s)\n",
-			res, strlen(header), strerror(errno));
+	/* Try opening the file now */
+	if(janus_recorder_open(rc, newname) < 0) {
 		janus_recorder_destroy(rc);
 		g_free(copy_for_parent);
 		g_free(copy_for_base);
 		return NULL;
 	}
+	/* In case we'll need to split the recording in segments, keep track of the base name */
+	rc->segment_duration = rec_segment_duration;
+	rc->base = g_strndup(newname, strlen(newname) - strlen(".mjr") - (rec_tempname ? (strlen(rec_tempext) + 1) : 0));
 	g_atomic_int_set(&rc->writable, 1);
 	/* We still need to also write the info header first */
 	g_atomic_int_set(&rc->header, 0);
@@ -253,6 +730,20 @@ janus_recorder *janus_recorder_create_full(const char *dir, const char *codec, c
 	return rc;
 }
 
+int janus_recorder_segments(janus_recorder *recorder, guint32 seconds) {
+	if(!recorder)
+		return -1;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	if(recorder->segment > 0 || g_atomic_int_get(&recorder->header)) {
+		/* Too late, we already started writing frames */
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -1;
+	}
+	recorder->segment_duration = seconds;
+	janus_mutex_unlock_nodebug(&recorder->mutex);
+	return 0;
+}
+
 int janus_recorder_encrypted(janus_recorder *recorder) {
 	if(!recorder)
 		return -1;
@@ -263,6 +754,261 @@ int janus_recorder_encrypted(janus_recorder *recorder) {
 	return -1;
 }
 
+int janus_recorder_filter(janus_recorder *recorder, gboolean enabled) {
+	if(!recorder || recorder->type == JANUS_RECORDER_DATA)
+		return -1;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	recorder->filter = enabled;
+	recorder->dtx = FALSE;
+	janus_mutex_unlock_nodebug(&recorder->mutex);
+	return 0;
+}
+
+/* Helper to check whether a packet should be left out of the recording,
+ * when filtering is enabled: called with the recorder mutex locked */
+static gboolean janus_recorder_filtered(janus_recorder *recorder, char *buffer, uint length) {
+	if(!recorder->filter || recorder->encrypted)
+		return FALSE;
+	int plen = 0;
+	char *payload = janus_rtp_payload(buffer, length, &plen);
+	if(payload == NULL)
+		return FALSE;
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	if(rtp->padding && plen > 0) {
+		/* The last byte tells us how many bytes of padding there are */
+		uint8_t padding = *(buffer + length - 1);
+		plen = (padding >= plen) ? 0 : plen - padding;
+	}
+	if(plen == 0) {
+		/* Padding only, there's no media to save */
+		recorder->skipped_padding++;
+		return TRUE;
+	}
+	if(recorder->type != JANUS_RECORDER_AUDIO || !recorder->codec ||
+			(strcasecmp(recorder->codec, "opus") && strcasecmp(recorder->codec, "multiopus")))
+		return FALSE;
+	/* Opus DTX packets only contain the TOC (plus one byte, at most) */
+	if(plen > 2) {
+		recorder->dtx = FALSE;
+		return FALSE;
+	}
+	if(!recorder->dtx) {
+		/* First DTX packet in a row, save it to mark where the silence starts */
+		recorder->dtx = TRUE;
+		return FALSE;
+	}
+	recorder->skipped_dtx++;
+	return TRUE;
+}
+
+/* Helper to flush the current file of a recorder, and rename it if needed: called with the recorder mutex locked */
+static void janus_recorder_finish_file(janus_recorder *recorder) {
+	if(rec_async)
+		janus_recorder_drain(recorder);
+	if(recorder->file) {
+		fseek(recorder->file, 0L, SEEK_END);
+		size_t fsize = ftell(recorder->file);
+		fseek(recorder->file, 0L, SEEK_SET);
+		JANUS_LOG(LOG_INFO, "File is %zu bytes: %s\n", fsize, recorder->filename);
+	}
+	if(recorder->index)
+		fflush(recorder->index);
+	if(rec_tempname) {
+		/* We need to rename the file, to remove the temporary extension */
+		char newname[1024];
+		memset(newname, 0, 1024);
+		g_snprintf(newname, strlen(recorder->filename)-strlen(rec_tempext), "%s", recorder->filename);
+		char oldpath[1024];
+		memset(oldpath, 0, 1024);
+		char newpath[1024];
+		memset(newpath, 0, 1024);
+		if(recorder->dir) {
+			g_snprintf(newpath, 1024, "%s/%s", recorder->dir, newname);
+			g_snprintf(oldpath, 1024, "%s/%s", recorder->dir, recorder->filename);
+		} else {
+			g_snprintf(newpath, 1024, "%s", newname);
+			g_snprintf(oldpath, 1024, "%s", recorder->filename);
+		}
+		if(rename(oldpath, newpath) != 0) {
+			JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", recorder->filename, newname);
+		} else {
+			JANUS_LOG(LOG_INFO, "Recording renamed: %s\n", newname);
+			g_free(recorder->filename);
+			recorder->filename = g_strdup(newname);
+			if(recorder->index != NULL) {
+				/* Rename the index as well */
+				char oldipath[1024], newipath[1024];
+				g_snprintf(oldipath, sizeof(oldipath), "%s.idx", oldpath);
+				g_snprintf(newipath, sizeof(newipath), "%s.idx", newpath);
+				if(rename(oldipath, newipath) != 0)
+					JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", oldipath, newipath);
+			}
+		}
+	}
+}
+
+/* Helper to check whether a packet is (part of) a keyframe, for video recordings */
+static gboolean janus_recorder_is_keyframe(janus_recorder *recorder, char *buffer, uint length) {
+	if(recorder->type != JANUS_RECORDER_VIDEO || length < RTP_HEADER_SIZE)
+		return FALSE;
+	int plen = 0;
+	char *payload = janus_rtp_payload(buffer, length, &plen);
+	if(payload == NULL || plen <= 0)
+		return FALSE;
+	if(!strcasecmp(recorder->codec, "vp8"))
+		return janus_vp8_is_keyframe(payload, plen);
+	else if(!strcasecmp(recorder->codec, "vp9"))
+		return janus_vp9_is_keyframe(payload, plen);
+	else if(!strcasecmp(recorder->codec, "h264"))
+		return janus_h264_is_keyframe(payload, plen);
+	else if(!strcasecmp(recorder->codec, "av1"))
+		return janus_av1_is_keyframe(payload, plen);
+	else if(!strcasecmp(recorder->codec, "h265"))
+		return janus_h265_is_keyframe(payload, plen);
+	return FALSE;
+}
+
+/* Helper to check if it's time to start a new segment: for video, we wait for a keyframe, unless it takes too long */
+static gboolean janus_recorder_segment_due(janus_recorder *recorder, char *buffer, uint length, gint64 now) {
+	if(recorder->segment_duration == 0 || !g_atomic_int_get(&recorder->header))
+		return FALSE;
+	gint64 elapsed = now - recorder->segment_started;
+	gint64 duration = (gint64)recorder->segment_duration * G_USEC_PER_SEC;
+	if(elapsed < duration)
+		return FALSE;
+	if(recorder->type != JANUS_RECORDER_VIDEO || elapsed >= 2*duration)
+		return TRUE;
+	return janus_recorder_is_keyframe(recorder, buffer, length);
+}
+
+/* Helper to close the current segment of a recording and start a new one: called with the recorder mutex locked */
+static void janus_recorder_next_segment(janus_recorder *recorder, gint64 now) {
+	janus_recorder_finish_file(recorder);
+	g_free(recorder->previous);
+	recorder->previous = g_strdup(recorder->filename);
+	if(recorder->file != NULL)
+		fclose(recorder->file);
+	recorder->file = NULL;
+	if(recorder->index != NULL)
+		fclose(recorder->index);
+	recorder->index = NULL;
+	recorder->segment++;
+	char newname[1024];
+	if(!rec_tempname)
+		g_snprintf(newname, sizeof(newname), "%s-%05"SCNu32".mjr", recorder->base, recorder->segment);
+	else
+		g_snprintf(newname, sizeof(newname), "%s-%05"SCNu32".mjr.%s", recorder->base, recorder->segment, rec_tempext);
+	if(janus_recorder_open(recorder, newname) < 0) {
+		/* Further frames will be refused */
+		JANUS_LOG(LOG_ERR, "Couldn't start segment %"SCNu32" of recording %s\n", recorder->segment, recorder->base);
+		if(recorder->file != NULL)
+			fclose(recorder->file);
+		recorder->file = NULL;
+		if(recorder->index != NULL)
+			fclose(recorder->index);
+		recorder->index = NULL;
+		return;
+	}
+	JANUS_LOG(LOG_VERB, "Started segment %"SCNu32" of recording: %s\n", recorder->segment, newname);
+	/* The new segment will need its own info header */
+	recorder->segment_started = now;
+	g_atomic_int_set(&recorder->header, 0);
+}
+
+/* Helper to generate the JSON formatted info header of a recording */
+static char *janus_recorder_info_text(janus_recorder *recorder) {
+	json_t *info = json_object();
+	/* FIXME Codecs should be configurable in the future */
+	const char *type = NULL;
+	if(recorder->type == JANUS_RECORDER_AUDIO)
+		type = "a";
+	else if(recorder->type == JANUS_RECORDER_VIDEO)
+		type = "v";
+	else if(recorder->type == JANUS_RECORDER_DATA)
+		type = "d";
+	json_object_set_new(info, "t", json_string(type));								/* Audio/Video/Data */
+	json_object_set_new(info, "c", json_string(recorder->codec));					/* Media codec */
+	if(recorder->fmtp)
+		json_object_set_new(info, "f", json_string(recorder->fmtp));				/* Codec-specific info */
+	json_object_set_new(info, "s", json_integer(recorder->created));				/* Created time */
+	json_object_set_new(info, "u", json_integer(janus_get_real_time()));			/* First frame written time */
+	/* If media will be end-to-end encrypted, mark it in the recording header */
+	if(recorder->encrypted)
+		json_object_set_new(info, "e", json_true());
+	/* If the recording is split in segments, add info on how this one relates to the others */
+	if(recorder->segment_duration > 0) {
+		json_object_set_new(info, "g", json_integer(recorder->segment));							/* Segment number */
+		json_object_set_new(info, "go", json_integer(recorder->segment > 0 ? (janus_get_monotonic_time() - recorder->started)/1000 : 0));	/* Offset since first segment (ms) */
+		if(recorder->previous)
+			json_object_set_new(info, "gp", json_string(recorder->previous));					/* Previous segment */
+	}
+	char *info_text = json_dumps(info, JSON_PRESERVE_ORDER);
+	json_decref(info);
+	return info_text;
+}
+
+/* Helper to serialize a frame when the asynchronous writer is enabled: called with the recorder mutex locked */
+static int janus_recorder_save_frame_async(janus_recorder *recorder, char *buffer, uint length, gint64 now) {
+	char *info_text = NULL;
+	size_t info_len = 0;
+	if(!g_atomic_int_get(&recorder->header)) {
+		info_text = janus_recorder_info_text(recorder);
+		info_len = sizeof(uint16_t) + strlen(info_text);
+	}
+	/* Make sure the writer can take this frame, first */
+	size_t needed = info_len + strlen(frame_header) + sizeof(uint32_t) + sizeof(uint16_t) + length;
+	if(recorder->type == JANUS_RECORDER_DATA)
+		needed += sizeof(gint64);
+	if(recorder->index != NULL)
+		needed += JANUS_RECORDER_INDEX_ENTRY_SIZE;
+	gboolean drop = FALSE;
+	if(!janus_recorder_reserve(needed)) {
+		/* The writer is lagging behind, drop the frame (but never the info header) */
+		g_atomic_int_inc(&recorder->dropped);
+		if(info_text == NULL)
+			return -6;
+		drop = TRUE;
+	}
+	if(info_text != NULL) {
+		uint16_t info_bytes = htons(strlen(info_text));
+		janus_recorder_append(recorder, FALSE, &info_bytes, sizeof(uint16_t));
+		janus_recorder_append(recorder, FALSE, info_text, strlen(info_text));
+		recorder->written += info_len;
+		free(info_text);
+		if(recorder->segment == 0) {
+			recorder->started = now;
+			recorder->segment_started = now;
+		}
+		recorder->chunk_started = now;
+		g_atomic_int_set(&recorder->header, 1);
+		if(drop)
+			return -6;
+	}
+	/* Serialize the frame header (fixed part[4], timestamp[4], length[2]) and the frame itself */
+	janus_recorder_append(recorder, FALSE, frame_header, strlen(frame_header));
+	uint32_t timestamp = (uint32_t)(now > recorder->started ? ((now - recorder->started)/1000) : 0);
+	timestamp = htonl(timestamp);
+	janus_recorder_append(recorder, FALSE, &timestamp, sizeof(uint32_t));
+	uint16_t header_bytes = htons(recorder->type == JANUS_RECORDER_DATA ? (length+sizeof(gint64)) : length);
+	janus_recorder_append(recorder, FALSE, &header_bytes, sizeof(uint16_t));
+	recorder->written += strlen(frame_header) + sizeof(uint32_t) + sizeof(uint16_t);
+	if(recorder->type == JANUS_RECORDER_DATA) {
+		gint64 when = htonll(janus_get_real_time());
+		janus_recorder_append(recorder, FALSE, &when, sizeof(gint64));
+		recorder->written += sizeof(gint64);
+	}
+	janus_recorder_index_write(recorder, ntohl(timestamp), buffer, length);
+	janus_recorder_append(recorder, FALSE, buffer, length);
+	recorder->written += length;
+	/* Don't keep data around for too long, if the recording is slow to fill chunks */
+	if(now - recorder->chunk_started >= JANUS_RECORDER_CHUNK_MAX_AGE) {
+		janus_recorder_push_chunk(recorder, FALSE);
+		janus_recorder_push_chunk(recorder, TRUE);
+		recorder->chunk_started = now;
+	}
+	return 0;
+}
+
 int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint length) {
 	if(!recorder)
 		return -1;
@@ -279,29 +1025,29 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		janus_mutex_unlock_nodebug(&recorder->mutex);
 		return -4;
 	}
+	if(janus_recorder_filtered(recorder, buffer, length)) {
+		/* Nothing worth saving in this packet */
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return 0;
+	}
 	gint64 now = janus_get_monotonic_time();
+	if(janus_recorder_segment_due(recorder, buffer, length, now)) {
+		/* Time to start a new segment */
+		janus_recorder_next_segment(recorder, now);
+		if(recorder->file == NULL) {
+			janus_mutex_unlock_nodebug(&recorder->mutex);
+			return -3;
+		}
+	}
+	if(rec_async) {
+		/* Serialize the frame for the writer thread, rather than writing it ourselves */
+		int ret = janus_recorder_save_frame_async(recorder, buffer, length, now);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return ret;
+	}
 	if(!g_atomic_int_get(&recorder->header)) {
 		/* Write info header as a JSON formatted info */
-		json_t *info = json_object();
-		/* FIXME Codecs should be configurable in the future */
-		const char *type = NULL;
-		if(recorder->type == JANUS_RECORDER_AUDIO)
-			type = "a";
-		else if(recorder->type == JANUS_RECORDER_VIDEO)
-			type = "v";
-		else if(recorder->type == JANUS_RECORDER_DATA)
-			type = "d";
-		json_object_set_new(info, "t", json_string(type));								/* Audio/Video/Data */
-		json_object_set_new(info, "c", json_string(recorder->codec));					/* Media codec */
-		if(recorder->fmtp)
-			json_object_set_new(info, "f", json_string(recorder->fmtp));				/* Codec-specific info */
-		json_object_set_new(info, "s", json_integer(recorder->created));				/* Created time */
-		json_object_set_new(info, "u", json_integer(janus_get_real_time()));			/* First frame written time */
-		/* If media will be end-to-end encrypted, mark it in the recording header */
-		if(recorder->encrypted)
-			json_object_set_new(info, "e", json_true());
-		gchar *info_text = json_dumps(info, JSON_PRESERVE_ORDER);
-		json_decref(info);
+		gchar *info_text = janus_recorder_info_text(recorder);
 		uint16_t info_bytes = htons(strlen(info_text));
 		size_t res = fwrite(&info_bytes, sizeof(uint16_t), 1, recorder->file);
 		if(res != 1) {
@@ -313,9 +1059,14 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 			JANUS_LOG(LOG_WARN, "Couldn't write JSON header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
 				res, strlen(info_text), strerror(errno));
 		}
+		recorder->written += sizeof(uint16_t) + strlen(info_text);
 		free(info_text);
 		/* Done */
-		recorder->started = now;
+		if(recorder->segment == 0) {
+			/* Frame times are relative to the first segment, so that they stay consistent */
+			recorder->started = now;
+			recorder->segment_started = now;
+		}
 		g_atomic_int_set(&recorder->header, 1);
 	}
 	/* Write frame header (fixed part[4], timestamp[4], length[2]) */
@@ -337,6 +1088,7 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		JANUS_LOG(LOG_WARN, "Couldn't write size of frame in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
 			res, sizeof(uint16_t), strerror(errno));
 	}
+	recorder->written += strlen(frame_header) + sizeof(uint32_t) + sizeof(uint16_t);
 	if(recorder->type == JANUS_RECORDER_DATA) {
 		/* If it's data, then we need to prepend timing related info, as it's not there by itself */
 		gint64 now = htonll(janus_get_real_time());
@@ -345,7 +1097,10 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 			JANUS_LOG(LOG_WARN, "Couldn't write data timestamp in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
 				res, sizeof(gint64), strerror(errno));
 		}
+		recorder->written += sizeof(gint64);
 	}
+	/* Add the packet to the index, if needed, before saving it */
+	janus_recorder_index_write(recorder, ntohl(timestamp), buffer, length);
 	/* Save packet on file */
 	int temp = 0, tot = length;
 	while(tot > 0) {
@@ -357,6 +1112,7 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		}
 		tot -= temp;
 	}
+	recorder->written += length;
 	/* Done */
 	janus_mutex_unlock_nodebug(&recorder->mutex);
 	return 0;
@@ -366,42 +1122,171 @@ int janus_recorder_close(janus_recorder *recorder) {
 	if(!recorder || !g_atomic_int_compare_and_exchange(&recorder->writable, 1, 0))
 		return -1;
 	janus_mutex_lock_nodebug(&recorder->mutex);
-	if(recorder->file) {
-		fseek(recorder->file, 0L, SEEK_END);
-		size_t fsize = ftell(recorder->file);
-		fseek(recorder->file, 0L, SEEK_SET);
-		JANUS_LOG(LOG_INFO, "File is %zu bytes: %s\n", fsize, recorder->filename);
+	janus_recorder_finish_file(recorder);
+	if(recorder->skipped_padding > 0 || recorder->skipped_dtx > 0) {
+		JANUS_LOG(LOG_INFO, "Skipped %"SCNu32" padding-only and %"SCNu32" DTX packets: %s\n",
+			recorder->skipped_padding, recorder->skipped_dtx, recorder->filename);
 	}
-	if(rec_tempname) {
-		/* We need to rename the file, to remove the temporary extension */
-		char newname[1024];
-		memset(newname, 0, 1024);
-		g_snprintf(newname, strlen(recorder->filename)-strlen(rec_tempext), "%s", recorder->filename);
-		char oldpath[1024];
-		memset(oldpath, 0, 1024);
-		char newpath[1024];
-		memset(newpath, 0, 1024);
-		if(recorder->dir) {
-			g_snprintf(newpath, 1024, "%s/%s", recorder->dir, newname);
-			g_snprintf(oldpath, 1024, "%s/%s", recorder->dir, recorder->filename);
-		} else {
-			g_snprintf(newpath, 1024, "%s", newname);
-			g_snprintf(oldpath, 1024, "%s", recorder->filename);
+	janus_mutex_unlock_nodebug(&recorder->mutex);
+	return 0;
+}
+
+void janus_recorder_destroy(janus_recorder *recorder) {
+	if(!recorder || !g_atomic_int_compare_and_exchange(&recorder->destroyed, 0, 1))
+		return;
+	janus_refcount_decrease(&recorder->ref);
+}
+
+/* Stream writers: we only use the file, the chunks and the counters of the recorder they wrap */
+struct janus_recorder_stream {
+	janus_recorder recorder;
+};
+
+static void janus_recorder_stream_free(const janus_refcount *stream_ref) {
+	janus_recorder *recorder = janus_refcount_containerof(stream_ref, janus_recorder, ref);
+	/* The file belongs to whoever created the stream, so we don't close it */
+	g_free(recorder->filename);
+	g_free(recorder->chunk);
+	g_free((janus_recorder_stream *)recorder);
+}
+
+janus_recorder_stream *janus_recorder_stream_new(FILE *file, const char *name) {
+	if(file == NULL)
+		return NULL;
+	janus_recorder_stream *stream = g_malloc0(sizeof(janus_recorder_stream));
+	janus_recorder *recorder = &stream->recorder;
+	recorder->file = file;
+	recorder->filename = g_strdup(name ? name : "??");
+	long position = ftell(file);
+	recorder->offset = position > 0 ? (size_t)position : 0;
+	recorder->written = recorder->offset;
+	recorder->chunk_started = janus_get_monotonic_time();
+	janus_mutex_init(&recorder->mutex);
+	janus_refcount_init(&recorder->ref, janus_recorder_stream_free);
+	g_atomic_int_inc(&rec_streams);
+	return stream;
+}
+
+int janus_recorder_stream_writev(janus_recorder_stream *stream, const struct iovec *iov, int iovcnt) {
+	if(stream == NULL || iov == NULL || iovcnt < 1)
+		return -1;
+	janus_recorder *recorder = &stream->recorder;
+	size_t size = 0;
+	int i = 0;
+	for(i=0; i<iovcnt; i++)
+		size += iov[i].iov_len;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	if(recorder->file == NULL) {
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -1;
+	}
+	if(!rec_async) {
+		for(i=0; i<iovcnt; i++) {
+			if(iov[i].iov_len == 0)
+				continue;
+			if(fwrite(iov[i].iov_base, sizeof(char), iov[i].iov_len, recorder->file) != iov[i].iov_len) {
+				JANUS_LOG(LOG_ERR, "Error saving to %s (%s)\n", recorder->filename, strerror(errno));
+				janus_mutex_unlock_nodebug(&recorder->mutex);
+				return -1;
+			}
+			recorder->written += iov[i].iov_len;
 		}
-		if(rename(oldpath, newpath) != 0) {
-			JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", recorder->filename, newname);
-		} else {
-			JANUS_LOG(LOG_INFO, "Recording renamed: %s\n", newname);
-			g_free(recorder->filename);
-			recorder->filename = g_strdup(newname);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return 0;
+	}
+	if(!janus_recorder_reserve(size)) {
+		g_atomic_int_inc(&recorder->dropped);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -2;
+	}
+	for(i=0; i<iovcnt; i++)
+		janus_recorder_append(recorder, FALSE, iov[i].iov_base, iov[i].iov_len);
+	recorder->written += size;
+	/* Don't let small writes sit in a chunk for too long */
+	gint64 now = janus_get_monotonic_time();
+	if(recorder->chunk == NULL) {
+		recorder->chunk_started = now;
+	} else if(now - recorder->chunk_started >= JANUS_RECORDER_CHUNK_MAX_AGE) {
+		janus_recorder_push_chunk(recorder, FALSE);
+		recorder->chunk_started = now;
+	}
+	janus_mutex_unlock_nodebug(&recorder->mutex);
+	return 0;
+}
+
+int janus_recorder_stream_write(janus_recorder_stream *stream, const void *data, size_t size) {
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = size };
+	return janus_recorder_stream_writev(stream, &iov, 1);
+}
+
+int janus_recorder_stream_write_at(janus_recorder_stream *stream, size_t offset, const void *data, size_t size) {
+	if(stream == NULL || data == NULL || size == 0)
+		return -1;
+	janus_recorder *recorder = &stream->recorder;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	if(recorder->file == NULL) {
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -1;
+	}
+	if(!rec_async) {
+		int res = 0;
+		fseek(recorder->file, offset, SEEK_SET);
+		if(fwrite(data, sizeof(char), size, recorder->file) != size) {
+			JANUS_LOG(LOG_ERR, "Error updating %s (%s)\n", recorder->filename, strerror(errno));
+			res = -1;
 		}
+		fflush(recorder->file);
+		fseek(recorder->file, 0, SEEK_END);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return res;
 	}
+	/* Queue a chunk of its own, which doesn't move the offset appended data is written at */
+	janus_recorder_chunk *chunk = g_malloc(sizeof(janus_recorder_chunk));
+	janus_refcount_increase(&recorder->ref);
+	chunk->recorder = recorder;
+	chunk->index = FALSE;
+	chunk->data = g_malloc(size);
+	memcpy(chunk->data, data, size);
+	chunk->size = size;
+	chunk->offset = offset;
+	g_atomic_int_inc(&recorder->pending);
+	g_atomic_int_add(&rec_queued, (gint)chunk->size);
+	janus_memory_add(NULL, JANUS_MEMORY_RECORDER, (gint)chunk->size);
+	g_async_queue_push(rec_chunks, chunk);
 	janus_mutex_unlock_nodebug(&recorder->mutex);
 	return 0;
 }
 
-void janus_recorder_destroy(janus_recorder *recorder) {
-	if(!recorder || !g_atomic_int_compare_and_exchange(&recorder->destroyed, 0, 1))
+size_t janus_recorder_stream_get_size(janus_recorder_stream *stream) {
+	if(stream == NULL)
+		return 0;
+	janus_mutex_lock_nodebug(&stream->recorder.mutex);
+	size_t size = stream->recorder.written;
+	janus_mutex_unlock_nodebug(&stream->recorder.mutex);
+	return size;
+}
+
+int janus_recorder_stream_get_dropped(janus_recorder_stream *stream) {
+	return stream ? g_atomic_int_get(&stream->recorder.dropped) : 0;
+}
+
+void janus_recorder_stream_close(janus_recorder_stream *stream) {
+	if(stream == NULL)
 		return;
+	janus_recorder *recorder = &stream->recorder;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	if(recorder->file != NULL) {
+		if(rec_async) {
+			janus_recorder_drain(recorder);
+			fflush(recorder->file);
+			fseek(recorder->file, 0, SEEK_END);
+		}
+		int dropped = g_atomic_int_get(&recorder->dropped);
+		if(dropped > 0)
+			JANUS_LOG(LOG_WARN, "Dropped %d writes to %s, as the writer was lagging behind\n", dropped, recorder->filename);
+	}
+	recorder->file = NULL;
+	janus_mutex_unlock_nodebug(&recorder->mutex);
+	g_atomic_int_add(&rec_streams, -1);
 	janus_refcount_decrease(&recorder->ref);
 }
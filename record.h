@@ -24,6 +24,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/uio.h>
+
+#include <jansson.h>
 
 #include "mutex.h"
 #include "refcount.h"
@@ -44,6 +47,32 @@ typedef struct janus_recorder {
 	char *filename;
 	/*! \brief Recording file */
 	FILE *file;
+	/*! \brief Index file, if indexing is enabled */
+	FILE *index;
+	/*! \brief How many bytes have been written to the recording file so far */
+	size_t written;
+	/*! \brief Chunks of serialized frames (and index entries) waiting to be handed to the asynchronous writer */
+	char *chunk, *ichunk;
+	/*! \brief How many bytes are in the current chunks */
+	size_t chunk_len, ichunk_len;
+	/*! \brief Offsets in the recording (and index) files the next chunks will be written at */
+	size_t offset, ioffset;
+	/*! \brief If the recording is split in segments, how long each of them should be (seconds) */
+	guint32 segment_duration;
+	/*! \brief Number of the current segment (0 is the first one) */
+	guint32 segment;
+	/*! \brief When the current segment was started, monotonic time */
+	gint64 segment_started;
+	/*! \brief Base name for segments (filename without extensions) */
+	char *base;
+	/*! \brief Name of the previous segment, if any */
+	char *previous;
+	/*! \brief When the current chunks were started, in case they need to be flushed before they're full */
+	gint64 chunk_started;
+	/*! \brief How many chunks of this recorder the asynchronous writer still has to write */
+	volatile gint pending;
+	/*! \brief How many frames were dropped because the asynchronous writer was lagging behind */
+	volatile gint dropped;
 	/*! \brief Codec the packets to record are encoded in ("vp8", "vp9", "h264", "opus", "pcma", "pcmu", "g722") */
 	char *codec;
 	/*! \brief Codec-specific info (e.g., H.264 or VP9 profile) */
@@ -54,6 +83,12 @@ typedef struct janus_recorder {
 	janus_recorder_medium type;
 	/*! \brief Whether the recording contains end-to-end encrypted media or not */
 	gboolean encrypted;
+	/*! \brief Whether padding-only packets and Opus DTX runs should be left out of the recording */
+	gboolean filter;
+	/*! \brief Whether we're in the middle of an Opus DTX run, when filtering */
+	gboolean dtx;
+	/*! \brief How many padding-only and DTX packets the filter skipped */
+	guint32 skipped_padding, skipped_dtx;
 	/*! \brief Whether the info header for this recorder instance has already been written or not */
 	volatile int header;
 	/*! \brief Whether this recorder instance can be used for writing or not */
@@ -66,10 +101,144 @@ typedef struct janus_recorder {
 	janus_refcount ref;
 } janus_recorder;
 
+/*! \brief Header of a recording index file */
+#define JANUS_RECORDER_INDEX_HEADER		"MJRIDX01"
+/*! \brief Size of each entry in a recording index file */
+#define JANUS_RECORDER_INDEX_ENTRY_SIZE	24
+/*! \brief Flag set in index entries for packets that are part of a keyframe */
+#define JANUS_RECORDER_INDEX_KEYFRAME	0x01
+/*! \brief Entry in the index of a recording
+ * \details When indexing is enabled, each RTP packet saved to a .mjr file
+ * is also described in a sidecar file with the same name and an additional
+ * .idx extension (e.g., \c rec.mjr.idx), so that whoever needs to get the
+ * list of packets (e.g., to replay the recording) can do that without
+ * reading the recording itself. The index file starts with the 8 bytes
+ * \c JANUS_RECORDER_INDEX_HEADER, and is followed by a sequence of
+ * \c JANUS_RECORDER_INDEX_ENTRY_SIZE entries, in network byte order: offset
+ * of the RTP packet in the .mjr file (8 bytes), time it was written, in
+ * the same format as the .mjr frame header (4 bytes), RTP timestamp (4 bytes),
+ * RTP sequence number (2 bytes), packet length (2 bytes), flags (1 byte)
+ * and 3 reserved bytes. */
+typedef struct janus_recorder_index_entry {
+	/*! \brief Offset of the RTP packet in the .mjr file */
+	guint64 offset;
+	/*! \brief When the packet was written, in milliseconds since the first one */
+	guint32 when;
+	/*! \brief RTP timestamp of the packet */
+	guint32 timestamp;
+	/*! \brief RTP sequence number of the packet */
+	guint16 seq;
+	/*! \brief Length of the RTP packet */
+	guint16 length;
+	/*! \brief Flags (e.g., JANUS_RECORDER_INDEX_KEYFRAME) */
+	guint8 flags;
+} janus_recorder_index_entry;
+
 /*! \brief Initialize the recorder code
  * @param[in] tempnames Whether the filenames should have a temporary extension, while saving, or not
  * @param[in] extension Extension to add in case tempnames is true */
 void janus_recorder_init(gboolean tempnames, const char *extension);
+/*! \brief Enable or disable writing index files next to new audio and video recordings
+ * @param[in] enabled Whether index files should be written or not */
+void janus_recorder_set_indexing(gboolean enabled);
+/*! \brief Allow or refuse the creation of new recorders
+ * \details This is used by the core to shed optional work when the server
+ * is overloaded: while new recorders are refused, janus_recorder_create and
+ * janus_recorder_create_full return NULL, as they do in case of errors,
+ * while the recordings that were started already go on as usual.
+ * @param[in] accept Whether new recorders can be created (the default) or not */
+void janus_recorder_set_accepting(gboolean accept);
+/*! \brief Split new recordings in segments of the provided duration
+ * \details When segments are enabled, recorders close their current
+ * .mjr file every \c seconds and start a new one, named after the first
+ * one with an incremental suffix (e.g., \c rec.mjr, \c rec-00001.mjr,
+ * \c rec-00002.mjr and so on), which means each completed segment can
+ * be post-processed while the recording is still going on. Video segments
+ * are only rolled on keyframes, unless one doesn't arrive within twice
+ * the segment duration. Each segment has its own info header, which also
+ * carries the segment number (\c g), the time since the recording started
+ * in milliseconds (\c go), and the name of the previous segment (\c gp):
+ * frame times are relative to the first segment for all of them.
+ * @param[in] seconds Duration of each segment, in seconds (0 disables segments) */
+void janus_recorder_set_segment_duration(guint32 seconds);
+/*! \brief Enable the asynchronous writer for recordings
+ * \details By default, frames are written to the recording file as soon
+ * as janus_recorder_save_frame is called, which means a slow disk can
+ * stall the thread recording it (e.g., the media thread of a publisher).
+ * When the asynchronous writer is enabled, frames are serialized in chunks
+ * instead, which a dedicated thread writes to disk in the background. The
+ * amount of data that can be waiting to be written is limited: when the
+ * backlog is full, new frames are either dropped or the recording thread
+ * waits for the writer to catch up, depending on the configured policy.
+ * If Janus was built with liburing support, the writer can also submit
+ * the chunks of all recordings in batches using a single io_uring instance,
+ * rather than writing them one by one via stdio.
+ * \note This must be called before any recorder is created
+ * @param[in] backlog Maximum amount of bytes that can wait to be written
+ * @param[in] drop Whether frames should be dropped when the backlog is full (TRUE), or the caller should wait (FALSE)
+ * @param[in] uring Whether chunks should be written via io_uring, if available */
+void janus_recorder_set_async(size_t backlog, gboolean drop, gboolean uring);
+/*! \brief Get a summary of the asynchronous writer status, e.g., for the Admin API
+ * @returns A json_t object with the status of the asynchronous writer */
+json_t *janus_recorder_async_summary(void);
+
+/*! \brief Opaque writer for files that are not .mjr recordings
+ * \details Plugins that save media in other formats (e.g., Ogg or .wav files)
+ * write to disk from the same threads that handle media, and so suffer from
+ * slow disks as much as recorders do. A stream wraps a \c FILE the caller
+ * opened, and hands what's written to it to the asynchronous writer, when it
+ * is enabled, sharing its backlog and its policy: when the asynchronous writer
+ * is not enabled, writes go to the file right away. */
+typedef struct janus_recorder_stream janus_recorder_stream;
+/*! \brief Create a new stream writer for an open file
+ * \note Data will be appended starting from the current position in the file
+ * @param[in] file The file to write to, which must stay open until the stream is closed
+ * @param[in] name Name of the file, for logging purposes
+ * @returns A new janus_recorder_stream instance, or NULL in case of errors */
+janus_recorder_stream *janus_recorder_stream_new(FILE *file, const char *name);
+/*! \brief Append data to a stream, as a single unit
+ * \note Buffers are either all written or all dropped, so that the caller
+ * never ends up with, e.g., an Ogg page header not followed by its body
+ * @param[in] stream The janus_recorder_stream instance to write to
+ * @param[in] iov The buffers to write, in order
+ * @param[in] iovcnt How many buffers there are
+ * @returns 0 in case of success, -1 in case of errors, -2 if the data was
+ * dropped because the backlog of the asynchronous writer was full */
+int janus_recorder_stream_writev(janus_recorder_stream *stream, const struct iovec *iov, int iovcnt);
+/*! \brief Append a single buffer to a stream
+ * @param[in] stream The janus_recorder_stream instance to write to
+ * @param[in] data The data to write
+ * @param[in] size How many bytes to write
+ * @returns 0 in case of success, a negative integer otherwise (see janus_recorder_stream_writev) */
+int janus_recorder_stream_write(janus_recorder_stream *stream, const void *data, size_t size);
+/*! \brief Overwrite part of what was already written to a stream (e.g., to update the size in a header)
+ * \note This is never dropped, and doesn't change where data is appended
+ * @param[in] stream The janus_recorder_stream instance to update
+ * @param[in] offset Position in the file to write at
+ * @param[in] data The data to write
+ * @param[in] size How many bytes to write
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_stream_write_at(janus_recorder_stream *stream, size_t offset, const void *data, size_t size);
+/*! \brief Get the size of the file, including what the asynchronous writer hasn't written yet
+ * @param[in] stream The janus_recorder_stream instance to query
+ * @returns The size of the file, once all pending writes are done */
+size_t janus_recorder_stream_get_size(janus_recorder_stream *stream);
+/*! \brief Get how many writes to a stream were dropped so far
+ * @param[in] stream The janus_recorder_stream instance to query
+ * @returns The number of dropped writes */
+int janus_recorder_stream_get_dropped(janus_recorder_stream *stream);
+/*! \brief Wait for all pending writes of a stream to be done, and get rid of it
+ * \note The file is not closed, and its position is moved to the end, so the
+ * caller can still update it synchronously before closing it
+ * @param[in] stream The janus_recorder_stream instance to close */
+void janus_recorder_stream_close(janus_recorder_stream *stream);
+/*! \brief Read the index of an existing recording, if available
+ * \note The index is only returned if it's consistent with the recording,
+ * that is if all the packets it describes fit in the .mjr file
+ * @param[in] path Path to the .mjr file (the index path is derived from it)
+ * @param[out] count Number of entries in the index
+ * @returns An array of janus_recorder_index_entry instances to free with \c g_free, or NULL if no usable index was found */
+janus_recorder_index_entry *janus_recorder_index_read(const char *path, size_t *count);
 /*! \brief De-initialize the recorder code */
 void janus_recorder_deinit(void);
 
@@ -90,6 +259,12 @@ janus_recorder *janus_recorder_create(const char *dir, const char *codec, const
  * @param[in] filename Filename to use for the recording
  * @returns A valid janus_recorder instance in case of success, NULL otherwise */
 janus_recorder *janus_recorder_create_full(const char *dir, const char *codec, const char *fmtp, const char *filename);
+/*! \brief Override the duration of segments for a specific recorder
+ * \note This will only be possible BEFORE the first frame is written
+ * @param[in] recorder The janus_recorder instance to update
+ * @param[in] seconds Duration of each segment, in seconds (0 disables segments)
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_segments(janus_recorder *recorder, guint32 seconds);
 /*! \brief Mark this recorder as end-to-end encrypted (e.g., via Insertable Streams)
  * \note This will only be possible BEFORE the first frame is written, as it needs to
  * be reflected in the .mjr header: doing this after that will return an error. Also
@@ -98,7 +273,23 @@ janus_recorder *janus_recorder_create_full(const char *dir, const char *codec, c
  * @param[in] recorder The janus_recorder instance to mark as encrypted
  * @returns 0 in case of success, a negative integer otherwise */
 int janus_recorder_encrypted(janus_recorder *recorder);
+/*! \brief Enable or disable filtering of packets that carry no media
+ * \details When the filter is enabled, RTP packets that only contain
+ * padding (e.g., those sent for bandwidth probing) are not saved at all,
+ * while for Opus recordings all the DTX packets (which only signal that
+ * the speaker is silent) after the first one in a row are skipped, until
+ * media starts flowing again. The first DTX packet acts as a marker:
+ * \c janus-pp-rec fills the timestamp gap it's followed by with silence
+ * already, so the processed file is the same, but silent participants
+ * cost much less in terms of storage and writes.
+ * @param[in] recorder The janus_recorder instance to update
+ * @param[in] enabled Whether the filter should be enabled or not
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_filter(janus_recorder *recorder, gboolean enabled);
 /*! \brief Save an RTP frame in the recorder
+ * \note When the asynchronous writer is enabled, the frame may only be
+ * written to disk later on, and -6 is returned when it was dropped
+ * because the writer backlog was full
  * @param[in] recorder The janus_recorder instance to save the frame to
  * @param[in] buffer The frame data to save
  * @param[in] length The frame data length
@@ -222,4 +222,35 @@ extern janus_mutex counters_mutex;
 }
 #endif
 
+/*! \brief Guard to borrow an object without touching its reference counter
+ * \details Taking and releasing a reference for each packet means two
+ * atomic operations on the counter of an object many threads may be using
+ * at the same time (e.g., a publisher all its subscribers reference),
+ * which is where the cost comes from. Objects that are only ever borrowed
+ * from their own thread (e.g., the loop of a handle) can use a guard
+ * instead: the guard is only touched by that thread, so it stays in its
+ * cache, and whoever is about to drop the reference the object is borrowed
+ * from first clears the pointer, and then waits for borrowers to be done
+ * with janus_refcount_guard_wait(), so that the object can't go away while
+ * it's still in use. References are then only taken and released when
+ * objects are created, attached to something else, or destroyed. */
+typedef struct janus_refcount_guard {
+	/*! \brief How many borrowers are currently within the guard */
+	volatile gint borrowers;
+} janus_refcount_guard;
+/*! \brief Enter the guard, before reading the pointer to borrow
+ * @param guardp Pointer to the Janus reference counter guard */
+#define janus_refcount_guard_enter(guardp) g_atomic_int_inc((gint *)&(guardp)->borrowers)
+/*! \brief Leave the guard, after we're done with what we borrowed
+ * @param guardp Pointer to the Janus reference counter guard */
+#define janus_refcount_guard_leave(guardp) (void)g_atomic_int_dec_and_test((gint *)&(guardp)->borrowers)
+/*! \brief Wait for all borrowers to leave the guard
+ * \note The pointer borrowers read must have been cleared (atomically) before
+ * calling this, so that borrowers entering the guard afterwards don't find it anymore
+ * @param guardp Pointer to the Janus reference counter guard */
+#define janus_refcount_guard_wait(guardp) { \
+	while(g_atomic_int_get((gint *)&(guardp)->borrowers) > 0) \
+		g_usleep(100); \
+}
+
 #endif
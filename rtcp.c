@@ -1282,6 +1282,24 @@ int janus_rtcp_remove_nacks(char *packet, int len) {
 	return len;
 }
 
+/* Get the bitrate out of a REMB message, if it's valid */
+static uint32_t janus_rtcp_remb_bitrate(janus_rtcp_header *rtcp, int total) {
+	janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
+	janus_rtcp_fb_remb *remb = (janus_rtcp_fb_remb *)rtcpfb->fci;
+	if(!janus_rtcp_check_remb(rtcp, total) || remb->id[0] != 'R' || remb->id[1] != 'E' || remb->id[2] != 'M' || remb->id[3] != 'B')
+		return 0;
+	/* FIXME From rtcp_utility.cc */
+	unsigned char *_ptrRTCPData = (unsigned char *)remb;
+	_ptrRTCPData += 4;	/* Skip unique identifier and num ssrc */
+	uint8_t brExp = (_ptrRTCPData[1] >> 2) & 0x3F;
+	uint32_t brMantissa = (_ptrRTCPData[1] & 0x03) << 16;
+	brMantissa += (_ptrRTCPData[2] << 8);
+	brMantissa += (_ptrRTCPData[3]);
+	uint32_t bitrate = (uint64_t)brMantissa << brExp;
+	JANUS_LOG(LOG_HUGE, "Got REMB bitrate %"SCNu32"\n", bitrate);
+	return bitrate;
+}
+
 /* Query an existing REMB message */
 uint32_t janus_rtcp_get_remb(char *packet, int len) {
 	if(packet == NULL || len == 0)
@@ -1297,21 +1315,9 @@ uint32_t janus_rtcp_get_remb(char *packet, int len) {
 		if(rtcp->type == RTCP_PSFB) {
 			gint fmt = rtcp->rc;
 			if(fmt == 15) {
-				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
-				janus_rtcp_fb_remb *remb = (janus_rtcp_fb_remb *)rtcpfb->fci;
-				if(janus_rtcp_check_remb(rtcp, total) && remb->id[0] == 'R' && remb->id[1] == 'E' && remb->id[2] == 'M' && remb->id[3] == 'B') {
-					/* FIXME From rtcp_utility.cc */
-					unsigned char *_ptrRTCPData = (unsigned char *)remb;
-					_ptrRTCPData += 4;	/* Skip unique identifier and num ssrc */
-					//~ JANUS_LOG(LOG_VERB, " %02X %02X %02X %02X\n", _ptrRTCPData[0], _ptrRTCPData[1], _ptrRTCPData[2], _ptrRTCPData[3]);
-					uint8_t brExp = (_ptrRTCPData[1] >> 2) & 0x3F;
-					uint32_t brMantissa = (_ptrRTCPData[1] & 0x03) << 16;
-					brMantissa += (_ptrRTCPData[2] << 8);
-					brMantissa += (_ptrRTCPData[3]);
-					uint32_t bitrate = (uint64_t)brMantissa << brExp;
-					JANUS_LOG(LOG_HUGE, "Got REMB bitrate %"SCNu32"\n", bitrate);
+				uint32_t bitrate = janus_rtcp_remb_bitrate(rtcp, total);
+				if(bitrate > 0)
 					return bitrate;
-				}
 			}
 		}
 		/* Is this a compound packet? */
@@ -1326,6 +1332,100 @@ uint32_t janus_rtcp_get_remb(char *packet, int len) {
 	return 0;
 }
 
+/* Collect everything the helpers above look for, walking the packet only once */
+int janus_rtcp_summarize(char *packet, int len, janus_rtcp_summary *summary) {
+	if(summary == NULL)
+		return -1;
+	memset(summary, 0, sizeof(*summary));
+	if(packet == NULL || len == 0)
+		return -1;
+	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
+	int total = len;
+	gboolean error = FALSE;
+	while(rtcp) {
+		if(!janus_rtcp_check_len(rtcp, total) || rtcp->version != 2) {
+			error = TRUE;
+			break;
+		}
+		switch(rtcp->type) {
+			case RTCP_SR:
+				summary->has_sr = TRUE;
+				summary->report_blocks += rtcp->rc;
+				break;
+			case RTCP_RR:
+				summary->has_rr = TRUE;
+				summary->report_blocks += rtcp->rc;
+				break;
+			case RTCP_BYE:
+				summary->has_bye = TRUE;
+				break;
+			case RTCP_FIR:
+				summary->has_fir = TRUE;
+				break;
+			case RTCP_PSFB:
+				if(rtcp->rc == 1) {
+					summary->has_pli = TRUE;
+				} else if(rtcp->rc == 15 && summary->remb == 0) {
+					summary->remb = janus_rtcp_remb_bitrate(rtcp, total);
+				}
+				break;
+			case RTCP_RTPFB:
+				if(rtcp->rc == 15) {
+					summary->has_twcc = TRUE;
+				} else if(rtcp->rc == 1) {
+					/* NACK FCI size is 4 bytes */
+					if(!janus_rtcp_check_fci(rtcp, total, 4)) {
+						error = TRUE;
+						break;
+					}
+					janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
+					int nacks = ntohs(rtcp->length)-2;	/* Skip SSRCs */
+					int i=0, j=0;
+					for(i=0; i<nacks && !summary->nacks_truncated; i++) {
+						janus_rtcp_nack *nack = (janus_rtcp_nack *)rtcpfb->fci + i;
+						uint16_t pid = ntohs(nack->pid);
+						uint16_t blp = ntohs(nack->blp);
+						if(summary->nacks_count == JANUS_RTCP_SUMMARY_MAX_NACKS) {
+							summary->nacks_truncated = TRUE;
+							break;
+						}
+						summary->nacks[summary->nacks_count++] = pid;
+						for(j=0; j<16; j++) {
+							if(!(blp & (1 << j)))
+								continue;
+							if(summary->nacks_count == JANUS_RTCP_SUMMARY_MAX_NACKS) {
+								summary->nacks_truncated = TRUE;
+								break;
+							}
+							summary->nacks[summary->nacks_count++] = pid+j+1;
+						}
+					}
+				}
+				break;
+			default:
+				break;
+		}
+		if(error)
+			break;
+		/* Is this a compound packet? */
+		int length = ntohs(rtcp->length);
+		if(length == 0)
+			break;
+		total -= length*4+4;
+		if(total <= 0)
+			break;
+		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
+	}
+	if(error) {
+		/* Like janus_rtcp_get_nacks, don't trust NACKs in broken packets */
+		summary->nacks_count = 0;
+		summary->nacks_truncated = FALSE;
+		return -1;
+	}
+	summary->valid = TRUE;
+	return 0;
+}
+
 /* Change an existing REMB message */
 int janus_rtcp_cap_remb(char *packet, int len, uint32_t bitrate) {
 	if(packet == NULL || len == 0)
@@ -1870,3 +1970,113 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	/* Done */
 	return len;
 }
+
+int janus_rtcp_transport_wide_cc_feedback_ring(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count,
+		const guint64 *times, guint32 mask, guint32 first, guint count) {
+	if(packet == NULL || times == NULL || count == 0 || count > JANUS_RTCP_TWCC_FEEDBACK_MAX ||
+			size < sizeof(janus_rtcp_header) + 8 + 8)
+		return -1;
+	memset(packet, 0, size);
+	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
+	rtcp->version = 2;
+	rtcp->type = RTCP_RTPFB;
+	rtcp->rc = 15;
+	janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
+	rtcpfb->ssrc = htonl(ssrc);
+	rtcpfb->media = htonl(media);
+	guint8 *data = (guint8 *)packet;
+	size_t len = sizeof(janus_rtcp_header) + 8;
+	janus_set2(data, len, (guint16)first);
+	janus_set2(data, len+2, count);
+	size_t reference_time_pos = len + 4;
+	janus_set1(data, len+7, feedback_packet_count);
+	len += 8;
+	/* Compute statuses and deltas in a single pass */
+	guint8 statuses[JANUS_RTCP_TWCC_FEEDBACK_MAX];
+	gint deltas[JANUS_RTCP_TWCC_FEEDBACK_MAX];
+	guint i = 0, received = 0;
+	guint64 timestamp = 0;
+	gboolean first_received = FALSE;
+	for(i=0; i<count; i++) {
+		guint64 arrival = times[(first+i) & mask];
+		if(arrival == 0) {
+			statuses[i] = janus_rtp_packet_status_notreceived;
+			continue;
+		}
+		if(!first_received) {
+			/* The reference time is in multiples of 64ms (and only uses 23 bits) */
+			first_received = TRUE;
+			guint64 reference_time = arrival / 64000;
+			timestamp = reference_time * 64000;
+			janus_set3(data, reference_time_pos, (reference_time & 0x007FFFFF));
+		}
+		gint delta = (arrival > timestamp) ? (gint)((arrival-timestamp)/250) : -(gint)((timestamp-arrival)/250);
+		statuses[i] = (delta < 0 || delta > 255) ?
+			janus_rtp_packet_status_largeornegativedelta : janus_rtp_packet_status_smalldelta;
+		deltas[received++] = delta;
+		timestamp = arrival;
+	}
+	/* Write the status chunks: run lengths when that's worth it, vectors otherwise */
+	i = 0;
+	while(i < count) {
+		if(len + 2 > size)
+			return -1;
+		guint run = 1;
+		while(i+run < count && run < 8191 && statuses[i+run] == statuses[i])
+			run++;
+		guint32 word = 0, j = 0;
+		gboolean large = FALSE;
+		for(j=i; j<i+14 && j<count; j++) {
+			if(statuses[j] == janus_rtp_packet_status_largeornegativedelta)
+				large = TRUE;
+		}
+		if(run >= 14 || i+run == count || (large && run >= 7)) {
+			/* Run length chunk (T=0) */
+			word = janus_push_bits(word, 1, 0);
+			word = janus_push_bits(word, 2, statuses[i]);
+			word = janus_push_bits(word, 13, run);
+			i += run;
+		} else if(!large) {
+			/* Status vector chunk with 14 one bit symbols (T=1, S=0) */
+			word = janus_push_bits(word, 1, 1);
+			word = janus_push_bits(word, 1, 0);
+			for(j=0; j<14; j++)
+				word = janus_push_bits(word, 1, (i+j < count) ? statuses[i+j] : 0);
+			i += 14;
+		} else {
+			/* Status vector chunk with 7 two bits symbols (T=1, S=1) */
+			word = janus_push_bits(word, 1, 1);
+			word = janus_push_bits(word, 1, 1);
+			for(j=0; j<7; j++)
+				word = janus_push_bits(word, 2, (i+j < count) ? statuses[i+j] : 0);
+			i += 7;
+		}
+		janus_set2(data, len, word);
+		len += 2;
+	}
+	/* Write the deltas */
+	for(i=0; i<received; i++) {
+		gint delta = deltas[i];
+		if(len + 2 > size)
+			return -1;
+		if(delta < 0 || delta > 255) {
+			short reported_delta = (short)delta;
+			if(reported_delta != delta) {
+				reported_delta = delta > 0 ? SHRT_MAX : SHRT_MIN;
+				JANUS_LOG(LOG_ERR, "Delta value (%d) too large, reporting it as %d\n", delta, reported_delta);
+			}
+			janus_set2(data, len, reported_delta);
+			len += 2;
+		} else {
+			janus_set1(data, len, (guint8)delta);
+			len++;
+		}
+	}
+	/* Add zero padding, and set the RTCP length */
+	if(len + (4 - len%4)%4 > size)
+		return -1;
+	while(len%4)
+		janus_set1(data, len++, 0);
+	rtcp->length = htons((len/4)-1);
+	return len;
+}
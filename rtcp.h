@@ -292,6 +292,40 @@ typedef struct rtcp_transport_wide_cc_stats
 } rtcp_transport_wide_cc_stats;
 typedef rtcp_transport_wide_cc_stats janus_rtcp_transport_wide_cc_stats;
 
+/*! \brief Maximum number of NACKed sequence numbers a janus_rtcp_summary can contain */
+#define JANUS_RTCP_SUMMARY_MAX_NACKS	256
+
+/*! \brief What an RTCP compound packet contains, as collected by
+ * janus_rtcp_summarize in a single pass: this is meant to replace the
+ * separate janus_rtcp_has_pli, janus_rtcp_has_fir, janus_rtcp_get_remb,
+ * etc. checks, each of which walks the whole packet again */
+typedef struct janus_rtcp_summary {
+	/*! \brief Whether all the messages in the compound packet were valid */
+	gboolean valid;
+	/*! \brief Whether the packet contains a Sender Report */
+	gboolean has_sr;
+	/*! \brief Whether the packet contains a Receiver Report */
+	gboolean has_rr;
+	/*! \brief Whether the packet contains a BYE */
+	gboolean has_bye;
+	/*! \brief Whether the packet contains a (legacy) FIR */
+	gboolean has_fir;
+	/*! \brief Whether the packet contains a PLI */
+	gboolean has_pli;
+	/*! \brief Whether the packet contains transport-wide CC feedback */
+	gboolean has_twcc;
+	/*! \brief How many report blocks the Sender and Receiver Reports contain, overall */
+	guint report_blocks;
+	/*! \brief Bitrate of the first valid REMB in the packet, 0 if there was none */
+	uint32_t remb;
+	/*! \brief How many sequence numbers are in nacks (always 0 if the packet is not valid) */
+	guint nacks_count;
+	/*! \brief Whether there were more NACKed sequence numbers than nacks can contain */
+	gboolean nacks_truncated;
+	/*! \brief Sequence numbers NACKed in the packet, in the same order as janus_rtcp_get_nacks */
+	uint16_t nacks[JANUS_RTCP_SUMMARY_MAX_NACKS];
+} janus_rtcp_summary;
+
 /*! \brief Method to retrieve the estimated round-trip time from an existing RTCP context
  * @param[in] ctx The RTCP context to query
  * @returns The estimated round-trip time */
@@ -478,6 +512,16 @@ int janus_rtcp_remove_nacks(char *packet, int len);
  * @returns The reported bitrate if successful, 0 if no REMB packet was available */
 uint32_t janus_rtcp_get_remb(char *packet, int len);
 
+/*! \brief Method to inspect a whole RTCP compound packet in a single pass
+ * \note The flags and values are the same the individual helpers (e.g.,
+ * janus_rtcp_has_pli or janus_rtcp_get_remb) would return for the same packet;
+ * if nacks_truncated is set, use janus_rtcp_get_nacks to get all the NACKs
+ * @param[in] packet The message data
+ * @param[in] len The message data length in bytes
+ * @param[out] summary The summary to fill in
+ * @returns 0 if the packet was valid, -1 otherwise */
+int janus_rtcp_summarize(char *packet, int len, janus_rtcp_summary *summary);
+
 /*! \brief Method to modify an existing RTCP REMB message to cap the reported bitrate
  * @param[in] packet The message data
  * @param[in] len The message data length in bytes
@@ -546,4 +590,23 @@ int janus_rtcp_nacks(char *packet, int len, GSList *nacks);
  * @returns The message data length in bytes, if successful, -1 on errors */
 int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats);
 
+/*! \brief Maximum number of packets a single transport wide feedback can report, when using janus_rtcp_transport_wide_cc_feedback_ring */
+#define JANUS_RTCP_TWCC_FEEDBACK_MAX	400
+/*! \brief Method to generate a new RTCP transport wide message to report reception stats,
+ * reading the arrival times directly from a ring indexed by transport wide sequence number
+ * \note Nothing is allocated and nothing is sorted: the \c count packets starting from
+ * \c first are reported in order, and those with a 0 arrival time as not received
+ * @param[in] packet The buffer data
+ * @param[in] size The size of the buffer, in bytes
+ * @param[in] ssrc SSRC of the origin stream
+ * @param[in] media SSRC of the destination stream
+ * @param[in] feedback_packet_count Feedback packet count
+ * @param[in] times The ring of arrival times, in microseconds (0 if not received)
+ * @param[in] mask The mask to apply to sequence numbers to get the index in the ring (size of the ring minus 1)
+ * @param[in] first The (extended) transport wide sequence number of the first packet to report
+ * @param[in] count How many packets to report (at most JANUS_RTCP_TWCC_FEEDBACK_MAX)
+ * @returns The message data length in bytes, if successful, -1 on errors */
+int janus_rtcp_transport_wide_cc_feedback_ring(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count,
+	const guint64 *times, guint32 mask, guint32 first, guint count);
+
 #endif
@@ -0,0 +1,132 @@
+/*! \file    rtp-bench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    RTP header rewriting benchmark
+ * \details  Standalone tool that measures how long it takes to rewrite
+ * the RTP headers of packets relayed to many recipients, as plugins
+ * like the VideoRoom and Streaming do for each of their subscribers
+ * using janus_rtp_switching_context. It simulates a publisher sending
+ * packets to a configurable number of recipients, each with its own
+ * context, and compares janus_rtp_header_update (which asks for the
+ * time for each recipient) with janus_rtp_header_update_at (where the
+ * time is retrieved once per packet). A publisher switch (new SSRC)
+ * can be simulated every few packets too:
+ *
+\verbatim
+./rtp-bench -r 1000 -n 5000
+./rtp-bench -r 100 -n 20000 -s 500
+\endverbatim
+ *
+ * Since the numbers depend on the machine, they're mostly useful to
+ * compare different versions of the code on the same box.
+ *
+ * \ingroup tools
+ * \ref tools
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "debug.h"
+#include "rtp.h"
+#include "utils.h"
+
+int janus_log_level = LOG_NONE;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+int refcount_debug = 0;
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* Relay num packets to all recipients, the same way plugins do: rewrite
+ * the header for each recipient, and restore it before the next one */
+static double rtp_bench_run(janus_rtp_switching_context *contexts, int recipients,
+		int num, int switches, gboolean video, gboolean once) {
+	char buf[1200];
+	memset(buf, 0, sizeof(buf));
+	janus_rtp_header *header = (janus_rtp_header *)buf;
+	header->version = 2;
+	header->type = video ? 96 : 111;
+	uint32_t ssrc = 1234, timestamp = 0;
+	uint16_t seq = 0;
+	int i = 0, r = 0;
+	for(r=0; r<recipients; r++)
+		janus_rtp_switching_context_reset(&contexts[r]);
+	double start = now_seconds();
+	for(i=0; i<num; i++) {
+		if(switches > 0 && i > 0 && (i % switches) == 0)
+			ssrc++;
+		seq++;
+		timestamp += video ? 3000 : 960;
+		gint64 now = once ? janus_get_monotonic_time() : 0;
+		for(r=0; r<recipients; r++) {
+			header->ssrc = htonl(ssrc);
+			header->timestamp = htonl(timestamp);
+			header->seq_number = htons(seq);
+			if(once)
+				janus_rtp_header_update_at(header, &contexts[r], video, now);
+			else
+				janus_rtp_header_update(header, &contexts[r], video, 0);
+		}
+	}
+	return now_seconds() - start;
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-r recipients] [-n packets] [-s switch]\n", name);
+	printf("  -r  How many recipients to relay each packet to (default: 500)\n");
+	printf("  -n  How many packets to relay (default: 10000)\n");
+	printf("  -s  Simulate a new SSRC every that many packets (default: 0, never)\n");
+}
+
+int main(int argc, char *argv[]) {
+	int recipients = 500, num = 10000, switches = 0, opt = 0;
+	while((opt = getopt(argc, argv, "r:n:s:h")) != -1) {
+		switch(opt) {
+			case 'r':
+				recipients = atoi(optarg);
+				break;
+			case 'n':
+				num = atoi(optarg);
+				break;
+			case 's':
+				switches = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if(recipients < 1 || num < 1 || switches < 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+	janus_rtp_switching_context *contexts = g_malloc0(recipients * sizeof(janus_rtp_switching_context));
+	printf("%d packets to %d recipients, SSRC switch %s\n", num, recipients,
+		switches ? "enabled" : "disabled");
+	printf("%-8s %-28s %12s %12s\n", "media", "method", "total (ms)", "per hdr (ns)");
+	int v = 0;
+	for(v=0; v<2; v++) {
+		double each = rtp_bench_run(contexts, recipients, num, switches, v, FALSE);
+		double once = rtp_bench_run(contexts, recipients, num, switches, v, TRUE);
+		double headers = (double)num*recipients;
+		printf("%-8s %-28s %12.2f %12.2f\n", v ? "video" : "audio", "janus_rtp_header_update",
+			each*1e3, each*1e9/headers);
+		printf("%-8s %-28s %12.2f %12.2f\n", v ? "video" : "audio", "janus_rtp_header_update_at",
+			once*1e3, once*1e9/headers);
+	}
+	g_free(contexts);
+	return 0;
+}
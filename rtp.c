@@ -123,8 +123,67 @@ const char *janus_rtp_header_extension_get_from_id(const char *sdp, int id) {
 }
 
 /* Static helper to quickly find the extension data */
-static int janus_rtp_header_extension_find(char *buf, int len, int id,
-		uint8_t *byte, uint32_t *word, char **ref) {
+int janus_rtp_header_extensions_map_parse(char *buf, int len, janus_rtp_header_extensions_map *map) {
+	if(map == NULL)
+		return -1;
+	memset(map, 0, sizeof(*map));
+	if(!buf || len < 12)
+		return -1;
+	janus_rtp_header *rtp = (janus_rtp_header *)buf;
+	if(rtp->version != 2)
+		return -1;
+	int hlen = 12, found = 0;
+	if(rtp->csrccount)	/* Skip CSRC if needed */
+		hlen += rtp->csrccount*4;
+	if(!rtp->extension)
+		return 0;
+	janus_rtp_header_extension *ext = (janus_rtp_header_extension *)(buf+hlen);
+	int extlen = ntohs(ext->length)*4;
+	hlen += 4;
+	/* Same checks as janus_rtp_header_extension_find, as we only map 1-byte extensions */
+	if(len <= (hlen + extlen) || ntohs(ext->type) != 0xBEDE)
+		return 0;
+	map->end = hlen + extlen;
+	const uint8_t padding = 0x00, reserved = 0xF;
+	uint8_t extid = 0, idlen;
+	int i = 0;
+	while(i < extlen) {
+		extid = (uint8_t)buf[hlen+i] >> 4;
+		if(extid == reserved) {
+			break;
+		} else if(extid == padding) {
+			i++;
+			continue;
+		}
+		idlen = ((uint8_t)buf[hlen+i] & 0xF)+1;
+		/* If an ID is there more than once, only the first one counts */
+		if(map->offset[extid] == 0) {
+			map->offset[extid] = hlen+i;
+			found++;
+		}
+		i += 1 + idlen;
+	}
+	return found;
+}
+
+static int janus_rtp_header_extension_find(const janus_rtp_header_extensions_map *map,
+		char *buf, int len, int id, uint8_t *byte, uint32_t *word, char **ref) {
+	if(map != NULL) {
+		/* We know where extensions are already */
+		if(!buf || id < 1 || id > 14 || map->offset[id] == 0)
+			return -1;
+		int offset = map->offset[id];
+		uint8_t idlen = ((uint8_t)buf[offset] & 0xF)+1;
+		if(byte)
+			*byte = (uint8_t)buf[offset+1];
+		if(word && idlen >= 3 && (offset+3) < map->end) {
+			memcpy(word, buf+offset, sizeof(uint32_t));
+			*word = ntohl(*word);
+		}
+		if(ref)
+			*ref = &buf[offset];
+		return 0;
+	}
 	if(!buf || len < 12)
 		return -1;
 	janus_rtp_header *rtp = (janus_rtp_header *)buf;
@@ -175,8 +234,13 @@ static int janus_rtp_header_extension_find(char *buf, int len, int id,
 }
 
 int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, gboolean *vad, int *level) {
+	return janus_rtp_header_extension_map_parse_audio_level(NULL, buf, len, id, vad, level);
+}
+
+int janus_rtp_header_extension_map_parse_audio_level(const janus_rtp_header_extensions_map *map,
+		char *buf, int len, int id, gboolean *vad, int *level) {
 	uint8_t byte = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, &byte, NULL, NULL) < 0)
+	if(janus_rtp_header_extension_find(map, buf, len, id, &byte, NULL, NULL) < 0)
 		return -1;
 	/* a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level */
 	gboolean v = (byte & 0x80) >> 7;
@@ -191,8 +255,13 @@ int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, gbo
 
 int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int id,
 		gboolean *c, gboolean *f, gboolean *r1, gboolean *r0) {
+	return janus_rtp_header_extension_map_parse_video_orientation(NULL, buf, len, id, c, f, r1, r0);
+}
+
+int janus_rtp_header_extension_map_parse_video_orientation(const janus_rtp_header_extensions_map *map,
+		char *buf, int len, int id, gboolean *c, gboolean *f, gboolean *r1, gboolean *r0) {
 	uint8_t byte = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, &byte, NULL, NULL) < 0)
+	if(janus_rtp_header_extension_find(map, buf, len, id, &byte, NULL, NULL) < 0)
 		return -1;
 	/* a=extmap:4 urn:3gpp:video-orientation */
 	gboolean cbit = (byte & 0x08) >> 3;
@@ -214,7 +283,7 @@ int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int i
 int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
 		uint16_t *min_delay, uint16_t *max_delay) {
 	uint32_t bytes = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, &bytes, NULL) < 0)
+	if(janus_rtp_header_extension_find(NULL, buf, len, id, NULL, &bytes, NULL) < 0)
 		return -1;
 	/* a=extmap:6 http://www.webrtc.org/experiments/rtp-hdrext/playout-delay */
 	uint16_t min = (bytes & 0x00FFF000) >> 12;
@@ -229,8 +298,13 @@ int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
 
 int janus_rtp_header_extension_parse_mid(char *buf, int len, int id,
 		char *sdes_item, int sdes_len) {
+	return janus_rtp_header_extension_map_parse_mid(NULL, buf, len, id, sdes_item, sdes_len);
+}
+
+int janus_rtp_header_extension_map_parse_mid(const janus_rtp_header_extensions_map *map,
+		char *buf, int len, int id, char *sdes_item, int sdes_len) {
 	char *ext = NULL;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext) < 0)
+	if(janus_rtp_header_extension_find(map, buf, len, id, NULL, NULL, &ext) < 0)
 		return -1;
 	/* a=extmap:3 urn:ietf:params:rtp-hdrext:sdes:mid */
 	if(ext == NULL)
@@ -250,8 +324,13 @@ int janus_rtp_header_extension_parse_mid(char *buf, int len, int id,
 
 int janus_rtp_header_extension_parse_rid(char *buf, int len, int id,
 		char *sdes_item, int sdes_len) {
+	return janus_rtp_header_extension_map_parse_rid(NULL, buf, len, id, sdes_item, sdes_len);
+}
+
+int janus_rtp_header_extension_map_parse_rid(const janus_rtp_header_extensions_map *map,
+		char *buf, int len, int id, char *sdes_item, int sdes_len) {
 	char *ext = NULL;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext) < 0)
+	if(janus_rtp_header_extension_find(map, buf, len, id, NULL, NULL, &ext) < 0)
 		return -1;
 	/* a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id */
 	/* a=extmap:5 urn:ietf:params:rtp-hdrext:sdes:repaired-rtp-stream-id */
@@ -272,7 +351,7 @@ int janus_rtp_header_extension_parse_rid(char *buf, int len, int id,
 
 int janus_rtp_header_extension_parse_framemarking(char *buf, int len, int id, janus_videocodec codec, uint8_t *tid) {
 	char *ext = NULL;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext) < 0)
+	if(janus_rtp_header_extension_find(NULL, buf, len, id, NULL, NULL, &ext) < 0)
 		return -1;
 	/*  0                   1                   2                   3
 	    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -291,8 +370,13 @@ int janus_rtp_header_extension_parse_framemarking(char *buf, int len, int id, ja
 }
 
 int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int id, uint16_t *transSeqNum) {
+	return janus_rtp_header_extension_map_parse_transport_wide_cc(NULL, buf, len, id, transSeqNum);
+}
+
+int janus_rtp_header_extension_map_parse_transport_wide_cc(const janus_rtp_header_extensions_map *map,
+		char *buf, int len, int id, uint16_t *transSeqNum) {
 	char *ext = NULL;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext) < 0)
+	if(janus_rtp_header_extension_find(map, buf, len, id, NULL, NULL, &ext) < 0)
 		return -1;
 	/*  0                   1                   2                   3
 	    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -310,9 +394,72 @@ int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int i
 	return 0;
 }
 
+int janus_rtp_header_extension_parse_dependency_desc(char *buf, int len, int id,
+		uint8_t *dd_content, int *dd_len) {
+	if(!buf || len < 12 || !dd_content || !dd_len || *dd_len < 1)
+		return -1;
+	janus_rtp_header *rtp = (janus_rtp_header *)buf;
+	if(rtp->version != 2 || !rtp->extension)
+		return -1;
+	int hlen = 12;
+	if(rtp->csrccount)	/* Skip CSRC if needed */
+		hlen += rtp->csrccount*4;
+	if(len < hlen + 4)
+		return -1;
+	janus_rtp_header_extension *ext = (janus_rtp_header_extension *)(buf+hlen);
+	uint16_t type = ntohs(ext->type);
+	int extlen = ntohs(ext->length)*4;
+	hlen += 4;
+	if(len < hlen + extlen)
+		return -1;
+	/* Unlike the other extensions we parse, this one may need a 2-byte header */
+	gboolean twobytes = ((type & 0xFFF0) == 0x1000);
+	if(type != 0xBEDE && !twobytes)
+		return -1;
+	int i = 0, idlen = 0;
+	uint8_t extid = 0;
+	while(i < extlen) {
+		extid = (uint8_t)buf[hlen+i];
+		if(twobytes) {
+			if(extid == 0) {
+				/* Padding */
+				i++;
+				continue;
+			}
+			if(i+1 >= extlen)
+				break;
+			idlen = (uint8_t)buf[hlen+i+1];
+			i += 2;
+		} else {
+			if((extid >> 4) == 0xF)
+				break;
+			if((extid >> 4) == 0) {
+				/* Padding */
+				i++;
+				continue;
+			}
+			idlen = (extid & 0x0F)+1;
+			extid = extid >> 4;
+			i++;
+		}
+		if(i + idlen > extlen)
+			break;
+		if(extid == id) {
+			/* Found! */
+			if(idlen > *dd_len)
+				return -2;
+			memcpy(dd_content, buf+hlen+i, idlen);
+			*dd_len = idlen;
+			return 0;
+		}
+		i += idlen;
+	}
+	return -1;
+}
+
 int janus_rtp_header_extension_set_transport_wide_cc(char *buf, int len, int id, uint16_t transSeqNum) {
 	char *ext = NULL;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext) < 0)
+	if(janus_rtp_header_extension_find(NULL, buf, len, id, NULL, NULL, &ext) < 0)
 		return -1;
 	if(ext == NULL)
 		return -2;
@@ -324,6 +471,22 @@ int janus_rtp_header_extension_set_transport_wide_cc(char *buf, int len, int id,
 	return 0;
 }
 
+int janus_rtp_header_extension_map_replace_id(janus_rtp_header_extensions_map *map,
+		char *buf, int len, int id, int new_id) {
+	if(map == NULL)
+		return janus_rtp_header_extension_replace_id(buf, len, id, new_id);
+	if(!buf || id < 1 || id > 14 || new_id < 1 || new_id > 14)
+		return -1;
+	int offset = map->offset[id];
+	if(offset == 0)
+		return -3;
+	buf[offset] = (new_id << 4) + (buf[offset] & 0xF);
+	map->offset[id] = 0;
+	if(map->offset[new_id] == 0 || map->offset[new_id] > offset)
+		map->offset[new_id] = offset;
+	return 0;
+}
+
 int janus_rtp_header_extension_replace_id(char *buf, int len, int id, int new_id) {
 	if(!buf || len < 12)
 		return -1;
@@ -606,17 +769,23 @@ int janus_rtp_skew_compensate_video(janus_rtp_header *header, janus_rtp_switchin
 }
 
 void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, int step) {
-	if(header == NULL || context == NULL)
-		return;
 	/* Note: while the step property is still there for compatibility reasons, to
 	 * keep the signature as it was before, it's ignored: whenever there's a switch
 	 * to take into account, we compute how much time passed between the last RTP
 	 * packet with the old SSRC and this new one, and prepare a timestamp accordingly */
+	if(header == NULL || context == NULL)
+		return;
+	janus_rtp_header_update_at(header, context, video, janus_get_monotonic_time());
+}
+
+void janus_rtp_header_update_at(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, gint64 now) {
+	if(header == NULL || context == NULL)
+		return;
 	uint32_t ssrc = ntohl(header->ssrc);
 	uint32_t timestamp = ntohl(header->timestamp);
 	uint16_t seq = ntohs(header->seq_number);
 	if(video) {
-		if(ssrc != context->v_last_ssrc) {
+		if(G_UNLIKELY(ssrc != context->v_last_ssrc)) {
 			/* Video SSRC changed: update both sequence number and timestamp */
 			JANUS_LOG(LOG_VERB, "Video SSRC changed, %"SCNu32" --> %"SCNu32"\n",
 				context->v_last_ssrc, ssrc);
@@ -627,7 +796,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 			context->v_base_seq = seq;
 			/* How much time since the last video RTP packet? We compute an offset accordingly */
 			if(context->v_last_time > 0) {
-				gint64 time_diff = janus_get_monotonic_time() - context->v_last_time;
+				gint64 time_diff = now - context->v_last_time;
 				time_diff = (time_diff*90)/1000; 	/* We're assuming 90khz here */
 				if(time_diff == 0)
 					time_diff = 1;
@@ -638,7 +807,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 			/* Reset skew compensation data */
 			context->v_new_ssrc = TRUE;
 		}
-		if(context->v_seq_reset) {
+		if(G_UNLIKELY(context->v_seq_reset)) {
 			/* Video sequence number was paused for a while: just update that */
 			context->v_seq_reset = FALSE;
 			context->v_base_seq_prev = context->v_last_seq;
@@ -653,9 +822,9 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 		header->timestamp = htonl(context->v_last_ts);
 		header->seq_number = htons(context->v_last_seq);
 		/* Take note of when we last handled this RTP packet */
-		context->v_last_time = janus_get_monotonic_time();
+		context->v_last_time = now;
 	} else {
-		if(ssrc != context->a_last_ssrc) {
+		if(G_UNLIKELY(ssrc != context->a_last_ssrc)) {
 			/* Audio SSRC changed: update both sequence number and timestamp */
 			JANUS_LOG(LOG_VERB, "Audio SSRC changed, %"SCNu32" --> %"SCNu32"\n",
 				context->a_last_ssrc, ssrc);
@@ -666,7 +835,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 			context->a_base_seq = seq;
 			/* How much time since the last audio RTP packet? We compute an offset accordingly */
 			if(context->a_last_time > 0) {
-				gint64 time_diff = janus_get_monotonic_time() - context->a_last_time;
+				gint64 time_diff = now - context->a_last_time;
 				int akhz = 48;
 				if(header->type == 0 || header->type == 8 || header->type == 9)
 					akhz = 8;	/* We're assuming 48khz here (Opus), unless it's G.711/G.722 (8khz) */
@@ -681,7 +850,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 			/* Reset skew compensation data */
 			context->a_new_ssrc = TRUE;
 		}
-		if(context->a_seq_reset) {
+		if(G_UNLIKELY(context->a_seq_reset)) {
 			/* Audio sequence number was paused for a while: just update that */
 			context->a_seq_reset = FALSE;
 			context->a_base_seq_prev = context->a_last_seq;
@@ -696,7 +865,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 		header->timestamp = htonl(context->a_last_ts);
 		header->seq_number = htons(context->a_last_seq);
 		/* Take note of when we last handled this RTP packet */
-		context->a_last_time = janus_get_monotonic_time();
+		context->a_last_time = now;
 	}
 }
 
@@ -1128,3 +1297,63 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 	/* If we got here, the packet can be relayed */
 	return TRUE;
 }
+
+void janus_rtp_simulcasting_cache_reset(janus_rtp_simulcasting_cache *cache) {
+	if(cache == NULL)
+		return;
+	cache->count = 0;
+	cache->now = 0;
+}
+
+/* Whether the time since the last relayed packet matters for a context (see above) */
+static int janus_rtp_simulcasting_context_stale(janus_rtp_simulcasting_context *context, gint64 now) {
+	if(context->last_relayed == 0)
+		return 2;
+	if(context->substream > 0 && (now - context->last_relayed) > (context->drop_trigger ? context->drop_trigger : 250000))
+		return 1;
+	return 0;
+}
+
+/* Whether two contexts would take the same decisions (the flags are reset anyway, and only staleness matters in the timing) */
+static gboolean janus_rtp_simulcasting_context_same(janus_rtp_simulcasting_context *a, janus_rtp_simulcasting_context *b) {
+	return a->rid_ext_id == b->rid_ext_id && a->framemarking_ext_id == b->framemarking_ext_id &&
+		a->substream == b->substream && a->substream_target == b->substream_target &&
+		a->substream_target_temp == b->substream_target_temp && a->templayer == b->templayer &&
+		a->templayer_target == b->templayer_target && a->drop_trigger == b->drop_trigger;
+}
+
+gboolean janus_rtp_simulcasting_context_process_rtp_cached(janus_rtp_simulcasting_cache *cache,
+		janus_rtp_simulcasting_context *context, char *buf, int len, uint32_t *ssrcs, char **rids,
+		janus_videocodec vcodec, janus_rtp_switching_context *sc) {
+	if(cache == NULL || context == NULL)
+		return janus_rtp_simulcasting_context_process_rtp(context, buf, len, ssrcs, rids, vcodec, sc);
+	if(cache->now == 0)
+		cache->now = janus_get_monotonic_time();
+	int stale = janus_rtp_simulcasting_context_stale(context, cache->now);
+	int i = 0;
+	for(i=0; i<cache->count; i++) {
+		if(cache->entries[i].stale != stale || !janus_rtp_simulcasting_context_same(&cache->entries[i].before, context))
+			continue;
+		/* Same state as a recipient we processed the packet for already, reuse what we decided then */
+		gint64 last_relayed = context->last_relayed;
+		*context = cache->entries[i].after;
+		if(cache->entries[i].after.last_relayed == cache->entries[i].before.last_relayed)
+			context->last_relayed = last_relayed;
+		if(cache->entries[i].base_seq && sc)
+			sc->v_base_seq++;
+		return cache->entries[i].relay;
+	}
+	/* New state, process the packet and take note of the result, if there's room */
+	janus_rtp_simulcasting_context before = *context;
+	uint16_t base_seq = sc ? sc->v_base_seq : 0;
+	gboolean relay = janus_rtp_simulcasting_context_process_rtp(context, buf, len, ssrcs, rids, vcodec, sc);
+	if(cache->count < JANUS_RTP_SIMULCASTING_CACHE_SIZE) {
+		cache->entries[cache->count].before = before;
+		cache->entries[cache->count].after = *context;
+		cache->entries[cache->count].stale = stale;
+		cache->entries[cache->count].relay = relay;
+		cache->entries[cache->count].base_seq = (sc && sc->v_base_seq != base_seq);
+		cache->count++;
+	}
+	return relay;
+}
@@ -88,6 +88,8 @@ typedef struct janus_rtp_header_extension {
 #define JANUS_RTP_EXTMAP_REPAIRED_RID		"urn:ietf:params:rtp-hdrext:sdes:repaired-rtp-stream-id"
 /*! \brief a=extmap:8 http://tools.ietf.org/html/draft-ietf-avtext-framemarking-07 */
 #define JANUS_RTP_EXTMAP_FRAME_MARKING		"http://tools.ietf.org/html/draft-ietf-avtext-framemarking-07"
+/*! \brief a=extmap:11 https://aomediacodec.github.io/av1-rtp-spec/#dependency-descriptor-rtp-header-extension */
+#define JANUS_RTP_EXTMAP_DEPENDENCY_DESC	"https://aomediacodec.github.io/av1-rtp-spec/#dependency-descriptor-rtp-header-extension"
 /*! \brief \note Note: We don't support encrypted extensions yet */
 #define JANUS_RTP_EXTMAP_ENCRYPTED			"urn:ietf:params:rtp-hdrext:encrypt"
 
@@ -144,6 +146,28 @@ int janus_rtp_header_extension_get_id(const char *sdp, const char *extension);
  * @returns The extension namespace, if found, NULL otherwise */
 const char *janus_rtp_header_extension_get_from_id(const char *sdp, int id);
 
+/*! \brief Where the (1-byte header) extensions of an RTP packet are
+ * \note Each of the janus_rtp_header_extension_parse_* helpers walks the
+ * extensions from the start to find the one it's asked for: when more than
+ * one is needed for the same packet, it's cheaper to have
+ * janus_rtp_header_extensions_map_parse walk them once, and then use the
+ * janus_rtp_header_extension_map_* version of the helpers instead. A map is
+ * only valid for the packet it was created for, as long as its header is
+ * not modified by anything other than janus_rtp_header_extension_map_replace_id */
+typedef struct janus_rtp_header_extensions_map {
+	/*! \brief Offset in the packet of each extension, by ID (0 if the packet doesn't have it) */
+	uint16_t offset[15];
+	/*! \brief Offset in the packet where the extensions end */
+	uint16_t end;
+} janus_rtp_header_extensions_map;
+
+/*! \brief Helper to find all the (1-byte header) extensions in an RTP packet in a single pass
+ * @param[in] buf The packet data
+ * @param[in] len The packet data length in bytes
+ * @param[out] map The map to fill in
+ * @returns The number of extensions found, -1 in case of errors */
+int janus_rtp_header_extensions_map_parse(char *buf, int len, janus_rtp_header_extensions_map *map);
+
 /*! \brief Helper to parse a ssrc-audio-level RTP extension (https://tools.ietf.org/html/rfc6464)
  * @note Browsers apparently always set the VAD to 1, so it's unreliable and should be ignored:
  * only use this method if you're interested in the audio-level value itself.
@@ -155,6 +179,10 @@ const char *janus_rtp_header_extension_get_from_id(const char *sdp, int id);
  * @returns 0 if found, -1 otherwise */
 int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, gboolean *vad, int *level);
 
+/*! \brief Same as janus_rtp_header_extension_parse_audio_level, but using a map of the extensions, if provided */
+int janus_rtp_header_extension_map_parse_audio_level(const janus_rtp_header_extensions_map *map,
+	char *buf, int len, int id, gboolean *vad, int *level);
+
 /*! \brief Helper to parse a video-orientation RTP extension (http://www.3gpp.org/ftp/Specs/html-info/26114.htm)
  * @param[in] buf The packet data
  * @param[in] len The packet data length in bytes
@@ -167,6 +195,10 @@ int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, gbo
 int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int id,
 	gboolean *c, gboolean *f, gboolean *r1, gboolean *r0);
 
+/*! \brief Same as janus_rtp_header_extension_parse_video_orientation, but using a map of the extensions, if provided */
+int janus_rtp_header_extension_map_parse_video_orientation(const janus_rtp_header_extensions_map *map,
+	char *buf, int len, int id, gboolean *c, gboolean *f, gboolean *r1, gboolean *r0);
+
 /*! \brief Helper to parse a playout-delay RTP extension (https://webrtc.org/experiments/rtp-hdrext/playout-delay)
  * @param[in] buf The packet data
  * @param[in] len The packet data length in bytes
@@ -187,6 +219,10 @@ int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
 int janus_rtp_header_extension_parse_mid(char *buf, int len, int id,
 	char *sdes_item, int sdes_len);
 
+/*! \brief Same as janus_rtp_header_extension_parse_mid, but using a map of the extensions, if provided */
+int janus_rtp_header_extension_map_parse_mid(const janus_rtp_header_extensions_map *map,
+	char *buf, int len, int id, char *sdes_item, int sdes_len);
+
 /*! \brief Helper to parse a rtp-stream-id RTP extension (https://tools.ietf.org/html/draft-ietf-avtext-rid-09)
  * @param[in] buf The packet data
  * @param[in] len The packet data length in bytes
@@ -197,6 +233,10 @@ int janus_rtp_header_extension_parse_mid(char *buf, int len, int id,
 int janus_rtp_header_extension_parse_rid(char *buf, int len, int id,
 	char *sdes_item, int sdes_len);
 
+/*! \brief Same as janus_rtp_header_extension_parse_rid, but using a map of the extensions, if provided */
+int janus_rtp_header_extension_map_parse_rid(const janus_rtp_header_extensions_map *map,
+	char *buf, int len, int id, char *sdes_item, int sdes_len);
+
 /*! \brief Helper to parse a frame-marking RTP extension (http://tools.ietf.org/html/draft-ietf-avtext-framemarking-07)
  * \note This is currently only used to get temporal layers for H.264 simulcasting
  * @param[in] buf The packet data
@@ -215,6 +255,21 @@ int janus_rtp_header_extension_parse_framemarking(char *buf, int len, int id, ja
  * @returns 0 if found, -1 otherwise */
 int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int id, uint16_t *transSeqNum);
 
+/*! \brief Same as janus_rtp_header_extension_parse_transport_wide_cc, but using a map of the extensions, if provided */
+int janus_rtp_header_extension_map_parse_transport_wide_cc(const janus_rtp_header_extensions_map *map,
+	char *buf, int len, int id, uint16_t *transSeqNum);
+
+/*! \brief Helper to extract the content of a Dependency Descriptor RTP extension (https://aomediacodec.github.io/av1-rtp-spec/#dependency-descriptor-rtp-header-extension)
+ * \note As the descriptor is often too large for a 1-byte header, 2-byte headers are supported too
+ * @param[in] buf The packet data
+ * @param[in] len The packet data length in bytes
+ * @param[in] id The extension ID to look for
+ * @param[out] dd_content Buffer to copy the content of the extension to
+ * @param[in,out] dd_len Size of the buffer, updated with the length of the extension
+ * @returns 0 if found, a negative integer otherwise */
+int janus_rtp_header_extension_parse_dependency_desc(char *buf, int len, int id,
+	uint8_t *dd_content, int *dd_len);
+
 /*! \brief Helper to set a transport wide sequence number (https://tools.ietf.org/html/draft-holmer-rmcat-transport-wide-cc-extensions-01)
  * @param[in] buf The packet data
  * @param[in] len The packet data length in bytes
@@ -232,6 +287,11 @@ int janus_rtp_header_extension_set_transport_wide_cc(char *buf, int len, int id,
  * @returns 0 if found, a negative integer otherwise */
 int janus_rtp_header_extension_replace_id(char *buf, int len, int id, int new_id);
 
+/*! \brief Same as janus_rtp_header_extension_replace_id, but using a map of the
+ * extensions, if provided, which is updated accordingly */
+int janus_rtp_header_extension_map_replace_id(janus_rtp_header_extensions_map *map,
+	char *buf, int len, int id, int new_id);
+
 /*! \brief RTP context, in order to make sure SSRC changes result in coherent seq/ts increases */
 typedef struct janus_rtp_switching_context {
 	uint32_t a_last_ssrc, a_last_ts, a_base_ts, a_base_ts_prev, a_prev_ts, a_target_ts, a_start_ts,
@@ -259,6 +319,16 @@ void janus_rtp_switching_context_reset(janus_rtp_switching_context *context);
  * @param[in] step \b deprecated The expected timestamp step */
 void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, int step);
 
+/*! \brief Same as janus_rtp_header_update, but with the current time provided by the caller
+ * \note This is meant for plugins that relay the same packet to many recipients,
+ * each with its own context: they can get the time once (e.g., when they receive
+ * the packet) rather than having the clock queried again for each recipient
+ * @param[in] header The RTP header to update
+ * @param[in] context The context to use as a reference
+ * @param[in] video Whether this is an audio or a video packet
+ * @param[in] now The current monotonic time, as returned by janus_get_monotonic_time */
+void janus_rtp_header_update_at(janus_rtp_header *header, janus_rtp_switching_context *context, gboolean video, gint64 now);
+
 #define RTP_AUDIO_SKEW_TH_MS 120
 #define RTP_VIDEO_SKEW_TH_MS 120
 #define SKEW_DETECTION_WAIT_TIME_SECS 10
@@ -331,4 +401,46 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 	char *buf, int len, uint32_t *ssrcs, char **rids,
 	janus_videocodec vcodec, janus_rtp_switching_context *sc);
 
+/*! \brief Maximum number of different simulcasting states a janus_rtp_simulcasting_cache can track */
+#define JANUS_RTP_SIMULCASTING_CACHE_SIZE	16
+/*! \brief Decisions taken for the same RTP packet on behalf of several recipients, so
+ * that recipients whose simulcasting context is in the same state (e.g., the same
+ * substream and temporal layer, and the same targets) can reuse them */
+typedef struct janus_rtp_simulcasting_cache {
+	/*! \brief Simulcasting states we processed the packet for so far */
+	struct {
+		/*! \brief The context before and after processing the packet */
+		janus_rtp_simulcasting_context before, after;
+		/*! \brief Whether the context was stale (2 if it had never relayed anything) */
+		int stale;
+		/*! \brief Whether the packet was relayed, and whether the base sequence number was increased */
+		gboolean relay, base_seq;
+	} entries[JANUS_RTP_SIMULCASTING_CACHE_SIZE];
+	/*! \brief Number of entries in use */
+	int count;
+	/*! \brief Time the cache was first used for this packet */
+	gint64 now;
+} janus_rtp_simulcasting_cache;
+
+/*! \brief Reset a simulcasting cache, before processing a new packet
+ * @param[in] cache The janus_rtp_simulcasting_cache instance to reset */
+void janus_rtp_simulcasting_cache_reset(janus_rtp_simulcasting_cache *cache);
+
+/*! \brief Same as janus_rtp_simulcasting_context_process_rtp, but reusing the decision
+ * already taken for another recipient of the same packet, if their context was in the same state
+ * \note All the calls using the same cache (until it's reset) must be for the same
+ * packet, SSRCs, rids and codec: only the simulcasting and switching contexts change
+ * @param[in] cache The janus_rtp_simulcasting_cache instance for this packet (plain processing if NULL)
+ * @param[in] context The simulcasting context to use
+ * @param[in] buf The RTP packet to process
+ * @param[in] len The length of the RTP packet (header, extension and payload)
+ * @param[in] ssrcs The simulcast SSRCs to refer to (may be updated if rids are involved)
+ * @param[in] rids The simulcast rids to refer to, if any
+ * @param[in] vcodec Video codec of the RTP payload
+ * @param[in] sc RTP switching context to refer to, if any (only needed for VP8 and dropping temporal layers)
+ * @returns TRUE if the packet should be relayed, FALSE if it should be dropped instead */
+gboolean janus_rtp_simulcasting_context_process_rtp_cached(janus_rtp_simulcasting_cache *cache,
+	janus_rtp_simulcasting_context *context, char *buf, int len, uint32_t *ssrcs, char **rids,
+	janus_videocodec vcodec, janus_rtp_switching_context *sc);
+
 #endif
@@ -0,0 +1,377 @@
+/*! \file    sctp-bench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Data channels (SCTP) throughput benchmark
+ * \details  Standalone tool that measures how many data channel messages
+ * per second libusrsctp can move, using the same AF_CONN approach the
+ * core uses: packets the stack wants to send are not put on the wire, but
+ * queued and fed to the peer association via \c usrsctp_conninput, which
+ * is what happens in Janus after DTLS decryption. Many associations can be
+ * created at the same time, and spread on several threads, to see how the
+ * global usrsctp stack behaves under load, e.g.:
+ *
+\verbatim
+./sctp-bench                       (1 association, usrsctp timer threads)
+./sctp-bench -a 1000 -w 4          (1000 associations served by 4 threads)
+./sctp-bench -a 1000 -w 4 -t 20    (same, timers triggered every 20ms by us)
+\endverbatim
+ *
+ * The \c -t option initializes usrsctp without threads of its own, and
+ * triggers its timers from a dedicated thread with the provided interval,
+ * as the core does when \c sctp_timer_interval is set: it's only available
+ * when libusrsctp supports \c usrsctp_init_nothreads.
+ *
+ * \ingroup tools
+ * \ref tools
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <usrsctp.h>
+
+#define SCTP_BENCH_PORT	5000
+#define SCTP_BENCH_PPID	53	/* WebRTC Binary */
+
+struct sctp_bench_worker;
+
+/* One side of an association */
+typedef struct sctp_bench_endpoint {
+	struct socket *sock;
+	struct sctp_bench_endpoint *peer;
+	struct sctp_bench_worker *worker;
+	int up;
+	unsigned long long received;
+} sctp_bench_endpoint;
+
+/* A packet waiting to be delivered to an endpoint */
+typedef struct sctp_bench_packet {
+	struct sctp_bench_packet *next;
+	sctp_bench_endpoint *to;
+	size_t len;
+	char data[];
+} sctp_bench_packet;
+
+/* A thread serving some of the associations */
+typedef struct sctp_bench_worker {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	sctp_bench_packet *head, *tail;
+	sctp_bench_endpoint *endpoints;	/* Pairs of client and server */
+	int associations;
+} sctp_bench_worker;
+
+static int messages = 10000, size = 512;
+static int timer_interval = 0;
+static volatile int timers_running = 0;
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* usrsctp callback: queue the packet for the peer, as we can't call
+ * usrsctp_conninput from here (the stack holds its locks) */
+static int sctp_bench_output(void *addr, void *buffer, size_t length, uint8_t tos, uint8_t set_df) {
+	sctp_bench_endpoint *endpoint = (sctp_bench_endpoint *)addr;
+	sctp_bench_packet *pkt = malloc(sizeof(sctp_bench_packet) + length);
+	if(pkt == NULL)
+		return -1;
+	pkt->next = NULL;
+	pkt->to = endpoint->peer;
+	pkt->len = length;
+	memcpy(pkt->data, buffer, length);
+	sctp_bench_worker *worker = endpoint->worker;
+	pthread_mutex_lock(&worker->mutex);
+	if(worker->tail != NULL)
+		worker->tail->next = pkt;
+	else
+		worker->head = pkt;
+	worker->tail = pkt;
+	pthread_mutex_unlock(&worker->mutex);
+	return 0;
+}
+
+/* usrsctp callback: count what we received */
+static int sctp_bench_receive(struct socket *sock, union sctp_sockstore addr, void *data,
+		size_t datalen, struct sctp_rcvinfo rcv, int flags, void *ulp_info) {
+	sctp_bench_endpoint *endpoint = (sctp_bench_endpoint *)ulp_info;
+	if(data == NULL)
+		return 1;
+	if(flags & MSG_NOTIFICATION) {
+		union sctp_notification *notif = (union sctp_notification *)data;
+		if(notif->sn_header.sn_type == SCTP_ASSOC_CHANGE &&
+				notif->sn_assoc_change.sac_state == SCTP_COMM_UP)
+			__atomic_store_n(&endpoint->up, 1, __ATOMIC_RELEASE);
+	} else {
+		__atomic_fetch_add(&endpoint->received, datalen, __ATOMIC_RELAXED);
+	}
+	free(data);
+	return 1;
+}
+
+/* Deliver all the queued packets, returning how many there were */
+static int sctp_bench_deliver(sctp_bench_worker *worker) {
+	pthread_mutex_lock(&worker->mutex);
+	sctp_bench_packet *pkt = worker->head;
+	worker->head = worker->tail = NULL;
+	pthread_mutex_unlock(&worker->mutex);
+	int count = 0;
+	while(pkt != NULL) {
+		sctp_bench_packet *next = pkt->next;
+		usrsctp_conninput(pkt->to, pkt->data, pkt->len, 0);
+		free(pkt);
+		pkt = next;
+		count++;
+	}
+	return count;
+}
+
+static int sctp_bench_setup(sctp_bench_endpoint *endpoint) {
+	usrsctp_register_address(endpoint);
+	endpoint->sock = usrsctp_socket(AF_CONN, SOCK_STREAM, IPPROTO_SCTP, sctp_bench_receive, NULL, 0, endpoint);
+	if(endpoint->sock == NULL)
+		return -1;
+	usrsctp_set_non_blocking(endpoint->sock, 1);
+	int nodelay = 1;
+	usrsctp_setsockopt(endpoint->sock, IPPROTO_SCTP, SCTP_NODELAY, &nodelay, sizeof(nodelay));
+	struct sctp_event event;
+	memset(&event, 0, sizeof(event));
+	event.se_assoc_id = SCTP_ALL_ASSOC;
+	event.se_on = 1;
+	event.se_type = SCTP_ASSOC_CHANGE;
+	usrsctp_setsockopt(endpoint->sock, IPPROTO_SCTP, SCTP_EVENT, &event, sizeof(event));
+	struct sockaddr_conn sconn;
+	memset(&sconn, 0, sizeof(sconn));
+	sconn.sconn_family = AF_CONN;
+	sconn.sconn_port = htons(SCTP_BENCH_PORT);
+	sconn.sconn_addr = endpoint;
+	if(usrsctp_bind(endpoint->sock, (struct sockaddr *)&sconn, sizeof(sconn)) < 0)
+		return -1;
+	return 0;
+}
+
+static int sctp_bench_connect(sctp_bench_endpoint *endpoint) {
+	/* As in the core, both sides connect at the same time */
+	struct sockaddr_conn rconn;
+	memset(&rconn, 0, sizeof(rconn));
+	rconn.sconn_family = AF_CONN;
+	rconn.sconn_port = htons(SCTP_BENCH_PORT);
+	rconn.sconn_addr = endpoint;
+	if(usrsctp_connect(endpoint->sock, (struct sockaddr *)&rconn, sizeof(rconn)) < 0 && errno != EINPROGRESS)
+		return -1;
+	return 0;
+}
+
+/* Wait for all the associations of a worker to be up */
+static void *sctp_bench_worker_connect(void *data) {
+	sctp_bench_worker *worker = (sctp_bench_worker *)data;
+	int i = 0, up = 0;
+	while(up < worker->associations*2) {
+		if(sctp_bench_deliver(worker) == 0)
+			usleep(100);
+		up = 0;
+		for(i = 0; i < worker->associations*2; i++)
+			up += __atomic_load_n(&worker->endpoints[i].up, __ATOMIC_ACQUIRE);
+	}
+	return NULL;
+}
+
+/* Have the clients send all their messages, until the servers got them all */
+static void *sctp_bench_worker_run(void *data) {
+	sctp_bench_worker *worker = (sctp_bench_worker *)data;
+	int *sent = calloc(worker->associations, sizeof(int));
+	char *buffer = calloc(1, size);
+	unsigned long long total = (unsigned long long)messages * size;
+	struct sctp_sndinfo sndinfo;
+	memset(&sndinfo, 0, sizeof(sndinfo));
+	sndinfo.snd_ppid = htonl(SCTP_BENCH_PPID);
+	int i = 0, done = 0;
+	while(!done) {
+		int progress = sctp_bench_deliver(worker);
+		done = 1;
+		for(i = 0; i < worker->associations; i++) {
+			sctp_bench_endpoint *client = &worker->endpoints[i*2];
+			while(sent[i] < messages) {
+				if(usrsctp_sendv(client->sock, buffer, size, NULL, 0, &sndinfo,
+						sizeof(sndinfo), SCTP_SENDV_SNDINFO, 0) < 0)
+					break;
+				sent[i]++;
+				progress++;
+			}
+			if(__atomic_load_n(&client->peer->received, __ATOMIC_RELAXED) < total)
+				done = 0;
+		}
+		if(!done && progress == 0)
+			usleep(100);
+	}
+	free(sent);
+	free(buffer);
+	return NULL;
+}
+
+static void sctp_bench_run_workers(sctp_bench_worker *workers, int num, void *(*func)(void *)) {
+	int i = 0;
+	for(i = 0; i < num; i++)
+		pthread_create(&workers[i].thread, NULL, func, &workers[i]);
+	for(i = 0; i < num; i++)
+		pthread_join(workers[i].thread, NULL);
+}
+
+#ifdef HAVE_USRSCTP_NOTHREADS
+static void *sctp_bench_timers(void *data) {
+	double last = now_seconds();
+	while(__atomic_load_n(&timers_running, __ATOMIC_RELAXED)) {
+		usleep(timer_interval*1000);
+		double now = now_seconds();
+		uint32_t elapsed = (uint32_t)((now-last)*1000);
+		if(elapsed == 0)
+			continue;
+		usrsctp_handle_timers(elapsed);
+		last += elapsed/1000.0;
+	}
+	return NULL;
+}
+#endif
+
+static void usage(const char *name) {
+	printf("Usage: %s [-a associations] [-w workers] [-n messages] [-s size] [-t timer_interval]\n", name);
+	printf("  -a  Number of associations (default=1)\n");
+	printf("  -w  Number of threads serving them (default=1)\n");
+	printf("  -n  Messages to send on each association (default=10000)\n");
+	printf("  -s  Size of each message, in bytes (default=512)\n");
+	printf("  -t  Trigger the usrsctp timers ourselves every that many ms, rather than\n");
+	printf("      having usrsctp start its own threads (default=0, usrsctp threads)\n");
+}
+
+int main(int argc, char *argv[]) {
+	int associations = 1, num_workers = 1;
+	int opt = 0;
+	while((opt = getopt(argc, argv, "a:w:n:s:t:h")) != -1) {
+		switch(opt) {
+			case 'a':
+				associations = atoi(optarg);
+				break;
+			case 'w':
+				num_workers = atoi(optarg);
+				break;
+			case 'n':
+				messages = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg);
+				break;
+			case 't':
+				timer_interval = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+	if(associations < 1 || num_workers < 1 || messages < 1 || size < 1 || timer_interval < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if(num_workers > associations)
+		num_workers = associations;
+#ifndef HAVE_USRSCTP_NOTHREADS
+	if(timer_interval > 0) {
+		fprintf(stderr, "This libusrsctp can't be initialized without threads, -t is not supported\n");
+		return 1;
+	}
+#endif
+
+	/* Initialize the stack the same way the core does */
+#ifdef HAVE_USRSCTP_NOTHREADS
+	pthread_t timers;
+	if(timer_interval > 0) {
+		usrsctp_init_nothreads(0, sctp_bench_output, NULL);
+		timers_running = 1;
+		pthread_create(&timers, NULL, sctp_bench_timers, NULL);
+	} else {
+		usrsctp_init(0, sctp_bench_output, NULL);
+	}
+#else
+	usrsctp_init(0, sctp_bench_output, NULL);
+#endif
+	usrsctp_sysctl_set_sctp_ecn_enable(0);
+
+	/* Create the associations, and spread them on the workers */
+	sctp_bench_endpoint *endpoints = calloc(associations*2, sizeof(sctp_bench_endpoint));
+	sctp_bench_worker *workers = calloc(num_workers, sizeof(sctp_bench_worker));
+	int i = 0, first = 0;
+	for(i = 0; i < num_workers; i++) {
+		pthread_mutex_init(&workers[i].mutex, NULL);
+		workers[i].associations = associations/num_workers + (i < associations%num_workers ? 1 : 0);
+		workers[i].endpoints = &endpoints[first*2];
+		first += workers[i].associations;
+	}
+	int w = 0, a = 0;
+	for(w = 0; w < num_workers; w++) {
+		for(a = 0; a < workers[w].associations; a++) {
+			sctp_bench_endpoint *client = &workers[w].endpoints[a*2], *server = client+1;
+			client->peer = server;
+			server->peer = client;
+			client->worker = server->worker = &workers[w];
+			if(sctp_bench_setup(client) < 0 || sctp_bench_setup(server) < 0) {
+				fprintf(stderr, "Error creating usrsctp sockets (%d)\n", errno);
+				return 1;
+			}
+		}
+	}
+	double start = now_seconds();
+	for(i = 0; i < associations*2; i++) {
+		if(sctp_bench_connect(&endpoints[i]) < 0) {
+			fprintf(stderr, "Error connecting usrsctp sockets (%d)\n", errno);
+			return 1;
+		}
+	}
+	sctp_bench_run_workers(workers, num_workers, sctp_bench_worker_connect);
+	double connected = now_seconds();
+
+	/* Send the messages */
+	sctp_bench_run_workers(workers, num_workers, sctp_bench_worker_run);
+	double end = now_seconds();
+
+	double elapsed = end - connected;
+	double total_messages = (double)messages * associations;
+	printf("usrsctp %s, %d association(s), %d worker(s), %d x %d bytes each\n",
+		timer_interval > 0 ? "without threads" : "with threads",
+		associations, num_workers, messages, size);
+	printf("  setup:      %8.1f ms\n", (connected - start)*1000);
+	printf("  throughput: %8.0f msg/s, %8.1f Mbit/s (%.2f s)\n",
+		total_messages/elapsed, total_messages*size*8/elapsed/1e6, elapsed);
+
+	/* Done, clean up */
+	for(i = 0; i < associations*2; i++) {
+		usrsctp_close(endpoints[i].sock);
+		usrsctp_deregister_address(&endpoints[i]);
+	}
+	for(i = 0; i < num_workers; i++)
+		sctp_bench_deliver(&workers[i]);
+	int attempts = 100;
+	while(usrsctp_finish() != 0 && attempts-- > 0) {
+		for(i = 0; i < num_workers; i++)
+			sctp_bench_deliver(&workers[i]);
+		usleep(10000);
+	}
+#ifdef HAVE_USRSCTP_NOTHREADS
+	if(timer_interval > 0) {
+		__atomic_store_n(&timers_running, 0, __ATOMIC_RELAXED);
+		pthread_join(timers, NULL);
+	}
+#endif
+	for(i = 0; i < num_workers; i++)
+		sctp_bench_deliver(&workers[i]);
+	free(workers);
+	free(endpoints);
+	return 0;
+}
@@ -61,31 +61,82 @@ static uint16_t event_types[] = {
 	SCTP_STREAM_CHANGE_EVENT
 };
 
-/* Buffered message (in case we can't send right away) */
+/* Buffered message (in case we can't send right away): the data is
+ * allocated together with the struct, and messages that have been sent
+ * are kept around (up to a point) to be reused for the next ones */
 typedef struct janus_sctp_pending_message {
 	uint16_t id;
 	gboolean textdata;
-	char *buf;
 	size_t len;
+	size_t size;
+	char buf[];
 } janus_sctp_pending_message;
-static janus_sctp_pending_message *janus_sctp_pending_message_create(uint16_t id, gboolean textdata, char *buf, size_t len) {
-	janus_sctp_pending_message *m = g_malloc(sizeof(janus_sctp_pending_message));
-	m->id = id;
-	m->textdata = textdata;
-	if(buf != NULL && len > 0) {
-		m->buf = g_malloc(len);
-		memcpy(m->buf, buf, len);
+#define JANUS_SCTP_PENDING_POOL_SIZE	16
+
+/* How many bytes we can queue per association, and what to tell plugins */
+static size_t sctp_pending_limit = JANUS_SCTP_DEFAULT_PENDING_LIMIT;
+static janus_sctp_pending_policy sctp_pending_policy = janus_sctp_pending_drop;
+void janus_sctp_set_pending_limit(size_t limit, janus_sctp_pending_policy policy) {
+	sctp_pending_limit = limit;
+	sctp_pending_policy = policy;
+	if(limit > 0) {
+		JANUS_LOG(LOG_INFO, "Queueing up to %zu bytes per SCTP association (policy: %s)\n",
+			limit, policy == janus_sctp_pending_notify ? "notify" : "drop");
+	} else {
+		JANUS_LOG(LOG_WARN, "No limit on the bytes queued per SCTP association\n");
+	}
+}
+
+/* Queue a message we couldn't send, unless the queue is full already */
+static gboolean janus_sctp_pending_message_queue(janus_sctp_association *sctp, uint16_t id, gboolean textdata, char *buf, size_t len) {
+	if(buf == NULL || len == 0)
+		return FALSE;
+	size_t pending = (size_t)g_atomic_int_get(&sctp->pending_bytes);
+	if(sctp_pending_limit > 0 && pending + len > sctp_pending_limit) {
+		if(sctp->pending_dropped == 0) {
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] SCTP pending queue full (%zu bytes), dropping messages\n",
+				sctp->handle_id, pending);
+		}
+		sctp->pending_dropped++;
+		sctp->pending_dropped_total++;
+		return FALSE;
+	}
+	janus_sctp_pending_message *m = sctp->pending_pool ? sctp->pending_pool->data : NULL;
+	if(m != NULL && m->size >= len) {
+		sctp->pending_pool = g_slist_delete_link(sctp->pending_pool, sctp->pending_pool);
+		sctp->pending_pool_size--;
 	} else {
-		m->buf = NULL;
-		m->len = 0;
+		m = g_malloc(sizeof(janus_sctp_pending_message) + len);
+		m->size = len;
 	}
-	return m;
+	m->id = id;
+	m->textdata = textdata;
+	m->len = len;
+	memcpy(m->buf, buf, len);
+	if(sctp->pending_messages == NULL)
+		sctp->pending_messages = g_queue_new();
+	g_queue_push_tail(sctp->pending_messages, m);
+	g_atomic_int_add(&sctp->pending_bytes, (gint)len);
+	g_atomic_int_add(&sctp->handle->data_pending, (gint)len);
+	janus_memory_add(&sctp->handle->memory, JANUS_MEMORY_SCTP_PENDING, (gint)len);
+	return TRUE;
 }
-static void janus_sctp_pending_message_free(janus_sctp_pending_message *m) {
-	if(m != NULL) {
-		g_free(m->buf);
-		g_free(m);
+
+/* Get rid of a message that has been sent, possibly keeping it for later */
+static void janus_sctp_pending_message_release(janus_sctp_association *sctp, janus_sctp_pending_message *m) {
+	g_atomic_int_add(&sctp->pending_bytes, -(gint)m->len);
+	g_atomic_int_add(&sctp->handle->data_pending, -(gint)m->len);
+	janus_memory_add(&sctp->handle->memory, JANUS_MEMORY_SCTP_PENDING, -(gint)m->len);
+	if(sctp->pending_pool_size < JANUS_SCTP_PENDING_POOL_SIZE && m->size <= BUFFER_SIZE) {
+		/* Keep the larger buffers at the head, so that they're tried first */
+		if(sctp->pending_pool == NULL || ((janus_sctp_pending_message *)sctp->pending_pool->data)->size <= m->size)
+			sctp->pending_pool = g_slist_prepend(sctp->pending_pool, m);
+		else
+			sctp->pending_pool = g_slist_insert(sctp->pending_pool, m, 1);
+		sctp->pending_pool_size++;
+		return;
 	}
+	g_free(m);
 }
 
 /* usrsctp callbacks and methods */
@@ -120,16 +171,73 @@ void janus_sctp_handle_send_failed_event(struct sctp_send_failed_event *ssfe);
 void janus_sctp_handle_notification(janus_sctp_association *sctp, union sctp_notification *notif, size_t n);
 
 /* We need to keep a map of associations with random IDs, as usrsctp will
- * use the pointer to our structures in the actual messages instead */
-static janus_mutex sctp_mutex;
-static GHashTable *sctp_ids = NULL;
+ * use the pointer to our structures in the actual messages instead. Since
+ * the map is looked up for each SCTP packet in either direction, it's split
+ * in shards, each with its own lock, so that associations served by
+ * different threads don't serialize on the same mutex */
+#define JANUS_SCTP_MAP_SHARDS	64
+typedef struct janus_sctp_map_shard {
+	janus_mutex mutex;
+	GHashTable *ids;
+} janus_sctp_map_shard;
+static janus_sctp_map_shard sctp_maps[JANUS_SCTP_MAP_SHARDS];
+#define janus_sctp_map_shard_get(id) (&sctp_maps[GPOINTER_TO_UINT(id) % JANUS_SCTP_MAP_SHARDS])
 static void janus_sctp_association_unref(janus_sctp_association *sctp);
 
+/* Helper to find an association from the ID usrsctp gave us: the returned
+ * association (if any) has a reference that must be released after use */
+static janus_sctp_association *janus_sctp_association_lookup(void *id) {
+	janus_sctp_map_shard *shard = janus_sctp_map_shard_get(id);
+	janus_mutex_lock(&shard->mutex);
+	janus_sctp_association *sctp = shard->ids ? g_hash_table_lookup(shard->ids, id) : NULL;
+	if(sctp != NULL)
+		janus_refcount_increase(&sctp->ref);
+	janus_mutex_unlock(&shard->mutex);
+	return sctp;
+}
+
+#ifdef HAVE_USRSCTP_NOTHREADS
+/* When the timer interval is configured, usrsctp doesn't start threads of
+ * its own, and we take care of triggering its timers here instead */
+static int sctp_timer_interval = 0;
+static volatile gint sctp_timers_running = 0;
+static GThread *sctp_timers_thread = NULL;
+static gpointer janus_sctp_timers_thread(gpointer data) {
+	JANUS_LOG(LOG_VERB, "SCTP timers thread started (%d ms)\n", sctp_timer_interval);
+	gint64 last = janus_get_monotonic_time();
+	while(g_atomic_int_get(&sctp_timers_running)) {
+		g_usleep(sctp_timer_interval*1000);
+		gint64 now = janus_get_monotonic_time();
+		uint32_t elapsed = (uint32_t)((now-last)/1000);
+		if(elapsed == 0)
+			continue;
+		usrsctp_handle_timers(elapsed);
+		last += (gint64)elapsed*1000;
+	}
+	JANUS_LOG(LOG_VERB, "SCTP timers thread leaving\n");
+	return NULL;
+}
+#endif
+
 /* SCTP management code */
 static gboolean sctp_running;
-int janus_sctp_init(void) {
+int janus_sctp_init(int timer_interval) {
 	/* Initialize the SCTP stack */
+#ifdef HAVE_USRSCTP_NOTHREADS
+	if(timer_interval > 0) {
+		sctp_timer_interval = timer_interval;
+		usrsctp_init_nothreads(0, janus_sctp_data_to_dtls, NULL);
+	} else {
+		usrsctp_init(0, janus_sctp_data_to_dtls, NULL);
+	}
+#else
+	if(timer_interval > 0) {
+		JANUS_LOG(LOG_WARN, "usrsctp can't be initialized without threads, ignoring SCTP timer interval\n");
+	}
 	usrsctp_init(0, janus_sctp_data_to_dtls, NULL);
+#endif
+	/* This is a global setting, so there's no need to do it for each association */
+	usrsctp_sysctl_set_sctp_ecn_enable(0);
 	sctp_running = TRUE;
 
 #ifdef DEBUG_SCTP
@@ -140,18 +248,47 @@ int janus_sctp_init(void) {
 #endif
 
 	/* Create a map of local IDs too, to map them to our SCTP associations */
-	janus_mutex_init(&sctp_mutex);
-	sctp_ids = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_sctp_association_unref);
+	int i = 0;
+	for(i = 0; i < JANUS_SCTP_MAP_SHARDS; i++) {
+		janus_mutex_init(&sctp_maps[i].mutex);
+		sctp_maps[i].ids = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_sctp_association_unref);
+	}
+
+#ifdef HAVE_USRSCTP_NOTHREADS
+	if(sctp_timer_interval > 0) {
+		GError *error = NULL;
+		g_atomic_int_set(&sctp_timers_running, 1);
+		sctp_timers_thread = g_thread_try_new("sctp timers", janus_sctp_timers_thread, NULL, &error);
+		if(error != NULL) {
+			g_atomic_int_set(&sctp_timers_running, 0);
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the SCTP timers thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			return -1;
+		}
+	}
+#endif
 
 	return 0;
 }
 
 void janus_sctp_deinit(void) {
+#ifdef HAVE_USRSCTP_NOTHREADS
+	if(sctp_timers_thread != NULL) {
+		g_atomic_int_set(&sctp_timers_running, 0);
+		g_thread_join(sctp_timers_thread);
+		sctp_timers_thread = NULL;
+	}
+#endif
 	usrsctp_finish();
 	sctp_running = FALSE;
-	janus_mutex_lock(&sctp_mutex);
-	g_hash_table_unref(sctp_ids);
-	janus_mutex_unlock(&sctp_mutex);
+	int i = 0;
+	for(i = 0; i < JANUS_SCTP_MAP_SHARDS; i++) {
+		janus_mutex_lock(&sctp_maps[i].mutex);
+		g_hash_table_unref(sctp_maps[i].ids);
+		sctp_maps[i].ids = NULL;
+		janus_mutex_unlock(&sctp_maps[i].mutex);
+	}
 }
 
 static void janus_sctp_association_unref(janus_sctp_association *sctp) {
@@ -162,10 +299,13 @@ static void janus_sctp_association_unref(janus_sctp_association *sctp) {
 static void janus_sctp_association_free(const janus_refcount *sctp_ref) {
 	janus_sctp_association *sctp = janus_refcount_containerof(sctp_ref, janus_sctp_association, ref);
 	/* This association can be destroyed, free all the resources */
+	g_atomic_int_add(&sctp->handle->data_pending, -g_atomic_int_get(&sctp->pending_bytes));
+	janus_memory_add(&sctp->handle->memory, JANUS_MEMORY_SCTP_PENDING, -g_atomic_int_get(&sctp->pending_bytes));
 	janus_refcount_decrease(&sctp->handle->ref);
 	janus_refcount_decrease(&sctp->dtls->ref);
 	if(sctp->pending_messages != NULL)
-		g_queue_free_full(sctp->pending_messages, (GDestroyNotify)janus_sctp_pending_message_free);
+		g_queue_free_full(sctp->pending_messages, (GDestroyNotify)g_free);
+	g_slist_free_full(sctp->pending_pool, (GDestroyNotify)g_free);
 #ifdef DEBUG_SCTP
 	if(sctp->debug_dump != NULL)
 		fclose(sctp->debug_dump);
@@ -228,20 +368,22 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 	/* Create a unique ID to map locally: this is what we'll pass to
 	 * usrsctp_socket, which means that's what we'll get in callbacks
 	 * too: we can then use the map to retrieve the actual struct */
-	janus_mutex_lock(&sctp_mutex);
 	while(sctp->map_id == 0) {
-		sctp->map_id = janus_random_uint32();
-		if(g_hash_table_lookup(sctp_ids, GUINT_TO_POINTER(sctp->map_id)) != NULL) {
-			/* ID already taken, try another one */
-			sctp->map_id = 0;
+		uint32_t map_id = janus_random_uint32();
+		if(map_id == 0)
+			continue;
+		janus_sctp_map_shard *shard = janus_sctp_map_shard_get(GUINT_TO_POINTER(map_id));
+		janus_mutex_lock(&shard->mutex);
+		/* If the ID is already taken, we'll try another one */
+		if(g_hash_table_lookup(shard->ids, GUINT_TO_POINTER(map_id)) == NULL) {
+			sctp->map_id = map_id;
+			janus_refcount_increase(&sctp->ref);
+			g_hash_table_insert(shard->ids, GUINT_TO_POINTER(sctp->map_id), sctp);
 		}
+		janus_mutex_unlock(&shard->mutex);
 	}
-	janus_refcount_increase(&sctp->ref);
-	g_hash_table_insert(sctp_ids, GUINT_TO_POINTER(sctp->map_id), sctp);
-	janus_mutex_unlock(&sctp_mutex);
 
 	usrsctp_register_address(GUINT_TO_POINTER(sctp->map_id));
-	usrsctp_sysctl_set_sctp_ecn_enable(0);
 	if((sock = usrsctp_socket(AF_CONN, SOCK_STREAM, IPPROTO_SCTP, janus_sctp_incoming_data, NULL, 0,
 			GUINT_TO_POINTER(sctp->map_id))) == NULL) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error creating usrsctp socket... (%d)\n", sctp->handle_id, errno);
@@ -349,9 +491,11 @@ void janus_sctp_association_destroy(janus_sctp_association *sctp) {
 
 	if(sctp->map_id != 0) {
 		usrsctp_deregister_address(GUINT_TO_POINTER(sctp->map_id));
-		janus_mutex_lock(&sctp_mutex);
-		g_hash_table_remove(sctp_ids, GUINT_TO_POINTER(sctp->map_id));
-		janus_mutex_unlock(&sctp_mutex);
+		janus_sctp_map_shard *shard = janus_sctp_map_shard_get(GUINT_TO_POINTER(sctp->map_id));
+		janus_mutex_lock(&shard->mutex);
+		if(shard->ids != NULL)
+			g_hash_table_remove(shard->ids, GUINT_TO_POINTER(sctp->map_id));
+		janus_mutex_unlock(&shard->mutex);
 	}
 	if(sctp->sock != NULL) {
 		usrsctp_shutdown(sctp->sock, SHUT_RDWR);
@@ -379,11 +523,13 @@ void janus_sctp_data_from_dtls(janus_sctp_association *sctp, char *buf, int len)
 }
 
 int janus_sctp_data_to_dtls(void *instance, void *buffer, size_t length, uint8_t tos, uint8_t set_df) {
-	janus_mutex_lock(&sctp_mutex);
-	janus_sctp_association *sctp = (janus_sctp_association *)g_hash_table_lookup(sctp_ids, instance);
-	janus_mutex_unlock(&sctp_mutex);
-	if(sctp == NULL || sctp->handle == NULL)
+	janus_sctp_association *sctp = janus_sctp_association_lookup(instance);
+	if(sctp == NULL)
 		return -1;
+	if(sctp->handle == NULL) {
+		janus_refcount_decrease(&sctp->ref);
+		return -1;
+	}
 	JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Data from SCTP to DTLS stack: %zu bytes\n", sctp->handle_id, length);
 #ifdef DEBUG_SCTP
 	if(sctp->debug_dump != NULL) {
@@ -397,14 +543,15 @@ int janus_sctp_data_to_dtls(void *instance, void *buffer, size_t length, uint8_t
 	}
 #endif
 	janus_ice_relay_sctp(sctp->handle, buffer, length);
+	janus_refcount_decrease(&sctp->ref);
 	return 0;
 }
 
 static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore addr, void *data, size_t datalen, struct sctp_rcvinfo rcv, int flags, void *ulp_info) {
-	janus_mutex_lock(&sctp_mutex);
-	janus_sctp_association *sctp = (janus_sctp_association *)g_hash_table_lookup(sctp_ids, ulp_info);
-	janus_mutex_unlock(&sctp_mutex);
+	janus_sctp_association *sctp = janus_sctp_association_lookup(ulp_info);
 	if(sctp == NULL || sctp->dtls == NULL) {
+		if(sctp != NULL)
+			janus_refcount_decrease(&sctp->ref);
 		free(data);
 		return 0;
 	}
@@ -416,27 +563,59 @@ static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore ad
 		}
 		free(data);
 	}
+	janus_refcount_decrease(&sctp->ref);
 	return 1;
 }
 
-void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len) {
+size_t janus_sctp_send_pending(janus_sctp_association *sctp) {
 	if(sctp == NULL)
-		return;
+		return 0;
 	if(sctp->pending_messages != NULL && !g_queue_is_empty(sctp->pending_messages)) {
-		/* Messages waiting in the queue, send those first */
+		/* Messages waiting in the queue, send as many as we can */
 		janus_sctp_pending_message *m = g_queue_peek_head(sctp->pending_messages);
 		while(m != NULL) {
 			int res = janus_sctp_send_text_or_binary(sctp, m->id, m->textdata, m->buf, m->len);
 			if(res == -2) {
-				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Got EAGAIN when trying to resend pending message on channel %"SCNu16"\n",
+				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Got EAGAIN when trying to resend pending message on channel %"SCNu16"\n",
 					sctp->handle_id, m->id);
 				break;
 			}
 			(void)g_queue_pop_head(sctp->pending_messages);
-			janus_sctp_pending_message_free(m);
+			janus_sctp_pending_message_release(sctp, m);
 			m = g_queue_peek_head(sctp->pending_messages);
 		}
+		if(m == NULL && sctp->pending_dropped > 0) {
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] SCTP pending queue drained, %"SCNu64" messages were dropped\n",
+				sctp->handle_id, sctp->pending_dropped);
+			sctp->pending_dropped = 0;
+		}
 	}
+	return (size_t)g_atomic_int_get(&sctp->pending_bytes);
+}
+
+size_t janus_sctp_get_pending(janus_sctp_association *sctp) {
+	return sctp ? (size_t)g_atomic_int_get(&sctp->pending_bytes) : 0;
+}
+
+gboolean janus_sctp_notify_writable(janus_sctp_association *sctp) {
+	size_t pending = janus_sctp_send_pending(sctp);
+	return (sctp_pending_policy != janus_sctp_pending_notify || pending == 0);
+}
+
+json_t *janus_sctp_pending_summary(janus_sctp_association *sctp) {
+	if(sctp == NULL)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "pending-messages", json_integer(sctp->pending_messages ? g_queue_get_length(sctp->pending_messages) : 0));
+	json_object_set_new(info, "pending-bytes", json_integer(g_atomic_int_get(&sctp->pending_bytes)));
+	json_object_set_new(info, "dropped-messages", json_integer(sctp->pending_dropped_total));
+	return info;
+}
+
+void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len) {
+	if(sctp == NULL)
+		return;
+	(void)janus_sctp_send_pending(sctp);
 	if(buf == NULL || len <= 0)
 		return;
 	if(label == NULL)
@@ -476,25 +655,19 @@ void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *proto
 	/* Send the data, whether it's text or binary */
 	if(sctp->pending_messages != NULL && !g_queue_is_empty(sctp->pending_messages)) {
 		/* We couldn't send all pending messages, queue the new one as well */
-		if(buf != NULL && len > 0) {
-			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Couldn't send all pending messages, queueing new message\n",
+		if(janus_sctp_pending_message_queue(sctp, i, textdata, buf, len)) {
+			JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Couldn't send all pending messages, queueing new message\n",
 				sctp->handle_id);
-			janus_sctp_pending_message *m = janus_sctp_pending_message_create(i, textdata, buf, len);
-			if(sctp->pending_messages == NULL)
-				sctp->pending_messages = g_queue_new();
-			g_queue_push_tail(sctp->pending_messages, m);
 		}
 		return;
 	}
 	int res = janus_sctp_send_text_or_binary(sctp, i, textdata, buf, len);
 	if(res == -2) {
 		/* Delivery failed with an EAGAIN, queue and retry later */
-		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Got EAGAIN when trying to send message on channel %"SCNu16", retrying later\n",
-			sctp->handle_id, i);
-		janus_sctp_pending_message *m = janus_sctp_pending_message_create(i, textdata, buf, len);
-		if(sctp->pending_messages == NULL)
-			sctp->pending_messages = g_queue_new();
-		g_queue_push_tail(sctp->pending_messages, m);
+		if(janus_sctp_pending_message_queue(sctp, i, textdata, buf, len)) {
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got EAGAIN when trying to send message on channel %"SCNu16", retrying later\n",
+				sctp->handle_id, i);
+		}
 	}
 }
 
@@ -42,18 +42,41 @@
 #include <errno.h>
 #include <usrsctp.h>
 #include <glib.h>
+#include <jansson.h>
 
 #include "mutex.h"
 #include "refcount.h"
 
 
 /*! \brief SCTP stuff initialization
+ * @param[in] timer_interval How often (in ms) to trigger the usrsctp timers
+ * from a thread of our own, rather than letting usrsctp start its own threads
+ * (0 keeps the usrsctp defaults; only available when libusrsctp supports it)
  * \returns 0 on success, a negative integer otherwise */
-int janus_sctp_init(void);
+int janus_sctp_init(int timer_interval);
 
 /*! \brief SCTP stuff de-initialization */
 void janus_sctp_deinit(void);
 
+/*! \brief Default limit on the bytes queued per association, when the SCTP stack can't take more */
+#define JANUS_SCTP_DEFAULT_PENDING_LIMIT	(1024*1024)
+
+/*! \brief What to do when the queue of pending messages of an association is full */
+typedef enum janus_sctp_pending_policy {
+	/*! \brief Drop new messages until there's room again, and tell plugins
+	 * data can be sent whenever the SCTP stack is writable (as before) */
+	janus_sctp_pending_drop = 0,
+	/*! \brief Drop new messages until there's room again, but only tell
+	 * plugins data can be sent when the queue has been drained, so that
+	 * they can hold messages back rather than having them buffered here */
+	janus_sctp_pending_notify
+} janus_sctp_pending_policy;
+
+/*! \brief Method to configure how many bytes can be queued per association
+ * @param[in] limit The maximum number of bytes to queue (0 means no limit)
+ * @param[in] policy What to do when the limit is reached */
+void janus_sctp_set_pending_limit(size_t limit, janus_sctp_pending_policy policy);
+
 
 #define BUFFER_SIZE (1<<16)
 #define NUMBER_OF_CHANNELS (150)
@@ -129,6 +152,14 @@ typedef struct janus_sctp_association {
 	size_t offset;
 	/*! \brief Buffer of pending messages */
 	GQueue *pending_messages;
+	/*! \brief How many bytes are waiting in the buffer of pending messages */
+	volatile gint pending_bytes;
+	/*! \brief Messages that have been sent, kept around to be reused */
+	GSList *pending_pool;
+	/*! \brief How many messages are in the pool */
+	guint pending_pool_size;
+	/*! \brief Messages dropped since the buffer was last drained, and in total */
+	guint64 pending_dropped, pending_dropped_total;
 #ifdef DEBUG_SCTP
 	FILE *debug_dump;
 #endif
@@ -215,6 +246,28 @@ void janus_sctp_data_from_dtls(janus_sctp_association *sctp, char *buf, int len)
  * \param[in] len The buffer length */
 void janus_sctp_send_data(janus_sctp_association *sctp, char *label, char *protocol, gboolean textdata, char *buf, int len);
 
+/*! \brief Method to try and send the messages that had to be queued
+ * \param[in] sctp The SCTP association to flush
+ * \returns How many bytes are still waiting to be sent */
+size_t janus_sctp_send_pending(janus_sctp_association *sctp);
+
+/*! \brief Method to get how many bytes are waiting to be sent on an association
+ * @note This can be called from any thread
+ * \param[in] sctp The SCTP association to query
+ * \returns How many bytes are waiting in the queue of pending messages */
+size_t janus_sctp_get_pending(janus_sctp_association *sctp);
+
+/*! \brief Method to flush an association that became writable, and check
+ * whether plugins should be told they can send data again
+ * \param[in] sctp The SCTP association that became writable
+ * \returns TRUE if plugins should be notified, FALSE otherwise */
+gboolean janus_sctp_notify_writable(janus_sctp_association *sctp);
+
+/*! \brief Method to get a summary of the queue of pending messages of an association, for the Admin API
+ * \param[in] sctp The SCTP association to query
+ * \returns A json_t object with the summary */
+json_t *janus_sctp_pending_summary(janus_sctp_association *sctp);
+
 #endif
 
 #endif
@@ -0,0 +1,135 @@
+/*! \file    sdp-bench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    SDP parsing and writing benchmark
+ * \details  Standalone tool that measures how long the SDP utilities take
+ * to parse an SDP and write it back, which the core and plugins do several
+ * times for each negotiation. It takes the SDPs to use as arguments (e.g.,
+ * the samples in the \c fuzzers/corpora folder), and can make them larger
+ * by repeating their m-lines, to get an idea of how renegotiations in big
+ * rooms (e.g., a VideoRoom subscription to 50 publishers) perform:
+ *
+\verbatim
+./sdp-bench fuzzers/corpora/sdp_fuzzer/2webrtc/firefox-*.sdp
+./sdp-bench -m 50 -n 2000 fuzzers/corpora/sdp_fuzzer/2webrtc/firefox-1.sdp
+\endverbatim
+ *
+ * Since the numbers depend on the machine, they're mostly useful to
+ * compare different versions of the code on the same box.
+ *
+ * \ingroup tools
+ * \ref tools
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "debug.h"
+#include "sdp-utils.h"
+
+int janus_log_level = LOG_NONE;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+int refcount_debug = 0;
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* Repeat the m-lines of an SDP, to get a bigger one */
+static char *sdp_bench_grow(const char *sdp, int mlines) {
+	const char *first = strstr(sdp, "\nm=");
+	if(first == NULL || mlines < 2)
+		return g_strdup(sdp);
+	first++;
+	GString *grown = g_string_new_len(sdp, first - sdp);
+	int i = 0;
+	for(i = 0; i < mlines; i++)
+		g_string_append(grown, first);
+	return g_string_free(grown, FALSE);
+}
+
+static void sdp_bench_run(const char *name, const char *sdp, int num) {
+	char error[512];
+	janus_sdp *parsed = janus_sdp_parse(sdp, error, sizeof(error));
+	if(parsed == NULL) {
+		printf("%-32s (invalid SDP: %s)\n", name, error);
+		return;
+	}
+	guint mlines = g_list_length(parsed->m_lines);
+	janus_sdp_destroy(parsed);
+	/* Parse */
+	int i = 0;
+	double start = now_seconds();
+	for(i = 0; i < num; i++) {
+		parsed = janus_sdp_parse(sdp, error, sizeof(error));
+		janus_sdp_destroy(parsed);
+	}
+	double parse = now_seconds() - start;
+	/* Write */
+	parsed = janus_sdp_parse(sdp, error, sizeof(error));
+	size_t written = 0;
+	start = now_seconds();
+	for(i = 0; i < num; i++) {
+		char *text = janus_sdp_write(parsed);
+		written = strlen(text);
+		g_free(text);
+	}
+	double write = now_seconds() - start;
+	janus_sdp_destroy(parsed);
+	printf("%-32s %8zu %6u %12.2f %12.2f %10.1f\n", name, strlen(sdp), mlines,
+		parse*1e6/num, write*1e6/num, written*num/(parse+write)/1e6);
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-n iterations] [-m mlines] file.sdp [file2.sdp ...]\n", name);
+	printf("  -n  How many times to parse and write each SDP (default: 10000)\n");
+	printf("  -m  Repeat the m-lines of each SDP that many times (default: 1, as they are)\n");
+}
+
+int main(int argc, char *argv[]) {
+	int num = 10000, mlines = 1, opt = 0;
+	while((opt = getopt(argc, argv, "n:m:h")) != -1) {
+		switch(opt) {
+			case 'n':
+				num = atoi(optarg);
+				break;
+			case 'm':
+				mlines = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if(optind >= argc || num < 1 || mlines < 1) {
+		usage(argv[0]);
+		exit(1);
+	}
+	printf("%d iterations per SDP, m-lines repeated %d time(s)\n", num, mlines);
+	printf("%-32s %8s %6s %12s %12s %10s\n", "sdp", "bytes", "m=", "parse (us)", "write (us)", "MB/s");
+	int i = 0;
+	for(i = optind; i < argc; i++) {
+		gchar *contents = NULL;
+		if(!g_file_get_contents(argv[i], &contents, NULL, NULL)) {
+			fprintf(stderr, "Couldn't read %s\n", argv[i]);
+			continue;
+		}
+		char *sdp = sdp_bench_grow(contents, mlines);
+		g_free(contents);
+		char *name = g_path_get_basename(argv[i]);
+		sdp_bench_run(name, sdp, num);
+		g_free(name);
+		g_free(sdp);
+	}
+	return 0;
+}
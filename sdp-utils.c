@@ -100,12 +100,47 @@ static void janus_sdp_mline_free(const janus_refcount *mline_ref) {
 
 static void janus_sdp_attribute_free(const janus_refcount *attr_ref) {
 	janus_sdp_attribute *attr = janus_refcount_containerof(attr_ref, janus_sdp_attribute, ref);
-	/* This SDP attribute instance can be destroyed, free all the resources */
-	g_free(attr->name);
-	g_free(attr->value);
+	/* This SDP attribute instance can be destroyed, free all the resources
+	 * (unless they were allocated together with the attribute itself) */
+	if(attr->name != (char *)attr + sizeof(janus_sdp_attribute)) {
+		g_free(attr->name);
+		g_free(attr->value);
+	}
 	g_free(attr);
 }
 
+/* Attributes we parse are allocated in a single block, with name and
+ * value right after the struct: one allocation (and one free) rather than
+ * three, which adds up quickly with SDPs that have hundreds of them */
+static janus_sdp_attribute *janus_sdp_attribute_new_packed(const char *name, size_t namelen, const char *value) {
+	size_t valuelen = value ? strlen(value) : 0;
+	janus_sdp_attribute *a = g_malloc(sizeof(janus_sdp_attribute) + namelen + 1 + (value ? valuelen + 1 : 0));
+	g_atomic_int_set(&a->destroyed, 0);
+	janus_refcount_init(&a->ref, janus_sdp_attribute_free);
+	a->name = (char *)a + sizeof(janus_sdp_attribute);
+	memcpy(a->name, name, namelen);
+	a->name[namelen] = '\0';
+	a->value = NULL;
+	if(value) {
+		a->value = a->name + namelen + 1;
+		memcpy(a->value, value, valuelen + 1);
+	}
+	a->direction = JANUS_SDP_DEFAULT;
+	return a;
+}
+
+/* Helper to parse the direction of an attribute value (e.g., extmap) */
+static janus_sdp_mdirection janus_sdp_attribute_parse_direction(const char *value) {
+	janus_sdp_mdirection direction = JANUS_SDP_DEFAULT;
+	if(strstr(value, "/sendonly"))
+		direction = JANUS_SDP_SENDONLY;
+	else if(strstr(value, "/recvonly"))
+		direction = JANUS_SDP_RECVONLY;
+	if(strstr(value, "/inactive"))
+		direction = JANUS_SDP_INACTIVE;
+	return direction;
+}
+
 
 /* SDP and m-lines/attributes code */
 janus_sdp_mline *janus_sdp_mline_create(janus_sdp_mtype type, guint16 port, const char *proto, janus_sdp_mdirection direction) {
@@ -259,18 +294,21 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 	gboolean success = TRUE;
 	janus_sdp_mline *mline = NULL;
 
-	gchar **parts = g_strsplit(sdp, "\n", -1);
-	if(parts) {
-		int index = 0;
-		char *line = NULL, *cr = NULL;
-		while(success && (line = parts[index]) != NULL) {
+	/* We work on a single copy of the SDP, that we terminate line by line
+	 * in place: lists are built backwards (appending would mean walking
+	 * them each time) and reversed when we're done */
+	char *copy = g_strdup(sdp);
+	if(copy) {
+		char *line = copy, *next = NULL, *cr = NULL;
+		while(success && line != NULL) {
+			next = strchr(line, '\n');
+			if(next != NULL)
+				*next++ = '\0';
 			cr = strchr(line, '\r');
 			if(cr != NULL)
 				*cr = '\0';
 			if(*line == '\0') {
-				if(cr != NULL)
-					*cr = '\r';
-				index++;
+				line = next;
 				continue;
 			}
 			if(strlen(line) < 3) {
@@ -286,6 +324,10 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 				break;
 			}
 			char c = *line;
+			if(mline != NULL && c == 'm') {
+				/* Current m-line ended, back to global parsing */
+				mline = NULL;
+			}
 			if(mline == NULL) {
 				/* Global stuff */
 				switch(c) {
@@ -374,34 +416,22 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 						break;
 					}
 					case 'a': {
-						janus_sdp_attribute *a = g_malloc0(sizeof(janus_sdp_attribute));
-						janus_refcount_init(&a->ref, janus_sdp_attribute_free);
+						janus_sdp_attribute *a = NULL;
 						line += 2;
 						char *semicolon = strchr(line, ':');
 						if(semicolon == NULL) {
-							a->name = g_strdup(line);
-							a->value = NULL;
+							a = janus_sdp_attribute_new_packed(line, strlen(line), NULL);
 						} else {
 							if(*(semicolon+1) == '\0') {
-								janus_sdp_attribute_destroy(a);
 								if(error)
 									g_snprintf(error, errlen, "Invalid a= line: %s", line);
 								success = FALSE;
 								break;
 							}
-							*semicolon = '\0';
-							a->name = g_strdup(line);
-							a->value = g_strdup(semicolon+1);
-							a->direction = JANUS_SDP_DEFAULT;
-							*semicolon = ':';
-							if(strstr(line, "/sendonly"))
-								a->direction = JANUS_SDP_SENDONLY;
-							else if(strstr(line, "/recvonly"))
-								a->direction = JANUS_SDP_RECVONLY;
-							if(strstr(line, "/inactive"))
-								a->direction = JANUS_SDP_INACTIVE;
+							a = janus_sdp_attribute_new_packed(line, semicolon-line, semicolon+1);
+							a->direction = janus_sdp_attribute_parse_direction(a->value);
 						}
-						imported->attributes = g_list_append(imported->attributes, a);
+						imported->attributes = g_list_prepend(imported->attributes, a);
 						break;
 					}
 					case 'm': {
@@ -432,33 +462,27 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 						m->c_ipv4 = TRUE;
 						if(m->port > 0 || m->type == JANUS_SDP_APPLICATION) {
 							/* Now let's check the payload types/formats */
-							gchar **mline_parts = g_strsplit(line+2, " ", -1);
-							if(!mline_parts) {
-								janus_sdp_mline_destroy(m);
-								if(error)
-									g_snprintf(error, errlen, "Invalid m= line (no payload types/formats): %s", line);
-								success = FALSE;
-								break;
-							}
+							const char *token = line+2, *end = NULL;
 							int mindex = 0;
-							while(mline_parts[mindex]) {
-								if(mindex < 3) {
-									/* We've parsed these before */
-									mindex++;
-									continue;
-								}
-								/* Add string fmt */
-								m->fmts = g_list_append(m->fmts, g_strdup(mline_parts[mindex]));
-								/* Add numeric payload type */
-								int ptype = atoi(mline_parts[mindex]);
-								if(ptype < 0) {
-									JANUS_LOG(LOG_ERR, "Invalid payload type (%s)\n", mline_parts[mindex]);
-								} else {
-									m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(ptype));
+							while(*token != '\0') {
+								end = strchr(token, ' ');
+								size_t toklen = end ? (size_t)(end-token) : strlen(token);
+								if(toklen > 0 && mindex++ >= 3) {
+									/* Add string fmt (we've parsed the first three tokens before) */
+									char *fmt = g_strndup(token, toklen);
+									m->fmts = g_list_prepend(m->fmts, fmt);
+									/* Add numeric payload type */
+									int ptype = atoi(fmt);
+									if(ptype < 0) {
+										JANUS_LOG(LOG_ERR, "Invalid payload type (%s)\n", fmt);
+									} else {
+										m->ptypes = g_list_prepend(m->ptypes, GINT_TO_POINTER(ptype));
+									}
 								}
-								mindex++;
+								token += toklen;
+								if(*token == ' ')
+									token++;
 							}
-							g_strfreev(mline_parts);
 							if(m->fmts == NULL || m->ptypes == NULL) {
 								janus_sdp_mline_destroy(m);
 								if(error)
@@ -467,8 +491,8 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 								break;
 							}
 						}
-						/* Append to the list of m-lines */
-						imported->m_lines = g_list_append(imported->m_lines, m);
+						/* Add to the list of m-lines */
+						imported->m_lines = g_list_prepend(imported->m_lines, m);
 						/* From now on, we parse this m-line */
 						mline = m;
 						break;
@@ -533,60 +557,49 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 						break;
 					}
 					case 'a': {
-						janus_sdp_attribute *a = g_malloc0(sizeof(janus_sdp_attribute));
-						janus_refcount_init(&a->ref, janus_sdp_attribute_free);
+						janus_sdp_attribute *a = NULL;
 						line += 2;
 						char *semicolon = strchr(line, ':');
 						if(semicolon == NULL) {
 							/* Is this a media direction attribute? */
 							janus_sdp_mdirection direction = janus_sdp_parse_mdirection(line);
 							if(direction != JANUS_SDP_INVALID) {
-								janus_sdp_attribute_destroy(a);
 								mline->direction = direction;
 								break;
 							}
-							a->name = g_strdup(line);
-							a->value = NULL;
+							a = janus_sdp_attribute_new_packed(line, strlen(line), NULL);
 						} else {
 							if(*(semicolon+1) == '\0') {
-								janus_sdp_attribute_destroy(a);
 								if(error)
 									g_snprintf(error, errlen, "Invalid a= line: %s", line);
 								success = FALSE;
 								break;
 							}
-							*semicolon = '\0';
-							a->name = g_strdup(line);
-							a->value = g_strdup(semicolon+1);
-							a->direction = JANUS_SDP_DEFAULT;
-							*semicolon = ':';
-							if(strstr(line, "/sendonly"))
-								a->direction = JANUS_SDP_SENDONLY;
-							else if(strstr(line, "/recvonly"))
-								a->direction = JANUS_SDP_RECVONLY;
-							if(strstr(line, "/inactive"))
-								a->direction = JANUS_SDP_INACTIVE;
+							a = janus_sdp_attribute_new_packed(line, semicolon-line, semicolon+1);
+							a->direction = janus_sdp_attribute_parse_direction(a->value);
 						}
-						mline->attributes = g_list_append(mline->attributes, a);
+						mline->attributes = g_list_prepend(mline->attributes, a);
 						break;
 					}
-					case 'm': {
-						/* Current m-line ended, back to global parsing */
-						mline = NULL;
-						continue;
-					}
 					default:
 						JANUS_LOG(LOG_WARN, "Ignoring '%c' property (m-line)\n", c);
 						break;
 				}
 			}
-			if(cr != NULL)
-				*cr = '\r';
-			index++;
+			line = next;
 		}
-		if(cr != NULL)
-			*cr = '\r';
-		g_strfreev(parts);
+		g_free(copy);
+	}
+	/* Put all lists back in the right order */
+	imported->attributes = g_list_reverse(imported->attributes);
+	imported->m_lines = g_list_reverse(imported->m_lines);
+	GList *temp = imported->m_lines;
+	while(temp) {
+		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
+		m->attributes = g_list_reverse(m->attributes);
+		m->fmts = g_list_reverse(m->fmts);
+		m->ptypes = g_list_reverse(m->ptypes);
+		temp = temp->next;
 	}
 	/* FIXME Do a last check: is all the stuff that's supposed to be there available? */
 	if(success && (imported->o_name == NULL || imported->o_addr == NULL || imported->s_name == NULL || imported->m_lines == NULL)) {
@@ -890,50 +903,52 @@ const char *janus_sdp_get_fmtp(janus_sdp *sdp, int pt) {
 	return NULL;
 }
 
+/* Helper to write an attribute line */
+static void janus_sdp_write_attribute(GString *sdp, janus_sdp_attribute *a) {
+	g_string_append_len(sdp, "a=", 2);
+	g_string_append(sdp, a->name);
+	if(a->value != NULL) {
+		g_string_append_c(sdp, ':');
+		g_string_append(sdp, a->value);
+	}
+	g_string_append_len(sdp, "\r\n", 2);
+}
+
 char *janus_sdp_write(janus_sdp *imported) {
 	if(!imported)
 		return NULL;
 	janus_refcount_increase(&imported->ref);
-	char *sdp = g_malloc(JANUS_BUFSIZE), buffer[512];
-	*sdp = '\0';
+	/* We append to a growing string, rather than concatenating to a fixed
+	 * size buffer: this means large SDPs are never truncated, and we don't
+	 * need to look for the end of the string for each line we add */
+	GString *sdp = g_string_sized_new(JANUS_BUFSIZE);
 	/* v= */
-	g_snprintf(buffer, sizeof(buffer), "v=%d\r\n", imported->version);
-	g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+	g_string_append_printf(sdp, "v=%d\r\n", imported->version);
 	/* o= */
-	g_snprintf(buffer, sizeof(buffer), "o=%s %"SCNu64" %"SCNu64" IN %s %s\r\n",
+	g_string_append_printf(sdp, "o=%s %"SCNu64" %"SCNu64" IN %s %s\r\n",
 		imported->o_name, imported->o_sessid, imported->o_version,
 		imported->o_ipv4 ? "IP4" : "IP6", imported->o_addr);
-	g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 	/* s= */
-	g_snprintf(buffer, sizeof(buffer), "s=%s\r\n", imported->s_name);
-	g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+	g_string_append_printf(sdp, "s=%s\r\n", imported->s_name);
 	/* t= */
-	g_snprintf(buffer, sizeof(buffer), "t=%"SCNu64" %"SCNu64"\r\n", imported->t_start, imported->t_stop);
-	g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+	g_string_append_printf(sdp, "t=%"SCNu64" %"SCNu64"\r\n", imported->t_start, imported->t_stop);
 	/* c= */
 	if(imported->c_addr != NULL) {
-		g_snprintf(buffer, sizeof(buffer), "c=IN %s %s\r\n",
+		g_string_append_printf(sdp, "c=IN %s %s\r\n",
 			imported->c_ipv4 ? "IP4" : "IP6", imported->c_addr);
-		g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 	}
 	/* a= */
 	GList *temp = imported->attributes;
 	while(temp) {
 		janus_sdp_attribute *a = (janus_sdp_attribute *)temp->data;
-		if(a->value != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "a=%s:%s\r\n", a->name, a->value);
-		} else {
-			g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", a->name);
-		}
-		g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+		janus_sdp_write_attribute(sdp, a);
 		temp = temp->next;
 	}
 	/* m= */
 	temp = imported->m_lines;
 	while(temp) {
 		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
-		g_snprintf(buffer, sizeof(buffer), "m=%s %d %s", m->type_str, m->port, m->proto);
-		g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+		g_string_append_printf(sdp, "m=%s %d %s", m->type_str, m->port, m->proto);
 		if(m->port == 0 && m->type != JANUS_SDP_APPLICATION) {
 			/* Remove all payload types/formats if we're rejecting the media */
 			g_list_free_full(m->fmts, (GDestroyNotify)g_free);
@@ -941,45 +956,41 @@ char *janus_sdp_write(janus_sdp *imported) {
 			g_list_free(m->ptypes);
 			m->ptypes = NULL;
 			m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(0));
-			g_strlcat(sdp, " 0", JANUS_BUFSIZE);
+			g_string_append_len(sdp, " 0", 2);
 		} else {
 			if(m->proto != NULL && strstr(m->proto, "RTP") != NULL) {
 				/* RTP profile, use payload types */
 				GList *ptypes = m->ptypes;
 				while(ptypes) {
-					g_snprintf(buffer, sizeof(buffer), " %d", GPOINTER_TO_INT(ptypes->data));
-					g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+					g_string_append_printf(sdp, " %d", GPOINTER_TO_INT(ptypes->data));
 					ptypes = ptypes->next;
 				}
 			} else {
 				/* Something else, use formats */
 				GList *fmts = m->fmts;
 				while(fmts) {
-					g_snprintf(buffer, sizeof(buffer), " %s", (char *)(fmts->data));
-					g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+					g_string_append_c(sdp, ' ');
+					g_string_append(sdp, (char *)(fmts->data));
 					fmts = fmts->next;
 				}
 			}
 		}
-		g_strlcat(sdp, "\r\n", JANUS_BUFSIZE);
+		g_string_append_len(sdp, "\r\n", 2);
 		/* c= */
 		if(m->c_addr != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "c=IN %s %s\r\n",
+			g_string_append_printf(sdp, "c=IN %s %s\r\n",
 				m->c_ipv4 ? "IP4" : "IP6", m->c_addr);
-			g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 		}
 		if(m->port > 0) {
 			/* b= */
 			if(m->b_name != NULL) {
-				g_snprintf(buffer, sizeof(buffer), "b=%s:%"SCNu32"\r\n", m->b_name, m->b_value);
-				g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+				g_string_append_printf(sdp, "b=%s:%"SCNu32"\r\n", m->b_name, m->b_value);
 			}
 		}
 		/* a= (note that we don't format the direction if it's JANUS_SDP_DEFAULT) */
 		const char *direction = m->direction != JANUS_SDP_DEFAULT ? janus_sdp_mdirection_str(m->direction) : NULL;
 		if(direction != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", direction);
-			g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+			g_string_append_printf(sdp, "a=%s\r\n", direction);
 		}
 		GList *temp2 = m->attributes;
 		while(temp2) {
@@ -989,18 +1000,13 @@ char *janus_sdp_write(janus_sdp *imported) {
 				temp2 = temp2->next;
 				continue;
 			}
-			if(a->value != NULL) {
-				g_snprintf(buffer, sizeof(buffer), "a=%s:%s\r\n", a->name, a->value);
-			} else {
-				g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", a->name);
-			}
-			g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+			janus_sdp_write_attribute(sdp, a);
 			temp2 = temp2->next;
 		}
 		temp = temp->next;
 	}
 	janus_refcount_decrease(&imported->ref);
-	return sdp;
+	return g_string_free(sdp, FALSE);
 }
 
 void janus_sdp_find_preferred_codecs(janus_sdp *sdp, const char **acodec, const char **vcodec) {
@@ -215,6 +215,9 @@ void janus_sdp_attribute_destroy(janus_sdp_attribute *attr);
 int janus_sdp_attribute_add_to_mline(janus_sdp_mline *mline, janus_sdp_attribute *attr);
 
 /*! \brief Method to parse an SDP string to a janus_sdp object
+ * @note The name and value of the attributes created by the parser are
+ * allocated together with the attribute itself: to change them, replace
+ * the attribute with a new one created with janus_sdp_attribute_create
  * @param[in] sdp The SDP string to parse
  * @param[in,out] error Buffer to receive a reason for an error, if any
  * @param[in] errlen The length of the error buffer
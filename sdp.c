@@ -117,6 +117,7 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 	int data = 0;
 #endif
 	gboolean rtx = FALSE;
+	int audio_red_pt = -1, video_red_pt = -1, video_ulpfec_pt = -1;
 	/* Ok, let's start with global attributes */
 	GList *temp = remote_sdp->attributes;
 	while(temp) {
@@ -551,6 +552,13 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 									g_hash_table_insert(stream->clock_rates, GINT_TO_POINTER(ptype), GUINT_TO_POINTER(clock_rate));
 								}
 							}
+							/* Take note of RED and ULPFEC, in case we offered them */
+							if(m->type == JANUS_SDP_AUDIO && strcasestr(a->value, " red/48000"))
+								audio_red_pt = ptype;
+							else if(m->type == JANUS_SDP_VIDEO && strcasestr(a->value, " red/90000"))
+								video_red_pt = ptype;
+							else if(m->type == JANUS_SDP_VIDEO && strcasestr(a->value, " ulpfec/90000"))
+								video_ulpfec_pt = ptype;
 						}
 					}
 				}
@@ -634,6 +642,27 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 		janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX);
 		stream->video_ssrc_rtx = 0;
 	}
+	/* If this is an answer to an offer where we added RED and/or ULPFEC,
+	 * check what the peer accepted: the context is never freed while the
+	 * PeerConnection is up, as the loop may be using it, we just update it */
+	if(stream->audio_red_pt > 0 || stream->video_red_pt > 0 || stream->fec != NULL) {
+		gboolean answer = !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_PROCESSING_OFFER);
+		if(stream->fec == NULL)
+			stream->fec = g_malloc0(sizeof(janus_fec_context));
+		janus_fec_context *fec = stream->fec;
+		fec->audio_red_pt = (answer && stream->audio_red_pt > 0 && audio_red_pt == stream->audio_red_pt) ?
+			stream->audio_red_pt : 0;
+		if(answer && stream->video_red_pt > 0 && video_red_pt == stream->video_red_pt &&
+				stream->video_ulpfec_pt > 0 && video_ulpfec_pt == stream->video_ulpfec_pt) {
+			fec->video_ulpfec_pt = stream->video_ulpfec_pt;
+			fec->video_red_pt = stream->video_red_pt;
+		} else {
+			fec->video_red_pt = 0;
+			fec->video_ulpfec_pt = 0;
+		}
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Audio RED %s, video RED/ULPFEC %s\n", handle->handle_id,
+			fec->audio_red_pt > 0 ? "enabled" : "disabled", fec->video_red_pt > 0 ? "enabled" : "disabled");
+	}
 	/* Cleanup */
 	g_free(ruser);
 	g_free(rpass);
@@ -643,33 +672,55 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 	return 0;	/* FIXME Handle errors better */
 }
 
+/* mDNS resolutions: the addresses names resolve to are cached for a while,
+ * and candidates for a name we're resolving already wait for that lookup,
+ * rather than starting a new one. Failures are cached too, but for less */
 typedef struct janus_sdp_mdns_candidate {
 	janus_ice_handle *handle;
 	char *candidate, *local;
-	GCancellable *cancellable;
 } janus_sdp_mdns_candidate;
-static void janus_sdp_mdns_resolved(GObject *source_object, GAsyncResult *res, gpointer user_data) {
-	/* This callback is invoked when the address is resolved */
-	janus_sdp_mdns_candidate *mc = (janus_sdp_mdns_candidate *)user_data;
-	GResolver *resolver = g_resolver_get_default();
-	GError *error = NULL;
-	GList *list = g_resolver_lookup_by_name_finish(resolver, res, &error);
-	if(mc == NULL) {
-		g_resolver_free_addresses(list);
-		g_object_unref(resolver);
-		return;
-	}
-	char *resolved = NULL;
-	if(error != NULL || list == NULL || list->data == NULL) {
-		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Error resolving mDNS address (%s): %s\n",
-			mc->handle->handle_id, mc->local, error ? error->message : "no results");
-	} else {
-		resolved = g_inet_address_to_string((GInetAddress *)list->data);
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] mDNS address (%s) resolved: %s\n",
-			mc->handle->handle_id, mc->local, resolved);
+typedef struct janus_sdp_mdns_entry {
+	char *name;
+	char *address;		/* NULL if the lookup failed, or is still in progress */
+	gboolean pending;
+	gint64 started, expires;
+	GSList *waiters;	/* Candidates waiting for the lookup to complete */
+} janus_sdp_mdns_entry;
+#define JANUS_SDP_MDNS_NEGATIVE_TTL		(5*G_USEC_PER_SEC)
+#define JANUS_SDP_MDNS_MAX_ENTRIES		4096
+static GHashTable *mdns_cache = NULL;
+static janus_mutex mdns_mutex = JANUS_MUTEX_INITIALIZER;
+static guint64 mdns_lookups = 0, mdns_failures = 0, mdns_hits = 0, mdns_coalesced = 0;
+static gint64 mdns_latency_total = 0, mdns_latency_max = 0;
+static void janus_sdp_mdns_entry_free(janus_sdp_mdns_entry *entry) {
+	g_free(entry->name);
+	g_free(entry->address);
+	g_free(entry);
+}
+static gboolean janus_sdp_mdns_entry_expired(gpointer key, gpointer value, gpointer user_data) {
+	janus_sdp_mdns_entry *entry = (janus_sdp_mdns_entry *)value;
+	return !entry->pending && entry->expires <= *(gint64 *)user_data;
+}
+
+json_t *janus_sdp_mdns_summary(void) {
+	json_t *info = json_object();
+	janus_mutex_lock(&mdns_mutex);
+	json_object_set_new(info, "cache_ttl", json_integer(janus_ice_get_mdns_cache_ttl()));
+	json_object_set_new(info, "cached", json_integer(mdns_cache ? g_hash_table_size(mdns_cache) : 0));
+	json_object_set_new(info, "lookups", json_integer(mdns_lookups));
+	json_object_set_new(info, "failures", json_integer(mdns_failures));
+	json_object_set_new(info, "cache_hits", json_integer(mdns_hits));
+	json_object_set_new(info, "coalesced", json_integer(mdns_coalesced));
+	if(mdns_lookups > 0) {
+		json_object_set_new(info, "latency_avg_ms", json_integer(mdns_latency_total/mdns_lookups/1000));
+		json_object_set_new(info, "latency_max_ms", json_integer(mdns_latency_max/1000));
 	}
-	g_resolver_free_addresses(list);
-	g_object_unref(resolver);
+	janus_mutex_unlock(&mdns_mutex);
+	json_object_set_new(info, "reachable", janus_ice_is_mdns_reachable() ? json_true() : json_false());
+	return info;
+}
+
+static void janus_sdp_mdns_candidate_done(janus_sdp_mdns_candidate *mc, const char *resolved) {
 	if(resolved != NULL && mc->handle->stream && mc->handle->app_handle &&
 			!g_atomic_int_get(&mc->handle->app_handle->stopped) &&
 			!g_atomic_int_get(&mc->handle->destroyed)) {
@@ -680,7 +731,6 @@ static void janus_sdp_mdns_resolved(GObject *source_object, GAsyncResult *res, g
 		(void)janus_sdp_parse_candidate(mc->handle->stream, mc->candidate, 1);
 		janus_mutex_unlock(&mc->handle->mutex);
 	}
-	g_free(resolved);
 	/* Get rid of the helper struct */
 	janus_refcount_decrease(&mc->handle->ref);
 	g_free(mc->candidate);
@@ -688,6 +738,114 @@ static void janus_sdp_mdns_resolved(GObject *source_object, GAsyncResult *res, g
 	g_free(mc);
 }
 
+static void janus_sdp_mdns_resolved(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	/* This callback is invoked when the address is resolved */
+	janus_sdp_mdns_entry *entry = (janus_sdp_mdns_entry *)user_data;
+	GResolver *resolver = g_resolver_get_default();
+	GError *error = NULL;
+	GList *list = g_resolver_lookup_by_name_finish(resolver, res, &error);
+	char *resolved = NULL;
+	if(error != NULL || list == NULL || list->data == NULL) {
+		JANUS_LOG(LOG_WARN, "Error resolving mDNS address (%s): %s\n",
+			entry->name, error ? error->message : "no results");
+	} else {
+		resolved = g_inet_address_to_string((GInetAddress *)list->data);
+		JANUS_LOG(LOG_VERB, "mDNS address (%s) resolved: %s\n", entry->name, resolved);
+	}
+	if(error != NULL)
+		g_error_free(error);
+	g_resolver_free_addresses(list);
+	g_object_unref(resolver);
+	/* Update the cache, and take note of who was waiting for this */
+	janus_mutex_lock(&mdns_mutex);
+	gint64 now = janus_get_monotonic_time();
+	gint64 latency = now - entry->started;
+	mdns_latency_total += latency;
+	if(latency > mdns_latency_max)
+		mdns_latency_max = latency;
+	if(resolved == NULL)
+		mdns_failures++;
+	GSList *waiters = entry->waiters;
+	entry->waiters = NULL;
+	entry->pending = FALSE;
+	entry->address = g_strdup(resolved);
+	guint ttl = janus_ice_get_mdns_cache_ttl();
+	entry->expires = now + (resolved ? (gint64)ttl*G_USEC_PER_SEC : JANUS_SDP_MDNS_NEGATIVE_TTL);
+	if(ttl == 0)
+		g_hash_table_remove(mdns_cache, entry->name);
+	janus_mutex_unlock(&mdns_mutex);
+	/* Now we can parse the candidates again, with the resolved address */
+	GSList *temp = waiters;
+	while(temp) {
+		janus_sdp_mdns_candidate_done((janus_sdp_mdns_candidate *)temp->data, resolved);
+		temp = temp->next;
+	}
+	g_slist_free(waiters);
+	g_free(resolved);
+}
+
+/* Resolve the mDNS address of a candidate: returns a copy of the address if
+ * it was cached, or NULL if the candidate is being (or can't be) resolved */
+static char *janus_sdp_mdns_resolve(janus_ice_handle *handle, const char *candidate, const char *name) {
+	janus_mutex_lock(&mdns_mutex);
+	if(mdns_cache == NULL) {
+		mdns_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, (GDestroyNotify)janus_sdp_mdns_entry_free);
+	}
+	gint64 now = janus_get_monotonic_time();
+	janus_sdp_mdns_entry *entry = g_hash_table_lookup(mdns_cache, name);
+	if(entry != NULL && !entry->pending && entry->expires <= now) {
+		g_hash_table_remove(mdns_cache, name);
+		entry = NULL;
+	}
+	if(entry != NULL && !entry->pending) {
+		/* We resolved this recently (or failed to) */
+		mdns_hits++;
+		char *address = g_strdup(entry->address);
+		janus_mutex_unlock(&mdns_mutex);
+		if(address == NULL) {
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] mDNS address (%s) failed to resolve recently, ignoring candidate\n",
+				handle->handle_id, name);
+		} else {
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] mDNS address (%s) resolved from cache: %s\n",
+				handle->handle_id, name, address);
+		}
+		return address;
+	}
+	janus_sdp_mdns_candidate *mc = g_malloc(sizeof(janus_sdp_mdns_candidate));
+	janus_refcount_increase(&handle->ref);
+	mc->handle = handle;
+	mc->candidate = g_strdup(candidate);
+	mc->local = g_strdup(name);
+	if(entry != NULL) {
+		/* There's a lookup in progress already, wait for that */
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] mDNS address (%s) already being resolved, waiting\n",
+			handle->handle_id, name);
+		mdns_coalesced++;
+		entry->waiters = g_slist_append(entry->waiters, mc);
+		janus_mutex_unlock(&mdns_mutex);
+		return NULL;
+	}
+	/* We'll resolve this address asynchronously, in order not to keep this thread busy */
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Resolving mDNS address (%s) asynchronously\n",
+		handle->handle_id, name);
+	if(g_hash_table_size(mdns_cache) >= JANUS_SDP_MDNS_MAX_ENTRIES)
+		g_hash_table_foreach_remove(mdns_cache, janus_sdp_mdns_entry_expired, &now);
+	entry = g_malloc0(sizeof(janus_sdp_mdns_entry));
+	entry->name = g_strdup(name);
+	entry->pending = TRUE;
+	entry->started = now;
+	entry->waiters = g_slist_append(NULL, mc);
+	g_hash_table_insert(mdns_cache, entry->name, entry);
+	mdns_lookups++;
+	janus_mutex_unlock(&mdns_mutex);
+	GResolver *resolver = g_resolver_get_default();
+	g_resolver_lookup_by_name_async(resolver, name, NULL,
+		(GAsyncReadyCallback)janus_sdp_mdns_resolved, entry);
+	g_object_unref(resolver);
+	return NULL;
+}
+
 int janus_sdp_parse_candidate(void *ice_stream, const char *candidate, int trickle) {
 	if(ice_stream == NULL || candidate == NULL)
 		return -1;
@@ -721,24 +879,20 @@ int janus_sdp_parse_candidate(void *ice_stream, const char *candidate, int trick
 		if(strstr(rip, ".local")) {
 			/* The IP is actually an mDNS address, try to resolve it
 			 * https://tools.ietf.org/html/draft-ietf-rtcweb-mdns-ice-candidates-04 */
-			if(!janus_ice_is_mdns_enabled()) {
-				/* ...unless mDNS resolution is disabled, in which case ignore this candidate */
+			if(!janus_ice_is_mdns_enabled() || !janus_ice_is_mdns_reachable()) {
+				/* ...unless mDNS resolution is disabled (or pointless), in which case ignore this candidate */
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"] mDNS candidate ignored\n", handle->handle_id);
 				return 0;
 			}
-			/* We'll resolve this address asynchronously, in order not to keep this thread busy */
-			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Resolving mDNS address (%s) asynchronously\n",
-				handle->handle_id, rip);
-			janus_sdp_mdns_candidate *mc = g_malloc(sizeof(janus_sdp_mdns_candidate));
-			janus_refcount_increase(&handle->ref);
-			mc->handle = handle;
-			mc->candidate = g_strdup(candidate);
-			mc->local = g_strdup(rip);
-			mc->cancellable = NULL;
-			GResolver *resolver = g_resolver_get_default();
-			g_resolver_lookup_by_name_async(resolver, rip, NULL,
-				(GAsyncReadyCallback)janus_sdp_mdns_resolved, mc);
-			return 0;
+			char *resolved = janus_sdp_mdns_resolve(handle, candidate, rip);
+			if(resolved == NULL)
+				return 0;
+			/* We had this address cached already, parse the candidate with it right away */
+			char *fixed = janus_string_replace(g_strdup(candidate), rip, resolved);
+			g_free(resolved);
+			res = janus_sdp_parse_candidate(stream, fixed, trickle);
+			g_free(fixed);
+			return res;
 		}
 		/* Add remote candidate */
 		component = stream->component;
@@ -870,7 +1024,7 @@ int janus_sdp_parse_candidate(void *ice_stream, const char *candidate, int trick
 				/* Save for the summary, in case we need it */
 				component->remote_candidates = g_slist_append(component->remote_candidates, g_strdup(candidate));
 				/* Notify event handlers */
-				if(janus_events_is_enabled()) {
+				if(janus_events_is_wanted(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_RCAND)) {
 					janus_session *session = (janus_session *)handle->session;
 					json_t *info = json_object();
 					json_object_set_new(info, "remote-candidate", json_string(candidate));
@@ -1189,6 +1343,82 @@ int janus_sdp_anonymize(janus_sdp *anon) {
 	return 0;
 }
 
+/* Pick a dynamic payload type no m-line (or rtx mapping) is using yet */
+static int janus_sdp_fec_pick_pt(janus_sdp *anon, janus_ice_stream *stream, int preferred) {
+	int pt = preferred > 0 ? preferred : 127, tries = 0;
+	GList *rtx_ptypes = stream->rtx_payload_types ? g_hash_table_get_values(stream->rtx_payload_types) : NULL;
+	for(tries=0; tries<32; tries++) {
+		gboolean used = (g_list_find(rtx_ptypes, GINT_TO_POINTER(pt)) != NULL);
+		GList *temp = anon->m_lines;
+		while(temp && !used) {
+			janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
+			if(g_list_find(m->ptypes, GINT_TO_POINTER(pt)))
+				used = TRUE;
+			temp = temp->next;
+		}
+		if(!used) {
+			g_list_free(rtx_ptypes);
+			return pt;
+		}
+		pt--;
+		if(pt < 96)
+			pt = 127;
+	}
+	g_list_free(rtx_ptypes);
+	return -1;
+}
+
+void janus_sdp_add_fec(void *ice_handle, janus_sdp *anon) {
+	if(!ice_handle || !anon)
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)ice_handle;
+	janus_ice_stream *stream = handle->stream;
+	if(!stream)
+		return;
+	/* We only protect what we send, so don't touch m-lines the peer sends on */
+	janus_sdp_mline *m = janus_sdp_mline_find(anon, JANUS_SDP_AUDIO);
+	if(m && m->port > 0 && m->direction == JANUS_SDP_SENDONLY) {
+		int opus_pt = janus_sdp_get_codec_pt(anon, "opus");
+		if(opus_pt > 0 && g_list_find(m->ptypes, GINT_TO_POINTER(opus_pt))) {
+			int red_pt = janus_sdp_fec_pick_pt(anon, stream, stream->audio_red_pt);
+			if(red_pt > 0) {
+				stream->audio_red_pt = red_pt;
+				m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(red_pt));
+				janus_sdp_attribute *a = janus_sdp_attribute_create("rtpmap", "%d red/48000/2", red_pt);
+				m->attributes = g_list_append(m->attributes, a);
+				a = janus_sdp_attribute_create("fmtp", "%d %d/%d", red_pt, opus_pt, opus_pt);
+				m->attributes = g_list_append(m->attributes, a);
+			}
+		}
+	}
+	m = janus_sdp_mline_find(anon, JANUS_SDP_VIDEO);
+	if(m && m->port > 0 && m->direction == JANUS_SDP_SENDONLY && m->ptypes) {
+		int red_pt = janus_sdp_fec_pick_pt(anon, stream, stream->video_red_pt);
+		if(red_pt > 0) {
+			m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(red_pt));
+			int ulpfec_pt = janus_sdp_fec_pick_pt(anon, stream, stream->video_ulpfec_pt);
+			if(ulpfec_pt < 0) {
+				m->ptypes = g_list_remove(m->ptypes, GINT_TO_POINTER(red_pt));
+			} else {
+				stream->video_red_pt = red_pt;
+				stream->video_ulpfec_pt = ulpfec_pt;
+				m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(ulpfec_pt));
+				janus_sdp_attribute *a = janus_sdp_attribute_create("rtpmap", "%d red/90000", red_pt);
+				m->attributes = g_list_append(m->attributes, a);
+				a = janus_sdp_attribute_create("rtpmap", "%d ulpfec/90000", ulpfec_pt);
+				m->attributes = g_list_append(m->attributes, a);
+				/* Retransmissions of RED packets need an rtx payload type of their own */
+				if(stream->rtx_payload_types != NULL &&
+						g_hash_table_lookup(stream->rtx_payload_types, GINT_TO_POINTER(red_pt)) == NULL) {
+					int rtx_pt = janus_sdp_fec_pick_pt(anon, stream, 0);
+					if(rtx_pt > 0)
+						g_hash_table_insert(stream->rtx_payload_types, GINT_TO_POINTER(red_pt), GINT_TO_POINTER(rtx_pt));
+				}
+			}
+		}
+	}
+}
+
 char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 	if(ice_handle == NULL || anon == NULL)
 		return NULL;
@@ -26,6 +26,7 @@
 
 
 #include <inttypes.h>
+#include <jansson.h>
 
 #include "sdp-utils.h"
 
@@ -64,6 +65,11 @@ int janus_sdp_process(void *handle, janus_sdp *sdp, gboolean update);
  * @param[in] trickle Whether this is a trickle candidate, or coming from the SDP
  * @returns 0 in case of success, a non-zero integer in case of an error */
 int janus_sdp_parse_candidate(void *stream, const char *candidate, int trickle);
+/*! \brief Method to get a summary of the mDNS resolutions done for candidates so far
+ * \details Includes how many lookups were done, how many candidates were served by the cache
+ * or waited for a lookup already in progress, and how long the lookups took
+ * @returns A JSON object */
+json_t *janus_sdp_mdns_summary(void);
 
 /*! \brief Method to parse a SSRC group attribute
  * \details This method will parse a SSRC group attribute, and set the parsed values for the peer
@@ -86,6 +92,12 @@ int janus_sdp_parse_ssrc(void *stream, const char *ssrc_attr, int video);
  * @returns 0 in case of success, a non-zero integer in case of an error */
 int janus_sdp_anonymize(janus_sdp *sdp);
 
+/*! \brief Method to add RED (for Opus) and RED+ULPFEC (for video) to the sendonly m-lines of an offer, for the core to generate
+ * \note The payload types are saved in the ICE stream, and only used if the peer accepts them in its answer
+ * @param[in] handle Opaque pointer to the ICE handle this session description is related to
+ * @param[in,out] sdp The Janus SDP description object to update */
+void janus_sdp_add_fec(void *handle, janus_sdp *sdp);
+
 /*! \brief Method to merge a stripped session description and the right transport information
  * @param[in] handle Opaque pointer to the ICE handle this session description is related to
  * @param[in] sdp The Janus SDP description object to merge/enrich
@@ -0,0 +1,488 @@
+import argparse
+import asyncio
+import json
+import logging
+import os
+import random
+import sys
+import time
+
+from aiortc import RTCPeerConnection, RTCSessionDescription
+from aiortc.mediastreams import AudioStreamTrack, VideoStreamTrack
+from aiortc.contrib.media import MediaBlackhole, MediaPlayer
+
+from echo import JanusSession
+
+
+logger = logging.getLogger('load')
+
+PLUGINS = {
+    'echo': 'janus.plugin.echotest',
+    'publisher': 'janus.plugin.videoroom',
+    'subscriber': 'janus.plugin.videoroom',
+    'participant': 'janus.plugin.audiobridge',
+    'viewer': 'janus.plugin.streaming',
+}
+
+
+def plugin_data(response):
+    if response.get('janus') == 'error':
+        raise RuntimeError(response['error']['reason'])
+    data = response.get('plugindata', {}).get('data', {})
+    if 'error' in data:
+        raise RuntimeError(data['error'])
+    return data
+
+
+def session_description(jsep):
+    return RTCSessionDescription(sdp=jsep['sdp'], type=jsep['type'])
+
+
+class CpuMeter():
+    """CPU time used by a process, read from /proc (100% is one core)"""
+
+    def __init__(self, pid=None):
+        self._pid = pid
+        self._hz = os.sysconf('SC_CLK_TCK')
+        self._last = self._read()
+
+    def _read(self):
+        now = time.monotonic()
+        if self._pid is None:
+            times = os.times()
+            return now, times.user + times.system
+        try:
+            with open(f'/proc/{self._pid}/stat') as f:
+                # Skip the command name, which may contain spaces
+                fields = f.read().rsplit(')', 1)[1].split()
+        except OSError:
+            return now, None
+        return now, (int(fields[11]) + int(fields[12])) / self._hz
+
+    def usage(self):
+        last = self._last
+        self._last = self._read()
+        if last[1] is None or self._last[1] is None:
+            return None
+        elapsed = self._last[0] - last[0]
+        if elapsed <= 0:
+            return None
+        return 100 * (self._last[1] - last[1]) / elapsed
+
+
+class Peer:
+    def __init__(self, index, role, args, feed=None):
+        self.index = index
+        self.role = role
+        self.feed = feed
+        self.id = None
+        self.setup_time = None
+        self._args = args
+        self._session = JanusSession(args.url)
+        self._pc = RTCPeerConnection()
+        self._sink = MediaBlackhole()
+        self._player = None
+        self._connected = asyncio.Event()
+
+        @self._pc.on('track')
+        def on_track(track):
+            self._sink.addTrack(track)
+
+        @self._pc.on('iceconnectionstatechange')
+        def on_ice_state_change():
+            if self._pc.iceConnectionState in {'completed', 'failed'}:
+                self._connected.set()
+
+    @property
+    def streams(self):
+        return len(self._pc.getTransceivers())
+
+    def _add_media(self, audio=True, video=True):
+        if self._args.play_from:
+            self._player = MediaPlayer(self._args.play_from)
+        if audio:
+            if self._player and self._player.audio:
+                self._pc.addTrack(self._player.audio)
+            else:
+                self._pc.addTrack(AudioStreamTrack())
+        if video:
+            if self._player and self._player.video:
+                self._pc.addTrack(self._player.video)
+            else:
+                self._pc.addTrack(VideoStreamTrack())
+
+    def _jsep(self):
+        return {
+            'sdp': self._pc.localDescription.sdp,
+            'trickle': False,
+            'type': self._pc.localDescription.type,
+        }
+
+    async def _offer(self):
+        await self._pc.setLocalDescription(await self._pc.createOffer())
+        return self._jsep()
+
+    async def _answer(self, jsep):
+        await self._pc.setRemoteDescription(session_description(jsep))
+        await self._pc.setLocalDescription(await self._pc.createAnswer())
+        return self._jsep()
+
+    async def _echo(self, handle):
+        self._add_media()
+        response = await handle.sendMessage({
+            'body': {'audio': True, 'video': True},
+            'jsep': await self._offer(),
+        })
+        plugin_data(response)
+        await self._pc.setRemoteDescription(session_description(response['jsep']))
+
+    async def _publisher(self, handle):
+        self._add_media()
+        response = await handle.sendMessage({
+            'body': {
+                'request': 'joinandconfigure',
+                'room': self._args.room,
+                'ptype': 'publisher',
+                'display': f'load-{self.index}',
+                'audio': True,
+                'video': True,
+            },
+            'jsep': await self._offer(),
+        })
+        self.id = plugin_data(response)['id']
+        await self._pc.setRemoteDescription(session_description(response['jsep']))
+
+    async def _subscriber(self, handle):
+        response = await handle.sendMessage({
+            'body': {
+                'request': 'join',
+                'room': self._args.room,
+                'ptype': 'subscriber',
+                'feed': self.feed,
+            },
+        })
+        plugin_data(response)
+        answer = await self._answer(response['jsep'])
+        response = await handle.sendMessage({
+            'body': {'request': 'start', 'room': self._args.room},
+            'jsep': answer,
+        })
+        plugin_data(response)
+
+    async def _participant(self, handle):
+        response = await handle.sendMessage({
+            'body': {
+                'request': 'join',
+                'room': self._args.room,
+                'display': f'load-{self.index}',
+            },
+        })
+        plugin_data(response)
+        self._add_media(video=False)
+        response = await handle.sendMessage({
+            'body': {'request': 'configure', 'muted': False},
+            'jsep': await self._offer(),
+        })
+        plugin_data(response)
+        await self._pc.setRemoteDescription(session_description(response['jsep']))
+
+    async def _viewer(self, handle):
+        response = await handle.sendMessage({
+            'body': {'request': 'watch', 'id': self._args.mountpoint},
+        })
+        plugin_data(response)
+        answer = await self._answer(response['jsep'])
+        response = await handle.sendMessage({
+            'body': {'request': 'start'},
+            'jsep': answer,
+        })
+        plugin_data(response)
+
+    async def start(self):
+        started = time.monotonic()
+        await self._session.create()
+        handle = await self._session.attach(PLUGINS[self.role])
+        await getattr(self, '_' + self.role)(handle)
+        await self._sink.start()
+        await self._connected.wait()
+        if self._pc.iceConnectionState != 'completed':
+            raise RuntimeError('ICE failed')
+        self.setup_time = time.monotonic() - started
+
+    async def counters(self):
+        """Cumulative RTP counters, plus the current RTT and jitter"""
+        counters = {'received': 0, 'lost': 0, 'sent': 0, 'rtt': [], 'jitter': []}
+        for stat in (await self._pc.getStats()).values():
+            if stat.type == 'inbound-rtp':
+                counters['received'] += stat.packetsReceived
+                counters['lost'] += max(stat.packetsLost, 0)
+                counters['jitter'].append(stat.jitter)
+            elif stat.type == 'outbound-rtp':
+                counters['sent'] += stat.packetsSent
+            elif stat.type == 'remote-inbound-rtp':
+                # What Janus reported, in its RTCP RRs, for what we sent
+                counters['lost'] += max(stat.packetsLost, 0)
+                if stat.roundTripTime is not None:
+                    counters['rtt'].append(stat.roundTripTime)
+        return counters
+
+    async def close(self):
+        try:
+            await self._pc.close()
+            await self._sink.stop()
+            await self._session.destroy()
+        except Exception:
+            logger.debug(f'Error closing peer {self.index}', exc_info=True)
+
+
+class Load:
+    def __init__(self, args):
+        self._args = args
+        self._peers = []
+        self._janus_cpu = CpuMeter(args.janus_pid) if args.janus_pid else None
+        self._client_cpu = CpuMeter()
+        self._control = None
+        self._room_created = False
+        self.failures = 0
+
+    def _role(self, index):
+        if self._args.plugin == 'echotest':
+            return 'echo'
+        if self._args.plugin == 'audiobridge':
+            return 'participant'
+        if self._args.plugin == 'streaming':
+            return 'viewer'
+        return 'publisher' if index < self._args.publishers else 'subscriber'
+
+    async def _create_room(self):
+        plugin = 'janus.plugin.' + self._args.plugin
+        self._control = JanusSession(self._args.url)
+        await self._control.create()
+        handle = await self._control.attach(plugin)
+        self._args.room = random.randint(1000000, 9999999)
+        body = {'request': 'create', 'room': self._args.room, 'permanent': False}
+        if self._args.plugin == 'videoroom':
+            body.update({'publishers': self._args.publishers, 'bitrate': self._args.bitrate})
+        plugin_data(await handle.sendMessage({'body': body}))
+        self._room = handle
+        self._room_created = True
+        logger.info(f'Created {self._args.plugin} room {self._args.room}')
+
+    async def _start(self, peers):
+        semaphore = asyncio.Semaphore(self._args.concurrency)
+
+        async def start(peer):
+            async with semaphore:
+                try:
+                    await asyncio.wait_for(peer.start(), self._args.timeout)
+                    return True
+                except Exception as e:
+                    logger.warning(f'Peer {peer.index} ({peer.role}) failed: {e!r}')
+                    await peer.close()
+                    return False
+        results = await asyncio.gather(*[start(peer) for peer in peers])
+        for peer, ok in zip(peers, results):
+            if ok:
+                self._peers.append(peer)
+            else:
+                self.failures += 1
+
+    async def grow(self, level):
+        if self._args.plugin in {'videoroom', 'audiobridge'} and \
+                self._args.room is None and not self._room_created:
+            await self._create_room()
+        first = len(self._peers) + self.failures
+        new = [Peer(i, self._role(i), self._args) for i in range(first, level)]
+        # Subscribers need the publishers to be there already
+        publishers = [peer for peer in new if peer.role == 'publisher']
+        await self._start(publishers)
+        feeds = [peer.id for peer in self._peers if peer.role == 'publisher']
+        others = [peer for peer in new if peer.role != 'publisher']
+        if others and not feeds and self._args.plugin == 'videoroom':
+            raise RuntimeError('No publisher to subscribe to')
+        for peer in others:
+            if peer.role == 'subscriber':
+                peer.feed = feeds[peer.index % len(feeds)]
+        await self._start(others)
+
+    async def _counters(self):
+        return await asyncio.gather(*[peer.counters() for peer in self._peers])
+
+    @staticmethod
+    def _aggregate(now, before):
+        received = sum(c['received'] for c in now) - sum(c['received'] for c in before)
+        sent = sum(c['sent'] for c in now) - sum(c['sent'] for c in before)
+        lost = sum(c['lost'] for c in now) - sum(c['lost'] for c in before)
+        rtt = [r for c in now for r in c['rtt']]
+        jitter = [j for c in now for j in c['jitter']]
+        expected = received + sent
+        return {
+            'received': received,
+            'sent': sent,
+            'loss': 100 * lost / expected if expected > 0 else 0,
+            'rtt': 1000 * sum(rtt) / len(rtt) if rtt else None,
+            'jitter': sum(jitter) / len(jitter) if jitter else None,
+        }
+
+    async def measure(self, level):
+        await asyncio.sleep(self._args.warmup)
+        start = await self._counters()
+        if self._janus_cpu:
+            self._janus_cpu.usage()
+        self._client_cpu.usage()
+        last = start
+        elapsed = 0
+        while elapsed < self._args.duration:
+            await asyncio.sleep(self._args.interval)
+            elapsed += self._args.interval
+            now = await self._counters()
+            interval = self._aggregate(now, last)
+            last = now
+            logger.info(f'{len(self._peers)} peers: {interval["received"]} packets in,'
+                        f' {interval["sent"]} out, {interval["loss"]:.2f}% loss')
+        streams = sum(peer.streams for peer in self._peers)
+        setup = [peer.setup_time for peer in self._peers if peer.setup_time is not None]
+        window = self._aggregate(last, start)
+        window.update({
+            'level': level,
+            'peers': len(self._peers),
+            'failures': self.failures,
+            'streams': streams,
+            'setup': sum(setup) / len(setup) if setup else None,
+            'janus_cpu': self._janus_cpu.usage() if self._janus_cpu else None,
+            'client_cpu': self._client_cpu.usage(),
+        })
+        if window['janus_cpu'] is not None and streams > 0:
+            window['cpu_per_stream'] = window['janus_cpu'] / streams
+        else:
+            window['cpu_per_stream'] = None
+        return window
+
+    def sustainable(self, window):
+        args = self._args
+        if window['failures'] > 0 or window['peers'] < window['level']:
+            return False
+        if window['loss'] > args.max_loss:
+            return False
+        if args.max_cpu and window['janus_cpu'] is not None and window['janus_cpu'] > args.max_cpu:
+            return False
+        return True
+
+    async def close(self):
+        await asyncio.gather(*[peer.close() for peer in self._peers])
+        self._peers = []
+        if self._room_created:
+            try:
+                await self._room.sendMessage({'body': {'request': 'destroy', 'room': self._args.room}})
+            except Exception:
+                logger.debug('Error destroying the room', exc_info=True)
+        if self._control:
+            await self._control.destroy()
+
+
+def fmt(value, unit='', precision=1):
+    return '-' if value is None else f'{value:.{precision}f}{unit}'
+
+
+def print_window(window, sustainable):
+    print(f'peers {window["peers"]}/{window["level"]} ({window["failures"]} failed),'
+          f' {window["streams"]} streams: setup {fmt(window["setup"], "s", 2)},'
+          f' rtt {fmt(window["rtt"], "ms")}, jitter {fmt(window["jitter"], "", 3)},'
+          f' loss {fmt(window["loss"], "%", 2)}, janus cpu {fmt(window["janus_cpu"], "%")}'
+          f' ({fmt(window["cpu_per_stream"], "%", 2)} per stream),'
+          f' client cpu {fmt(window["client_cpu"], "%")}'
+          f' -> {"OK" if sustainable else "NOT SUSTAINABLE"}')
+
+
+async def run(args):
+    load = Load(args)
+    windows = []
+    maximum = None
+    level = args.peers
+    try:
+        while True:
+            await load.grow(level)
+            window = await load.measure(level)
+            sustainable = load.sustainable(window)
+            window['sustainable'] = sustainable
+            windows.append(window)
+            print_window(window, sustainable)
+            if sustainable:
+                maximum = level
+            if not args.step or not sustainable or level + args.step > args.max_peers:
+                break
+            level += args.step
+    finally:
+        await load.close()
+    print(f'Maximum sustainable concurrency: {maximum if maximum is not None else "none"} peers')
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump({'plugin': args.plugin, 'maximum': maximum, 'windows': windows}, f, indent=2)
+    return maximum is not None
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Janus load generator')
+    parser.add_argument('url',
+                        help='Janus root URL, e.g. ws://localhost:8188/')
+    parser.add_argument('--plugin', default='echotest',
+                        choices=['echotest', 'videoroom', 'audiobridge', 'streaming'],
+                        help='Plugin to load (default: echotest)')
+    parser.add_argument('--peers', type=int, default=10,
+                        help='Number of peers to start with (default: 10)')
+    parser.add_argument('--step', type=int, default=0,
+                        help='Peers to add after each window that was sustainable'
+                             ' (default: 0, which means run a single window)')
+    parser.add_argument('--max-peers', type=int, default=1000,
+                        help='Stop ramping up at this many peers (default: 1000)')
+    parser.add_argument('--publishers', type=int, default=1,
+                        help='How many of the VideoRoom peers publish, the others'
+                             ' subscribe to them round robin (default: 1)')
+    parser.add_argument('--room', type=int,
+                        help='VideoRoom/AudioBridge room to use (default: create a temporary one)')
+    parser.add_argument('--mountpoint', type=int, default=1,
+                        help='Streaming mountpoint to watch (default: 1)')
+    parser.add_argument('--bitrate', type=int, default=512000,
+                        help='Bitrate cap of the temporary VideoRoom room (default: 512000)')
+    parser.add_argument('--play-from',
+                        help='Read the media from a file and send it, instead of'
+                             ' generating it')
+    parser.add_argument('--concurrency', type=int, default=10,
+                        help='How many peers can be negotiating at the same time (default: 10)')
+    parser.add_argument('--timeout', type=float, default=30,
+                        help='Seconds a peer has to get connected (default: 30)')
+    parser.add_argument('--warmup', type=float, default=5,
+                        help='Seconds to wait before measuring a window (default: 5)')
+    parser.add_argument('--duration', type=float, default=30,
+                        help='Length in seconds of each measurement window (default: 30)')
+    parser.add_argument('--interval', type=float, default=5,
+                        help='Seconds between intermediate reports (default: 5)')
+    parser.add_argument('--max-loss', type=float, default=1,
+                        help='Packet loss percentage a window can have to be'
+                             ' sustainable (default: 1)')
+    parser.add_argument('--max-cpu', type=float, default=0,
+                        help='Janus CPU percentage (100 per core) a window can use'
+                             ' to be sustainable (default: 0, no limit)')
+    parser.add_argument('--janus-pid', type=int,
+                        default=int(os.environ['JANUS_PID']) if os.environ.get('JANUS_PID') else None,
+                        help='PID of the Janus process, to measure its CPU usage'
+                             ' (default: $JANUS_PID, if set)')
+    parser.add_argument('--output',
+                        help='Write all the measurements to this JSON file')
+    parser.add_argument('--verbose', '-v', action='count')
+    args = parser.parse_args()
+
+    if args.verbose:
+        logging.basicConfig(level=logging.DEBUG if args.verbose > 1 else logging.INFO)
+        if args.verbose < 2:
+            logging.getLogger('echo').setLevel(logging.WARNING)
+    else:
+        logging.basicConfig(level=logging.WARNING)
+
+    loop = asyncio.get_event_loop()
+    try:
+        ok = loop.run_until_complete(run(args))
+        sys.exit(0 if ok else 1)
+    except Exception:
+        logger.exception('Load test failed')
+        sys.exit(1)
@@ -8,13 +8,13 @@ URL=${2-"ws://localhost:8188/"}
 
 echo "Starting Janus binary from $JANUS_SRC ..."
 $JANUS_SRC/janus >/dev/null 2>&1 &
-JANUS_PID=$!
+export JANUS_PID=$!
 
 echo "Waiting for some seconds before launching the test ..."
 sleep 5
 
 echo "Launching test $TEST ..."
-python3 $TEST $URL
+python3 $TEST $URL "${@:3}"
 
 if [ $? -eq 0 ]; then
     echo "TEST SUCCEEDED"
@@ -4,9 +4,14 @@
  * \brief    Dumping of RTP/RTCP packets to text2pcap or pcap format
  * \details  Implementation of a simple helper utility that can be used
  * to dump incoming and outgoing RTP/RTCP packets to pcap or text2pcap format.
- * Saving to pcap natively can be more efficient but will lack some features,
- * as the target will be a legacy (v2.4) \c .pcap file and not a \c .pcapng one.
- * When saving to a text file, instead, the resulting file can be passed to
+ * Saving to pcap or pcapng natively is much more efficient: packets are
+ * only copied to a lock-free ring on the media path, and a single writer
+ * thread shared by all captures drains them to file in the background.
+ * Binary captures can also only keep the RTP headers of the packets, and
+ * keep the last seconds of traffic in memory rather than on disk, so that
+ * they're only saved when somebody asks for them (e.g., after a problem
+ * has been noticed). When saving to a text file, instead, the resulting
+ * file (which is written on the media path) can be passed to
  * the \c text2pcap application in order to get a \c .pcap or \c .pcapng file
  * that can be analyzed via Wireshark or similar applications, e.g.:
  *
@@ -48,6 +53,7 @@
 #include "text2pcap.h"
 #include "debug.h"
 #include "utils.h"
+#include "rtp.h"
 
 #define CASE_STR(name) case name: return #name
 const char *janus_text2pcap_packet_string(janus_text2pcap_packet type) {
@@ -61,6 +67,20 @@ const char *janus_text2pcap_packet_string(janus_text2pcap_packet type) {
 	return NULL;
 }
 
+const char *janus_text2pcap_format_string(janus_text2pcap_format format) {
+	switch(format) {
+		case JANUS_TEXT2PCAP_FORMAT_TEXT:
+			return "text";
+		case JANUS_TEXT2PCAP_FORMAT_PCAP:
+			return "pcap";
+		case JANUS_TEXT2PCAP_FORMAT_PCAPNG:
+			return "pcapng";
+		default:
+			break;
+	}
+	return NULL;
+}
+
 /* Helper struct to define a libpcap global header
  * https://wiki.wireshark.org/Development/LibpcapFileFormat */
 typedef struct janus_text2pcap_global_header {
@@ -146,20 +166,256 @@ static void janus_text2pcap_udp_header_init(janus_text2pcap_udp_header *udp, gbo
 	udp->csum = 0;
 }
 
+/* Size of the fake encapsulation we add to each packet */
+#define JANUS_TEXT2PCAP_ENCAPSULATION (sizeof(janus_text2pcap_ethernet_header) + \
+	sizeof(janus_text2pcap_ip_header) + sizeof(janus_text2pcap_udp_header))
+
+/* pcapng blocks we write (https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html) */
+#define JANUS_TEXT2PCAP_PCAPNG_SHB		0x0A0D0D0A
+#define JANUS_TEXT2PCAP_PCAPNG_IDB		0x00000001
+#define JANUS_TEXT2PCAP_PCAPNG_EPB		0x00000006
+#define JANUS_TEXT2PCAP_PCAPNG_EPB_FLAGS	2
+#define JANUS_TEXT2PCAP_PCAPNG_INBOUND	1
+#define JANUS_TEXT2PCAP_PCAPNG_OUTBOUND	2
+typedef struct janus_text2pcap_pcapng_shb {
+	guint32 type;
+	guint32 length;
+	guint32 magic;
+	guint16 version_major;
+	guint16 version_minor;
+	gint64 section_length;
+	guint32 length_again;
+} __attribute__((packed)) janus_text2pcap_pcapng_shb;
+typedef struct janus_text2pcap_pcapng_idb {
+	guint32 type;
+	guint32 length;
+	guint16 linktype;
+	guint16 reserved;
+	guint32 snaplen;
+	guint32 length_again;
+} janus_text2pcap_pcapng_idb;
+typedef struct janus_text2pcap_pcapng_epb {
+	guint32 type;
+	guint32 length;
+	guint32 interface;
+	guint32 ts_high;
+	guint32 ts_low;
+	guint32 caplen;
+	guint32 origlen;
+} janus_text2pcap_pcapng_epb;
+
+/* Packet waiting to be written by a binary capture */
+typedef struct janus_text2pcap_record {
+	gint64 when;
+	gboolean incoming;
+	guint16 length;
+	guint16 caplen;
+	char data[JANUS_TEXT2PCAP_MAX_SNAPLEN];
+} janus_text2pcap_record;
+/* Size of a record that only has caplen bytes of data */
+#define JANUS_TEXT2PCAP_RECORD_SIZE(caplen) (G_STRUCT_OFFSET(janus_text2pcap_record, data) + caplen)
+
+/* Slots of the ring binary captures queue records to: this is a bounded
+ * queue where each slot has a sequence number, which tells producers
+ * whether it's free (sequence equal to the position they want to write)
+ * and the writer whether it's full (sequence one past that position) */
+#define JANUS_TEXT2PCAP_RING_SIZE	512
+struct janus_text2pcap_slot {
+	volatile gint sequence;
+	janus_text2pcap_record record;
+};
+
+/* Writer thread shared by all binary captures */
+static GThread *capture_writer = NULL;
+static GAsyncQueue *capture_writer_queue = NULL;
+static GList *captures = NULL;
+static janus_mutex captures_mutex = JANUS_MUTEX_INITIALIZER;
+static int capture_writer_exit;
+
+/* Headers only saving only needs to know where the RTP header ends */
+static int janus_text2pcap_rtp_header_length(char *buf, int len) {
+	if(len < 12)
+		return len;
+	janus_rtp_header *rtp = (janus_rtp_header *)buf;
+	int hlen = 12 + 4*rtp->csrccount;
+	if(rtp->extension && len >= hlen + 4) {
+		janus_rtp_header_extension *ext = (janus_rtp_header_extension *)(buf + hlen);
+		hlen += 4 + 4*ntohs(ext->length);
+	}
+	return hlen > len ? len : hlen;
+}
+
+/* Write the file header of a binary capture */
+static int janus_text2pcap_write_header(FILE *file, janus_text2pcap_format format) {
+	if(format == JANUS_TEXT2PCAP_FORMAT_PCAPNG) {
+		/* A new section (appending to an existing file works too) with a single interface */
+		janus_text2pcap_pcapng_shb shb = {
+			JANUS_TEXT2PCAP_PCAPNG_SHB, sizeof(shb), 0x1A2B3C4D, 1, 0, -1, sizeof(shb)
+		};
+		janus_text2pcap_pcapng_idb idb = {
+			JANUS_TEXT2PCAP_PCAPNG_IDB, sizeof(idb), 1, 0, 65535, sizeof(idb)
+		};
+		if(fwrite(&shb, sizeof(char), sizeof(shb), file) != sizeof(shb) ||
+				fwrite(&idb, sizeof(char), sizeof(idb), file) != sizeof(idb))
+			return -1;
+		return 0;
+	}
+	janus_text2pcap_global_header header = {
+		0xa1b2c3d4, 2, 4, 0, 0, 65535, 1
+	};
+	if(fwrite(&header, sizeof(char), sizeof(header), file) != sizeof(header))
+		return -1;
+	return 0;
+}
+
+/* Write a packet to a binary capture, with its fake encapsulation */
+static int janus_text2pcap_write_record(FILE *file, janus_text2pcap_format format, janus_text2pcap_record *record) {
+	char buffer[sizeof(janus_text2pcap_pcapng_epb) + JANUS_TEXT2PCAP_ENCAPSULATION + JANUS_TEXT2PCAP_MAX_SNAPLEN + 3 + 16];
+	size_t offset = 0, hsize = JANUS_TEXT2PCAP_ENCAPSULATION;
+	size_t caplen = hsize + record->caplen, origlen = hsize + record->length;
+	if(format == JANUS_TEXT2PCAP_FORMAT_PCAPNG) {
+		/* Enhanced packet block, with the direction in the flags option */
+		size_t padded = (caplen + 3) & ~3;
+		janus_text2pcap_pcapng_epb *epb = (janus_text2pcap_pcapng_epb *)buffer;
+		epb->type = JANUS_TEXT2PCAP_PCAPNG_EPB;
+		epb->length = sizeof(*epb) + padded + 16;
+		epb->interface = 0;
+		epb->ts_high = (guint64)record->when >> 32;
+		epb->ts_low = (guint64)record->when & 0xFFFFFFFF;
+		epb->caplen = caplen;
+		epb->origlen = origlen;
+		offset = sizeof(*epb);
+		memset(buffer + offset + caplen, 0, padded - caplen);
+	} else {
+		janus_text2pcap_packet_header *header = (janus_text2pcap_packet_header *)buffer;
+		header->ts_sec = record->when / G_USEC_PER_SEC;
+		header->ts_usec = record->when % G_USEC_PER_SEC;
+		header->incl_len = caplen;
+		header->orig_len = origlen;
+		offset = sizeof(*header);
+	}
+	janus_text2pcap_ethernet_header *eth = (janus_text2pcap_ethernet_header *)(buffer + offset);
+	janus_text2pcap_ethernet_header_init(eth);
+	offset += sizeof(*eth);
+	janus_text2pcap_ip_header_init((janus_text2pcap_ip_header *)(buffer + offset), record->incoming, record->length);
+	offset += sizeof(janus_text2pcap_ip_header);
+	janus_text2pcap_udp_header_init((janus_text2pcap_udp_header *)(buffer + offset), record->incoming, record->length);
+	offset += sizeof(janus_text2pcap_udp_header);
+	memcpy(buffer + offset, record->data, record->caplen);
+	offset += record->caplen;
+	if(format == JANUS_TEXT2PCAP_FORMAT_PCAPNG) {
+		offset = (offset + 3) & ~3;
+		guint16 option[2] = { JANUS_TEXT2PCAP_PCAPNG_EPB_FLAGS, 4 };
+		guint32 flags = record->incoming ? JANUS_TEXT2PCAP_PCAPNG_INBOUND : JANUS_TEXT2PCAP_PCAPNG_OUTBOUND;
+		memcpy(buffer + offset, option, sizeof(option));
+		memcpy(buffer + offset + 4, &flags, sizeof(flags));
+		/* End of options */
+		memset(buffer + offset + 8, 0, 4);
+		guint32 length = ((janus_text2pcap_pcapng_epb *)buffer)->length;
+		memcpy(buffer + offset + 12, &length, sizeof(length));
+		offset += 16;
+	}
+	if(fwrite(buffer, sizeof(char), offset, file) != offset)
+		return -1;
+	return 0;
+}
+
+/* Move the packets queued by a binary capture to its file or its rolling
+ * window: the capture mutex must be locked, which means there's never more
+ * than one thread consuming the ring */
+static void janus_text2pcap_drain(janus_text2pcap *tp) {
+	gboolean written = FALSE;
+	while(TRUE) {
+		janus_text2pcap_slot *slot = &tp->ring[tp->ring_tail % JANUS_TEXT2PCAP_RING_SIZE];
+		guint sequence = g_atomic_int_get(&slot->sequence);
+		if((gint)(sequence - (tp->ring_tail + 1)) < 0)
+			break;
+		janus_text2pcap_record *record = &slot->record;
+		if(tp->window > 0) {
+			gsize size = JANUS_TEXT2PCAP_RECORD_SIZE(record->caplen);
+			janus_text2pcap_record *copy = g_malloc(size);
+			memcpy(copy, record, size);
+			g_queue_push_tail(tp->window_packets, copy);
+		} else if(tp->file != NULL) {
+			if(janus_text2pcap_write_record(tp->file, tp->format, record) < 0)
+				JANUS_LOG(LOG_ERR, "Error dumping packet to %s...\n", tp->filename);
+			written = TRUE;
+		}
+		g_atomic_int_set(&slot->sequence, tp->ring_tail + JANUS_TEXT2PCAP_RING_SIZE);
+		tp->ring_tail++;
+	}
+	if(written)
+		fflush(tp->file);
+	if(tp->window > 0) {
+		/* Get rid of the packets that are out of the window */
+		gint64 oldest = janus_get_real_time() - (gint64)tp->window*G_USEC_PER_SEC;
+		janus_text2pcap_record *record = NULL;
+		while((record = g_queue_peek_head(tp->window_packets)) != NULL && record->when < oldest)
+			g_free(g_queue_pop_head(tp->window_packets));
+	}
+}
+
+static void *janus_text2pcap_writer_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Captures writer thread started\n");
+	while(g_async_queue_timeout_pop(capture_writer_queue, 10*G_TIME_SPAN_MILLISECOND) != &capture_writer_exit) {
+		janus_mutex_lock(&captures_mutex);
+		GList *l = captures;
+		while(l) {
+			janus_text2pcap *tp = (janus_text2pcap *)l->data;
+			janus_mutex_lock_nodebug(&tp->mutex);
+			janus_text2pcap_drain(tp);
+			janus_mutex_unlock_nodebug(&tp->mutex);
+			l = l->next;
+		}
+		janus_mutex_unlock(&captures_mutex);
+	}
+	JANUS_LOG(LOG_VERB, "Captures writer thread leaving\n");
+	return NULL;
+}
+
+void janus_text2pcap_deinit(void) {
+	janus_mutex_lock(&captures_mutex);
+	GThread *writer = capture_writer;
+	capture_writer = NULL;
+	janus_mutex_unlock(&captures_mutex);
+	if(writer == NULL)
+		return;
+	g_async_queue_push(capture_writer_queue, &capture_writer_exit);
+	g_thread_join(writer);
+	g_async_queue_unref(capture_writer_queue);
+	capture_writer_queue = NULL;
+}
+
 
 janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, int truncate, gboolean text) {
+	return janus_text2pcap_create_full(dir, filename, truncate,
+		text ? JANUS_TEXT2PCAP_FORMAT_TEXT : JANUS_TEXT2PCAP_FORMAT_PCAP, FALSE, 0);
+}
+
+janus_text2pcap *janus_text2pcap_create_full(const char *dir, const char *filename, int truncate,
+		janus_text2pcap_format format, gboolean headers_only, guint window) {
 	janus_text2pcap *tp;
 	char newname[1024];
 	char *fname;
-	FILE *f;
+	FILE *f = NULL;
+	gboolean text = (format == JANUS_TEXT2PCAP_FORMAT_TEXT);
 
 	if(truncate < 0)
 		return NULL;
+	if(text && (headers_only || window > 0)) {
+		JANUS_LOG(LOG_ERR, "Headers only and rolling windows are only supported for binary captures\n");
+		return NULL;
+	}
+	if(window > JANUS_TEXT2PCAP_MAX_WINDOW) {
+		JANUS_LOG(LOG_ERR, "Rolling window too long (%u > %d)\n", window, JANUS_TEXT2PCAP_MAX_WINDOW);
+		return NULL;
+	}
 
 	/* Copy given filename or generate a random one */
 	if(filename == NULL) {
 		g_snprintf(newname, sizeof(newname),
-		    "janus-text2pcap-%"SCNu32".%s", janus_random_uint32(), text ? "txt" : "pcap");
+		    "janus-text2pcap-%"SCNu32".%s", janus_random_uint32(), text ? "txt" :
+				(format == JANUS_TEXT2PCAP_FORMAT_PCAPNG ? "pcapng" : "pcap"));
 	} else {
 		g_strlcpy(newname, filename, sizeof(newname));
 	}
@@ -178,30 +434,63 @@ janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, i
 		return NULL;
 	}
 
-	/* Try opening the file now */
-	f = fopen(fname, "ab");
-	if (f == NULL) {
-		JANUS_LOG(LOG_ERR, "fopen(%s) error: %d\n", fname, errno);
-		g_free(fname);
-		return NULL;
+	/* Try opening the file now, unless we're only keeping packets in memory */
+	if(window == 0) {
+		f = fopen(fname, "ab");
+		if (f == NULL) {
+			JANUS_LOG(LOG_ERR, "fopen(%s) error: %d\n", fname, errno);
+			g_free(fname);
+			return NULL;
+		}
+		/* If we're saving to .pcap or .pcapng directly, generate a global header */
+		if(!text && janus_text2pcap_write_header(f, format) < 0) {
+			JANUS_LOG(LOG_ERR, "Error writing capture header to %s...\n", fname);
+			fclose(f);
+			g_free(fname);
+			return NULL;
+		}
 	}
 
 	/* Create the text2pcap instance */
-	tp = g_malloc(sizeof(janus_text2pcap));
+	tp = g_malloc0(sizeof(janus_text2pcap));
 	tp->filename = fname;
 	tp->file = f;
 	tp->truncate = truncate;
 	tp->text = text;
+	tp->format = format;
+	tp->headers_only = headers_only;
+	tp->window = window;
 	g_atomic_int_set(&tp->writable, 1);
 	janus_mutex_init(&tp->mutex);
+	if(text)
+		return tp;
 
-	/* If we're saving to .pcap directly, generate a global header */
-	if(!text) {
-		janus_text2pcap_global_header header = {
-			0xa1b2c3d4, 2, 4, 0, 0, 65535, 1
-		};
-		fwrite(&header, sizeof(char), sizeof(header), f);
+	/* Binary captures are written by the shared writer thread */
+	tp->ring = g_malloc0(JANUS_TEXT2PCAP_RING_SIZE * sizeof(janus_text2pcap_slot));
+	int i = 0;
+	for(i=0; i<JANUS_TEXT2PCAP_RING_SIZE; i++)
+		tp->ring[i].sequence = i;
+	if(window > 0)
+		tp->window_packets = g_queue_new();
+	janus_mutex_lock(&captures_mutex);
+	if(capture_writer == NULL) {
+		GError *error = NULL;
+		capture_writer_queue = g_async_queue_new();
+		capture_writer = g_thread_try_new("captures writer", &janus_text2pcap_writer_thread, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the captures writer thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			capture_writer = NULL;
+			g_async_queue_unref(capture_writer_queue);
+			capture_writer_queue = NULL;
+			janus_mutex_unlock(&captures_mutex);
+			janus_text2pcap_free(tp);
+			return NULL;
+		}
 	}
+	captures = g_list_prepend(captures, tp);
+	janus_mutex_unlock(&captures_mutex);
 
 	return tp;
 }
@@ -210,51 +499,48 @@ int janus_text2pcap_dump(janus_text2pcap *instance,
 		janus_text2pcap_packet type, gboolean incoming, char *buf, int len, const char *format, ...) {
 	if(instance == NULL || buf == NULL || len < 1)
 		return -1;
-	janus_mutex_lock_nodebug(&instance->mutex);
-	if(instance->file == NULL || !g_atomic_int_get(&instance->writable)) {
-		janus_mutex_unlock_nodebug(&instance->mutex);
-		return -1;
-	}
-	/* If we're saving to .pcap directly, generate a packet header and save the payload */
+	/* If we're saving to .pcap or .pcapng directly, just queue the packet for the writer thread */
 	if(!instance->text) {
+		if(!g_atomic_int_get(&instance->writable))
+			return -1;
 		/* Are we truncating? */
 		int size = instance->truncate ? (len > instance->truncate ? instance->truncate : len) : len;
-		int hsize = sizeof(janus_text2pcap_ethernet_header) + sizeof(janus_text2pcap_ip_header) +
-			sizeof(janus_text2pcap_udp_header);
-		int hsize_cut = hsize + size;
-		int hsize_tot = hsize + len;
-		/* We need a fake Ethernet/IP/UDP encapsulation for this packet */
-		janus_text2pcap_ethernet_header eth;
-		janus_text2pcap_ethernet_header_init(&eth);
-		janus_text2pcap_ip_header ip;
-		janus_text2pcap_ip_header_init(&ip, incoming, len);
-		janus_text2pcap_udp_header udp;
-		janus_text2pcap_udp_header_init(&udp, incoming, len);
-		/* Now prepare the packet header */
-		struct timeval tv;
-		gettimeofday(&tv, NULL);
-		janus_text2pcap_packet_header header = {
-			tv.tv_sec, tv.tv_usec, hsize_cut, hsize_tot
-		};
-		fwrite(&header, sizeof(char), sizeof(header), instance->file);
-		fwrite(&eth, sizeof(char), sizeof(eth), instance->file);
-		fwrite(&ip, sizeof(char), sizeof(ip), instance->file);
-		fwrite(&udp, sizeof(char), sizeof(udp), instance->file);
-		/* The write the packet itself (or part of it) */
-		int temp = 0, tot = size;
-		while(tot > 0) {
-			temp = fwrite(buf+size-tot, sizeof(char), tot, instance->file);
-			if(temp <= 0) {
-				JANUS_LOG(LOG_ERR, "Error dumping packet...\n");
-				janus_mutex_unlock_nodebug(&instance->mutex);
-				return -2;
+		if(instance->headers_only && type == JANUS_TEXT2PCAP_RTP)
+			size = MIN(size, janus_text2pcap_rtp_header_length(buf, len));
+		size = MIN(size, JANUS_TEXT2PCAP_MAX_SNAPLEN);
+		/* Reserve a slot in the ring */
+		janus_text2pcap_slot *slot = NULL;
+		guint pos = g_atomic_int_get(&instance->ring_head);
+		while(TRUE) {
+			slot = &instance->ring[pos % JANUS_TEXT2PCAP_RING_SIZE];
+			gint diff = (gint)((guint)g_atomic_int_get(&slot->sequence) - pos);
+			if(diff == 0) {
+				if(g_atomic_int_compare_and_exchange(&instance->ring_head, (gint)pos, (gint)(pos + 1)))
+					break;
+				pos = g_atomic_int_get(&instance->ring_head);
+			} else if(diff < 0) {
+				/* The ring is full, the writer is lagging behind */
+				g_atomic_int_inc(&instance->dropped);
+				return -3;
+			} else {
+				pos = g_atomic_int_get(&instance->ring_head);
 			}
-			tot -= temp;
 		}
-		/* Done */
-		janus_mutex_unlock_nodebug(&instance->mutex);
+		janus_text2pcap_record *record = &slot->record;
+		record->when = janus_get_real_time();
+		record->incoming = incoming;
+		record->length = len;
+		record->caplen = size;
+		memcpy(record->data, buf, size);
+		/* Done, make the slot available to the writer thread */
+		g_atomic_int_set(&slot->sequence, pos + 1);
 		return 0;
 	}
+	janus_mutex_lock_nodebug(&instance->mutex);
+	if(instance->file == NULL || !g_atomic_int_get(&instance->writable)) {
+		janus_mutex_unlock_nodebug(&instance->mutex);
+		return -1;
+	}
 	/* If we got here, we need to prepare a text representation of the packet */
 	char buffer[5000], timestamp[20], usec[10], byte[10];
 	memset(timestamp, 0, sizeof(timestamp));
@@ -304,15 +590,76 @@ int janus_text2pcap_dump(janus_text2pcap *instance,
 	return 0;
 }
 
+int janus_text2pcap_dump_window(janus_text2pcap *instance, const char *filename, char **path) {
+	if(instance == NULL || instance->text || instance->window == 0)
+		return -1;
+	/* Dumps go to the same folder as the capture */
+	char *dir = g_path_get_dirname(instance->filename), *fname = NULL;
+	if(filename != NULL) {
+		fname = g_build_filename(dir, filename, NULL);
+	} else {
+		char *base = g_strdup(instance->filename);
+		char *ext = strrchr(base, '.');
+		if(ext && (!strcmp(ext, ".pcap") || !strcmp(ext, ".pcapng")))
+			*ext = '\0';
+		fname = g_strdup_printf("%s-%"SCNi64".%s", base, janus_get_real_time()/G_USEC_PER_SEC,
+			instance->format == JANUS_TEXT2PCAP_FORMAT_PCAPNG ? "pcapng" : "pcap");
+		g_free(base);
+	}
+	g_free(dir);
+	if(janus_is_folder_protected(fname)) {
+		JANUS_LOG(LOG_ERR, "Target capture path '%s' is in protected folder...\n", fname);
+		g_free(fname);
+		return -2;
+	}
+	FILE *f = fopen(fname, "wb");
+	if(f == NULL) {
+		JANUS_LOG(LOG_ERR, "fopen(%s) error: %d\n", fname, errno);
+		g_free(fname);
+		return -3;
+	}
+	int packets = 0;
+	janus_mutex_lock_nodebug(&instance->mutex);
+	/* Get the latest packets from the ring too */
+	janus_text2pcap_drain(instance);
+	int res = janus_text2pcap_write_header(f, instance->format);
+	GList *l = instance->window_packets->head;
+	while(res == 0 && l) {
+		res = janus_text2pcap_write_record(f, instance->format, (janus_text2pcap_record *)l->data);
+		packets++;
+		l = l->next;
+	}
+	janus_mutex_unlock_nodebug(&instance->mutex);
+	fclose(f);
+	if(res < 0) {
+		JANUS_LOG(LOG_ERR, "Error dumping the rolling window to %s...\n", fname);
+		g_free(fname);
+		return -4;
+	}
+	JANUS_LOG(LOG_INFO, "Dumped %d packets to %s\n", packets, fname);
+	if(path)
+		*path = fname;
+	else
+		g_free(fname);
+	return packets;
+}
+
 int janus_text2pcap_close(janus_text2pcap *instance) {
 	if(instance == NULL)
 		return -1;
-	janus_mutex_lock_nodebug(&instance->mutex);
-	if(!g_atomic_int_compare_and_exchange(&instance->writable, 1, 0)) {
-		janus_mutex_unlock_nodebug(&instance->mutex);
+	if(!g_atomic_int_compare_and_exchange(&instance->writable, 1, 0))
 		return 0;
+	if(!instance->text) {
+		/* The writer thread won't look at this capture anymore */
+		janus_mutex_lock(&captures_mutex);
+		captures = g_list_remove(captures, instance);
+		janus_mutex_unlock(&captures_mutex);
 	}
-	fclose(instance->file);
+	janus_mutex_lock_nodebug(&instance->mutex);
+	if(instance->ring != NULL)
+		janus_text2pcap_drain(instance);
+	if(instance->file != NULL)
+		fclose(instance->file);
 	instance->file = NULL;
 	janus_mutex_unlock_nodebug(&instance->mutex);
 	return 0;
@@ -322,6 +669,9 @@ void janus_text2pcap_free(janus_text2pcap *instance) {
 	if(instance == NULL)
 		return;
 	janus_text2pcap_close(instance);
+	g_free(instance->ring);
+	if(instance->window_packets != NULL)
+		g_queue_free_full(instance->window_packets, (GDestroyNotify)g_free);
 	g_free(instance->filename);
 	g_free(instance);
 }
@@ -4,9 +4,14 @@
  * \brief    Dumping of RTP/RTCP packets to text2pcap or pcap format (headers)
  * \details  Implementation of a simple helper utility that can be used
  * to dump incoming and outgoing RTP/RTCP packets to pcap or text2pcap format.
- * Saving to pcap natively can be more efficient but will lack some features,
- * as the target will be a legacy (v2.4) \c .pcap file and not a \c .pcapng one.
- * When saving to a text file, instead, the resulting file can be passed to
+ * Saving to pcap or pcapng natively is much more efficient: packets are
+ * only copied to a lock-free ring on the media path, and a single writer
+ * thread shared by all captures drains them to file in the background.
+ * Binary captures can also only keep the RTP headers of the packets, and
+ * keep the last seconds of traffic in memory rather than on disk, so that
+ * they're only saved when somebody asks for them (e.g., after a problem
+ * has been noticed). When saving to a text file, instead, the resulting
+ * file (which is written on the media path) can be passed to
  * the \c text2pcap application in order to get a \c .pcap or \c .pcapng file
  * that can be analyzed via Wireshark or similar applications, e.g.:
  *
@@ -45,9 +50,32 @@
 
 #include "mutex.h"
 
+/*! \brief Formats captures can be saved in */
+typedef enum janus_text2pcap_format {
+	/*! \brief Text, to be converted with text2pcap */
+	JANUS_TEXT2PCAP_FORMAT_TEXT = 0,
+	/*! \brief Legacy (v2.4) pcap */
+	JANUS_TEXT2PCAP_FORMAT_PCAP,
+	/*! \brief pcapng, where the direction of each packet is saved as well */
+	JANUS_TEXT2PCAP_FORMAT_PCAPNG
+} janus_text2pcap_format;
+/*! \brief Helper to get a string representation of a capture format
+ * @param[in] format The janus_text2pcap_format value
+ * @returns A string representation of the format (e.g., "pcapng") */
+const char *janus_text2pcap_format_string(janus_text2pcap_format format);
+
+/*! \brief Longest part of a packet binary captures can save */
+#define JANUS_TEXT2PCAP_MAX_SNAPLEN	1500
+/*! \brief Longest rolling window, in seconds, binary captures can keep in memory */
+#define JANUS_TEXT2PCAP_MAX_WINDOW	300
+
+/*! \brief Slot of the ring binary captures queue packets to, for the writer thread */
+typedef struct janus_text2pcap_slot janus_text2pcap_slot;
+
 /*! \brief Instance of a text2pcap recorder */
 typedef struct janus_text2pcap {
-	/*! \brief Absolute path to where the text2pcap file is stored */
+	/*! \brief Absolute path to where the text2pcap file is stored (or, for rolling
+	 * windows, the path dumps are named after) */
 	char *filename;
 	/*! \brief Pointer to the file handle */
 	FILE *file;
@@ -55,6 +83,23 @@ typedef struct janus_text2pcap {
 	int truncate;
 	/*! \brief Whether we'll save as text, or directly to pcap */
 	gboolean text;
+	/*! \brief Format we're saving to */
+	janus_text2pcap_format format;
+	/*! \brief Whether only the headers of RTP packets should be saved */
+	gboolean headers_only;
+	/*! \brief If not 0, how many seconds of packets to keep in memory, rather
+	 * than writing them to file (see janus_text2pcap_dump_window) */
+	guint window;
+	/*! \brief Ring of packets binary captures have still to write (lock-free) */
+	janus_text2pcap_slot *ring;
+	/*! \brief Next slot of the ring to fill */
+	volatile gint ring_head;
+	/*! \brief Next slot of the ring the writer will drain */
+	guint ring_tail;
+	/*! \brief Packets in the rolling window, oldest first */
+	GQueue *window_packets;
+	/*! \brief How many packets were dropped because the writer was lagging behind */
+	volatile gint dropped;
 	/*! \brief Whether we can write to this file or not */
 	volatile int writable;
 	/*! \brief Mutex to lock/unlock this recorder instance */
@@ -78,6 +123,20 @@ const char *janus_text2pcap_packet_string(janus_text2pcap_packet type);
  * @param[in] text Whether we'll save as text, or directly to pcap
  * @returns A valid janus_text2pcap instance in case of success, NULL otherwise */
 janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, int truncate, gboolean text);
+/*! \brief Create a text2pcap recorder, with more options
+ * \note Binary captures are written by a writer thread shared by all of
+ * them, which means packets are saved to disk a few milliseconds after
+ * janus_text2pcap_dump returns. When a window is provided, instead,
+ * nothing is written until janus_text2pcap_dump_window is called.
+ * @param[in] dir Path of the directory to save the recording into (will try to create it if it doesn't exist)
+ * @param[in] filename Filename to use for the recording
+ * @param[in] truncate Number of bytes to truncate each packet at (0 to not truncate at all)
+ * @param[in] format Format to save the capture in
+ * @param[in] headers_only Whether only the headers of RTP packets should be saved (binary formats only)
+ * @param[in] window If not 0, how many seconds of packets to keep in memory, without writing them to file (binary formats only)
+ * @returns A valid janus_text2pcap instance in case of success, NULL otherwise */
+janus_text2pcap *janus_text2pcap_create_full(const char *dir, const char *filename, int truncate,
+	janus_text2pcap_format format, gboolean headers_only, guint window);
 
 /*! \brief Dump an RTP or RTCP packet
  * @param[in] instance Instance of the janus_text2pcap recorder to dump the packet to
@@ -85,11 +144,20 @@ janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, i
  * @param[in] incoming Whether this is an incoming or outgoing packet
  * @param[in] buf Packet data to dump
  * @param[in] len Size of the packet data to dump
- * @param[in] format Format for the optional string to append to the line, if any
- * @returns 0 in case of success, a negative integer otherwise */
+ * @param[in] format Format for the optional string to append to the line, if any (text only)
+ * @returns 0 in case of success, a negative integer otherwise (-3 if the
+ * packet was dropped because the writer thread was lagging behind) */
 int janus_text2pcap_dump(janus_text2pcap *instance,
 	janus_text2pcap_packet type, gboolean incoming, char *buf, int len, const char *format, ...) G_GNUC_PRINTF(6, 7);
 
+/*! \brief Save the packets in the rolling window of a binary capture to a new file
+ * @param[in] instance Instance of the janus_text2pcap recorder
+ * @param[in] filename Filename to use for the dump, in the same folder as the capture
+ * (optional, the capture filename and the current time will be used if missing)
+ * @param[out] path Where to return the full path of the dump (optional, must be freed by the caller)
+ * @returns The number of packets saved in case of success, a negative integer otherwise */
+int janus_text2pcap_dump_window(janus_text2pcap *instance, const char *filename, char **path);
+
 /*! \brief Close a text2pcap recorder
  * @param[in] instance Instance of the janus_text2pcap recorder to close
  * @returns 0 in case of success, a negative integer otherwise */
@@ -99,4 +167,7 @@ int janus_text2pcap_close(janus_text2pcap *instance);
  * @param[in] instance Instance of the janus_text2pcap recorder to free */
 void janus_text2pcap_free(janus_text2pcap *instance);
 
+/*! \brief Stop the writer thread binary captures share, if it was started */
+void janus_text2pcap_deinit(void);
+
 #endif
@@ -0,0 +1,222 @@
+/*! \file    timerwheel.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Hierarchical timer wheel
+ * \details  Implementation of a hierarchical timer wheel. Each level has
+ * JANUS_TIMERWHEEL_SLOTS slots: the first level has a slot per tick, while
+ * each slot of the following levels covers a whole revolution of the
+ * previous one. Timers are put in the finest level that can hold them,
+ * and when the wheel gets to a coarser slot its timers are cascaded to
+ * the finer levels, until they end up in the list of expired timers.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include "timerwheel.h"
+#include "mutex.h"
+#include "utils.h"
+
+struct janus_timerwheel {
+	/* How long a tick is, in microseconds */
+	gint64 resolution;
+	/* The tick we're at */
+	gint64 tick;
+	/* The slots of all the levels */
+	janus_timerwheel_timer *slots[JANUS_TIMERWHEEL_LEVELS][JANUS_TIMERWHEEL_SLOTS];
+	/* Timers that expired and are waiting to be fired, and the ones being fired */
+	janus_timerwheel_timer *expired, *firing;
+	/* How many timers are scheduled */
+	guint size;
+	/* Mutex to lock this instance */
+	janus_mutex mutex;
+};
+
+/* Helpers to add and remove timers from the lists */
+static void janus_timerwheel_link(janus_timerwheel_timer **list, janus_timerwheel_timer *timer) {
+	timer->list = list;
+	timer->prev = NULL;
+	timer->next = *list;
+	if(*list != NULL)
+		(*list)->prev = timer;
+	*list = timer;
+}
+
+static void janus_timerwheel_unlink(janus_timerwheel_timer *timer) {
+	if(timer->prev != NULL)
+		timer->prev->next = timer->next;
+	else
+		*timer->list = timer->next;
+	if(timer->next != NULL)
+		timer->next->prev = timer->prev;
+	timer->list = NULL;
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+/* Helper to put a timer in the right slot, depending on how far in the future it is */
+static void janus_timerwheel_place(janus_timerwheel *wheel, janus_timerwheel_timer *timer) {
+	/* Round up, so that timers never fire early */
+	gint64 t = (timer->expires + wheel->resolution - 1) / wheel->resolution;
+	if(t <= wheel->tick) {
+		janus_timerwheel_link(&wheel->expired, timer);
+		return;
+	}
+	gint64 delta = t - wheel->tick;
+	gint64 span = JANUS_TIMERWHEEL_SLOTS;
+	int level = 0;
+	while(level < JANUS_TIMERWHEEL_LEVELS-1 && delta >= span) {
+		level++;
+		span <<= JANUS_TIMERWHEEL_BITS;
+	}
+	if(delta >= span) {
+		/* Too far in the future: park it in the farthest slot, we'll place it again from there */
+		t = wheel->tick + span - 1;
+	}
+	int slot = (t >> (level*JANUS_TIMERWHEEL_BITS)) & (JANUS_TIMERWHEEL_SLOTS-1);
+	janus_timerwheel_link(&wheel->slots[level][slot], timer);
+}
+
+/* Move the wheel forward by one tick (wheel->mutex must be locked) */
+static void janus_timerwheel_step(janus_timerwheel *wheel) {
+	wheel->tick++;
+	/* Find out which coarser slots we just entered, and cascade them
+	 * starting from the coarsest, as they may end up in finer ones */
+	int level = 0;
+	while(level < JANUS_TIMERWHEEL_LEVELS-1 &&
+			(wheel->tick & (((gint64)1 << ((level+1)*JANUS_TIMERWHEEL_BITS)) - 1)) == 0)
+		level++;
+	for(; level > 0; level--) {
+		int slot = (wheel->tick >> (level*JANUS_TIMERWHEEL_BITS)) & (JANUS_TIMERWHEEL_SLOTS-1);
+		janus_timerwheel_timer *timer = wheel->slots[level][slot];
+		wheel->slots[level][slot] = NULL;
+		while(timer != NULL) {
+			janus_timerwheel_timer *next = timer->next;
+			timer->list = NULL;
+			janus_timerwheel_place(wheel, timer);
+			timer = next;
+		}
+	}
+	/* Whatever is in the slot of this tick expired */
+	int slot = wheel->tick & (JANUS_TIMERWHEEL_SLOTS-1);
+	janus_timerwheel_timer *timer = wheel->slots[0][slot];
+	wheel->slots[0][slot] = NULL;
+	while(timer != NULL) {
+		janus_timerwheel_timer *next = timer->next;
+		janus_timerwheel_link(&wheel->expired, timer);
+		timer = next;
+	}
+}
+
+void janus_timerwheel_timer_init(janus_timerwheel_timer *timer, janus_timerwheel_callback callback, gpointer user_data) {
+	if(timer == NULL)
+		return;
+	timer->expires = 0;
+	timer->callback = callback;
+	timer->user_data = user_data;
+	timer->list = NULL;
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+janus_timerwheel *janus_timerwheel_new(gint64 resolution) {
+	janus_timerwheel *wheel = g_malloc0(sizeof(janus_timerwheel));
+	wheel->resolution = resolution > 0 ? resolution : 1;
+	wheel->tick = janus_get_monotonic_time() / wheel->resolution;
+	janus_mutex_init(&wheel->mutex);
+	return wheel;
+}
+
+void janus_timerwheel_destroy(janus_timerwheel *wheel) {
+	if(wheel == NULL)
+		return;
+	janus_mutex_lock(&wheel->mutex);
+	int level = 0, slot = 0;
+	for(level=0; level<JANUS_TIMERWHEEL_LEVELS; level++) {
+		for(slot=0; slot<JANUS_TIMERWHEEL_SLOTS; slot++) {
+			while(wheel->slots[level][slot] != NULL)
+				janus_timerwheel_unlink(wheel->slots[level][slot]);
+		}
+	}
+	while(wheel->expired != NULL)
+		janus_timerwheel_unlink(wheel->expired);
+	while(wheel->firing != NULL)
+		janus_timerwheel_unlink(wheel->firing);
+	janus_mutex_unlock(&wheel->mutex);
+	janus_mutex_destroy(&wheel->mutex);
+	g_free(wheel);
+}
+
+gboolean janus_timerwheel_schedule(janus_timerwheel *wheel, janus_timerwheel_timer *timer, gint64 when, gboolean only_sooner) {
+	if(wheel == NULL || timer == NULL)
+		return FALSE;
+	janus_mutex_lock(&wheel->mutex);
+	gboolean scheduled = (timer->list != NULL);
+	if(scheduled) {
+		if(only_sooner && timer->expires <= when) {
+			janus_mutex_unlock(&wheel->mutex);
+			return TRUE;
+		}
+		janus_timerwheel_unlink(timer);
+	} else {
+		wheel->size++;
+	}
+	timer->expires = when;
+	janus_timerwheel_place(wheel, timer);
+	janus_mutex_unlock(&wheel->mutex);
+	return scheduled;
+}
+
+gboolean janus_timerwheel_cancel(janus_timerwheel *wheel, janus_timerwheel_timer *timer) {
+	if(wheel == NULL || timer == NULL)
+		return FALSE;
+	janus_mutex_lock(&wheel->mutex);
+	gboolean scheduled = (timer->list != NULL);
+	if(scheduled) {
+		janus_timerwheel_unlink(timer);
+		wheel->size--;
+	}
+	janus_mutex_unlock(&wheel->mutex);
+	return scheduled;
+}
+
+guint janus_timerwheel_advance(janus_timerwheel *wheel, gint64 now) {
+	if(wheel == NULL)
+		return 0;
+	janus_mutex_lock(&wheel->mutex);
+	gint64 target = now / wheel->resolution;
+	while(wheel->tick < target)
+		janus_timerwheel_step(wheel);
+	/* Move the expired timers to a different list, so that callbacks
+	 * scheduling timers in the past don't keep us here forever */
+	while(wheel->expired != NULL) {
+		janus_timerwheel_timer *timer = wheel->expired;
+		janus_timerwheel_unlink(timer);
+		janus_timerwheel_link(&wheel->firing, timer);
+	}
+	guint fired = 0;
+	while(wheel->firing != NULL) {
+		janus_timerwheel_timer *timer = wheel->firing;
+		janus_timerwheel_unlink(timer);
+		wheel->size--;
+		janus_timerwheel_callback callback = timer->callback;
+		gpointer user_data = timer->user_data;
+		/* Invoke the callback without holding the lock */
+		janus_mutex_unlock(&wheel->mutex);
+		if(callback != NULL)
+			callback(timer, user_data);
+		fired++;
+		janus_mutex_lock(&wheel->mutex);
+	}
+	janus_mutex_unlock(&wheel->mutex);
+	return fired;
+}
+
+guint janus_timerwheel_size(janus_timerwheel *wheel) {
+	if(wheel == NULL)
+		return 0;
+	janus_mutex_lock(&wheel->mutex);
+	guint size = wheel->size;
+	janus_mutex_unlock(&wheel->mutex);
+	return size;
+}
@@ -0,0 +1,100 @@
+/*! \file    timerwheel.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Hierarchical timer wheel (headers)
+ * \details  Implementation of a hierarchical timer wheel, to manage large
+ * numbers of timers (e.g., session timeouts) without having to look at
+ * all of them every time: scheduling and cancelling a timer are O(1),
+ * and advancing the wheel only costs as much as the timers that expired,
+ * plus the occasional cascade of a coarser slot into finer ones. Timers
+ * are embedded in the structures they belong to, and are owned by the
+ * caller: the wheel only links them. Callbacks are invoked by whoever
+ * advances the wheel, without holding any lock, so they're free to
+ * schedule or cancel any timer, including the one that fired.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_TIMERWHEEL_H
+#define JANUS_TIMERWHEEL_H
+
+#include <glib.h>
+
+/*! \brief Number of levels in a wheel */
+#define JANUS_TIMERWHEEL_LEVELS		4
+/*! \brief Number of bits of the tick each level accounts for */
+#define JANUS_TIMERWHEEL_BITS		6
+/*! \brief Number of slots in each level */
+#define JANUS_TIMERWHEEL_SLOTS		(1 << JANUS_TIMERWHEEL_BITS)
+
+typedef struct janus_timerwheel janus_timerwheel;
+typedef struct janus_timerwheel_timer janus_timerwheel_timer;
+
+/*! \brief Callback invoked when a timer expires
+ * @param[in] timer The timer that expired (which is not scheduled anymore)
+ * @param[in] user_data The opaque pointer passed when initializing the timer */
+typedef void (*janus_timerwheel_callback)(janus_timerwheel_timer *timer, gpointer user_data);
+
+/*! \brief Timer that can be scheduled on a janus_timerwheel
+ * @note The fields are private, use the janus_timerwheel_timer_init and
+ * janus_timerwheel_schedule functions to manipulate them */
+struct janus_timerwheel_timer {
+	/*! \brief Monotonic time (in microseconds) this timer is due */
+	gint64 expires;
+	/*! \brief Callback to invoke when the timer expires */
+	janus_timerwheel_callback callback;
+	/*! \brief Opaque pointer to pass to the callback */
+	gpointer user_data;
+	/*! \brief List this timer is currently linked in, if it's scheduled */
+	janus_timerwheel_timer **list;
+	/*! \brief Neighbours in that list */
+	janus_timerwheel_timer *prev, *next;
+};
+
+/*! \brief Method to initialize a timer before scheduling it for the first time
+ * @param[in] timer The timer to initialize
+ * @param[in] callback The callback to invoke when the timer expires
+ * @param[in] user_data An opaque pointer to pass to the callback */
+void janus_timerwheel_timer_init(janus_timerwheel_timer *timer, janus_timerwheel_callback callback, gpointer user_data);
+
+/*! \brief Method to create a new wheel
+ * @param[in] resolution How many microseconds each tick of the wheel lasts:
+ * timers will fire up to a tick late, and the wheel can schedule timers up to
+ * JANUS_TIMERWHEEL_SLOTS^JANUS_TIMERWHEEL_LEVELS ticks in the future before
+ * they have to go around more than once
+ * @returns A new janus_timerwheel instance */
+janus_timerwheel *janus_timerwheel_new(gint64 resolution);
+
+/*! \brief Method to destroy a wheel
+ * @note Timers still scheduled are unlinked, but their callbacks are not invoked
+ * @param[in] wheel The wheel to destroy */
+void janus_timerwheel_destroy(janus_timerwheel *wheel);
+
+/*! \brief Method to schedule a timer, or move it if it's scheduled already
+ * @param[in] wheel The wheel to schedule the timer on
+ * @param[in] timer The timer to schedule
+ * @param[in] when The monotonic time (in microseconds) the timer should fire at
+ * @param[in] only_sooner If the timer is already scheduled, only move it if it's due later than \c when
+ * @returns TRUE if the timer was already scheduled, FALSE otherwise */
+gboolean janus_timerwheel_schedule(janus_timerwheel *wheel, janus_timerwheel_timer *timer, gint64 when, gboolean only_sooner);
+
+/*! \brief Method to cancel a timer
+ * @param[in] wheel The wheel the timer was scheduled on
+ * @param[in] timer The timer to cancel
+ * @returns TRUE if the timer was scheduled, FALSE if it wasn't (e.g., because it fired already) */
+gboolean janus_timerwheel_cancel(janus_timerwheel *wheel, janus_timerwheel_timer *timer);
+
+/*! \brief Method to advance a wheel, invoking the callbacks of all the timers that expired
+ * @note Only one thread should ever advance a specific wheel
+ * @param[in] wheel The wheel to advance
+ * @param[in] now The current monotonic time (in microseconds)
+ * @returns The number of timers that fired */
+guint janus_timerwheel_advance(janus_timerwheel *wheel, gint64 now);
+
+/*! \brief Helper to get how many timers are currently scheduled on a wheel
+ * @param[in] wheel The wheel to check
+ * @returns The number of scheduled timers */
+guint janus_timerwheel_size(janus_timerwheel *wheel);
+
+#endif
@@ -66,6 +66,7 @@ const char *janus_http_get_package(void);
 gboolean janus_http_is_janus_api_enabled(void);
 gboolean janus_http_is_admin_api_enabled(void);
 int janus_http_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+int janus_http_send_shared_message(janus_transport_session *transport, gboolean admin, json_t *envelope, janus_transport_shared_body *body);
 void janus_http_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_http_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_http_session_claimed(janus_transport_session *transport, guint64 session_id);
@@ -92,6 +93,7 @@ static janus_transport janus_http_transport =
 		.session_created = janus_http_session_created,
 		.session_over = janus_http_session_over,
 		.session_claimed = janus_http_session_claimed,
+		.send_shared_message = janus_http_send_shared_message,
 	);
 
 /* Transport creator */
@@ -111,6 +113,18 @@ static gboolean notify_events = TRUE;
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
+/* Long poll batching: how many events to return when clients don't say,
+ * and how large a batch of events can get (0 means no limit) */
+static int longpoll_maxev = 1;
+static size_t longpoll_budget = 65536;
+
+/* Stats on connection reuse, request pooling and batching */
+static int stats_period = 0;
+static volatile gint open_connections = 0;
+static volatile gint new_connections = 0, served_requests = 0;
+static volatile gint longpoll_responses = 0, longpoll_events = 0;
+static volatile gint pool_misses = 0;
+
 
 /* Incoming HTTP message */
 typedef struct janus_http_msg {
@@ -134,6 +148,11 @@ typedef struct janus_http_msg {
 static GHashTable *messages = NULL;
 static janus_mutex messages_mutex = JANUS_MUTEX_INITIALIZER;
 
+/* Pool of request instances we recycle, instead of allocating one per request */
+static GQueue msg_pool = G_QUEUE_INIT;
+static janus_mutex msg_pool_mutex = JANUS_MUTEX_INITIALIZER;
+static guint msg_pool_size = 256;
+
 static void janus_http_msg_free(const janus_refcount *msg_ref) {
 	janus_http_msg *request = janus_refcount_containerof(msg_ref, janus_http_msg, ref);
 	/* This message can be destroyed, free all the resources */
@@ -144,9 +163,31 @@ static void janus_http_msg_free(const janus_refcount *msg_ref) {
 	g_free(request->acrh);
 	g_free(request->acrm);
 	g_free(request->response);
+	/* Put the instance back in the pool, if there's room */
+	janus_mutex_lock(&msg_pool_mutex);
+	if(g_queue_get_length(&msg_pool) < msg_pool_size && !g_atomic_int_get(&stopping)) {
+		g_queue_push_head(&msg_pool, request);
+		request = NULL;
+	}
+	janus_mutex_unlock(&msg_pool_mutex);
 	g_free(request);
 }
 
+static janus_http_msg *janus_http_msg_new(struct MHD_Connection *connection) {
+	janus_mutex_lock(&msg_pool_mutex);
+	janus_http_msg *msg = g_queue_pop_head(&msg_pool);
+	janus_mutex_unlock(&msg_pool_mutex);
+	if(msg != NULL) {
+		memset(msg, 0, sizeof(janus_http_msg));
+	} else {
+		msg = g_malloc0(sizeof(janus_http_msg));
+		g_atomic_int_inc(&pool_misses);
+	}
+	msg->connection = connection;
+	janus_refcount_init(&msg->ref, janus_http_msg_free);
+	return msg;
+}
+
 static void janus_http_msg_destroy(void *msg) {
 	janus_http_msg *request = (janus_http_msg *)msg;
 	if(request && g_atomic_int_compare_and_exchange(&request->destroyed, 0, 1))
@@ -157,7 +198,8 @@ static void janus_http_msg_destroy(void *msg) {
 /* Helper for long poll: HTTP events to push per session */
 typedef struct janus_http_session {
 	guint64 session_id;			/* Core session identifier */
-	GAsyncQueue *events;		/* Events to notify for this session */
+	GAsyncQueue *events;		/* Events to notify for this session (already serialized) */
+	char *next_event;			/* Event that didn't fit in the previous batch, if any */
 	GList *longpolls;			/* Long poll connection */
 	janus_mutex mutex;			/* Mutex to lock this instance */
 	volatile gint destroyed;	/* Whether this session has been destroyed */
@@ -177,11 +219,12 @@ static void janus_http_session_free(const janus_refcount *session_ref) {
 	janus_http_session *session = janus_refcount_containerof(session_ref, janus_http_session, ref);
 	/* This session can be destroyed, free all the resources */
 	if(session->events) {
-		json_t *event = NULL;
+		char *event = NULL;
 		while((event = g_async_queue_try_pop(session->events)) != NULL)
-			json_decref(event);
+			g_free(event);
 		g_async_queue_unref(session->events);
 	}
+	g_free(session->next_event);
 	g_free(session);
 }
 
@@ -266,6 +309,8 @@ static char *cert_pem_bytes = NULL, *cert_key_bytes = NULL;
 /* Admin/Monitor MHD Web Server */
 static struct MHD_Daemon *admin_ws = NULL, *admin_sws = NULL;
 static char *admin_ws_path = NULL;
+/* Path the metrics of the core are exported on, in the admin/monitor web server, if enabled */
+static char *metrics_path = NULL;
 
 /* Custom Access-Control-Allow-Origin value, if specified */
 static char *allow_origin = NULL;
@@ -340,6 +385,103 @@ static void janus_http_random_string(int length, char *buffer) {
 	}
 }
 
+/* Helper to get the next event to send for a session (session->mutex must be locked) */
+static char *janus_http_session_pop_event(janus_http_session *session) {
+	char *event = session->next_event;
+	if(event != NULL) {
+		session->next_event = NULL;
+		return event;
+	}
+	return g_async_queue_try_pop(session->events);
+}
+
+/* Helper to prepare a long poll response out of the first event and as many
+ * pending ones as allowed by max_events and the byte budget (session->mutex
+ * must be locked): anything that doesn't fit is left for the next poll */
+static char *janus_http_session_batch_events(janus_http_session *session, char *first, int max_events) {
+	g_atomic_int_inc(&longpoll_responses);
+	g_atomic_int_inc(&longpoll_events);
+	if(max_events == 1)
+		return first;
+	GString *list = g_string_new("[");
+	g_string_append(list, first);
+	g_free(first);
+	int events = 1;
+	char *event = NULL;
+	while(events < max_events && (event = janus_http_session_pop_event(session)) != NULL) {
+		if(longpoll_budget > 0 && list->len + strlen(event) + 2 > longpoll_budget) {
+			/* Keep this for the next poll */
+			session->next_event = event;
+			break;
+		}
+		g_string_append_c(list, ',');
+		g_string_append(list, event);
+		g_free(event);
+		events++;
+	}
+	g_string_append_c(list, ']');
+	g_atomic_int_add(&longpoll_events, events-1);
+	return g_string_free(list, FALSE);
+}
+
+/* Helper to parse the maxev query argument of a long poll */
+static int janus_http_parse_maxev(const char *maxev) {
+	if(maxev == NULL)
+		return longpoll_maxev;
+	/* Clients can ask for all the events we have, within the budget */
+	if(!strcasecmp(maxev, "all"))
+		return G_MAXINT;
+	int max_events = atoi(maxev);
+	if(max_events < 1) {
+		JANUS_LOG(LOG_WARN, "Invalid maxev parameter passed (%d), defaulting to 1\n", max_events);
+		max_events = 1;
+	}
+	return max_events;
+}
+
+/* Callback (libmicrohttpd) invoked when a connection is opened or closed, to see how much keep-alive is reused */
+static void janus_http_connection_notify(void *cls, struct MHD_Connection *connection,
+		void **socket_context, enum MHD_ConnectionNotificationCode toe) {
+	if(toe == MHD_CONNECTION_NOTIFY_STARTED) {
+		g_atomic_int_inc(&open_connections);
+		g_atomic_int_inc(&new_connections);
+	} else if(toe == MHD_CONNECTION_NOTIFY_CLOSED) {
+		g_atomic_int_add(&open_connections, -1);
+	}
+}
+
+/* Periodic stats on how the HTTP transport is being used */
+static gboolean janus_http_stats(gpointer user_data) {
+	int connections = g_atomic_int_get(&open_connections);
+	int created = g_atomic_int_and(&new_connections, 0);
+	int requests = g_atomic_int_and(&served_requests, 0);
+	int responses = g_atomic_int_and(&longpoll_responses, 0);
+	int events = g_atomic_int_and(&longpoll_events, 0);
+	int misses = g_atomic_int_and(&pool_misses, 0);
+	janus_mutex_lock(&msg_pool_mutex);
+	guint pooled = g_queue_get_length(&msg_pool);
+	janus_mutex_unlock(&msg_pool_mutex);
+	double reuse = created > 0 ? (double)requests/(double)created : (double)requests;
+	double batch = responses > 0 ? (double)events/(double)responses : 0;
+	JANUS_LOG(LOG_VERB, "[HTTP] %d connections open, %d new, %d requests (%.2f per connection), "
+		"%d long poll responses (%.2f events each), %d requests allocated, %u pooled\n",
+		connections, created, requests, reuse, responses, batch, misses, pooled);
+	if(notify_events && gateway->events_is_enabled()) {
+		json_t *info = json_object();
+		json_object_set_new(info, "event", json_string("stats"));
+		json_object_set_new(info, "connections", json_integer(connections));
+		json_object_set_new(info, "new-connections", json_integer(created));
+		json_object_set_new(info, "requests", json_integer(requests));
+		json_object_set_new(info, "requests-per-connection", json_real(reuse));
+		json_object_set_new(info, "longpoll-responses", json_integer(responses));
+		json_object_set_new(info, "events-per-response", json_real(batch));
+		json_object_set_new(info, "allocated-requests", json_integer(misses));
+		json_object_set_new(info, "pooled-requests", json_integer(pooled));
+		gateway->notify_event(&janus_http_transport, NULL, info);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
 /* Event loop for timeout monitoring purposes */
 static GThread *httptimer = NULL;
 static GMainLoop *httploop = NULL;
@@ -475,6 +617,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				admin ? &janus_http_admin_handler : &janus_http_handler,
 				path,
 				MHD_OPTION_NOTIFY_COMPLETED, &janus_http_request_completed, NULL,
+				MHD_OPTION_NOTIFY_CONNECTION, &janus_http_connection_notify, NULL,
 				MHD_OPTION_CONNECTION_TIMEOUT, 120,
 				MHD_OPTION_END);
 		} else {
@@ -490,6 +633,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				admin ? &janus_http_admin_handler : &janus_http_handler,
 				path,
 				MHD_OPTION_NOTIFY_COMPLETED, &janus_http_request_completed, NULL,
+				MHD_OPTION_NOTIFY_CONNECTION, &janus_http_connection_notify, NULL,
 				MHD_OPTION_SOCK_ADDR, ipv6 ? (struct sockaddr *)&addr6 : (struct sockaddr *)&addr,
 				MHD_OPTION_CONNECTION_TIMEOUT, 120,
 				MHD_OPTION_END);
@@ -512,6 +656,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				admin ? &janus_http_admin_handler : &janus_http_handler,
 				path,
 				MHD_OPTION_NOTIFY_COMPLETED, &janus_http_request_completed, NULL,
+				MHD_OPTION_NOTIFY_CONNECTION, &janus_http_connection_notify, NULL,
 				MHD_OPTION_HTTPS_PRIORITIES, ciphers,
 				MHD_OPTION_HTTPS_MEM_CERT, cert_pem_bytes,
 				MHD_OPTION_HTTPS_MEM_KEY, cert_key_bytes,
@@ -531,6 +676,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				admin ? &janus_http_admin_handler : &janus_http_handler,
 				path,
 				MHD_OPTION_NOTIFY_COMPLETED, &janus_http_request_completed, NULL,
+				MHD_OPTION_NOTIFY_CONNECTION, &janus_http_connection_notify, NULL,
 				MHD_OPTION_HTTPS_PRIORITIES, ciphers,
 				MHD_OPTION_HTTPS_MEM_CERT, cert_pem_bytes,
 				MHD_OPTION_HTTPS_MEM_KEY, cert_key_bytes,
@@ -589,6 +735,12 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 	httpctx = g_main_context_new();
 	httploop = g_main_loop_new(httpctx, FALSE);
 	GError *error = NULL;
+	if(stats_period > 0) {
+		GSource *stats = g_timeout_source_new_seconds(stats_period);
+		g_source_set_callback(stats, janus_http_stats, NULL, NULL);
+		g_source_attach(stats, httpctx);
+		g_source_unref(stats);
+	}
 	httptimer = g_thread_try_new("http timer", &janus_http_timer, NULL, &error);
 	if(error != NULL) {
 		JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to start HTTP timer...\n",
@@ -642,6 +794,44 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_REST_NAME);
 		}
 
+		/* Long poll batching and request pooling */
+		item = janus_config_get(config, config_general, janus_config_type_item, "longpoll_maxev");
+		if(item && item->value) {
+			longpoll_maxev = atoi(item->value);
+			if(longpoll_maxev < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid value for longpoll_maxev (%d), using 1 instead\n", longpoll_maxev);
+				longpoll_maxev = 1;
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "longpoll_budget");
+		if(item && item->value) {
+			int budget = atoi(item->value);
+			if(budget < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid value for longpoll_budget (%d), ignoring...\n", budget);
+			} else {
+				longpoll_budget = budget;
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "request_pool");
+		if(item && item->value) {
+			int pool = atoi(item->value);
+			if(pool < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid value for request_pool (%d), ignoring...\n", pool);
+			} else {
+				msg_pool_size = pool;
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "stats_period");
+		if(item && item->value) {
+			stats_period = atoi(item->value);
+			if(stats_period < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid value for stats_period (%d), ignoring...\n", stats_period);
+				stats_period = 0;
+			}
+		}
+		JANUS_LOG(LOG_VERB, "Long polls: maxev=%d by default, batches of at most %zu bytes, pool of %u requests\n",
+			longpoll_maxev, longpoll_budget, msg_pool_size);
+
 		/* Check the base paths */
 		item = janus_config_get(config, config_general, janus_config_type_item, "base_path");
 		if(item && item->value) {
@@ -672,6 +862,17 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 		} else {
 			admin_ws_path = g_strdup("/admin");
 		}
+		/* Should we export metrics (e.g., for Prometheus) on the admin/monitor web server too? */
+		item = janus_config_get(config, config_admin, janus_config_type_item, "metrics");
+		if(item && item->value && janus_is_true(item->value)) {
+			item = janus_config_get(config, config_admin, janus_config_type_item, "metrics_path");
+			if(item && item->value && item->value[0] != '/') {
+				JANUS_LOG(LOG_WARN, "Invalid metrics path %s (it should start with a /), using /metrics\n", item->value);
+				item = NULL;
+			}
+			metrics_path = g_strdup(item && item->value ? item->value : "/metrics");
+			JANUS_LOG(LOG_INFO, "Exporting metrics on %s\n", metrics_path);
+		}
 
 		/* Any ACL for either the Janus or Admin API? */
 		item = janus_config_get(config, config_general, janus_config_type_item, "acl");
@@ -914,6 +1115,8 @@ void janus_http_destroy(void) {
 	cert_key_bytes = NULL;
 	g_free(allow_origin);
 	allow_origin = NULL;
+	g_free(metrics_path);
+	metrics_path = NULL;
 
 	janus_mutex_lock(&messages_mutex);
 	g_hash_table_destroy(messages);
@@ -923,6 +1126,11 @@ void janus_http_destroy(void) {
 	g_hash_table_destroy(sessions);
 	sessions = NULL;
 	janus_mutex_unlock(&sessions_mutex);
+	janus_mutex_lock(&msg_pool_mutex);
+	janus_http_msg *pooled = NULL;
+	while((pooled = g_queue_pop_head(&msg_pool)) != NULL)
+		g_free(pooled);
+	janus_mutex_unlock(&msg_pool_mutex);
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -966,6 +1174,67 @@ gboolean janus_http_is_admin_api_enabled(void) {
 	return http_admin_api_enabled;
 }
 
+/* Helper to serialize an event and add it to the queue of its session, whether its body is shared with other sessions or not */
+static int janus_http_queue_event(json_t *message, janus_transport_shared_body *body) {
+	json_t *s = json_object_get(message, "session_id");
+	if(!s || !json_is_integer(s)) {
+		JANUS_LOG(LOG_ERR, "Can't notify event, no session_id...\n");
+		json_decref(message);
+		return -1;
+	}
+	guint64 session_id = json_integer_value(s);
+	janus_mutex_lock(&sessions_mutex);
+	janus_http_session *session = g_hash_table_lookup(sessions, &session_id);
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		JANUS_LOG(LOG_ERR, "Can't notify event, no session object...\n");
+		janus_mutex_unlock(&sessions_mutex);
+		json_decref(message);
+		return -1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&sessions_mutex);
+	/* We serialize the event now, so that long polls only need to concatenate strings */
+	char *event_text = NULL;
+	if(body != NULL) {
+		event_text = janus_transport_shared_body_dumps(body, message, json_format);
+	} else {
+		char *text = json_dumps(message, json_format);
+		event_text = text ? g_strdup(text) : NULL;
+		free(text);
+	}
+	json_decref(message);
+	if(event_text == NULL) {
+		JANUS_LOG(LOG_ERR, "Can't notify event, error serializing it...\n");
+		janus_refcount_decrease(&session->ref);
+		return -1;
+	}
+	g_async_queue_push(session->events, event_text);
+	/* Are there long polls waiting? */
+	janus_mutex_lock(&session->mutex);
+	janus_http_msg *msg = NULL;
+	janus_transport_session *transport = NULL;
+	while(session->longpolls) {
+		transport = (janus_transport_session *)session->longpolls->data;
+		msg = (janus_http_msg *)(transport ? transport->transport_p : NULL);
+		/* Is this connection ready to send a response back? */
+		if(msg && g_atomic_pointer_compare_and_exchange(&msg->longpoll, session, NULL)) {
+			janus_refcount_increase(&msg->ref);
+			/* Send the events back */
+			if(g_atomic_int_compare_and_exchange(&msg->timeout_flag, 1, 0)) {
+				g_source_destroy(msg->timeout);
+				g_source_unref(msg->timeout);
+			}
+			msg->timeout = NULL;
+			janus_http_notifier(msg);
+			janus_refcount_decrease(&msg->ref);
+		}
+		session->longpolls = g_list_remove(session->longpolls, transport);
+	}
+	janus_mutex_unlock(&session->mutex);
+	janus_refcount_decrease(&session->ref);
+	return 0;
+}
+
 int janus_http_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
 	JANUS_LOG(LOG_HUGE, "Got a %s API %s to send (%p)\n", admin ? "admin" : "Janus", request_id ? "response" : "event", transport);
 	if(message == NULL) {
@@ -974,46 +1243,7 @@ int janus_http_send_message(janus_transport_session *transport, void *request_id
 	}
 	if(request_id == NULL) {
 		/* This is an event, add to the session queue */
-		json_t *s = json_object_get(message, "session_id");
-		if(!s || !json_is_integer(s)) {
-			JANUS_LOG(LOG_ERR, "Can't notify event, no session_id...\n");
-			json_decref(message);
-			return -1;
-		}
-		guint64 session_id = json_integer_value(s);
-		janus_mutex_lock(&sessions_mutex);
-		janus_http_session *session = g_hash_table_lookup(sessions, &session_id);
-		if(session == NULL || g_atomic_int_get(&session->destroyed)) {
-			JANUS_LOG(LOG_ERR, "Can't notify event, no session object...\n");
-			janus_mutex_unlock(&sessions_mutex);
-			json_decref(message);
-			return -1;
-		}
-		janus_refcount_increase(&session->ref);
-		g_async_queue_push(session->events, message);
-		janus_mutex_unlock(&sessions_mutex);
-		/* Are there long polls waiting? */
-		janus_mutex_lock(&session->mutex);
-		janus_http_msg *msg = NULL;
-		while(session->longpolls) {
-			transport = (janus_transport_session *)session->longpolls->data;
-			msg = (janus_http_msg *)(transport ? transport->transport_p : NULL);
-			/* Is this connection ready to send a response back? */
-			if(msg && g_atomic_pointer_compare_and_exchange(&msg->longpoll, session, NULL)) {
-				janus_refcount_increase(&msg->ref);
-				/* Send the events back */
-				if(g_atomic_int_compare_and_exchange(&msg->timeout_flag, 1, 0)) {
-					g_source_destroy(msg->timeout);
-					g_source_unref(msg->timeout);
-				}
-				msg->timeout = NULL;
-				janus_http_notifier(msg);
-				janus_refcount_decrease(&msg->ref);
-			}
-			session->longpolls = g_list_remove(session->longpolls, transport);
-		}
-		janus_mutex_unlock(&session->mutex);
-		janus_refcount_decrease(&session->ref);
+		return janus_http_queue_event(message, NULL);
 	} else {
 		if(request_id == keepalive_id) {
 			/* It's a response from our fake long-poll related keepalive, ignore */
@@ -1059,6 +1289,17 @@ int janus_http_send_message(janus_transport_session *transport, void *request_id
 	return 0;
 }
 
+int janus_http_send_shared_message(janus_transport_session *transport, gboolean admin, json_t *envelope, janus_transport_shared_body *body) {
+	JANUS_LOG(LOG_HUGE, "Got a shared %s API event to send (%p)\n", admin ? "admin" : "Janus", transport);
+	if(envelope == NULL || body == NULL) {
+		JANUS_LOG(LOG_ERR, "No message...\n");
+		if(envelope != NULL)
+			json_decref(envelope);
+		return -1;
+	}
+	return janus_http_queue_event(envelope, body);
+}
+
 void janus_http_session_created(janus_transport_session *transport, guint64 session_id) {
 	if(transport == NULL || transport->transport_p == NULL)
 		return;
@@ -1198,9 +1439,8 @@ static int janus_http_handler(void *cls, struct MHD_Connection *connection,
 		firstround = 1;
 		JANUS_LOG(LOG_DBG, "Got a HTTP %s request on %s...\n", method, url);
 		JANUS_LOG(LOG_DBG, " ... Just parsing headers for now...\n");
-		msg = g_malloc0(sizeof(janus_http_msg));
-		msg->connection = connection;
-		janus_refcount_init(&msg->ref, janus_http_msg_free);
+		msg = janus_http_msg_new(connection);
+		g_atomic_int_inc(&served_requests);
 		ts = janus_transport_session_create(msg, janus_http_msg_destroy);
 		janus_mutex_lock(&messages_mutex);
 		g_hash_table_insert(messages, ts, ts);
@@ -1425,43 +1665,15 @@ static int janus_http_handler(void *cls, struct MHD_Connection *connection,
 		}
 		janus_refcount_increase(&session->ref);
 		janus_mutex_unlock(&sessions_mutex);
-		/* How many messages can we send back in a single response? (just one by default) */
-		int max_events = 1;
-		const char *maxev = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "maxev");
-		if(maxev != NULL) {
-			max_events = atoi(maxev);
-			if(max_events < 1) {
-				JANUS_LOG(LOG_WARN, "Invalid maxev parameter passed (%d), defaulting to 1\n", max_events);
-				max_events = 1;
-			}
-		}
+		/* How many messages can we send back in a single response? (longpoll_maxev by default) */
+		int max_events = janus_http_parse_maxev(MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "maxev"));
 		JANUS_LOG(LOG_VERB, "Session %"SCNu64" found... returning up to %d messages\n", session_id, max_events);
 		/* Handle GET, taking the first message from the list */
 		janus_mutex_lock(&session->mutex);
-		json_t *event = g_async_queue_try_pop(session->events);
+		char *event = janus_http_session_pop_event(session);
 		if(event != NULL) {
-			if(max_events == 1) {
-				/* Return just this message and leave */
-				char *event_text = json_dumps(event, json_format);
-				json_decref(event);
-				ret = janus_http_return_success(ts, event_text);
-			} else {
-				/* The application is willing to receive more events at the same time, anything to report? */
-				json_t *list = json_array();
-				json_array_append_new(list, event);
-				int events = 1;
-				while(events < max_events) {
-					event = g_async_queue_try_pop(session->events);
-					if(event == NULL)
-						break;
-					json_array_append_new(list, event);
-					events++;
-				}
-				/* Return the array of messages and leave */
-				char *list_text = json_dumps(list, json_format);
-				json_decref(list);
-				ret = janus_http_return_success(ts, list_text);
-			}
+			/* Return this message, and whatever else we can fit, and leave */
+			ret = janus_http_return_success(ts, janus_http_session_batch_events(session, event, max_events));
 		} else {
 			/* Still no message, wait */
 			response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN,
@@ -1586,9 +1798,8 @@ static int janus_http_admin_handler(void *cls, struct MHD_Connection *connection
 		firstround = 1;
 		JANUS_LOG(LOG_VERB, "Got an admin/monitor HTTP %s request on %s...\n", method, url);
 		JANUS_LOG(LOG_DBG, " ... Just parsing headers for now...\n");
-		msg = g_malloc0(sizeof(janus_http_msg));
-		msg->connection = connection;
-		janus_refcount_init(&msg->ref, janus_http_msg_free);
+		msg = janus_http_msg_new(connection);
+		g_atomic_int_inc(&served_requests);
 		ts = janus_transport_session_create(msg, janus_http_msg_destroy);
 		janus_mutex_lock(&messages_mutex);
 		g_hash_table_insert(messages, ts, ts);
@@ -1633,6 +1844,18 @@ static int janus_http_admin_handler(void *cls, struct MHD_Connection *connection
 		ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
 		MHD_destroy_response(response);
 	}
+	/* Is this a request for the metrics? */
+	if(metrics_path != NULL && !strcasecmp(method, "GET") && !strcmp(url, metrics_path)) {
+		if(firstround)
+			return ret;
+		char *metrics = gateway->get_metrics(&janus_http_transport);
+		response = MHD_create_response_from_buffer(strlen(metrics), metrics, MHD_RESPMEM_MUST_FREE);
+		MHD_add_response_header(response, "Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+		janus_http_add_cors_headers(msg, response);
+		ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+		MHD_destroy_response(response);
+		goto done;
+	}
 	/* Get path components */
 	if(strcasecmp(url, admin_ws_path)) {
 		if(strlen(admin_ws_path) > 1) {
@@ -1889,46 +2112,34 @@ static int janus_http_notifier(janus_http_msg *msg) {
 	}
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&sessions_mutex);
-	json_t *event = NULL, *list = NULL;
-	int events = 0;
-	while((event = g_async_queue_try_pop(session->events)) != NULL) {
-		if(session->destroyed || g_atomic_int_get(&stopping)) {
-			/* TODO return error */
-			JANUS_LOG(LOG_ERR, "Session %"SCNu64" destroyed...\n", session_id);
-			MHD_resume_connection(msg->connection);
-			janus_refcount_decrease(&session->ref);
-			return -1;
-		}
-		if(max_events == 1) {
-			break;
-		} else {
-			/* The application is willing to receive more events at the same time, anything to report? */
-			if(list == NULL)
-				list = json_array();
-			json_array_append_new(list, event);
-			events++;
-			if(events == max_events)
-				break;
-		}
+	if(session->destroyed || g_atomic_int_get(&stopping)) {
+		/* TODO return error */
+		JANUS_LOG(LOG_ERR, "Session %"SCNu64" destroyed...\n", session_id);
+		MHD_resume_connection(msg->connection);
+		janus_refcount_decrease(&session->ref);
+		return -1;
 	}
-	if(event == NULL && list == NULL) {
+	/* Send all the pending events we can in a single response */
+	char *payload_text = NULL;
+	char *event = janus_http_session_pop_event(session);
+	if(event != NULL)
+		payload_text = janus_http_session_batch_events(session, event, max_events);
+	if(payload_text == NULL) {
 		JANUS_LOG(LOG_VERB, "No events available for session %"SCNu64"...\n", session_id);
 		/* Turn this into a "keepalive" response */
 		char tr[12];
 		janus_http_random_string(12, (char *)&tr);
-		if(max_events == 1) {
-			event = json_object();
-			json_object_set_new(event, "janus", json_string("keepalive"));
-		} else {
-			list = json_array();
-			event = json_object();
-			json_object_set_new(event, "janus", json_string("keepalive"));
-			json_array_append_new(list, event);
+		json_t *keepalive = json_object();
+		json_object_set_new(keepalive, "janus", json_string("keepalive"));
+		if(max_events > 1) {
+			json_t *keepalives = json_array();
+			json_array_append_new(keepalives, keepalive);
+			keepalive = keepalives;
 		}
+		payload_text = json_dumps(keepalive, json_format);
+		json_decref(keepalive);
 		/* FIXME Improve the Janus protocol keep-alive mechanism in JavaScript */
 	}
-	char *payload_text = json_dumps(max_events == 1 ? event : list, json_format);
-	json_decref(max_events == 1 ? event : list);
 	/* Finish the request by sending the response */
 	JANUS_LOG(LOG_HUGE, "We have a message to serve...\n\t%s\n", payload_text);
 	/* Send event back */
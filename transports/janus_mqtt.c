@@ -22,6 +22,16 @@
  * events related to it is done automatically through the outgoing queue,
  * so no need for an explicit request as the GET in the plain HTTP API.
  *
+ * By default, the same client connection is used for everything. Since the
+ * broker acknowledges QoS 1 and 2 messages within a limited in-flight window
+ * per connection, busy deployments can configure a pool of additional
+ * \c publishers connections, that will only be used to send responses and
+ * events: messages related to the same session always go through the same
+ * connection, so that their order is preserved. Several Janus instances
+ * can also share the load of the incoming requests, by subscribing to the
+ * request topic as members of the same \c shared_group (MQTT v5 shared
+ * subscriptions, which many v3.1.1 brokers support as well).
+ *
  * \ingroup transports
  * \ref transports
  */
@@ -106,10 +116,24 @@ static gboolean notify_events = TRUE;
 /* JSON serialization options */
 static size_t json_format_ = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
+/* Additional client connection, only used to publish responses and events */
+struct janus_mqtt_context;
+typedef struct janus_mqtt_publisher {
+	struct janus_mqtt_context *ctx;
+	MQTTAsync client;
+	int index;
+	volatile gint connected;
+} janus_mqtt_publisher;
+
 /* MQTT client context */
 typedef struct janus_mqtt_context {
 	janus_transport_callbacks *gateway;
 	MQTTAsync client;
+	/* Pool of publisher connections, if any */
+	janus_mqtt_publisher *publishers;
+	int publishers_num;
+	int publishers_max_inflight;
+	volatile gint publishers_next;
 	struct {
 		int mqtt_version;
 		int keep_alive_interval;
@@ -133,6 +157,8 @@ typedef struct janus_mqtt_context {
 	} status;
 	struct {
 		char *topic;
+		/* Topic filter we actually subscribe to, in case of shared subscriptions */
+		char *filter;
 		int qos;
 	} subscribe;
 	struct {
@@ -204,7 +230,7 @@ void janus_mqtt_client_publish_admin_success(void *context, MQTTAsync_successDat
 void janus_mqtt_client_publish_admin_failure(void *context, MQTTAsync_failureData *response);
 void janus_mqtt_client_publish_status_success(void *context, MQTTAsync_successData *response);
 void janus_mqtt_client_publish_status_failure(void *context, MQTTAsync_failureData *response);
-int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gboolean admin);
+int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, MQTTAsync client, char *payload, gboolean admin);
 int janus_mqtt_client_get_response_code(MQTTAsync_failureData *response);
 #ifdef MQTTVERSION_5
 /* MQTT v5 interface callbacks */
@@ -224,7 +250,7 @@ void janus_mqtt_client_publish_admin_success5(void *context, MQTTAsync_successDa
 void janus_mqtt_client_publish_admin_failure5(void *context, MQTTAsync_failureData5 *response);
 void janus_mqtt_client_publish_status_success5(void *context, MQTTAsync_successData5 *response);
 void janus_mqtt_client_publish_status_failure5(void *context, MQTTAsync_failureData5 *response);
-int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, char *payload, gboolean admin, MQTTProperties *properties, char *custom_topic);
+int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, MQTTAsync client, char *payload, gboolean admin, MQTTProperties *properties, char *custom_topic);
 int janus_mqtt_client_get_response_code5(MQTTAsync_failureData5 *response);
 #endif
 /* MQTT version independent callback implementations */
@@ -243,6 +269,16 @@ void janus_mqtt_client_publish_admin_success_impl(char *topic);
 void janus_mqtt_client_publish_admin_failure_impl(int rc);
 void janus_mqtt_client_publish_status_success_impl(char *topic);
 void janus_mqtt_client_publish_status_failure_impl(int rc);
+/* Publisher connections methods */
+static int janus_mqtt_client_connect_with(janus_mqtt_context *ctx, janus_mqtt_publisher *publisher);
+static MQTTAsync janus_mqtt_client_get_publisher(janus_mqtt_context *ctx, json_t *message);
+void janus_mqtt_publisher_connected(void *context, char *cause);
+void janus_mqtt_publisher_connection_lost(void *context, char *cause);
+int janus_mqtt_publisher_message_arrived(void *context, char *topicName, int topicLen, MQTTAsync_message *message);
+void janus_mqtt_publisher_connect_failure(void *context, MQTTAsync_failureData *response);
+#ifdef MQTTVERSION_5
+void janus_mqtt_publisher_connect_failure5(void *context, MQTTAsync_failureData5 *response);
+#endif
 
 /* We only handle a single client */
 static janus_mqtt_context *context_ = NULL;
@@ -468,6 +504,20 @@ int janus_mqtt_init(janus_transport_callbacks *callback, const char *config_path
 				JANUS_LOG(LOG_ERR, "Invalid subscribe-qos value: %s (falling back to default)\n", qos_item->value);
 				ctx->subscribe.qos = 1;
 			}
+
+			janus_config_item *group_item = janus_config_get(config, config_general, janus_config_type_item, "shared_group");
+			if(group_item && group_item->value && strlen(group_item->value) > 0) {
+				if(strpbrk(group_item->value, "/+#") != NULL) {
+					JANUS_LOG(LOG_FATAL, "Invalid shared subscription group '%s' for MQTT integration...\n", group_item->value);
+					goto error;
+				}
+#ifdef MQTTVERSION_5
+				if(ctx->connect.mqtt_version != MQTTVERSION_5)
+#endif
+					JANUS_LOG(LOG_WARN, "Shared subscriptions are an MQTT v5 feature, make sure your broker supports them with older versions as well\n");
+				ctx->subscribe.filter = g_strdup_printf("$share/%s/%s", group_item->value, ctx->subscribe.topic);
+				JANUS_LOG(LOG_INFO, "Using shared subscription for incoming messages: %s\n", ctx->subscribe.filter);
+			}
 		}
 
 		/* Publish configuration */
@@ -486,6 +536,19 @@ int janus_mqtt_init(janus_transport_callbacks *callback, const char *config_path
 				ctx->publish.qos = 1;
 			}
 
+			janus_config_item *publishers_item = janus_config_get(config, config_general, janus_config_type_item, "publishers");
+			ctx->publishers_num = (publishers_item && publishers_item->value) ? atoi(publishers_item->value) : 0;
+			if(ctx->publishers_num < 0 || ctx->publishers_num > 64) {
+				JANUS_LOG(LOG_ERR, "Invalid publishers value: %s (falling back to default)\n", publishers_item->value);
+				ctx->publishers_num = 0;
+			}
+			janus_config_item *inflight_item = janus_config_get(config, config_general, janus_config_type_item, "publishers_max_inflight");
+			ctx->publishers_max_inflight = (inflight_item && inflight_item->value) ? atoi(inflight_item->value) : ctx->connect.max_inflight;
+			if(ctx->publishers_max_inflight <= 0 || ctx->publishers_max_inflight > 65535) {
+				JANUS_LOG(LOG_ERR, "Invalid publishers-max-inflight value: %s (falling back to default)\n", inflight_item->value);
+				ctx->publishers_max_inflight = ctx->connect.max_inflight;
+			}
+
 #ifdef MQTTVERSION_5
 			if (ctx->connect.mqtt_version == MQTTVERSION_5) {
 				/* MQTT 5 specific configuration */
@@ -710,12 +773,50 @@ int janus_mqtt_init(janus_transport_callbacks *callback, const char *config_path
 	}
 #endif
 
+	/* Creating the publisher connections, if needed */
+	if(ctx->publishers_num > 0) {
+		ctx->publishers = g_malloc0(ctx->publishers_num * sizeof(janus_mqtt_publisher));
+		int i = 0;
+		for(i=0; i<ctx->publishers_num; i++) {
+			janus_mqtt_publisher *publisher = &ctx->publishers[i];
+			publisher->ctx = ctx;
+			publisher->index = i;
+			char publisher_id[256];
+			g_snprintf(publisher_id, sizeof(publisher_id), "%s-pub%d", client_id, i);
+			if(MQTTAsync_createWithOptions(
+					&publisher->client,
+					url,
+					publisher_id,
+					MQTTCLIENT_PERSISTENCE_NONE,
+					NULL,
+					&create_options) != MQTTASYNC_SUCCESS) {
+				JANUS_LOG(LOG_FATAL, "Can't connect to MQTT broker: error creating publisher #%d...\n", i);
+				goto error;
+			}
+			if(MQTTAsync_setConnected(publisher->client, publisher, janus_mqtt_publisher_connected) != MQTTASYNC_SUCCESS ||
+					MQTTAsync_setCallbacks(publisher->client, publisher, janus_mqtt_publisher_connection_lost,
+						janus_mqtt_publisher_message_arrived, NULL) != MQTTASYNC_SUCCESS) {
+				JANUS_LOG(LOG_FATAL, "Can't connect to MQTT broker: error setting up callbacks of publisher #%d...\n", i);
+				goto error;
+			}
+		}
+		JANUS_LOG(LOG_INFO, "Using %d additional MQTT connections for outgoing messages (max inflight: %d)\n",
+			ctx->publishers_num, ctx->publishers_max_inflight);
+	}
+
 	/* Connecting to the broker */
 	int rc = janus_mqtt_client_connect(ctx);
 	if(rc != MQTTASYNC_SUCCESS) {
 		JANUS_LOG(LOG_FATAL, "Can't connect to MQTT broker, return code: %d\n", rc);
 		goto error;
 	}
+	int i = 0;
+	for(i=0; i<ctx->publishers_num; i++) {
+		/* If this fails, we'll just use the main connection instead */
+		rc = janus_mqtt_client_connect_with(ctx, &ctx->publishers[i]);
+		if(rc != MQTTASYNC_SUCCESS)
+			JANUS_LOG(LOG_ERR, "Can't connect MQTT publisher #%d to the broker, return code: %d\n", i, rc);
+	}
 
 	g_free((char *)url);
 	g_free((char *)client_id);
@@ -839,6 +940,8 @@ int janus_mqtt_send_message(janus_transport_session *transport, void *request_id
 	char *payload = json_dumps(message, json_format_);
 	JANUS_LOG(LOG_HUGE, "Sending %s API message via MQTT: %s\n", admin ? "admin" : "Janus", payload);
 
+	/* Admin messages always go through the main connection */
+	MQTTAsync client = admin ? ctx->client : janus_mqtt_client_get_publisher(ctx, message);
 	int rc;
 #ifdef MQTTVERSION_5
 	if(ctx->connect.mqtt_version == MQTTVERSION_5) {
@@ -860,14 +963,14 @@ int janus_mqtt_send_message(janus_transport_session *transport, void *request_id
 			g_rw_lock_reader_unlock(&janus_mqtt_transaction_states_lock);
 		}
 
-		rc = janus_mqtt_client_publish_message5(ctx, payload, admin, &properties, response_topic);
+		rc = janus_mqtt_client_publish_message5(ctx, client, payload, admin, &properties, response_topic);
 		if(response_topic != NULL) g_free(response_topic);
 		MQTTProperties_free(&properties);
 	} else {
-		rc = janus_mqtt_client_publish_message(ctx, payload, admin);
+		rc = janus_mqtt_client_publish_message(ctx, client, payload, admin);
 	}
 #else
-	rc = janus_mqtt_client_publish_message(ctx, payload, admin);
+	rc = janus_mqtt_client_publish_message(ctx, client, payload, admin);
 #endif
 
 	if(rc != MQTTASYNC_SUCCESS) {
@@ -1071,6 +1174,11 @@ done:
 }
 
 int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
+	return janus_mqtt_client_connect_with(ctx, NULL);
+}
+
+/* Connects either the main client (publisher is NULL) or one of the publishers */
+static int janus_mqtt_client_connect_with(janus_mqtt_context *ctx, janus_mqtt_publisher *publisher) {
 	MQTTAsync_connectOptions options = MQTTAsync_connectOptions_initializer;
 
 #ifdef MQTTVERSION_5
@@ -1078,14 +1186,14 @@ int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
 		MQTTAsync_connectOptions options5 = MQTTAsync_connectOptions_initializer5;
 		options = options5;
 		options.cleanstart = ctx->connect.cleansession;
-		options.onFailure5 = janus_mqtt_client_connect_failure5;
+		options.onFailure5 = publisher ? janus_mqtt_publisher_connect_failure5 : janus_mqtt_client_connect_failure5;
 	} else {
 		options.cleansession = ctx->connect.cleansession;
-		options.onFailure = janus_mqtt_client_connect_failure;
+		options.onFailure = publisher ? janus_mqtt_publisher_connect_failure : janus_mqtt_client_connect_failure;
 	}
 #else
 	options.cleansession = ctx->connect.cleansession;
-	options.onFailure = janus_mqtt_client_connect_failure;
+	options.onFailure = publisher ? janus_mqtt_publisher_connect_failure : janus_mqtt_client_connect_failure;
 #endif
 
 	options.MQTTVersion = ctx->connect.mqtt_version;
@@ -1093,7 +1201,7 @@ int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
 	options.password = ctx->connect.password;
 	options.automaticReconnect = TRUE;
 	options.keepAliveInterval = ctx->connect.keep_alive_interval;
-	options.maxInflight = ctx->connect.max_inflight;
+	options.maxInflight = publisher ? ctx->publishers_max_inflight : ctx->connect.max_inflight;
 
 	MQTTAsync_SSLOptions ssl_opts = MQTTAsync_SSLOptions_initializer;
 	if(ctx->ssl_enabled) {
@@ -1104,8 +1212,9 @@ int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
 		options.ssl = &ssl_opts;
 	}
 
+	/* Only the main connection has a will, publishers come and go with it */
 	MQTTAsync_willOptions willOptions = MQTTAsync_willOptions_initializer;
-	if(ctx->status.enabled && ctx->status.disconnect_message != NULL) {
+	if(publisher == NULL && ctx->status.enabled && ctx->status.disconnect_message != NULL) {
 		willOptions.topicName = ctx->status.topic;
 		willOptions.message = ctx->status.disconnect_message;
 		willOptions.retained = ctx->status.retain;
@@ -1113,6 +1222,10 @@ int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
 		options.will = &willOptions;
 	}
 
+	if(publisher != NULL) {
+		options.context = publisher;
+		return MQTTAsync_connect(publisher->client, &options);
+	}
 	options.context = ctx;
 	return MQTTAsync_connect(ctx->client, &options);
 }
@@ -1207,6 +1320,18 @@ int janus_mqtt_client_disconnect(janus_mqtt_context *ctx) {
 		}
 	}
 
+	/* Publishers are destroyed together with the context, just tell the broker they're going away */
+	int i = 0;
+	for(i=0; i<ctx->publishers_num; i++) {
+		janus_mqtt_publisher *publisher = &ctx->publishers[i];
+		g_atomic_int_set(&publisher->connected, 0);
+		if(publisher->client == NULL)
+			continue;
+		MQTTAsync_disconnectOptions publisher_options = MQTTAsync_disconnectOptions_initializer;
+		publisher_options.timeout = ctx->disconnect.timeout;
+		MQTTAsync_disconnect(publisher->client, &publisher_options);
+	}
+
 	MQTTAsync_disconnectOptions options = MQTTAsync_disconnectOptions_initializer;
 
 #ifdef MQTTVERSION_5
@@ -1292,7 +1417,7 @@ int janus_mqtt_client_subscribe(janus_mqtt_context *ctx, gboolean admin) {
 		options.onSuccess = janus_mqtt_client_subscribe_success;
 		options.onFailure = janus_mqtt_client_subscribe_failure;
 #endif
-		return MQTTAsync_subscribe(ctx->client, ctx->subscribe.topic, ctx->subscribe.qos, &options);
+		return MQTTAsync_subscribe(ctx->client, ctx->subscribe.filter ? ctx->subscribe.filter : ctx->subscribe.topic, ctx->subscribe.qos, &options);
 	}
 }
 
@@ -1384,7 +1509,7 @@ void janus_mqtt_client_admin_subscribe_failure_impl(void *context, int rc) {
 	}
 }
 
-int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gboolean admin) {
+int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, MQTTAsync client, char *payload, gboolean admin) {
 	MQTTAsync_message msg = MQTTAsync_message_initializer;
 	msg.payload = payload;
 	msg.payloadlen = strlen(payload);
@@ -1404,11 +1529,11 @@ int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gb
 		options.onFailure = janus_mqtt_client_publish_janus_failure;
 	}
 
-	return MQTTAsync_sendMessage(ctx->client, topic, &msg, &options);
+	return MQTTAsync_sendMessage(client, topic, &msg, &options);
 }
 
 #ifdef MQTTVERSION_5
-int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, char *payload, gboolean admin, MQTTProperties *properties, char *custom_topic) {
+int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, MQTTAsync client, char *payload, gboolean admin, MQTTProperties *properties, char *custom_topic) {
 	MQTTAsync_message msg = MQTTAsync_message_initializer;
 	msg.payload = payload;
 	msg.payloadlen = strlen(payload);
@@ -1436,7 +1561,7 @@ int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, char *payload, g
 		options.onFailure5 = janus_mqtt_client_publish_janus_failure5;
 	}
 
-	return MQTTAsync_sendMessage(ctx->client, topic, &msg, &options);
+	return MQTTAsync_sendMessage(client, topic, &msg, &options);
 }
 #endif
 
@@ -1556,11 +1681,74 @@ void janus_mqtt_client_publish_status_failure_impl(int rc) {
 	JANUS_LOG(LOG_ERR, "MQTT client has failed publishing to status topic, return code: %d\n", rc);
 }
 
+static MQTTAsync janus_mqtt_client_get_publisher(janus_mqtt_context *ctx, json_t *message) {
+	if(ctx->publishers_num == 0)
+		return ctx->client;
+	/* Messages related to the same session always use the same connection,
+	 * so that they're not reordered; other messages are spread around */
+	guint index = 0;
+	json_t *session_id = json_object_get(message, "session_id");
+	const char *transaction = json_string_value(json_object_get(message, "transaction"));
+	if(json_is_integer(session_id)) {
+		guint64 id = json_integer_value(session_id);
+		index = (guint)((id ^ (id >> 32)) % ctx->publishers_num);
+	} else if(transaction != NULL) {
+		index = g_str_hash(transaction) % ctx->publishers_num;
+	} else {
+		index = (guint)g_atomic_int_add(&ctx->publishers_next, 1) % ctx->publishers_num;
+	}
+	janus_mqtt_publisher *publisher = &ctx->publishers[index];
+	if(!g_atomic_int_get(&publisher->connected)) {
+		/* Not connected (yet, or anymore), fallback to the main connection */
+		return ctx->client;
+	}
+	return publisher->client;
+}
+
+void janus_mqtt_publisher_connected(void *context, char *cause) {
+	janus_mqtt_publisher *publisher = (janus_mqtt_publisher *)context;
+	JANUS_LOG(LOG_INFO, "MQTT publisher #%d connected to broker: %s\n", publisher->index, cause);
+	g_atomic_int_set(&publisher->connected, 1);
+}
+
+void janus_mqtt_publisher_connection_lost(void *context, char *cause) {
+	janus_mqtt_publisher *publisher = (janus_mqtt_publisher *)context;
+	JANUS_LOG(LOG_WARN, "MQTT publisher #%d connection lost cause of %s. Reconnecting...\n", publisher->index, cause);
+	/* Automatic reconnect, until then we'll use the main connection */
+	g_atomic_int_set(&publisher->connected, 0);
+}
+
+int janus_mqtt_publisher_message_arrived(void *context, char *topicName, int topicLen, MQTTAsync_message *message) {
+	/* Publishers don't subscribe to anything, so this should never happen */
+	MQTTAsync_freeMessage(&message);
+	MQTTAsync_free(topicName);
+	return TRUE;
+}
+
+void janus_mqtt_publisher_connect_failure(void *context, MQTTAsync_failureData *response) {
+	janus_mqtt_publisher *publisher = (janus_mqtt_publisher *)context;
+	JANUS_LOG(LOG_ERR, "MQTT publisher #%d has failed connecting to the broker, return code: %d. Reconnecting...\n",
+		publisher->index, janus_mqtt_client_get_response_code(response));
+}
+
+#ifdef MQTTVERSION_5
+void janus_mqtt_publisher_connect_failure5(void *context, MQTTAsync_failureData5 *response) {
+	janus_mqtt_publisher *publisher = (janus_mqtt_publisher *)context;
+	JANUS_LOG(LOG_ERR, "MQTT publisher #%d has failed connecting to the broker, return code: %d. Reconnecting...\n",
+		publisher->index, janus_mqtt_client_get_response_code5(response));
+}
+#endif
+
 void janus_mqtt_client_destroy_context(janus_mqtt_context **ptr) {
 	janus_mqtt_context *ctx = (janus_mqtt_context *)*ptr;
 	if(ctx) {
+		int i = 0;
+		for(i=0; i<ctx->publishers_num && ctx->publishers != NULL; i++)
+			MQTTAsync_destroy(&ctx->publishers[i].client);
+		g_free(ctx->publishers);
 		MQTTAsync_destroy(&ctx->client);
 		g_free(ctx->subscribe.topic);
+		g_free(ctx->subscribe.filter);
 		g_free(ctx->publish.topic);
 		g_free(ctx->connect.username);
 		g_free(ctx->connect.password);
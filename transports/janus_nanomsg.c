@@ -7,8 +7,12 @@
  * remote applications can use Nanomsg to make requests to Janus.
  * Note that not all the protocols Nanomsg implements are made available
  * in this plugin: specifically, you'll only be able to use the \c NN_PAIR
- * transport mechanism. Future versions may implement more, but for the
- * time being these should be enough to cover most development requirements.
+ * and \c NN_BUS transport mechanisms. Future versions may implement more,
+ * but for the time being these should be enough to cover most development
+ * requirements. Multiple addresses can be configured for each API: each
+ * gets its own socket, served by its own thread. Outgoing messages are
+ * serialized straight to buffers allocated by Nanomsg and sent with
+ * \c NN_MSG, which means they're not copied again before being sent.
  *
  * \ingroup transports
  * \ref transports
@@ -18,6 +22,7 @@
 
 #include <nanomsg/nn.h>
 #include <nanomsg/pair.h>
+#include <nanomsg/bus.h>
 #include <nanomsg/inproc.h>
 #include <nanomsg/ipc.h>
 #include <nanomsg/pipeline.h>
@@ -94,25 +99,173 @@ static gboolean notify_events = TRUE;
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
-#define BUFFER_SIZE		8192
-
-/* Nanomsg server thread */
-static GThread *nanomsg_thread = NULL;
-void *janus_nanomsg_thread(void *data);
-
-/* Nanomsg servers */
-static int nfd = -1, nfd_addr = -1, admin_nfd = -1, admin_nfd_addr = -1;
-/* Pipeline to notify about the need for outgoing data */
-static int write_nfd[2];
-
-/* Nanomsg client session */
+/* Nanomsg client session: each socket we create is a client, with its
+ * own queue of outgoing messages and its own worker thread */
 typedef struct janus_nanomsg_client {
 	gboolean admin;					/* Whether this client is for the Admin or Janus API */
-	GAsyncQueue *messages;			/* Queue of outgoing messages to push */
+	guint index;					/* Index of this client, used for naming its thread and pipeline */
+	int nfd, nfd_addr;				/* Nanomsg socket, and its endpoint */
+	int write_nfd[2];				/* Pipeline to notify about the need for outgoing data */
+	GAsyncQueue *messages;			/* Queue of outgoing messages to push, as Nanomsg buffers */
 	janus_transport_session *ts;	/* Janus core-transport session */
+	GThread *thread;				/* Worker thread serving this socket */
 } janus_nanomsg_client;
-/* We only handle a single client per API, since we use NN_PAIR and we bind locally */
-static janus_nanomsg_client client, admin_client;
+/* We handle a client per socket, since NN_PAIR and NN_BUS write to all
+ * their peers anyway: multiple sockets can be configured per API */
+static GList *clients = NULL;
+static gboolean janus_api_enabled = FALSE, admin_api_enabled = FALSE;
+
+/* Nanomsg worker thread */
+static void *janus_nanomsg_thread(void *data);
+
+/* Helpers to serialize a message straight to a Nanomsg buffer, which we
+ * can then pass to nn_send() with NN_MSG, so that it doesn't copy it */
+static void *janus_nanomsg_dump(json_t *message) {
+#if JANSSON_VERSION_HEX >= 0x020a00
+	size_t size = json_dumpb(message, NULL, 0, json_format);
+	if(size == 0)
+		return NULL;
+	void *buffer = nn_allocmsg(size, 0);
+	if(buffer == NULL)
+		return NULL;
+	json_dumpb(message, buffer, size, json_format);
+	return buffer;
+#else
+	/* This version of Jansson can't serialize to a buffer we provide */
+	char *payload = json_dumps(message, json_format);
+	if(payload == NULL)
+		return NULL;
+	size_t size = strlen(payload);
+	void *buffer = nn_allocmsg(size, 0);
+	if(buffer != NULL)
+		memcpy(buffer, payload, size);
+	free(payload);
+	return buffer;
+#endif
+}
+static void janus_nanomsg_freemsg(void *buffer) {
+	(void)nn_freemsg(buffer);
+}
+static void janus_nanomsg_client_free(void *data) {
+	janus_nanomsg_client *client = (janus_nanomsg_client *)data;
+	if(client == NULL)
+		return;
+	g_async_queue_unref(client->messages);
+	g_free(client);
+}
+
+/* Helper to create the sockets for one of the APIs */
+static void janus_nanomsg_create_sockets(gboolean admin, const char *addresses, const char *mode, const char *pattern) {
+	const char *api = admin ? "Admin" : "Janus";
+	if(addresses == NULL) {
+		JANUS_LOG(LOG_ERR, "Missing %s API Nanomsg address\n", api);
+		return;
+	}
+	int protocol = NN_PAIR;
+	if(pattern != NULL && !strcasecmp(pattern, "bus")) {
+		protocol = NN_BUS;
+	} else if(pattern != NULL && strcasecmp(pattern, "pair")) {
+		JANUS_LOG(LOG_ERR, "Unsupported pattern '%s'\n", pattern);
+		return;
+	}
+	if(mode == NULL)
+		mode = "bind";
+	if(strcasecmp(mode, "bind") && strcasecmp(mode, "connect")) {
+		/* Unsupported mode */
+		JANUS_LOG(LOG_ERR, "Unsupported mode '%s'\n", mode);
+		return;
+	}
+	/* We create a different socket for each address */
+	gchar **list = g_strsplit(addresses, ",", -1);
+	gchar *address = NULL;
+	int i = 0;
+	while((address = list[i]) != NULL) {
+		i++;
+		g_strstrip(address);
+		if(strlen(address) == 0)
+			continue;
+		int nfd = nn_socket(AF_SP, protocol);
+		if(nfd < 0) {
+			JANUS_LOG(LOG_ERR, "Error creating %s API Nanomsg socket: %d (%s)\n", api, errno, nn_strerror(errno));
+			continue;
+		}
+		int nfd_addr = -1;
+		if(!strcasecmp(mode, "bind")) {
+			/* Bind to this address */
+			nfd_addr = nn_bind(nfd, address);
+			if(nfd_addr < 0) {
+				JANUS_LOG(LOG_ERR, "Error binding %s API Nanomsg socket to address '%s': %d (%s)\n",
+					api, address, errno, nn_strerror(errno));
+				nn_close(nfd);
+				continue;
+			}
+		} else {
+			/* Connect to this address */
+			nfd_addr = nn_connect(nfd, address);
+			if(nfd_addr < 0) {
+				JANUS_LOG(LOG_ERR, "Error connecting %s API Nanomsg socket to address '%s': %d (%s)\n",
+					api, address, errno, nn_strerror(errno));
+				nn_close(nfd);
+				continue;
+			}
+		}
+		/* Initialize the pipeline for writeable notifications */
+		janus_nanomsg_client *client = g_malloc0(sizeof(janus_nanomsg_client));
+		client->admin = admin;
+		client->index = g_list_length(clients);
+		client->nfd = nfd;
+		client->nfd_addr = nfd_addr;
+		client->write_nfd[0] = nn_socket(AF_SP, NN_PULL);
+		client->write_nfd[1] = nn_socket(AF_SP, NN_PUSH);
+		char pipeline[32];
+		g_snprintf(pipeline, sizeof(pipeline), "inproc://janus-%u", client->index);
+		if(nn_bind(client->write_nfd[0], pipeline) < 0 || nn_connect(client->write_nfd[1], pipeline) < 0) {
+			JANUS_LOG(LOG_ERR, "Error configuring internal Nanomsg pipeline... %d (%s)\n", errno, nn_strerror(errno));
+			nn_close(client->write_nfd[0]);
+			nn_close(client->write_nfd[1]);
+			nn_shutdown(nfd, nfd_addr);
+			nn_close(nfd);
+			g_free(client);
+			continue;
+		}
+		client->messages = g_async_queue_new_full((GDestroyNotify)janus_nanomsg_freemsg);
+		/* Create a transport instance as well */
+		client->ts = janus_transport_session_create(client, janus_nanomsg_client_free);
+		clients = g_list_append(clients, client);
+		if(admin)
+			admin_api_enabled = TRUE;
+		else
+			janus_api_enabled = TRUE;
+		JANUS_LOG(LOG_INFO, "%s API Nanomsg %s socket on '%s' (%s)\n", api,
+			protocol == NN_BUS ? "NN_BUS" : "NN_PAIR", address, mode);
+	}
+	g_strfreev(list);
+}
+
+/* Helper to stop the worker threads, and get rid of the clients */
+static void janus_nanomsg_destroy_clients(void) {
+	GList *temp = clients;
+	while(temp) {
+		janus_nanomsg_client *client = (janus_nanomsg_client *)temp->data;
+		if(client->thread != NULL) {
+			/* Wake the thread up, so that it notices we're stopping */
+			(void)nn_send(client->write_nfd[1], "x", 1, 0);
+			g_thread_join(client->thread);
+			client->thread = NULL;
+		}
+		nn_close(client->write_nfd[0]);
+		nn_close(client->write_nfd[1]);
+		nn_shutdown(client->nfd, client->nfd_addr);
+		nn_close(client->nfd);
+		/* The client will be freed when the core is done with the session */
+		janus_transport_session_destroy(client->ts);
+		temp = temp->next;
+	}
+	g_list_free(clients);
+	clients = NULL;
+	janus_api_enabled = FALSE;
+	admin_api_enabled = FALSE;
+}
 
 
 /* Transport implementation */
@@ -172,18 +325,6 @@ int janus_nanomsg_init(janus_transport_callbacks *callback, const char *config_p
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_NANOMSG_NAME);
 		}
 
-		/* First of all, initialize the pipeline for writeable notifications */
-		write_nfd[0] = nn_socket(AF_SP, NN_PULL);
-		write_nfd[1] = nn_socket(AF_SP, NN_PUSH);
-		if(nn_bind(write_nfd[0], "inproc://janus") < 0) {
-			JANUS_LOG(LOG_WARN, "Error configuring internal Nanomsg pipeline... %d (%s)\n", errno, nn_strerror(errno));
-			return -1;	/* No point in keeping the plugin loaded */
-		}
-		if(nn_connect(write_nfd[1], "inproc://janus") < 0) {
-			JANUS_LOG(LOG_WARN, "Error configuring internal Nanomsg pipeline...%d (%s)\n", errno, nn_strerror(errno));
-			return -1;	/* No point in keeping the plugin loaded */
-		}
-
 		/* Setup the Janus API Nanomsg server(s) */
 		item = janus_config_get(config, config_general, janus_config_type_item, "enabled");
 		if(!item || !item->value || !janus_is_true(item->value)) {
@@ -193,37 +334,9 @@ int janus_nanomsg_init(janus_transport_callbacks *callback, const char *config_p
 			const char *address = item && item->value ? item->value : NULL;
 			item = janus_config_get(config, config_general, janus_config_type_item, "mode");
 			const char *mode = item && item->value ? item->value : NULL;
-			if(mode == NULL)
-				mode = "bind";
-			nfd = nn_socket(AF_SP, NN_PAIR);
-			if(nfd < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating Janus API Nanomsg socket: %d (%s)\n", errno, nn_strerror(errno));
-			} else {
-				if(!strcasecmp(mode, "bind")) {
-					/* Bind to this address */
-					nfd_addr = nn_bind(nfd, address);
-					if(nfd_addr < 0) {
-						JANUS_LOG(LOG_ERR, "Error binding Janus API Nanomsg socket to address '%s': %d (%s)\n",
-							address, errno, nn_strerror(errno));
-						nn_close(nfd);
-						nfd = -1;
-					}
-				} else if(!strcasecmp(mode, "connect")) {
-					/* Connect to this address */
-					nfd_addr = nn_connect(nfd, address);
-					if(nfd_addr < 0) {
-						JANUS_LOG(LOG_ERR, "Error connecting Janus API Nanomsg socket to address '%s': %d (%s)\n",
-							address, errno, nn_strerror(errno));
-						nn_close(nfd);
-						nfd = -1;
-					}
-				} else {
-					/* Unsupported mode */
-					JANUS_LOG(LOG_ERR, "Unsupported mode '%s'\n", mode);
-					nn_close(nfd);
-					nfd = -1;
-				}
-			}
+			item = janus_config_get(config, config_general, janus_config_type_item, "pattern");
+			const char *pattern = item && item->value ? item->value : NULL;
+			janus_nanomsg_create_sockets(FALSE, address, mode, pattern);
 		}
 		/* Do the same for the Admin API, if enabled */
 		item = janus_config_get(config, config_admin, janus_config_type_item, "admin_enabled");
@@ -234,87 +347,44 @@ int janus_nanomsg_init(janus_transport_callbacks *callback, const char *config_p
 			const char *address = item && item->value ? item->value : NULL;
 			item = janus_config_get(config, config_admin, janus_config_type_item, "admin_mode");
 			const char *mode = item && item->value ? item->value : NULL;
-			if(mode == NULL)
-				mode = "bind";
-			admin_nfd = nn_socket(AF_SP, NN_PAIR);
-			if(admin_nfd < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating Admin API Nanomsg socket: %d (%s)\n", errno, nn_strerror(errno));
-			} else {
-				if(!strcasecmp(mode, "bind")) {
-					/* Bind to this address */
-					admin_nfd_addr = nn_bind(admin_nfd, address);
-					if(admin_nfd_addr < 0) {
-						JANUS_LOG(LOG_ERR, "Error binding Admin API Nanomsg socket to address '%s': %d (%s)\n",
-							address, errno, nn_strerror(errno));
-						nn_close(admin_nfd);
-						admin_nfd = -1;
-					}
-				} else if(!strcasecmp(mode, "connect")) {
-					/* Connect to this address */
-					admin_nfd_addr = nn_connect(admin_nfd, address);
-					if(admin_nfd_addr < 0) {
-						JANUS_LOG(LOG_ERR, "Error connecting Admin API Nanomsg socket to address '%s': %d (%s)\n",
-							address, errno, nn_strerror(errno));
-						nn_close(admin_nfd);
-						admin_nfd = -1;
-					}
-				} else {
-					/* Unsupported mode */
-					JANUS_LOG(LOG_ERR, "Unsupported mode '%s'\n", mode);
-					nn_close(admin_nfd);
-					admin_nfd = -1;
-				}
-			}
+			item = janus_config_get(config, config_admin, janus_config_type_item, "admin_pattern");
+			const char *pattern = item && item->value ? item->value : NULL;
+			janus_nanomsg_create_sockets(TRUE, address, mode, pattern);
 		}
 	}
 	janus_config_destroy(config);
 	config = NULL;
-	if(nfd < 0 && admin_nfd < 0) {
+	if(clients == NULL) {
 		JANUS_LOG(LOG_WARN, "No Nanomsg server started, giving up...\n");
 		return -1;	/* No point in keeping the plugin loaded */
 	}
 
-	/* Create the clients */
-	memset(&client, 0, sizeof(janus_nanomsg_client));
-	if(nfd > -1) {
-		client.admin = FALSE;
-		client.messages = g_async_queue_new();
-		/* Create a transport instance as well */
-		client.ts = janus_transport_session_create(&client, NULL);
-		/* Notify handlers about this new transport */
+	/* Notify handlers about the new transports, and start the worker threads */
+	GList *temp = clients;
+	while(temp) {
+		janus_nanomsg_client *client = (janus_nanomsg_client *)temp->data;
 		if(notify_events && gateway->events_is_enabled()) {
 			json_t *info = json_object();
 			json_object_set_new(info, "event", json_string("created"));
-			json_object_set_new(info, "admin_api", json_false());
-			json_object_set_new(info, "socket", json_integer(nfd));
-			gateway->notify_event(&janus_nanomsg_transport, client.ts, info);
+			json_object_set_new(info, "admin_api", client->admin ? json_true() : json_false());
+			json_object_set_new(info, "socket", json_integer(client->nfd));
+			gateway->notify_event(&janus_nanomsg_transport, client->ts, info);
 		}
-	}
-	memset(&admin_client, 0, sizeof(janus_nanomsg_client));
-	if(admin_nfd > -1) {
-		admin_client.admin = TRUE;
-		admin_client.messages = g_async_queue_new();
-		/* Create a transport instance as well */
-		admin_client.ts = janus_transport_session_create(&admin_client, NULL);
-		/* Notify handlers about this new transport */
-		if(notify_events && gateway->events_is_enabled()) {
-			json_t *info = json_object();
-			json_object_set_new(info, "event", json_string("created"));
-			json_object_set_new(info, "admin_api", json_true());
-			json_object_set_new(info, "socket", json_integer(admin_nfd));
-			gateway->notify_event(&janus_nanomsg_transport, admin_client.ts, info);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "nanomsg %u", client->index);
+		client->thread = g_thread_try_new(tname, &janus_nanomsg_thread, client, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Nanomsg thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			/* Stop the threads we started already */
+			g_atomic_int_set(&stopping, 1);
+			janus_nanomsg_destroy_clients();
+			g_atomic_int_set(&stopping, 0);
+			return -1;
 		}
-	}
-
-	/* Start the Nanomsg service thread */
-	GError *error = NULL;
-	nanomsg_thread = g_thread_try_new("nanomsg thread", &janus_nanomsg_thread, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Nanomsg thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		return -1;
+		temp = temp->next;
 	}
 
 	/* Done */
@@ -328,13 +398,8 @@ void janus_nanomsg_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	/* Stop the service thread */
-	(void)nn_send(write_nfd[1], "x", 1, 0);
-
-	if(nanomsg_thread != NULL) {
-		g_thread_join(nanomsg_thread);
-		nanomsg_thread = NULL;
-	}
+	/* Stop the worker threads */
+	janus_nanomsg_destroy_clients();
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -371,23 +436,32 @@ const char *janus_nanomsg_get_package(void) {
 }
 
 gboolean janus_nanomsg_is_janus_api_enabled(void) {
-	return nfd > -1;
+	return janus_api_enabled;
 }
 
 gboolean janus_nanomsg_is_admin_api_enabled(void) {
-	return admin_nfd > -1;
+	return admin_api_enabled;
 }
 
 int janus_nanomsg_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
 	if(message == NULL)
 		return -1;
-	/* Convert to string */
-	char *payload = json_dumps(message, json_format);
+	if(transport == NULL || transport->transport_p == NULL || g_atomic_int_get(&transport->destroyed)) {
+		json_decref(message);
+		return -1;
+	}
+	janus_nanomsg_client *client = (janus_nanomsg_client *)transport->transport_p;
+	/* Serialize to a Nanomsg buffer */
+	void *payload = janus_nanomsg_dump(message);
 	json_decref(message);
+	if(payload == NULL) {
+		JANUS_LOG(LOG_ERR, "Error serializing %s API message...\n", client->admin ? "Admin" : "Janus");
+		return -1;
+	}
 	/* Enqueue the packet and have poll tell us when it's time to send it */
-	g_async_queue_push(admin ? admin_client.messages : client.messages, payload);
+	g_async_queue_push(client->messages, payload);
 	/* Notify the thread there's data to send */
-	(void)nn_send(write_nfd[1], "x", 1, 0);
+	(void)nn_send(client->write_nfd[1], "x", 1, 0);
 	return 0;
 }
 
@@ -406,36 +480,28 @@ void janus_nanomsg_session_claimed(janus_transport_session *transport, guint64 s
 
 
 /* Thread */
-void *janus_nanomsg_thread(void *data) {
-	JANUS_LOG(LOG_INFO, "Nanomsg thread started\n");
+static void *janus_nanomsg_thread(void *data) {
+	janus_nanomsg_client *client = (janus_nanomsg_client *)data;
+	const char *api = client->admin ? "Admin" : "Janus";
+	JANUS_LOG(LOG_INFO, "Nanomsg thread started (%s API, socket %d)\n", api, client->nfd);
 
 	int fds = 0;
-	struct nn_pollfd poll_nfds[3];	/* FIXME Should we allow for more clients? */
-	char buffer[BUFFER_SIZE];
+	struct nn_pollfd poll_nfds[2];
+	char wakeup[1];
 
-	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
+	while(!g_atomic_int_get(&stopping)) {
 		/* Prepare poll list of file descriptors */
 		fds = 0;
 		/* Writeable monitor */
-		poll_nfds[fds].fd = write_nfd[0];
+		poll_nfds[fds].fd = client->write_nfd[0];
 		poll_nfds[fds].events = NN_POLLIN;
 		fds++;
-		if(nfd > -1) {
-			/* Janus API */
-			poll_nfds[fds].fd = nfd;
-			poll_nfds[fds].events = NN_POLLIN;
-			if(client.messages != NULL && g_async_queue_length(client.messages) > 0)
-				poll_nfds[fds].events |= NN_POLLOUT;
-			fds++;
-		}
-		if(admin_nfd > -1) {
-			/* Admin API */
-			poll_nfds[fds].fd = admin_nfd;
-			poll_nfds[fds].events = NN_POLLIN;
-			if(admin_client.messages != NULL && g_async_queue_length(admin_client.messages) > 0)
-				poll_nfds[fds].events |= NN_POLLOUT;
-			fds++;
-		}
+		/* Janus or Admin API */
+		poll_nfds[fds].fd = client->nfd;
+		poll_nfds[fds].events = NN_POLLIN;
+		if(g_async_queue_length(client->messages) > 0)
+			poll_nfds[fds].events |= NN_POLLOUT;
+		fds++;
 		/* Start polling */
 		int res = nn_poll(poll_nfds, fds, -1);
 		if(res == 0)
@@ -448,68 +514,47 @@ void *janus_nanomsg_thread(void *data) {
 			JANUS_LOG(LOG_ERR, "poll() failed: %d (%s)\n", errno, nn_strerror(errno));
 			break;
 		}
-		int i = 0;
-		for(i=0; i<fds; i++) {
-			/* FIXME Is there a Nanomsg equivalent of POLLERR? */
-			if(poll_nfds[i].revents & NN_POLLOUT) {
-				/* Find the client from its file descriptor */
-				if(poll_nfds[i].fd == nfd || poll_nfds[i].fd == admin_nfd) {
-					char *payload = NULL;
-					while((payload = g_async_queue_try_pop(poll_nfds[i].fd == nfd ? client.messages : admin_client.messages)) != NULL) {
-						int res = nn_send(poll_nfds[i].fd, payload, strlen(payload), 0);
-						/* FIXME Should we check if sent everything? */
-						JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, strlen(payload), poll_nfds[i].fd);
-						g_free(payload);
-					}
+		if(g_atomic_int_get(&stopping))
+			break;
+		/* FIXME Is there a Nanomsg equivalent of POLLERR? */
+		if(poll_nfds[0].revents & NN_POLLIN) {
+			/* Read and ignore: we use this to unlock the poll if there's data to write */
+			(void)nn_recv(client->write_nfd[0], wakeup, sizeof(wakeup), 0);
+		}
+		if(poll_nfds[1].revents & NN_POLLOUT) {
+			void *payload = NULL;
+			while((payload = g_async_queue_try_pop(client->messages)) != NULL) {
+				/* Nanomsg takes ownership of the buffer, when the send succeeds */
+				int res = nn_send(client->nfd, &payload, NN_MSG, 0);
+				if(res < 0) {
+					JANUS_LOG(LOG_WARN, "Error sending %s API message... %d (%s)\n", api, errno, nn_strerror(errno));
+					(void)nn_freemsg(payload);
+					continue;
 				}
+				JANUS_LOG(LOG_HUGE, "Written %d bytes on %d\n", res, client->nfd);
 			}
-			if(poll_nfds[i].revents & NN_POLLIN) {
-				if(poll_nfds[i].fd == write_nfd[0]) {
-					/* Read and ignore: we use this to unlock the poll if there's data to write */
-					(void)nn_recv(poll_nfds[i].fd, buffer, BUFFER_SIZE, 0);
-				} else if(poll_nfds[i].fd == nfd || poll_nfds[i].fd == admin_nfd) {
-					/* Janus/Admin API: get the message from the client */
-					int res = nn_recv(poll_nfds[i].fd, buffer, BUFFER_SIZE, 0);
-					if(res < 0) {
-						JANUS_LOG(LOG_WARN, "Error receiving %s API message... %d (%s)\n",
-							poll_nfds[i].fd == nfd ? "Janus" : "Admin", errno, nn_strerror(errno));
-						continue;
-					}
-					/* If we got here, there's data to handle */
-					buffer[res] = '\0';
-					JANUS_LOG(LOG_VERB, "Got %s API message (%d bytes)\n",
-						poll_nfds[i].fd == nfd ? "Janus" : "Admin", res);
-					JANUS_LOG(LOG_HUGE, "%s\n", buffer);
-					/* Parse the JSON payload */
-					json_error_t error;
-					json_t *root = json_loads(buffer, 0, &error);
-					/* Notify the core, passing both the object and, since it may be needed, the error */
-					gateway->incoming_request(&janus_nanomsg_transport,
-						poll_nfds[i].fd == nfd ? client.ts : admin_client.ts,
-						NULL,
-						poll_nfds[i].fd == nfd ? FALSE : TRUE,
-						root, &error);
-				}
+		}
+		if(poll_nfds[1].revents & NN_POLLIN) {
+			/* Janus/Admin API: get the message from the client, in a buffer Nanomsg allocates */
+			void *buffer = NULL;
+			int res = nn_recv(client->nfd, &buffer, NN_MSG, 0);
+			if(res < 0) {
+				JANUS_LOG(LOG_WARN, "Error receiving %s API message... %d (%s)\n", api, errno, nn_strerror(errno));
+				continue;
 			}
+			/* If we got here, there's data to handle */
+			JANUS_LOG(LOG_VERB, "Got %s API message (%d bytes)\n", api, res);
+			JANUS_LOG(LOG_HUGE, "%.*s\n", res, (char *)buffer);
+			/* Parse the JSON payload */
+			json_error_t error;
+			json_t *root = json_loadb(buffer, res, 0, &error);
+			(void)nn_freemsg(buffer);
+			/* Notify the core, passing both the object and, since it may be needed, the error */
+			gateway->incoming_request(&janus_nanomsg_transport, client->ts, NULL, client->admin, root, &error);
 		}
 	}
 
-	nn_close(write_nfd[0]);
-	nn_close(write_nfd[1]);
-	if(nfd > -1) {
-		nn_shutdown(nfd, nfd_addr);
-		nn_close(nfd);
-		janus_transport_session_destroy(client.ts);
-		client.ts = NULL;
-	}
-	if(admin_nfd > -1) {
-		nn_shutdown(admin_nfd, admin_nfd_addr);
-		nn_close(admin_nfd);
-		janus_transport_session_destroy(admin_client.ts);
-		admin_client.ts = NULL;
-	}
-
 	/* Done */
-	JANUS_LOG(LOG_INFO, "Nanomsg thread ended\n");
+	JANUS_LOG(LOG_INFO, "Nanomsg thread ended (%s API, socket %d)\n", api, client->nfd);
 	return NULL;
 }
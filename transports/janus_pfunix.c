@@ -22,6 +22,15 @@
  * explicit request as the GET in the plain HTTP API. Closing a client
  * Unix Socket will also destroy all the sessions it created.
  *
+ * \c SOCK_SEQPACKET clients on the same host can also ask for responses
+ * and events to be delivered on a shared memory ring instead, with the
+ * socket only used for requests and wakeups, so that large numbers of
+ * events can flow without a system call each: the ring has to be enabled
+ * in the configuration (\c ring_size ), and its layout, along with a small
+ * header only library clients can use to consume it, is described in
+ * janus_pfunix_ring.h. Outgoing messages for clients not using a ring are
+ * sent in batches, when possible.
+ *
  * \ingroup transports
  * \ref transports
  */
@@ -32,6 +41,10 @@
 #include <sys/socket.h>
 #include <poll.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "janus_pfunix_ring.h"
 
 #ifdef  HAVE_LIBSYSTEMD
 #include "systemd/sd-daemon.h"
@@ -126,8 +139,31 @@ static gboolean dgram = FALSE, admin_dgram = FALSE;
 #ifdef HAVE_LIBSYSTEMD
 static gboolean sd_socket = FALSE, admin_sd_socket = FALSE;
 #endif /* HAVE_LIBSYSTEMD */
-/* Socket pair to notify about the need for outgoing data */
+/* Socket pair to notify about the need for outgoing data (only written
+ * to when a notification isn't pending already) */
 static int write_fd[2];
+static volatile gint write_pending = 0;
+static void janus_pfunix_notify_thread(void) {
+	if(!g_atomic_int_compare_and_exchange(&write_pending, 0, 1))
+		return;
+	int res = 0;
+	do {
+		res = write(write_fd[1], "x", 1);
+	} while(res == -1 && errno == EINTR);
+}
+
+/* Size of the shared memory rings clients can ask for (0 means disabled) */
+static uint64_t ring_size = 0;
+/* How many messages we try to send at once to a client */
+#define BATCH_SIZE		64
+
+/* Shared memory ring of a client, as seen by the writer */
+typedef struct janus_pfunix_client_ring {
+	janus_pfunix_ring_header *header;
+	uint8_t *data;
+	size_t length;
+	char *pending;					/* Message that didn't fit, we'll write it when there's room */
+} janus_pfunix_client_ring;
 
 /* Unix Sockets client session */
 typedef struct janus_pfunix_client {
@@ -136,11 +172,20 @@ typedef struct janus_pfunix_client {
 	gboolean admin;					/* Whether this client is for the Admin or Janus API */
 	GAsyncQueue *messages;			/* Queue of outgoing messages to push */
 	gboolean session_timeout;		/* Whether a Janus session timeout occurred in the core */
+	janus_pfunix_client_ring *ring;	/* Shared memory ring to write messages to, if the client asked for one */
 	janus_transport_session *ts;	/* Janus core-transport session */
 } janus_pfunix_client;
 static GHashTable *clients = NULL, *clients_by_fd = NULL, *clients_by_path = NULL;
 static janus_mutex clients_mutex = JANUS_MUTEX_INITIALIZER;
 
+static void janus_pfunix_client_ring_free(janus_pfunix_client_ring *ring) {
+	if(ring == NULL)
+		return;
+	munmap(ring->header, ring->length);
+	g_free(ring->pending);
+	g_free(ring);
+}
+
 static void janus_pfunix_client_free(void *client_ref) {
 	if(!client_ref)
 		return;
@@ -153,9 +198,225 @@ static void janus_pfunix_client_free(void *client_ref) {
 		}
 		g_async_queue_unref(client->messages);
 	}
+	janus_pfunix_client_ring_free(client->ring);
 	g_free(client);
 }
 
+/* Helper to create the shared memory for a client ring: returns the file descriptor to send the client */
+static int janus_pfunix_client_ring_create(janus_pfunix_client *client) {
+	size_t length = JANUS_PFUNIX_RING_DATA + ring_size;
+	int fd = -1;
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("janus-pfunix-ring", MFD_CLOEXEC);
+#else
+	char *filename = NULL;
+	fd = g_file_open_tmp("janus-pfunix-ring-XXXXXX", &filename, NULL);
+	if(filename != NULL) {
+		/* We only need the descriptor, no one else should open this */
+		unlink(filename);
+		g_free(filename);
+	}
+#endif
+	if(fd < 0) {
+		JANUS_LOG(LOG_ERR, "Error creating shared memory for client ring: %d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	if(ftruncate(fd, length) < 0) {
+		JANUS_LOG(LOG_ERR, "Error sizing shared memory for client ring: %d (%s)\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	void *mem = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mem == MAP_FAILED) {
+		JANUS_LOG(LOG_ERR, "Error mapping shared memory for client ring: %d (%s)\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	janus_pfunix_client_ring *ring = g_malloc0(sizeof(janus_pfunix_client_ring));
+	ring->header = (janus_pfunix_ring_header *)mem;
+	ring->data = (uint8_t *)mem + JANUS_PFUNIX_RING_DATA;
+	ring->length = length;
+	ring->header->version = JANUS_PFUNIX_RING_VERSION;
+	ring->header->size = ring_size;
+	__atomic_store_n(&ring->header->magic, JANUS_PFUNIX_RING_MAGIC, __ATOMIC_SEQ_CST);
+	client->ring = ring;
+	return fd;
+}
+
+/* Helper to write a message to a ring: returns FALSE if there's no room for it right now */
+static gboolean janus_pfunix_client_ring_write(janus_pfunix_client_ring *ring, uint64_t *write_pos, const char *payload) {
+	janus_pfunix_ring_header *header = ring->header;
+	size_t len = strlen(payload);
+	uint64_t need = JANUS_PFUNIX_RING_RECORD_SIZE(len);
+	uint64_t offset = *write_pos & (header->size - 1);
+	uint64_t skip = (offset + need > header->size) ? header->size - offset : 0;
+	uint64_t read_pos = __atomic_load_n(&header->read_pos, __ATOMIC_SEQ_CST);
+	if(*write_pos + skip + need - read_pos > header->size) {
+		/* Full: tell the client we're waiting, and check again in case it just made room */
+		__atomic_store_n(&header->writer_waiting, 1, __ATOMIC_SEQ_CST);
+		read_pos = __atomic_load_n(&header->read_pos, __ATOMIC_SEQ_CST);
+		if(*write_pos + skip + need - read_pos > header->size)
+			return FALSE;
+		__atomic_store_n(&header->writer_waiting, 0, __ATOMIC_SEQ_CST);
+	}
+	if(skip > 0) {
+		uint32_t marker = JANUS_PFUNIX_RING_SKIP;
+		memcpy(ring->data + offset, &marker, sizeof(marker));
+		*write_pos += skip;
+		offset = 0;
+	}
+	uint32_t length = len;
+	memcpy(ring->data + offset, &length, sizeof(length));
+	memcpy(ring->data + offset + 4, payload, len + 1);
+	*write_pos += need;
+	return TRUE;
+}
+
+/* Helper to move the queued messages of a client to its ring (clients_mutex must be locked) */
+static void janus_pfunix_client_ring_flush(janus_pfunix_client *client) {
+	janus_pfunix_client_ring *ring = client->ring;
+	janus_pfunix_ring_header *header = ring->header;
+	uint64_t start = header->write_pos, write_pos = start;
+	char *payload = NULL;
+	while((payload = ring->pending ? ring->pending : g_async_queue_try_pop(client->messages)) != NULL) {
+		ring->pending = NULL;
+		if(JANUS_PFUNIX_RING_RECORD_SIZE(strlen(payload)) > header->size) {
+			JANUS_LOG(LOG_WARN, "Message for client %d too large for the ring (%zu bytes), dropping it\n",
+				client->fd, strlen(payload));
+			g_free(payload);
+			continue;
+		}
+		if(!janus_pfunix_client_ring_write(ring, &write_pos, payload)) {
+			/* No room, wait for the client to wake us up */
+			ring->pending = payload;
+			break;
+		}
+		g_free(payload);
+	}
+	if(write_pos == start)
+		return;
+	/* Publish what we wrote, and wake up the client if it had consumed everything already */
+	__atomic_store_n(&header->write_pos, write_pos, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&header->read_pos, __ATOMIC_SEQ_CST) == start && client->fd > -1) {
+		const char *wakeup = "{\"pfunix\":\"wakeup\"}";
+		int res = 0;
+		do {
+			res = send(client->fd, wakeup, strlen(wakeup), MSG_NOSIGNAL);
+		} while(res == -1 && errno == EINTR);
+	}
+}
+
+/* Helper to handle the transport-level requests clients can send (clients_mutex must be locked):
+ * returns TRUE if this was one, and so it shouldn't be passed to the core */
+static gboolean janus_pfunix_client_control(janus_pfunix_client *client, json_t *root) {
+	const char *request = json_string_value(json_object_get(root, "pfunix"));
+	if(request == NULL)
+		return FALSE;
+	if(!strcasecmp(request, "wakeup")) {
+		/* The client made some room in the ring */
+		if(client->ring != NULL)
+			janus_pfunix_client_ring_flush(client);
+		return TRUE;
+	}
+	if(strcasecmp(request, "ring"))
+		return FALSE;
+	/* The client wants a shared memory ring */
+	int fd = -1;
+	json_t *reply = json_object();
+	json_object_set_new(reply, "pfunix", json_string("ring"));
+	if(ring_size == 0) {
+		json_object_set_new(reply, "error", json_string("Rings are disabled"));
+	} else if(client->ring != NULL) {
+		json_object_set_new(reply, "error", json_string("Ring already created"));
+	} else if((fd = janus_pfunix_client_ring_create(client)) < 0) {
+		json_object_set_new(reply, "error", json_string("Error creating ring"));
+	} else {
+		json_object_set_new(reply, "size", json_integer(ring_size));
+	}
+	char *payload = json_dumps(reply, JSON_COMPACT);
+	json_decref(reply);
+	struct iovec iov = { .iov_base = payload, .iov_len = strlen(payload) };
+	union {
+		struct cmsghdr cmsg;
+		char control[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if(fd > -1) {
+		/* Pass the file descriptor of the ring as well */
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.control;
+		msg.msg_controllen = sizeof(control.control);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	int res = 0;
+	do {
+		res = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+	} while(res == -1 && errno == EINTR);
+	if(res < 0 && client->ring != NULL) {
+		JANUS_LOG(LOG_ERR, "Error sending ring to client %d: %d (%s)\n", client->fd, errno, strerror(errno));
+		janus_pfunix_client_ring_free(client->ring);
+		client->ring = NULL;
+	} else if(client->ring != NULL) {
+		JANUS_LOG(LOG_INFO, "Unix Sockets client %d will receive messages on a %"SCNu64" bytes ring\n", client->fd, ring_size);
+		/* Anything we queued already will go to the ring too */
+		janus_pfunix_client_ring_flush(client);
+	}
+	free(payload);
+	if(fd > -1)
+		close(fd);
+	return TRUE;
+}
+
+/* Helper to send all the queued messages to a SOCK_SEQPACKET client, in batches when possible */
+static void janus_pfunix_client_send_queued(janus_pfunix_client *client) {
+	char *payloads[BATCH_SIZE];
+	int count = 0, i = 0;
+	while(client->fd > -1) {
+		count = 0;
+		while(count < BATCH_SIZE && (payloads[count] = g_async_queue_try_pop(client->messages)) != NULL)
+			count++;
+		if(count == 0)
+			break;
+		int sent = 0;
+#ifdef HAVE_SENDMMSG
+		struct mmsghdr msgs[BATCH_SIZE];
+		struct iovec iovs[BATCH_SIZE];
+		memset(msgs, 0, sizeof(msgs));
+		for(i=0; i<count; i++) {
+			iovs[i].iov_base = payloads[i];
+			iovs[i].iov_len = strlen(payloads[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int res = 0;
+		do {
+			res = sendmmsg(client->fd, msgs, count, MSG_NOSIGNAL);
+		} while(res == -1 && errno == EINTR);
+		if(res > 0)
+			sent = res;
+		JANUS_LOG(LOG_HUGE, "Written %d/%d messages on %d\n", sent, count, client->fd);
+#endif
+		/* Whatever we couldn't send in a batch, we send one by one */
+		for(i=sent; i<count; i++) {
+			int res = 0;
+			do {
+				res = write(client->fd, payloads[i], strlen(payloads[i]));
+			} while(res == -1 && errno == EINTR);
+			/* FIXME Should we check if sent everything? */
+			JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, strlen(payloads[i]), client->fd);
+		}
+		for(i=0; i<count; i++)
+			g_free(payloads[i]);
+	}
+}
+
 
 /* Helper to create a named Unix Socket out of the path to link to */
 static int janus_pfunix_create_socket(char *pfname, gboolean use_dgram) {
@@ -255,6 +516,21 @@ int janus_pfunix_init(janus_transport_callbacks *callback, const char *config_pa
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_PFUNIX_NAME);
 		}
 
+		/* Check if clients can ask for shared memory rings */
+		item = janus_config_get(config, config_general, janus_config_type_item, "ring_size");
+		if(item && item->value) {
+			int size = atoi(item->value);
+			if(size < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid ring_size value (%d), rings will be disabled\n", size);
+			} else if(size > 0) {
+				/* The size is in KB, and must be a power of 2 */
+				ring_size = 1024;
+				while(ring_size < (uint64_t)size * 1024)
+					ring_size <<= 1;
+				JANUS_LOG(LOG_INFO, "Clients can ask for %"SCNu64" bytes shared memory rings\n", ring_size);
+			}
+		}
+
 		/* First of all, initialize the socketpair for writeable notifications */
 		if(socketpair(PF_LOCAL, SOCK_STREAM, 0, write_fd) < 0) {
 			JANUS_LOG(LOG_FATAL, "Error creating socket pair for writeable events: %d, %s\n", errno, strerror(errno));
@@ -435,10 +711,7 @@ int janus_pfunix_send_message(janus_transport_session *transport, void *request_
 		/* SOCK_SEQPACKET, enqueue the packet and have poll tell us when it's time to send it */
 		g_async_queue_push(client->messages, payload);
 		/* Notify the thread there's data to send */
-		int res = 0;
-		do {
-			res = write(write_fd[1], "x", 1);
-		} while(res == -1 && errno == EINTR);
+		janus_pfunix_notify_thread();
 	} else {
 		/* SOCK_DGRAM, send it right away */
 		int res = 0;
@@ -464,10 +737,7 @@ void janus_pfunix_session_over(janus_transport_session *transport, guint64 sessi
 	if(g_hash_table_lookup(clients, client) != NULL) {
 		client->session_timeout = TRUE;
 		/* Notify the thread about this */
-		int res = 0;
-		do {
-			res = write(write_fd[1], "x", 1);
-		} while(res == -1 && errno == EINTR);
+		janus_pfunix_notify_thread();
 	}
 	janus_mutex_unlock(&clients_mutex);
 }
@@ -521,8 +791,12 @@ void *janus_pfunix_thread(void *data) {
 		while(g_hash_table_iter_next(&iter, NULL, &value)) {
 			janus_pfunix_client *client = value;
 			if(client->fd > -1) {
+				/* Clients with a ring don't need the socket to be writable, write to the ring right away */
+				if(client->ring != NULL && client->ring->pending == NULL)
+					janus_pfunix_client_ring_flush(client);
 				poll_fds[fds].fd = client->fd;
-				poll_fds[fds].events = g_async_queue_length(client->messages) > 0 ? POLLIN | POLLOUT : POLLIN;
+				poll_fds[fds].events = (client->ring == NULL && g_async_queue_length(client->messages) > 0) ||
+					client->session_timeout ? POLLIN | POLLOUT : POLLIN;
 				fds++;
 			}
 		}
@@ -607,18 +881,8 @@ void *janus_pfunix_thread(void *data) {
 				janus_mutex_lock(&clients_mutex);
 				janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
 				if(client != NULL) {
-					char *payload = NULL;
-					while((payload = g_async_queue_try_pop(client->messages)) != NULL) {
-						int res = 0;
-						do {
-							if(client->fd < 0)
-								break;
-							res = write(client->fd, payload, strlen(payload));
-						} while(res == -1 && errno == EINTR);
-						/* FIXME Should we check if sent everything? */
-						JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, strlen(payload), client->fd);
-						g_free(payload);
-					}
+					if(client->ring == NULL)
+						janus_pfunix_client_send_queued(client);
 					if(client->session_timeout) {
 						/* We should actually get rid of this connection, now */
 						shutdown(SHUT_RDWR, poll_fds[i].fd);
@@ -634,6 +898,7 @@ void *janus_pfunix_thread(void *data) {
 							}
 							g_async_queue_unref(client->messages);
 						}
+						janus_pfunix_client_ring_free(client->ring);
 						g_free(client);
 					}
 				}
@@ -642,6 +907,7 @@ void *janus_pfunix_thread(void *data) {
 			if(poll_fds[i].revents & POLLIN) {
 				if(poll_fds[i].fd == write_fd[0]) {
 					/* Read and ignore: we use this to unlock the poll if there's data to write */
+					g_atomic_int_set(&write_pending, 0);
 					(void)read(poll_fds[i].fd, buffer, BUFFER_SIZE);
 				} else if(poll_fds[i].fd == pfd || poll_fds[i].fd == admin_pfd) {
 					/* Janus/Admin API: accept the new client (SOCK_SEQPACKET) or receive data (SOCK_DGRAM) */
@@ -660,6 +926,7 @@ void *janus_pfunix_thread(void *data) {
 							client->admin = (poll_fds[i].fd == admin_pfd);	/* API client type */
 							client->messages = g_async_queue_new();
 							client->session_timeout = FALSE;
+							client->ring = NULL;
 							/* Create a transport instance as well */
 							client->ts = janus_transport_session_create(client, janus_pfunix_client_free);
 							/* Take note of this new client */
@@ -707,6 +974,7 @@ void *janus_pfunix_thread(void *data) {
 							client->admin = (poll_fds[i].fd == admin_pfd);	/* API client type */
 							client->messages = g_async_queue_new();
 							client->session_timeout = FALSE;
+							client->ring = NULL;
 							/* Create a transport instance as well */
 							client->ts = janus_transport_session_create(client, janus_pfunix_client_free);
 							/* Take note of this new client */
@@ -779,7 +1047,6 @@ void *janus_pfunix_thread(void *data) {
 						janus_mutex_unlock(&clients_mutex);
 						continue;
 					}
-					janus_mutex_unlock(&clients_mutex);
 					/* If we got here, there's data to handle */
 					buffer[res] = '\0';
 					JANUS_LOG(LOG_VERB, "Message from client %d (%d bytes)\n", poll_fds[i].fd, res);
@@ -787,6 +1054,13 @@ void *janus_pfunix_thread(void *data) {
 					/* Parse the JSON payload */
 					json_error_t error;
 					json_t *root = json_loads(buffer, 0, &error);
+					/* Check if this is a request for us (e.g., rings), rather than for the core */
+					if(root != NULL && json_is_object(root) && janus_pfunix_client_control(client, root)) {
+						janus_mutex_unlock(&clients_mutex);
+						json_decref(root);
+						continue;
+					}
+					janus_mutex_unlock(&clients_mutex);
 					/* Notify the core, passing both the object and, since it may be needed, the error */
 					gateway->incoming_request(&janus_pfunix_transport, client->ts, NULL, client->admin, root, &error);
 				}
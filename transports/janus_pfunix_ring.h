@@ -0,0 +1,231 @@
+/*! \file   janus_pfunix_ring.h
+ * \author Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief  Shared memory event ring of the Unix Sockets transport
+ * \details  This header describes the layout of the shared memory ring
+ * that \c SOCK_SEQPACKET clients of the Unix Sockets transport can ask
+ * Janus to deliver messages on, and contains a small, header only, client
+ * library to consume it. It has no dependencies besides libc, so it can be
+ * included in controllers and applications as it is.
+ *
+ * A client asks for a ring sending a \c {"pfunix":"ring"} message on its
+ * socket, right after connecting and before any other request: Janus will
+ * reply with a \c {"pfunix":"ring","size":N} message, carrying the file
+ * descriptor of the ring as ancillary data (\c SCM_RIGHTS). From then on,
+ * all the responses and events for that client are written to the ring,
+ * and the socket is only used for requests and wakeups: when Janus writes
+ * to a ring the client had fully consumed, it sends a \c {"pfunix":"wakeup"}
+ * message on the socket, so that clients can sleep in \c poll() on it. When
+ * the ring is full, Janus stops writing and waits for the client to send
+ * a wakeup of its own, which clients must do when janus_pfunix_ring_consume
+ * tells them to. The usual loop looks more or less like this:
+ *
+\verbatim
+janus_pfunix_ring ring;
+if(janus_pfunix_ring_attach(fd, &ring) < 0)
+	[..]
+while(running) {
+	uint32_t len = 0;
+	const char *event = NULL;
+	while((event = janus_pfunix_ring_peek(&ring, &len)) != NULL) {
+		handle_event(event, len);
+		if(janus_pfunix_ring_consume(&ring))
+			janus_pfunix_ring_wakeup(fd);
+	}
+	poll() on fd, and read the wakeup (or anything else) when POLLIN
+}
+janus_pfunix_ring_detach(&ring);
+\endverbatim
+ *
+ * Each message in the ring is stored as a 32-bit length, followed by the
+ * JSON payload itself and a terminating NUL, padded to 8 bytes: payloads
+ * that wouldn't fit before the end of the ring are preceded by a record
+ * with a \c JANUS_PFUNIX_RING_SKIP length, telling the reader to start
+ * again from the beginning of the data area.
+ *
+ * \ingroup transports
+ * \ref transports
+ */
+
+#ifndef JANUS_PFUNIX_RING_H
+#define JANUS_PFUNIX_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*! \brief Magic value at the beginning of the ring ("JRNG") */
+#define JANUS_PFUNIX_RING_MAGIC		0x4a524e47
+/*! \brief Version of the ring layout */
+#define JANUS_PFUNIX_RING_VERSION	1
+/*! \brief Offset of the data area in the shared memory */
+#define JANUS_PFUNIX_RING_DATA		4096
+/*! \brief Length of the records telling the reader to go back to the start of the data area */
+#define JANUS_PFUNIX_RING_SKIP		0xFFFFFFFF
+/*! \brief Helper to get how much space a record with a payload of the specified length takes */
+#define JANUS_PFUNIX_RING_RECORD_SIZE(len)	((4 + (uint64_t)(len) + 1 + 7) & ~(uint64_t)7)
+
+/*! \brief Header of the ring, at the beginning of the shared memory */
+typedef struct janus_pfunix_ring_header {
+	/*! \brief Must be JANUS_PFUNIX_RING_MAGIC */
+	uint32_t magic;
+	/*! \brief Must be JANUS_PFUNIX_RING_VERSION */
+	uint32_t version;
+	/*! \brief Size of the data area (always a power of 2) */
+	uint64_t size;
+	/*! \brief Total bytes written to the ring so far (only updated by Janus) */
+	uint64_t write_pos __attribute__((aligned(64)));
+	/*! \brief Total bytes consumed by the client so far (only updated by the client) */
+	uint64_t read_pos __attribute__((aligned(64)));
+	/*! \brief Set by Janus when it's waiting for the client to free some space */
+	uint32_t writer_waiting __attribute__((aligned(64)));
+} janus_pfunix_ring_header;
+
+/*! \brief Client side view of a mapped ring */
+typedef struct janus_pfunix_ring {
+	/*! \brief The mapped header */
+	janus_pfunix_ring_header *header;
+	/*! \brief The mapped data area */
+	uint8_t *data;
+	/*! \brief Size of the whole mapping */
+	size_t length;
+	/*! \brief File descriptor of the shared memory */
+	int fd;
+} janus_pfunix_ring;
+
+/*! \brief Helper to map a ring out of the file descriptor Janus sent
+ * @param[in] fd The file descriptor received via SCM_RIGHTS
+ * @param[in] size The size of the data area, as advertised by Janus
+ * @param[out] ring The ring instance to fill in
+ * @returns 0 in case of success, -1 otherwise */
+static inline int janus_pfunix_ring_map(int fd, uint64_t size, janus_pfunix_ring *ring) {
+	if(fd < 0 || ring == NULL || size == 0 || (size & (size-1)) != 0)
+		return -1;
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+	ring->length = JANUS_PFUNIX_RING_DATA + size;
+	void *mem = mmap(NULL, ring->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mem == MAP_FAILED)
+		return -1;
+	ring->header = (janus_pfunix_ring_header *)mem;
+	if(ring->header->magic != JANUS_PFUNIX_RING_MAGIC || ring->header->version != JANUS_PFUNIX_RING_VERSION ||
+			ring->header->size != size) {
+		munmap(mem, ring->length);
+		ring->header = NULL;
+		return -1;
+	}
+	ring->data = (uint8_t *)mem + JANUS_PFUNIX_RING_DATA;
+	ring->fd = fd;
+	return 0;
+}
+
+/*! \brief Helper to ask Janus for a ring on a connected \c SOCK_SEQPACKET socket, and map it
+ * @note Call this right after connecting: it blocks until Janus replies,
+ * and messages received in the meanwhile are discarded
+ * @param[in] sock The connected Unix Socket
+ * @param[out] ring The ring instance to fill in
+ * @returns 0 in case of success, -1 otherwise */
+static inline int janus_pfunix_ring_attach(int sock, janus_pfunix_ring *ring) {
+	const char *request = "{\"pfunix\":\"ring\"}";
+	if(send(sock, request, strlen(request), 0) < 0)
+		return -1;
+	char buffer[256];
+	union {
+		struct cmsghdr cmsg;
+		char control[CMSG_SPACE(sizeof(int))];
+	} control;
+	while(1) {
+		struct iovec iov = { .iov_base = buffer, .iov_len = sizeof(buffer)-1 };
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.control;
+		msg.msg_controllen = sizeof(control.control);
+		ssize_t res = recvmsg(sock, &msg, 0);
+		if(res <= 0)
+			return -1;
+		buffer[res] = '\0';
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+			/* A reply with no file descriptor means Janus refused to give us a ring */
+			if(strstr(buffer, "\"pfunix\"") != NULL)
+				return -1;
+			continue;
+		}
+		int fd = -1;
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		const char *size = strstr(buffer, "\"size\"");
+		size = size ? strchr(size, ':') : NULL;
+		if(size == NULL || janus_pfunix_ring_map(fd, strtoull(size+1, NULL, 10), ring) < 0) {
+			close(fd);
+			return -1;
+		}
+		return 0;
+	}
+}
+
+/*! \brief Helper to get the next message in the ring, if any
+ * @param[in] ring The ring to read from
+ * @param[out] len The length of the message (the message is NUL terminated as well)
+ * @returns A pointer to the message in the shared memory, or NULL if the ring is empty */
+static inline const char *janus_pfunix_ring_peek(janus_pfunix_ring *ring, uint32_t *len) {
+	janus_pfunix_ring_header *header = ring->header;
+	uint64_t read_pos = header->read_pos;
+	while(1) {
+		uint64_t write_pos = __atomic_load_n(&header->write_pos, __ATOMIC_SEQ_CST);
+		if(read_pos == write_pos)
+			return NULL;
+		uint64_t offset = read_pos & (header->size - 1);
+		uint32_t length = 0;
+		memcpy(&length, ring->data + offset, sizeof(length));
+		if(length == JANUS_PFUNIX_RING_SKIP) {
+			/* Start again from the beginning of the data area */
+			read_pos += header->size - offset;
+			__atomic_store_n(&header->read_pos, read_pos, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		if(len)
+			*len = length;
+		return (const char *)(ring->data + offset + 4);
+	}
+}
+
+/*! \brief Helper to mark the message returned by janus_pfunix_ring_peek as consumed
+ * @param[in] ring The ring to update
+ * @returns 1 if Janus is waiting for space, and so needs a wakeup (see janus_pfunix_ring_wakeup), 0 otherwise */
+static inline int janus_pfunix_ring_consume(janus_pfunix_ring *ring) {
+	janus_pfunix_ring_header *header = ring->header;
+	uint64_t read_pos = header->read_pos;
+	uint32_t length = 0;
+	memcpy(&length, ring->data + (read_pos & (header->size - 1)), sizeof(length));
+	__atomic_store_n(&header->read_pos, read_pos + JANUS_PFUNIX_RING_RECORD_SIZE(length), __ATOMIC_SEQ_CST);
+	return __atomic_exchange_n(&header->writer_waiting, 0, __ATOMIC_SEQ_CST) ? 1 : 0;
+}
+
+/*! \brief Helper to tell Janus there's space in the ring again
+ * @param[in] sock The connected Unix Socket
+ * @returns 0 in case of success, -1 otherwise */
+static inline int janus_pfunix_ring_wakeup(int sock) {
+	const char *wakeup = "{\"pfunix\":\"wakeup\"}";
+	return send(sock, wakeup, strlen(wakeup), 0) < 0 ? -1 : 0;
+}
+
+/*! \brief Helper to unmap a ring, and close its file descriptor
+ * @param[in] ring The ring to release */
+static inline void janus_pfunix_ring_detach(janus_pfunix_ring *ring) {
+	if(ring == NULL || ring->header == NULL)
+		return;
+	munmap(ring->header, ring->length);
+	ring->header = NULL;
+	ring->data = NULL;
+	if(ring->fd > -1)
+		close(ring->fd);
+	ring->fd = -1;
+}
+
+#endif
@@ -27,6 +27,14 @@
  * events related to it is done automatically through the outgoing queue,
  * so no need for an explicit request as the GET in the plain HTTP API.
  *
+ * Outgoing messages are published on dedicated channels, each served by
+ * its own thread: when more than one is configured, responses use the
+ * first one and events are spread on the others (events for the same
+ * session always on the same channel), so that they don't wait for each
+ * other. Publisher confirms can be enabled as well, in which case each
+ * channel keeps publishing until a configurable number of messages are
+ * waiting to be confirmed, rather than waiting for each of them.
+ *
  * \ingroup transports
  * \ref transports
  */
@@ -115,10 +123,25 @@ static gboolean notify_events = TRUE;
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
 
+/* Channel we publish outgoing messages on */
+typedef struct janus_rabbitmq_channel {
+	amqp_channel_t id;						/* AMQP channel */
+	GThread *thread;						/* Thread publishing the messages */
+	GAsyncQueue *messages;					/* Queue of outgoing messages to push */
+	guint64 *unconfirmed;					/* Ring of delivery tags waiting for a confirm (0 for confirmed, if out of order) */
+	guint head, count;						/* Position and size of the unconfirmed messages in the ring */
+	guint64 next_tag;						/* Delivery tag of the last message we published */
+	guint64 published, confirmed, nacked;	/* Counters, for debugging purposes */
+	janus_mutex mutex;						/* Mutex to lock/unlock the confirms state */
+	janus_condition cond;					/* Condition to wait for confirms, when the window is full */
+} janus_rabbitmq_channel;
+
 /* RabbitMQ client session: we only create a single one as of now */
 typedef struct janus_rabbitmq_client {
 	amqp_connection_state_t rmq_conn;		/* AMQP connection state */
-	amqp_channel_t rmq_channel;				/* AMQP channel */
+	amqp_channel_t rmq_channel;				/* AMQP channel (incoming messages) */
+	janus_rabbitmq_channel *out;			/* AMQP channels for outgoing messages */
+	int out_num;							/* Number of channels for outgoing messages */
 	gboolean janus_api_enabled;				/* Whether the Janus API via RabbitMQ is enabled */
 	amqp_bytes_t janus_exchange;			/* AMQP exchange for outgoing messages */
 	amqp_bytes_t to_janus_queue;			/* AMQP outgoing messages queue (Janus API) */
@@ -126,9 +149,8 @@ typedef struct janus_rabbitmq_client {
 	gboolean admin_api_enabled;				/* Whether the Janus API via RabbitMQ is enabled */
 	amqp_bytes_t to_janus_admin_queue;		/* AMQP outgoing messages queue (Admin API) */
 	amqp_bytes_t from_janus_admin_queue;	/* AMQP incoming messages queue (Admin API) */
-	GThread *in_thread, *out_thread;		/* Threads to handle incoming and outgoing queues */
-	GAsyncQueue *messages;					/* Queue of outgoing messages to push */
-	janus_mutex mutex;						/* Mutex to lock/unlock this session */
+	GThread *in_thread;						/* Thread to handle incoming queues */
+	janus_mutex mutex;						/* Mutex to lock/unlock this session (and writes on the connection) */
 	gint session_timeout:1;					/* Whether a Janus session timeout occurred in the core */
 	gint destroy:1;							/* Flag to trigger a lazy session destruction */
 } janus_rabbitmq_client;
@@ -150,6 +172,12 @@ void *janus_rmq_out_thread(void *data);
 static janus_rabbitmq_client *rmq_client = NULL;
 static janus_transport_session *rmq_session = NULL;
 
+/* Outgoing channels, publisher confirms and prefetch settings */
+static int publish_channels = 1, confirm_window = 256;
+static gboolean publisher_confirms = FALSE;
+static uint16_t prefetch = 0;
+static void janus_rabbitmq_channel_confirm(janus_rabbitmq_channel *channel, uint64_t tag, gboolean multiple, gboolean nack);
+
 /* Global properties */
 static char *rmqhost = NULL, *vhost = NULL, *username = NULL, *password = NULL,
 	*ssl_cacert_file = NULL, *ssl_cert_file = NULL, *ssl_key_file = NULL,
@@ -319,6 +347,37 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 		}
 		rmq_janus_api_enabled = TRUE;
 	}
+	/* Outgoing channels and flow control */
+	item = janus_config_get(config, config_general, janus_config_type_item, "publish_channels");
+	if(item && item->value) {
+		publish_channels = atoi(item->value);
+		if(publish_channels < 1 || publish_channels > 16) {
+			JANUS_LOG(LOG_WARN, "Invalid number of publish channels %s, using 1\n", item->value);
+			publish_channels = 1;
+		}
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "publisher_confirms");
+	if(item && item->value)
+		publisher_confirms = janus_is_true(item->value);
+	item = janus_config_get(config, config_general, janus_config_type_item, "confirm_window");
+	if(item && item->value) {
+		confirm_window = atoi(item->value);
+		if(confirm_window < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid confirm window %s, using 256\n", item->value);
+			confirm_window = 256;
+		}
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "prefetch");
+	if(item && item->value) {
+		int value = atoi(item->value);
+		if(value < 0 || value > 65535) {
+			JANUS_LOG(LOG_WARN, "Invalid prefetch %s, disabling it\n", item->value);
+			value = 0;
+		}
+		prefetch = value;
+	}
+	JANUS_LOG(LOG_VERB, "RabbitMQ publishing: %d channel(s), confirms %s (window %d), prefetch %"SCNu16"\n",
+		publish_channels, publisher_confirms ? "enabled" : "disabled", confirm_window, prefetch);
 	/* Do the same for the admin API */
 	item = janus_config_get(config, config_admin, janus_config_type_item, "admin_enabled");
 	if(item == NULL) {
@@ -426,6 +485,15 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 				goto error;
 			}
 		}
+		if(prefetch > 0) {
+			/* Limit how many unacknowledged requests the server can send us */
+			amqp_basic_qos(rmq_client->rmq_conn, rmq_client->rmq_channel, 0, prefetch, 0);
+			result = amqp_get_rpc_reply(rmq_client->rmq_conn);
+			if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+				JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error setting prefetch... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+				goto error;
+			}
+		}
 		rmq_client->janus_api_enabled = FALSE;
 		if(rmq_janus_api_enabled) {
 			rmq_client->janus_api_enabled = TRUE;
@@ -445,7 +513,7 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 				JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error declaring queue... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
 				goto error;
 			}
-			amqp_basic_consume(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->to_janus_queue, amqp_empty_bytes, 0, 1, 0, amqp_empty_table);
+			amqp_basic_consume(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->to_janus_queue, amqp_empty_bytes, 0, prefetch == 0, 0, amqp_empty_table);
 			result = amqp_get_rpc_reply(rmq_client->rmq_conn);
 			if(result.reply_type != AMQP_RESPONSE_NORMAL) {
 				JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error consuming... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
@@ -471,14 +539,40 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 				JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error declaring queue... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
 				goto error;
 			}
-			amqp_basic_consume(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->to_janus_admin_queue, amqp_empty_bytes, 0, 1, 0, amqp_empty_table);
+			amqp_basic_consume(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->to_janus_admin_queue, amqp_empty_bytes, 0, prefetch == 0, 0, amqp_empty_table);
 			result = amqp_get_rpc_reply(rmq_client->rmq_conn);
 			if(result.reply_type != AMQP_RESPONSE_NORMAL) {
 				JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error consuming... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
 				goto error;
 			}
 		}
-		rmq_client->messages = g_async_queue_new();
+		/* Open the channels for outgoing messages */
+		rmq_client->out_num = publish_channels;
+		rmq_client->out = g_malloc0(publish_channels * sizeof(janus_rabbitmq_channel));
+		int i = 0;
+		for(i=0; i<publish_channels; i++) {
+			janus_rabbitmq_channel *channel = &rmq_client->out[i];
+			channel->id = rmq_client->rmq_channel + 1 + i;
+			channel->messages = g_async_queue_new();
+			janus_mutex_init(&channel->mutex);
+			janus_condition_init(&channel->cond);
+			JANUS_LOG(LOG_VERB, "Opening outgoing channel %d...\n", channel->id);
+			amqp_channel_open(rmq_client->rmq_conn, channel->id);
+			result = amqp_get_rpc_reply(rmq_client->rmq_conn);
+			if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+				JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error opening channel... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+				goto error;
+			}
+			if(publisher_confirms) {
+				amqp_confirm_select(rmq_client->rmq_conn, channel->id);
+				result = amqp_get_rpc_reply(rmq_client->rmq_conn);
+				if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+					JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error enabling publisher confirms... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+					goto error;
+				}
+				channel->unconfirmed = g_malloc0(confirm_window * sizeof(guint64));
+			}
+		}
 		rmq_client->destroy = 0;
 		/* Prepare the transport session (again, just one) */
 		rmq_session = janus_transport_session_create(rmq_client, NULL);
@@ -495,16 +589,20 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 			janus_config_destroy(config);
 			return -1;
 		}
-		rmq_client->out_thread = g_thread_try_new("rmq_out_thread", &janus_rmq_out_thread, rmq_client, &error);
-		if(error != NULL) {
-			/* Something went wrong... */
-			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the RabbitMQ outgoing thread...\n",
-				error->code, error->message ? error->message : "??");
-			g_error_free(error);
-			janus_transport_session_destroy(rmq_session);
-			g_free(rmq_client);
-			janus_config_destroy(config);
-			return -1;
+		for(i=0; i<publish_channels; i++) {
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "rmq_out_%d", i);
+			rmq_client->out[i].thread = g_thread_try_new(tname, &janus_rmq_out_thread, &rmq_client->out[i], &error);
+			if(error != NULL) {
+				/* Something went wrong... */
+				JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the RabbitMQ outgoing thread...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				janus_transport_session_destroy(rmq_session);
+				g_free(rmq_client);
+				janus_config_destroy(config);
+				return -1;
+			}
 		}
 		janus_mutex_init(&rmq_client->mutex);
 		/* Done */
@@ -526,6 +624,15 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 
 error:
 	/* If we got here, something went wrong */
+	if(rmq_client != NULL && rmq_client->out != NULL) {
+		int i = 0;
+		for(i=0; i<rmq_client->out_num; i++) {
+			if(rmq_client->out[i].messages != NULL)
+				g_async_queue_unref(rmq_client->out[i].messages);
+			g_free(rmq_client->out[i].unconfirmed);
+		}
+		g_free(rmq_client->out);
+	}
 	g_free(rmq_client);
 	g_free(rmqhost);
 	g_free(vhost);
@@ -551,16 +658,36 @@ void janus_rabbitmq_destroy(void) {
 
 	if(rmq_client) {
 		rmq_client->destroy = 1;
-		g_async_queue_push(rmq_client->messages, &exit_message);
+		int i = 0;
+		for(i=0; i<rmq_client->out_num; i++) {
+			janus_rabbitmq_channel *channel = &rmq_client->out[i];
+			g_async_queue_push(channel->messages, &exit_message);
+			janus_mutex_lock(&channel->mutex);
+			janus_condition_broadcast(&channel->cond);
+			janus_mutex_unlock(&channel->mutex);
+		}
 		if(rmq_client->in_thread)
 			g_thread_join(rmq_client->in_thread);
-		if(rmq_client->out_thread)
-			g_thread_join(rmq_client->out_thread);
+		for(i=0; i<rmq_client->out_num; i++) {
+			janus_rabbitmq_channel *channel = &rmq_client->out[i];
+			if(channel->thread)
+				g_thread_join(channel->thread);
+			JANUS_LOG(LOG_VERB, "Outgoing channel %d: %"SCNu64" published, %"SCNu64" confirmed, %"SCNu64" nacked\n",
+				channel->id, channel->published, channel->confirmed, channel->nacked);
+		}
 		if(rmq_client->rmq_conn && rmq_client->rmq_channel) {
+			for(i=0; i<rmq_client->out_num; i++)
+				amqp_channel_close(rmq_client->rmq_conn, rmq_client->out[i].id, AMQP_REPLY_SUCCESS);
 			amqp_channel_close(rmq_client->rmq_conn, rmq_client->rmq_channel, AMQP_REPLY_SUCCESS);
 			amqp_connection_close(rmq_client->rmq_conn, AMQP_REPLY_SUCCESS);
 			amqp_destroy_connection(rmq_client->rmq_conn);
 		}
+		for(i=0; i<rmq_client->out_num; i++) {
+			janus_mutex_destroy(&rmq_client->out[i].mutex);
+			janus_condition_destroy(&rmq_client->out[i].cond);
+			g_free(rmq_client->out[i].unconfirmed);
+		}
+		g_free(rmq_client->out);
 	}
 	g_free(rmq_client);
 	janus_transport_session_destroy(rmq_session);
@@ -630,13 +757,20 @@ int janus_rabbitmq_send_message(janus_transport_session *transport, void *reques
 		return -1;
 	}
 	JANUS_LOG(LOG_HUGE, "Sending %s API %s via RabbitMQ\n", admin ? "admin" : "Janus", request_id ? "response" : "event");
+	/* Responses use the first channel, events for the same session always use the same one of the others */
+	janus_rabbitmq_channel *channel = &rmq_client->out[0];
+	if(request_id == NULL && rmq_client->out_num > 1) {
+		json_t *session_id = json_object_get(message, "session_id");
+		guint64 id = json_is_integer(session_id) ? json_integer_value(session_id) : 0;
+		channel = &rmq_client->out[1 + ((id ^ (id >> 32)) % (rmq_client->out_num - 1))];
+	}
 	/* FIXME Add to the queue of outgoing messages */
 	janus_rabbitmq_response *response = g_malloc(sizeof(janus_rabbitmq_response));
 	response->admin = admin;
 	response->payload = json_dumps(message, json_format);
 	json_decref(message);
 	response->correlation_id = (char *)request_id;
-	g_async_queue_push(rmq_client->messages, response);
+	g_async_queue_push(channel->messages, response);
 	return 0;
 }
 
@@ -666,14 +800,25 @@ void *janus_rmq_in_thread(void *data) {
 	timeout.tv_sec = 0;
 	timeout.tv_usec = 20000;
 	amqp_frame_t frame;
+	/* When using a prefetch, we acknowledge deliveries in batches */
+	uint64_t delivery_tag = 0, last_tag = 0;
+	int unacked = 0, ack_batch = prefetch > 1 ? prefetch/2 : 1;
 	while(!rmq_client->destroy && !g_atomic_int_get(&stopping)) {
 		amqp_maybe_release_buffers(rmq_client->rmq_conn);
 		/* Wait for a frame */
 		int res = amqp_simple_wait_frame_noblock(rmq_client->rmq_conn, &frame, &timeout);
 		if(res != AMQP_STATUS_OK) {
 			/* No data */
-			if(res == AMQP_STATUS_TIMEOUT || res == AMQP_STATUS_SSL_ERROR)
+			if(res == AMQP_STATUS_TIMEOUT || res == AMQP_STATUS_SSL_ERROR) {
+				if(unacked > 0) {
+					/* Nothing else coming for now, acknowledge what we got so far */
+					janus_mutex_lock(&rmq_client->mutex);
+					amqp_basic_ack(rmq_client->rmq_conn, rmq_client->rmq_channel, last_tag, 1);
+					janus_mutex_unlock(&rmq_client->mutex);
+					unacked = 0;
+				}
 				continue;
+			}
 			JANUS_LOG(LOG_VERB, "Error on amqp_simple_wait_frame_noblock: %d (%s)\n", res, amqp_error_string2(res));
 			break;
 		}
@@ -682,9 +827,26 @@ void *janus_rmq_in_thread(void *data) {
 		if(frame.frame_type != AMQP_FRAME_METHOD)
 			continue;
 		JANUS_LOG(LOG_VERB, "Method %s\n", amqp_method_name(frame.payload.method.id));
+		if(frame.payload.method.id == AMQP_BASIC_ACK_METHOD || frame.payload.method.id == AMQP_BASIC_NACK_METHOD) {
+			/* Publisher confirm for one of our outgoing channels */
+			int index = (int)frame.channel - (int)rmq_client->rmq_channel - 1;
+			if(index < 0 || index >= rmq_client->out_num)
+				continue;
+			if(frame.payload.method.id == AMQP_BASIC_ACK_METHOD) {
+				amqp_basic_ack_t *ack = (amqp_basic_ack_t *)frame.payload.method.decoded;
+				janus_rabbitmq_channel_confirm(&rmq_client->out[index], ack->delivery_tag, ack->multiple, FALSE);
+			} else {
+				amqp_basic_nack_t *nack = (amqp_basic_nack_t *)frame.payload.method.decoded;
+				JANUS_LOG(LOG_WARN, "RabbitMQ server nacked message(s) on channel %d (tag %"SCNu64"%s)\n",
+					frame.channel, (guint64)nack->delivery_tag, nack->multiple ? " and previous" : "");
+				janus_rabbitmq_channel_confirm(&rmq_client->out[index], nack->delivery_tag, nack->multiple, TRUE);
+			}
+			continue;
+		}
 		gboolean admin = FALSE;
 		if(frame.payload.method.id == AMQP_BASIC_DELIVER_METHOD) {
 			amqp_basic_deliver_t *d = (amqp_basic_deliver_t *)frame.payload.method.decoded;
+			delivery_tag = d->delivery_tag;
 			JANUS_LOG(LOG_VERB, "Delivery #%u, %.*s\n", (unsigned) d->delivery_tag, (int) d->routing_key.len, (char *) d->routing_key.bytes);
 			/* Check if this is a Janus or Admin API request */
 			if(rmq_client->admin_api_enabled) {
@@ -743,22 +905,49 @@ void *janus_rmq_in_thread(void *data) {
 		/* Notify the core, passing both the object and, since it may be needed, the error
 		 * We also specify the correlation ID as an opaque request identifier: we'll need it later */
 		gateway->incoming_request(&janus_rabbitmq_transport, rmq_session, correlation, admin, root, &error);
+		if(prefetch > 0 && delivery_tag > 0) {
+			last_tag = delivery_tag;
+			unacked++;
+			if(unacked >= ack_batch) {
+				janus_mutex_lock(&rmq_client->mutex);
+				amqp_basic_ack(rmq_client->rmq_conn, rmq_client->rmq_channel, last_tag, 1);
+				janus_mutex_unlock(&rmq_client->mutex);
+				unacked = 0;
+			}
+		}
+		delivery_tag = 0;
 	}
 	JANUS_LOG(LOG_INFO, "Leaving RabbitMQ in thread\n");
 	return NULL;
 }
 
 void *janus_rmq_out_thread(void *data) {
-	if(rmq_client == NULL) {
+	janus_rabbitmq_channel *channel = (janus_rabbitmq_channel *)data;
+	if(rmq_client == NULL || channel == NULL) {
 		JANUS_LOG(LOG_ERR, "No RabbitMQ connection??\n");
 		return NULL;
 	}
-	JANUS_LOG(LOG_VERB, "Joining RabbitMQ out thread\n");
+	JANUS_LOG(LOG_VERB, "Joining RabbitMQ out thread (channel %d)\n", channel->id);
 	while(!rmq_client->destroy && !g_atomic_int_get(&stopping)) {
 		/* We send messages from here as well, not only notifications */
-		janus_rabbitmq_response *response = g_async_queue_pop(rmq_client->messages);
+		janus_rabbitmq_response *response = g_async_queue_pop(channel->messages);
 		if(response == &exit_message)
 			break;
+		uint64_t tag = 0;
+		if(publisher_confirms && !rmq_client->destroy && !g_atomic_int_get(&stopping) && response->payload) {
+			/* Don't wait for this message to be confirmed, just for some room in the window */
+			janus_mutex_lock(&channel->mutex);
+			while(channel->count == (guint)confirm_window && !rmq_client->destroy && !g_atomic_int_get(&stopping)) {
+				gint64 end = g_get_monotonic_time() + 100*G_TIME_SPAN_MILLISECOND;
+				janus_condition_wait_until(&channel->cond, &channel->mutex, end);
+			}
+			if(channel->count < (guint)confirm_window) {
+				tag = ++channel->next_tag;
+				channel->unconfirmed[(channel->head + channel->count) % confirm_window] = tag;
+				channel->count++;
+			}
+			janus_mutex_unlock(&channel->mutex);
+		}
 		if(!rmq_client->destroy && !g_atomic_int_get(&stopping) && response->payload) {
 			janus_mutex_lock(&rmq_client->mutex);
 			/* Gotcha! Convert json_t to string */
@@ -776,13 +965,17 @@ void *janus_rmq_out_thread(void *data) {
 			props._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG;
 			props.content_type = amqp_cstring_bytes("application/json");
 			amqp_bytes_t message = amqp_cstring_bytes(payload_text);
-			int status = amqp_basic_publish(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->janus_exchange,
+			int status = amqp_basic_publish(rmq_client->rmq_conn, channel->id, rmq_client->janus_exchange,
 				response->admin ? rmq_client->from_janus_admin_queue : rmq_client->from_janus_queue,
 				0, 0, &props, message);
+			janus_mutex_unlock(&rmq_client->mutex);
+			channel->published++;
 			if(status != AMQP_STATUS_OK) {
 				JANUS_LOG(LOG_ERR, "Error publishing... %d, %s\n", status, amqp_error_string2(status));
+				/* No confirm will ever come for this one */
+				if(tag > 0)
+					janus_rabbitmq_channel_confirm(channel, tag, FALSE, TRUE);
 			}
-			janus_mutex_unlock(&rmq_client->mutex);
 		}
 		/* Free the message */
 		g_free(response->correlation_id);
@@ -793,7 +986,38 @@ void *janus_rmq_out_thread(void *data) {
 		g_free(response);
 		response = NULL;
 	}
-	g_async_queue_unref(rmq_client->messages);
-	JANUS_LOG(LOG_INFO, "Leaving RabbitMQ out thread\n");
+	g_async_queue_unref(channel->messages);
+	JANUS_LOG(LOG_INFO, "Leaving RabbitMQ out thread (channel %d)\n", channel->id);
 	return NULL;
 }
+
+/* Publisher confirms: the server may confirm several messages at once */
+static void janus_rabbitmq_channel_confirm(janus_rabbitmq_channel *channel, uint64_t tag, gboolean multiple, gboolean nack) {
+	if(channel == NULL || channel->unconfirmed == NULL)
+		return;
+	janus_mutex_lock(&channel->mutex);
+	guint i = 0;
+	for(i=0; i<channel->count; i++) {
+		guint64 *unconfirmed = &channel->unconfirmed[(channel->head + i) % confirm_window];
+		if(*unconfirmed == 0)
+			continue;
+		if(*unconfirmed > tag)
+			break;
+		if(multiple || *unconfirmed == tag) {
+			*unconfirmed = 0;
+			if(nack)
+				channel->nacked++;
+			else
+				channel->confirmed++;
+			if(!multiple)
+				break;
+		}
+	}
+	/* Free the slots at the beginning of the window */
+	while(channel->count > 0 && channel->unconfirmed[channel->head] == 0) {
+		channel->head = (channel->head + 1) % confirm_window;
+		channel->count--;
+	}
+	janus_condition_signal(&channel->cond);
+	janus_mutex_unlock(&channel->mutex);
+}
@@ -17,6 +17,13 @@
  * request with an additional \c session_id field in the JSON payload.
  * The same applies for the handle. The JavaScript library (janus.js)
  * implements all of this on the client side automatically.
+ * \note Besides the default \c janus-protocol (and \c janus-admin-protocol
+ * for the Admin API), clients can negotiate the \c janus-protocol-cbor
+ * (or \c janus-admin-protocol-cbor ) subprotocol instead: in that case,
+ * requests, responses and events are exchanged as CBOR (RFC 8949)
+ * binary messages rather than JSON text, using the same exact syntax.
+ * The transport decodes and encodes CBOR straight from and to the JSON
+ * objects the core works with, with no JSON serialization involved.
  * \note When you create a session using WebSockets, a subscription to
  * the events related to it is done automatically, so no need for an
  * explicit request as the GET in the plain HTTP API. Closing a WebSocket
@@ -39,6 +46,7 @@
 #include "../config.h"
 #include "../mutex.h"
 #include "../utils.h"
+#include "../cbor.h"
 
 
 /* Transport plugin information */
@@ -63,6 +71,7 @@ const char *janus_websockets_get_package(void);
 gboolean janus_websockets_is_janus_api_enabled(void);
 gboolean janus_websockets_is_admin_api_enabled(void);
 int janus_websockets_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+int janus_websockets_send_shared_message(janus_transport_session *transport, gboolean admin, json_t *envelope, janus_transport_shared_body *body);
 void janus_websockets_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_websockets_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_websockets_session_claimed(janus_transport_session *transport, guint64 session_id);
@@ -89,6 +98,7 @@ static janus_transport janus_websockets_transport =
 		.session_created = janus_websockets_session_created,
 		.session_over = janus_websockets_session_over,
 		.session_claimed = janus_websockets_session_claimed,
+		.send_shared_message = janus_websockets_send_shared_message,
 	);
 
 /* Transport creator */
@@ -107,7 +117,7 @@ static gboolean notify_events = TRUE;
 
 /* Clients maps */
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-static GHashTable *clients = NULL, *writable_clients = NULL;
+static GHashTable *clients = NULL;
 #endif
 static janus_mutex writable_mutex;
 
@@ -154,20 +164,53 @@ static void janus_websockets_log_emit_function(int level, const char *line) {
 	JANUS_LOG(LOG_INFO, "[libwebsockets][%s] %s", janus_websockets_get_level_str(level), line);
 }
 
-/* WebSockets service thread */
-static GThread *ws_thread = NULL;
+/* WebSockets service threads: libwebsockets shards the connections
+ * across them, and each thread only serves its own connections */
+typedef struct janus_websockets_service {
+	int tsi;								/* Thread service index in the libwebsockets context */
+	GThread *thread;						/* Thread serving this index */
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
+	GHashTable *writable_clients;			/* Connections on this thread with something to send */
+#endif
+	volatile gint clients;					/* Number of connections served by this thread */
+	volatile gint queued;					/* Number of messages queued and not sent yet */
+	guint64 writes;							/* Messages written since the last stats round */
+	gint64 write_latency, max_write_latency;	/* Total and max time (us) messages waited before being written */
+	gint64 last_stats;						/* When we last reported the stats for this thread */
+} janus_websockets_service;
+static janus_websockets_service *services = NULL;
+static int ws_threads = 1;
+static int stats_period = 0;
+static GPrivate current_service = G_PRIVATE_INIT(NULL);
 void *janus_websockets_thread(void *data);
 
+/* Outgoing message, and when it was queued */
+typedef struct janus_websockets_message {
+	char *payload;
+	size_t length;
+	gint64 queued;
+} janus_websockets_message;
+static void janus_websockets_message_free(janus_websockets_message *msg) {
+	if(msg == NULL)
+		return;
+	g_free(msg->payload);
+	g_free(msg);
+}
+
 
 /* WebSocket client session */
 typedef struct janus_websockets_client {
 	struct lws *wsi;						/* The libwebsockets client instance */
+	janus_websockets_service *service;		/* The service thread this client belongs to */
+	gboolean cbor;							/* Whether this client negotiated CBOR instead of JSON */
 	GAsyncQueue *messages;					/* Queue of outgoing messages to push */
 	char *incoming;							/* Buffer containing the incoming message to process (in case there are fragments) */
+	size_t incoming_len;					/* Length of the incoming message so far */
 	unsigned char *buffer;					/* Buffer containing the message to send */
 	size_t buflen;								/* Length of the buffer (may be resized after re-allocations) */
 	size_t bufpending;							/* Data an interrupted previous write couldn't send */
 	size_t bufoffset;							/* Offset from where the interrupted previous write should resume */
+	gint64 bufqueued;						/* When the message in the buffer was queued */
 	volatile gint destroyed;				/* Whether this libwebsockets client instance has been closed */
 	janus_transport_session *ts;			/* Janus core-transport session */
 } janus_websockets_client;
@@ -205,21 +248,25 @@ static int janus_websockets_admin_callback_secure(
 static struct lws_protocols ws_protocols[] = {
 	{ "http-only", janus_websockets_callback_http, 0, 0 },
 	{ "janus-protocol", janus_websockets_callback, sizeof(janus_websockets_client), 0 },
+	{ "janus-protocol-cbor", janus_websockets_callback, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
 static struct lws_protocols sws_protocols[] = {
 	{ "http-only", janus_websockets_callback_https, 0, 0 },
 	{ "janus-protocol", janus_websockets_callback_secure, sizeof(janus_websockets_client), 0 },
+	{ "janus-protocol-cbor", janus_websockets_callback_secure, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
 static struct lws_protocols admin_ws_protocols[] = {
 	{ "http-only", janus_websockets_callback_http, 0, 0 },
 	{ "janus-admin-protocol", janus_websockets_admin_callback, sizeof(janus_websockets_client), 0 },
+	{ "janus-admin-protocol-cbor", janus_websockets_admin_callback, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
 static struct lws_protocols admin_sws_protocols[] = {
 	{ "http-only", janus_websockets_callback_https, 0, 0 },
 	{ "janus-admin-protocol", janus_websockets_admin_callback_secure, sizeof(janus_websockets_client), 0 },
+	{ "janus-admin-protocol-cbor", janus_websockets_admin_callback_secure, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
 /* Helper for debugging reasons */
@@ -465,6 +512,37 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			}
 		}
 		JANUS_LOG(LOG_INFO, "libwebsockets logging: %d\n", ws_log_level);
+
+		/* How many service threads should we use? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "ws_threads");
+		if(item && item->value) {
+			ws_threads = atoi(item->value);
+			if(ws_threads < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid value for ws_threads (%d), using 1 instead\n", ws_threads);
+				ws_threads = 1;
+			}
+#if (LWS_LIBRARY_VERSION_MAJOR < 3)
+			if(ws_threads > 1) {
+				JANUS_LOG(LOG_WARN, "Multiple WebSockets service threads only supported in libwebsockets >= 3.0, using 1 instead\n");
+				ws_threads = 1;
+			}
+#elif defined(LWS_MAX_SMP)
+			if(ws_threads > LWS_MAX_SMP) {
+				JANUS_LOG(LOG_WARN, "libwebsockets has been built with support for at most %d service threads, using %d instead of %d\n",
+					LWS_MAX_SMP, LWS_MAX_SMP, ws_threads);
+				ws_threads = LWS_MAX_SMP;
+			}
+#endif
+		}
+		JANUS_LOG(LOG_INFO, "WebSockets service threads: %d\n", ws_threads);
+		item = janus_config_get(config, config_general, janus_config_type_item, "stats_period");
+		if(item && item->value) {
+			stats_period = atoi(item->value);
+			if(stats_period < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid value for stats_period (%d), ignoring...\n", stats_period);
+				stats_period = 0;
+			}
+		}
 		lws_set_log_level(ws_log_level, janus_websockets_log_emit_function);
 
 		/* Any ACL for either the Janus or Admin API? */
@@ -550,8 +628,8 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 		}
 #endif
 #endif
-		/* Force single-thread server */
-		wscinfo.count_threads = 1;
+		/* Connections are spread across all the service threads */
+		wscinfo.count_threads = ws_threads;
 
 		/* Create the base context */
 		wsc = lws_create_context(&wscinfo);
@@ -808,22 +886,46 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 	clients = g_hash_table_new(NULL, NULL);
-	writable_clients = g_hash_table_new(NULL, NULL);
 #endif
 	janus_mutex_init(&writable_mutex);
+	services = g_malloc0(ws_threads * sizeof(janus_websockets_service));
+	int i = 0;
+	for(i=0; i<ws_threads; i++) {
+		services[i].tsi = i;
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
+		services[i].writable_clients = g_hash_table_new(NULL, NULL);
+#endif
+		services[i].last_stats = janus_get_monotonic_time();
+	}
 
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
-	/* Start the WebSocket service thread */
+	/* Start the WebSocket service threads */
 	if(ws_janus_api_enabled || ws_admin_api_enabled) {
-		ws_thread = g_thread_try_new("ws thread", &janus_websockets_thread, wsc, &error);
-		if(error != NULL) {
-			g_atomic_int_set(&initialized, 0);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread...\n",
-				error->code, error->message ? error->message : "??");
-			g_error_free(error);
-			return -1;
+		char tname[16];
+		for(i=0; i<ws_threads; i++) {
+			if(ws_threads == 1)
+				g_snprintf(tname, sizeof(tname), "ws thread");
+			else
+				g_snprintf(tname, sizeof(tname), "ws thread #%d", i);
+			services[i].thread = g_thread_try_new(tname, &janus_websockets_thread, &services[i], &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread #%d...\n",
+					error->code, error->message ? error->message : "??", i);
+				g_error_free(error);
+				/* Stop the threads we already started */
+				g_atomic_int_set(&stopping, 1);
+				lws_cancel_service(wsc);
+				int j = 0;
+				for(j=0; j<i; j++) {
+					g_thread_join(services[j].thread);
+					services[j].thread = NULL;
+				}
+				g_atomic_int_set(&initialized, 0);
+				g_atomic_int_set(&stopping, 0);
+				return -1;
+			}
 		}
 	}
 
@@ -837,10 +939,13 @@ void janus_websockets_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	/* Stop the service thread */
-	if(ws_thread != NULL) {
-		g_thread_join(ws_thread);
-		ws_thread = NULL;
+	/* Stop the service threads */
+	int i = 0;
+	for(i=0; i<ws_threads; i++) {
+		if(services[i].thread != NULL) {
+			g_thread_join(services[i].thread);
+			services[i].thread = NULL;
+		}
 	}
 
 	/* Destroy the context */
@@ -853,10 +958,14 @@ void janus_websockets_destroy(void) {
 	janus_mutex_lock(&writable_mutex);
 	g_hash_table_destroy(clients);
 	clients = NULL;
-	g_hash_table_destroy(writable_clients);
-	writable_clients = NULL;
+	for(i=0; i<ws_threads; i++) {
+		g_hash_table_destroy(services[i].writable_clients);
+		services[i].writable_clients = NULL;
+	}
 	janus_mutex_unlock(&writable_mutex);
 #endif
+	g_free(services);
+	services = NULL;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -879,7 +988,8 @@ static void janus_websockets_destroy_client(
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 	janus_mutex_lock(&writable_mutex);
 	g_hash_table_remove(clients, ws_client);
-	g_hash_table_remove(writable_clients, ws_client);
+	if(ws_client->service != NULL)
+		g_hash_table_remove(ws_client->service->writable_clients, ws_client);
 	janus_mutex_unlock(&writable_mutex);
 #endif
 	ws_client->wsi = NULL;
@@ -892,15 +1002,20 @@ static void janus_websockets_destroy_client(
 	ws_client->ts->transport_p = NULL;
 	/* Remove messages queue too, if needed */
 	if(ws_client->messages != NULL) {
-		char *response = NULL;
-		while((response = g_async_queue_try_pop(ws_client->messages)) != NULL) {
-			g_free(response);
+		janus_websockets_message *msg = NULL;
+		while((msg = g_async_queue_try_pop(ws_client->messages)) != NULL) {
+			if(ws_client->service != NULL)
+				g_atomic_int_add(&ws_client->service->queued, -1);
+			janus_websockets_message_free(msg);
 		}
 		g_async_queue_unref(ws_client->messages);
 	}
+	if(ws_client->service != NULL)
+		g_atomic_int_add(&ws_client->service->clients, -1);
 	/* ... and the shared buffers */
 	g_free(ws_client->incoming);
 	ws_client->incoming = NULL;
+	ws_client->incoming_len = 0;
 	g_free(ws_client->buffer);
 	ws_client->buffer = NULL;
 	ws_client->buflen = 0;
@@ -949,7 +1064,8 @@ gboolean janus_websockets_is_admin_api_enabled(void) {
 	return ws_admin_api_enabled;
 }
 
-int janus_websockets_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+/* Helper to serialize and queue a message, whether its body is shared with other clients or not */
+static int janus_websockets_queue_message(janus_transport_session *transport, json_t *message, janus_transport_shared_body *body) {
 	if(message == NULL)
 		return -1;
 	if(transport == NULL || g_atomic_int_get(&transport->destroyed)) {
@@ -963,16 +1079,36 @@ int janus_websockets_send_message(janus_transport_session *transport, void *requ
 		janus_mutex_unlock(&transport->mutex);
 		return -1;
 	}
-	/* Convert to string and enqueue */
-	char *payload = json_dumps(message, json_format);
-	g_async_queue_push(client->messages, payload);
+	/* Convert to string and enqueue: we do this here, and not on the
+	 * service thread, so that serialization is done by whoever is sending */
+	janus_websockets_message *msg = g_malloc(sizeof(janus_websockets_message));
+	if(client->cbor) {
+		/* CBOR clients get the whole message encoded as binary */
+		if(body != NULL)
+			json_object_set(message, body->name, body->body);
+		msg->payload = (char *)janus_cbor_encode(message, &msg->length);
+	} else {
+		msg->payload = body ? janus_transport_shared_body_dumps(body, message, json_format) : json_dumps(message, json_format);
+		msg->length = msg->payload ? strlen(msg->payload) : 0;
+	}
+	if(msg->payload == NULL) {
+		JANUS_LOG(LOG_ERR, "Error serializing the message...\n");
+		g_free(msg);
+		janus_mutex_unlock(&transport->mutex);
+		json_decref(message);
+		return -1;
+	}
+	msg->queued = janus_get_monotonic_time();
+	g_async_queue_push(client->messages, msg);
+	g_atomic_int_inc(&client->service->queued);
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-	/* On libwebsockets >= 3.x we use lws_cancel_service */
+	/* On libwebsockets >= 3.x we use lws_cancel_service_pt, which only
+	 * wakes the service thread this connection belongs to */
 	janus_mutex_lock(&writable_mutex);
 	if(g_hash_table_lookup(clients, client) == client)
-		g_hash_table_insert(writable_clients, client, client);
+		g_hash_table_insert(client->service->writable_clients, client, client);
 	janus_mutex_unlock(&writable_mutex);
-	lws_cancel_service(wsc);
+	lws_cancel_service_pt(client->wsi);
 #else
 	/* On libwebsockets < 3.x we use lws_callback_on_writable */
 	janus_mutex_lock(&writable_mutex);
@@ -984,6 +1120,18 @@ int janus_websockets_send_message(janus_transport_session *transport, void *requ
 	return 0;
 }
 
+int janus_websockets_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+	return janus_websockets_queue_message(transport, message, NULL);
+}
+
+int janus_websockets_send_shared_message(janus_transport_session *transport, gboolean admin, json_t *envelope, janus_transport_shared_body *body) {
+	if(body == NULL) {
+		json_decref(envelope);
+		return -1;
+	}
+	return janus_websockets_queue_message(transport, envelope, body);
+}
+
 void janus_websockets_session_created(janus_transport_session *transport, guint64 session_id) {
 	/* We don't care */
 }
@@ -998,25 +1146,56 @@ void janus_websockets_session_claimed(janus_transport_session *transport, guint6
 }
 
 
+/* Helper to report the stats of a service thread, called by the thread itself */
+static void janus_websockets_service_stats(janus_websockets_service *service, gint64 now) {
+	gint64 avg = service->writes > 0 ? (service->write_latency / (gint64)service->writes) : 0;
+	int connections = g_atomic_int_get(&service->clients);
+	int queued = g_atomic_int_get(&service->queued);
+	JANUS_LOG(LOG_VERB, "[WebSockets thread #%d] %d connections, %d messages queued, %"SCNu64" written (latency avg=%"SCNi64"us, max=%"SCNi64"us)\n",
+		service->tsi, connections, queued, service->writes, avg, service->max_write_latency);
+	if(notify_events && gateway->events_is_enabled()) {
+		json_t *info = json_object();
+		json_object_set_new(info, "event", json_string("stats"));
+		json_object_set_new(info, "thread", json_integer(service->tsi));
+		json_object_set_new(info, "connections", json_integer(connections));
+		json_object_set_new(info, "queued", json_integer(queued));
+		json_object_set_new(info, "written", json_integer(service->writes));
+		json_object_set_new(info, "avg-write-latency", json_integer(avg));
+		json_object_set_new(info, "max-write-latency", json_integer(service->max_write_latency));
+		gateway->notify_event(&janus_websockets_transport, NULL, info);
+	}
+	service->writes = 0;
+	service->write_latency = 0;
+	service->max_write_latency = 0;
+	service->last_stats = now;
+}
+
 /* Thread */
 void *janus_websockets_thread(void *data) {
-	struct lws_context *service = (struct lws_context *)data;
-	if(service == NULL) {
+	janus_websockets_service *service = (janus_websockets_service *)data;
+	if(service == NULL || wsc == NULL) {
 		JANUS_LOG(LOG_ERR, "Invalid service\n");
 		return NULL;
 	}
+	g_private_set(&current_service, service);
 
-	JANUS_LOG(LOG_INFO, "WebSockets thread started\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d started\n", service->tsi);
 
+	gint64 now = 0;
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		/* libwebsockets is single thread, we cycle through events here */
-		lws_service(service, 50);
+		/* Each thread only cycles through the events of its own connections */
+		lws_service_tsi(wsc, 50, service->tsi);
+		if(stats_period > 0) {
+			now = janus_get_monotonic_time();
+			if(now - service->last_stats >= (gint64)stats_period*G_USEC_PER_SEC)
+				janus_websockets_service_stats(service, now);
+		}
 	}
 
 	/* Get rid of the WebSockets server */
-	lws_cancel_service(service);
+	lws_cancel_service(wsc);
 	/* Done */
-	JANUS_LOG(LOG_INFO, "WebSockets thread ended\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d ended\n", service->tsi);
 	return NULL;
 }
 
@@ -1091,13 +1270,25 @@ static int janus_websockets_common_callback(
 				JANUS_LOG(LOG_ERR, "[%s-%p] Invalid WebSocket client instance...\n", log_prefix, wsi);
 				return -1;
 			}
-			/* Prepare the session */
+			/* Prepare the session: this callback is invoked by the
+			 * service thread libwebsockets assigned the connection to */
 			ws_client->wsi = wsi;
+			const struct lws_protocols *protocol = lws_get_protocol(wsi);
+			ws_client->cbor = (protocol && protocol->name && g_str_has_suffix(protocol->name, "-cbor"));
+			if(ws_client->cbor)
+				JANUS_LOG(LOG_VERB, "[%s-%p]   -- Using CBOR\n", log_prefix, wsi);
+			ws_client->service = g_private_get(&current_service);
+			if(ws_client->service == NULL)
+				ws_client->service = &services[0];
+			g_atomic_int_inc(&ws_client->service->clients);
 			ws_client->messages = g_async_queue_new();
+			ws_client->incoming = NULL;
+			ws_client->incoming_len = 0;
 			ws_client->buffer = NULL;
 			ws_client->buflen = 0;
 			ws_client->bufpending = 0;
 			ws_client->bufoffset = 0;
+			ws_client->bufqueued = 0;
 			g_atomic_int_set(&ws_client->destroyed, 0);
 			ws_client->ts = janus_transport_session_create(ws_client, NULL);
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
@@ -1133,26 +1324,35 @@ static int janus_websockets_common_callback(
 				ws_client->incoming = g_malloc(len+1);
 				memcpy(ws_client->incoming, in, len);
 				ws_client->incoming[len] = '\0';
-				JANUS_LOG(LOG_HUGE, "%s\n", ws_client->incoming);
+				ws_client->incoming_len = len;
+				if(!ws_client->cbor)
+					JANUS_LOG(LOG_HUGE, "%s\n", ws_client->incoming);
 			} else {
-				size_t offset = strlen(ws_client->incoming);
+				size_t offset = ws_client->incoming_len;
 				JANUS_LOG(LOG_HUGE, "[%s-%p] Appending fragment: offset %zu, %zu bytes, %zu remaining\n", log_prefix, wsi, offset, len, remaining);
 				ws_client->incoming = g_realloc(ws_client->incoming, offset+len+1);
 				memcpy(ws_client->incoming+offset, in, len);
 				ws_client->incoming[offset+len] = '\0';
-				JANUS_LOG(LOG_HUGE, "%s\n", ws_client->incoming+offset);
+				ws_client->incoming_len = offset+len;
+				if(!ws_client->cbor)
+					JANUS_LOG(LOG_HUGE, "%s\n", ws_client->incoming+offset);
 			}
 			if(remaining > 0 || !lws_is_final_fragment(wsi)) {
 				/* Still waiting for some more fragments */
 				JANUS_LOG(LOG_HUGE, "[%s-%p] Waiting for more fragments\n", log_prefix, wsi);
 				return 0;
 			}
-			JANUS_LOG(LOG_HUGE, "[%s-%p] Done, parsing message: %zu bytes\n", log_prefix, wsi, strlen(ws_client->incoming));
-			/* If we got here, the message is complete: parse the JSON payload */
+			JANUS_LOG(LOG_HUGE, "[%s-%p] Done, parsing message: %zu bytes\n", log_prefix, wsi, ws_client->incoming_len);
+			/* If we got here, the message is complete: parse the JSON (or CBOR) payload */
 			json_error_t error;
-			json_t *root = json_loads(ws_client->incoming, 0, &error);
+			json_t *root = NULL;
+			if(ws_client->cbor)
+				root = janus_cbor_decode((const uint8_t *)ws_client->incoming, ws_client->incoming_len, &error);
+			else
+				root = json_loads(ws_client->incoming, 0, &error);
 			g_free(ws_client->incoming);
 			ws_client->incoming = NULL;
+			ws_client->incoming_len = 0;
 			/* Notify the core, passing both the object and, since it may be needed, the error */
 			gateway->incoming_request(&janus_websockets_transport, ws_client->ts, NULL, admin, root, &error);
 			return 0;
@@ -1160,18 +1360,21 @@ static int janus_websockets_common_callback(
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 		/* On libwebsockets >= 3.x, we use this event to mark connections as writable in the event loop */
 		case LWS_CALLBACK_EVENT_WAIT_CANCELLED: {
+			janus_websockets_service *service = g_private_get(&current_service);
+			if(service == NULL || service->writable_clients == NULL)
+				return 0;
 			janus_mutex_lock(&writable_mutex);
-			/* We iterate on all the clients we marked as writable and act on them */
+			/* We iterate on all the clients of this thread we marked as writable and act on them */
 			GHashTableIter iter;
 			gpointer value;
-			g_hash_table_iter_init(&iter, writable_clients);
+			g_hash_table_iter_init(&iter, service->writable_clients);
 			while(g_hash_table_iter_next(&iter, NULL, &value)) {
 				janus_websockets_client *client = value;
 				if(client == NULL || client->wsi == NULL)
 					continue;
 				lws_callback_on_writable(client->wsi);
 			}
-			g_hash_table_remove_all(writable_clients);
+			g_hash_table_remove_all(service->writable_clients);
 			janus_mutex_unlock(&writable_mutex);
 			return 0;
 		}
@@ -1206,32 +1409,35 @@ static int janus_websockets_common_callback(
 						log_prefix, wsi, ws_client->bufpending);
 				} else {
 					/* Shoot all the pending messages */
-					char *response = g_async_queue_try_pop(ws_client->messages);
-					if (!response) {
+					janus_websockets_message *msg = g_async_queue_try_pop(ws_client->messages);
+					if (!msg) {
 						/* No messages found */
 						janus_mutex_unlock(&ws_client->ts->mutex);
 						return 0;
 					}
+					g_atomic_int_add(&ws_client->service->queued, -1);
 					if (g_atomic_int_get(&ws_client->destroyed) || g_atomic_int_get(&stopping)) {
-						free(response);
+						janus_websockets_message_free(msg);
 						janus_mutex_unlock(&ws_client->ts->mutex);
 						return 0;
 					}
+					char *response = msg->payload;
 					/* Gotcha! */
-					JANUS_LOG(LOG_HUGE, "[%s-%p] Sending WebSocket message (%zu bytes)...\n", log_prefix, wsi, strlen(response));
-					size_t buflen = LWS_PRE + strlen(response);
+					JANUS_LOG(LOG_HUGE, "[%s-%p] Sending WebSocket message (%zu bytes)...\n", log_prefix, wsi, msg->length);
+					size_t buflen = LWS_PRE + msg->length;
 					if (buflen > ws_client->buflen) {
 						/* We need a larger shared buffer */
-						JANUS_LOG(LOG_HUGE, "[%s-%p] Re-allocating to %zu bytes (was %zu, response is %zu bytes)\n", log_prefix, wsi, buflen, ws_client->buflen, strlen(response));
+						JANUS_LOG(LOG_HUGE, "[%s-%p] Re-allocating to %zu bytes (was %zu, response is %zu bytes)\n", log_prefix, wsi, buflen, ws_client->buflen, msg->length);
 						ws_client->buflen = buflen;
 						ws_client->buffer = g_realloc(ws_client->buffer, buflen);
 					}
-					memcpy(ws_client->buffer + LWS_PRE, response, strlen(response));
+					memcpy(ws_client->buffer + LWS_PRE, response, msg->length);
 					/* Initialize pending bytes count and buffer offset */
-					ws_client->bufpending = strlen(response);
+					ws_client->bufpending = msg->length;
 					ws_client->bufoffset = LWS_PRE;
+					ws_client->bufqueued = msg->queued;
 					/* We can get rid of the message */
-					free(response);
+					janus_websockets_message_free(msg);
 				}
 
 				if (g_atomic_int_get(&ws_client->destroyed) || g_atomic_int_get(&stopping)) {
@@ -1242,7 +1448,8 @@ static int janus_websockets_common_callback(
 				/* Evaluate amount of data to send according to MESSAGE_CHUNK_SIZE */
 				int amount = ws_client->bufpending <= MESSAGE_CHUNK_SIZE ? ws_client->bufpending : MESSAGE_CHUNK_SIZE;
 				/* Set fragment flags */
-				int flags = lws_write_ws_flags(LWS_WRITE_TEXT, ws_client->bufoffset == LWS_PRE, ws_client->bufpending <= (size_t)amount);
+				int flags = lws_write_ws_flags(ws_client->cbor ? LWS_WRITE_BINARY : LWS_WRITE_TEXT,
+					ws_client->bufoffset == LWS_PRE, ws_client->bufpending <= (size_t)amount);
 				/* Send the fragment with proper flags */
 				int sent = lws_write(wsi, ws_client->buffer + ws_client->bufoffset, (size_t)amount, flags);
 				JANUS_LOG(LOG_HUGE, "[%s-%p]   -- First=%d, Last=%d, Requested=%d bytes, Sent=%d bytes, Missing=%zu bytes\n", log_prefix, wsi, ws_client->bufoffset <= LWS_PRE, ws_client->bufpending <= (size_t)amount, amount, sent, ws_client->bufpending - amount);
@@ -1259,6 +1466,14 @@ static int janus_websockets_common_callback(
 						/* We couldn't send everything in a single write, we'll complete this in the next round */
 						JANUS_LOG(LOG_HUGE, "[%s-%p]   -- Couldn't write all bytes (%zu missing), setting offset %zu\n",
 							log_prefix, wsi, ws_client->bufpending, ws_client->bufoffset);
+					} else if(ws_client->service != NULL) {
+						/* Message sent, keep track of how long it waited */
+						janus_websockets_service *service = ws_client->service;
+						gint64 latency = janus_get_monotonic_time() - ws_client->bufqueued;
+						service->writes++;
+						service->write_latency += latency;
+						if(latency > service->max_write_latency)
+							service->max_write_latency = latency;
 					}
 				}
 				/* Done for this round, check the next response/notification later */
@@ -37,3 +37,96 @@ void janus_transport_session_destroy(janus_transport_session *session) {
 	if(session && g_atomic_int_compare_and_exchange(&session->destroyed, 0, 1))
 		janus_refcount_decrease(&session->ref);
 }
+
+static void janus_transport_shared_body_free(const janus_refcount *shared_ref) {
+	janus_transport_shared_body *shared = janus_refcount_containerof(shared_ref, janus_transport_shared_body, ref);
+	/* This body can be destroyed, free all the resources */
+	int i = 0;
+	for(i=0; i<shared->formats; i++)
+		free(shared->text[i]);
+	json_decref(shared->body);
+	g_free(shared->name);
+	g_free(shared);
+}
+
+janus_transport_shared_body *janus_transport_shared_body_new(const char *name, json_t *body) {
+	if(name == NULL || body == NULL)
+		return NULL;
+	janus_transport_shared_body *shared = g_malloc0(sizeof(janus_transport_shared_body));
+	shared->name = g_strdup(name);
+	shared->body = body;
+	janus_mutex_init(&shared->mutex);
+	janus_refcount_init(&shared->ref, janus_transport_shared_body_free);
+	return shared;
+}
+
+void janus_transport_shared_body_ref(janus_transport_shared_body *shared) {
+	if(shared)
+		janus_refcount_increase(&shared->ref);
+}
+
+void janus_transport_shared_body_unref(janus_transport_shared_body *shared) {
+	if(shared)
+		janus_refcount_decrease(&shared->ref);
+}
+
+/* Helper to serialize the whole message the usual way */
+static char *janus_transport_shared_body_dumps_merged(janus_transport_shared_body *shared, json_t *envelope, size_t flags) {
+	json_t *message = json_copy(envelope);
+	json_object_set(message, shared->name, shared->body);
+	char *text = json_dumps(message, flags);
+	json_decref(message);
+	if(text == NULL)
+		return NULL;
+	char *copy = g_strdup(text);
+	free(text);
+	return copy;
+}
+
+char *janus_transport_shared_body_dumps(janus_transport_shared_body *shared, json_t *envelope, size_t flags) {
+	if(shared == NULL || envelope == NULL || !json_is_object(envelope))
+		return NULL;
+	/* The body would have the wrong indentation if spliced as it is */
+	if(flags & JSON_MAX_INDENT)
+		return janus_transport_shared_body_dumps_merged(shared, envelope, flags);
+	/* Check if we serialized the body with these flags already */
+	const char *body = NULL;
+	size_t blen = 0;
+	janus_mutex_lock(&shared->mutex);
+	int i = 0;
+	for(i=0; i<shared->formats; i++) {
+		if(shared->flags[i] == flags) {
+			body = shared->text[i];
+			blen = shared->len[i];
+			break;
+		}
+	}
+	if(body == NULL && shared->formats < JANUS_TRANSPORT_SHARED_FORMATS) {
+		char *text = json_dumps(shared->body, flags);
+		if(text != NULL) {
+			i = shared->formats;
+			shared->text[i] = text;
+			shared->len[i] = strlen(text);
+			shared->flags[i] = flags;
+			shared->formats++;
+			body = text;
+			blen = shared->len[i];
+		}
+	}
+	janus_mutex_unlock(&shared->mutex);
+	if(body == NULL)
+		return janus_transport_shared_body_dumps_merged(shared, envelope, flags);
+	/* Serialize the envelope, and add the body before its closing brace */
+	char *head = json_dumps(envelope, flags);
+	if(head == NULL)
+		return NULL;
+	size_t hlen = strlen(head);
+	const char *separator = (flags & JSON_COMPACT) ? "," : ", ";
+	const char *colon = (flags & JSON_COMPACT) ? ":" : ": ";
+	if(json_object_size(envelope) == 0)
+		separator = "";
+	char *text = g_strdup_printf("%.*s%s\"%s\"%s%.*s}", (int)(hlen-1), head,
+		separator, shared->name, colon, (int)blen, body);
+	free(head);
+	return text;
+}
@@ -61,7 +61,13 @@ janus_transport *create(void) {
  *
  * All the above methods and callbacks are mandatory: the Janus core will
  * reject a transport plugin that doesn't implement any of the
- * mandatory callbacks.
+ * mandatory callbacks. A transport plugin can optionally implement
+ * \c send_shared_message() as well: this is used when the same event
+ * (e.g., a VideoRoom notification) is sent to many clients, and gives
+ * the transport a per-client envelope and a body shared with all the
+ * other recipients, which \c janus_transport_shared_body_dumps() only
+ * serializes once. Transports that don't implement it get the merged
+ * message in \c send_message() instead.
  *
  * The Janus core \c janus_transport_callbacks interface is provided to a
  * transport plugin, together with the path to the configurations files
@@ -97,7 +103,7 @@ janus_transport *create(void) {
 
 
 /*! \brief Version of the API, to match the one transport plugins were compiled against */
-#define JANUS_TRANSPORT_API_VERSION		7
+#define JANUS_TRANSPORT_API_VERSION		9
 
 /*! \brief Initialization of all transport plugin properties to NULL
  *
@@ -129,6 +135,7 @@ static janus_transport janus_http_transport_plugin =
 		.session_created = NULL,		\
 		.session_over = NULL,			\
 		.session_claimed = NULL,			\
+		.send_shared_message = NULL,	\
 		## __VA_ARGS__ }
 
 
@@ -138,6 +145,8 @@ typedef struct janus_transport_callbacks janus_transport_callbacks;
 typedef struct janus_transport janus_transport;
 /*! \brief Transport-Gateway session mapping */
 typedef struct janus_transport_session janus_transport_session;
+/*! \brief Message body shared by many recipients */
+typedef struct janus_transport_shared_body janus_transport_shared_body;
 
 
 /*! \brief Transport-Gateway session mapping */
@@ -170,6 +179,56 @@ janus_transport_session *janus_transport_session_create(void *transport_p, void
 void janus_transport_session_destroy(janus_transport_session *session);
 
 
+/*! \brief Maximum number of serialization formats cached for a shared body */
+#define JANUS_TRANSPORT_SHARED_FORMATS	4
+/*! \brief Message body shared by many recipients
+ * \details When the core sends the same event to many clients, only a
+ * small envelope (e.g., \c session_id and \c sender ) changes from one
+ * recipient to the other. The rest of the message is kept here, and is
+ * serialized only once for each JSON format transports ask for: the
+ * result is then spliced in the envelope of each recipient. */
+struct janus_transport_shared_body {
+	/*! \brief Name of the envelope property the body is the value of (e.g., "plugindata") */
+	char *name;
+	/*! \brief The body itself, which MUST NOT be modified once shared */
+	json_t *body;
+	/*! \brief Cached serializations of the body */
+	char *text[JANUS_TRANSPORT_SHARED_FORMATS];
+	/*! \brief Length of the cached serializations */
+	size_t len[JANUS_TRANSPORT_SHARED_FORMATS];
+	/*! \brief JSON flags each cached serialization was created with */
+	size_t flags[JANUS_TRANSPORT_SHARED_FORMATS];
+	/*! \brief Number of cached serializations */
+	int formats;
+	/*! \brief Mutex to protect the cache */
+	janus_mutex mutex;
+	/*! \brief Reference counter for this instance */
+	janus_refcount ref;
+};
+/*! \brief Helper to create a janus_transport_shared_body instance
+ * @note The body reference is stolen, and the name must be a plain
+ * property name, as it's not escaped when splicing
+ * @param name Name of the envelope property the body will be the value of
+ * @param body The JSON body to share
+ * @returns Pointer to a new janus_transport_shared_body, with a reference already held */
+janus_transport_shared_body *janus_transport_shared_body_new(const char *name, json_t *body);
+/*! \brief Helper to add a reference to a janus_transport_shared_body instance
+ * @param shared The janus_transport_shared_body instance to reference */
+void janus_transport_shared_body_ref(janus_transport_shared_body *shared);
+/*! \brief Helper to release a reference to a janus_transport_shared_body instance
+ * @param shared The janus_transport_shared_body instance to unreference */
+void janus_transport_shared_body_unref(janus_transport_shared_body *shared);
+/*! \brief Helper to serialize a message made of a per-recipient envelope and a shared body
+ * @note The result is the same \c json_dumps would return for the envelope
+ * with the body added as its last property. Indented formats can't be
+ * spliced, so in that case the whole message is serialized as usual
+ * @param shared The shared body
+ * @param envelope The per-recipient part of the message (not modified)
+ * @param flags The Jansson flags to serialize the message with
+ * @returns The serialized message, to be freed with g_free, or NULL in case of errors */
+char *janus_transport_shared_body_dumps(janus_transport_shared_body *shared, json_t *envelope, size_t flags);
+
+
 /*! \brief The transport plugin session and callbacks interface */
 struct janus_transport {
 	/*! \brief Transport plugin initialization/constructor
@@ -229,6 +288,16 @@ struct janus_transport {
 	 * @param[in] transport Pointer to the new transport session instance that has claimed the session
 	 * @param[in] session_id The session ID that was claimed (if the transport cares) */
 	void (* const session_claimed)(janus_transport_session *transport, guint64 session_id);
+	/*! \brief Method to send an event whose body is shared with other clients (optional)
+	 * \note It's the transport plugin's responsibility to free the envelope, while the
+	 * body is only valid for the duration of the call: if the transport needs it later,
+	 * it must add a reference, or serialize it right away with janus_transport_shared_body_dumps
+	 * @param[in] transport Pointer to the transport session instance
+	 * @param[in] admin Whether this is an admin API or a Janus API message
+	 * @param[in] envelope The per-client part of the message, as a Jansson json_t object
+	 * @param[in] body The part of the message shared with all the other recipients
+	 * @returns 0 on success, a negative integer otherwise */
+	int (* const send_shared_message)(janus_transport_session *transport, gboolean admin, json_t *envelope, janus_transport_shared_body *body);
 
 };
 
@@ -283,6 +352,12 @@ struct janus_transport_callbacks {
 	 * @param[in] plugin The transport originating the event
 	 * @param[in] event The event to notify as a Jansson json_t object */
 	void (* const notify_event)(janus_transport *plugin, void *transport, json_t *event);
+
+	/*! \brief Callback to get the core metrics in the OpenMetrics text format (e.g., for Prometheus)
+	 * \note Gathering the metrics takes no global lock, so it's fine to call this often
+	 * @param[in] plugin The transport asking for the metrics
+	 * @returns A string with the metrics, to be freed with g_free */
+	char *(* const get_metrics)(janus_transport *plugin);
 };
 
 /*! \brief The hook that transport plugins need to implement to be created from the Janus core */
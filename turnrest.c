@@ -33,6 +33,25 @@ static const char *api_key = NULL;
 static gboolean api_http_get = FALSE;
 static janus_mutex api_mutex = JANUS_MUTEX_INITIALIZER;
 
+/* Cache of credentials, indexed by the username they were requested for */
+typedef struct janus_turnrest_cached {
+	/* Latest response we got, if any */
+	janus_turnrest_response *response;
+	/* Monotonic times after which we should refresh it, and stop using it */
+	gint64 refresh, expires;
+	/* Whether there's a request in progress for this username */
+	gboolean fetching;
+} janus_turnrest_cached;
+static gboolean cache_enabled = FALSE, cache_nonblocking = FALSE;
+static GHashTable *cache = NULL;
+/* Incremented any time the backend changes, to ignore responses to older requests */
+static guint cache_generation = 0;
+static janus_mutex cache_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition cache_cond;
+/* Threads taking care of prefetching and refreshing credentials */
+static GThreadPool *cache_fetchers = NULL;
+#define JANUS_TURNREST_FETCHERS	2
+
 
 /* Buffer we use to receive the response via libcurl */
 typedef struct janus_turnrest_buffer {
@@ -55,20 +74,60 @@ static size_t janus_turnrest_callback(void *payload, size_t size, size_t nmemb,
 }
 
 
+static void janus_turnrest_cached_destroy(gpointer data) {
+	janus_turnrest_cached *cached = (janus_turnrest_cached *)data;
+	if(cached == NULL)
+		return;
+	janus_turnrest_response_destroy(cached->response);
+	g_free(cached);
+}
+
+static void janus_turnrest_fetcher(gpointer data, gpointer user_data);
+
 void janus_turnrest_init(void) {
 	/* Initialize libcurl, needed for contacting the TURN REST API backend */
 	curl_global_init(CURL_GLOBAL_ALL);
+	janus_condition_init(&cache_cond);
+	cache = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, janus_turnrest_cached_destroy);
+	GError *error = NULL;
+	cache_fetchers = g_thread_pool_new(janus_turnrest_fetcher, NULL, JANUS_TURNREST_FETCHERS, FALSE, &error);
+	if(error != NULL) {
+		/* Without fetchers we can still use the cache, we'll just block on misses */
+		JANUS_LOG(LOG_ERR, "Couldn't start the TURN REST API fetchers: %s\n", error->message);
+		g_error_free(error);
+		cache_fetchers = NULL;
+	}
 }
 
 void janus_turnrest_deinit(void) {
+	/* Stop the fetchers first, dropping what they haven't started yet */
+	if(cache_fetchers != NULL)
+		g_thread_pool_free(cache_fetchers, TRUE, TRUE);
+	cache_fetchers = NULL;
+	janus_mutex_lock(&cache_mutex);
+	g_hash_table_destroy(cache);
+	cache = NULL;
+	janus_mutex_unlock(&cache_mutex);
 	/* Cleanup the libcurl initialization */
 	curl_global_cleanup();
 	janus_mutex_lock(&api_mutex);
 	g_free((char *)api_server);
+	api_server = NULL;
 	g_free((char *)api_key);
+	api_key = NULL;
 	janus_mutex_unlock(&api_mutex);
 }
 
+void janus_turnrest_set_cache(gboolean enabled, gboolean nonblocking) {
+	janus_mutex_lock(&cache_mutex);
+	cache_enabled = enabled;
+	cache_nonblocking = enabled && nonblocking;
+	if(!enabled && cache != NULL)
+		g_hash_table_remove_all(cache);
+	janus_condition_broadcast(&cache_cond);
+	janus_mutex_unlock(&cache_mutex);
+}
+
 void janus_turnrest_set_backend(const char *server, const char *key, const char *method) {
 	janus_mutex_lock(&api_mutex);
 
@@ -95,6 +154,13 @@ void janus_turnrest_set_backend(const char *server, const char *key, const char
 		}
 	}
 	janus_mutex_unlock(&api_mutex);
+	/* Whatever we cached came from the previous backend */
+	janus_mutex_lock(&cache_mutex);
+	cache_generation++;
+	if(cache != NULL)
+		g_hash_table_remove_all(cache);
+	janus_condition_broadcast(&cache_cond);
+	janus_mutex_unlock(&cache_mutex);
 }
 
 const char *janus_turnrest_get_backend(void) {
@@ -115,9 +181,31 @@ void janus_turnrest_response_destroy(janus_turnrest_response *response) {
 	g_free(response->username);
 	g_free(response->password);
 	g_list_free_full(response->servers, janus_turnrest_instance_destroy);
+	g_free(response);
 }
 
-janus_turnrest_response *janus_turnrest_request(const char *user) {
+static janus_turnrest_response *janus_turnrest_response_copy(const janus_turnrest_response *response) {
+	janus_turnrest_response *copy = g_malloc(sizeof(janus_turnrest_response));
+	copy->username = g_strdup(response->username);
+	copy->password = g_strdup(response->password);
+	copy->ttl = response->ttl;
+	copy->servers = NULL;
+	GList *temp = response->servers;
+	while(temp) {
+		janus_turnrest_instance *instance = (janus_turnrest_instance *)temp->data;
+		janus_turnrest_instance *dup = g_malloc(sizeof(janus_turnrest_instance));
+		dup->server = g_strdup(instance->server);
+		dup->port = instance->port;
+		dup->transport = instance->transport;
+		copy->servers = g_list_prepend(copy->servers, dup);
+		temp = temp->next;
+	}
+	copy->servers = g_list_reverse(copy->servers);
+	return copy;
+}
+
+/* Actually send a request to the backend: this blocks until we get a response */
+static janus_turnrest_response *janus_turnrest_fetch(const char *user) {
 	janus_mutex_lock(&api_mutex);
 	if(api_server == NULL) {
 		janus_mutex_unlock(&api_mutex);
@@ -192,40 +280,41 @@ janus_turnrest_response *janus_turnrest_request(const char *user) {
 		return NULL;
 	}
 	g_free(data.buffer);
+	janus_turnrest_response *response = NULL;
 	json_t *username = json_object_get(root, "username");
 	if(!username) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing username\n");
-		return NULL;
+		goto done;
 	}
 	if(!json_is_string(username)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: username should be a string\n");
-		return NULL;
+		goto done;
 	}
 	json_t *password = json_object_get(root, "password");
 	if(!password) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing password\n");
-		return NULL;
+		goto done;
 	}
 	if(!json_is_string(password)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: password should be a string\n");
-		return NULL;
+		goto done;
 	}
 	json_t *ttl = json_object_get(root, "ttl");
 	if(ttl && (!json_is_integer(ttl) || json_integer_value(ttl) < 0)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: ttl should be a positive integer\n");
-		return NULL;
+		goto done;
 	}
 	json_t *uris = json_object_get(root, "uris");
 	if(!uris) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing uris\n");
-		return NULL;
+		goto done;
 	}
 	if(!json_is_array(uris) || json_array_size(uris) == 0) {
 		JANUS_LOG(LOG_ERR, "Invalid response: uris should be a non-empty array\n");
-		return NULL;
+		goto done;
 	}
 	/* Turn the response into a janus_turnrest_response object we can use */
-	janus_turnrest_response *response = g_malloc(sizeof(janus_turnrest_response));
+	response = g_malloc(sizeof(janus_turnrest_response));
 	response->username = g_strdup(json_string_value(username));
 	response->password = g_strdup(json_string_value(password));
 	response->ttl = ttl ? json_integer_value(ttl) : 0;
@@ -284,9 +373,148 @@ janus_turnrest_response *janus_turnrest_request(const char *user) {
 	if(response->servers == NULL) {
 		JANUS_LOG(LOG_ERR, "Couldn't find any valid TURN URI in the response...\n");
 		janus_turnrest_response_destroy(response);
-		return NULL;
+		response = NULL;
+	}
+done:
+	json_decref(root);
+	return response;
+}
+
+/* Store a response in the cache, if it can be cached: must be called with cache_mutex locked */
+static void janus_turnrest_cache_store(const char *user, guint generation, janus_turnrest_response *response) {
+	if(cache == NULL || generation != cache_generation) {
+		/* The backend changed (or we're shutting down) while we were waiting */
+		janus_turnrest_response_destroy(response);
+		return;
+	}
+	janus_turnrest_cached *cached = g_hash_table_lookup(cache, user);
+	if(response == NULL || response->ttl == 0 || !cache_enabled) {
+		/* Nothing to keep (without a TTL we can't know how long it would be valid) */
+		janus_turnrest_response_destroy(response);
+		if(cached != NULL)
+			g_hash_table_remove(cache, user);
+		return;
+	}
+	if(cached == NULL) {
+		cached = g_malloc0(sizeof(janus_turnrest_cached));
+		g_hash_table_insert(cache, g_strdup(user), cached);
+	}
+	janus_turnrest_response_destroy(cached->response);
+	cached->response = response;
+	cached->fetching = FALSE;
+	/* We refresh after half the TTL, and stop handing the credentials out after
+	 * three quarters, so that PeerConnections always get some lifetime left */
+	gint64 now = janus_get_monotonic_time();
+	cached->refresh = now + (gint64)response->ttl*G_USEC_PER_SEC/2;
+	cached->expires = now + (gint64)response->ttl*G_USEC_PER_SEC*3/4;
+}
+
+/* Get rid of entries that expired: must be called with cache_mutex locked */
+static gboolean janus_turnrest_cache_is_expired(gpointer key, gpointer value, gpointer user_data) {
+	janus_turnrest_cached *cached = (janus_turnrest_cached *)value;
+	gint64 *now = (gint64 *)user_data;
+	return !cached->fetching && *now >= cached->expires;
+}
+
+/* Fetch credentials in the background, for prefetching and refreshing */
+static void janus_turnrest_fetcher(gpointer data, gpointer user_data) {
+	char *user = (char *)data;
+	janus_mutex_lock(&cache_mutex);
+	guint generation = cache_generation;
+	janus_mutex_unlock(&cache_mutex);
+	janus_turnrest_response *response = janus_turnrest_fetch(user);
+	janus_mutex_lock(&cache_mutex);
+	janus_turnrest_cached *cached = cache ? g_hash_table_lookup(cache, user) : NULL;
+	if(cached != NULL && cached->response != NULL && response == NULL &&
+			janus_get_monotonic_time() < cached->expires) {
+		/* The refresh failed, but what we have is still usable for a while */
+		cached->fetching = FALSE;
+	} else {
+		janus_turnrest_cache_store(user, generation, response);
+	}
+	if(cache != NULL) {
+		gint64 now = janus_get_monotonic_time();
+		g_hash_table_foreach_remove(cache, janus_turnrest_cache_is_expired, &now);
+	}
+	janus_condition_broadcast(&cache_cond);
+	janus_mutex_unlock(&cache_mutex);
+	g_free(user);
+}
+
+/* Schedule a background request: must be called with cache_mutex locked */
+static gboolean janus_turnrest_schedule(const char *user, janus_turnrest_cached *cached) {
+	if(cache_fetchers == NULL)
+		return FALSE;
+	if(cached == NULL) {
+		cached = g_malloc0(sizeof(janus_turnrest_cached));
+		g_hash_table_insert(cache, g_strdup(user), cached);
+	}
+	cached->fetching = TRUE;
+	g_thread_pool_push(cache_fetchers, g_strdup(user), NULL);
+	return TRUE;
+}
+
+void janus_turnrest_prefetch(const char *user) {
+	if(user == NULL || api_server == NULL)
+		return;
+	janus_mutex_lock(&cache_mutex);
+	if(cache_enabled && cache != NULL) {
+		janus_turnrest_cached *cached = g_hash_table_lookup(cache, user);
+		if(cached == NULL || (!cached->fetching && janus_get_monotonic_time() >= cached->refresh))
+			janus_turnrest_schedule(user, cached);
+	}
+	janus_mutex_unlock(&cache_mutex);
+}
+
+janus_turnrest_response *janus_turnrest_request(const char *user) {
+	janus_mutex_lock(&cache_mutex);
+	if(!cache_enabled || cache == NULL || user == NULL) {
+		/* No cache, always ask the backend */
+		janus_mutex_unlock(&cache_mutex);
+		return janus_turnrest_fetch(user);
+	}
+	janus_turnrest_response *response = NULL;
+	while(cache != NULL) {
+		janus_turnrest_cached *cached = g_hash_table_lookup(cache, user);
+		gint64 now = janus_get_monotonic_time();
+		if(cached != NULL && cached->response != NULL && now < cached->expires) {
+			/* We have usable credentials: if they're getting old, refresh them in the background */
+			response = janus_turnrest_response_copy(cached->response);
+			if(!cached->fetching && now >= cached->refresh)
+				janus_turnrest_schedule(user, cached);
+			break;
+		}
+		if(cached != NULL && cached->fetching) {
+			/* There's a request in progress already */
+			if(cache_nonblocking)
+				break;
+			janus_condition_wait(&cache_cond, &cache_mutex);
+			continue;
+		}
+		/* Nothing we can use */
+		if(cache_nonblocking && janus_turnrest_schedule(user, cached)) {
+			/* Don't wait: this PeerConnection will do without, the next ones will find it */
+			break;
+		}
+		/* Send the request ourselves, letting other requests for the same username wait for us */
+		if(cached == NULL) {
+			cached = g_malloc0(sizeof(janus_turnrest_cached));
+			g_hash_table_insert(cache, g_strdup(user), cached);
+		}
+		cached->fetching = TRUE;
+		guint generation = cache_generation;
+		janus_mutex_unlock(&cache_mutex);
+		response = janus_turnrest_fetch(user);
+		janus_mutex_lock(&cache_mutex);
+		if(response != NULL) {
+			janus_turnrest_cache_store(user, generation, janus_turnrest_response_copy(response));
+		} else if(cache != NULL && generation == cache_generation) {
+			g_hash_table_remove(cache, user);
+		}
+		janus_condition_broadcast(&cache_cond);
+		break;
 	}
-	/* Done */
+	janus_mutex_unlock(&cache_mutex);
 	return response;
 }
 
@@ -37,6 +37,18 @@ void janus_turnrest_set_backend(const char *server, const char *key, const char
  * @returns The currently set TURN REST API backend */
 const char *janus_turnrest_get_backend(void);
 
+/*! \brief Configure the cache of credentials
+ * \details When enabled, the credentials returned by the backend are reused
+ * for all PeerConnections with the same username, rather than sending a
+ * new request each time: they're refreshed in the background when half
+ * of their TTL has passed, and stop being used after three quarters of
+ * it. Responses with no TTL are never cached.
+ * @param enabled Whether credentials should be cached
+ * @param nonblocking Whether janus_turnrest_request should return NULL
+ * right away, rather than waiting for the backend, if there's nothing
+ * cached for the username yet (the request is still sent in the background) */
+void janus_turnrest_set_cache(gboolean enabled, gboolean nonblocking);
+
 
 /*! \brief Complete response from the TURN REST API service */
 typedef struct janus_turnrest_response {
@@ -65,11 +77,20 @@ void janus_turnrest_response_destroy(janus_turnrest_response *response);
 
 
 /*! \brief Retrieve address and credentials for one or more TURN servers
- * @note Use janus_turnrest_response_destroy to get rid of the response, once done
+ * @note Use janus_turnrest_response_destroy to get rid of the response, once done.
+ * If caching is enabled, this may return cached credentials instead of
+ * contacting the backend (see janus_turnrest_set_cache)
  * @param[in] user Username to provide in the TURN REST API request
  * @returns A valid janus_turnrest_response instance, if successful, NULL otherwise */
 janus_turnrest_response *janus_turnrest_request(const char *user);
 
+/*! \brief Ask for credentials in the background, so that they're cached
+ * by the time janus_turnrest_request is called for the same username
+ * @note Does nothing if caching is disabled, or if the credentials we
+ * have for this username are still fresh
+ * @param[in] user Username to provide in the TURN REST API request */
+void janus_turnrest_prefetch(const char *user);
+
 #endif
 
 #endif
@@ -1137,6 +1137,123 @@ int janus_vp9_parse_svc(char *buffer, int len, gboolean *found, janus_vp9_svc_in
 	return 0;
 }
 
+void janus_av1_svc_context_reset(janus_av1_svc_context *context) {
+	if(context == NULL)
+		return;
+	memset(context, 0, sizeof(*context));
+}
+
+/* Static helper to read some bits from the Dependency Descriptor */
+static uint32_t janus_av1_dd_read_bits(uint8_t *dd, int len, int *offset, int bits, gboolean *overflow) {
+	uint32_t value = 0;
+	while(bits > 0) {
+		if(*offset >= len*8) {
+			*overflow = TRUE;
+			return 0;
+		}
+		value = (value << 1) | ((dd[*offset/8] >> (7 - (*offset % 8))) & 0x01);
+		(*offset)++;
+		bits--;
+	}
+	return value;
+}
+
+/* Helper method to parse an AV1 Dependency Descriptor and get some SVC-related info:
+ * we only parse the template dependency structure up to the decode target indications,
+ * as that's all we need to know which layers a frame belongs to (custom DTIs are ignored) */
+int janus_av1_parse_dependency_descriptor(uint8_t *dd, int len, janus_av1_svc_context *context,
+		gboolean *found, janus_vp9_svc_info *info) {
+	if(found)
+		*found = FALSE;
+	if(!dd || len < 3 || !context || !info)
+		return -1;
+	gboolean overflow = FALSE;
+	int offset = 0;
+	/* Mandatory fields */
+	uint8_t start = janus_av1_dd_read_bits(dd, len, &offset, 1, &overflow);
+	uint8_t end = janus_av1_dd_read_bits(dd, len, &offset, 1, &overflow);
+	uint8_t template_id = janus_av1_dd_read_bits(dd, len, &offset, 6, &overflow);
+	janus_av1_dd_read_bits(dd, len, &offset, 16, &overflow);	/* Frame number */
+	if(len > 3) {
+		/* Extended fields */
+		uint8_t structure = janus_av1_dd_read_bits(dd, len, &offset, 1, &overflow);
+		janus_av1_dd_read_bits(dd, len, &offset, 4, &overflow);	/* Other flags we don't care about */
+		if(structure) {
+			/* There's a new template dependency structure (e.g., keyframe) */
+			janus_av1_svc_context ctx;
+			memset(&ctx, 0, sizeof(ctx));
+			ctx.template_id_offset = janus_av1_dd_read_bits(dd, len, &offset, 6, &overflow);
+			ctx.targets = janus_av1_dd_read_bits(dd, len, &offset, 5, &overflow) + 1;
+			/* Template layers */
+			uint8_t spatial = 0, temporal = 0, next = 0;
+			do {
+				if(ctx.templates == 64)
+					return -2;
+				ctx.spatial_id[ctx.templates] = spatial;
+				ctx.temporal_id[ctx.templates] = temporal;
+				ctx.templates++;
+				next = janus_av1_dd_read_bits(dd, len, &offset, 2, &overflow);
+				if(next == 1) {
+					temporal++;
+				} else if(next == 2) {
+					temporal = 0;
+					spatial++;
+				}
+			} while(next != 3 && !overflow);
+			/* Template decode target indications */
+			int t = 0, d = 0;
+			for(t=0; t<ctx.templates; t++) {
+				for(d=0; d<ctx.targets; d++)
+					ctx.dti[t][d] = janus_av1_dd_read_bits(dd, len, &offset, 2, &overflow);
+			}
+			if(overflow)
+				return -3;
+			/* Check which layers each decode target involves */
+			for(d=0; d<ctx.targets; d++) {
+				for(t=0; t<ctx.templates; t++) {
+					if(ctx.dti[t][d] == 0)
+						continue;
+					if(ctx.spatial_id[t] > ctx.target_spatial_id[d])
+						ctx.target_spatial_id[d] = ctx.spatial_id[t];
+					if(ctx.temporal_id[t] > ctx.target_temporal_id[d])
+						ctx.target_temporal_id[d] = ctx.temporal_id[t];
+				}
+			}
+			ctx.ready = TRUE;
+			*context = ctx;
+		}
+	}
+	if(overflow)
+		return -3;
+	if(!context->ready) {
+		/* We can't make sense of this packet until we get a structure */
+		return 0;
+	}
+	int index = (template_id + 64 - context->template_id_offset) % 64;
+	if(index >= context->templates)
+		return -4;
+	info->spatial_layer = context->spatial_id[index];
+	info->temporal_layer = context->temporal_id[index];
+	info->fbit = 1;
+	info->pbit = 0;
+	info->dbit = 0;
+	info->bbit = start;
+	info->ebit = end;
+	/* Is this frame a switching point for the decode target of its own layers? */
+	info->ubit = 0;
+	int d = 0;
+	for(d=0; d<context->targets; d++) {
+		if(context->target_spatial_id[d] == info->spatial_layer &&
+				context->target_temporal_id[d] == info->temporal_layer) {
+			info->ubit = (context->dti[index][d] == 2);
+			break;
+		}
+	}
+	if(found)
+		*found = TRUE;
+	return 0;
+}
+
 inline guint32 janus_push_bits(guint32 word, size_t num, guint32 val) {
 	return (word << num) | (val & (0xFFFFFFFF>>(32-num)));
 }
@@ -1201,4 +1318,60 @@ size_t janus_gzip_compress(int compression, char *text, size_t tlen, char *compr
 	/* Done, return the size of the compressed data */
 	return zs.total_out;
 }
+
+struct janus_gzip_stream {
+	z_stream zs;
+};
+
+janus_gzip_stream *janus_gzip_stream_create(int compression) {
+	if(compression < 0 || compression > 9) {
+		JANUS_LOG(LOG_WARN, "Invalid compression factor %d, falling back to default compression...\n", compression);
+		compression = Z_DEFAULT_COMPRESSION;
+	}
+	janus_gzip_stream *stream = g_malloc0(sizeof(janus_gzip_stream));
+	stream->zs.zalloc = Z_NULL;
+	stream->zs.zfree = Z_NULL;
+	stream->zs.opaque = Z_NULL;
+	int res = deflateInit2(&stream->zs, compression, Z_DEFLATED, 15 | 16, 8, Z_DEFAULT_STRATEGY);
+	if(res != Z_OK) {
+		JANUS_LOG(LOG_ERR, "deflateInit error: %d\n", res);
+		g_free(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+size_t janus_gzip_stream_bound(janus_gzip_stream *stream, size_t tlen) {
+	if(stream == NULL)
+		return 0;
+	return deflateBound(&stream->zs, tlen);
+}
+
+size_t janus_gzip_stream_compress(janus_gzip_stream *stream, const char *text, size_t tlen, char *compressed, size_t zlen) {
+	if(stream == NULL || text == NULL || tlen < 1 || compressed == NULL || zlen < 1)
+		return 0;
+	/* Start from a fresh state, without freeing and allocating it again */
+	int res = deflateReset(&stream->zs);
+	if(res != Z_OK) {
+		JANUS_LOG(LOG_ERR, "deflateReset error: %d\n", res);
+		return 0;
+	}
+	stream->zs.next_in = (Bytef *)text;
+	stream->zs.avail_in = (uInt)tlen;
+	stream->zs.next_out = (Bytef *)compressed;
+	stream->zs.avail_out = (uInt)zlen;
+	res = deflate(&stream->zs, Z_FINISH);
+	if(res != Z_STREAM_END) {
+		JANUS_LOG(LOG_ERR, "deflate error: %d\n", res);
+		return 0;
+	}
+	return stream->zs.total_out;
+}
+
+void janus_gzip_stream_destroy(janus_gzip_stream *stream) {
+	if(stream == NULL)
+		return;
+	deflateEnd(&stream->zs);
+	g_free(stream);
+}
 #endif
@@ -342,6 +342,40 @@ typedef struct janus_vp9_svc_info {
  * @returns 0 in case of success, a negative integer otherwise */
 int janus_vp9_parse_svc(char *buffer, int len, gboolean *found, janus_vp9_svc_info *info);
 
+/*! \brief AV1 SVC context, keeping track of the latest template dependency structure
+ * a publisher sent in the Dependency Descriptor RTP extension */
+typedef struct janus_av1_svc_context {
+	/*! \brief Whether we received a template dependency structure already */
+	gboolean ready;
+	/*! \brief Offset of the template IDs in the structure */
+	uint8_t template_id_offset;
+	/*! \brief Number of templates and decode targets in the structure */
+	uint8_t templates, targets;
+	/*! \brief Spatial and temporal layer of each template */
+	uint8_t spatial_id[64], temporal_id[64];
+	/*! \brief Decode target indications of each template (0=not present, 1=discardable, 2=switch, 3=required) */
+	uint8_t dti[64][32];
+	/*! \brief Highest spatial and temporal layer of each decode target */
+	uint8_t target_spatial_id[32], target_temporal_id[32];
+} janus_av1_svc_context;
+
+/*! \brief Set (or reset) the context fields to their default values
+ * @param[in] context The context to (re)set */
+void janus_av1_svc_context_reset(janus_av1_svc_context *context);
+
+/*! \brief Helper method to parse an AV1 Dependency Descriptor for SVC-related info
+ * \note The info is returned as a janus_vp9_svc_info instance, so that the same layer selection
+ * can be used for both codecs: \c bbit and \c ebit are set on the first and last packet of
+ * a frame, and \c ubit when the frame is a switching point for the layers it belongs to
+ * @param[in] dd The content of the Dependency Descriptor RTP extension
+ * @param[in] len The length of the Dependency Descriptor
+ * @param[in] context The AV1 SVC context to use, updated when there's a new template dependency structure
+ * @param[out] found Whether any SVC related info has been found or not
+ * @param[out] info Pointer to a janus_vp9_svc_info structure for passing the parsed info back
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_av1_parse_dependency_descriptor(uint8_t *dd, int len, janus_av1_svc_context *context,
+	gboolean *found, janus_vp9_svc_info *info);
+
 /*! \brief Helper method to push individual bits at the end of a word
  * @param[in] word Initial value of word
  * @param[in] num Number of bits to push
@@ -389,4 +423,30 @@ void janus_set4(guint8 *data, size_t i, guint32 val);
  */
 size_t janus_gzip_compress(int compression, char *text, size_t tlen, char *compressed, size_t zlen);
 
+/*! \brief Opaque gzip compression context, to reuse the same zlib stream for many strings */
+typedef struct janus_gzip_stream janus_gzip_stream;
+/*! \brief Helper method to create a reusable gzip compression context
+ * \note A context is not thread safe: use one per thread
+ * @param[in] compression Compression factor (1=fastest, 9=best compression)
+ * @returns A new context, if successful, or NULL otherwise */
+janus_gzip_stream *janus_gzip_stream_create(int compression);
+/*! \brief Helper method to get the maximum size the compressed version of a string may have
+ * @param[in] stream The compression context
+ * @param[in] tlen Length of the string to compress
+ * @returns The size of the buffer to provide to janus_gzip_stream_compress */
+size_t janus_gzip_stream_bound(janus_gzip_stream *stream, size_t tlen);
+/*! \brief Helper method to compress a string to gzip, reusing an existing context
+ * \note Unlike janus_gzip_compress, only \c tlen bytes are compressed (no
+ * terminating NUL), and the state allocated by zlib is reused across calls
+ * @param[in] stream The compression context
+ * @param[in] text Pointer to the string to compress
+ * @param[in] tlen Length of the string to compress
+ * @param[in] compressed Pointer to the buffer where to compress the string to
+ * @param[in] zlen Size of the output buffer
+ * @returns The size of the compressed data, if successful, or 0 otherwise */
+size_t janus_gzip_stream_compress(janus_gzip_stream *stream, const char *text, size_t tlen, char *compressed, size_t zlen);
+/*! \brief Helper method to destroy a compression context
+ * @param[in] stream The compression context to destroy */
+void janus_gzip_stream_destroy(janus_gzip_stream *stream);
+
 #endif